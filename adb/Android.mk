@@ -109,6 +109,22 @@ LOCAL_STATIC_LIBRARIES := libadbd
 LOCAL_SHARED_LIBRARIES := liblog libbase libcutils
 include $(BUILD_NATIVE_TEST)
 
+# Loopback throughput benchmarks, using the harness from liblog's tests. Run with:
+#   adb shell /data/nativetest/adbd_benchmark/adbd_benchmark
+include $(CLEAR_VARS)
+LOCAL_CLANG := true
+LOCAL_MODULE := adbd_benchmark
+LOCAL_CFLAGS := -DADB_HOST=0 $(LIBADB_CFLAGS) -D_GNU_SOURCE
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../liblog/tests
+LOCAL_SRC_FILES := \
+    ../liblog/tests/benchmark_main.cpp \
+    adb_benchmark.cpp \
+    file_sync_service.cpp \
+
+LOCAL_STATIC_LIBRARIES := libadbd
+LOCAL_SHARED_LIBRARIES := liblog libbase libcutils libselinux libz
+include $(BUILD_NATIVE_TEST)
+
 include $(CLEAR_VARS)
 LOCAL_CLANG := $(adb_host_clang)
 LOCAL_MODULE := adb_test
@@ -188,6 +204,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcrypto_static \
     libcutils \
     liblog \
+    libz \
     $(EXTRA_STATIC_LIBS) \
 
 # libc++ not available on windows yet
@@ -258,5 +275,6 @@ LOCAL_STATIC_LIBRARIES := \
     libmincrypt \
     libselinux \
     libext4_utils_static \
+    libz \
 
 include $(BUILD_EXECUTABLE)
@@ -21,6 +21,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -30,6 +31,7 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include <algorithm>
 #include <string>
 
 #include <base/stringprintf.h>
@@ -38,6 +40,7 @@
 #include "adb_auth.h"
 #include "adb_io.h"
 #include "adb_listeners.h"
+#include "adb_utils.h"
 #include "transport.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
@@ -201,11 +204,35 @@ void adb_trace_init() {
 #endif
 }
 
+// Every read from a socket or a transport needs a MAX_PAYLOAD-sized packet,
+// which is large enough for malloc to hand it straight back to the kernel on
+// free. Keep a bounded number of released packets around for reuse instead.
+#if ADB_HOST
+#define APACKET_POOL_MAX 64
+#else
+#define APACKET_POOL_MAX 16
+#endif
+
+ADB_MUTEX_DEFINE( apacket_pool_lock );
+
+static apacket* apacket_pool;
+static size_t apacket_pool_size;
+
 apacket* get_apacket(void)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    adb_mutex_lock(&apacket_pool_lock);
+    apacket* p = apacket_pool;
+    if (p != nullptr) {
+        apacket_pool = p->next;
+        apacket_pool_size--;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+          fatal("failed to allocate an apacket");
+        }
     }
 
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
@@ -214,6 +241,15 @@ apacket* get_apacket(void)
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&apacket_pool_lock);
+    if (apacket_pool_size < APACKET_POOL_MAX) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        apacket_pool_size++;
+        p = nullptr;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
     free(p);
 }
 
@@ -292,10 +328,16 @@ static void send_close(unsigned local, unsigned remote, atransport *t)
     send_packet(p, t);
 }
 
+const char* supported_features() {
+    return FEATURE_SYNC_V2 "," FEATURE_STAT_V2 "," FEATURE_SYNC_DEFLATE ","
+           FEATURE_STREAM_WINDOW "," FEATURE_SHELL_SESSION;
+}
+
 static size_t fill_connect_data(char *buf, size_t bufsize)
 {
 #if ADB_HOST
-    return snprintf(buf, bufsize, "host::") + 1;
+    // adbd needs to know what the host supports too, for FEATURE_STREAM_WINDOW.
+    return snprintf(buf, bufsize, "host::features=%s;", supported_features()) + 1;
 #else
     static const char *cnxn_props[] = {
         "ro.product.name",
@@ -318,6 +360,10 @@ static size_t fill_connect_data(char *buf, size_t bufsize)
         buf += len;
     }
 
+    len = snprintf(buf, remaining, "features=%s;", supported_features());
+    remaining -= len;
+    buf += len;
+
     return bufsize - remaining + 1;
 #endif
 }
@@ -346,6 +392,10 @@ static void qual_overwrite(char** dst, const std::string& src) {
 void parse_banner(const char* banner, atransport* t) {
     D("parse_banner: %s\n", banner);
 
+    // Features are optional, so forget any left over from a previous CONNECT.
+    free(t->features);
+    t->features = nullptr;
+
     // The format is something like:
     // "device::ro.product.name=x;ro.product.model=y;ro.product.device=z;".
     std::vector<std::string> pieces = android::base::Split(banner, ":");
@@ -367,6 +417,8 @@ void parse_banner(const char* banner, atransport* t) {
                 qual_overwrite(&t->model, value);
             } else if (key == "ro.product.device") {
                 qual_overwrite(&t->device, value);
+            } else if (key == "features") {
+                qual_overwrite(&t->features, value);
             }
         }
     }
@@ -396,6 +448,8 @@ void parse_banner(const char* banner, atransport* t) {
 
 void handle_packet(apacket *p, atransport *t)
 {
+    daemon_trace_poll();
+    DAEMON_TRACE_SCOPE("adb handle_packet");
     asocket *s;
 
     D("handle_packet() %c%c%c%c\n", ((char*) (&(p->msg.command)))[0],
@@ -417,12 +471,13 @@ void handle_packet(apacket *p, atransport *t)
         return;
 
     case A_CNXN: /* CONNECT(version, maxdata, "system-id-string") */
-            /* XXX verify version, etc */
         if(t->connection_state != CS_OFFLINE) {
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
 
+        t->update_version(p->msg.arg0, p->msg.arg1);
+
         parse_banner(reinterpret_cast<const char*>(p->data), t);
 
         if (HOST || !auth_required) {
@@ -482,8 +537,24 @@ void handle_packet(apacket *p, atransport *t)
                     s->peer->peer = s;
                     s->ready(s);
                 } else if (s->peer->id == p->msg.arg0) {
-                    /* Other READY messages must use the same local-id */
-                    s->ready(s);
+                    /* Other READY messages must use the same local-id.
+                    ** With a window, one READY may acknowledge several
+                    ** WRTEs; its payload says how many.
+                    */
+                    asocket* rs = s->peer;
+                    uint32_t acked = 1;
+                    if (p->msg.data_length == sizeof(acked)) {
+                        memcpy(&acked, p->data, sizeof(acked));
+                    }
+                    if (rs->in_flight > 0) {
+                        uint64_t now = adb_monotonic_ns();
+                        stats_record_okay_rtt(t, now - rs->wrte_sent_ns);
+                        rs->wrte_sent_ns = now;
+                    }
+                    rs->in_flight -= std::min(rs->in_flight, acked);
+                    if (rs->in_flight < rs->window) {
+                        s->ready(s);
+                    }
                 } else {
                     D("Invalid A_OKAY(%d,%d), expected A_OKAY(%d,%d) on transport %s\n",
                       p->msg.arg0, p->msg.arg1, s->peer->id, p->msg.arg1, t->serial);
@@ -518,12 +589,13 @@ void handle_packet(apacket *p, atransport *t)
     case A_WRTE: /* WRITE(local-id, remote-id, <data>) */
         if (t->online && p->msg.arg0 != 0 && p->msg.arg1 != 0) {
             if((s = find_local_socket(p->msg.arg1, p->msg.arg0))) {
-                unsigned rid = p->msg.arg0;
+                asocket* rs = s->peer;
                 p->len = p->msg.data_length;
+                rs->unacked++;
 
                 if(s->enqueue(s, p) == 0) {
                     D("Enqueue the socket\n");
-                    send_ready(s->id, rid, t);
+                    rs->ready(rs);
                 }
                 return;
             }
@@ -902,6 +974,29 @@ int handle_host_request(char *service, transport_type ttype, char* serial, int r
         SendProtocolString(reply_fd, out);
         return 0;
     }
+    if (!strcmp(service, "features")) {
+        std::string error_msg;
+        transport = acquire_one_transport(CS_ANY, ttype, serial, &error_msg);
+        if (transport) {
+            SendOkay(reply_fd);
+            SendProtocolString(reply_fd, transport->features ? transport->features : "");
+        } else {
+            SendFail(reply_fd, error_msg);
+        }
+        return 0;
+    }
+    if (!strcmp(service, "stats")) {
+        fdevent_stats fs;
+        fdevent_get_stats(&fs);
+        std::string stats = list_transport_stats();
+        stats += android::base::StringPrintf(
+            "fdevent: %" PRIu64 " iterations, %" PRIu64 "ms busy, %" PRIu64 "us max\n",
+            fs.iterations, fs.busy_ns / 1000000, fs.max_busy_ns / 1000);
+        stats += list_socket_queues();
+        SendOkay(reply_fd);
+        SendProtocolString(reply_fd, stats);
+        return 0;
+    }
     if(!strncmp(service,"get-devpath",strlen("get-devpath"))) {
         const char *out = "unknown";
         transport = acquire_one_transport(CS_ANY, ttype, serial, NULL);
@@ -18,12 +18,18 @@
 #define __ADB_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "adb_trace.h"
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+// The maximum payload size is negotiated in the CONNECT handshake: each side
+// advertises the largest payload it will accept, and both use the smaller of
+// the two. Peers that predate negotiation always advertise MAX_PAYLOAD_V1.
+#define MAX_PAYLOAD_V1 (4 * 1024)
+#define MAX_PAYLOAD_V2 (256 * 1024)
+#define MAX_PAYLOAD MAX_PAYLOAD_V2
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -34,14 +40,29 @@
 #define A_AUTH 0x48545541
 
 // ADB protocol version.
-#define A_VERSION 0x01000000
+#define A_VERSION_MIN 0x01000000
+#define A_VERSION_MAX_PAYLOAD 0x01000001  // First version to negotiate maxdata.
+#define A_VERSION 0x01000001
 
 // Used for help/version information.
 #define ADB_VERSION_MAJOR 1
 #define ADB_VERSION_MINOR 0
 
 // Increment this when we want to force users to start a new adb server.
-#define ADB_SERVER_VERSION 32
+#define ADB_SERVER_VERSION 33
+
+// Optional features adbd advertises as "features=a,b,c;" in its CONNECT
+// banner. Older hosts ignore properties they don't recognize, and clients
+// can retrieve the list for a device through the "host:features" service.
+#define FEATURE_SYNC_V2 "sync_v2"  // One status per SEND; requests may be pipelined.
+#define FEATURE_STAT_V2 "stat_v2"  // STA2/LST2 sync requests with 64-bit stat data.
+#define FEATURE_SYNC_DEFLATE "sync_deflate"  // DATZ chunks and RCVZ requests.
+#define FEATURE_STREAM_WINDOW "stream_window"  // Several WRTEs in flight per stream.
+#define FEATURE_SHELL_SESSION "shell_session"  // The shell-session: service.
+
+// With FEATURE_STREAM_WINDOW, a stream may have this many WRTE packets
+// outstanding before it waits for an OKAY.
+#define ADB_STREAM_WINDOW 8
 
 struct atransport;
 struct usb_handle;
@@ -108,6 +129,20 @@ struct asocket {
     apacket *pkt_first;
     apacket *pkt_last;
 
+        /* flow control, for remote asockets only: the number of WRTE
+        ** packets sent and not yet acknowledged, the number allowed
+        ** (1 unless both ends support FEATURE_STREAM_WINDOW), and the
+        ** number received whose OKAY hasn't been sent yet.
+        */
+    unsigned in_flight;
+    unsigned window;
+    unsigned unacked;
+
+        /* for the OKAY round-trip statistics: when the oldest WRTE still
+        ** in flight was sent
+        */
+    uint64_t wrte_sent_ns;
+
         /* enqueue is called by our peer when it has data
         ** for us.  It should return 0 if we can accept more
         ** data or 1 if not.  If we return 1, we must call
@@ -135,6 +170,10 @@ struct asocket {
 
         /* A socket is bound to atransport */
     atransport *transport;
+
+    // The largest payload that can be enqueued to this socket's peer without
+    // exceeding what either transport involved has negotiated.
+    size_t get_max_payload() const;
 };
 
 
@@ -170,6 +209,28 @@ enum transport_type {
 
 #define TOKEN_SIZE 20
 
+#define ADB_STATS_RTT_BUCKETS 16
+
+/* Counters reported by "adb stats". The transport's input and output
+** threads each update their own fields while the fdevent thread reads
+** them, so every access goes through stats_add()/stats_load().
+*/
+struct transport_stats {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+
+        /* time the input thread spent blocked in write_to_remote */
+    uint64_t write_blocked_ns;
+    uint64_t write_blocked_max_ns;
+
+        /* OKAY round trips: bucket i counts those shorter than 2^(i+6)us,
+        ** and the last bucket everything slower
+        */
+    uint64_t okay_rtt[ADB_STATS_RTT_BUCKETS];
+};
+
 struct atransport
 {
     atransport *next;
@@ -199,6 +260,7 @@ struct atransport
     char *model;
     char *device;
     char *devpath;
+    char *features;
     int adb_port; // Use for emulators (local transport)
 
         /* a list of adisconnect callbacks called when the transport is kicked */
@@ -210,7 +272,20 @@ struct atransport
     fdevent auth_fde;
     unsigned failed_auth_attempts;
 
+        /* negotiated in the CONNECT handshake, see update_version() */
+    unsigned protocol_version;
+    size_t max_payload;
+
+    transport_stats stats;
+
     const char* connection_state_name() const;
+    bool has_feature(const char* feature) const;
+
+    // Records the version and maxdata advertised by the remote CONNECT,
+    // clamped to what we support ourselves.
+    void update_version(unsigned version, size_t payload);
+    unsigned get_protocol_version() const;
+    size_t get_max_payload() const;
 };
 
 
@@ -280,7 +355,7 @@ asocket *host_service_to_socket(const char*  name, const char *serial);
 #if !ADB_HOST
 int       init_jdwp(void);
 asocket*  create_jdwp_service_socket();
-asocket*  create_jdwp_tracker_service_socket();
+asocket*  create_jdwp_tracker_service_socket(bool deltas);
 int       create_jdwp_connection_fd(int  jdwp_pid);
 #endif
 
@@ -288,6 +363,7 @@ int handle_forward_request(const char* service, transport_type ttype, char* seri
 
 #if !ADB_HOST
 void framebuffer_service(int fd, void *cookie);
+void framebuffer_stream_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
@@ -383,4 +459,7 @@ void handle_offline(atransport *t);
 
 void send_connect(atransport *t);
 
+// Returns the comma-separated list of features this build supports.
+const char* supported_features();
+
 #endif
@@ -23,6 +23,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <vector>
+
 #include "cutils/list.h"
 #include "cutils/sockets.h"
 #include "mincrypt/rsa.h"
@@ -54,7 +56,7 @@ static bool needs_retry = false;
 static void read_keys(const char *file, struct listnode *list)
 {
     FILE *f;
-    char buf[MAX_PAYLOAD];
+    char buf[MAX_PAYLOAD_V1];
     char *sep;
     int ret;
 
@@ -142,7 +144,7 @@ int adb_auth_verify(uint8_t* token, uint8_t* sig, int siglen)
 {
     struct listnode *item;
     struct listnode key_list;
-    int ret = 0;
+    std::vector<const RSAPublicKey*> keys;
 
     if (siglen != RSANUMBYTES)
         return 0;
@@ -151,10 +153,9 @@ int adb_auth_verify(uint8_t* token, uint8_t* sig, int siglen)
 
     list_for_each(item, &key_list) {
         adb_public_key* key = node_to_item(item, struct adb_public_key, node);
-        ret = RSA_verify(&key->key, sig, siglen, token, SHA_DIGEST_SIZE);
-        if (ret)
-            break;
+        keys.push_back(&key->key);
     }
+    int ret = RSA_verify_any(keys.data(), keys.size(), sig, siglen, token, SHA_DIGEST_SIZE) >= 0;
 
     free_keys(&key_list);
 
@@ -191,7 +192,7 @@ static void adb_auth_event(int fd, unsigned events, void *data)
 
 void adb_auth_confirm_key(unsigned char *key, size_t len, atransport *t)
 {
-    char msg[MAX_PAYLOAD];
+    char msg[MAX_PAYLOAD_V1];
     int ret;
 
     if (!usb_transport) {
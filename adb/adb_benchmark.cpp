@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loopback throughput benchmarks for adbd's transport, sync service and I/O
+// helpers. Each benchmark reports MB/s; for the small-file sync benchmarks an
+// iteration is one file, so the ns/op column is the time per file.
+//
+// Build with "mmm system/core/adb" and run with:
+//   adb shell /data/nativetest/adbd_benchmark/adbd_benchmark [regex]
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <base/stringprintf.h>
+#include <benchmark.h>
+
+#include "adb.h"
+#include "adb_io.h"
+#include "file_sync_service.h"
+#include "transport.h"
+
+static void fail(const char* what) {
+  fprintf(stderr, "adbd_benchmark: %s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static void make_socketpair(int fds[2]) {
+  if (adb_socketpair(fds) != 0) fail("socketpair");
+}
+
+/*
+ * WriteFdExactly/ReadFdExactly through a socketpair, |chunk| bytes per call.
+ */
+static void BM_adb_io_exactly(int iters, int chunk) {
+  int fds[2];
+  make_socketpair(fds);
+  std::vector<char> buf(chunk, 'x');
+
+  std::thread reader([&]() {
+    std::vector<char> in(chunk);
+    for (int i = 0; i < iters; ++i) {
+      if (!ReadFdExactly(fds[1], in.data(), chunk)) fail("ReadFdExactly");
+    }
+  });
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    if (!WriteFdExactly(fds[0], buf.data(), chunk)) fail("WriteFdExactly");
+  }
+  reader.join();
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * chunk);
+  adb_close(fds[0]);
+  adb_close(fds[1]);
+}
+BENCHMARK(BM_adb_io_exactly)->Arg(64)->Arg(4096)->Arg(64 * 1024)->Arg(256 * 1024);
+
+/*
+ * WRTE packets with a |payload| byte body pushed through a pair of socket
+ * transports, using the same read_from_remote/write_to_remote functions as
+ * adbd over TCP.
+ */
+static void BM_transport_packets(int iters, int payload) {
+  int fds[2];
+  make_socketpair(fds);
+
+  atransport sender = {};
+  atransport receiver = {};
+  init_socket_transport(&sender, fds[0], 0, 0);
+  init_socket_transport(&receiver, fds[1], 0, 0);
+  sender.max_payload = receiver.max_payload = MAX_PAYLOAD;
+
+  apacket* out = get_apacket();
+  out->msg.command = A_WRTE;
+  out->msg.arg0 = 1;
+  out->msg.arg1 = 2;
+  out->msg.data_length = payload;
+  out->msg.magic = A_WRTE ^ 0xffffffff;
+  memset(out->data, 'x', payload);
+  out->msg.data_check = 'x' * payload;
+
+  std::thread reader([&]() {
+    apacket* in = get_apacket();
+    for (int i = 0; i < iters; ++i) {
+      if (receiver.read_from_remote(in, &receiver) != 0) fail("read_from_remote");
+    }
+    put_apacket(in);
+  });
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    if (sender.write_to_remote(out, &sender) != 0) fail("write_to_remote");
+  }
+  reader.join();
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * (sizeof(amessage) + payload));
+  put_apacket(out);
+  adb_close(fds[0]);
+  adb_close(fds[1]);
+}
+BENCHMARK(BM_transport_packets)->Arg(0)->Arg(MAX_PAYLOAD_V1)->Arg(64 * 1024)
+    ->Arg(MAX_PAYLOAD);
+
+/*
+ * A sync service running on its own thread, as it would behind "sync:",
+ * working in a scratch directory.
+ */
+#define SMALL_FILE_SIZE 4096
+#define SMALL_FILE_COUNT 256
+#define LARGE_FILE_SIZE (64 * 1024 * 1024)
+
+static int sync_fd = -1;
+static std::string sync_dir;
+
+static std::string small_file_path(int i) {
+  return android::base::StringPrintf("%s/small-%d", sync_dir.c_str(), i % SMALL_FILE_COUNT);
+}
+
+static void sync_cleanup() {
+  for (int i = 0; i < SMALL_FILE_COUNT; ++i) {
+    adb_unlink(small_file_path(i).c_str());
+  }
+  adb_unlink((sync_dir + "/large").c_str());
+  rmdir(sync_dir.c_str());
+}
+
+static void sync_start() {
+  if (sync_fd != -1) return;
+
+  char dir[] = "/data/local/tmp/adbd_benchmark-XXXXXX";
+  if (mkdtemp(dir) == nullptr) fail("mkdtemp");
+  sync_dir = dir;
+  atexit(sync_cleanup);
+
+  int fds[2];
+  make_socketpair(fds);
+  std::thread(file_sync_service, fds[1], nullptr).detach();
+  sync_fd = fds[0];
+}
+
+static void sync_request(unsigned id, const std::string& path) {
+  syncmsg msg;
+  msg.req.id = id;
+  msg.req.namelen = htoll(path.size());
+  if (!WriteFdExactly(sync_fd, &msg.req, sizeof(msg.req)) ||
+      !WriteFdExactly(sync_fd, path.data(), path.size())) {
+    fail("sync request");
+  }
+}
+
+static void sync_send(const std::string& path, const char* data, size_t size) {
+  sync_request(ID_SEND, path + ",0644");
+
+  syncmsg msg;
+  while (size > 0) {
+    size_t len = std::min(size, static_cast<size_t>(SYNC_DATA_MAX));
+    msg.data.id = ID_DATA;
+    msg.data.size = htoll(len);
+    if (!WriteFdExactly(sync_fd, &msg.data, sizeof(msg.data)) ||
+        !WriteFdExactly(sync_fd, data, len)) {
+      fail("sync DATA");
+    }
+    data += len;
+    size -= len;
+  }
+  msg.data.id = ID_DONE;
+  msg.data.size = 0;
+  if (!WriteFdExactly(sync_fd, &msg.data, sizeof(msg.data)) ||
+      !ReadFdExactly(sync_fd, &msg.status, sizeof(msg.status))) {
+    fail("sync DONE");
+  }
+  if (msg.status.id != ID_OKAY) {
+    errno = EIO;
+    fail(path.c_str());
+  }
+}
+
+static size_t sync_recv(const std::string& path, char* buffer) {
+  sync_request(ID_RECV, path);
+
+  size_t total = 0;
+  syncmsg msg;
+  for (;;) {
+    if (!ReadFdExactly(sync_fd, &msg.data, sizeof(msg.data))) fail("sync RECV");
+    if (msg.data.id == ID_DONE) break;
+    size_t len = ltohl(msg.data.size);
+    if (msg.data.id != ID_DATA || len > SYNC_DATA_MAX) {
+      errno = EIO;
+      fail(path.c_str());
+    }
+    if (!ReadFdExactly(sync_fd, buffer, len)) fail("sync DATA");
+    total += len;
+  }
+  return total;
+}
+
+static void BM_sync_send_small_files(int iters) {
+  sync_start();
+  std::vector<char> data(SMALL_FILE_SIZE, 'x');
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sync_send(small_file_path(i), data.data(), data.size());
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * SMALL_FILE_SIZE);
+}
+BENCHMARK(BM_sync_send_small_files);
+
+static void BM_sync_recv_small_files(int iters) {
+  sync_start();
+  std::vector<char> data(SMALL_FILE_SIZE, 'x');
+  for (int i = 0; i < SMALL_FILE_COUNT; ++i) {
+    sync_send(small_file_path(i), data.data(), data.size());
+  }
+
+  uint64_t bytes = 0;
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    bytes += sync_recv(small_file_path(i), data.data());
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_sync_recv_small_files);
+
+static void BM_sync_send_large_file(int iters) {
+  sync_start();
+  std::string path = sync_dir + "/large";
+  std::vector<char> data(LARGE_FILE_SIZE, 'x');
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sync_send(path, data.data(), data.size());
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * LARGE_FILE_SIZE);
+}
+BENCHMARK(BM_sync_send_large_file);
+
+static void BM_sync_recv_large_file(int iters) {
+  sync_start();
+  std::string path = sync_dir + "/large";
+  std::vector<char> data(LARGE_FILE_SIZE, 'x');
+  sync_send(path, data.data(), data.size());
+
+  uint64_t bytes = 0;
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    bytes += sync_recv(path, data.data());
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_sync_recv_large_file);
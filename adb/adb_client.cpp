@@ -316,3 +316,26 @@ bool adb_query(const std::string& service, std::string* result, std::string* err
     }
     return true;
 }
+
+bool adb_get_features(std::string* features, std::string* error) {
+    std::string service;
+    if (__adb_serial) {
+        service = android::base::StringPrintf("host-serial:%s:features", __adb_serial);
+    } else if (__adb_transport == kTransportUsb) {
+        service = "host-usb:features";
+    } else if (__adb_transport == kTransportLocal) {
+        service = "host-local:features";
+    } else {
+        service = "host:features";
+    }
+
+    int fd = adb_connect(service, error);
+    if (fd < 0) {
+        return false;
+    }
+
+    features->clear();
+    bool result = ReadProtocolString(fd, features, error);
+    adb_close(fd);
+    return result;
+}
@@ -45,6 +45,11 @@ int  adb_get_emulator_console_port(void);
  */
 int  adb_send_emulator_command(int  argc, const char**  argv);
 
+// Fills 'features' with the comma-separated list of features advertised by
+// the device selected with adb_set_transport.
+// Returns true on success; returns false and fills 'error' on failure.
+bool adb_get_features(std::string* features, std::string* error);
+
 // Reads a standard adb status response (OKAY|FAIL) and
 // returns true in the event of OKAY, false in the event of FAIL
 // or protocol error.
@@ -23,6 +23,12 @@
 #include <stdio.h>
 #endif
 
+/* Systrace events (see cutils/daemon_trace.h) are only emitted by adbd. */
+#if ADB_HOST
+#define DAEMON_TRACE 0
+#endif
+#include <cutils/daemon_trace.h>
+
 /* IMPORTANT: if you change the following list, don't
  * forget to update the corresponding 'tags' table in
  * the adb_trace_init() function implemented in adb.c
@@ -18,14 +18,17 @@
 
 #include "adb_utils.h"
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 
 #include <base/stringprintf.h>
+#include <base/strings.h>
 
 #include "adb_trace.h"
 #include "sysdeps.h"
@@ -103,3 +106,28 @@ void dump_hex(const void* data, size_t byte_count) {
 
     DR("%s\n", line.c_str());
 }
+
+bool has_feature(const std::string& features, const std::string& feature) {
+  for (const auto& f : android::base::Split(features, ",")) {
+    if (f == feature) return true;
+  }
+  return false;
+}
+
+bool is_compressed_file_name(const std::string& path) {
+  static const char* const kCompressedSuffixes[] = {
+    ".7z", ".apk", ".br", ".bz2", ".gz", ".jar", ".jpeg", ".jpg", ".lz4",
+    ".mp3", ".mp4", ".png", ".tgz", ".webm", ".webp", ".xz", ".zip",
+  };
+  std::string lower(path);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for (const char* suffix : kCompressedSuffixes) {
+    if (android::base::EndsWith(lower, suffix)) return true;
+  }
+  return false;
+}
+
+uint64_t adb_monotonic_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
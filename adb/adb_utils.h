@@ -17,6 +17,8 @@
 #ifndef _ADB_UTILS_H_
 #define _ADB_UTILS_H_
 
+#include <stdint.h>
+
 #include <string>
 
 bool getcwd(std::string* cwd);
@@ -28,4 +30,14 @@ std::string escape_arg(const std::string& s);
 
 void dump_hex(const void* ptr, size_t byte_count);
 
+// Returns true if the comma-separated |features| list contains |feature|.
+bool has_feature(const std::string& features, const std::string& feature);
+
+// Returns true if |path| names a file format that is already compressed
+// (.apk, .zip, .gz and friends), so that deflating it again is wasted work.
+bool is_compressed_file_name(const std::string& path);
+
+// Returns a monotonic timestamp in nanoseconds, for measuring intervals.
+uint64_t adb_monotonic_ns();
+
 #endif
@@ -50,3 +50,20 @@ TEST(adb_utils, escape_arg) {
   ASSERT_EQ(R"('abc(')", escape_arg("abc("));
   ASSERT_EQ(R"('abc)')", escape_arg("abc)"));
 }
+
+TEST(adb_utils, has_feature) {
+  ASSERT_FALSE(has_feature("", "sync_v2"));
+  ASSERT_TRUE(has_feature("sync_v2", "sync_v2"));
+  ASSERT_TRUE(has_feature("foo,sync_v2,bar", "sync_v2"));
+  ASSERT_FALSE(has_feature("foo,sync_v2x", "sync_v2"));
+  ASSERT_FALSE(has_feature("sync", "sync_v2"));
+}
+
+TEST(adb_utils, is_compressed_file_name) {
+  ASSERT_TRUE(is_compressed_file_name("/data/app/foo.apk"));
+  ASSERT_TRUE(is_compressed_file_name("FOO.ZIP"));
+  ASSERT_TRUE(is_compressed_file_name("a.tar.gz"));
+  ASSERT_FALSE(is_compressed_file_name("/system/lib/libc.so"));
+  ASSERT_FALSE(is_compressed_file_name("zip"));
+  ASSERT_FALSE(is_compressed_file_name(""));
+}
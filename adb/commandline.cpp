@@ -204,6 +204,7 @@ static void help() {
         "  adb get-state                - prints: offline | bootloader | device\n"
         "  adb get-serialno             - prints: <serial-number>\n"
         "  adb get-devpath              - prints: <device-path>\n"
+        "  adb stats                    - prints the server's per-transport throughput and latency counters\n"
         "  adb remount                  - remounts the /system, /vendor (if present) and /oem (if present) partitions on the device read-write\n"
         "  adb reboot [bootloader|recovery]\n"
         "                               - reboots the device, optionally into the bootloader or recovery program.\n"
@@ -234,6 +235,8 @@ static void help() {
         "                                 1 or all, adb, sockets, packets, rwx, usb, sync, sysdeps, transport, jdwp\n"
         "  ANDROID_SERIAL               - The serial number to connect to. -s takes priority over this if given.\n"
         "  ANDROID_LOG_TAGS             - When used with the logcat option, only these debug tags are printed.\n"
+        "  ADB_SYNC_DEFLATE             - Set to 0 to stop push/pull/sync compressing file data on the wire.\n"
+        "  ADB_SYNC_STREAMS             - Number of parallel streams used to push/pull/sync a directory (default 4).\n"
         );
 }
 
@@ -1138,6 +1141,9 @@ int adb_commandline(int argc, const char **argv) {
                                                         (argc == 2) ? argv[1] : "");
         return adb_query_command(query);
     }
+    else if (!strcmp(argv[0], "stats")) {
+        return adb_query_command("host:stats");
+    }
     else if (!strcmp(argv[0], "emu")) {
         return adb_send_emulator_command(argc, argv);
     }
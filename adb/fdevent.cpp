@@ -32,6 +32,7 @@
 
 #include "adb_io.h"
 #include "adb_trace.h"
+#include "adb_utils.h"
 
 /* !!! Do not enable DEBUG for the adb that will run as the server:
 ** both stdout and stderr are used to communicate between the client
@@ -97,133 +98,209 @@ static fdevent list_pending = {
 static fdevent **fd_table = 0;
 static int fd_table_max = 0;
 
-#ifdef CRAPTASTIC
-//HAVE_EPOLL
+#if defined(__linux__)
 
 #include <sys/epoll.h>
 
+/* The epoll backend keeps the kernel's interest set in sync with each
+** fde's FDE_READ/FDE_WRITE/FDE_ERROR mask as it changes, so a wakeup costs
+** O(ready fds) rather than a rebuild and scan of every installed fd.
+**
+** Registration is level-triggered on purpose: socket handlers read at most
+** one packet per callback and rely on being called again while data is
+** still pending, which edge-triggered delivery would not do.
+*/
+
 static int epoll_fd = -1;
 
 static void fdevent_init()
 {
-        /* XXX: what's a good size for the passed in hint? */
-    epoll_fd = epoll_create(256);
-
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if(epoll_fd < 0) {
-        perror("epoll_create() failed");
-        exit(1);
+        FATAL("epoll_create1() failed: %s\n", strerror(errno));
     }
-
-        /* mark for close-on-exec */
-    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
 }
 
-static void fdevent_connect(fdevent *fde)
+static uint32_t fdevent_epoll_events(unsigned events)
 {
-    struct epoll_event ev;
-
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
+    uint32_t ev = 0;
+    if(events & FDE_READ) ev |= EPOLLIN;
+    if(events & FDE_WRITE) ev |= EPOLLOUT;
+    if(events & FDE_ERROR) ev |= EPOLLPRI;
+    return ev;
+}
 
-#if 0
-    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-        perror("epoll_ctl() failed\n");
-        exit(1);
-    }
-#endif
+static void fdevent_connect(fdevent* /* fde */)
+{
+    /* nothing to do until there are events to monitor */
 }
 
 static void fdevent_disconnect(fdevent *fde)
 {
-    struct epoll_event ev;
-
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
+    if(fdevent_epoll_events(fde->state) == 0) return;
 
-        /* technically we only need to delete if we
-        ** were actively monitoring events, but let's
-        ** be aggressive and do it anyway, just in case
-        ** something's out of sync
-        */
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev);
+    /* the fd may already have been closed behind our back, in which
+    ** case the kernel has dropped it from the interest set itself
+    */
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, nullptr);
 }
 
 static void fdevent_update(fdevent *fde, unsigned events)
 {
     struct epoll_event ev;
-    int active;
-
-    active = (fde->state & FDE_EVENTMASK) != 0;
+    uint32_t old_events = fdevent_epoll_events(fde->state);
 
     memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
+    ev.events = fdevent_epoll_events(events);
     ev.data.ptr = fde;
 
-    if(events & FDE_READ) ev.events |= EPOLLIN;
-    if(events & FDE_WRITE) ev.events |= EPOLLOUT;
-    if(events & FDE_ERROR) ev.events |= (EPOLLERR | EPOLLHUP);
-
     fde->state = (fde->state & FDE_STATEMASK) | events;
 
-    if(active) {
-            /* we're already active. if we're changing to *no*
-            ** events being monitored, we need to delete, otherwise
-            ** we need to just modify
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        } else {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        }
+    if(ev.events == old_events) return;
+
+    int op;
+    if(old_events == 0) {
+        op = EPOLL_CTL_ADD;
+    } else if(ev.events == 0) {
+        op = EPOLL_CTL_DEL;
     } else {
-            /* we're not active.  if we're watching events, we need
-            ** to add, otherwise we can just do nothing
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        }
+        op = EPOLL_CTL_MOD;
+    }
+
+    if(epoll_ctl(epoll_fd, op, fde->fd, &ev)) {
+        FATAL("epoll_ctl(%d) failed for fd %d: %s\n", op, fde->fd, strerror(errno));
     }
 }
 
 static void fdevent_process()
 {
     struct epoll_event events[256];
-    fdevent *fde;
-    int i, n;
 
-    n = epoll_wait(epoll_fd, events, 256, -1);
+    int n = epoll_wait(epoll_fd, events, 256, -1);
+    int saved_errno = errno;
+    D("epoll_wait() returned n=%d, errno=%d\n", n, n<0?saved_errno:0);
 
     if(n < 0) {
-        if(errno == EINTR) return;
-        perror("epoll_wait");
-        exit(1);
+        if(saved_errno == EINTR) return;
+        FATAL("epoll_wait() failed: %s\n", strerror(saved_errno));
     }
 
-    for(i = 0; i < n; i++) {
+    for(int i = 0; i < n; i++) {
         struct epoll_event *ev = events + i;
-        fde = ev->data.ptr;
+        fdevent *fde = reinterpret_cast<fdevent*>(ev->data.ptr);
+        unsigned got = 0;
+
+        if(ev->events & EPOLLIN) got |= FDE_READ;
+        if(ev->events & EPOLLOUT) got |= FDE_WRITE;
+        if(ev->events & EPOLLPRI) got |= FDE_ERROR;
 
-        if(ev->events & EPOLLIN) {
-            fde->events |= FDE_READ;
+        /* select() reports a hung up or failed fd as readable and
+        ** writable, and the handlers expect to discover the condition
+        ** from the next read or write; do the same here
+        */
+        if(ev->events & (EPOLLERR | EPOLLHUP)) {
+            got |= (fde->state & (FDE_READ | FDE_WRITE | FDE_ERROR));
         }
-        if(ev->events & EPOLLOUT) {
-            fde->events |= FDE_WRITE;
+
+        if(got) {
+            fde->events |= got;
+
+            D("got events fde->fd=%d events=%04x, state=%04x\n",
+                fde->fd, fde->events, fde->state);
+            if(fde->state & FDE_PENDING) continue;
+            fde->state |= FDE_PENDING;
+            fdevent_plist_enqueue(fde);
         }
-        if(ev->events & (EPOLLERR | EPOLLHUP)) {
-            fde->events |= FDE_ERROR;
+    }
+}
+
+#elif defined(__APPLE__)
+
+#include <sys/event.h>
+
+/* kqueue keeps one filter per direction, which we add and delete as the
+** fde's FDE_READ/FDE_WRITE interest changes. See the epoll notes above.
+*/
+
+static int kqueue_fd = -1;
+
+static void fdevent_init()
+{
+    kqueue_fd = kqueue();
+    if(kqueue_fd < 0) {
+        FATAL("kqueue() failed: %s\n", strerror(errno));
+    }
+    fcntl(kqueue_fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void fdevent_kqueue_change(fdevent *fde, unsigned old_events, unsigned events)
+{
+    struct kevent changes[2];
+    int n = 0;
+
+    if((old_events ^ events) & FDE_READ) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_READ,
+               (events & FDE_READ) ? EV_ADD : EV_DELETE, 0, 0, fde);
+    }
+    if((old_events ^ events) & FDE_WRITE) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_WRITE,
+               (events & FDE_WRITE) ? EV_ADD : EV_DELETE, 0, 0, fde);
+    }
+
+    if(n > 0 && kevent(kqueue_fd, changes, n, nullptr, 0, nullptr) < 0 &&
+       (events & (FDE_READ | FDE_WRITE))) {
+        FATAL("kevent() failed for fd %d: %s\n", fde->fd, strerror(errno));
+    }
+}
+
+static void fdevent_connect(fdevent* /* fde */)
+{
+    /* nothing to do until there are events to monitor */
+}
+
+static void fdevent_disconnect(fdevent *fde)
+{
+    fdevent_kqueue_change(fde, fde->state, 0);
+}
+
+static void fdevent_update(fdevent *fde, unsigned events)
+{
+    unsigned old_events = fde->state;
+    fde->state = (fde->state & FDE_STATEMASK) | events;
+    fdevent_kqueue_change(fde, old_events, events);
+}
+
+static void fdevent_process()
+{
+    struct kevent events[256];
+
+    int n = kevent(kqueue_fd, nullptr, 0, events, 256, nullptr);
+    int saved_errno = errno;
+    D("kevent() returned n=%d, errno=%d\n", n, n<0?saved_errno:0);
+
+    if(n < 0) {
+        if(saved_errno == EINTR) return;
+        FATAL("kevent() failed: %s\n", strerror(saved_errno));
+    }
+
+    for(int i = 0; i < n; i++) {
+        struct kevent *ev = events + i;
+        fdevent *fde = reinterpret_cast<fdevent*>(ev->udata);
+        unsigned got = 0;
+
+        if(ev->flags & EV_ERROR) {
+            got |= (fde->state & (FDE_READ | FDE_WRITE | FDE_ERROR));
+        } else if(ev->filter == EVFILT_READ) {
+            got |= FDE_READ;
+        } else if(ev->filter == EVFILT_WRITE) {
+            got |= FDE_WRITE;
         }
-        if(fde->events) {
+
+        if(got) {
+            fde->events |= got;
+
+            D("got events fde->fd=%d events=%04x, state=%04x\n",
+                fde->fd, fde->events, fde->state);
             if(fde->state & FDE_PENDING) continue;
             fde->state |= FDE_PENDING;
             fdevent_plist_enqueue(fde);
@@ -678,6 +755,13 @@ void fdevent_subproc_setup()
     fdevent_add(fde, FDE_READ);
 }
 
+static fdevent_stats loop_stats;
+
+void fdevent_get_stats(fdevent_stats* stats)
+{
+    *stats = loop_stats;
+}
+
 void fdevent_loop()
 {
     fdevent *fde;
@@ -688,8 +772,14 @@ void fdevent_loop()
 
         fdevent_process();
 
+        uint64_t start = adb_monotonic_ns();
         while((fde = fdevent_plist_dequeue())) {
             fdevent_call_fdfunc(fde);
         }
+        uint64_t busy = adb_monotonic_ns() - start;
+
+        loop_stats.iterations++;
+        loop_stats.busy_ns += busy;
+        if (busy > loop_stats.max_busy_ns) loop_stats.max_busy_ns = busy;
     }
 }
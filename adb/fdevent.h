@@ -64,6 +64,17 @@ void fdevent_set_timeout(fdevent *fde, int64_t  timeout_ms);
 */
 void fdevent_loop();
 
+/* Event loop statistics for "adb stats": how many times the loop has
+** dispatched events and how long the handlers took. Only safe to call on
+** the fdevent thread.
+*/
+struct fdevent_stats {
+    uint64_t iterations;
+    uint64_t busy_ns;
+    uint64_t max_busy_ns;
+};
+void fdevent_get_stats(fdevent_stats* stats);
+
 struct fdevent {
     fdevent *next;
     fdevent *prev;
@@ -25,6 +25,14 @@
 #include <sys/types.h>
 #include <time.h>
 #include <utime.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "sysdeps.h"
 
@@ -34,7 +42,7 @@
 #include "adb_utils.h"
 #include "file_sync_service.h"
 
-static unsigned long long total_bytes;
+static std::atomic<unsigned long long> total_bytes;
 static long long start_time;
 
 static long long NOW()
@@ -54,14 +62,15 @@ static void BEGIN()
 static void END()
 {
     long long t = NOW() - start_time;
-    if(total_bytes == 0) return;
+    unsigned long long bytes = total_bytes;
+    if(bytes == 0) return;
 
     if (t == 0)  /* prevent division by 0 :-) */
         t = 1000000;
 
     fprintf(stderr,"%lld KB/s (%lld bytes in %lld.%03llds)\n",
-            ((total_bytes * 1000000LL) / t) / 1024LL,
-            total_bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL);
+            ((bytes * 1000000LL) / t) / 1024LL,
+            bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL);
 }
 
 static const char* transfer_progress_format = "\rTransferring: %llu/%llu (%d%%)";
@@ -80,6 +89,30 @@ static void print_transfer_progress(unsigned long long bytes_current,
     fflush(stderr);
 }
 
+// Returns true if the selected device advertises |feature|. The feature list
+// is fetched from the server once per process.
+static bool sync_has_feature(const char* feature) {
+    static bool queried = false;
+    static std::string features;
+    if (!queried) {
+        std::string error;
+        if (!adb_get_features(&features, &error)) {
+            features.clear();
+        }
+        queried = true;
+    }
+    return has_feature(features, feature);
+}
+
+// Returns true if DATA chunks to or from |path| should be deflated. Setting
+// ADB_SYNC_DEFLATE=0 turns compression off, for links fast enough that the
+// CPU time isn't worth it.
+static bool sync_use_deflate(const char* path) {
+    const char* env = getenv("ADB_SYNC_DEFLATE");
+    if (env != nullptr && strcmp(env, "0") == 0) return false;
+    return !is_compressed_file_name(path) && sync_has_feature(FEATURE_SYNC_DEFLATE);
+}
+
 static void sync_quit(int fd) {
     syncmsg msg;
 
@@ -129,12 +162,82 @@ fail:
     return -1;
 }
 
+typedef void (*sync_ls_v2_cb)(unsigned mode, uint64_t size, int64_t time, const char *name,
+                              void *cookie);
+
+// Lists the whole tree below |path| with a single LST2 request.
+static int sync_ls_v2(int fd, const char* path, sync_ls_v2_cb func, void* cookie) {
+    syncmsg msg;
+    char buf[SYNC_LIST_V2_NAME_MAX + 1];
+    int len;
+
+    len = strlen(path);
+    if(len > 1024) goto fail;
+
+    msg.req.id = ID_LIST_V2;
+    msg.req.namelen = htoll(len);
+
+    if(!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) ||
+       !WriteFdExactly(fd, path, len)) {
+        goto fail;
+    }
+
+    for(;;) {
+        if(!ReadFdExactly(fd, &msg.dent_v2, sizeof(msg.dent_v2))) break;
+        if(msg.dent_v2.id == ID_DONE) return 0;
+        if(msg.dent_v2.id != ID_DENT_V2) break;
+
+        len = msg.dent_v2.namelen;
+        if(len > SYNC_LIST_V2_NAME_MAX) break;
+
+        if(!ReadFdExactly(fd, buf, len)) break;
+        buf[len] = 0;
+
+        func(msg.dent_v2.mode, msg.dent_v2.size, msg.dent_v2.mtime, buf, cookie);
+    }
+
+fail:
+    adb_close(fd);
+    return -1;
+}
+
+// Issues a STA2 request. A missing file is reported as mode 0, like STAT.
+static int sync_stat_v2(int fd, const char* path, unsigned* mode, uint64_t* size, int64_t* time) {
+    syncmsg msg;
+    int len = strlen(path);
+
+    msg.req.id = ID_STAT_V2;
+    msg.req.namelen = htoll(len);
+
+    if(!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) ||
+       !WriteFdExactly(fd, path, len)) {
+        return -1;
+    }
+
+    if(!ReadFdExactly(fd, &msg.stat_v2, sizeof(msg.stat_v2))) {
+        return -1;
+    }
+
+    if(msg.stat_v2.id != ID_STAT_V2) {
+        return -1;
+    }
+
+    *mode = msg.stat_v2.error ? 0 : msg.stat_v2.mode;
+    if (size) *size = msg.stat_v2.size;
+    if (time) *time = msg.stat_v2.mtime;
+    return 0;
+}
+
 struct syncsendbuf {
     unsigned id;
     unsigned size;
     char data[SYNC_DATA_MAX];
+    // Never sent: scratch space for the raw side of a DATZ chunk.
+    char raw[SYNC_DATA_MAX];
 };
 
+// The buffer for the main sync: stream. Extra streams opened for a parallel
+// directory transfer each allocate their own.
 static syncsendbuf send_buffer;
 
 static int sync_readtime(int fd, const char* path, unsigned int* timestamp, unsigned int* mode) {
@@ -220,10 +323,12 @@ static int sync_readmode(int fd, const char* path, unsigned* mode) {
     return 0;
 }
 
-static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show_progress)
+static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show_progress,
+                           bool deflate)
 {
     int lfd, err = 0;
     unsigned long long size = 0;
+    bool first_chunk = true;
 
     lfd = adb_open(path, O_RDONLY);
     if(lfd < 0) {
@@ -242,11 +347,10 @@ static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show
         size = st.st_size;
     }
 
-    sbuf->id = ID_DATA;
     for(;;) {
         int ret;
 
-        ret = adb_read(lfd, sbuf->data, SYNC_DATA_MAX);
+        ret = adb_read(lfd, deflate ? sbuf->raw : sbuf->data, SYNC_DATA_MAX);
         if(!ret)
             break;
 
@@ -257,15 +361,34 @@ static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show
             break;
         }
 
+        sbuf->id = ID_DATA;
         sbuf->size = htoll(ret);
-        if(!WriteFdExactly(fd, sbuf, sizeof(unsigned) * 2 + ret)){
+        if (deflate) {
+            uLongf z_len = ret - 1;
+            if (compress2(reinterpret_cast<Bytef*>(sbuf->data), &z_len,
+                          reinterpret_cast<Bytef*>(sbuf->raw), ret,
+                          SYNC_DEFLATE_LEVEL) == Z_OK) {
+                sbuf->id = ID_DATA_Z;
+                sbuf->size = htoll(z_len);
+            } else {
+                memcpy(sbuf->data, sbuf->raw, ret);
+                z_len = ret;
+            }
+            if (first_chunk && !SYNC_DEFLATE_WORTHWHILE(static_cast<uLongf>(ret), z_len)) {
+                // Judging by its start, this file isn't worth the CPU time.
+                deflate = false;
+            }
+        }
+        first_chunk = false;
+
+        if(!WriteFdExactly(fd, sbuf, sizeof(unsigned) * 2 + ltohl(sbuf->size))){
             err = -1;
             break;
         }
         total_bytes += ret;
 
         if (show_progress) {
-            print_transfer_progress(total_bytes, size);
+            print_transfer_progress(total_bytes.load(), size);
         }
     }
 
@@ -330,12 +453,13 @@ static int write_data_link(int fd, const char *path, syncsendbuf *sbuf)
 }
 #endif
 
-static int sync_send(int fd, const char *lpath, const char *rpath,
-                     unsigned mtime, mode_t mode, int show_progress)
+// Sends a complete SEND request (header, data and DONE) without waiting for
+// the service's reply; see sync_read_status.
+static int sync_send_request(int fd, syncsendbuf *sbuf, const char *lpath, const char *rpath,
+                             unsigned mtime, mode_t mode, int show_progress)
 {
     syncmsg msg;
     int len, r;
-    syncsendbuf *sbuf = &send_buffer;
     char* file_buffer = NULL;
     int size = 0;
     char tmp[64];
@@ -359,7 +483,7 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
         write_data_buffer(fd, file_buffer, size, sbuf, show_progress);
         free(file_buffer);
     } else if (S_ISREG(mode))
-        write_data_file(fd, lpath, sbuf, show_progress);
+        write_data_file(fd, lpath, sbuf, show_progress, sync_use_deflate(lpath));
     else if (S_ISLNK(mode))
         write_data_link(fd, lpath, sbuf);
     else
@@ -370,6 +494,20 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     if(!WriteFdExactly(fd, &msg.data, sizeof(msg.data)))
         goto fail;
 
+    return 0;
+
+fail:
+    fprintf(stderr,"protocol failure\n");
+    adb_close(fd);
+    return -1;
+}
+
+// Reads the service's reply to the oldest outstanding SEND request.
+static int sync_read_status(int fd, syncsendbuf *sbuf, const char *lpath, const char *rpath)
+{
+    syncmsg msg;
+    int len;
+
     if(!ReadFdExactly(fd, &msg.status, sizeof(msg.status)))
         return -1;
 
@@ -389,25 +527,38 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     }
 
     return 0;
+}
 
-fail:
-    fprintf(stderr,"protocol failure\n");
-    adb_close(fd);
-    return -1;
+static int sync_send(int fd, syncsendbuf *sbuf, const char *lpath, const char *rpath,
+                     unsigned mtime, mode_t mode, int show_progress)
+{
+    if(sync_send_request(fd, sbuf, lpath, rpath, mtime, mode, show_progress)) {
+        return -1;
+    }
+    return sync_read_status(fd, sbuf, lpath, rpath);
 }
 
-static int sync_recv(int fd, const char* rpath, const char* lpath, int show_progress) {
+
+static int sync_recv(int fd, syncsendbuf *sbuf, const char* rpath, const char* lpath,
+                     int show_progress) {
     syncmsg msg;
     int len;
     int lfd = -1;
-    char *buffer = send_buffer.data;
+    char *buffer = sbuf->data;
     unsigned id;
     unsigned long long size = 0;
 
     len = strlen(rpath);
     if(len > 1024) return -1;
 
-    if (show_progress) {
+    if (show_progress && sync_has_feature(FEATURE_STAT_V2)) {
+        unsigned mode;
+        uint64_t size64;
+        if (sync_stat_v2(fd, rpath, &mode, &size64, nullptr)) {
+            return -1;
+        }
+        size = size64;
+    } else if (show_progress) {
         // Determine remote file size.
         syncmsg stat_msg;
         stat_msg.req.id = ID_STAT;
@@ -427,7 +578,7 @@ static int sync_recv(int fd, const char* rpath, const char* lpath, int show_prog
         size = ltohl(stat_msg.stat.size);
     }
 
-    msg.req.id = ID_RECV;
+    msg.req.id = sync_use_deflate(rpath) ? ID_RECV_Z : ID_RECV;
     msg.req.namelen = htoll(len);
     if(!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) ||
        !WriteFdExactly(fd, rpath, len)) {
@@ -439,7 +590,7 @@ static int sync_recv(int fd, const char* rpath, const char* lpath, int show_prog
     }
     id = msg.data.id;
 
-    if((id == ID_DATA) || (id == ID_DONE)) {
+    if((id == ID_DATA) || (id == ID_DATA_Z) || (id == ID_DONE)) {
         adb_unlink(lpath);
         mkdirs(lpath);
         lfd = adb_creat(lpath, 0644);
@@ -461,18 +612,29 @@ static int sync_recv(int fd, const char* rpath, const char* lpath, int show_prog
     handle_data:
         len = ltohl(msg.data.size);
         if(id == ID_DONE) break;
-        if(id != ID_DATA) goto remote_error;
+        if(id != ID_DATA && id != ID_DATA_Z) goto remote_error;
         if(len > SYNC_DATA_MAX) {
             fprintf(stderr,"data overrun\n");
             adb_close(lfd);
             return -1;
         }
 
-        if(!ReadFdExactly(fd, buffer, len)) {
+        if(!ReadFdExactly(fd, id == ID_DATA_Z ? sbuf->raw : buffer, len)) {
             adb_close(lfd);
             return -1;
         }
 
+        if(id == ID_DATA_Z) {
+            uLongf raw_len = SYNC_DATA_MAX;
+            if(uncompress(reinterpret_cast<Bytef*>(buffer), &raw_len,
+                          reinterpret_cast<Bytef*>(sbuf->raw), len) != Z_OK) {
+                fprintf(stderr,"corrupt compressed data\n");
+                adb_close(lfd);
+                return -1;
+            }
+            len = raw_len;
+        }
+
         if(!WriteFdExactly(lfd, buffer, len)) {
             fprintf(stderr,"cannot write '%s': %s\n", rpath, strerror(errno));
             adb_close(lfd);
@@ -482,7 +644,7 @@ static int sync_recv(int fd, const char* rpath, const char* lpath, int show_prog
         total_bytes += len;
 
         if (show_progress) {
-            print_transfer_progress(total_bytes, size);
+            print_transfer_progress(total_bytes.load(), size);
         }
     }
 
@@ -536,9 +698,9 @@ struct copyinfo
     copyinfo *next;
     const char *src;
     const char *dst;
-    unsigned int time;
+    int64_t time;
     unsigned int mode;
-    unsigned int size;
+    uint64_t size;
     int flag;
 };
 
@@ -643,10 +805,186 @@ static int local_build_list(copyinfo **filelist,
 }
 
 
-static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, int checktimestamps, int listonly)
+struct remote_stat {
+    unsigned mode;
+    uint64_t size;
+    int64_t time;
+};
+
+static void remote_stat_cb(unsigned mode, uint64_t size, int64_t time, const char *name,
+                           void *cookie)
+{
+    std::map<std::string, remote_stat>* remote =
+        reinterpret_cast<std::map<std::string, remote_stat>*>(cookie);
+    (*remote)[name] = remote_stat{mode, size, time};
+}
+
+// The number of SEND requests kept in flight when the service supports
+// pipelining, so that many small files cost one round trip per window
+// rather than one per file.
+#define SYNC_SEND_WINDOW 32
+
+// Directory pushes and pulls spread their files over this many sync: streams
+// on the one transport, so that one file's round trips and host-side work
+// overlap with the transfer of others. ADB_SYNC_STREAMS overrides it.
+#define SYNC_STREAMS_DEFAULT 4
+#define SYNC_STREAMS_MAX 16
+
+static int sync_stream_count() {
+    const char* env = getenv("ADB_SYNC_STREAMS");
+    if (env == nullptr) return SYNC_STREAMS_DEFAULT;
+    return std::max(1, std::min(atoi(env), SYNC_STREAMS_MAX));
+}
+
+// The files of one directory transfer, shared by all of its streams.
+struct sync_work {
+    std::vector<copyinfo*> files;
+    std::atomic<size_t> next;
+    std::atomic<bool> failed;
+    bool pipelined;
+    int copy_attrs;
+};
+
+struct sync_stream {
+    sync_work* work;
+    int fd;
+    syncsendbuf* sbuf;
+    int (*run)(sync_stream* stream);
+    int done_fd;  // The stream's thread writes a byte here when it finishes.
+    int count;    // Files transferred.
+    int result;
+};
+
+// Returns the next file to transfer, or nullptr once the list is used up or
+// any stream has failed.
+static copyinfo* sync_work_next(sync_work* work) {
+    if (work->failed) return nullptr;
+    size_t i = work->next++;
+    return (i < work->files.size()) ? work->files[i] : nullptr;
+}
+
+static void* sync_stream_thread(void* arg) {
+    sync_stream* stream = reinterpret_cast<sync_stream*>(arg);
+    stream->result = stream->run(stream);
+    if (stream->result) stream->work->failed = true;
+    char done = 0;
+    adb_write(stream->done_fd, &done, 1);
+    return nullptr;
+}
+
+// Runs |run| over work->files on |fd| and on up to sync_stream_count() - 1
+// extra sync: streams, each in its own thread. If fewer streams can be
+// opened, the ones that did open share the work. Returns non-zero if any
+// stream failed, and sets *count to the number of files transferred.
+static int sync_run_streams(int fd, sync_work* work, int (*run)(sync_stream* stream),
+                            int* count) {
+    size_t wanted = std::min(static_cast<size_t>(sync_stream_count()), work->files.size());
+    std::vector<sync_stream> streams(std::max(wanted, static_cast<size_t>(1)));
+    int done[2] = { -1, -1 };
+    if (streams.size() > 1 && adb_socketpair(done) != 0) {
+        streams.resize(1);
+    }
+
+    work->next = 0;
+    work->failed = false;
+    streams[0] = { work, fd, &send_buffer, run, -1, 0, 0 };
+
+    size_t started = 1;
+    while (started < streams.size()) {
+        std::string error;
+        int extra_fd = adb_connect("sync:", &error);
+        if (extra_fd < 0) break;
+
+        sync_stream* stream = &streams[started];
+        *stream = { work, extra_fd, new syncsendbuf, run, done[1], 0, 0 };
+        adb_thread_t thread;
+        if (adb_thread_create(&thread, sync_stream_thread, stream)) {
+            delete stream->sbuf;
+            adb_close(extra_fd);
+            break;
+        }
+        started++;
+    }
+
+    streams[0].result = run(&streams[0]);
+    if (streams[0].result) work->failed = true;
+
+    int result = streams[0].result;
+    *count = streams[0].count;
+    for (size_t i = 1; i < started; i++) {
+        char unused;
+        if (!ReadFdExactly(done[0], &unused, 1)) {
+            fatal_errno("lost track of sync streams");
+        }
+    }
+    for (size_t i = 1; i < started; i++) {
+        *count += streams[i].count;
+        if (streams[i].result) {
+            // A failed stream has already been closed or is unusable.
+            result = 1;
+        } else {
+            sync_quit(streams[i].fd);
+            adb_close(streams[i].fd);
+        }
+        delete streams[i].sbuf;
+    }
+    if (done[0] != -1) {
+        adb_close(done[0]);
+        adb_close(done[1]);
+    }
+    return result;
+}
+
+static int sync_push_stream(sync_stream* stream) {
+    sync_work* work = stream->work;
+    std::deque<copyinfo*> inflight;
+    copyinfo* ci;
+
+    while ((ci = sync_work_next(work)) != nullptr) {
+        fprintf(stderr, "push: %s -> %s\n", ci->src, ci->dst);
+        if (!work->pipelined) {
+            if (sync_send(stream->fd, stream->sbuf, ci->src, ci->dst, ci->time, ci->mode,
+                          0 /* no show progress */)) {
+                return 1;
+            }
+            stream->count++;
+            continue;
+        }
+
+        if (sync_send_request(stream->fd, stream->sbuf, ci->src, ci->dst, ci->time, ci->mode,
+                              0 /* no show progress */)) {
+            return 1;
+        }
+        stream->count++;
+
+        // Replies arrive in request order; keep ci until its reply has been
+        // read so that failures can be reported.
+        inflight.push_back(ci);
+        if (inflight.size() < SYNC_SEND_WINDOW) continue;
+
+        ci = inflight.front();
+        inflight.pop_front();
+        if (sync_read_status(stream->fd, stream->sbuf, ci->src, ci->dst)) {
+            return 1;
+        }
+    }
+
+    while (!inflight.empty()) {
+        ci = inflight.front();
+        inflight.pop_front();
+        if (sync_read_status(stream->fd, stream->sbuf, ci->src, ci->dst)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, int checktimestamps, int listonly,
+                                 bool pipelined)
 {
     copyinfo *filelist = 0;
     copyinfo *ci, *next;
+    sync_work work;
     int pushed = 0;
     int skipped = 0;
 
@@ -670,7 +1008,24 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
         return -1;
     }
 
-    if(checktimestamps){
+    if(checktimestamps && sync_has_feature(FEATURE_STAT_V2)) {
+        std::map<std::string, remote_stat> remote;
+        if(sync_ls_v2(fd, rpath, remote_stat_cb, &remote)) {
+            return 1;
+        }
+        size_t rlen = strlen(rpath);
+        for(ci = filelist; ci != 0; ci = ci->next) {
+            auto it = remote.find(ci->dst + rlen);
+            if(it == remote.end()) continue;
+            const remote_stat& rs = it->second;
+            if(rs.size == ci->size) {
+                /* for links, we cannot update the atime/mtime */
+                if((S_ISREG(ci->mode & rs.mode) && rs.time == ci->time) ||
+                    (S_ISLNK(ci->mode & rs.mode) && rs.time >= ci->time))
+                    ci->flag = 1;
+            }
+        }
+    } else if(checktimestamps){
         for(ci = filelist; ci != 0; ci = ci->next) {
             if(sync_start_readtime(fd, ci->dst)) {
                 return 1;
@@ -690,13 +1045,12 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
     }
     for(ci = filelist; ci != 0; ci = next) {
         next = ci->next;
+        if(ci->flag == 0 && !listonly) {
+            work.files.push_back(ci);
+            continue;
+        }
         if(ci->flag == 0) {
-            fprintf(stderr,"%spush: %s -> %s\n", listonly ? "would " : "", ci->src, ci->dst);
-            if(!listonly &&
-               sync_send(fd, ci->src, ci->dst, ci->time, ci->mode,
-                         0 /* no show progress */)) {
-                return 1;
-            }
+            fprintf(stderr,"would push: %s -> %s\n", ci->src, ci->dst);
             pushed++;
         } else {
             skipped++;
@@ -704,6 +1058,14 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
         free(ci);
     }
 
+    work.pipelined = pipelined;
+    work.copy_attrs = 0;
+    int sent = 0;
+    int ret = sync_run_streams(fd, &work, sync_push_stream, &sent);
+    for(copyinfo* f : work.files) free(f);
+    if(ret) return 1;
+    pushed += sent;
+
     fprintf(stderr,"%d file%s pushed. %d file%s skipped.\n",
             pushed, (pushed == 1) ? "" : "s",
             skipped, (skipped == 1) ? "" : "s");
@@ -732,7 +1094,7 @@ int do_sync_push(const char *lpath, const char *rpath, int show_progress)
 
     if(S_ISDIR(st.st_mode)) {
         BEGIN();
-        if(copy_local_dir_remote(fd, lpath, rpath, 0, 0)) {
+        if(copy_local_dir_remote(fd, lpath, rpath, 0, 0, sync_has_feature(FEATURE_SYNC_V2))) {
             return 1;
         } else {
             END();
@@ -760,7 +1122,7 @@ int do_sync_push(const char *lpath, const char *rpath, int show_progress)
             rpath = tmp;
         }
         BEGIN();
-        if(sync_send(fd, lpath, rpath, st.st_mtime, st.st_mode, show_progress)) {
+        if(sync_send(fd, &send_buffer, lpath, rpath, st.st_mtime, st.st_mode, show_progress)) {
             return 1;
         } else {
             END();
@@ -812,6 +1174,26 @@ static void sync_ls_build_list_cb(unsigned mode, unsigned size, unsigned time,
     }
 }
 
+static void sync_ls_v2_build_list_cb(unsigned mode, uint64_t size, int64_t time,
+                                     const char* name, void* cookie)
+{
+    sync_ls_build_list_cb_args *args = (sync_ls_build_list_cb_args *)cookie;
+
+    /* LST2 already recursed for us, so directories need no further work */
+    if (S_ISDIR(mode)) return;
+
+    if (S_ISREG(mode) || S_ISLNK(mode)) {
+        copyinfo *ci = mkcopyinfo(args->rpath, args->lpath, name, 0);
+        ci->time = time;
+        ci->mode = mode;
+        ci->size = size;
+        ci->next = *args->filelist;
+        *args->filelist = ci;
+    } else {
+        fprintf(stderr, "skipping special file '%s'\n", name);
+    }
+}
+
 static int remote_build_list(int syncfd, copyinfo **filelist,
                              const char *rpath, const char *lpath)
 {
@@ -823,6 +1205,10 @@ static int remote_build_list(int syncfd, copyinfo **filelist,
     args.rpath = rpath;
     args.lpath = lpath;
 
+    if (sync_has_feature(FEATURE_STAT_V2)) {
+        return sync_ls_v2(syncfd, rpath, sync_ls_v2_build_list_cb, (void *)&args) ? 1 : 0;
+    }
+
     /* Put the files/dirs in rpath on the lists. */
     if (sync_ls(syncfd, rpath, sync_ls_build_list_cb, (void *)&args)) {
         return 1;
@@ -841,15 +1227,26 @@ static int remote_build_list(int syncfd, copyinfo **filelist,
     return 0;
 }
 
+/* Reading the umask means briefly changing it, which would race with the
+** files other sync streams are creating, so it is read only once.
+*/
+static mode_t get_umask()
+{
+    static const mode_t mask = []() {
+        mode_t m = umask(0000);
+        umask(m);
+        return m;
+    }();
+    return mask;
+}
+
 static int set_time_and_mode(const char *lpath, time_t time, unsigned int mode)
 {
     struct utimbuf times = { time, time };
     int r1 = utime(lpath, &times);
 
     /* use umask for permissions */
-    mode_t mask=umask(0000);
-    umask(mask);
-    int r2 = chmod(lpath, mode & ~mask);
+    int r2 = chmod(lpath, mode & ~get_umask());
 
     return r1 ? : r2;
 }
@@ -869,11 +1266,29 @@ static char *add_slash_to_path(const char *path)
     }
 }
 
+static int sync_pull_stream(sync_stream* stream) {
+    sync_work* work = stream->work;
+    copyinfo* ci;
+
+    while ((ci = sync_work_next(work)) != nullptr) {
+        fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
+        if (sync_recv(stream->fd, stream->sbuf, ci->src, ci->dst, 0 /* no show progress */)) {
+            return 1;
+        }
+        if (work->copy_attrs && set_time_and_mode(ci->dst, ci->time, ci->mode)) {
+            return 1;
+        }
+        stream->count++;
+    }
+    return 0;
+}
+
 static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
                                  int copy_attrs)
 {
     copyinfo *filelist = 0;
     copyinfo *ci, *next;
+    sync_work work;
     int pulled = 0;
     int skipped = 0;
     char *rpath_clean = NULL;
@@ -907,23 +1322,20 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
     for (ci = filelist; ci != 0; ci = next) {
         next = ci->next;
         if (ci->flag == 0) {
-            fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
-            if (sync_recv(fd, ci->src, ci->dst, 0 /* no show progress */)) {
-                ret = -1;
-                goto finish;
-            }
-
-            if (copy_attrs && set_time_and_mode(ci->dst, ci->time, ci->mode)) {
-                ret = -1;
-                goto finish;
-            }
-            pulled++;
+            work.files.push_back(ci);
         } else {
             skipped++;
+            free(ci);
         }
-        free(ci);
     }
 
+    work.pipelined = false;
+    work.copy_attrs = copy_attrs;
+    if (copy_attrs) get_umask();
+    ret = sync_run_streams(fd, &work, sync_pull_stream, &pulled) ? -1 : 0;
+    for (copyinfo* f : work.files) free(f);
+    if (ret) goto finish;
+
     fprintf(stderr, "%d file%s pulled. %d file%s skipped.\n",
             pulled, (pulled == 1) ? "" : "s",
             skipped, (skipped == 1) ? "" : "s");
@@ -936,7 +1348,8 @@ finish:
 
 int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int copy_attrs)
 {
-    unsigned mode, time;
+    unsigned mode;
+    int64_t time;
     struct stat st;
 
     std::string error;
@@ -946,8 +1359,16 @@ int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int co
         return 1;
     }
 
-    if(sync_readtime(fd, rpath, &time, &mode)) {
-        return 1;
+    if (sync_has_feature(FEATURE_STAT_V2)) {
+        if (sync_stat_v2(fd, rpath, &mode, nullptr, &time)) {
+            return 1;
+        }
+    } else {
+        unsigned time32;
+        if(sync_readtime(fd, rpath, &time32, &mode)) {
+            return 1;
+        }
+        time = time32;
     }
     if(mode == 0) {
         fprintf(stderr,"remote object '%s' does not exist\n", rpath);
@@ -974,7 +1395,7 @@ int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int co
             }
         }
         BEGIN();
-        if (sync_recv(fd, rpath, lpath, show_progress)) {
+        if (sync_recv(fd, &send_buffer, rpath, lpath, show_progress)) {
             return 1;
         } else {
             if (copy_attrs && set_time_and_mode(lpath, time, mode))
@@ -1010,7 +1431,8 @@ int do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_o
     }
 
     BEGIN();
-    if (copy_local_dir_remote(fd, lpath.c_str(), rpath.c_str(), 1, list_only)) {
+    if (copy_local_dir_remote(fd, lpath.c_str(), rpath.c_str(), 1, list_only,
+                              sync_has_feature(FEATURE_SYNC_V2))) {
         return 1;
     } else {
         END();
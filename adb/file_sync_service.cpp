@@ -25,13 +25,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utime.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "adb.h"
 #include "adb_io.h"
+#include "adb_utils.h"
 #include "private/android_filesystem_config.h"
 
 static bool should_use_fs_config(const char* path) {
@@ -97,6 +104,90 @@ static int do_stat(int s, const char *path)
     return WriteFdExactly(s, &msg.stat, sizeof(msg.stat)) ? 0 : -1;
 }
 
+template <typename T>
+static void fill_stat_v2(T* msg, const struct stat& st)
+{
+    msg->error = 0;
+    msg->mode = st.st_mode;
+    msg->nlink = st.st_nlink;
+    msg->uid = st.st_uid;
+    msg->gid = st.st_gid;
+    msg->size = st.st_size;
+    msg->atime = st.st_atime;
+    msg->mtime = st.st_mtime;
+    msg->ctime = st.st_ctime;
+}
+
+static int do_stat_v2(int s, const char *path)
+{
+    syncmsg msg;
+    struct stat st;
+
+    memset(&msg.stat_v2, 0, sizeof(msg.stat_v2));
+    msg.stat_v2.id = ID_STAT_V2;
+
+    if(lstat(path, &st)) {
+        msg.stat_v2.error = errno;
+    } else {
+        fill_stat_v2(&msg.stat_v2, st);
+    }
+
+    return WriteFdExactly(s, &msg.stat_v2, sizeof(msg.stat_v2)) ? 0 : -1;
+}
+
+// Streams a DNT2 entry for everything below |path|, depth first, naming each
+// by its path relative to |path|, so that a client can compare a whole tree
+// with a single request. Symbolic links are reported, not followed.
+static int do_list_v2(int s, const char *path)
+{
+    syncmsg msg;
+    std::vector<std::string> pending;
+    pending.push_back("");
+
+    while(!pending.empty()) {
+        std::string dir = pending.back();
+        pending.pop_back();
+
+        std::string dir_path = std::string(path) + "/" + dir;
+        DIR *d = opendir(dir_path.c_str());
+        if(d == 0) continue;
+
+        struct dirent *de;
+        while((de = readdir(d))) {
+            const char *name = de->d_name;
+            if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+
+            std::string rel = dir + name;
+            if(rel.size() > SYNC_LIST_V2_NAME_MAX) continue;
+
+            struct stat st;
+            if(lstat((dir_path + name).c_str(), &st)) continue;
+
+            memset(&msg.dent_v2, 0, sizeof(msg.dent_v2));
+            msg.dent_v2.id = ID_DENT_V2;
+            fill_stat_v2(&msg.dent_v2, st);
+            msg.dent_v2.namelen = rel.size();
+
+            if(!WriteFdExactly(s, &msg.dent_v2, sizeof(msg.dent_v2)) ||
+               !WriteFdExactly(s, rel.data(), rel.size())) {
+                closedir(d);
+                return -1;
+            }
+
+            if(S_ISDIR(st.st_mode)) {
+                pending.push_back(rel + "/");
+            }
+        }
+        closedir(d);
+    }
+
+    memset(&msg.dent_v2, 0, sizeof(msg.dent_v2));
+    msg.dent_v2.id = ID_DONE;
+    return WriteFdExactly(s, &msg.dent_v2, sizeof(msg.dent_v2)) ? 0 : -1;
+}
+
 static int do_list(int s, const char *path)
 {
     DIR *d;
@@ -179,6 +270,9 @@ static int handle_send_file(int s, char *path, uid_t uid,
     syncmsg msg;
     unsigned int timestamp = 0;
     int fd;
+    // Clients may pipeline SENDs (FEATURE_SYNC_V2), so each one must get
+    // exactly one status reply: once a FAIL has gone out, don't send OKAY.
+    bool failed = false;
 
     fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
     if(fd < 0 && errno == ENOENT) {
@@ -200,6 +294,7 @@ static int handle_send_file(int s, char *path, uid_t uid,
     } else {
         if(fchown(fd, uid, gid) != 0) {
             fail_errno(s);
+            failed = true;
             errno = 0;
         }
 
@@ -217,7 +312,7 @@ static int handle_send_file(int s, char *path, uid_t uid,
         if(!ReadFdExactly(s, &msg.data, sizeof(msg.data)))
             goto fail;
 
-        if(msg.data.id != ID_DATA) {
+        if(msg.data.id != ID_DATA && msg.data.id != ID_DATA_Z) {
             if(msg.data.id == ID_DONE) {
                 timestamp = ltohl(msg.data.size);
                 break;
@@ -230,8 +325,21 @@ static int handle_send_file(int s, char *path, uid_t uid,
             fail_message(s, "oversize data message");
             goto fail;
         }
-        if(!ReadFdExactly(s, buffer, len))
+        if(msg.data.id == ID_DATA_Z) {
+            // Inflate from the scratch half of the buffer into the front.
+            char* zbuffer = buffer + SYNC_DATA_MAX;
+            if(!ReadFdExactly(s, zbuffer, len))
+                goto fail;
+            uLongf raw_len = SYNC_DATA_MAX;
+            if(uncompress(reinterpret_cast<Bytef*>(buffer), &raw_len,
+                          reinterpret_cast<Bytef*>(zbuffer), len) != Z_OK) {
+                fail_message(s, "corrupt compressed data message");
+                goto fail;
+            }
+            len = raw_len;
+        } else if(!ReadFdExactly(s, buffer, len)) {
             goto fail;
+        }
 
         if(fd < 0)
             continue;
@@ -253,10 +361,12 @@ static int handle_send_file(int s, char *path, uid_t uid,
         u.modtime = timestamp;
         utime(path, &u);
 
-        msg.status.id = ID_OKAY;
-        msg.status.msglen = 0;
-        if(!WriteFdExactly(s, &msg.status, sizeof(msg.status)))
-            return -1;
+        if(!failed) {
+            msg.status.id = ID_OKAY;
+            msg.status.msglen = 0;
+            if(!WriteFdExactly(s, &msg.status, sizeof(msg.status)))
+                return -1;
+        }
     }
     return 0;
 
@@ -371,10 +481,60 @@ static int do_send(int s, char *path, char *buffer)
     return handle_send_file(s, path, uid, gid, mode, buffer, do_unlink);
 }
 
-static int do_recv(int s, const char *path, char *buffer)
+// Deflates |len| bytes of |buffer| into its scratch half. Returns the
+// compressed size, or 0 if the chunk didn't shrink.
+static unsigned deflate_chunk(char* buffer, unsigned len)
+{
+    uLongf z_len = len - 1;
+    if(compress2(reinterpret_cast<Bytef*>(buffer + SYNC_DATA_MAX), &z_len,
+                 reinterpret_cast<Bytef*>(buffer), len, SYNC_DEFLATE_LEVEL) != Z_OK) {
+        return 0;
+    }
+    return z_len;
+}
+
+// Sends the first |size| bytes of |fd| as DATA chunks, letting the kernel
+// copy the file straight into the socket. Each chunk's header promises its
+// length before any data goes out, so a file that shrinks underneath us
+// can only be reported by dropping the connection. Returns -1 on failure.
+static int send_file_data(int s, int fd, off_t size, char *buffer)
+{
+    bool use_sendfile = true;
+
+    while(size > 0) {
+        size_t len = std::min(size, static_cast<off_t>(SYNC_DATA_MAX));
+        syncmsg msg;
+        msg.data.id = ID_DATA;
+        msg.data.size = htoll(len);
+        if(!WriteFdExactly(s, &msg.data, sizeof(msg.data))) return -1;
+        size -= len;
+
+        while(len > 0 && use_sendfile) {
+            ssize_t r = TEMP_FAILURE_RETRY(sendfile(s, fd, NULL, len));
+            if(r > 0) {
+                len -= r;
+            } else if(r == -1 && errno == EAGAIN) {
+                adb_sleep_ms(1);
+            } else if(r == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                // This kernel can't sendfile() to this kind of fd.
+                use_sendfile = false;
+            } else {
+                return -1;
+            }
+        }
+        if(len > 0 && (!ReadFdExactly(fd, buffer, len) ||
+                       !WriteFdExactly(s, buffer, len))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int do_recv(int s, const char *path, char *buffer, bool deflate)
 {
     syncmsg msg;
     int fd, r;
+    bool first_chunk = true;
 
     fd = adb_open(path, O_RDONLY | O_CLOEXEC);
     if(fd < 0) {
@@ -382,7 +542,20 @@ static int do_recv(int s, const char *path, char *buffer)
         return 0;
     }
 
-    msg.data.id = ID_DATA;
+    if(deflate && is_compressed_file_name(path)) {
+        deflate = false;
+    }
+
+    // Uncompressed regular files don't need to pass through |buffer|. Any
+    // data appended after the fstat() is picked up by the loop below.
+    struct stat st;
+    if(!deflate && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if(send_file_data(s, fd, st.st_size, buffer) != 0) {
+            adb_close(fd);
+            return -1;
+        }
+    }
+
     for(;;) {
         r = adb_read(fd, buffer, SYNC_DATA_MAX);
         if(r <= 0) {
@@ -392,9 +565,23 @@ static int do_recv(int s, const char *path, char *buffer)
             adb_close(fd);
             return r;
         }
+        unsigned z_len = deflate ? deflate_chunk(buffer, r) : 0;
+        if(first_chunk && !SYNC_DEFLATE_WORTHWHILE(static_cast<unsigned>(r), z_len)) {
+            // Judging by its start, this file isn't worth the CPU time.
+            deflate = false;
+        }
+        first_chunk = false;
+
+        const char* payload = buffer;
+        msg.data.id = ID_DATA;
         msg.data.size = htoll(r);
+        if(z_len != 0) {
+            payload = buffer + SYNC_DATA_MAX;
+            msg.data.id = ID_DATA_Z;
+            msg.data.size = htoll(z_len);
+        }
         if(!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
-           !WriteFdExactly(s, buffer, r)) {
+           !WriteFdExactly(s, payload, ltohl(msg.data.size))) {
             adb_close(fd);
             return -1;
         }
@@ -411,13 +598,28 @@ static int do_recv(int s, const char *path, char *buffer)
     return 0;
 }
 
+static const char* sync_trace_name(unsigned id)
+{
+    switch (id) {
+    case ID_STAT: return "sync STAT";
+    case ID_LIST: return "sync LIST";
+    case ID_STAT_V2: return "sync STAT2";
+    case ID_LIST_V2: return "sync LIST2";
+    case ID_SEND: return "sync SEND";
+    case ID_RECV: return "sync RECV";
+    case ID_RECV_Z: return "sync RECV_Z";
+    default: return "sync";
+    }
+}
+
 void file_sync_service(int fd, void *cookie)
 {
     syncmsg msg;
     char name[1025];
     unsigned namelen;
 
-    char *buffer = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX));
+    // The second half is scratch space for compressed DATZ chunks.
+    char *buffer = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX * 2));
     if(buffer == 0) goto fail;
 
     for(;;) {
@@ -441,6 +643,7 @@ void file_sync_service(int fd, void *cookie)
         msg.req.namelen = 0;
         D("sync: '%s' '%s'\n", (char*) &msg.req, name);
 
+        DAEMON_TRACE_SCOPE(sync_trace_name(msg.req.id));
         switch(msg.req.id) {
         case ID_STAT:
             if(do_stat(fd, name)) goto fail;
@@ -448,11 +651,20 @@ void file_sync_service(int fd, void *cookie)
         case ID_LIST:
             if(do_list(fd, name)) goto fail;
             break;
+        case ID_STAT_V2:
+            if(do_stat_v2(fd, name)) goto fail;
+            break;
+        case ID_LIST_V2:
+            if(do_list_v2(fd, name)) goto fail;
+            break;
         case ID_SEND:
             if(do_send(fd, name, buffer)) goto fail;
             break;
         case ID_RECV:
-            if(do_recv(fd, name, buffer)) goto fail;
+            if(do_recv(fd, name, buffer, false)) goto fail;
+            break;
+        case ID_RECV_Z:
+            if(do_recv(fd, name, buffer, true)) goto fail;
             break;
         case ID_QUIT:
             goto fail;
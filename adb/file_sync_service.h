@@ -17,6 +17,8 @@
 #ifndef _FILE_SYNC_SERVICE_H_
 #define _FILE_SYNC_SERVICE_H_
 
+#include <stdint.h>
+
 #include <string>
 
 #define htoll(x) (x)
@@ -35,6 +37,11 @@
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_STAT_V2 MKID('S','T','A','2')
+#define ID_LIST_V2 MKID('L','S','T','2')
+#define ID_DENT_V2 MKID('D','N','T','2')
+#define ID_RECV_Z MKID('R','C','V','Z')
+#define ID_DATA_Z MKID('D','A','T','Z')
 
 union syncmsg {
     unsigned id;
@@ -55,6 +62,34 @@ union syncmsg {
         unsigned time;
         unsigned namelen;
     } dent;
+    // STA2 and LST2 (FEATURE_STAT_V2) report full 64-bit sizes and times.
+    // The 32-bit fields come first so that no ABI inserts padding.
+    struct {
+        uint32_t id;
+        uint32_t error;  // errno from lstat(2), or 0.
+        uint32_t mode;
+        uint32_t nlink;
+        uint32_t uid;
+        uint32_t gid;
+        uint64_t size;
+        int64_t atime;
+        int64_t mtime;
+        int64_t ctime;
+    } stat_v2;
+    struct {
+        uint32_t id;
+        uint32_t error;
+        uint32_t mode;
+        uint32_t nlink;
+        uint32_t uid;
+        uint32_t gid;
+        uint32_t namelen;
+        uint32_t reserved;
+        uint64_t size;
+        int64_t atime;
+        int64_t mtime;
+        int64_t ctime;
+    } dent_v2;
     struct {
         unsigned id;
         unsigned size;
@@ -74,4 +109,15 @@ int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int pu
 
 #define SYNC_DATA_MAX (64*1024)
 
+// The longest path, relative to the LST2 root, that a DNT2 entry may carry.
+#define SYNC_LIST_V2_NAME_MAX 1024
+
+// DATZ chunks are compressed at this zlib level: on a USB link the cost of
+// anything slower than Z_BEST_SPEED outweighs the bytes it saves.
+#define SYNC_DEFLATE_LEVEL 1
+
+// A file whose first chunk doesn't deflate to less than 7/8 of its size is
+// sent uncompressed from then on.
+#define SYNC_DEFLATE_WORTHWHILE(raw, z) ((z) < (raw) - (raw) / 8)
+
 #endif
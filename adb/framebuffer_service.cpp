@@ -26,10 +26,16 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
+#include <zlib.h>
+
 #include "sysdeps.h"
 
 #include "adb.h"
 #include "adb_io.h"
+#include "adb_utils.h"
 #include "fdevent.h"
 
 /* TODO:
@@ -54,20 +60,103 @@ struct fbinfo {
     unsigned int alpha_length;
 } __attribute__((packed));
 
-void framebuffer_service(int fd, void *cookie)
+/* Fills in |fbinfo| for a |w| x |h| screencap image in pixel format |f|.
+** Returns false for formats we don't know how to describe.
+*/
+static bool fill_fbinfo(struct fbinfo* fbinfo, int w, int h, int f)
+{
+    fbinfo->version = DDMS_RAWIMAGE_VERSION;
+    /* see hardware/hardware.h */
+    switch (f) {
+        case 1: /* RGBA_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
+            break;
+        case 2: /* RGBX_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
+            break;
+        case 3: /* RGB_888 */
+            fbinfo->bpp = 24;
+            fbinfo->size = w * h * 3;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
+            break;
+        case 4: /* RGB_565 */
+            fbinfo->bpp = 16;
+            fbinfo->size = w * h * 2;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 11;
+            fbinfo->red_length = 5;
+            fbinfo->green_offset = 5;
+            fbinfo->green_length = 6;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 5;
+            fbinfo->alpha_offset = 0;
+            fbinfo->alpha_length = 0;
+            break;
+        case 5: /* BGRA_8888 */
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 16;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
+           break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/* Starts screencap writing a raw image to the pipe returned in |fd|. */
+static pid_t spawn_screencap(int* fd)
 {
-    struct fbinfo fbinfo;
-    unsigned int i, bsize;
-    char buf[640];
-    int fd_screencap;
-    int w, h, f;
     int fds[2];
-    pid_t pid;
 
-    if (pipe2(fds, O_CLOEXEC) < 0) goto pipefail;
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
 
-    pid = fork();
-    if (pid < 0) goto done;
+    pid_t pid = fork();
+    if (pid < 0) {
+        adb_close(fds[0]);
+        adb_close(fds[1]);
+        return -1;
+    }
 
     if (pid == 0) {
         dup2(fds[1], STDOUT_FILENO);
@@ -80,89 +169,33 @@ void framebuffer_service(int fd, void *cookie)
     }
 
     adb_close(fds[1]);
-    fd_screencap = fds[0];
+    *fd = fds[0];
+    return pid;
+}
 
-    /* read w, h & format */
-    if(!ReadFdExactly(fd_screencap, &w, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &h, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &f, 4)) goto done;
+/* Reads screencap's w, h & format and fills in |fbinfo| from them. */
+static bool read_screencap_header(int fd_screencap, struct fbinfo* fbinfo)
+{
+    int w, h, f;
 
-    fbinfo.version = DDMS_RAWIMAGE_VERSION;
-    /* see hardware/hardware.h */
-    switch (f) {
-        case 1: /* RGBA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
-            break;
-        case 2: /* RGBX_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
-            break;
-        case 3: /* RGB_888 */
-            fbinfo.bpp = 24;
-            fbinfo.size = w * h * 3;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
-            break;
-        case 4: /* RGB_565 */
-            fbinfo.bpp = 16;
-            fbinfo.size = w * h * 2;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 11;
-            fbinfo.red_length = 5;
-            fbinfo.green_offset = 5;
-            fbinfo.green_length = 6;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 5;
-            fbinfo.alpha_offset = 0;
-            fbinfo.alpha_length = 0;
-            break;
-        case 5: /* BGRA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 16;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
-           break;
-        default:
-            goto done;
-    }
+    if(!ReadFdExactly(fd_screencap, &w, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &h, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &f, 4)) return false;
+    return fill_fbinfo(fbinfo, w, h, f);
+}
+
+void framebuffer_service(int fd, void *cookie)
+{
+    struct fbinfo fbinfo;
+    unsigned int i, bsize;
+    char buf[640];
+    int fd_screencap;
+    pid_t pid;
+
+    pid = spawn_screencap(&fd_screencap);
+    if (pid < 0) goto pipefail;
+
+    if(!read_screencap_header(fd_screencap, &fbinfo)) goto done;
 
     /* write header */
     if(!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) goto done;
@@ -177,9 +210,148 @@ void framebuffer_service(int fd, void *cookie)
     }
 
 done:
-    adb_close(fds[0]);
+    adb_close(fd_screencap);
 
     TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
 pipefail:
     adb_close(fd);
 }
+
+/* framebuffer-stream: sends the fbinfo header once, then one fbframe per
+** capture. Each frame carries only the FB_STREAM_TILE-pixel tiles that
+** changed since the last one, each deflated on its own; the first frame
+** carries every tile. See SERVICES.TXT.
+*/
+#define FB_STREAM_TILE 64
+#define FB_STREAM_FPS_MAX 30
+
+struct fbframe {
+    unsigned int tiles;
+    unsigned int size;  /* bytes of tile data that follow */
+} __attribute__((packed));
+
+struct fbtile {
+    unsigned short x;
+    unsigned short y;
+    unsigned short width;
+    unsigned short height;
+    unsigned int size;  /* deflated bytes that follow */
+} __attribute__((packed));
+
+static bool capture_frame(struct fbinfo* fbinfo, std::vector<unsigned char>* pixels)
+{
+    int fd_screencap;
+    pid_t pid = spawn_screencap(&fd_screencap);
+    if (pid < 0) return false;
+
+    bool ok = read_screencap_header(fd_screencap, fbinfo);
+    if (ok) {
+        pixels->resize(fbinfo->size);
+        ok = ReadFdExactly(fd_screencap, pixels->data(), pixels->size());
+    }
+
+    adb_close(fd_screencap);
+    TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+    return ok;
+}
+
+/* Appends the tile at |x|,|y| to |out| if it differs from |prev|, counting
+** it in |tiles|. Returns false if it changed but couldn't be compressed: the
+** client would never get it, since the next frame is only compared against
+** this one.
+*/
+static bool append_tile(const struct fbinfo& fbinfo,
+                        const std::vector<unsigned char>& cur,
+                        const std::vector<unsigned char>& prev,
+                        unsigned int x, unsigned int y,
+                        std::vector<unsigned char>* raw,
+                        std::vector<unsigned char>* out,
+                        unsigned int* tiles)
+{
+    unsigned int bytes_per_pixel = fbinfo.bpp / 8;
+    unsigned int stride = fbinfo.width * bytes_per_pixel;
+    unsigned int width = std::min(FB_STREAM_TILE, static_cast<int>(fbinfo.width - x));
+    unsigned int height = std::min(FB_STREAM_TILE, static_cast<int>(fbinfo.height - y));
+    unsigned int row_bytes = width * bytes_per_pixel;
+
+    bool changed = prev.empty();
+    for (unsigned int row = 0; row < height && !changed; row++) {
+        size_t offset = (y + row) * stride + x * bytes_per_pixel;
+        changed = memcmp(&cur[offset], &prev[offset], row_bytes) != 0;
+    }
+    if (!changed) return true;
+
+    raw->resize(row_bytes * height);
+    for (unsigned int row = 0; row < height; row++) {
+        size_t offset = (y + row) * stride + x * bytes_per_pixel;
+        memcpy(&(*raw)[row * row_bytes], &cur[offset], row_bytes);
+    }
+
+    uLongf z_len = compressBound(raw->size());
+    size_t start = out->size();
+    out->resize(start + sizeof(fbtile) + z_len);
+    if (compress2(&(*out)[start + sizeof(fbtile)], &z_len,
+                  raw->data(), raw->size(), Z_BEST_SPEED) != Z_OK) {
+        out->resize(start);
+        return false;
+    }
+    out->resize(start + sizeof(fbtile) + z_len);
+
+    struct fbtile tile;
+    tile.x = x;
+    tile.y = y;
+    tile.width = width;
+    tile.height = height;
+    tile.size = z_len;
+    memcpy(&(*out)[start], &tile, sizeof(tile));
+    (*tiles)++;
+    return true;
+}
+
+void framebuffer_stream_service(int fd, void *cookie)
+{
+    int fps = static_cast<int>(reinterpret_cast<uintptr_t>(cookie));
+    if (fps <= 0) fps = 1;
+    if (fps > FB_STREAM_FPS_MAX) fps = FB_STREAM_FPS_MAX;
+    const uint64_t interval_ns = 1000000000ULL / fps;
+
+    struct fbinfo first;
+    std::vector<unsigned char> cur, prev, raw, out;
+
+    for (;;) {
+        uint64_t start = adb_monotonic_ns();
+
+        struct fbinfo fbinfo;
+        if (!capture_frame(&fbinfo, &cur)) break;
+        if (prev.empty()) {
+            first = fbinfo;
+            if (!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) break;
+        } else if (memcmp(&first, &fbinfo, sizeof(fbinfo)) != 0) {
+            /* The display changed shape; the client has to start over. */
+            break;
+        }
+
+        struct fbframe frame = {};
+        out.clear();
+        bool ok = true;
+        for (unsigned int y = 0; ok && y < fbinfo.height; y += FB_STREAM_TILE) {
+            for (unsigned int x = 0; ok && x < fbinfo.width; x += FB_STREAM_TILE) {
+                ok = append_tile(fbinfo, cur, prev, x, y, &raw, &out, &frame.tiles);
+            }
+        }
+        if (!ok) break;
+        frame.size = out.size();
+        if (!WriteFdExactly(fd, &frame, sizeof(frame)) ||
+            !WriteFdExactly(fd, out.data(), out.size())) {
+            break;
+        }
+        prev.swap(cur);
+
+        uint64_t elapsed = adb_monotonic_ns() - start;
+        if (elapsed < interval_ns) {
+            adb_sleep_ms((interval_ns - elapsed) / 1000000);
+        }
+    }
+
+    adb_close(fd);
+}
@@ -25,6 +25,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <unordered_map>
+
 #include "adb.h"
 
 /* here's how these things work.
@@ -137,8 +139,13 @@ struct JdwpProcess {
 
 static JdwpProcess  _jdwp_list;
 
+/* the processes of _jdwp_list whose pid is known, by pid */
+static std::unordered_map<int, JdwpProcess*>  _jdwp_pids;
+
+/* lists the known pids, each as a "+<pid>\n" line if deltas, as
+ * "track-jdwp-delta" reports additions */
 static int
-jdwp_process_list( char*  buffer, int  bufferlen )
+jdwp_process_list( char*  buffer, int  bufferlen, bool  deltas = false )
 {
     char*         end  = buffer + bufferlen;
     char*         p    = buffer;
@@ -151,7 +158,7 @@ jdwp_process_list( char*  buffer, int  bufferlen )
         if (proc->pid < 0)
             continue;
 
-        len = snprintf(p, end-p, "%d\n", proc->pid);
+        len = snprintf(p, end-p, deltas ? "+%d\n" : "%d\n", proc->pid);
         if (p + len >= end)
             break;
         p += len;
@@ -162,17 +169,22 @@ jdwp_process_list( char*  buffer, int  bufferlen )
 
 
 static int
-jdwp_process_list_msg( char*  buffer, int  bufferlen )
+jdwp_process_list_msg( char*  buffer, int  bufferlen, bool  deltas = false )
 {
     char  head[5];
-    int   len = jdwp_process_list( buffer+4, bufferlen-4 );
+    int   len;
+
+    /* the length must fit in its 4 hex digits */
+    if (bufferlen > 0xffff + 4)
+        bufferlen = 0xffff + 4;
+    len = jdwp_process_list( buffer+4, bufferlen-4, deltas );
     snprintf(head, sizeof head, "%04x", len);
     memcpy(buffer, head, 4);
     return len + 4;
 }
 
 
-static void  jdwp_process_list_updated(void);
+static void  jdwp_process_list_updated(char  op, int  pid);
 
 static void
 jdwp_process_free( JdwpProcess*  proc )
@@ -180,9 +192,18 @@ jdwp_process_free( JdwpProcess*  proc )
     if (proc) {
         int  n;
 
+        int  pid = proc->pid;
+
         proc->prev->next = proc->next;
         proc->next->prev = proc->prev;
 
+        /* a process that reconnected with the same pid replaced it */
+        if (pid >= 0) {
+            auto  it = _jdwp_pids.find(pid);
+            if (it != _jdwp_pids.end() && it->second == proc)
+                _jdwp_pids.erase(it);
+        }
+
         if (proc->socket >= 0) {
             adb_shutdown(proc->socket);
             adb_close(proc->socket);
@@ -202,7 +223,8 @@ jdwp_process_free( JdwpProcess*  proc )
 
         free(proc);
 
-        jdwp_process_list_updated();
+        if (pid >= 0)
+            jdwp_process_list_updated('-', pid);
     }
 }
 
@@ -294,7 +316,8 @@ jdwp_process_event( int  socket, unsigned  events, void*  _proc )
 
             /* all is well, keep reading to detect connection closure */
             D("Adding pid %d to jdwp process list\n", proc->pid);
-            jdwp_process_list_updated();
+            _jdwp_pids[proc->pid] = proc;
+            jdwp_process_list_updated('+', proc->pid);
         }
         else
         {
@@ -409,40 +432,35 @@ jdwp_process_event( int  socket, unsigned  events, void*  _proc )
 int
 create_jdwp_connection_fd(int  pid)
 {
-    JdwpProcess*  proc = _jdwp_list.next;
+    JdwpProcess*  proc;
+    int           fds[2];
 
     D("looking for pid %d in JDWP process list\n", pid);
-    for ( ; proc != &_jdwp_list; proc = proc->next ) {
-        if (proc->pid == pid) {
-            goto FoundIt;
-        }
+    auto  it = _jdwp_pids.find(pid);
+    if (it == _jdwp_pids.end()) {
+        D("search failed !!\n");
+        return -1;
     }
-    D("search failed !!\n");
-    return -1;
-
-FoundIt:
-    {
-        int  fds[2];
+    proc = it->second;
 
-        if (proc->out_count >= MAX_OUT_FDS) {
-            D("%s: too many pending JDWP connection for pid %d\n",
-              __FUNCTION__, pid);
-            return -1;
-        }
+    if (proc->out_count >= MAX_OUT_FDS) {
+        D("%s: too many pending JDWP connection for pid %d\n",
+          __FUNCTION__, pid);
+        return -1;
+    }
 
-        if (adb_socketpair(fds) < 0) {
-            D("%s: socket pair creation failed: %s\n",
-              __FUNCTION__, strerror(errno));
-            return -1;
-        }
-        D("socketpair: (%d,%d)", fds[0], fds[1]);
+    if (adb_socketpair(fds) < 0) {
+        D("%s: socket pair creation failed: %s\n",
+          __FUNCTION__, strerror(errno));
+        return -1;
+    }
+    D("socketpair: (%d,%d)", fds[0], fds[1]);
 
-        proc->out_fds[ proc->out_count ] = fds[1];
-        if (++proc->out_count == 1)
-            fdevent_add( proc->fde, FDE_WRITE );
+    proc->out_fds[ proc->out_count ] = fds[1];
+    if (++proc->out_count == 1)
+        fdevent_add( proc->fde, FDE_WRITE );
 
-        return fds[0];
-    }
+    return fds[0];
 }
 
 /**  VM DEBUG CONTROL SOCKET
@@ -608,7 +626,7 @@ jdwp_socket_ready( asocket*  s )
     */
     if (jdwp->pass == 0) {
         apacket*  p = get_apacket();
-        p->len = jdwp_process_list((char*)p->data, MAX_PAYLOAD);
+        p->len = jdwp_process_list((char*)p->data, s->get_max_payload());
         peer->enqueue(peer, p);
         jdwp->pass = 1;
     }
@@ -635,9 +653,9 @@ create_jdwp_service_socket( void )
     return &s->socket;
 }
 
-/** "track-jdwp" local service implementation
- ** this periodically sends the list of known JDWP process pids
- ** to the client...
+/** "track-jdwp" and "track-jdwp-delta" local service implementation
+ ** these send the list of known JDWP process pids to the client each
+ ** time it changes, either all of it or only what changed
  **/
 
 struct JdwpTracker {
@@ -645,25 +663,39 @@ struct JdwpTracker {
     JdwpTracker*  next;
     JdwpTracker*  prev;
     int           need_update;
+    bool          deltas;
 };
 
 static JdwpTracker   _jdwp_trackers_list;
 
 
+/* op is '+' when pid was added to the list, '-' when it was removed */
 static void
-jdwp_process_list_updated(void)
+jdwp_process_list_updated(char  op, int  pid)
 {
-    char             buffer[1024];
-    int              len;
+    char             line[16];
+    char             delta[24];
+    int              delta_len;
     JdwpTracker*  t = _jdwp_trackers_list.next;
 
-    len = jdwp_process_list_msg(buffer, sizeof(buffer));
+    snprintf(line, sizeof line, "%c%d\n", op, pid);
+    delta_len = snprintf(delta, sizeof delta, "%04zx%s", strlen(line), line);
 
     for ( ; t != &_jdwp_trackers_list; t = t->next ) {
-        apacket*  p    = get_apacket();
+        apacket*  p;
         asocket*  peer = t->socket.peer;
-        memcpy(p->data, buffer, len);
-        p->len = len;
+
+        /* the whole list is still to be sent, with this change in it */
+        if (t->deltas && t->need_update)
+            continue;
+
+        p = get_apacket();
+        if (t->deltas) {
+            memcpy(p->data, delta, delta_len);
+            p->len = delta_len;
+        } else {
+            p->len = jdwp_process_list_msg((char*)p->data, t->socket.get_max_payload());
+        }
         peer->enqueue( peer, p );
     }
 }
@@ -695,7 +727,9 @@ jdwp_tracker_ready( asocket*  s )
     if (t->need_update) {
         apacket*  p = get_apacket();
         t->need_update = 0;
-        p->len = jdwp_process_list_msg((char*)p->data, sizeof(p->data));
+        /* all of the list, as additions for a "track-jdwp-delta" client */
+        p->len = jdwp_process_list_msg((char*)p->data, s->get_max_payload(),
+                                       t->deltas);
         s->peer->enqueue(s->peer, p);
     }
 }
@@ -711,7 +745,7 @@ jdwp_tracker_enqueue( asocket*  s, apacket*  p )
 
 
 asocket*
-create_jdwp_tracker_service_socket( void )
+create_jdwp_tracker_service_socket( bool  deltas )
 {
     JdwpTracker* t = reinterpret_cast<JdwpTracker*>(calloc(sizeof(*t), 1));
 
@@ -730,6 +764,7 @@ create_jdwp_tracker_service_socket( void )
     t->socket.enqueue = jdwp_tracker_enqueue;
     t->socket.close   = jdwp_tracker_close;
     t->need_update    = 1;
+    t->deltas         = deltas;
 
     return &t->socket;
 }
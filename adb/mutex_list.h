@@ -12,6 +12,7 @@ ADB_MUTEX(transport_lock)
 ADB_MUTEX(local_transports_lock)
 #endif
 ADB_MUTEX(usb_lock)
+ADB_MUTEX(apacket_pool_lock)
 
 // Sadly logging to /data/adb/adb-... is not thread safe.
 //  After modifying adb.h::D() to count invocations:
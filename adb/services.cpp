@@ -31,6 +31,11 @@
 #include <unistd.h>
 #endif
 
+#if !ADB_HOST
+#include <poll.h>
+#include <signal.h>
+#endif
+
 #include <base/file.h>
 #include <base/stringprintf.h>
 #include <base/strings.h>
@@ -44,6 +49,7 @@
 #include "adb_io.h"
 #include "file_sync_service.h"
 #include "remount_service.h"
+#include "shell_session.h"
 #include "transport.h"
 
 struct stinfo {
@@ -392,6 +398,22 @@ static void subproc_waiter_service(int fd, void *cookie)
     }
 }
 
+// Returns the shell to run commands with. |value| must have room for
+// PROPERTY_VALUE_MAX bytes; the result may point into it.
+static const char* get_shell_command(char* value)
+{
+    struct stat st;
+
+    property_get("persist.sys.adb.shell", value, "");
+    if (value[0] != '\0' && stat(value, &st) == 0) {
+        return value;
+    }
+    else if (stat(ALTERNATE_SHELL_COMMAND, &st) == 0) {
+        return ALTERNATE_SHELL_COMMAND;
+    }
+    return SHELL_COMMAND;
+}
+
 static int create_subproc_thread(const char *name, const subproc_mode mode)
 {
     adb_thread_t t;
@@ -399,7 +421,6 @@ static int create_subproc_thread(const char *name, const subproc_mode mode)
     pid_t pid = -1;
 
     const char* shell_command;
-    struct stat st;
 
     const char *arg0, *arg1;
     if (name == 0 || *name == 0) {
@@ -409,16 +430,7 @@ static int create_subproc_thread(const char *name, const subproc_mode mode)
     }
 
     char value[PROPERTY_VALUE_MAX];
-    property_get("persist.sys.adb.shell", value, "");
-    if (value[0] != '\0' && stat(value, &st) == 0) {
-        shell_command = value;
-    }
-    else if (stat(ALTERNATE_SHELL_COMMAND, &st) == 0) {
-        shell_command = ALTERNATE_SHELL_COMMAND;
-    }
-    else {
-        shell_command = SHELL_COMMAND;
-    }
+    shell_command = get_shell_command(value);
 
     switch (mode) {
     case SUBPROC_PTY:
@@ -449,6 +461,171 @@ static int create_subproc_thread(const char *name, const subproc_mode mode)
     D("service thread started, fd=%d pid=%d\n", ret_fd, pid);
     return ret_fd;
 }
+
+static bool shell_session_send(int fd, uint32_t id, const void* data, uint32_t length)
+{
+    shell_session_header header;
+    header.id = id;
+    header.length = length;
+    return WriteFdExactly(fd, &header, sizeof(header)) &&
+           WriteFdExactly(fd, data, length);
+}
+
+// Forwards one read from |from| as an |id| message. Returns false at EOF.
+static bool shell_session_forward(int fd, int* from, uint32_t id, char* buffer)
+{
+    int r = adb_read(*from, buffer, SHELL_SESSION_DATA_MAX);
+    if (r > 0) {
+        return shell_session_send(fd, id, buffer, r);
+    }
+    if (r < 0 && errno == EINTR) return true;
+    adb_close(*from);
+    *from = -1;
+    return false;
+}
+
+// Runs |command| with pipes for stdin, stdout and stderr, relaying them to
+// and from the client until the command exits and its output is drained.
+// Returns -1 if the session can't continue.
+static int shell_session_run(int fd, const char* shell, const char* command, char* buffer)
+{
+    int in[2], out[2], err[2];
+    if (pipe2(in, O_CLOEXEC) < 0) return -1;
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        adb_close(in[0]); adb_close(in[1]);
+        return -1;
+    }
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        adb_close(in[0]); adb_close(in[1]);
+        adb_close(out[0]); adb_close(out[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        init_subproc_child();
+
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+
+        execl(shell, shell, "-c", command, NULL);
+        fprintf(stderr, "- exec '%s' failed: %s (%d) -\n",
+                shell, strerror(errno), errno);
+        exit(-1);
+    }
+
+    adb_close(in[0]);
+    adb_close(out[1]);
+    adb_close(err[1]);
+    int stdin_fd = in[1], stdout_fd = out[0], stderr_fd = err[0];
+    int result = (pid < 0) ? -1 : 0;
+
+    // stdin is written as the command reads it, so that a command busy
+    // writing output it can't get rid of never blocks us. Until it has taken
+    // the last of it, nothing more is read from the client.
+    fcntl(stdin_fd, F_SETFL, O_NONBLOCK);
+    std::string pending;
+
+    while (result == 0 && (stdout_fd >= 0 || stderr_fd >= 0)) {
+        pollfd pfds[4] = {
+            { .fd = pending.empty() ? fd : -1, .events = POLLIN },
+            { .fd = stdout_fd, .events = POLLIN },
+            { .fd = stderr_fd, .events = POLLIN },
+            { .fd = pending.empty() ? -1 : stdin_fd, .events = POLLOUT },
+        };
+        if (TEMP_FAILURE_RETRY(poll(pfds, 4, -1)) < 0) {
+            result = -1;
+            break;
+        }
+
+        if (pfds[3].revents) {
+            int r = adb_write(stdin_fd, pending.data(), pending.size());
+            if (r > 0) {
+                pending.erase(0, r);
+            } else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+                // Input for a command that has stopped reading is dropped.
+                adb_close(stdin_fd);
+                stdin_fd = -1;
+                pending.clear();
+            }
+        }
+        if (pfds[1].revents) {
+            shell_session_forward(fd, &stdout_fd, ID_SHELL_STDOUT, buffer);
+        }
+        if (pfds[2].revents) {
+            shell_session_forward(fd, &stderr_fd, ID_SHELL_STDERR, buffer);
+        }
+        if (pfds[0].revents) {
+            shell_session_header header;
+            if (!ReadFdExactly(fd, &header, sizeof(header)) ||
+                header.length > SHELL_SESSION_DATA_MAX ||
+                !ReadFdExactly(fd, buffer, header.length)) {
+                result = -1;
+            } else if (header.id == ID_SHELL_STDIN) {
+                if (stdin_fd >= 0) pending.assign(buffer, header.length);
+            } else if (header.id == ID_SHELL_CLOSE_STDIN) {
+                if (stdin_fd >= 0) adb_close(stdin_fd);
+                stdin_fd = -1;
+            } else {
+                D("shell-session: unexpected message %08x\n", header.id);
+                result = -1;
+            }
+        }
+    }
+
+    if (stdin_fd >= 0) adb_close(stdin_fd);
+    if (stdout_fd >= 0) adb_close(stdout_fd);
+    if (stderr_fd >= 0) adb_close(stderr_fd);
+    if (pid < 0) return -1;
+
+    // If the client went away, don't wait for a command that may never exit.
+    if (result != 0) kill(pid, SIGKILL);
+
+    int status;
+    if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid) return -1;
+    if (result != 0) return -1;
+
+    uint32_t code = 0;
+    if (WIFEXITED(status)) {
+        code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        code = 128 + WTERMSIG(status);
+    }
+    return shell_session_send(fd, ID_SHELL_EXIT, &code, sizeof(code)) ? 0 : -1;
+}
+
+// "shell-session:" runs each command line the client sends, one at a time,
+// without setting up a new stream and pty for each of them.
+static void shell_session_service(int fd, void* cookie)
+{
+    char value[PROPERTY_VALUE_MAX];
+    const char* shell = get_shell_command(value);
+
+    char* buffer = reinterpret_cast<char*>(malloc(SHELL_SESSION_DATA_MAX + 1));
+    if (buffer == nullptr) {
+        adb_close(fd);
+        return;
+    }
+
+    for (;;) {
+        shell_session_header header;
+        if (!ReadFdExactly(fd, &header, sizeof(header))) break;
+        if (header.length > SHELL_SESSION_DATA_MAX) break;
+        if (!ReadFdExactly(fd, buffer, header.length)) break;
+
+        // Stray input left over from the previous command is ignored.
+        if (header.id == ID_SHELL_STDIN || header.id == ID_SHELL_CLOSE_STDIN) continue;
+        if (header.id != ID_SHELL_COMMAND) break;
+
+        buffer[header.length] = '\0';
+        D("shell-session: running '%s'\n", buffer);
+        if (shell_session_run(fd, shell, buffer, buffer) != 0) break;
+    }
+
+    free(buffer);
+    adb_close(fd);
+}
 #endif
 
 #if !ADB_HOST
@@ -495,12 +672,17 @@ int service_to_fd(const char *name)
         ret = unix_open(name + 4, O_RDWR | O_CLOEXEC);
     } else if(!strncmp(name, "framebuffer:", 12)) {
         ret = create_service_thread(framebuffer_service, 0);
+    } else if(!strncmp(name, "framebuffer-stream:", 19)) {
+        int fps = atoi(name + 19);
+        ret = create_service_thread(framebuffer_stream_service, (void *) (uintptr_t) fps);
     } else if (!strncmp(name, "jdwp:", 5)) {
         ret = create_jdwp_connection_fd(atoi(name+5));
     } else if(!HOST && !strncmp(name, "shell:", 6)) {
         ret = create_subproc_thread(name + 6, SUBPROC_PTY);
     } else if(!HOST && !strncmp(name, "exec:", 5)) {
         ret = create_subproc_thread(name + 5, SUBPROC_RAW);
+    } else if(!HOST && !strncmp(name, "shell-session:", 14)) {
+        ret = create_service_thread(shell_session_service, NULL);
     } else if(!strncmp(name, "sync:", 5)) {
         ret = create_service_thread(file_sync_service, NULL);
     } else if(!strncmp(name, "remount:", 8)) {
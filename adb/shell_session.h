@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SHELL_SESSION_H_
+#define _SHELL_SESSION_H_
+
+#include <stdint.h>
+
+// The framing used by the "shell-session:" service (FEATURE_SHELL_SESSION),
+// which runs any number of commands, one after another, over one stream.
+// Every message in either direction is a shell_session_header followed by
+// |length| bytes. All integers are little-endian. See SERVICES.TXT.
+
+#define SHELL_SESSION_ID(a,b,c,d) ((a) | ((b) << 8) | ((c) << 16) | ((d) << 24))
+
+// Client to device.
+#define ID_SHELL_COMMAND SHELL_SESSION_ID('C','M','N','D')  // Start a command line.
+#define ID_SHELL_STDIN   SHELL_SESSION_ID('S','T','D','I')  // Data for its stdin.
+#define ID_SHELL_CLOSE_STDIN SHELL_SESSION_ID('E','O','F','I')
+
+// Device to client.
+#define ID_SHELL_STDOUT  SHELL_SESSION_ID('S','T','D','O')
+#define ID_SHELL_STDERR  SHELL_SESSION_ID('S','T','D','E')
+#define ID_SHELL_EXIT    SHELL_SESSION_ID('E','X','I','T')  // 4-byte exit status.
+
+// No message carries more data than this.
+#define SHELL_SESSION_DATA_MAX (64*1024)
+
+struct shell_session_header {
+    uint32_t id;
+    uint32_t length;
+};
+
+#endif
@@ -25,16 +25,26 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include <base/stringprintf.h>
+
 #if !ADB_HOST
 #include "cutils/properties.h"
 #endif
 
 #include "adb.h"
 #include "adb_io.h"
+#include "adb_utils.h"
 #include "transport.h"
 
 ADB_MUTEX_DEFINE( socket_list_lock );
 
+// Upper bound on the number of queued packets flushed by a single writev().
+#define LOCAL_SOCKET_MAX_IOV 16
+
 static void local_socket_close_locked(asocket *s);
 
 static unsigned local_socket_next_id = 1;
@@ -44,6 +54,10 @@ static asocket local_socket_list = {
     .prev = &local_socket_list,
 };
 
+// The sockets on local_socket_list by id, so that every incoming packet
+// doesn't scan the whole list. Guarded by socket_list_lock.
+static std::unordered_map<unsigned, asocket*> local_socket_ids;
+
 /* the the list of currently closing local sockets.
 ** these have no peer anymore, but still packets to
 ** write to their fd.
@@ -62,13 +76,12 @@ asocket *find_local_socket(unsigned local_id, unsigned peer_id)
     asocket *result = NULL;
 
     adb_mutex_lock(&socket_list_lock);
-    for (s = local_socket_list.next; s != &local_socket_list; s = s->next) {
-        if (s->id != local_id)
-            continue;
+    auto it = local_socket_ids.find(local_id);
+    if (it != local_socket_ids.end()) {
+        s = it->second;
         if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
             result = s;
         }
-        break;
     }
     adb_mutex_unlock(&socket_list_lock);
 
@@ -89,11 +102,14 @@ void install_local_socket(asocket *s)
 {
     adb_mutex_lock(&socket_list_lock);
 
-    s->id = local_socket_next_id++;
+    // If the ids have wrapped, skip any that are still in use.
+    do {
+        s->id = local_socket_next_id++;
 
-    // Socket ids should never be 0.
-    if (local_socket_next_id == 0)
-      local_socket_next_id = 1;
+        // Socket ids should never be 0.
+        if (local_socket_next_id == 0)
+          local_socket_next_id = 1;
+    } while (!local_socket_ids.emplace(s->id, s).second);
 
     insert_local_socket(s, &local_socket_list);
 
@@ -105,6 +121,10 @@ void remove_socket(asocket *s)
     // socket_list_lock should already be held
     if (s->prev && s->next)
     {
+        auto it = local_socket_ids.find(s->id);
+        if (it != local_socket_ids.end() && it->second == s) {
+            local_socket_ids.erase(it);
+        }
         s->prev->next = s->next;
         s->next->prev = s->prev;
         s->next = 0;
@@ -131,6 +151,28 @@ restart:
     adb_mutex_unlock(&socket_list_lock);
 }
 
+std::string list_socket_queues()
+{
+    std::string result;
+
+    adb_mutex_lock(&socket_list_lock);
+    for (asocket* s = local_socket_list.next; s != &local_socket_list; s = s->next) {
+        size_t packets = 0;
+        size_t bytes = 0;
+        for (apacket* p = s->pkt_first; p != nullptr; p = p->next) {
+            packets++;
+            bytes += p->len;
+        }
+        if (packets == 0) continue;
+        result += android::base::StringPrintf(
+            "LS(%u) fd %d peer %u: %zu packets, %zu bytes queued\n",
+            s->id, s->fd, s->peer ? s->peer->id : 0, packets, bytes);
+    }
+    adb_mutex_unlock(&socket_list_lock);
+
+    return result;
+}
+
 static int local_socket_enqueue(asocket *s, apacket *p)
 {
     D("LS(%d): enqueue %d\n", s->id, p->len);
@@ -279,34 +321,48 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     */
     if (ev & FDE_WRITE) {
         apacket* p;
-        while ((p = s->pkt_first) != nullptr) {
-            while (p->len > 0) {
-                int r = adb_write(fd, p->ptr, p->len);
-                if (r == -1) {
+        while (s->pkt_first != nullptr) {
+            /* hand the whole backlog to the kernel in one call rather
+            ** than one write() per queued packet
+            */
+            adb_iovec iov[LOCAL_SOCKET_MAX_IOV];
+            int iovcnt = 0;
+            for (p = s->pkt_first; p && iovcnt < LOCAL_SOCKET_MAX_IOV; p = p->next) {
+                if (p->len > 0) {
+                    iov[iovcnt].iov_base = p->ptr;
+                    iov[iovcnt].iov_len = p->len;
+                    iovcnt++;
+                }
+            }
+
+            size_t written = 0;
+            if (iovcnt > 0) {
+                int r = adb_writev(fd, iov, iovcnt);
+                if (r == -1 && errno == EAGAIN) {
                     /* returning here is ok because FDE_READ will
                     ** be processed in the next iteration loop
                     */
-                    if (errno == EAGAIN) {
-                        return;
-                    }
-                } else if (r > 0) {
-                    p->ptr += r;
-                    p->len -= r;
-                    continue;
+                    return;
+                } else if (r <= 0) {
+                    D(" closing after write because r=%d and errno is %d\n", r, errno);
+                    s->close(s);
+                    return;
                 }
-
-                D(" closing after write because r=%d and errno is %d\n", r, errno);
-                s->close(s);
-                return;
+                written = r;
             }
 
-            if (p->len == 0) {
+            while ((p = s->pkt_first) != nullptr && written >= p->len) {
+                written -= p->len;
                 s->pkt_first = p->next;
                 if (s->pkt_first == 0) {
                     s->pkt_last = 0;
                 }
                 put_apacket(p);
             }
+            if (p != nullptr) {
+                p->ptr += written;
+                p->len -= written;
+            }
         }
 
         /* if we sent the last packet of a closing socket,
@@ -330,7 +386,8 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     if (ev & FDE_READ) {
         apacket *p = get_apacket();
         unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
+        const size_t max_payload = s->get_max_payload();
+        size_t avail = max_payload;
         int r;
         int is_eof = 0;
 
@@ -354,10 +411,10 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
         }
         D("LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d\n",
           s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if ((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if ((avail == max_payload) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = MAX_PAYLOAD - avail;
+            p->len = max_payload - avail;
 
             r = s->peer->enqueue(s->peer, p);
             D("LS(%d): fd=%d post peer->enqueue(). r=%d\n", s->id, s->fd,
@@ -425,7 +482,10 @@ asocket *create_local_service_socket(const char *name)
         return create_jdwp_service_socket();
     }
     if (!strcmp(name,"track-jdwp")) {
-        return create_jdwp_tracker_service_socket();
+        return create_jdwp_tracker_service_socket(false);
+    }
+    if (!strcmp(name,"track-jdwp-delta")) {
+        return create_jdwp_tracker_service_socket(true);
     }
 #endif
     int fd = service_to_fd(name);
@@ -483,8 +543,13 @@ static int remote_socket_enqueue(asocket *s, apacket *p)
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
     p->msg.data_length = p->len;
+    if (s->in_flight == 0) {
+        s->wrte_sent_ns = adb_monotonic_ns();
+    }
     send_packet(p, s->transport);
-    return 1;
+
+    /* keep the local socket reading until the window is full */
+    return (++s->in_flight < s->window) ? 0 : 1;
 }
 
 static void remote_socket_ready(asocket *s)
@@ -495,6 +560,13 @@ static void remote_socket_ready(asocket *s)
     p->msg.command = A_OKAY;
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
+    if (s->window > 1) {
+        /* acknowledge every WRTE delivered since the last OKAY */
+        uint32_t acked = std::max(s->unacked, 1U);
+        memcpy(p->data, &acked, sizeof(acked));
+        p->msg.data_length = sizeof(acked);
+    }
+    s->unacked = 0;
     send_packet(p, s->transport);
 }
 
@@ -557,6 +629,7 @@ asocket *create_remote_socket(unsigned id, atransport *t)
     s->shutdown = remote_socket_shutdown;
     s->close = remote_socket_close;
     s->transport = t;
+    s->window = t->has_feature(FEATURE_STREAM_WINDOW) ? ADB_STREAM_WINDOW : 1;
 
     dis->func   = remote_socket_disconnect;
     dis->opaque = s;
@@ -569,9 +642,9 @@ void connect_to_remote(asocket *s, const char *destination)
 {
     D("Connect_to_remote call RS(%d) fd=%d\n", s->id, s->fd);
     apacket *p = get_apacket();
-    int len = strlen(destination) + 1;
+    size_t len = strlen(destination) + 1;
 
-    if(len > (MAX_PAYLOAD-1)) {
+    if(len > (s->get_max_payload()-1)) {
         fatal("destination oversized");
     }
 
@@ -900,3 +973,14 @@ void connect_to_smartsocket(asocket *s)
     ss->peer = s;
     s->ready(s);
 }
+
+size_t asocket::get_max_payload() const {
+    size_t max_payload = MAX_PAYLOAD;
+    if (transport) {
+        max_payload = std::min(max_payload, transport->get_max_payload());
+    }
+    if (peer && peer->transport) {
+        max_payload = std::min(max_payload, peer->transport->get_max_payload());
+    }
+    return max_payload;
+}
@@ -135,6 +135,18 @@ extern int  adb_open(const char*  path, int  options);
 extern int  adb_creat(const char*  path, int  mode);
 extern int  adb_read(int  fd, void* buf, int len);
 extern int  adb_write(int  fd, const void*  buf, int  len);
+
+struct adb_iovec {
+    void*   iov_base;
+    size_t  iov_len;
+};
+
+/* there is no scatter/gather write for emulated fds; a short write of the
+ * first buffer is a valid writev() result, so callers need no special case */
+static __inline__ int  adb_writev(int  fd, const adb_iovec*  iov, int  iovcnt)
+{
+    return (iovcnt > 0) ? adb_write(fd, iov[0].iov_base, iov[0].iov_len) : 0;
+}
 extern int  adb_lseek(int  fd, int  pos, int  where);
 extern int  adb_shutdown(int  fd);
 extern int  adb_close(int  fd);
@@ -276,9 +288,14 @@ static __inline__  int  adb_is_absolute_host_path( const char*  path )
 #include "fdevent.h"
 #include <cutils/sockets.h>
 #include <cutils/misc.h>
+#if !ADB_HOST
+/* Uses write(), so it has to come before it is redefined below. */
+#include <cutils/daemon_trace.h>
+#endif
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
 #include <pthread.h>
@@ -384,6 +401,13 @@ static __inline__  int  adb_write(int  fd, const void*  buf, size_t  len)
 #undef   write
 #define  write  ___xxx_write
 
+typedef struct iovec  adb_iovec;
+
+static __inline__  int  adb_writev(int  fd, const adb_iovec*  iov, int  iovcnt)
+{
+    return TEMP_FAILURE_RETRY( writev( fd, iov, iovcnt ) );
+}
+
 static __inline__ int   adb_lseek(int  fd, int  pos, int  where)
 {
     return lseek(fd, pos, where);
@@ -21,11 +21,16 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
 #include <base/stringprintf.h>
 
 #include "adb.h"
@@ -38,6 +43,30 @@ static atransport transport_list = {
     .prev = &transport_list,
 };
 
+// Transports on transport_list by serial and by devpath, so that the common
+// "adb -s SERIAL" lookup doesn't compare against every device. Guarded by
+// transport_lock.
+static std::unordered_multimap<std::string, atransport*> transport_index;
+
+static void transport_index_add_locked(atransport* t) {
+    if (t->serial) {
+        transport_index.emplace(t->serial, t);
+    }
+    if (t->devpath && !(t->serial && !strcmp(t->serial, t->devpath))) {
+        transport_index.emplace(t->devpath, t);
+    }
+}
+
+static void transport_index_remove_locked(atransport* t) {
+    for (const char* key : { t->serial, t->devpath }) {
+        if (!key) continue;
+        auto range = transport_index.equal_range(key);
+        for (auto it = range.first; it != range.second;) {
+            it = (it->second == t) ? transport_index.erase(it) : std::next(it);
+        }
+    }
+}
+
 static atransport pending_list = {
     .next = &pending_list,
     .prev = &pending_list,
@@ -202,6 +231,7 @@ static void transport_socket_events(int fd, unsigned events, void *_t)
 
 void send_packet(apacket *p, atransport *t)
 {
+    DAEMON_TRACE_SCOPE("adb send_packet");
     unsigned char *x;
     unsigned sum;
     unsigned count;
@@ -268,6 +298,8 @@ static void *output_thread(void *_t)
         if(t->read_from_remote(p, t) == 0){
             D("%s: received remote packet, sending to transport\n",
               t->serial);
+            stats_add(&t->stats.packets_received, 1);
+            stats_add(&t->stats.bytes_received, p->msg.data_length);
             if(write_packet(t->fd, t->serial, &p)){
                 put_apacket(p);
                 D("%s: failed to write apacket to transport\n", t->serial);
@@ -330,7 +362,17 @@ static void *input_thread(void *_t)
         } else {
             if(active) {
                 D("%s: transport got packet, sending to remote\n", t->serial);
+                uint64_t start = adb_monotonic_ns();
                 t->write_to_remote(p, t);
+                uint64_t blocked = adb_monotonic_ns() - start;
+
+                stats_add(&t->stats.packets_sent, 1);
+                stats_add(&t->stats.bytes_sent, p->msg.data_length);
+                stats_add(&t->stats.write_blocked_ns, blocked);
+                /* only this thread writes the maximum */
+                if (blocked > stats_load(&t->stats.write_blocked_max_ns)) {
+                    __atomic_store_n(&t->stats.write_blocked_max_ns, blocked, __ATOMIC_RELAXED);
+                }
             } else {
                 D("%s: transport ignoring packet while offline\n", t->serial);
             }
@@ -557,6 +599,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
         adb_mutex_lock(&transport_lock);
         t->next->prev = t->prev;
         t->prev->next = t->next;
+        transport_index_remove_locked(t);
         adb_mutex_unlock(&transport_lock);
 
         run_transport_disconnects(t);
@@ -571,6 +614,8 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
             free(t->device);
         if (t->devpath)
             free(t->devpath);
+        if (t->features)
+            free(t->features);
 
         memset(t,0xee,sizeof(atransport));
         free(t);
@@ -618,6 +663,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     t->prev = transport_list.prev;
     t->next->prev = t;
     t->prev->next = t;
+    transport_index_add_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     t->disconnects.next = t->disconnects.prev = &t->disconnects;
@@ -740,6 +786,16 @@ static int qual_match(const char *to_test,
     return !*to_test;
 }
 
+/* Returns true if |serial| selects devices by product, model or device
+** name rather than naming one serial number or devpath.
+*/
+static bool is_qualifier(const char* serial)
+{
+    return !strncmp(serial, "product:", strlen("product:")) ||
+           !strncmp(serial, "model:", strlen("model:")) ||
+           !strncmp(serial, "device:", strlen("device:"));
+}
+
 atransport* acquire_one_transport(int state, transport_type ttype,
                                   const char* serial, std::string* error_out)
 {
@@ -751,7 +807,26 @@ retry:
     if (error_out) *error_out = android::base::StringPrintf("device '%s' not found", serial);
 
     adb_mutex_lock(&transport_lock);
-    for (t = transport_list.next; t != &transport_list; t = t->next) {
+    if (serial && *serial && !is_qualifier(serial)) {
+        /* a plain serial number or devpath: only look at the transports
+        ** indexed under it.
+        */
+        auto range = transport_index.equal_range(serial);
+        for (auto it = range.first; it != range.second; ++it) {
+            t = it->second;
+            if (t->connection_state == CS_NOPERM) {
+                if (error_out) *error_out = "insufficient permissions for device";
+                continue;
+            }
+            if (result) {
+                if (error_out) *error_out = "more than one device";
+                ambiguous = 1;
+                result = NULL;
+                break;
+            }
+            result = t;
+        }
+    } else for (t = transport_list.next; t != &transport_list; t = t->next) {
         if (t->connection_state == CS_NOPERM) {
             if (error_out) *error_out = "insufficient permissions for device";
             continue;
@@ -841,6 +916,39 @@ retry:
     return result;
 }
 
+void stats_record_okay_rtt(atransport* t, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (bucket < ADB_STATS_RTT_BUCKETS - 1 && us >= (1ULL << (bucket + 6))) {
+        bucket++;
+    }
+    stats_add(&t->stats.okay_rtt[bucket], 1);
+}
+
+void atransport::update_version(unsigned version, size_t payload) {
+    // Old peers advertise A_VERSION_MIN and MAX_PAYLOAD_V1; a version below
+    // that is treated as an old peer. A smaller payload is taken at its word,
+    // since the peer can't take anything larger.
+    protocol_version = std::max(std::min(version, static_cast<unsigned>(A_VERSION)),
+                                static_cast<unsigned>(A_VERSION_MIN));
+    max_payload = std::min(payload, static_cast<size_t>(MAX_PAYLOAD));
+    D("%s: negotiated protocol version 0x%08x, max payload %zu\n",
+      serial, protocol_version, max_payload);
+}
+
+bool atransport::has_feature(const char* feature) const {
+    return features != nullptr && ::has_feature(features, feature);
+}
+
+unsigned atransport::get_protocol_version() const {
+    return protocol_version;
+}
+
+size_t atransport::get_max_payload() const {
+    // Until the CONNECT handshake completes, only V1-sized payloads are safe.
+    return max_payload ? max_payload : MAX_PAYLOAD_V1;
+}
+
 const char* atransport::connection_state_name() const {
     switch (connection_state) {
     case CS_OFFLINE: return "offline";
@@ -902,6 +1010,44 @@ std::string list_transports(bool long_listing) {
     return result;
 }
 
+static void append_transport_stats(atransport* t, std::string* result) {
+    const transport_stats& st = t->stats;
+    *result += android::base::StringPrintf(
+        "%s\t%s\n"
+        "  sent: %" PRIu64 " packets, %" PRIu64 " bytes\n"
+        "  received: %" PRIu64 " packets, %" PRIu64 " bytes\n"
+        "  blocked in write_to_remote: %" PRIu64 "ms total, %" PRIu64 "us max\n",
+        t->serial ? t->serial : "(no serial number)", t->connection_state_name(),
+        stats_load(&st.packets_sent), stats_load(&st.bytes_sent),
+        stats_load(&st.packets_received), stats_load(&st.bytes_received),
+        stats_load(&st.write_blocked_ns) / 1000000,
+        stats_load(&st.write_blocked_max_ns) / 1000);
+
+    *result += "  OKAY round trips:";
+    for (int i = 0; i < ADB_STATS_RTT_BUCKETS; i++) {
+        uint64_t n = stats_load(&st.okay_rtt[i]);
+        if (n == 0) continue;
+        if (i == ADB_STATS_RTT_BUCKETS - 1) {
+            *result += android::base::StringPrintf(" >=%lluus:%" PRIu64,
+                                                   1ULL << (i + 5), n);
+        } else {
+            *result += android::base::StringPrintf(" <%lluus:%" PRIu64,
+                                                   1ULL << (i + 6), n);
+        }
+    }
+    *result += "\n";
+}
+
+std::string list_transport_stats() {
+    std::string result;
+    adb_mutex_lock(&transport_lock);
+    for (atransport* t = transport_list.next; t != &transport_list; t = t->next) {
+        append_transport_stats(t, &result);
+    }
+    adb_mutex_unlock(&transport_lock);
+    return result;
+}
+
 /* hack for osx */
 void close_usb_devices()
 {
@@ -969,18 +1115,20 @@ atransport *find_transport(const char *serial)
 {
     atransport *t;
 
+    atransport *result = 0;
+
     adb_mutex_lock(&transport_lock);
-    for(t = transport_list.next; t != &transport_list; t = t->next) {
+    auto range = transport_index.equal_range(serial);
+    for (auto it = range.first; it != range.second; ++it) {
+        t = it->second;
         if (t->serial && !strcmp(serial, t->serial)) {
+            result = t;
             break;
         }
-     }
+    }
     adb_mutex_unlock(&transport_lock);
 
-    if (t != &transport_list)
-        return t;
-    else
-        return 0;
+    return result;
 }
 
 void unregister_transport(atransport *t)
@@ -988,6 +1136,7 @@ void unregister_transport(atransport *t)
     adb_mutex_lock(&transport_lock);
     t->next->prev = t->prev;
     t->prev->next = t->next;
+    transport_index_remove_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     kick_transport(t);
@@ -1004,6 +1153,7 @@ void unregister_all_tcp_transports()
         if (t->type == kTransportLocal && t->adb_port == 0) {
             t->next->prev = t->prev;
             t->prev->next = next;
+            transport_index_remove_locked(t);
             // we cannot call kick_transport when holding transport_lock
             if (!t->kicked)
             {
@@ -1052,6 +1202,7 @@ void unregister_usb_transport(usb_handle *usb)
         if (t->usb == usb && t->connection_state == CS_NOPERM) {
             t->next->prev = t->prev;
             t->prev->next = t->next;
+            transport_index_remove_locked(t);
             break;
         }
      }
@@ -1061,15 +1212,19 @@ void unregister_usb_transport(usb_handle *usb)
 #undef TRACE_TAG
 #define TRACE_TAG  TRACE_RWX
 
-int check_header(apacket *p)
+int check_header(apacket *p, atransport *t)
 {
     if(p->msg.magic != (p->msg.command ^ 0xffffffff)) {
         D("check_header(): invalid magic\n");
         return -1;
     }
 
-    if(p->msg.data_length > MAX_PAYLOAD) {
-        D("check_header(): %d > MAX_PAYLOAD\n", p->msg.data_length);
+    // A CONNECT may arrive before anything has been negotiated, and carries
+    // at most a banner, so it only ever has to fit in our own buffer.
+    size_t max_payload = (p->msg.command == A_CNXN) ? MAX_PAYLOAD : t->get_max_payload();
+    if(p->msg.data_length > max_payload) {
+        D("check_header(): %u atransport::max_payload = %zu\n",
+          p->msg.data_length, max_payload);
         return -1;
     }
 
@@ -57,7 +57,7 @@ void unregister_usb_transport(usb_handle* usb);
 void unregister_transport(atransport* t);
 void unregister_all_tcp_transports();
 
-int check_header(apacket* p);
+int check_header(apacket* p, atransport* t);
 int check_data(apacket* p);
 
 /* for MacOS X cleanup */
@@ -65,6 +65,23 @@ void close_usb_devices();
 
 void send_packet(apacket* p, atransport* t);
 
+static inline void stats_add(uint64_t* counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_load(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Records one OKAY round trip of |ns| nanoseconds. */
+void stats_record_okay_rtt(atransport* t, uint64_t ns);
+
+/* The per-transport part of the text returned by the host:stats service. */
+std::string list_transport_stats();
+
+/* Describes the local sockets that have packets queued up behind a slow fd. */
+std::string list_socket_queues();
+
 asocket* create_device_tracker(void);
 
 #endif   /* __TRANSPORT_H */
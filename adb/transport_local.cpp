@@ -53,7 +53,7 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
-    if(check_header(p)) {
+    if(check_header(p, t)) {
         D("bad header: terminated (data)\n");
         return -1;
     }
@@ -390,6 +390,8 @@ int init_socket_transport(atransport *t, int s, int adb_port, int local)
     t->write_to_remote = remote_write;
     t->sfd = s;
     t->sync_token = 1;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
     t->connection_state = CS_OFFLINE;
     t->type = kTransportLocal;
     t->adb_port = 0;
@@ -45,6 +45,15 @@
 
 ADB_MUTEX_DEFINE( usb_lock );
 
+/* Each usb_read/usb_write is split into URBs of at most USB_URB_SIZE bytes
+** (the largest transfer every usbfs version accepts), and up to
+** USB_URB_COUNT of them are submitted at once so the host controller always
+** has the next one queued when the current one completes. That's enough to
+** move a whole MAX_PAYLOAD packet as one batch.
+*/
+#define USB_URB_SIZE (16 * 1024)
+#define USB_URB_COUNT (MAX_PAYLOAD / USB_URB_SIZE)
+
 struct usb_handle
 {
     usb_handle *prev;
@@ -58,9 +67,10 @@ struct usb_handle
     unsigned zero_mask;
     unsigned writeable;
 
-    struct usbdevfs_urb urb_in;
-    struct usbdevfs_urb urb_out;
+    struct usbdevfs_urb urb_in[USB_URB_COUNT];
+    struct usbdevfs_urb urb_out[USB_URB_COUNT];
 
+    /* the number of URBs in each array still owned by the kernel */
     int urb_in_busy;
     int urb_out_busy;
     int dead;
@@ -314,19 +324,61 @@ void usb_cleanup()
 {
 }
 
+/* Fills in up to USB_URB_COUNT URBs covering |len| bytes of |data| and
+** returns how many were used. A zero |len| still takes one (empty) URB.
+*/
+static int usb_fill_urbs(struct usbdevfs_urb *urbs, unsigned char ep, void *data, int len)
+{
+    int count = 0;
+    char *p = (char*) data;
+
+    do {
+        int xfer = (len > USB_URB_SIZE) ? USB_URB_SIZE : len;
+        struct usbdevfs_urb *urb = &urbs[count++];
+
+        memset(urb, 0, sizeof(*urb));
+        urb->type = USBDEVFS_URB_TYPE_BULK;
+        urb->endpoint = ep;
+        urb->status = -1;
+        urb->buffer = p;
+        urb->buffer_length = xfer;
+
+        p += xfer;
+        len -= xfer;
+    } while(len > 0 && count < USB_URB_COUNT);
+
+    return count;
+}
+
+/* Submits |count| URBs with the handle lock held, returning how many the
+** kernel accepted.
+*/
+static int usb_submit_urbs(usb_handle *h, struct usbdevfs_urb *urbs, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++) {
+        int res;
+        do {
+            res = ioctl(h->desc, USBDEVFS_SUBMITURB, &urbs[i]);
+        } while((res < 0) && (errno == EINTR));
+        if(res < 0) {
+            D("[ submit urb %d/%d failed: %s ]\n", i, count, strerror(errno));
+            break;
+        }
+    }
+    return i;
+}
+
 static int usb_bulk_write(usb_handle *h, const void *data, int len)
 {
-    struct usbdevfs_urb *urb = &h->urb_out;
+    struct usbdevfs_urb *urbs = h->urb_out;
+    int count, submitted, i;
     int res;
     struct timeval tv;
     struct timespec ts;
 
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_out;
-    urb->status = -1;
-    urb->buffer = (void*) data;
-    urb->buffer_length = len;
+    count = usb_fill_urbs(urbs, h->ep_out, (void*) data, len);
 
     D("++ write ++\n");
 
@@ -335,16 +387,14 @@ static int usb_bulk_write(usb_handle *h, const void *data, int len)
         res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
+    submitted = usb_submit_urbs(h, urbs, count);
+    if(submitted == 0) {
+        res = -1;
         goto fail;
     }
 
-    res = -1;
-    h->urb_out_busy = 1;
+    h->urb_out_busy = submitted;
     for(;;) {
         /* time out after five seconds */
         gettimeofday(&tv, NULL);
@@ -352,11 +402,19 @@ static int usb_bulk_write(usb_handle *h, const void *data, int len)
         ts.tv_nsec = tv.tv_usec * 1000L;
         res = pthread_cond_timedwait(&h->notify, &h->lock, &ts);
         if(res < 0 || h->dead) {
+            res = -1;
             break;
         }
         if(h->urb_out_busy == 0) {
-            if(urb->status == 0) {
-                res = urb->actual_length;
+            /* report the bytes that went out in order before any failure */
+            res = 0;
+            for(i = 0; i < submitted; i++) {
+                if(urbs[i].status != 0) {
+                    if(res == 0) res = -1;
+                    break;
+                }
+                res += urbs[i].actual_length;
+                if(urbs[i].actual_length != urbs[i].buffer_length) break;
             }
             break;
         }
@@ -369,33 +427,42 @@ fail:
 
 static int usb_bulk_read(usb_handle *h, void *data, int len)
 {
-    struct usbdevfs_urb *urb = &h->urb_in;
+    struct usbdevfs_urb *urbs = h->urb_in;
     struct usbdevfs_urb *out = NULL;
+    int count, submitted, i;
     int res;
+    int total = 0;
+    int failed = 0;
+    int next = 0;
 
     D("++ usb_bulk_read ++\n");
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_in;
-    urb->status = -1;
-    urb->buffer = data;
-    urb->buffer_length = len;
-
+    count = usb_fill_urbs(urbs, h->ep_in, data, len);
+
+    /* a short packet ends the transfer: have the kernel cancel the URBs
+    ** queued behind it before they take in the start of the next one
+    */
+    for(i = 0; i < count; i++) {
+        if(i < count - 1) urbs[i].flags |= USBDEVFS_URB_SHORT_NOT_OK;
+        if(i > 0) urbs[i].flags |= USBDEVFS_URB_BULK_CONTINUATION;
+    }
 
     adb_mutex_lock(&h->lock);
     if(h->dead) {
         res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
+    submitted = usb_submit_urbs(h, urbs, count);
+    if(submitted == 0) {
+        res = -1;
         goto fail;
     }
+    if(submitted < count) {
+        /* the rest of the transfer has nowhere to land */
+        failed = 1;
+    }
 
-    h->urb_in_busy = 1;
+    h->urb_in_busy = submitted;
     for(;;) {
         D("[ reap urb - wait ]\n");
         h->reaper_thread = pthread_self();
@@ -418,20 +485,39 @@ static int usb_bulk_read(usb_handle *h, void *data, int len)
         D("[ urb @%p status = %d, actual = %d ]\n",
             out, out->status, out->actual_length);
 
-        if(out == &h->urb_in) {
+        if(out >= h->urb_in && out < h->urb_in + USB_URB_COUNT) {
             D("[ reap urb - IN complete ]\n");
-            h->urb_in_busy = 0;
-            if(urb->status == 0) {
-                res = urb->actual_length;
-            } else {
-                res = -1;
+            h->urb_in_busy--;
+            /* URBs on one endpoint complete in submission order */
+            if(!failed && out == &urbs[next]) {
+                next++;
+                /* -EREMOTEIO is a short packet, see above */
+                if(out->status != 0 && out->status != -EREMOTEIO) {
+                    failed = 1;
+                } else {
+                    total += out->actual_length;
+                    if(out->actual_length != out->buffer_length) failed = 1;
+                }
+                if(failed) {
+                    /* a short or failed URB ends the transfer: take back
+                    ** the ones still queued behind it
+                    */
+                    for(i = next; i < submitted; i++) {
+                        ioctl(h->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+                    }
+                }
             }
-            break;
+            if(h->urb_in_busy == 0) {
+                res = (total == 0 && failed) ? -1 : total;
+                break;
+            }
+            continue;
         }
-        if(out == &h->urb_out) {
+        if(out >= h->urb_out && out < h->urb_out + USB_URB_COUNT) {
             D("[ reap urb - OUT compelete ]\n");
-            h->urb_out_busy = 0;
-            adb_cond_broadcast(&h->notify);
+            if(--h->urb_out_busy == 0) {
+                adb_cond_broadcast(&h->notify);
+            }
         }
     }
 fail:
@@ -459,7 +545,7 @@ int usb_write(usb_handle *h, const void *_data, int len)
     }
 
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URB_SIZE * USB_URB_COUNT) ? USB_URB_SIZE * USB_URB_COUNT : len;
 
         n = usb_bulk_write(h, data, xfer);
         if(n != xfer) {
@@ -488,7 +574,7 @@ int usb_read(usb_handle *h, void *_data, int len)
 
     D("++ usb_read ++\n");
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URB_SIZE * USB_URB_COUNT) ? USB_URB_SIZE * USB_URB_COUNT : len;
 
         D("[ usb read %d fd = %d], fname=%s\n", xfer, h->desc, h->fname);
         n = usb_bulk_read(h, data, xfer);
@@ -536,10 +622,12 @@ void usb_kick(usb_handle *h)
             ** but this ensures that a reader blocked on REAPURB
             ** will get unblocked
             */
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in);
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out);
-            h->urb_in.status = -ENODEV;
-            h->urb_out.status = -ENODEV;
+            for (int i = 0; i < USB_URB_COUNT; i++) {
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in[i]);
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out[i]);
+                h->urb_in[i].status = -ENODEV;
+                h->urb_out[i].status = -ENODEV;
+            }
             h->urb_in_busy = 0;
             h->urb_out_busy = 0;
             adb_cond_broadcast(&h->notify);
@@ -21,15 +21,19 @@
 #include <cutils/properties.h>
 #include <dirent.h>
 #include <errno.h>
+#include <linux/aio_abi.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "adb.h"
 #include "transport.h"
 
@@ -40,6 +44,25 @@
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
+// The legacy f_adb driver fails any read larger than its request buffer.
+#define USB_ADB_MAX_READ 4096
+
+// FunctionFS transfers are split into USB_FFS_AIO_CHUNK pieces, and up to
+// USB_FFS_AIO_CHUNKS of them are queued on the endpoint with one io_submit so
+// that the UDC always has the next request ready when one completes.
+#define USB_FFS_AIO_CHUNK (16 * 1024)
+#define USB_FFS_AIO_CHUNKS (MAX_PAYLOAD / USB_FFS_AIO_CHUNK)
+
+// One per direction: the transport's read and write threads each wait for
+// their own completions.
+struct usb_aio
+{
+    aio_context_t ctx;
+    struct iocb iocbs[USB_FFS_AIO_CHUNKS];
+    struct iocb* iocbp[USB_FFS_AIO_CHUNKS];
+    struct io_event events[USB_FFS_AIO_CHUNKS];
+};
+
 struct usb_handle
 {
     adb_cond_t notify;
@@ -56,6 +79,11 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+
+    // Kernel AIO on the FunctionFS endpoints, if the kernel supports it.
+    bool use_aio;
+    struct usb_aio read_aio;
+    struct usb_aio write_aio;
 };
 
 struct func_desc {
@@ -258,14 +286,20 @@ static int usb_adb_write(usb_handle *h, const void *data, int len)
 
 static int usb_adb_read(usb_handle *h, void *data, int len)
 {
-    int n;
+    char* buf = static_cast<char*>(data);
 
-    D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        int xfer = (len > USB_ADB_MAX_READ) ? USB_ADB_MAX_READ : len;
+
+        D("about to read (fd=%d, len=%d)\n", h->fd, xfer);
+        int n = adb_read(h->fd, buf, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -442,10 +476,131 @@ static int bulk_write(int bulk_in, const uint8_t* buf, size_t length)
     return count;
 }
 
+// bionic has no libaio, so talk to the kernel directly.
+static int sys_io_setup(unsigned nr_events, aio_context_t* ctx) {
+    return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+static int sys_io_submit(aio_context_t ctx, long nr, struct iocb** iocbpp) {
+    return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static int sys_io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event* events) {
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, nullptr);
+}
+
+static int sys_io_cancel(aio_context_t ctx, struct iocb* iocb, struct io_event* result) {
+    return syscall(__NR_io_cancel, ctx, iocb, result);
+}
+
+// Takes back the iocbs of a batch that are still in flight, so that none of
+// them goes on using the caller's buffer after bulk_aio gives up on it.
+static void bulk_aio_cancel(struct usb_aio* aio, int submitted, int reaped) {
+    bool done[USB_FFS_AIO_CHUNKS] = {};
+    for (int i = 0; i < reaped; i++) {
+        done[aio->events[i].data] = true;
+    }
+
+    int pending = submitted - reaped;
+    for (int i = 0; i < submitted; i++) {
+        struct io_event event;
+        if (!done[i] && sys_io_cancel(aio->ctx, &aio->iocbs[i], &event) == 0) {
+            pending--;
+        }
+    }
+
+    // The rest were cancelled asynchronously, or had already completed.
+    while (pending > 0) {
+        int n = sys_io_getevents(aio->ctx, pending, pending, aio->events);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            D("[ aio reap failed: %s ]\n", strerror(errno));
+            break;
+        }
+        pending -= n;
+    }
+}
+
+// Transfers |length| bytes with up to USB_FFS_AIO_CHUNKS requests queued at
+// once. Returns the number of bytes transferred, or -1 with errno set. A
+// short chunk ends the transfer, since the bytes after it belong to the next
+// one. If the endpoint turns out not to support AIO, clears h->use_aio and
+// returns -1 with errno set to EINVAL before anything has been transferred.
+static int bulk_aio(usb_handle* h, struct usb_aio* aio, int fd, uint8_t* buf, size_t length,
+                    bool read) {
+    size_t count = 0;
+
+    while (count < length) {
+        long nr = 0;
+        for (size_t offset = count; offset < length && nr < USB_FFS_AIO_CHUNKS; nr++) {
+            size_t xfer = std::min(length - offset, static_cast<size_t>(USB_FFS_AIO_CHUNK));
+            struct iocb* cb = &aio->iocbs[nr];
+            memset(cb, 0, sizeof(*cb));
+            cb->aio_data = nr;
+            cb->aio_fildes = fd;
+            cb->aio_lio_opcode = read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+            cb->aio_buf = reinterpret_cast<uintptr_t>(buf + offset);
+            cb->aio_nbytes = xfer;
+            aio->iocbp[nr] = cb;
+            offset += xfer;
+        }
+
+        int submitted = TEMP_FAILURE_RETRY(sys_io_submit(aio->ctx, nr, aio->iocbp));
+        if (submitted <= 0) {
+            if (submitted == 0) errno = EIO;
+            if (errno == EINVAL && count == 0) {
+                D("[ FunctionFS AIO unsupported, falling back to read/write ]\n");
+                h->use_aio = false;
+            }
+            return -1;
+        }
+
+        int reaped = 0;
+        while (reaped < submitted) {
+            int n = sys_io_getevents(aio->ctx, 1, submitted - reaped, aio->events + reaped);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                int saved_errno = errno;
+                bulk_aio_cancel(aio, submitted, reaped);
+                errno = saved_errno;
+                return -1;
+            }
+            reaped += n;
+        }
+
+        // Completions on one endpoint arrive in submission order, but account
+        // for them by index anyway.
+        ssize_t results[USB_FFS_AIO_CHUNKS];
+        for (int i = 0; i < submitted; i++) {
+            results[aio->events[i].data] = aio->events[i].res;
+        }
+        for (int i = 0; i < submitted; i++) {
+            if (results[i] < 0) {
+                errno = -results[i];
+                return -1;
+            }
+            count += results[i];
+            if (static_cast<size_t>(results[i]) != aio->iocbs[i].aio_nbytes) {
+                D("[ short aio fd=%d length=%zu count=%zu ]\n", fd, length, count);
+                return count;
+            }
+        }
+    }
+
+    return count;
+}
+
 static int usb_ffs_write(usb_handle* h, const void* data, int len)
 {
     D("about to write (fd=%d, len=%d)\n", h->bulk_in, len);
-    int n = bulk_write(h->bulk_in, reinterpret_cast<const uint8_t*>(data), len);
+    int n = -1;
+    if (h->use_aio) {
+        n = bulk_aio(h, &h->write_aio, h->bulk_in,
+                     reinterpret_cast<uint8_t*>(const_cast<void*>(data)), len, false);
+    }
+    if (!h->use_aio) {
+        n = bulk_write(h->bulk_in, reinterpret_cast<const uint8_t*>(data), len);
+    }
     if (n != len) {
         D("ERROR: fd = %d, n = %d: %s\n", h->bulk_in, n, strerror(errno));
         return -1;
@@ -478,7 +633,13 @@ static int bulk_read(int bulk_out, uint8_t* buf, size_t length)
 static int usb_ffs_read(usb_handle* h, void* data, int len)
 {
     D("about to read (fd=%d, len=%d)\n", h->bulk_out, len);
-    int n = bulk_read(h->bulk_out, reinterpret_cast<uint8_t*>(data), len);
+    int n = -1;
+    if (h->use_aio) {
+        n = bulk_aio(h, &h->read_aio, h->bulk_out, reinterpret_cast<uint8_t*>(data), len, true);
+    }
+    if (!h->use_aio) {
+        n = bulk_read(h->bulk_out, reinterpret_cast<uint8_t*>(data), len);
+    }
     if (n != len) {
         D("ERROR: fd = %d, n = %d: %s\n", h->bulk_out, n, strerror(errno));
         return -1;
@@ -527,6 +688,12 @@ static void usb_ffs_init()
     h->bulk_out = -1;
     h->bulk_out = -1;
 
+    h->use_aio = sys_io_setup(USB_FFS_AIO_CHUNKS, &h->read_aio.ctx) == 0 &&
+                 sys_io_setup(USB_FFS_AIO_CHUNKS, &h->write_aio.ctx) == 0;
+    if (!h->use_aio) {
+        D("[ usb_init - io_setup failed: %s ]\n", strerror(errno));
+    }
+
     adb_cond_init(&h->notify, 0);
     adb_mutex_init(&h->lock, 0);
 
@@ -18,26 +18,80 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/limits.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include <adf/adf.h>
+#include <sync/sync.h>
 
 #define ADF_BASE_PATH "/dev/"
 
-static ssize_t adf_find_nodes(const char *pattern, adf_id_t **ids)
+enum adf_node_type {
+    ADF_NODE_DEVICE,
+    ADF_NODE_INTERFACE,
+    ADF_NODE_OVERLAY_ENGINE,
+};
+
+struct adf_node {
+    enum adf_node_type type;
+    adf_id_t dev;
+    adf_id_t id;
+};
+
+/*
+ * The ADF nodes in /dev, scanned once and kept for as long as /dev is left
+ * alone.  ueventd adds and removes the nodes as the devices come and go,
+ * which changes the modification time of /dev, so a stat() is enough to
+ * tell whether the list is still right.
+ */
+static struct {
+    pthread_mutex_t lock;
+    bool valid;
+    dev_t st_dev;
+    ino_t st_ino;
+    struct timespec mtime;
+    struct adf_node *nodes;
+    size_t n_nodes;
+} adf_node_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool adf_parse_node(const char *name, struct adf_node *node)
+{
+    if (sscanf(name, "adf%u", &node->id) == 1) {
+        node->type = ADF_NODE_DEVICE;
+        node->dev = node->id;
+        return true;
+    }
+    if (sscanf(name, "adf-interface%u.%u", &node->dev, &node->id) == 2) {
+        node->type = ADF_NODE_INTERFACE;
+        return true;
+    }
+    if (sscanf(name, "adf-overlay-engine%u.%u", &node->dev, &node->id) == 2) {
+        node->type = ADF_NODE_OVERLAY_ENGINE;
+        return true;
+    }
+    return false;
+}
+
+/* Called with the cache lock held. */
+static int adf_scan_nodes_locked(const struct stat *st)
 {
     DIR *dir;
     struct dirent *dirent;
-    size_t n = 0;
-    ssize_t ret;
-    adf_id_t *ids_ret = NULL;
+    struct adf_node *nodes = NULL;
+    size_t n = 0, capacity = 0;
+    time_t now = time(NULL);
+    int ret = 0;
 
     dir = opendir(ADF_BASE_PATH);
     if (!dir)
@@ -45,52 +99,109 @@ static ssize_t adf_find_nodes(const char *pattern, adf_id_t **ids)
 
     errno = 0;
     while ((dirent = readdir(dir))) {
-        adf_id_t id;
-        int matched = sscanf(dirent->d_name, pattern, &id);
+        struct adf_node node;
 
-        if (matched < 0) {
-            ret = -errno;
-#if __clang_analyzer__
-            if (ret >= 0)
-                __builtin_unreachable();
-#endif
-            goto done;
-        } else if (matched != 1) {
+        if (!adf_parse_node(dirent->d_name, &node))
             continue;
+
+        if (n == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            struct adf_node *new_nodes = realloc(nodes,
+                    new_capacity * sizeof(nodes[0]));
+            if (!new_nodes) {
+                ret = -ENOMEM;
+                goto done;
+            }
+            nodes = new_nodes;
+            capacity = new_capacity;
         }
+        nodes[n++] = node;
+    }
+    if (errno)
+        ret = -errno;
 
-        adf_id_t *new_ids = realloc(ids_ret, (n + 1) * sizeof(ids_ret[0]));
-        if (!new_ids) {
-            ret = -ENOMEM;
+done:
+    closedir(dir);
+    if (ret < 0) {
+        free(nodes);
+        return ret;
+    }
+
+    free(adf_node_cache.nodes);
+    adf_node_cache.nodes = nodes;
+    adf_node_cache.n_nodes = n;
+    adf_node_cache.st_dev = st->st_dev;
+    adf_node_cache.st_ino = st->st_ino;
+    adf_node_cache.mtime = st->st_mtim;
+    /* A node made within the same second as the scan may not change the
+     * modification time of /dev, if its timestamps are coarse enough, so
+     * the list is only kept once /dev has been left alone for a while. */
+    adf_node_cache.valid = st->st_mtim.tv_sec < now;
+    return 0;
+}
+
+static bool adf_node_cache_fresh(const struct stat *st)
+{
+    return adf_node_cache.valid &&
+            adf_node_cache.st_dev == st->st_dev &&
+            adf_node_cache.st_ino == st->st_ino &&
+            adf_node_cache.mtime.tv_sec == st->st_mtim.tv_sec &&
+            adf_node_cache.mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Devices are matched on their type alone, the others on their device too. */
+static bool adf_node_matches(const struct adf_node *node,
+        enum adf_node_type type, adf_id_t dev)
+{
+    return node->type == type && (type == ADF_NODE_DEVICE || node->dev == dev);
+}
+
+static ssize_t adf_find_nodes(enum adf_node_type type, adf_id_t dev,
+        adf_id_t **ids)
+{
+    struct stat st;
+    size_t n = 0;
+    size_t i;
+    ssize_t ret;
+    adf_id_t *ids_ret = NULL;
+
+    if (stat(ADF_BASE_PATH, &st) < 0)
+        return -errno;
+
+    pthread_mutex_lock(&adf_node_cache.lock);
+    if (!adf_node_cache_fresh(&st)) {
+        ret = adf_scan_nodes_locked(&st);
+        if (ret < 0)
             goto done;
-        }
+    }
 
-        ids_ret = new_ids;
-        ids_ret[n] = id;
-        n++;
+    for (i = 0; i < adf_node_cache.n_nodes; i++) {
+        if (adf_node_matches(&adf_node_cache.nodes[i], type, dev))
+            n++;
     }
-    if (errno) {
-        ret = -errno;
-#if __clang_analyzer__
-        if (ret >= 0)
-            __builtin_unreachable();
-#endif
+    if (n) {
+        ids_ret = malloc(n * sizeof(ids_ret[0]));
+        if (!ids_ret) {
+            ret = -ENOMEM;
+            goto done;
+        }
+        n = 0;
+        for (i = 0; i < adf_node_cache.n_nodes; i++) {
+            if (adf_node_matches(&adf_node_cache.nodes[i], type, dev))
+                ids_ret[n++] = adf_node_cache.nodes[i].id;
+        }
     }
-    else
-        ret = n;
+    *ids = ids_ret;
+    ret = n;
 
 done:
-    closedir(dir);
-    if (ret < 0)
-        free(ids_ret);
-    else
-        *ids = ids_ret;
+    pthread_mutex_unlock(&adf_node_cache.lock);
     return ret;
 }
 
 ssize_t adf_devices(adf_id_t **ids)
 {
-    return adf_find_nodes("adf%u", ids);
+    return adf_find_nodes(ADF_NODE_DEVICE, 0, ids);
 }
 
 int adf_device_open(adf_id_t id, int flags, struct adf_device *dev)
@@ -167,6 +278,27 @@ void adf_free_device_data(struct adf_device_data *data)
     free(data->custom_data);
 }
 
+int adf_get_device_data_into(struct adf_device *dev,
+        struct adf_device_data *data)
+{
+    size_t n_attachments = data->n_attachments;
+    size_t n_allowed_attachments = data->n_allowed_attachments;
+    size_t custom_data_size = data->custom_data_size;
+
+    int err = ioctl(dev->fd, ADF_GET_DEVICE_DATA, data);
+    if (err < 0)
+        return -errno;
+
+    /* The counts come back as they are on the device, however many of
+     * them were copied. */
+    if ((data->attachments && data->n_attachments > n_attachments) ||
+            (data->allowed_attachments &&
+             data->n_allowed_attachments > n_allowed_attachments) ||
+            (data->custom_data && data->custom_data_size > custom_data_size))
+        return -EOVERFLOW;
+    return 0;
+}
+
 int adf_device_post(struct adf_device *dev,
         adf_id_t *interfaces, size_t n_interfaces,
         struct adf_buffer_config *bufs, size_t n_bufs,
@@ -190,6 +322,78 @@ int adf_device_post(struct adf_device *dev,
     return (int)data.complete_fence;
 }
 
+struct adf_post_queue {
+    struct adf_device *dev;
+    size_t depth;
+    /* the release fences of the posts not known to be off the screen,
+     * oldest first from head */
+    int *fences;
+    size_t head;
+    size_t n_fences;
+};
+
+struct adf_post_queue *adf_post_queue_create(struct adf_device *dev,
+        size_t depth)
+{
+    struct adf_post_queue *queue;
+
+    /* A post only leaves the screen for the next one */
+    if (depth < 2) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue)
+        return NULL;
+    queue->fences = malloc(depth * sizeof(queue->fences[0]));
+    if (!queue->fences) {
+        free(queue);
+        return NULL;
+    }
+    queue->dev = dev;
+    queue->depth = depth;
+    return queue;
+}
+
+void adf_post_queue_destroy(struct adf_post_queue *queue)
+{
+    if (!queue)
+        return;
+    while (queue->n_fences) {
+        close(queue->fences[queue->head]);
+        queue->head = (queue->head + 1) % queue->depth;
+        queue->n_fences--;
+    }
+    free(queue->fences);
+    free(queue);
+}
+
+int adf_post_queue_post(struct adf_post_queue *queue,
+        adf_id_t *interfaces, size_t n_interfaces,
+        struct adf_buffer_config *bufs, size_t n_bufs,
+        void *custom_data, size_t custom_data_size)
+{
+    int fence;
+    int ret = 0;
+
+    fence = adf_device_post(queue->dev, interfaces, n_interfaces, bufs, n_bufs,
+            custom_data, custom_data_size);
+    if (fence < 0)
+        return fence;
+    queue->fences[(queue->head + queue->n_fences) % queue->depth] = fence;
+    queue->n_fences++;
+
+    if (queue->n_fences == queue->depth) {
+        if (sync_wait(queue->fences[queue->head], -1) < 0)
+            ret = -errno;
+        close(queue->fences[queue->head]);
+        queue->head = (queue->head + 1) % queue->depth;
+        queue->n_fences--;
+    }
+    return ret;
+}
+
 static int adf_device_attachment(struct adf_device *dev,
         adf_id_t overlay_engine, adf_id_t interface, bool attach)
 {
@@ -221,27 +425,42 @@ int adf_device_detach(struct adf_device *dev, adf_id_t overlay_engine,
 
 ssize_t adf_interfaces(struct adf_device *dev, adf_id_t **interfaces)
 {
-    char pattern[64];
-
-    snprintf(pattern, sizeof(pattern), "adf-interface%u.%%u", dev->id);
-    return adf_find_nodes(pattern, interfaces);
+    return adf_find_nodes(ADF_NODE_INTERFACE, dev->id, interfaces);
 }
 
-ssize_t adf_interfaces_for_overlay_engine(struct adf_device *dev,
-        adf_id_t overlay_engine, adf_id_t **interfaces)
+/* Enough for the allowed attachments of most devices, which are then read
+ * without allocating them. */
+#define ADF_ATTACHMENTS_ON_STACK 16
+
+/*
+ * Lists the other end of the allowed attachments of an overlay engine, if
+ * by_engine, or of an interface.
+ */
+static ssize_t adf_find_attachments(struct adf_device *dev, bool by_engine,
+        adf_id_t id, adf_id_t **ids)
 {
+    struct adf_attachment_config on_stack[ADF_ATTACHMENTS_ON_STACK];
     struct adf_device_data data;
-    ssize_t n = 0;
+    bool allocated = false;
+    size_t n = 0;
     ssize_t ret;
     adf_id_t *ids_ret = NULL;
 
-    ret = adf_get_device_data(dev, &data);
+    memset(&data, 0, sizeof(data));
+    data.allowed_attachments = on_stack;
+    data.n_allowed_attachments = ADF_ATTACHMENTS_ON_STACK;
+    ret = adf_get_device_data_into(dev, &data);
+    if (ret == -EOVERFLOW) {
+        ret = adf_get_device_data(dev, &data);
+        allocated = true;
+    }
     if (ret < 0)
         return ret;
 
     size_t i;
     for (i = 0; i < data.n_allowed_attachments; i++) {
-        if (data.allowed_attachments[i].overlay_engine != overlay_engine)
+        struct adf_attachment_config *attachment = &data.allowed_attachments[i];
+        if ((by_engine ? attachment->overlay_engine : attachment->interface) != id)
             continue;
 
         adf_id_t *new_ids = realloc(ids_ret, (n + 1) * sizeof(ids_ret[0]));
@@ -251,21 +470,29 @@ ssize_t adf_interfaces_for_overlay_engine(struct adf_device *dev,
         }
 
         ids_ret = new_ids;
-        ids_ret[n] = data.allowed_attachments[i].interface;
+        ids_ret[n] = by_engine ? attachment->interface :
+                attachment->overlay_engine;
         n++;
     }
 
     ret = n;
 
 done:
-    adf_free_device_data(&data);
+    if (allocated)
+        adf_free_device_data(&data);
     if (ret < 0)
         free(ids_ret);
     else
-        *interfaces = ids_ret;
+        *ids = ids_ret;
     return ret;
 }
 
+ssize_t adf_interfaces_for_overlay_engine(struct adf_device *dev,
+        adf_id_t overlay_engine, adf_id_t **interfaces)
+{
+    return adf_find_attachments(dev, true, overlay_engine, interfaces);
+}
+
 static ssize_t adf_interfaces_filter(struct adf_device *dev,
         adf_id_t *in, size_t n_in, adf_id_t **out,
         bool (*filter)(struct adf_interface_data *data, __u32 match),
@@ -458,49 +685,13 @@ int adf_interface_simple_post(int fd, __u32 overlay_engine,
 
 ssize_t adf_overlay_engines(struct adf_device *dev, adf_id_t **overlay_engines)
 {
-    char pattern[64];
-
-    snprintf(pattern, sizeof(pattern), "adf-overlay-engine%u.%%u", dev->id);
-    return adf_find_nodes(pattern, overlay_engines);
+    return adf_find_nodes(ADF_NODE_OVERLAY_ENGINE, dev->id, overlay_engines);
 }
 
 ssize_t adf_overlay_engines_for_interface(struct adf_device *dev,
         adf_id_t interface, adf_id_t **overlay_engines)
 {
-    struct adf_device_data data;
-    ssize_t n = 0;
-    ssize_t ret;
-    adf_id_t *ids_ret = NULL;
-
-    ret = adf_get_device_data(dev, &data);
-    if (ret < 0)
-        return ret;
-
-    size_t i;
-    for (i = 0; i < data.n_allowed_attachments; i++) {
-        if (data.allowed_attachments[i].interface != interface)
-            continue;
-
-        adf_id_t *new_ids = realloc(ids_ret, (n + 1) * sizeof(ids_ret[0]));
-        if (!new_ids) {
-            ret = -ENOMEM;
-            goto done;
-        }
-
-        ids_ret = new_ids;
-        ids_ret[n] = data.allowed_attachments[i].overlay_engine;
-        n++;
-    }
-
-    ret = n;
-
-done:
-    adf_free_device_data(&data);
-    if (ret < 0)
-        free(ids_ret);
-    else
-        *overlay_engines = ids_ret;
-    return ret;
+    return adf_find_attachments(dev, false, interface, overlay_engines);
 }
 
 static ssize_t adf_overlay_engines_filter(struct adf_device *dev,
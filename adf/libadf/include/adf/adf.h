@@ -38,6 +38,9 @@ __BEGIN_DECLS
  * Returns the number of ADF devices, and sets ids to a list of device IDs.
  * The caller must free() the returned list of device IDs.
  *
+ * The devices, interfaces and overlay engines found in /dev are cached, and
+ * only looked for again once a node is added to or removed from /dev.
+ *
  * On error, returns -errno.
  */
 ssize_t adf_devices(adf_id_t **ids);
@@ -63,6 +66,18 @@ int adf_get_device_data(struct adf_device *dev, struct adf_device_data *data);
  * Frees the device data returned by adf_get_device_data().
  */
 void adf_free_device_data(struct adf_device_data *data);
+/**
+ * Reads the ADF device data into buffers provided by the caller, with a
+ * single ioctl and without allocating.
+ *
+ * The caller sets the attachments, allowed_attachments and custom_data
+ * pointers in data, and the sizes of what they point to in n_attachments,
+ * n_allowed_attachments and custom_data_size.  Any left NULL are not read.
+ * Returns -EOVERFLOW if a buffer was too small, with its size in data set
+ * to the size needed.  On other errors, returns -errno.
+ */
+int adf_get_device_data_into(struct adf_device *dev,
+        struct adf_device_data *data);
 
 /**
  * Atomically posts a new display configuration to the specified interfaces.
@@ -74,6 +89,41 @@ int adf_device_post(struct adf_device *dev,
         adf_id_t *interfaces, size_t n_interfaces,
         struct adf_buffer_config *bufs, size_t n_bufs,
         void *custom_data, size_t custom_data_size);
+
+struct adf_post_queue;
+
+/**
+ * Creates a queue of posts to dev, which keeps the release fences of up to
+ * depth posts, for a client drawing into depth sets of buffers in turn:
+ * 2 for double buffering, 3 for triple buffering.
+ *
+ * Users of the post queue must link with libsync.  On error, returns NULL
+ * and sets errno.
+ */
+struct adf_post_queue *adf_post_queue_create(struct adf_device *dev,
+        size_t depth);
+/**
+ * Destroys the queue, without waiting for the posts still on it.
+ */
+void adf_post_queue_destroy(struct adf_post_queue *queue);
+/**
+ * Posts a new display configuration, as adf_device_post(), and keeps its
+ * release fence instead of returning it.
+ *
+ * Once depth posts are on the queue, waits for the oldest of them to leave
+ * the screen, which happens as soon as the next post is shown, and lets go of
+ * it.  Its buffers, the next ones in turn, can then be drawn into again, so
+ * that a client posting in a loop runs in step with the display, without
+ * ever waiting on a fence itself.
+ *
+ * On error, returns -errno.  An error waiting for the release fence of the
+ * oldest post is returned as well, even though the new post was made.
+ */
+int adf_post_queue_post(struct adf_post_queue *queue,
+        adf_id_t *interfaces, size_t n_interfaces,
+        struct adf_buffer_config *bufs, size_t n_bufs,
+        void *custom_data, size_t custom_data_size);
+
 /**
  * Attaches the specified interface and overlay engine.
  */
@@ -188,6 +188,47 @@ TEST_F(AdfTest, device_data) {
     adf_free_device_data(&data);
 }
 
+TEST(adf, devices_again) {
+    adf_id_t *devs1, *devs2;
+    ssize_t n_devs1 = adf_devices(&devs1);
+    ASSERT_GE(n_devs1, 0) << "enumerating ADF devices failed: " <<
+            strerror(-n_devs1);
+    ssize_t n_devs2 = adf_devices(&devs2);
+    ASSERT_EQ(n_devs1, n_devs2);
+
+    for (ssize_t i = 0; i < n_devs1; i++)
+        EXPECT_EQ(devs1[i], devs2[i]);
+    free(devs1);
+    free(devs2);
+}
+
+TEST_F(AdfTest, device_data_into) {
+    adf_device_data data;
+    int err = adf_get_device_data(&dev, &data);
+    ASSERT_GE(err, 0) << "getting ADF device data failed: " << strerror(-err);
+
+    adf_attachment_config allowed[ADF_MAX_ATTACHMENTS];
+    adf_device_data data_into;
+    memset(&data_into, 0, sizeof(data_into));
+    data_into.allowed_attachments = allowed;
+    data_into.n_allowed_attachments = ADF_MAX_ATTACHMENTS;
+    err = adf_get_device_data_into(&dev, &data_into);
+    EXPECT_GE(err, 0) << "getting ADF device data failed: " << strerror(-err);
+    ASSERT_EQ(data.n_allowed_attachments, data_into.n_allowed_attachments);
+    for (size_t i = 0; i < data.n_allowed_attachments; i++) {
+        EXPECT_EQ(data.allowed_attachments[i].overlay_engine,
+                allowed[i].overlay_engine);
+        EXPECT_EQ(data.allowed_attachments[i].interface, allowed[i].interface);
+    }
+
+    memset(&data_into, 0, sizeof(data_into));
+    data_into.allowed_attachments = allowed;
+    err = adf_get_device_data_into(&dev, &data_into);
+    EXPECT_EQ(-EOVERFLOW, err);
+    EXPECT_EQ(data.n_allowed_attachments, data_into.n_allowed_attachments);
+    adf_free_device_data(&data);
+}
+
 TEST_F(AdfTest, interface_data) {
     adf_interface_data data;
     ASSERT_NO_FATAL_FAILURE(getInterfaceData(data));
@@ -340,3 +381,47 @@ TEST_F(AdfTest, simple_buffer) {
             format_str << " buffer failed: " << strerror(-release_fence);
     close(release_fence);
 }
+
+TEST_F(AdfTest, post_queue) {
+    uint32_t w = 0, h = 0;
+    ASSERT_NO_FATAL_FAILURE(getCurrentMode(w, h));
+
+    uint32_t format = 0;
+    char format_str[ADF_FORMAT_STR_SIZE];
+    ASSERT_NO_FATAL_FAILURE(get8888Format(format, format_str));
+
+    uint32_t offset;
+    uint32_t pitch;
+    int buf_fd = adf_interface_simple_buffer_alloc(intf, w, h, format, &offset,
+            &pitch);
+    ASSERT_GE(buf_fd, 0) << "allocating " << w << "x" << h << " " <<
+            format_str << " buffer failed: " << strerror(-buf_fd);
+
+    ASSERT_NO_FATAL_FAILURE(attach());
+    ASSERT_NO_FATAL_FAILURE(blank(DRM_MODE_DPMS_ON));
+
+    EXPECT_TRUE(adf_post_queue_create(&dev, 1) == NULL);
+    adf_post_queue *queue = adf_post_queue_create(&dev, 2);
+    ASSERT_TRUE(queue != NULL);
+
+    adf_buffer_config buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.overlay_engine = eng_id;
+    buf.w = w;
+    buf.h = h;
+    buf.format = format;
+    buf.fd[0] = buf_fd;
+    buf.offset[0] = offset;
+    buf.pitch[0] = pitch;
+    buf.n_planes = 1;
+    buf.acquire_fence = -1;
+
+    for (int i = 0; i < 3; i++) {
+        int err = adf_post_queue_post(queue, &intf_id, 1, &buf, 1, NULL, 0);
+        EXPECT_GE(err, 0) << "posting " << w << "x" << h << " " <<
+                format_str << " buffer failed: " << strerror(-err);
+    }
+
+    adf_post_queue_destroy(queue);
+    close(buf_fd);
+}
@@ -20,6 +20,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #include <string>
 
@@ -34,6 +37,28 @@ namespace base {
 bool ReadFdToString(int fd, std::string* content) {
   content->clear();
 
+  // A regular file is read straight into a string of its size, normally
+  // with a single read. Files that don't know their size (such as those in
+  // /proc) are read in chunks.
+  struct stat sb;
+  if (fstat(fd, &sb) != -1 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos != -1 && pos < sb.st_size) {
+      size_t expected = sb.st_size - pos;
+      size_t done = 0;
+      content->resize(expected);
+      while (done < expected) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, &(*content)[done], expected - done));
+        if (n <= 0) {
+          content->resize(done);
+          return n == 0;
+        }
+        done += n;
+      }
+      return true;
+    }
+  }
+
   char buf[BUFSIZ];
   ssize_t n;
   while ((n = TEMP_FAILURE_RETRY(read(fd, &buf[0], sizeof(buf)))) > 0) {
@@ -144,6 +169,49 @@ bool WriteFully(int fd, const void* data, size_t byte_count) {
   return true;
 }
 
+#if !defined(_WIN32)
+std::unique_ptr<MappedFile> MappedFile::FromFd(int fd) {
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    return nullptr;
+  }
+  if (!S_ISREG(sb.st_mode)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  // mmap refuses empty mappings.
+  void* data = nullptr;
+  size_t size = sb.st_size;
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+  return std::unique_ptr<MappedFile>(new MappedFile(data, size));
+}
+
+std::unique_ptr<MappedFile> MappedFile::FromPath(const std::string& path) {
+  int fd =
+      TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+  if (fd == -1) {
+    return nullptr;
+  }
+  std::unique_ptr<MappedFile> result = FromFd(fd);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return result;
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+#endif
+
 bool RemoveFileIfExists(const std::string& path, std::string* err) {
   struct stat st;
 #if defined(_WIN32)
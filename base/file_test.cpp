@@ -43,6 +43,29 @@ TEST(file, ReadFileToString_success) {
   EXPECT_STREQ("Linux", s.c_str());
 }
 
+TEST(file, ReadFileToString_large) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  std::string content;
+  for (size_t i = 0; i < 3 * BUFSIZ; ++i) {
+    content += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_TRUE(android::base::WriteStringToFile(content, tf.filename)) << errno;
+  std::string s("hello");
+  ASSERT_TRUE(android::base::ReadFileToString(tf.filename, &s)) << errno;
+  EXPECT_EQ(content, s);
+}
+
+TEST(file, ReadFdToString_offset) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  ASSERT_TRUE(android::base::WriteStringToFd("abcdef", tf.fd)) << errno;
+  ASSERT_EQ(2, lseek(tf.fd, 2, SEEK_SET));
+  std::string s;
+  ASSERT_TRUE(android::base::ReadFdToString(tf.fd, &s)) << errno;
+  EXPECT_EQ("cdef", s);
+}
+
 TEST(file, WriteStringToFile) {
   TemporaryFile tf;
   ASSERT_TRUE(tf.fd != -1);
@@ -105,6 +128,27 @@ TEST(file, WriteFully) {
   EXPECT_EQ("abc", s);
 }
 
+#if !defined(_WIN32)
+TEST(file, MappedFile) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  ASSERT_TRUE(android::base::WriteStringToFd("abc", tf.fd)) << errno;
+  std::unique_ptr<android::base::MappedFile> m =
+      android::base::MappedFile::FromPath(tf.filename);
+  ASSERT_TRUE(m != nullptr) << errno;
+  EXPECT_EQ("abc", std::string(m->data(), m->size()));
+
+  ASSERT_EQ(0, ftruncate(tf.fd, 0));
+  m = android::base::MappedFile::FromFd(tf.fd);
+  ASSERT_TRUE(m != nullptr) << errno;
+  EXPECT_EQ(0U, m->size());
+
+  errno = 0;
+  EXPECT_TRUE(android::base::MappedFile::FromPath("/proc/does-not-exist") == nullptr);
+  EXPECT_EQ(ENOENT, errno);
+}
+#endif
+
 TEST(file, RemoveFileIfExist) {
   TemporaryFile tf;
   ASSERT_TRUE(tf.fd != -1);
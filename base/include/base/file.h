@@ -18,8 +18,12 @@
 #define BASE_FILE_H
 
 #include <sys/stat.h>
+
+#include <memory>
 #include <string>
 
+#include "base/macros.h"
+
 namespace android {
 namespace base {
 
@@ -39,6 +43,37 @@ bool WriteFully(int fd, const void* data, size_t byte_count);
 
 bool RemoveFileIfExists(const std::string& path, std::string* err = nullptr);
 
+#if !defined(_WIN32)
+// A read-only mapping of a whole regular file, for reading large files
+// without copying them into memory. The contents are as of the time of the
+// mapping only as long as nobody writes to the file. Returns nullptr and
+// sets errno on failure.
+class MappedFile {
+ public:
+  static std::unique_ptr<MappedFile> FromFd(int fd);
+  static std::unique_ptr<MappedFile> FromPath(const std::string& path);
+
+  ~MappedFile();
+
+  const char* data() const {
+    return reinterpret_cast<const char*>(data_);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  MappedFile(void* data, size_t size) : data_(data), size_(size) {
+  }
+
+  void* const data_;
+  const size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+#endif
+
 }  // namespace base
 }  // namespace android
 
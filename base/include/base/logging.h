@@ -20,6 +20,8 @@
 #include <functional>
 #include <memory>
 #include <ostream>
+#include <streambuf>
+#include <string>
 
 #include "base/macros.h"
 
@@ -76,33 +78,48 @@ extern void InitLogging(char* argv[], LogFunction&& logger);
 // the host).
 extern void InitLogging(char* argv[]);
 
-// Replace the current logger.
+// Replace the current logger. Loggers are called without a lock held, so they
+// may run on several threads at once.
 extern void SetLogger(LogFunction&& logger);
 
+// The least severe messages that are logged; others are skipped.
+extern LogSeverity GetMinimumLogSeverity();
+
+// Skips the whole statement, including evaluating whatever is streamed into
+// it, for messages that won't be logged. FATAL messages are never skipped.
+#define LOG_IS_SUPPRESSED(severity) \
+  (::android::base::severity < ::android::base::GetMinimumLogSeverity())
+
 // Logs a message to logcat on Android otherwise to stderr. If the severity is
 // FATAL it also causes an abort. For example:
 //
 //     LOG(FATAL) << "We didn't expect to reach here";
-#define LOG(severity)                                                       \
-  ::android::base::LogMessage(__FILE__, __LINE__, ::android::base::DEFAULT, \
-                              ::android::base::severity, -1).stream()
+#define LOG(severity) LOG_TO(DEFAULT, severity)
 
 // Logs a message to logcat with the specified log ID on Android otherwise to
 // stderr. If the severity is FATAL it also causes an abort.
-#define LOG_TO(dest, severity)                                           \
-  ::android::base::LogMessage(__FILE__, __LINE__, ::android::base::dest, \
-                              ::android::base::severity, -1).stream()
+#define LOG_TO(dest, severity)                                             \
+  LOG_IS_SUPPRESSED(severity)                                              \
+      ? (void)0                                                            \
+      : ::android::base::LogMessageVoidify() &                             \
+            ::android::base::LogMessage(__FILE__, __LINE__,                \
+                                        ::android::base::dest,             \
+                                        ::android::base::severity, -1)     \
+                .stream()
 
 // A variant of LOG that also logs the current errno value. To be used when
 // library calls fail.
-#define PLOG(severity)                                                      \
-  ::android::base::LogMessage(__FILE__, __LINE__, ::android::base::DEFAULT, \
-                              ::android::base::severity, errno).stream()
+#define PLOG(severity) PLOG_TO(DEFAULT, severity)
 
 // Behaves like PLOG, but logs to the specified log ID.
-#define PLOG_TO(dest, severity)                                          \
-  ::android::base::LogMessage(__FILE__, __LINE__, ::android::base::dest, \
-                              ::android::base::severity, errno).stream()
+#define PLOG_TO(dest, severity)                                            \
+  LOG_IS_SUPPRESSED(severity)                                              \
+      ? (void)0                                                            \
+      : ::android::base::LogMessageVoidify() &                             \
+            ::android::base::LogMessage(__FILE__, __LINE__,                \
+                                        ::android::base::dest,             \
+                                        ::android::base::severity, errno)  \
+                .stream()
 
 // Marker that code is yet to be implemented.
 #define UNIMPLEMENTED(level) \
@@ -254,9 +271,14 @@ EAGER_PTR_EVALUATOR(const signed char*, signed char*);
 EAGER_PTR_EVALUATOR(signed char*, const signed char*);
 EAGER_PTR_EVALUATOR(signed char*, signed char*);
 
-// Data for the log message, not stored in LogMessage to avoid increasing the
-// stack size.
-class LogMessageData;
+// Turns the stream of a LOG statement into void, for the other branch of the
+// severity check. operator& binds more loosely than << but more tightly
+// than ?:, so the whole statement is streamed first.
+class LogMessageVoidify {
+ public:
+  void operator&(std::ostream&) {
+  }
+};
 
 // A LogMessage is a temporarily scoped object used by LOG and the unlikely part
 // of a CHECK. The destructor will abort if the severity is FATAL.
@@ -276,7 +298,35 @@ class LogMessage {
                       LogSeverity severity, const char* msg);
 
  private:
-  const std::unique_ptr<LogMessageData> data_;
+  // Collects the message in an inline buffer, and only moves it to the heap
+  // if it grows longer than that.
+  class Buffer : public std::streambuf {
+   public:
+    Buffer();
+
+    // Returns the message so far, NUL-terminated and writable.
+    char* Finish();
+
+   protected:
+    int_type overflow(int_type ch) override;
+
+   private:
+    static constexpr size_t kInlineSize = 256;
+
+    // Room is left for the NUL that Finish() adds.
+    char inline_[kInlineSize];
+    std::string spill_;
+
+    DISALLOW_COPY_AND_ASSIGN(Buffer);
+  };
+
+  const char* const file_;
+  const unsigned int line_number_;
+  const LogId id_;
+  const LogSeverity severity_;
+  const int error_;
+  Buffer buffer_;
+  std::ostream stream_;
 
   DISALLOW_COPY_AND_ASSIGN(LogMessage);
 };
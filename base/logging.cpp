@@ -17,6 +17,7 @@
 #include "base/logging.h"
 
 #include <libgen.h>
+#include <string.h>
 
 // For getprogname(3) or program_invocation_short_name.
 #if defined(__ANDROID__) || defined(__APPLE__)
@@ -25,10 +26,10 @@
 #include <errno.h>
 #endif
 
+#include <atomic>
 #include <iostream>
 #include <limits>
 #include <mutex>
-#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -48,13 +49,11 @@
 namespace android {
 namespace base {
 
+// Only taken to replace the logger: lines are logged without it.
 static std::mutex logging_lock;
 
-#ifdef __ANDROID__
-static LogFunction gLogger = LogdLogger();
-#else
-static LogFunction gLogger = StderrLogger;
-#endif
+// The logger set by SetLogger, or null for the default one.
+static std::atomic<LogFunction*> gLogger(nullptr);
 
 static bool gInitialized = false;
 static LogSeverity gMinimumLogSeverity = INFO;
@@ -121,6 +120,15 @@ void LogdLogger::operator()(LogId id, LogSeverity severity, const char* tag,
 }
 #endif
 
+static LogFunction& DefaultLogger() {
+#ifdef __ANDROID__
+  static LogFunction* logger = new LogFunction(LogdLogger());
+#else
+  static LogFunction* logger = new LogFunction(StderrLogger);
+#endif
+  return *logger;
+}
+
 void InitLogging(char* argv[], LogFunction&& logger) {
   SetLogger(std::forward<LogFunction>(logger));
   InitLogging(argv);
@@ -183,112 +191,95 @@ void InitLogging(char* argv[]) {
 
 void SetLogger(LogFunction&& logger) {
   std::lock_guard<std::mutex> lock(logging_lock);
-  gLogger = std::move(logger);
+  // Another thread may still be running the old logger, and loggers are
+  // rarely replaced, so the old one is never freed.
+  gLogger.store(new LogFunction(std::move(logger)), std::memory_order_release);
 }
 
-// This indirection greatly reduces the stack impact of having lots of
-// checks/logging in a function.
-class LogMessageData {
- public:
-  LogMessageData(const char* file, unsigned int line, LogId id,
-                 LogSeverity severity, int error)
-      : file_(file),
-        line_number_(line),
-        id_(id),
-        severity_(severity),
-        error_(error) {
-    const char* last_slash = strrchr(file, '/');
-    file = (last_slash == nullptr) ? file : last_slash + 1;
-  }
-
-  const char* GetFile() const {
-    return file_;
-  }
-
-  unsigned int GetLineNumber() const {
-    return line_number_;
-  }
-
-  LogSeverity GetSeverity() const {
-    return severity_;
-  }
-
-  LogId GetId() const {
-    return id_;
-  }
+LogSeverity GetMinimumLogSeverity() {
+  return gMinimumLogSeverity;
+}
 
-  int GetError() const {
-    return error_;
-  }
+LogMessage::Buffer::Buffer() {
+  setp(inline_, inline_ + kInlineSize - 1);
+}
 
-  std::ostream& GetBuffer() {
-    return buffer_;
+LogMessage::Buffer::int_type LogMessage::Buffer::overflow(int_type ch) {
+  // The inline buffer is full: move what it has to the heap and start over.
+  spill_.append(pbase(), pptr());
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    spill_ += traits_type::to_char_type(ch);
   }
+  setp(inline_, inline_ + kInlineSize - 1);
+  return traits_type::not_eof(ch);
+}
 
-  std::string ToString() const {
-    return buffer_.str();
+char* LogMessage::Buffer::Finish() {
+  if (spill_.empty()) {
+    *pptr() = '\0';
+    return pbase();
   }
-
- private:
-  std::ostringstream buffer_;
-  const char* const file_;
-  const unsigned int line_number_;
-  const LogId id_;
-  const LogSeverity severity_;
-  const int error_;
-
-  DISALLOW_COPY_AND_ASSIGN(LogMessageData);
-};
+  spill_.append(pbase(), pptr());
+  setp(inline_, inline_ + kInlineSize - 1);
+  return &spill_[0];
+}
 
 LogMessage::LogMessage(const char* file, unsigned int line, LogId id,
                        LogSeverity severity, int error)
-    : data_(new LogMessageData(file, line, id, severity, error)) {
+    : file_(file),
+      line_number_(line),
+      id_(id),
+      severity_(severity),
+      error_(error),
+      stream_(&buffer_) {
 }
 
 LogMessage::~LogMessage() {
-  if (data_->GetSeverity() < gMinimumLogSeverity) {
+  if (severity_ < gMinimumLogSeverity) {
     return;  // No need to format something we're not going to output.
   }
 
   // Finish constructing the message.
-  if (data_->GetError() != -1) {
-    data_->GetBuffer() << ": " << strerror(data_->GetError());
+  if (error_ != -1) {
+    stream_ << ": " << strerror(error_);
   }
-  std::string msg(data_->ToString());
-
-  if (msg.find('\n') == std::string::npos) {
-    LogLine(data_->GetFile(), data_->GetLineNumber(), data_->GetId(),
-            data_->GetSeverity(), msg.c_str());
-  } else {
-    msg += '\n';
-    size_t i = 0;
-    while (i < msg.size()) {
-      size_t nl = msg.find('\n', i);
-      msg[nl] = '\0';
-      LogLine(data_->GetFile(), data_->GetLineNumber(), data_->GetId(),
-              data_->GetSeverity(), &msg[i]);
-      i = nl + 1;
+  char* msg = buffer_.Finish();
+
+  // Each line is logged separately.
+  char* line = msg;
+  for (;;) {
+    char* nl = strchr(line, '\n');
+    if (nl == nullptr) {
+      LogLine(file_, line_number_, id_, severity_, line);
+      break;
     }
+    *nl = '\0';
+    LogLine(file_, line_number_, id_, severity_, line);
+    *nl = '\n';
+    line = nl + 1;
   }
 
   // Abort if necessary.
-  if (data_->GetSeverity() == FATAL) {
+  if (severity_ == FATAL) {
 #ifdef __ANDROID__
-    android_set_abort_message(msg.c_str());
+    android_set_abort_message(msg);
 #endif
     abort();
   }
 }
 
 std::ostream& LogMessage::stream() {
-  return data_->GetBuffer();
+  return stream_;
 }
 
 void LogMessage::LogLine(const char* file, unsigned int line, LogId id,
                          LogSeverity severity, const char* message) {
   const char* tag = ProgramInvocationName();
-  std::lock_guard<std::mutex> lock(logging_lock);
-  gLogger(id, severity, tag, file, line, message);
+  LogFunction* logger = gLogger.load(std::memory_order_acquire);
+  if (logger == nullptr) {
+    logger = &DefaultLogger();
+  }
+  (*logger)(id, severity, tag, file, line, message);
 }
 
 ScopedLogSeverity::ScopedLogSeverity(LogSeverity level) {
@@ -136,6 +136,35 @@ TEST(logging, LOG) {
   }
 }
 
+TEST(logging, LOG_suppressed_skips_arguments) {
+  int evaluated = 0;
+  auto count = [&evaluated]() { return ++evaluated; };
+
+  CapturedStderr cap;
+  LOG(DEBUG) << count();
+  ASSERT_EQ(0, evaluated);
+
+  LOG(WARNING) << count();
+  ASSERT_EQ(1, evaluated);
+}
+
+TEST(logging, LOG_long_and_multiline) {
+  CapturedStderr cap;
+  std::string long_message(1000, 'x');
+  LOG(WARNING) << long_message << "\nsecond line";
+  ASSERT_EQ(0, lseek(cap.fd(), SEEK_SET, 0));
+
+  std::string output;
+  android::base::ReadFdToString(cap.fd(), &output);
+
+  std::regex first_regex(
+      make_log_pattern(android::base::WARNING, (long_message + "\n").c_str()));
+  ASSERT_TRUE(std::regex_search(output, first_regex));
+  std::regex second_regex(
+      make_log_pattern(android::base::WARNING, "second line"));
+  ASSERT_TRUE(std::regex_search(output, second_regex));
+}
+
 TEST(logging, PLOG) {
   {
     CapturedStderr cap;
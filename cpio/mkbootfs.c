@@ -11,6 +11,13 @@
 
 #include <stdarg.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <zlib.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -21,6 +28,9 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - the tree is walked first; the contents of files are then read, by
+**   several threads with -j, and written out in the order of the walk,
+**   so the output doesn't depend on the number of threads
 */
 
 void die(const char *why, ...)
@@ -54,6 +64,135 @@ static char *target_out_path = NULL;
 static int verbose = 0;
 static int total_size = 0;
 
+/* Output is collected in a large buffer and written with write(2), or
+ * gzip compressed in-process with -z. */
+#define OUT_BUFFER_SIZE (1024 * 1024)
+/* Files at least this large are copied with sendfile(2) when possible. */
+#define SENDFILE_MIN_SIZE (256 * 1024)
+
+static char *out_buffer;
+static size_t out_len;
+static int out_compress = 0;
+static z_stream out_zstream;
+
+static void out_write_raw(const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            die("write failed: %s", strerror(errno));
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/* Compresses data into the output buffer, or just writes out what is
+ * buffered if data is NULL.  flush is the zlib flush mode. */
+static void out_deflate(const void *data, size_t len, int flush)
+{
+    char zbuf[64 * 1024];
+    int ret;
+
+    out_zstream.next_in = (Bytef *) data;
+    out_zstream.avail_in = len;
+    do {
+        out_zstream.next_out = (Bytef *) zbuf;
+        out_zstream.avail_out = sizeof(zbuf);
+        ret = deflate(&out_zstream, flush);
+        if (ret == Z_STREAM_ERROR) die("deflate failed");
+        out_write_raw(zbuf, sizeof(zbuf) - out_zstream.avail_out);
+    } while (out_zstream.avail_out == 0 || out_zstream.avail_in > 0);
+    (void) ret;
+}
+
+static void out_flush(void)
+{
+    if (out_len == 0) return;
+    if (out_compress) {
+        out_deflate(out_buffer, out_len, Z_NO_FLUSH);
+    } else {
+        out_write_raw(out_buffer, out_len);
+    }
+    out_len = 0;
+}
+
+static void out_write(const void *data, size_t len)
+{
+    if (out_len + len > OUT_BUFFER_SIZE) {
+        out_flush();
+        if (len > OUT_BUFFER_SIZE) {
+            if (out_compress) {
+                out_deflate(data, len, Z_NO_FLUSH);
+            } else {
+                out_write_raw(data, len);
+            }
+            return;
+        }
+    }
+    memcpy(out_buffer + out_len, data, len);
+    out_len += len;
+}
+
+static void out_pad(unsigned align)
+{
+    static const char zeros[256];
+
+    while (total_size & (align - 1)) {
+        unsigned n = align - (total_size & (align - 1));
+        out_write(zeros, n);
+        total_size += n;
+    }
+}
+
+static void out_init(void)
+{
+    out_buffer = malloc(OUT_BUFFER_SIZE);
+    if (out_buffer == NULL) die("cannot allocate output buffer");
+    if (out_compress) {
+        memset(&out_zstream, 0, sizeof(out_zstream));
+        // 16 + MAX_WBITS asks for a gzip header and trailer.
+        if (deflateInit2(&out_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            die("deflateInit2 failed");
+        }
+    }
+}
+
+static void out_finish(void)
+{
+    out_flush();
+    if (out_compress) {
+        out_deflate(NULL, 0, Z_FINISH);
+        deflateEnd(&out_zstream);
+    }
+    free(out_buffer);
+}
+
+/* An entry of the archive, in the order of the walk. */
+struct entry {
+    char *in;
+    char *out;
+    struct stat s;
+    char *data;         /* the contents, once read */
+    unsigned size;
+    int use_sendfile;   /* copied straight from in when written */
+    int ready;
+};
+
+static struct entry *entries;
+static int num_entries, size_entries;
+
+static int jobs = 1;
+static pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t entries_cond = PTHREAD_COND_INITIALIZER;
+static int next_to_read, next_to_write;
+/* How far ahead of the writer the readers may go, to bound the memory. */
+#define READ_AHEAD 256
+
 static void fix_stat(const char *path, struct stat *s)
 {
     uint64_t capabilities;
@@ -93,16 +232,16 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
     // values which may be special.
     static unsigned next_inode = 300000;
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    char header[6 + 8*13 + 1];
+
+    out_pad(4);
 
     fix_stat(out, s);
 //    fprintf(stderr, "_eject %s: mode=0%o\n", out, s->st_mode);
 
-    printf("%06x%08x%08x%08x%08x%08x%08x"
-           "%08x%08x%08x%08x%08x%08x%08x%s%c",
+    snprintf(header, sizeof(header),
+           "%06x%08x%08x%08x%08x%08x%08x"
+           "%08x%08x%08x%08x%08x%08x%08x",
            0x070701,
            next_inode++,  //  s.st_ino,
            s->st_mode,
@@ -116,22 +255,19 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
            0, // devmajor
            0, // devminor,
            olen + 1,
-           0,
-           out,
            0
            );
+    out_write(header, 6 + 8*13);
+    out_write(out, olen + 1);
 
     total_size += 6 + 8*13 + olen + 1;
 
     if(strlen(out) != (unsigned int)olen) die("ACK!");
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    out_pad(4);
 
-    if(datasize) {
-        fwrite(data, datasize, 1, stdout);
+    if(datasize && data) {
+        out_write(data, datasize);
         total_size += datasize;
     }
 }
@@ -142,10 +278,7 @@ static void _eject_trailer()
     memset(&s, 0, sizeof(s));
     _eject(&s, "TRAILER!!!", 10, 0, 0);
 
-    while(total_size & 0xff) {
-        total_size++;
-        putchar(0);
-    }
+    out_pad(0x100);
 }
 
 static void _archive(char *in, char *out, int ilen, int olen);
@@ -227,9 +360,28 @@ static void _archive_dir(char *in, char *out, int ilen, int olen)
     closedir(d);
 }
 
+static struct entry *add_entry(const char *in, const char *out, struct stat *s)
+{
+    struct entry *e;
+
+    if (num_entries == size_entries) {
+        size_entries = size_entries ? size_entries * 2 : 1024;
+        entries = realloc(entries, size_entries * sizeof(struct entry));
+        if (entries == NULL) die("cannot allocate %d entries", size_entries);
+    }
+    e = &entries[num_entries++];
+    memset(e, 0, sizeof(*e));
+    e->in = strdup(in);
+    e->out = strdup(out);
+    if (e->in == NULL || e->out == NULL) die("cannot allocate entry for '%s'", in);
+    e->s = *s;
+    return e;
+}
+
 static void _archive(char *in, char *out, int ilen, int olen)
 {
     struct stat s;
+    struct entry *e;
 
     if(verbose) {
         fprintf(stderr,"_archive('%s','%s',%d,%d)\n",
@@ -239,37 +391,157 @@ static void _archive(char *in, char *out, int ilen, int olen)
     if(lstat(in, &s)) die("could not stat '%s'\n", in);
 
     if(S_ISREG(s.st_mode)){
-        char *tmp;
-        int fd;
-
-        fd = open(in, O_RDONLY);
-        if(fd < 0) die("cannot open '%s' for read", in);
-
-        tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) die("cannot allocate %d bytes", s.st_size);
-
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            die("cannot read %d bytes", s.st_size);
-        }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
-        close(fd);
+        e = add_entry(in, out, &s);
+        e->size = s.st_size;
+#if defined(__linux__)
+        e->use_sendfile = !out_compress && s.st_size >= SENDFILE_MIN_SIZE;
+#endif
     } else if(S_ISDIR(s.st_mode)) {
-        _eject(&s, out, olen, 0, 0);
+        e = add_entry(in, out, &s);
+        e->ready = 1;
         _archive_dir(in, out, ilen, olen);
     } else if(S_ISLNK(s.st_mode)) {
         char buf[1024];
         int size;
         size = readlink(in, buf, 1024);
         if(size < 0) die("cannot read symlink '%s'", in);
-        _eject(&s, out, olen, buf, size);
+        e = add_entry(in, out, &s);
+        e->data = malloc(size);
+        if(e->data == 0) die("cannot allocate %d bytes", size);
+        memcpy(e->data, buf, size);
+        e->size = size;
+        e->ready = 1;
     } else {
         die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
     }
 }
 
+static void read_entry(struct entry *e)
+{
+    char *tmp = NULL;
+    int fd;
+
+    if (e->size > 0 && !e->use_sendfile) {
+        fd = open(e->in, O_RDONLY);
+        if(fd < 0) die("cannot open '%s' for read", e->in);
+
+        tmp = (char*) malloc(e->size);
+        if(tmp == 0) die("cannot allocate %d bytes", e->size);
+
+        if(read(fd, tmp, e->size) != (ssize_t) e->size) {
+            die("cannot read %d bytes", e->size);
+        }
+        close(fd);
+    }
+    e->data = tmp;
+}
+
+static void *reader_thread(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&entries_lock);
+    for (;;) {
+        while (next_to_read < num_entries &&
+               next_to_read >= next_to_write + READ_AHEAD) {
+            pthread_cond_wait(&entries_cond, &entries_lock);
+        }
+        if (next_to_read >= num_entries) break;
+
+        struct entry *e = &entries[next_to_read++];
+        if (e->ready) continue;
+        pthread_mutex_unlock(&entries_lock);
+        read_entry(e);
+        pthread_mutex_lock(&entries_lock);
+        e->ready = 1;
+        pthread_cond_broadcast(&entries_cond);
+    }
+    pthread_mutex_unlock(&entries_lock);
+    return NULL;
+}
+
+#if defined(__linux__)
+static void sendfile_entry(struct entry *e)
+{
+    off_t offset = 0;
+    int fd;
+
+    fd = open(e->in, O_RDONLY);
+    if(fd < 0) die("cannot open '%s' for read", e->in);
+    out_flush();
+    while (offset < (off_t) e->size) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, e->size - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            // Not every kind of output can take sendfile: copy it instead.
+            char buf[64 * 1024];
+            if (lseek(fd, offset, SEEK_SET) != offset) die("cannot seek '%s'", e->in);
+            while (offset < (off_t) e->size) {
+                n = read(fd, buf, sizeof(buf));
+                if (n <= 0) die("cannot read %d bytes", e->size);
+                out_write(buf, n);
+                offset += n;
+            }
+            break;
+        }
+    }
+    close(fd);
+    total_size += e->size;
+}
+#endif
+
+/* Writes out the entries in order, reading the files with jobs threads. */
+static void write_entries(void)
+{
+    pthread_t *threads = NULL;
+    int i;
+
+    if (jobs > 1) {
+        threads = calloc(jobs, sizeof(pthread_t));
+        if (threads == NULL) die("cannot allocate threads");
+        for (i = 0; i < jobs; i++) {
+            if (pthread_create(&threads[i], NULL, reader_thread, NULL)) {
+                die("cannot create reader thread");
+            }
+        }
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        struct entry *e = &entries[i];
+
+        if (jobs > 1) {
+            pthread_mutex_lock(&entries_lock);
+            while (!e->ready) pthread_cond_wait(&entries_cond, &entries_lock);
+            pthread_mutex_unlock(&entries_lock);
+        } else if (!e->ready) {
+            read_entry(e);
+        }
+
+        _eject(&e->s, e->out, strlen(e->out), e->data, e->size);
+#if defined(__linux__)
+        if (e->use_sendfile && e->size > 0) sendfile_entry(e);
+#endif
+
+        free(e->data);
+        free(e->in);
+        free(e->out);
+
+        if (jobs > 1) {
+            pthread_mutex_lock(&entries_lock);
+            next_to_write = i + 1;
+            pthread_cond_broadcast(&entries_cond);
+            pthread_mutex_unlock(&entries_lock);
+        }
+    }
+
+    if (jobs > 1) {
+        for (i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+        free(threads);
+    }
+    free(entries);
+    entries = NULL;
+    num_entries = size_entries = 0;
+}
+
 void archive(const char *start, const char *prefix)
 {
     char in[8192];
@@ -342,8 +614,23 @@ int main(int argc, char *argv[])
         argv += 2;
     }
 
+    if (argc > 1 && strcmp(argv[0], "-j") == 0) {
+        jobs = atoi(argv[1]);
+        if (jobs < 1) die("bad number of jobs '%s'", argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 0 && strcmp(argv[0], "-z") == 0) {
+        out_compress = 1;
+        argc--;
+        argv++;
+    }
+
     if(argc == 0) die("no directories to process?!");
 
+    out_init();
+
     while(argc-- > 0){
         char *x = strchr(*argv, '=');
         if(x != 0) {
@@ -357,7 +644,9 @@ int main(int argc, char *argv[])
         argv++;
     }
 
+    write_entries();
     _eject_trailer();
+    out_finish();
 
     return 0;
 }
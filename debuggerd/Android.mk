@@ -15,6 +15,7 @@ LOCAL_SRC_FILES:= \
     debuggerd.cpp \
     elf_utils.cpp \
     getevent.cpp \
+    minidump.cpp \
     tombstone.cpp \
     utility.cpp \
 
@@ -30,6 +30,12 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include <selinux/android.h>
 
 #include <log/logger.h>
@@ -63,6 +69,47 @@ struct debugger_request_t {
   int32_t original_si_code;
 };
 
+// Requests for different processes are handled concurrently, each on a
+// thread of its own from start to finish: only the thread that attached to
+// a tid can make ptrace requests on it. Requests for a process that is
+// already being handled wait for it, up to the request timeout.
+#define DEFAULT_MAX_REQUESTS 4
+#define DEFAULT_REQUEST_TIMEOUT_SEC 10
+
+static std::mutex g_requests_mutex;
+static std::condition_variable g_requests_cond;
+static size_t g_requests_running;
+static std::set<pid_t> g_busy_pids;
+static std::chrono::seconds g_request_timeout(DEFAULT_REQUEST_TIMEOUT_SEC);
+
+// Marks a process as being handled for as long as it is in scope.
+class ScopedBusyPid {
+ public:
+  explicit ScopedBusyPid(pid_t pid) : pid_(pid), claimed_(false) {
+    std::unique_lock<std::mutex> lock(g_requests_mutex);
+    claimed_ = g_requests_cond.wait_for(lock, g_request_timeout, [pid]() {
+      return g_busy_pids.count(pid) == 0;
+    });
+    if (claimed_) {
+      g_busy_pids.insert(pid);
+    }
+  }
+
+  ~ScopedBusyPid() {
+    if (claimed_) {
+      std::lock_guard<std::mutex> lock(g_requests_mutex);
+      g_busy_pids.erase(pid_);
+      g_requests_cond.notify_all();
+    }
+  }
+
+  bool claimed() const { return claimed_; }
+
+ private:
+  pid_t pid_;
+  bool claimed_;
+};
+
 static void wait_for_user_action(const debugger_request_t &request) {
   // Find out the name of the process that crashed.
   char path[64];
@@ -90,7 +137,9 @@ static void wait_for_user_action(const debugger_request_t &request) {
         "********************************************************",
         request.pid, exe, request.tid);
 
-  // Wait for VOLUME DOWN.
+  // Wait for VOLUME DOWN. The input devices are shared by all requests.
+  static std::mutex getevent_mutex;
+  std::lock_guard<std::mutex> guard(getevent_mutex);
   if (init_getevent() == 0) {
     while (true) {
       input_event e;
@@ -370,6 +419,13 @@ static void handle_request(int fd) {
     }
 #endif
 
+    ScopedBusyPid busy(request.pid);
+    if (!busy.claimed()) {
+      ALOGE("timed out waiting for the request in progress for pid %d\n", request.pid);
+      close(fd);
+      return;
+    }
+
     // At this point, the thread that made the request is blocked in
     // a read() call.  If the thread has crashed, then this gives us
     // time to PTRACE_ATTACH to it before it has a chance to really fault.
@@ -503,6 +559,14 @@ static void handle_request(int fd) {
   }
 }
 
+static void request_thread(int fd) {
+  handle_request(fd);
+
+  std::lock_guard<std::mutex> lock(g_requests_mutex);
+  g_requests_running--;
+  g_requests_cond.notify_all();
+}
+
 static int do_server() {
   // debuggerd crashes can't be reported to debuggerd.
   // Reset all of the crash handlers.
@@ -538,9 +602,27 @@ static int do_server() {
     return 1;
   fcntl(s, F_SETFD, FD_CLOEXEC);
 
+  int32_t max_requests = property_get_int32("debug.debuggerd.max_requests",
+                                            DEFAULT_MAX_REQUESTS);
+  if (max_requests < 1) {
+    max_requests = 1;
+  }
+  int timeout_sec = property_get_int32("debug.debuggerd.request_timeout",
+                                       DEFAULT_REQUEST_TIMEOUT_SEC);
+  if (timeout_sec > 0) {
+    g_request_timeout = std::chrono::seconds(timeout_sec);
+  }
+
   ALOGI("debuggerd: starting\n");
 
   for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(g_requests_mutex);
+      g_requests_cond.wait(lock, [max_requests]() {
+        return g_requests_running < static_cast<size_t>(max_requests);
+      });
+    }
+
     sockaddr addr;
     socklen_t alen = sizeof(addr);
 
@@ -553,7 +635,11 @@ static int do_server() {
 
     fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-    handle_request(fd);
+    {
+      std::lock_guard<std::mutex> lock(g_requests_mutex);
+      g_requests_running++;
+    }
+    std::thread(request_thread, fd).detach();
   }
   return 0;
 }
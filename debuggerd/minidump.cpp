@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DEBUG"
+
+#include <elf.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+
+#include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
+#include <base/file.h>
+#include <log/log.h>
+
+#include "elf_utils.h"
+#include "minidump.h"
+#include "utility.h"
+
+// Large enough for the NT_PRSTATUS registers of any supported architecture.
+#define MAX_REGS_SIZE 1024
+
+template <typename T>
+static void append(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void append_string(std::string* out, const std::string& value) {
+  append<uint32_t>(out, value.size());
+  out->append(value);
+}
+
+// Starts a record, whose size is filled in by end_record().
+static size_t begin_record(std::string* out, Minidump::RecordType type) {
+  append<uint32_t>(out, type);
+  size_t start = out->size();
+  append<uint32_t>(out, 0);
+  return start;
+}
+
+static void end_record(std::string* out, size_t start) {
+  uint32_t size = out->size() - start - sizeof(uint32_t);
+  memcpy(&(*out)[start], &size, sizeof(size));
+  out->append((8 - out->size() % 8) % 8, '\0');
+}
+
+Minidump::Minidump(pid_t pid, pid_t tid, int signal, int si_code, uintptr_t fault_addr) {
+  crash_.append("ADMP", 4);
+  append<uint32_t>(&crash_, kVersion);
+  size_t start = begin_record(&crash_, CRASH);
+  append<int32_t>(&crash_, pid);
+  append<int32_t>(&crash_, tid);
+  append<int32_t>(&crash_, signal);
+  append<int32_t>(&crash_, si_code);
+  append<uint64_t>(&crash_, fault_addr);
+  append_string(&crash_, ABI_STRING);
+  end_record(&crash_, start);
+}
+
+void Minidump::AddThread(Backtrace* backtrace) {
+  pid_t tid = backtrace->Tid();
+
+  uint8_t regs[MAX_REGS_SIZE];
+  struct iovec iov = { regs, sizeof(regs) };
+  if (ptrace(PTRACE_GETREGSET, tid, reinterpret_cast<void*>(NT_PRSTATUS), &iov) == -1) {
+    ALOGE("minidump: cannot get registers of %d: %s", tid, strerror(errno));
+    iov.iov_len = 0;
+  }
+
+  // The stack is read up from where the innermost frame left it, to the
+  // end of its mapping at most.
+  uintptr_t sp = 0;
+  size_t stack_size = 0;
+  std::unique_ptr<uint8_t[]> stack;
+  if (backtrace->NumFrames() > 0) {
+    sp = backtrace->GetFrame(0)->sp;
+    backtrace_map_t map;
+    backtrace->FillInMap(sp, &map);
+    if (sp >= map.start && sp < map.end) {
+      stack_size = map.end - sp;
+      if (stack_size > kStackBytes) {
+        stack_size = kStackBytes;
+      }
+      stack.reset(new uint8_t[stack_size]);
+      stack_size = backtrace->Read(sp, stack.get(), stack_size);
+    }
+  }
+
+  std::string record;
+  size_t start = begin_record(&record, THREAD);
+  append<int32_t>(&record, tid);
+  append<uint32_t>(&record, iov.iov_len);
+  record.append(reinterpret_cast<const char*>(regs), iov.iov_len);
+  append<uint64_t>(&record, sp);
+  append<uint32_t>(&record, stack_size);
+  if (stack_size > 0) {
+    record.append(reinterpret_cast<const char*>(stack.get()), stack_size);
+  }
+  end_record(&record, start);
+
+  std::lock_guard<std::mutex> guard(lock_);
+  threads_.append(record);
+}
+
+void Minidump::AddModules(Backtrace* backtrace, BacktraceMap* map) {
+  std::string build_id;
+  for (BacktraceMap::const_iterator it = map->begin(); it != map->end(); ++it) {
+    // Only mappings of files are of use to find the symbols with.
+    if (it->name.empty()) {
+      continue;
+    }
+    build_id.clear();
+    if (it->flags & PROT_READ) {
+      elf_get_build_id(backtrace, it->start, &build_id);
+    }
+    size_t start = begin_record(&modules_, MODULE);
+    append<uint64_t>(&modules_, it->start);
+    append<uint64_t>(&modules_, it->end);
+    append<uint64_t>(&modules_, it->offset);
+    append<uint64_t>(&modules_, it->load_base);
+    append<uint32_t>(&modules_, it->flags);
+    append_string(&modules_, build_id);
+    append_string(&modules_, it->name);
+    end_record(&modules_, start);
+  }
+}
+
+void Minidump::AddLog(const std::string& text) {
+  size_t start = begin_record(&log_, LOG);
+  log_.append(text);
+  end_record(&log_, start);
+}
+
+bool Minidump::Write(int fd) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return android::base::WriteFully(fd, crash_.data(), crash_.size()) &&
+         android::base::WriteFully(fd, threads_.data(), threads_.size()) &&
+         android::base::WriteFully(fd, modules_.data(), modules_.size()) &&
+         android::base::WriteFully(fd, log_.data(), log_.size());
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEBUGGERD_MINIDUMP_H
+#define _DEBUGGERD_MINIDUMP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <mutex>
+#include <string>
+
+class Backtrace;
+class BacktraceMap;
+
+// A compact binary companion to the text tombstone, written next to it as
+// tombstone_NN.dmp when debug.debuggerd.minidump is set. It holds what the
+// tombstone shows as text in raw form, for devices that upload crashes:
+// the registers and the top of the stack of every thread, the module list
+// with build ids, and, on debuggable builds, the log tail.
+//
+// The file starts with the magic "ADMP" and a uint32_t version, followed by
+// records of a uint32_t type and a uint32_t size, and size bytes of payload
+// padded to 8 bytes. Integers are in the byte order of the device.
+//   CRASH:  int32_t pid, tid, signal, si_code; uint64_t fault address;
+//           the abi as a string.
+//   THREAD: int32_t tid; uint32_t size of the registers, as returned by
+//           PTRACE_GETREGSET for NT_PRSTATUS, then the registers;
+//           uint64_t stack address; uint32_t size of the stack, then the
+//           stack.
+//   MODULE: uint64_t start, end, offset, load base; uint32_t flags; the
+//           build id, then the name, as strings.
+//   LOG:    the log tail, as text.
+// A string is a uint32_t length followed by that many bytes.
+class Minidump {
+ public:
+  enum RecordType : uint32_t {
+    CRASH = 1,
+    THREAD = 2,
+    MODULE = 3,
+    LOG = 4,
+  };
+
+  static constexpr uint32_t kVersion = 1;
+
+  // How much of the stack above the stack pointer of each thread is kept.
+  static constexpr size_t kStackBytes = 8 * 1024;
+
+  Minidump(pid_t pid, pid_t tid, int signal, int si_code, uintptr_t fault_addr);
+
+  // Adds the thread backtrace has been unwound from, which the caller must
+  // be attached to. Can be called from several threads at once.
+  void AddThread(Backtrace* backtrace);
+
+  void AddModules(Backtrace* backtrace, BacktraceMap* map);
+
+  void AddLog(const std::string& text);
+
+  // Writes the records out, in a handful of large writes.
+  bool Write(int fd);
+
+ private:
+  std::mutex lock_;
+  std::string crash_;
+  std::string threads_;
+  std::string modules_;
+  std::string log_;
+};
+
+#endif // _DEBUGGERD_MINIDUMP_H
@@ -34,7 +34,12 @@ class BacktraceMapMock : public BacktraceMap {
   virtual ~BacktraceMapMock() {}
 
   void AddMap(backtrace_map_t& map) {
-    maps_.push_back(map);
+    // Keep maps_ sorted, as FillIn expects.
+    auto it = maps_.begin();
+    while (it != maps_.end() && it->start < map.start) {
+      ++it;
+    }
+    maps_.insert(it, map);
   }
 };
 
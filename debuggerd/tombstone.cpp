@@ -31,12 +31,18 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <private/android_filesystem_config.h>
 
+#include <base/file.h>
 #include <base/stringprintf.h>
 #include <cutils/properties.h>
 #include <log/log.h>
@@ -51,10 +57,17 @@
 #include "backtrace.h"
 #include "elf_utils.h"
 #include "machine.h"
+#include "minidump.h"
 #include "tombstone.h"
 
 #define STACK_WORDS 16
 
+// The most threads used to dump the sibling threads of a crashed thread.
+#define MAX_SIBLING_WORKERS 4
+
+// How many lines of each log the minidump keeps.
+#define MINIDUMP_LOG_TAIL 50
+
 #define MAX_TOMBSTONES  10
 #define TOMBSTONE_DIR   "/data/tombstones"
 #define TOMBSTONE_TEMPLATE (TOMBSTONE_DIR"/tombstone_%02d")
@@ -424,9 +437,47 @@ static void dump_backtrace_and_stack(Backtrace* backtrace, log_t* log) {
   }
 }
 
+// Dumps one sibling thread, which must not be attached yet. Sets
+// detach_failed if the thread could not be detached cleanly.
+static void dump_sibling_thread(log_t* log, pid_t pid, pid_t new_tid, int* total_sleep_time_usec,
+                                bool* detach_failed, BacktraceMap* map, Minidump* minidump) {
+  // Skip this thread if cannot ptrace it
+  if (ptrace(PTRACE_ATTACH, new_tid, 0, 0) < 0) {
+    _LOG(log, logtype::ERROR, "ptrace attach to %d failed: %s\n", new_tid, strerror(errno));
+    return;
+  }
+
+  if (wait_for_sigstop(new_tid, total_sleep_time_usec, detach_failed) == -1) {
+    return;
+  }
+
+  log->current_tid = new_tid;
+  _LOG(log, logtype::THREAD, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
+  dump_thread_info(log, pid, new_tid);
+
+  dump_registers(log, new_tid);
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, new_tid, map));
+  if (backtrace->Unwind(0)) {
+    dump_backtrace_and_stack(backtrace.get(), log);
+  } else {
+    ALOGE("Unwind of sibling failed: pid = %d, tid = %d", pid, new_tid);
+  }
+  if (minidump != nullptr) {
+    minidump->AddThread(backtrace.get());
+  }
+
+  log->current_tid = log->crashed_tid;
+
+  if (ptrace(PTRACE_DETACH, new_tid, 0, 0) != 0) {
+    _LOG(log, logtype::ERROR, "ptrace detach from %d failed: %s\n", new_tid, strerror(errno));
+    *detach_failed = true;
+  }
+}
+
 // Return true if some thread is not detached cleanly
 static bool dump_sibling_thread_report(
-    log_t* log, pid_t pid, pid_t tid, int* total_sleep_time_usec, BacktraceMap* map) {
+    log_t* log, pid_t pid, pid_t tid, int* total_sleep_time_usec, BacktraceMap* map,
+    Minidump* minidump) {
   char task_path[64];
 
   snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
@@ -438,7 +489,7 @@ static bool dump_sibling_thread_report(
     return false;
   }
 
-  bool detach_failed = false;
+  std::vector<pid_t> tids;
   struct dirent* de;
   while ((de = readdir(d)) != NULL) {
     // Ignore "." and ".."
@@ -452,39 +503,63 @@ static bool dump_sibling_thread_report(
     if (*end || new_tid == tid) {
       continue;
     }
+    tids.push_back(new_tid);
+  }
+  closedir(d);
 
-    // Skip this thread if cannot ptrace it
-    if (ptrace(PTRACE_ATTACH, new_tid, 0, 0) < 0) {
-      _LOG(log, logtype::ERROR, "ptrace attach to %d failed: %s\n", new_tid, strerror(errno));
-      continue;
-    }
+  // Unwinding is most of the time spent on a process with many threads, so
+  // the threads are shared out between several workers, each collecting
+  // its output for the tombstone to be written in order at the end. Each
+  // worker attaches to the threads it dumps itself, since only the thread
+  // that attached can make ptrace requests.
+  size_t num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers > MAX_SIBLING_WORKERS) {
+    num_workers = MAX_SIBLING_WORKERS;
+  }
+  if (num_workers > tids.size()) {
+    num_workers = tids.size();
+  }
+  if (num_workers == 0) {
+    return false;
+  }
 
-    if (wait_for_sigstop(new_tid, total_sleep_time_usec, &detach_failed) == -1) {
-      continue;
+  std::vector<std::string> reports(tids.size());
+  std::atomic<size_t> next_thread(0);
+  // Every worker gets the sleep time left when they start.
+  std::vector<int> sleep_time_usec(num_workers, *total_sleep_time_usec);
+  std::unique_ptr<bool[]> detach_failed(new bool[num_workers]());
+  auto worker = [&](size_t n) {
+    log_t thread_log = *log;
+    for (size_t i; (i = next_thread++) < tids.size();) {
+      thread_log.buffer = &reports[i];
+      dump_sibling_thread(&thread_log, pid, tids[i], &sleep_time_usec[n], &detach_failed[n], map,
+                          minidump);
     }
+  };
+  std::vector<std::thread> threads;
+  for (size_t n = 1; n < num_workers; n++) {
+    threads.emplace_back(worker, n);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
 
-    log->current_tid = new_tid;
-    _LOG(log, logtype::THREAD, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
-    dump_thread_info(log, pid, new_tid);
-
-    dump_registers(log, new_tid);
-    std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, new_tid, map));
-    if (backtrace->Unwind(0)) {
-      dump_backtrace_and_stack(backtrace.get(), log);
-    } else {
-      ALOGE("Unwind of sibling failed: pid = %d, tid = %d", pid, new_tid);
+  for (const std::string& report : reports) {
+    // Output for sibling threads only ever goes to the tombstone.
+    if (log->tfd != -1 && !android::base::WriteFully(log->tfd, report.data(), report.size())) {
+      ALOGE("Tombstone write failed: %s", strerror(errno));
     }
+  }
 
-    log->current_tid = log->crashed_tid;
-
-    if (ptrace(PTRACE_DETACH, new_tid, 0, 0) != 0) {
-      _LOG(log, logtype::ERROR, "ptrace detach from %d failed: %s\n", new_tid, strerror(errno));
-      detach_failed = true;
+  bool any_detach_failed = false;
+  for (size_t n = 0; n < num_workers; n++) {
+    any_detach_failed |= detach_failed[n];
+    if (sleep_time_usec[n] > *total_sleep_time_usec) {
+      *total_sleep_time_usec = sleep_time_usec[n];
     }
   }
-
-  closedir(d);
-  return detach_failed;
+  return any_detach_failed;
 }
 
 // Reads the contents of the specified log device, filters out the entries
@@ -492,6 +567,7 @@ static bool dump_sibling_thread_report(
 //
 // If "tail" is non-zero, log the last "tail" number of lines.
 static EventTagMap* g_eventTagMap = NULL;
+static std::once_flag g_eventTagMap_once;
 
 static void dump_log_file(
     log_t* log, pid_t pid, const char* filename, unsigned int tail) {
@@ -566,9 +642,9 @@ static void dump_log_file(
     strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
 
     if (log_entry.id() == LOG_ID_EVENTS) {
-      if (!g_eventTagMap) {
+      std::call_once(g_eventTagMap_once, []() {
         g_eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
-      }
+      });
       AndroidLogEntry e;
       char buf[512];
       android_log_processBinaryLogBuffer(entry, &e, g_eventTagMap, buf, sizeof(buf));
@@ -644,7 +720,7 @@ static void dump_abort_message(Backtrace* backtrace, log_t* log, uintptr_t addre
 // Dumps all information about the specified pid to the tombstone.
 static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code,
                        uintptr_t abort_msg_address, bool dump_sibling_threads,
-                       int* total_sleep_time_usec) {
+                       int* total_sleep_time_usec, Minidump* minidump) {
   // don't copy log messages to tombstone unless this is a dev device
   char value[PROPERTY_VALUE_MAX];
   property_get("ro.debuggable", value, "0");
@@ -683,13 +759,28 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code
     dump_all_maps(backtrace.get(), map.get(), log, tid);
   }
 
+  if (minidump != nullptr) {
+    minidump->AddThread(backtrace.get());
+    if (map.get() != nullptr) {
+      minidump->AddModules(backtrace.get(), map.get());
+    }
+    if (want_logs) {
+      std::string text;
+      log_t text_log = *log;
+      text_log.buffer = &text;
+      dump_logs(&text_log, pid, MINIDUMP_LOG_TAIL);
+      minidump->AddLog(text);
+    }
+  }
+
   if (want_logs) {
     dump_logs(log, pid, 5);
   }
 
   bool detach_failed = false;
   if (dump_sibling_threads) {
-    detach_failed = dump_sibling_thread_report(log, pid, tid, total_sleep_time_usec, map.get());
+    detach_failed = dump_sibling_thread_report(log, pid, tid, total_sleep_time_usec, map.get(),
+                                               minidump);
   }
 
   if (want_logs) {
@@ -714,6 +805,12 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code
 //
 // Returns the path of the tombstone file, allocated using malloc().  Caller must free() it.
 static char* find_and_open_tombstone(int* fd) {
+  // Requests for different processes are handled concurrently; the
+  // truncation below updates the mtime, so holding this over the scan and
+  // the open keeps two of them from picking the same oldest file.
+  static std::mutex tombstone_mutex;
+  std::lock_guard<std::mutex> guard(tombstone_mutex);
+
   // In a single pass, find an available slot and, in case none
   // exist, find and record the least-recently-modified file.
   char path[128];
@@ -757,6 +854,27 @@ static char* find_and_open_tombstone(int* fd) {
   return strdup(path);
 }
 
+// Writes the minidump next to the tombstone at path, or removes the one
+// left there by the last tombstone in that slot if there is none.
+static void write_minidump(const char* path, Minidump* minidump) {
+  std::string dmp_path = std::string(path) + ".dmp";
+  if (minidump == nullptr) {
+    unlink(dmp_path.c_str());
+    return;
+  }
+
+  int fd = open(dmp_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ALOGE("failed to open minidump file '%s': %s\n", dmp_path.c_str(), strerror(errno));
+    return;
+  }
+  fchown(fd, AID_SYSTEM, AID_SYSTEM);
+  if (!minidump->Write(fd)) {
+    ALOGE("failed to write minidump file '%s': %s\n", dmp_path.c_str(), strerror(errno));
+  }
+  close(fd);
+}
+
 static int activity_manager_connect() {
   int amfd = socket(PF_UNIX, SOCK_STREAM, 0);
   if (amfd >= 0) {
@@ -809,8 +927,21 @@ char* engrave_tombstone(pid_t pid, pid_t tid, int signal, int original_si_code,
   // being closed.
   int amfd = activity_manager_connect();
   log.amfd = amfd;
+
+  std::unique_ptr<Minidump> minidump;
+  if (property_get_bool("debug.debuggerd.minidump", false)) {
+    uintptr_t fault_addr = 0;
+    siginfo_t si;
+    memset(&si, 0, sizeof(si));
+    if (signal_has_si_addr(signal) && ptrace(PTRACE_GETSIGINFO, tid, 0, &si) != -1) {
+      fault_addr = reinterpret_cast<uintptr_t>(si.si_addr);
+    }
+    minidump.reset(new Minidump(pid, tid, signal, original_si_code, fault_addr));
+  }
+
   *detach_failed = dump_crash(&log, pid, tid, signal, original_si_code, abort_msg_address,
-                              dump_sibling_threads, total_sleep_time_usec);
+                              dump_sibling_threads, total_sleep_time_usec, minidump.get());
+  write_minidump(path, minidump.get());
 
   _LOG(&log, logtype::BACKTRACE, "\nTombstone written to: %s\n", path);
 
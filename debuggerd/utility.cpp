@@ -63,6 +63,11 @@ void _LOG(log_t* log, enum logtype ltype, const char* fmt, ...) {
     return;
   }
 
+  if (log->buffer != nullptr) {
+    log->buffer->append(buf, len);
+    return;
+  }
+
   if (write_to_tombstone) {
     TEMP_FAILURE_RETRY(write(log->tfd, buf, len));
   }
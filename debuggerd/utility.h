@@ -21,6 +21,8 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+#include <string>
+
 #include <backtrace/Backtrace.h>
 
 // Figure out the abi based on defined macros.
@@ -52,9 +54,14 @@ struct log_t{
     pid_t current_tid;
     // logd daemon crash, can block asking for logcat data, allow suppression.
     bool should_retrieve_logcat;
+    // If set, output is appended here instead of being written anywhere.
+    // Threads that are dumped in parallel collect their output in here so
+    // that it can be written out in order.
+    std::string* buffer;
 
     log_t()
-        : tfd(-1), amfd(-1), crashed_tid(-1), current_tid(-1), should_retrieve_logcat(true) {}
+        : tfd(-1), amfd(-1), crashed_tid(-1), current_tid(-1), should_retrieve_logcat(true),
+          buffer(nullptr) {}
 };
 
 // List of types of logs to simplify the logging decision in _LOG
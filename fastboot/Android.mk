@@ -60,6 +60,7 @@ LOCAL_STATIC_LIBRARIES := \
     libext4_utils_host \
     libsparse_host \
     libutils \
+    libcutils \
     liblog \
     libz \
     libbase
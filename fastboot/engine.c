@@ -29,9 +29,12 @@
 #include "fastboot.h"
 #include "fs.h"
 
+#include <sparse/sparse.h>
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,6 +45,7 @@
 #ifdef USE_MINGW
 #include <fcntl.h>
 #else
+#include <pthread.h>
 #include <sys/mman.h>
 #endif
 
@@ -57,11 +61,31 @@
 #define OP_NOTICE     4
 #define OP_DOWNLOAD_SPARSE 5
 #define OP_WAIT_FOR_DISCONNECT 6
+#define OP_RESPARSE   7
+#define OP_DOWNLOAD_FD 8
+#define OP_DOWNLOAD_STREAM 9
+#define OP_FLASH_CHANGED 10
+#define OP_LOAD       11
 
 typedef struct Action Action;
 
 #define CMD_SIZE 64
 
+/* A device the queue runs on, see fb_execute_queues */
+struct queue_run {
+    usb_handle *usb;
+    const char *name;       /* for the json stats, if known */
+    const char *tag;        /* put in front of each line of its output */
+    char *product;          /* where "product" is saved, for cb_check */
+    char saved_product[FB_RESPONSE_SZ + 1];
+    Action *list;
+    int status;
+    double elapsed;
+#ifndef USE_MINGW
+    pthread_t thread;
+#endif
+};
+
 struct Action
 {
     unsigned op;
@@ -70,17 +94,29 @@ struct Action
     char cmd[CMD_SIZE];
     const char *prod;
     void *data;
+    int fd;
+    fb_stream_func stream;
+    fb_load_func load;
     unsigned size;
 
     const char *msg;
     int (*func)(Action *a, int status, char *resp);
 
     double start;
+    struct queue_run *run;
+
+    /* how it went, for the json stats */
+    bool ran;
+    int status;
+    double elapsed;
+    struct fb_download_stats stats;     /* of the data it sent or wrote */
 };
 
 static Action *action_list = 0;
 static Action *action_last = 0;
 
+static FILE *json_stats = 0;
+
 
 
 
@@ -121,46 +157,87 @@ int fb_format_supported(usb_handle *usb, const char *partition, const char *type
     return !!fs_get_generator(fs_type);
 }
 
+/* Prints a line of output for a, tagged with the device it is running on */
+static void report(Action *a, const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "%s%s", a->run->tag, line);
+}
+
 static int cb_default(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        report(a, "FAILED (%s)\n", resp);
     } else {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
+        report(a, "OKAY [%7.3fs]\n", (split - a->start));
         a->start = split;
     }
     return status;
 }
 
-static Action *queue_action(unsigned op, const char *fmt, ...)
+static Action *new_action(unsigned op, const char *fmt, va_list ap)
 {
     Action *a;
-    va_list ap;
     size_t cmdsize;
 
     a = calloc(1, sizeof(Action));
     if (a == 0) die("out of memory");
 
-    va_start(ap, fmt);
     cmdsize = vsnprintf(a->cmd, sizeof(a->cmd), fmt, ap);
-    va_end(ap);
 
     if (cmdsize >= sizeof(a->cmd)) {
         free(a);
         die("Command length (%d) exceeds maximum size (%d)", cmdsize, sizeof(a->cmd));
     }
 
+    a->op = op;
+    a->func = cb_default;
+
+    a->start = -1;
+
+    return a;
+}
+
+static Action *queue_action(unsigned op, const char *fmt, ...)
+{
+    Action *a;
+    va_list ap;
+
+    va_start(ap, fmt);
+    a = new_action(op, fmt, ap);
+    va_end(ap);
+
     if (action_last) {
         action_last->next = a;
     } else {
         action_list = a;
     }
     action_last = a;
-    a->op = op;
-    a->func = cb_default;
 
-    a->start = -1;
+    return a;
+}
+
+/* Like queue_action, but to run right after prev, while the queue runs */
+static Action *insert_action(Action *prev, unsigned op, const char *fmt, ...)
+{
+    Action *a;
+    va_list ap;
+
+    va_start(ap, fmt);
+    a = new_action(op, fmt, ap);
+    va_end(ap);
+
+    a->next = prev->next;
+    prev->next = a;
+    if (action_last == prev) {
+        action_last = a;
+    }
 
     return a;
 }
@@ -185,6 +262,33 @@ void fb_queue_flash(const char *ptn, void *data, unsigned sz)
     a->msg = mkmsg("writing '%s'", ptn);
 }
 
+void fb_queue_flash_fd(const char *ptn, int fd, unsigned sz)
+{
+    Action *a;
+
+    a = queue_action(OP_DOWNLOAD_FD, "");
+    a->fd = fd;
+    a->size = sz;
+    a->msg = mkmsg("sending '%s' (%d KB)", ptn, sz / 1024);
+
+    a = queue_action(OP_COMMAND, "flash:%s", ptn);
+    a->msg = mkmsg("writing '%s'", ptn);
+}
+
+void fb_queue_flash_stream(const char *ptn, fb_stream_func stream, void *priv, unsigned sz)
+{
+    Action *a;
+
+    a = queue_action(OP_DOWNLOAD_STREAM, "");
+    a->stream = stream;
+    a->data = priv;
+    a->size = sz;
+    a->msg = mkmsg("sending '%s' (%d KB)", ptn, sz / 1024);
+
+    a = queue_action(OP_COMMAND, "flash:%s", ptn);
+    a->msg = mkmsg("writing '%s'", ptn);
+}
+
 void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s, unsigned sz)
 {
     Action *a;
@@ -198,6 +302,359 @@ void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s, unsigned sz)
     a->msg = mkmsg("writing '%s'", ptn);
 }
 
+struct resparse {
+    struct sparse_file *s;
+    struct sparse_file *piece;  /* the last one taken off s */
+    unsigned max_size;
+};
+
+void fb_queue_flash_resparse(const char *ptn, struct sparse_file *s, unsigned max_size)
+{
+    struct resparse *r;
+    Action *a;
+
+    r = calloc(1, sizeof(*r));
+    if (r == 0) die("out of memory");
+    r->s = s;
+    r->max_size = max_size;
+
+    a = queue_action(OP_RESPARSE, "%s", ptn);
+    a->data = r;
+}
+
+/* Queues sending and flashing piece right after prev, returns the last */
+static Action *insert_piece(Action *prev, const char *ptn, struct sparse_file *piece)
+{
+    int64_t sz64 = sparse_file_len(piece, true, false);
+    Action *a;
+
+    a = insert_action(prev, OP_DOWNLOAD_SPARSE, "");
+    a->data = piece;
+    a->size = 0;
+    a->msg = mkmsg("sending sparse '%s' (%d KB)", ptn, (int)(sz64 / 1024));
+
+    a = insert_action(a, OP_COMMAND, "flash:%s", ptn);
+    a->msg = mkmsg("writing '%s'", ptn);
+
+    return a;
+}
+
+/*
+ * Takes the next piece off the sparse file and queues sending and flashing
+ * it, and then this again, right after a.  So the first piece is on its
+ * way before the rest of the file has been split up.
+ */
+static void resparse_next(Action *a)
+{
+    struct resparse *r = a->data;
+    const char *ptn = a->cmd;
+    struct sparse_file *piece;
+    int ret;
+
+    if (r->piece) {
+        sparse_file_destroy(r->piece);
+        r->piece = NULL;
+    }
+
+    ret = sparse_file_resparse_next(r->s, r->max_size, &piece);
+    if (ret < 0) {
+        die("Failed to resparse\n");
+    }
+    if (ret == 0) {
+        sparse_file_destroy(r->s);
+        free(r);
+        return;
+    }
+    r->piece = piece;
+
+    a = insert_piece(a, ptn, piece);
+    a = insert_action(a, OP_RESPARSE, "%s", ptn);
+    a->data = r;
+}
+
+/*
+ * Splits up every sparse image at once, in place of the OP_RESPARSE
+ * actions, for a queue that is going to run more than once.  The pieces
+ * are kept until we exit.
+ */
+static void resparse_all(void)
+{
+    Action *prev = NULL;
+    Action *a = action_list;
+    Action *next;
+    Action *last;
+    struct resparse *r;
+    struct sparse_file *piece;
+    int ret;
+
+    while (a) {
+        if (a->op != OP_RESPARSE) {
+            prev = a;
+            a = a->next;
+            continue;
+        }
+
+        r = a->data;
+        last = a;
+        while ((ret = sparse_file_resparse_next(r->s, r->max_size, &piece)) > 0) {
+            last = insert_piece(last, a->cmd, piece);
+        }
+        if (ret < 0) {
+            die("Failed to resparse\n");
+        }
+        sparse_file_destroy(r->s);
+        free(r);
+
+        next = a->next;
+        if (prev) {
+            prev->next = next;
+        } else {
+            action_list = next;
+        }
+        if (action_last == a) {
+            action_last = prev;
+        }
+        free(a);
+        a = next;
+    }
+}
+
+/*
+ * A sparse image to flash only the parts of which differ from what is on
+ * the device, which it is asked about with "crc32-compare".  Each range is
+ * the data of the image within one CHANGED_CHUNK_SIZE chunk of the
+ * partition, so a small change costs about a chunk to send.
+ */
+#define CHANGED_CHUNK_SIZE (1024 * 1024)
+#define CHANGED_RECORD_SIZE 16
+
+struct changed_range {
+    unsigned block;
+    unsigned count;
+};
+
+struct changed_image {
+    struct sparse_file *s;
+    unsigned max_size;
+    unsigned block_size;
+    struct changed_range *ranges;
+    unsigned count;
+    unsigned char *records;     /* what is downloaded for crc32-compare */
+};
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int add_changed_range(void *priv, unsigned block, unsigned count, uint32_t crc)
+{
+    struct changed_image *c = priv;
+    uint64_t offset = (uint64_t)block * c->block_size;
+    unsigned char *record;
+
+    c->ranges = realloc(c->ranges, (c->count + 1) * sizeof(*c->ranges));
+    c->records = realloc(c->records, (c->count + 1) * CHANGED_RECORD_SIZE);
+    if (!c->ranges || !c->records) die("out of memory");
+
+    c->ranges[c->count].block = block;
+    c->ranges[c->count].count = count;
+    record = c->records + c->count * CHANGED_RECORD_SIZE;
+    put_le32(record, offset);
+    put_le32(record + 4, offset >> 32);
+    put_le32(record + 8, count * c->block_size);
+    put_le32(record + 12, crc);
+    c->count++;
+    return 0;
+}
+
+void fb_queue_flash_changed(const char *ptn, struct sparse_file *s, unsigned max_size)
+{
+    struct changed_image *c;
+    unsigned chunk;
+    Action *a;
+
+    c = calloc(1, sizeof(*c));
+    if (c == 0) die("out of memory");
+    c->s = s;
+    c->max_size = max_size;
+    c->block_size = sparse_file_block_size(s);
+
+    chunk = CHANGED_CHUNK_SIZE - CHANGED_CHUNK_SIZE % c->block_size;
+    if (chunk == 0) chunk = c->block_size;
+    if (sparse_file_chunk_crc32(s, chunk, add_changed_range, c) < 0) {
+        die("cannot checksum '%s'", ptn);
+    }
+
+    a = queue_action(OP_FLASH_CHANGED, "%s", ptn);
+    a->data = c;
+    a->msg = mkmsg("comparing '%s' (%d ranges)", ptn, c->count);
+}
+
+/* Asks the device which ranges differ, all of them if it can't say */
+static int compare_changed(Action *a, struct changed_image *c, unsigned char *bitmap)
+{
+    usb_handle *usb = a->run->usb;
+    unsigned bitmap_size = (c->count + 7) / 8;
+    char resp[FB_RESPONSE_SZ + 1];
+    char cmd[CMD_SIZE];
+
+    if (fb_getvar(usb, resp, "crc32-compare") || strcmp(resp, "yes")) {
+        report(a, "device can't compare, sending all of '%s'\n", a->cmd);
+        memset(bitmap, 0xff, bitmap_size);
+        return 0;
+    }
+
+    snprintf(cmd, sizeof(cmd), "crc32-compare:%s", a->cmd);
+    if (fb_download_data(usb, c->records, c->count * CHANGED_RECORD_SIZE) ||
+            fb_command_upload(usb, cmd, bitmap, bitmap_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Adds the sent part of a piece of the image to what a has sent so far */
+static void add_download_stats(Action *a)
+{
+    struct fb_download_stats stats;
+
+    fb_get_download_stats(&stats);
+    a->stats.bytes += stats.bytes;
+    a->stats.read += stats.read;
+    a->stats.usb += stats.usb;
+    a->stats.device += stats.device;
+}
+
+/*
+ * Sends and flashes the ranges of the image the device says differ, split
+ * up like fb_queue_flash_resparse would.  The ranges are put in a sparse
+ * file of their own, which leaves the rest of the partition alone, so
+ * several devices can do this with the same image at once.
+ */
+static int flash_changed(Action *a)
+{
+    struct changed_image *c = a->data;
+    usb_handle *usb = a->run->usb;
+    struct sparse_file *changed;
+    struct sparse_file *piece;
+    unsigned char *bitmap;
+    unsigned blocks = 0;
+    char cmd[CMD_SIZE];
+    unsigned i;
+    int status;
+    int ret;
+
+    bitmap = calloc(1, (c->count + 7) / 8 + 1);
+    changed = sparse_file_new(c->block_size, sparse_file_expanded_len(c->s));
+    if (!bitmap || !changed) die("out of memory");
+
+    status = compare_changed(a, c, bitmap);
+    if (status) {
+        report(a, "FAILED (%s)\n", fb_get_error());
+        goto out;
+    }
+
+    for (i = 0; i < c->count; i++) {
+        if (!(bitmap[i / 8] & (1 << (i % 8)))) continue;
+        if (sparse_file_copy_blocks(c->s, changed, c->ranges[i].block, c->ranges[i].count)) {
+            die("cannot copy '%s'", a->cmd);
+        }
+        blocks += c->ranges[i].count;
+    }
+    if (blocks == 0) {
+        report(a, "'%s' is unchanged\n", a->cmd);
+        goto out;
+    }
+
+    snprintf(cmd, sizeof(cmd), "flash:%s", a->cmd);
+    while ((ret = sparse_file_resparse_next(changed, c->max_size, &piece)) > 0) {
+        report(a, "sending sparse '%s' (%d KB of changes)...\n", a->cmd,
+               (int)(sparse_file_len(piece, true, false) / 1024));
+        status = fb_download_data_sparse(usb, piece);
+        add_download_stats(a);
+        if (!status) {
+            report(a, "writing '%s'...\n", a->cmd);
+            status = fb_command(usb, cmd);
+        }
+        sparse_file_destroy(piece);
+        if (status) {
+            report(a, "FAILED (%s)\n", fb_get_error());
+            goto out;
+        }
+    }
+    if (ret < 0) {
+        die("Failed to resparse\n");
+    }
+    report(a, "OKAY [%7.3fs], %u of %u blocks changed\n", now() - a->start, blocks,
+           (unsigned)((sparse_file_expanded_len(c->s) + c->block_size - 1) / c->block_size));
+
+out:
+    sparse_file_destroy(changed);
+    free(bitmap);
+    return status;
+}
+
+/*
+ * Queues a call to load(priv) for when the queue gets this far, for an
+ * image that is still being made: what load queues runs right after.  So
+ * sending what comes first overlaps with making it.
+ */
+void fb_queue_load(fb_load_func load, void *priv)
+{
+    Action *a;
+
+    a = queue_action(OP_LOAD, "");
+    a->load = load;
+    a->data = priv;
+}
+
+/* Calls a's load, with what it queues going in right after a */
+static void load_now(Action *a)
+{
+    Action *rest = a->next;
+    Action *last = action_last;
+
+    a->next = NULL;
+    action_last = a;
+    a->load(a->data);
+    if (rest) {
+        action_last->next = rest;
+        action_last = last;
+    }
+}
+
+/* Loads everything up front, for a queue that is going to run more than once */
+static void load_all(void)
+{
+    Action *prev = NULL;
+    Action *a = action_list;
+    Action *next;
+
+    while (a) {
+        if (a->op != OP_LOAD) {
+            prev = a;
+            a = a->next;
+            continue;
+        }
+
+        load_now(a);
+        next = a->next;
+        if (prev) {
+            prev->next = next;
+        } else {
+            action_list = next;
+        }
+        if (action_last == a) {
+            action_last = prev;
+        }
+        free(a);
+        a = next;
+    }
+}
+
 static int match(char *str, const char **value, unsigned count)
 {
     unsigned n;
@@ -230,15 +687,15 @@ static int cb_check(Action *a, int status, char *resp, int invert)
     int yes;
 
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        report(a, "FAILED (%s)\n", resp);
         return status;
     }
 
     if (a->prod) {
-        if (strcmp(a->prod, cur_product) != 0) {
+        if (strcmp(a->prod, a->run->product) != 0) {
             double split = now();
-            fprintf(stderr,"IGNORE, product is %s required only for %s [%7.3fs]\n",
-                    cur_product, a->prod, (split - a->start));
+            report(a, "IGNORE, product is %s required only for %s [%7.3fs]\n",
+                   a->run->product, a->prod, (split - a->start));
             a->start = split;
             return 0;
         }
@@ -249,15 +706,14 @@ static int cb_check(Action *a, int status, char *resp, int invert)
 
     if (yes) {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
+        report(a, "OKAY [%7.3fs]\n", (split - a->start));
         a->start = split;
         return 0;
     }
 
-    fprintf(stderr,"FAILED\n\n");
-    fprintf(stderr,"Device %s is '%s'.\n", a->cmd + 7, resp);
-    fprintf(stderr,"Update %s '%s'",
-            invert ? "rejects" : "requires", value[0]);
+    report(a, "FAILED\n\n");
+    report(a, "Device %s is '%s'.\n", a->cmd + 7, resp);
+    report(a, "Update %s '%s'", invert ? "rejects" : "requires", value[0]);
     for (n = 1; n < count; n++) {
         fprintf(stderr," or '%s'", value[n]);
     }
@@ -291,10 +747,10 @@ void fb_queue_require(const char *prod, const char *var,
 static int cb_display(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        report(a, "%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
-    fprintf(stderr, "%s: %s\n", (char*) a->data, resp);
+    report(a, "%s: %s\n", (char*) a->data, resp);
     return 0;
 }
 
@@ -310,7 +766,7 @@ void fb_queue_display(const char *var, const char *prettyname)
 static int cb_save(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        report(a, "%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
     strncpy(a->data, resp, a->size);
@@ -326,9 +782,9 @@ void fb_queue_query_save(const char *var, char *dest, unsigned dest_size)
     a->func = cb_save;
 }
 
-static int cb_do_nothing(Action *a __unused, int status __unused, char *resp __unused)
+static int cb_do_nothing(Action *a, int status __unused, char *resp __unused)
 {
-    fprintf(stderr,"\n");
+    report(a, "\n");
     return 0;
 }
 
@@ -364,51 +820,314 @@ void fb_queue_wait_for_disconnect(void)
     queue_action(OP_WAIT_FOR_DISCONNECT, "");
 }
 
-int fb_execute_queue(usb_handle *usb)
+static bool is_download(Action *a)
 {
+    return a->op == OP_DOWNLOAD || a->op == OP_DOWNLOAD_SPARSE ||
+           a->op == OP_DOWNLOAD_FD || a->op == OP_DOWNLOAD_STREAM ||
+           a->op == OP_FLASH_CHANGED;
+}
+
+static void report_rate(char *buf, size_t size, unsigned bytes, double secs)
+{
+    if (secs > 0) {
+        snprintf(buf, size, "%.3fs (%.1f MB/s)", secs, bytes / secs / (1024 * 1024));
+    } else {
+        snprintf(buf, size, "%.3fs", secs);
+    }
+}
+
+/* Where the time of a download went, after its OKAY */
+static void report_download(Action *a)
+{
+    char read[32];
+    char usb[32];
+
+    report_rate(read, sizeof(read), a->stats.bytes, a->stats.read);
+    report_rate(usb, sizeof(usb), a->stats.bytes, a->stats.usb);
+    report(a, "    read %s, usb %s, device %.3fs\n", read, usb, a->stats.device);
+}
+
+static int execute_actions(struct queue_run *run)
+{
+    usb_handle *usb = run->usb;
     Action *a;
     char resp[FB_RESPONSE_SZ+1];
+    unsigned last_bytes = 0;
+    double action_start;
     int status = 0;
 
-    a = action_list;
+    a = run->list;
     if (!a)
         return status;
     resp[FB_RESPONSE_SZ] = 0;
 
     double start = -1;
-    for (a = action_list; a; a = a->next) {
+    for (a = run->list; a; a = a->next) {
+        a->run = run;
         a->start = now();
+        action_start = a->start;
         if (start < 0) start = a->start;
         if (a->msg) {
             // fprintf(stderr,"%30s... ",a->msg);
-            fprintf(stderr,"%s...\n",a->msg);
+            report(a, "%s...\n", a->msg);
         }
         if (a->op == OP_DOWNLOAD) {
             status = fb_download_data(usb, a->data, a->size);
+            fb_get_download_stats(&a->stats);
             status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
         } else if (a->op == OP_COMMAND) {
             status = fb_command(usb, a->cmd);
             status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
+            if (!strncmp(a->cmd, "flash:", 6)) {
+                a->stats.bytes = last_bytes;
+            }
         } else if (a->op == OP_QUERY) {
             status = fb_command_response(usb, a->cmd, resp);
             status = a->func(a, status, status ? fb_get_error() : resp);
-            if (status) break;
         } else if (a->op == OP_NOTICE) {
-            fprintf(stderr,"%s\n",(char*)a->data);
+            report(a, "%s\n", (char*)a->data);
         } else if (a->op == OP_DOWNLOAD_SPARSE) {
             status = fb_download_data_sparse(usb, a->data);
+            fb_get_download_stats(&a->stats);
             status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
         } else if (a->op == OP_WAIT_FOR_DISCONNECT) {
             usb_wait_for_disconnect(usb);
+        } else if (a->op == OP_RESPARSE) {
+            resparse_next(a);
+        } else if (a->op == OP_DOWNLOAD_FD) {
+            status = fb_download_data_fd(usb, a->fd, a->size);
+            fb_get_download_stats(&a->stats);
+            status = a->func(a, status, status ? fb_get_error() : "");
+        } else if (a->op == OP_DOWNLOAD_STREAM) {
+            status = fb_download_data_stream(usb, a->size, a->stream, a->data);
+            fb_get_download_stats(&a->stats);
+            status = a->func(a, status, status ? fb_get_error() : "");
+        } else if (a->op == OP_FLASH_CHANGED) {
+            status = flash_changed(a);
+        } else if (a->op == OP_LOAD) {
+            load_now(a);
         } else {
             die("bogus action");
         }
+
+        a->ran = true;
+        a->status = status;
+        a->elapsed = now() - action_start;
+        if (status) break;
+        if (is_download(a) && a->stats.bytes) {
+            report_download(a);
+            last_bytes = a->stats.bytes;
+        }
+    }
+
+    run->elapsed = now() - start;
+    fprintf(stderr,"%sfinished. total time: %.3fs\n", run->tag, run->elapsed);
+    run->status = status;
+    return status;
+}
+
+void fb_set_json_stats(FILE *f)
+{
+    json_stats = f;
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static double rate(unsigned bytes, double secs)
+{
+    return secs > 0 ? bytes / secs : 0;
+}
+
+static const char *op_name(Action *a)
+{
+    if (a->op == OP_FLASH_CHANGED) return "flash-changed";
+    if (is_download(a)) return "download";
+    if (a->op == OP_COMMAND) return "command";
+    if (a->op == OP_QUERY) return "query";
+    if (a->op == OP_WAIT_FOR_DISCONNECT) return "wait-for-disconnect";
+    return NULL;
+}
+
+/*
+ * Writes what was done on each device to the file given to
+ * fb_set_json_stats, as one object with a "devices" array, each with the
+ * "actions" that ran on it.  Downloads say where their time went, and
+ * flash commands how much they wrote.
+ */
+static void write_json_stats(struct queue_run *runs, unsigned count)
+{
+    FILE *f = json_stats;
+    struct queue_run *run;
+    const char *op;
+    bool first;
+    Action *a;
+    unsigned i;
+
+    if (!f) return;
+
+    fprintf(f, "{\"devices\": [");
+    for (i = 0; i < count; i++) {
+        run = &runs[i];
+        fprintf(f, "%s\n  {\"serial\": ", i ? "," : "");
+        if (run->name) {
+            json_string(f, run->name);
+        } else {
+            fprintf(f, "null");
+        }
+        fprintf(f, ", \"status\": \"%s\", \"seconds\": %.6f, \"actions\": [",
+                run->status ? "failed" : "okay", run->elapsed);
+
+        first = true;
+        for (a = run->list; a; a = a->next) {
+            op = op_name(a);
+            if (!a->ran || !op) continue;
+            fprintf(f, "%s\n    {\"op\": \"%s\", ", first ? "" : ",", op);
+            first = false;
+            if (a->cmd[0]) {
+                fprintf(f, "\"command\": ");
+                json_string(f, a->cmd);
+                fprintf(f, ", ");
+            }
+            if (a->msg) {
+                fprintf(f, "\"message\": ");
+                json_string(f, a->msg);
+                fprintf(f, ", ");
+            }
+            fprintf(f, "\"status\": \"%s\", \"seconds\": %.6f",
+                    a->status ? "failed" : "okay", a->elapsed);
+            if (is_download(a)) {
+                fprintf(f, ", \"bytes\": %u, \"read_seconds\": %.6f, \"usb_seconds\": %.6f"
+                        ", \"device_seconds\": %.6f, \"read_bytes_per_second\": %.0f"
+                        ", \"usb_bytes_per_second\": %.0f",
+                        a->stats.bytes, a->stats.read, a->stats.usb, a->stats.device,
+                        rate(a->stats.bytes, a->stats.read), rate(a->stats.bytes, a->stats.usb));
+            } else if (a->stats.bytes) {
+                fprintf(f, ", \"bytes\": %u, \"bytes_per_second\": %.0f",
+                        a->stats.bytes, rate(a->stats.bytes, a->elapsed));
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+    fflush(f);
+}
+
+int fb_execute_queue(usb_handle *usb)
+{
+    struct queue_run run;
+
+    memset(&run, 0, sizeof(run));
+    run.usb = usb;
+    run.tag = "";
+    run.product = cur_product;
+    run.list = action_list;
+    execute_actions(&run);
+    write_json_stats(&run, 1);
+    return run.status;
+}
+
+/*
+ * A device's own copy of the queue, to keep the state of its run in.
+ * What the actions send is shared.
+ */
+static Action *copy_actions(struct queue_run *run)
+{
+    Action *list = NULL;
+    Action **tail = &list;
+    Action *a;
+    Action *copy;
+
+    for (a = action_list; a; a = a->next) {
+        copy = malloc(sizeof(*copy));
+        if (copy == 0) die("out of memory");
+        *copy = *a;
+        copy->next = NULL;
+        if (copy->func == cb_save && copy->data == cur_product) {
+            copy->data = run->product;
+        }
+        *tail = copy;
+        tail = &copy->next;
     }
+    return list;
+}
 
-    fprintf(stderr,"finished. total time: %.3fs\n", (now() - start));
+#ifndef USE_MINGW
+static void *execute_thread(void *arg)
+{
+    execute_actions(arg);
+    return NULL;
+}
+#endif
+
+/*
+ * Runs the queue on count devices at once, a thread each, so flashing
+ * them takes about as long as flashing the slowest one would.  Images are
+ * read from the same buffers and fds by all of them, and sparse images are
+ * split up once, here.  Without threads the devices go one after the
+ * other.  Returns nonzero if the queue failed on any of them.
+ */
+int fb_execute_queues(usb_handle **usbs, const char **names, unsigned count)
+{
+    struct queue_run *runs;
+    Action *a;
+    unsigned i;
+    int status = 0;
+
+    load_all();
+    resparse_all();
+
+    runs = calloc(count, sizeof(*runs));
+    if (runs == 0) die("out of memory");
+    for (i = 0; i < count; i++) {
+        runs[i].usb = usbs[i];
+        runs[i].name = names[i];
+        runs[i].tag = mkmsg("%s: ", names[i]);
+        runs[i].product = runs[i].saved_product;
+        runs[i].list = copy_actions(&runs[i]);
+    }
+
+#ifdef USE_MINGW
+    for (i = 0; i < count; i++) {
+        execute_actions(&runs[i]);
+    }
+#else
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&runs[i].thread, NULL, execute_thread, &runs[i])) {
+            die("could not start a thread for %s", names[i]);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(runs[i].thread, NULL);
+    }
+#endif
+
+    write_json_stats(runs, count);
+    for (i = 0; i < count; i++) {
+        if (runs[i].status) {
+            fprintf(stderr, "%sFAILED\n", runs[i].tag);
+            status = -1;
+        }
+        while ((a = runs[i].list)) {
+            runs[i].list = a->next;
+            free(a);
+        }
+    }
+    free(runs);
     return status;
 }
 
@@ -44,6 +44,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include <sparse/sparse.h>
 #include <ziparchive/zip_archive.h>
 
@@ -60,12 +62,14 @@
 char cur_product[FB_RESPONSE_SZ + 1];
 
 static const char *serial = 0;
+static std::vector<const char*> serials;  // from -s, there may be several
 static const char *product = 0;
 static const char *cmdline = 0;
 static unsigned short vendor_id = 0;
 static int long_listing = 0;
 static int64_t sparse_limit = -1;
 static int64_t target_sparse_limit = -1;
+static bool skip_unchanged = false;  // send only what differs, see fb_queue_flash_changed
 
 unsigned page_size = 2048;
 unsigned base_addr      = 0x10000000;
@@ -77,11 +81,14 @@ unsigned tags_offset    = 0x00000100;
 enum fb_buffer_type {
     FB_BUFFER,
     FB_BUFFER_SPARSE,
+    FB_BUFFER_FD,
+    FB_BUFFER_ZIP,
 };
 
 struct fastboot_buffer {
     enum fb_buffer_type type;
     void *data;
+    int fd;
     unsigned int sz;
 };
 
@@ -243,24 +250,48 @@ int list_devices_callback(usb_ifc_info *info)
     return -1;
 }
 
-usb_handle *open_device(void)
+static usb_handle *wait_for_device(const char *name)
 {
-    static usb_handle *usb = 0;
+    usb_handle *usb;
     int announce = 1;
 
-    if(usb) return usb;
-
     for(;;) {
         usb = usb_open(match_fastboot);
         if(usb) return usb;
         if(announce) {
             announce = 0;
-            fprintf(stderr,"< waiting for device >\n");
+            fprintf(stderr,"< waiting for %s >\n", name);
         }
         usleep(1000);
     }
 }
 
+usb_handle *open_device(void)
+{
+    static usb_handle *usb = 0;
+
+    if(usb) return usb;
+
+    usb = wait_for_device("device");
+    return usb;
+}
+
+// Opens all the devices named with -s, for fb_execute_queues.
+static std::vector<usb_handle*> open_devices(void)
+{
+    std::vector<usb_handle*> usbs;
+
+    for (size_t i = 0; i < serials.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (!strcmp(serials[i], serials[j])) die("device '%s' given twice", serials[i]);
+        }
+        serial = serials[i];
+        usbs.push_back(wait_for_device(serial));
+    }
+    serial = serials[0];
+    return usbs;
+}
+
 void list_devices(void) {
     // We don't actually open a USB device here,
     // just getting our callback called so we can
@@ -314,7 +345,10 @@ void usage(void)
             "  -u                                       do not first erase partition before\n"
             "                                           formatting\n"
             "  -s <specific device>                     specify device serial number\n"
-            "                                           or path to device port\n"
+            "                                           or path to device port.  Given\n"
+            "                                           more than once, flashes all of\n"
+            "                                           them at once, asking the first\n"
+            "                                           about its partitions\n"
             "  -l                                       with \"devices\", lists device paths\n"
             "  -p <product>                             specify product name\n"
             "  -c <cmdline>                             override kernel commandline\n"
@@ -328,6 +362,12 @@ void usage(void)
             "  -R                                       reboot device (e.g. after flash)\n"
             "  -a <boot.img>                            use alternate <boot.img> instead of\n"
             "                                           boot.img in update.zip file\n"
+            "  --json-stats <file>                      write how long each step took, and\n"
+            "                                           where the time of each download\n"
+            "                                           went, to <file> (- for stdout)\n"
+            "  --skip-unchanged                         only send the parts of images that\n"
+            "                                           differ from what is on the device,\n"
+            "                                           if it can tell\n"
         );
 }
 
@@ -573,31 +613,6 @@ void queue_info_dump(void)
     fb_queue_notice("--------------------------------------------");
 }
 
-static struct sparse_file **load_sparse_files(int fd, int max_size)
-{
-    struct sparse_file* s = sparse_file_import_auto(fd, false, true);
-    if (!s) {
-        die("cannot sparse read file\n");
-    }
-
-    int files = sparse_file_resparse(s, max_size, NULL, 0);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    sparse_file** out_s = reinterpret_cast<sparse_file**>(calloc(sizeof(struct sparse_file *), files + 1));
-    if (!out_s) {
-        die("Failed to allocate sparse file array\n");
-    }
-
-    files = sparse_file_resparse(s, max_size, out_s, files);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    return out_s;
-}
-
 static int64_t get_target_sparse_limit(struct usb_handle *usb)
 {
     int64_t limit = 0;
@@ -657,7 +672,6 @@ static int load_buf_fd(usb_handle *usb, int fd,
         struct fastboot_buffer *buf)
 {
     int64_t sz64;
-    void *data;
     int64_t limit;
 
 
@@ -668,20 +682,23 @@ static int load_buf_fd(usb_handle *usb, int fd,
 
     lseek(fd, 0, SEEK_SET);
     limit = get_sparse_limit(usb, sz64);
-    if (limit) {
-        struct sparse_file **s = load_sparse_files(fd, limit);
-        if (s == NULL) {
-            return -1;
+    if (limit || skip_unchanged) {
+        // Split into pieces of at most limit bytes as they are sent.
+        struct sparse_file* s = sparse_file_import_auto(fd, false, true);
+        if (!s) {
+            die("cannot sparse read file\n");
         }
         buf->type = FB_BUFFER_SPARSE;
         buf->data = s;
+        buf->sz = limit ? limit : INT_MAX;
     } else {
-        unsigned int sz;
-        data = load_fd(fd, &sz);
-        if (data == 0) return -1;
-        buf->type = FB_BUFFER;
-        buf->data = data;
-        buf->sz = sz;
+        // Read from the fd as it is sent, rather than all up front.
+        if (sz64 > UINT_MAX) {
+            return -1;
+        }
+        buf->type = FB_BUFFER_FD;
+        buf->fd = fd;
+        buf->sz = sz64;
     }
 
     return 0;
@@ -700,21 +717,81 @@ static int load_buf(usb_handle *usb, const char *fname,
     return load_buf_fd(usb, fd, buf);
 }
 
+struct zip_image {
+    ZipArchiveHandle zip;
+    ZipEntry entry;
+    const char* name;
+};
+
+struct zip_image_writer {
+    fb_write_func write;
+    void* priv;
+    bool failed;
+};
+
+static bool write_zip_data(const uint8_t* buf, size_t size, void* cookie) {
+    zip_image_writer* writer = reinterpret_cast<zip_image_writer*>(cookie);
+    if (writer->write(writer->priv, buf, size) != 0) {
+        writer->failed = true;
+        return false;
+    }
+    return true;
+}
+
+// Inflates the image as it is sent, see flash_from_zip.
+static int stream_zip_image(void* priv, fb_write_func write, void* write_priv) {
+    zip_image* image = reinterpret_cast<zip_image*>(priv);
+    zip_image_writer writer = { write, write_priv, false };
+    // Our own copy, other devices may be sent the same entry at once.
+    ZipEntry entry = image->entry;
+    int error = ProcessZipEntryContents(image->zip, &entry, write_zip_data, &writer);
+    if (error != 0) {
+        if (!writer.failed) {
+            fprintf(stderr, "failed to extract '%s': %s\n", image->name, ErrorCodeString(error));
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Sets up buf to be inflated out of the zip as it is sent, rather than
+// first extracted to a temporary file, if the entry can go to the device
+// as it is. The zip must then stay open until the queue has run.
+static bool load_buf_zip(usb_handle* usb, ZipArchiveHandle zip, const ZipEntry& entry,
+                         const char* entry_name, struct fastboot_buffer* buf) {
+    if (entry.uncompressed_length == 0 || get_sparse_limit(usb, entry.uncompressed_length) ||
+            skip_unchanged) {
+        return false;  // nothing to send, or to be split up or compared first
+    }
+    zip_image* image = new zip_image;
+    image->zip = zip;
+    image->entry = entry;
+    image->name = entry_name;
+    buf->type = FB_BUFFER_ZIP;
+    buf->data = image;
+    buf->sz = entry.uncompressed_length;
+    return true;
+}
+
 static void flash_buf(const char *pname, struct fastboot_buffer *buf)
 {
-    sparse_file** s;
-
     switch (buf->type) {
         case FB_BUFFER_SPARSE:
-            s = reinterpret_cast<sparse_file**>(buf->data);
-            while (*s) {
-                int64_t sz64 = sparse_file_len(*s, true, false);
-                fb_queue_flash_sparse(pname, *s++, sz64);
+            if (skip_unchanged) {
+                fb_queue_flash_changed(pname, reinterpret_cast<sparse_file*>(buf->data), buf->sz);
+            } else {
+                fb_queue_flash_resparse(pname, reinterpret_cast<sparse_file*>(buf->data), buf->sz);
             }
             break;
         case FB_BUFFER:
             fb_queue_flash(pname, buf->data, buf->sz);
             break;
+        case FB_BUFFER_FD:
+            fb_queue_flash_fd(pname, buf->fd, buf->sz);
+            break;
+        case FB_BUFFER_ZIP:
+            fb_queue_flash_stream(pname, stream_zip_image, buf->data, buf->sz);
+            break;
         default:
             die("unknown buffer type: %d", buf->type);
     }
@@ -761,22 +838,33 @@ void do_update(usb_handle *usb, const char *filename, int erase_first, const cha
 
     setup_requirements(reinterpret_cast<char*>(data), sz);
 
+    bool zip_in_use = false;
     for (size_t i = 0; i < ARRAY_SIZE(images); ++i) {
         fastboot_buffer buf;
         // support alt images only for boot partition
         bool from_zip = alt_boot_fname == NULL ||
                 strncmp(images[i].part_name, "boot", sizeof(images[i].part_name));
         if (from_zip) {
-            int fd = unzip_to_file(zip, images[i].img_name);
-            if (fd == -1) {
+            ZipEntry entry;
+            if (FindEntry(zip, ZipString(images[i].img_name), &entry) != 0) {
                 if (images[i].is_optional) {
                     continue;
                 }
+                fprintf(stderr, "archive does not contain '%s'\n", images[i].img_name);
                 CloseArchive(zip);
-                exit(1); // unzip_to_file already explained why.
+                exit(1);
+            }
+            if (load_buf_zip(usb, zip, entry, images[i].img_name, &buf)) {
+                zip_in_use = true;
+            } else {
+                int fd = unzip_to_file(zip, images[i].img_name);
+                if (fd == -1) {
+                    CloseArchive(zip);
+                    exit(1); // unzip_to_file already explained why.
+                }
+                int rc = load_buf_fd(usb, fd, &buf);
+                if (rc) die("cannot load %s from flash", images[i].img_name);
             }
-            int rc = load_buf_fd(usb, fd, &buf);
-            if (rc) die("cannot load %s from flash", images[i].img_name);
             do_update_signature(zip, images[i].sig_name);
         } else {
             int rc = load_buf(usb, alt_boot_fname, &buf);
@@ -787,13 +875,15 @@ void do_update(usb_handle *usb, const char *filename, int erase_first, const cha
             fb_queue_erase(images[i].part_name);
         }
         flash_buf(images[i].part_name, &buf);
-        /* not closing the fd here since the sparse code keeps the fd around
-         * but hasn't mmaped data yet. The tmpfile will get cleaned up when the
+        /* not closing the fd here since the image is only read from it
+         * when the queue runs. The tmpfile will get cleaned up when the
          * program exits.
          */
     }
 
-    CloseArchive(zip);
+    if (!zip_in_use) {
+        CloseArchive(zip);
+    }
 }
 
 void do_send_signature(char *fn)
@@ -927,6 +1017,30 @@ static int64_t parse_num(const char *arg)
     return num;
 }
 
+// A filesystem image being generated while what is queued before it is sent.
+struct format_job {
+    usb_handle* usb;
+    const char* partition;
+    int fd;
+    fs_job* gen_job;
+};
+
+static void finish_format(void* priv) {
+    format_job* job = reinterpret_cast<format_job*>(priv);
+    struct fastboot_buffer buf;
+
+    if (fs_generator_finish(job->gen_job)) {
+        fprintf(stderr, "Cannot generate image.\n");
+        close(job->fd);
+    } else if (load_buf_fd(job->usb, job->fd, &buf)) {
+        fprintf(stderr, "Cannot read image.\n");
+        close(job->fd);
+    } else {
+        flash_buf(job->partition, &buf);
+    }
+    delete job;
+}
+
 void fb_perform_format(usb_handle* usb,
                        const char *partition, int skip_if_not_supported,
                        const char *type_override, const char *size_override)
@@ -935,9 +1049,9 @@ void fb_perform_format(usb_handle* usb,
     char *pType = pTypeBuff;
     char *pSize = pSizeBuff;
     unsigned int limit = INT_MAX;
-    struct fastboot_buffer buf;
     const char *errMsg = NULL;
     const struct fs_generator *gen;
+    format_job *job;
     uint64_t pSz;
     int status;
     int fd;
@@ -989,18 +1103,18 @@ void fb_perform_format(usb_handle* usb,
     pSz = strtoll(pSize, (char **)NULL, 16);
 
     fd = fileno(tmpfile());
-    if (fs_generator_generate(gen, fd, pSz)) {
+    job = new format_job;
+    job->usb = usb;
+    job->partition = partition;
+    job->fd = fd;
+    job->gen_job = fs_generator_start(gen, fd, pSz);
+    if (!job->gen_job) {
         close(fd);
+        delete job;
         fprintf(stderr, "Cannot generate image.\n");
         return;
     }
-
-    if (load_buf_fd(usb, fd, &buf)) {
-        fprintf(stderr, "Cannot read image.\n");
-        close(fd);
-        return;
-    }
-    flash_buf(partition, &buf);
+    fb_queue_load(finish_format, job);
 
     return;
 
@@ -1037,6 +1151,8 @@ int main(int argc, char **argv)
         {"help", no_argument, 0, 'h'},
         {"unbuffered", no_argument, 0, 0},
         {"version", no_argument, 0, 0},
+        {"json-stats", required_argument, 0, 0},
+        {"skip-unchanged", no_argument, 0, 0},
         {"reboot", no_argument, 0, 'R'},
         {0, 0, 0, 0}
     };
@@ -1096,6 +1212,7 @@ int main(int argc, char **argv)
             break;
         case 's':
             serial = optarg;
+            serials.push_back(optarg);
             break;
         case 'S':
             sparse_limit = parse_num(optarg);
@@ -1118,6 +1235,12 @@ int main(int argc, char **argv)
             } else if (strcmp("version", longopts[longindex].name) == 0) {
                 fprintf(stdout, "fastboot version %s\n", FASTBOOT_REVISION);
                 return 0;
+            } else if (strcmp("json-stats", longopts[longindex].name) == 0) {
+                FILE* stats = strcmp(optarg, "-") ? fopen(optarg, "w") : stdout;
+                if (stats == NULL) die("cannot open '%s': %s", optarg, strerror(errno));
+                fb_set_json_stats(stats);
+            } else if (strcmp("skip-unchanged", longopts[longindex].name) == 0) {
+                skip_unchanged = true;
             }
             break;
         default:
@@ -1144,7 +1267,22 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    usb_handle* usb = open_device();
+    std::vector<usb_handle*> usbs;
+    if (serials.size() > 1) {
+        // One queue for all of them, built with what the first one says,
+        // and sent in pieces that fit every one of them.
+        usbs = open_devices();
+        if (sparse_limit == -1) {
+            target_sparse_limit = 0;
+            for (size_t i = 0; i < usbs.size(); i++) {
+                int64_t limit = get_target_sparse_limit(usbs[i]);
+                if (limit > 0 && (target_sparse_limit == 0 || limit < target_sparse_limit)) {
+                    target_sparse_limit = limit;
+                }
+            }
+        }
+    }
+    usb_handle* usb = usbs.empty() ? open_device() : usbs[0];
 
     while (argc > 0) {
         if(!strcmp(*argv, "getvar")) {
@@ -1316,6 +1454,10 @@ int main(int argc, char **argv)
     if (fb_queue_is_empty())
         return 0;
 
-    status = fb_execute_queue(usb);
+    if (usbs.empty()) {
+        status = fb_execute_queue(usb);
+    } else {
+        status = fb_execute_queues(usbs.data(), serials.data(), usbs.size());
+    }
     return (status) ? 1 : 0;
 }
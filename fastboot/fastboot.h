@@ -29,6 +29,8 @@
 #ifndef _FASTBOOT_H_
 #define _FASTBOOT_H_
 
+#include <stdio.h>
+
 #include "usb.h"
 
 #if defined(__cplusplus)
@@ -37,12 +39,33 @@ extern "C" {
 
 struct sparse_file;
 
+/* Produces all of a download's data by calling write(write_priv, ...),
+ * returning 0 once it's done, like sparse_file_callback */
+typedef int (*fb_write_func)(void *priv, const void *data, int len);
+typedef int (*fb_stream_func)(void *priv, fb_write_func write, void *write_priv);
+
+/* Queues what is to be done with something that isn't ready yet, see fb_queue_load */
+typedef void (*fb_load_func)(void *priv);
+
+/* Where the time of the last download on this thread went */
+struct fb_download_stats {
+    unsigned bytes;
+    double read;        /* reading, converting or inflating it on the host */
+    double usb;         /* writing it to usb */
+    double device;      /* from the end of the data to the device's OKAY */
+};
+
 /* protocol.c - fastboot protocol */
 int fb_command(usb_handle *usb, const char *cmd);
 int fb_command_response(usb_handle *usb, const char *cmd, char *response);
 int fb_download_data(usb_handle *usb, const void *data, unsigned size);
+int fb_download_data_fd(usb_handle *usb, int fd, unsigned size);
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s);
+int fb_download_data_stream(usb_handle *usb, unsigned size,
+        fb_stream_func stream, void *priv);
+int fb_command_upload(usb_handle *usb, const char *cmd, void *buf, unsigned size);
 char *fb_get_error(void);
+void fb_get_download_stats(struct fb_download_stats *stats);
 
 #define FB_COMMAND_SZ 64
 #define FB_RESPONSE_SZ 64
@@ -51,7 +74,11 @@ char *fb_get_error(void);
 int fb_getvar(struct usb_handle *usb, char *response, const char *fmt, ...);
 int fb_format_supported(usb_handle *usb, const char *partition, const char *type_override);
 void fb_queue_flash(const char *ptn, void *data, unsigned sz);
+void fb_queue_flash_fd(const char *ptn, int fd, unsigned sz);
+void fb_queue_flash_stream(const char *ptn, fb_stream_func stream, void *priv, unsigned sz);
 void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s, unsigned sz);
+void fb_queue_flash_resparse(const char *ptn, struct sparse_file *s, unsigned max_size);
+void fb_queue_flash_changed(const char *ptn, struct sparse_file *s, unsigned max_size);
 void fb_queue_erase(const char *ptn);
 void fb_queue_format(const char *ptn, int skip_if_not_supported, unsigned int max_chunk_sz);
 void fb_queue_require(const char *prod, const char *var, int invert,
@@ -63,8 +90,11 @@ void fb_queue_command(const char *cmd, const char *msg);
 void fb_queue_download(const char *name, void *data, unsigned size);
 void fb_queue_notice(const char *notice);
 void fb_queue_wait_for_disconnect(void);
+void fb_queue_load(fb_load_func load, void *priv);
 int fb_execute_queue(usb_handle *usb);
+int fb_execute_queues(usb_handle **usbs, const char **names, unsigned count);
 int fb_queue_is_empty(void);
+void fb_set_json_stats(FILE *f);
 
 /* util stuff */
 double now();
@@ -17,6 +17,7 @@
 #ifdef USE_MINGW
 #include <fcntl.h>
 #else
+#include <pthread.h>
 #include <sys/mman.h>
 #endif
 
@@ -63,3 +64,62 @@ int fs_generator_generate(const struct fs_generator* gen, int tmpFileNo, long lo
 {
     return gen->generate(tmpFileNo, partSize);
 }
+
+/* An image being generated, see fs_generator_start */
+struct fs_job {
+    const struct fs_generator* gen;
+    int fd;
+    long long partSize;
+    int result;
+#ifndef USE_MINGW
+    pthread_t thread;
+#endif
+};
+
+#ifndef USE_MINGW
+/* make_ext4fs and make_f2fs keep their state in globals */
+static pthread_mutex_t generate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *generate_thread(void *arg)
+{
+    struct fs_job *job = arg;
+
+    pthread_mutex_lock(&generate_lock);
+    job->result = fs_generator_generate(job->gen, job->fd, job->partSize);
+    pthread_mutex_unlock(&generate_lock);
+    return NULL;
+}
+#endif
+
+struct fs_job* fs_generator_start(const struct fs_generator* gen, int tmpFileNo, long long partSize)
+{
+    struct fs_job *job = calloc(1, sizeof(*job));
+
+    if (!job) {
+        return NULL;
+    }
+    job->gen = gen;
+    job->fd = tmpFileNo;
+    job->partSize = partSize;
+#ifdef USE_MINGW
+    job->result = fs_generator_generate(gen, tmpFileNo, partSize);
+#else
+    if (pthread_create(&job->thread, NULL, generate_thread, job)) {
+        free(job);
+        return NULL;
+    }
+#endif
+    return job;
+}
+
+int fs_generator_finish(struct fs_job* job)
+{
+    int result;
+
+#ifndef USE_MINGW
+    pthread_join(job->thread, NULL);
+#endif
+    result = job->result;
+    free(job);
+    return result;
+}
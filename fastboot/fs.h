@@ -12,6 +12,12 @@ struct fs_generator;
 const struct fs_generator* fs_get_generator(const char *fs_type);
 int fs_generator_generate(const struct fs_generator* gen, int tmpFileNo, long long partSize);
 
+/* Like fs_generator_generate, but on a thread of its own; generators still
+ * take turns.  fs_generator_finish waits for it and returns its result. */
+struct fs_job;
+struct fs_job* fs_generator_start(const struct fs_generator* gen, int tmpFileNo, long long partSize);
+int fs_generator_finish(struct fs_job* job);
+
 #if defined(__cplusplus)
 }
 #endif
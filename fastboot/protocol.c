@@ -28,23 +28,87 @@
 
 #define min(a, b) \
     ({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
-#define round_down(a, b) \
-    ({ typeof(a) _a = (a); typeof(b) _b = (b); _a - (_a % _b); })
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 
 #include <sparse/sparse.h>
 
 #include "fastboot.h"
 
-static char ERROR[128];
+#define ERROR_SIZE 128
+
+/* What the last command on this thread left behind */
+struct protocol_state {
+    char error[ERROR_SIZE];
+    struct fb_download_stats stats;
+};
+
+#ifdef USE_MINGW
+static struct protocol_state *protocol_state(void)
+{
+    static struct protocol_state state;
+
+    return &state;
+}
+#else
+/* One per thread, fb_execute_queues may talk to several devices at once */
+static pthread_key_t state_key;
+static pthread_once_t state_once = PTHREAD_ONCE_INIT;
+
+static void state_key_create(void)
+{
+    pthread_key_create(&state_key, free);
+}
+
+static struct protocol_state *protocol_state(void)
+{
+    static struct protocol_state fallback;
+    struct protocol_state *state;
+
+    pthread_once(&state_once, state_key_create);
+    state = pthread_getspecific(state_key);
+    if (!state) {
+        state = calloc(1, sizeof(*state));
+        if (!state || pthread_setspecific(state_key, state)) {
+            free(state);
+            return &fallback;
+        }
+    }
+    return state;
+}
+#endif
+
+static char *error_buf(void)
+{
+    return protocol_state()->error;
+}
 
 char *fb_get_error(void)
 {
-    return ERROR;
+    return error_buf();
+}
+
+void fb_get_download_stats(struct fb_download_stats *stats)
+{
+    *stats = protocol_state()->stats;
+}
+
+static struct fb_download_stats *download_stats_start(unsigned size)
+{
+    struct fb_download_stats *stats = &protocol_state()->stats;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes = size;
+    return stats;
 }
 
 static int check_response(usb_handle *usb, unsigned int size, char *response)
@@ -55,14 +119,14 @@ static int check_response(usb_handle *usb, unsigned int size, char *response)
     for(;;) {
         r = usb_read(usb, status, 64);
         if(r < 0) {
-            snprintf(ERROR, sizeof(ERROR), "status read failed (%s)", strerror(errno));
+            snprintf(error_buf(), ERROR_SIZE, "status read failed (%s)", strerror(errno));
             usb_close(usb);
             return -1;
         }
         status[r] = 0;
 
         if(r < 4) {
-            snprintf(ERROR, sizeof(ERROR), "status malformed (%d bytes)", r);
+            snprintf(error_buf(), ERROR_SIZE, "status malformed (%d bytes)", r);
             usb_close(usb);
             return -1;
         }
@@ -81,9 +145,9 @@ static int check_response(usb_handle *usb, unsigned int size, char *response)
 
         if(!memcmp(status, "FAIL", 4)) {
             if(r > 4) {
-                snprintf(ERROR, sizeof(ERROR), "remote: %s", status + 4);
+                snprintf(error_buf(), ERROR_SIZE, "remote: %s", status + 4);
             } else {
-                strcpy(ERROR, "remote failure");
+                strcpy(error_buf(), "remote failure");
             }
             return -1;
         }
@@ -91,14 +155,14 @@ static int check_response(usb_handle *usb, unsigned int size, char *response)
         if(!memcmp(status, "DATA", 4) && size > 0){
             unsigned dsize = strtoul((char*) status + 4, 0, 16);
             if(dsize > size) {
-                strcpy(ERROR, "data size too large");
+                strcpy(error_buf(), "data size too large");
                 usb_close(usb);
                 return -1;
             }
             return dsize;
         }
 
-        strcpy(ERROR,"unknown status code");
+        strcpy(error_buf(),"unknown status code");
         usb_close(usb);
         break;
     }
@@ -116,12 +180,12 @@ static int _command_start(usb_handle *usb, const char *cmd, unsigned size,
     }
 
     if(cmdsize > 64) {
-        snprintf(ERROR, sizeof(ERROR),"command too large");
+        snprintf(error_buf(), ERROR_SIZE,"command too large");
         return -1;
     }
 
     if(usb_write(usb, cmd, cmdsize) != cmdsize) {
-        snprintf(ERROR, sizeof(ERROR),"command write failed (%s)", strerror(errno));
+        snprintf(error_buf(), ERROR_SIZE,"command write failed (%s)", strerror(errno));
         usb_close(usb);
         return -1;
     }
@@ -135,12 +199,12 @@ static int _command_data(usb_handle *usb, const void *data, unsigned size)
 
     r = usb_write(usb, data, size);
     if(r < 0) {
-        snprintf(ERROR, sizeof(ERROR), "data transfer failure (%s)", strerror(errno));
+        snprintf(error_buf(), ERROR_SIZE, "data transfer failure (%s)", strerror(errno));
         usb_close(usb);
         return -1;
     }
     if(r != ((int) size)) {
-        snprintf(ERROR, sizeof(ERROR), "data transfer failure (short transfer)");
+        snprintf(error_buf(), ERROR_SIZE, "data transfer failure (short transfer)");
         usb_close(usb);
         return -1;
     }
@@ -167,24 +231,45 @@ static int _command_send(usb_handle *usb, const char *cmd,
         return -1;
     }
 
+    struct fb_download_stats *stats = download_stats_start(size);
+    double start;
+
     r = _command_start(usb, cmd, size, response);
     if (r < 0) {
         return -1;
     }
 
+    start = now();
     r = _command_data(usb, data, size);
     if (r < 0) {
         return -1;
     }
+    stats->usb = now() - start;
 
+    start = now();
     r = _command_end(usb);
     if(r < 0) {
         return -1;
     }
+    stats->device = now() - start;
 
     return size;
 }
 
+/* Waits for the device to be done with a download, see _command_send */
+static int download_end(usb_handle *usb)
+{
+    double start = now();
+    int r;
+
+    r = _command_end(usb);
+    if (r < 0) {
+        return -1;
+    }
+    protocol_state()->stats.device = now() - start;
+    return 0;
+}
+
 static int _command_send_no_data(usb_handle *usb, const char *cmd,
                                  char *response)
 {
@@ -216,77 +301,257 @@ int fb_download_data(usb_handle *usb, const void *data, unsigned size)
     }
 }
 
-#define USB_BUF_SIZE 1024
-static char usb_buf[USB_BUF_SIZE];
-static int usb_buf_len;
-
-static int fb_download_data_sparse_write(void *priv, const void *data, int len)
+/*
+ * Runs a command the device answers with DATA and then size bytes of its
+ * own, which are read into buf.  Returns 0 on success.
+ */
+int fb_command_upload(usb_handle *usb, const char *cmd, void *buf, unsigned size)
 {
+    unsigned char *ptr = buf;
+    unsigned got = 0;
     int r;
-    usb_handle *usb = priv;
-    int to_write;
-    const char *ptr = data;
-
-    if (usb_buf_len) {
-        to_write = min(USB_BUF_SIZE - usb_buf_len, len);
 
-        memcpy(usb_buf + usb_buf_len, ptr, to_write);
-        usb_buf_len += to_write;
-        ptr += to_write;
-        len -= to_write;
+    r = _command_start(usb, cmd, size, 0);
+    if (r < 0) {
+        return -1;
+    }
+    if ((unsigned) r != size) {
+        snprintf(error_buf(), ERROR_SIZE, "expected %u bytes, device has %d", size, r);
+        usb_close(usb);
+        return -1;
     }
 
-    if (usb_buf_len == USB_BUF_SIZE) {
-        r = _command_data(usb, usb_buf, USB_BUF_SIZE);
-        if (r != USB_BUF_SIZE) {
+    while (got < size) {
+        r = usb_read(usb, ptr + got, size - got);
+        if (r < 0) {
+            snprintf(error_buf(), ERROR_SIZE, "data read failed (%s)", strerror(errno));
+            usb_close(usb);
             return -1;
         }
-        usb_buf_len = 0;
+        got += r;
     }
 
-    if (len > USB_BUF_SIZE) {
-        if (usb_buf_len > 0) {
-            snprintf(ERROR, sizeof(ERROR), "internal error: usb_buf not empty\n");
-            return -1;
+    return _command_end(usb);
+}
+
+/*
+ * Sparse images and files are sent out of a ring of SEND_BUFS buffers:
+ * libsparse or read() fills one while a thread sends the others, so
+ * reading and sending overlap.  Without threads there is a single buffer,
+ * sent whenever it is full.
+ */
+#define SEND_BUF_SIZE (1024 * 1024)
+#ifdef USE_MINGW
+#define SEND_BUFS 1
+#else
+#define SEND_BUFS 4
+#endif
+
+struct data_sender {
+    usb_handle *usb;
+    char *bufs[SEND_BUFS];
+    unsigned lens[SEND_BUFS];
+    unsigned len;       /* of the buffer being filled, bufs[filled % SEND_BUFS] */
+    unsigned filled;    /* buffers handed over to be sent so far */
+    unsigned sent;      /* and sent so far */
+    int error;
+    double started;
+    double blocked;     /* filling nothing, for want of a buffer */
+    double sending;     /* in usb_write */
+#ifndef USE_MINGW
+    char *error_msg;    /* the starting thread's, for fb_get_error */
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+#endif
+};
+
+#ifndef USE_MINGW
+static void *data_sender_thread(void *arg)
+{
+    struct data_sender *ss = arg;
+    double start;
+    unsigned i;
+    int r;
+
+    pthread_mutex_lock(&ss->lock);
+    while (true) {
+        if (ss->sent == ss->filled) {
+            if (ss->done) {
+                break;
+            }
+            pthread_cond_wait(&ss->cond, &ss->lock);
+            continue;
+        }
+        i = ss->sent % SEND_BUFS;
+        pthread_mutex_unlock(&ss->lock);
+
+        start = now();
+        r = _command_data(ss->usb, ss->bufs[i], ss->lens[i]);
+
+        pthread_mutex_lock(&ss->lock);
+        ss->sending += now() - start;
+        if (r < 0) {
+            ss->error = -1;
+            strcpy(ss->error_msg, error_buf());
+            pthread_cond_signal(&ss->cond);
+            break;
         }
-        to_write = round_down(len, USB_BUF_SIZE);
-        r = _command_data(usb, ptr, to_write);
-        if (r != to_write) {
+        ss->sent++;
+        pthread_cond_signal(&ss->cond);
+    }
+    pthread_mutex_unlock(&ss->lock);
+    return NULL;
+}
+#endif
+
+/* Waits for the next buffer to fill to have been sent */
+static int data_sender_wait(struct data_sender *ss)
+{
+#ifndef USE_MINGW
+    double start = -1;
+    int error;
+
+    pthread_mutex_lock(&ss->lock);
+    while (ss->filled - ss->sent == SEND_BUFS && !ss->error) {
+        if (start < 0) start = now();
+        pthread_cond_wait(&ss->cond, &ss->lock);
+    }
+    if (start >= 0) ss->blocked += now() - start;
+    error = ss->error;
+    pthread_mutex_unlock(&ss->lock);
+    return error;
+#else
+    return ss->error;
+#endif
+}
+
+/* Hands the buffer being filled over to be sent */
+static int data_sender_queue(struct data_sender *ss)
+{
+    unsigned i = ss->filled % SEND_BUFS;
+    int error;
+#ifdef USE_MINGW
+    double start;
+#endif
+
+    ss->lens[i] = ss->len;
+    ss->len = 0;
+#ifndef USE_MINGW
+    pthread_mutex_lock(&ss->lock);
+    ss->filled++;
+    pthread_cond_signal(&ss->cond);
+    error = ss->error;
+    pthread_mutex_unlock(&ss->lock);
+#else
+    ss->filled++;
+    start = now();
+    if (_command_data(ss->usb, ss->bufs[i], ss->lens[i]) < 0) {
+        ss->error = -1;
+    } else {
+        ss->sent++;
+    }
+    ss->sending += now() - start;
+    ss->blocked += now() - start;
+    error = ss->error;
+#endif
+    return error;
+}
+
+static int fb_download_data_sparse_write(void *priv, const void *data, int len)
+{
+    struct data_sender *ss = priv;
+    const char *ptr = data;
+    unsigned to_write;
+
+    while (len > 0) {
+        if (ss->len == 0 && data_sender_wait(ss) < 0) {
             return -1;
         }
+
+        to_write = min((unsigned)len, SEND_BUF_SIZE - ss->len);
+        memcpy(ss->bufs[ss->filled % SEND_BUFS] + ss->len, ptr, to_write);
+        ss->len += to_write;
         ptr += to_write;
         len -= to_write;
-    }
 
-    if (len > 0) {
-        if (len > USB_BUF_SIZE) {
-            snprintf(ERROR, sizeof(ERROR), "internal error: too much left for usb_buf\n");
+        if (ss->len == SEND_BUF_SIZE && data_sender_queue(ss) < 0) {
             return -1;
         }
-        memcpy(usb_buf, ptr, len);
-        usb_buf_len = len;
     }
 
     return 0;
 }
 
-static int fb_download_data_sparse_flush(usb_handle *usb)
+static int data_sender_start(struct data_sender *ss, usb_handle *usb)
 {
-    int r;
-
-    if (usb_buf_len > 0) {
-        r = _command_data(usb, usb_buf, usb_buf_len);
-        if (r != usb_buf_len) {
-            return -1;
+    int i;
+
+    memset(ss, 0, sizeof(*ss));
+    ss->usb = usb;
+    ss->started = now();
+    for (i = 0; i < SEND_BUFS; i++) {
+        ss->bufs[i] = malloc(SEND_BUF_SIZE);
+        if (!ss->bufs[i]) {
+            snprintf(error_buf(), ERROR_SIZE, "out of memory");
+            goto err;
         }
-        usb_buf_len = 0;
     }
 
+#ifndef USE_MINGW
+    ss->error_msg = error_buf();
+    pthread_mutex_init(&ss->lock, NULL);
+    pthread_cond_init(&ss->cond, NULL);
+    if (pthread_create(&ss->thread, NULL, data_sender_thread, ss)) {
+        snprintf(error_buf(), ERROR_SIZE, "could not start the sending thread");
+        pthread_cond_destroy(&ss->cond);
+        pthread_mutex_destroy(&ss->lock);
+        goto err;
+    }
+#endif
     return 0;
+
+err:
+    for (i = 0; i < SEND_BUFS; i++) {
+        free(ss->bufs[i]);
+    }
+    return -1;
+}
+
+/* Sends what is left and waits for it all to have been sent */
+static int data_sender_finish(struct data_sender *ss)
+{
+    struct fb_download_stats *stats = &protocol_state()->stats;
+    int error = 0;
+    int i;
+
+    stats->read = now() - ss->started - ss->blocked;
+    if (ss->len > 0 && data_sender_wait(ss) == 0) {
+        data_sender_queue(ss);
+    }
+
+#ifndef USE_MINGW
+    pthread_mutex_lock(&ss->lock);
+    ss->done = true;
+    pthread_cond_signal(&ss->cond);
+    pthread_mutex_unlock(&ss->lock);
+    pthread_join(ss->thread, NULL);
+    pthread_cond_destroy(&ss->cond);
+    pthread_mutex_destroy(&ss->lock);
+#endif
+    error = ss->error;
+    stats->usb = ss->sending;
+
+    for (i = 0; i < SEND_BUFS; i++) {
+        free(ss->bufs[i]);
+    }
+    return error;
 }
 
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
 {
+    struct data_sender ss;
     char cmd[64];
     int r;
     int size = sparse_file_len(s, true, false);
@@ -294,21 +559,162 @@ int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
         return -1;
     }
 
+    download_stats_start(size);
     snprintf(cmd, sizeof(cmd), "download:%08x", size);
     r = _command_start(usb, cmd, size, 0);
     if (r < 0) {
         return -1;
     }
 
-    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, usb);
+    if (data_sender_start(&ss, usb) < 0) {
+        return -1;
+    }
+
+    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, &ss);
     if (r < 0) {
+        ss.len = 0;
+    }
+    if (data_sender_finish(&ss) < 0 || r < 0) {
         return -1;
     }
 
-    r = fb_download_data_sparse_flush(usb);
+    return download_end(usb);
+}
+
+struct stream_writer {
+    struct data_sender *ss;
+    unsigned left;
+    bool failed;    /* it was us, not the stream */
+};
+
+static int stream_write(void *priv, const void *data, int len)
+{
+    struct stream_writer *sw = priv;
+
+    if ((unsigned)len > sw->left) {
+        snprintf(error_buf(), ERROR_SIZE, "image is longer than it was");
+        sw->failed = true;
+        return -1;
+    }
+    sw->left -= len;
+    if (fb_download_data_sparse_write(sw->ss, data, len) < 0) {
+        sw->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/* Sends the size bytes stream writes, as it writes them */
+int fb_download_data_stream(usb_handle *usb, unsigned size,
+        fb_stream_func stream, void *priv)
+{
+    struct data_sender ss;
+    struct stream_writer sw;
+    char cmd[64];
+    int r;
+
+    if (size == 0) {
+        return -1;
+    }
+
+    download_stats_start(size);
+    snprintf(cmd, sizeof(cmd), "download:%08x", size);
+    r = _command_start(usb, cmd, size, 0);
     if (r < 0) {
         return -1;
     }
 
-    return _command_end(usb);
+    if (data_sender_start(&ss, usb) < 0) {
+        return -1;
+    }
+
+    sw.ss = &ss;
+    sw.left = size;
+    sw.failed = false;
+    r = stream(priv, stream_write, &sw);
+    if (r < 0 && !sw.failed) {
+        snprintf(error_buf(), ERROR_SIZE, "could not read the image");
+    } else if (r == 0 && sw.left > 0) {
+        snprintf(error_buf(), ERROR_SIZE, "image is shorter than it was");
+        r = -1;
+    }
+    if (r < 0) {
+        ss.len = 0;
+    }
+    if (data_sender_finish(&ss) < 0 || r < 0) {
+        return -1;
+    }
+
+    return download_end(usb);
+}
+
+int fb_download_data_fd(usb_handle *usb, int fd, unsigned size)
+{
+    struct data_sender ss;
+    char cmd[64];
+    unsigned remaining = size;
+    unsigned to_read;
+    int n;
+    int r;
+
+    if (size == 0) {
+        return -1;
+    }
+
+#ifdef USE_MINGW
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        snprintf(error_buf(), ERROR_SIZE, "seek failed (%s)", strerror(errno));
+        return -1;
+    }
+#endif
+
+    download_stats_start(size);
+    snprintf(cmd, sizeof(cmd), "download:%08x", size);
+    r = _command_start(usb, cmd, size, 0);
+    if (r < 0) {
+        return -1;
+    }
+
+    if (data_sender_start(&ss, usb) < 0) {
+        return -1;
+    }
+
+    /* Straight into the buffers, nothing else holds the file */
+    r = 0;
+    while (remaining > 0) {
+        if (ss.len == 0 && data_sender_wait(&ss) < 0) {
+            r = -1;
+            break;
+        }
+
+        to_read = min(remaining, SEND_BUF_SIZE - ss.len);
+#ifdef USE_MINGW
+        n = read(fd, ss.bufs[ss.filled % SEND_BUFS] + ss.len, to_read);
+#else
+        /* Other devices may be reading the same fd on other threads */
+        n = pread(fd, ss.bufs[ss.filled % SEND_BUFS] + ss.len, to_read,
+                  (off_t)(size - remaining));
+#endif
+        if (n <= 0) {
+            snprintf(error_buf(), ERROR_SIZE, "read failed (%s)",
+                     n < 0 ? strerror(errno) : "file is shorter than it was");
+            r = -1;
+            break;
+        }
+        ss.len += n;
+        remaining -= n;
+
+        if (ss.len == SEND_BUF_SIZE && data_sender_queue(&ss) < 0) {
+            r = -1;
+            break;
+        }
+    }
+    if (r < 0) {
+        ss.len = 0;
+    }
+    if (data_sender_finish(&ss) < 0 || r < 0) {
+        return -1;
+    }
+
+    return download_end(usb);
 }
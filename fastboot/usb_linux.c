@@ -363,10 +363,87 @@ static usb_handle *find_usb_device(const char *base, ifc_match_func callback)
     return usb;
 }
 
+/* Writes longer than MAX_USBFS_BULK_SIZE are split into URBs, up to
+ * WRITE_URBS of which are submitted at a time, so the host controller
+ * always has the next one queued when a transfer completes.
+ */
+#define WRITE_URBS 8
+
+static int reap_urb(usb_handle *h, struct usbdevfs_urb **urb)
+{
+    int n;
+
+    do {
+        n = ioctl(h->desc, USBDEVFS_REAPURB, urb);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static int usb_write_async(usb_handle *h, const unsigned char *data, int len)
+{
+    struct usbdevfs_urb urbs[WRITE_URBS];
+    struct usbdevfs_urb *free_urbs[WRITE_URBS];
+    struct usbdevfs_urb *urb;
+    int nfree = WRITE_URBS;
+    int submitted = 0;
+    int count = 0;
+    int err = 0;
+    int i;
+
+    for (i = 0; i < WRITE_URBS; i++) {
+        free_urbs[i] = &urbs[i];
+    }
+
+    while (count < len) {
+        if (submitted < len && nfree > 0) {
+            urb = free_urbs[--nfree];
+            memset(urb, 0, sizeof(*urb));
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = h->ep_out;
+            urb->buffer = (void *)(data + submitted);
+            urb->buffer_length = (len - submitted > MAX_USBFS_BULK_SIZE) ?
+                    MAX_USBFS_BULK_SIZE : len - submitted;
+            if (ioctl(h->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                err = errno;
+                free_urbs[nfree++] = urb;
+                break;
+            }
+            submitted += urb->buffer_length;
+            continue;
+        }
+
+        if (reap_urb(h, &urb) < 0) {
+            err = errno;
+            break;
+        }
+        free_urbs[nfree++] = urb;
+        if (urb->status != 0 || urb->actual_length != urb->buffer_length) {
+            err = urb->status ? -urb->status : EIO;
+            break;
+        }
+        count += urb->actual_length;
+    }
+
+    if (err) {
+        DBG("ERROR: async write failed, errno = %d (%s)\n", err, strerror(err));
+        /* The kernel still has the rest, cancel them before data goes away */
+        for (i = 0; i < WRITE_URBS; i++) {
+            ioctl(h->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+        }
+        while (nfree < WRITE_URBS &&
+                reap_urb(h, &urb) == 0) {
+            nfree++;
+        }
+        errno = err;
+        return -1;
+    }
+
+    return count;
+}
+
 int usb_write(usb_handle *h, const void *_data, int len)
 {
     unsigned char *data = (unsigned char*) _data;
-    unsigned count = 0;
     struct usbdevfs_bulktransfer bulk;
     int n;
 
@@ -374,28 +451,23 @@ int usb_write(usb_handle *h, const void *_data, int len)
         return -1;
     }
 
-    do {
-        int xfer;
-        xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
-
-        bulk.ep = h->ep_out;
-        bulk.len = xfer;
-        bulk.data = data;
-        bulk.timeout = 0;
+    if(len > MAX_USBFS_BULK_SIZE) {
+        return usb_write_async(h, data, len);
+    }
 
-        n = ioctl(h->desc, USBDEVFS_BULK, &bulk);
-        if(n != xfer) {
-            DBG("ERROR: n = %d, errno = %d (%s)\n",
-                n, errno, strerror(errno));
-            return -1;
-        }
+    bulk.ep = h->ep_out;
+    bulk.len = len;
+    bulk.data = data;
+    bulk.timeout = 0;
 
-        count += xfer;
-        len -= xfer;
-        data += xfer;
-    } while(len > 0);
+    n = ioctl(h->desc, USBDEVFS_BULK, &bulk);
+    if(n != len) {
+        DBG("ERROR: n = %d, errno = %d (%s)\n",
+            n, errno, strerror(errno));
+        return -1;
+    }
 
-    return count;
+    return len;
 }
 
 int usb_read(usb_handle *h, void *_data, int len)
@@ -29,6 +29,10 @@
 #include <time.h>
 #include <sys/swap.h>
 #include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 #include <ext4.h>
 #include <ext4_sb.h>
 #include <ext4_crypt_init_extensions.h>
@@ -82,14 +86,122 @@ static time_t gettime(void)
     return ts.tv_sec;
 }
 
-static int wait_for_file(const char *filename, int timeout)
+static fs_mgr_wait_hook wait_hook;
+
+void fs_mgr_set_wait_hook(fs_mgr_wait_hook hook)
+{
+    wait_hook = hook;
+}
+
+static uint64_t gettime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Watch the deepest directory on the way to filename that exists already,
+ * the next thing to appear there is what brings filename closer.
+ */
+static void watch_nearest_dir(int inotify_fd, const char *filename)
 {
+    char dir[PATH_MAX];
     struct stat info;
-    time_t timeout_time = gettime() + timeout;
-    int ret = -1;
+    char *slash;
+
+    strlcpy(dir, filename, sizeof(dir));
+    while ((slash = strrchr(dir, '/')) != NULL) {
+        if (slash == dir) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+        if (!stat(dir, &info) && S_ISDIR(info.st_mode)) {
+            inotify_add_watch(inotify_fd, dir, IN_CREATE | IN_MOVED_TO);
+            return;
+        }
+        if (slash == dir) {
+            return;
+        }
+    }
+}
+
+/*
+ * Waits up to timeout_ms for filename to exist. Rather than polling, this
+ * sleeps until something is created in the directories leading to it,
+ * which is how ueventd's device nodes and symlinks appear. Returns 0 once
+ * the file is there, otherwise -1 with errno from the last stat.
+ */
+int fs_mgr_wait_for_file(const char *filename, int timeout_ms)
+{
+    struct stat info;
+    uint64_t deadline_ns = gettime_ns() + (uint64_t) timeout_ms * 1000000ULL;
+    int inotify_fd = -1;
+    int save_errno;
+
+    while (stat(filename, &info) < 0) {
+        uint64_t now_ns = gettime_ns();
+        int wait_ms;
+
+        if (errno != ENOENT && errno != ENOTDIR) {
+            break;
+        }
+        if (now_ns >= deadline_ns) {
+            errno = ENOENT;
+            break;
+        }
+        /* A symlink that doesn't lead anywhere yet doesn't get an event
+         * when its target shows up, so look again now and then anyway.
+         */
+        wait_ms = (deadline_ns - now_ns + 999999) / 1000000;
+        if (wait_ms > 250) {
+            wait_ms = 250;
+        }
+
+        if (inotify_fd < 0) {
+            inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+            if (inotify_fd < 0) {
+                usleep(10000);
+                continue;
+            }
+        }
+        watch_nearest_dir(inotify_fd, filename);
+
+        /* It may have shown up before the watch was in place */
+        if (!stat(filename, &info)) {
+            break;
+        }
+
+        struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, wait_ms)) > 0) {
+            char buf[1024];
+            while (read(inotify_fd, buf, sizeof(buf)) > 0) {
+            }
+        }
+    }
+
+    save_errno = errno;
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if (!stat(filename, &info)) {
+        return 0;
+    }
+    errno = save_errno;
+    return -1;
+}
+
+static int wait_for_file(const char *filename, int timeout)
+{
+    uint64_t start_ns = wait_hook ? gettime_ns() : 0;
+    int ret;
+
+    ret = fs_mgr_wait_for_file(filename, timeout * 1000);
 
-    while (gettime() < timeout_time && ((ret = stat(filename, &info)) < 0))
-        usleep(10000);
+    if (wait_hook) {
+        wait_hook(filename, start_ns, gettime_ns());
+    }
 
     return ret;
 }
@@ -151,7 +263,7 @@ static void check_fs(char *blk_device, char *fs_type, char *target)
             INFO("Running %s on %s\n", E2FSCK_BIN, blk_device);
 
             ret = android_fork_execvp_ext(ARRAY_SIZE(e2fsck_argv), e2fsck_argv,
-                                        &status, true, LOG_KLOG | LOG_FILE,
+                                        &status, true, LOG_KLOG | LOG_FILE | LOG_SHM,
                                         true, FSCK_LOG_FILE);
 
             if (ret < 0) {
@@ -168,7 +280,7 @@ static void check_fs(char *blk_device, char *fs_type, char *target)
         INFO("Running %s -a %s\n", F2FS_FSCK_BIN, blk_device);
 
         ret = android_fork_execvp_ext(ARRAY_SIZE(f2fs_fsck_argv), f2fs_fsck_argv,
-                                      &status, true, LOG_KLOG | LOG_FILE,
+                                      &status, true, LOG_KLOG | LOG_FILE | LOG_SHM,
                                       true, FSCK_LOG_FILE);
         if (ret < 0) {
             /* No need to check for error in fork, we can't really handle it now */
@@ -289,10 +401,30 @@ static int device_is_force_encrypted() {
     return strcmp(value, "1") ? 0 : 1;
 }
 
+static void check_rec(struct fstab_rec *rec)
+{
+    int cmp_len;
+    char *detected_fs_type;
+
+    if (rec->fs_mgr_flags & MF_CHECK) {
+        /* Skip file system check unless we are sure we are the right type */
+        detected_fs_type = blkid_get_tag_value(NULL, "TYPE", rec->blk_device);
+        if (detected_fs_type) {
+            cmp_len = (!strncmp(detected_fs_type, "ext", 3) &&
+                    strlen(detected_fs_type) == 4) ? 3 : strlen(detected_fs_type);
+            if (!strncmp(rec->fs_type, detected_fs_type, cmp_len)) {
+                check_fs(rec->blk_device, rec->fs_type, rec->mount_point);
+            }
+        }
+    }
+}
+
 /*
  * Tries to mount any of the consecutive fstab entries that match
  * the mountpoint of the one given by fstab->recs[start_idx].
  *
+ * checked: The file system check of fstab->recs[start_idx] has
+ *     already been run.
  * end_idx: On return, will be the last rec that was looked at.
  * attempted_idx: On return, will indicate which fstab rec
  *     succeeded. In case of failure, it will be the start_idx.
@@ -300,13 +432,12 @@ static int device_is_force_encrypted() {
  *   -1 on failure with errno set to match the 1st mount failure.
  *   0 on success.
  */
-static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_idx, int *attempted_idx)
+static int mount_with_alternatives(struct fstab *fstab, int start_idx, int checked,
+                                   int *end_idx, int *attempted_idx)
 {
     int i;
     int mount_errno = 0;
     int mounted = 0;
-    int cmp_len;
-    char *detected_fs_type;
 
     if (!end_idx || !attempted_idx || start_idx >= fstab->num_entries) {
       errno = EINVAL;
@@ -331,17 +462,8 @@ static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_
                 continue;
             }
 
-            if (fstab->recs[i].fs_mgr_flags & MF_CHECK) {
-                /* Skip file system check unless we are sure we are the right type */
-                detected_fs_type = blkid_get_tag_value(NULL, "TYPE", fstab->recs[i].blk_device);
-                if (detected_fs_type) {
-                    cmp_len = (!strncmp(detected_fs_type, "ext", 3) &&
-                            strlen(detected_fs_type) == 4) ? 3 : strlen(detected_fs_type);
-                    if (!strncmp(fstab->recs[i].fs_type, detected_fs_type, cmp_len)) {
-                        check_fs(fstab->recs[i].blk_device, fstab->recs[i].fs_type,
-                                 fstab->recs[i].mount_point);
-                    }
-                }
+            if (!(i == start_idx && checked)) {
+                check_rec(&fstab->recs[i]);
             }
             if (!__mount(fstab->recs[i].blk_device, fstab->recs[i].mount_point, &fstab->recs[i])) {
                 *attempted_idx = i;
@@ -503,6 +625,235 @@ static int handle_encryptable(struct fstab *fstab, const struct fstab_rec* rec)
     return FS_MGR_MNTALL_DEV_NOT_ENCRYPTED;
 }
 
+static int is_mountable(const struct fstab_rec *rec)
+{
+    /* Don't mount entries that are managed by vold */
+    if (rec->fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) {
+        return 0;
+    }
+
+    /* Skip swap and raw partition entries such as boot, recovery, etc */
+    if (!strcmp(rec->fs_type, "swap") ||
+        !strcmp(rec->fs_type, "emmc") ||
+        !strcmp(rec->fs_type, "mtd")) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Everything that has to happen to an entry before it can be checked.
+ * Returns -1 if the entry should be skipped.
+ */
+static int prepare_rec(struct fstab_rec *rec)
+{
+    /* Translate LABEL= file system labels into block devices */
+    if (!strcmp(rec->fs_type, "ext2") ||
+        !strcmp(rec->fs_type, "ext3") ||
+        !strcmp(rec->fs_type, "ext4")) {
+        int tret = translate_ext_labels(rec);
+        if (tret < 0) {
+            ERROR("Could not translate label to block device\n");
+            return -1;
+        }
+    }
+
+    if (rec->fs_mgr_flags & MF_WAIT) {
+        wait_for_file(rec->blk_device, WAIT_TIMEOUT);
+    }
+
+    if ((rec->fs_mgr_flags & MF_VERIFY) && device_is_secure()) {
+        int rc = fs_mgr_setup_verity(rec);
+        if (device_is_debuggable() && rc == FS_MGR_SETUP_VERITY_DISABLED) {
+            INFO("Verity disabled");
+        } else if (rc != FS_MGR_SETUP_VERITY_SUCCESS) {
+            ERROR("Could not set up verified partition, skipping!\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * fs_mgr_mount_all() checks the first entry for each mount point in a
+ * child process of its own, so that the checks of different partitions
+ * overlap. A check starts once the mount point it is under, if that is
+ * in the fstab too, has been dealt with. The mounts themselves still
+ * happen one at a time, in fstab order.
+ */
+enum {
+    PREP_NONE,      /* nothing done yet, or to be done again */
+    PREP_CHECKING,  /* prepared, its check running in pid */
+    PREP_SKIP,      /* could not be prepared */
+    PREP_USED,      /* taken by the mount loop */
+};
+
+struct mount_prep {
+    int state;
+    pid_t pid;
+};
+
+/* True if the idx is where fs_mgr_mount_all() will start on a mount point */
+static int is_first_rec(struct fstab *fstab, int idx)
+{
+    int i;
+
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (!is_mountable(&fstab->recs[i])) {
+            continue;
+        }
+        if (i == idx) {
+            return 1;
+        }
+        /* mount_with_alternatives() goes through all of the same mount point */
+        while (i + 1 < fstab->num_entries &&
+               !strcmp(fstab->recs[i].mount_point, fstab->recs[i + 1].mount_point)) {
+            i++;
+        }
+        if (i >= idx) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int is_under(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    if (!strcmp(dir, "/")) {
+        return strcmp(path, "/") != 0;
+    }
+    return !strncmp(path, dir, len) && path[len] == '/';
+}
+
+/* The last entry of the earlier mount point that fstab->recs[idx] is
+ * mounted under, or -1
+ */
+static int parent_rec(struct fstab *fstab, int idx)
+{
+    int i;
+    int parent = -1;
+    size_t parent_len = 0;
+
+    for (i = 0; i < idx; i++) {
+        const char *dir = fstab->recs[i].mount_point;
+        if (is_mountable(&fstab->recs[i]) && is_under(fstab->recs[idx].mount_point, dir) &&
+            (parent == -1 || strlen(dir) >= parent_len)) {
+            parent = i;
+            parent_len = strlen(dir);
+        }
+    }
+    return parent;
+}
+
+/* prepared is what prepare_rec() returned for the entry */
+static void start_check(struct fstab *fstab, int idx, int prepared, struct mount_prep *prep)
+{
+    pid_t pid;
+
+    if (prepared) {
+        prep->state = PREP_SKIP;
+        return;
+    }
+    prep->state = PREP_CHECKING;
+    prep->pid = 0;
+    if (!(fstab->recs[idx].fs_mgr_flags & MF_CHECK)) {
+        return;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        check_rec(&fstab->recs[idx]);
+        _exit(0);
+    } else if (pid < 0) {
+        ERROR("%s(): fork failed (%s), checking %s in line\n", __func__, strerror(errno),
+              fstab->recs[idx].blk_device);
+        check_rec(&fstab->recs[idx]);
+    } else {
+        prep->pid = pid;
+    }
+}
+
+static void finish_check(struct mount_prep *prep)
+{
+    int status;
+
+    if (prep->pid > 0 && TEMP_FAILURE_RETRY(waitpid(prep->pid, &status, 0)) < 0) {
+        ERROR("%s(): waitpid failed (%s)\n", __func__, strerror(errno));
+    }
+    prep->pid = 0;
+}
+
+/* Don't leave checks running behind an early return */
+static void finish_checks(struct fstab *fstab, struct mount_prep *preps)
+{
+    int i;
+
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (preps[i].state == PREP_CHECKING) {
+            finish_check(&preps[i]);
+        }
+    }
+}
+
+struct prepare_work {
+    struct fstab_rec *rec;
+    int idx;
+    int result;
+    int threaded;
+    pthread_t thread;
+};
+
+static void *prepare_thread(void *arg)
+{
+    struct prepare_work *work = arg;
+
+    work->result = prepare_rec(work->rec);
+    return NULL;
+}
+
+/* Start the checks of every mount point whose parent, if it has one in the
+ * fstab, is before done_idx and so has been dealt with already. Waiting for
+ * their block devices and setting up verity on them happens in parallel.
+ */
+static void start_checks(struct fstab *fstab, struct mount_prep *preps, int done_idx)
+{
+    struct prepare_work *works;
+    int n = 0;
+    int i;
+
+    works = calloc(fstab->num_entries, sizeof(*works));
+
+    for (i = done_idx; i < fstab->num_entries; i++) {
+        if (preps[i].state == PREP_NONE && is_first_rec(fstab, i) &&
+            parent_rec(fstab, i) < done_idx) {
+            if (!works) {
+                start_check(fstab, i, prepare_rec(&fstab->recs[i]), &preps[i]);
+                continue;
+            }
+            works[n].rec = &fstab->recs[i];
+            works[n].idx = i;
+            n++;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        works[i].threaded = n > 1 &&
+                !pthread_create(&works[i].thread, NULL, prepare_thread, &works[i]);
+        if (!works[i].threaded) {
+            works[i].result = prepare_rec(works[i].rec);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (works[i].threaded) {
+            pthread_join(works[i].thread, NULL);
+        }
+        start_check(fstab, works[i].idx, works[i].result, &preps[works[i].idx]);
+    }
+
+    free(works);
+}
+
 /* When multiple fstab records share the same mount_point, it will
  * try to mount each one in turn, and ignore any duplicates after a
  * first successful mount.
@@ -516,52 +867,42 @@ int fs_mgr_mount_all(struct fstab *fstab)
     int mret = -1;
     int mount_errno = 0;
     int attempted_idx = -1;
+    struct mount_prep *preps;
 
     if (!fstab) {
         return -1;
     }
 
-    for (i = 0; i < fstab->num_entries; i++) {
-        /* Don't mount entries that are managed by vold */
-        if (fstab->recs[i].fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) {
-            continue;
-        }
+    preps = calloc(fstab->num_entries, sizeof(*preps));
+    if (!preps) {
+        return -1;
+    }
 
-        /* Skip swap and raw partition entries such as boot, recovery, etc */
-        if (!strcmp(fstab->recs[i].fs_type, "swap") ||
-            !strcmp(fstab->recs[i].fs_type, "emmc") ||
-            !strcmp(fstab->recs[i].fs_type, "mtd")) {
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (!is_mountable(&fstab->recs[i])) {
             continue;
         }
 
-        /* Translate LABEL= file system labels into block devices */
-        if (!strcmp(fstab->recs[i].fs_type, "ext2") ||
-            !strcmp(fstab->recs[i].fs_type, "ext3") ||
-            !strcmp(fstab->recs[i].fs_type, "ext4")) {
-            int tret = translate_ext_labels(&fstab->recs[i]);
-            if (tret < 0) {
-                ERROR("Could not translate label to block device\n");
-                continue;
-            }
-        }
+        start_checks(fstab, preps, i);
 
-        if (fstab->recs[i].fs_mgr_flags & MF_WAIT) {
-            wait_for_file(fstab->recs[i].blk_device, WAIT_TIMEOUT);
+        int checked = 0;
+        if (preps[i].state == PREP_CHECKING) {
+            finish_check(&preps[i]);
+            checked = 1;
+        } else if (preps[i].state == PREP_SKIP) {
+            preps[i].state = PREP_USED;
+            continue;
+        } else if (prepare_rec(&fstab->recs[i])) {
+            /* Not started ahead, an alternative or going over it again
+             * after it was formatted */
+            continue;
         }
+        preps[i].state = PREP_USED;
 
-        if ((fstab->recs[i].fs_mgr_flags & MF_VERIFY) && device_is_secure()) {
-            int rc = fs_mgr_setup_verity(&fstab->recs[i]);
-            if (device_is_debuggable() && rc == FS_MGR_SETUP_VERITY_DISABLED) {
-                INFO("Verity disabled");
-            } else if (rc != FS_MGR_SETUP_VERITY_SUCCESS) {
-                ERROR("Could not set up verified partition, skipping!\n");
-                continue;
-            }
-        }
         int last_idx_inspected;
         int top_idx = i;
 
-        mret = mount_with_alternatives(fstab, i, &last_idx_inspected, &attempted_idx);
+        mret = mount_with_alternatives(fstab, i, checked, &last_idx_inspected, &attempted_idx);
         i = last_idx_inspected;
         mount_errno = errno;
 
@@ -571,6 +912,8 @@ int fs_mgr_mount_all(struct fstab *fstab)
 
             if (status == FS_MGR_MNTALL_FAIL) {
                 /* Fatal error - no point continuing */
+                finish_checks(fstab, preps);
+                free(preps);
                 return status;
             }
 
@@ -646,6 +989,8 @@ int fs_mgr_mount_all(struct fstab *fstab)
         }
     }
 
+    free(preps);
+
     if (error_count) {
         return -1;
     } else {
@@ -16,14 +16,20 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "fs_mgr_priv.h"
 
+struct fstab_index;
+static void free_index(struct fstab_index *index);
+
 struct fs_mgr_flag_values {
     char *key_loc;
     char *verity_loc;
@@ -208,46 +214,108 @@ static int parse_flags(char *flags, struct flag_list *fl,
     return f;
 }
 
-struct fstab *fs_mgr_read_fstab(const char *fstab_path)
+/* Parses one non-comment line of an fstab into rec. line is modified. */
+static int parse_fstab_line(char *line, struct fstab_rec *rec)
 {
-    FILE *fstab_file;
-    int cnt, entries;
-    ssize_t len;
-    size_t alloc_len = 0;
-    char *line = NULL;
     const char *delim = " \t";
     char *save_ptr, *p;
-    struct fstab *fstab = NULL;
     struct fs_mgr_flag_values flag_vals;
 #define FS_OPTIONS_LEN 1024
     char tmp_fs_options[FS_OPTIONS_LEN];
 
-    fstab_file = fopen(fstab_path, "r");
-    if (!fstab_file) {
-        ERROR("Cannot open file %s\n", fstab_path);
-        return 0;
+    if (!(p = strtok_r(line, delim, &save_ptr))) {
+        ERROR("Error parsing mount source\n");
+        return -1;
+    }
+    rec->blk_device = strdup(p);
+
+    if (!(p = strtok_r(NULL, delim, &save_ptr))) {
+        ERROR("Error parsing mount_point\n");
+        return -1;
+    }
+    rec->mount_point = strdup(p);
+
+    if (!(p = strtok_r(NULL, delim, &save_ptr))) {
+        ERROR("Error parsing fs_type\n");
+        return -1;
+    }
+    rec->fs_type = strdup(p);
+
+    if (!(p = strtok_r(NULL, delim, &save_ptr))) {
+        ERROR("Error parsing mount_flags\n");
+        return -1;
+    }
+    tmp_fs_options[0] = '\0';
+    rec->flags = parse_flags(p, mount_flags, NULL, tmp_fs_options, FS_OPTIONS_LEN);
+
+    /* fs_options are optional */
+    if (tmp_fs_options[0]) {
+        rec->fs_options = strdup(tmp_fs_options);
+    } else {
+        rec->fs_options = NULL;
     }
 
-    entries = 0;
-    while ((len = getline(&line, &alloc_len, fstab_file)) != -1) {
-        /* if the last character is a newline, shorten the string by 1 byte */
-        if (line[len - 1] == '\n') {
-            line[len - 1] = '\0';
+    if (!(p = strtok_r(NULL, delim, &save_ptr))) {
+        ERROR("Error parsing fs_mgr_options\n");
+        return -1;
+    }
+    rec->fs_mgr_flags = parse_flags(p, fs_mgr_flags, &flag_vals, NULL, 0);
+    rec->key_loc = flag_vals.key_loc;
+    rec->verity_loc = flag_vals.verity_loc;
+    rec->length = flag_vals.part_length;
+    rec->label = flag_vals.label;
+    rec->partnum = flag_vals.partnum;
+    rec->swap_prio = flag_vals.swap_prio;
+    rec->zram_size = flag_vals.zram_size;
+    return 0;
+}
+
+/* Reads the whole file with one read, the fstab is small. */
+static char *read_fstab_file(int fd, size_t size)
+{
+    char *data = malloc(size + 1);
+    size_t done = 0;
+
+    if (!data) {
+        return NULL;
+    }
+    while (done < size) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, data + done, size - done));
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    data[done] = '\0';
+    return data;
+}
+
+static struct fstab *parse_fstab(const char *fstab_path, char *data)
+{
+    struct fstab *fstab;
+    char *line, *next, *p;
+    int entries = 0;
+    int cnt = 0;
+
+    /* Count the entries first so that recs is allocated once */
+    for (line = data; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) {
+            next++;
         }
-        /* Skip any leading whitespace */
         p = line;
-        while (isspace(*p)) {
+        while (*p != '\n' && isspace(*p)) {
             p++;
         }
         /* ignore comments or empty lines */
-        if (*p == '#' || *p == '\0')
-            continue;
-        entries++;
+        if (*p != '#' && *p != '\n' && *p != '\0') {
+            entries++;
+        }
     }
 
     if (!entries) {
         ERROR("No entries found in fstab\n");
-        goto err;
+        return NULL;
     }
 
     /* Allocate and init the fstab structure */
@@ -256,13 +324,10 @@ struct fstab *fs_mgr_read_fstab(const char *fstab_path)
     fstab->fstab_filename = strdup(fstab_path);
     fstab->recs = calloc(fstab->num_entries, sizeof(struct fstab_rec));
 
-    fseek(fstab_file, 0, SEEK_SET);
-
-    cnt = 0;
-    while ((len = getline(&line, &alloc_len, fstab_file)) != -1) {
-        /* if the last character is a newline, shorten the string by 1 byte */
-        if (line[len - 1] == '\n') {
-            line[len - 1] = '\0';
+    for (line = data; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
         }
 
         /* Skip any leading whitespace */
@@ -274,73 +339,111 @@ struct fstab *fs_mgr_read_fstab(const char *fstab_path)
         if (*p == '#' || *p == '\0')
             continue;
 
-        /* If a non-comment entry is greater than the size we allocated, give an
-         * error and quit.  This can happen in the unlikely case the file changes
-         * between the two reads.
-         */
-        if (cnt >= entries) {
-            ERROR("Tried to process more entries than counted\n");
-            break;
+        if (parse_fstab_line(line, &fstab->recs[cnt])) {
+            fs_mgr_free_fstab(fstab);
+            return NULL;
         }
+        cnt++;
+    }
+    return fstab;
+}
 
-        if (!(p = strtok_r(line, delim, &save_ptr))) {
-            ERROR("Error parsing mount source\n");
-            goto err;
-        }
-        fstab->recs[cnt].blk_device = strdup(p);
+static char *dup_or_null(const char *s)
+{
+    return s ? strdup(s) : NULL;
+}
 
-        if (!(p = strtok_r(NULL, delim, &save_ptr))) {
-            ERROR("Error parsing mount_point\n");
-            goto err;
-        }
-        fstab->recs[cnt].mount_point = strdup(p);
+static struct fstab *dup_fstab(const struct fstab *fstab)
+{
+    struct fstab *copy = calloc(1, sizeof(struct fstab));
+    int i;
 
-        if (!(p = strtok_r(NULL, delim, &save_ptr))) {
-            ERROR("Error parsing fs_type\n");
-            goto err;
-        }
-        fstab->recs[cnt].fs_type = strdup(p);
+    if (!copy) {
+        return NULL;
+    }
+    copy->num_entries = fstab->num_entries;
+    copy->fstab_filename = dup_or_null(fstab->fstab_filename);
+    copy->recs = calloc(fstab->num_entries, sizeof(struct fstab_rec));
+    if (!copy->recs) {
+        free(copy->fstab_filename);
+        free(copy);
+        return NULL;
+    }
+    for (i = 0; i < fstab->num_entries; i++) {
+        const struct fstab_rec *rec = &fstab->recs[i];
+
+        copy->recs[i] = *rec;
+        copy->recs[i].blk_device = dup_or_null(rec->blk_device);
+        copy->recs[i].mount_point = dup_or_null(rec->mount_point);
+        copy->recs[i].fs_type = dup_or_null(rec->fs_type);
+        copy->recs[i].fs_options = dup_or_null(rec->fs_options);
+        copy->recs[i].key_loc = dup_or_null(rec->key_loc);
+        copy->recs[i].verity_loc = dup_or_null(rec->verity_loc);
+        copy->recs[i].label = dup_or_null(rec->label);
+    }
+    return copy;
+}
 
-        if (!(p = strtok_r(NULL, delim, &save_ptr))) {
-            ERROR("Error parsing mount_flags\n");
-            goto err;
-        }
-        tmp_fs_options[0] = '\0';
-        fstab->recs[cnt].flags = parse_flags(p, mount_flags, NULL,
-                                       tmp_fs_options, FS_OPTIONS_LEN);
+/* The last fstab parsed, so that init, which reads the same fstab for
+ * mount_all, the verity state and the recovery properties, only parses it
+ * once. Callers get their own copy, they may change it.
+ */
+static pthread_mutex_t fstab_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fstab *fstab_cache;
+static struct stat fstab_cache_stat;
 
-        /* fs_options are optional */
-        if (tmp_fs_options[0]) {
-            fstab->recs[cnt].fs_options = strdup(tmp_fs_options);
-        } else {
-            fstab->recs[cnt].fs_options = NULL;
-        }
+static int same_file(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime &&
+           a->st_ctime == b->st_ctime;
+}
+
+struct fstab *fs_mgr_read_fstab(const char *fstab_path)
+{
+    struct fstab *fstab = NULL;
+    struct stat sb;
+    char *data;
+    int fd;
 
-        if (!(p = strtok_r(NULL, delim, &save_ptr))) {
-            ERROR("Error parsing fs_mgr_options\n");
-            goto err;
+    fd = TEMP_FAILURE_RETRY(open(fstab_path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0 || fstat(fd, &sb) < 0) {
+        ERROR("Cannot open file %s\n", fstab_path);
+        if (fd >= 0) {
+            close(fd);
         }
-        fstab->recs[cnt].fs_mgr_flags = parse_flags(p, fs_mgr_flags,
-                                                    &flag_vals, NULL, 0);
-        fstab->recs[cnt].key_loc = flag_vals.key_loc;
-        fstab->recs[cnt].verity_loc = flag_vals.verity_loc;
-        fstab->recs[cnt].length = flag_vals.part_length;
-        fstab->recs[cnt].label = flag_vals.label;
-        fstab->recs[cnt].partnum = flag_vals.partnum;
-        fstab->recs[cnt].swap_prio = flag_vals.swap_prio;
-        fstab->recs[cnt].zram_size = flag_vals.zram_size;
-        cnt++;
+        return 0;
     }
-    fclose(fstab_file);
-    free(line);
-    return fstab;
 
-err:
-    fclose(fstab_file);
-    free(line);
-    if (fstab)
-        fs_mgr_free_fstab(fstab);
-    return NULL;
+    pthread_mutex_lock(&fstab_cache_lock);
+    if (fstab_cache && !strcmp(fstab_cache->fstab_filename, fstab_path) &&
+            same_file(&fstab_cache_stat, &sb)) {
+        fstab = dup_fstab(fstab_cache);
+        pthread_mutex_unlock(&fstab_cache_lock);
+        close(fd);
+        return fstab;
+    }
+    pthread_mutex_unlock(&fstab_cache_lock);
+
+    data = read_fstab_file(fd, sb.st_size);
+    close(fd);
+    if (!data) {
+        ERROR("Cannot read file %s\n", fstab_path);
+        return NULL;
+    }
+    fstab = parse_fstab(fstab_path, data);
+    free(data);
+    if (!fstab) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&fstab_cache_lock);
+    fs_mgr_free_fstab(fstab_cache);
+    fstab_cache = dup_fstab(fstab);
+    fstab_cache_stat = sb;
+    pthread_mutex_unlock(&fstab_cache_lock);
+
+    return fstab;
 }
 
 void fs_mgr_free_fstab(struct fstab *fstab)
@@ -358,6 +461,7 @@ void fs_mgr_free_fstab(struct fstab *fstab)
         free(fstab->recs[i].fs_type);
         free(fstab->recs[i].fs_options);
         free(fstab->recs[i].key_loc);
+        free(fstab->recs[i].verity_loc);
         free(fstab->recs[i].label);
     }
 
@@ -367,6 +471,8 @@ void fs_mgr_free_fstab(struct fstab *fstab)
     /* Free the fstab filename */
     free(fstab->fstab_filename);
 
+    free_index(fstab->index);
+
     /* Free fstab */
     free(fstab);
 }
@@ -400,35 +506,164 @@ int fs_mgr_add_entry(struct fstab *fstab,
      return 0;
 }
 
+/* Where each mount point is in the fstab, so that a lookup costs a probe
+ * per component of the path rather than a compare per entry. Built on the
+ * first lookup and rebuilt if entries were added since.
+ */
+struct fstab_index {
+    int num_entries;    /* of the fstab it was built for */
+    unsigned mask;      /* slots is a power of two long */
+    int *slots;         /* first rec with each mount point, or -1 */
+    int *next;          /* next rec with the same mount point, or -1 */
+};
+
+static unsigned hash_mount_point(const char *s, size_t len)
+{
+    unsigned h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int is_mount_point(struct fstab *fstab, int i, const char *path, size_t len)
+{
+    const char *mp = fstab->recs[i].mount_point;
+    return !strncmp(mp, path, len) && mp[len] == '\0';
+}
+
+/* The first rec whose mount point is the len bytes at path, or -1 */
+static int index_find(struct fstab *fstab, struct fstab_index *index,
+                      const char *path, size_t len)
+{
+    unsigned slot = hash_mount_point(path, len) & index->mask;
+
+    while (index->slots[slot] != -1) {
+        if (is_mount_point(fstab, index->slots[slot], path, len)) {
+            return index->slots[slot];
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return -1;
+}
+
+static void free_index(struct fstab_index *index)
+{
+    if (index) {
+        free(index->slots);
+        free(index->next);
+        free(index);
+    }
+}
+
+static struct fstab_index *get_index(struct fstab *fstab)
+{
+    struct fstab_index *index = fstab->index;
+    unsigned size = 1;
+    int i;
+
+    if (index && index->num_entries == fstab->num_entries) {
+        return index;
+    }
+    free_index(index);
+    fstab->index = NULL;
+
+    while (size < 2 * (unsigned) fstab->num_entries) {
+        size <<= 1;
+    }
+    index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->num_entries = fstab->num_entries;
+    index->mask = size - 1;
+    index->slots = malloc(size * sizeof(int));
+    index->next = malloc((fstab->num_entries + 1) * sizeof(int));
+    if (!index->slots || !index->next) {
+        free_index(index);
+        return NULL;
+    }
+    memset(index->slots, -1, size * sizeof(int));
+
+    for (i = 0; i < fstab->num_entries; i++) {
+        const char *mp = fstab->recs[i].mount_point;
+        size_t len = strlen(mp);
+        int first = index_find(fstab, index, mp, len);
+
+        index->next[i] = -1;
+        if (first == -1) {
+            unsigned slot = hash_mount_point(mp, len) & index->mask;
+            while (index->slots[slot] != -1) {
+                slot = (slot + 1) & index->mask;
+            }
+            index->slots[slot] = i;
+        } else {
+            while (index->next[first] != -1) {
+                first = index->next[first];
+            }
+            index->next[first] = i;
+        }
+    }
+
+    fstab->index = index;
+    return index;
+}
+
 /*
  * Returns the 1st matching fstab_rec that follows the start_rec.
  * start_rec is the result of a previous search or NULL.
  */
 struct fstab_rec *fs_mgr_get_entry_for_mount_point_after(struct fstab_rec *start_rec, struct fstab *fstab, const char *path)
 {
+    struct fstab_index *index;
+    int start = 0;
+    int best = -1;
+    size_t len;
     int i;
+
     if (!fstab) {
         return NULL;
     }
 
     if (start_rec) {
-        for (i = 0; i < fstab->num_entries; i++) {
-            if (&fstab->recs[i] == start_rec) {
-                i++;
-                break;
+        if (start_rec < fstab->recs || start_rec >= fstab->recs + fstab->num_entries) {
+            return NULL;
+        }
+        start = start_rec - fstab->recs + 1;
+    }
+
+    index = get_index(fstab);
+    if (!index) {
+        for (i = start; i < fstab->num_entries; i++) {
+            len = strlen(fstab->recs[i].mount_point);
+            if (strncmp(path, fstab->recs[i].mount_point, len) == 0 &&
+                (path[len] == '\0' || path[len] == '/')) {
+                return &fstab->recs[i];
             }
         }
-    } else {
-        i = 0;
+        return NULL;
     }
-    for (; i < fstab->num_entries; i++) {
-        int len = strlen(fstab->recs[i].mount_point);
-        if (strncmp(path, fstab->recs[i].mount_point, len) == 0 &&
-            (path[len] == '\0' || path[len] == '/')) {
-            return &fstab->recs[i];
+
+    /* An entry matches if its mount point is path, or a directory path is
+     * in. Look up each of those in turn and keep the earliest entry.
+     */
+    for (len = 0; ; len++) {
+        if (path[len] == '/' || path[len] == '\0') {
+            i = index_find(fstab, index, path, len);
+            while (i != -1 && i < start) {
+                i = index->next[i];
+            }
+            if (i != -1 && (best == -1 || i < best)) {
+                best = i;
+            }
+        }
+        if (path[len] == '\0') {
+            break;
         }
     }
-    return NULL;
+    return (best == -1) ? NULL : &fstab->recs[best];
 }
 
 /*
@@ -83,5 +83,6 @@
 #define DM_BUF_SIZE 4096
 
 int fs_mgr_set_blk_ro(const char *blockdev);
+int fs_mgr_wait_for_file(const char *filename, int timeout_ms);
 
 #endif /* __CORE_FS_MGR_PRIV_H */
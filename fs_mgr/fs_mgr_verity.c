@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <time.h>
 
 #include <private/android_filesystem_config.h>
@@ -110,6 +111,20 @@ static RSAPublicKey *load_key(char *path)
     return key;
 }
 
+// The key is the same for every partition, and partitions may be set up
+// from more than one thread at a time.
+static pthread_once_t verity_key_once = PTHREAD_ONCE_INIT;
+static RSAPublicKey *verity_key;
+
+static void load_verity_key(void)
+{
+    verity_key = load_key(VERITY_TABLE_RSA_KEY);
+}
+
+// Serializes access to the metadata in verity_loc, which all the verified
+// partitions share.
+static pthread_mutex_t verity_state_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int verify_table(char *signature, char *table, int table_length)
 {
     RSAPublicKey *key;
@@ -120,7 +135,8 @@ static int verify_table(char *signature, char *table, int table_length)
     SHA256_hash((uint8_t*)table, table_length, hash_buf);
 
     // Now get the public key from the keyfile
-    key = load_key(VERITY_TABLE_RSA_KEY);
+    pthread_once(&verity_key_once, load_verity_key);
+    key = verity_key;
     if (!key) {
         ERROR("Couldn't load verity keys");
         goto out;
@@ -139,7 +155,6 @@ static int verify_table(char *signature, char *table, int table_length)
     retval = 0;
 
 out:
-    free(key);
     return retval;
 }
 
@@ -241,6 +256,9 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     int protocol_version;
     int device;
     int retval = FS_MGR_SETUP_VERITY_FAIL;
+    char *metadata = NULL;
+    size_t pos = 0;
+    ssize_t size;
 
     *signature = NULL;
 
@@ -254,17 +272,26 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
         goto out;
     }
 
-    if (TEMP_FAILURE_RETRY(lseek64(device, device_size, SEEK_SET)) < 0) {
-        ERROR("Could not seek to start of verity metadata block.\n");
+    // The whole metadata block in one go, it starts on the block boundary
+    // right after the file system.
+    metadata = malloc(VERITY_METADATA_SIZE);
+    if (!metadata) {
+        ERROR("Couldn't allocate memory for verity metadata!\n");
+        goto out;
+    }
+    size = TEMP_FAILURE_RETRY(pread64(device, metadata, VERITY_METADATA_SIZE, device_size));
+    if (size < 0) {
+        ERROR("Could not read verity metadata block (%s).\n", strerror(errno));
         goto out;
     }
 
     // check the magic number
-    if (TEMP_FAILURE_RETRY(read(device, &magic_number, sizeof(magic_number))) !=
-            sizeof(magic_number)) {
+    if ((size_t) size < sizeof(magic_number)) {
         ERROR("Couldn't read magic number!\n");
         goto out;
     }
+    memcpy(&magic_number, metadata, sizeof(magic_number));
+    pos += sizeof(magic_number);
 
 #ifdef ALLOW_ADBD_DISABLE_VERITY
     if (magic_number == VERITY_METADATA_MAGIC_DISABLE) {
@@ -280,26 +307,29 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     }
 
     // check the protocol version
-    if (TEMP_FAILURE_RETRY(read(device, &protocol_version,
-            sizeof(protocol_version))) != sizeof(protocol_version)) {
+    if ((size_t) size - pos < sizeof(protocol_version)) {
         ERROR("Couldn't read verity metadata protocol version!\n");
         goto out;
     }
+    memcpy(&protocol_version, metadata + pos, sizeof(protocol_version));
+    pos += sizeof(protocol_version);
     if (protocol_version != 0) {
         ERROR("Got unknown verity metadata protocol version %d!\n", protocol_version);
         goto out;
     }
 
     // get the signature
+    if ((size_t) size - pos < RSANUMBYTES) {
+        ERROR("Couldn't read signature from verity metadata!\n");
+        goto out;
+    }
     *signature = (char*) malloc(RSANUMBYTES);
     if (!*signature) {
         ERROR("Couldn't allocate memory for signature!\n");
         goto out;
     }
-    if (TEMP_FAILURE_RETRY(read(device, *signature, RSANUMBYTES)) != RSANUMBYTES) {
-        ERROR("Couldn't read signature from verity metadata!\n");
-        goto out;
-    }
+    memcpy(*signature, metadata + pos, RSANUMBYTES);
+    pos += RSANUMBYTES;
 
     if (!table) {
         retval = FS_MGR_SETUP_VERITY_SUCCESS;
@@ -307,23 +337,24 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     }
 
     // get the size of the table
-    if (TEMP_FAILURE_RETRY(read(device, &table_length, sizeof(table_length))) !=
-            sizeof(table_length)) {
+    if ((size_t) size - pos < sizeof(table_length)) {
         ERROR("Couldn't get the size of the verity table from metadata!\n");
         goto out;
     }
+    memcpy(&table_length, metadata + pos, sizeof(table_length));
+    pos += sizeof(table_length);
 
     // get the table + null terminator
+    if ((size_t) size - pos < table_length) {
+        ERROR("Couldn't read the verity table from metadata!\n");
+        goto out;
+    }
     *table = malloc(table_length + 1);
     if (!*table) {
         ERROR("Couldn't allocate memory for verity table!\n");
         goto out;
     }
-    if (TEMP_FAILURE_RETRY(read(device, *table, table_length)) !=
-            (ssize_t)table_length) {
-        ERROR("Couldn't read the verity table from metadata!\n");
-        goto out;
-    }
+    memcpy(*table, metadata + pos, table_length);
 
     (*table)[table_length] = 0;
     retval = FS_MGR_SETUP_VERITY_SUCCESS;
@@ -332,6 +363,8 @@ out:
     if (device != -1)
         close(device);
 
+    free(metadata);
+
     if (retval != FS_MGR_SETUP_VERITY_SUCCESS) {
         free(*signature);
         *signature = NULL;
@@ -441,12 +474,8 @@ static int resume_verity_table(struct dm_ioctl *io, char *name, int fd)
 }
 
 static int test_access(char *device) {
-    int tries = 25;
-    while (tries--) {
-        if (!access(device, F_OK) || errno != ENOENT) {
-            return 0;
-        }
-        usleep(40 * 1000);
+    if (!fs_mgr_wait_for_file(device, 1000) || errno != ENOENT) {
+        return 0;
     }
     return -1;
 }
@@ -705,10 +734,14 @@ out:
     return rc;
 }
 
-static int compare_last_signature(struct fstab_rec *fstab, int *match)
+/*
+ * signature is the one from the verity metadata of the partition, or NULL
+ * to read it here.
+ */
+static int compare_last_signature(struct fstab_rec *fstab, const char *signature, int *match)
 {
     char tag[METADATA_TAG_MAX_LENGTH + 1];
-    char *signature = NULL;
+    char *read_signature = NULL;
     int fd = -1;
     int rc = -1;
     uint8_t curr[SHA256_DIGEST_SIZE];
@@ -718,15 +751,18 @@ static int compare_last_signature(struct fstab_rec *fstab, int *match)
 
     *match = 1;
 
-    // get verity filesystem size
-    if (get_fs_size(fstab->fs_type, fstab->blk_device, &device_size) < 0) {
-        ERROR("Failed to get filesystem size\n");
-        goto out;
-    }
+    if (!signature) {
+        // get verity filesystem size
+        if (get_fs_size(fstab->fs_type, fstab->blk_device, &device_size) < 0) {
+            ERROR("Failed to get filesystem size\n");
+            goto out;
+        }
 
-    if (read_verity_metadata(device_size, fstab->blk_device, &signature, NULL) < 0) {
-        ERROR("Failed to read verity signature from %s\n", fstab->mount_point);
-        goto out;
+        if (read_verity_metadata(device_size, fstab->blk_device, &read_signature, NULL) < 0) {
+            ERROR("Failed to read verity signature from %s\n", fstab->mount_point);
+            goto out;
+        }
+        signature = read_signature;
     }
 
     SHA256_hash(signature, RSANUMBYTES, curr);
@@ -771,7 +807,7 @@ static int compare_last_signature(struct fstab_rec *fstab, int *match)
     rc = 0;
 
 out:
-    free(signature);
+    free(read_signature);
 
     if (fd != -1) {
         close(fd);
@@ -794,27 +830,11 @@ static int get_verity_state_offset(struct fstab_rec *fstab, off64_t *offset)
                 offset);
 }
 
-static int load_verity_state(struct fstab_rec *fstab, int *mode)
+static int load_verity_state_locked(struct fstab_rec *fstab, const char *signature, int *mode)
 {
-    char propbuf[PROPERTY_VALUE_MAX];
     int match = 0;
     off64_t offset = 0;
 
-    /* use the kernel parameter if set */
-    property_get("ro.boot.veritymode", propbuf, "");
-
-    if (*propbuf != '\0') {
-        if (!strcmp(propbuf, "enforcing")) {
-            *mode = VERITY_MODE_DEFAULT;
-            return 0;
-        } else if (!strcmp(propbuf, "logging")) {
-            *mode = VERITY_MODE_LOGGING;
-            return 0;
-        } else {
-            INFO("Unknown value %s for veritymode; ignoring", propbuf);
-        }
-    }
-
     if (get_verity_state_offset(fstab, &offset) < 0) {
         /* fall back to stateless behavior */
         *mode = VERITY_MODE_EIO;
@@ -828,7 +848,7 @@ static int load_verity_state(struct fstab_rec *fstab, int *mode)
         return write_verity_state(fstab->verity_loc, offset, *mode);
     }
 
-    if (!compare_last_signature(fstab, &match) && !match) {
+    if (!compare_last_signature(fstab, signature, &match) && !match) {
         /* partition has been reflashed, reset dm-verity state */
         *mode = VERITY_MODE_DEFAULT;
         return write_verity_state(fstab->verity_loc, offset, *mode);
@@ -837,6 +857,36 @@ static int load_verity_state(struct fstab_rec *fstab, int *mode)
     return read_verity_state(fstab->verity_loc, offset, mode);
 }
 
+/*
+ * signature is the one from the verity metadata of the partition, or NULL
+ * to read it again.
+ */
+static int load_verity_state(struct fstab_rec *fstab, const char *signature, int *mode)
+{
+    char propbuf[PROPERTY_VALUE_MAX];
+    int rc;
+
+    /* use the kernel parameter if set */
+    property_get("ro.boot.veritymode", propbuf, "");
+
+    if (*propbuf != '\0') {
+        if (!strcmp(propbuf, "enforcing")) {
+            *mode = VERITY_MODE_DEFAULT;
+            return 0;
+        } else if (!strcmp(propbuf, "logging")) {
+            *mode = VERITY_MODE_LOGGING;
+            return 0;
+        } else {
+            INFO("Unknown value %s for veritymode; ignoring", propbuf);
+        }
+    }
+
+    pthread_mutex_lock(&verity_state_lock);
+    rc = load_verity_state_locked(fstab, signature, mode);
+    pthread_mutex_unlock(&verity_state_lock);
+    return rc;
+}
+
 int fs_mgr_load_verity_state(int *mode)
 {
     char fstab_filename[PROPERTY_VALUE_MAX + sizeof(FSTAB_PREFIX)];
@@ -865,7 +915,7 @@ int fs_mgr_load_verity_state(int *mode)
             continue;
         }
 
-        rc = load_verity_state(&fstab->recs[i], &current);
+        rc = load_verity_state(&fstab->recs[i], NULL, &current);
         if (rc < 0) {
             continue;
         }
@@ -1033,7 +1083,7 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
         goto out;
     }
 
-    if (load_verity_state(fstab, &mode) < 0) {
+    if (load_verity_state(fstab, verity_table_signature, &mode) < 0) {
         /* if accessing or updating the state failed, switch to the default
          * safe mode. This makes sure the device won't end up in an endless
          * restart loop, and no corrupted data will be exposed to userspace
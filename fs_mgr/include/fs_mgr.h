@@ -49,6 +49,7 @@ struct fstab {
     int num_entries;
     struct fstab_rec *recs;
     char *fstab_filename;
+    void *index;    /* private to fs_mgr_fstab.c, NULL in a new fstab */
 };
 
 struct fstab_rec {
@@ -71,6 +72,11 @@ struct fstab_rec {
 typedef void (*fs_mgr_verity_state_callback)(struct fstab_rec *fstab,
         const char *mount_point, int mode, int status);
 
+// Called after each wait for a block device to show up, with the
+// CLOCK_MONOTONIC times it started and ended, in ns.
+typedef void (*fs_mgr_wait_hook)(const char *filename, uint64_t start_ns, uint64_t end_ns);
+void fs_mgr_set_wait_hook(fs_mgr_wait_hook hook);
+
 struct fstab *fs_mgr_read_fstab(const char *fstab_path);
 void fs_mgr_free_fstab(struct fstab *fstab);
 
@@ -19,11 +19,13 @@
 #include "healthd.h"
 #include "BatteryMonitor.h"
 
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -99,18 +101,63 @@ int BatteryMonitor::getBatteryHealth(const char* status) {
     return ret;
 }
 
+int BatteryMonitor::readFromUevent(const String8& path, char* buf, size_t size) {
+    static const char kDir[] = POWER_SUPPLY_SYSFS_PATH "/";
+    static const char kPrefix[] = "POWER_SUPPLY_";
+    const char* attr = path.string();
+    size_t len = strlen(mUeventSupply);
+
+    // Only the attributes of the supply that sent the uevent are in it,
+    // as POWER_SUPPLY_<ATTRIBUTE>=<value>.
+    if (strncmp(attr, kDir, sizeof(kDir) - 1))
+        return -1;
+    attr += sizeof(kDir) - 1;
+    if (strncmp(attr, mUeventSupply, len) || attr[len] != '/')
+        return -1;
+    attr += len + 1;
+
+    for (const char* cp = mUevent; *cp; cp += strlen(cp) + 1) {
+        if (strncmp(cp, kPrefix, sizeof(kPrefix) - 1))
+            continue;
+        const char* key = cp + sizeof(kPrefix) - 1;
+        size_t i = 0;
+        while (attr[i] && toupper(attr[i]) == key[i])
+            i++;
+        if (!attr[i] && key[i] == '=') {
+            strlcpy(buf, key + i + 1, size);
+            return strlen(buf) + 1;
+        }
+    }
+    return -1;
+}
+
 int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     char *cp = NULL;
+    int fd;
 
     if (path.isEmpty())
         return -1;
-    int fd = open(path.string(), O_RDONLY, 0);
-    if (fd == -1) {
-        KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
-        return -1;
+
+    if (mUevent) {
+        int count = readFromUevent(path, buf, size);
+        if (count > 0)
+            return count;
+    }
+
+    ssize_t index = mSysfsFds.indexOfKey(path);
+    if (index >= 0) {
+        fd = mSysfsFds.valueAt(index);
+    } else {
+        fd = open(path.string(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd == -1) {
+            KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
+            return -1;
+        }
+        mSysfsFds.add(path, fd);
     }
 
-    ssize_t count = TEMP_FAILURE_RETRY(read(fd, buf, size));
+    // sysfs attributes are read afresh from the start
+    ssize_t count = TEMP_FAILURE_RETRY(pread(fd, buf, size, 0));
     if (count > 0)
             cp = (char *)memrchr(buf, '\n', count);
 
@@ -119,7 +166,11 @@ int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     else
         buf[0] = '\0';
 
-    close(fd);
+    if (count < 0) {
+        // The device may have gone, open it again next time.
+        close(fd);
+        mSysfsFds.removeItem(path);
+    }
     return count;
 }
 
@@ -176,9 +227,42 @@ int BatteryMonitor::getIntField(const String8& path) {
     return value;
 }
 
-bool BatteryMonitor::update(void) {
+bool BatteryMonitor::changedEnough() {
+    const struct BatteryProperties& last = mReportedProps;
+
+    if (!mHaveReportedProps)
+        return true;
+
+    if (props.chargerAcOnline != last.chargerAcOnline ||
+        props.chargerUsbOnline != last.chargerUsbOnline ||
+        props.chargerWirelessOnline != last.chargerWirelessOnline ||
+        props.maxChargingCurrent != last.maxChargingCurrent ||
+        props.batteryStatus != last.batteryStatus ||
+        props.batteryHealth != last.batteryHealth ||
+        props.batteryPresent != last.batteryPresent ||
+        props.batteryLevel != last.batteryLevel ||
+        props.batteryTechnology != last.batteryTechnology)
+        return true;
+
+    // Voltage and temperature wander, only report them as they move away.
+    return abs(props.batteryVoltage - last.batteryVoltage) >
+                mHealthdConfig->notify_voltage_threshold ||
+            abs(props.batteryTemperature - last.batteryTemperature) >
+                mHealthdConfig->notify_temperature_threshold;
+}
+
+bool BatteryMonitor::update(const char* uevent, bool notifyAlways) {
     bool logthis;
 
+    mUevent = NULL;
+    for (const char* cp = uevent; cp && *cp; cp += strlen(cp) + 1) {
+        if (!strncmp(cp, "POWER_SUPPLY_NAME=", strlen("POWER_SUPPLY_NAME="))) {
+            mUevent = uevent;
+            mUeventSupply = cp + strlen("POWER_SUPPLY_NAME=");
+            break;
+        }
+    }
+
     props.chargerAcOnline = false;
     props.chargerUsbOnline = false;
     props.chargerWirelessOnline = false;
@@ -219,22 +303,18 @@ bool BatteryMonitor::update(void) {
     if (readFromFile(mHealthdConfig->batteryHealthPath, buf, SIZE) > 0)
         props.batteryHealth = getBatteryHealth(buf);
 
-    if (readFromFile(mHealthdConfig->batteryTechnologyPath, buf, SIZE) > 0)
+    if (readFromFile(mHealthdConfig->batteryTechnologyPath, buf, SIZE) > 0 &&
+            strcmp(props.batteryTechnology.string(), buf))
         props.batteryTechnology = String8(buf);
 
     unsigned int i;
 
-    for (i = 0; i < mChargerNames.size(); i++) {
-        String8 path;
-        path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH,
-                          mChargerNames[i].string());
+    for (i = 0; i < mChargers.size(); i++) {
+        const Charger& charger = mChargers[i];
 
-        if (readFromFile(path, buf, SIZE) > 0) {
+        if (readFromFile(charger.onlinePath, buf, SIZE) > 0) {
             if (buf[0] != '0') {
-                path.clear();
-                path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                switch(readPowerSupplyType(path)) {
+                switch(readPowerSupplyType(charger.typePath)) {
                 case ANDROID_POWER_SUPPLY_TYPE_AC:
                     props.chargerAcOnline = true;
                     break;
@@ -246,13 +326,10 @@ bool BatteryMonitor::update(void) {
                     break;
                 default:
                     KLOG_WARNING(LOG_TAG, "%s: Unknown power supply type\n",
-                                 mChargerNames[i].string());
+                                 charger.name.string());
                 }
-                path.clear();
-                path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                if (access(path.string(), R_OK) == 0) {
-                    int maxChargingCurrent = getIntField(path);
+                if (!charger.currentMaxPath.isEmpty()) {
+                    int maxChargingCurrent = getIntField(charger.currentMaxPath);
                     if (props.maxChargingCurrent < maxChargingCurrent) {
                         props.maxChargingCurrent = maxChargingCurrent;
                     }
@@ -315,7 +392,13 @@ bool BatteryMonitor::update(void) {
         KLOG_WARNING(LOG_TAG, "%s\n", dmesgline);
     }
 
-    healthd_mode_ops->battery_update(&props);
+    mUevent = NULL;
+    mPropertiesChanged = changedEnough();
+    if (mPropertiesChanged || notifyAlways) {
+        mReportedProps = props;
+        mHaveReportedProps = true;
+        healthd_mode_ops->battery_update(&props);
+    }
     return props.chargerAcOnline | props.chargerUsbOnline |
             props.chargerWirelessOnline;
 }
@@ -453,8 +536,19 @@ void BatteryMonitor::init(struct healthd_config *hc) {
             case ANDROID_POWER_SUPPLY_TYPE_WIRELESS:
                 path.clear();
                 path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
-                if (access(path.string(), R_OK) == 0)
-                    mChargerNames.add(String8(name));
+                if (access(path.string(), R_OK) == 0) {
+                    Charger charger;
+                    charger.name = name;
+                    charger.onlinePath = path;
+                    charger.typePath.appendFormat("%s/%s/type",
+                                                  POWER_SUPPLY_SYSFS_PATH, name);
+                    path.clear();
+                    path.appendFormat("%s/%s/current_max",
+                                      POWER_SUPPLY_SYSFS_PATH, name);
+                    if (access(path.string(), R_OK) == 0)
+                        charger.currentMaxPath = path;
+                    mChargers.add(charger);
+                }
                 break;
 
             case ANDROID_POWER_SUPPLY_TYPE_BATTERY:
@@ -19,6 +19,7 @@
 
 #include <batteryservice/BatteryService.h>
 #include <binder/IInterface.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
@@ -38,23 +39,47 @@ class BatteryMonitor {
     };
 
     void init(struct healthd_config *hc);
-    bool update(void);
+    // uevent is the power_supply uevent that triggered the update, if any:
+    // the properties it carries are used instead of reading them again.
+    // The properties are passed on to the mode if they changed by more than
+    // the thresholds of the config since they were last, or if notifyAlways.
+    bool update(const char* uevent = NULL, bool notifyAlways = true);
+    // Whether the last update() found the properties changed.
+    bool propertiesChanged() const { return mPropertiesChanged; }
     int getChargeStatus();
     status_t getProperty(int id, struct BatteryProperty *val);
     void dumpState(int fd);
 
   private:
+    struct Charger {
+        String8 name;
+        String8 onlinePath;
+        String8 typePath;
+        String8 currentMaxPath;     // empty if the charger doesn't have one
+    };
+
     struct healthd_config *mHealthdConfig;
-    Vector<String8> mChargerNames;
+    Vector<Charger> mChargers;
+    // The attribute files read so far, kept open to be read again.
+    KeyedVector<String8, int> mSysfsFds;
+    // The uevent being handled by update(), and the name of its supply.
+    const char* mUevent;
+    const char* mUeventSupply;
     bool mBatteryDevicePresent;
     bool mAlwaysPluggedDevice;
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
     struct BatteryProperties props;
+    // The properties as last passed on to the mode.
+    struct BatteryProperties mReportedProps;
+    bool mHaveReportedProps;
+    bool mPropertiesChanged;
 
+    bool changedEnough();
     int getBatteryStatus(const char* status);
     int getBatteryHealth(const char* status);
     int readFromFile(const String8& path, char* buf, size_t size);
+    int readFromUevent(const String8& path, char* buf, size_t size);
     PowerSupplyType readPowerSupplyType(const String8& path);
     bool getBooleanField(const String8& path);
     int getIntField(const String8& path);
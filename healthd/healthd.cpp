@@ -31,6 +31,7 @@
 #include <cutils/uevent.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <utils/Errors.h>
 
 using namespace android;
@@ -46,6 +47,11 @@ using namespace android;
 #define DEFAULT_PERIODIC_CHORES_INTERVAL_SLOW (60 * 10)
 #endif
 
+// The fast interval is doubled up to this many times while nothing changes
+#define MAX_CHORES_BACKOFF 3
+
+#define DEFAULT_UEVENT_COALESCE_MS 200
+
 static struct healthd_config healthd_config = {
     .periodic_chores_interval_fast = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST,
     .periodic_chores_interval_slow = DEFAULT_PERIODIC_CHORES_INTERVAL_SLOW,
@@ -62,6 +68,9 @@ static struct healthd_config healthd_config = {
     .energyCounter = NULL,
     .boot_min_cap = 0,
     .screen_on = NULL,
+    .uevent_coalesce_ms = DEFAULT_UEVENT_COALESCE_MS,
+    .notify_voltage_threshold = 0,
+    .notify_temperature_threshold = 0,
 };
 
 static int eventct;
@@ -79,6 +88,14 @@ static int awake_poll_interval = -1;
 
 static int wakealarm_wake_interval = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST;
 
+// Periodic chores in a row that found the battery properties unchanged
+static int chores_backoff;
+
+// Power supply uevents are folded into one update until then (in ms of
+// CLOCK_BOOTTIME), and one is owed if any came in the meantime.
+static int64_t uevent_quiet_until;
+static bool uevent_update_pending;
+
 static BatteryMonitor* gBatteryMonitor;
 
 struct healthd_mode_ops *healthd_mode_ops;
@@ -180,12 +197,38 @@ status_t healthd_get_property(int id, struct BatteryProperty *val) {
     return gBatteryMonitor->getProperty(id, val);
 }
 
-void healthd_battery_update(void) {
+static int64_t curr_time_ms(void) {
+    struct timespec tm;
+    clock_gettime(CLOCK_BOOTTIME, &tm);
+    return tm.tv_sec * 1000LL + tm.tv_nsec / 1000000;
+}
+
+// uevent is the power_supply uevent that triggered the update, if any.
+static void battery_update(const char* uevent, bool notifyAlways) {
+    uevent_update_pending = false;
+
+    bool charger_online = gBatteryMonitor->update(uevent, notifyAlways);
+
+    if (gBatteryMonitor->propertiesChanged())
+        chores_backoff = 0;
+    else if (chores_backoff < MAX_CHORES_BACKOFF)
+        chores_backoff++;
+
+    // Back the fast interval off while the battery is steady, never past
+    // the slow one.
+    int fast_interval = healthd_config.periodic_chores_interval_fast;
+    if (fast_interval > 0) {
+        fast_interval <<= chores_backoff;
+        if (healthd_config.periodic_chores_interval_slow > 0 &&
+            fast_interval > healthd_config.periodic_chores_interval_slow)
+            fast_interval = healthd_config.periodic_chores_interval_slow;
+    }
+
     // Fast wake interval when on charger (watch for overheat);
     // slow wake interval when on battery (watch for drained battery).
 
-   int new_wake_interval = gBatteryMonitor->update() ?
-       healthd_config.periodic_chores_interval_fast :
+   int new_wake_interval = charger_online ?
+       fast_interval :
            healthd_config.periodic_chores_interval_slow;
 
     if (new_wake_interval != wakealarm_wake_interval)
@@ -196,12 +239,25 @@ void healthd_battery_update(void) {
     // poll at fast rate while awake and let alarm wake up at slow rate when
     // asleep.
 
-    if (healthd_config.periodic_chores_interval_fast == -1)
+    if (fast_interval == -1)
         awake_poll_interval = -1;
     else
         awake_poll_interval =
-            new_wake_interval == healthd_config.periodic_chores_interval_fast ?
-                -1 : healthd_config.periodic_chores_interval_fast * 1000;
+            new_wake_interval == fast_interval ?
+                -1 : fast_interval * 1000;
+}
+
+// A charger coming or going, or negotiating its current, sends power_supply
+// uevents in bursts: the first of a burst updates at once, the others make
+// a single update at the end of the coalescing window.
+static void uevent_battery_update(const char* uevent) {
+    battery_update(uevent, false);
+    if (healthd_config.uevent_coalesce_ms > 0)
+        uevent_quiet_until = curr_time_ms() + healthd_config.uevent_coalesce_ms;
+}
+
+void healthd_battery_update(void) {
+    battery_update(NULL, true);
 }
 
 void healthd_dump_battery_state(int fd) {
@@ -210,7 +266,7 @@ void healthd_dump_battery_state(int fd) {
 }
 
 static void periodic_chores() {
-    healthd_battery_update();
+    battery_update(NULL, false);
 }
 
 #define UEVENT_MSG_LEN 2048
@@ -231,7 +287,10 @@ static void uevent_event(uint32_t /*epevents*/) {
 
     while (*cp) {
         if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
-            healthd_battery_update();
+            if (curr_time_ms() < uevent_quiet_until)
+                uevent_update_pending = true;
+            else
+                uevent_battery_update(msg);
             break;
         }
 
@@ -290,6 +349,13 @@ static void healthd_mainloop(void) {
         mode_timeout = healthd_mode_ops->preparetowait();
         if (timeout < 0 || (mode_timeout > 0 && mode_timeout < timeout))
             timeout = mode_timeout;
+        if (uevent_update_pending) {
+            int64_t wait = uevent_quiet_until - curr_time_ms();
+            if (wait < 0)
+                wait = 0;
+            if (timeout < 0 || wait < timeout)
+                timeout = (int)wait;
+        }
         nevents = epoll_wait(epollfd, events, eventct, timeout);
 
         if (nevents == -1) {
@@ -304,7 +370,9 @@ static void healthd_mainloop(void) {
                 (*(void (*)(int))events[n].data.ptr)(events[n].events);
         }
 
-        if (!nevents)
+        if (uevent_update_pending && curr_time_ms() >= uevent_quiet_until)
+            uevent_battery_update(NULL);
+        else if (!nevents)
             periodic_chores();
 
         healthd_mode_ops->heartbeat();
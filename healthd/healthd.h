@@ -36,6 +36,20 @@
 //    remaining capacity).  The default value is 600 (10 minutes).  Value -1
 //    tuns off periodic chores (and wakeups) in these conditions.
 //
+//    While the battery properties stay the same, the fast interval is
+//    doubled at each periodic chore, up to 8 times or to the slow interval.
+//
+// uevent_coalesce_ms: a power_supply uevent updates the battery properties
+// at once, but further ones within this many milliseconds are folded into
+// a single update at its end.  0 updates on every uevent.
+//
+// notify_voltage_threshold, notify_temperature_threshold: updated
+// properties are only passed on to the mode, and so to the listeners of
+// the Android runtime, when they changed,
+// and voltage (in mV) and temperature (in tenths of a degree C) only count
+// as changed when they moved by more than these from the values last
+// passed on.  The defaults of 0 pass on any change.
+//
 // power_supply sysfs attribute file paths.  Set these to specific paths
 // to use for the associated battery parameters.  healthd will search for
 // appropriate power_supply attribute files to use for any paths left empty:
@@ -69,6 +83,10 @@ struct healthd_config {
     int (*energyCounter)(int64_t *);
     int boot_min_cap;
     bool (*screen_on)(android::BatteryProperties *props);
+
+    int uevent_coalesce_ms;
+    int notify_voltage_threshold;
+    int notify_temperature_threshold;
 };
 
 // Global helper functions
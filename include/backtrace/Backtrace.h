@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -128,7 +129,8 @@ protected:
   pid_t tid_;
 
   BacktraceMap* map_;
-  bool map_shared_;
+  // Set when map_ was not passed in, and came from BacktraceMap::CreateShared.
+  std::shared_ptr<BacktraceMap> shared_map_;
 
   std::vector<backtrace_frame_data_t> frames_;
 };
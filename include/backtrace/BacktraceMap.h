@@ -29,8 +29,9 @@
 #include <sys/mman.h>
 #endif
 
-#include <deque>
+#include <memory>
 #include <string>
+#include <vector>
 
 struct backtrace_map_t {
   uintptr_t start = 0;
@@ -48,9 +49,17 @@ public:
   // is unsupported.
   static BacktraceMap* Create(pid_t pid, bool uncached = false);
 
+  // Returns the map for pid that every other holder of a shared map for
+  // that pid is using, creating one if there is none. The map is rebuilt
+  // from scratch once the last holder releases it, so a long-lived caller
+  // that wants fresh data should not keep it around. Returns an empty
+  // pointer if the map could not be built.
+  static std::shared_ptr<BacktraceMap> CreateShared(pid_t pid);
+
   virtual ~BacktraceMap();
 
-  // Fill in the map data structure for the given address.
+  // Fill in the map data structure for the given address. maps_ must be
+  // sorted by start address.
   virtual void FillIn(uintptr_t addr, backtrace_map_t* map);
 
   // The flags returned are the same flags as used by the mmap call.
@@ -68,11 +77,11 @@ public:
   bool IsWritable(uintptr_t pc) { return GetFlags(pc) & PROT_WRITE; }
   bool IsExecutable(uintptr_t pc) { return GetFlags(pc) & PROT_EXEC; }
 
-  typedef std::deque<backtrace_map_t>::iterator iterator;
+  typedef std::vector<backtrace_map_t>::iterator iterator;
   iterator begin() { return maps_.begin(); }
   iterator end() { return maps_.end(); }
 
-  typedef std::deque<backtrace_map_t>::const_iterator const_iterator;
+  typedef std::vector<backtrace_map_t>::const_iterator const_iterator;
   const_iterator begin() const { return maps_.begin(); }
   const_iterator end() const { return maps_.end(); }
 
@@ -95,7 +104,8 @@ protected:
 
   virtual bool ParseLine(const char* line, backtrace_map_t* map);
 
-  std::deque<backtrace_map_t> maps_;
+  // Sorted by start, non-overlapping.
+  std::vector<backtrace_map_t> maps_;
   pid_t pid_;
 };
 
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BACKTRACE_BACKTRACE_SAMPLER_H
+#define _BACKTRACE_BACKTRACE_SAMPLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <backtrace/Backtrace.h>
+
+// Samples the stacks of all the other threads of the current process at
+// once, for profilers. Snapshot() makes every thread copy its registers
+// and the top of its stack in a signal handler and carry on running; the
+// samples are unwound afterwards by Unwind(), on whatever thread the
+// caller likes. Unwind tables and the map of the process are kept from
+// one sample to the next.
+//
+// Snapshot() and Unwind() must not be called concurrently on the same
+// sampler.
+class BacktraceSampler {
+public:
+  // Room for max_threads samples of stack_bytes of stack each is allocated
+  // here, so that taking a snapshot doesn't allocate. Returns nullptr if
+  // the architecture is not supported.
+  static BacktraceSampler* Create(size_t max_threads = 64, size_t stack_bytes = 16 * 1024);
+
+  virtual ~BacktraceSampler() {}
+
+  // Samples every thread in the process but the caller, and returns how
+  // many were sampled. Threads that don't respond within timeout_ms, and
+  // those beyond max_threads, are left out. The samples of the previous
+  // snapshot are discarded.
+  virtual size_t Snapshot(int timeout_ms = 50) = 0;
+
+  // The thread that sample index was taken from.
+  virtual pid_t GetTid(size_t index) = 0;
+
+  // Unwinds sample index into frames, replacing their contents. Function
+  // names are only looked up if with_names is true, as that is the
+  // slowest part; a profiler can do it later for the pcs it keeps.
+  virtual bool Unwind(size_t index, std::vector<backtrace_frame_data_t>* frames,
+                      bool with_names = false) = 0;
+
+protected:
+  BacktraceSampler() {}
+};
+
+#endif // _BACKTRACE_BACKTRACE_SAMPLER_H
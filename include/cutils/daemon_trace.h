@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUTILS_DAEMON_TRACE_H
+#define _CUTILS_DAEMON_TRACE_H
+
+/*
+ * Systrace events from the native daemons (adbd, logd, init, sdcard), all
+ * under ATRACE_TAG_DAEMON so that one category shows where their time goes.
+ *
+ *     bool traced = daemon_trace_begin("name");
+ *     ...
+ *     daemon_trace_end(traced);
+ *
+ * or DAEMON_TRACE_SCOPE("name") in C++. The end is traced if and only if
+ * the beginning was, even if tracing is toggled in between. Nothing is
+ * formatted on these paths: pass names that are already there, such as
+ * literals, rather than building them.
+ *
+ * The daemons aren't binder services and don't hear of the tags changing,
+ * so their main loops call daemon_trace_poll() now and then.
+ *
+ * Defining DAEMON_TRACE to 0 before including this header, or in the
+ * build, compiles it all out.
+ */
+
+#ifndef DAEMON_TRACE
+#define DAEMON_TRACE 1
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if DAEMON_TRACE
+
+#include <cutils/trace.h>
+
+static inline bool daemon_trace_begin(const char* name)
+{
+    if (CC_UNLIKELY(atrace_is_tag_enabled(ATRACE_TAG_DAEMON))) {
+        atrace_begin_body(name);
+        return true;
+    }
+    return false;
+}
+
+static inline void daemon_trace_end(bool begun)
+{
+    if (CC_UNLIKELY(begun)) {
+        char c = 'E';
+        write(atrace_marker_fd, &c, 1);
+    }
+}
+
+static inline void daemon_trace_int(const char* name, int32_t value)
+{
+    atrace_int(ATRACE_TAG_DAEMON, name, value);
+}
+
+static inline void daemon_trace_poll()
+{
+    atrace_update_tags_if_changed();
+}
+
+#else
+
+static inline bool daemon_trace_begin(const char* name __attribute__((unused)))
+{
+    return false;
+}
+
+static inline void daemon_trace_end(bool begun __attribute__((unused))) { }
+
+static inline void daemon_trace_int(const char* name __attribute__((unused)),
+                                    int32_t value __attribute__((unused))) { }
+
+static inline void daemon_trace_poll() { }
+
+#endif
+
+#ifdef __cplusplus
+
+class DaemonTraceScope {
+public:
+    explicit DaemonTraceScope(const char* name) : mBegun(daemon_trace_begin(name)) { }
+    ~DaemonTraceScope() { daemon_trace_end(mBegun); }
+
+private:
+    DaemonTraceScope(const DaemonTraceScope&);
+    void operator=(const DaemonTraceScope&);
+
+    bool mBegun;
+};
+
+#define DAEMON_TRACE_SCOPE_NAME(line) daemon_trace_scope_ ## line
+#define DAEMON_TRACE_SCOPE_AT(name, line) DaemonTraceScope DAEMON_TRACE_SCOPE_NAME(line)(name)
+#define DAEMON_TRACE_SCOPE(name) DAEMON_TRACE_SCOPE_AT(name, __LINE__)
+
+#endif
+
+#endif /* _CUTILS_DAEMON_TRACE_H */
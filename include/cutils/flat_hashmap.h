@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Flat hash map.
+ *
+ * Unlike Hashmap, entries live in one array and are found through an
+ * open-addressed index, so puts don't allocate per entry. Keys are ints or
+ * C strings, hashed and compared inline rather than through callbacks.
+ * There is no built-in lock: callers that share a map provide their own.
+ *
+ * Entries are visited in the order they were first put.
+ */
+
+#ifndef __FLAT_HASHMAP_H
+#define __FLAT_HASHMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A flat hash map. */
+typedef struct FlatHashmap FlatHashmap;
+
+/** What the void* keys of a map are. */
+typedef enum {
+    /** ints, passed as FLAT_HASHMAP_INT_KEY(i) */
+    FLAT_HASHMAP_INT_KEYS,
+    /** NUL-terminated strings, compared with strcmp */
+    FLAT_HASHMAP_STRING_KEYS,
+    /** NUL-terminated strings, compared with strcasecmp */
+    FLAT_HASHMAP_ICASE_STRING_KEYS,
+} FlatHashmapKeyType;
+
+#define FLAT_HASHMAP_INT_KEY(i) ((void*) (intptr_t) (i))
+
+/**
+ * Creates a new hash map. Returns NULL if memory allocation fails.
+ *
+ * @param keyType what the keys are
+ * @param initialCapacity number of expected entries
+ */
+FlatHashmap* flatHashmapCreate(FlatHashmapKeyType keyType, size_t initialCapacity);
+
+/**
+ * Frees the hash map. Does not free the keys or values themselves.
+ */
+void flatHashmapFree(FlatHashmap* map);
+
+/**
+ * Makes room for capacity entries in total, so that building a map of
+ * known size doesn't rehash on the way. Returns false and sets errno to
+ * ENOMEM if memory allocation fails.
+ */
+bool flatHashmapReserve(FlatHashmap* map, size_t capacity);
+
+/**
+ * Removes every entry, calling release (if not NULL) on each one first.
+ * Keeps the memory for reuse.
+ */
+void flatHashmapClear(FlatHashmap* map, void (*release)(void* key, void* value));
+
+/**
+ * Puts value for the given key in the map. Returns pre-existing value if
+ * any; the map then keeps the key it already had.
+ *
+ * If memory allocation fails, this function returns NULL, the map's size
+ * does not increase, and errno is set to ENOMEM.
+ */
+void* flatHashmapPut(FlatHashmap* map, void* key, void* value);
+
+/**
+ * Gets a value from the map. Returns NULL if no entry for the given key is
+ * found or if the value itself is NULL.
+ */
+void* flatHashmapGet(const FlatHashmap* map, const void* key);
+
+/**
+ * Returns true if the map contains an entry for the given key.
+ */
+bool flatHashmapContainsKey(const FlatHashmap* map, const void* key);
+
+/**
+ * Removes an entry from the map. Returns the removed value or NULL if no
+ * entry was present. If removedKey is not NULL, it is set to the key the
+ * map held, or NULL.
+ */
+void* flatHashmapRemove(FlatHashmap* map, const void* key, void** removedKey);
+
+/**
+ * Gets the number of entries in this map.
+ */
+size_t flatHashmapSize(const FlatHashmap* map);
+
+/**
+ * Invokes the given callback on each entry in the map, oldest first. Stops
+ * iterating if the callback returns false. The callback may remove entries
+ * but must not put any.
+ */
+void flatHashmapForEach(FlatHashmap* map,
+        bool (*callback)(void* key, void* value, void* context),
+        void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FLAT_HASHMAP_H */
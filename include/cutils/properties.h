@@ -18,6 +18,7 @@
 #define __CUTILS_PROPERTIES_H
 
 #include <sys/cdefs.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/system_properties.h>
 #include <stdint.h>
@@ -103,6 +104,51 @@ int64_t property_get_int64(const char *key, int64_t default_value);
 **/
 int32_t property_get_int32(const char *key, int32_t default_value);
 
+/* property_handle: a cached view of one property, for code that reads the
+** same property over and over (log tags, debug flags, ...).
+**
+** The handle remembers where the property lives and the value it last saw,
+** already parsed. Reading through a handle whose property has not changed
+** costs a single atomic load of the property's serial number; the value is
+** only copied and parsed again after a change. A property that does not
+** exist yet is watched through the serial of the whole property area
+** instead, which changes whenever a property is added.
+**
+** Declare handles with PROPERTY_HANDLE_INIT, typically as statics:
+**
+**     static property_handle_t debug_flag = PROPERTY_HANDLE_INIT("debug.foo");
+**     if (property_handle_get_bool(&debug_flag, false)) { ... }
+**
+** A handle is not thread-safe; threads sharing one must serialize access.
+** The fields are private.
+*/
+typedef struct property_handle {
+    const char *key;
+    const prop_info *pi;
+    uint32_t serial;
+    bool loaded;
+    int len;
+    int8_t bool_value;      /* -1 when not a boolean */
+    bool int_valid;
+    intmax_t int_value;
+    char value[PROPERTY_VALUE_MAX];
+} property_handle_t;
+
+#define PROPERTY_HANDLE_INIT(key) { (key), NULL, 0, false, 0, -1, false, 0, { 0 } }
+
+/* property_handle_get: like property_get, reading through the handle.
+** Returns the length of the value copied into value, or of default_value.
+*/
+int property_handle_get(property_handle_t *handle, char *value, const char *default_value);
+
+/* property_handle_get_bool, property_handle_get_int64,
+** property_handle_get_int32: like property_get_bool, property_get_int64 and
+** property_get_int32, reading through the handle.
+*/
+int8_t property_handle_get_bool(property_handle_t *handle, int8_t default_value);
+int64_t property_handle_get_int64(property_handle_t *handle, int64_t default_value);
+int32_t property_handle_get_int32(property_handle_t *handle, int32_t default_value);
+
 /* property_set: returns 0 on success, < 0 on failure
 */
 int property_set(const char *key, const char *value);
@@ -34,6 +34,38 @@ extern void record_stream_free(RecordStream *p_rs);
 extern int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord, 
                                     size_t *p_outRecordLen);
 
+/*
+ * A variant that keeps the records in a ring buffer of ringLen bytes, at
+ * least a record and its header long. It reads as much as there is room
+ * for at once, and hands out records where they were read, rather than
+ * moving the partial one left at the end of the buffer before reading.
+ *
+ * The records returned are valid until the next call to
+ * record_ring_get_next() or record_ring_get_batch().
+ */
+typedef struct RecordRing RecordRing;
+
+typedef struct {
+    void *data;
+    size_t len;
+} RecordView;
+
+extern RecordRing *record_ring_new(int fd, size_t maxRecordLen, size_t ringLen);
+extern void record_ring_free(RecordRing *p_rr);
+
+/* Same return values as record_stream_get_next() */
+extern int record_ring_get_next (RecordRing *p_rr, void ** p_outRecord,
+                                  size_t *p_outRecordLen);
+
+/*
+ * Returns in p_outRecords every complete record in the buffer, up to
+ * maxRecords, reading once first if there is none. Returns 0 on success
+ * or end of stream, with *p_outCount set to 0 for the latter, and -1 /
+ * errno = EAGAIN if it needs to read again.
+ */
+extern int record_ring_get_batch (RecordRing *p_rr, RecordView *p_outRecords,
+                                   size_t maxRecords, size_t *p_outCount);
+
 #ifdef __cplusplus
 }
 #endif
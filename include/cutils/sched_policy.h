@@ -17,6 +17,8 @@
 #ifndef __CUTILS_SCHED_POLICY_H
 #define __CUTILS_SCHED_POLICY_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -45,12 +47,32 @@ extern int set_cpuset_policy(int tid, SchedPolicy policy);
  */
 extern int set_sched_policy(int tid, SchedPolicy policy);
 
+/* Like set_cpuset_policy() and set_sched_policy(), for count threads at once.
+ * Zero is not allowed as a tid here. Every thread is moved even if some
+ * fail; the return value is 0 or the first -errno.
+ */
+extern int set_cpuset_policy_tids(const int *tids, size_t count, SchedPolicy policy);
+extern int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy);
+
+/* Move every thread of process pid, as listed in /proc/<pid>/task.
+ * Return value: 0 for success, or -errno for error.
+ */
+extern int set_process_cpuset_policy(int pid, SchedPolicy policy);
+extern int set_process_sched_policy(int pid, SchedPolicy policy);
+
 /* Return the policy associated with the cgroup of thread tid via policy pointer.
  * On platforms which support gettid(), zero tid means current thread.
  * Return value: 0 for success, or -1 for error and set errno.
  */
 extern int get_sched_policy(int tid, SchedPolicy *policy);
 
+/* Like get_sched_policy(), but returns the policy this process last moved
+ * thread tid to, or last read for it, without going back to /proc. Moves made
+ * by other processes are not seen, so only use this for threads this process
+ * manages.
+ */
+extern int get_cached_sched_policy(int tid, SchedPolicy *policy);
+
 /* Return a displayable string corresponding to policy.
  * Return value: non-NULL NUL-terminated name of unspecified length;
  * the caller is responsible for displaying the useful part of the string.
@@ -17,6 +17,7 @@
 #ifndef __CUTILS_STR_PARMS_H
 #define __CUTILS_STR_PARMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -55,6 +56,42 @@ char *str_parms_to_str(struct str_parms *str_parms);
 /* debug */
 void str_parms_dump(struct str_parms *str_parms);
 
+// A parsed "key1=value1;key2=value2" string that points into the string
+// instead of copying it, for callers that can't afford to allocate (e.g. on
+// an audio thread). The string must outlive the view. Keys and values are
+// not NUL-terminated. Parsing follows str_parms_create_str(): empty pairs
+// and pairs with an empty key are skipped, and when a key is repeated the
+// last value wins.
+#define STR_PARMS_VIEW_MAX_PAIRS 16
+
+struct str_parms_view {
+    size_t count;
+    struct {
+        const char *key;
+        size_t key_len;
+        const char *value;
+        size_t value_len;
+    } pairs[STR_PARMS_VIEW_MAX_PAIRS];
+};
+
+// Returns the number of pairs, or -E2BIG if there are more than
+// STR_PARMS_VIEW_MAX_PAIRS; the view then holds the first ones.
+int str_parms_view_parse(struct str_parms_view *view, const char *str);
+
+// As the str_parms_ functions of the same names.
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key);
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *out_val, int len);
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *out_val);
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *out_val);
+
+// Writes the pairs back as a string, each key once, into buf. Returns the
+// length of the whole string like snprintf, so a return value of len or
+// more means it was truncated.
+int str_parms_view_to_str(const struct str_parms_view *view, char *buf, size_t len);
+
 __END_DECLS
 
 #endif /* __CUTILS_STR_PARMS_H */
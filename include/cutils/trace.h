@@ -70,7 +70,8 @@ __BEGIN_DECLS
 #define ATRACE_TAG_PACKAGE_MANAGER  (1<<18)
 #define ATRACE_TAG_SYSTEM_SERVER    (1<<19)
 #define ATRACE_TAG_DATABASE         (1<<20)
-#define ATRACE_TAG_LAST             ATRACE_TAG_DATABASE
+#define ATRACE_TAG_DAEMON           (1<<21) // adbd, logd, init, sdcard, see cutils/daemon_trace.h
+#define ATRACE_TAG_LAST             ATRACE_TAG_DAEMON
 
 // Reserved for initialization.
 #define ATRACE_TAG_NOT_READY        (1ULL<<63)
@@ -97,6 +98,14 @@ void atrace_setup();
  */
 void atrace_update_tags();
 
+/**
+ * Calls atrace_update_tags() if debug.atrace.tags.enableflags has changed
+ * since the last call. The sysprop change callback only reaches binder
+ * services, so daemons call this instead, as often as they like: when
+ * nothing changed it costs a couple of loads.
+ */
+void atrace_update_tags_if_changed();
+
 /**
  * Set whether the process is debuggable.  By default the process is not
  * considered debuggable.  If the process is not debuggable then application-
@@ -131,6 +140,12 @@ extern uint64_t atrace_enabled_tags;
  */
 extern int atrace_marker_fd;
 
+/**
+ * Writes the beginning of a context to the trace buffer, without checking
+ * whether any tag is enabled. Use atrace_begin instead.
+ */
+void atrace_begin_body(const char* name);
+
 /**
  * atrace_init readies the process for tracing by opening the trace_marker file.
  * Calling any trace function causes this to be run, so calling it is optional.
@@ -164,6 +179,10 @@ static inline uint64_t atrace_get_enabled_tags()
 #define ATRACE_ENABLED() atrace_is_tag_enabled(ATRACE_TAG)
 static inline uint64_t atrace_is_tag_enabled(uint64_t tag)
 {
+    // Lets the compiler drop trace calls entirely for ATRACE_TAG_NEVER.
+    if (tag == ATRACE_TAG_NEVER) {
+        return 0;
+    }
     return atrace_get_enabled_tags() & tag;
 }
 
@@ -175,7 +194,6 @@ static inline uint64_t atrace_is_tag_enabled(uint64_t tag)
 static inline void atrace_begin(uint64_t tag, const char* name)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        void atrace_begin_body(const char*);
         atrace_begin_body(name);
     }
 }
@@ -29,6 +29,19 @@ ssize_t uevent_kernel_multicast_recv(int socket, void *buffer, size_t length);
 ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length, uid_t *uid);
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid);
 
+#define UEVENT_RECV_BATCH_MAX 16
+
+/*
+ * Receives up to count (at most UEVENT_RECV_BATCH_MAX) messages with one
+ * recvmmsg() call, message i into the slot_size bytes at buffer + i * slot_size.
+ * Blocks only until the first message arrives. lengths[i] and uids[i] are set
+ * as uevent_kernel_recv() would return and set them; a rejected or truncated
+ * message gets length -1 and a cleared slot. Returns the number of messages
+ * received, or -1 and sets errno.
+ */
+int uevent_kernel_recv_batch(int socket, void *buffer, size_t slot_size, unsigned count,
+                             bool require_group, ssize_t *lengths, uid_t *uids);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,15 @@ void android_closeEventTagMap(EventTagMap* map);
  */
 const char* android_lookupEventTag(const EventTagMap* map, int tag);
 
+/*
+ * Parse the text map fileName and write the precompiled index to
+ * indexName, "<fileName>.idx" being the one android_openEventTagMap
+ * uses. For the build.
+ *
+ * Returns 0 on success.
+ */
+int android_writeEventTagIndex(const char* fileName, const char* indexName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -647,6 +647,18 @@ int __android_log_buf_print(int bufID, int prio, const char *tag, const char *fm
 #endif
     ;
 
+/*
+ * Like __android_log_buf_print, but rather than the text the arguments are
+ * sent, with the format registered once per process, and logd only formats
+ * the entry if and when it is read. %n, positional and wide character
+ * arguments are formatted at once as before; so are fatal entries.
+ */
+int __android_log_deferred_print(int bufID, int prio, const char *tag, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((__format__(printf, 4, 5)))
+#endif
+    ;
+
 #ifdef __cplusplus
 }
 #endif
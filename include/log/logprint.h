@@ -143,6 +143,30 @@ char *android_log_formatLogLine (
     size_t *p_outLength);
 
 
+/**
+ * Growable output for android_log_formatLogLines(), zero it to start.
+ * The caller consumes buf[0..len) and resets len as it sees fit, and
+ * frees buf when done.
+ */
+typedef struct AndroidLogBuffer_t {
+    char *buf;
+    size_t len;
+    size_t size;
+} AndroidLogBuffer;
+
+/**
+ * Formats count entries, as android_log_formatLogLine would each, one
+ * after the other onto the end of out. Does not filter.
+ *
+ * Returns the bytes appended, or -1 on malloc error, in which case out
+ * still holds the entries that made it.
+ */
+ssize_t android_log_formatLogLines(
+    AndroidLogFormat *p_format,
+    AndroidLogBuffer *out,
+    const AndroidLogEntry *entries,
+    size_t count);
+
 /**
  * Either print or do not print log line, based on filter
  *
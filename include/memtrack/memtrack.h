@@ -35,6 +35,15 @@ extern "C" {
  */
 struct memtrack_proc;
 
+/**
+ * struct memtrack_procs
+ *
+ * an opaque handle to the memory stats on a set of processes.
+ * Created with memtrack_procs_new, destroyed by memtrack_procs_destroy.
+ * Can be reused multiple times with memtrack_procs_get.
+ */
+struct memtrack_procs;
+
 /**
  * memtrack_init
  *
@@ -75,6 +84,58 @@ void memtrack_proc_destroy(struct memtrack_proc *p);
  */
 int memtrack_proc_get(struct memtrack_proc *p, pid_t pid);
 
+/**
+ * memtrack_procs_new
+ *
+ * Return a new handle to hold the memory stats of a set of processes.
+ *
+ * Returns NULL on error.
+ */
+struct memtrack_procs *memtrack_procs_new(void);
+
+/**
+ * memtrack_procs_destroy
+ *
+ * Free all memory associated with a set of process memory stats, including
+ * the handles returned by memtrack_procs_at.
+ */
+void memtrack_procs_destroy(struct memtrack_procs *ps);
+
+/**
+ * memtrack_procs_get
+ *
+ * Fill a set of process memory stats with data about the given pids, in that
+ * order, replacing what a previous call left in it.  The records of all the
+ * processes share one buffer that is kept from call to call, so once the set
+ * has grown to its working size, further calls don't allocate any memory.
+ * A type of memory the HAL reports as unsupported is only asked about once
+ * per call.
+ *
+ * Returns 0 on success, -errno on error.  A process the HAL has no data for
+ * is left without records rather than failing the call.
+ */
+int memtrack_procs_get(struct memtrack_procs *ps, const pid_t *pids,
+        size_t num_pids);
+
+/**
+ * memtrack_procs_count
+ *
+ * Return the number of processes filled in by the last memtrack_procs_get.
+ */
+size_t memtrack_procs_count(struct memtrack_procs *ps);
+
+/**
+ * memtrack_procs_at
+ *
+ * Return the stats of the i-th pid passed to the last memtrack_procs_get,
+ * for use with the memtrack_proc_*_total and _pss functions below.  The
+ * handle belongs to the set: it must not be passed to memtrack_proc_get or
+ * memtrack_proc_destroy, and is only valid until the next memtrack_procs_get.
+ *
+ * Returns NULL if i is out of range.
+ */
+struct memtrack_proc *memtrack_procs_at(struct memtrack_procs *ps, size_t i);
+
 /**
  * memtrack_proc_graphics_total
  *
@@ -51,6 +51,15 @@ int RSA_verify(const RSAPublicKey *key,
                const uint8_t* hash,
                const int hash_len);
 
+/* Verifies the signature against each key in turn, as RSA_verify() would.
+ * Returns the index of the first key it verifies with, or -1. */
+int RSA_verify_any(const RSAPublicKey* const* keys,
+                   const int count,
+                   const uint8_t* signature,
+                   const int len,
+                   const uint8_t* hash,
+                   const int hash_len);
+
 #ifdef __cplusplus
 }
 #endif
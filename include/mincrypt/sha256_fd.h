@@ -0,0 +1,65 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Google Inc. nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SYSTEM_CORE_INCLUDE_MINCRYPT_SHA256_FD_H_
+#define SYSTEM_CORE_INCLUDE_MINCRYPT_SHA256_FD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// Hashes length bytes of fd from offset into digest, mapping the file a
+// window at a time and asking for the next one to be read ahead while
+// the current one is hashed. Files that can't be mapped are read.
+// Returns 0, or -1 with errno set.
+int SHA256_hash_fd(int fd, uint64_t offset, uint64_t length, uint8_t* digest);
+
+// Returns the size of the dm-verity hash tree of data_size bytes of data,
+// or 0 if data_size isn't a non-zero multiple of block_size or block_size
+// isn't a power of two of at least 64 bytes.
+uint64_t SHA256_verity_tree_size(uint64_t data_size, uint32_t block_size);
+
+// Builds the dm-verity hash tree of data_size bytes of fd from offset,
+// as veritysetup does for format 1 with the salt prepended to each block:
+// tree, of SHA256_verity_tree_size() bytes, gets the levels from the top
+// one down, and root_digest the hash of the top level. Each level is
+// split across up to threads threads. To check an existing tree, build
+// it again and compare. Returns 0, or -1 with errno set.
+int SHA256_verity_tree(int fd, uint64_t offset, uint64_t data_size,
+                       uint32_t block_size, const uint8_t* salt,
+                       size_t salt_size, int threads, uint8_t* tree,
+                       uint8_t* root_digest);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif  // SYSTEM_CORE_INCLUDE_MINCRYPT_SHA256_FD_H_
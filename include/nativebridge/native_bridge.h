@@ -64,7 +64,9 @@ bool NativeBridgeInitialized();
 // Load a shared library that is supported by the native bridge.
 void* NativeBridgeLoadLibrary(const char* libpath, int flag);
 
-// Get a native bridge trampoline for specified native method.
+// Get a native bridge trampoline for specified native method. The bridge is asked once for each
+// handle, name and shorty; later calls, including ones it answered with null, are served from a
+// cache that lives until the native bridge is unloaded.
 void* NativeBridgeGetTrampoline(void* handle, const char* name, const char* shorty, uint32_t len);
 
 // True if native library is valid and is for an ABI that is supported by native bridge.
@@ -50,6 +50,38 @@ extern int ifc_set_prefixLength(const char *name, int prefixLength);
 extern int ifc_set_hwaddr(const char *name, const void *ptr);
 extern int ifc_clear_addresses(const char *name);
 
+/*
+ * Batches of rtnetlink requests, sent to the kernel in one message.  The
+ * actions are RTM_NEWADDR/RTM_DELADDR and RTM_NEWROUTE/RTM_DELROUTE;
+ * addresses are numeric IPv4 or IPv6 strings.  ifc_batch_commit() returns
+ * zero, or the first negative errno of the batch, and empties it.
+ */
+struct ifc_batch;
+
+extern struct ifc_batch *ifc_batch_new(void);
+extern void ifc_batch_free(struct ifc_batch *batch);
+extern void ifc_batch_link(struct ifc_batch *batch, const char *name, int up);
+extern void ifc_batch_address(struct ifc_batch *batch, int action,
+                              const char *name, const char *address,
+                              int prefixlen);
+extern void ifc_batch_route(struct ifc_batch *batch, int action,
+                            const char *name, const char *dst, int prefixlen,
+                            const char *gateway);
+extern int ifc_batch_commit(struct ifc_batch *batch);
+
+struct ifc_address {
+    int family;
+    int prefixlen;
+    unsigned int flags;     /* IFA_F_* */
+    unsigned int scope;     /* RT_SCOPE_* */
+    char address[INET6_ADDRSTRLEN];
+};
+
+/* Returns the number of addresses on the interface, up to max of which are
+ * filled in, or negative errno. */
+extern int ifc_get_addresses(const char *name, int family,
+                             struct ifc_address *addrs, int max);
+
 extern int ifc_create_default_route(const char *name, in_addr_t addr);
 extern int ifc_remove_default_route(const char *ifname);
 extern int ifc_get_info(const char *name, in_addr_t *addr, int *prefixLength,
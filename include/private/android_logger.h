@@ -19,13 +19,22 @@
 #ifndef _SYSTEM_CORE_INCLUDE_PRIVATE_ANDROID_LOGGER_H_
 #define _SYSTEM_CORE_INCLUDE_PRIVATE_ANDROID_LOGGER_H_
 
+#include <stdarg.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <log/log.h>
 #include <log/log_read.h>
 
 #define LOGGER_MAGIC 'l'
 
+/*
+ * Largest frame=<bytes> a reader may ask of logd. Each packet logd then
+ * sends holds one or more whole entries back to back, each hdr_size + len
+ * bytes long.
+ */
+#define LOGGER_FRAME_MAX (64 * 1024)
+
 /* Header Structure to pstore */
 typedef struct __attribute__((__packed__)) {
     uint8_t magic;
@@ -95,4 +104,70 @@ typedef struct __attribute__((__packed__)) {
     char data[];
 } android_log_event_string_t;
 
+/*
+ * Shared memory ring from one writer process to logd, set up with the
+ * "getLogRing" command when logd.ring is enabled. Writers reserve slots
+ * lock free by advancing tail, fill them in and then publish them by
+ * setting their sequence; logd frees each slot it has read the same way.
+ * When logd sets sleeping it is about to wait on the doorbell eventfd,
+ * and the next writer clears it and rings. All fields are updated with
+ * the __atomic builtins. Messages too long for a slot, and any that find
+ * the ring full, still go to /dev/socket/logdw.
+ */
+#define LOGGER_RING_MAGIC 0x676e6972 /* "ring" */
+#define LOGGER_RING_SLOTS 256        /* power of two */
+#define LOGGER_RING_SLOT_PAYLOAD 492
+
+typedef struct {
+    uint32_t sequence;
+    uint16_t len;
+    android_log_header_t header;
+    char msg[LOGGER_RING_SLOT_PAYLOAD];
+} android_log_ring_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t tail;
+    uint32_t sleeping;
+    android_log_ring_slot_t slots[LOGGER_RING_SLOTS];
+} android_log_ring_t;
+
+/*
+ * Format deferred text logs. When the priority byte has LOGGER_DEFERRED
+ * set, the tag is followed by the uint32_t id of the format and by the
+ * arguments as packed by __android_log_deferred_pack() rather than by the
+ * message. logd formats the entry, with the format registered under that
+ * id by the same uid, only when a reader asks for it. A priority byte of
+ * LOGGER_DEFERRED_REGISTER instead carries the id and the nul terminated
+ * format it stands for, and is not logged itself.
+ */
+#define LOGGER_DEFERRED 0x80
+#define LOGGER_DEFERRED_REGISTER 0xFF
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* id a format is registered under */
+uint32_t __android_log_deferred_id(const char *fmt);
+/*
+ * Pack the arguments fmt consumes from ap into buf. Returns the bytes
+ * used, or -1 if they do not fit or fmt has conversions (%n, positional
+ * or wide arguments) that can not be deferred.
+ */
+ssize_t __android_log_deferred_pack(const char *fmt, va_list ap,
+                                    char *buf, size_t len);
+/*
+ * Format packed args with fmt into buf, always nul terminated and
+ * truncated as snprintf would. Returns the length of the text, or -1 if
+ * args do not match fmt.
+ */
+ssize_t __android_log_deferred_format(const char *fmt,
+                                      const char *args, size_t argsLen,
+                                      char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
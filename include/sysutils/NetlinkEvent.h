@@ -42,11 +42,19 @@ private:
     Action mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    /* Length of each param's name, or 0 if not known */
+    unsigned short mParamNameLen[NL_PARAMS_MAX];
+    /* False when the strings above point into the decoded buffer */
+    bool mOwnsStrings;
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
+    /*
+     * An ASCII (uevent) message is parsed in place: the path, subsystem
+     * and params then point into buffer, which must outlive the event.
+     */
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
     const char *findParam(const char *paramName);
 
@@ -44,6 +44,10 @@ public:
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt) = 0;
+
+private:
+    bool receiveUevents(int socket);
+    void dispatchEvent(char *buffer, ssize_t count);
 };
 
 #endif
@@ -28,9 +28,18 @@ class SocketListener {
     SocketClientCollection  *mClients;
     pthread_mutex_t         mClientsLock;
     int                     mCtrlPipe[2];
+    int                     mEpollFd;
     pthread_t               mThread;
     bool                    mUseCmdNum;
 
+    /* Optional pool that runs onDataAvailable() off the listener thread */
+    int                     mWorkerCount;
+    pthread_t               *mWorkers;
+    SocketClientCollection  mWorkQueue;
+    pthread_mutex_t         mWorkLock;
+    pthread_cond_t          mWorkCond;
+    bool                    mWorkersExiting;
+
 public:
     SocketListener(const char *socketName, bool listen);
     SocketListener(const char *socketName, bool listen, bool useCmdNum);
@@ -39,6 +48,13 @@ public:
     virtual ~SocketListener();
     int startListener();
     int startListener(int backlog);
+    /*
+     * With workerThreads > 0, onDataAvailable() runs on that many worker
+     * threads, so a slow command doesn't hold up other clients. It is
+     * still never called for the same client twice at once, but it may
+     * be for different clients, so subclasses must be thread-safe.
+     */
+    int startListener(int backlog, int workerThreads);
     int stopListener();
 
     void sendBroadcast(int code, const char *msg, bool addErrno);
@@ -54,6 +70,11 @@ private:
     bool release(SocketClient *c, bool wakeup);
     static void *threadStart(void *obj);
     void runListener();
+    bool watchClient(SocketClient *c, int op);
+    void dispatch(SocketClient *c);
+    static void *workerStart(void *obj);
+    void runWorker();
+    void stopWorkers();
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
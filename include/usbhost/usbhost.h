@@ -237,6 +237,47 @@ struct usb_request *usb_request_wait(struct usb_device *dev);
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* A stream keeps num_requests bulk or interrupt transfers of buffer_length
+ * bytes in flight on an endpoint, from a ring of buffers it owns.
+ *
+ * The callback is called with each buffer the stream has free: for an IN
+ * endpoint once it has been filled, with actual_length bytes, and for an OUT
+ * endpoint once it can be filled, at the start and after it went out.  It sets
+ * buffer_length to the bytes to send (up to the buffer's length) on OUT
+ * endpoints.  status is 0, or the negative errno of a failed transfer.  The
+ * callback returns 0 to queue the request again, non-zero to retire it;
+ * the stream is over once no request is in flight.
+ */
+struct usb_stream;
+typedef int (* usb_stream_cb)(struct usb_request *req, int status, void *client_data);
+
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc,
+        int num_requests, int buffer_length,
+        usb_stream_cb cb, void *client_data);
+
+/* Queues the requests of the stream.  Returns 0, or -1 if none went out. */
+int usb_stream_start(struct usb_stream *stream);
+
+/* Returns the fd to poll (or epoll) for POLLOUT, which means that transfers
+ * have completed, after which usb_stream_process() handles them.  It is the
+ * device's fd, so it serves all the streams of the device.
+ */
+int usb_stream_get_fd(struct usb_stream *stream);
+
+/* Handles the transfers of the device that have completed, without blocking,
+ * calling the callbacks of their streams.  Requests of the device's own are
+ * kept for usb_request_wait().  Returns how many requests of the stream are
+ * still in flight, or -1 for error.
+ */
+int usb_stream_process(struct usb_stream *stream);
+
+/* Runs the stream until no request is in flight.  Returns 0, or -1 for error. */
+int usb_stream_run(struct usb_stream *stream);
+
+/* Cancels what the stream has in flight and releases it. */
+void usb_stream_free(struct usb_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
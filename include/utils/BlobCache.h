@@ -22,6 +22,7 @@
 #include <utils/Flattenable.h>
 #include <utils/RefBase.h>
 #include <utils/SortedVector.h>
+#include <utils/Vector.h>
 #include <utils/threads.h>
 
 namespace android {
@@ -87,7 +88,9 @@ public:
     // flatten serializes the current contents of the cache into the memory
     // pointed to by 'buffer'.  The serialized cache contents can later be
     // loaded into a BlobCache object using the unflatten method.  The contents
-    // of the BlobCache object will not be modified.
+    // of the BlobCache object will not be modified.  Entries are written from
+    // the least to the most recently used, so unflattening them restores the
+    // order in which they will be evicted.
     //
     // Preconditions:
     //   size >= this.getFlattenedSize()
@@ -106,13 +109,14 @@ private:
     BlobCache(const BlobCache&);
     void operator=(const BlobCache&);
 
-    // A random function helper to get around MinGW not having nrand48()
-    long int blob_random();
-
-    // clean evicts a randomly chosen set of entries from the cache such that
+    // clean evicts the least recently used entries from the cache such that
     // the total size of all remaining entries is less than mMaxTotalSize/2.
     void clean();
 
+    // getIndicesByLastUse fills 'indices' with the indices of all cache
+    // entries, ordered from the least to the most recently used.
+    void getIndicesByLastUse(Vector<size_t>* indices) const;
+
     // isCleanable returns true if the cache is full enough for the clean method
     // to have some effect, and false otherwise.
     bool isCleanable() const;
@@ -159,6 +163,9 @@ private:
 
         void setValue(const sp<Blob>& value);
 
+        uint64_t getLastUse() const;
+        void setLastUse(uint64_t lastUse);
+
     private:
 
         // mKey is the key that identifies the cache entry.
@@ -166,6 +173,10 @@ private:
 
         // mValue is the cached data associated with the key.
         sp<Blob> mValue;
+
+        // mLastUse is the value of BlobCache::mUseCount when the entry was
+        // last set or retrieved.
+        uint64_t mLastUse;
     };
 
     // A Header is the header for the entire BlobCache serialization format. No
@@ -235,9 +246,9 @@ private:
     // the cache.
     size_t mTotalSize;
 
-    // mRandState is the pseudo-random number generator state. It is passed to
-    // nrand48 to generate random numbers when needed.
-    unsigned short mRandState[3];
+    // mUseCount is incremented every time an entry is set or retrieved, and
+    // orders the entries from the least to the most recently used.
+    uint64_t mUseCount;
 
     // mCacheEntries stores all the cache entries that are resident in memory.
     // Cache entries are added to it by the 'set' method.
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_FIXED_LRU_CACHE_H
+#define ANDROID_UTILS_FIXED_LRU_CACHE_H
+
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <utils/LruCache.h>
+#include <utils/TypeHelpers.h>
+
+namespace android {
+
+/**
+ * An LruCache whose capacity is fixed when it is created.
+ *
+ * All storage is allocated up front: the entries themselves, the LRU list
+ * (which links entries by index) and an open-addressed index of the keys'
+ * hashes. put(), get() and remove() never allocate, and a hit only touches
+ * the index slot, the entry and its links.
+ *
+ * When the cache is full, put() evicts the least recently used entry.
+ */
+template <typename TKey, typename TValue>
+class FixedLruCache {
+public:
+    explicit FixedLruCache(uint32_t capacity);
+    ~FixedLruCache();
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    const TValue& get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    bool removeOldest();
+    void clear();
+    const TValue& peekOldestValue();
+
+    /* Walks the entries from the oldest to the youngest. */
+    class Iterator {
+    public:
+        Iterator(const FixedLruCache<TKey, TValue>& cache): mCache(cache), mIndex(kNone) {
+        }
+
+        bool next() {
+            mIndex = (mIndex == kNone) ? mCache.mOldest : mCache.mLinks[mIndex].younger;
+            return mIndex != kNone;
+        }
+
+        size_t index() const {
+            return mIndex;
+        }
+
+        const TValue& value() const {
+            return mCache.mEntries[mIndex].value;
+        }
+
+        const TKey& key() const {
+            return mCache.mEntries[mIndex].key;
+        }
+    private:
+        const FixedLruCache<TKey, TValue>& mCache;
+        uint32_t mIndex;
+    };
+
+private:
+    FixedLruCache(const FixedLruCache& that);  // disallow copy constructor
+    FixedLruCache& operator=(const FixedLruCache& that);
+
+    static const uint32_t kNone = 0xffffffff;
+
+    struct Entry {
+        TKey key;
+        TValue value;
+
+        Entry(const TKey& key_, const TValue& value_) : key(key_), value(value_) {
+        }
+    };
+
+    // Kept apart from the entries so that reordering the list doesn't pull
+    // keys and values into the cache. Free entries are chained through
+    // 'younger'.
+    struct Link {
+        uint32_t older;
+        uint32_t younger;
+    };
+
+    // The hash is kept next to the entry index so that probing past other
+    // keys doesn't have to touch their entries.
+    struct Slot {
+        hash_t hash;
+        uint32_t index;
+    };
+
+    ssize_t findSlot(const TKey& key, hash_t hash) const;
+    void removeSlot(uint32_t slot);
+    void removeEntryAt(uint32_t slot);
+    void attachToCache(uint32_t index);
+    void detachFromCache(uint32_t index);
+
+    Entry* mEntries;
+    Link* mLinks;
+    Slot* mSlots;
+    uint32_t mCapacity;
+    uint32_t mSlotMask;
+    uint32_t mSize;
+    uint32_t mFree;
+    uint32_t mOldest;
+    uint32_t mYoungest;
+    OnEntryRemoved<TKey, TValue>* mListener;
+    TValue mNullValue;
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::FixedLruCache(uint32_t capacity)
+    : mCapacity(capacity ? capacity : 1)
+    , mSize(0)
+    , mFree(0)
+    , mOldest(kNone)
+    , mYoungest(kNone)
+    , mListener(NULL)
+    , mNullValue(NULL) {
+    // Keep the index at most half full so that probe sequences stay short.
+    uint32_t slots = 2;
+    while (slots < mCapacity * 2) {
+        slots <<= 1;
+    }
+    mSlotMask = slots - 1;
+
+    mEntries = static_cast<Entry*>(malloc(sizeof(Entry) * mCapacity));
+    mLinks = static_cast<Link*>(malloc(sizeof(Link) * mCapacity));
+    mSlots = static_cast<Slot*>(malloc(sizeof(Slot) * slots));
+    for (uint32_t i = 0; i < mCapacity; i++) {
+        mLinks[i].older = kNone;
+        mLinks[i].younger = (i + 1 < mCapacity) ? i + 1 : kNone;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        mSlots[i].index = kNone;
+    }
+}
+
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::~FixedLruCache() {
+    for (uint32_t i = mOldest; i != kNone; i = mLinks[i].younger) {
+        mEntries[i].~Entry();
+    }
+    free(mSlots);
+    free(mLinks);
+    free(mEntries);
+}
+
+template<typename K, typename V>
+void FixedLruCache<K, V>::setOnEntryRemovedListener(OnEntryRemoved<K, V>* listener) {
+    mListener = listener;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::get(const TKey& key) {
+    ssize_t slot = findSlot(key, hash_type(key));
+    if (slot < 0) {
+        return mNullValue;
+    }
+    uint32_t index = mSlots[slot].index;
+    if (index != mYoungest) {
+        detachFromCache(index);
+        attachToCache(index);
+    }
+    return mEntries[index].value;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    hash_t hash = hash_type(key);
+    if (findSlot(key, hash) >= 0) {
+        return false;
+    }
+    if (mSize >= mCapacity) {
+        removeOldest();
+    }
+
+    uint32_t index = mFree;
+    mFree = mLinks[index].younger;
+    new (&mEntries[index]) Entry(key, value);
+    attachToCache(index);
+
+    uint32_t slot = hash & mSlotMask;
+    while (mSlots[slot].index != kNone) {
+        slot = (slot + 1) & mSlotMask;
+    }
+    mSlots[slot].hash = hash;
+    mSlots[slot].index = index;
+    mSize++;
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::remove(const TKey& key) {
+    ssize_t slot = findSlot(key, hash_type(key));
+    if (slot < 0) {
+        return false;
+    }
+    removeEntryAt(slot);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::removeOldest() {
+    if (mOldest != kNone) {
+        return remove(mEntries[mOldest].key);
+    }
+    return false;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::peekOldestValue() {
+    if (mOldest != kNone) {
+        return mEntries[mOldest].value;
+    }
+    return mNullValue;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::clear() {
+    for (uint32_t i = mOldest; i != kNone; ) {
+        uint32_t younger = mLinks[i].younger;
+        if (mListener) {
+            (*mListener)(mEntries[i].key, mEntries[i].value);
+        }
+        mEntries[i].~Entry();
+        mLinks[i].younger = mFree;
+        mFree = i;
+        i = younger;
+    }
+    for (uint32_t i = 0; i <= mSlotMask; i++) {
+        mSlots[i].index = kNone;
+    }
+    mOldest = kNone;
+    mYoungest = kNone;
+    mSize = 0;
+}
+
+template <typename TKey, typename TValue>
+ssize_t FixedLruCache<TKey, TValue>::findSlot(const TKey& key, hash_t hash) const {
+    uint32_t slot = hash & mSlotMask;
+    while (mSlots[slot].index != kNone) {
+        if (mSlots[slot].hash == hash && mEntries[mSlots[slot].index].key == key) {
+            return slot;
+        }
+        slot = (slot + 1) & mSlotMask;
+    }
+    return -1;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::removeSlot(uint32_t slot) {
+    // Backward-shift deletion: pull later members of the probe sequence
+    // into the hole so that lookups never need tombstones.
+    for (;;) {
+        mSlots[slot].index = kNone;
+        uint32_t next = slot;
+        for (;;) {
+            next = (next + 1) & mSlotMask;
+            if (mSlots[next].index == kNone) {
+                return;
+            }
+            uint32_t home = mSlots[next].hash & mSlotMask;
+            // leave it if its home is cyclically within (slot, next]
+            bool inRange = (slot <= next) ? (slot < home && home <= next)
+                                          : (slot < home || home <= next);
+            if (!inRange) {
+                break;
+            }
+        }
+        mSlots[slot] = mSlots[next];
+        slot = next;
+    }
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::removeEntryAt(uint32_t slot) {
+    uint32_t index = mSlots[slot].index;
+    Entry& entry = mEntries[index];
+    if (mListener) {
+        (*mListener)(entry.key, entry.value);
+    }
+    removeSlot(slot);
+    detachFromCache(index);
+    entry.~Entry();
+    mLinks[index].younger = mFree;
+    mFree = index;
+    mSize--;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::attachToCache(uint32_t index) {
+    mLinks[index].older = mYoungest;
+    mLinks[index].younger = kNone;
+    if (mYoungest == kNone) {
+        mOldest = index;
+    } else {
+        mLinks[mYoungest].younger = index;
+    }
+    mYoungest = index;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::detachFromCache(uint32_t index) {
+    Link& link = mLinks[index];
+    if (link.older != kNone) {
+        mLinks[link.older].younger = link.younger;
+    } else {
+        mOldest = link.younger;
+    }
+    if (link.younger != kNone) {
+        mLinks[link.younger].older = link.older;
+    } else {
+        mYoungest = link.older;
+    }
+    link.older = kNone;
+    link.younger = kNone;
+}
+
+}
+
+#endif // ANDROID_UTILS_FIXED_LRU_CACHE_H
@@ -71,6 +71,14 @@ public:
             ssize_t         indexOfKey(const KEY& key) const;
             const VALUE&    operator[] (size_t index) const;
 
+            /*!
+             * finds a key with another type that compares with it, such as
+             * a const char* for a String8 key, without building a KEY for
+             * the lookup. It needs a compare_type(const KEY&, const K&).
+             */
+            template<typename K>
+            ssize_t         indexOfEquivalentKey(const K& key) const;
+
     /*!
      * modifying the array
      */
@@ -86,6 +94,14 @@ public:
             ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
             ssize_t         replaceValueAt(size_t index, const VALUE& item);
 
+            /*!
+             * adds many items at once, sorting and merging them in rather
+             * than adding them one by one. Where keys are equal, the later
+             * item wins, as with successive add()s.
+             */
+            ssize_t         merge(const Vector< key_value_pair_t<KEY, VALUE> >& items);
+            ssize_t         merge(const KeyedVector& other);
+
     /*!
      * remove items
      */
@@ -138,6 +154,25 @@ ssize_t KeyedVector<KEY,VALUE>::indexOfKey(const KEY& key) const {
     return mVector.indexOf( key_value_pair_t<KEY,VALUE>(key) );
 }
 
+template<typename KEY, typename VALUE> template<typename K> inline
+ssize_t KeyedVector<KEY,VALUE>::indexOfEquivalentKey(const K& key) const {
+    const key_value_pair_t<KEY,VALUE>* items = mVector.array();
+    ssize_t l = 0;
+    ssize_t h = size() - 1;
+    while (l <= h) {
+        const ssize_t mid = l + (h - l)/2;
+        const int c = compare_type(items[mid].key, key);
+        if (c == 0) {
+            return mid;
+        } else if (c < 0) {
+            l = mid + 1;
+        } else {
+            h = mid - 1;
+        }
+    }
+    return NAME_NOT_FOUND;
+}
+
 template<typename KEY, typename VALUE> inline
 const VALUE& KeyedVector<KEY,VALUE>::valueFor(const KEY& key) const {
     ssize_t i = this->indexOfKey(key);
@@ -193,6 +228,16 @@ ssize_t KeyedVector<KEY,VALUE>::replaceValueAt(size_t index, const VALUE& item)
     return BAD_INDEX;
 }
 
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::merge(const Vector< key_value_pair_t<KEY,VALUE> >& items) {
+    return mVector.merge(items);
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::merge(const KeyedVector<KEY,VALUE>& other) {
+    return mVector.merge(other.mVector);
+}
+
 template<typename KEY, typename VALUE> inline
 ssize_t KeyedVector<KEY,VALUE>::removeItem(const KEY& key) {
     return mVector.remove(key_value_pair_t<KEY,VALUE>(key));
@@ -425,7 +425,7 @@ private:
         sp<LooperCallback> callback;
         void* data;
 
-        void initEventItem(struct epoll_event* eventItem) const;
+        void initEventItem(struct epoll_event* eventItem, size_t slot) const;
     };
 
     struct Response {
@@ -434,13 +434,20 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
 
-        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler> handler,
-                const Message& message) : uptime(uptime), handler(handler), message(message) {
+        MessageEnvelope(nsecs_t uptime, uint64_t seq, const sp<MessageHandler> handler,
+                const Message& message) : uptime(uptime), seq(seq), handler(handler),
+                message(message) {
+        }
+
+        // Messages due at the same time are delivered in the order they were sent.
+        inline bool operator<(const MessageEnvelope& other) const {
+            return uptime < other.uptime || (uptime == other.uptime && seq < other.seq);
         }
 
         nsecs_t uptime;
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
@@ -450,7 +457,10 @@ private:
     int mWakeEventFd;  // immutable
     Mutex mLock;
 
+    // Binary heap ordered by MessageEnvelope::operator<, so the next message due is
+    // always at index 0.
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -460,13 +470,22 @@ private:
     int mEpollFd; // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked list of file descriptor monitoring requests.
-    KeyedVector<int, Request> mRequests;  // guarded by mLock
+    // Maximum number of file descriptors for which to retrieve poll events each iteration.
+    static const int EPOLL_MAX_EVENTS = 16;
+
+    // Locked table of file descriptor monitoring requests.  Each epoll item carries the
+    // slot of its request and the request's sequence number, so an event finds its
+    // request without a lookup, and one left over from a replaced or removed request
+    // is recognized.  Unused slots have fd -1 and are kept in mFreeRequestSlots.
+    Vector<Request> mRequests;  // guarded by mLock
+    KeyedVector<int, size_t> mRequestSlotsByFd;  // guarded by mLock
+    Vector<size_t> mFreeRequestSlots;  // guarded by mLock
     int mNextRequestSeq;
 
     // This state is only used privately by pollOnce and does not require a lock since
-    // it runs on a single thread.
-    Vector<Response> mResponses;
+    // it runs on a single thread.  Each poll yields at most one response per event.
+    Response mResponses[EPOLL_MAX_EVENTS];
+    size_t mResponseCount;
     size_t mResponseIndex;
     nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
 
@@ -476,6 +495,10 @@ private:
     void pushResponse(int events, const Request& request);
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
+    size_t enqueueMessageEnvelopeLocked(const MessageEnvelope& messageEnvelope);
+    void dequeueMessageEnvelopeLocked();
+    void siftDownMessageEnvelopeLocked(size_t index);
+    void heapifyMessageEnvelopesLocked();
 
     static void initTLSKey();
     static void threadDestructor(void *st);
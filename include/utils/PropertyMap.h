@@ -21,6 +21,8 @@
 #include <utils/String8.h>
 #include <utils/Errors.h>
 #include <utils/Tokenizer.h>
+#include <utils/TypeHelpers.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -44,6 +46,11 @@ namespace android {
  * The file must not contain duplicate keys.
  *
  * TODO Support escape sequences and quoted values when needed.
+ *
+ * Properties are found through a hash index. Keys and values are not stored
+ * as individual strings: a loaded map keeps one copy of its file and points
+ * into it, and added properties are kept in the same way. Copying a map
+ * shares that text rather than duplicating it.
  */
 class PropertyMap {
 public:
@@ -74,8 +81,11 @@ public:
     /* Adds all values from the specified property map. */
     void addAll(const PropertyMap* map);
 
-    /* Gets the underlying property map. */
-    inline const KeyedVector<String8, String8>& getProperties() const { return mProperties; }
+    /* Gets the properties as a sorted map of strings.
+     * This builds the map on first use after a change, so it is meant for dumping rather
+     * than for lookups, and must not be called concurrently on the same property map.
+     */
+    const KeyedVector<String8, String8>& getProperties() const;
 
     /* Loads a property map from a file. */
     static status_t load(const String8& filename, PropertyMap** outMap);
@@ -98,7 +108,28 @@ private:
         status_t parseCharacterLiteral(char16_t* outCharacter);
     };
 
-    KeyedVector<String8, String8> mProperties;
+    struct Entry {
+        const char* key;
+        const char* value;
+        uint32_t keyLength;
+        uint32_t valueLength;
+        hash_t hash;
+    };
+
+    ssize_t indexOf(const char* key, size_t keyLength, hash_t hash) const;
+    void put(const char* key, size_t keyLength, const char* value, size_t valueLength);
+    void rebuildIndex(size_t capacity);
+    void rebase(const char* oldBase, size_t length, const String8& text);
+
+    // Entries in the order they were added. Their keys and values point into mText.
+    Vector<Entry> mEntries;
+    // Open-addressed table of indices into mEntries, at most half full; -1 is free.
+    Vector<int32_t> mIndex;
+    // Text the entries point into: loaded files and copies of added properties.
+    Vector<String8> mText;
+
+    mutable KeyedVector<String8, String8> mProperties;
+    mutable bool mPropertiesValid;
 };
 
 } // namespace android
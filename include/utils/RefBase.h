@@ -223,10 +223,12 @@ public:
 
     wp(T* other);
     wp(const wp<T>& other);
+    wp(wp<T>&& other);
     wp(const sp<T>& other);
     template<typename U> wp(U* other);
     template<typename U> wp(const sp<U>& other);
     template<typename U> wp(const wp<U>& other);
+    template<typename U> wp(wp<U>&& other);
 
     ~wp();
     
@@ -234,10 +236,12 @@ public:
 
     wp& operator = (T* other);
     wp& operator = (const wp<T>& other);
+    wp& operator = (wp<T>&& other);
     wp& operator = (const sp<T>& other);
     
     template<typename U> wp& operator = (U* other);
     template<typename U> wp& operator = (const wp<U>& other);
+    template<typename U> wp& operator = (wp<U>&& other);
     template<typename U> wp& operator = (const sp<U>& other);
     
     void set_object_and_refs(T* other, weakref_type* refs);
@@ -325,6 +329,15 @@ wp<T>::wp(const wp<T>& other)
     if (m_ptr) m_refs->incWeak(this);
 }
 
+// Like sp<>, moving a wp<> hands its weak reference over without touching the
+// weak count.
+template<typename T>
+wp<T>::wp(wp<T>&& other)
+    : m_ptr(other.m_ptr), m_refs(other.m_refs)
+{
+    other.m_ptr = 0;
+}
+
 template<typename T>
 wp<T>::wp(const sp<T>& other)
     : m_ptr(other.m_ptr)
@@ -351,6 +364,13 @@ wp<T>::wp(const wp<U>& other)
     }
 }
 
+template<typename T> template<typename U>
+wp<T>::wp(wp<U>&& other)
+    : m_ptr(other.m_ptr), m_refs(other.m_refs)
+{
+    other.m_ptr = 0;
+}
+
 template<typename T> template<typename U>
 wp<T>::wp(const sp<U>& other)
     : m_ptr(other.m_ptr)
@@ -389,6 +409,18 @@ wp<T>& wp<T>::operator = (const wp<T>& other)
     return *this;
 }
 
+template<typename T>
+wp<T>& wp<T>::operator = (wp<T>&& other)
+{
+    weakref_type* oldRefs(m_refs);
+    T* oldPtr(m_ptr);
+    m_ptr = other.m_ptr;
+    m_refs = other.m_refs;
+    other.m_ptr = 0;
+    if (oldPtr) oldRefs->decWeak(this);
+    return *this;
+}
+
 template<typename T>
 wp<T>& wp<T>::operator = (const sp<T>& other)
 {
@@ -424,6 +456,18 @@ wp<T>& wp<T>::operator = (const wp<U>& other)
     return *this;
 }
 
+template<typename T> template<typename U>
+wp<T>& wp<T>::operator = (wp<U>&& other)
+{
+    weakref_type* oldRefs(m_refs);
+    T* oldPtr(m_ptr);
+    m_ptr = other.m_ptr;
+    m_refs = other.m_refs;
+    other.m_ptr = 0;
+    if (oldPtr) oldRefs->decWeak(this);
+    return *this;
+}
+
 template<typename T> template<typename U>
 wp<T>& wp<T>::operator = (const sp<U>& other)
 {
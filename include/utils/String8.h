@@ -48,6 +48,7 @@ public:
                                 String8();
     explicit                    String8(StaticLinkage);
                                 String8(const String8& o);
+                                String8(String8&& o);
     explicit                    String8(const char* o);
     explicit                    String8(const char* o, size_t numChars);
     
@@ -96,6 +97,7 @@ public:
             void                getUtf32(char32_t* dst) const;
 
     inline  String8&            operator=(const String8& other);
+            String8&            operator=(String8&& other);
     inline  String8&            operator=(const char* other);
     
     inline  String8&            operator+=(const String8& other);
@@ -249,6 +251,11 @@ inline int compare_type(const String8& lhs, const String8& rhs)
     return lhs.compare(rhs);
 }
 
+inline int compare_type(const String8& lhs, const char* rhs)
+{
+    return strcmp(lhs.string(), rhs);
+}
+
 inline int strictly_order_type(const String8& lhs, const String8& rhs)
 {
     return compare_type(lhs, rhs) < 0;
@@ -62,8 +62,10 @@ public:
 
     sp(T* other);
     sp(const sp<T>& other);
+    sp(sp<T>&& other);
     template<typename U> sp(U* other);
     template<typename U> sp(const sp<U>& other);
+    template<typename U> sp(sp<U>&& other);
 
     ~sp();
 
@@ -71,8 +73,10 @@ public:
 
     sp& operator = (T* other);
     sp& operator = (const sp<T>& other);
+    sp& operator = (sp<T>&& other);
 
     template<typename U> sp& operator = (const sp<U>& other);
+    template<typename U> sp& operator = (sp<U>&& other);
     template<typename U> sp& operator = (U* other);
 
     //! Special optimization for use by ProcessState (and nobody else).
@@ -109,6 +113,10 @@ private:
 // ---------------------------------------------------------------------------
 // No user serviceable parts below here.
 
+// Moving an sp<> hands its reference over without touching the reference count.
+// With DEBUG_REFS tracking the reference stays recorded under the id of the sp<>
+// it was moved from.
+
 template<typename T>
 sp<T>::sp(T* other)
         : m_ptr(other) {
@@ -123,6 +131,12 @@ sp<T>::sp(const sp<T>& other)
         m_ptr->incStrong(this);
 }
 
+template<typename T>
+sp<T>::sp(sp<T>&& other)
+        : m_ptr(other.m_ptr) {
+    other.m_ptr = 0;
+}
+
 template<typename T> template<typename U>
 sp<T>::sp(U* other)
         : m_ptr(other) {
@@ -137,6 +151,12 @@ sp<T>::sp(const sp<U>& other)
         m_ptr->incStrong(this);
 }
 
+template<typename T> template<typename U>
+sp<T>::sp(sp<U>&& other)
+        : m_ptr(other.m_ptr) {
+    other.m_ptr = 0;
+}
+
 template<typename T>
 sp<T>::~sp() {
     if (m_ptr)
@@ -154,6 +174,16 @@ sp<T>& sp<T>::operator =(const sp<T>& other) {
     return *this;
 }
 
+template<typename T>
+sp<T>& sp<T>::operator =(sp<T>&& other) {
+    T* oldPtr(m_ptr);
+    m_ptr = other.m_ptr;
+    other.m_ptr = 0;
+    if (oldPtr)
+        oldPtr->decStrong(this);
+    return *this;
+}
+
 template<typename T>
 sp<T>& sp<T>::operator =(T* other) {
     if (other)
@@ -175,6 +205,16 @@ sp<T>& sp<T>::operator =(const sp<U>& other) {
     return *this;
 }
 
+template<typename T> template<typename U>
+sp<T>& sp<T>::operator =(sp<U>&& other) {
+    T* oldPtr(m_ptr);
+    m_ptr = other.m_ptr;
+    other.m_ptr = 0;
+    if (oldPtr)
+        oldPtr->decStrong(this);
+    return *this;
+}
+
 template<typename T> template<typename U>
 sp<T>& sp<T>::operator =(U* other) {
     if (other)
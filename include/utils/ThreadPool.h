@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBS_UTILS_THREAD_POOL_H
+#define _LIBS_UTILS_THREAD_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/ThreadDefs.h>
+#include <utils/Vector.h>
+
+// ---------------------------------------------------------------------------
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * A fixed set of worker threads that run posted tasks.
+ *
+ * Each worker has its own queue. Tasks posted from outside the pool are
+ * spread over the queues; tasks posted by a running task go to the queue of
+ * the worker running it. A worker takes the task it queued last, and when
+ * its queue is empty it steals the oldest task from another worker.
+ *
+ * All workers run at the priority given to the constructor, which also
+ * moves them to the matching scheduling group (see androidSetThreadPriority).
+ */
+class ThreadPool : public RefBase
+{
+public:
+    /*
+     * A unit of work. Implement run(); the Task itself serves as the future:
+     * any result it stores is safe to read once wait() has returned.
+     */
+    class Task : public RefBase {
+    public:
+                        Task();
+
+        // Block until run() has returned. A task waiting for another task
+        // should use ThreadPool::wait() instead.
+                void    wait();
+
+        // Returns true once run() has returned.
+                bool    isDone() const;
+
+    protected:
+        virtual         ~Task();
+        virtual void    run() = 0;
+
+    private:
+        friend class ThreadPool;
+                void    execute();
+                bool    waitRelative(nsecs_t timeout);
+
+        mutable Mutex   mLock;
+        Condition       mDoneCondition;
+        bool            mDone;
+    };
+
+                        ThreadPool(const char* name, size_t threadCount,
+                                int32_t priority = PRIORITY_DEFAULT);
+
+    // Start the worker threads.
+            status_t    start();
+
+    // Queue a task. Returns INVALID_OPERATION if the pool is not running.
+            status_t    post(const sp<Task>& task);
+
+    // Wait until the task has run. When called from one of this pool's
+    // tasks, the worker runs other queued tasks in the meantime rather than
+    // blocking, so that tasks can wait for the tasks they posted.
+            void        wait(const sp<Task>& task);
+
+    // Run all tasks queued so far, then stop the worker threads. Must not be
+    // called from a task. Called by the destructor if needed.
+            void        shutdown();
+
+protected:
+    virtual             ~ThreadPool();
+
+private:
+    class Worker : public Thread {
+    public:
+                        Worker(ThreadPool* pool, size_t index);
+
+        // Set in readyToRun(), so that post() can recognize its own workers.
+        // Guarded by the pool's mLock.
+        thread_id_t     mThreadId;
+
+    private:
+        virtual status_t readyToRun();
+        virtual bool    threadLoop();
+
+        ThreadPool*     mPool;
+        size_t          mIndex;
+    };
+
+    struct Queue {
+        Mutex           lock;
+        Vector<sp<Task> > tasks;
+    };
+
+            ssize_t     currentWorkerIndex() const;
+            sp<Task>    takeTask(size_t index);
+            bool        runOneTask(size_t index);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    const String8       mName;
+    const size_t        mThreadCount;
+    const int32_t       mPriority;
+    Queue*              mQueues;
+    Vector<sp<Worker> > mWorkers;
+
+    // mLock guards the fields below and is only taken to park a worker or
+    // to wake one up; queues have their own locks.
+    Mutex               mLock;
+    Condition           mWorkAvailable;
+    size_t              mPendingTasks;
+    size_t              mNextQueue;
+    bool                mRunning;
+    bool                mExiting;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+// ---------------------------------------------------------------------------
+
+#endif // _LIBS_UTILS_THREAD_POOL_H
@@ -103,6 +103,20 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Like nextToken() but does not copy: returns a pointer to the token within
+     * the tokenizer's contents and sets outLength to its length. The token is
+     * not null-terminated and stays valid for the lifetime of the tokenizer.
+     */
+    const char* nextTokenView(const char* delimiters, size_t* outLength);
+
+    /**
+     * Gets the contents being tokenized and their length, for relating the
+     * tokens returned by nextTokenView() to the whole.
+     */
+    inline const char* getContents() const { return mBuffer; }
+    inline size_t getLength() const { return mLength; }
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
@@ -44,17 +44,25 @@ namespace android {
 
 class ScopedTrace {
 public:
+// The tag is only checked once, so that the end of the scope is always
+// traced if and only if its beginning was, even if tracing is toggled in
+// between.
 inline ScopedTrace(uint64_t tag, const char* name)
-    : mTag(tag) {
-    atrace_begin(mTag,name);
+    : mEnabled(atrace_is_tag_enabled(tag) != 0) {
+    if (CC_UNLIKELY(mEnabled)) {
+        atrace_begin_body(name);
+    }
 }
 
 inline ~ScopedTrace() {
-    atrace_end(mTag);
+    if (CC_UNLIKELY(mEnabled)) {
+        char c = 'E';
+        write(atrace_marker_fd, &c, 1);
+    }
 }
 
 private:
-    uint64_t mTag;
+    bool mEnabled;
 };
 
 }; // namespace android
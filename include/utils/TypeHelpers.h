@@ -30,10 +30,19 @@ namespace android {
  * Types traits
  */
 
-template <typename T> struct trait_trivial_ctor { enum { value = false }; };
-template <typename T> struct trait_trivial_dtor { enum { value = false }; };
-template <typename T> struct trait_trivial_copy { enum { value = false }; };
-template <typename T> struct trait_trivial_move { enum { value = false }; };
+/*
+ * By default, ask the compiler. This covers enums and plain structs without
+ * having to list them here; types with non-trivial special members (or that
+ * must be moved with care, like sp<>) still need an explicit specialization
+ * to be treated as trivially movable. A type that can be copied with memcpy
+ * and needs no destructor can always be relocated with memcpy as well.
+ */
+template <typename T> struct trait_trivial_ctor { enum { value = __has_trivial_constructor(T) }; };
+template <typename T> struct trait_trivial_dtor { enum { value = __has_trivial_destructor(T) }; };
+template <typename T> struct trait_trivial_copy { enum { value = __has_trivial_copy(T) }; };
+template <typename T> struct trait_trivial_move {
+    enum { value = __has_trivial_copy(T) && __has_trivial_destructor(T) };
+};
 template <typename T> struct trait_pointer      { enum { value = false }; };    
 template <typename T> struct trait_pointer<T*>  { enum { value = true }; };
 
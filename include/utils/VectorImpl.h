@@ -44,6 +44,7 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
@@ -105,11 +106,25 @@ protected:
     virtual void            do_splat(void* dest, const void* item, size_t num) const = 0;
     virtual void            do_move_forward(void* dest, const void* from, size_t num) const = 0;
     virtual void            do_move_backward(void* dest, const void* from, size_t num) const = 0;
+
+            // stable sort of count items starting at from
+            status_t        sortItems(size_t from, size_t count, compar_r_t cmp, void* state);
+            // keeps only the last of equal items in the sorted items starting
+            // at from, returns the new size
+            ssize_t         uniqueItems(size_t from, compar_r_t cmp, void* state);
+            // merges the sorted items starting at split into the sorted items
+            // before it, each without duplicates; the later item replaces an
+            // equal one
+            status_t        mergeItems(size_t split, compar_r_t cmp, void* state);
     
 private:
         void* _grow(size_t where, size_t amount);
         void  _shrink(size_t where, size_t amount);
 
+        inline bool _can_relocate() const;
+        inline void _do_relocate(void* dest, const void* from, size_t num) const;
+        inline void _release_relocated_storage();
+
         inline void _do_construct(void* storage, size_t num) const;
         inline void _do_destroy(void* storage, size_t num) const;
         inline void _do_copy(void* dest, const void* from, size_t num) const;
@@ -117,6 +132,11 @@ private:
         inline void _do_move_forward(void* dest, const void* from, size_t num) const;
         inline void _do_move_backward(void* dest, const void* from, size_t num) const;
 
+        void _merge_sort(uint8_t* array, size_t count, compar_r_t cmp, void* state,
+                uint8_t* scratch) const;
+        void _insertion_sort(uint8_t* array, size_t count, compar_r_t cmp, void* state,
+                uint8_t* temp) const;
+
             // These 2 fields are exposed in the inlines below,
             // so they're set in stone.
             void *      mStorage;   // base address of the vector
@@ -158,6 +178,7 @@ protected:
 
 private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = 0) const;
+    static  int             compareProxy(const void* lhs, const void* rhs, void* state);
 
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
@@ -130,6 +130,17 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle);
 int32_t OpenArchiveFd(const int fd, const char* debugFileName,
                       ZipArchiveHandle *handle, bool assume_ownership = true);
 
+/*
+ * Like OpenArchive and OpenArchiveFd, but only locates and maps the
+ * central directory. It is scanned, and checked, on the first call to
+ * FindEntry or StartIteration instead, which then return any error the
+ * scan finds. For callers that only want a few entries out of a huge
+ * archive.
+ */
+int32_t OpenArchiveLazy(const char* fileName, ZipArchiveHandle* handle);
+int32_t OpenArchiveFdLazy(const int fd, const char* debugFileName,
+                          ZipArchiveHandle *handle, bool assume_ownership = true);
+
 /*
  * Close archive, releasing resources associated with it. This will
  * unmap the central directory of the zipfile and free all internal
@@ -165,6 +176,8 @@ int32_t FindEntry(const ZipArchiveHandle handle, const ZipString& entryName,
  *
  * This method also accepts optional prefix and suffix to restrict iteration to
  * entry names that start with |optional_prefix| or end with |optional_suffix|.
+ * With a prefix, the matching entries are found without looking at the rest
+ * of the archive, and come in the byte order of their names.
  *
  * Returns 0 on success and negative values on failure.
  */
@@ -207,6 +220,67 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
 int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry,
                         uint8_t* begin, uint32_t size);
 
+/*
+ * Uncompress |entry| and hand its data to |func| as it comes out, a block
+ * at a time, without holding the whole entry anywhere. |func| returns
+ * false to stop. Entries can be processed from several threads at once.
+ *
+ * Returns 0 once all of the data has been through |func|, and negative
+ * values on failure, including when |func| returned false.
+ */
+typedef bool (*ProcessZipEntryFunction)(const uint8_t* buf, size_t buf_size, void* cookie);
+
+int32_t ProcessZipEntryContents(ZipArchiveHandle handle, ZipEntry* entry,
+                                ProcessZipEntryFunction func, void* cookie);
+
+#ifdef __cplusplus
+namespace android {
+class FileMap;
+}
+
+/*
+ * Map the data of a kCompressStored entry read-only, straight from the
+ * archive's file, into |map|, which must not have been created yet. There
+ * is no copy: the pages are shared with the page cache and with every
+ * other mapping of the archive, and the data starts on a page boundary
+ * if the archive was aligned that way (zipalign -p).
+ *
+ * The data is not checked against the entry's crc32.
+ *
+ * Returns 0 on success and negative values on failure, in particular for
+ * compressed and empty entries.
+ */
+int32_t MapEntry(const ZipArchiveHandle handle, const ZipEntry* entry,
+                 android::FileMap* map);
+#endif
+
+/*
+ * One entry for ExtractEntries. It is extracted to the file |fd| at its
+ * current position, as by ExtractEntryToFile, or if |fd| is -1 to the
+ * |size| bytes at |begin|, as by ExtractToMemory. |result| is set to what
+ * that call would have returned.
+ */
+struct ZipExtraction {
+  ZipEntry* entry;
+  int fd;
+  uint8_t* begin;
+  uint32_t size;
+  int32_t result;
+};
+
+/*
+ * Extract |count| entries from the archive, spread over |num_threads|
+ * threads, or one per online CPU if it is 0. The archive is only read
+ * with pread, so the entries' data is read and inflated concurrently.
+ * No two extractions may write to the same file descriptor or memory.
+ *
+ * Returns 0 if every entry was extracted, otherwise the result of the
+ * first extraction in |extractions| that failed. Every extraction is
+ * attempted either way.
+ */
+int32_t ExtractEntries(ZipArchiveHandle handle, ZipExtraction* extractions,
+                       size_t count, size_t num_threads);
+
 int GetFileDescriptor(const ZipArchiveHandle handle);
 
 const char* ErrorCodeString(int32_t error_code);
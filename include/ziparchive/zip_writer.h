@@ -47,6 +47,12 @@
  *   writer.Finish();
  *
  *   fclose(file);
+ *
+ * A ZipWriter created with a number of threads deflates in parallel instead:
+ * the data of the entries is kept in memory until enough of it accumulates
+ * (or Finish is called), then all of it is compressed at once, large entries
+ * split into chunks that are compressed separately. The zip file is the same
+ * apart from the compressed bytes, and is only complete after Finish.
  */
 class ZipWriter {
 public:
@@ -72,6 +78,14 @@ public:
    */
   explicit ZipWriter(FILE* f);
 
+  /**
+   * Create a ZipWriter that compresses entries on |num_threads| threads, or on as many as
+   * there are CPUs if |num_threads| is 0.
+   */
+  ZipWriter(FILE* f, size_t num_threads);
+
+  ~ZipWriter();
+
   // Move constructor.
   ZipWriter(ZipWriter&& zipWriter);
 
@@ -91,12 +105,38 @@ public:
    */
   int32_t StartEntryWithTime(const char* path, size_t flags, time_t time);
 
+  /**
+   * Same as StartEntry(const char*, size_t), but pads the local file header so that the
+   * entry's data starts at a multiple of |alignment| in the file, for instance 4096 for
+   * uncompressed libraries and resources that are mmapped in place. |alignment| must be a
+   * power of 2 no larger than 32768.
+   */
+  int32_t StartAlignedEntry(const char* path, size_t flags, uint32_t alignment);
+
+  /**
+   * Same as StartAlignedEntry(const char*, size_t, uint32_t), but sets a last modified time
+   * for the entry.
+   */
+  int32_t StartAlignedEntryWithTime(const char* path, size_t flags, time_t time,
+                                    uint32_t alignment);
+
   /**
    * Writes bytes to the zip file for the previously started zip entry.
    * Returns 0 on success, and an error value < 0 on failure.
    */
   int32_t WriteBytes(const void* data, size_t len);
 
+#if !defined(_WIN32)
+  /**
+   * Writes |len| bytes at |offset| in |fd| to the zip file for the previously started zip
+   * entry. The data is mapped rather than read, and when the entry is stored it is copied
+   * from |fd| to the zip file by the kernel (copy_file_range or sendfile) where possible,
+   * without passing through a buffer here. |fd| must be a regular file.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t WriteBytesFromFd(int fd, off64_t offset, size_t len);
+#endif
+
   /**
    * Finish a zip entry started with StartEntry(const char*, size_t) or
    * StartEntryWithTime(const char*, size_t, time_t). This must be called before
@@ -125,7 +165,13 @@ private:
     uint32_t local_file_header_offset;
   };
 
+  struct PendingEntry;
+
   int32_t HandleError(int32_t error_code);
+  int32_t WriteLocalFileHeader(FileInfo* file, const char* path, uint32_t alignment);
+  int32_t CopyBytesFromFd(int fd, off64_t offset, size_t len, const uint8_t* data);
+  int32_t WriteDataDescriptor(const FileInfo& file);
+  int32_t FlushPendingEntries();
   int32_t PrepareDeflate();
   int32_t StoreBytes(FileInfo* file, const void* data, size_t len);
   int32_t CompressBytes(FileInfo* file, const void* data, size_t len);
@@ -145,6 +191,12 @@ private:
 
   std::unique_ptr<z_stream, void(*)(z_stream*)> z_stream_;
   std::vector<uint8_t> buffer_;
+
+  // Only when compressing in parallel (num_threads_ != 0): the entries
+  // written since the last flush, and the size of their data.
+  size_t num_threads_;
+  std::vector<std::unique_ptr<PendingEntry>> pending_;
+  size_t pending_bytes_;
 };
 
 #endif /* LIBZIPARCHIVE_ZIPWRITER_H_ */
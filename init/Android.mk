@@ -28,6 +28,7 @@ LOCAL_SRC_FILES:= \
     init_parser.cpp \
     log.cpp \
     parser.cpp \
+    rc_cache.cpp \
     util.cpp \
 
 LOCAL_STATIC_LIBRARIES := libbase
@@ -38,12 +39,18 @@ include $(BUILD_STATIC_LIBRARY)
 include $(CLEAR_VARS)
 LOCAL_CPPFLAGS := $(init_cflags)
 LOCAL_SRC_FILES:= \
+    boot_trace.cpp \
     bootchart.cpp \
     builtins.cpp \
     devices.cpp \
+    exec_helpers.cpp \
+    firmware.cpp \
     init.cpp \
     keychords.cpp \
+    parallel.cpp \
+    persistent_properties.cpp \
     property_service.cpp \
+    restorecon.cpp \
     signal_handler.cpp \
     ueventd.cpp \
     ueventd_parser.cpp \
@@ -90,10 +97,33 @@ include $(BUILD_EXECUTABLE)
 
 
 
+# Builds the ramdisk's init.rc.cache, see rc_cache.h
+include $(CLEAR_VARS)
+LOCAL_CPPFLAGS := $(init_cflags)
+LOCAL_SRC_FILES := \
+    parser.cpp \
+    rc_cache.cpp \
+    rc_cache_main.cpp \
+
+LOCAL_STATIC_LIBRARIES := libbase
+LOCAL_MODULE := init_rc_cache
+LOCAL_CLANG := $(init_clang)
+include $(BUILD_HOST_EXECUTABLE)
+
+# Turns /data/bootchart/bootchart.bin into bootchart's logs, see bootchart.h
+include $(CLEAR_VARS)
+LOCAL_CPPFLAGS := $(init_cflags)
+LOCAL_SRC_FILES := bootchart_convert.cpp
+LOCAL_STATIC_LIBRARIES := libbase
+LOCAL_MODULE := bootchart_convert
+LOCAL_CLANG := $(init_clang)
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE := init_tests
 LOCAL_SRC_FILES := \
     init_parser_test.cpp \
+    rc_cache_test.cpp \
     util_test.cpp \
 
 LOCAL_SHARED_LIBRARIES += \
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "boot_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+#include <fs_mgr.h>
+
+#include "init.h"
+#include "log.h"
+#include "property_service.h"
+#include "util.h"
+
+// Enough for a boot, and a bound on what a boot that never completes costs.
+#define BOOT_TRACE_MAX_EVENTS 16384
+
+struct boot_trace_event {
+    uint64_t ns;
+    pid_t tid;
+    char phase;             // as atrace has them: B, E, S (async start), F
+    pid_t cookie;           // the service's pid, for S and F
+    std::string name;
+};
+
+// All protected by trace_lock, commands may run on parallel.cpp's threads.
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<boot_trace_event> trace_events;
+static size_t trace_dropped;
+static bool trace_recording = true;
+static std::set<std::string> trace_started_services;
+
+static void add_event(uint64_t ns, char phase, const char* name, pid_t cookie) {
+    pid_t tid = syscall(__NR_gettid);
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_recording) {
+        // Nothing to do.
+    } else if (trace_events.size() >= BOOT_TRACE_MAX_EVENTS) {
+        trace_dropped++;
+    } else {
+        trace_events.push_back({ ns, tid, phase, cookie, name ? name : "" });
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void fs_mgr_wait(const char* filename, uint64_t start_ns, uint64_t end_ns) {
+    boot_trace_slice(android::base::StringPrintf("wait for %s", filename).c_str(),
+                     start_ns, end_ns);
+}
+
+void boot_trace_init() {
+    trace_events.reserve(1024);
+    fs_mgr_set_wait_hook(fs_mgr_wait);
+}
+
+void boot_trace_begin(const char* name) {
+    add_event(gettime_ns(), 'B', name, 0);
+}
+
+void boot_trace_command_begin(const struct command* cmd) {
+    if (!trace_recording) {
+        return;
+    }
+    std::string name;
+    for (int i = 0; i < cmd->nargs; i++) {
+        if (i) {
+            name += ' ';
+        }
+        name += cmd->args[i];
+    }
+    boot_trace_begin(name.c_str());
+}
+
+void boot_trace_end() {
+    add_event(gettime_ns(), 'E', NULL, 0);
+}
+
+void boot_trace_slice(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    add_event(start_ns, 'B', name, 0);
+    add_event(end_ns, 'E', NULL, 0);
+}
+
+void boot_trace_service_start(const char* name, pid_t pid) {
+    uint64_t now = gettime_ns();
+    add_event(now, 'S', name, pid);
+
+    pthread_mutex_lock(&trace_lock);
+    bool first = trace_recording && trace_started_services.insert(name).second;
+    pthread_mutex_unlock(&trace_lock);
+    if (first) {
+        std::string prop = android::base::StringPrintf("ro.boottime.%s", name);
+        if (prop.size() < PROP_NAME_MAX) {
+            property_set(prop.c_str(), std::to_string(now).c_str());
+        }
+    }
+}
+
+void boot_trace_service_exit(const char* name, pid_t pid) {
+    add_event(gettime_ns(), 'F', name, pid);
+}
+
+static void append_event(std::string* out, const boot_trace_event& event) {
+    // The same columns as the kernel's trace, all of it from init's tgid.
+    android::base::StringAppendF(out, "%16s-%-5d [000] ...1 %5" PRIu64 ".%06" PRIu64
+                                 ": tracing_mark_write: ", "init", event.tid,
+                                 event.ns / 1000000000, (event.ns / 1000) % 1000000);
+    switch (event.phase) {
+    case 'B':
+        android::base::StringAppendF(out, "B|1|%s\n", event.name.c_str());
+        break;
+    case 'E':
+        out->append("E\n");
+        break;
+    default:
+        android::base::StringAppendF(out, "%c|1|%s|%d\n", event.phase, event.name.c_str(),
+                                     event.cookie);
+        break;
+    }
+}
+
+void boot_trace_finish() {
+    std::vector<boot_trace_event> events;
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_recording) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    trace_recording = false;
+    events.swap(trace_events);
+    size_t dropped = trace_dropped;
+    trace_started_services.clear();
+    pthread_mutex_unlock(&trace_lock);
+
+    std::string out = android::base::StringPrintf(
+            "# tracer: nop\n"
+            "#\n"
+            "# entries-in-buffer/entries-written: %zu/%zu   #P:1\n"
+            "#\n"
+            "#           TASK-PID    CPU#  ||||    TIMESTAMP  FUNCTION\n"
+            "#              | |       |   ||||       |         |\n",
+            events.size(), events.size() + dropped);
+    for (const auto& event : events) {
+        append_event(&out, event);
+    }
+
+    int fd = TEMP_FAILURE_RETRY(open(BOOT_TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                                     0444));
+    if (fd == -1 || !android::base::WriteFully(fd, out.data(), out.size())) {
+        ERROR("Unable to write %s: %s\n", BOOT_TRACE_FILE, strerror(errno));
+    } else {
+        NOTICE("Boot trace of %zu events written to %s\n", events.size(), BOOT_TRACE_FILE);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_BOOT_TRACE_H_
+#define _INIT_BOOT_TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// A record, in memory, of what init spent the boot doing: each action and
+// command as a slice on the thread that ran it, the waits inside them, and
+// each service from its start to its exit. Timestamps are CLOCK_MONOTONIC,
+// as from gettime_ns.
+//
+// When sys.boot_completed is set the record is written out to
+// BOOT_TRACE_FILE in the text format atrace produces, so that systrace can
+// show it, and recording stops. The first start of each service is also
+// published as ro.boottime.<service>, in ns, as it happens.
+
+#define BOOT_TRACE_FILE "/dev/boot_trace"
+
+struct command;
+
+// Also hooks up fs_mgr's waits for block devices.
+void boot_trace_init();
+
+// Slices nest on the calling thread like atrace's begin and end.
+void boot_trace_begin(const char* name);
+void boot_trace_command_begin(const struct command* cmd);
+void boot_trace_end();
+
+// A slice that was timed by someone else.
+void boot_trace_slice(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+void boot_trace_service_start(const char* name, pid_t pid);
+void boot_trace_service_exit(const char* name, pid_t pid);
+
+void boot_trace_finish();
+
+#endif
@@ -22,48 +22,78 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
 
 #include <base/file.h>
 
 #define LOG_ROOT        "/data/bootchart"
-#define LOG_STAT        LOG_ROOT"/proc_stat.log"
-#define LOG_PROCS       LOG_ROOT"/proc_ps.log"
-#define LOG_DISK        LOG_ROOT"/proc_diskstats.log"
+#define LOG_DATA        LOG_ROOT"/bootchart.bin"
 #define LOG_HEADER      LOG_ROOT"/header"
 #define LOG_ACCT        LOG_ROOT"/kernel_pacct"
 
 #define LOG_STARTFILE   LOG_ROOT"/start"
 #define LOG_STOPFILE    LOG_ROOT"/stop"
 
-// Polling period in ms.
+// Default polling period in ms, the start file can ask for another.
 static const int BOOTCHART_POLLING_MS = 200;
+static const int BOOTCHART_MIN_POLLING_MS = 10;
 
 // Max polling time in seconds.
 static const int BOOTCHART_MAX_TIME_SEC = 10*60;
 
-static long long g_last_bootchart_time;
-static int g_remaining_samples;
+// Records are collected here and written out in one go.
+static const size_t BOOTCHART_BUFFER_SIZE = 256 * 1024;
 
-static FILE* log_stat;
-static FILE* log_procs;
-static FILE* log_disks;
+// How often the stop file is looked at, in ms.
+static const int BOOTCHART_STOP_CHECK_MS = 1000;
 
-static long long get_uptime_jiffies() {
-    std::string uptime;
-    if (!android::base::ReadFileToString("/proc/uptime", &uptime)) {
-        return 0;
-    }
-    return 100LL * strtod(uptime.c_str(), NULL);
+// Processes whose stat file is kept open between samples. Past this they
+// are opened afresh each time, init has other uses for its descriptors.
+static const size_t BOOTCHART_MAX_PROC_FDS = 256;
+
+struct bootchart_proc {
+    int fd;                 // /proc/<pid>/stat, or -1
+    std::string comm;       // name in stat when cmdline was read
+    std::string cmdline;
+    std::string last;       // line last recorded
+};
+
+// Everything below is only touched by the bootchart thread once it runs.
+static int g_polling_ms;
+static int g_remaining_samples;
+static int g_data_fd = -1;
+static std::string g_buffer;
+
+static int g_stat_fd = -1;
+static int g_disk_fd = -1;
+static DIR* g_proc_dir;
+static std::map<int, bootchart_proc> g_procs;
+static size_t g_proc_fds;
+
+static int g_taskstats_fd = -1;
+static uint16_t g_taskstats_family;
+
+static long long uptime_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 static void log_header() {
@@ -99,65 +129,431 @@ static void log_header() {
     fclose(out);
 }
 
-static void do_log_uptime(FILE* log) {
-    fprintf(log, "%lld\n", get_uptime_jiffies());
+static void flush_buffer() {
+    if (!g_buffer.empty() && !android::base::WriteFully(g_data_fd, g_buffer.data(), g_buffer.size())) {
+        ERROR("bootchart: write to %s failed: %s\n", LOG_DATA, strerror(errno));
+    }
+    g_buffer.clear();
 }
 
-static void do_log_file(FILE* log, const char* procfile) {
-    do_log_uptime(log);
+static void add_record(uint32_t type, const void* data1, size_t len1,
+                       const void* data2 = NULL, size_t len2 = 0) {
+    bootchart_record record = { type, static_cast<uint32_t>(len1 + len2) };
+    g_buffer.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    g_buffer.append(reinterpret_cast<const char*>(data1), len1);
+    if (len2) {
+        g_buffer.append(reinterpret_cast<const char*>(data2), len2);
+    }
+    if (g_buffer.size() >= BOOTCHART_BUFFER_SIZE) {
+        flush_buffer();
+    }
+}
 
-    std::string content;
-    if (android::base::ReadFileToString(procfile, &content)) {
-        fprintf(log, "%s\n", content.c_str());
+// Reading a /proc file again from offset 0 makes the kernel regenerate it,
+// so the descriptor can be kept across samples.
+static bool read_proc_fd(int fd, std::string* out) {
+    char buf[4096];
+    off_t offset = 0;
+    out->clear();
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), offset));
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        out->append(buf, n);
+        offset += n;
     }
 }
 
-static void do_log_procs(FILE* log) {
-    do_log_uptime(log);
+static void log_proc_file(uint32_t type, int fd) {
+    static std::string content;
+    if (fd != -1 && read_proc_fd(fd, &content)) {
+        add_record(type, content.data(), content.size());
+    }
+}
 
-    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir("/proc"), closedir);
+static int open_proc_stat(int pid) {
+    char filename[32];
+    snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
+    return open(filename, O_RDONLY | O_CLOEXEC);
+}
+
+// Returns false once the process is gone.
+static bool log_proc(int pid, bootchart_proc* proc) {
+    static std::string stat;
+
+    int fd = proc->fd;
+    if (fd == -1 && (fd = open_proc_stat(pid)) == -1) {
+        return false;
+    }
+    bool ok = read_proc_fd(fd, &stat) && !stat.empty();
+    if (proc->fd == -1) {
+        close(fd);
+    }
+    if (!ok) {
+        return false;
+    }
+
+    size_t open = stat.find('(');
+    size_t close = stat.find_last_of(')');
+    if (open == std::string::npos || close == std::string::npos || close < open) {
+        return true;
+    }
+
+    // /proc/<pid>/stat only has truncated task names, so get the full name
+    // from /proc/<pid>/cmdline. That only changes along with the short name,
+    // on an exec, so it is read again only then.
+    std::string comm = stat.substr(open + 1, close - open - 1);
+    if (comm != proc->comm) {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
+        std::string cmdline;
+        android::base::ReadFileToString(filename, &cmdline);
+        proc->cmdline = cmdline.c_str(); // So we stop at the first NUL.
+        proc->comm = comm;
+    }
+    if (!proc->cmdline.empty()) {
+        // Substitute the process name with its real name.
+        stat.replace(open + 1, close - open - 1, proc->cmdline);
+    }
+
+    if (stat != proc->last) {
+        int32_t id = pid;
+        add_record(BOOTCHART_PROC, &id, sizeof(id), stat.data(), stat.size());
+        proc->last = stat;
+    }
+    return true;
+}
+
+static void log_procs() {
+    rewinddir(g_proc_dir);
     struct dirent* entry;
-    while ((entry = readdir(dir.get())) != NULL) {
+    while ((entry = readdir(g_proc_dir)) != NULL) {
         // Only match numeric values.
         char* end;
         int pid = strtol(entry->d_name, &end, 10);
-        if (end != NULL && end > entry->d_name && *end == 0) {
-            char filename[32];
-
-            // /proc/<pid>/stat only has truncated task names, so get the full
-            // name from /proc/<pid>/cmdline.
-            snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
-            std::string cmdline;
-            android::base::ReadFileToString(filename, &cmdline);
-            const char* full_name = cmdline.c_str(); // So we stop at the first NUL.
-
-            // Read process stat line.
-            snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
-            std::string stat;
-            if (android::base::ReadFileToString(filename, &stat)) {
-                if (!cmdline.empty()) {
-                    // Substitute the process name with its real name.
-                    size_t open = stat.find('(');
-                    size_t close = stat.find_last_of(')');
-                    if (open != std::string::npos && close != std::string::npos) {
-                        stat.replace(open + 1, close - open - 1, full_name);
-                    }
+        if (end == NULL || end == entry->d_name || *end != 0) {
+            continue;
+        }
+        if (g_procs.find(pid) == g_procs.end()) {
+            bootchart_proc& proc = g_procs[pid];
+            proc.fd = -1;
+            if (g_proc_fds < BOOTCHART_MAX_PROC_FDS && (proc.fd = open_proc_stat(pid)) != -1) {
+                g_proc_fds++;
+            }
+        }
+    }
+
+    for (auto it = g_procs.begin(); it != g_procs.end();) {
+        if (log_proc(it->first, &it->second)) {
+            ++it;
+            continue;
+        }
+        int32_t id = it->first;
+        add_record(BOOTCHART_PROC_EXIT, &id, sizeof(id));
+        if (it->second.fd != -1) {
+            close(it->second.fd);
+            g_proc_fds--;
+        }
+        it = g_procs.erase(it);
+    }
+}
+
+static void bootchart_step() {
+    uint64_t now = uptime_ms();
+    add_record(BOOTCHART_SAMPLE, &now, sizeof(now));
+    log_proc_file(BOOTCHART_STAT, g_stat_fd);
+    log_proc_file(BOOTCHART_DISKSTATS, g_disk_fd);
+    log_procs();
+}
+
+// Process accounting through taskstats: the kernel sends us a message as
+// each task exits, instead of appending to a file we have to share with
+// everything else it accounts. Without taskstats we fall back on acct(2).
+
+static int taskstats_send(uint16_t type, uint8_t cmd, uint16_t attr,
+                          const void* data, size_t len) {
+    struct {
+        nlmsghdr n;
+        genlmsghdr g;
+        char buf[128];
+    } msg;
+    if (len > sizeof(msg.buf) - NLA_HDRLEN) {
+        return -1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    msg.n.nlmsg_type = type;
+    msg.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    msg.n.nlmsg_pid = getpid();
+    msg.g.cmd = cmd;
+    msg.g.version = 1;
+
+    nlattr* na = reinterpret_cast<nlattr*>(reinterpret_cast<char*>(&msg) + msg.n.nlmsg_len);
+    na->nla_type = attr;
+    na->nla_len = NLA_HDRLEN + len;
+    memcpy(reinterpret_cast<char*>(na) + NLA_HDRLEN, data, len);
+    msg.n.nlmsg_len += NLA_ALIGN(na->nla_len);
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    return TEMP_FAILURE_RETRY(sendto(g_taskstats_fd, &msg, msg.n.nlmsg_len, 0,
+                                     reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+}
+
+static const nlattr* find_attr(const char* p, size_t len, uint16_t type) {
+    while (len >= NLA_HDRLEN) {
+        const nlattr* na = reinterpret_cast<const nlattr*>(p);
+        if (na->nla_len < NLA_HDRLEN || na->nla_len > len) {
+            return NULL;
+        }
+        if ((na->nla_type & NLA_TYPE_MASK) == type) {
+            return na;
+        }
+        size_t step = NLA_ALIGN(na->nla_len);
+        if (step >= len) {
+            break;
+        }
+        p += step;
+        len -= step;
+    }
+    return NULL;
+}
+
+static const char* attr_data(const nlattr* na) {
+    return reinterpret_cast<const char*>(na) + NLA_HDRLEN;
+}
+
+static size_t attr_len(const nlattr* na) {
+    return na->nla_len - NLA_HDRLEN;
+}
+
+// Waits for the answer to the last request. Returns the error it carries,
+// and fills in *family if the answer is the one to CTRL_CMD_GETFAMILY.
+static int taskstats_reply(uint16_t* family) {
+    char buf[4096];
+    while (true) {
+        pollfd pfd = { g_taskstats_fd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, 1000)) != 1) {
+            return -ETIMEDOUT;
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(recv(g_taskstats_fd, buf, sizeof(buf), 0));
+        if (n < 0) {
+            return -errno;
+        }
+        int len = n;
+        for (nlmsghdr* nh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nh, len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                return reinterpret_cast<nlmsgerr*>(NLMSG_DATA(nh))->error;
+            }
+            if (family && nh->nlmsg_type == GENL_ID_CTRL &&
+                    nh->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN)) {
+                const nlattr* id = find_attr(reinterpret_cast<char*>(NLMSG_DATA(nh)) + GENL_HDRLEN,
+                                             nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                                             CTRL_ATTR_FAMILY_ID);
+                if (id && attr_len(id) >= sizeof(*family)) {
+                    memcpy(family, attr_data(id), sizeof(*family));
                 }
-                fputs(stat.c_str(), log);
             }
         }
     }
+}
+
+static std::string taskstats_cpumask() {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    char mask[32];
+    snprintf(mask, sizeof(mask), "0-%ld", (cpus > 0 ? cpus : 1) - 1);
+    return mask;
+}
+
+static void taskstats_close() {
+    if (g_taskstats_fd != -1) {
+        std::string mask = taskstats_cpumask();
+        taskstats_send(g_taskstats_family, TASKSTATS_CMD_GET,
+                       TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, mask.c_str(), mask.size() + 1);
+        close(g_taskstats_fd);
+        g_taskstats_fd = -1;
+    }
+}
+
+static bool taskstats_open() {
+    g_taskstats_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (g_taskstats_fd == -1) {
+        return false;
+    }
+    // Lots of short lived processes exit together during boot.
+    int size = 256 * 1024;
+    setsockopt(g_taskstats_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = getpid();
+    uint16_t family = 0;
+    static const char name[] = TASKSTATS_GENL_NAME;
+    int rc = -1;
+    if (bind(g_taskstats_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            taskstats_send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                           name, sizeof(name)) != -1 &&
+            taskstats_reply(&family) == 0 && family != 0) {
+        g_taskstats_family = family;
+        std::string mask = taskstats_cpumask();
+        if (taskstats_send(family, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK,
+                           mask.c_str(), mask.size() + 1) != -1) {
+            rc = taskstats_reply(NULL);
+        }
+    }
+    if (rc != 0) {
+        close(g_taskstats_fd);
+        g_taskstats_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void log_task_exit(const taskstats& ts) {
+    bootchart_exit exit;
+    memset(&exit, 0, sizeof(exit));
+    exit.etime_us = ts.ac_etime;
+    exit.utime_us = ts.ac_utime;
+    exit.stime_us = ts.ac_stime;
+    exit.minflt = ts.ac_minflt;
+    exit.majflt = ts.ac_majflt;
+    exit.pid = ts.ac_pid;
+    exit.ppid = ts.ac_ppid;
+    exit.uid = ts.ac_uid;
+    exit.gid = ts.ac_gid;
+    exit.exitcode = ts.ac_exitcode;
+    exit.btime = ts.ac_btime;
+    exit.flag = ts.ac_flag;
+    strncpy(exit.comm, ts.ac_comm, sizeof(exit.comm) - 1);
+    add_record(BOOTCHART_TASK_EXIT, &exit, sizeof(exit));
+}
+
+static void read_taskstats() {
+    char buf[8192];
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(recv(g_taskstats_fd, buf, sizeof(buf), MSG_DONTWAIT));
+        if (n < 0 && errno == ENOBUFS) {
+            // The socket overflowed and some exits are lost, carry on.
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        int len = n;
+        for (nlmsghdr* nh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nh, len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != g_taskstats_family ||
+                    nh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+                continue;
+            }
+            const nlattr* aggr = find_attr(reinterpret_cast<char*>(NLMSG_DATA(nh)) + GENL_HDRLEN,
+                                           nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                                           TASKSTATS_TYPE_AGGR_PID);
+            if (!aggr) {
+                continue;
+            }
+            const nlattr* stats = find_attr(attr_data(aggr), attr_len(aggr),
+                                            TASKSTATS_TYPE_STATS);
+            if (!stats) {
+                continue;
+            }
+            // Older and newer kernels have shorter and longer versions.
+            taskstats ts;
+            memset(&ts, 0, sizeof(ts));
+            memcpy(&ts, attr_data(stats), std::min(attr_len(stats), sizeof(ts)));
+            log_task_exit(ts);
+        }
+    }
+}
 
-    fputc('\n', log);
+static bool bootchart_stopped() {
+    // Stop if /data/bootchart/stop contains 1.
+    std::string stop;
+    return android::base::ReadFileToString(LOG_STOPFILE, &stop) && stop == "1";
+}
+
+static void bootchart_finish() {
+    flush_buffer();
+    unlink(LOG_STOPFILE);
+    close(g_data_fd);
+    close(g_stat_fd);
+    close(g_disk_fd);
+    closedir(g_proc_dir);
+    for (const auto& proc : g_procs) {
+        if (proc.second.fd != -1) {
+            close(proc.second.fd);
+        }
+    }
+    g_procs.clear();
+    if (g_taskstats_fd != -1) {
+        taskstats_close();
+    } else {
+        acct(NULL);
+    }
+    NOTICE("Bootcharting finished.\n");
+}
+
+// Samples are taken on a fixed schedule, however busy init itself is, and
+// task exits are collected in between.
+static void* bootchart_thread(void*) {
+    long long next = uptime_ms();
+    long long next_stop_check = next + BOOTCHART_STOP_CHECK_MS;
+
+    while (g_remaining_samples > 0) {
+        bootchart_step();
+        g_remaining_samples--;
+
+        long long now = uptime_ms();
+        if (now >= next_stop_check) {
+            if (bootchart_stopped()) {
+                break;
+            }
+            flush_buffer();
+            next_stop_check = now + BOOTCHART_STOP_CHECK_MS;
+        }
+
+        // Count missed samples.
+        next += g_polling_ms;
+        while (next <= now) {
+            next += g_polling_ms;
+            g_remaining_samples--;
+        }
+
+        while (now < next) {
+            pollfd pfd = { g_taskstats_fd, POLLIN, 0 };
+            int nr = TEMP_FAILURE_RETRY(poll(&pfd, g_taskstats_fd != -1 ? 1 : 0, next - now));
+            if (nr > 0) {
+                read_taskstats();
+            }
+            now = uptime_ms();
+        }
+    }
+
+    bootchart_finish();
+    return NULL;
 }
 
 static int bootchart_init() {
     int timeout = 0;
+    g_polling_ms = BOOTCHART_POLLING_MS;
 
     std::string start;
     android::base::ReadFileToString(LOG_STARTFILE, &start);
     if (!start.empty()) {
-        timeout = atoi(start.c_str());
+        // <timeout> [<polling period in ms>]
+        char* end;
+        timeout = strtol(start.c_str(), &end, 10);
+        int polling_ms = strtol(end, NULL, 10);
+        if (polling_ms > 0) {
+            g_polling_ms = std::max(polling_ms, BOOTCHART_MIN_POLLING_MS);
+        }
     } else {
         // When running with emulator, androidboot.bootchart=<timeout>
         // might be passed by as kernel parameters to specify the bootchart
@@ -166,108 +562,81 @@ static int bootchart_init() {
         std::string cmdline;
         android::base::ReadFileToString("/proc/cmdline", &cmdline);
 #define KERNEL_OPTION  "androidboot.bootchart="
-        if (strstr(cmdline.c_str(), KERNEL_OPTION) != NULL) {
-            timeout = atoi(cmdline.c_str() + sizeof(KERNEL_OPTION) - 1);
+        const char* option = strstr(cmdline.c_str(), KERNEL_OPTION);
+        if (option != NULL) {
+            timeout = atoi(option + sizeof(KERNEL_OPTION) - 1);
         }
     }
-    if (timeout == 0)
+    if (timeout <= 0)
         return 0;
 
     if (timeout > BOOTCHART_MAX_TIME_SEC)
         timeout = BOOTCHART_MAX_TIME_SEC;
 
-    int count = (timeout*1000 + BOOTCHART_POLLING_MS-1)/BOOTCHART_POLLING_MS;
+    int count = (timeout*1000 + g_polling_ms-1)/g_polling_ms;
 
-    log_stat = fopen(LOG_STAT, "we");
-    if (log_stat == NULL) {
-        return -1;
-    }
-    log_procs = fopen(LOG_PROCS, "we");
-    if (log_procs == NULL) {
-        fclose(log_stat);
+    g_data_fd = open(LOG_DATA, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_data_fd == -1) {
         return -1;
     }
-    log_disks = fopen(LOG_DISK, "we");
-    if (log_disks == NULL) {
-        fclose(log_stat);
-        fclose(log_procs);
+    g_stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    g_disk_fd = open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+    g_proc_dir = opendir("/proc");
+    if (g_proc_dir == NULL) {
+        close(g_data_fd);
+        close(g_stat_fd);
+        close(g_disk_fd);
         return -1;
     }
 
-    // Create kernel process accounting file.
-    close(open(LOG_ACCT, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
-    acct(LOG_ACCT);
+    g_buffer.reserve(BOOTCHART_BUFFER_SIZE + 4096);
+    g_buffer.assign(BOOTCHART_MAGIC, BOOTCHART_MAGIC_LEN);
+
+    unlink(LOG_ACCT);
+    if (taskstats_open()) {
+        INFO("Bootcharting with taskstats.\n");
+    } else {
+        // Create kernel process accounting file.
+        close(open(LOG_ACCT, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        acct(LOG_ACCT);
+    }
 
     log_header();
     return count;
 }
 
 int do_bootchart_init(int nargs, char** args) {
+    // The thread owns the state from here on.
+    static bool started = false;
+    if (started) {
+        return 0;
+    }
+    started = true;
+
     g_remaining_samples = bootchart_init();
     if (g_remaining_samples < 0) {
         ERROR("Bootcharting init failure: %s\n", strerror(errno));
-    } else if (g_remaining_samples > 0) {
-        NOTICE("Bootcharting started (will run for %d s).\n",
-               (g_remaining_samples * BOOTCHART_POLLING_MS) / 1000);
-    } else {
+        g_remaining_samples = 0;
+        return 0;
+    }
+    if (g_remaining_samples == 0) {
         NOTICE("Not bootcharting.\n");
+        return 0;
     }
-    return 0;
-}
 
-static int bootchart_step() {
-    do_log_file(log_stat,   "/proc/stat");
-    do_log_file(log_disks,  "/proc/diskstats");
-    do_log_procs(log_procs);
-
-    // Stop if /data/bootchart/stop contains 1.
-    std::string stop;
-    if (android::base::ReadFileToString(LOG_STOPFILE, &stop) && stop == "1") {
-        return -1;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, bootchart_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        ERROR("could not start bootchart thread: %s\n", strerror(rc));
+        g_remaining_samples = 0;
+        bootchart_finish();
+        return 0;
     }
-
+    NOTICE("Bootcharting started (will run for %d s, sampling every %d ms).\n",
+           (g_remaining_samples * g_polling_ms) / 1000, g_polling_ms);
     return 0;
 }
-
-/* called to get time (in ms) used by bootchart */
-static long long bootchart_gettime() {
-    return 10LL*get_uptime_jiffies();
-}
-
-static void bootchart_finish() {
-    unlink(LOG_STOPFILE);
-    fclose(log_stat);
-    fclose(log_disks);
-    fclose(log_procs);
-    acct(NULL);
-}
-
-void bootchart_sample(int* timeout) {
-    // Do we have any more bootcharting to do?
-    if (g_remaining_samples <= 0) {
-        return;
-    }
-
-    long long current_time = bootchart_gettime();
-    int elapsed_time = current_time - g_last_bootchart_time;
-
-    if (elapsed_time >= BOOTCHART_POLLING_MS) {
-        /* count missed samples */
-        while (elapsed_time >= BOOTCHART_POLLING_MS) {
-            elapsed_time -= BOOTCHART_POLLING_MS;
-            g_remaining_samples--;
-        }
-        /* count may be negative, take a sample anyway */
-        g_last_bootchart_time = current_time;
-        if (bootchart_step() < 0 || g_remaining_samples <= 0) {
-            bootchart_finish();
-            g_remaining_samples = 0;
-        }
-    }
-    if (g_remaining_samples > 0) {
-        int remaining_time = BOOTCHART_POLLING_MS - elapsed_time;
-        if (*timeout < 0 || *timeout > remaining_time) {
-            *timeout = remaining_time;
-        }
-    }
-}
@@ -17,6 +17,58 @@
 #ifndef _BOOTCHART_H
 #define _BOOTCHART_H
 
-void bootchart_sample(int* timeout);
+#include <stdint.h>
+
+// Layout of /data/bootchart/bootchart.bin, written by init's bootchart
+// thread and turned back into the text logs bootchart expects by the host
+// tool bootchart_convert (see grab-bootchart.sh).
+//
+// The file starts with BOOTCHART_MAGIC, then holds records of a
+// bootchart_record header followed by len bytes of payload. Integers are
+// native endian, the log is only read by the matching converter.
+
+#define BOOTCHART_MAGIC "BOOTCHT1"
+#define BOOTCHART_MAGIC_LEN 8
+
+struct bootchart_record {
+    uint32_t type;
+    uint32_t len;
+};
+
+enum {
+    // Starts a sample. uint64_t uptime in ms.
+    BOOTCHART_SAMPLE = 1,
+    // The contents of /proc/stat.
+    BOOTCHART_STAT = 2,
+    // The contents of /proc/diskstats.
+    BOOTCHART_DISKSTATS = 3,
+    // int32_t pid, then its /proc/<pid>/stat line with the name taken from
+    // the command line. Only recorded when the line changed, a process
+    // keeps its last line until a BOOTCHART_PROC_EXIT.
+    BOOTCHART_PROC = 4,
+    // int32_t pid of a process that is gone.
+    BOOTCHART_PROC_EXIT = 5,
+    // A bootchart_exit, from taskstats, for a task that exited.
+    BOOTCHART_TASK_EXIT = 6,
+};
+
+// What the kernel's process accounting would have said about a task, so
+// that the converter can write kernel_pacct when taskstats is used instead.
+struct bootchart_exit {
+    uint64_t etime_us;      // elapsed
+    uint64_t utime_us;
+    uint64_t stime_us;
+    uint64_t minflt;
+    uint64_t majflt;
+    uint32_t pid;
+    uint32_t ppid;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t exitcode;
+    uint32_t btime;         // seconds since the epoch
+    uint32_t flag;          // AFORK, ASU, ... as in acct
+    uint32_t reserved;
+    char comm[16];
+};
 
 #endif /* _BOOTCHART_H */
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tool that turns the bootchart.bin init writes back into the logs
+// the bootchart tools read:
+//
+//   bootchart_convert <bootchart.bin> <output directory>
+//
+// writes proc_stat.log, proc_diskstats.log and proc_ps.log, and also
+// kernel_pacct if the device used taskstats for process accounting.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include <base/file.h>
+
+#include "bootchart.h"
+
+// struct acct_v3 from <linux/acct.h>, spelled out so that this builds on
+// any host.
+struct acct_v3 {
+    char ac_flag;
+    char ac_version;
+    uint16_t ac_tty;
+    uint32_t ac_exitcode;
+    uint32_t ac_uid;
+    uint32_t ac_gid;
+    uint32_t ac_pid;
+    uint32_t ac_ppid;
+    uint32_t ac_btime;
+    float ac_etime;
+    uint16_t ac_utime;
+    uint16_t ac_stime;
+    uint16_t ac_mem;
+    uint16_t ac_io;
+    uint16_t ac_rw;
+    uint16_t ac_minflt;
+    uint16_t ac_majflt;
+    uint16_t ac_swaps;
+    char ac_comm[16];
+};
+
+static const int ACCT_VERSION = 3;
+static const int AHZ = 100;
+
+// The kernel's encode_comp_t: 13 bits of mantissa, 3 of base 8 exponent.
+static uint16_t encode_comp_t(uint64_t value) {
+    int exp = 0, rnd = 0;
+    while (value > 0x1fff) {
+        rnd = value & 4;
+        value >>= 3;
+        exp++;
+    }
+    if (rnd && (++value > 0x1fff)) {
+        value >>= 3;
+        exp++;
+    }
+    if (exp > 7) {
+        return 0xffff;
+    }
+    return (exp << 13) + value;
+}
+
+static void append_acct(std::string* out, const bootchart_exit& exit) {
+    acct_v3 ac;
+    memset(&ac, 0, sizeof(ac));
+    ac.ac_flag = exit.flag;
+    ac.ac_version = ACCT_VERSION;
+    ac.ac_exitcode = exit.exitcode;
+    ac.ac_uid = exit.uid;
+    ac.ac_gid = exit.gid;
+    ac.ac_pid = exit.pid;
+    ac.ac_ppid = exit.ppid;
+    ac.ac_btime = exit.btime;
+    ac.ac_etime = exit.etime_us * AHZ / 1e6;
+    ac.ac_utime = encode_comp_t(exit.utime_us * AHZ / 1000000);
+    ac.ac_stime = encode_comp_t(exit.stime_us * AHZ / 1000000);
+    ac.ac_minflt = encode_comp_t(exit.minflt);
+    ac.ac_majflt = encode_comp_t(exit.majflt);
+    memcpy(ac.ac_comm, exit.comm, sizeof(ac.ac_comm) - 1);
+    out->append(reinterpret_cast<const char*>(&ac), sizeof(ac));
+}
+
+struct logs {
+    std::string stat;
+    std::string disks;
+    std::string procs;
+    std::string pacct;
+};
+
+// Each log gets, per sample, the uptime in jiffies and then what was read
+// at that time, as init used to write them.
+static void end_sample(logs* out, const std::string& uptime,
+                       const std::map<int32_t, std::string>& procs) {
+    out->procs += uptime;
+    for (const auto& proc : procs) {
+        out->procs += proc.second;
+    }
+    out->procs += "\n";
+}
+
+static bool convert(const std::string& data, logs* out) {
+    if (data.size() < BOOTCHART_MAGIC_LEN || data.compare(0, BOOTCHART_MAGIC_LEN, BOOTCHART_MAGIC)) {
+        fprintf(stderr, "not a bootchart log\n");
+        return false;
+    }
+
+    std::map<int32_t, std::string> procs;
+    std::string uptime;
+    bool in_sample = false;
+
+    size_t pos = BOOTCHART_MAGIC_LEN;
+    while (data.size() - pos >= sizeof(bootchart_record)) {
+        bootchart_record record;
+        memcpy(&record, data.data() + pos, sizeof(record));
+        pos += sizeof(record);
+        if (data.size() - pos < record.len) {
+            // init was stopped in the middle of a write.
+            break;
+        }
+        const char* p = data.data() + pos;
+        pos += record.len;
+
+        int32_t pid;
+        switch (record.type) {
+        case BOOTCHART_SAMPLE: {
+            uint64_t ms;
+            if (record.len < sizeof(ms)) {
+                break;
+            }
+            memcpy(&ms, p, sizeof(ms));
+            if (in_sample) {
+                end_sample(out, uptime, procs);
+            }
+            uptime = std::to_string(ms / 10) + "\n";
+            in_sample = true;
+            break;
+        }
+        case BOOTCHART_STAT:
+            out->stat += uptime;
+            out->stat.append(p, record.len);
+            out->stat += "\n";
+            break;
+        case BOOTCHART_DISKSTATS:
+            out->disks += uptime;
+            out->disks.append(p, record.len);
+            out->disks += "\n";
+            break;
+        case BOOTCHART_PROC:
+            if (record.len >= sizeof(pid)) {
+                memcpy(&pid, p, sizeof(pid));
+                procs[pid].assign(p + sizeof(pid), record.len - sizeof(pid));
+            }
+            break;
+        case BOOTCHART_PROC_EXIT:
+            if (record.len >= sizeof(pid)) {
+                memcpy(&pid, p, sizeof(pid));
+                procs.erase(pid);
+            }
+            break;
+        case BOOTCHART_TASK_EXIT: {
+            bootchart_exit exit;
+            memset(&exit, 0, sizeof(exit));
+            memcpy(&exit, p, std::min(sizeof(exit), static_cast<size_t>(record.len)));
+            append_acct(&out->pacct, exit);
+            break;
+        }
+        default:
+            // Newer record types can't matter to the old logs.
+            break;
+        }
+    }
+    if (in_sample) {
+        end_sample(out, uptime, procs);
+    }
+    return true;
+}
+
+static bool write_log(const std::string& dir, const char* name, const std::string& content) {
+    std::string path = dir + "/" + name;
+    if (!android::base::WriteStringToFile(content, path)) {
+        fprintf(stderr, "couldn't write '%s': %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <bootchart.bin> <output directory>\n", argv[0]);
+        return 1;
+    }
+
+    std::string data;
+    if (!android::base::ReadFileToString(argv[1], &data)) {
+        fprintf(stderr, "%s: couldn't read '%s': %s\n", argv[0], argv[1], strerror(errno));
+        return 1;
+    }
+
+    logs out;
+    if (!convert(data, &out)) {
+        return 1;
+    }
+    std::string dir(argv[2]);
+    if (!write_log(dir, "proc_stat.log", out.stat) ||
+            !write_log(dir, "proc_diskstats.log", out.disks) ||
+            !write_log(dir, "proc_ps.log", out.procs)) {
+        return 1;
+    }
+    // Otherwise the device wrote kernel_pacct itself, through acct(2).
+    if (!out.pacct.empty() && !write_log(dir, "kernel_pacct", out.pacct)) {
+        return 1;
+    }
+    return 0;
+}
@@ -46,6 +46,7 @@
 #include "init.h"
 #include "keywords.h"
 #include "property_service.h"
+#include "restorecon.h"
 #include "devices.h"
 #include "init_parser.h"
 #include "util.h"
@@ -654,6 +655,9 @@ int do_powerctl(int nargs, char **args)
         return -EINVAL;
     }
 
+    // Persistent properties are written in the background, finish them first.
+    property_flush_persistent();
+
     return android_reboot_with_callback(cmd, 0, reboot_target,
                                         callback_on_ro_remount);
 }
@@ -833,11 +837,16 @@ int do_restorecon(int nargs, char **args) {
 }
 
 int do_restorecon_recursive(int nargs, char **args) {
-    int i;
+    int i = 1;
     int ret = 0;
+    bool skip_unchanged = false;
 
-    for (i = 1; i < nargs; i++) {
-        if (restorecon_recursive(args[i]) < 0)
+    if (nargs > 2 && !strcmp(args[1], "--skip-unchanged")) {
+        skip_unchanged = true;
+        i++;
+    }
+    for (; i < nargs; i++) {
+        if (restorecon_tree(args[i], skip_unchanged) < 0)
             ret = -errno;
     }
     return ret;
@@ -40,23 +40,27 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
 #include <cutils/list.h>
 #include <cutils/uevent.h>
 
 #include "devices.h"
+#include "firmware.h"
 #include "ueventd_parser.h"
 #include "util.h"
 #include "log.h"
 
 #define SYSFS_PREFIX    "/sys"
-static const char *firmware_dirs[] = { "/etc/firmware",
-                                       "/vendor/firmware",
-                                       "/firmware/image" };
-
 extern struct selabel_handle *sehandle;
 
 static int device_fd = -1;
 
+#define UEVENT_SOCKET_BUF (2*1024*1024)
+
 struct uevent {
     const char *action;
     const char *path;
@@ -79,9 +83,26 @@ struct perms_ {
     unsigned short wildcard;
 };
 
-struct perm_node {
-    struct perms_ dp;
-    struct listnode plist;
+/*
+ * The rules from ueventd.rc, compiled as they are parsed. Names without a
+ * wildcard go into a trie, so that the rules matching a path are all found
+ * in one walk down it: prefix rules ("foo*") wherever they end along the
+ * path, the others only at its end. Rules with any other '*' stay in a
+ * list for fnmatch. Rules are numbered in the order they were added,
+ * which is all the order the old lists gave them.
+ */
+struct perm_trie_node {
+    std::map<char, size_t> children;
+    std::vector<int> exact;
+    std::vector<int> prefix;
+};
+
+struct perm_table {
+    std::vector<perms_> rules;
+    std::vector<perm_trie_node> trie;
+    std::vector<int> wildcards;
+
+    perm_table() : trie(1) {}
 };
 
 struct platform_node {
@@ -91,98 +112,134 @@ struct platform_node {
     struct listnode list;
 };
 
-static list_declare(sys_perms);
-static list_declare(dev_perms);
+static perm_table sys_perms;
+static perm_table dev_perms;
 static list_declare(platform_names);
 
+static void perm_table_add(perm_table *table, const perms_ &dp)
+{
+    int index = table->rules.size();
+    table->rules.push_back(dp);
+
+    if (dp.wildcard) {
+        table->wildcards.push_back(index);
+        return;
+    }
+
+    size_t node = 0;
+    for (const char *p = dp.name; *p; p++) {
+        auto it = table->trie[node].children.find(*p);
+        if (it != table->trie[node].children.end()) {
+            node = it->second;
+        } else {
+            table->trie.push_back(perm_trie_node());
+            table->trie[node].children[*p] = table->trie.size() - 1;
+            node = table->trie.size() - 1;
+        }
+    }
+    if (dp.prefix)
+        table->trie[node].prefix.push_back(index);
+    else
+        table->trie[node].exact.push_back(index);
+}
+
+/* Calls fn with each trie rule matching path, not necessarily in order. */
+template <typename F>
+static void perm_table_match(const perm_table &table, const char *path, F fn)
+{
+    size_t node = 0;
+    for (;;) {
+        for (int i : table.trie[node].prefix)
+            fn(i);
+        if (!*path) {
+            for (int i : table.trie[node].exact)
+                fn(i);
+            return;
+        }
+        auto it = table.trie[node].children.find(*path++);
+        if (it == table.trie[node].children.end())
+            return;
+        node = it->second;
+    }
+}
+
 int add_dev_perms(const char *name, const char *attr,
                   mode_t perm, unsigned int uid, unsigned int gid,
                   unsigned short prefix,
                   unsigned short wildcard) {
-    struct perm_node *node = (perm_node*) calloc(1, sizeof(*node));
-    if (!node)
-        return -ENOMEM;
+    perms_ dp;
+    memset(&dp, 0, sizeof(dp));
 
-    node->dp.name = strdup(name);
-    if (!node->dp.name)
+    dp.name = strdup(name);
+    if (!dp.name)
         return -ENOMEM;
 
     if (attr) {
-        node->dp.attr = strdup(attr);
-        if (!node->dp.attr)
+        dp.attr = strdup(attr);
+        if (!dp.attr)
             return -ENOMEM;
     }
 
-    node->dp.perm = perm;
-    node->dp.uid = uid;
-    node->dp.gid = gid;
-    node->dp.prefix = prefix;
-    node->dp.wildcard = wildcard;
+    dp.perm = perm;
+    dp.uid = uid;
+    dp.gid = gid;
+    dp.prefix = prefix;
+    dp.wildcard = wildcard;
 
     if (attr)
-        list_add_tail(&sys_perms, &node->plist);
+        perm_table_add(&sys_perms, dp);
     else
-        list_add_tail(&dev_perms, &node->plist);
+        perm_table_add(&dev_perms, dp);
 
     return 0;
 }
 
-static int match_subsystem(struct perms_ *dp, const char *upath,
-                           const char *base, const char *subsystem)
+static void fixup_sys_perms(const char *upath, const char *subsystem)
 {
+    char buf[512];
     char class_path[512];
-    const char *name;
-
-    if (strstr(dp->name, subsystem) == NULL)
-        return -1;
-
-    name = basename(upath);
-    snprintf(class_path, sizeof(class_path), "/sys/%s/%s/%s", base, subsystem, name);
-
-    if (dp->prefix) {
-        if (strncmp(class_path, dp->name, strlen(dp->name)) == 0)
-            return 0;
-    } else {
-        if (strcmp(class_path, dp->name) == 0)
-            return 0;
+    char bus_path[512];
+    char sys_path[512];
+    const char *name = basename(upath);
+    std::vector<int> matches;
+
+    /* A rule applies if it names the device under /sys/class or /sys/bus
+     * by its subsystem, or names its path under /sys. upaths omit the
+     * "/sys" that paths in this table contain, so it is added back.
+     */
+    snprintf(class_path, sizeof(class_path), "/sys/class/%s/%s", subsystem, name);
+    snprintf(bus_path, sizeof(bus_path), "/sys/bus/%s/%s", subsystem, name);
+    snprintf(sys_path, sizeof(sys_path), "/sys%s", upath);
+
+    auto by_subsystem = [&](int i) {
+        if (strstr(sys_perms.rules[i].name, subsystem))
+            matches.push_back(i);
+    };
+    perm_table_match(sys_perms, class_path, by_subsystem);
+    perm_table_match(sys_perms, bus_path, by_subsystem);
+    perm_table_match(sys_perms, sys_path, [&](int i) { matches.push_back(i); });
+    for (int i : sys_perms.wildcards) {
+        const perms_ &dp = sys_perms.rules[i];
+        if ((strstr(dp.name, subsystem) &&
+                (!strcmp(class_path, dp.name) || !strcmp(bus_path, dp.name))) ||
+                fnmatch(dp.name + 4, upath, FNM_PATHNAME) == 0)
+            matches.push_back(i);
     }
 
-    return -1;
-}
+    /* Applied in the order they were written, as more than one can match */
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
 
-static void fixup_sys_perms(const char *upath, const char *subsystem)
-{
-    char buf[512];
-    struct listnode *node;
-    struct perms_ *dp;
+    for (int i : matches) {
+        const perms_ &dp = sys_perms.rules[i];
 
-    /* upaths omit the "/sys" that paths in this list
-     * contain, so we add 4 when comparing...
-     */
-    list_for_each(node, &sys_perms) {
-        dp = &(node_to_item(node, struct perm_node, plist))->dp;
-        if (match_subsystem(dp, upath, "class", subsystem) == 0) {
-            ; // matched
-        } else if (match_subsystem(dp, upath, "bus", subsystem) == 0) {
-            ; // matched
-        } else if (dp->prefix) {
-            if (strncmp(upath, dp->name + 4, strlen(dp->name + 4)))
-                continue;
-        } else if (dp->wildcard) {
-            if (fnmatch(dp->name + 4, upath, FNM_PATHNAME) != 0)
-                continue;
-        } else {
-            if (strcmp(upath, dp->name + 4))
-                continue;
-        }
-
-        if ((strlen(upath) + strlen(dp->attr) + 6) > sizeof(buf))
+        if ((strlen(upath) + strlen(dp.attr) + 6) > sizeof(buf))
             break;
 
-        snprintf(buf, sizeof(buf), "/sys%s/%s", upath, dp->attr);
-        INFO("fixup %s %d %d 0%o\n", buf, dp->uid, dp->gid, dp->perm);
-        chown(buf, dp->uid, dp->gid);
-        chmod(buf, dp->perm);
+        snprintf(buf, sizeof(buf), "/sys%s/%s", upath, dp.attr);
+        INFO("fixup %s %d %d 0%o\n", buf, dp.uid, dp.gid, dp.perm);
+        chown(buf, dp.uid, dp.gid);
+        chmod(buf, dp.perm);
     }
 
     // Now fixup SELinux file labels
@@ -197,58 +254,43 @@ static void fixup_sys_perms(const char *upath, const char *subsystem)
     }
 }
 
-static bool perm_path_matches(const char *path, struct perms_ *dp)
-{
-    if (dp->prefix) {
-        if (strncmp(path, dp->name, strlen(dp->name)) == 0)
-            return true;
-    } else if (dp->wildcard) {
-        if (fnmatch(dp->name, path, FNM_PATHNAME) == 0)
-            return true;
-    } else {
-        if (strcmp(path, dp->name) == 0)
-            return true;
-    }
-
-    return false;
-}
-
 static mode_t get_device_perm(const char *path, const char **links,
                 unsigned *uid, unsigned *gid)
 {
-    struct listnode *node;
-    struct perm_node *perm_node;
-    struct perms_ *dp;
-
-    /* search the perms list in reverse so that ueventd.$hardware can
+    /* the last rule to match wins, so that ueventd.$hardware can
      * override ueventd.rc
      */
-    list_for_each_reverse(node, &dev_perms) {
-        bool match = false;
+    int best = -1;
+    auto latest = [&](int i) {
+        if (i > best)
+            best = i;
+    };
 
-        perm_node = node_to_item(node, struct perm_node, plist);
-        dp = &perm_node->dp;
-
-        if (perm_path_matches(path, dp)) {
-            match = true;
-        } else {
-            if (links) {
-                int i;
-                for (i = 0; links[i]; i++) {
-                    if (perm_path_matches(links[i], dp)) {
-                        match = true;
-                        break;
-                    }
-                }
-            }
-        }
+    perm_table_match(dev_perms, path, latest);
+    if (links) {
+        for (int i = 0; links[i]; i++)
+            perm_table_match(dev_perms, links[i], latest);
+    }
 
+    for (auto it = dev_perms.wildcards.rbegin(); it != dev_perms.wildcards.rend(); ++it) {
+        if (*it < best)
+            break;
+        const char *name = dev_perms.rules[*it].name;
+        bool match = fnmatch(name, path, FNM_PATHNAME) == 0;
+        for (int i = 0; !match && links && links[i]; i++)
+            match = fnmatch(name, links[i], FNM_PATHNAME) == 0;
         if (match) {
-            *uid = dp->uid;
-            *gid = dp->gid;
-            return dp->perm;
+            best = *it;
+            break;
         }
     }
+
+    if (best >= 0) {
+        const perms_ &dp = dev_perms.rules[best];
+        *uid = dp.uid;
+        *gid = dp.gid;
+        return dp.perm;
+    }
     /* Default if nothing found. */
     *uid = 0;
     *gid = 0;
@@ -775,176 +817,78 @@ static void handle_device_event(struct uevent *uevent)
     }
 }
 
-static int load_firmware(int fw_fd, int loading_fd, int data_fd)
+static void handle_firmware_event(struct uevent *uevent)
 {
-    struct stat st;
-    long len_to_copy;
-    int ret = 0;
-
-    if(fstat(fw_fd, &st) < 0)
-        return -1;
-    len_to_copy = st.st_size;
-
-    write(loading_fd, "1", 1);  /* start transfer */
-
-    while (len_to_copy > 0) {
-        char buf[PAGE_SIZE];
-        ssize_t nr;
-
-        nr = read(fw_fd, buf, sizeof(buf));
-        if(!nr)
-            break;
-        if(nr < 0) {
-            ret = -1;
-            break;
-        }
-
-        len_to_copy -= nr;
-        while (nr > 0) {
-            ssize_t nw = 0;
-
-            nw = write(data_fd, buf + nw, nr);
-            if(nw <= 0) {
-                ret = -1;
-                goto out;
-            }
-            nr -= nw;
-        }
-    }
-
-out:
-    if(!ret)
-        write(loading_fd, "0", 1);  /* successful end of transfer */
-    else
-        write(loading_fd, "-1", 2); /* abort transfer */
+    if(strcmp(uevent->subsystem, "firmware"))
+        return;
 
-    return ret;
-}
+    if(strcmp(uevent->action, "add"))
+        return;
 
-static int is_booting(void)
-{
-    return access("/dev/.booting", F_OK) == 0;
+    firmware_request(uevent->path, uevent->firmware);
 }
 
-static void process_firmware_event(struct uevent *uevent)
+static void update_sehandle()
 {
-    char *root, *loading, *data;
-    int l, loading_fd, data_fd, fw_fd;
-    size_t i;
-    int booting = is_booting();
-
-    INFO("firmware: loading '%s' for '%s'\n",
-         uevent->firmware, uevent->path);
-
-    l = asprintf(&root, SYSFS_PREFIX"%s/", uevent->path);
-    if (l == -1)
-        return;
-
-    l = asprintf(&loading, "%sloading", root);
-    if (l == -1)
-        goto root_free_out;
-
-    l = asprintf(&data, "%sdata", root);
-    if (l == -1)
-        goto loading_free_out;
-
-    loading_fd = open(loading, O_WRONLY|O_CLOEXEC);
-    if(loading_fd < 0)
-        goto data_free_out;
-
-    data_fd = open(data, O_WRONLY|O_CLOEXEC);
-    if(data_fd < 0)
-        goto loading_close_out;
-
-try_loading_again:
-    for (i = 0; i < ARRAY_SIZE(firmware_dirs); i++) {
-        char *file = NULL;
-        l = asprintf(&file, "%s/%s", firmware_dirs[i], uevent->firmware);
-        if (l == -1)
-            goto data_free_out;
-        fw_fd = open(file, O_RDONLY|O_CLOEXEC);
-        free(file);
-        if (fw_fd >= 0) {
-            if(!load_firmware(fw_fd, loading_fd, data_fd))
-                INFO("firmware: copy success { '%s', '%s' }\n", root, uevent->firmware);
-            else
-                INFO("firmware: copy failure { '%s', '%s' }\n", root, uevent->firmware);
-            break;
-        }
-    }
-    if (fw_fd < 0) {
-        if (booting) {
-            /* If we're not fully booted, we may be missing
-             * filesystems needed for firmware, wait and retry.
-             */
-            usleep(100000);
-            booting = is_booting();
-            goto try_loading_again;
+    if (sehandle && selinux_status_updated() > 0) {
+        struct selabel_handle *sehandle2;
+        sehandle2 = selinux_android_file_context_handle();
+        if (sehandle2) {
+            selabel_close(sehandle);
+            sehandle = sehandle2;
         }
-        INFO("firmware: could not open '%s': %s\n", uevent->firmware, strerror(errno));
-        write(loading_fd, "-1", 2);
-        goto data_close_out;
     }
-
-    close(fw_fd);
-data_close_out:
-    close(data_fd);
-loading_close_out:
-    close(loading_fd);
-data_free_out:
-    free(data);
-loading_free_out:
-    free(loading);
-root_free_out:
-    free(root);
 }
 
-static void handle_firmware_event(struct uevent *uevent)
-{
-    pid_t pid;
-
-    if(strcmp(uevent->subsystem, "firmware"))
-        return;
-
-    if(strcmp(uevent->action, "add"))
-        return;
+#define UEVENT_MSG_LEN  2048
+#define UEVENT_SLOT_LEN (UEVENT_MSG_LEN+2)
 
-    /* we fork, to avoid making large memory allocations in init proper */
-    pid = fork();
-    if (!pid) {
-        process_firmware_event(uevent);
-        _exit(EXIT_SUCCESS);
-    } else if (pid < 0) {
-        ERROR("could not fork to process firmware event: %s\n", strerror(errno));
+/* Receives the pending messages, up to UEVENT_RECV_BATCH_MAX, with one
+ * system call into msgs. Returns how many were received, with the
+ * length of each in lengths, -1 for one that must be dropped. Each
+ * message is followed by two '\0's, as parse_event() expects. */
+static int recv_uevents(char (*msgs)[UEVENT_SLOT_LEN], ssize_t *lengths)
+{
+    uid_t uids[UEVENT_RECV_BATCH_MAX];
+    int count = uevent_kernel_recv_batch(device_fd, msgs, UEVENT_SLOT_LEN,
+                                         UEVENT_RECV_BATCH_MAX, true,
+                                         lengths, uids);
+
+    for (int i = 0; i < count; i++) {
+        ssize_t n = lengths[i];
+        if (n >= UEVENT_MSG_LEN) {  /* overflow -- discard */
+            lengths[i] = -1;
+        } else if (n >= 0) {
+            msgs[i][n] = '\0';
+            msgs[i][n+1] = '\0';
+        }
     }
+    return count;
 }
 
-#define UEVENT_MSG_LEN  2048
 void handle_device_fd()
 {
-    char msg[UEVENT_MSG_LEN+2];
-    int n;
-    while ((n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN)) > 0) {
-        if(n >= UEVENT_MSG_LEN)   /* overflow -- discard */
-            continue;
-
-        msg[n] = '\0';
-        msg[n+1] = '\0';
-
-        struct uevent uevent;
-        parse_event(msg, &uevent);
-
-        if (sehandle && selinux_status_updated() > 0) {
-            struct selabel_handle *sehandle2;
-            sehandle2 = selinux_android_file_context_handle();
-            if (sehandle2) {
-                selabel_close(sehandle);
-                sehandle = sehandle2;
+    static char msgs[UEVENT_RECV_BATCH_MAX][UEVENT_SLOT_LEN];
+    ssize_t lengths[UEVENT_RECV_BATCH_MAX];
+    struct uevent uevents[UEVENT_RECV_BATCH_MAX];
+    int count;
+
+    /* A batch is parsed before any of it is handled, and handled in the
+     * order it came in, which keeps the events of each device in order. */
+    while ((count = recv_uevents(msgs, lengths)) > 0) {
+        int parsed = 0;
+        for (int i = 0; i < count; i++) {
+            if (lengths[i] >= 0) {
+                parse_event(msgs[i], &uevents[parsed++]);
             }
         }
 
-        handle_device_event(&uevent);
-        handle_firmware_event(&uevent);
+        update_sehandle();
+
+        for (int i = 0; i < parsed; i++) {
+            handle_device_event(&uevents[i]);
+            handle_firmware_event(&uevents[i]);
+        }
     }
 }
 
@@ -954,9 +898,28 @@ void handle_device_fd()
 **
 ** We drain any pending events from the netlink socket every time
 ** we poke another uevent file to make sure we don't overrun the
-** socket's buffer.
+** socket's buffer. The events are only collected during the walk,
+** and handled afterwards by several processes at once.
 */
 
+#define COLDBOOT_WORKERS_MAX 4
+
+static std::vector<std::string> coldboot_events;
+
+static void collect_coldboot_events()
+{
+    static char msgs[UEVENT_RECV_BATCH_MAX][UEVENT_SLOT_LEN];
+    ssize_t lengths[UEVENT_RECV_BATCH_MAX];
+    int count;
+    while ((count = recv_uevents(msgs, lengths)) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (lengths[i] >= 0) {
+                coldboot_events.push_back(std::string(msgs[i], lengths[i] + 2));
+            }
+        }
+    }
+}
+
 static void do_coldboot(DIR *d)
 {
     struct dirent *de;
@@ -968,7 +931,7 @@ static void do_coldboot(DIR *d)
     if(fd >= 0) {
         write(fd, "add\n", 4);
         close(fd);
-        handle_device_fd();
+        collect_coldboot_events();
     }
 
     while((de = readdir(d))) {
@@ -1000,6 +963,77 @@ static void coldboot(const char *path)
     }
 }
 
+/* Which worker handles events for path, all of a device's go to the same. */
+static unsigned coldboot_worker(const char *path, unsigned workers)
+{
+    unsigned hash = 5381;
+    while (*path)
+        hash = hash * 33 + (unsigned char) *path++;
+    return hash % workers;
+}
+
+static void handle_coldboot_events()
+{
+    std::vector<struct uevent> uevents(coldboot_events.size());
+    for (size_t i = 0; i < coldboot_events.size(); i++) {
+        parse_event(coldboot_events[i].c_str(), &uevents[i]);
+    }
+
+    update_sehandle();
+
+    /* Platform devices first, block and character devices look them up
+     * for their symlinks. Firmware is loaded by its own threads. */
+    for (struct uevent& uevent : uevents) {
+        if (!strncmp(uevent.subsystem, "platform", 8)) {
+            handle_device_event(&uevent);
+        }
+        handle_firmware_event(&uevent);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned workers = (cpus < 1) ? 1 :
+        (cpus > COLDBOOT_WORKERS_MAX) ? COLDBOOT_WORKERS_MAX : cpus;
+
+    /* Everything else is independent of any other device, so each worker
+     * gets its share of the devices with the events in their original
+     * order. The children exit when done, whatever they change in our
+     * state they only changed in their own copy. ueventd ignores SIGCHLD,
+     * so they are waited for by each holding the write end of a pipe. */
+    int done[2] = { -1, -1 };
+    if (workers > 1 && pipe2(done, O_CLOEXEC) == -1) {
+        ERROR("could not create coldboot pipe: %s\n", strerror(errno));
+        workers = 1;
+    }
+    for (unsigned w = 0; w < workers; w++) {
+        pid_t pid = (workers > 1) ? fork() : -1;
+        if (pid > 0) {
+            continue;
+        }
+        if (pid < 0 && workers > 1) {
+            ERROR("could not fork coldboot worker: %s\n", strerror(errno));
+        }
+        for (struct uevent& uevent : uevents) {
+            if (strncmp(uevent.subsystem, "platform", 8) &&
+                    coldboot_worker(uevent.path, workers) == w) {
+                handle_device_event(&uevent);
+            }
+        }
+        if (pid == 0) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (done[0] != -1) {
+        close(done[1]);
+        char c;
+        while (TEMP_FAILURE_RETRY(read(done[0], &c, 1)) > 0) {
+        }
+        close(done[0]);
+    }
+
+    std::vector<std::string>().swap(coldboot_events);
+}
+
 void device_init() {
     sehandle = NULL;
     if (is_selinux_enabled() > 0) {
@@ -1007,8 +1041,9 @@ void device_init() {
         selinux_status_open(true);
     }
 
-    /* is 256K enough? udev uses 16MB! */
-    device_fd = uevent_open_socket(256*1024, true);
+    /* Large enough for the bursts of a hub full of devices or of a batch
+     * of modules being loaded; udev uses 16MB. */
+    device_fd = uevent_open_socket(UEVENT_SOCKET_BUF, true);
     if (device_fd == -1) {
         return;
     }
@@ -1023,6 +1058,7 @@ void device_init() {
     coldboot("/sys/class");
     coldboot("/sys/block");
     coldboot("/sys/devices");
+    handle_coldboot_events();
     close(open(COLDBOOT_DONE, O_WRONLY|O_CREAT|O_CLOEXEC, 0000));
     NOTICE("Coldboot took %.2fs.\n", t.duration());
 }
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exec_helpers.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "log.h"
+#include "util.h"
+
+// Each helper returns false, before touching anything, if it can't do
+// exactly what the real tool would with these arguments.
+struct exec_helper {
+    const char* name;
+    bool (*run)(int argc, char** argv, int* status);
+};
+
+static bool parse_octal(const char* s, mode_t* mode) {
+    if (*s == '\0') {
+        return false;
+    }
+    mode_t m = 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '7') {
+            return false;
+        }
+        m = (m << 3) | (*s - '0');
+    }
+    *mode = m & 07777;
+    return true;
+}
+
+// chmod MODE FILE... with an octal MODE, following symlinks like toolbox.
+static bool run_chmod(int argc, char** argv, int* status) {
+    mode_t mode;
+    if (argc < 3 || argv[1][0] == '-' || !parse_octal(argv[1], &mode)) {
+        return false;
+    }
+    *status = 0;
+    for (int i = 2; i < argc; i++) {
+        if (chmod(argv[i], mode) == -1) {
+            ERROR("chmod: %s: %s\n", argv[i], strerror(errno));
+            *status = 1;
+        }
+    }
+    return true;
+}
+
+// chown OWNER[:GROUP] FILE...
+static bool run_chown(int argc, char** argv, int* status) {
+    if (argc < 3 || argv[1][0] == '-') {
+        return false;
+    }
+    std::string owner(argv[1]);
+    std::string group;
+    size_t colon = owner.find_first_of(":.");
+    if (colon != std::string::npos) {
+        group = owner.substr(colon + 1);
+        owner.erase(colon);
+    }
+    uid_t uid = decode_uid(owner.c_str());
+    gid_t gid = group.empty() ? -1 : decode_uid(group.c_str());
+    if (uid == (uid_t) -1 || (!group.empty() && gid == (gid_t) -1)) {
+        return false;
+    }
+    *status = 0;
+    for (int i = 2; i < argc; i++) {
+        if (chown(argv[i], uid, gid) == -1) {
+            ERROR("chown: %s: %s\n", argv[i], strerror(errno));
+            *status = 1;
+        }
+    }
+    return true;
+}
+
+// restorecon [-R] FILE...
+static bool run_restorecon(int argc, char** argv, int* status) {
+    bool recursive = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-R") || !strcmp(argv[i], "-r")) {
+            recursive = true;
+        } else {
+            return false;
+        }
+    }
+    if (i == argc) {
+        return false;
+    }
+    *status = 0;
+    for (; i < argc; i++) {
+        int rc = recursive ? restorecon_recursive(argv[i]) : restorecon(argv[i]);
+        if (rc < 0) {
+            ERROR("restorecon: %s: %s\n", argv[i], strerror(errno));
+            *status = 1;
+        }
+    }
+    return true;
+}
+
+static const exec_helper exec_helpers[] = {
+    { "chmod",      run_chmod },
+    { "chown",      run_chown },
+    { "restorecon", run_restorecon },
+};
+
+static bool is_toolbox(const char* name) {
+    return !strcmp(name, "toolbox") || !strcmp(name, "toybox");
+}
+
+static const char* basename_of(const char* path) {
+    const char* base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+// True if path is a symlink to the multi-call binary itself, rather than
+// some other implementation of the tool that may behave differently.
+static bool is_toolbox_link(const char* path) {
+    char target[PATH_MAX];
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) {
+        return false;
+    }
+    target[len] = '\0';
+    return is_toolbox(basename_of(target));
+}
+
+bool exec_helper_run(char** args, int* status) {
+    // Either /system/bin/chmod ... or /system/bin/toolbox chmod ...
+    bool multicall = is_toolbox(basename_of(args[0]));
+    if (multicall) {
+        if (!args[1]) {
+            return false;
+        }
+        args++;
+    }
+    const char* base = basename_of(args[0]);
+
+    for (size_t i = 0; i < ARRAY_SIZE(exec_helpers); i++) {
+        if (strcmp(base, exec_helpers[i].name)) {
+            continue;
+        }
+        if (!multicall && !is_toolbox_link(args[0])) {
+            return false;
+        }
+        int argc = 0;
+        while (args[argc]) {
+            argc++;
+        }
+        return exec_helpers[i].run(argc, args, status);
+    }
+    return false;
+}
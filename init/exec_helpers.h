@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_EXEC_HELPERS_H_
+#define _INIT_EXEC_HELPERS_H_
+
+// A few of the tools that boot scripts exec, toolbox's chmod, chown and
+// restorecon, are simple enough for init to do itself. When args names
+// one of them, as the toolbox or toybox symlink it is on the device, and
+// uses only the options init understands, this does the work and returns
+// true with the tool's exit status in status. Otherwise it returns false
+// and the program must be exec'ed as usual.
+//
+// Only for the child init forked for a oneshot service, after its
+// credentials have been set up: it saves that child the exec and the
+// dynamic linking of the tool.
+bool exec_helper_run(char** args, int* status);
+
+#endif
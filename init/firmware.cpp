@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "firmware.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "log.h"
+#include "util.h"
+
+#define SYSFS_PREFIX    "/sys"
+#define BOOTING_FILE    "/dev/.booting"
+
+#define FIRMWARE_THREADS 4
+#define FIRMWARE_INDEX_DEPTH 4    // subdirectories followed below each dir
+#define FIRMWARE_RECHECK_MS 1000  // in case a change slipped past the watches
+
+static const char *firmware_dirs[] = { "/etc/firmware",
+                                       "/vendor/firmware",
+                                       "/firmware/image" };
+
+struct firmware_work {
+    std::string root;      // the device's directory in sysfs, with a '/'
+    std::string firmware;
+};
+
+// All protected by firmware_lock.
+static pthread_mutex_t firmware_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t firmware_cond = PTHREAD_COND_INITIALIZER;
+static std::deque<firmware_work> firmware_queue;
+static std::vector<firmware_work> firmware_waiting;  // not there yet
+static bool firmware_started;
+
+// Where each image under firmware_dirs is, by the name the kernel asks
+// for, so that a request is a single open. Rebuilt whenever the watcher
+// sees the directories change.
+static std::map<std::string, std::string> firmware_index;
+static bool firmware_index_stale = true;
+
+static int is_booting(void)
+{
+    return access(BOOTING_FILE, F_OK) == 0;
+}
+
+static void index_dir(const std::string& dir, const std::string& prefix, int depth)
+{
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        std::string name = prefix + de->d_name;
+        std::string path = dir + "/" + de->d_name;
+        if (de->d_type == DT_DIR) {
+            if (depth > 0) {
+                index_dir(path, name + "/", depth - 1);
+            }
+        } else if (firmware_index.find(name) == firmware_index.end()) {
+            // The first directory listed wins, as it did for the lookup.
+            firmware_index[name] = path;
+        }
+    }
+    closedir(d);
+}
+
+// Called with firmware_lock held.
+static void refresh_index()
+{
+    if (!firmware_index_stale) {
+        return;
+    }
+    firmware_index.clear();
+    for (size_t i = 0; i < ARRAY_SIZE(firmware_dirs); i++) {
+        index_dir(firmware_dirs[i], "", FIRMWARE_INDEX_DEPTH);
+    }
+    firmware_index_stale = false;
+}
+
+static int open_firmware(const std::string& firmware)
+{
+    pthread_mutex_lock(&firmware_lock);
+    refresh_index();
+    auto it = firmware_index.find(firmware);
+    std::string path = (it == firmware_index.end()) ? "" : it->second;
+    pthread_mutex_unlock(&firmware_lock);
+
+    if (!path.empty()) {
+        int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd >= 0) {
+            return fd;
+        }
+    }
+
+    // The index is only a shortcut, it may not have caught up yet.
+    for (size_t i = 0; i < ARRAY_SIZE(firmware_dirs); i++) {
+        std::string file = std::string(firmware_dirs[i]) + "/" + firmware;
+        int fd = open(file.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd >= 0) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+static int load_firmware(int fw_fd, int loading_fd, int data_fd)
+{
+    struct stat st;
+    off_t offset = 0;
+    int ret = 0;
+
+    if(fstat(fw_fd, &st) < 0)
+        return -1;
+
+    posix_fadvise(fw_fd, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+
+    write(loading_fd, "1", 1);  /* start transfer */
+
+    // Let the kernel copy it, without the image passing through here.
+    while (offset < st.st_size) {
+        ssize_t nw = sendfile(data_fd, fw_fd, &offset, st.st_size - offset);
+        if (nw <= 0) {
+            break;
+        }
+    }
+
+    // Older kernels can't sendfile to sysfs, copy the rest.
+    if (offset < st.st_size && lseek(fw_fd, offset, SEEK_SET) == offset) {
+        static const size_t chunk = 64 * 1024;
+        std::vector<char> buf(chunk);
+        while (offset < st.st_size) {
+            ssize_t nr = TEMP_FAILURE_RETRY(read(fw_fd, &buf[0], chunk));
+            if (nr <= 0) {
+                break;
+            }
+            ssize_t done = 0;
+            while (done < nr) {
+                ssize_t nw = TEMP_FAILURE_RETRY(write(data_fd, &buf[done], nr - done));
+                if (nw <= 0) {
+                    ret = -1;
+                    goto out;
+                }
+                done += nw;
+            }
+            offset += nr;
+        }
+    }
+    if (offset < st.st_size) {
+        ret = -1;
+    }
+
+out:
+    if(!ret)
+        write(loading_fd, "0", 1);  /* successful end of transfer */
+    else
+        write(loading_fd, "-1", 2); /* abort transfer */
+
+    return ret;
+}
+
+// Returns false if the image isn't there yet and the request should wait.
+static bool process_firmware_work(const firmware_work& work, bool booting)
+{
+    std::string loading = work.root + "loading";
+    std::string data = work.root + "data";
+
+    int loading_fd = open(loading.c_str(), O_WRONLY|O_CLOEXEC);
+    if (loading_fd < 0) {
+        // The device went away, or the kernel gave up on it.
+        return true;
+    }
+
+    int fw_fd = open_firmware(work.firmware);
+    if (fw_fd < 0) {
+        if (booting) {
+            close(loading_fd);
+            return false;
+        }
+        INFO("firmware: could not open '%s': %s\n", work.firmware.c_str(), strerror(errno));
+        write(loading_fd, "-1", 2);
+        close(loading_fd);
+        return true;
+    }
+
+    int data_fd = open(data.c_str(), O_WRONLY|O_CLOEXEC);
+    if (data_fd >= 0) {
+        if (!load_firmware(fw_fd, loading_fd, data_fd))
+            INFO("firmware: copy success { '%s', '%s' }\n", work.root.c_str(), work.firmware.c_str());
+        else
+            INFO("firmware: copy failure { '%s', '%s' }\n", work.root.c_str(), work.firmware.c_str());
+        close(data_fd);
+    }
+    close(fw_fd);
+    close(loading_fd);
+    return true;
+}
+
+static void* firmware_thread(void*)
+{
+    pthread_mutex_lock(&firmware_lock);
+    while (true) {
+        while (firmware_queue.empty()) {
+            pthread_cond_wait(&firmware_cond, &firmware_lock);
+        }
+        firmware_work work = firmware_queue.front();
+        firmware_queue.pop_front();
+        pthread_mutex_unlock(&firmware_lock);
+
+        bool done = process_firmware_work(work, is_booting());
+
+        pthread_mutex_lock(&firmware_lock);
+        if (!done) {
+            firmware_waiting.push_back(work);
+        }
+    }
+    return NULL;
+}
+
+static void add_watches(int inotify_fd)
+{
+    // Re-adding a watch just updates it, this also picks up directories
+    // that only appeared with a new mount.
+    inotify_add_watch(inotify_fd, "/dev", IN_DELETE);
+    for (size_t i = 0; i < ARRAY_SIZE(firmware_dirs); i++) {
+        inotify_add_watch(inotify_fd, firmware_dirs[i],
+                          IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE);
+    }
+}
+
+// Waits for anything that may let a waiting request through: a firmware
+// directory changing, a filesystem being mounted, or the end of boot. The
+// waiting requests are also retried every FIRMWARE_RECHECK_MS regardless.
+static void* firmware_watch_thread(void*)
+{
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int mounts_fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+    if (inotify_fd >= 0) {
+        add_watches(inotify_fd);
+    }
+
+    while (true) {
+        struct pollfd fds[2];
+        int n = 0;
+        if (inotify_fd >= 0) {
+            fds[n].fd = inotify_fd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            n++;
+        }
+        if (mounts_fd >= 0) {
+            fds[n].fd = mounts_fd;
+            fds[n].events = POLLPRI;
+            fds[n].revents = 0;
+            n++;
+        }
+        int nr = poll(fds, n, FIRMWARE_RECHECK_MS);
+
+        for (int i = 0; nr > 0 && i < n; i++) {
+            if (fds[i].fd == inotify_fd && (fds[i].revents & POLLIN)) {
+                char buf[4096];
+                while (read(inotify_fd, buf, sizeof(buf)) > 0) {
+                }
+            } else if (fds[i].fd == mounts_fd && fds[i].revents) {
+                // The mount table changed, reading it clears the event.
+                char buf[4096];
+                lseek(mounts_fd, 0, SEEK_SET);
+                while (read(mounts_fd, buf, sizeof(buf)) > 0) {
+                }
+                if (inotify_fd >= 0) {
+                    add_watches(inotify_fd);
+                }
+            }
+        }
+
+        pthread_mutex_lock(&firmware_lock);
+        if (nr > 0) {
+            firmware_index_stale = true;
+        }
+        if (!firmware_waiting.empty()) {
+            firmware_queue.insert(firmware_queue.end(),
+                                  firmware_waiting.begin(), firmware_waiting.end());
+            firmware_waiting.clear();
+            pthread_cond_broadcast(&firmware_cond);
+        }
+        pthread_mutex_unlock(&firmware_lock);
+    }
+    return NULL;
+}
+
+static bool start_thread(void* (*fn)(void*))
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, fn, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        ERROR("could not start firmware thread: %s\n", strerror(rc));
+        return false;
+    }
+    return true;
+}
+
+static bool start_firmware_threads()
+{
+    static bool watching = false;
+    if (!watching && !(watching = start_thread(firmware_watch_thread))) {
+        return false;
+    }
+    size_t started = 0;
+    while (started < FIRMWARE_THREADS && start_thread(firmware_thread)) {
+        started++;
+    }
+    return started != 0;
+}
+
+void firmware_request(const char* devpath, const char* firmware)
+{
+    INFO("firmware: loading '%s' for '%s'\n", firmware, devpath);
+
+    firmware_work work = { std::string(SYSFS_PREFIX) + devpath + "/", firmware };
+
+    if (!firmware_started) {
+        if (!start_firmware_threads()) {
+            process_firmware_work(work, false);
+            return;
+        }
+        firmware_started = true;
+    }
+
+    pthread_mutex_lock(&firmware_lock);
+    firmware_queue.push_back(work);
+    pthread_cond_signal(&firmware_cond);
+    pthread_mutex_unlock(&firmware_lock);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_FIRMWARE_H_
+#define _INIT_FIRMWARE_H_
+
+// Answer the kernel's request for firmware on behalf of the device at
+// devpath. Returns at once, the image is copied by one of ueventd's
+// firmware threads. While the device is booting a request for an image
+// that is not there yet waits for the firmware directories to change, or
+// for a filesystem to be mounted, instead of failing.
+void firmware_request(const char* devpath, const char* firmware);
+
+#endif
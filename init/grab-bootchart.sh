@@ -13,9 +13,12 @@ TARBALL=bootchart.tgz
 
 FILES="header proc_stat.log proc_ps.log proc_diskstats.log kernel_pacct"
 
-for f in $FILES; do
+# init only writes the header, bootchart.bin and, without taskstats,
+# kernel_pacct. bootchart_convert makes the rest from bootchart.bin.
+for f in header bootchart.bin kernel_pacct; do
     adb "${@}" pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
 done
+bootchart_convert $TMPDIR/bootchart.bin $TMPDIR || exit 1
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 bootchart ${TMPDIR}/${TARBALL}
 gnome-open ${TARBALL%.tgz}.png
@@ -44,21 +44,29 @@
 #include <base/file.h>
 #include <base/stringprintf.h>
 #include <cutils/android_reboot.h>
+#include <cutils/daemon_trace.h>
 #include <cutils/fs.h>
 #include <cutils/iosched_policy.h>
 #include <cutils/list.h>
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
 
+#include <functional>
 #include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
 
+#include "boot_trace.h"
 #include "devices.h"
+#include "exec_helpers.h"
 #include "init.h"
 #include "log.h"
 #include "property_service.h"
-#include "bootchart.h"
+#include "rc_cache.h"
 #include "signal_handler.h"
 #include "keychords.h"
+#include "parallel.h"
 #include "init_parser.h"
 #include "util.h"
 #include "ueventd.h"
@@ -76,12 +84,23 @@ static struct command *cur_command = NULL;
 
 static int have_console;
 static char console_name[PROP_VALUE_MAX] = "/dev/console";
-static time_t process_needs_restart;
+
+// Services waiting to restart, soonest first. An entry goes stale when its
+// service is started or stopped some other way, stale entries are dropped
+// as they reach the top.
+typedef std::pair<time_t, struct service*> pending_restart;
+static std::priority_queue<pending_restart, std::vector<pending_restart>,
+                           std::greater<pending_restart>> pending_restarts;
 
 static const char *ENV[32];
 
 bool waiting_for_exec = false;
 
+// Systrace events are only emitted once tracing has been turned on: the
+// first of them opens the trace_marker, which isn't there before debugfs is
+// mounted, and a failed open is never retried.
+bool daemon_tracing = false;
+
 static int epoll_fd = -1;
 
 void register_epoll_handler(int fd, void (*fn)()) {
@@ -219,8 +238,12 @@ void service_start(struct service *svc, const char *dynamic_args)
         return;
     }
 
+    // A oneshot whose exec wouldn't change its domain may be run by init
+    // itself instead, see exec_helpers.h.
+    bool same_domain = true;
     char* scon = NULL;
     if (is_selinux_enabled() > 0) {
+        same_domain = false;
         if (svc->seclabel) {
             scon = strdup(svc->seclabel);
             if (!scon) {
@@ -246,6 +269,7 @@ void service_start(struct service *svc, const char *dynamic_args)
 
             rc = security_compute_create(mycon, fcon, string_to_security_class("process"), &scon);
             if (rc == 0 && !strcmp(scon, mycon)) {
+                same_domain = true;
                 ERROR("Warning!  Service %s needs a SELinux domain defined; please fix!\n", svc->name);
             }
             freecon(mycon);
@@ -352,6 +376,11 @@ void service_start(struct service *svc, const char *dynamic_args)
         }
 
         if (!dynamic_args) {
+            int status;
+            if ((svc->flags & SVC_ONESHOT) && same_domain &&
+                    exec_helper_run(svc->args, &status)) {
+                _exit(status);
+            }
             if (execve(svc->args[0], (char**) svc->args, (char**) ENV) < 0) {
                 ERROR("cannot execve('%s'): %s\n", svc->args[0], strerror(errno));
             }
@@ -380,13 +409,14 @@ void service_start(struct service *svc, const char *dynamic_args)
 
     if (pid < 0) {
         ERROR("failed to start '%s'\n", svc->name);
-        svc->pid = 0;
+        service_set_pid(svc, 0);
         return;
     }
 
     svc->time_started = gettime();
-    svc->pid = pid;
+    service_set_pid(svc, pid);
     svc->flags |= SVC_RUNNING;
+    boot_trace_service_start(svc->name, pid);
 
     if ((svc->flags & SVC_EXEC) != 0) {
         INFO("SVC_EXEC pid %d (uid %d gid %d+%zu context %s) started; waiting...\n",
@@ -452,29 +482,53 @@ void property_changed(const char *name, const char *value)
 {
     if (property_triggers_enabled)
         queue_property_triggers(name, value);
+    if (!strcmp(name, "sys.boot_completed") && !strcmp(value, "1"))
+        boot_trace_finish();
+    if (!strcmp(name, "debug.atrace.tags.enableflags")) {
+        daemon_tracing = true;
+        daemon_trace_poll();
+    }
 }
 
-static void restart_service_if_needed(struct service *svc)
+static time_t next_start_time(const struct service *svc)
 {
-    time_t next_start_time = svc->time_started + 5;
+    return svc->time_started + 5;
+}
 
-    if (next_start_time <= gettime()) {
-        svc->flags &= (~SVC_RESTARTING);
-        service_start(svc, NULL);
-        return;
-    }
+void service_schedule_restart(struct service *svc)
+{
+    pending_restarts.push(pending_restart(next_start_time(svc), svc));
+}
 
-    if ((next_start_time < process_needs_restart) ||
-        (process_needs_restart == 0)) {
-        process_needs_restart = next_start_time;
-    }
+static bool is_pending(const pending_restart& entry)
+{
+    return (entry.second->flags & SVC_RESTARTING) &&
+           next_start_time(entry.second) == entry.first;
 }
 
 static void restart_processes()
 {
-    process_needs_restart = 0;
-    service_for_each_flags(SVC_RESTARTING,
-                           restart_service_if_needed);
+    time_t now = gettime();
+    while (!pending_restarts.empty()) {
+        pending_restart entry = pending_restarts.top();
+        if (is_pending(entry) && entry.first > now) {
+            break;
+        }
+        pending_restarts.pop();
+        if (is_pending(entry)) {
+            service_start(entry.second, NULL);
+        }
+    }
+}
+
+// How long epoll_wait may sleep before a service is due, or -1.
+static int restart_timeout_ms()
+{
+    if (pending_restarts.empty()) {
+        return -1;
+    }
+    time_t delay = pending_restarts.top().first - gettime();
+    return (delay < 0) ? 0 : delay * 1000;
 }
 
 static void msg_start(const char *name)
@@ -581,60 +635,103 @@ void build_triggers_string(char *name_str, int length, struct action *cur_action
     }
 }
 
-void execute_one_command() {
-    Timer t;
+void log_command(struct command *cmd, const char *action_name, int result, double duration) {
+    if (klog_get_level() < KLOG_INFO_LEVEL) {
+        return;
+    }
 
     char cmd_str[256] = "";
+    for (int i = 0; i < cmd->nargs; i++) {
+        strlcat(cmd_str, cmd->args[i], sizeof(cmd_str));
+        if (i < cmd->nargs - 1) {
+            strlcat(cmd_str, " ", sizeof(cmd_str));
+        }
+    }
+    char source[256];
+    if (cmd->filename) {
+        snprintf(source, sizeof(source), " (%s:%d)", cmd->filename, cmd->line);
+    } else {
+        *source = '\0';
+    }
+    INFO("Command '%s%s' action=%s%s returned %d took %.2fs\n",
+         cmd->parallel ? "parallel " : "", cmd_str, action_name, source, result, duration);
+}
+
+// A command that waits for the parallel commands before it to finish.
+static bool waiting_for_parallel = false;
+
+// cur_action has an open slice in the boot trace.
+static bool tracing_action = false;
+
+void execute_one_command() {
     char name_str[256] = "";
 
-    if (!cur_action || !cur_command || is_last_command(cur_action, cur_command)) {
-        cur_action = action_remove_queue_head();
-        cur_command = NULL;
-        if (!cur_action) {
+    if (waiting_for_parallel) {
+        if (parallel_commands_pending()) {
             return;
         }
-
-        build_triggers_string(name_str, sizeof(name_str), cur_action);
-
-        INFO("processing action %p (%s)\n", cur_action, name_str);
-        cur_command = get_first_command(cur_action);
+        waiting_for_parallel = false;
     } else {
-        cur_command = get_next_command(cur_action, cur_command);
-    }
+        if (!cur_action || !cur_command || is_last_command(cur_action, cur_command)) {
+            if (tracing_action) {
+                boot_trace_end();
+                tracing_action = false;
+            }
+            cur_action = action_remove_queue_head();
+            cur_command = NULL;
+            if (!cur_action) {
+                return;
+            }
 
-    if (!cur_command) {
-        return;
-    }
+            build_triggers_string(name_str, sizeof(name_str), cur_action);
 
-    int result = cur_command->func(cur_command->nargs, cur_command->args);
-    if (klog_get_level() >= KLOG_INFO_LEVEL) {
-        for (int i = 0; i < cur_command->nargs; i++) {
-            strlcat(cmd_str, cur_command->args[i], sizeof(cmd_str));
-            if (i < cur_command->nargs - 1) {
-                strlcat(cmd_str, " ", sizeof(cmd_str));
+            INFO("processing action %p (%s)\n", cur_action, name_str);
+            cur_command = get_first_command(cur_action);
+            if (cur_command) {
+                boot_trace_begin(android::base::StringPrintf("action %s", name_str).c_str());
+                tracing_action = true;
             }
-        }
-        char source[256];
-        if (cur_command->filename) {
-            snprintf(source, sizeof(source), " (%s:%d)", cur_command->filename, cur_command->line);
         } else {
-            *source = '\0';
+            cur_command = get_next_command(cur_action, cur_command);
+        }
+
+        if (!cur_command) {
+            return;
+        }
+
+        if (cur_command->parallel) {
+            parallel_command_queue(cur_command, name_str);
+            return;
+        }
+
+        // Everything else keeps to the order it was written in
+        if (parallel_commands_pending()) {
+            waiting_for_parallel = true;
+            return;
         }
-        INFO("Command '%s' action=%s%s returned %d took %.2fs\n",
-             cmd_str, cur_action ? name_str : "", source, result, t.duration());
     }
+
+    Timer t;
+    boot_trace_command_begin(cur_command);
+    bool traced = daemon_tracing && daemon_trace_begin(cur_command->args[0]);
+    int result = cur_command->func(cur_command->nargs, cur_command->args);
+    daemon_trace_end(traced);
+    boot_trace_end();
+    log_command(cur_command, cur_action ? name_str : "", result, t.duration());
 }
 
 static int wait_for_coldboot_done_action(int nargs, char **args) {
     Timer t;
 
     NOTICE("Waiting for %s...\n", COLDBOOT_DONE);
+    boot_trace_begin("wait for " COLDBOOT_DONE);
     // Any longer than 1s is an unreasonable length of time to delay booting.
     // If you're hitting this timeout, check that you didn't make your
     // sepolicy regular expressions too expensive (http://b/19899875).
     if (wait_for_file(COLDBOOT_DONE, 5)) {
         ERROR("Timed out waiting for %s\n", COLDBOOT_DONE);
     }
+    boot_trace_end();
 
     NOTICE("Waiting for %s took %.2fs.\n", COLDBOOT_DONE, t.duration());
     return 0;
@@ -1036,6 +1133,8 @@ int main(int argc, char** argv) {
         // Indicate that booting is in progress to background fw loaders, etc.
         close(open("/dev/.booting", O_WRONLY | O_CREAT | O_CLOEXEC, 0000));
 
+        boot_trace_init();
+
         property_init();
 
         // If arguments are passed both on the command line and in DT,
@@ -1086,6 +1185,7 @@ int main(int argc, char** argv) {
     property_load_boot_defaults();
     start_property_service();
 
+    rc_cache_load(RC_CACHE_PATH);
     init_parse_config_file("/init.rc");
 
     action_for_each_trigger("early-init", action_add_queue_tail);
@@ -1121,19 +1221,14 @@ int main(int argc, char** argv) {
             restart_processes();
         }
 
-        int timeout = -1;
-        if (process_needs_restart) {
-            timeout = (process_needs_restart - gettime()) * 1000;
-            if (timeout < 0)
-                timeout = 0;
-        }
+        // Restarts wait for a running exec, whose exit wakes us up anyway.
+        int timeout = waiting_for_exec ? -1 : restart_timeout_ms();
 
-        if (!action_queue_empty() || cur_action) {
+        // A finished parallel command wakes us up
+        if ((!action_queue_empty() || cur_action) && !waiting_for_parallel) {
             timeout = 0;
         }
 
-        bootchart_sample(&timeout);
-
         epoll_event ev;
         int nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, &ev, 1, timeout));
         if (nr == -1) {
@@ -35,6 +35,9 @@ struct command
     int line;
     const char *filename;
 
+        /* may run alongside the commands around it, see parallel.h */
+    bool parallel;
+
     int nargs;
     char *args[1];
 };
@@ -135,15 +138,19 @@ struct service {
 }; /*     ^-------'args' MUST be at the end of this struct! */
 
 extern bool waiting_for_exec;
+extern bool daemon_tracing;
 extern struct selabel_handle *sehandle;
 extern struct selabel_handle *sehandle_prop;
 
 void build_triggers_string(char *name_str, int length, struct action *cur_action);
+void log_command(struct command *cmd, const char *action_name, int result, double duration);
 
 void handle_control_message(const char *msg, const char *arg);
 
 struct service *service_find_by_name(const char *name);
 struct service *service_find_by_pid(pid_t pid);
+/* Every change to svc->pid goes through here to keep the lookup by pid */
+void service_set_pid(struct service *svc, pid_t pid);
 struct service *service_find_by_keychord(int keychord_id);
 void service_for_each(void (*func)(struct service *svc));
 void service_for_each_class(const char *classname,
@@ -154,6 +161,8 @@ void service_stop(struct service *svc);
 void service_reset(struct service *svc);
 void service_restart(struct service *svc);
 void service_start(struct service *svc, const char *dynamic_args);
+/* Queue svc, which has just gone SVC_RESTARTING, to be started again */
+void service_schedule_restart(struct service *svc);
 void property_changed(const char *name, const char *value);
 
 int selinux_reload_policy(void);
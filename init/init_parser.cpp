@@ -30,8 +30,13 @@
 #include "init_parser.h"
 #include "log.h"
 #include "property_service.h"
+#include "rc_cache.h"
 #include "util.h"
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <cutils/iosched_policy.h>
 #include <cutils/list.h>
 
@@ -39,6 +44,24 @@ static list_declare(service_list);
 static list_declare(action_list);
 static list_declare(action_queue);
 
+/* Actions by the triggers that can queue them, each in action_list order */
+struct indexed_action {
+    unsigned seq;
+    struct action *act;
+};
+
+struct property_triggers {
+    std::unordered_map<std::string, std::vector<indexed_action>> by_value;
+    std::vector<indexed_action> any;  /* property:name=* */
+};
+
+/* Running services, so that reaping a child doesn't walk service_list */
+static std::unordered_map<pid_t, service*> services_by_pid;
+
+static std::unordered_map<std::string, std::vector<action*>> trigger_actions;
+static std::unordered_map<std::string, property_triggers> property_trigger_actions;
+static std::vector<action*> property_actions;  /* with only property triggers */
+
 struct import {
     struct listnode list;
     const char *filename;
@@ -53,6 +76,7 @@ static void parse_line_action(struct parse_state *state, int nargs, char **args)
 #define SECTION 0x01
 #define COMMAND 0x02
 #define OPTION  0x04
+#define PARALLEL 0x08 /* safe to run as "parallel <command>" */
 
 #include "keywords.h"
 
@@ -384,6 +408,17 @@ static void parse_new_section(struct parse_state *state, int kw,
     state->parse_line = parse_line_no_op;
 }
 
+static void parse_line(struct parse_state *state, int nargs, char **args)
+{
+    int kw = lookup_keyword(args[0]);
+    if (kw_is(kw, SECTION)) {
+        state->parse_line(state, 0, 0);
+        parse_new_section(state, kw, nargs, args);
+    } else {
+        state->parse_line(state, nargs, args);
+    }
+}
+
 static void parse_config(const char *fn, const std::string& data)
 {
     struct listnode import_list;
@@ -395,13 +430,19 @@ static void parse_config(const char *fn, const std::string& data)
     parse_state state;
     state.filename = fn;
     state.line = 0;
-    state.ptr = strdup(data.c_str());  // TODO: fix this code!
+    state.ptr = NULL;
     state.nexttoken = 0;
     state.parse_line = parse_line_no_op;
 
     list_init(&import_list);
     state.priv = &import_list;
 
+    if (rc_cache_parse(fn, data, &state, parse_line)) {
+        state.parse_line(&state, 0, 0);
+        goto parser_done;
+    }
+
+    state.ptr = strdup(data.c_str());  // TODO: fix this code!
     for (;;) {
         switch (next_token(&state)) {
         case T_EOF:
@@ -410,13 +451,7 @@ static void parse_config(const char *fn, const std::string& data)
         case T_NEWLINE:
             state.line++;
             if (nargs) {
-                int kw = lookup_keyword(args[0]);
-                if (kw_is(kw, SECTION)) {
-                    state.parse_line(&state, 0, 0);
-                    parse_new_section(&state, kw, nargs, args);
-                } else {
-                    state.parse_line(&state, nargs, args);
-                }
+                parse_line(&state, nargs, args);
                 nargs = 0;
             }
             break;
@@ -485,15 +520,22 @@ struct service *service_find_by_name(const char *name)
 
 struct service *service_find_by_pid(pid_t pid)
 {
-    struct listnode *node;
-    struct service *svc;
-    list_for_each(node, &service_list) {
-        svc = node_to_item(node, struct service, slist);
-        if (svc->pid == pid) {
-            return svc;
+    auto it = services_by_pid.find(pid);
+    return (it == services_by_pid.end()) ? 0 : it->second;
+}
+
+void service_set_pid(struct service *svc, pid_t pid)
+{
+    if (svc->pid) {
+        auto it = services_by_pid.find(svc->pid);
+        if (it != services_by_pid.end() && it->second == svc) {
+            services_by_pid.erase(it);
         }
     }
-    return 0;
+    svc->pid = pid;
+    if (pid) {
+        services_by_pid[pid] = svc;
+    }
 }
 
 struct service *service_find_by_keychord(int keychord_id)
@@ -548,70 +590,92 @@ void service_for_each_flags(unsigned matchflags,
 void action_for_each_trigger(const char *trigger,
                              void (*func)(struct action *act))
 {
-    struct listnode *node, *node2;
-    struct action *act;
-    struct trigger *cur_trigger;
-
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        list_for_each(node2, &act->triggers) {
-            cur_trigger = node_to_item(node2, struct trigger, nlist);
-            if (!strcmp(cur_trigger->name, trigger)) {
-                func(act);
-            }
-        }
+    auto it = trigger_actions.find(trigger);
+    if (it == trigger_actions.end()) {
+        return;
+    }
+    for (action* act : it->second) {
+        func(act);
     }
 }
 
-
-void queue_property_triggers(const char *name, const char *value)
+/* Do all of act's triggers hold, given name was just set to value? */
+static bool action_property_triggers_hold(struct action *act, const char *name,
+                                          const char *value)
 {
-    struct listnode *node, *node2;
-    struct action *act;
+    struct listnode *node;
     struct trigger *cur_trigger;
-    bool match;
+    bool match = !name;
     int name_length;
 
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        match = !name;
-        list_for_each(node2, &act->triggers) {
-            cur_trigger = node_to_item(node2, struct trigger, nlist);
-            if (!strncmp(cur_trigger->name, "property:", strlen("property:"))) {
-                const char *test = cur_trigger->name + strlen("property:");
-                if (!match) {
-                    name_length = strlen(name);
-                    if (!strncmp(name, test, name_length) &&
-                        test[name_length] == '=' &&
-                        (!strcmp(test + name_length + 1, value) ||
-                        !strcmp(test + name_length + 1, "*"))) {
-                        match = true;
-                        continue;
-                    }
+    list_for_each(node, &act->triggers) {
+        cur_trigger = node_to_item(node, struct trigger, nlist);
+        if (!strncmp(cur_trigger->name, "property:", strlen("property:"))) {
+            const char *test = cur_trigger->name + strlen("property:");
+            if (!match) {
+                name_length = strlen(name);
+                if (!strncmp(name, test, name_length) &&
+                    test[name_length] == '=' &&
+                    (!strcmp(test + name_length + 1, value) ||
+                    !strcmp(test + name_length + 1, "*"))) {
+                    match = true;
+                    continue;
                 }
-                const char* equals = strchr(test, '=');
-                if (equals) {
-                    char prop_name[PROP_NAME_MAX + 1];
-                    char value[PROP_VALUE_MAX];
-                    int length = equals - test;
-                    if (length <= PROP_NAME_MAX) {
-                        int ret;
-                        memcpy(prop_name, test, length);
-                        prop_name[length] = 0;
-
-                        /* does the property exist, and match the trigger value? */
-                        ret = property_get(prop_name, value);
-                        if (ret > 0 && (!strcmp(equals + 1, value) ||
-                                        !strcmp(equals + 1, "*"))) {
-                            continue;
-                        }
+            }
+            const char* equals = strchr(test, '=');
+            if (equals) {
+                char prop_name[PROP_NAME_MAX + 1];
+                char value[PROP_VALUE_MAX];
+                int length = equals - test;
+                if (length <= PROP_NAME_MAX) {
+                    int ret;
+                    memcpy(prop_name, test, length);
+                    prop_name[length] = 0;
+
+                    /* does the property exist, and match the trigger value? */
+                    ret = property_get(prop_name, value);
+                    if (ret > 0 && (!strcmp(equals + 1, value) ||
+                                    !strcmp(equals + 1, "*"))) {
+                        continue;
                     }
                 }
             }
-            match = false;
-            break;
         }
-        if (match) {
+        return false;
+    }
+    return match;
+}
+
+void queue_property_triggers(const char *name, const char *value)
+{
+    if (!name) {
+        for (action* act : property_actions) {
+            if (action_property_triggers_hold(act, NULL, NULL)) {
+                action_add_queue_tail(act);
+            }
+        }
+        return;
+    }
+
+    auto it = property_trigger_actions.find(name);
+    if (it == property_trigger_actions.end()) {
+        return;
+    }
+    static const std::vector<indexed_action> none;
+    auto v = it->second.by_value.find(value);
+    const std::vector<indexed_action>& exact = (v == it->second.by_value.end()) ? none : v->second;
+    const std::vector<indexed_action>& any = it->second.any;
+
+    /* Merge the two so actions still queue in the order they were parsed */
+    size_t i = 0, j = 0;
+    while (i < exact.size() || j < any.size()) {
+        action* act;
+        if (j == any.size() || (i < exact.size() && exact[i].seq < any[j].seq)) {
+            act = exact[i++].act;
+        } else {
+            act = any[j++].act;
+        }
+        if (action_property_triggers_hold(act, name, value)) {
             action_add_queue_tail(act);
         }
     }
@@ -622,6 +686,51 @@ void queue_all_property_triggers()
     queue_property_triggers(NULL, NULL);
 }
 
+static void add_indexed_action(std::vector<indexed_action>* actions, unsigned seq,
+                               struct action *act)
+{
+    if (actions->empty() || actions->back().act != act) {
+        actions->push_back({ seq, act });
+    }
+}
+
+/* Called as each action is added to action_list */
+static void index_action(struct action *act)
+{
+    static unsigned seq;
+    struct listnode *node;
+    bool property_only = true;
+
+    seq++;
+    list_for_each(node, &act->triggers) {
+        struct trigger *cur_trigger = node_to_item(node, struct trigger, nlist);
+        std::vector<action*>& actions = trigger_actions[cur_trigger->name];
+        if (actions.empty() || actions.back() != act) {
+            actions.push_back(act);
+        }
+        if (strncmp(cur_trigger->name, "property:", strlen("property:"))) {
+            property_only = false;
+            continue;
+        }
+
+        const char *test = cur_trigger->name + strlen("property:");
+        const char *equals = strchr(test, '=');
+        if (!equals) {
+            /* can never hold, as before */
+            continue;
+        }
+        property_triggers& triggers = property_trigger_actions[std::string(test, equals - test)];
+        if (!strcmp(equals + 1, "*")) {
+            add_indexed_action(&triggers.any, seq, act);
+        } else {
+            add_indexed_action(&triggers.by_value[equals + 1], seq, act);
+        }
+    }
+    if (property_only) {
+        property_actions.push_back(act);
+    }
+}
+
 void queue_builtin_action(int (*func)(int nargs, char **args), const char *name)
 {
     action* act = (action*) calloc(1, sizeof(*act));
@@ -639,6 +748,7 @@ void queue_builtin_action(int (*func)(int nargs, char **args), const char *name)
     list_add_tail(&act->commands, &cmd->clist);
 
     list_add_tail(&action_list, &act->alist);
+    index_action(act);
     action_add_queue_tail(act);
 }
 
@@ -870,6 +980,7 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
 
         cmd = (command*) malloc(sizeof(*cmd) + sizeof(char*) * nargs);
         cmd->func = kw_func(kw);
+        cmd->parallel = false;
         cmd->nargs = nargs;
         memcpy(cmd->args, args, sizeof(char*) * nargs);
         list_add_tail(&svc->onrestart.commands, &cmd->clist);
@@ -986,7 +1097,7 @@ static void *parse_action(struct parse_state *state, int nargs, char **args)
     list_init(&act->commands);
     list_init(&act->qlist);
     list_add_tail(&action_list, &act->alist);
-        /* XXX add to hash */
+    index_action(act);
     return act;
 }
 
@@ -994,16 +1105,27 @@ static void parse_line_action(struct parse_state* state, int nargs, char **args)
 {
     struct action *act = (action*) state->context;
     int kw, n;
+    bool parallel = false;
 
     if (nargs == 0) {
         return;
     }
 
+    if (nargs > 1 && !strcmp(args[0], "parallel")) {
+        parallel = true;
+        args++;
+        nargs--;
+    }
+
     kw = lookup_keyword(args[0]);
     if (!kw_is(kw, COMMAND)) {
         parse_error(state, "invalid command '%s'\n", args[0]);
         return;
     }
+    if (parallel && !kw_is(kw, PARALLEL)) {
+        parse_error(state, "'%s' can not run in parallel\n", args[0]);
+        return;
+    }
 
     n = kw_nargs(kw);
     if (nargs < n) {
@@ -1015,6 +1137,7 @@ static void parse_line_action(struct parse_state* state, int nargs, char **args)
     cmd->func = kw_func(kw);
     cmd->line = state->line;
     cmd->filename = state->filename;
+    cmd->parallel = parallel;
     cmd->nargs = nargs;
     memcpy(cmd->args, args, sizeof(char*) * nargs);
     list_add_tail(&act->commands, &cmd->clist);
@@ -23,7 +23,7 @@
 #define NOTICE(x...)  init_klog_write(KLOG_NOTICE_LEVEL, x)
 #define INFO(x...)    init_klog_write(KLOG_INFO_LEVEL, x)
 
-void init_klog_write(int level, const char* fmt, ...) __printflike(2, 3);
-int selinux_klog_callback(int level, const char* fmt, ...) __printflike(2, 3);
+void init_klog_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+int selinux_klog_callback(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
 
 #endif
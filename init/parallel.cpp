@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+
+#include "boot_trace.h"
+#include "init.h"
+#include "log.h"
+#include "util.h"
+
+#define PARALLEL_WORKERS 4
+
+struct parallel_work {
+    struct command* cmd;
+    std::string action_name;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static std::deque<parallel_work> queue;
+static unsigned pending;  // queued or running, protected by queue_lock
+static size_t workers;
+
+// Written to by a worker when it is done, to wake up init's main loop.
+static int done_write_fd = -1;
+static int done_read_fd = -1;
+
+static void run_command(const parallel_work& work) {
+    Timer t;
+    boot_trace_command_begin(work.cmd);
+    int result = work.cmd->func(work.cmd->nargs, work.cmd->args);
+    boot_trace_end();
+    log_command(work.cmd, work.action_name.c_str(), result, t.duration());
+}
+
+static void* worker(void*) {
+    pthread_mutex_lock(&queue_lock);
+    while (true) {
+        while (queue.empty()) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        parallel_work work = queue.front();
+        queue.pop_front();
+        pthread_mutex_unlock(&queue_lock);
+
+        run_command(work);
+
+        pthread_mutex_lock(&queue_lock);
+        --pending;
+        if (TEMP_FAILURE_RETRY(write(done_write_fd, "1", 1)) == -1) {
+            ERROR("write(done_write_fd) failed: %s\n", strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+static void handle_done() {
+    // Clear outstanding notifications, the main loop does the rest.
+    char buf[32];
+    read(done_read_fd, buf, sizeof(buf));
+}
+
+static bool start_workers() {
+    if (done_read_fd == -1) {
+        int s[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, s) == -1) {
+            ERROR("socketpair failed: %s\n", strerror(errno));
+            return false;
+        }
+        done_write_fd = s[0];
+        done_read_fd = s[1];
+        register_epoll_handler(done_read_fd, handle_done);
+    }
+
+    while (workers < PARALLEL_WORKERS) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&thread, &attr, worker, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc) {
+            ERROR("pthread_create failed: %s\n", strerror(rc));
+            break;
+        }
+        ++workers;
+    }
+    return workers != 0;
+}
+
+void parallel_command_queue(struct command* cmd, const char* action_name) {
+    parallel_work work = { cmd, action_name };
+
+    if (!workers && !start_workers()) {
+        run_command(work);
+        return;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    queue.push_back(work);
+    ++pending;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+bool parallel_commands_pending() {
+    pthread_mutex_lock(&queue_lock);
+    bool retval = pending != 0;
+    pthread_mutex_unlock(&queue_lock);
+    return retval;
+}
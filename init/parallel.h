@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PARALLEL_H_
+#define _INIT_PARALLEL_H_
+
+struct command;
+
+// Run cmd, one marked "parallel" in its .rc file, on a worker thread.
+void parallel_command_queue(struct command* cmd, const char* action_name);
+
+// True until every queued command has returned. Init waits on this, with
+// its main loop still running, before any command that is not parallel.
+bool parallel_commands_pending();
+
+#endif
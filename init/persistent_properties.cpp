@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <base/file.h>
+#include <zlib.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+#include "log.h"
+
+#define PERSISTENT_PROPERTY_FILE PERSISTENT_PROPERTY_DIR "/persistent_properties"
+#define PERSISTENT_PROPERTY_TEMP PERSISTENT_PROPERTY_DIR "/.persistent_properties.tmp"
+
+// Superseded records tolerated before the log is rewritten.
+#define PERSISTENT_PROPERTY_SLACK 256
+
+// The log is a magic followed by records of
+//
+//   uint8_t  name_len
+//   uint8_t  value_len
+//   char     name[name_len]
+//   char     value[value_len]
+//   uint32_t crc32 of all of the above
+//
+// Reading stops at the first record that is cut short or does not match
+// its checksum, which is all a crash part way through an append leaves.
+static const char persistent_magic[8] = { 'P', 'R', 'O', 'P', 'L', 'O', 'G', '1' };
+
+// Everything below belongs to whoever holds store_lock.
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::string> store_values;
+static size_t store_records;
+static int store_fd = -1;
+
+static void append_record(std::string* out, const std::string& name, const std::string& value) {
+    size_t start = out->size();
+    out->push_back(static_cast<char>(name.size()));
+    out->push_back(static_cast<char>(value.size()));
+    out->append(name);
+    out->append(value);
+    uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(out->data() + start),
+                         out->size() - start);
+    out->append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+}
+
+// Returns the length of the valid prefix of data.
+static size_t parse_log(const std::string& data, std::map<std::string, std::string>* values,
+                        size_t* records) {
+    const char* p = data.data() + sizeof(persistent_magic);
+    const char* end = data.data() + data.size();
+
+    while (end - p >= 2) {
+        size_t name_len = static_cast<uint8_t>(p[0]);
+        size_t value_len = static_cast<uint8_t>(p[1]);
+        size_t len = 2 + name_len + value_len;
+        uint32_t crc;
+        if ((size_t) (end - p) < len + sizeof(crc)) {
+            break;
+        }
+        memcpy(&crc, p + len, sizeof(crc));
+        if (crc != crc32(0, reinterpret_cast<const Bytef*>(p), len) || name_len == 0) {
+            break;
+        }
+        (*values)[std::string(p + 2, name_len)] = std::string(p + 2 + name_len, value_len);
+        ++*records;
+        p += len + sizeof(crc);
+    }
+    return p - data.data();
+}
+
+static bool check_file(int fd, const char* name) {
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        ERROR("fstat on property file \"%s\" failed: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    // File must not be accessible to others, be owned by root/root, and
+    // not be a hard link to any other file.
+    if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != 0) || (sb.st_gid != 0) ||
+            (sb.st_nlink != 1) || !S_ISREG(sb.st_mode)) {
+        ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
+              name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
+              (unsigned int)sb.st_nlink, sb.st_mode);
+        return false;
+    }
+    return true;
+}
+
+// The old layout, PERSISTENT_PROPERTY_DIR/<name> holding each value.
+static void load_legacy_properties(std::map<std::string, std::string>* values,
+                                   std::vector<std::string>* files) {
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(PERSISTENT_PROPERTY_DIR), closedir);
+    if (!dir) {
+        ERROR("Unable to open persistent property directory \"%s\": %s\n",
+              PERSISTENT_PROPERTY_DIR, strerror(errno));
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir.get())) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist."))) {
+            continue;
+        }
+        if (entry->d_type != DT_REG) {
+            continue;
+        }
+
+        // Open the file and read the property value.
+        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            ERROR("Unable to open persistent property file \"%s\": %s\n",
+                  entry->d_name, strerror(errno));
+            continue;
+        }
+        if (!check_file(fd, entry->d_name)) {
+            close(fd);
+            continue;
+        }
+
+        char value[PROP_VALUE_MAX];
+        int length = read(fd, value, sizeof(value) - 1);
+        if (length >= 0) {
+            value[length] = 0;
+            (*values)[entry->d_name] = value;
+            files->push_back(entry->d_name);
+        } else {
+            ERROR("Unable to read persistent property file %s: %s\n",
+                  entry->d_name, strerror(errno));
+        }
+        close(fd);
+    }
+}
+
+static int open_log() {
+    int fd = TEMP_FAILURE_RETRY(open(PERSISTENT_PROPERTY_FILE,
+                                     O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC));
+    if (fd == -1) {
+        ERROR("Unable to open %s: %s\n", PERSISTENT_PROPERTY_FILE, strerror(errno));
+    }
+    return fd;
+}
+
+// Replace the log with one holding only store_values. Called with
+// store_lock held.
+static bool compact_log() {
+    std::string data(persistent_magic, sizeof(persistent_magic));
+    for (const auto& value : store_values) {
+        append_record(&data, value.first, value.second);
+    }
+
+    int fd = TEMP_FAILURE_RETRY(open(PERSISTENT_PROPERTY_TEMP,
+                                     O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                                     0600));
+    if (fd == -1) {
+        ERROR("Unable to write persistent properties to %s: %s\n",
+              PERSISTENT_PROPERTY_TEMP, strerror(errno));
+        return false;
+    }
+    bool ok = android::base::WriteFully(fd, data.data(), data.size()) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(PERSISTENT_PROPERTY_TEMP, PERSISTENT_PROPERTY_FILE)) {
+        ERROR("Unable to replace %s: %s\n", PERSISTENT_PROPERTY_FILE, strerror(errno));
+        unlink(PERSISTENT_PROPERTY_TEMP);
+        return false;
+    }
+
+    // Make the rename itself durable before anything relies on it.
+    int dir_fd = TEMP_FAILURE_RETRY(open(PERSISTENT_PROPERTY_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    if (store_fd != -1) {
+        close(store_fd);
+    }
+    store_fd = open_log();
+    store_records = store_values.size();
+    return true;
+}
+
+void persistent_properties_load(void (*set)(const char* name, const char* value)) {
+    pthread_mutex_lock(&store_lock);
+
+    store_values.clear();
+    store_records = 0;
+    if (store_fd != -1) {
+        close(store_fd);
+        store_fd = -1;
+    }
+
+    int fd = TEMP_FAILURE_RETRY(open(PERSISTENT_PROPERTY_FILE, O_RDWR | O_NOFOLLOW | O_CLOEXEC));
+    if (fd == -1 && errno == ENOENT) {
+        // First boot with the log: take over whatever the old layout had,
+        // and only remove those files once the log is safely written.
+        std::vector<std::string> files;
+        load_legacy_properties(&store_values, &files);
+        if (compact_log()) {
+            for (const auto& file : files) {
+                unlink((PERSISTENT_PROPERTY_DIR "/" + file).c_str());
+            }
+            if (!files.empty()) {
+                NOTICE("Migrated %zu persistent properties to %s\n", files.size(),
+                       PERSISTENT_PROPERTY_FILE);
+            }
+        }
+    } else if (fd == -1) {
+        ERROR("Unable to open %s: %s\n", PERSISTENT_PROPERTY_FILE, strerror(errno));
+    } else if (check_file(fd, PERSISTENT_PROPERTY_FILE)) {
+        std::string data;
+        android::base::ReadFdToString(fd, &data);
+        if (data.size() < sizeof(persistent_magic) ||
+                memcmp(data.data(), persistent_magic, sizeof(persistent_magic))) {
+            ERROR("Ignoring corrupt %s\n", PERSISTENT_PROPERTY_FILE);
+            compact_log();
+        } else {
+            size_t valid = parse_log(data, &store_values, &store_records);
+            if (valid != data.size()) {
+                // Drop what a crash left half way through an append.
+                ERROR("Truncating %s from %zu to %zu bytes\n", PERSISTENT_PROPERTY_FILE,
+                      data.size(), valid);
+                if (ftruncate(fd, valid) == -1) {
+                    ERROR("ftruncate failed: %s\n", strerror(errno));
+                }
+            }
+            if (store_records > store_values.size() + PERSISTENT_PROPERTY_SLACK) {
+                compact_log();
+            } else {
+                store_fd = open_log();
+            }
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+
+    std::map<std::string, std::string> values = store_values;
+    pthread_mutex_unlock(&store_lock);
+
+    for (const auto& value : values) {
+        set(value.first.c_str(), value.second.c_str());
+    }
+}
+
+void persistent_properties_write(const std::map<std::string, std::string>& props) {
+    std::string data;
+    for (const auto& prop : props) {
+        append_record(&data, prop.first, prop.second);
+    }
+
+    pthread_mutex_lock(&store_lock);
+    for (const auto& prop : props) {
+        store_values[prop.first] = prop.second;
+    }
+    store_records += props.size();
+
+    if (store_fd == -1 ||
+            !android::base::WriteFully(store_fd, data.data(), data.size()) ||
+            fdatasync(store_fd) == -1) {
+        // A partial append is cut off on the next load, the rewrite puts
+        // everything back in one piece now.
+        ERROR("Unable to append to %s: %s\n", PERSISTENT_PROPERTY_FILE, strerror(errno));
+        compact_log();
+    } else if (store_records > store_values.size() + PERSISTENT_PROPERTY_SLACK) {
+        compact_log();
+    }
+    pthread_mutex_unlock(&store_lock);
+}
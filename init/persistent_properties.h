@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PERSISTENT_PROPERTIES_H_
+#define _INIT_PERSISTENT_PROPERTIES_H_
+
+#include <map>
+#include <string>
+
+#define PERSISTENT_PROPERTY_DIR  "/data/property"
+
+// All the persist.* properties live in one append-only log in
+// PERSISTENT_PROPERTY_DIR. Each set appends a record, the last record for
+// a name wins, and the log is rewritten with just the live values once
+// enough of it is superseded.
+
+// Read the store, migrating the old one-file-per-property layout into it
+// the first time, and call set for every property found.
+void persistent_properties_load(void (*set)(const char* name, const char* value));
+
+// Append props to the store with a single write and fdatasync. Safe to
+// call from a thread other than the one persistent_properties_load ran on.
+void persistent_properties_write(const std::map<std::string, std::string>& props);
+
+#endif
@@ -24,10 +24,17 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/poll.h>
 
+#include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <cutils/daemon_trace.h>
 #include <cutils/misc.h>
 #include <cutils/sockets.h>
 #include <cutils/multiuser.h>
@@ -51,14 +58,17 @@
 #include "bootimg.h"
 
 #include "property_service.h"
+#include "persistent_properties.h"
 #include "init.h"
 #include "util.h"
 #include "log.h"
 
-#define PERSISTENT_PROPERTY_DIR  "/data/property"
 #define FSTAB_PREFIX "/fstab."
 #define RECOVERY_MOUNT_POINT "/recovery"
 
+#define PROPERTY_SET_BATCH_MAX 32  /* connections taken per wakeup */
+#define PROPERTY_MAC_CACHE_MAX 256
+
 static int persistent_properties_loaded = 0;
 static bool property_area_initialized = false;
 
@@ -90,33 +100,78 @@ void property_init() {
     }
 }
 
+/*
+ * Decisions already made by the policy, so that a burst of setprops from
+ * the same process does not look up the same labels over and over. The
+ * target context is what property_contexts gives the name's prefix, and
+ * only grants made while enforcing are kept: a denial, or anything in
+ * permissive mode, is always checked again so that it is audited.
+ * Both are dropped whenever the policy is reloaded.
+ */
+static std::unordered_map<std::string, std::string> mac_target_cache;
+static std::unordered_set<std::string> mac_grant_cache;
+static bool mac_cache_enforcing;
+
+static void reset_mac_cache()
+{
+    mac_target_cache.clear();
+    mac_grant_cache.clear();
+}
+
+static bool lookup_target_context(const char *name, std::string *tctx)
+{
+    auto it = mac_target_cache.find(name);
+    if (it != mac_target_cache.end()) {
+        *tctx = it->second;
+        return true;
+    }
+
+    char *con = NULL;
+    if (selabel_lookup(sehandle_prop, &con, name, 1) != 0)
+        return false;
+    *tctx = con;
+    freecon(con);
+
+    if (mac_target_cache.size() >= PROPERTY_MAC_CACHE_MAX)
+        mac_target_cache.clear();
+    mac_target_cache.emplace(name, *tctx);
+    return true;
+}
+
 static int check_mac_perms(const char *name, char *sctx, struct ucred *cr)
 {
     if (is_selinux_enabled() <= 0)
         return 1;
 
-    char *tctx = NULL;
-    int result = 0;
+    std::string tctx;
+    std::string grant;
     property_audit_data audit_data;
 
     if (!sctx)
-        goto err;
+        return 0;
 
     if (!sehandle_prop)
-        goto err;
+        return 0;
 
-    if (selabel_lookup(sehandle_prop, &tctx, name, 1) != 0)
-        goto err;
+    if (!lookup_target_context(name, &tctx))
+        return 0;
+
+    grant = std::string(sctx) + '\n' + tctx;
+    if (mac_cache_enforcing && mac_grant_cache.count(grant))
+        return 1;
 
     audit_data.name = name;
     audit_data.cr = cr;
 
-    if (selinux_check_access(sctx, tctx, "property_service", "set", reinterpret_cast<void*>(&audit_data)) == 0)
-        result = 1;
+    if (selinux_check_access(sctx, tctx.c_str(), "property_service", "set", reinterpret_cast<void*>(&audit_data)) != 0)
+        return 0;
 
-    freecon(tctx);
- err:
-    return result;
+    if (mac_cache_enforcing) {
+        if (mac_grant_cache.size() >= PROPERTY_MAC_CACHE_MAX)
+            mac_grant_cache.clear();
+        mac_grant_cache.insert(grant);
+    }
+    return 1;
 }
 
 static int check_control_mac_perms(const char *name, char *sctx, struct ucred *cr)
@@ -180,27 +235,72 @@ bool property_get_bool(const char *key, bool default_value) {
     return result;
 }
 
-static void write_persistent_property(const char *name, const char *value)
+/*
+ * Persistent properties are written by their own thread, so that init is
+ * not held up on fsync for every persist.* set. Whatever was set since the
+ * thread last woke up goes into the store as one batch, with only the last
+ * value of a property set more than once.
+ */
+static pthread_mutex_t persist_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t persist_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t persist_idle_cond = PTHREAD_COND_INITIALIZER;
+static std::map<std::string, std::string> persist_pending;
+static bool persist_writing;
+static bool persist_thread_started;
+
+static void* persist_thread(void*)
 {
-    char tempPath[PATH_MAX];
-    char path[PATH_MAX];
-    int fd;
+    pthread_mutex_lock(&persist_lock);
+    while (true) {
+        while (persist_pending.empty()) {
+            pthread_cond_wait(&persist_cond, &persist_lock);
+        }
+        std::map<std::string, std::string> props;
+        props.swap(persist_pending);
+        persist_writing = true;
+        pthread_mutex_unlock(&persist_lock);
 
-    snprintf(tempPath, sizeof(tempPath), "%s/.temp.XXXXXX", PERSISTENT_PROPERTY_DIR);
-    fd = mkstemp(tempPath);
-    if (fd < 0) {
-        ERROR("Unable to write persistent property to temp file %s: %s\n", tempPath, strerror(errno));
-        return;
+        persistent_properties_write(props);
+
+        pthread_mutex_lock(&persist_lock);
+        persist_writing = false;
+        if (persist_pending.empty()) {
+            pthread_cond_broadcast(&persist_idle_cond);
+        }
+    }
+    return NULL;
+}
+
+static void write_persistent_property(const char *name, const char *value)
+{
+    if (!persist_thread_started) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&thread, &attr, persist_thread, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc) {
+            ERROR("Unable to start persistent property writer: %s\n", strerror(rc));
+            persistent_properties_write({ { name, value } });
+            return;
+        }
+        persist_thread_started = true;
     }
-    write(fd, value, strlen(value));
-    fsync(fd);
-    close(fd);
 
-    snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, name);
-    if (rename(tempPath, path)) {
-        unlink(tempPath);
-        ERROR("Unable to rename persistent property file %s to %s\n", tempPath, path);
+    pthread_mutex_lock(&persist_lock);
+    persist_pending[name] = value;
+    pthread_cond_signal(&persist_cond);
+    pthread_mutex_unlock(&persist_lock);
+}
+
+void property_flush_persistent()
+{
+    pthread_mutex_lock(&persist_lock);
+    while (!persist_pending.empty() || persist_writing) {
+        pthread_cond_wait(&persist_idle_cond, &persist_lock);
     }
+    pthread_mutex_unlock(&persist_lock);
 }
 
 static bool is_legal_property_name(const char* name, size_t namelen)
@@ -240,6 +340,7 @@ static int property_set_impl(const char* name, const char* value) {
         if (selinux_reload_policy() != 0) {
             ERROR("Failed to reload policy\n");
         }
+        reset_mac_cache();
     } else if (strcmp("selinux.restorecon_recursive", name) == 0 && valuelen > 0) {
         if (restorecon_recursive(value) != 0) {
             ERROR("Failed to restorecon_recursive %s\n", value);
@@ -283,51 +384,20 @@ static int property_set_impl(const char* name, const char* value) {
 }
 
 int property_set(const char* name, const char* value) {
+    bool traced = daemon_tracing && daemon_trace_begin("init property_set");
     int rc = property_set_impl(name, value);
+    daemon_trace_end(traced);
     if (rc == -1) {
         ERROR("property_set(\"%s\", \"%s\") failed\n", name, value);
     }
     return rc;
 }
 
-static void handle_property_set_fd()
+static void handle_property_request(int s, struct ucred *cr)
 {
     prop_msg msg;
-    int s;
     int r;
-    struct ucred cr;
-    struct sockaddr_un addr;
-    socklen_t addr_size = sizeof(addr);
-    socklen_t cr_size = sizeof(cr);
     char * source_ctx = NULL;
-    struct pollfd ufds[1];
-    const int timeout_ms = 2 * 1000;  /* Default 2 sec timeout for caller to send property. */
-    int nr;
-
-    if ((s = accept(property_set_fd, (struct sockaddr *) &addr, &addr_size)) < 0) {
-        return;
-    }
-
-    /* Check socket options here */
-    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
-        close(s);
-        ERROR("Unable to receive socket options\n");
-        return;
-    }
-
-    ufds[0].fd = s;
-    ufds[0].events = POLLIN;
-    ufds[0].revents = 0;
-    nr = TEMP_FAILURE_RETRY(poll(ufds, 1, timeout_ms));
-    if (nr == 0) {
-        ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n", cr.uid);
-        close(s);
-        return;
-    } else if (nr < 0) {
-        ERROR("sys_prop: error waiting for uid=%d to send property message: %s\n", cr.uid, strerror(errno));
-        close(s);
-        return;
-    }
 
     r = TEMP_FAILURE_RETRY(recv(s, &msg, sizeof(msg), MSG_DONTWAIT));
     if(r != sizeof(prop_msg)) {
@@ -354,18 +424,18 @@ static void handle_property_set_fd()
             // Keep the old close-socket-early behavior when handling
             // ctl.* properties.
             close(s);
-            if (check_control_mac_perms(msg.value, source_ctx, &cr)) {
+            if (check_control_mac_perms(msg.value, source_ctx, cr)) {
                 handle_control_message((char*) msg.name + 4, (char*) msg.value);
             } else {
                 ERROR("sys_prop: Unable to %s service ctl [%s] uid:%d gid:%d pid:%d\n",
-                        msg.name + 4, msg.value, cr.uid, cr.gid, cr.pid);
+                        msg.name + 4, msg.value, cr->uid, cr->gid, cr->pid);
             }
         } else {
-            if (check_perms(msg.name, source_ctx, &cr)) {
+            if (check_perms(msg.name, source_ctx, cr)) {
                 property_set((char*) msg.name, (char*) msg.value);
             } else {
                 ERROR("sys_prop: permission denied uid:%d  name:%s\n",
-                      cr.uid, msg.name);
+                      cr->uid, msg.name);
             }
 
             // Note: bionic's property client code assumes that the
@@ -382,6 +452,79 @@ static void handle_property_set_fd()
     }
 }
 
+/*
+ * Take every connection already waiting, up to PROPERTY_SET_BATCH_MAX, and
+ * serve them as their messages arrive, so that the clients that have sent
+ * theirs go first and one slow client no longer holds up the rest.
+ */
+static void handle_property_set_fd()
+{
+    std::vector<pollfd> ufds;
+    std::vector<ucred> creds;
+    const int timeout_ms = 2 * 1000;  /* Default 2 sec timeout for caller to send property. */
+
+    while (ufds.size() < PROPERTY_SET_BATCH_MAX) {
+        struct ucred cr;
+        struct sockaddr_un addr;
+        socklen_t addr_size = sizeof(addr);
+        socklen_t cr_size = sizeof(cr);
+        int s;
+
+        if ((s = accept(property_set_fd, (struct sockaddr *) &addr, &addr_size)) < 0) {
+            break;
+        }
+
+        /* Check socket options here */
+        if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
+            close(s);
+            ERROR("Unable to receive socket options\n");
+            continue;
+        }
+
+        pollfd ufd = { s, POLLIN, 0 };
+        ufds.push_back(ufd);
+        creds.push_back(cr);
+    }
+    if (ufds.empty()) {
+        return;
+    }
+
+    mac_cache_enforcing = security_getenforce() == 1;
+
+    Timer t;
+    while (!ufds.empty()) {
+        int remaining_ms = timeout_ms - (int) (t.duration() * 1000);
+        int nr = (remaining_ms > 0) ?
+            TEMP_FAILURE_RETRY(poll(&ufds[0], ufds.size(), remaining_ms)) : 0;
+        if (nr <= 0) {
+            for (size_t i = 0; i < ufds.size(); i++) {
+                if (nr == 0) {
+                    ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n",
+                          creds[i].uid);
+                } else {
+                    ERROR("sys_prop: error waiting for uid=%d to send property message: %s\n",
+                          creds[i].uid, strerror(errno));
+                }
+                close(ufds[i].fd);
+            }
+            return;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < ufds.size(); i++) {
+            if (ufds[i].revents) {
+                handle_property_request(ufds[i].fd, &creds[i]);
+                continue;
+            }
+            ufds[kept] = ufds[i];
+            creds[kept] = creds[i];
+            kept++;
+        }
+        ufds.resize(kept);
+        creds.resize(kept);
+    }
+}
+
 void get_property_workspace(int *fd, int *sz)
 {
     *fd = pa_workspace.fd;
@@ -464,62 +607,15 @@ static void load_properties_from_file(const char* filename, const char* filter)
     NOTICE("(Loading properties from %s took %.2fs.)\n", filename, t.duration());
 }
 
-static void load_persistent_properties() {
-    persistent_properties_loaded = 1;
-
-    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(PERSISTENT_PROPERTY_DIR), closedir);
-    if (!dir) {
-        ERROR("Unable to open persistent property directory \"%s\": %s\n",
-              PERSISTENT_PROPERTY_DIR, strerror(errno));
-        return;
-    }
-
-    struct dirent* entry;
-    while ((entry = readdir(dir.get())) != NULL) {
-        if (strncmp("persist.", entry->d_name, strlen("persist."))) {
-            continue;
-        }
-        if (entry->d_type != DT_REG) {
-            continue;
-        }
-
-        // Open the file and read the property value.
-        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW);
-        if (fd == -1) {
-            ERROR("Unable to open persistent property file \"%s\": %s\n",
-                  entry->d_name, strerror(errno));
-            continue;
-        }
-
-        struct stat sb;
-        if (fstat(fd, &sb) == -1) {
-            ERROR("fstat on property file \"%s\" failed: %s\n", entry->d_name, strerror(errno));
-            close(fd);
-            continue;
-        }
+static void set_persistent_property(const char* name, const char* value) {
+    property_set(name, value);
+}
 
-        // File must not be accessible to others, be owned by root/root, and
-        // not be a hard link to any other file.
-        if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != 0) || (sb.st_gid != 0) ||
-                (sb.st_nlink != 1)) {
-            ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
-                  entry->d_name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
-                  (unsigned int)sb.st_nlink, sb.st_mode);
-            close(fd);
-            continue;
-        }
+static void load_persistent_properties() {
+    persistent_properties_load(set_persistent_property);
 
-        char value[PROP_VALUE_MAX];
-        int length = read(fd, value, sizeof(value) - 1);
-        if (length >= 0) {
-            value[length] = 0;
-            property_set(entry->d_name, value);
-        } else {
-            ERROR("Unable to read persistent property file %s: %s\n",
-                  entry->d_name, strerror(errno));
-        }
-        close(fd);
-    }
+    // Only now, the values just loaded are already in the store.
+    persistent_properties_loaded = 1;
 }
 
 void property_load_boot_defaults() {
@@ -36,6 +36,7 @@ extern int __property_get(const char *name, char *value);
 extern int property_set(const char *name, const char *value);
 extern bool property_get_bool(const char *name, bool def_value);
 extern bool properties_initialized();
+void property_flush_persistent();
 
 #ifndef __clang__
 extern void __property_get_size_error()
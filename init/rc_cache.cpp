@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rc_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "init_parser.h"
+#include "log.h"
+
+// The image is a header followed by one record per file:
+//
+//   char     magic[8]
+//   uint32_t nfiles
+//   nfiles times:
+//     uint32_t name_len      including the terminating NUL
+//     char     name[name_len]
+//     uint64_t hash          of the contents, see rc_cache_hash
+//     uint32_t nlines
+//     nlines times:
+//       uint32_t line
+//       uint32_t nargs
+//       nargs NUL terminated arguments
+//
+// Integers are native endian and unaligned, the cache is only ever read
+// by the init built alongside it.
+static const char rc_cache_magic[8] = { 'I', 'N', 'I', 'T', 'R', 'C', '1', '\0' };
+
+struct rc_cache_file {
+    const char* name;
+    uint64_t hash;
+    uint32_t nlines;
+    char* lines;
+};
+
+static std::vector<rc_cache_file> rc_cache_files;
+
+uint64_t rc_cache_hash(const std::string& data) {
+    // FNV-1a. This only has to notice a file that changed since the
+    // image was built, both live on the same read-only ramdisk.
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool get_u32(char** p, char* end, uint32_t* value) {
+    if (end - *p < (ptrdiff_t) sizeof(*value)) {
+        return false;
+    }
+    memcpy(value, *p, sizeof(*value));
+    *p += sizeof(*value);
+    return true;
+}
+
+static bool get_string(char** p, char* end, char** s) {
+    char* nul = (char*) memchr(*p, '\0', end - *p);
+    if (!nul) {
+        return false;
+    }
+    *s = *p;
+    *p = nul + 1;
+    return true;
+}
+
+// Walk the whole image once so that rc_cache_parse never has to bail out
+// half way through a file.
+static bool index_cache(char* p, char* end, std::vector<rc_cache_file>* files) {
+    if (end - p < (ptrdiff_t) sizeof(rc_cache_magic) ||
+            memcmp(p, rc_cache_magic, sizeof(rc_cache_magic))) {
+        return false;
+    }
+    p += sizeof(rc_cache_magic);
+
+    uint32_t nfiles;
+    if (!get_u32(&p, end, &nfiles)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < nfiles; i++) {
+        rc_cache_file file;
+        uint32_t name_len;
+        char* name;
+        if (!get_u32(&p, end, &name_len) || !get_string(&p, end, &name) ||
+                strlen(name) + 1 != name_len) {
+            return false;
+        }
+        file.name = name;
+        if (end - p < (ptrdiff_t) sizeof(file.hash)) {
+            return false;
+        }
+        memcpy(&file.hash, p, sizeof(file.hash));
+        p += sizeof(file.hash);
+        if (!get_u32(&p, end, &file.nlines)) {
+            return false;
+        }
+        file.lines = p;
+        for (uint32_t l = 0; l < file.nlines; l++) {
+            uint32_t line, nargs;
+            if (!get_u32(&p, end, &line) || !get_u32(&p, end, &nargs) ||
+                    nargs == 0 || nargs > INIT_PARSER_MAXARGS) {
+                return false;
+            }
+            for (uint32_t n = 0; n < nargs; n++) {
+                char* arg;
+                if (!get_string(&p, end, &arg)) {
+                    return false;
+                }
+            }
+        }
+        files->push_back(file);
+    }
+    return p == end;
+}
+
+bool rc_cache_load(const char* path) {
+    int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC));
+    if (fd == -1) {
+        INFO("no rc cache at '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    // Same rule as read_file applies to the .rc files themselves.
+    if ((sb.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        ERROR("skipping insecure file '%s'\n", path);
+        close(fd);
+        return false;
+    }
+
+    // Private and writable, since the parser hands out the arguments as
+    // char* just as it does for the copy of a text file it tokenized.
+    void* map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERROR("mmap of '%s' failed: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char* p = (char*) map;
+    std::vector<rc_cache_file> files;
+    if (!index_cache(p, p + sb.st_size, &files)) {
+        ERROR("ignoring corrupt rc cache '%s'\n", path);
+        munmap(map, sb.st_size);
+        return false;
+    }
+
+    // The mapping lives as long as init does, commands point into it.
+    rc_cache_files.swap(files);
+    INFO("loaded rc cache '%s' with %zu files\n", path, rc_cache_files.size());
+    return true;
+}
+
+bool rc_cache_parse(const char* fn, const std::string& data, struct parse_state* state,
+                    void (*parse_line)(struct parse_state* state, int nargs, char** args)) {
+    const rc_cache_file* file = NULL;
+    for (const rc_cache_file& f : rc_cache_files) {
+        if (!strcmp(f.name, fn)) {
+            file = &f;
+            break;
+        }
+    }
+    if (!file) {
+        return false;
+    }
+    if (file->hash != rc_cache_hash(data)) {
+        INFO("'%s' changed since the rc cache was built\n", fn);
+        return false;
+    }
+
+    char* p = file->lines;
+    char* args[INIT_PARSER_MAXARGS];
+    for (uint32_t l = 0; l < file->nlines; l++) {
+        uint32_t line, nargs;
+        memcpy(&line, p, sizeof(line));
+        p += sizeof(line);
+        memcpy(&nargs, p, sizeof(nargs));
+        p += sizeof(nargs);
+        for (uint32_t n = 0; n < nargs; n++) {
+            args[n] = p;
+            p += strlen(p) + 1;
+        }
+        state->line = line;
+        parse_line(state, nargs, args);
+    }
+    return true;
+}
+
+static void put_u32(std::string* out, uint32_t value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_string(std::string* out, const char* s) {
+    out->append(s, strlen(s) + 1);
+}
+
+std::string rc_cache_build(const std::vector<std::pair<std::string, std::string>>& files) {
+    std::string out(rc_cache_magic, sizeof(rc_cache_magic));
+    put_u32(&out, files.size());
+
+    for (const auto& file : files) {
+        // init_parse_config_file adds the same newline before parsing.
+        std::string data = file.second;
+        data.push_back('\n');
+
+        put_u32(&out, file.first.size() + 1);
+        put_string(&out, file.first.c_str());
+        uint64_t hash = rc_cache_hash(data);
+        out.append(reinterpret_cast<const char*>(&hash), sizeof(hash));
+
+        // Tokenize exactly as parse_config does, arguments past
+        // INIT_PARSER_MAXARGS are dropped the same way.
+        std::string lines;
+        uint32_t nlines = 0;
+        std::vector<char> text(data.begin(), data.end());
+        text.push_back('\0');
+        char* args[INIT_PARSER_MAXARGS];
+        int nargs = 0;
+
+        parse_state state;
+        memset(&state, 0, sizeof(state));
+        state.filename = file.first.c_str();
+        state.ptr = &text[0];
+
+        for (bool done = false; !done;) {
+            switch (next_token(&state)) {
+            case T_EOF:
+                done = true;
+                break;
+            case T_NEWLINE:
+                state.line++;
+                if (nargs) {
+                    put_u32(&lines, state.line);
+                    put_u32(&lines, nargs);
+                    for (int n = 0; n < nargs; n++) {
+                        put_string(&lines, args[n]);
+                    }
+                    nlines++;
+                    nargs = 0;
+                }
+                break;
+            case T_TEXT:
+                if (nargs < INIT_PARSER_MAXARGS) {
+                    args[nargs++] = state.text;
+                }
+                break;
+            }
+        }
+
+        put_u32(&out, nlines);
+        out.append(lines);
+    }
+    return out;
+}
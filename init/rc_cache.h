@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_RC_CACHE_H_
+#define _INIT_RC_CACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+// Built with the ramdisk by init_rc_cache, see rootdir/Android.mk.
+#define RC_CACHE_PATH "/init.rc.cache"
+
+// The cache holds every .rc file already split into the lines and
+// arguments next_token would find in it, each tagged with a hash of the
+// text it came from. Importing a file whose contents still match skips
+// tokenizing it, and its arguments point straight into the mapped cache.
+// A file that has changed, or is not in the cache, is parsed as text.
+
+// Map the cache at path. Safe to skip, everything is then parsed as text.
+bool rc_cache_load(const char* path);
+
+// If fn is in the cache with exactly these contents, call parse_line for
+// each of its lines, with state->line set as the text parser would, and
+// return true. Otherwise return false without calling anything.
+bool rc_cache_parse(const char* fn, const std::string& data, struct parse_state* state,
+                    void (*parse_line)(struct parse_state* state, int nargs, char** args));
+
+// Tokenize each of files and return the cache image. files holds pairs of
+// the path init will import the file by and its contents.
+std::string rc_cache_build(const std::vector<std::pair<std::string, std::string>>& files);
+
+uint64_t rc_cache_hash(const std::string& data);
+
+#endif
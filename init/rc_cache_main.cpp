@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tool that builds the init.rc.cache for a ramdisk:
+//
+//   init_rc_cache <output> <path on device>=<file> ...
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <base/file.h>
+
+#include "log.h"
+#include "rc_cache.h"
+
+// parser.cpp reports through init's klog, on the host that is stderr.
+void init_klog_write(int, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <output> <path on device>=<file> ...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> files;
+    for (int i = 2; i < argc; i++) {
+        const char* eq = strchr(argv[i], '=');
+        if (!eq || eq == argv[i] || argv[i][0] != '/') {
+            fprintf(stderr, "%s: expected /path=file, not '%s'\n", argv[0], argv[i]);
+            return 1;
+        }
+        std::string data;
+        if (!android::base::ReadFileToString(eq + 1, &data)) {
+            fprintf(stderr, "%s: couldn't read '%s': %s\n", argv[0], eq + 1, strerror(errno));
+            return 1;
+        }
+        files.emplace_back(std::string(argv[i], eq - argv[i]), data);
+    }
+
+    if (!android::base::WriteStringToFile(rc_cache_build(files), argv[1])) {
+        fprintf(stderr, "%s: couldn't write '%s': %s\n", argv[0], argv[1], strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rc_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <base/file.h>
+#include <gtest/gtest.h>
+
+static std::vector<std::string> lines;
+
+static void record_line(struct parse_state* state, int nargs, char** args) {
+    std::string line = std::to_string(state->line) + ":";
+    for (int i = 0; i < nargs; i++) {
+        line += " ";
+        line += args[i];
+    }
+    lines.push_back(line);
+}
+
+TEST(rc_cache, round_trip) {
+    const std::string rc =
+        "# comment\n"
+        "on boot\n"
+        "    write /proc/sys/kernel/foo \"a b\"\n"
+        "\n"
+        "service x /system/bin/x \\\n"
+        "    --flag\n"
+        "    class main";
+
+    char path[] = "/data/local/tmp/rc_cache_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    ASSERT_TRUE(android::base::WriteStringToFile(rc_cache_build({ { "/test.rc", rc } }), path));
+    ASSERT_TRUE(rc_cache_load(path));
+    unlink(path);
+
+    parse_state state;
+    memset(&state, 0, sizeof(state));
+
+    // Parsed the way init_parse_config_file hands it over.
+    lines.clear();
+    ASSERT_TRUE(rc_cache_parse("/test.rc", rc + "\n", &state, record_line));
+    ASSERT_EQ(4U, lines.size());
+    EXPECT_EQ("2: on boot", lines[0]);
+    EXPECT_EQ("3: write /proc/sys/kernel/foo a b", lines[1]);
+    EXPECT_EQ("6: service x /system/bin/x --flag", lines[2]);
+    EXPECT_EQ("7: class main", lines[3]);
+
+    // Any change and it is the text parser's job again.
+    lines.clear();
+    EXPECT_FALSE(rc_cache_parse("/test.rc", rc + " \n", &state, record_line));
+    EXPECT_FALSE(rc_cache_parse("/other.rc", rc + "\n", &state, record_line));
+    EXPECT_TRUE(lines.empty());
+}
+
+TEST(rc_cache, corrupt) {
+    char path[] = "/data/local/tmp/rc_cache_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    std::string image = rc_cache_build({ { "/test.rc", "on boot\n" } });
+    image.resize(image.size() - 1);
+    ASSERT_TRUE(android::base::WriteStringToFile(image, path));
+    EXPECT_FALSE(rc_cache_load(path));
+    unlink(path);
+}
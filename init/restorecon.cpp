@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "restorecon.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <base/file.h>
+#include <mincrypt/sha.h>
+#include <selinux/android.h>
+#include <selinux/label.h>
+#include <selinux/selinux.h>
+
+#include "log.h"
+#include "util.h"
+
+#define RESTORECON_THREADS 4
+
+// SHA-1 of the file contexts a complete walk of the tree was done with.
+// Not libselinux's security.restorecon_last, which it computes its own way.
+#define RESTORECON_DIGEST_XATTR "trusted.init.restorecon_last"
+
+// Where selinux_android_file_context_handle loads the file contexts from.
+static const char* file_contexts_paths[] = { "/data/security/current/file_contexts",
+                                             "/file_contexts" };
+
+struct walker {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // Everything below is protected by lock.
+    std::vector<std::deque<std::string>> queues;  // directories, one queue per thread
+    size_t queued;
+    size_t busy;       // threads in the middle of a directory
+    int error;         // the first errno, if anything failed
+    bool sys;          // walking /sys, see should_descend
+};
+
+struct walk_thread {
+    walker* w;
+    size_t self;
+    struct selabel_handle* sehandle;  // lookups on one handle aren't thread safe
+    pthread_t thread;
+    bool started;
+};
+
+static void record_error(walker* w, int error) {
+    pthread_mutex_lock(&w->lock);
+    if (!w->error) {
+        w->error = error;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void relabel(walker* w, struct selabel_handle* sehandle, const std::string& path,
+                    mode_t mode) {
+    char* want = NULL;
+    if (selabel_lookup(sehandle, &want, path.c_str(), mode) < 0) {
+        // Nothing in the file contexts for it, libselinux leaves it be too.
+        if (errno != ENOENT) {
+            record_error(w, errno);
+        }
+        return;
+    }
+
+    char* have = NULL;
+    if (lgetfilecon(path.c_str(), &have) < 0 || strcmp(have, want)) {
+        if (lsetfilecon(path.c_str(), want) < 0) {
+            ERROR("restorecon: could not label '%s' as %s: %s\n", path.c_str(), want,
+                  strerror(errno));
+            record_error(w, errno);
+        }
+    }
+    freecon(have);
+    freecon(want);
+}
+
+static bool should_descend(walker* w, struct selabel_handle* sehandle, const std::string& path) {
+    // installd labels app data itself, from seapp_contexts.
+    if (path == "/data/data" || !path.compare(0, strlen("/data/user/"), "/data/user/")) {
+        return false;
+    }
+    // The same shortcut libselinux takes for the huge /sys tree.
+    if (w->sys && !selabel_partial_match(sehandle, path.c_str())) {
+        return false;
+    }
+    return true;
+}
+
+static void walk_dir(walker* w, struct selabel_handle* sehandle, const std::string& dir,
+                     std::vector<std::string>* subdirs) {
+    int fd = TEMP_FAILURE_RETRY(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    if (fd == -1) {
+        ERROR("restorecon: could not open '%s': %s\n", dir.c_str(), strerror(errno));
+        record_error(w, errno);
+        return;
+    }
+    DIR* d = fdopendir(fd);
+    if (!d) {
+        record_error(w, errno);
+        close(fd);
+        return;
+    }
+
+    std::string prefix = (dir == "/") ? dir : dir + "/";
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        struct stat sb;
+        if (fstatat(fd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue;  // gone since readdir
+        }
+        std::string path = prefix + de->d_name;
+        relabel(w, sehandle, path, sb.st_mode);
+        if (S_ISDIR(sb.st_mode) && should_descend(w, sehandle, path)) {
+            subdirs->push_back(path);
+        }
+    }
+    closedir(d);
+}
+
+// Takes the newest directory off our own queue, where its parent's inodes
+// are likely still cached, or else the oldest, and so biggest, of someone
+// else's. Called with lock held.
+static bool take_dir(walker* w, size_t self, std::string* dir) {
+    if (!w->queued) {
+        return false;
+    }
+    std::deque<std::string>* own = &w->queues[self];
+    if (!own->empty()) {
+        *dir = own->back();
+        own->pop_back();
+    } else {
+        for (size_t i = 1; i < w->queues.size(); i++) {
+            std::deque<std::string>* other = &w->queues[(self + i) % w->queues.size()];
+            if (!other->empty()) {
+                *dir = other->front();
+                other->pop_front();
+                break;
+            }
+        }
+    }
+    w->queued--;
+    return true;
+}
+
+static void* walk_thread_main(void* arg) {
+    walk_thread* t = reinterpret_cast<walk_thread*>(arg);
+    walker* w = t->w;
+    std::vector<std::string> subdirs;
+
+    pthread_mutex_lock(&w->lock);
+    while (true) {
+        std::string dir;
+        if (!take_dir(w, t->self, &dir)) {
+            if (!w->busy) {
+                break;
+            }
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        subdirs.clear();
+        walk_dir(w, t->sehandle, dir, &subdirs);
+
+        pthread_mutex_lock(&w->lock);
+        w->busy--;
+        for (auto& subdir : subdirs) {
+            w->queues[t->self].push_back(subdir);
+        }
+        w->queued += subdirs.size();
+        if (!subdirs.empty() || (!w->busy && !w->queued)) {
+            pthread_cond_broadcast(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static bool file_contexts_digest(uint8_t* digest) {
+    std::string data;
+    for (size_t i = 0; i < ARRAY_SIZE(file_contexts_paths); i++) {
+        std::string contents;
+        if (android::base::ReadFileToString(file_contexts_paths[i], &contents)) {
+            data.append(file_contexts_paths[i]);
+            data.push_back('\0');
+            data.append(contents);
+        }
+    }
+    if (data.empty()) {
+        return false;
+    }
+    SHA_hash(data.data(), data.size(), digest);
+    return true;
+}
+
+int restorecon_tree(const char* path, bool skip_unchanged) {
+    uint8_t digest[SHA_DIGEST_SIZE];
+    bool have_digest = file_contexts_digest(digest);
+    if (skip_unchanged && have_digest) {
+        uint8_t last[SHA_DIGEST_SIZE];
+        if (lgetxattr(path, RESTORECON_DIGEST_XATTR, last, sizeof(last)) == sizeof(last) &&
+                !memcmp(last, digest, sizeof(digest))) {
+            INFO("restorecon: '%s' is already labeled\n", path);
+            return 0;
+        }
+    }
+
+    struct stat sb;
+    if (lstat(path, &sb) == -1) {
+        return -1;
+    }
+
+    walker w;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.queues.resize(RESTORECON_THREADS);
+    w.queued = 0;
+    w.busy = 0;
+    w.error = 0;
+    w.sys = !strcmp(path, "/sys") || !strncmp(path, "/sys/", 5);
+
+    std::vector<walk_thread> threads(RESTORECON_THREADS);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].w = &w;
+        threads[i].self = i;
+        threads[i].sehandle = selinux_android_file_context_handle();
+        threads[i].started = false;
+    }
+
+    int ret = 0;
+    if (!threads[0].sehandle) {
+        ERROR("restorecon: no file contexts for '%s'\n", path);
+        w.error = EINVAL;
+        goto out;
+    }
+
+    relabel(&w, threads[0].sehandle, path, sb.st_mode);
+    if (S_ISDIR(sb.st_mode) && should_descend(&w, threads[0].sehandle, path)) {
+        w.queues[0].push_back(path);
+        w.queued = 1;
+    }
+
+    // The calling thread is the first walker, the rest only help.
+    for (size_t i = 1; i < threads.size(); i++) {
+        if (threads[i].sehandle) {
+            threads[i].started = !pthread_create(&threads[i].thread, NULL, walk_thread_main,
+                                                 &threads[i]);
+        }
+    }
+    walk_thread_main(&threads[0]);
+    for (size_t i = 1; i < threads.size(); i++) {
+        if (threads[i].started) {
+            pthread_join(threads[i].thread, NULL);
+        }
+    }
+
+    if (!w.error && have_digest &&
+            lsetxattr(path, RESTORECON_DIGEST_XATTR, digest, sizeof(digest), 0) == -1) {
+        ERROR("restorecon: could not record digest on '%s': %s\n", path, strerror(errno));
+    }
+
+out:
+    for (size_t i = 0; i < threads.size(); i++) {
+        if (threads[i].sehandle) {
+            selabel_close(threads[i].sehandle);
+        }
+    }
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+
+    if (w.error) {
+        errno = w.error;
+        ret = -1;
+    }
+    return ret;
+}
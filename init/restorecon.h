@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_RESTORECON_H_
+#define _INIT_RESTORECON_H_
+
+// Relabel everything under path, path included, from the file contexts,
+// walking the tree on several threads each with its own label handle.
+// Like selinux_android_restorecon, it doesn't follow symlinks and leaves
+// what is below /data/data and /data/user/<id> to installd.
+//
+// When the file contexts are unchanged since the last complete walk of
+// path, according to a digest kept in an xattr on path, skip_unchanged
+// makes this return at once.
+//
+// Returns 0 on success, or -1 with errno set if anything couldn't be
+// relabeled.
+int restorecon_tree(const char* path, bool skip_unchanged);
+
+#endif
@@ -28,6 +28,7 @@
 #include <cutils/list.h>
 #include <cutils/sockets.h>
 
+#include "boot_trace.h"
 #include "init.h"
 #include "log.h"
 #include "util.h"
@@ -75,6 +76,8 @@ static bool wait_for_one_process() {
         return true;
     }
 
+    boot_trace_service_exit(svc->name, pid);
+
     // TODO: all the code from here down should be a member function on service.
 
     if (!(svc->flags & SVC_ONESHOT) || (svc->flags & SVC_RESTART)) {
@@ -92,13 +95,14 @@ static bool wait_for_one_process() {
     if (svc->flags & SVC_EXEC) {
         INFO("SVC_EXEC pid %d finished...\n", svc->pid);
         waiting_for_exec = false;
+        service_set_pid(svc, 0);
         list_remove(&svc->slist);
         free(svc->name);
         free(svc);
         return true;
     }
 
-    svc->pid = 0;
+    service_set_pid(svc, 0);
     svc->flags &= (~SVC_RUNNING);
 
     // Oneshot processes go into the disabled state on exit,
@@ -131,6 +135,7 @@ static bool wait_for_one_process() {
 
     svc->flags &= (~SVC_RESTART);
     svc->flags |= SVC_RESTARTING;
+    service_schedule_restart(svc);
 
     // Execute all onrestart commands for this service.
     struct listnode* node;
@@ -46,11 +46,13 @@ libbacktrace_src_files := \
 	BacktraceCurrent.cpp \
 	BacktraceMap.cpp \
 	BacktracePtrace.cpp \
+	SymbolCache.cpp \
 	thread_utils.c \
 	ThreadEntry.cpp \
 	UnwindCurrent.cpp \
 	UnwindMap.cpp \
 	UnwindPtrace.cpp \
+	UnwindSampler.cpp \
 
 libbacktrace_shared_libraries_target := \
 	libcutils \
@@ -40,18 +40,16 @@ using android::base::StringPrintf;
 // Backtrace functions.
 //-------------------------------------------------------------------------
 Backtrace::Backtrace(pid_t pid, pid_t tid, BacktraceMap* map)
-    : pid_(pid), tid_(tid), map_(map), map_shared_(true) {
+    : pid_(pid), tid_(tid), map_(map) {
   if (map_ == nullptr) {
-    map_ = BacktraceMap::Create(pid);
-    map_shared_ = false;
+    // Backtraces of several threads of one process, made without a map,
+    // all parse the maps once between them.
+    shared_map_ = BacktraceMap::CreateShared(pid);
+    map_ = shared_map_.get();
   }
 }
 
 Backtrace::~Backtrace() {
-  if (map_ && !map_shared_) {
-    delete map_;
-    map_ = nullptr;
-  }
 }
 
 std::string Backtrace::GetFunctionName(uintptr_t pc, uintptr_t* offset) {
@@ -91,7 +91,7 @@ bool BacktraceCurrent::DiscardFrame(const backtrace_frame_data_t& frame) {
   return false;
 }
 
-static pthread_mutex_t g_sigaction_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t g_sigaction_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void SignalLogOnly(int, siginfo_t*, void*) {
   BACK_LOGE("pid %d, tid %d: Received a spurious signal %d\n", getpid(), gettid(), THREAD_SIGNAL);
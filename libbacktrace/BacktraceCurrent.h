@@ -17,6 +17,7 @@
 #ifndef _LIBBACKTRACE_BACKTRACE_CURRENT_H
 #define _LIBBACKTRACE_BACKTRACE_CURRENT_H
 
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <ucontext.h>
@@ -33,6 +34,10 @@
 #define THREAD_SIGNAL (__SIGRTMIN+1)
 #endif
 
+// Held by whoever is changing the action for THREAD_SIGNAL and waiting for
+// the signal to be handled.
+extern pthread_mutex_t g_sigaction_mutex;
+
 class BacktraceMap;
 
 class BacktraceCurrent : public Backtrace {
@@ -19,6 +19,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include <backtrace/backtrace_constants.h>
 #include <backtrace/BacktraceMap.h>
 #include <log/log.h>
@@ -35,20 +40,58 @@ BacktraceMap::~BacktraceMap() {
 }
 
 void BacktraceMap::FillIn(uintptr_t addr, backtrace_map_t* map) {
-  for (BacktraceMap::const_iterator it = begin();
-       it != end(); ++it) {
-    if (addr >= it->start && addr < it->end) {
-      *map = *it;
-      return;
-    }
+  // Find the last map starting at or below addr.
+  const_iterator it = std::upper_bound(begin(), end(), addr,
+      [](uintptr_t addr, const backtrace_map_t& map) { return addr < map.start; });
+  if (it != begin() && addr < (--it)->end) {
+    *map = *it;
+    return;
   }
   *map = {};
 }
 
+#if !defined(__APPLE__)
+static bool ParseHex(const char** line, uintptr_t* value) {
+  const char* p = *line;
+  uintptr_t v = 0;
+  for (;; p++) {
+    int digit;
+    if (*p >= '0' && *p <= '9') {
+      digit = *p - '0';
+    } else if (*p >= 'a' && *p <= 'f') {
+      digit = *p - 'a' + 10;
+    } else if (*p >= 'A' && *p <= 'F') {
+      digit = *p - 'A' + 10;
+    } else {
+      break;
+    }
+    v = (v << 4) | digit;
+  }
+  if (p == *line) {
+    return false;
+  }
+  *line = p;
+  *value = v;
+  return true;
+}
+
+static bool SkipField(const char** line) {
+  const char* p = *line;
+  while (*p != '\0' && *p != ' ') {
+    p++;
+  }
+  if (p == *line || *p != ' ') {
+    return false;
+  }
+  *line = p + 1;
+  return true;
+}
+#endif
+
 bool BacktraceMap::ParseLine(const char* line, backtrace_map_t* map) {
-  unsigned long int start;
-  unsigned long int end;
-  char permissions[5];
+  uintptr_t start;
+  uintptr_t end;
+  const char* permissions;
   int name_pos;
 
 #if defined(__APPLE__)
@@ -56,18 +99,37 @@ bool BacktraceMap::ParseLine(const char* line, backtrace_map_t* map) {
 // __TEXT                 0009f000-000a1000 [    8K     8K] r-x/rwx SM=COW  /Volumes/android/dalvik-dev/out/host/darwin-x86/bin/libcorkscrew_test\n
 // 012345678901234567890123456789012345678901234567890123456789
 // 0         1         2         3         4         5
+  unsigned long int start_l;
+  unsigned long int end_l;
+  char perms[5];
   if (sscanf(line, "%*21c %lx-%lx [%*13c] %3c/%*3c SM=%*3c  %n",
-             &start, &end, permissions, &name_pos) != 3) {
+             &start_l, &end_l, perms, &name_pos) != 3) {
+    return false;
+  }
+  start = start_l;
+  end = end_l;
+  permissions = perms;
 #else
 // Linux /proc/<pid>/maps lines:
 // 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so\n
 // 012345678901234567890123456789012345678901234567890123456789
 // 0         1         2         3         4         5
-  if (sscanf(line, "%lx-%lx %4s %*x %*x:%*x %*d%n",
-             &start, &end, permissions, &name_pos) != 3) {
-#endif
+  // This runs for every line of every maps file read, so it is done by
+  // hand rather than with sscanf.
+  const char* p = line;
+  uintptr_t skipped;
+  if (!ParseHex(&p, &start) || *p++ != '-' || !ParseHex(&p, &end) || *p++ != ' ') {
+    return false;
+  }
+  permissions = p;
+  // Offset, device and inode are not used here.
+  if (!SkipField(&p) || p - permissions != 5 ||
+      !ParseHex(&p, &skipped) || *p++ != ' ' ||
+      !SkipField(&p) || !ParseHex(&p, &skipped)) {
     return false;
   }
+  name_pos = p - line;
+#endif
 
   map->start = start;
   map->end = end;
@@ -120,7 +182,7 @@ bool BacktraceMap::Build() {
   while(fgets(line, sizeof(line), fp)) {
     backtrace_map_t map;
     if (ParseLine(line, &map)) {
-      maps_.push_back(map);
+      maps_.push_back(std::move(map));
     }
   }
 #if defined(__APPLE__)
@@ -129,9 +191,49 @@ bool BacktraceMap::Build() {
   fclose(fp);
 #endif
 
+  // FillIn depends on the order; /proc/<pid>/maps is already sorted.
+  auto by_start = [](const backtrace_map_t& a, const backtrace_map_t& b) {
+    return a.start < b.start;
+  };
+  if (!std::is_sorted(maps_.begin(), maps_.end(), by_start)) {
+    std::sort(maps_.begin(), maps_.end(), by_start);
+  }
   return true;
 }
 
+std::shared_ptr<BacktraceMap> BacktraceMap::CreateShared(pid_t pid) {
+  static std::mutex lock;
+  static auto* cache = new std::unordered_map<pid_t, std::weak_ptr<BacktraceMap>>;
+
+  if (pid < 0) {
+    pid = getpid();
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  std::shared_ptr<BacktraceMap> map = (*cache)[pid].lock();
+  if (map) {
+    return map;
+  }
+
+  // Drop the entries of processes nobody is looking at any more, so the
+  // cache stays as small as the set of live users.
+  for (auto it = cache->begin(); it != cache->end();) {
+    if (it->first != pid && it->second.expired()) {
+      it = cache->erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  map.reset(Create(pid));
+  if (map) {
+    (*cache)[pid] = map;
+  } else {
+    cache->erase(pid);
+  }
+  return map;
+}
+
 #if defined(__APPLE__)
 // Corkscrew and libunwind don't compile on the mac, so create a generic
 // map object.
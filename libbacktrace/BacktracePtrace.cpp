@@ -20,6 +20,7 @@
 #include <sys/param.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ucontext.h>
 #include <unistd.h>
 
@@ -30,6 +31,21 @@
 #include "BacktracePtrace.h"
 #include "thread_utils.h"
 
+BacktracePtrace::BacktracePtrace(pid_t pid, pid_t tid, BacktraceMap* map)
+    : Backtrace(pid, tid, map), next_cache_block_(0), use_vm_readv_(true) {
+}
+
+BacktracePtrace::~BacktracePtrace() {
+}
+
+void BacktracePtrace::ClearCache() {
+  if (cache_) {
+    for (size_t i = 0; i < kCacheBlocks; i++) {
+      cache_[i].valid = false;
+    }
+  }
+}
+
 #if !defined(__APPLE__)
 static bool PtraceRead(pid_t tid, uintptr_t addr, word_t* out_value) {
   // ptrace() returns -1 and sets errno when the operation fails.
@@ -41,39 +57,43 @@ static bool PtraceRead(pid_t tid, uintptr_t addr, word_t* out_value) {
   }
   return true;
 }
-#endif
 
-bool BacktracePtrace::ReadWord(uintptr_t ptr, word_t* out_value) {
-#if defined(__APPLE__)
-  BACK_LOGW("MacOS does not support reading from another pid.");
-  return false;
-#else
-  if (!VerifyReadWordArgs(ptr, out_value)) {
-    return false;
+// Returns the kCacheBlockSize bytes at addr, which must be aligned, or
+// nullptr if they can't be read in one go.
+const uint8_t* BacktracePtrace::GetCacheBlock(uintptr_t addr) {
+  if (!use_vm_readv_) {
+    return nullptr;
   }
-
-  backtrace_map_t map;
-  FillInMap(ptr, &map);
-  if (!BacktraceMap::IsValid(map) || !(map.flags & PROT_READ)) {
-    return false;
+  if (!cache_) {
+    cache_.reset(new CacheBlock[kCacheBlocks]);
+    ClearCache();
+  }
+  for (size_t i = 0; i < kCacheBlocks; i++) {
+    if (cache_[i].valid && cache_[i].addr == addr) {
+      return cache_[i].data;
+    }
   }
 
-  return PtraceRead(Tid(), ptr, out_value);
-#endif
-}
+  CacheBlock* block = &cache_[next_cache_block_];
+  next_cache_block_ = (next_cache_block_ + 1) % kCacheBlocks;
+  block->valid = false;
 
-size_t BacktracePtrace::Read(uintptr_t addr, uint8_t* buffer, size_t bytes) {
-#if defined(__APPLE__)
-  BACK_LOGW("MacOS does not support reading from another pid.");
-  return 0;
-#else
-  backtrace_map_t map;
-  FillInMap(addr, &map);
-  if (!BacktraceMap::IsValid(map) || !(map.flags & PROT_READ)) {
-    return 0;
+  struct iovec local_io = { block->data, kCacheBlockSize };
+  struct iovec remote_io = { reinterpret_cast<void*>(addr), kCacheBlockSize };
+  ssize_t bytes = process_vm_readv(Tid(), &local_io, 1, &remote_io, 1, 0);
+  if (bytes != static_cast<ssize_t>(kCacheBlockSize)) {
+    if (bytes == -1 && (errno == ENOSYS || errno == EPERM)) {
+      // Not available or not allowed, stick to ptrace from now on.
+      use_vm_readv_ = false;
+    }
+    return nullptr;
   }
+  block->addr = addr;
+  block->valid = true;
+  return block->data;
+}
 
-  bytes = MIN(map.end - addr, bytes);
+size_t BacktracePtrace::PtraceReadBytes(uintptr_t addr, uint8_t* buffer, size_t bytes) {
   size_t bytes_read = 0;
   word_t data_word;
   size_t align_bytes = addr & (sizeof(word_t) - 1);
@@ -109,5 +129,59 @@ size_t BacktracePtrace::Read(uintptr_t addr, uint8_t* buffer, size_t bytes) {
     bytes_read += left_over;
   }
   return bytes_read;
+}
+#endif
+
+bool BacktracePtrace::ReadWord(uintptr_t ptr, word_t* out_value) {
+#if defined(__APPLE__)
+  BACK_LOGW("MacOS does not support reading from another pid.");
+  return false;
+#else
+  if (!VerifyReadWordArgs(ptr, out_value)) {
+    return false;
+  }
+
+  backtrace_map_t map;
+  FillInMap(ptr, &map);
+  if (!BacktraceMap::IsValid(map) || !(map.flags & PROT_READ)) {
+    return false;
+  }
+
+  // ReadWord only takes aligned addresses, so the word is in one block.
+  const uint8_t* block = GetCacheBlock(ptr & ~(kCacheBlockSize - 1));
+  if (block != nullptr) {
+    memcpy(out_value, block + (ptr & (kCacheBlockSize - 1)), sizeof(word_t));
+    return true;
+  }
+  return PtraceRead(Tid(), ptr, out_value);
+#endif
+}
+
+size_t BacktracePtrace::Read(uintptr_t addr, uint8_t* buffer, size_t bytes) {
+#if defined(__APPLE__)
+  BACK_LOGW("MacOS does not support reading from another pid.");
+  return 0;
+#else
+  backtrace_map_t map;
+  FillInMap(addr, &map);
+  if (!BacktraceMap::IsValid(map) || !(map.flags & PROT_READ)) {
+    return 0;
+  }
+
+  bytes = MIN(map.end - addr, bytes);
+  size_t bytes_read = 0;
+  while (bytes_read < bytes) {
+    uintptr_t block_addr = (addr + bytes_read) & ~(kCacheBlockSize - 1);
+    const uint8_t* block = GetCacheBlock(block_addr);
+    if (block == nullptr) {
+      return bytes_read + PtraceReadBytes(addr + bytes_read, buffer + bytes_read,
+                                          bytes - bytes_read);
+    }
+    size_t offset = addr + bytes_read - block_addr;
+    size_t copy_bytes = MIN(kCacheBlockSize - offset, bytes - bytes_read);
+    memcpy(buffer + bytes_read, block + offset, copy_bytes);
+    bytes_read += copy_bytes;
+  }
+  return bytes_read;
 #endif
 }
@@ -20,18 +20,44 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <memory>
+
 #include <backtrace/Backtrace.h>
 
 class BacktraceMap;
 
 class BacktracePtrace : public Backtrace {
 public:
-  BacktracePtrace(pid_t pid, pid_t tid, BacktraceMap* map) : Backtrace(pid, tid, map) {}
-  virtual ~BacktracePtrace() {}
+  BacktracePtrace(pid_t pid, pid_t tid, BacktraceMap* map);
+  virtual ~BacktracePtrace();
 
   size_t Read(uintptr_t addr, uint8_t* buffer, size_t bytes);
 
   bool ReadWord(uintptr_t ptr, word_t* out_value);
+
+protected:
+  // Memory is read a block at a time with process_vm_readv and the last few
+  // blocks are kept, which is only right while the thread stays stopped.
+  // Forget them before looking at the thread again.
+  void ClearCache();
+
+private:
+  static const size_t kCacheBlockSize = 4096;
+  static const size_t kCacheBlocks = 16;
+
+  struct CacheBlock {
+    uintptr_t addr;
+    bool valid;
+    uint8_t data[kCacheBlockSize];
+  };
+
+  const uint8_t* GetCacheBlock(uintptr_t addr);
+  size_t PtraceReadBytes(uintptr_t addr, uint8_t* buffer, size_t bytes);
+
+  std::unique_ptr<CacheBlock[]> cache_;
+  size_t next_cache_block_;
+  // Cleared if process_vm_readv isn't allowed at all
+  bool use_vm_readv_;
 };
 
 #endif // _LIBBACKTRACE_BACKTRACE_PTRACE_H
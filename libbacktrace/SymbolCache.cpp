@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <backtrace/BacktraceMap.h>
+
+#include "SymbolCache.h"
+
+// The cache is emptied when it holds this many names, which is far more
+// than the distinct pcs in a dump of every thread of a large process.
+static constexpr size_t kMaxSymbols = 32768;
+
+struct Symbol {
+  std::string name;
+  uintptr_t offset;
+};
+
+struct MapSymbols {
+  uintptr_t end = 0;
+  std::string file;
+  // Keyed by pc - start.
+  std::unordered_map<uintptr_t, Symbol> symbols;
+};
+
+static std::mutex g_lock;
+static std::unordered_map<uintptr_t, MapSymbols>* g_maps;
+static size_t g_num_symbols;
+
+static bool Cacheable(const backtrace_map_t& map) {
+  return BacktraceMap::IsValid(map) && !map.name.empty() && map.name[0] == '/' &&
+      strncmp(map.name.c_str(), "/dev/", 5) != 0;
+}
+
+bool SymbolCache::Find(const backtrace_map_t& map, uintptr_t pc, std::string* name,
+                       uintptr_t* offset) {
+  if (!Cacheable(map)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(g_lock);
+  if (g_maps == nullptr) {
+    return false;
+  }
+  auto map_it = g_maps->find(map.start);
+  if (map_it == g_maps->end() || map_it->second.end != map.end ||
+      map_it->second.file != map.name) {
+    return false;
+  }
+  auto it = map_it->second.symbols.find(pc - map.start);
+  if (it == map_it->second.symbols.end()) {
+    return false;
+  }
+  *name = it->second.name;
+  *offset = it->second.offset;
+  return true;
+}
+
+void SymbolCache::Add(const backtrace_map_t& map, uintptr_t pc, const std::string& name,
+                      uintptr_t offset) {
+  if (!Cacheable(map)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(g_lock);
+  if (g_maps == nullptr) {
+    g_maps = new std::unordered_map<uintptr_t, MapSymbols>;
+  }
+  if (g_num_symbols >= kMaxSymbols) {
+    g_maps->clear();
+    g_num_symbols = 0;
+  }
+
+  MapSymbols& map_symbols = (*g_maps)[map.start];
+  if (map_symbols.end != map.end || map_symbols.file != map.name) {
+    // Something else is mapped here now.
+    g_num_symbols -= map_symbols.symbols.size();
+    map_symbols.symbols.clear();
+    map_symbols.end = map.end;
+    map_symbols.file = map.name;
+  }
+  if (map_symbols.symbols.emplace(pc - map.start, Symbol{name, offset}).second) {
+    g_num_symbols++;
+  }
+}
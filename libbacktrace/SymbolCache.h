@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBBACKTRACE_SYMBOL_CACHE_H
+#define _LIBBACKTRACE_SYMBOL_CACHE_H
+
+#include <stdint.h>
+
+#include <string>
+
+#include <backtrace/BacktraceMap.h>
+
+// Function names found by libunwind, shared by every Backtrace in the
+// process, since looking one up means searching the ELF symbol tables and
+// the same pcs come up in backtrace after backtrace. Names are filed under
+// the map the pc is in, keyed by its start and file name, so that a
+// different library mapped at the same place doesn't get them. Only maps
+// of regular files are cached; anonymous and /dev maps can hold code that
+// changes, such as the JIT's.
+class SymbolCache {
+public:
+  // Returns true and sets name and offset if pc, in map, has been looked
+  // up before. A cached name may be empty: not finding one is cached too.
+  static bool Find(const backtrace_map_t& map, uintptr_t pc, std::string* name,
+                   uintptr_t* offset);
+
+  static void Add(const backtrace_map_t& map, uintptr_t pc, const std::string& name,
+                  uintptr_t offset);
+};
+
+#endif // _LIBBACKTRACE_SYMBOL_CACHE_H
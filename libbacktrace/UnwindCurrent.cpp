@@ -26,18 +26,27 @@
 #include <backtrace/Backtrace.h>
 
 #include "BacktraceLog.h"
+#include "SymbolCache.h"
 #include "UnwindCurrent.h"
 
 std::string UnwindCurrent::GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) {
+  backtrace_map_t map;
+  FillInMap(pc, &map);
+  std::string name;
+  if (SymbolCache::Find(map, pc, &name, offset)) {
+    return name;
+  }
+
   *offset = 0;
   char buf[512];
   unw_word_t value;
   if (unw_get_proc_name_by_ip(unw_local_addr_space, pc, buf, sizeof(buf),
                               &value, &context_) >= 0 && buf[0] != '\0') {
     *offset = static_cast<uintptr_t>(value);
-    return buf;
+    name = buf;
   }
-  return "";
+  SymbolCache::Add(map, pc, name, *offset);
+  return name;
 }
 
 void UnwindCurrent::GetUnwContextFromUcontext(const ucontext_t* ucontext) {
@@ -19,6 +19,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <mutex>
+
 #include <backtrace/BacktraceMap.h>
 
 #include <libunwind.h>
@@ -60,9 +63,10 @@ bool UnwindMapRemote::GenerateMap() {
     map.flags = unw_map.flags;
     map.name = unw_map.path;
 
-    // The maps are in descending order, but we want them in ascending order.
-    maps_.push_front(map);
+    maps_.push_back(map);
   }
+  // The maps are in descending order, but we want them in ascending order.
+  std::reverse(maps_.begin(), maps_.end());
 
   return true;
 }
@@ -105,11 +109,12 @@ bool UnwindMapLocal::GenerateMap() {
 
       free(unw_map.path);
 
-      // The maps are in descending order, but we want them in ascending order.
-      maps_.push_front(map);
+      maps_.push_back(map);
     }
     // Check to see if the map changed while getting the data.
     if (ret != -UNW_EINVAL) {
+      // The maps are in descending order, but we want them in ascending order.
+      std::reverse(maps_.begin(), maps_.end());
       return true;
     }
   }
@@ -123,6 +128,9 @@ bool UnwindMapLocal::Build() {
 }
 
 void UnwindMapLocal::FillIn(uintptr_t addr, backtrace_map_t* map) {
+  // A map from CreateShared can be used by several threads at once, and any
+  // of them may regenerate it here.
+  std::lock_guard<std::mutex> guard(lock_);
   BacktraceMap::FillIn(addr, map);
   if (!IsValid(*map)) {
     // Check to see if the underlying map changed and regenerate the map
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <mutex>
+
 #include <backtrace/BacktraceMap.h>
 
 // The unw_map_cursor_t structure is different depending on whether it is
@@ -60,6 +62,7 @@ private:
   bool GenerateMap();
 
   bool map_created_;
+  std::mutex lock_;
 };
 
 #endif // _LIBBACKTRACE_UNWIND_MAP_H
@@ -25,6 +25,7 @@
 #include <backtrace/BacktraceMap.h>
 
 #include "BacktraceLog.h"
+#include "SymbolCache.h"
 #include "UnwindMap.h"
 #include "UnwindPtrace.h"
 
@@ -58,6 +59,9 @@ bool UnwindPtrace::Unwind(size_t num_ignore_frames, ucontext_t* ucontext) {
     return false;
   }
 
+  // The thread may have run since the last unwind.
+  ClearCache();
+
   addr_space_ = unw_create_addr_space(&_UPT_accessors, 0);
   if (!addr_space_) {
     BACK_LOGW("unw_create_addr_space failed.");
@@ -123,13 +127,23 @@ bool UnwindPtrace::Unwind(size_t num_ignore_frames, ucontext_t* ucontext) {
 }
 
 std::string UnwindPtrace::GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) {
+  // Processes forked from the same parent, zygote's children in particular,
+  // share the cache for the libraries they have in common.
+  backtrace_map_t map;
+  FillInMap(pc, &map);
+  std::string name;
+  if (SymbolCache::Find(map, pc, &name, offset)) {
+    return name;
+  }
+
   *offset = 0;
   char buf[512];
   unw_word_t value;
   if (unw_get_proc_name_by_ip(addr_space_, pc, buf, sizeof(buf), &value,
                               upt_info_) >= 0 && buf[0] != '\0') {
     *offset = static_cast<uintptr_t>(value);
-    return buf;
+    name = buf;
   }
-  return "";
+  SymbolCache::Add(map, pc, name, *offset);
+  return name;
 }
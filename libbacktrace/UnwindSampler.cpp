@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <libunwind.h>
+#include <libunwind-ptrace.h>
+
+#include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
+
+#include "BacktraceCurrent.h"
+#include "BacktraceLog.h"
+#include "SymbolCache.h"
+#include "UnwindMap.h"
+#include "UnwindSampler.h"
+#include "thread_utils.h"
+
+#if defined(__arm__) || defined(__aarch64__) || defined(__i386__) || defined(__x86_64__)
+#define SAMPLER_SUPPORTED 1
+#endif
+
+// Don't look for new libraries more often than this when unwinding keeps
+// finding pcs that are not in any map.
+#define MAP_REFRESH_INTERVAL_NS 1000000000ULL
+
+enum SampleState {
+  // Waiting for the thread to run the signal handler.
+  SAMPLE_SIGNALLED,
+  // The handler is filling in the sample.
+  SAMPLE_COPYING,
+  SAMPLE_CAPTURED,
+};
+
+// The sampler taking a snapshot, if any, and the number of signal handlers
+// that might be looking at it.
+static UnwindSampler* g_sampler;
+static int g_handlers_running;
+
+// The sampler whose accessors are in use on this thread.
+static thread_local UnwindSampler* t_sampler;
+
+static uint64_t NanoTime() {
+  struct timespec t = { 0, 0 };
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
+}
+
+#if defined(SAMPLER_SUPPORTED)
+// Stores the registers libunwind knows about, indexed by libunwind register
+// number.
+static void CopyRegisters(const ucontext_t* ucontext, unw_word_t* regs) {
+#if defined(__arm__)
+  // arm_r0 to arm_pc are r0 to r15, in order.
+  const unsigned long* r = &ucontext->uc_mcontext.arm_r0;
+  for (int i = 0; i < 16; i++) {
+    regs[UNW_ARM_R0 + i] = r[i];
+  }
+#elif defined(__aarch64__)
+  for (int i = 0; i < 31; i++) {
+    regs[UNW_AARCH64_X0 + i] = ucontext->uc_mcontext.regs[i];
+  }
+  regs[UNW_AARCH64_SP] = ucontext->uc_mcontext.sp;
+  regs[UNW_AARCH64_PC] = ucontext->uc_mcontext.pc;
+#elif defined(__i386__)
+  const greg_t* gregs = ucontext->uc_mcontext.gregs;
+  regs[UNW_X86_EAX] = gregs[REG_EAX];
+  regs[UNW_X86_EDX] = gregs[REG_EDX];
+  regs[UNW_X86_ECX] = gregs[REG_ECX];
+  regs[UNW_X86_EBX] = gregs[REG_EBX];
+  regs[UNW_X86_ESI] = gregs[REG_ESI];
+  regs[UNW_X86_EDI] = gregs[REG_EDI];
+  regs[UNW_X86_EBP] = gregs[REG_EBP];
+  regs[UNW_X86_ESP] = gregs[REG_ESP];
+  regs[UNW_X86_EIP] = gregs[REG_EIP];
+#elif defined(__x86_64__)
+  const greg_t* gregs = ucontext->uc_mcontext.gregs;
+  regs[UNW_X86_64_RAX] = gregs[REG_RAX];
+  regs[UNW_X86_64_RDX] = gregs[REG_RDX];
+  regs[UNW_X86_64_RCX] = gregs[REG_RCX];
+  regs[UNW_X86_64_RBX] = gregs[REG_RBX];
+  regs[UNW_X86_64_RSI] = gregs[REG_RSI];
+  regs[UNW_X86_64_RDI] = gregs[REG_RDI];
+  regs[UNW_X86_64_RBP] = gregs[REG_RBP];
+  regs[UNW_X86_64_RSP] = gregs[REG_RSP];
+  regs[UNW_X86_64_R8] = gregs[REG_R8];
+  regs[UNW_X86_64_R9] = gregs[REG_R9];
+  regs[UNW_X86_64_R10] = gregs[REG_R10];
+  regs[UNW_X86_64_R11] = gregs[REG_R11];
+  regs[UNW_X86_64_R12] = gregs[REG_R12];
+  regs[UNW_X86_64_R13] = gregs[REG_R13];
+  regs[UNW_X86_64_R14] = gregs[REG_R14];
+  regs[UNW_X86_64_R15] = gregs[REG_R15];
+  regs[UNW_X86_64_RIP] = gregs[REG_RIP];
+#endif
+}
+#endif
+
+static void SnapshotHandler(int, siginfo_t*, void* sigcontext) {
+  int saved_errno = errno;
+  __atomic_add_fetch(&g_handlers_running, 1, __ATOMIC_SEQ_CST);
+  UnwindSampler* sampler = __atomic_load_n(&g_sampler, __ATOMIC_SEQ_CST);
+  if (sampler != nullptr) {
+    sampler->Capture(reinterpret_cast<const ucontext_t*>(sigcontext));
+  }
+  __atomic_sub_fetch(&g_handlers_running, 1, __ATOMIC_SEQ_CST);
+  errno = saved_errno;
+}
+
+static void LateSignalLogOnly(int, siginfo_t*, void*) {
+  BACK_LOGE("pid %d, tid %d: Received a late sampling signal %d\n", getpid(), gettid(),
+            THREAD_SIGNAL);
+}
+
+static int AccessMem(unw_addr_space_t, unw_word_t addr, unw_word_t* value, int write, void*) {
+  if (write || !t_sampler->ReadWord(addr, value)) {
+    return -UNW_EINVAL;
+  }
+  return 0;
+}
+
+static int AccessReg(unw_addr_space_t, unw_regnum_t regnum, unw_word_t* value, int write, void*) {
+  if (write || !t_sampler->ReadRegister(regnum, value)) {
+    return -UNW_EBADREG;
+  }
+  return 0;
+}
+
+static int AccessFpreg(unw_addr_space_t, unw_regnum_t, unw_fpreg_t*, int, void*) {
+  return -UNW_EBADREG;
+}
+
+static int Resume(unw_addr_space_t, unw_cursor_t*, void*) {
+  return -UNW_EINVAL;
+}
+
+UnwindSampler::UnwindSampler(size_t max_threads, size_t stack_bytes)
+    : stack_bytes_(stack_bytes < kMaxStackBytes ? stack_bytes : kMaxStackBytes),
+      samples_(max_threads), stacks_(new uint8_t[max_threads * stack_bytes_]),
+      num_signalled_(0), num_samples_(0), map_stale_(true), map_time_ns_(0),
+      addr_space_(nullptr), upt_info_(nullptr), unwinding_(nullptr) {
+  for (size_t i = 0; i < max_threads; i++) {
+    samples_[i].stack = &stacks_[i * stack_bytes_];
+  }
+  sem_init(&captured_, 0, 0);
+}
+
+UnwindSampler::~UnwindSampler() {
+  if (upt_info_) {
+    _UPT_destroy(upt_info_);
+    upt_info_ = nullptr;
+  }
+  if (addr_space_) {
+    unw_map_set(addr_space_, nullptr);
+    unw_destroy_addr_space(addr_space_);
+    addr_space_ = nullptr;
+  }
+  sem_destroy(&captured_);
+}
+
+bool UnwindSampler::Init() {
+  // Finding and parsing the unwind info is exactly what the ptrace
+  // accessors do, but registers and memory come from the sample.
+  unw_accessors_t accessors = _UPT_accessors;
+  accessors.access_mem = AccessMem;
+  accessors.access_reg = AccessReg;
+  accessors.access_fpreg = AccessFpreg;
+  accessors.resume = Resume;
+
+  addr_space_ = unw_create_addr_space(&accessors, 0);
+  if (!addr_space_) {
+    BACK_LOGW("unw_create_addr_space failed.");
+    return false;
+  }
+  // The address space outlives the samples, so what libunwind learns from
+  // one sample is still there for the next.
+  unw_set_caching_policy(addr_space_, UNW_CACHE_GLOBAL);
+
+  upt_info_ = reinterpret_cast<struct UPT_info*>(_UPT_create(getpid()));
+  if (!upt_info_) {
+    BACK_LOGW("Failed to create upt info.");
+    return false;
+  }
+  return RefreshMap();
+}
+
+bool UnwindSampler::RefreshMap() {
+  unw_map_set(addr_space_, nullptr);
+  map_.reset(new UnwindMapRemote(getpid()));
+  if (!map_->Build()) {
+    BACK_LOGW("Failed to build the map.");
+    map_.reset();
+    return false;
+  }
+  unw_map_set(addr_space_, map_->GetMapCursor());
+  unw_flush_cache(addr_space_, 0, 0);
+  map_stale_ = false;
+  map_time_ns_ = NanoTime();
+  return true;
+}
+
+void UnwindSampler::Capture(const ucontext_t* ucontext) {
+#if defined(SAMPLER_SUPPORTED)
+  pid_t tid = gettid();
+  for (size_t i = 0; i < num_signalled_; i++) {
+    Sample* sample = &samples_[i];
+    if (sample->tid != tid) {
+      continue;
+    }
+    int expected = SAMPLE_SIGNALLED;
+    if (!__atomic_compare_exchange_n(&sample->state, &expected, SAMPLE_COPYING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return;
+    }
+
+    CopyRegisters(ucontext, sample->regs);
+    sample->stack_start = sample->regs[UNW_REG_SP];
+
+    // Copy the stack with process_vm_readv rather than memcpy, so that
+    // reaching the end of the stack mapping stops the copy instead of
+    // faulting. One element per 4KiB, as a partial read never splits an
+    // element.
+    const uintptr_t chunk = 4096;
+    struct iovec remote[kMaxStackBytes / chunk + 1];
+    size_t num_remote = 0;
+    uintptr_t addr = sample->stack_start;
+    uintptr_t end = addr + stack_bytes_;
+    while (addr < end) {
+      uintptr_t next = (addr & ~(chunk - 1)) + chunk;
+      if (next > end) {
+        next = end;
+      }
+      remote[num_remote].iov_base = reinterpret_cast<void*>(addr);
+      remote[num_remote].iov_len = next - addr;
+      num_remote++;
+      addr = next;
+    }
+    struct iovec local = { sample->stack, stack_bytes_ };
+    ssize_t bytes = process_vm_readv(getpid(), &local, 1, remote, num_remote, 0);
+    sample->stack_size = (bytes > 0) ? bytes : 0;
+
+    __atomic_store_n(&sample->state, SAMPLE_CAPTURED, __ATOMIC_RELEASE);
+    sem_post(&captured_);
+    return;
+  }
+#else
+  (void)ucontext;
+#endif
+}
+
+size_t UnwindSampler::Snapshot(int timeout_ms) {
+  num_samples_ = 0;
+  if (map_stale_ && NanoTime() - map_time_ns_ >= MAP_REFRESH_INTERVAL_NS) {
+    RefreshMap();
+  }
+  if (!map_) {
+    return 0;
+  }
+
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    BACK_LOGW("Cannot list threads: %s", strerror(errno));
+    return 0;
+  }
+  pid_t self = gettid();
+  size_t num_threads = 0;
+  struct dirent* entry;
+  while (num_threads < samples_.size() && (entry = readdir(dir)) != nullptr) {
+    pid_t tid = atoi(entry->d_name);
+    if (tid <= 0 || tid == self) {
+      continue;
+    }
+    samples_[num_threads].tid = tid;
+    samples_[num_threads].state = SAMPLE_SIGNALLED;
+    samples_[num_threads].stack_size = 0;
+    num_threads++;
+  }
+  closedir(dir);
+
+  // Keep UnwindThread from changing the action while the signals are out.
+  pthread_mutex_lock(&g_sigaction_mutex);
+
+  num_signalled_ = num_threads;
+  __atomic_store_n(&g_sampler, this, __ATOMIC_SEQ_CST);
+
+  struct sigaction act, oldact;
+  memset(&act, 0, sizeof(act));
+  act.sa_sigaction = SnapshotHandler;
+  act.sa_flags = SA_RESTART | SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&act.sa_mask);
+  if (sigaction(THREAD_SIGNAL, &act, &oldact) != 0) {
+    BACK_LOGE("sigaction failed: %s", strerror(errno));
+    __atomic_store_n(&g_sampler, nullptr, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&g_sigaction_mutex);
+    return 0;
+  }
+
+  pid_t pid = getpid();
+  size_t pending = 0;
+  for (size_t i = 0; i < num_threads; i++) {
+    if (tgkill(pid, samples_[i].tid, THREAD_SIGNAL) == 0) {
+      pending++;
+    }
+    // Otherwise the thread has exited; it stays SAMPLE_SIGNALLED and is
+    // left out below.
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  while (pending > 0) {
+    if (sem_timedwait(&captured_, &deadline) == 0) {
+      pending--;
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+
+  // Once no handler can still be using the samples, they are ours again.
+  __atomic_store_n(&g_sampler, nullptr, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&g_handlers_running, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+
+  if (pending > 0 && oldact.sa_sigaction == nullptr) {
+    // A thread that didn't get the signal in time would otherwise be killed
+    // by it when it does.
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = LateSignalLogOnly;
+    act.sa_flags = SA_RESTART | SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&act.sa_mask);
+    sigaction(THREAD_SIGNAL, &act, nullptr);
+  } else {
+    sigaction(THREAD_SIGNAL, &oldact, nullptr);
+  }
+  pthread_mutex_unlock(&g_sigaction_mutex);
+
+  while (sem_trywait(&captured_) == 0) {
+  }
+  num_signalled_ = 0;
+
+  for (size_t i = 0; i < num_threads; i++) {
+    if (samples_[i].state == SAMPLE_CAPTURED) {
+      if (i != num_samples_) {
+        std::swap(samples_[num_samples_], samples_[i]);
+      }
+      num_samples_++;
+    }
+  }
+  return num_samples_;
+}
+
+pid_t UnwindSampler::GetTid(size_t index) {
+  return (index < num_samples_) ? samples_[index].tid : -1;
+}
+
+bool UnwindSampler::ReadWord(uintptr_t addr, unw_word_t* value) {
+  const Sample* sample = unwinding_;
+  if (addr >= sample->stack_start && addr - sample->stack_start < sample->stack_size &&
+      sample->stack_size - (addr - sample->stack_start) >= sizeof(*value)) {
+    memcpy(value, &sample->stack[addr - sample->stack_start], sizeof(*value));
+    return true;
+  }
+
+  // Everything else, the code and unwind info in particular, is read live.
+  backtrace_map_t map;
+  map_->FillIn(addr, &map);
+  if (!BacktraceMap::IsValid(map) || !(map.flags & PROT_READ) ||
+      map.end - addr < sizeof(*value)) {
+    return false;
+  }
+  memcpy(value, reinterpret_cast<void*>(addr), sizeof(*value));
+  return true;
+}
+
+bool UnwindSampler::ReadRegister(unw_regnum_t regnum, unw_word_t* value) {
+  if (regnum < 0 || static_cast<size_t>(regnum) >= kMaxRegs) {
+    return false;
+  }
+  *value = unwinding_->regs[regnum];
+  return true;
+}
+
+bool UnwindSampler::Unwind(size_t index, std::vector<backtrace_frame_data_t>* frames,
+                           bool with_names) {
+  frames->clear();
+  if (index >= num_samples_) {
+    return false;
+  }
+
+  unwinding_ = &samples_[index];
+  t_sampler = this;
+
+  unw_cursor_t cursor;
+  int ret = unw_init_remote(&cursor, addr_space_, upt_info_);
+  if (ret < 0) {
+    BACK_LOGW("unw_init_remote failed %d", ret);
+    t_sampler = nullptr;
+    unwinding_ = nullptr;
+    return false;
+  }
+
+  size_t num_frames = 0;
+  do {
+    unw_word_t pc;
+    ret = unw_get_reg(&cursor, UNW_REG_IP, &pc);
+    if (ret < 0) {
+      BACK_LOGW("Failed to read IP %d", ret);
+      break;
+    }
+    unw_word_t sp;
+    ret = unw_get_reg(&cursor, UNW_REG_SP, &sp);
+    if (ret < 0) {
+      BACK_LOGW("Failed to read SP %d", ret);
+      break;
+    }
+
+    frames->resize(num_frames + 1);
+    backtrace_frame_data_t* frame = &frames->at(num_frames);
+    frame->num = num_frames;
+    frame->pc = static_cast<uintptr_t>(pc);
+    frame->sp = static_cast<uintptr_t>(sp);
+    frame->stack_size = 0;
+    if (num_frames > 0) {
+      backtrace_frame_data_t* prev = &frames->at(num_frames - 1);
+      prev->stack_size = frame->sp - prev->sp;
+    }
+
+    map_->FillIn(frame->pc, &frame->map);
+    if (!BacktraceMap::IsValid(frame->map) && frame->pc != 0) {
+      // Probably a library loaded since the map was read.
+      map_stale_ = true;
+    }
+
+    if (with_names &&
+        !SymbolCache::Find(frame->map, frame->pc, &frame->func_name, &frame->func_offset)) {
+      char buf[512];
+      unw_word_t offset;
+      if (unw_get_proc_name_by_ip(addr_space_, pc, buf, sizeof(buf), &offset,
+                                  upt_info_) >= 0 && buf[0] != '\0') {
+        frame->func_name = buf;
+        frame->func_offset = static_cast<uintptr_t>(offset);
+      }
+      SymbolCache::Add(frame->map, frame->pc, frame->func_name, frame->func_offset);
+    }
+
+    num_frames++;
+    ret = unw_step(&cursor);
+  } while (ret > 0 && num_frames < MAX_BACKTRACE_FRAMES);
+
+  t_sampler = nullptr;
+  unwinding_ = nullptr;
+  return true;
+}
+
+BacktraceSampler* BacktraceSampler::Create(size_t max_threads, size_t stack_bytes) {
+#if defined(SAMPLER_SUPPORTED)
+  UnwindSampler* sampler = new UnwindSampler(max_threads, stack_bytes);
+  if (!sampler->Init()) {
+    delete sampler;
+    return nullptr;
+  }
+  return sampler;
+#else
+  BACK_LOGW("Sampling is not supported on this architecture.");
+  return nullptr;
+#endif
+}
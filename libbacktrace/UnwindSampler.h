@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBBACKTRACE_UNWIND_SAMPLER_H
+#define _LIBBACKTRACE_UNWIND_SAMPLER_H
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <ucontext.h>
+
+#include <memory>
+#include <vector>
+
+#include <backtrace/BacktraceSampler.h>
+
+#include <libunwind.h>
+
+#include "UnwindMap.h"
+
+// Unwinds the samples with the remote libunwind interface, on an address
+// space whose register and memory accessors read from the sample. Finding
+// and decoding unwind info is left to the ptrace accessors, which only
+// need the map of the process.
+class UnwindSampler : public BacktraceSampler {
+public:
+  UnwindSampler(size_t max_threads, size_t stack_bytes);
+  virtual ~UnwindSampler();
+
+  bool Init();
+
+  size_t Snapshot(int timeout_ms) override;
+
+  pid_t GetTid(size_t index) override;
+
+  bool Unwind(size_t index, std::vector<backtrace_frame_data_t>* frames,
+              bool with_names) override;
+
+  // Called by the signal handler of a thread being sampled.
+  void Capture(const ucontext_t* ucontext);
+
+  // Called by the libunwind accessors, while Unwind() runs.
+  bool ReadWord(uintptr_t addr, unw_word_t* value);
+  bool ReadRegister(unw_regnum_t regnum, unw_word_t* value);
+
+  // Enough for the general purpose registers of any supported architecture.
+  static constexpr size_t kMaxRegs = 33;
+
+  // The largest stack window that is taken.
+  static constexpr size_t kMaxStackBytes = 256 * 1024;
+
+private:
+  struct Sample {
+    pid_t tid;
+    int state;
+    unw_word_t regs[kMaxRegs];
+    uintptr_t stack_start;
+    size_t stack_size;
+    uint8_t* stack;
+  };
+
+  bool RefreshMap();
+
+  size_t stack_bytes_;
+  std::vector<Sample> samples_;
+  std::unique_ptr<uint8_t[]> stacks_;
+  size_t num_signalled_;
+  size_t num_samples_;
+  sem_t captured_;
+
+  std::unique_ptr<UnwindMapRemote> map_;
+  bool map_stale_;
+  uint64_t map_time_ns_;
+  unw_addr_space_t addr_space_;
+  struct UPT_info* upt_info_;
+  const Sample* unwinding_;
+};
+
+#endif // _LIBBACKTRACE_UNWIND_SAMPLER_H
@@ -41,6 +41,7 @@
 
 #include <backtrace/Backtrace.h>
 #include <backtrace/BacktraceMap.h>
+#include <backtrace/BacktraceSampler.h>
 
 #include <base/stringprintf.h>
 #include <cutils/atomic.h>
@@ -540,6 +541,53 @@ TEST(libbacktrace, thread_level_trace) {
   EXPECT_EQ(cur_action.sa_flags, new_action.sa_flags);
 }
 
+TEST(libbacktrace, sampler_threads) {
+  std::unique_ptr<BacktraceSampler> sampler(BacktraceSampler::Create());
+  ASSERT_TRUE(sampler.get() != nullptr);
+
+  thread_t thread_data = { 0, 0, 0, nullptr };
+  pthread_t thread;
+  ASSERT_TRUE(pthread_create(&thread, nullptr, ThreadLevelRun, &thread_data) == 0);
+
+  // Wait up to 2 seconds for the tid to be set.
+  ASSERT_TRUE(WaitForNonZero(&thread_data.state, 2));
+
+  struct sigaction cur_action;
+  ASSERT_TRUE(sigaction(THREAD_SIGNAL, nullptr, &cur_action) == 0);
+
+  // Later passes unwind with the tables cached by the first.
+  for (size_t pass = 0; pass < 3; pass++) {
+    size_t num_samples = sampler->Snapshot();
+    size_t index = num_samples;
+    for (size_t i = 0; i < num_samples; i++) {
+      if (sampler->GetTid(i) == thread_data.tid) {
+        index = i;
+      }
+    }
+    ASSERT_LT(index, num_samples);
+
+    std::vector<backtrace_frame_data_t> frames;
+    ASSERT_TRUE(sampler->Unwind(index, &frames, true));
+    size_t frame_num = 0;
+    while (frame_num < frames.size() && frames[frame_num].func_name != "test_level_four") {
+      frame_num++;
+    }
+    ASSERT_LT(frame_num + 3, frames.size());
+    EXPECT_EQ("test_level_three", frames[frame_num + 1].func_name);
+    EXPECT_EQ("test_level_two", frames[frame_num + 2].func_name);
+    EXPECT_EQ("test_level_one", frames[frame_num + 3].func_name);
+    EXPECT_TRUE(BacktraceMap::IsValid(frames[frame_num].map));
+  }
+
+  // Tell the thread to exit its infinite loop.
+  android_atomic_acquire_store(0, &thread_data.state);
+  ASSERT_TRUE(pthread_join(thread, nullptr) == 0);
+
+  struct sigaction new_action;
+  ASSERT_TRUE(sigaction(THREAD_SIGNAL, nullptr, &new_action) == 0);
+  EXPECT_EQ(cur_action.sa_sigaction, new_action.sa_sigaction);
+}
+
 TEST(libbacktrace, thread_ignore_frames) {
   pthread_attr_t attr;
   pthread_attr_init(&attr);
@@ -754,6 +802,60 @@ TEST(libbacktrace, fillin_erases) {
   ASSERT_EQ("", map.name);
 }
 
+TEST(libbacktrace, fillin_search) {
+  std::unique_ptr<BacktraceMap> map(BacktraceMap::Create(getpid(), true));
+  ASSERT_TRUE(map.get() != nullptr);
+
+  uintptr_t last_end = 0;
+  for (BacktraceMap::const_iterator it = map->begin(); it != map->end(); ++it) {
+    ASSERT_LE(last_end, it->start);
+    backtrace_map_t found;
+    if (last_end < it->start) {
+      map->FillIn(it->start - 1, &found);
+      EXPECT_FALSE(BacktraceMap::IsValid(found));
+    }
+    map->FillIn(it->start, &found);
+    EXPECT_EQ(it->start, found.start);
+    EXPECT_EQ(it->name, found.name);
+    map->FillIn(it->end - 1, &found);
+    EXPECT_EQ(it->start, found.start);
+    last_end = it->end;
+  }
+}
+
+TEST(libbacktrace, shared_map) {
+  std::unique_ptr<Backtrace> back1(Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD));
+  std::unique_ptr<Backtrace> back2(Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD));
+  ASSERT_TRUE(back1.get() != nullptr);
+  ASSERT_TRUE(back2.get() != nullptr);
+  ASSERT_TRUE(back1->GetMap() != nullptr);
+  EXPECT_EQ(back1->GetMap(), back2->GetMap());
+
+  std::shared_ptr<BacktraceMap> map(BacktraceMap::CreateShared(getpid()));
+  EXPECT_EQ(back1->GetMap(), map.get());
+
+  back1.reset();
+  back2.reset();
+  ASSERT_TRUE(map->begin() != map->end());
+  EXPECT_TRUE(map->IsExecutable(reinterpret_cast<uintptr_t>(&test_level_one)));
+}
+
+TEST(libbacktrace, function_name_repeated) {
+  uintptr_t pc = reinterpret_cast<uintptr_t>(&test_level_one);
+
+  // The second lookup, from another backtrace, is answered from the cache.
+  for (size_t i = 0; i < 2; i++) {
+    std::unique_ptr<Backtrace> backtrace(
+        Backtrace::Create(BACKTRACE_CURRENT_PROCESS, BACKTRACE_CURRENT_THREAD));
+    ASSERT_TRUE(backtrace.get() != nullptr);
+    uintptr_t offset;
+    EXPECT_EQ("test_level_one", backtrace->GetFunctionName(pc, &offset));
+    uintptr_t next_offset;
+    EXPECT_EQ("test_level_one", backtrace->GetFunctionName(pc + 4, &next_offset));
+    EXPECT_EQ(offset + 4, next_offset);
+  }
+}
+
 TEST(libbacktrace, format_test) {
   std::unique_ptr<Backtrace> backtrace(Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD));
   ASSERT_TRUE(backtrace.get() != nullptr);
@@ -983,6 +1085,14 @@ void RunReadTest(Backtrace* backtrace, uintptr_t read_addr) {
           << "Offset at " << i << " length " << j << " wrote too much data";
     }
   }
+
+  // Verify word reads across the page.
+  for (size_t i = 0; i < pagesize; i += sizeof(word_t)) {
+    word_t value;
+    ASSERT_TRUE(backtrace->ReadWord(read_addr + i, &value)) << "Offset at " << i;
+    ASSERT_TRUE(memcmp(&value, &expected[i], sizeof(word_t)) == 0)
+        << "Offset at " << i << " miscompared";
+  }
   delete[] data;
   delete[] expected;
 }
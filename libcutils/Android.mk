@@ -18,6 +18,7 @@ include $(CLEAR_VARS)
 
 commonSources := \
 	hashmap.c \
+	flat_hashmap.c \
 	native_handle.c \
 	config_utils.c \
 	load_file.c \
@@ -33,6 +34,10 @@ commonSources := \
 	str_parms.c \
 	fs_config.c
 
+# The target uses the per-architecture android_memset versions below.
+commonHostSources := \
+        android_memset.c \
+
 # some files must not be compiled when building against Mingw
 # they correspond to features not used by our host development tools
 # which are also hard or even impossible to port to native Win32
@@ -113,8 +118,8 @@ LOCAL_CLANG_ASFLAGS_arm += -no-integrated-as
 LOCAL_SRC_FILES_arm += arch-arm/memset32.S
 LOCAL_SRC_FILES_arm64 += arch-arm64/android_memset.S
 
-LOCAL_SRC_FILES_mips += arch-mips/android_memset.c
-LOCAL_SRC_FILES_mips64 += arch-mips/android_memset.c
+LOCAL_SRC_FILES_mips += android_memset.c
+LOCAL_SRC_FILES_mips64 += android_memset.c
 
 LOCAL_SRC_FILES_x86 += \
         arch-x86/android_memset16.S \
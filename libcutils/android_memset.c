@@ -26,10 +26,20 @@
  * SUCH DAMAGE.
  */
 
-/* generic C version for any machine */
+/*
+ * Generic C version for any machine: used on architectures without an
+ * assembly version, and on the host. x86 hosts switch to AVX2 stores when
+ * the CPU has them.
+ */
 
 #include <cutils/memory.h>
 
+#if !defined(__ANDROID__) && !defined(_WIN32) && defined(__GNUC__) && \
+        (defined(__i386__) || defined(__x86_64__))
+#define MEMSET_AVX2 1
+#include <immintrin.h>
+#endif
+
 void android_memset16(uint16_t* dst, uint16_t value, size_t size)
 {
    /* optimized version of
@@ -54,7 +64,7 @@ void android_memset16(uint16_t* dst, uint16_t value, size_t size)
 }
 
 
-void android_memset32(uint32_t* dst, uint32_t value, size_t size)
+static void memset32_generic(uint32_t* dst, uint32_t value, size_t size)
 {
    /* optimized version of
       size >>= 2;
@@ -91,3 +101,60 @@ void android_memset32(uint32_t* dst, uint32_t value, size_t size)
    }
 
 }
+
+#if MEMSET_AVX2
+
+__attribute__((target("avx2")))
+static void memset32_avx2(uint32_t* dst, uint32_t value, size_t size)
+{
+   __m256i value256 = _mm256_set1_epi32((int) value);
+
+   size >>= 2;
+   /* align to 32 bytes so that no store splits a cache line */
+   while (((uintptr_t)dst & 31) && size) {
+      *dst++ = value;
+      size--;
+   }
+   while (size >= 32) {
+      _mm256_store_si256((__m256i*) dst, value256);
+      _mm256_store_si256((__m256i*) (dst + 8), value256);
+      _mm256_store_si256((__m256i*) (dst + 16), value256);
+      _mm256_store_si256((__m256i*) (dst + 24), value256);
+      size -= 32;
+      dst += 32;
+   }
+   while (size >= 8) {
+      _mm256_store_si256((__m256i*) dst, value256);
+      size -= 8;
+      dst += 8;
+   }
+   while (size--) {
+      *dst++ = value;
+   }
+}
+
+/* Starts out generic so that it works from other constructors too. */
+static void (*memset32_impl)(uint32_t*, uint32_t, size_t) = memset32_generic;
+
+__attribute__((constructor))
+static void memset32_select(void)
+{
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      memset32_impl = memset32_avx2;
+   }
+}
+
+void android_memset32(uint32_t* dst, uint32_t value, size_t size)
+{
+   memset32_impl(dst, value, size);
+}
+
+#else
+
+void android_memset32(uint32_t* dst, uint32_t value, size_t size)
+{
+   memset32_generic(dst, value, size);
+}
+
+#endif
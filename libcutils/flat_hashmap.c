@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/flat_hashmap.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+
+#define NO_ENTRY (-1)
+
+typedef struct FlatEntry FlatEntry;
+struct FlatEntry {
+    void* key;
+    void* value;
+    uint32_t hash; /* never 0 for a live entry; 0 once removed */
+};
+
+/*
+ * Entries are appended to 'entries' in the order they are first put, and
+ * removing one only marks it, so iteration order is insertion order. The
+ * index is a linearly probed table of entry numbers, at most half full;
+ * removal shifts later members of a probe sequence back instead of leaving
+ * tombstones. Removed entries are squeezed out when 'entries' fills up.
+ */
+struct FlatHashmap {
+    FlatEntry* entries;
+    size_t entryCount;    /* entries used, including removed ones */
+    size_t entryCapacity;
+    int32_t* index;
+    size_t indexMask;
+    size_t size;          /* live entries */
+    FlatHashmapKeyType keyType;
+};
+
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static uint32_t hashKey(const FlatHashmap* map, const void* key) {
+    uint32_t h = 2166136261u;
+    const unsigned char* p;
+
+    switch (map->keyType) {
+    case FLAT_HASHMAP_INT_KEYS:
+        h = (uint32_t) (uintptr_t) key * 0x9e3779b1u;
+        h ^= h >> 16;
+        break;
+    case FLAT_HASHMAP_STRING_KEYS:
+        for (p = key; *p; p++) {
+            h = (h ^ *p) * 16777619u;
+        }
+        break;
+    case FLAT_HASHMAP_ICASE_STRING_KEYS:
+        /* Fold the way strcasecmp does in the C locale. */
+        for (p = key; *p; p++) {
+            unsigned char c = (*p >= 'A' && *p <= 'Z') ? *p + ('a' - 'A') : *p;
+            h = (h ^ c) * 16777619u;
+        }
+        break;
+    }
+    return h ? h : 1;
+}
+
+static inline bool keysEqual(const FlatHashmap* map, const void* a, const void* b) {
+    switch (map->keyType) {
+    case FLAT_HASHMAP_STRING_KEYS:
+        return strcmp(a, b) == 0;
+    case FLAT_HASHMAP_ICASE_STRING_KEYS:
+        return strcasecmp(a, b) == 0;
+    default:
+        return a == b;
+    }
+}
+
+/* Returns the index slot holding key, or -1. */
+static ssize_t findSlot(const FlatHashmap* map, const void* key, uint32_t hash) {
+    size_t slot = hash & map->indexMask;
+    int32_t e;
+
+    while ((e = map->index[slot]) != NO_ENTRY) {
+        if (map->entries[e].hash == hash && keysEqual(map, map->entries[e].key, key)) {
+            return slot;
+        }
+        slot = (slot + 1) & map->indexMask;
+    }
+    return -1;
+}
+
+static void insertIndex(FlatHashmap* map, uint32_t hash, int32_t e) {
+    size_t slot = hash & map->indexMask;
+
+    while (map->index[slot] != NO_ENTRY) {
+        slot = (slot + 1) & map->indexMask;
+    }
+    map->index[slot] = e;
+}
+
+/*
+ * Gives the map room for entryCapacity entries, dropping removed entries and
+ * rebuilding the index. entryCapacity must be at least map->size. On
+ * failure the map is left as it was.
+ */
+static bool rebuild(FlatHashmap* map, size_t entryCapacity) {
+    size_t indexSize = 8;
+    int32_t* index;
+    size_t i, j;
+
+    while (indexSize < entryCapacity * 2) {
+        indexSize <<= 1;
+    }
+    index = malloc(indexSize * sizeof(*index));
+    if (index == NULL) {
+        return false;
+    }
+    if (entryCapacity != map->entryCapacity) {
+        FlatEntry* entries = realloc(map->entries, entryCapacity * sizeof(*entries));
+        if (entries == NULL) {
+            free(index);
+            return false;
+        }
+        map->entries = entries;
+        map->entryCapacity = entryCapacity;
+    }
+
+    free(map->index);
+    map->index = index;
+    map->indexMask = indexSize - 1;
+    memset(index, 0xff, indexSize * sizeof(*index));
+
+    for (i = 0, j = 0; i < map->entryCount; i++) {
+        if (map->entries[i].hash != 0) {
+            map->entries[j] = map->entries[i];
+            insertIndex(map, map->entries[j].hash, j);
+            j++;
+        }
+    }
+    map->entryCount = j;
+    return true;
+}
+
+FlatHashmap* flatHashmapCreate(FlatHashmapKeyType keyType, size_t initialCapacity) {
+    FlatHashmap* map = calloc(1, sizeof(FlatHashmap));
+    if (map == NULL) {
+        return NULL;
+    }
+    map->keyType = keyType;
+    if (!rebuild(map, initialCapacity > 4 ? initialCapacity : 4)) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void flatHashmapFree(FlatHashmap* map) {
+    free(map->entries);
+    free(map->index);
+    free(map);
+}
+
+bool flatHashmapReserve(FlatHashmap* map, size_t capacity) {
+    if (capacity <= map->size
+            || map->entryCount + (capacity - map->size) <= map->entryCapacity) {
+        return true;
+    }
+    if (!rebuild(map, capacity)) {
+        errno = ENOMEM;
+        return false;
+    }
+    return true;
+}
+
+void flatHashmapClear(FlatHashmap* map, void (*release)(void* key, void* value)) {
+    size_t i;
+
+    if (release != NULL) {
+        for (i = 0; i < map->entryCount; i++) {
+            if (map->entries[i].hash != 0) {
+                release(map->entries[i].key, map->entries[i].value);
+            }
+        }
+    }
+    memset(map->index, 0xff, (map->indexMask + 1) * sizeof(*map->index));
+    map->entryCount = 0;
+    map->size = 0;
+}
+
+void* flatHashmapPut(FlatHashmap* map, void* key, void* value) {
+    uint32_t hash = hashKey(map, key);
+    ssize_t slot = findSlot(map, key, hash);
+    FlatEntry* entry;
+
+    if (slot >= 0) {
+        void* oldValue;
+        entry = &map->entries[map->index[slot]];
+        oldValue = entry->value;
+        entry->value = value;
+        return oldValue;
+    }
+
+    if (map->entryCount == map->entryCapacity) {
+        /* Reclaim removed entries if that frees enough, otherwise grow. */
+        size_t capacity = map->entryCapacity;
+        if (map->size > capacity / 2) {
+            capacity *= 2;
+        }
+        if (!rebuild(map, capacity)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    entry = &map->entries[map->entryCount];
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    insertIndex(map, hash, map->entryCount);
+    map->entryCount++;
+    map->size++;
+    return NULL;
+}
+
+void* flatHashmapGet(const FlatHashmap* map, const void* key) {
+    ssize_t slot = findSlot(map, key, hashKey(map, key));
+    return slot >= 0 ? map->entries[map->index[slot]].value : NULL;
+}
+
+bool flatHashmapContainsKey(const FlatHashmap* map, const void* key) {
+    return findSlot(map, key, hashKey(map, key)) >= 0;
+}
+
+void* flatHashmapRemove(FlatHashmap* map, const void* key, void** removedKey) {
+    ssize_t found = findSlot(map, key, hashKey(map, key));
+    FlatEntry* entry;
+    void* value;
+    size_t slot, next;
+
+    if (found < 0) {
+        if (removedKey != NULL) {
+            *removedKey = NULL;
+        }
+        return NULL;
+    }
+
+    entry = &map->entries[map->index[found]];
+    if (removedKey != NULL) {
+        *removedKey = entry->key;
+    }
+    value = entry->value;
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->hash = 0;
+    map->size--;
+    while (map->entryCount > 0 && map->entries[map->entryCount - 1].hash == 0) {
+        map->entryCount--;
+    }
+
+    /* Pull later members of the probe sequence into the hole. */
+    slot = found;
+    for (;;) {
+        map->index[slot] = NO_ENTRY;
+        next = slot;
+        for (;;) {
+            size_t home;
+            next = (next + 1) & map->indexMask;
+            if (map->index[next] == NO_ENTRY) {
+                return value;
+            }
+            home = map->entries[map->index[next]].hash & map->indexMask;
+            /* leave it if its home is cyclically within (slot, next] */
+            if ((slot <= next) ? (slot < home && home <= next)
+                               : (slot < home || home <= next)) {
+                continue;
+            }
+            break;
+        }
+        map->index[slot] = map->index[next];
+        slot = next;
+    }
+}
+
+size_t flatHashmapSize(const FlatHashmap* map) {
+    return map->size;
+}
+
+void flatHashmapForEach(FlatHashmap* map,
+        bool (*callback)(void* key, void* value, void* context),
+        void* context) {
+    size_t i;
+
+    for (i = 0; i < map->entryCount; i++) {
+        FlatEntry* entry = &map->entries[i];
+        if (entry->hash != 0 && !callback(entry->key, entry->value, context)) {
+            return;
+        }
+    }
+}
@@ -32,7 +32,12 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
+#include <cutils/threads.h>
 #include <log/log.h>
 #include <private/android_filesystem_config.h>
 #include <utils/Compat.h>
@@ -66,6 +71,10 @@ static inline uint64_t get8LE(const uint8_t* src)
     return ((uint64_t) high << 32) | (uint64_t) low;
 }
 
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
 #define ALIGN(x, alignment) ( ((x) + ((alignment) - 1)) & ~((alignment) - 1) )
 
 /* Rules for directories.
@@ -196,70 +205,302 @@ static bool fs_config_cmp(bool dir, const char *prefix, size_t len,
     return !strncmp(prefix, path, len);
 }
 
-void fs_config(const char *path, int dir, const char *target_out_path,
-               unsigned *uid, unsigned *gid, unsigned *mode, uint64_t *capabilities)
+/* Each rule file is loaded once, together with the built-in rules, into a
+** trie of path characters. A rule that matches a path exactly is attached
+** to the node its prefix ends at as "exact"; a rule that matches any path
+** starting with its prefix (every directory rule, and file rules ending in
+** '*') is attached as "wildcard". Rules are numbered in the order they are
+** applied, so "first match" becomes the lowest number seen on the way down.
+*/
+#define FS_CONFIG_NONE (-1)
+
+struct fs_config_node {
+    int32_t child;    /* first child, or FS_CONFIG_NONE */
+    int32_t sibling;  /* next child of the same parent, or FS_CONFIG_NONE */
+    int32_t exact;    /* rule matching exactly the path to here */
+    int32_t wildcard; /* rule matching any path starting here */
+    char c;
+};
+
+struct fs_config_trie {
+    bool loaded;
+    bool valid;
+    char *target_out_path;
+    struct fs_config_node *nodes;
+    size_t node_count;
+    size_t node_alloc;
+    struct fs_path_config *rules;
+    size_t rule_count;
+    size_t rule_alloc;
+};
+
+static mutex_t fs_config_lock = MUTEX_INITIALIZER;
+static struct fs_config_trie fs_config_tries[2]; /* files, dirs */
+
+static int32_t fs_config_new_node(struct fs_config_trie *trie, char c)
 {
-    const struct fs_path_config *pc;
-    int fd, plen;
+    struct fs_config_node *node;
 
-    if (path[0] == '/') {
-        path++;
+    if (trie->node_count == trie->node_alloc) {
+        size_t alloc = trie->node_alloc ? trie->node_alloc * 2 : 256;
+        node = realloc(trie->nodes, alloc * sizeof(*node));
+        if (!node) {
+            return FS_CONFIG_NONE;
+        }
+        trie->nodes = node;
+        trie->node_alloc = alloc;
     }
+    node = &trie->nodes[trie->node_count];
+    node->child = FS_CONFIG_NONE;
+    node->sibling = FS_CONFIG_NONE;
+    node->exact = FS_CONFIG_NONE;
+    node->wildcard = FS_CONFIG_NONE;
+    node->c = c;
+    return trie->node_count++;
+}
 
-    plen = strlen(path);
+static int32_t fs_config_find_child(const struct fs_config_trie *trie, int32_t n, char c)
+{
+    for (n = trie->nodes[n].child; n != FS_CONFIG_NONE; n = trie->nodes[n].sibling) {
+        if (trie->nodes[n].c == c) {
+            break;
+        }
+    }
+    return n;
+}
 
-    fd = fs_config_open(dir, target_out_path);
-    if (fd >= 0) {
-        struct fs_path_config_from_file header;
-
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char *prefix;
-            uint16_t host_len = get2LE((const uint8_t *)&header.len);
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", dir ? conf_dir : conf_file);
-                break;
-            }
-            prefix = calloc(1, remainder);
-            if (!prefix) {
-                ALOGE("%s out of memory", dir ? conf_dir : conf_file);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", dir ? conf_dir : conf_file);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) { /* missing a terminating null */
-                free(prefix);
-                ALOGE("%s is corrupted", dir ? conf_dir : conf_file);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                *uid = get2LE((const uint8_t *)&(header.uid));
-                *gid = get2LE((const uint8_t *)&(header.gid));
-                *mode = (*mode & (~07777)) | get2LE((const uint8_t *)&(header.mode));
-                *capabilities = get8LE((const uint8_t *)&(header.capabilities));
-                return;
+static bool fs_config_add(struct fs_config_trie *trie, bool dir, const char *prefix, size_t len,
+                          unsigned mode, unsigned uid, unsigned gid, uint64_t capabilities)
+{
+    bool wildcard = dir;
+    int32_t n = 0;
+    int32_t *slot;
+    size_t i;
+
+    if (!dir && len && prefix[len - 1] == '*') {
+        wildcard = true;
+        len--;
+    }
+    for (i = 0; i < len; i++) {
+        int32_t child = fs_config_find_child(trie, n, prefix[i]);
+        if (child == FS_CONFIG_NONE) {
+            child = fs_config_new_node(trie, prefix[i]);
+            if (child == FS_CONFIG_NONE) {
+                return false;
             }
-            free(prefix);
+            trie->nodes[child].sibling = trie->nodes[n].child;
+            trie->nodes[n].child = child;
+        }
+        n = child;
+    }
+
+    /* An earlier rule for the same prefix shadows this one. */
+    slot = wildcard ? &trie->nodes[n].wildcard : &trie->nodes[n].exact;
+    if (*slot != FS_CONFIG_NONE) {
+        return true;
+    }
+
+    if (trie->rule_count == trie->rule_alloc) {
+        size_t alloc = trie->rule_alloc ? trie->rule_alloc * 2 : 64;
+        struct fs_path_config *rules = realloc(trie->rules, alloc * sizeof(*rules));
+        if (!rules) {
+            return false;
+        }
+        trie->rules = rules;
+        trie->rule_alloc = alloc;
+    }
+    trie->rules[trie->rule_count].mode = mode;
+    trie->rules[trie->rule_count].uid = uid;
+    trie->rules[trie->rule_count].gid = gid;
+    trie->rules[trie->rule_count].capabilities = capabilities;
+    trie->rules[trie->rule_count].prefix = NULL;
+    *slot = trie->rule_count++;
+    return true;
+}
+
+static void *fs_config_map(int fd, size_t *size)
+{
+    struct stat st;
+    void *data;
+
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        return NULL;
+    }
+    *size = st.st_size;
+#if !defined(_WIN32)
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    return (data == MAP_FAILED) ? NULL : data;
+#else
+    data = malloc(*size);
+    if (data && TEMP_FAILURE_RETRY(read(fd, data, *size)) != (ssize_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    return data;
+#endif
+}
+
+static void fs_config_unmap(void *data, size_t size)
+{
+#if !defined(_WIN32)
+    munmap(data, size);
+#else
+    (void)size;
+    free(data);
+#endif
+}
+
+static bool fs_config_load_file(struct fs_config_trie *trie, bool dir, const char *target_out_path)
+{
+    const char *name = dir ? conf_dir : conf_file;
+    const uint8_t *data, *p, *end;
+    size_t size;
+    bool ok = true;
+    int fd;
+
+    fd = fs_config_open(dir, target_out_path);
+    if (fd < 0) {
+        return true;
+    }
+    data = fs_config_map(fd, &size);
+    close(fd);
+    if (!data) {
+        return true;
+    }
+
+    for (p = data, end = data + size; ok && (size_t)(end - p) >= sizeof(struct fs_path_config_from_file); ) {
+        const struct fs_path_config_from_file *header = (const struct fs_path_config_from_file *)p;
+        const char *prefix = (const char *)(p + sizeof(*header));
+        uint16_t host_len = get2LE((const uint8_t *)&header->len);
+        ssize_t len, remainder = host_len - sizeof(*header);
+        if (remainder <= 0) {
+            ALOGE("%s len is corrupted", name);
+            break;
+        }
+        if (remainder > end - (const uint8_t *)prefix) {
+            ALOGE("%s prefix is truncated", name);
+            break;
+        }
+        len = strnlen(prefix, remainder);
+        if (len >= remainder) { /* missing a terminating null */
+            ALOGE("%s is corrupted", name);
+            break;
         }
-        close(fd);
+        ok = fs_config_add(trie, dir, prefix, len,
+                           get2LE((const uint8_t *)&header->mode),
+                           get2LE((const uint8_t *)&header->uid),
+                           get2LE((const uint8_t *)&header->gid),
+                           get8LE((const uint8_t *)&header->capabilities));
+        p += host_len;
     }
 
-    pc = dir ? android_dirs : android_files;
-    for(; pc->prefix; pc++){
+    fs_config_unmap((void *)data, size);
+    return ok;
+}
+
+static void fs_config_reset(struct fs_config_trie *trie)
+{
+    free(trie->target_out_path);
+    free(trie->nodes);
+    free(trie->rules);
+    memset(trie, 0, sizeof(*trie));
+}
+
+static void fs_config_load(struct fs_config_trie *trie, bool dir, const char *target_out_path)
+{
+    const struct fs_path_config *pc;
+
+    fs_config_reset(trie);
+    trie->loaded = true;
+    if (target_out_path && *target_out_path) {
+        trie->target_out_path = strdup(target_out_path);
+        if (!trie->target_out_path) {
+            goto oom;
+        }
+    }
+    if (fs_config_new_node(trie, '\0') == FS_CONFIG_NONE ||
+            !fs_config_load_file(trie, dir, target_out_path)) {
+        goto oom;
+    }
+    for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+        if (!fs_config_add(trie, dir, pc->prefix, strlen(pc->prefix),
+                           pc->mode, pc->uid, pc->gid, pc->capabilities)) {
+            goto oom;
+        }
+    }
+    trie->valid = true;
+    return;
+
+oom:
+    ALOGE("%s out of memory", dir ? conf_dir : conf_file);
+}
+
+/* Only used if the trie could not be built. */
+static const struct fs_path_config *fs_config_scan(bool dir, const char *path, size_t plen)
+{
+    const struct fs_path_config *pc = dir ? android_dirs : android_files;
+
+    for (; pc->prefix; pc++) {
         if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
             break;
         }
     }
+    return pc;
+}
+
+static const struct fs_path_config *fs_config_lookup(const struct fs_config_trie *trie,
+                                                     const char *path)
+{
+    const struct fs_config_node *nodes = trie->nodes;
+    int32_t best = nodes[0].wildcard;
+    int32_t n = 0;
+
+    for (; *path; path++) {
+        n = fs_config_find_child(trie, n, *path);
+        if (n == FS_CONFIG_NONE) {
+            break;
+        }
+        if ((uint32_t)nodes[n].wildcard < (uint32_t)best) {
+            best = nodes[n].wildcard;
+        }
+    }
+    if (n != FS_CONFIG_NONE && (uint32_t)nodes[n].exact < (uint32_t)best) {
+        best = nodes[n].exact;
+    }
+    return (best == FS_CONFIG_NONE) ? NULL : &trie->rules[best];
+}
+
+void fs_config(const char *path, int dir, const char *target_out_path,
+               unsigned *uid, unsigned *gid, unsigned *mode, uint64_t *capabilities)
+{
+    struct fs_config_trie *trie = &fs_config_tries[dir ? 1 : 0];
+    const struct fs_path_config *pc;
+    const char *loaded_path;
+
+    if (path[0] == '/') {
+        path++;
+    }
+
+    mutex_lock(&fs_config_lock);
+    loaded_path = trie->target_out_path ? trie->target_out_path : "";
+    if (!trie->loaded || strcmp(loaded_path, target_out_path ? target_out_path : "")) {
+        fs_config_load(trie, dir, target_out_path);
+    }
+    if (trie->valid) {
+        pc = fs_config_lookup(trie, path);
+    } else {
+        pc = fs_config_scan(dir, path, strlen(path));
+    }
+    if (!pc) {
+        /* The last built-in entry matches everything. */
+        pc = dir ? &android_dirs[ARRAY_SIZE(android_dirs) - 1]
+                 : &android_files[ARRAY_SIZE(android_files) - 1];
+    }
     *uid = pc->uid;
     *gid = pc->gid;
     *mode = (*mode & (~07777)) | pc->mode;
     *capabilities = pc->capabilities;
+    mutex_unlock(&fs_config_lock);
 }
 
 ssize_t fs_config_generate(char *buffer, size_t length, const struct fs_path_config *pc)
@@ -30,31 +30,59 @@
 #include <inttypes.h>
 #include <log/log.h>
 
-int8_t property_get_bool(const char *key, int8_t default_value) {
-    if (!key) {
-        return default_value;
-    }
-
-    int8_t result = default_value;
-    char buf[PROPERTY_VALUE_MAX] = {'\0',};
-
-    int len = property_get(key, buf, "");
+// Returns 1 or 0 for a boolean value of the given length, -1 for anything else
+static int8_t parse_bool(const char *buf, int len) {
     if (len == 1) {
         char ch = buf[0];
         if (ch == '0' || ch == 'n') {
-            result = false;
+            return false;
         } else if (ch == '1' || ch == 'y') {
-            result = true;
+            return true;
         }
     } else if (len > 1) {
          if (!strcmp(buf, "no") || !strcmp(buf, "false") || !strcmp(buf, "off")) {
-            result = false;
+            return false;
         } else if (!strcmp(buf, "yes") || !strcmp(buf, "true") || !strcmp(buf, "on")) {
-            result = true;
+            return true;
         }
     }
+    return -1;
+}
 
-    return result;
+int8_t property_get_bool(const char *key, int8_t default_value) {
+    if (!key) {
+        return default_value;
+    }
+
+    char buf[PROPERTY_VALUE_MAX] = {'\0',};
+
+    int len = property_get(key, buf, "");
+    int8_t result = parse_bool(buf, len);
+    return result < 0 ? default_value : result;
+}
+
+// Convert string to int; return false if that fails
+static bool parse_imax(const char *key, const char *buf, intmax_t *result) {
+    char *end = NULL;
+    bool ok = true;
+    int tmp = errno;
+    errno = 0;
+
+    // Infer base automatically
+    intmax_t value = strtoimax(buf, &end, /*base*/0);
+    if ((value == INTMAX_MIN || value == INTMAX_MAX) && errno == ERANGE) {
+        // Over or underflow
+        ok = false;
+        ALOGV("%s(%s) - overflow", __FUNCTION__, key);
+    } else if (end == buf) {
+        // Numeric conversion failed
+        ok = false;
+        ALOGV("%s(%s) - numeric conversion failed", __FUNCTION__, key);
+    }
+
+    errno = tmp;
+    *result = value;
+    return ok;
 }
 
 // Convert string property to int (default if fails); return default value if out of bounds
@@ -66,31 +94,16 @@ static intmax_t property_get_imax(const char *key, intmax_t lower_bound, intmax_
 
     intmax_t result = default_value;
     char buf[PROPERTY_VALUE_MAX] = {'\0',};
-    char *end = NULL;
 
     int len = property_get(key, buf, "");
     if (len > 0) {
-        int tmp = errno;
-        errno = 0;
-
-        // Infer base automatically
-        result = strtoimax(buf, &end, /*base*/0);
-        if ((result == INTMAX_MIN || result == INTMAX_MAX) && errno == ERANGE) {
-            // Over or underflow
+        if (!parse_imax(key, buf, &result)) {
             result = default_value;
-            ALOGV("%s(%s,%" PRIdMAX ") - overflow", __FUNCTION__, key, default_value);
         } else if (result < lower_bound || result > upper_bound) {
             // Out of range of requested bounds
             result = default_value;
             ALOGV("%s(%s,%" PRIdMAX ") - out of range", __FUNCTION__, key, default_value);
-        } else if (end == buf) {
-            // Numeric conversion failed
-            result = default_value;
-            ALOGV("%s(%s,%" PRIdMAX ") - numeric conversion failed",
-                    __FUNCTION__, key, default_value);
         }
-
-        errno = tmp;
     }
 
     return result;
@@ -131,6 +144,97 @@ int property_get(const char *key, char *value, const char *default_value)
     return len;
 }
 
+/*
+ * Brings the handle's cached value up to date. Loads one serial when nothing
+ * has changed. The serial is read before the value, so a change racing with
+ * the read at worst costs another refresh on the next call.
+ */
+static void property_handle_refresh(property_handle_t *handle)
+{
+    uint32_t serial;
+
+    if (handle->pi == NULL) {
+        serial = __system_property_area_serial();
+        if (handle->loaded && serial == handle->serial) {
+            return;
+        }
+        handle->pi = __system_property_find(handle->key);
+        if (handle->pi == NULL) {
+            handle->serial = serial;
+            handle->loaded = true;
+            handle->len = 0;
+            handle->value[0] = '\0';
+            handle->bool_value = -1;
+            handle->int_valid = false;
+            return;
+        }
+        handle->loaded = false;
+    }
+
+    serial = __system_property_serial(handle->pi);
+    if (handle->loaded && serial == handle->serial) {
+        return;
+    }
+    handle->len = __system_property_read(handle->pi, NULL, handle->value);
+    if (handle->len < 0) {
+        handle->len = 0;
+        handle->value[0] = '\0';
+    }
+    handle->serial = serial;
+    handle->loaded = true;
+    handle->bool_value = parse_bool(handle->value, handle->len);
+    handle->int_valid = handle->len > 0
+            && parse_imax(handle->key, handle->value, &handle->int_value);
+}
+
+int property_handle_get(property_handle_t *handle, char *value, const char *default_value)
+{
+    int len;
+
+    property_handle_refresh(handle);
+    if (handle->len > 0) {
+        memcpy(value, handle->value, handle->len + 1);
+        return handle->len;
+    }
+    len = 0;
+    if (default_value) {
+        len = strlen(default_value);
+        if (len >= PROPERTY_VALUE_MAX) {
+            len = PROPERTY_VALUE_MAX - 1;
+        }
+        memcpy(value, default_value, len);
+        value[len] = '\0';
+    }
+    return len;
+}
+
+int8_t property_handle_get_bool(property_handle_t *handle, int8_t default_value)
+{
+    property_handle_refresh(handle);
+    return handle->bool_value < 0 ? default_value : handle->bool_value;
+}
+
+static intmax_t property_handle_get_imax(property_handle_t *handle, intmax_t lower_bound,
+        intmax_t upper_bound, intmax_t default_value)
+{
+    property_handle_refresh(handle);
+    if (!handle->int_valid
+            || handle->int_value < lower_bound || handle->int_value > upper_bound) {
+        return default_value;
+    }
+    return handle->int_value;
+}
+
+int64_t property_handle_get_int64(property_handle_t *handle, int64_t default_value)
+{
+    return (int64_t)property_handle_get_imax(handle, INT64_MIN, INT64_MAX, default_value);
+}
+
+int32_t property_handle_get_int32(property_handle_t *handle, int32_t default_value)
+{
+    return (int32_t)property_handle_get_imax(handle, INT32_MIN, INT32_MAX, default_value);
+}
+
 struct property_list_callback_data
 {
     void (*propfn)(const char *key, const char *value, void *cookie);
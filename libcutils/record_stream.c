@@ -26,6 +26,7 @@
 #include <winsock2.h>   /* for ntohl */
 #else
 #include <netinet/in.h>
+#include <sys/uio.h>
 #endif
 
 #define HEADER_SIZE 4
@@ -184,3 +185,218 @@ int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord,
     *p_outRecord = ret;        
     return 0;
 }
+
+
+struct RecordRing {
+    int fd;
+    size_t maxRecordLen;
+    size_t ringLen;
+
+    /* ringLen bytes, followed by room to make a record that wraps around
+     * the end of the ring contiguous */
+    unsigned char *buffer;
+
+    /* where the unconsumed bytes start in the ring, and how many */
+    size_t start;
+    size_t used;
+};
+
+
+extern RecordRing *record_ring_new(int fd, size_t maxRecordLen, size_t ringLen)
+{
+    RecordRing *ret;
+
+    assert (maxRecordLen <= 0xffff);
+
+    if (ringLen < maxRecordLen + HEADER_SIZE) {
+        ringLen = maxRecordLen + HEADER_SIZE;
+    }
+
+    ret = (RecordRing *)calloc(1, sizeof(RecordRing));
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    ret->fd = fd;
+    ret->maxRecordLen = maxRecordLen;
+    ret->ringLen = ringLen;
+    ret->buffer = (unsigned char *)malloc(ringLen + maxRecordLen + HEADER_SIZE);
+    if (ret->buffer == NULL) {
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+extern void record_ring_free(RecordRing *p_rr)
+{
+    free(p_rr->buffer);
+    free(p_rr);
+}
+
+
+/* returns the len unconsumed bytes at offset in the ring, copying those
+ * that wrapped around after the end of the ring so that they follow */
+static unsigned char *ringBytes (RecordRing *p_rr, size_t offset, size_t len)
+{
+    size_t begin = (p_rr->start + offset) % p_rr->ringLen;
+
+    if (begin + len > p_rr->ringLen) {
+        memcpy(p_rr->buffer + p_rr->ringLen, p_rr->buffer,
+               begin + len - p_rr->ringLen);
+    }
+
+    return p_rr->buffer + begin;
+}
+
+/* returns 1 and consumes the next record if there is a full one in the
+ * buffer, 0 if there isn't, -1 if it is too long */
+static int ringNextRecord (RecordRing *p_rr, void **p_outRecord,
+                                size_t *p_outRecordLen)
+{
+    uint32_t len;
+
+    if (p_rr->used < HEADER_SIZE) {
+        return 0;
+    }
+
+    //First four bytes are length
+    memcpy(&len, ringBytes(p_rr, 0, HEADER_SIZE), HEADER_SIZE);
+    len = ntohl(len);
+
+    if (len > p_rr->maxRecordLen) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (p_rr->used < HEADER_SIZE + len) {
+        return 0;
+    }
+
+    *p_outRecord = ringBytes(p_rr, 0, HEADER_SIZE + len) + HEADER_SIZE;
+    *p_outRecordLen = len;
+
+    p_rr->start = (p_rr->start + HEADER_SIZE + len) % p_rr->ringLen;
+    p_rr->used -= HEADER_SIZE + len;
+
+    return 1;
+}
+
+/* reads as much as there is room for, in two pieces if the free space
+ * wraps around the end of the ring */
+static ssize_t ringFill (RecordRing *p_rr)
+{
+    size_t end, room, first;
+    ssize_t countRead;
+
+    if (p_rr->used == 0) {
+        // read from the start, in one piece
+        p_rr->start = 0;
+    }
+
+    end = (p_rr->start + p_rr->used) % p_rr->ringLen;
+    room = p_rr->ringLen - p_rr->used;
+    first = p_rr->ringLen - end;
+    if (first > room) {
+        first = room;
+    }
+
+#ifdef HAVE_WINSOCK
+    countRead = read (p_rr->fd, p_rr->buffer + end, first);
+#else
+    struct iovec iov[2];
+    iov[0].iov_base = p_rr->buffer + end;
+    iov[0].iov_len = first;
+    iov[1].iov_base = p_rr->buffer;
+    iov[1].iov_len = room - first;
+    countRead = readv (p_rr->fd, iov, room > first ? 2 : 1);
+#endif
+
+    if (countRead > 0) {
+        p_rr->used += countRead;
+    }
+
+    return countRead;
+}
+
+int record_ring_get_next (RecordRing *p_rr, void ** p_outRecord,
+                                  size_t *p_outRecordLen)
+{
+    ssize_t countRead;
+    int ret;
+
+    /* is there one record already in the buffer? */
+    ret = ringNextRecord (p_rr, p_outRecord, p_outRecordLen);
+
+    if (ret != 0) {
+        return ret > 0 ? 0 : -1;
+    }
+
+    countRead = ringFill (p_rr);
+
+    if (countRead <= 0) {
+        /* note: end-of-stream drops through here too */
+        *p_outRecord = NULL;
+        return countRead;
+    }
+
+    ret = ringNextRecord (p_rr, p_outRecord, p_outRecordLen);
+
+    if (ret == 0) {
+        /* not enough of a buffer to for a whole command */
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return ret > 0 ? 0 : -1;
+}
+
+int record_ring_get_batch (RecordRing *p_rr, RecordView *p_outRecords,
+                                   size_t maxRecords, size_t *p_outCount)
+{
+    ssize_t countRead;
+    size_t count;
+    int ret;
+
+    *p_outCount = 0;
+
+    if (maxRecords == 0) {
+        return 0;
+    }
+
+    ret = ringNextRecord (p_rr, &p_outRecords[0].data, &p_outRecords[0].len);
+
+    if (ret == 0) {
+        countRead = ringFill (p_rr);
+
+        if (countRead <= 0) {
+            /* note: end-of-stream drops through here too */
+            return countRead;
+        }
+
+        ret = ringNextRecord (p_rr, &p_outRecords[0].data, &p_outRecords[0].len);
+
+        if (ret == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    /* a record too long ends the batch, and is reported by the next call */
+    count = 1;
+    while (count < maxRecords
+        && ringNextRecord (p_rr, &p_outRecords[count].data,
+                           &p_outRecords[count].len) > 0
+    ) {
+        count++;
+    }
+
+    *p_outCount = count;
+    return 0;
+}
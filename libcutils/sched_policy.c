@@ -39,6 +39,7 @@ static inline SchedPolicy _policy(SchedPolicy p)
 
 #if defined(__ANDROID__)
 
+#include <dirent.h>
 #include <pthread.h>
 #include <sched.h>
 #include <sys/prctl.h>
@@ -69,6 +70,24 @@ static int system_bg_cpuset_fd = -1;
 static int bg_cpuset_fd = -1;
 static int fg_cpuset_fd = -1;
 
+// The policy each recently seen tid was last found in or moved to, indexed by
+// tid modulo the size. Only consulted by get_cached_sched_policy().
+#define POLICY_CACHE_SIZE 256
+
+static struct {
+    int tid;
+    SchedPolicy policy;
+} policy_cache[POLICY_CACHE_SIZE];
+static pthread_mutex_t policy_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_policy(int tid, SchedPolicy policy)
+{
+    pthread_mutex_lock(&policy_cache_lock);
+    policy_cache[tid % POLICY_CACHE_SIZE].tid = tid;
+    policy_cache[tid % POLICY_CACHE_SIZE].policy = policy;
+    pthread_mutex_unlock(&policy_cache_lock);
+}
+
 static int write_tid_to_fd(int tid, int fd)
 {
     // specialized itoa -- works for tid > 0
@@ -241,56 +260,65 @@ static int getSchedulerGroup(int tid, char* buf, size_t bufLen)
 {
 #if defined(__ANDROID__)
     char pathBuf[32];
-    char lineBuf[256];
-    FILE *fp;
+    char data[4096];
+    char *line, *next;
+    ssize_t n;
+    int fd;
 
     snprintf(pathBuf, sizeof(pathBuf), "/proc/%d/cgroup", tid);
-    if (!(fp = fopen(pathBuf, "r"))) {
+    fd = open(pathBuf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return -1;
     }
+    n = TEMP_FAILURE_RETRY(read(fd, data, sizeof(data) - 1));
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    data[n] = '\0';
 
-    while(fgets(lineBuf, sizeof(lineBuf) -1, fp)) {
-        char *next = lineBuf;
+    for (line = data; *line; line = next) {
         char *subsys;
         char *grp;
         size_t len;
 
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        } else {
+            next = line + strlen(line);
+        }
+
         /* Junk the first field */
-        if (!strsep(&next, ":")) {
+        if (!(subsys = strchr(line, ':'))) {
             goto out_bad_data;
         }
+        subsys++;
 
-        if (!(subsys = strsep(&next, ":"))) {
+        if (!(grp = strchr(subsys, ':'))) {
             goto out_bad_data;
         }
+        *grp++ = '\0';
 
         if (strcmp(subsys, "cpu")) {
             /* Not the subsys we're looking for */
             continue;
         }
 
-        if (!(grp = strsep(&next, ":"))) {
-            goto out_bad_data;
-        }
         grp++; /* Drop the leading '/' */
         len = strlen(grp);
-        grp[len-1] = '\0'; /* Drop the trailing '\n' */
-
         if (bufLen <= len) {
             len = bufLen - 1;
         }
         strncpy(buf, grp, len);
         buf[len] = '\0';
-        fclose(fp);
         return 0;
     }
 
     SLOGE("%s Failed to find cpu subsys", proc_name);
-    fclose(fp);
     return -1;
  out_bad_data:
-    SLOGE("%s Bad cgroup data {%s}", proc_name, lineBuf);
-    fclose(fp);
+    SLOGE("%s Bad cgroup data {%s}", proc_name, line);
     return -1;
 #else
     errno = ENOSYS;
@@ -335,62 +363,83 @@ int get_sched_policy(int tid, SchedPolicy *policy)
             return -1;
         }
     }
+    cache_policy(tid, *policy);
     return 0;
 }
 
-int set_cpuset_policy(int tid, SchedPolicy policy)
+int get_cached_sched_policy(int tid, SchedPolicy *policy)
 {
-    // in the absence of cpusets, use the old sched policy
-#ifndef USE_CPUSETS
-    return set_sched_policy(tid, policy);
-#else
     if (tid == 0) {
         tid = gettid();
     }
 
-    pthread_once(&cpuset_once, __init_cpuset);
-
-    if (!__sys_supports_cpusets)
-        return set_sched_policy(tid, policy);
+    pthread_mutex_lock(&policy_cache_lock);
+    if (policy_cache[tid % POLICY_CACHE_SIZE].tid == tid) {
+        *policy = policy_cache[tid % POLICY_CACHE_SIZE].policy;
+        pthread_mutex_unlock(&policy_cache_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&policy_cache_lock);
 
-    policy = _policy(policy);
+    return get_sched_policy(tid, policy);
+}
 
-    int fd;
+#ifdef USE_CPUSETS
+static int cpuset_fd_for_policy(SchedPolicy policy)
+{
     switch (policy) {
     case SP_BACKGROUND:
-        fd = bg_cpuset_fd;
-        break;
+        return bg_cpuset_fd;
     case SP_FOREGROUND:
     case SP_AUDIO_APP:
     case SP_AUDIO_SYS:
-        fd = fg_cpuset_fd;
-        break;
+        return fg_cpuset_fd;
     case SP_SYSTEM:
-        fd = system_bg_cpuset_fd;
-        break;
+        return system_bg_cpuset_fd;
     default:
-        fd = -1;
-        break;
-    }
-
-    if (add_tid_to_cpuset(tid, fd) != 0) {
-        if (errno != ESRCH && errno != ENOENT)
-            return -errno;
+        return -1;
     }
-
-    return 0;
-#endif
 }
+#endif
 
-int set_sched_policy(int tid, SchedPolicy policy)
+int set_cpuset_policy(int tid, SchedPolicy policy)
 {
     if (tid == 0) {
         tid = gettid();
     }
-    policy = _policy(policy);
+    return set_cpuset_policy_tids(&tid, 1, policy);
+}
 
-    pthread_once(&sched_once, __init_sched);
+int set_cpuset_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+    // in the absence of cpusets, use the old sched policy
+#ifndef USE_CPUSETS
+    return set_sched_policy_tids(tids, count, policy);
+#else
+    int fd;
+    int rc = 0;
+    size_t i;
+
+    pthread_once(&cpuset_once, __init_cpuset);
 
+    if (!__sys_supports_cpusets)
+        return set_sched_policy_tids(tids, count, policy);
+
+    fd = cpuset_fd_for_policy(_policy(policy));
+    for (i = 0; i < count; i++) {
+        if (add_tid_to_cpuset(tids[i], fd) != 0) {
+            if (errno != ESRCH && errno != ENOENT && rc == 0)
+                rc = -errno;
+        }
+    }
+
+    return rc;
+#endif
+}
+
+/* Move one tid; policy has already been passed through _policy(). */
+static int __set_sched_policy(int tid, SchedPolicy policy)
+{
 #if POLICY_DEBUG
     char statfile[64];
     char statline[1024];
@@ -484,9 +533,80 @@ int set_sched_policy(int tid, SchedPolicy policy)
     prctl(PR_SET_TIMERSLACK_PID,
           policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG, tid);
 
+    cache_policy(tid, policy);
     return 0;
 }
 
+int set_sched_policy(int tid, SchedPolicy policy)
+{
+    if (tid == 0) {
+        tid = gettid();
+    }
+    return set_sched_policy_tids(&tid, 1, policy);
+}
+
+int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+    int rc = 0;
+    size_t i;
+
+    policy = _policy(policy);
+
+    pthread_once(&sched_once, __init_sched);
+
+    for (i = 0; i < count; i++) {
+        int err = __set_sched_policy(tids[i], policy);
+        if (err != 0 && rc == 0)
+            rc = err;
+    }
+    return rc;
+}
+
+/* Apply set(tids, count, policy) to every thread of pid, a batch at a time. */
+static int set_process_policy(int pid, SchedPolicy policy,
+                              int (*set)(const int *, size_t, SchedPolicy))
+{
+    char path[32];
+    int tids[64];
+    size_t count = 0;
+    struct dirent *de;
+    DIR *d;
+    int rc = 0;
+    int err;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    d = opendir(path);
+    if (!d)
+        return -errno;
+
+    while ((de = readdir(d)) != NULL) {
+        int tid = atoi(de->d_name);
+        if (tid <= 0)
+            continue;
+        tids[count++] = tid;
+        if (count == sizeof(tids) / sizeof(tids[0])) {
+            err = set(tids, count, policy);
+            if (err != 0 && rc == 0)
+                rc = err;
+            count = 0;
+        }
+    }
+    closedir(d);
+
+    err = set(tids, count, policy);
+    return rc != 0 ? rc : err;
+}
+
+int set_process_sched_policy(int pid, SchedPolicy policy)
+{
+    return set_process_policy(pid, policy, set_sched_policy_tids);
+}
+
+int set_process_cpuset_policy(int pid, SchedPolicy policy)
+{
+    return set_process_policy(pid, policy, set_cpuset_policy_tids);
+}
+
 #else
 
 /* Stubs for non-Android targets. */
@@ -496,12 +616,29 @@ int set_sched_policy(int tid UNUSED, SchedPolicy policy UNUSED)
     return 0;
 }
 
+int set_sched_policy_tids(const int *tids UNUSED, size_t count UNUSED,
+                          SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
+int set_process_sched_policy(int pid UNUSED, SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
 int get_sched_policy(int tid UNUSED, SchedPolicy *policy)
 {
     *policy = SP_SYSTEM_DEFAULT;
     return 0;
 }
 
+int get_cached_sched_policy(int tid UNUSED, SchedPolicy *policy)
+{
+    *policy = SP_SYSTEM_DEFAULT;
+    return 0;
+}
+
 #endif
 
 const char *get_sched_policy_name(SchedPolicy policy)
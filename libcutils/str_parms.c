@@ -23,8 +23,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
-#include <cutils/hashmap.h>
+#include <cutils/flat_hashmap.h>
 #include <cutils/memory.h>
 #include <cutils/str_parms.h>
 #include <log/log.h>
@@ -46,29 +47,9 @@ static void *released_pointer;
 #endif
 
 struct str_parms {
-    Hashmap *map;
+    FlatHashmap *map;
 };
 
-
-static bool str_eq(void *key_a, void *key_b)
-{
-    return !strcmp((const char *)key_a, (const char *)key_b);
-}
-
-/* use djb hash unless we find it inadequate */
-#ifdef __clang__
-__attribute__((no_sanitize("integer")))
-#endif
-static int str_hash_fn(void *str)
-{
-    uint32_t hash = 5381;
-    char *p;
-
-    for (p = str; p && *p; p++)
-        hash = ((hash << 5) + hash) + *p;
-    return (int)hash;
-}
-
 struct str_parms *str_parms_create(void)
 {
     struct str_parms *str_parms;
@@ -77,7 +58,7 @@ struct str_parms *str_parms_create(void)
     if (!str_parms)
         return NULL;
 
-    str_parms->map = hashmapCreate(5, str_hash_fn, str_eq);
+    str_parms->map = flatHashmapCreate(FLAT_HASHMAP_STRING_KEYS, 5);
     if (!str_parms->map)
         goto err;
 
@@ -88,58 +69,26 @@ err:
     return NULL;
 }
 
-struct remove_ctxt {
-    struct str_parms *str_parms;
-    const char *key;
-};
-
-static bool remove_pair(void *key, void *value, void *context)
+static void free_pair(void *key, void *value)
 {
-    struct remove_ctxt *ctxt = context;
-    bool should_continue;
-
-    /*
-     * - if key is not supplied, then we are removing all entries,
-     *   so remove key and continue (i.e. return true)
-     * - if key is supplied and matches, then remove it and don't
-     *   continue (return false). Otherwise, return true and keep searching
-     *   for key.
-     *
-     */
-    if (!ctxt->key) {
-        should_continue = true;
-        goto do_remove;
-    } else if (!strcmp(ctxt->key, key)) {
-        should_continue = false;
-        goto do_remove;
-    }
-
-    return true;
-
-do_remove:
-    hashmapRemove(ctxt->str_parms->map, key);
     free(key);
     free(value);
-    return should_continue;
 }
 
 void str_parms_del(struct str_parms *str_parms, const char *key)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-        .key = key,
-    };
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
+    void *old_key;
+    void *old_val;
+
+    old_val = flatHashmapRemove(str_parms->map, key, &old_key);
+    free(old_key);
+    free(old_val);
 }
 
 void str_parms_destroy(struct str_parms *str_parms)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-    };
-
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
-    hashmapFree(str_parms->map);
+    flatHashmapClear(str_parms->map, free_pair);
+    flatHashmapFree(str_parms->map);
     free(str_parms);
 }
 
@@ -183,7 +132,7 @@ struct str_parms *str_parms_create_str(const char *_string)
         }
 
         /* if we replaced a value, free it */
-        old_val = hashmapPut(str_parms->map, key, value);
+        old_val = flatHashmapPut(str_parms->map, key, value);
         RELEASE_OWNERSHIP(value);
         if (old_val) {
             free(old_val);
@@ -217,7 +166,7 @@ int str_parms_add_str(struct str_parms *str_parms, const char *key,
     void *tmp_val = NULL;
     void *old_val = NULL;
 
-    // strdup and hashmapPut both set errno on failure.
+    // strdup and flatHashmapPut both set errno on failure.
     // Set errno to 0 so we can recognize whether anything went wrong.
     int saved_errno = errno;
     errno = 0;
@@ -232,9 +181,9 @@ int str_parms_add_str(struct str_parms *str_parms, const char *key,
         goto clean_up;
     }
 
-    old_val = hashmapPut(str_parms->map, tmp_key, tmp_val);
+    old_val = flatHashmapPut(str_parms->map, tmp_key, tmp_val);
     if (old_val == NULL) {
-        // Did hashmapPut fail?
+        // Did flatHashmapPut fail?
         if (errno == ENOMEM) {
             goto clean_up;
         }
@@ -286,7 +235,7 @@ int str_parms_add_float(struct str_parms *str_parms, const char *key,
 }
 
 int str_parms_has_key(struct str_parms *str_parms, const char *key) {
-    return hashmapGet(str_parms->map, (void *)key) != NULL;
+    return flatHashmapGet(str_parms->map, key) != NULL;
 }
 
 int str_parms_get_str(struct str_parms *str_parms, const char *key, char *val,
@@ -294,7 +243,7 @@ int str_parms_get_str(struct str_parms *str_parms, const char *key, char *val,
 {
     char *value;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = flatHashmapGet(str_parms->map, key);
     if (value)
         return strlcpy(val, value, len);
 
@@ -306,7 +255,7 @@ int str_parms_get_int(struct str_parms *str_parms, const char *key, int *val)
     char *value;
     char *end;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = flatHashmapGet(str_parms->map, key);
     if (!value)
         return -ENOENT;
 
@@ -324,7 +273,7 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
     char *value;
     char *end;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = flatHashmapGet(str_parms->map, key);
     if (!value)
         return -ENOENT;
 
@@ -336,37 +285,44 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
     return 0;
 }
 
-static bool combine_strings(void *key, void *value, void *context)
+static bool measure_pair(void *key, void *value, void *context)
 {
-    char **old_str = context;
-    char *new_str;
-    int ret;
+    size_t *len = context;
 
-    ret = asprintf(&new_str, "%s%s%s=%s",
-                   *old_str ? *old_str : "",
-                   *old_str ? ";" : "",
-                   (char *)key,
-                   (char *)value);
-    if (*old_str)
-        free(*old_str);
-
-    if (ret >= 0) {
-        *old_str = new_str;
-        return true;
-    }
+    *len += strlen(key) + 1 + strlen(value) + 1;
+    return true;
+}
 
-    *old_str = NULL;
-    return false;
+static bool append_pair(void *key, void *value, void *context)
+{
+    char **p = context;
+    size_t key_len = strlen(key);
+    size_t value_len = strlen(value);
+
+    memcpy(*p, key, key_len);
+    (*p)[key_len] = '=';
+    memcpy(*p + key_len + 1, value, value_len);
+    (*p)[key_len + 1 + value_len] = ';';
+    *p += key_len + 1 + value_len + 1;
+    return true;
 }
 
 char *str_parms_to_str(struct str_parms *str_parms)
 {
-    char *str = NULL;
+    size_t len = 0;
+    char *str;
+    char *p;
 
-    if (hashmapSize(str_parms->map) > 0)
-        hashmapForEach(str_parms->map, combine_strings, &str);
-    else
-        str = strdup("");
+    /* Size it first so that the string is built in one allocation. */
+    flatHashmapForEach(str_parms->map, measure_pair, &len);
+    str = malloc(len + 1);
+    if (!str)
+        return NULL;
+
+    p = str;
+    flatHashmapForEach(str_parms->map, append_pair, &p);
+    /* Replace the last separator. */
+    str[len ? len - 1 : 0] = '\0';
     return str;
 }
 
@@ -378,5 +334,169 @@ static bool dump_entry(void *key, void *value, void *context UNUSED)
 
 void str_parms_dump(struct str_parms *str_parms)
 {
-    hashmapForEach(str_parms->map, dump_entry, str_parms);
+    flatHashmapForEach(str_parms->map, dump_entry, str_parms);
+}
+
+static ssize_t view_find(const struct str_parms_view *view, const char *key)
+{
+    size_t key_len = strlen(key);
+    size_t i;
+
+    /* Last one wins, as when a later pair replaces an earlier one. */
+    for (i = view->count; i-- > 0; ) {
+        if (view->pairs[i].key_len == key_len &&
+                !memcmp(view->pairs[i].key, key, key_len))
+            return i;
+    }
+    return -1;
+}
+
+int str_parms_view_parse(struct str_parms_view *view, const char *str)
+{
+    const char *p = str;
+
+    view->count = 0;
+    while (*p) {
+        const char *end = p;
+        const char *eq;
+
+        while (*end && *end != ';')
+            end++;
+        eq = memchr(p, '=', end - p);
+
+        if (end != p && eq != p) {
+            if (view->count == STR_PARMS_VIEW_MAX_PAIRS)
+                return -E2BIG;
+            view->pairs[view->count].key = p;
+            view->pairs[view->count].key_len = (eq ? eq : end) - p;
+            view->pairs[view->count].value = eq ? eq + 1 : end;
+            view->pairs[view->count].value_len = end - view->pairs[view->count].value;
+            view->count++;
+        }
+
+        p = *end ? end + 1 : end;
+    }
+    return view->count;
+}
+
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key)
+{
+    return view_find(view, key) >= 0;
+}
+
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *val, int len)
+{
+    ssize_t i = view_find(view, key);
+    size_t n;
+
+    if (i < 0)
+        return -ENOENT;
+
+    n = view->pairs[i].value_len;
+    if (len > 0) {
+        size_t copy = n < (size_t)len ? n : (size_t)len - 1;
+        memcpy(val, view->pairs[i].value, copy);
+        val[copy] = '\0';
+    }
+    return n;
+}
+
+/* Copies the value of key into buf as a C string for strtol and strtof. */
+static int view_get_number(const struct str_parms_view *view, const char *key,
+                           char *buf, size_t len)
+{
+    ssize_t i = view_find(view, key);
+
+    if (i < 0)
+        return -ENOENT;
+    if (view->pairs[i].value_len >= len)
+        return -EINVAL;
+
+    memcpy(buf, view->pairs[i].value, view->pairs[i].value_len);
+    buf[view->pairs[i].value_len] = '\0';
+    return 0;
+}
+
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *val)
+{
+    char value[32];
+    char *end;
+    int ret;
+
+    ret = view_get_number(view, key, value, sizeof(value));
+    if (ret < 0)
+        return ret;
+
+    *val = (int)strtol(value, &end, 0);
+    if (*value != '\0' && *end == '\0')
+        return 0;
+
+    return -EINVAL;
+}
+
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *val)
+{
+    char value[64];
+    float out;
+    char *end;
+    int ret;
+
+    ret = view_get_number(view, key, value, sizeof(value));
+    if (ret < 0)
+        return ret;
+
+    out = strtof(value, &end);
+    if (*value == '\0' || *end != '\0')
+        return -EINVAL;
+
+    *val = out;
+    return 0;
+}
+
+/* Appends n bytes of s at offset *pos of buf, as far as it fits. */
+static void view_append(char *buf, size_t len, size_t *pos, const char *s, size_t n)
+{
+    if (*pos < len) {
+        size_t room = len - *pos;
+        memcpy(buf + *pos, s, n < room ? n : room);
+    }
+    *pos += n;
+}
+
+int str_parms_view_to_str(const struct str_parms_view *view, char *buf, size_t len)
+{
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < view->count; i++) {
+        const char *key = view->pairs[i].key;
+        size_t key_len = view->pairs[i].key_len;
+        ssize_t last = i;
+        size_t j;
+
+        /* Written already, at its first position, with its last value. */
+        for (j = 0; j < i; j++) {
+            if (view->pairs[j].key_len == key_len && !memcmp(view->pairs[j].key, key, key_len))
+                break;
+        }
+        if (j < i)
+            continue;
+        for (j = i + 1; j < view->count; j++) {
+            if (view->pairs[j].key_len == key_len && !memcmp(view->pairs[j].key, key, key_len))
+                last = j;
+        }
+
+        if (pos)
+            view_append(buf, len, &pos, ";", 1);
+        view_append(buf, len, &pos, key, key_len);
+        view_append(buf, len, &pos, "=", 1);
+        view_append(buf, len, &pos, view->pairs[last].value, view->pairs[last].value_len);
+    }
+
+    if (len)
+        buf[pos < len ? pos : len - 1] = '\0';
+    return pos;
 }
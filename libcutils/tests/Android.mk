@@ -15,10 +15,12 @@
 LOCAL_PATH := $(call my-dir)
 
 test_src_files := \
+    FlatHashmapTest.cpp \
+    MemsetTest.cpp \
+    RecordStreamTest.cpp \
     test_str_parms.cpp \
 
 test_target_only_src_files := \
-    MemsetTest.cpp \
     PropertiesTest.cpp \
 
 test_libraries := libcutils liblog
@@ -71,3 +73,20 @@ LOCAL_MULTILIB := both
 LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
 LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
 include $(BUILD_HOST_NATIVE_TEST)
+
+
+#
+# Benchmarks, using the harness from liblog's tests (device only). Run with:
+#   adb shell /data/nativetest/libcutils_benchmark/libcutils_benchmark
+#
+
+benchmark_src_files := \
+    ../../liblog/tests/benchmark_main.cpp \
+    memset_benchmark.cpp \
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcutils_benchmark
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../liblog/tests
+LOCAL_SRC_FILES := $(benchmark_src_files)
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cutils/flat_hashmap.h>
+#include <gtest/gtest.h>
+
+static void* Value(intptr_t v) {
+    return reinterpret_cast<void*>(v);
+}
+
+static bool CollectKey(void* key, void*, void* context) {
+    static_cast<std::vector<std::string>*>(context)->push_back(static_cast<char*>(key));
+    return true;
+}
+
+TEST(FlatHashmap, StringKeys) {
+    FlatHashmap* map = flatHashmapCreate(FLAT_HASHMAP_STRING_KEYS, 2);
+    ASSERT_TRUE(map != NULL);
+
+    char foo[] = "foo";
+    char bar[] = "bar";
+    EXPECT_EQ(NULL, flatHashmapPut(map, foo, Value(1)));
+    EXPECT_EQ(NULL, flatHashmapPut(map, bar, Value(2)));
+    EXPECT_EQ(Value(1), flatHashmapPut(map, foo, Value(3)));
+    EXPECT_EQ(2U, flatHashmapSize(map));
+
+    EXPECT_EQ(Value(3), flatHashmapGet(map, "foo"));
+    EXPECT_EQ(NULL, flatHashmapGet(map, "FOO"));
+    EXPECT_TRUE(flatHashmapContainsKey(map, "bar"));
+    EXPECT_FALSE(flatHashmapContainsKey(map, "baz"));
+
+    void* removedKey;
+    EXPECT_EQ(Value(2), flatHashmapRemove(map, "bar", &removedKey));
+    EXPECT_EQ(bar, removedKey);
+    EXPECT_EQ(NULL, flatHashmapRemove(map, "bar", &removedKey));
+    EXPECT_EQ(NULL, removedKey);
+    EXPECT_EQ(1U, flatHashmapSize(map));
+
+    flatHashmapFree(map);
+}
+
+TEST(FlatHashmap, IcaseStringKeys) {
+    FlatHashmap* map = flatHashmapCreate(FLAT_HASHMAP_ICASE_STRING_KEYS, 0);
+    ASSERT_TRUE(map != NULL);
+
+    char key[] = "com.Example.App";
+    flatHashmapPut(map, key, Value(10042));
+    EXPECT_EQ(Value(10042), flatHashmapGet(map, "com.example.app"));
+    EXPECT_EQ(Value(10042), flatHashmapGet(map, "COM.EXAMPLE.APP"));
+    EXPECT_EQ(NULL, flatHashmapGet(map, "com.example.ap"));
+
+    flatHashmapFree(map);
+}
+
+TEST(FlatHashmap, KeepsInsertionOrder) {
+    FlatHashmap* map = flatHashmapCreate(FLAT_HASHMAP_STRING_KEYS, 0);
+    ASSERT_TRUE(map != NULL);
+
+    char names[][4] = { "c", "a", "d", "b" };
+    for (size_t i = 0; i < 4; i++) {
+        flatHashmapPut(map, names[i], Value(i + 1));
+    }
+    flatHashmapRemove(map, "a", NULL);
+    flatHashmapPut(map, names[1], Value(5));
+
+    std::vector<std::string> keys;
+    flatHashmapForEach(map, CollectKey, &keys);
+    ASSERT_EQ(4U, keys.size());
+    EXPECT_EQ("c", keys[0]);
+    EXPECT_EQ("d", keys[1]);
+    EXPECT_EQ("b", keys[2]);
+    EXPECT_EQ("a", keys[3]);
+
+    flatHashmapFree(map);
+}
+
+static int released;
+
+static void CountRelease(void*, void*) {
+    released++;
+}
+
+TEST(FlatHashmap, ReserveAndClear) {
+    FlatHashmap* map = flatHashmapCreate(FLAT_HASHMAP_INT_KEYS, 0);
+    ASSERT_TRUE(map != NULL);
+    ASSERT_TRUE(flatHashmapReserve(map, 1000));
+
+    for (int i = 0; i < 1000; i++) {
+        flatHashmapPut(map, FLAT_HASHMAP_INT_KEY(i), Value(i + 1));
+    }
+    EXPECT_EQ(1000U, flatHashmapSize(map));
+
+    released = 0;
+    flatHashmapClear(map, CountRelease);
+    EXPECT_EQ(1000, released);
+    EXPECT_EQ(0U, flatHashmapSize(map));
+    EXPECT_FALSE(flatHashmapContainsKey(map, FLAT_HASHMAP_INT_KEY(0)));
+
+    flatHashmapFree(map);
+}
+
+TEST(FlatHashmap, MatchesStdMap) {
+    FlatHashmap* map = flatHashmapCreate(FLAT_HASHMAP_INT_KEYS, 0);
+    ASSERT_TRUE(map != NULL);
+    std::map<int, intptr_t> expected;
+
+    srand(42);
+    for (int i = 0; i < 100000; i++) {
+        int key = rand() % 512;
+        intptr_t value = i + 1;
+        if (rand() % 3 == 0) {
+            void* removed = flatHashmapRemove(map, FLAT_HASHMAP_INT_KEY(key), NULL);
+            std::map<int, intptr_t>::iterator it = expected.find(key);
+            EXPECT_EQ(Value(it == expected.end() ? 0 : it->second), removed);
+            if (it != expected.end()) {
+                expected.erase(it);
+            }
+        } else {
+            void* old = flatHashmapPut(map, FLAT_HASHMAP_INT_KEY(key), Value(value));
+            std::map<int, intptr_t>::iterator it = expected.find(key);
+            EXPECT_EQ(Value(it == expected.end() ? 0 : it->second), old);
+            expected[key] = value;
+        }
+        ASSERT_EQ(expected.size(), flatHashmapSize(map));
+    }
+    for (int key = 0; key < 512; key++) {
+        std::map<int, intptr_t>::iterator it = expected.find(key);
+        EXPECT_EQ(Value(it == expected.end() ? 0 : it->second),
+                  flatHashmapGet(map, FLAT_HASHMAP_INT_KEY(key)));
+    }
+
+    flatHashmapFree(map);
+}
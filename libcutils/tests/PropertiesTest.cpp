@@ -306,4 +306,42 @@ TEST_F(PropertiesTest, GetInt32) {
     }
 }
 
+TEST_F(PropertiesTest, HandleTracksChanges) {
+    property_handle_t handle = PROPERTY_HANDLE_INIT(PROPERTY_TEST_KEY);
+
+    // Not set yet -> defaults
+    EXPECT_EQ(int(strlen(PROPERTY_TEST_VALUE_DEFAULT)),
+              property_handle_get(&handle, mValue, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT, mValue);
+    EXPECT_TRUE(property_handle_get_bool(&handle, /*default_value*/true));
+    EXPECT_EQ(-7, property_handle_get_int32(&handle, -7));
+
+    // Created after the handle first looked
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "0x10"));
+    EXPECT_EQ(4, property_handle_get(&handle, mValue, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_STREQ("0x10", mValue);
+    EXPECT_EQ(16, property_handle_get_int64(&handle, -7));
+    EXPECT_FALSE(property_handle_get_bool(&handle, /*default_value*/false));
+
+    // Changed in place
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "on"));
+    EXPECT_TRUE(property_handle_get_bool(&handle, /*default_value*/false));
+    EXPECT_EQ(-7, property_handle_get_int32(&handle, -7));
+
+    const std::string intMaxString = ToString(INT32_MAX) + "0";
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, intMaxString.c_str()));
+    EXPECT_EQ(int64_t(INT32_MAX) * 10, property_handle_get_int64(&handle, -7));
+    EXPECT_EQ(-7, property_handle_get_int32(&handle, -7));
+
+    // Matches the plain getters after every change
+    const char *values[] = { "1", "no", "12345", "-2", "garbage", "" };
+    for (size_t i = 0; i < ARRAY_SIZE(values); ++i) {
+        ASSERT_OK(property_set(PROPERTY_TEST_KEY, values[i]));
+        EXPECT_EQ(property_get_bool(PROPERTY_TEST_KEY, true),
+                  property_handle_get_bool(&handle, true)) << values[i];
+        EXPECT_EQ(property_get_int32(PROPERTY_TEST_KEY, -7),
+                  property_handle_get_int32(&handle, -7)) << values[i];
+    }
+}
+
 } // namespace android
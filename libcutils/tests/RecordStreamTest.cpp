@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <cutils/record_stream.h>
+#include <gtest/gtest.h>
+
+static const size_t kMaxRecordLen = 100;
+
+// Records of every length up to kMaxRecordLen, so that they end up
+// wrapping around a small ring at every possible offset.
+static std::vector<std::string> MakeRecords() {
+    std::vector<std::string> records;
+    for (size_t i = 0; i < 3 * kMaxRecordLen; i++) {
+        std::string record;
+        for (size_t j = 0; j < (i * 7) % (kMaxRecordLen + 1); j++) {
+            record.push_back(static_cast<char>(i + j));
+        }
+        records.push_back(record);
+    }
+    return records;
+}
+
+static std::string Frame(const std::string& record) {
+    uint32_t len = htonl(record.size());
+    return std::string(reinterpret_cast<char*>(&len), sizeof(len)) + record;
+}
+
+// Returns the read end of a pipe that has data written to it and closed.
+static int PipeWith(const std::string& data) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    EXPECT_EQ(static_cast<ssize_t>(data.size()), write(fds[1], data.data(), data.size()));
+    close(fds[1]);
+    return fds[0];
+}
+
+static std::string AllFramed(const std::vector<std::string>& records) {
+    std::string data;
+    for (const std::string& record : records) {
+        data += Frame(record);
+    }
+    return data;
+}
+
+TEST(RecordRing, GetNext) {
+    const std::vector<std::string> records = MakeRecords();
+    const std::string data = AllFramed(records);
+
+    for (size_t ring_len : { size_t(0), size_t(150), size_t(4096) }) {
+        int fd = PipeWith(data);
+        ASSERT_NE(-1, fd);
+        RecordRing* rr = record_ring_new(fd, kMaxRecordLen, ring_len);
+        ASSERT_TRUE(rr != NULL);
+
+        size_t i = 0;
+        for (;;) {
+            void* record;
+            size_t len;
+            int ret = record_ring_get_next(rr, &record, &len);
+            if (ret == -1 && errno == EAGAIN) {
+                continue;
+            }
+            ASSERT_EQ(0, ret);
+            if (record == NULL) {
+                break;
+            }
+            ASSERT_LT(i, records.size());
+            EXPECT_EQ(records[i], std::string(static_cast<char*>(record), len))
+                    << "record " << i << ", ring of " << ring_len;
+            i++;
+        }
+        EXPECT_EQ(records.size(), i);
+
+        record_ring_free(rr);
+        close(fd);
+    }
+}
+
+TEST(RecordRing, GetBatch) {
+    const std::vector<std::string> records = MakeRecords();
+    const std::string data = AllFramed(records);
+    int fd = PipeWith(data);
+    ASSERT_NE(-1, fd);
+    RecordRing* rr = record_ring_new(fd, kMaxRecordLen, 1000);
+    ASSERT_TRUE(rr != NULL);
+
+    RecordView views[8];
+    size_t i = 0;
+    bool several = false;
+    for (;;) {
+        size_t count;
+        int ret = record_ring_get_batch(rr, views, 8, &count);
+        if (ret == -1 && errno == EAGAIN) {
+            continue;
+        }
+        ASSERT_EQ(0, ret);
+        if (count == 0) {
+            break;
+        }
+        several |= count > 1;
+        for (size_t j = 0; j < count; j++, i++) {
+            ASSERT_LT(i, records.size());
+            EXPECT_EQ(records[i], std::string(static_cast<char*>(views[j].data), views[j].len))
+                    << "record " << i;
+        }
+    }
+    EXPECT_EQ(records.size(), i);
+    EXPECT_TRUE(several);
+
+    record_ring_free(rr);
+    close(fd);
+}
+
+TEST(RecordRing, PartialRecord) {
+    const std::string data = Frame("partial");
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    RecordRing* rr = record_ring_new(fds[0], kMaxRecordLen, 0);
+    ASSERT_TRUE(rr != NULL);
+
+    void* record;
+    size_t len;
+    ASSERT_EQ(6, write(fds[1], data.data(), 6));
+    errno = 0;
+    EXPECT_EQ(-1, record_ring_get_next(rr, &record, &len));
+    EXPECT_EQ(EAGAIN, errno);
+
+    ASSERT_EQ(static_cast<ssize_t>(data.size() - 6), write(fds[1], data.data() + 6, data.size() - 6));
+    ASSERT_EQ(0, record_ring_get_next(rr, &record, &len));
+    EXPECT_EQ("partial", std::string(static_cast<char*>(record), len));
+
+    close(fds[1]);
+    EXPECT_EQ(0, record_ring_get_next(rr, &record, &len));
+    EXPECT_TRUE(record == NULL);
+
+    record_ring_free(rr);
+    close(fds[0]);
+}
+
+TEST(RecordRing, RecordTooLong) {
+    int fd = PipeWith(Frame(std::string(kMaxRecordLen + 1, 'x')));
+    ASSERT_NE(-1, fd);
+    RecordRing* rr = record_ring_new(fd, kMaxRecordLen, 0);
+    ASSERT_TRUE(rr != NULL);
+
+    void* record;
+    size_t len;
+    errno = 0;
+    EXPECT_EQ(-1, record_ring_get_next(rr, &record, &len));
+    EXPECT_EQ(EFBIG, errno);
+
+    record_ring_free(rr);
+    close(fd);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for android_memset16/32 against a plain store loop and
+// memset, over sizes from a pixelflinger span to a libsparse copy buffer.
+// All report MB/s.
+//
+// Build with "mmm system/core/libcutils" and run with:
+//   adb shell /data/nativetest/libcutils_benchmark/libcutils_benchmark [regex]
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark.h>
+#include <cutils/memory.h>
+
+static void* buffer(int bytes) {
+  static void* buf;
+  static int buf_bytes;
+  if (bytes > buf_bytes) {
+    free(buf);
+    // Aligned like the scanlines and blocks the callers fill.
+    if (posix_memalign(&buf, 64, bytes) != 0) abort();
+    buf_bytes = bytes;
+  }
+  return buf;
+}
+
+// Kept out of line so that the compiler can't turn it into memset.
+static void __attribute__((noinline)) loop_memset32(uint32_t* dst, uint32_t value, size_t size) {
+  volatile uint32_t* p = dst;
+  for (size_t i = 0; i < size / 4; ++i) {
+    p[i] = value;
+  }
+}
+
+static void BM_android_memset16(int iters, int bytes) {
+  uint16_t* dst = static_cast<uint16_t*>(buffer(bytes));
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    android_memset16(dst, 0xb139, bytes);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+}
+BENCHMARK(BM_android_memset16)->Arg(64)->Arg(1024)->Arg(4096)->Arg(64*1024)->Arg(1024*1024);
+
+static void BM_android_memset32(int iters, int bytes) {
+  uint32_t* dst = static_cast<uint32_t*>(buffer(bytes));
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    android_memset32(dst, 0x48193a27, bytes);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+}
+BENCHMARK(BM_android_memset32)->Arg(64)->Arg(1024)->Arg(4096)->Arg(64*1024)->Arg(1024*1024);
+
+static void BM_loop_memset32(int iters, int bytes) {
+  uint32_t* dst = static_cast<uint32_t*>(buffer(bytes));
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    loop_memset32(dst, 0x48193a27, bytes);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+}
+BENCHMARK(BM_loop_memset32)->Arg(64)->Arg(1024)->Arg(4096)->Arg(64*1024)->Arg(1024*1024);
+
+// The byte-pattern baseline: what the fills would cost if they were memsets.
+static void BM_memset(int iters, int bytes) {
+  void* dst = buffer(bytes);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    memset(dst, 0x5a, bytes);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+}
+BENCHMARK(BM_memset)->Arg(64)->Arg(1024)->Arg(4096)->Arg(64*1024)->Arg(1024*1024);
@@ -17,6 +17,8 @@
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
+#include <string>
+
 static void test_str_parms_str(const char* str, const char* expected) {
     str_parms* str_parms = str_parms_create_str(str);
     str_parms_add_str(str_parms, "dude", "woah");
@@ -55,3 +57,62 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+static void test_str_parms_view_str(const char* str, const char* expected) {
+    str_parms_view view;
+    char out_str[64];
+    ASSERT_LE(0, str_parms_view_parse(&view, str)) << str;
+    ASSERT_EQ((int)strlen(expected), str_parms_view_to_str(&view, out_str, sizeof(out_str))) << str;
+    ASSERT_STREQ(expected, out_str) << str;
+}
+
+TEST(str_parms, view_smoke) {
+    test_str_parms_view_str("", "");
+    test_str_parms_view_str(";", "");
+    test_str_parms_view_str("=", "");
+    test_str_parms_view_str("=;", "");
+    test_str_parms_view_str("=bar", "");
+    test_str_parms_view_str("=bar;", "");
+    test_str_parms_view_str("foo=", "foo=");
+    test_str_parms_view_str("foo=;", "foo=");
+    test_str_parms_view_str("foo=bar", "foo=bar");
+    test_str_parms_view_str("foo=bar;", "foo=bar");
+    test_str_parms_view_str("foo=bar;baz", "foo=bar;baz=");
+    test_str_parms_view_str("foo=bar;baz=", "foo=bar;baz=");
+    test_str_parms_view_str("foo=bar;baz=bat", "foo=bar;baz=bat");
+    test_str_parms_view_str("foo=bar;baz=bat;", "foo=bar;baz=bat");
+    test_str_parms_view_str("foo=bar1;baz=bat;foo=bar2", "foo=bar2;baz=bat");
+}
+
+TEST(str_parms, view_get) {
+    str_parms_view view;
+    ASSERT_EQ(4, str_parms_view_parse(&view, "routing=2;rate=0x10;gain=0.5;rate=48000"));
+
+    int rate;
+    EXPECT_EQ(0, str_parms_view_get_int(&view, "rate", &rate));
+    EXPECT_EQ(48000, rate);
+
+    float gain;
+    EXPECT_EQ(0, str_parms_view_get_float(&view, "gain", &gain));
+    EXPECT_EQ(0.5f, gain);
+
+    char value[2];
+    EXPECT_EQ(1, str_parms_view_get_str(&view, "routing", value, sizeof(value)));
+    EXPECT_STREQ("2", value);
+    EXPECT_EQ(-ENOENT, str_parms_view_get_str(&view, "rout", value, sizeof(value)));
+    EXPECT_FALSE(str_parms_view_has_key(&view, "routing2"));
+
+    char out_str[8];
+    EXPECT_EQ(29, str_parms_view_to_str(&view, out_str, sizeof(out_str)));
+    EXPECT_STREQ("routing", out_str);
+}
+
+TEST(str_parms, view_too_many_pairs) {
+    std::string str;
+    for (int i = 0; i <= STR_PARMS_VIEW_MAX_PAIRS; i++) {
+        str += "k" + std::to_string(i) + "=v;";
+    }
+    str_parms_view view;
+    EXPECT_EQ(-E2BIG, str_parms_view_parse(&view, str.c_str()));
+    EXPECT_EQ((size_t)STR_PARMS_VIEW_MAX_PAIRS, view.count);
+}
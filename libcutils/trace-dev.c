@@ -27,6 +27,9 @@
 #include <cutils/properties.h>
 #include <cutils/trace.h>
 
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
 #define LOG_TAG "cutils-trace"
 #include <log/log.h>
 
@@ -45,6 +48,11 @@ static atomic_bool      atrace_is_enabled    = ATOMIC_VAR_INIT(true);
 static pthread_once_t   atrace_once_control  = PTHREAD_ONCE_INIT;
 static pthread_mutex_t  atrace_tags_mutex    = PTHREAD_MUTEX_INITIALIZER;
 
+// For atrace_update_tags_if_changed(): the tags property, once it exists,
+// and the serial of the property, or of the whole area until then.
+static const prop_info* _Atomic atrace_tags_prop     = NULL;
+static atomic_uint      atrace_tags_serial   = ATOMIC_VAR_INIT(0);
+
 // Set whether this process is debuggable, which determines whether
 // application-level tracing is allowed when the ro.debuggable system property
 // is not set to '1'.
@@ -171,6 +179,43 @@ void atrace_update_tags()
     }
 }
 
+void atrace_update_tags_if_changed()
+{
+    // Until the first trace call reads them, there are no tags to update.
+    if (!atomic_load_explicit(&atrace_is_ready, memory_order_acquire)) {
+        return;
+    }
+
+    const prop_info* pi = atomic_load_explicit(&atrace_tags_prop, memory_order_acquire);
+    unsigned int serial;
+    if (CC_LIKELY(pi != NULL)) {
+        serial = __system_property_serial(pi);
+    } else {
+        // The property doesn't exist until tracing is first turned on;
+        // only look it up again when properties were added.
+        serial = __system_property_area_serial();
+    }
+    if (CC_LIKELY(serial == atomic_load_explicit(&atrace_tags_serial,
+                                                 memory_order_relaxed))) {
+        return;
+    }
+
+    pthread_mutex_lock(&atrace_tags_mutex);
+    if (pi == NULL) {
+        pi = __system_property_find("debug.atrace.tags.enableflags");
+        if (pi != NULL) {
+            atomic_store_explicit(&atrace_tags_prop, pi, memory_order_release);
+            serial = __system_property_serial(pi);
+        }
+    }
+    atomic_store_explicit(&atrace_tags_serial, serial, memory_order_relaxed);
+    pthread_mutex_unlock(&atrace_tags_mutex);
+
+    if (pi != NULL) {
+        atrace_update_tags();
+    }
+}
+
 static void atrace_init_once()
 {
     atrace_marker_fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
@@ -191,16 +236,40 @@ void atrace_setup()
     pthread_once(&atrace_once_control, atrace_init_once);
 }
 
+// Formats "<type>|<pid>|" into buf and returns its length. This runs for
+// every ATRACE_BEGIN, so avoid going through snprintf.
+static size_t atrace_format_prefix(char* buf, char type)
+{
+    char digits[12];
+    size_t ndigits = 0;
+    unsigned int pid = getpid();
+    do {
+        digits[ndigits++] = '0' + pid % 10;
+        pid /= 10;
+    } while (pid != 0);
+
+    size_t len = 0;
+    buf[len++] = type;
+    buf[len++] = '|';
+    while (ndigits > 0) {
+        buf[len++] = digits[--ndigits];
+    }
+    buf[len++] = '|';
+    return len;
+}
+
 void atrace_begin_body(const char* name)
 {
     char buf[ATRACE_MESSAGE_LENGTH];
 
-    int len = snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), name);
-    if (len >= (int) sizeof(buf)) {
+    size_t len = atrace_format_prefix(buf, 'B');
+    size_t name_len = strnlen(name, sizeof(buf) - len);
+    if (name_len == sizeof(buf) - len) {
         ALOGW("Truncated name in %s: %s\n", __FUNCTION__, name);
-        len = sizeof(buf) - 1;
+        name_len--;
     }
-    write(atrace_marker_fd, buf, len);
+    memcpy(buf + len, name, name_len);
+    write(atrace_marker_fd, buf, len + name_len);
 }
 
 #define WRITE_MSG(format_begin, format_end, pid, name, value) { \
@@ -49,6 +49,37 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/* Checks a received message; returns false if it must be dropped. */
+static bool uevent_check_sender(struct msghdr *hdr, bool require_group, uid_t *uid)
+{
+    const struct sockaddr_nl *addr = hdr->msg_name;
+
+    *uid = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        /* ignoring netlink message with no sender credentials */
+        return false;
+    }
+
+    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        /* ignoring netlink message from non-root user */
+        return false;
+    }
+
+    if (addr->nl_pid != 0) {
+        /* ignore non-kernel */
+        return false;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        /* ignore unicast messages when requested */
+        return false;
+    }
+
+    return true;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     struct iovec iov = { buffer, length };
@@ -70,35 +101,56 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
-    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        /* ignoring netlink message with no sender credentials */
-        goto out;
+    if (!uevent_check_sender(&hdr, require_group, uid)) {
+        /* clear residual potentially malicious data */
+        bzero(buffer, length);
+        errno = EIO;
+        return -1;
     }
 
-    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        /* ignoring netlink message from non-root user */
-        goto out;
-    }
+    return n;
+}
 
-    if (addr.nl_pid != 0) {
-        /* ignore non-kernel */
-        goto out;
+int uevent_kernel_recv_batch(int socket, void *buffer, size_t slot_size, unsigned count,
+                             bool require_group, ssize_t *lengths, uid_t *uids)
+{
+    struct mmsghdr msgs[UEVENT_RECV_BATCH_MAX];
+    struct iovec iovs[UEVENT_RECV_BATCH_MAX];
+    struct sockaddr_nl addrs[UEVENT_RECV_BATCH_MAX];
+    char controls[UEVENT_RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+    unsigned i;
+    int n;
+
+    if (count > UEVENT_RECV_BATCH_MAX) {
+        count = UEVENT_RECV_BATCH_MAX;
     }
-    if (require_group && addr.nl_groups == 0) {
-        /* ignore unicast messages when requested */
-        goto out;
+    memset(msgs, 0, sizeof(msgs[0]) * count);
+    for (i = 0; i < count; i++) {
+        iovs[i].iov_base = (char *)buffer + i * slot_size;
+        iovs[i].iov_len = slot_size;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
 
-    return n;
+    n = recvmmsg(socket, msgs, count, MSG_WAITFORONE, NULL);
+    if (n <= 0) {
+        return n;
+    }
 
-out:
-    /* clear residual potentially malicious data */
-    bzero(buffer, length);
-    errno = EIO;
-    return -1;
+    for (i = 0; i < (unsigned)n; i++) {
+        lengths[i] = msgs[i].msg_len;
+        if (!uevent_check_sender(&msgs[i].msg_hdr, require_group, &uids[i])
+                || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+            /* clear residual potentially malicious data */
+            bzero(iovs[i].iov_base, slot_size);
+            lengths[i] = -1;
+        }
+    }
+    return n;
 }
 
 int uevent_open_socket(int buf_sz, bool passcred)
@@ -41,6 +41,26 @@ int ion_map(int fd, ion_user_handle_t handle, size_t length, int prot,
 int ion_share(int fd, ion_user_handle_t handle, int *share_fd);
 int ion_import(int fd, int share_fd, ion_user_handle_t *handle);
 
+/* A pool keeps freed buffers mapped, to hand them out again for allocations
+ * of the same length, heaps and flags without the kernel zeroing pages and
+ * setting up a new mapping.  Reused buffers keep their old contents.  Up to
+ * max_free_bytes of freed buffers are kept, the least recently freed go
+ * first; ion_pool_trim() lets fewer be kept, e.g. under memory pressure.
+ * Buffer fds belong to the pool: dup() them to hand them on, don't close
+ * them.  A pool can be used from several threads.
+ */
+struct ion_pool;
+
+struct ion_pool *ion_pool_create(int fd, size_t max_free_bytes);
+void ion_pool_destroy(struct ion_pool *pool);
+/* As ion_alloc_fd(), with the buffer mapped read-write at *ptr. */
+int ion_pool_alloc(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                   unsigned int flags, int *handle_fd, unsigned char **ptr);
+int ion_pool_free(struct ion_pool *pool, int handle_fd);
+/* As ion_sync_fd(), skipped for buffers that don't need it. */
+int ion_pool_sync(struct ion_pool *pool, int handle_fd);
+void ion_pool_trim(struct ion_pool *pool, size_t keep_bytes);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_ION_H */
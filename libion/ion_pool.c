@@ -0,0 +1,242 @@
+/*
+ *  ion_pool.c
+ *
+ * Reuse of freed ion buffers and their mappings
+ *
+ *   Copyright 2016 The Android Open Source Project
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#define LOG_TAG "ion"
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/ion.h>
+#include <ion/ion.h>
+
+struct ion_pool_buffer {
+    int fd;
+    unsigned char *ptr;
+    size_t len;
+    unsigned int heap_mask;
+    unsigned int flags;
+    int in_use;
+    uint64_t freed;     /* when it was last freed, to release the oldest */
+};
+
+struct ion_pool {
+    int ion_fd;
+    size_t max_free_bytes;
+    size_t free_bytes;
+    uint64_t clock;
+    pthread_mutex_t lock;
+    struct ion_pool_buffer *buffers;
+    size_t count;
+    size_t capacity;
+};
+
+struct ion_pool *ion_pool_create(int fd, size_t max_free_bytes)
+{
+    struct ion_pool *pool = calloc(1, sizeof(*pool));
+
+    if (pool == NULL)
+        return NULL;
+    pool->ion_fd = fd;
+    pool->max_free_bytes = max_free_bytes;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+static void release_buffer(struct ion_pool *pool, size_t i)
+{
+    struct ion_pool_buffer *buf = &pool->buffers[i];
+
+    munmap(buf->ptr, buf->len);
+    close(buf->fd);
+    if (!buf->in_use)
+        pool->free_bytes -= buf->len;
+    pool->buffers[i] = pool->buffers[--pool->count];
+}
+
+/* Releases the least recently freed buffers until no more than keep_bytes
+ * are left free.  Called with the lock held. */
+static void trim_locked(struct ion_pool *pool, size_t keep_bytes)
+{
+    while (pool->free_bytes > keep_bytes) {
+        size_t oldest = pool->count;
+        size_t i;
+
+        for (i = 0; i < pool->count; i++) {
+            if (!pool->buffers[i].in_use &&
+                (oldest == pool->count ||
+                 pool->buffers[i].freed < pool->buffers[oldest].freed))
+                oldest = i;
+        }
+        release_buffer(pool, oldest);
+    }
+}
+
+void ion_pool_destroy(struct ion_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    while (pool->count > 0) {
+        if (pool->buffers[0].in_use)
+            ALOGW("ion pool destroyed with buffer fd %d in use\n",
+                  pool->buffers[0].fd);
+        release_buffer(pool, 0);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->buffers);
+    free(pool);
+}
+
+int ion_pool_alloc(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                   unsigned int flags, int *handle_fd, unsigned char **ptr)
+{
+    struct ion_pool_buffer *buf;
+    size_t best;
+    size_t i;
+    int fd;
+    unsigned char *map;
+    int ret;
+
+    if (handle_fd == NULL || ptr == NULL)
+        return -EINVAL;
+
+    pthread_mutex_lock(&pool->lock);
+    /* the most recently freed match, most likely still in the caches */
+    best = pool->count;
+    for (i = 0; i < pool->count; i++) {
+        buf = &pool->buffers[i];
+        if (!buf->in_use && buf->len == len && buf->heap_mask == heap_mask &&
+            buf->flags == flags &&
+            (best == pool->count || buf->freed > pool->buffers[best].freed))
+            best = i;
+    }
+    if (best < pool->count) {
+        buf = &pool->buffers[best];
+        buf->in_use = 1;
+        pool->free_bytes -= buf->len;
+        *handle_fd = buf->fd;
+        *ptr = buf->ptr;
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    ret = ion_alloc_fd(pool->ion_fd, len, 0, heap_mask, flags, &fd);
+    if (ret < 0)
+        return ret;
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = -errno;
+        ALOGE("mmap failed: %s\n", strerror(errno));
+        close(fd);
+        return ret;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : 16;
+        struct ion_pool_buffer *buffers =
+                realloc(pool->buffers, capacity * sizeof(*buffers));
+        if (buffers == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            munmap(map, len);
+            close(fd);
+            return -ENOMEM;
+        }
+        pool->buffers = buffers;
+        pool->capacity = capacity;
+    }
+    buf = &pool->buffers[pool->count++];
+    buf->fd = fd;
+    buf->ptr = map;
+    buf->len = len;
+    buf->heap_mask = heap_mask;
+    buf->flags = flags;
+    buf->in_use = 1;
+    buf->freed = 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    *handle_fd = fd;
+    *ptr = map;
+    return 0;
+}
+
+/* Finds the buffer of handle_fd.  Called with the lock held. */
+static struct ion_pool_buffer *find_buffer(struct ion_pool *pool, int handle_fd)
+{
+    size_t i;
+
+    for (i = 0; i < pool->count; i++) {
+        if (pool->buffers[i].fd == handle_fd)
+            return &pool->buffers[i];
+    }
+    return NULL;
+}
+
+int ion_pool_free(struct ion_pool *pool, int handle_fd)
+{
+    struct ion_pool_buffer *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    buf = find_buffer(pool, handle_fd);
+    if (buf == NULL || !buf->in_use) {
+        pthread_mutex_unlock(&pool->lock);
+        return -EINVAL;
+    }
+    buf->in_use = 0;
+    buf->freed = ++pool->clock;
+    pool->free_bytes += buf->len;
+    trim_locked(pool, pool->max_free_bytes);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int ion_pool_sync(struct ion_pool *pool, int handle_fd)
+{
+    struct ion_pool_buffer *buf;
+    unsigned int flags;
+
+    pthread_mutex_lock(&pool->lock);
+    buf = find_buffer(pool, handle_fd);
+    if (buf == NULL) {
+        pthread_mutex_unlock(&pool->lock);
+        return -EINVAL;
+    }
+    flags = buf->flags;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Only cached mappings that the kernel doesn't keep coherent itself
+     * need the cache maintenance. */
+    if ((flags & (ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC)) !=
+            (ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC))
+        return 0;
+    return ion_sync_fd(pool->ion_fd, handle_fd);
+}
+
+void ion_pool_trim(struct ion_pool *pool, size_t keep_bytes)
+{
+    pthread_mutex_lock(&pool->lock);
+    trim_locked(pool, keep_bytes);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -28,5 +28,21 @@ LOCAL_SRC_FILES := \
 	invalid_values_test.cpp \
 	map_test.cpp \
 	device_test.cpp \
-	exit_test.cpp
+	exit_test.cpp \
+	pool_test.cpp
+include $(BUILD_NATIVE_TEST)
+
+#
+# Benchmarks, using the harness from liblog's tests. Run with:
+#   adb shell /data/nativetest/ion_benchmark/ion_benchmark
+#
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := ion_benchmark
+LOCAL_CFLAGS += -Wall -Werror
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../liblog/tests
+LOCAL_SRC_FILES := \
+	../../liblog/tests/benchmark_main.cpp \
+	pool_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := libion
 include $(BUILD_NATIVE_TEST)
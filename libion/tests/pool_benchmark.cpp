@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for the allocate, map, write, free cycle of a camera or video
+// buffer, straight from the kernel and through an ion_pool, in the system
+// heap.  Each iteration writes the whole buffer, as a producer would.
+//
+// Build with "mmm system/core/libion" and run with:
+//   adb shell /data/nativetest/ion_benchmark/ion_benchmark [regex]
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <benchmark.h>
+#include <ion/ion.h>
+
+static void BM_ion_alloc_map(int iters, int bytes) {
+  int ion_fd = ion_open();
+  if (ion_fd < 0) abort();
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    int fd;
+    if (ion_alloc_fd(ion_fd, bytes, 0, ION_HEAP_SYSTEM_MASK, 0, &fd) != 0) abort();
+    void* ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) abort();
+    memset(ptr, i, bytes);
+    munmap(ptr, bytes);
+    close(fd);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+
+  ion_close(ion_fd);
+}
+BENCHMARK(BM_ion_alloc_map)->Arg(64*1024)->Arg(1024*1024)->Arg(8*1024*1024);
+
+static void BM_ion_pool_alloc(int iters, int bytes) {
+  int ion_fd = ion_open();
+  if (ion_fd < 0) abort();
+  struct ion_pool* pool = ion_pool_create(ion_fd, 4 * bytes);
+  if (pool == NULL) abort();
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    int fd;
+    unsigned char* ptr;
+    if (ion_pool_alloc(pool, bytes, ION_HEAP_SYSTEM_MASK, 0, &fd, &ptr) != 0) abort();
+    memset(ptr, i, bytes);
+    ion_pool_free(pool, fd);
+  }
+  StopBenchmarkTiming();
+  SetBenchmarkBytesProcessed(uint64_t(iters) * bytes);
+
+  ion_pool_destroy(pool);
+  ion_close(ion_fd);
+}
+BENCHMARK(BM_ion_pool_alloc)->Arg(64*1024)->Arg(1024*1024)->Arg(8*1024*1024);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+
+#include <gtest/gtest.h>
+
+#include <ion/ion.h>
+
+#include "ion_test_fixture.h"
+
+class Pool : public IonAllHeapsTest {
+};
+
+TEST_F(Pool, Reuse)
+{
+    static const size_t allocationSizes[] = {4*1024, 64*1024, 1024*1024};
+    for (unsigned int heapMask : m_allHeaps) {
+        for (size_t size : allocationSizes) {
+            SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+            SCOPED_TRACE(::testing::Message() << "size " << size);
+            struct ion_pool *pool = ion_pool_create(m_ionFd, 4 * size);
+            ASSERT_TRUE(pool != NULL);
+
+            int fd = -1;
+            unsigned char *ptr = NULL;
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &fd, &ptr));
+            ASSERT_GE(fd, 0);
+            ASSERT_TRUE(ptr != NULL);
+            memset(ptr, 0xaa, size);
+            ASSERT_EQ(0, ion_pool_free(pool, fd));
+            ASSERT_EQ(-EINVAL, ion_pool_free(pool, fd));
+
+            // The same buffer comes back, still mapped, for the same request.
+            int fd2 = -1;
+            unsigned char *ptr2 = NULL;
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &fd2, &ptr2));
+            ASSERT_EQ(fd, fd2);
+            ASSERT_EQ(ptr, ptr2);
+            ASSERT_EQ(0xaa, ptr2[size - 1]);
+
+            // A different one for a different request.
+            int fd3 = -1;
+            unsigned char *ptr3 = NULL;
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, ION_FLAG_CACHED, &fd3, &ptr3));
+            ASSERT_NE(fd, fd3);
+            ASSERT_EQ(0, ion_pool_sync(pool, fd3));
+
+            ASSERT_EQ(0, ion_pool_free(pool, fd2));
+            ASSERT_EQ(0, ion_pool_free(pool, fd3));
+            ion_pool_trim(pool, 0);
+            ion_pool_destroy(pool);
+        }
+    }
+}
+
+TEST_F(Pool, Limit)
+{
+    static const size_t size = 64*1024;
+    for (unsigned int heapMask : m_allHeaps) {
+        SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+        struct ion_pool *pool = ion_pool_create(m_ionFd, size);
+        ASSERT_TRUE(pool != NULL);
+
+        int fd[2];
+        unsigned char *ptr[2];
+        for (int i = 0; i < 2; i++) {
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &fd[i], &ptr[i]));
+        }
+        ASSERT_EQ(0, ion_pool_free(pool, fd[0]));
+        // Over the limit: the older free buffer goes.
+        ASSERT_EQ(0, ion_pool_free(pool, fd[1]));
+        ASSERT_EQ(-EINVAL, ion_pool_sync(pool, fd[0]));
+        ASSERT_EQ(0, ion_pool_sync(pool, fd[1]));
+
+        ion_pool_destroy(pool);
+    }
+}
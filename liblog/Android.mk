@@ -39,7 +39,7 @@ else
 endif
 
 liblog_host_sources := $(liblog_sources) fake_log_device.c event.logtags
-liblog_target_sources := $(liblog_sources) log_time.cpp log_is_loggable.c
+liblog_target_sources := $(liblog_sources) log_time.cpp log_is_loggable.c log_deferred.c
 ifeq ($(strip $(USE_MINGW)),)
 liblog_target_sources += logprint.c
 endif
@@ -81,6 +81,32 @@ LOCAL_CFLAGS := -Werror $(liblog_cflags)
 # TODO: This is to work around b/19059885. Remove after root cause is fixed
 LOCAL_LDFLAGS_arm := -Wl,--hash-style=both
 
+LOCAL_REQUIRED_MODULES := event-log-tags.idx
+
 include $(BUILD_SHARED_LIBRARY)
 
+ifeq ($(strip $(USE_MINGW)),)
+# Precompiled event tag map index, see event_tag_map.c
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event_tag_index
+LOCAL_SRC_FILES := event_tag_index.c
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_CFLAGS := -Werror
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags.idx
+LOCAL_MODULE_CLASS := ETC
+include $(BUILD_SYSTEM)/base_rules.mk
+
+event_tag_index_tool := $(HOST_OUT_EXECUTABLES)/event_tag_index$(HOST_EXECUTABLE_SUFFIX)
+$(LOCAL_BUILT_MODULE): $(TARGET_OUT)/etc/event-log-tags $(event_tag_index_tool)
+	@echo "Event tag index: $< -> $@"
+	@mkdir -p $(dir $@)
+	$(hide) $(event_tag_index_tool) $< $@
+
+event_tag_index_tool :=
+endif
+
 include $(call first-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Precompiles an event-log-tags file into the index android_openEventTagMap
+ * prefers, see event_tag_map.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <log/event_tag_map.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <event-log-tags> <event-log-tags.idx>\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    return android_writeEventTagIndex(argv[1], argv[2])
+        ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -17,9 +17,13 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/event_tag_map.h>
 #include <log/log.h>
@@ -34,6 +38,23 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Precompiled index, "<map file>.idx", generated at build time by
+ * event_tag_index so that nothing need be parsed, sorted or written to
+ * at runtime and the pages stay shared and clean. All fields are little
+ * endian uint32_t:
+ *
+ *   magic, number of slots (a power of two), number of tags, string bytes
+ *   slots: { tag, offset of its name in the strings, 0 if empty }
+ *   strings: the nul terminated names, after a leading nul
+ *
+ * A tag lives in the first empty-or-matching slot at or after its hash,
+ * wrapping around; no more than half the slots are used.
+ */
+#define INDEX_MAGIC 0x31495445  /* "ETI1" */
+#define INDEX_HEADER_WORDS 4
+#define INDEX_SLOT_WORDS 2
+
 /*
  * Map.
  */
@@ -45,6 +66,12 @@ struct EventTagMap {
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* or, when mapAddr is an index, its slots and strings */
+    const unsigned char* slots;
+    uint32_t        slotMask;
+    const char*     strings;
+    uint32_t        stringsLen;
 };
 
 /* fwd */
@@ -55,11 +82,106 @@ static int scanTagLine(char** pData, EventTag* tag, int lineNum);
 static int sortTags(EventTagMap* map);
 
 
+static inline uint32_t get4LE(const unsigned char* src)
+{
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline void set4LE(unsigned char* dst, uint32_t val)
+{
+    dst[0] = val;
+    dst[1] = val >> 8;
+    dst[2] = val >> 16;
+    dst[3] = val >> 24;
+}
+
+static inline uint32_t hashTag(uint32_t tag)
+{
+    return tag * 2654435761U;
+}
+
+/*
+ * Map fileName's index, if it has one at least as new as fileName.
+ *
+ * Returns NULL if there is none, or it is not valid.
+ */
+static EventTagMap* openIndex(const char* fileName)
+{
+    EventTagMap* newTagMap;
+    struct stat st, indexSt;
+    char indexName[PATH_MAX];
+    const unsigned char* header;
+    uint32_t numSlots, numTags, stringsLen;
+    int fd;
+
+    if ((size_t)snprintf(indexName, sizeof(indexName), "%s.idx", fileName)
+            >= sizeof(indexName)) {
+        return NULL;
+    }
+    fd = open(indexName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    /* a newer text map, pushed by hand say, wins */
+    if ((fstat(fd, &indexSt) < 0)
+            || ((stat(fileName, &st) == 0) && (st.st_mtime > indexSt.st_mtime))
+            || (indexSt.st_size < (INDEX_HEADER_WORDS * 4))) {
+        close(fd);
+        return NULL;
+    }
+
+    newTagMap = calloc(1, sizeof(EventTagMap));
+    if (newTagMap == NULL) {
+        close(fd);
+        return NULL;
+    }
+    newTagMap->mapAddr = mmap(NULL, indexSt.st_size, PROT_READ, MAP_SHARED,
+                              fd, 0);
+    close(fd);
+    if (newTagMap->mapAddr == MAP_FAILED) {
+        free(newTagMap);
+        return NULL;
+    }
+    newTagMap->mapLen = indexSt.st_size;
+
+    header = newTagMap->mapAddr;
+    numSlots = get4LE(header + 4);
+    numTags = get4LE(header + 8);
+    stringsLen = get4LE(header + 12);
+    if ((get4LE(header) != INDEX_MAGIC)
+            || !numSlots || (numSlots & (numSlots - 1))
+            || (numSlots > (UINT32_MAX / (INDEX_SLOT_WORDS * 4)))
+            || (numTags >= numSlots)
+            || ((uint64_t)INDEX_HEADER_WORDS * 4
+                    + (uint64_t)numSlots * INDEX_SLOT_WORDS * 4
+                    + stringsLen != newTagMap->mapLen)
+            || !stringsLen) {
+        fprintf(stderr, "%s: invalid index '%s'\n", OUT_TAG, indexName);
+        android_closeEventTagMap(newTagMap);
+        return NULL;
+    }
+    newTagMap->slots = header + INDEX_HEADER_WORDS * 4;
+    newTagMap->slotMask = numSlots - 1;
+    newTagMap->strings = (const char*) newTagMap->slots
+                       + numSlots * INDEX_SLOT_WORDS * 4;
+    newTagMap->stringsLen = stringsLen;
+    newTagMap->numTags = numTags;
+    /* names are only looked for within the strings, so they must end */
+    if (newTagMap->strings[stringsLen - 1] != '\0') {
+        fprintf(stderr, "%s: invalid index '%s'\n", OUT_TAG, indexName);
+        android_closeEventTagMap(newTagMap);
+        return NULL;
+    }
+
+    return newTagMap;
+}
+
 /*
  * Open the map file and allocate a structure to manage it.
  *
- * We create a private mapping because we want to terminate the log tag
- * strings with '\0'.
+ * The precompiled index is used if there is one. Otherwise we parse the
+ * text, and create a private mapping because we want to terminate the
+ * log tag strings with '\0'.
  */
 EventTagMap* android_openEventTagMap(const char* fileName)
 {
@@ -67,6 +189,10 @@ EventTagMap* android_openEventTagMap(const char* fileName)
     off_t end;
     int fd = -1;
 
+    newTagMap = openIndex(fileName);
+    if (newTagMap != NULL)
+        return newTagMap;
+
     newTagMap = calloc(1, sizeof(EventTagMap));
     if (newTagMap == NULL)
         return NULL;
@@ -114,7 +240,9 @@ void android_closeEventTagMap(EventTagMap* map)
     if (map == NULL)
         return;
 
-    munmap(map->mapAddr, map->mapLen);
+    if (map->mapAddr && (map->mapAddr != MAP_FAILED))
+        munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
@@ -127,6 +255,21 @@ const char* android_lookupEventTag(const EventTagMap* map, int tag)
 {
     int hi, lo, mid;
 
+    if (map->slots) {
+        uint32_t i = hashTag(tag) & map->slotMask;
+        for (;;) {
+            const unsigned char* slot = map->slots + i * INDEX_SLOT_WORDS * 4;
+            uint32_t name = get4LE(slot + 4);
+            if (!name || (name >= map->stringsLen)) {
+                return NULL;
+            }
+            if (get4LE(slot) == (uint32_t)tag) {
+                return map->strings + name;
+            }
+            i = (i + 1) & map->slotMask;
+        }
+    }
+
     lo = 0;
     hi = map->numTags-1;
 
@@ -420,3 +563,84 @@ static int sortTags(EventTagMap* map)
 
     return 0;
 }
+
+/*
+ * Parse the text map fileName and write its index to indexName.
+ *
+ * Returns 0 on success.
+ */
+int android_writeEventTagIndex(const char* fileName, const char* indexName)
+{
+    EventTagMap* map;
+    unsigned char* index = NULL;
+    size_t indexLen, stringsLen, pos;
+    uint32_t numSlots;
+    int i, fd, ret = -1;
+
+    /* load the text, even if an index is there already */
+    map = calloc(1, sizeof(EventTagMap));
+    if (map == NULL)
+        return -1;
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: unable to open map '%s': %s\n",
+            OUT_TAG, fileName, strerror(errno));
+        goto done;
+    }
+    map->mapLen = lseek(fd, 0L, SEEK_END);
+    map->mapAddr = mmap(NULL, map->mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd, 0);
+    close(fd);
+    if ((map->mapAddr == MAP_FAILED) || (processFile(map) != 0))
+        goto done;
+
+    /* at most half full */
+    numSlots = 1;
+    while (numSlots < (uint32_t)map->numTags * 2)
+        numSlots <<= 1;
+    stringsLen = 1;
+    for (i = 0; i < map->numTags; i++)
+        stringsLen += strlen(map->tagArray[i].tagStr) + 1;
+
+    indexLen = INDEX_HEADER_WORDS * 4 + numSlots * INDEX_SLOT_WORDS * 4
+             + stringsLen;
+    index = calloc(1, indexLen);
+    if (index == NULL)
+        goto done;
+    set4LE(index, INDEX_MAGIC);
+    set4LE(index + 4, numSlots);
+    set4LE(index + 8, map->numTags);
+    set4LE(index + 12, stringsLen);
+
+    unsigned char* slots = index + INDEX_HEADER_WORDS * 4;
+    char* strings = (char*) slots + numSlots * INDEX_SLOT_WORDS * 4;
+    pos = 1;
+    for (i = 0; i < map->numTags; i++) {
+        uint32_t s = hashTag(map->tagArray[i].tagIndex) & (numSlots - 1);
+        while (get4LE(slots + s * INDEX_SLOT_WORDS * 4 + 4))
+            s = (s + 1) & (numSlots - 1);
+        set4LE(slots + s * INDEX_SLOT_WORDS * 4, map->tagArray[i].tagIndex);
+        set4LE(slots + s * INDEX_SLOT_WORDS * 4 + 4, pos);
+        strcpy(strings + pos, map->tagArray[i].tagStr);
+        pos += strlen(map->tagArray[i].tagStr) + 1;
+    }
+
+    fd = open(indexName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: unable to create index '%s': %s\n",
+            OUT_TAG, indexName, strerror(errno));
+        goto done;
+    }
+    if (write(fd, index, indexLen) == (ssize_t)indexLen)
+        ret = 0;
+    if ((close(fd) != 0) || ret) {
+        fprintf(stderr, "%s: unable to write index '%s'\n", OUT_TAG, indexName);
+        unlink(indexName);
+        ret = -1;
+    }
+
+done:
+    free(index);
+    android_closeEventTagMap(map);
+    return ret;
+}
@@ -0,0 +1,409 @@
+/*
+** Copyright 2015, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Packing the arguments of a format deferred log, and formatting them
+ * again once logd is asked for the entry. Every argument is packed the
+ * same size whatever the bitness of the writer: integers, characters,
+ * pointers and '*' widths as 64 bits, floating point as a double, and
+ * strings as a 16 bit length followed by that many bytes.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+enum length {
+    LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_BIG_L
+};
+
+#define FLAGS_MAX 5 /* "-+ #0" */
+#define NUMBER_MAX 4096
+
+struct conversion {
+    char flags[FLAGS_MAX + 1];
+    int width;     /* -1 if none, -2 if '*' */
+    int precision; /* -1 if none, -2 if '*' */
+    enum length length;
+    char conv;
+};
+
+/*
+ * Parse the conversion after a '%', returns the character following it,
+ * or NULL if it is one that can not be deferred.
+ */
+static const char *parse_conversion(const char *p, struct conversion *c)
+{
+    size_t nflags = 0;
+
+    while (*p && strchr("-+ #0", *p)) {
+        if (nflags < FLAGS_MAX) {
+            c->flags[nflags++] = *p;
+        }
+        ++p;
+    }
+    c->flags[nflags] = '\0';
+
+    c->width = -1;
+    if (*p == '*') {
+        c->width = -2;
+        ++p;
+    } else if ((*p >= '0') && (*p <= '9')) {
+        c->width = 0;
+        while ((*p >= '0') && (*p <= '9')) {
+            c->width = c->width * 10 + (*p++ - '0');
+            if (c->width > NUMBER_MAX) {
+                return NULL;
+            }
+        }
+        if (*p == '$') { /* positional arguments */
+            return NULL;
+        }
+    }
+
+    c->precision = -1;
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            c->precision = -2;
+            ++p;
+        } else {
+            c->precision = 0;
+            while ((*p >= '0') && (*p <= '9')) {
+                c->precision = c->precision * 10 + (*p++ - '0');
+                if (c->precision > NUMBER_MAX) {
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    c->length = LEN_NONE;
+    switch (*p) {
+    case 'h':
+        c->length = (*++p == 'h') ? (++p, LEN_HH) : LEN_H;
+        break;
+    case 'l':
+        c->length = (*++p == 'l') ? (++p, LEN_LL) : LEN_L;
+        break;
+    case 'j': c->length = LEN_J; ++p; break;
+    case 'z': c->length = LEN_Z; ++p; break;
+    case 't': c->length = LEN_T; ++p; break;
+    case 'L': c->length = LEN_BIG_L; ++p; break;
+    }
+
+    c->conv = *p;
+    switch (c->conv) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        if (c->length == LEN_BIG_L) {
+            return NULL;
+        }
+        break;
+    case 'c':
+    case 's':
+    case 'p':
+        if (c->length != LEN_NONE) { /* wide characters */
+            return NULL;
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A':
+        break;
+    case '%':
+        break;
+    default: /* %n, %m and the unknown */
+        return NULL;
+    }
+    return p + 1;
+}
+
+static int put(char **buf, char *end, const void *value, size_t len)
+{
+    if ((size_t)(end - *buf) < len) {
+        return -1;
+    }
+    memcpy(*buf, value, len);
+    *buf += len;
+    return 0;
+}
+
+static int put_int(char **buf, char *end, int64_t value)
+{
+    return put(buf, end, &value, sizeof(value));
+}
+
+ssize_t __android_log_deferred_pack(const char *fmt, va_list ap,
+                                    char *buf, size_t len)
+{
+    char *start = buf;
+    char *end = buf + len;
+    struct conversion c;
+    va_list args;
+    ssize_t ret = -1;
+
+    va_copy(args, ap);
+    while ((fmt = strchr(fmt, '%'))) {
+        fmt = parse_conversion(fmt + 1, &c);
+        if (!fmt) {
+            goto done;
+        }
+        if (c.conv == '%') {
+            continue;
+        }
+        if ((c.width == -2) && put_int(&buf, end, va_arg(args, int))) {
+            goto done;
+        }
+        if (c.precision == -2) {
+            c.precision = va_arg(args, int);
+            if (put_int(&buf, end, c.precision)) {
+                goto done;
+            }
+        }
+
+        int64_t i = 0;
+        switch (c.conv) {
+        case 'd': case 'i':
+            switch (c.length) {
+            case LEN_L:  i = va_arg(args, long); break;
+            case LEN_LL: i = va_arg(args, long long); break;
+            case LEN_J:  i = va_arg(args, intmax_t); break;
+            case LEN_Z:  i = va_arg(args, ssize_t); break;
+            case LEN_T:  i = va_arg(args, ptrdiff_t); break;
+            default:     i = va_arg(args, int); break;
+            }
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            switch (c.length) {
+            case LEN_L:  i = va_arg(args, unsigned long); break;
+            case LEN_LL: i = va_arg(args, unsigned long long); break;
+            case LEN_J:  i = va_arg(args, uintmax_t); break;
+            case LEN_Z:  i = va_arg(args, size_t); break;
+            case LEN_T:  i = va_arg(args, ptrdiff_t); break;
+            default:     i = va_arg(args, unsigned int); break;
+            }
+            break;
+        case 'c':
+            i = va_arg(args, int);
+            break;
+        case 'p':
+            i = (uintptr_t)va_arg(args, void *);
+            break;
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            if (!s) {
+                s = "(null)";
+            }
+            /* the precision may be all that bounds s */
+            size_t l = (c.precision >= 0) ? strnlen(s, c.precision) : strlen(s);
+            uint16_t l16 = (l > LOGGER_ENTRY_MAX_PAYLOAD)
+                ? LOGGER_ENTRY_MAX_PAYLOAD : l;
+            if (put(&buf, end, &l16, sizeof(l16)) || put(&buf, end, s, l16)) {
+                goto done;
+            }
+            continue;
+        }
+        default: {
+            double d = (c.length == LEN_BIG_L)
+                ? (double)va_arg(args, long double) : va_arg(args, double);
+            if (put(&buf, end, &d, sizeof(d))) {
+                goto done;
+            }
+            continue;
+        }
+        }
+        if (put_int(&buf, end, i)) {
+            goto done;
+        }
+    }
+    ret = buf - start;
+
+done:
+    va_end(args);
+    return ret;
+}
+
+static int get(const char **args, const char *end, void *value, size_t len)
+{
+    if ((size_t)(end - *args) < len) {
+        return -1;
+    }
+    memcpy(value, *args, len);
+    *args += len;
+    return 0;
+}
+
+/* snprintf onto the end of buf, does nothing once it is full */
+static void append(char *buf, size_t len, size_t *pos, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (*pos >= len - 1) {
+        return;
+    }
+    va_start(ap, fmt);
+    ret = vsnprintf(buf + *pos, len - *pos, fmt, ap);
+    va_end(ap);
+    if (ret < 0) {
+        return;
+    }
+    *pos += ret;
+    if (*pos > len - 1) {
+        *pos = len - 1;
+    }
+}
+
+ssize_t __android_log_deferred_format(const char *fmt,
+                                      const char *args, size_t argsLen,
+                                      char *buf, size_t len)
+{
+    const char *end = args + argsLen;
+    struct conversion c;
+    size_t pos = 0;
+    char spec[32];
+
+    if (!len) {
+        return -1;
+    }
+    buf[0] = '\0';
+
+    for (;;) {
+        const char *percent = strchr(fmt, '%');
+        size_t literal = percent ? (size_t)(percent - fmt) : strlen(fmt);
+        append(buf, len, &pos, "%.*s", (int)literal, fmt);
+        if (!percent) {
+            break;
+        }
+        fmt = parse_conversion(percent + 1, &c);
+        if (!fmt) {
+            return -1;
+        }
+        if (c.conv == '%') {
+            append(buf, len, &pos, "%%");
+            continue;
+        }
+
+        int64_t i;
+        if (c.width == -2) {
+            if (get(&args, end, &i, sizeof(i))) {
+                return -1;
+            }
+            c.width = (i < -NUMBER_MAX) ? -NUMBER_MAX
+                    : (i > NUMBER_MAX) ? NUMBER_MAX : i;
+            if (c.width < 0) { /* as printf, a negative width left justifies */
+                size_t n = strlen(c.flags);
+                if (n < FLAGS_MAX) {
+                    c.flags[n++] = '-';
+                    c.flags[n] = '\0';
+                }
+                c.width = -c.width;
+            }
+        }
+        if (c.precision == -2) {
+            if (get(&args, end, &i, sizeof(i))) {
+                return -1;
+            }
+            c.precision = (i < 0) ? -1 : (i > NUMBER_MAX) ? NUMBER_MAX : i;
+        }
+
+        /* rebuild the conversion for the packed size of its argument */
+        size_t n = snprintf(spec, sizeof(spec), "%%%s", c.flags);
+        if (c.width >= 0) {
+            n += snprintf(spec + n, sizeof(spec) - n, "%d", c.width);
+        }
+        if ((c.precision >= 0) && (c.conv != 's')) {
+            n += snprintf(spec + n, sizeof(spec) - n, ".%d", c.precision);
+        }
+
+        switch (c.conv) {
+        case 's': {
+            uint16_t l16;
+            if (get(&args, end, &l16, sizeof(l16)) || ((size_t)(end - args) < l16)) {
+                return -1;
+            }
+            snprintf(spec + n, sizeof(spec) - n, ".*s");
+            append(buf, len, &pos, spec, (int)l16, args);
+            args += l16;
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A': {
+            double d;
+            if (get(&args, end, &d, sizeof(d))) {
+                return -1;
+            }
+            snprintf(spec + n, sizeof(spec) - n, "%c", c.conv);
+            append(buf, len, &pos, spec, d);
+            break;
+        }
+        case 'p':
+            if (get(&args, end, &i, sizeof(i))) {
+                return -1;
+            }
+            append(buf, len, &pos, "0x%" PRIx64, (uint64_t)i);
+            break;
+        case 'c':
+            if (get(&args, end, &i, sizeof(i))) {
+                return -1;
+            }
+            snprintf(spec + n, sizeof(spec) - n, "c");
+            append(buf, len, &pos, spec, (int)i);
+            break;
+        default:
+            if (get(&args, end, &i, sizeof(i))) {
+                return -1;
+            }
+            /* narrower arguments wrap the way the writer's printf would */
+            switch (c.length) {
+            case LEN_HH:
+                i = strchr("di", c.conv) ? (int64_t)(signed char)i : (int64_t)(unsigned char)i;
+                break;
+            case LEN_H:
+                i = strchr("di", c.conv) ? (int64_t)(short)i : (int64_t)(unsigned short)i;
+                break;
+            case LEN_NONE:
+                i = strchr("di", c.conv) ? (int64_t)(int)i : (int64_t)(unsigned int)i;
+                break;
+            default:
+                break;
+            }
+            snprintf(spec + n, sizeof(spec) - n, "ll%c", c.conv);
+            append(buf, len, &pos, spec, (long long)i);
+            break;
+        }
+    }
+
+    return pos;
+}
+
+uint32_t __android_log_deferred_id(const char *fmt)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+
+    while (*fmt) {
+        hash ^= (unsigned char)*fmt++;
+        hash *= 16777619U;
+    }
+    return hash ? hash : 1;
+}
@@ -73,8 +73,10 @@ static int __android_log_level(const char *tag, int def)
      * system global default. We do not support ro.log.tag* .
      */
     static char *last_tag;
-    static uint32_t global_serial;
-    uint32_t current_global_serial;
+    /* area serial each cache layer was last refreshed against */
+    static uint32_t tag_serial = -1;
+    static uint32_t global_serial = -1;
+    uint32_t current_serial;
     static struct cache tag_cache[2] = {
         { NULL, -1, 0 },
         { NULL, -1, 0 }
@@ -88,10 +90,10 @@ static int __android_log_level(const char *tag, int def)
 
     pthread_mutex_lock(&lock);
 
-    current_global_serial = __system_property_area_serial();
+    current_serial = __system_property_area_serial();
 
     if (taglen) {
-        uint32_t current_local_serial = current_global_serial;
+        int refresh = current_serial != tag_serial;
 
         if (!last_tag || (last_tag[0] != tag[0]) || strcmp(last_tag + 1, tag + 1)) {
             /* invalidate log.tag.<tag> cache */
@@ -102,7 +104,7 @@ static int __android_log_level(const char *tag, int def)
             }
             free(last_tag);
             last_tag = NULL;
-            current_global_serial = -1;
+            refresh = 1;
         }
         if (!last_tag) {
             last_tag = strdup(tag);
@@ -111,7 +113,7 @@ static int __android_log_level(const char *tag, int def)
 
         kp = key;
         for(i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-            if (current_local_serial != global_serial) {
+            if (refresh) {
                 refresh_cache(&tag_cache[i], kp);
             }
 
@@ -122,6 +124,7 @@ static int __android_log_level(const char *tag, int def)
 
             kp = key + base_offset;
         }
+        tag_serial = current_serial;
     }
 
     switch (toupper(c)) { /* if invalid, resort to global */
@@ -140,7 +143,7 @@ static int __android_log_level(const char *tag, int def)
 
         kp = key;
         for(i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-            if (current_global_serial != global_serial) {
+            if (current_serial != global_serial) {
                 refresh_cache(&global_cache[i], kp);
             }
 
@@ -151,11 +154,10 @@ static int __android_log_level(const char *tag, int def)
 
             kp = key + base_offset;
         }
+        global_serial = current_serial;
         break;
     }
 
-    global_serial = current_global_serial;
-
     pthread_mutex_unlock(&lock);
 
     switch (toupper(c)) {
@@ -171,8 +173,73 @@ static int __android_log_level(const char *tag, int def)
     return def;
 }
 
+/*
+ * Per tag results of __android_log_level(), each good for as long as
+ * __system_property_area_serial() does not change, so that while no
+ * property changes a tag costs neither the lock nor a property lookup.
+ * Entries are seqlocks: readers never wait, and a writer that finds an
+ * entry being written by another thread simply does not cache.
+ */
+#define LEVEL_CACHE_SIZE 64    /* power of two */
+#define LEVEL_CACHE_TAG_MAX 32 /* longer tags are not cached */
+#define LEVEL_CACHE_DEFAULT 0  /* no property set, use def */
+
+struct level_cache {
+    uint32_t seq;    /* odd while being written, 0 if never */
+    uint32_t serial;
+    int level;
+    char tag[LEVEL_CACHE_TAG_MAX];
+};
+
+static struct level_cache level_cache[LEVEL_CACHE_SIZE];
+
+static int __android_log_level_cached(const char *tag, int def)
+{
+    const char *t = tag ? tag : "";
+    size_t len = strlen(t);
+    uint32_t hash = 2166136261U; /* FNV-1a */
+    uint32_t serial, seq;
+    struct level_cache *e;
+    size_t i;
+    int level;
+
+    if (len >= LEVEL_CACHE_TAG_MAX) {
+        return __android_log_level(tag, def);
+    }
+    for (i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)t[i]) * 16777619U;
+    }
+    e = &level_cache[hash & (LEVEL_CACHE_SIZE - 1)];
+
+    serial = __system_property_area_serial();
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq && !(seq & 1)
+            && (__atomic_load_n(&e->serial, __ATOMIC_RELAXED) == serial)
+            && !memcmp(e->tag, t, len + 1)) {
+        level = __atomic_load_n(&e->level, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) {
+            return (level == LEVEL_CACHE_DEFAULT) ? def : level;
+        }
+    }
+
+    /* serial is read before the lookup, a change meanwhile is not missed */
+    level = __android_log_level(tag, LEVEL_CACHE_DEFAULT);
+
+    if (!(seq & 1) && __atomic_compare_exchange_n(&e->seq, &seq, seq + 1, 0,
+                                                  __ATOMIC_ACQUIRE,
+                                                  __ATOMIC_RELAXED)) {
+        __atomic_store_n(&e->serial, serial, __ATOMIC_RELAXED);
+        __atomic_store_n(&e->level, level, __ATOMIC_RELAXED);
+        memcpy(e->tag, t, len + 1);
+        __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    return (level == LEVEL_CACHE_DEFAULT) ? def : level;
+}
+
 int __android_log_is_loggable(int prio, const char *tag, int def)
 {
-    int logLevel = __android_log_level(tag, def);
+    int logLevel = __android_log_level_cached(tag, def);
     return logLevel >= 0 && prio >= logLevel;
 }
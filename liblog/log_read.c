@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <cutils/list.h>
@@ -34,6 +35,8 @@
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
 
+#define PSTORE_PMSG_FILE "/sys/fs/pstore/pmsg-ramoops-0"
+
 /* branchless on many architectures. */
 #define min(x,y) ((y) ^ (((x) ^ (y)) & -((x) < (y))))
 
@@ -253,6 +256,11 @@ struct logger_list {
     log_time start;
     pid_t pid;
     int sock;
+    /* logd packets hold several entries when frame is allocated, in
+     * pstore mode it holds all of pmsg */
+    char *frame;
+    size_t frame_len;
+    size_t frame_pos;
 };
 
 struct logger {
@@ -417,7 +425,7 @@ int android_logger_clear(struct logger *logger)
 
     if (logger->top->mode & ANDROID_LOG_PSTORE) {
         if (uid_has_log_permission(get_best_effective_uid())) {
-            return unlink("/sys/fs/pstore/pmsg-ramoops-0");
+            return unlink(PSTORE_PMSG_FILE);
         }
         errno = EPERM;
         return -1;
@@ -625,114 +633,178 @@ struct logger_list *android_logger_list_open(log_id_t id,
     return logger_list;
 }
 
+/* Used when pstore reports no size for pmsg */
+#define PSTORE_READ_CHUNK (64 * 1024)
+
+/*
+ * Read all of pmsg into the frame with as few reads as it takes, pstore
+ * files can't be mapped. The entries are then parsed in place, only the
+ * payload of those passing the filters is copied out.
+ */
+static int pstore_load(struct logger_list *logger_list)
+{
+    struct stat st;
+    size_t size, len = 0;
+    ssize_t ret;
+    char *buf;
+    int fd = TEMP_FAILURE_RETRY(open(PSTORE_PMSG_FILE, O_RDONLY | O_CLOEXEC));
+
+    if (fd < 0) {
+        return -errno;
+    }
+    /* one byte to spare, so the read that sees the end needs no realloc */
+    if (!fstat(fd, &st) && (st.st_size > 0)) {
+        size = st.st_size + 1;
+    } else {
+        size = PSTORE_READ_CHUNK;
+    }
+    buf = malloc(size);
+    if (!buf) {
+        close(fd);
+        return -ENOMEM;
+    }
+    while ((ret = TEMP_FAILURE_RETRY(read(fd, buf + len, size - len))) > 0) {
+        len += ret;
+        if (len == size) {
+            char *bigger = realloc(buf, size * 2);
+            if (!bigger) {
+                ret = -1;
+                errno = ENOMEM;
+                break;
+            }
+            buf = bigger;
+            size *= 2;
+        }
+    }
+    if (ret < 0) {
+        ret = -errno;
+        free(buf);
+        close(fd);
+        return ret;
+    }
+
+    logger_list->sock = fd;
+    logger_list->frame = buf;
+    logger_list->frame_len = len;
+    logger_list->frame_pos = 0;
+    return 0;
+}
+
 static int android_logger_list_read_pstore(struct logger_list *logger_list,
                                            struct log_msg *log_msg)
 {
-    ssize_t ret;
-    off_t current, next;
-    uid_t uid;
+    int ret;
     struct logger *logger;
     struct __attribute__((__packed__)) {
         android_pmsg_log_header_t p;
         android_log_header_t l;
     } buf;
-    static uint8_t preread_count;
+    unsigned int ids = 0;
+    int privileged = -1;
+    uid_t uid = 0;
 
     memset(log_msg, 0, sizeof(*log_msg));
 
     if (logger_list->sock < 0) {
-        int fd = open("/sys/fs/pstore/pmsg-ramoops-0", O_RDONLY);
-
-        if (fd < 0) {
-            return -errno;
+        ret = pstore_load(logger_list);
+        if (ret < 0) {
+            return ret;
         }
-        logger_list->sock = fd;
-        preread_count = 0;
     }
 
-    ret = 0;
-    while(1) {
-        if (preread_count < sizeof(buf)) {
-            ret = TEMP_FAILURE_RETRY(read(logger_list->sock,
-                                          &buf.p.magic + preread_count,
-                                          sizeof(buf) - preread_count));
-            if (ret < 0) {
-                return -errno;
-            }
-            preread_count += ret;
-        }
-        if (preread_count != sizeof(buf)) {
-            return preread_count ? -EIO : -EAGAIN;
+    logger_for_each(logger, logger_list) {
+        ids |= 1 << logger->id;
+    }
+
+    while (logger_list->frame_pos < logger_list->frame_len) {
+        const char *entry = logger_list->frame + logger_list->frame_pos;
+        size_t remaining = logger_list->frame_len - logger_list->frame_pos;
+        size_t payload;
+
+        if (remaining < sizeof(buf)) {
+            logger_list->frame_pos = logger_list->frame_len;
+            return -EIO;
         }
+        memcpy(&buf, entry, sizeof(buf));
         if ((buf.p.magic != LOGGER_MAGIC)
          || (buf.p.len <= sizeof(buf))
          || (buf.p.len > (sizeof(buf) + LOGGER_ENTRY_MAX_PAYLOAD))
          || (buf.l.id >= LOG_ID_MAX)
          || (buf.l.realtime.tv_nsec >= NS_PER_SEC)) {
-            do {
-                memmove(&buf.p.magic, &buf.p.magic + 1, --preread_count);
-            } while (preread_count && (buf.p.magic != LOGGER_MAGIC));
+            /* resynchronize on the next magic */
+            const char *next = memchr(entry + 1, LOGGER_MAGIC, remaining - 1);
+            logger_list->frame_pos = next ? (size_t)(next - logger_list->frame)
+                                          : logger_list->frame_len;
             continue;
         }
-        preread_count = 0;
+        if (remaining < buf.p.len) {
+            logger_list->frame_pos = logger_list->frame_len;
+            return -EIO;
+        }
+        logger_list->frame_pos += buf.p.len;
 
-        logger_for_each(logger, logger_list) {
-            if (buf.l.id != logger->id) {
-                continue;
-            }
+        if (!(ids & (1 << buf.l.id))) {
+            continue;
+        }
 
-            if ((logger_list->start.tv_sec || logger_list->start.tv_nsec)
-             && ((logger_list->start.tv_sec > buf.l.realtime.tv_sec)
-              || ((logger_list->start.tv_sec == buf.l.realtime.tv_sec)
-               && (logger_list->start.tv_nsec > buf.l.realtime.tv_nsec)))) {
-                break;
-            }
+        if ((logger_list->start.tv_sec || logger_list->start.tv_nsec)
+         && ((logger_list->start.tv_sec > buf.l.realtime.tv_sec)
+          || ((logger_list->start.tv_sec == buf.l.realtime.tv_sec)
+           && (logger_list->start.tv_nsec > buf.l.realtime.tv_nsec)))) {
+            continue;
+        }
 
-            if (logger_list->pid && (logger_list->pid != buf.p.pid)) {
-                break;
-            }
+        if (logger_list->pid && (logger_list->pid != buf.p.pid)) {
+            continue;
+        }
 
+        if (privileged < 0) {
             uid = get_best_effective_uid();
-            if (!uid_has_log_permission(uid) && (uid != buf.p.uid)) {
-                break;
-            }
+            privileged = uid_has_log_permission(uid);
+        }
+        if (!privileged && (uid != buf.p.uid)) {
+            continue;
+        }
 
-            ret = TEMP_FAILURE_RETRY(read(logger_list->sock,
-                                          log_msg->entry_v3.msg,
-                                          buf.p.len - sizeof(buf)));
-            if (ret < 0) {
-                return -errno;
-            }
-            if (ret != (ssize_t)(buf.p.len - sizeof(buf))) {
-                return -EIO;
-            }
+        payload = buf.p.len - sizeof(buf);
+        memcpy(log_msg->entry_v3.msg, entry + sizeof(buf), payload);
 
-            log_msg->entry_v3.len = buf.p.len - sizeof(buf);
-            log_msg->entry_v3.hdr_size = sizeof(log_msg->entry_v3);
-            log_msg->entry_v3.pid = buf.p.pid;
-            log_msg->entry_v3.tid = buf.l.tid;
-            log_msg->entry_v3.sec = buf.l.realtime.tv_sec;
-            log_msg->entry_v3.nsec = buf.l.realtime.tv_nsec;
-            log_msg->entry_v3.lid = buf.l.id;
+        log_msg->entry_v3.len = payload;
+        log_msg->entry_v3.hdr_size = sizeof(log_msg->entry_v3);
+        log_msg->entry_v3.pid = buf.p.pid;
+        log_msg->entry_v3.tid = buf.l.tid;
+        log_msg->entry_v3.sec = buf.l.realtime.tv_sec;
+        log_msg->entry_v3.nsec = buf.l.realtime.tv_nsec;
+        log_msg->entry_v3.lid = buf.l.id;
 
-            return ret;
-        }
+        return payload;
+    }
+    return -EAGAIN;
+}
 
-        current = TEMP_FAILURE_RETRY(lseek(logger_list->sock,
-                                           (off_t)0, SEEK_CUR));
-        if (current < 0) {
-            return -errno;
-        }
-        next = TEMP_FAILURE_RETRY(lseek(logger_list->sock,
-                                        (off_t)(buf.p.len - sizeof(buf)),
-                                        SEEK_CUR));
-        if (next < 0) {
-            return -errno;
-        }
-        if ((next - current) != (ssize_t)(buf.p.len - sizeof(buf))) {
-            return -EIO;
-        }
+/* Copy out the next entry of the frame logd last sent */
+static int unpack_frame_entry(struct logger_list *logger_list,
+                              struct log_msg *log_msg)
+{
+    const char *entry = logger_list->frame + logger_list->frame_pos;
+    size_t remaining = logger_list->frame_len - logger_list->frame_pos;
+    struct logger_entry_v2 header;
+    size_t len;
+
+    if (remaining < sizeof(header)) {
+        logger_list->frame_pos = logger_list->frame_len;
+        return -EIO;
     }
+    memcpy(&header, entry, sizeof(header));
+    len = (header.hdr_size ? header.hdr_size : sizeof(struct logger_entry))
+        + header.len;
+    if ((len > remaining) || (len > LOGGER_ENTRY_MAX_LEN)) {
+        logger_list->frame_pos = logger_list->frame_len;
+        return -EIO;
+    }
+    memcpy(log_msg, entry, len);
+    logger_list->frame_pos += len;
+    return len;
 }
 
 static void caught_signal(int signum __unused)
@@ -815,6 +887,18 @@ int android_logger_list_read(struct logger_list *logger_list,
             cp += ret;
         }
 
+        /* Older logd ignore this, and a lone entry is a valid frame */
+        if (!logger_list->frame) {
+            logger_list->frame = malloc(LOGGER_FRAME_MAX);
+        }
+        if (logger_list->frame) {
+            ret = snprintf(cp, remaining, " frame=%u", LOGGER_FRAME_MAX);
+            ret = min(ret, remaining);
+            remaining -= ret;
+            cp += ret;
+        }
+        logger_list->frame_len = logger_list->frame_pos = 0;
+
         if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
             /* Deal with an unresponsive logd */
             sigaction(SIGALRM, &ignore, &old_sigaction);
@@ -848,13 +932,32 @@ int android_logger_list_read(struct logger_list *logger_list,
     while(1) {
         memset(log_msg, 0, sizeof(*log_msg));
 
+        if (logger_list->frame
+                && (logger_list->frame_pos < logger_list->frame_len)) {
+            ret = unpack_frame_entry(logger_list, log_msg);
+            if (ret < 0) {
+                return ret;
+            }
+            logger_for_each(logger, logger_list) {
+                if (log_msg->entry.lid == logger->id) {
+                    return ret;
+                }
+            }
+            continue;
+        }
+
         if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
             /* particularily useful if tombstone is reporting for logd */
             sigaction(SIGALRM, &ignore, &old_sigaction);
             old_alarm = alarm(30);
         }
-        /* NOTE: SOCK_SEQPACKET guarantees we read exactly one full entry */
-        ret = recv(logger_list->sock, log_msg, LOGGER_ENTRY_MAX_LEN, 0);
+        /* NOTE: SOCK_SEQPACKET guarantees we read exactly one full packet */
+        if (logger_list->frame) {
+            ret = recv(logger_list->sock, logger_list->frame,
+                       LOGGER_FRAME_MAX, 0);
+        } else {
+            ret = recv(logger_list->sock, log_msg, LOGGER_ENTRY_MAX_LEN, 0);
+        }
         e = errno;
         if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
             if ((ret == 0) || (e == EINTR)) {
@@ -872,6 +975,12 @@ int android_logger_list_read(struct logger_list *logger_list,
             return ret;
         }
 
+        if (logger_list->frame) {
+            logger_list->frame_len = ret;
+            logger_list->frame_pos = 0;
+            continue;
+        }
+
         logger_for_each(logger, logger_list) {
             if (log_msg->entry.lid == logger->id) {
                 return ret;
@@ -899,5 +1008,7 @@ void android_logger_list_free(struct logger_list *logger_list)
         close (logger_list->sock);
     }
 
+    free(logger_list->frame);
+
     free(logger_list);
 }
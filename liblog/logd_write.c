@@ -29,7 +29,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #if (FAKE_LOG_DEVICE == 0)
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/system_properties.h>
 #include <sys/un.h>
 #endif
 #include <time.h>
@@ -67,6 +70,36 @@ static int log_fds[(int)LOG_ID_MAX] = { -1, -1, -1, -1, -1 };
 #else
 static int logd_fd = -1;
 static int pstore_fd = -1;
+
+/*
+ * Optional shared memory ring to logd, see android_log_ring_t. Once
+ * published a log_ring is never freed, another thread may still be
+ * writing into it when logd goes away and we let go of it.
+ */
+struct log_ring {
+    android_log_ring_t *ring;
+    int doorbell;
+    int control; /* logd drops the ring when this closes */
+    pid_t pid;   /* a forked child must not write as its parent */
+};
+static struct log_ring *log_ring;
+
+/*
+ * Ids of the formats sent to logd for __android_log_deferred_print,
+ * direct mapped so a collision just has the format sent again. logd
+ * forgets them all if it restarts, and so do we.
+ */
+#define DEFERRED_IDS 1024 /* power of two */
+static uint32_t deferred_ids[DEFERRED_IDS];
+
+static void __deferred_ids_forget()
+{
+    size_t i;
+
+    for (i = 0; i < DEFERRED_IDS; ++i) {
+        __atomic_store_n(&deferred_ids[i], 0, __ATOMIC_RELAXED);
+    }
+}
 #endif
 
 /*
@@ -90,6 +123,182 @@ int __android_log_dev_available(void)
     return (g_log_status == kLogAvailable);
 }
 
+#if (FAKE_LOG_DEVICE == 0)
+#define LOG_RING_REPLY_TIMEOUT 250 /* ms a writer may wait on logd, once */
+
+/* log_init_lock assumed */
+static void __log_ring_open()
+{
+    char property[PROP_VALUE_MAX];
+    union {
+        struct sockaddr sa;
+        struct sockaddr_un un;
+    } ad;
+    static const char ask[] = "getLogRing";
+    char reply[8];
+    struct iovec iov = { reply, sizeof(reply) };
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    struct log_ring *r;
+    int fds[2] = { -1, -1 };
+    void *p = MAP_FAILED;
+    int sock;
+
+    if (__atomic_load_n(&log_ring, __ATOMIC_RELAXED) || (getuid() == AID_LOGD)) {
+        return;
+    }
+    if ((__system_property_get("logd.ring", property) <= 0)
+            || (strcmp(property, "true") && strcmp(property, "1"))) {
+        return;
+    }
+
+    sock = TEMP_FAILURE_RETRY(socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (sock < 0) {
+        return;
+    }
+    memset(&ad, 0, sizeof(struct sockaddr_un));
+    ad.un.sun_family = AF_UNIX;
+    strcpy(ad.un.sun_path, "/dev/socket/logd");
+    if ((TEMP_FAILURE_RETRY(connect(sock, &ad.sa,
+                                    sizeof(struct sockaddr_un))) < 0)
+            || (TEMP_FAILURE_RETRY(write(sock, ask, sizeof(ask)))
+                != (ssize_t)sizeof(ask))) {
+        goto error;
+    }
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (TEMP_FAILURE_RETRY(poll(&pfd, 1, LOG_RING_REPLY_TIMEOUT)) <= 0) {
+        goto error;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    if ((TEMP_FAILURE_RETRY(recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC)) <= 0)
+            || strncmp(reply, "ring", sizeof(reply))) {
+        goto error;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET)
+                && (cmsg->cmsg_type == SCM_RIGHTS)
+                && (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+            break;
+        }
+    }
+    if ((fds[0] < 0) || (fds[1] < 0)) {
+        goto error;
+    }
+
+    p = mmap(NULL, sizeof(android_log_ring_t), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    fds[0] = -1;
+    if ((p == MAP_FAILED) || (__atomic_load_n(
+            &((android_log_ring_t *)p)->magic, __ATOMIC_ACQUIRE)
+                != LOGGER_RING_MAGIC)) {
+        goto error;
+    }
+
+    r = malloc(sizeof(*r));
+    if (!r) {
+        goto error;
+    }
+    r->ring = p;
+    r->doorbell = fds[1];
+    r->control = sock;
+    r->pid = getpid();
+    __atomic_store_n(&log_ring, r, __ATOMIC_RELEASE);
+    return;
+
+error:
+    if (p != MAP_FAILED) {
+        munmap(p, sizeof(android_log_ring_t));
+    }
+    if (fds[0] >= 0) {
+        close(fds[0]);
+    }
+    if (fds[1] >= 0) {
+        close(fds[1]);
+    }
+    close(sock);
+}
+
+/* log_init_lock assumed */
+static void __log_ring_close()
+{
+    struct log_ring *r = __atomic_exchange_n(&log_ring, NULL, __ATOMIC_ACQ_REL);
+    if (r) {
+        /* leave ring and doorbell be, they may still be in use */
+        close(r->control);
+    }
+}
+
+/*
+ * Put one message into the ring. Returns 0 if it went in, or non-zero if
+ * it must go to the socket instead: no ring, too long, or the ring is full.
+ */
+static int __write_to_log_ring(android_log_header_t *header,
+                               struct iovec *vec, size_t nr,
+                               size_t payload_size)
+{
+    struct log_ring *r = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    android_log_ring_t *ring;
+    android_log_ring_slot_t *slot;
+    uint32_t pos;
+    size_t i, len;
+
+    if (!r || (payload_size > LOGGER_RING_SLOT_PAYLOAD)
+            || (r->pid != getpid())) {
+        return -EINVAL;
+    }
+    ring = r->ring;
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        int32_t dif;
+
+        slot = &ring->slots[pos & (LOGGER_RING_SLOTS - 1)];
+        dif = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -EAGAIN;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(&slot->header, header, sizeof(*header));
+    for (len = 0, i = 0; i < nr; ++i) {
+        memcpy(slot->msg + len, vec[i].iov_base, vec[i].iov_len);
+        len += vec[i].iov_len;
+    }
+    slot->len = len;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    /* pairs with logd setting sleeping before its last look at the ring */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        TEMP_FAILURE_RETRY(write(r->doorbell, &one, sizeof(one)));
+    }
+
+    return 0;
+}
+#endif
+
 /* log_init_lock assumed */
 static int __write_to_log_initialize()
 {
@@ -128,6 +337,9 @@ static int __write_to_log_initialize()
                 close(i);
             } else {
                 logd_fd = i;
+                /* a new logd knows nothing of any ring we had */
+                __log_ring_close();
+                __log_ring_open();
             }
         }
     }
@@ -247,7 +459,9 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
     }
     pmsg_header.len += payload_size;
 
-    if (pstore_fd >= 0) {
+    /* pstore is read back without logd there to format deferred entries */
+    if ((pstore_fd >= 0) && ((log_id == LOG_ID_EVENTS)
+            || !(*(unsigned char *)vec[0].iov_base & LOGGER_DEFERRED))) {
         TEMP_FAILURE_RETRY(writev(pstore_fd, newVec, i));
     }
 
@@ -260,6 +474,10 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
         return 0;
     }
 
+    if (!__write_to_log_ring(&header, newVec + 2, i - 2, payload_size)) {
+        return payload_size;
+    }
+
     if (logd_fd < 0) {
         return -EBADF;
     }
@@ -281,6 +499,7 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
 #endif
             close(logd_fd);
             logd_fd = -1;
+            __deferred_ids_forget();
             ret = __write_to_log_initialize();
 #if !defined(_WIN32)
             pthread_mutex_unlock(&log_init_lock);
@@ -363,6 +582,19 @@ int __android_log_write(int prio, const char *tag, const char *msg)
     return __android_log_buf_write(LOG_ID_MAIN, prio, tag, msg);
 }
 
+static int __is_radio_tag(const char *tag)
+{
+    return !strcmp(tag, "HTC_RIL") ||
+        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
+        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
+        !strcmp(tag, "AT") ||
+        !strcmp(tag, "GSM") ||
+        !strcmp(tag, "STK") ||
+        !strcmp(tag, "CDMA") ||
+        !strcmp(tag, "PHONE") ||
+        !strcmp(tag, "SMS");
+}
+
 int __android_log_buf_write(int bufID, int prio, const char *tag, const char *msg)
 {
     struct iovec vec[3];
@@ -372,16 +604,7 @@ int __android_log_buf_write(int bufID, int prio, const char *tag, const char *ms
         tag = "";
 
     /* XXX: This needs to go! */
-    if ((bufID != LOG_ID_RADIO) &&
-         (!strcmp(tag, "HTC_RIL") ||
-        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
-        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS"))) {
+    if ((bufID != LOG_ID_RADIO) && __is_radio_tag(tag)) {
             bufID = LOG_ID_RADIO;
             /* Inform third party apps/ril/radio.. to use Rlog or RLOG */
             snprintf(tmp_tag, sizeof(tmp_tag), "use-Rlog/RLOG-%s", tag);
@@ -437,6 +660,92 @@ int __android_log_buf_print(int bufID, int prio, const char *tag, const char *fm
     return __android_log_buf_write(bufID, prio, tag, buf);
 }
 
+#if (FAKE_LOG_DEVICE == 0)
+/*
+ * Send the packed arguments rather than the text, registering the format
+ * with logd first if we have not yet. Returns -EINVAL if the entry has to
+ * be formatted here after all.
+ */
+static int __write_deferred(log_id_t bufID, int prio, const char *tag,
+                            const char *fmt, va_list ap)
+{
+    struct iovec vec[4];
+    char args[LOG_BUF_SIZE];
+    unsigned char type;
+    uint32_t id;
+    uint32_t *slot;
+    ssize_t len;
+
+    /* aborts need the text, and radio tags are rewritten */
+    if ((bufID >= LOG_ID_MAX) || (bufID == LOG_ID_EVENTS)
+            || (prio <= ANDROID_LOG_UNKNOWN) || (prio >= ANDROID_LOG_FATAL)
+            || ((bufID != LOG_ID_RADIO) && __is_radio_tag(tag))) {
+        return -EINVAL;
+    }
+
+    len = __android_log_deferred_pack(fmt, ap, args, sizeof(args));
+    if (len < 0) {
+        return -EINVAL;
+    }
+
+    id = __android_log_deferred_id(fmt);
+    slot = &deferred_ids[id & (DEFERRED_IDS - 1)];
+    if (__atomic_load_n(slot, __ATOMIC_RELAXED) != id) {
+        size_t fmt_len = strlen(fmt) + 1;
+        if (fmt_len > (LOGGER_ENTRY_MAX_PAYLOAD - 1 - sizeof(id))) {
+            return -EINVAL;
+        }
+        type = LOGGER_DEFERRED_REGISTER;
+        vec[0].iov_base = &type;
+        vec[0].iov_len  = 1;
+        vec[1].iov_base = &id;
+        vec[1].iov_len  = sizeof(id);
+        vec[2].iov_base = (void *) fmt;
+        vec[2].iov_len  = fmt_len;
+        /* if lost, logd formats our entries once a later one gets there */
+        if (write_to_log(bufID, vec, 3) > 0) {
+            __atomic_store_n(slot, id, __ATOMIC_RELAXED);
+        }
+    }
+
+    type = prio | LOGGER_DEFERRED;
+    vec[0].iov_base = &type;
+    vec[0].iov_len  = 1;
+    vec[1].iov_base = (void *) tag;
+    vec[1].iov_len  = strlen(tag) + 1;
+    vec[2].iov_base = &id;
+    vec[2].iov_len  = sizeof(id);
+    vec[3].iov_base = args;
+    vec[3].iov_len  = len;
+
+    return write_to_log(bufID, vec, 4);
+}
+#endif
+
+int __android_log_deferred_print(int bufID, int prio, const char *tag,
+                                 const char *fmt, ...)
+{
+    va_list ap;
+    char buf[LOG_BUF_SIZE];
+    int ret;
+
+    if (!tag)
+        tag = "";
+
+    va_start(ap, fmt);
+#if (FAKE_LOG_DEVICE == 0)
+    ret = __write_deferred(bufID, prio, tag, fmt, ap);
+    if (ret != -EINVAL) {
+        va_end(ap);
+        return ret;
+    }
+#endif
+    vsnprintf(buf, LOG_BUF_SIZE, fmt, ap);
+    va_end(ap);
+
+    return __android_log_buf_write(bufID, prio, tag, buf);
+}
+
 void __android_log_assert(const char *cond, const char *tag,
                           const char *fmt, ...)
 {
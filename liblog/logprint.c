@@ -50,8 +50,18 @@ struct AndroidLogFormat_t {
     bool printable_output;
     bool year_output;
     bool zone_output;
+    /* date and zone of the second last formatted, see formatTime() */
+    bool date_cached;
+    time_t date_sec;
+    unsigned date_tz;
+    size_t date_len;
+    char date[32];
+    char date_zone[16];
 };
 
+/* Bumped whenever we change TZ, which the date cache depends on */
+static unsigned tz_generation;
+
 /*
  *  gnome-terminal color tags
  *    See http://misc.flogisoft.com/bash/tip_colors_and_formatting
@@ -221,6 +231,7 @@ void android_log_format_free(AndroidLogFormat *p_format)
 int android_log_setPrintFormat(AndroidLogFormat *p_format,
         AndroidLogPrintFormat format)
 {
+    p_format->date_cached = false;
     switch (format) {
     case FORMAT_MODIFIER_COLOR:
         p_format->colored_output = true;
@@ -275,6 +286,7 @@ AndroidLogPrintFormat android_log_formatFromString(const char * formatString)
             cp = strdup(cp);
         }
         setenv(tz, formatString, 1);
+        ++tz_generation;
         /*
          * Run tzset here to determine if the timezone is legitimate. If the
          * zone is GMT, check if that is what was asked for, if not then
@@ -854,6 +866,25 @@ WEAK ssize_t utf8_character_length(const char *src, size_t len)
     return num_to_read;
 }
 
+/*
+ * Eight bytes at a time, non-zero if any is not printable ASCII as is:
+ * below a space, above a tilde, or a backslash.
+ */
+#define BYTES_ONES  0x0101010101010101ULL
+#define BYTES_HIGHS 0x8080808080808080ULL
+static inline uint64_t notPlain(uint64_t x)
+{
+    uint64_t backslash = x ^ (BYTES_ONES * '\\');
+    return (((x - BYTES_ONES * ' ') & ~x)
+          | ((x + BYTES_ONES * (0x7F - '~')) | x)
+          | ((backslash - BYTES_ONES) & ~backslash)) & BYTES_HIGHS;
+}
+
+static inline bool isPlain(char c)
+{
+    return (c >= ' ') && (c <= '~') && (c != '\\');
+}
+
 /*
  * Convert to printable from message to p buffer, return string length. If p is
  * NULL, do not copy, but still return the expected string length.
@@ -864,6 +895,29 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
     bool print = p != NULL;
 
     while (messageLen) {
+        /* runs of plain ASCII, the bulk of any log, are copied as is */
+        const char *run = message;
+        while (messageLen >= sizeof(uint64_t)) {
+            uint64_t x;
+            memcpy(&x, message, sizeof(x));
+            if (notPlain(x)) {
+                break;
+            }
+            message += sizeof(x);
+            messageLen -= sizeof(x);
+        }
+        while (messageLen && isPlain(*message)) {
+            ++message;
+            --messageLen;
+        }
+        if (message != run) {
+            if (print) {
+                memcpy(p, run, message - run);
+            }
+            p += message - run;
+            continue;
+        }
+
         char buf[6];
         ssize_t len = sizeof(buf) - 1;
         if ((size_t)len > messageLen) {
@@ -911,97 +965,127 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
         message += len;
         messageLen -= len;
     }
+    if (print) {
+        *p = '\0';
+    }
     return p - begin;
 }
 
-/**
- * Formats a log message into a buffer
+/*
+ * Get the current date/time in pretty form
  *
- * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
- * If return value != defaultBuffer, caller must call free()
- * Returns NULL on malloc error
+ * It's often useful when examining a log with "less" to jump to
+ * a specific point in the file by searching for the date/time stamp.
+ * For this reason it's very annoying to have regexp meta characters
+ * in the time stamp.  Don't use forward slashes, parenthesis,
+ * brackets, asterisks, or other special chars here.
+ *
+ * The caller may have affected the timezone environment, this is
+ * expected to be sensitive to that. Consecutive entries mostly share
+ * the second, so its date and zone are kept for the next one.
  */
-
-char *android_log_formatLogLine (
-    AndroidLogFormat *p_format,
-    char *defaultBuffer,
-    size_t defaultBufferSize,
-    const AndroidLogEntry *entry,
-    size_t *p_outLength)
+static void formatTime(AndroidLogFormat *p_format, const AndroidLogEntry *entry,
+                       char *timeBuf, size_t timeBufSize)
 {
+    if (!p_format->date_cached || (p_format->date_sec != entry->tv_sec)
+            || (p_format->date_tz != tz_generation)) {
 #if !defined(_WIN32)
-    struct tm tmBuf;
+        struct tm tmBuf;
 #endif
-    struct tm* ptm;
-    char timeBuf[64]; /* good margin, 23+nul for msec, 26+nul for usec */
-    char prefixBuf[128], suffixBuf[128];
-    char priChar;
-    int prefixSuffixIsHeaderFooter = 0;
-    char * ret = NULL;
-
-    priChar = filterPriToChar(entry->priority);
-    size_t prefixLen = 0, suffixLen = 0;
-    size_t len;
+        struct tm* ptm;
 
-    /*
-     * Get the current date/time in pretty form
-     *
-     * It's often useful when examining a log with "less" to jump to
-     * a specific point in the file by searching for the date/time stamp.
-     * For this reason it's very annoying to have regexp meta characters
-     * in the time stamp.  Don't use forward slashes, parenthesis,
-     * brackets, asterisks, or other special chars here.
-     *
-     * The caller may have affected the timezone environment, this is
-     * expected to be sensitive to that.
-     */
 #if !defined(_WIN32)
-    ptm = localtime_r(&(entry->tv_sec), &tmBuf);
+        ptm = localtime_r(&(entry->tv_sec), &tmBuf);
 #else
-    ptm = localtime(&(entry->tv_sec));
+        ptm = localtime(&(entry->tv_sec));
 #endif
-    strftime(timeBuf, sizeof(timeBuf),
-             &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3],
-             ptm);
-    len = strlen(timeBuf);
+        p_format->date_len = strftime(p_format->date, sizeof(p_format->date),
+                 &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3],
+                 ptm);
+        p_format->date_zone[0] = '\0';
+        if (p_format->zone_output) {
+            strftime(p_format->date_zone, sizeof(p_format->date_zone), " %z", ptm);
+        }
+        p_format->date_sec = entry->tv_sec;
+        p_format->date_tz = tz_generation;
+        p_format->date_cached = true;
+    }
+
+    size_t len = MIN(p_format->date_len, timeBufSize - 1);
+    memcpy(timeBuf, p_format->date, len);
     if (p_format->usec_time_output) {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len,
+        len += snprintf(timeBuf + len, timeBufSize - len,
                         ".%06ld", entry->tv_nsec / 1000);
     } else {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len,
+        len += snprintf(timeBuf + len, timeBufSize - len,
                         ".%03ld", entry->tv_nsec / 1000000);
     }
-    if (p_format->zone_output) {
-        strftime(timeBuf + len, sizeof(timeBuf) - len, " %z", ptm);
+    if (len < timeBufSize) {
+        snprintf(timeBuf + len, timeBufSize - len, "%s", p_format->date_zone);
+    }
+}
+
+/* The header/footer, or per line prefix/suffix, of one formatted entry */
+typedef struct {
+    char prefix[128];
+    char suffix[128];
+    size_t prefixLen;
+    size_t suffixLen;
+    int isHeaderFooter;
+    size_t size; /* upper bound of the formatted entry, with a nul */
+} LogLineParts;
+
+static void prepareLogLine(AndroidLogFormat *p_format,
+                           const AndroidLogEntry *entry,
+                           LogLineParts *parts)
+{
+    char timeBuf[64]; /* good margin, 23+nul for msec, 26+nul for usec */
+    char *prefixBuf = parts->prefix;
+    char *suffixBuf = parts->suffix;
+    char priChar;
+    int prefixSuffixIsHeaderFooter = 0;
+
+    priChar = filterPriToChar(entry->priority);
+    size_t prefixLen = 0, suffixLen = 0;
+    size_t len;
+
+    switch (p_format->format) {
+        case FORMAT_TIME:
+        case FORMAT_THREADTIME:
+        case FORMAT_LONG:
+            formatTime(p_format, entry, timeBuf, sizeof(timeBuf));
+            break;
+        default:
+            break;
     }
 
     /*
      * Construct a buffer containing the log header and log message.
      */
     if (p_format->colored_output) {
-        prefixLen = snprintf(prefixBuf, sizeof(prefixBuf), "\x1B[38;5;%dm",
+        prefixLen = snprintf(prefixBuf, sizeof(parts->prefix), "\x1B[38;5;%dm",
                              colorFromPri(entry->priority));
-        prefixLen = MIN(prefixLen, sizeof(prefixBuf));
-        suffixLen = snprintf(suffixBuf, sizeof(suffixBuf), "\x1B[0m");
-        suffixLen = MIN(suffixLen, sizeof(suffixBuf));
+        prefixLen = MIN(prefixLen, sizeof(parts->prefix));
+        suffixLen = snprintf(suffixBuf, sizeof(parts->suffix), "\x1B[0m");
+        suffixLen = MIN(suffixLen, sizeof(parts->suffix));
     }
 
     switch (p_format->format) {
         case FORMAT_TAG:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%c/%-8s: ", priChar, entry->tag);
             strcpy(suffixBuf + suffixLen, "\n");
             ++suffixLen;
             break;
         case FORMAT_PROCESS:
-            len = snprintf(suffixBuf + suffixLen, sizeof(suffixBuf) - suffixLen,
+            len = snprintf(suffixBuf + suffixLen, sizeof(parts->suffix) - suffixLen,
                 "  (%s)\n", entry->tag);
-            suffixLen += MIN(len, sizeof(suffixBuf) - suffixLen);
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            suffixLen += MIN(len, sizeof(parts->suffix) - suffixLen);
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%c(%5d) ", priChar, entry->pid);
             break;
         case FORMAT_THREAD:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%c(%5d:%5d) ", priChar, entry->pid, entry->tid);
             strcpy(suffixBuf + suffixLen, "\n");
             ++suffixLen;
@@ -1013,20 +1097,20 @@ char *android_log_formatLogLine (
             ++suffixLen;
             break;
         case FORMAT_TIME:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%s %c/%-8s(%5d): ", timeBuf, priChar, entry->tag, entry->pid);
             strcpy(suffixBuf + suffixLen, "\n");
             ++suffixLen;
             break;
         case FORMAT_THREADTIME:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%s %5d %5d %c %-8s: ", timeBuf,
                 entry->pid, entry->tid, priChar, entry->tag);
             strcpy(suffixBuf + suffixLen, "\n");
             ++suffixLen;
             break;
         case FORMAT_LONG:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "[ %s %5d:%5d %c/%-8s ]\n",
                 timeBuf, entry->pid, entry->tid, priChar, entry->tag);
             strcpy(suffixBuf + suffixLen, "\n\n");
@@ -1035,7 +1119,7 @@ char *android_log_formatLogLine (
             break;
         case FORMAT_BRIEF:
         default:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
+            len = snprintf(prefixBuf + prefixLen, sizeof(parts->prefix) - prefixLen,
                 "%c/%-8s(%5d): ", priChar, entry->tag, entry->pid);
             strcpy(suffixBuf + suffixLen, "\n");
             ++suffixLen;
@@ -1048,105 +1132,188 @@ char *android_log_formatLogLine (
      * possibly causing heap corruption.  To avoid this we double check and
      * set the length at the maximum (size minus null byte)
      */
-    prefixLen += MIN(len, sizeof(prefixBuf) - prefixLen);
-    suffixLen = MIN(suffixLen, sizeof(suffixBuf));
-
-    /* the following code is tragically unreadable */
+    prefixLen += MIN(len, sizeof(parts->prefix) - prefixLen);
+    suffixLen = MIN(suffixLen, sizeof(parts->suffix));
+    /* and a prefix that filled its buffer is missing its nul in the count */
+    prefixLen = MIN(prefixLen, sizeof(parts->prefix) - 1);
+    suffixLen = MIN(suffixLen, sizeof(parts->suffix) - 1);
 
     size_t numLines;
-    char *p;
-    size_t bufferSize;
-    const char *pm;
 
     if (prefixSuffixIsHeaderFooter) {
         /* we're just wrapping message with a header/footer */
         numLines = 1;
     } else {
-        pm = entry->message;
+        const char *pm = entry->message;
+        const char *end = entry->message + entry->messageLen;
         numLines = 0;
 
         /*
          * The line-end finding here must match the line-end finding
-         * in for ( ... numLines...) loop below
+         * in writeLogLine()
          */
-        while (pm < (entry->message + entry->messageLen)) {
-            if (*pm++ == '\n') numLines++;
+        while (pm < end) {
+            pm = memchr(pm, '\n', end - pm);
+            if (!pm) {
+                /* plus one line for anything not newline-terminated */
+                numLines++;
+                break;
+            }
+            numLines++;
+            pm++;
         }
-        /* plus one line for anything not newline-terminated at the end */
-        if (pm > entry->message && *(pm-1) != '\n') numLines++;
     }
 
     /*
      * this is an upper bound--newlines in message may be counted
      * extraneously
      */
-    bufferSize = (numLines * (prefixLen + suffixLen)) + 1;
+    parts->size = (numLines * (prefixLen + suffixLen)) + 1;
     if (p_format->printable_output) {
         /* Calculate extra length to convert non-printable to printable */
-        bufferSize += convertPrintable(NULL, entry->message, entry->messageLen);
-    } else {
-        bufferSize += entry->messageLen;
-    }
-
-    if (defaultBufferSize >= bufferSize) {
-        ret = defaultBuffer;
+        parts->size += convertPrintable(NULL, entry->message, entry->messageLen);
     } else {
-        ret = (char *)malloc(bufferSize);
-
-        if (ret == NULL) {
-            return ret;
-        }
+        parts->size += entry->messageLen;
     }
 
-    ret[0] = '\0';       /* to start strcat off */
+    parts->prefixLen = prefixLen;
+    parts->suffixLen = suffixLen;
+    parts->isHeaderFooter = prefixSuffixIsHeaderFooter;
+}
 
-    p = ret;
-    pm = entry->message;
+/*
+ * Write the entry prepared in parts to p, which holds at least
+ * parts->size bytes. Returns the length written, not counting the nul.
+ */
+static size_t writeLogLine(AndroidLogFormat *p_format,
+                           const AndroidLogEntry *entry,
+                           const LogLineParts *parts, char *ret)
+{
+    char *p = ret;
+    const char *pm = entry->message;
+    const char *end = entry->message + entry->messageLen;
 
-    if (prefixSuffixIsHeaderFooter) {
-        strcat(p, prefixBuf);
-        p += prefixLen;
+    if (parts->isHeaderFooter) {
+        memcpy(p, parts->prefix, parts->prefixLen);
+        p += parts->prefixLen;
         if (p_format->printable_output) {
             p += convertPrintable(p, entry->message, entry->messageLen);
         } else {
-            strncat(p, entry->message, entry->messageLen);
-            p += entry->messageLen;
+            /* as strncat did, the message stops at any nul */
+            size_t messageLen = strnlen(entry->message, entry->messageLen);
+            memcpy(p, entry->message, messageLen);
+            p += messageLen;
         }
-        strcat(p, suffixBuf);
-        p += suffixLen;
+        memcpy(p, parts->suffix, parts->suffixLen);
+        p += parts->suffixLen;
     } else {
-        while(pm < (entry->message + entry->messageLen)) {
-            const char *lineStart;
+        while (pm < end) {
+            const char *lineStart = pm;
             size_t lineLen;
-            lineStart = pm;
 
             /* Find the next end-of-line in message */
-            while (pm < (entry->message + entry->messageLen)
-                    && *pm != '\n') pm++;
+            pm = memchr(pm, '\n', end - pm);
+            if (!pm) {
+                pm = end;
+            }
             lineLen = pm - lineStart;
 
-            strcat(p, prefixBuf);
-            p += prefixLen;
+            memcpy(p, parts->prefix, parts->prefixLen);
+            p += parts->prefixLen;
             if (p_format->printable_output) {
                 p += convertPrintable(p, lineStart, lineLen);
             } else {
-                strncat(p, lineStart, lineLen);
+                lineLen = strnlen(lineStart, lineLen);
+                memcpy(p, lineStart, lineLen);
                 p += lineLen;
             }
-            strcat(p, suffixBuf);
-            p += suffixLen;
+            memcpy(p, parts->suffix, parts->suffixLen);
+            p += parts->suffixLen;
+
+            if ((pm < end) && (*pm == '\n')) pm++;
+        }
+    }
+    *p = '\0';
+
+    return p - ret;
+}
+
+/**
+ * Formats a log message into a buffer
+ *
+ * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
+ * If return value != defaultBuffer, caller must call free()
+ * Returns NULL on malloc error
+ */
 
-            if (*pm == '\n') pm++;
+char *android_log_formatLogLine (
+    AndroidLogFormat *p_format,
+    char *defaultBuffer,
+    size_t defaultBufferSize,
+    const AndroidLogEntry *entry,
+    size_t *p_outLength)
+{
+    LogLineParts parts;
+    char *ret;
+    size_t len;
+
+    prepareLogLine(p_format, entry, &parts);
+
+    if (defaultBufferSize >= parts.size) {
+        ret = defaultBuffer;
+    } else {
+        ret = (char *)malloc(parts.size);
+
+        if (ret == NULL) {
+            return ret;
         }
     }
 
+    len = writeLogLine(p_format, entry, &parts, ret);
+
     if (p_outLength != NULL) {
-        *p_outLength = p - ret;
+        *p_outLength = len;
     }
 
     return ret;
 }
 
+#define LOG_BUFFER_MIN_SIZE 4096
+
+ssize_t android_log_formatLogLines(
+    AndroidLogFormat *p_format,
+    AndroidLogBuffer *out,
+    const AndroidLogEntry *entries,
+    size_t count)
+{
+    size_t startLen = out->len;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        LogLineParts parts;
+
+        prepareLogLine(p_format, &entries[i], &parts);
+
+        if ((out->size - out->len) < parts.size) {
+            size_t size = out->size ? out->size : LOG_BUFFER_MIN_SIZE;
+            while ((size - out->len) < parts.size) {
+                size *= 2;
+            }
+            char *buf = (char *)realloc(out->buf, size);
+            if (buf == NULL) {
+                return -1;
+            }
+            out->buf = buf;
+            out->size = size;
+        }
+
+        out->len += writeLogLine(p_format, &entries[i], &parts,
+                                 out->buf + out->len);
+    }
+
+    return out->len - startLen;
+}
+
 /**
  * Either print or do not print log line, based on filter
  *
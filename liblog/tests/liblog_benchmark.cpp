@@ -280,3 +280,22 @@ static void BM_is_loggable(int iters) {
     StopBenchmarkTiming();
 }
 BENCHMARK(BM_is_loggable);
+
+/*
+ *	Measure the time it takes for __android_log_is_loggable when callers
+ *	alternate between tags, defeating any single tag cache.
+ */
+static void BM_is_loggable_tags(int iters) {
+    static const char *tags[] = { "logd", "ActivityManager", "libc", "vold" };
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_is_loggable(ANDROID_LOG_WARN,
+                                  tags[i % (sizeof(tags) / sizeof(tags[0]))],
+                                  ANDROID_LOG_VERBOSE);
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_is_loggable_tags);
@@ -19,8 +19,11 @@
 #include <signal.h>
 #include <string.h>
 
+#include <string>
+
 #include <cutils/properties.h>
 #include <gtest/gtest.h>
+#include <log/event_tag_map.h>
 #include <log/log.h>
 #include <log/logger.h>
 #include <log/log_read.h>
@@ -71,6 +74,55 @@ TEST(liblog, __android_log_buf_write) {
     usleep(1000);
 }
 
+TEST(liblog, __android_log_deferred_print) {
+    pid_t pid = getpid();
+    char tag[32];
+    snprintf(tag, sizeof(tag), "TEST_deferred_%04X", pid & 0xFFFF);
+
+    // twice, the second with the format already registered
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_LT(0, __android_log_deferred_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                                  tag, "%d [%-4s] %.*s %05.1f %llx",
+                                                  -i, "ab", 3, "defg", 2.5,
+                                                  0xdeadbeefcafeULL));
+    }
+    sleep(2);
+
+    struct logger_list *logger_list;
+
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_MAIN, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid)));
+
+    int count = 0;
+
+    for(;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+
+        if ((log_msg.entry.pid != pid) || (log_msg.id() != LOG_ID_MAIN)) {
+            continue;
+        }
+
+        char *data = log_msg.msg();
+
+        if (strcmp(data + 1, tag)) {
+            continue;
+        }
+
+        EXPECT_EQ(ANDROID_LOG_INFO, data[0]);
+        data += strlen(tag) + 2;
+        EXPECT_STREQ(count ? "-1 [ab  ] def 002.5 deadbeefcafe"
+                           : "0 [ab  ] def 002.5 deadbeefcafe", data);
+        ++count;
+    }
+
+    android_logger_list_close(logger_list);
+
+    EXPECT_EQ(2, count);
+}
+
 TEST(liblog, __android_log_btwrite) {
     int intBuf = 0xDEADBEEF;
     EXPECT_LT(0, __android_log_btwrite(0,
@@ -598,6 +650,41 @@ TEST(liblog, dual_reader) {
     EXPECT_EQ(15, count2);
 }
 
+TEST(liblog, android_writeEventTagIndex) {
+    static const char map_file[] = "/data/local/tmp/event-log-tags";
+    static const char index_file[] = "/data/local/tmp/event-log-tags.idx";
+
+    FILE *fp = fopen(map_file, "w");
+    ASSERT_TRUE(NULL != fp);
+    fprintf(fp, "# comment\n\n");
+    for (int i = 0; i < 1000; ++i) {
+        fprintf(fp, "%d tag_%d (value|1)\n", 42 + i * 7, i);
+    }
+    fclose(fp);
+    unlink(index_file);
+
+    EventTagMap *text = android_openEventTagMap(map_file);
+    ASSERT_TRUE(NULL != text);
+    ASSERT_EQ(0, android_writeEventTagIndex(map_file, index_file));
+    EventTagMap *index = android_openEventTagMap(map_file);
+    ASSERT_TRUE(NULL != index);
+
+    for (int tag = 0; tag < (42 + 1000 * 7); ++tag) {
+        const char *expected = android_lookupEventTag(text, tag);
+        const char *name = android_lookupEventTag(index, tag);
+        if (!expected) {
+            EXPECT_TRUE(NULL == name);
+        } else {
+            EXPECT_STREQ(expected, name);
+        }
+    }
+
+    android_closeEventTagMap(index);
+    android_closeEventTagMap(text);
+    unlink(index_file);
+    unlink(map_file);
+}
+
 TEST(liblog, android_logger_get_) {
     struct logger_list * logger_list = android_logger_list_alloc(ANDROID_LOG_WRONLY, 0, 0);
 
@@ -691,6 +778,51 @@ TEST(liblog, filterRule) {
     android_log_format_free(p_format);
 }
 
+TEST(liblog, android_log_formatLogLines) {
+    AndroidLogFormat *p_format = android_log_format_new();
+    android_log_setPrintFormat(p_format, FORMAT_THREADTIME);
+    android_log_setPrintFormat(p_format, FORMAT_MODIFIER_PRINTABLE);
+
+    static const char message[] = "Hello\tWorld, a long enough line of plain text\nand more";
+    AndroidLogEntry entries[3];
+    for (size_t i = 0; i < (sizeof(entries) / sizeof(entries[0])); ++i) {
+        entries[i].tv_sec = 1000000000 + (i / 2);
+        entries[i].tv_nsec = i * 1000000;
+        entries[i].priority = ANDROID_LOG_INFO;
+        entries[i].pid = 123;
+        entries[i].tid = 456;
+        entries[i].tag = "TEST_formatLogLines";
+        entries[i].messageLen = sizeof(message) - 1 - i;
+        entries[i].message = message;
+    }
+
+    // the same as formatting them one at a time
+    std::string expected;
+    for (size_t i = 0; i < (sizeof(entries) / sizeof(entries[0])); ++i) {
+        char defaultBuffer[512];
+        size_t len;
+        char *line = android_log_formatLogLine(p_format, defaultBuffer,
+                                               sizeof(defaultBuffer),
+                                               &entries[i], &len);
+        ASSERT_TRUE(NULL != line);
+        expected.append(line, len);
+        if (line != defaultBuffer) {
+            free(line);
+        }
+    }
+
+    AndroidLogBuffer out;
+    memset(&out, 0, sizeof(out));
+    EXPECT_EQ(static_cast<ssize_t>(expected.length()),
+              android_log_formatLogLines(p_format, &out, entries,
+                                         sizeof(entries) / sizeof(entries[0])));
+    EXPECT_EQ(expected, std::string(out.buf, out.len));
+    EXPECT_NE(std::string::npos, expected.find("Hello\\tWorld"));
+
+    free(out.buf);
+    android_log_format_free(p_format);
+}
+
 TEST(liblog, is_loggable) {
     static const char tag[] = "is_loggable";
     static const char log_namespace[] = "persist.log.tag.";
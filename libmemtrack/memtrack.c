@@ -37,9 +37,20 @@ struct memtrack_proc {
         size_t num_records;
         size_t allocated_records;
         struct memtrack_record *records;
+        size_t offset;  /* of the records in the memtrack_procs arena */
     } types[MEMTRACK_NUM_TYPES];
 };
 
+struct memtrack_procs {
+    struct memtrack_proc *procs;
+    size_t num_procs;
+    size_t allocated_procs;
+    /* The records of all the procs, one type of one proc after another */
+    struct memtrack_record *records;
+    size_t num_records;
+    size_t allocated_records;
+};
+
 int memtrack_init(void)
 {
     int err;
@@ -140,6 +151,152 @@ int memtrack_proc_get(struct memtrack_proc *p, pid_t pid)
     return memtrack_proc_sanity_check(p);
 }
 
+struct memtrack_procs *memtrack_procs_new(void)
+{
+    if (!module) {
+        return NULL;
+    }
+
+    return calloc(sizeof(struct memtrack_procs), 1);
+}
+
+void memtrack_procs_destroy(struct memtrack_procs *ps)
+{
+    if (ps) {
+        free(ps->procs);
+        free(ps->records);
+    }
+    free(ps);
+}
+
+/* Appends the records of one type of one process to the arena. */
+static int memtrack_procs_get_type(struct memtrack_procs *ps,
+            struct memtrack_proc_type *t, pid_t pid, enum memtrack_type type)
+{
+    size_t room;
+    size_t num_records;
+    int ret;
+
+    t->num_records = 0;
+    t->offset = ps->num_records;
+
+retry:
+    room = ps->allocated_records - ps->num_records;
+    num_records = room;
+    ret = module->getMemory(module, pid, type, ps->records + ps->num_records,
+            &num_records);
+    if (ret) {
+        return ret;
+    }
+    if (num_records > room) {
+        /* Need more records than are left, grow the arena */
+        size_t allocated = ps->allocated_records * 2;
+        struct memtrack_record *records;
+
+        if (allocated < ps->num_records + num_records) {
+            allocated = ps->num_records + num_records;
+        }
+        records = realloc(ps->records, sizeof(*records) * allocated);
+        if (!records) {
+            return -ENOMEM;
+        }
+        ps->records = records;
+        ps->allocated_records = allocated;
+        goto retry;
+    }
+    t->num_records = num_records;
+    ps->num_records += num_records;
+
+    return 0;
+}
+
+int memtrack_procs_get(struct memtrack_procs *ps, const pid_t *pids,
+            size_t num_pids)
+{
+    int supported[MEMTRACK_NUM_TYPES];
+    enum memtrack_type i;
+    size_t j;
+    int ret;
+
+    if (!module) {
+        return -EINVAL;
+    }
+
+    if (!ps || (!pids && num_pids)) {
+        return -EINVAL;
+    }
+
+    if (num_pids > ps->allocated_procs) {
+        struct memtrack_proc *procs =
+                realloc(ps->procs, sizeof(*procs) * num_pids);
+        if (!procs) {
+            return -ENOMEM;
+        }
+        ps->procs = procs;
+        ps->allocated_procs = num_pids;
+    }
+    ps->num_procs = num_pids;
+    ps->num_records = 0;
+
+    for (i = 0; i < MEMTRACK_NUM_TYPES; i++) {
+        supported[i] = 1;
+    }
+
+    for (j = 0; j < num_pids; j++) {
+        struct memtrack_proc *p = &ps->procs[j];
+
+        p->pid = pids[j];
+        for (i = 0; i < MEMTRACK_NUM_TYPES; i++) {
+            struct memtrack_proc_type *t = &p->types[i];
+
+            t->type = i;
+            t->allocated_records = 0;
+            if (!supported[i]) {
+                t->num_records = 0;
+                t->offset = ps->num_records;
+                continue;
+            }
+            /* The HAL answers -ENODEV for a type it doesn't track, and
+             * will for every other process too */
+            ret = memtrack_procs_get_type(ps, t, p->pid, i);
+            if (ret == -ENODEV) {
+                supported[i] = 0;
+            } else if (ret == -ENOMEM) {
+                ps->num_procs = 0;
+                return ret;
+            }
+        }
+    }
+
+    /* The arena has stopped moving, point the procs into it */
+    for (j = 0; j < num_pids; j++) {
+        for (i = 0; i < MEMTRACK_NUM_TYPES; i++) {
+            struct memtrack_proc_type *t = &ps->procs[j].types[i];
+            t->records = ps->records + t->offset;
+        }
+    }
+
+    for (j = 0; j < num_pids; j++) {
+        memtrack_proc_sanity_check(&ps->procs[j]);
+    }
+
+    return 0;
+}
+
+size_t memtrack_procs_count(struct memtrack_procs *ps)
+{
+    return ps ? ps->num_procs : 0;
+}
+
+struct memtrack_proc *memtrack_procs_at(struct memtrack_procs *ps, size_t i)
+{
+    if (!ps || i >= ps->num_procs) {
+        return NULL;
+    }
+
+    return &ps->procs[i];
+}
+
 static ssize_t memtrack_proc_sum(struct memtrack_proc *p,
             enum memtrack_type types[], size_t num_types,
             unsigned int flags)
@@ -76,7 +76,7 @@ int main(int argc, char *argv[])
     pm_kernel_t *ker;
     size_t num_procs;
     pid_t *pids;
-    struct memtrack_proc *p;
+    struct memtrack_procs *ps;
     size_t i;
 
     (void)argc;
@@ -101,13 +101,21 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    p = memtrack_proc_new();
-    if (ret) {
+    ps = memtrack_procs_new();
+    if (!ps) {
         fprintf(stderr, "failed to create memtrack process handle\n");
         exit(EXIT_FAILURE);
     }
 
+    ret = memtrack_procs_get(ps, pids, num_procs);
+    if (ret) {
+        fprintf(stderr, "failed to get memory info: %s (%d)\n",
+                strerror(-ret), ret);
+        exit(EXIT_FAILURE);
+    }
+
     for (i = 0; i < num_procs; i++) {
+        struct memtrack_proc *p = memtrack_procs_at(ps, i);
         pid_t pid = pids[i];
         char cmdline[256];
         size_t v1;
@@ -119,13 +127,6 @@ int main(int argc, char *argv[])
 
         getprocname(pid, cmdline, (int)sizeof(cmdline));
 
-        ret = memtrack_proc_get(p, pid);
-        if (ret) {
-            fprintf(stderr, "failed to get memory info for pid %d: %s (%d)\n",
-                    pid, strerror(-ret), ret);
-            continue;
-        }
-
         v1 = DIV_ROUND_UP(memtrack_proc_graphics_total(p), 1024);
         v2 = DIV_ROUND_UP(memtrack_proc_graphics_pss(p), 1024);
         v3 = DIV_ROUND_UP(memtrack_proc_gl_total(p), 1024);
@@ -139,7 +140,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    memtrack_proc_destroy(p);
+    memtrack_procs_destroy(ps);
 
     return 0;
 }
@@ -20,6 +20,7 @@
 // up to 4032*8*8=258048, which is 256KiB minus the header page
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include <sys/cdefs.h>
@@ -63,6 +64,13 @@ static constexpr unsigned int kNumBuckets = const_log2(kMaxBucketAllocationSize)
     - const_log2(kMinBucketAllocationSize) + 1;
 static constexpr unsigned int kUsablePagesPerChunk = kUsableChunkSize
     / kPageSize;
+// Thread caches hold blocks of up to kMaxCachedAllocationSize, at most
+// kThreadCacheDepth of each size, and move half that to or from the heap at
+// a time.
+static constexpr size_t kMaxCachedAllocationSize = 1024;
+static constexpr unsigned int kNumCachedBuckets =
+    const_log2(kMaxCachedAllocationSize) - const_log2(kMinBucketAllocationSize) + 1;
+static constexpr unsigned int kThreadCacheDepth = 32;
 
 std::atomic<int> heap_count;
 
@@ -78,12 +86,21 @@ class HeapImpl {
   void* Alloc(size_t size);
   void Free(void* ptr);
   bool Empty();
+  void Reset();
+  void GetStats(HeapStats* stats);
+
+  ThreadCacheImpl* CreateThreadCache();
+  void DestroyThreadCache(ThreadCacheImpl* cache);
 
   void MoveToFullList(Chunk* chunk, int bucket_);
   void MoveToFreeList(Chunk* chunk, int bucket_);
 
  private:
   DISALLOW_COPY_AND_ASSIGN(HeapImpl);
+  friend class ThreadCacheImpl;
+
+  ThreadCacheImpl* ThreadCache();
+  void FreeChunks();
 
   LinkedList<Chunk*> free_chunks_[kNumBuckets];
   LinkedList<Chunk*> full_chunks_[kNumBuckets];
@@ -101,16 +118,55 @@ class HeapImpl {
   };
   MapAllocation* map_allocation_list_;
   std::mutex m_;
+
+  // Guarded by m_
+  HeapStats stats_;
+
+  // Number of ThreadCaches on any thread, so that heaps without any don't
+  // have to look for one
+  std::atomic<int> thread_caches_;
 };
 
+// A thread's stock of small blocks from one heap. The caches a thread has
+// open are chained through next_ from a pthread key; the key is used rather
+// than thread_local, which may call malloc on first use.
+class ThreadCacheImpl {
+ public:
+  ThreadCacheImpl(HeapImpl* heap, ThreadCacheImpl* next);
+
+  void* Alloc(unsigned int bucket);
+  bool Free(void* ptr, unsigned int bucket);
+  void Flush();
+
+  HeapImpl* heap() { return heap_; }
+  ThreadCacheImpl*& next() { return next_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ThreadCacheImpl);
+
+  HeapImpl* heap_;
+  ThreadCacheImpl* next_;
+  unsigned int count_[kNumCachedBuckets];
+  void* blocks_[kNumCachedBuckets][kThreadCacheDepth];
+};
+
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void CreateThreadCacheKey() {
+  if (pthread_key_create(&thread_cache_key, nullptr)) {
+    abort();
+  }
+}
+
 // Integer log 2, rounds down
 static inline unsigned int log2(size_t n) {
   return 8 * sizeof(unsigned long long) - __builtin_clzll(n) - 1;
 }
 
 static inline unsigned int size_to_bucket(size_t size) {
-  if (size < kMinBucketAllocationSize)
-    return kMinBucketAllocationSize;
+  if (size <= kMinBucketAllocationSize)
+    return 0;
   return log2(size - 1) + 1 - const_log2(kMinBucketAllocationSize);
 }
 
@@ -188,6 +244,9 @@ class Chunk {
   unsigned int free_count() {
     return free_count_;
   }
+  unsigned int bucket() {
+    return bucket_;
+  }
   HeapImpl* heap() {
     return heap_;
   }
@@ -329,7 +388,8 @@ void HeapImpl::operator delete(void *ptr) {
 }
 
 HeapImpl::HeapImpl() :
-    free_chunks_(), full_chunks_(), map_allocation_list_(NULL) {
+    free_chunks_(), full_chunks_(), map_allocation_list_(NULL), stats_(),
+    thread_caches_(0) {
 }
 
 bool HeapImpl::Empty() {
@@ -350,6 +410,11 @@ bool HeapImpl::Empty() {
 }
 
 HeapImpl::~HeapImpl() {
+  assert(thread_caches_ == 0);
+  FreeChunks();
+}
+
+void HeapImpl::FreeChunks() {
   for (unsigned int i = 0; i < kNumBuckets; i++) {
     while (!free_chunks_[i].empty()) {
       Chunk *chunk = free_chunks_[i].next()->data();
@@ -364,7 +429,47 @@ HeapImpl::~HeapImpl() {
   }
 }
 
+void HeapImpl::Reset() {
+  std::lock_guard<std::mutex> lk(m_);
+  assert(thread_caches_ == 0);
+
+  // The list itself lives in the chunks, so unmap its allocations first.
+  for (MapAllocation* allocation = map_allocation_list_; allocation != nullptr;
+      allocation = allocation->next) {
+    munmap(allocation->ptr, allocation->size);
+  }
+  map_allocation_list_ = nullptr;
+  FreeChunks();
+
+  stats_.allocations = 0;
+  stats_.allocated_bytes = 0;
+  stats_.mapped_bytes = 0;
+}
+
+void HeapImpl::GetStats(HeapStats* stats) {
+  std::lock_guard<std::mutex> lk(m_);
+  *stats = stats_;
+}
+
+ThreadCacheImpl* HeapImpl::ThreadCache() {
+  if (__predict_true(thread_caches_ == 0)) {
+    return nullptr;
+  }
+  ThreadCacheImpl* cache =
+      reinterpret_cast<ThreadCacheImpl*>(pthread_getspecific(thread_cache_key));
+  while (cache != nullptr && cache->heap() != this) {
+    cache = cache->next();
+  }
+  return cache;
+}
+
 void* HeapImpl::Alloc(size_t size) {
+  if (size <= kMaxCachedAllocationSize) {
+    ThreadCacheImpl* cache = ThreadCache();
+    if (cache != nullptr) {
+      return cache->Alloc(size_to_bucket(size));
+    }
+  }
   std::lock_guard<std::mutex> lk(m_);
   return AllocLocked(size);
 }
@@ -377,11 +482,23 @@ void* HeapImpl::AllocLocked(size_t size) {
   if (__predict_false(free_chunks_[bucket].empty())) {
     Chunk *chunk = new Chunk(this, bucket);
     free_chunks_[bucket].insert(chunk->node_);
+    stats_.mapped_bytes += kChunkSize;
+    if (stats_.mapped_bytes > stats_.peak_mapped_bytes) {
+      stats_.peak_mapped_bytes = stats_.mapped_bytes;
+    }
   }
+  stats_.allocations++;
+  stats_.allocated_bytes += bucket_to_size(bucket);
   return free_chunks_[bucket].next()->data()->Alloc();
 }
 
 void HeapImpl::Free(void *ptr) {
+  if (Chunk::is_chunk(ptr)) {
+    ThreadCacheImpl* cache = ThreadCache();
+    if (cache != nullptr && cache->Free(ptr, Chunk::ptr_to_chunk(ptr)->bucket())) {
+      return;
+    }
+  }
   std::lock_guard<std::mutex> lk(m_);
   FreeLocked(ptr);
 }
@@ -392,6 +509,8 @@ void HeapImpl::FreeLocked(void *ptr) {
   } else {
     Chunk* chunk = Chunk::ptr_to_chunk(ptr);
     assert(chunk->heap() == this);
+    stats_.allocations--;
+    stats_.allocated_bytes -= bucket_to_size(chunk->bucket());
     chunk->Free(ptr);
   }
 }
@@ -411,6 +530,13 @@ void* HeapImpl::MapAlloc(size_t size) {
   allocation->next = map_allocation_list_;
   map_allocation_list_ = allocation;
 
+  // Counted as a single allocation, not as the record plus the mapping.
+  stats_.allocated_bytes += size - bucket_to_size(size_to_bucket(sizeof(MapAllocation)));
+  stats_.mapped_bytes += size;
+  if (stats_.mapped_bytes > stats_.peak_mapped_bytes) {
+    stats_.peak_mapped_bytes = stats_.mapped_bytes;
+  }
+
   return ptr;
 }
 
@@ -421,10 +547,89 @@ void HeapImpl::MapFree(void *ptr) {
 
   assert(*allocation != nullptr);
 
-  munmap((*allocation)->ptr, (*allocation)->size);
-  FreeLocked(*allocation);
+  MapAllocation* freed = *allocation;
+  *allocation = freed->next;
+
+  munmap(freed->ptr, freed->size);
+  stats_.allocated_bytes -= freed->size - bucket_to_size(size_to_bucket(sizeof(MapAllocation)));
+  stats_.mapped_bytes -= freed->size;
+  FreeLocked(freed);
+}
+
+ThreadCacheImpl* HeapImpl::CreateThreadCache() {
+  pthread_once(&thread_cache_key_once, CreateThreadCacheKey);
 
-  *allocation = (*allocation)->next;
+  void* mem;
+  {
+    std::lock_guard<std::mutex> lk(m_);
+    mem = AllocLocked(sizeof(ThreadCacheImpl));
+  }
+  ThreadCacheImpl* head =
+      reinterpret_cast<ThreadCacheImpl*>(pthread_getspecific(thread_cache_key));
+  ThreadCacheImpl* cache = new (mem) ThreadCacheImpl(this, head);
+  pthread_setspecific(thread_cache_key, cache);
+  thread_caches_++;
+  return cache;
+}
+
+void HeapImpl::DestroyThreadCache(ThreadCacheImpl* cache) {
+  ThreadCacheImpl* head =
+      reinterpret_cast<ThreadCacheImpl*>(pthread_getspecific(thread_cache_key));
+  if (head == cache) {
+    pthread_setspecific(thread_cache_key, cache->next());
+  } else {
+    ThreadCacheImpl** link = &head->next();
+    while (*link != cache) {
+      assert(*link != nullptr);
+      link = &(*link)->next();
+    }
+    *link = cache->next();
+  }
+  thread_caches_--;
+
+  std::lock_guard<std::mutex> lk(m_);
+  cache->Flush();
+  cache->~ThreadCacheImpl();
+  FreeLocked(cache);
+}
+
+ThreadCacheImpl::ThreadCacheImpl(HeapImpl* heap, ThreadCacheImpl* next) :
+    heap_(heap), next_(next), count_(), blocks_() {
+}
+
+void* ThreadCacheImpl::Alloc(unsigned int bucket) {
+  assert(bucket < kNumCachedBuckets);
+  if (__predict_false(count_[bucket] == 0)) {
+    std::lock_guard<std::mutex> lk(heap_->m_);
+    while (count_[bucket] < kThreadCacheDepth / 2) {
+      blocks_[bucket][count_[bucket]++] = heap_->AllocLocked(bucket_to_size(bucket));
+    }
+  }
+  return blocks_[bucket][--count_[bucket]];
+}
+
+// Returns false if ptr should go straight to the heap instead.
+bool ThreadCacheImpl::Free(void* ptr, unsigned int bucket) {
+  if (bucket >= kNumCachedBuckets) {
+    return false;
+  }
+  if (__predict_false(count_[bucket] == kThreadCacheDepth)) {
+    std::lock_guard<std::mutex> lk(heap_->m_);
+    while (count_[bucket] > kThreadCacheDepth / 2) {
+      heap_->FreeLocked(blocks_[bucket][--count_[bucket]]);
+    }
+  }
+  blocks_[bucket][count_[bucket]++] = ptr;
+  return true;
+}
+
+// Returns all blocks to the heap; called with the heap's lock held.
+void ThreadCacheImpl::Flush() {
+  for (unsigned int bucket = 0; bucket < kNumCachedBuckets; bucket++) {
+    while (count_[bucket] > 0) {
+      heap_->FreeLocked(blocks_[bucket][--count_[bucket]]);
+    }
+  }
 }
 
 void HeapImpl::MoveToFreeList(Chunk *chunk, int bucket) {
@@ -478,3 +683,21 @@ void Heap::deallocate(HeapImpl*impl, void* ptr) {
 bool Heap::empty() {
   return impl_->Empty();
 }
+
+void Heap::reset() {
+  impl_->Reset();
+}
+
+HeapStats Heap::stats() {
+  HeapStats stats;
+  impl_->GetStats(&stats);
+  return stats;
+}
+
+Heap::ThreadCache::ThreadCache(const Heap& heap) :
+    impl_(heap.impl_->CreateThreadCache()) {
+}
+
+Heap::ThreadCache::~ThreadCache() {
+  impl_->heap()->DestroyThreadCache(impl_);
+}
@@ -19,16 +19,31 @@
 
 #include <atomic>
 #include <cstddef>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 extern std::atomic<int> heap_count;
 
 class HeapImpl;
+class ThreadCacheImpl;
+
+// Snapshot of a Heap's usage, see Heap::stats()
+struct HeapStats {
+  // Live allocations, including blocks held in thread caches
+  size_t allocations;
+  // Bytes in those allocations, rounded up to their bucket or page size
+  size_t allocated_bytes;
+  // Memory currently mapped for chunks and large allocations
+  size_t mapped_bytes;
+  // Highest mapped_bytes seen since the heap was created
+  size_t peak_mapped_bytes;
+};
 
 template<typename T>
 class Allocator;
@@ -55,8 +70,32 @@ public:
 
   bool empty();
 
+  // Frees every allocation at once and unmaps the heap's memory, keeping
+  // the heap itself usable. Nothing allocated from the heap may be touched
+  // afterwards, and no ThreadCache may be active for it.
+  void reset();
+
+  HeapStats stats();
+
   static void deallocate(HeapImpl* impl, void* ptr);
 
+  // While in scope, keeps a small stock of freed blocks of each small size
+  // for the calling thread, so that most allocations and frees of small
+  // objects on this thread don't take the heap's lock. Frees from other
+  // threads still go to the heap. Must be destroyed on the thread that
+  // created it, before the heap.
+  class ThreadCache {
+   public:
+    explicit ThreadCache(const Heap& heap);
+    ~ThreadCache();
+
+    ThreadCache(const ThreadCache&) = delete;
+    ThreadCache& operator=(const ThreadCache&) = delete;
+
+   private:
+    ThreadCacheImpl* impl_;
+  };
+
   // Allocate a class of type T
   template<class T>
   T* allocate() {
@@ -135,7 +174,7 @@ public:
   }
   template<typename U>
   inline bool operator !=(const STLAllocator<U>& other) const {
-    return !(this == other);
+    return !(*this == other);
   }
 
   template<typename U>
@@ -209,9 +248,16 @@ using vector = std::vector<T, Allocator<T>>;
 template<class T>
 using list = std::list<T, Allocator<T>>;
 
+template<class T>
+using deque = std::deque<T, Allocator<T>>;
+
 template<class T, class Key, class Compare = std::less<Key>>
 using map = std::map<Key, T, Compare, Allocator<std::pair<const Key, T>>>;
 
+template<class T, class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+using unordered_map = std::unordered_map<Key, T, Hash, KeyEqual,
+    Allocator<std::pair<const Key, T>>>;
+
 template<class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
 using unordered_set = std::unordered_set<Key, Hash, KeyEqual, Allocator<Key>>;
 
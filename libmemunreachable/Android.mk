@@ -8,6 +8,7 @@ memunreachable_srcs := \
    MemUnreachable.cpp \
    ProcessMappings.cpp \
    PtracerThread.cpp \
+   SoftDirty.cpp \
    ThreadCapture.cpp \
 
 memunreachable_test_srcs := \
@@ -15,53 +15,237 @@
  */
 
 #include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#include <map>
-#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
 
 #include "Allocator.h"
 #include "HeapWalker.h"
 #include "log.h"
 
+// Bytes covered by each bit of the page bitmap, unless the allocations are
+// spread so widely that the bitmap would need more than kMaxPageBitmapBits.
+static constexpr unsigned int kMinPageShift = 12;
+static constexpr size_t kMaxPageBitmapBits = 1 << 24;
+
+// Marking is split into chunks of at most kMarkChunkBytes, shared by up to
+// kMaxMarkThreads threads once there are kParallelMarkBytes to scan.
+static constexpr size_t kMarkChunkBytes = 256 * 1024;
+static constexpr size_t kParallelMarkBytes = 16 * 1024 * 1024;
+static constexpr size_t kMaxMarkThreads = 4;
+
+static inline bool overlaps(const Range& a, const Range& b) {
+  return a.end > b.begin && b.end > a.begin;
+}
+
 bool HeapWalker::Allocation(uintptr_t begin, uintptr_t end) {
-  auto inserted = allocations_.insert(std::pair<Range, RangeInfo>(Range{begin, end}, RangeInfo{false, false}));
-  if (inserted.second) {
-    valid_allocations_range_.begin = std::min(valid_allocations_range_.begin, begin);
-    valid_allocations_range_.end = std::max(valid_allocations_range_.end, end);
-    allocation_bytes_ += end - begin;
-    return true;
-  } else {
-    Range overlap = inserted.first->first;
+  // Heap mappings are walked in address order, so this is almost always an
+  // append.
+  auto it = std::upper_bound(allocations_.begin(), allocations_.end(), Range{begin, end},
+      [](const Range& r, const AllocationInfo& a) {
+    return r.begin < a.range.begin || (r.begin == a.range.begin && r.end < a.range.end);
+  });
+
+  const AllocationInfo* overlap = nullptr;
+  if (it != allocations_.begin() && overlaps(std::prev(it)->range, Range{begin, end})) {
+    overlap = &*std::prev(it);
+  } else if (it != allocations_.end() && overlaps(it->range, Range{begin, end})) {
+    overlap = &*it;
+  }
+  if (overlap) {
     ALOGE("range %p-%p overlaps with existing range %p-%p",
         reinterpret_cast<void*>(begin),
         reinterpret_cast<void*>(end),
-        reinterpret_cast<void*>(overlap.begin),
-        reinterpret_cast<void*>(overlap.end));
+        reinterpret_cast<void*>(overlap->range.begin),
+        reinterpret_cast<void*>(overlap->range.end));
     return false;
   }
+
+  allocations_.insert(it, AllocationInfo{Range{begin, end}, RangeInfo{false, false}});
+  if (begin < end) {
+    valid_allocations_range_.begin = std::min(valid_allocations_range_.begin, begin);
+    valid_allocations_range_.end = std::max(valid_allocations_range_.end, end);
+  }
+  allocation_bytes_ += end - begin;
+  return true;
+}
+
+void HeapWalker::BuildPageBitmap() {
+  page_bitmap_.clear();
+  if (valid_allocations_range_.begin >= valid_allocations_range_.end) {
+    return;
+  }
+
+  uintptr_t base = valid_allocations_range_.begin;
+  uintptr_t span = valid_allocations_range_.end - base;
+  page_shift_ = kMinPageShift;
+  while ((span >> page_shift_) >= kMaxPageBitmapBits) {
+    page_shift_++;
+  }
+  page_bitmap_.resize(((span - 1) >> page_shift_) / 64 + 1);
+
+  for (auto it = allocations_.begin(); it != allocations_.end(); it++) {
+    if (it->range.begin == it->range.end) {
+      continue;
+    }
+    uintptr_t first = (it->range.begin - base) >> page_shift_;
+    uintptr_t last = (it->range.end - 1 - base) >> page_shift_;
+    for (uintptr_t page = first; page <= last; page++) {
+      page_bitmap_[page / 64] |= 1ULL << (page % 64);
+    }
+  }
+}
+
+HeapWalker::AllocationInfo* HeapWalker::Find(uintptr_t val) {
+  if (val < valid_allocations_range_.begin || val >= valid_allocations_range_.end) {
+    return nullptr;
+  }
+  uintptr_t page = (val - valid_allocations_range_.begin) >> page_shift_;
+  if (!(page_bitmap_[page / 64] & (1ULL << (page % 64)))) {
+    return nullptr;
+  }
+
+  auto it = std::upper_bound(allocations_.begin(), allocations_.end(), val,
+      [](uintptr_t v, const AllocationInfo& a) { return v < a.range.begin; });
+  if (it == allocations_.begin()) {
+    return nullptr;
+  }
+  --it;
+  return val < it->range.end ? &*it : nullptr;
+}
+
+// Marks the allocations pointed to by the words in [begin, end), adding the
+// ones that weren't marked yet to to_do. Several threads may scan at once;
+// whichever sets an allocation's flag first is the one that queues it.
+// Returns whether any word was inside the heap.
+bool HeapWalker::Scan(uintptr_t begin, uintptr_t end, bool RangeInfo::*flag,
+    allocator::vector<Range>& to_do) {
+  bool in_heap = false;
+  // TODO(ccross): we might need to consider a pointer to the end of a buffer
+  // to be inside the buffer, which means the common case of a pointer to the
+  // beginning of a buffer may keep two ranges live.
+  for (uintptr_t i = begin; i < end; i += sizeof(uintptr_t)) {
+    uintptr_t val = *reinterpret_cast<uintptr_t*>(i);
+    if (val >= heap_.begin && val < heap_.end) {
+      in_heap = true;
+      AllocationInfo* allocation = Find(val);
+      if (allocation) {
+        bool* marked = &(allocation->info.*flag);
+        if (!__atomic_load_n(marked, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(marked, true, __ATOMIC_RELAXED)) {
+          to_do.push_back(allocation->range);
+        }
+      }
+    }
+  }
+  return in_heap;
 }
 
-void HeapWalker::Walk(const Range& range, bool RangeInfo::*flag) {
-  allocator::vector<Range> to_do(1, range, allocator_);
+// Walks everything reachable from range, marking each allocation it finds.
+// If incremental, skips the pages in skip_pages_, and adds whole pages that
+// hold no words inside the heap to pointer_free if it isn't null.
+void HeapWalker::Walk(const Range& range, bool RangeInfo::*flag,
+    allocator::vector<Range>& to_do, bool incremental,
+    allocator::vector<uintptr_t>* pointer_free) {
+  bool by_page = incremental && (pointer_free != nullptr || !skip_pages_.empty());
+  to_do.push_back(range);
   while (!to_do.empty()) {
     Range range = to_do.back();
     to_do.pop_back();
     uintptr_t begin = (range.begin + (sizeof(uintptr_t) - 1)) & ~(sizeof(uintptr_t) - 1);
-    // TODO(ccross): we might need to consider a pointer to the end of a buffer
-    // to be inside the buffer, which means the common case of a pointer to the
-    // beginning of a buffer may keep two ranges live.
-    for (uintptr_t i = begin; i < range.end; i += sizeof(uintptr_t)) {
-      uintptr_t val = *reinterpret_cast<uintptr_t*>(i);
-      if (val >= valid_allocations_range_.begin && val < valid_allocations_range_.end) {
-        RangeMap::iterator it = allocations_.find(Range{val, val + 1});
-        if (it != allocations_.end()) {
-          if (!(it->second.*flag)) {
-            to_do.push_back(it->first);
-            it->second.*flag = true;
-          }
-        }
+    uintptr_t page = (begin + page_size_ - 1) & ~(page_size_ - 1);
+    if (!by_page || page >= range.end) {
+      Scan(begin, range.end, flag, to_do);
+      continue;
+    }
+
+    Scan(begin, page, flag, to_do);
+    for (; range.end - page >= page_size_; page += page_size_) {
+      bool skip = std::binary_search(skip_pages_.begin(), skip_pages_.end(), page);
+      if ((skip || !Scan(page, page + page_size_, flag, to_do)) && pointer_free) {
+        pointer_free->push_back(page);
       }
     }
+    Scan(page, range.end, flag, to_do);
+  }
+}
+
+// The chunks of one marking pass, handed out to the marking threads in turn.
+class HeapWalker::MarkWork {
+ public:
+  MarkWork(HeapWalker* walker, const allocator::vector<Range>& chunks,
+      bool RangeInfo::*flag, bool incremental) : walker_(walker), chunks_(chunks),
+      flag_(flag), incremental_(incremental), next_(0) {}
+
+  void Run() {
+    allocator::vector<Range> to_do(walker_->allocator_);
+    allocator::vector<uintptr_t> pointer_free(walker_->allocator_);
+    size_t i;
+    while ((i = next_.fetch_add(1, std::memory_order_relaxed)) < chunks_.size()) {
+      walker_->Walk(chunks_[i], flag_, to_do, incremental_,
+          walker_->record_pointer_free_ ? &pointer_free : nullptr);
+    }
+    if (!pointer_free.empty()) {
+      std::lock_guard<std::mutex> lk(m_);
+      walker_->pointer_free_pages_.insert(walker_->pointer_free_pages_.end(),
+          pointer_free.begin(), pointer_free.end());
+    }
+  }
+
+  static void* RunThread(void* arg) {
+    reinterpret_cast<MarkWork*>(arg)->Run();
+    return nullptr;
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MarkWork);
+  HeapWalker* walker_;
+  const allocator::vector<Range>& chunks_;
+  bool RangeInfo::*flag_;
+  bool incremental_;
+  std::atomic<size_t> next_;
+  std::mutex m_;
+};
+
+void HeapWalker::Mark(const allocator::vector<Range>& ranges, bool RangeInfo::*flag,
+    bool incremental) {
+  allocator::vector<Range> chunks(allocator_);
+  size_t bytes = 0;
+  for (auto it = ranges.begin(); it != ranges.end(); it++) {
+    uintptr_t begin = (it->begin + (sizeof(uintptr_t) - 1)) & ~(sizeof(uintptr_t) - 1);
+    while (begin < it->end) {
+      // Chunks end on multiples of kMarkChunkBytes so they don't split pages
+      uintptr_t next = (begin | (kMarkChunkBytes - 1)) + 1;
+      uintptr_t end = next > begin && next < it->end ? next : it->end;
+      chunks.push_back(Range{begin, end});
+      bytes += end - begin;
+      begin = end;
+    }
+  }
+
+  size_t threads = 1;
+  if (bytes >= kParallelMarkBytes) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = std::min(static_cast<size_t>(std::max(cpus, 1L)), kMaxMarkThreads);
+  }
+
+  // Plain pthreads rather than std::thread, which would need malloc, and
+  // malloc is disabled in the heap walker process.
+  MarkWork work(this, chunks, flag, incremental);
+  pthread_t helpers[kMaxMarkThreads];
+  size_t started = 0;
+  for (size_t i = 1; i < threads; i++) {
+    if (pthread_create(&helpers[started], nullptr, MarkWork::RunThread, &work) == 0) {
+      started++;
+    }
+  }
+  work.Run();
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(helpers[i], nullptr);
   }
 }
 
@@ -81,21 +265,62 @@ size_t HeapWalker::AllocationBytes() {
   return allocation_bytes_;
 }
 
+void HeapWalker::RecordPointerFreePages(const Range& heap) {
+  page_size_ = sysconf(_SC_PAGE_SIZE);
+  record_pointer_free_ = true;
+  record_heap_ = heap;
+}
+
+void HeapWalker::SkipPages(const allocator::vector<uintptr_t>& pages, const Range& heap) {
+  page_size_ = sysconf(_SC_PAGE_SIZE);
+  skip_pages_ = pages;
+  std::sort(skip_pages_.begin(), skip_pages_.end());
+  skip_heap_ = heap;
+}
+
+Range HeapWalker::PointerFreePages(allocator::vector<uintptr_t>& pages) {
+  pages = pointer_free_pages_;
+  return heap_;
+}
+
 bool HeapWalker::DetectLeaks() {
-  for (auto it = roots_.begin(); it != roots_.end(); it++) {
-    Walk(*it, &RangeInfo::referenced_from_root);
+  BuildPageBitmap();
+
+  heap_ = valid_allocations_range_;
+  if (record_pointer_free_) {
+    heap_.begin = std::min(heap_.begin, record_heap_.begin);
+    heap_.end = std::max(heap_.end, record_heap_.end);
+  }
+  // A skipped page may hold words inside the part of the heap that is new
+  if (heap_.begin < skip_heap_.begin || heap_.end > skip_heap_.end) {
+    skip_pages_.clear();
   }
+  pointer_free_pages_.clear();
 
+  Mark(roots_, &RangeInfo::referenced_from_root, true);
+
+  // root_vals_ is our own memory, not the memory being checked, so its
+  // pages are neither skipped nor recorded
+  allocator::vector<Range> ranges(allocator_);
   Range vals;
   vals.begin = reinterpret_cast<uintptr_t>(root_vals_.data());
   vals.end = vals.begin + root_vals_.size() * sizeof(uintptr_t);
-  Walk(vals, &RangeInfo::referenced_from_root);
+  ranges.push_back(vals);
+  Mark(ranges, &RangeInfo::referenced_from_root, false);
 
+  ranges.clear();
   for (auto it = allocations_.begin(); it != allocations_.end(); it++) {
-    if (!it->second.referenced_from_root) {
-      Walk(it->first, &RangeInfo::referenced_from_leak);
+    if (!it->info.referenced_from_root) {
+      ranges.push_back(it->range);
     }
   }
+  Mark(ranges, &RangeInfo::referenced_from_leak, true);
+
+  // A page can be scanned more than once, once per flag or as part of a
+  // leak reached from another
+  std::sort(pointer_free_pages_.begin(), pointer_free_pages_.end());
+  pointer_free_pages_.erase(std::unique(pointer_free_pages_.begin(), pointer_free_pages_.end()),
+      pointer_free_pages_.end());
 
   return true;
 }
@@ -108,17 +333,17 @@ bool HeapWalker::Leaked(allocator::vector<Range>& leaked, size_t limit,
   size_t num_leaks = 0;
   size_t leak_bytes = 0;
   for (auto it = allocations_.begin(); it != allocations_.end(); it++) {
-    if (!it->second.referenced_from_root) {
+    if (!it->info.referenced_from_root) {
       num_leaks++;
-      leak_bytes += it->first.end - it->first.begin;
+      leak_bytes += it->range.end - it->range.begin;
     }
   }
 
   size_t n = 0;
   for (auto it = allocations_.begin(); it != allocations_.end(); it++) {
-    if (!it->second.referenced_from_root) {
+    if (!it->info.referenced_from_root) {
       if (n++ <= limit) {
-        leaked.push_back(it->first);
+        leaked.push_back(it->range);
       }
     }
   }
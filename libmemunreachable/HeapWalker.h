@@ -27,21 +27,26 @@ struct Range {
   uintptr_t end;
 };
 
-// Comparator for Ranges that returns equivalence for overlapping ranges
-struct compare_range {
-  bool operator()(const Range& a, const Range& b) const {
-    return a.end <= b.begin;
-  }
-};
-
-
+// HeapWalker finds allocations that can't be reached by following pointers
+// from the roots. Allocations are kept in an array sorted by address, with a
+// bitmap of the pages they cover in front of it, so that most words that
+// aren't pointers into the heap are rejected without a search. Large heaps
+// are marked by several threads at once.
+//
+// For incremental checks, HeapWalker can also collect the pages that hold
+// no words inside the heap, and skip pages that held none last time and
+// haven't been written since. Only whole pages inside a scanned range count.
 class HeapWalker {
  public:
   HeapWalker(Allocator<HeapWalker> allocator) : allocator_(allocator),
     allocations_(allocator), allocation_bytes_(0),
-	roots_(allocator), root_vals_(allocator) {
+    page_bitmap_(allocator), page_shift_(0),
+	roots_(allocator), root_vals_(allocator),
+    page_size_(0), record_pointer_free_(false), skip_pages_(allocator),
+    pointer_free_pages_(allocator) {
     valid_allocations_range_.end = 0;
     valid_allocations_range_.begin = ~valid_allocations_range_.end;
+    heap_ = record_heap_ = skip_heap_ = valid_allocations_range_;
   }
   ~HeapWalker() {}
   bool Allocation(uintptr_t begin, uintptr_t end);
@@ -55,21 +60,58 @@ class HeapWalker {
   size_t Allocations();
   size_t AllocationBytes();
 
+  // Collect the pages that hold no words inside heap, which must cover every
+  // allocation.
+  void RecordPointerFreePages(const Range& heap);
+  // Don't scan pages, which held no words inside heap when they were last
+  // scanned and haven't been written since. Ignored if the heap has grown
+  // past heap.
+  void SkipPages(const allocator::vector<uintptr_t>& pages, const Range& heap);
+  // The pages collected by DetectLeaks, sorted, and the heap they hold no
+  // words inside.
+  Range PointerFreePages(allocator::vector<uintptr_t>& pages);
+
  private:
   struct RangeInfo {
     bool referenced_from_root;
     bool referenced_from_leak;
   };
-  void Walk(const Range& range, bool RangeInfo::* flag);
+  struct AllocationInfo {
+    Range range;
+    RangeInfo info;
+  };
+  class MarkWork;
+  void BuildPageBitmap();
+  AllocationInfo* Find(uintptr_t val);
+  void Mark(const allocator::vector<Range>& ranges, bool RangeInfo::* flag, bool incremental);
+  void Walk(const Range& range, bool RangeInfo::* flag, allocator::vector<Range>& to_do,
+      bool incremental, allocator::vector<uintptr_t>* pointer_free);
+  bool Scan(uintptr_t begin, uintptr_t end, bool RangeInfo::* flag,
+      allocator::vector<Range>& to_do);
   DISALLOW_COPY_AND_ASSIGN(HeapWalker);
   Allocator<HeapWalker> allocator_;
-  using RangeMap = allocator::map<RangeInfo, Range, compare_range>;
-  RangeMap allocations_;
+  // Sorted by begin, then end
+  allocator::vector<AllocationInfo> allocations_;
   size_t allocation_bytes_;
   Range valid_allocations_range_;
+  // One bit per 1 << page_shift_ bytes of valid_allocations_range_, set if
+  // any allocation touches those bytes
+  allocator::vector<uint64_t> page_bitmap_;
+  unsigned int page_shift_;
+
+  // Words inside heap_ are looked up as pointers; it covers
+  // valid_allocations_range_ and any heap passed to RecordPointerFreePages
+  Range heap_;
 
   allocator::vector<Range> roots_;
   allocator::vector<uintptr_t> root_vals_;
+
+  size_t page_size_;
+  bool record_pointer_free_;
+  Range record_heap_;
+  allocator::vector<uintptr_t> skip_pages_;
+  Range skip_heap_;
+  allocator::vector<uintptr_t> pointer_free_pages_;
 };
 
 #endif
@@ -31,6 +31,7 @@
 #include "PtracerThread.h"
 #include "ScopedDisableMalloc.h"
 #include "Semaphore.h"
+#include "SoftDirty.h"
 #include "ThreadCapture.h"
 
 #include "memunreachable/memunreachable.h"
@@ -43,13 +44,22 @@ using namespace std::chrono_literals;
 class MemUnreachable {
  public:
   MemUnreachable(pid_t pid, Allocator<void> allocator) : pid_(pid), allocator_(allocator),
-      heap_walker_(allocator_) {}
+      heap_walker_(allocator_), clean_pages_(nullptr) {}
+  // Skip clean_pages, which held no words inside previous_heap, and collect
+  // the pages that hold no words inside the heap now.
+  void Incremental(const allocator::vector<uintptr_t>& clean_pages, const Range& previous_heap) {
+    clean_pages_ = &clean_pages;
+    previous_heap_ = previous_heap;
+  }
   bool CollectAllocations(const allocator::vector<ThreadInfo>& threads,
       const allocator::vector<Mapping>& mappings);
   bool GetUnreachableMemory(allocator::vector<Leak>& leaks, size_t limit,
       size_t* num_leaks, size_t* leak_bytes);
   size_t Allocations() { return heap_walker_.Allocations(); }
   size_t AllocationBytes() { return heap_walker_.AllocationBytes(); }
+  Range PointerFreePages(allocator::vector<uintptr_t>& pages) {
+    return heap_walker_.PointerFreePages(pages);
+  }
  private:
   bool ClassifyMappings(const allocator::vector<Mapping>& mappings,
       allocator::vector<Mapping>& heap_mappings,
@@ -60,8 +70,31 @@ class MemUnreachable {
   pid_t pid_;
   Allocator<void> allocator_;
   HeapWalker heap_walker_;
+  const allocator::vector<uintptr_t>* clean_pages_;
+  Range previous_heap_;
+};
+
+class UnreachableMemoryHistory::Impl {
+ public:
+  Impl() : pages(heap), generation(0) {
+    heap_range.begin = heap_range.end = 0;
+  }
+  // The pages live in a Heap of their own so that they aren't scanned
+  Heap heap;
+  // Pages that held no words inside heap_range at the last check, sorted
+  allocator::vector<uintptr_t> pages;
+  Range heap_range;
+  // SoftDirtyGeneration() after the last check cleared the bits
+  uint64_t generation;
 };
 
+UnreachableMemoryHistory::UnreachableMemoryHistory() : impl_(new Impl) {
+}
+
+UnreachableMemoryHistory::~UnreachableMemoryHistory() {
+  delete impl_;
+}
+
 static void HeapIterate(const Mapping& heap_mapping,
     const std::function<void(uintptr_t, size_t)>& func) {
   malloc_iterate(heap_mapping.begin, heap_mapping.end - heap_mapping.begin,
@@ -83,16 +116,28 @@ bool MemUnreachable::CollectAllocations(const allocator::vector<ThreadInfo>& thr
     return false;
   }
 
+  Range heap{~uintptr_t(0), 0};
   for (auto it = heap_mappings.begin(); it != heap_mappings.end(); it++) {
     ALOGV("Heap mapping %" PRIxPTR "-%" PRIxPTR " %s", it->begin, it->end, it->name);
     HeapIterate(*it, [&](uintptr_t base, size_t size) {
       heap_walker_.Allocation(base, base + size);
     });
+    heap.begin = std::min(heap.begin, it->begin);
+    heap.end = std::max(heap.end, it->end);
   }
 
   for (auto it = anon_mappings.begin(); it != anon_mappings.end(); it++) {
     ALOGV("Anon mapping %" PRIxPTR "-%" PRIxPTR " %s", it->begin, it->end, it->name);
     heap_walker_.Allocation(it->begin, it->end);
+    heap.begin = std::min(heap.begin, it->begin);
+    heap.end = std::max(heap.end, it->end);
+  }
+
+  if (clean_pages_) {
+    // Using the mappings rather than the allocations keeps the heap from
+    // looking like it grew every time an allocation lands near its edge
+    heap_walker_.RecordPointerFreePages(heap);
+    heap_walker_.SkipPages(*clean_pages_, previous_heap_);
   }
 
   for (auto it = globals_mappings.begin(); it != globals_mappings.end(); it++) {
@@ -196,10 +241,13 @@ bool MemUnreachable::ClassifyMappings(const allocator::vector<Mapping>& mappings
   return true;
 }
 
-bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
+static bool CheckUnreachableMemory(UnreachableMemoryInfo& info, size_t limit,
+    UnreachableMemoryHistory::Impl* history) {
   int parent_pid = getpid();
   int parent_tid = gettid();
 
+  bool incremental = history != nullptr && SoftDirtySupported();
+
   Heap heap;
 
   Semaphore continue_parent_sem;
@@ -230,6 +278,22 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
       return 1;
     }
 
+    // find the pages that haven't been written since the last check, then
+    // start tracking writes for the next one, while all the threads are
+    // still stopped
+    allocator::vector<uintptr_t> clean_pages(heap);
+    if (incremental) {
+      if (history->generation == SoftDirtyGeneration()) {
+        clean_pages.reserve(history->pages.size());
+        if (!CleanPages(parent_pid, history->pages, clean_pages)) {
+          clean_pages.clear();
+        }
+      }
+      history->pages.clear();
+      incremental = ClearSoftDirty(parent_pid);
+      history->generation = SoftDirtyGeneration();
+    }
+
     // malloc must be enabled to call fork, at_fork handlers take the same
     // locks as ScopedDisableMalloc.  All threads are paused in ptrace, so
     // memory state is still consistent.  Unfreeze the original thread so it
@@ -255,6 +319,9 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
       }
 
       MemUnreachable unreachable{parent_pid, heap};
+      if (incremental) {
+        unreachable.Incremental(clean_pages, history->heap_range);
+      }
 
       if (!unreachable.CollectAllocations(thread_info, mappings)) {
         _exit(2);
@@ -274,6 +341,13 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
       ok = ok && pipe.Sender().Send(leak_bytes);
       ok = ok && pipe.Sender().SendVector(leaks);
 
+      if (incremental) {
+        allocator::vector<uintptr_t> pointer_free_pages{heap};
+        Range pointer_free_heap = unreachable.PointerFreePages(pointer_free_pages);
+        ok = ok && pipe.Sender().Send(pointer_free_heap);
+        ok = ok && pipe.Sender().SendVector(pointer_free_pages);
+      }
+
       if (!ok) {
         _exit(3);
       }
@@ -324,6 +398,13 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
   ok = ok && pipe.Receiver().Receive(&info.num_leaks);
   ok = ok && pipe.Receiver().Receive(&info.leak_bytes);
   ok = ok && pipe.Receiver().ReceiveVector(info.leaks);
+  if (ok && incremental) {
+    ok = pipe.Receiver().Receive(&history->heap_range) &&
+        pipe.Receiver().ReceiveVector(history->pages);
+    if (!ok) {
+      history->pages.clear();
+    }
+  }
   if (!ok) {
     return false;
   }
@@ -336,6 +417,15 @@ bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
   return true;
 }
 
+bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit) {
+  return CheckUnreachableMemory(info, limit, nullptr);
+}
+
+bool GetUnreachableMemoryIncremental(UnreachableMemoryHistory& history,
+    UnreachableMemoryInfo& info, size_t limit) {
+  return CheckUnreachableMemory(info, limit, history.impl_);
+}
+
 static void LogUnreachable(Leak& leak, bool log_contents) {
   ALOGE("unreachable allocation at %" PRIxPTR " of approximate size %zu",
       leak.begin, leak.size);
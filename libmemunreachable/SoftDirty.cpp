@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include <android-base/unique_fd.h>
+
+#include "SoftDirty.h"
+#include "log.h"
+
+static constexpr uint64_t kPagemapSoftDirty = 1ULL << 55;
+static constexpr size_t kPagemapBatch = 256;
+
+static std::atomic<uint64_t> soft_dirty_generation;
+
+bool ClearSoftDirty(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+  int fd = open(path, O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  android::base::unique_fd fd_guard{fd};
+
+  if (write(fd, "4", 1) != 1) {
+    return false;
+  }
+  soft_dirty_generation++;
+  return true;
+}
+
+uint64_t SoftDirtyGeneration() {
+  return soft_dirty_generation;
+}
+
+bool CleanPages(pid_t pid, const allocator::vector<uintptr_t>& pages,
+    allocator::vector<uintptr_t>& clean) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  android::base::unique_fd fd_guard{fd};
+
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  uint64_t entries[kPagemapBatch];
+  uintptr_t first = 0;
+  size_t count = 0;
+  for (auto it = pages.begin(); it != pages.end(); it++) {
+    uintptr_t index = *it / page_size;
+    if (index < first || index >= first + count) {
+      // Read the entries for this page and the ones after it
+      ssize_t ret = TEMP_FAILURE_RETRY(pread(fd, entries, sizeof(entries),
+          index * sizeof(uint64_t)));
+      if (ret < static_cast<ssize_t>(sizeof(uint64_t))) {
+        ALOGE("failed to read pagemap at %" PRIxPTR ": %s", *it, strerror(errno));
+        return false;
+      }
+      first = index;
+      count = ret / sizeof(uint64_t);
+    }
+    if (!(entries[index - first] & kPagemapSoftDirty)) {
+      clean.push_back(*it);
+    }
+  }
+  return true;
+}
+
+static bool SoftDirtyProbe() {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  void* map = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  volatile char* page = reinterpret_cast<char*>(map);
+  *page = 1;
+
+  // Without kernel support, clearing succeeds and nothing is ever dirty
+  Heap heap;
+  allocator::vector<uintptr_t> pages(1, reinterpret_cast<uintptr_t>(map), heap);
+  allocator::vector<uintptr_t> cleared(heap);
+  allocator::vector<uintptr_t> written(heap);
+  bool ok = ClearSoftDirty(getpid()) && CleanPages(getpid(), pages, cleared);
+  *page = 2;
+  ok = ok && CleanPages(getpid(), pages, written);
+
+  munmap(map, page_size);
+  return ok && cleared.size() == 1 && written.empty();
+}
+
+bool SoftDirtySupported() {
+  static bool supported = SoftDirtyProbe();
+  return supported;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMEMUNREACHABLE_SOFT_DIRTY_H_
+#define LIBMEMUNREACHABLE_SOFT_DIRTY_H_
+
+#include <sys/types.h>
+
+#include "Allocator.h"
+
+// Soft-dirty page tracking, see Documentation/vm/soft-dirty.txt in the
+// kernel.  The bits belong to the whole process, so clearing them for one
+// user invalidates what any other user learned from them; the generation
+// counts clears so that users can tell.
+
+// Whether the kernel tracks soft-dirty bits.  Clears them the first time
+// it is called.
+bool SoftDirtySupported();
+
+// Clears the soft-dirty bits of every page of pid.
+bool ClearSoftDirty(pid_t pid);
+
+// The number of times ClearSoftDirty has succeeded.
+uint64_t SoftDirtyGeneration();
+
+// Appends the pages of pid that haven't been written since the last clear
+// to clean.  pages must be sorted.
+bool CleanPages(pid_t pid, const allocator::vector<uintptr_t>& pages,
+    allocator::vector<uintptr_t>& clean);
+
+#endif // LIBMEMUNREACHABLE_SOFT_DIRTY_H_
@@ -44,10 +44,38 @@ struct UnreachableMemoryInfo {
   }
 };
 
+class UnreachableMemoryHistory;
+
 __BEGIN_DECLS
 bool GetUnreachableMemory(UnreachableMemoryInfo& info, size_t limit = 100);
 
+// Like GetUnreachableMemory, but skips scanning pages that haven't been
+// written since the previous check with the same history and held nothing
+// that looked like a pointer into the heap then.  Falls back to a full scan
+// when the kernel doesn't track soft-dirty pages, when the heap has grown,
+// or when something else cleared the soft-dirty bits in between, which
+// includes a check with another history.
+bool GetUnreachableMemoryIncremental(UnreachableMemoryHistory& history,
+    UnreachableMemoryInfo& info, size_t limit = 100);
+
 bool LogUnreachableMemory(bool log_contents = false, size_t limit = 100);
 __END_DECLS
 
+// What an incremental check learned, for the next one.
+class UnreachableMemoryHistory {
+ public:
+  UnreachableMemoryHistory();
+  ~UnreachableMemoryHistory();
+
+  class Impl;
+
+ private:
+  UnreachableMemoryHistory(const UnreachableMemoryHistory&) = delete;
+  void operator=(const UnreachableMemoryHistory&) = delete;
+  friend bool GetUnreachableMemoryIncremental(UnreachableMemoryHistory&,
+      UnreachableMemoryInfo&, size_t);
+
+  Impl* impl_;
+};
+
 #endif // LIBMEMUNREACHABLE_MEMUNREACHABLE_H_
@@ -181,6 +181,88 @@ TEST_F(AllocatorTest, unique) {
   ASSERT_NE(ptr, nullptr);
 }
 
+TEST_F(AllocatorTest, stl_unordered_map) {
+  auto m = allocator::unordered_map<int, int>(Allocator<std::pair<const int, int>>(heap));
+  for (int i = 0; i < 1024; i++) {
+    m[i] = i * 2;
+  }
+  for (int i = 0; i < 1024; i++) {
+    ASSERT_EQ(m[i], i * 2);
+  }
+  m.clear();
+}
+
+TEST_F(AllocatorTest, stats) {
+  HeapStats stats = heap.stats();
+  ASSERT_EQ(0U, stats.allocations);
+  ASSERT_EQ(0U, stats.allocated_bytes);
+
+  void* small = heap.allocate(100);
+  void* tiny = heap.allocate(1);
+  void* large = heap.allocate(1024 * 1024);
+  stats = heap.stats();
+  EXPECT_EQ(3U, stats.allocations);
+  EXPECT_EQ(128U + 8U + 1024 * 1024U, stats.allocated_bytes);
+  EXPECT_GE(stats.mapped_bytes, stats.allocated_bytes);
+  EXPECT_EQ(stats.mapped_bytes, stats.peak_mapped_bytes);
+
+  heap.deallocate(large);
+  heap.deallocate(tiny);
+  heap.deallocate(small);
+  HeapStats after = heap.stats();
+  EXPECT_EQ(0U, after.allocations);
+  EXPECT_EQ(0U, after.allocated_bytes);
+  EXPECT_LT(after.mapped_bytes, stats.mapped_bytes);
+  EXPECT_EQ(stats.peak_mapped_bytes, after.peak_mapped_bytes);
+}
+
+TEST_F(AllocatorTest, reset) {
+  auto v = new (heap.allocate<allocator::vector<int>>())
+      allocator::vector<int>(Allocator<int>(heap));
+  for (int i = 0; i < 100000; i++) {
+    v->push_back(i);
+  }
+  heap.allocate(1024 * 1024);
+  ASSERT_NE(0U, heap.stats().allocations);
+
+  // No destructors or frees: everything goes at once.
+  heap.reset();
+  HeapStats stats = heap.stats();
+  EXPECT_EQ(0U, stats.allocations);
+  EXPECT_EQ(0U, stats.mapped_bytes);
+
+  void* ptr = heap.allocate(100);
+  ASSERT_TRUE(ptr != NULL);
+  heap.deallocate(ptr);
+}
+
+TEST_F(AllocatorTest, thread_cache) {
+  void* ptrs[100];
+  {
+    Heap::ThreadCache cache(heap);
+
+    for (int i = 0; i < 100; i++) {
+      ptrs[i] = heap.allocate(16 + i);
+    }
+    for (int i = 0; i < 100; i++) {
+      for (int j = 0; j < i; j++) {
+        ASSERT_NE(ptrs[i], ptrs[j]);
+      }
+    }
+    // Freed blocks are reused from the cache.
+    heap.deallocate(ptrs[0]);
+    ASSERT_EQ(ptrs[0], heap.allocate(16));
+    for (int i = 0; i < 50; i++) {
+      heap.deallocate(ptrs[i]);
+    }
+  }
+  // Blocks freed after the cache is gone go straight back to the heap.
+  for (int i = 50; i < 100; i++) {
+    heap.deallocate(ptrs[i]);
+  }
+  ASSERT_EQ(0U, heap.stats().allocations);
+}
+
 class DisableMallocTest : public ::testing::Test {
  protected:
   void alarm(std::chrono::microseconds us) {
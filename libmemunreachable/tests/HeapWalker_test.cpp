@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "HeapWalker.h"
 
 #include <gtest/gtest.h>
@@ -133,3 +136,109 @@ TEST_F(HeapWalkerTest, unaligned) {
     }
   }
 }
+
+TEST_F(HeapWalkerTest, chain) {
+  const size_t nodes = 4096;
+  const size_t leaked_nodes = 16;
+  uintptr_t* buffer = reinterpret_cast<uintptr_t*>(heap_.allocate(nodes * 2 * sizeof(uintptr_t)));
+  memset(buffer, 0, nodes * 2 * sizeof(uintptr_t));
+
+  // A list of nodes reachable from root, followed by a cycle of leaked nodes
+  for (size_t i = 0; i + 1 < nodes; i++) {
+    if (i + 1 != nodes - leaked_nodes) {
+      buffer[i * 2] = reinterpret_cast<uintptr_t>(&buffer[(i + 1) * 2]);
+    }
+  }
+  buffer[(nodes - 1) * 2] = reinterpret_cast<uintptr_t>(&buffer[(nodes - leaked_nodes) * 2]);
+  void* root[1] = {buffer};
+
+  HeapWalker heap_walker(heap_);
+  for (size_t i = nodes; i-- > 0;) {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(&buffer[i * 2]);
+    ASSERT_TRUE(heap_walker.Allocation(begin, begin + 2 * sizeof(uintptr_t)));
+  }
+  heap_walker.Root(buffer_begin(root), buffer_end(root));
+
+  allocator::vector<Range> leaked(heap_);
+  size_t num_leaks = SIZE_T_MAX;
+  size_t leaked_bytes = SIZE_T_MAX;
+  ASSERT_EQ(true, heap_walker.Leaked(leaked, 100, &num_leaks, &leaked_bytes));
+
+  EXPECT_EQ(nodes, heap_walker.Allocations());
+  EXPECT_EQ(leaked_nodes, num_leaks);
+  EXPECT_EQ(leaked_nodes * 2 * sizeof(uintptr_t), leaked_bytes);
+  ASSERT_EQ(leaked_nodes, leaked.size());
+  for (size_t i = 0; i < leaked_nodes; i++) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&buffer[(nodes - leaked_nodes + i) * 2]),
+        leaked[i].begin);
+  }
+
+  heap_.deallocate(buffer);
+}
+
+TEST_F(HeapWalkerTest, pointer_free_pages) {
+  const size_t page_size = sysconf(_SC_PAGE_SIZE);
+  void* map = mmap(NULL, 4 * page_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, map);
+  uintptr_t pages = reinterpret_cast<uintptr_t>(map);
+  char buffer[16]{};
+  Range heap{buffer_begin(buffer), buffer_end(buffer)};
+
+  // Only the first page points into the heap
+  reinterpret_cast<void**>(pages)[0] = &buffer[0];
+
+  allocator::vector<uintptr_t> pointer_free(heap_);
+  {
+    HeapWalker heap_walker(heap_);
+    heap_walker.Allocation(buffer_begin(buffer), buffer_end(buffer));
+    heap_walker.Root(pages, pages + 4 * page_size);
+    heap_walker.RecordPointerFreePages(heap);
+
+    allocator::vector<Range> leaked(heap_);
+    size_t num_leaks = SIZE_T_MAX;
+    ASSERT_EQ(true, heap_walker.Leaked(leaked, 100, &num_leaks, nullptr));
+    EXPECT_EQ(0U, num_leaks);
+
+    Range pointer_free_heap = heap_walker.PointerFreePages(pointer_free);
+    EXPECT_EQ(heap.begin, pointer_free_heap.begin);
+    EXPECT_EQ(heap.end, pointer_free_heap.end);
+    ASSERT_EQ(3U, pointer_free.size());
+    EXPECT_EQ(pages + page_size, pointer_free[0]);
+    EXPECT_EQ(pages + 3 * page_size, pointer_free[2]);
+  }
+
+  // Move the pointer to a page that is skipped, which hides it
+  reinterpret_cast<void**>(pages)[0] = nullptr;
+  reinterpret_cast<void**>(pages + page_size)[0] = &buffer[0];
+  {
+    HeapWalker heap_walker(heap_);
+    heap_walker.Allocation(buffer_begin(buffer), buffer_end(buffer));
+    heap_walker.Root(pages, pages + 4 * page_size);
+    heap_walker.SkipPages(pointer_free, heap);
+
+    allocator::vector<Range> leaked(heap_);
+    size_t num_leaks = SIZE_T_MAX;
+    ASSERT_EQ(true, heap_walker.Leaked(leaked, 100, &num_leaks, nullptr));
+    EXPECT_EQ(1U, num_leaks);
+  }
+
+  // Unless the heap has grown past what the pages were checked against
+  {
+    char buffer2[16]{};
+    HeapWalker heap_walker(heap_);
+    heap_walker.Allocation(buffer_begin(buffer), buffer_end(buffer));
+    heap_walker.Allocation(buffer_begin(buffer2), buffer_end(buffer2));
+    heap_walker.Root(pages, pages + 4 * page_size);
+    heap_walker.SkipPages(pointer_free, heap);
+
+    allocator::vector<Range> leaked(heap_);
+    size_t num_leaks = SIZE_T_MAX;
+    ASSERT_EQ(true, heap_walker.Leaked(leaked, 100, &num_leaks, nullptr));
+    EXPECT_EQ(1U, num_leaks);
+    ASSERT_EQ(1U, leaked.size());
+    EXPECT_EQ(buffer_begin(buffer2), leaked[0].begin);
+  }
+
+  munmap(map, 4 * page_size);
+}
@@ -185,6 +185,48 @@ TEST(MemunreachableTest, twice) {
   }
 }
 
+TEST(MemunreachableTest, incremental) {
+  UnreachableMemoryHistory history;
+  HiddenPointer hidden_ptr;
+
+  ptr = hidden_ptr.Get();
+
+  {
+    UnreachableMemoryInfo info;
+
+    ASSERT_TRUE(GetUnreachableMemoryIncremental(history, info));
+    ASSERT_EQ(0U, info.leaks.size());
+  }
+
+  ptr = NULL;
+
+  {
+    UnreachableMemoryInfo info;
+
+    ASSERT_TRUE(GetUnreachableMemoryIncremental(history, info));
+    ASSERT_EQ(1U, info.leaks.size());
+  }
+
+  ptr = hidden_ptr.Get();
+
+  {
+    UnreachableMemoryInfo info;
+
+    ASSERT_TRUE(GetUnreachableMemoryIncremental(history, info));
+    ASSERT_EQ(0U, info.leaks.size());
+  }
+
+  ptr = NULL;
+  hidden_ptr.Free();
+
+  {
+    UnreachableMemoryInfo info;
+
+    ASSERT_TRUE(GetUnreachableMemoryIncremental(history, info));
+    ASSERT_EQ(0U, info.leaks.size());
+  }
+}
+
 TEST(MemunreachableTest, log) {
   HiddenPointer hidden_ptr;
 
@@ -6,12 +6,18 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := libmincrypt
 LOCAL_SRC_FILES := dsa_sig.c p256.c p256_ec.c p256_ecdsa.c rsa.c sha.c sha256.c
 LOCAL_CFLAGS := -Wall -Werror
+# Lets sha.c and sha256.c use the SHA instructions, on CPUs that have them.
+LOCAL_CFLAGS_arm64 := -march=armv8-a+crypto
+LOCAL_SRC_FILES += sha256_fd.c
 include $(BUILD_STATIC_LIBRARY)
 
 include $(CLEAR_VARS)
 LOCAL_MODULE := libmincrypt
 LOCAL_SRC_FILES := dsa_sig.c p256.c p256_ec.c p256_ecdsa.c rsa.c sha.c sha256.c
 LOCAL_CFLAGS := -Wall -Werror
+ifneq ($(HOST_OS),windows)
+LOCAL_SRC_FILES += sha256_fd.c
+endif
 include $(BUILD_HOST_STATIC_LIBRARY)
 
 include $(LOCAL_PATH)/tools/Android.mk \
@@ -75,6 +75,8 @@ static const felem kOne = {
     0x1fffffff, 0xfffffff, 0x1fbfffff, 0x1ffffff,
     0
 };
+#if !defined(__SIZEOF_INT128__)
+/* Only the 32-bit signature verification needs these, see below. */
 static const felem kZero = {0};
 static const felem kP = {
     0x1fffffff, 0xfffffff, 0x1fffffff, 0x3ff,
@@ -86,6 +88,7 @@ static const felem k2P = {
     0, 0, 0x400000, 0xe000000,
     0x1fffffff
 };
+#endif
 /* kPrecomputed contains precomputed values to aid the calculation of scalar
  * multiples of the base point, G. It's actually two, equal length, tables
  * concatenated.
@@ -756,6 +759,7 @@ static void felem_scalar_8(felem out) {
   felem_reduce_carry(out, carry);
 }
 
+#if !defined(__SIZEOF_INT128__)
 /* felem_is_zero_vartime returns 1 iff |in| == 0. It takes a variable amount of
  * time depending on the value of |in|. */
 static char felem_is_zero_vartime(const felem in) {
@@ -790,6 +794,7 @@ static char felem_is_zero_vartime(const felem in) {
          memcmp(tmp, kP, sizeof(tmp)) == 0 ||
          memcmp(tmp, k2P, sizeof(tmp)) == 0;
 }
+#endif
 
 
 /* Group operations:
@@ -870,6 +875,7 @@ static void point_add_mixed(felem x_out, felem y_out, felem z_out,
   felem_diff(y_out, y_out, tmp);
 }
 
+#if !defined(__SIZEOF_INT128__)
 /* point_add sets {x_out,y_out,z_out} = {x1,y1,z1} + {x2,y2,z2}.
  *
  * See http://www.hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-0.html#addition-add-2007-bl
@@ -970,6 +976,7 @@ static void point_add_or_double_vartime(
   felem_diff(y_out, y_out, tmp);
   felem_diff(y_out, y_out, tmp);
 }
+#endif
 
 /* copy_conditional sets out=in if mask = 0xffffffff in constant time.
  *
@@ -1007,39 +1014,6 @@ static void select_affine_point(felem out_x, felem out_y, const limb* table,
   }
 }
 
-/* select_jacobian_point sets {out_x,out_y,out_z} to the index'th entry of
- * table. On entry: index < 16, table[0] must be zero. */
-static void select_jacobian_point(felem out_x, felem out_y, felem out_z,
-                                  const limb* table, limb index) {
-  limb i, j;
-
-  memset(out_x, 0, sizeof(felem));
-  memset(out_y, 0, sizeof(felem));
-  memset(out_z, 0, sizeof(felem));
-
-  /* The implicit value at index 0 is all zero. We don't need to perform that
-   * iteration of the loop because we already set out_* to zero. */
-  table += 3 * NLIMBS;
-
-  // Hit all entries to obscure cache profiling.
-  for (i = 1; i < 16; i++) {
-    limb mask = i ^ index;
-    mask |= mask >> 2;
-    mask |= mask >> 1;
-    mask &= 1;
-    mask--;
-    for (j = 0; j < NLIMBS; j++, table++) {
-      out_x[j] |= *table & mask;
-    }
-    for (j = 0; j < NLIMBS; j++, table++) {
-      out_y[j] |= *table & mask;
-    }
-    for (j = 0; j < NLIMBS; j++, table++) {
-      out_z[j] |= *table & mask;
-    }
-  }
-}
-
 /* scalar_base_mult sets {nx,ny,nz} = scalar*G where scalar is a little-endian
  * number. Note that the value of scalar must be less than the order of the
  * group. */
@@ -1110,71 +1084,628 @@ static void point_to_affine(felem x_out, felem y_out, const felem nx,
   felem_mul(y_out, ny, z_inv);
 }
 
-/* scalar_base_mult sets {nx,ny,nz} = scalar*{x,y}. */
-static void scalar_mult(felem nx, felem ny, felem nz, const felem x,
-                        const felem y, const p256_int* scalar) {
+/* wnaf computes the width-w non-adjacent form of scalar: out[i] is 0 or
+ * an odd digit d, |d| < 2**(w-1), such that scalar = sum(out[i] * 2**i).
+ * Non-zero digits are at least w positions apart. */
+static void wnaf(signed char out[257], const p256_int* scalar, int w) {
+  int i, j, carry = 0;
+
+  memset(out, 0, 257);
+  for (i = 0; i < 257;) {
+    int bit = i < 256 ? p256_get_bit(scalar, i) : 0;
+    int word;
+
+    if (bit == carry) {
+      i++;
+      continue;
+    }
+    word = carry;
+    for (j = 0; j < w && i + j < 256; j++) {
+      word += p256_get_bit(scalar, i + j) << j;
+    }
+    if (word >= 1 << (w - 1)) {
+      out[i] = word - (1 << w);
+      carry = 1;
+    } else {
+      out[i] = word;
+      carry = 0;
+    }
+    i += w;
+  }
+}
+
+#if defined(__SIZEOF_INT128__)
+
+/* On 64-bit CPUs, signature verification, which needs neither constant
+ * time nor the felem code's care for 32-bit multipliers, does its
+ * arithmetic on four 64-bit limbs instead:
+ *
+ *   x[0] + (x[1] * 2**64) + (x[2] * 2**128) + (x[3] * 2**192)
+ *
+ * The values are in Montgomery form with R = 2**256 and always fully
+ * reduced, that is less than p. */
+typedef unsigned __int128 u128;
+typedef u64 fe64[4];
+
+static const fe64 kP64 = {
+    0xffffffffffffffff, 0x00000000ffffffff, 0x0000000000000000, 0xffffffff00000001
+};
+static const fe64 kZero64 = {0};
+/* 2**256 mod p, 1 in Montgomery form */
+static const fe64 kOne64 = {
+    0x0000000000000001, 0xffffffff00000000, 0xffffffffffffffff, 0x00000000fffffffe
+};
+/* 2**512 mod p, to convert into Montgomery form */
+static const fe64 kRR64 = {
+    0x0000000000000003, 0xfffffffbffffffff, 0xfffffffffffffffe, 0x00000004fffffffd
+};
+
+/* kOddMultiples64 contains the affine (x,y) pairs for G, 3G, 5G, ..., 63G,
+ * the multiples of the base point that the signed digits computed by
+ * wnaf() with w = 7 call for.
+ *
+ * This is 2KB of data, generated with the functions in this file. */
+static const fe64 kOddMultiples64[32 * 2] = {
+    {0x79e730d418a9143c, 0x75ba95fc5fedb601, 0x79fb732b77622510, 0x18905f76a53755c6},
+    {0xddf25357ce95560a, 0x8b4ab8e4ba19e45c, 0xd2e88688dd21f325, 0x8571ff1825885d85},
+    {0xffac3f904eebc127, 0xb027f84a087d81fb, 0x66ad77dd87cbbc98, 0x26936a3fb6ff747e},
+    {0xb04c5c1fc983a7eb, 0x583e47ad0861fe1a, 0x788208311a2ee98e, 0xd5f06a29e587cc07},
+    {0xbe1b8aaec45c61f5, 0x90ec649a94b9537d, 0x941cb5aad076c20c, 0xc9079605890523c8},
+    {0xeb309b4ae7ba4f10, 0x73c568efe5eb882b, 0x3540a9877e7a1f68, 0x73a076bb2dd1e916},
+    {0x0746354ea0173b4f, 0x2bd20213d23c00f7, 0xf43eaab50c23bb08, 0x13ba5119c3123e03},
+    {0x2847d0303f5b9d4d, 0x6742f2f25da67bdd, 0xef933bdc77c94195, 0xeaedd9156e240867},
+    {0x75c96e8f264e20e8, 0xabe6bfed59a7a841, 0x2cc09c0444c8eb00, 0xe05b3080f0c4e16b},
+    {0x1eb7777aa45f3314, 0x56af7bedce5d45e3, 0x2b6e019a88b12f1a, 0x086659cdfd835f9b},
+    {0xea7d260a6245e404, 0x9de407956e7fdfe0, 0x1ff3a4158dac1ab5, 0x3e7090f1649c9073},
+    {0x1a7685612b944e88, 0x250f939ee57f61c8, 0x0c0daa891ead643d, 0x68930023e125b88e},
+    {0xccc425634b2ed709, 0x0e356769856fd30d, 0xbcbcd43f559e9811, 0x738477ac5395b759},
+    {0x35752b90c00ee17f, 0x68748390742ed2e3, 0x7cd06422bd1f5bc1, 0xfbc08769c9e7b797},
+    {0x72bcd8b7bc60055b, 0x03cc23ee56e27e4b, 0xee337424e4819370, 0xe2aa0e430ad3da09},
+    {0x40b8524f6383c45d, 0xd766355442a41b25, 0x64efa6de778a4797, 0x2042170a7079adf4},
+    {0x97091dcbd53c5c9d, 0xf17624b6ac0a177b, 0xb0f139752cfe2dff, 0xc1a35c0a6c7a574e},
+    {0x227d314693e79987, 0x0575bf30e89cb80e, 0x2f4e247f0d1883bb, 0xebd512263274c3d0},
+    {0xfea912baa5659ae8, 0x68363aba25e1a16e, 0xb8842277752c41ac, 0xfe545c282897c3fc},
+    {0x2d36e9e7dc4c696b, 0x5806244afba977c5, 0x85665e9be39508c1, 0xf720ee256d12597b},
+    {0x562e4cecc135b208, 0x74e1b2654783f47d, 0x6d2a506c5a3f3b30, 0xecead9f4c16762fc},
+    {0xf29dd4b2e286e5b9, 0x1b0fadc083bb3c61, 0x7a75023e7fac29a4, 0xc086d5f1c9477fa3},
+    {0xf4f876532de45068, 0x37c7a7e89e2e1f6e, 0xd0825fa2a3584069, 0xaf2cea7c1727bf42},
+    {0x0360a4fb9e4785a9, 0xe5fda49c27299f4a, 0x48068e1371ac2f71, 0x83d0687b9077666f},
+    {0xa4a319acd837879f, 0x6fc1b49eed6b67b0, 0xe395993332f1f3af, 0x966742eb65432a2e},
+    {0x4b8dc9feb4966228, 0x96cc631243f43950, 0x12068859c9b731ee, 0x7b948dc356f79968},
+    {0x042c2af497e2feb4, 0xd36a42d7aebf7313, 0x49d2c9eb084ffdd7, 0x9f8aa54b2ef7c76a},
+    {0x9200b7ba09895e70, 0x3bd0c66fddb7fb58, 0x2d97d10878eb4cbb, 0x2d431068d84bde31},
+    {0x5e5db46acb66e132, 0xf1be963a0d925880, 0x944a70270317b9e2, 0xe266f95948603d48},
+    {0x98db66735c208899, 0x90472447a2fb18a3, 0x8a966939777c619f, 0x3798142a2a3be21b},
+    {0xe2f73c696755ff89, 0xdd3cf7e7473017e6, 0x8ef5689d3cf7600d, 0x948dc4f8b1fc87b4},
+    {0xd9e9fe814ea53299, 0x2d921ca298eb6028, 0xfaecedfd0c9803fc, 0xf38ae8914d7b4745},
+    {0x871514560f664534, 0x85ceae7c4b68f103, 0xac09c4ae65578ab9, 0x33ec6868f044b10c},
+    {0x6ac4832b3a8ec1f1, 0x5509d1285847d5ef, 0xf909604f763f1574, 0xb16c4303c32f63c4},
+    {0xfd16847fdec67ef5, 0x742ee464233e76b7, 0x0b8e4134efc2b4c8, 0xca640b8642a3e521},
+    {0x653a01908ceb6aa9, 0x313c300c547852d5, 0x24e4ab126b237af7, 0x2ba901628bb47af8},
+    {0x00467bc58cce08b5, 0xb636458c7f178d55, 0xc5748baea677d806, 0x2763a387dfa394eb},
+    {0xa12b448a7d3cebb6, 0xe7adda3e6f20d850, 0xf63ebce51558462c, 0x58b36143620088a8},
+    {0xa9d89488a059c142, 0x6f5ae714ff0b9346, 0x068f237d16fb3664, 0x5853e4c4363186ac},
+    {0xe2d87d2363c52f98, 0x2ec4a76681828876, 0x47b864fae14e7b1c, 0x0c0bc0e569192408},
+    {0x624d60492ed22e91, 0x6fdfe0b56f072822, 0xeeca111539ce2271, 0x98100a4fdb01614f},
+    {0xb6b0daa2a35c628f, 0xb6f94d2ec87e9a47, 0xc67732591d57d9ce, 0xf70bfeec03884a7b},
+    {0x4ff23ffd248a7d06, 0x80c5bfb4878873fa, 0xb7d9ad9005745981, 0x179c85db3db01994},
+    {0xba41b06261a6966c, 0x4d82d052eadce5a8, 0x9e91cd3ba5e6a318, 0x47795f4f95b2dda0},
+    {0x1ee426ccd5cd79bf, 0x0032940b946c6e18, 0x1b1e8ae057477f58, 0xe94f7d346d823278},
+    {0xc747cb96782ba21a, 0xc5254469f72b33a5, 0x772ef6dec7f80c81, 0xd73acbfe2cd9e6b5},
+    {0x283c7513caa76097, 0x0a624fa936c83906, 0x6b20afec715af2c7, 0x4b969974eba78bfd},
+    {0x220755ccd921d60e, 0x9b944e107baeca13, 0x04819d515ded93d4, 0x9bbff86e6dddfd27},
+    {0x21950b421ff6acd3, 0xffe7048453dc6909, 0xff4cd0b228766127, 0xabdbe6084fb7db2b},
+    {0x837c92285e1109e8, 0x26147d27f4645b5a, 0x4d78f592f7818ed8, 0xd394077ef247fa36},
+    {0x508cec1c3b3f64c9, 0xe20bc0ba1e5edf3f, 0xda1deb852f4318d4, 0xd20ebe0d5c3fa443},
+    {0x370b4ea773241ea3, 0x61f1511c5e1a5f65, 0x99a5e23d82681c62, 0xd731e383a2f54c2d},
+    {0x97359638546c4d8d, 0x5f9c3fc492f24679, 0x912e8beda8c8acd9, 0xec3a318d306634b0},
+    {0x80167f41c31cb264, 0x3db82f6f522113f2, 0xb155bcd2dcafe197, 0xfba1da5943465283},
+    {0x258bbbf9e7305683, 0x31eea5bf07ef5be6, 0x0deb0e4a46c814c1, 0x5cee8449a7b730dd},
+    {0xeab495c5a0182bde, 0xee759f879e27a6b4, 0xc2cf6a6880e518ca, 0x25e8013ff14cf3f4},
+    {0x3ec832e77acaca28, 0x1bfeea57c7385b29, 0x068212e3fd1eaf38, 0xc13298306acf8ccc},
+    {0xb909f2db2aac9e59, 0x5748060db661782a, 0xc5ab2632c79b7a01, 0xda44c6c600017626},
+    {0x69d44ed65c46aa8e, 0x2100d5d3a8d063d1, 0xcb9727eaa2d17c36, 0x4c2bab1b8add53b7},
+    {0xa084e90c15426704, 0x778afcd3a837ebea, 0x6651f7017ce477f8, 0xa062499846fb7a8b},
+    {0x3667eb1a7f4c04cc, 0x59556621a9404f84, 0x71cdf6537eceb50a, 0x994a44a69b8335fa},
+    {0xd7faf819dbeb9b69, 0x473c5680eed4350d, 0xb6658466da44bba2, 0x0d1bc780872bdbf3},
+    {0xb8d3d9319ff91fe5, 0x039c4800f0518eed, 0x95c376329182cb26, 0x0763a43482fc568d},
+    {0x707c04d5383e76ba, 0xac98b930824e8197, 0x92bf7c8f91230de0, 0x90876a0140959b70},
+};
+
+/* fe64_sub_p sets out = in - p if in + carry*2**256 >= p, else out = in. */
+static void fe64_sub_p(fe64 out, const fe64 in, u64 carry) {
+  fe64 tmp;
+  u64 borrow = 0;
   int i;
-  felem px, py, pz, tx, ty, tz;
-  felem precomp[16][3];
-  limb n_is_infinity_mask, index, p_is_noninfinite_mask, mask;
-
-  /* We precompute 0,1,2,... times {x,y}. */
-  memset(precomp, 0, sizeof(felem) * 3);
-  memcpy(&precomp[1][0], x, sizeof(felem));
-  memcpy(&precomp[1][1], y, sizeof(felem));
-  memcpy(&precomp[1][2], kOne, sizeof(felem));
-
-  for (i = 2; i < 16; i += 2) {
-    point_double(precomp[i][0], precomp[i][1], precomp[i][2],
-                 precomp[i / 2][0], precomp[i / 2][1], precomp[i / 2][2]);
-
-    point_add_mixed(precomp[i + 1][0], precomp[i + 1][1], precomp[i + 1][2],
-                    precomp[i][0], precomp[i][1], precomp[i][2], x, y);
+
+  for (i = 0; i < 4; i++) {
+    u128 d = (u128)in[i] - kP64[i] - borrow;
+    tmp[i] = (u64)d;
+    borrow = (u64)(d >> 64) & 1;
+  }
+  if (carry || !borrow) {
+    memcpy(out, tmp, sizeof(fe64));
+  } else if (out != in) {
+    memcpy(out, in, sizeof(fe64));
   }
+}
 
-  memset(nx, 0, sizeof(felem));
-  memset(ny, 0, sizeof(felem));
-  memset(nz, 0, sizeof(felem));
-  n_is_infinity_mask = -1;
+static void fe64_add(fe64 out, const fe64 a, const fe64 b) {
+  u128 t = 0;
+  int i;
 
-  /* We add in a window of four bits each iteration and do this 64 times. */
-  for (i = 0; i < 256; i += 4) {
-    if (i) {
-      point_double(nx, ny, nz, nx, ny, nz);
-      point_double(nx, ny, nz, nx, ny, nz);
-      point_double(nx, ny, nz, nx, ny, nz);
-      point_double(nx, ny, nz, nx, ny, nz);
+  for (i = 0; i < 4; i++) {
+    t += (u128)a[i] + b[i];
+    out[i] = (u64)t;
+    t >>= 64;
+  }
+  fe64_sub_p(out, out, (u64)t);
+}
+
+static void fe64_sub(fe64 out, const fe64 a, const fe64 b) {
+  u64 borrow = 0;
+  u128 t = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    u128 d = (u128)a[i] - b[i] - borrow;
+    out[i] = (u64)d;
+    borrow = (u64)(d >> 64) & 1;
+  }
+  if (borrow) {
+    for (i = 0; i < 4; i++) {
+      t += (u128)out[i] + kP64[i];
+      out[i] = (u64)t;
+      t >>= 64;
+    }
+  }
+}
+
+/* fe64_mul sets out = a*b/R mod p. As p = -1 mod 2**64, -1/p mod 2**64 is
+ * 1 and each step of the reduction adds a multiple of p equal to the
+ * lowest limb. The partial result stays below 2p, in four limbs and a
+ * carry bit, so only the final one is reduced. */
+static void fe64_mul(fe64 out, const fe64 a, const fe64 b) {
+  u64 c[4] = { 0, 0, 0, 0 };
+  u64 carry = 0;
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    u128 A = (u128)a[i] * b[0] + c[0];
+    u64 d0 = (u64)A;
+    u128 B = (u128)d0 * kP64[0] + (u64)A;
+
+    for (j = 1; j < 4; j++) {
+      A = (A >> 64) + (u128)a[i] * b[j] + c[j];
+      B = (B >> 64) + (u128)d0 * kP64[j] + (u64)A;
+      c[j - 1] = (u64)B;
+    }
+    A = (A >> 64) + (B >> 64) + carry;
+    c[3] = (u64)A;
+    carry = (u64)(A >> 64);
+  }
+  fe64_sub_p(out, c, carry);
+}
+
+static void fe64_square(fe64 out, const fe64 in) {
+  fe64_mul(out, in, in);
+}
+
+static char fe64_is_zero(const fe64 in) {
+  return (in[0] | in[1] | in[2] | in[3]) == 0;
+}
+
+/* fe64_inv sets out = in**-1, with the same chain as felem_inv(). */
+static void fe64_inv(fe64 out, const fe64 in) {
+  fe64 ftmp, ftmp2;
+  /* each e_I will hold |in|^{2^I - 1} */
+  fe64 e2, e4, e8, e16, e32, e64;
+  unsigned i;
+
+  fe64_square(ftmp, in); /* 2^1 */
+  fe64_mul(ftmp, in, ftmp); /* 2^2 - 2^0 */
+  memcpy(e2, ftmp, sizeof(fe64));
+  fe64_square(ftmp, ftmp); /* 2^3 - 2^1 */
+  fe64_square(ftmp, ftmp); /* 2^4 - 2^2 */
+  fe64_mul(ftmp, ftmp, e2); /* 2^4 - 2^0 */
+  memcpy(e4, ftmp, sizeof(fe64));
+  for (i = 0; i < 4; i++) {
+    fe64_square(ftmp, ftmp);
+  } /* 2^8 - 2^4 */
+  fe64_mul(ftmp, ftmp, e4); /* 2^8 - 2^0 */
+  memcpy(e8, ftmp, sizeof(fe64));
+  for (i = 0; i < 8; i++) {
+    fe64_square(ftmp, ftmp);
+  } /* 2^16 - 2^8 */
+  fe64_mul(ftmp, ftmp, e8); /* 2^16 - 2^0 */
+  memcpy(e16, ftmp, sizeof(fe64));
+  for (i = 0; i < 16; i++) {
+    fe64_square(ftmp, ftmp);
+  } /* 2^32 - 2^16 */
+  fe64_mul(ftmp, ftmp, e16); /* 2^32 - 2^0 */
+  memcpy(e32, ftmp, sizeof(fe64));
+  for (i = 0; i < 32; i++) {
+    fe64_square(ftmp, ftmp);
+  } /* 2^64 - 2^32 */
+  memcpy(e64, ftmp, sizeof(fe64));
+  fe64_mul(ftmp, ftmp, in); /* 2^64 - 2^32 + 2^0 */
+  for (i = 0; i < 192; i++) {
+    fe64_square(ftmp, ftmp);
+  } /* 2^256 - 2^224 + 2^192 */
+
+  fe64_mul(ftmp2, e64, e32); /* 2^64 - 2^0 */
+  for (i = 0; i < 16; i++) {
+    fe64_square(ftmp2, ftmp2);
+  } /* 2^80 - 2^16 */
+  fe64_mul(ftmp2, ftmp2, e16); /* 2^80 - 2^0 */
+  for (i = 0; i < 8; i++) {
+    fe64_square(ftmp2, ftmp2);
+  } /* 2^88 - 2^8 */
+  fe64_mul(ftmp2, ftmp2, e8); /* 2^88 - 2^0 */
+  for (i = 0; i < 4; i++) {
+    fe64_square(ftmp2, ftmp2);
+  } /* 2^92 - 2^4 */
+  fe64_mul(ftmp2, ftmp2, e4); /* 2^92 - 2^0 */
+  fe64_square(ftmp2, ftmp2); /* 2^93 - 2^1 */
+  fe64_square(ftmp2, ftmp2); /* 2^94 - 2^2 */
+  fe64_mul(ftmp2, ftmp2, e2); /* 2^94 - 2^0 */
+  fe64_square(ftmp2, ftmp2); /* 2^95 - 2^1 */
+  fe64_square(ftmp2, ftmp2); /* 2^96 - 2^2 */
+  fe64_mul(ftmp2, ftmp2, in); /* 2^96 - 3 */
+
+  fe64_mul(out, ftmp2, ftmp); /* 2^256 - 2^224 + 2^192 + 2^96 - 3 */
+}
+
+static void fe64_from_p256(fe64 out, const p256_int* in) {
+  fe64 tmp;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    tmp[i] = P256_DIGIT(in, 2 * i) | (u64)P256_DIGIT(in, 2 * i + 1) << 32;
+  }
+  /* in may be up to 2**256 - 1; the multiplication reduces it. */
+  fe64_mul(out, tmp, kRR64);
+}
+
+static void fe64_to_p256(p256_int* out, const fe64 in) {
+  static const fe64 kPlainOne = { 1, 0, 0, 0 };
+  fe64 tmp;
+  int i;
+
+  fe64_mul(tmp, in, kPlainOne);
+  for (i = 0; i < 4; i++) {
+    P256_DIGIT(out, 2 * i) = (p256_digit)tmp[i];
+    P256_DIGIT(out, 2 * i + 1) = (p256_digit)(tmp[i] >> 32);
+  }
+}
+
+/* point64_double is point_double() on fe64s. */
+static void point64_double(fe64 x_out, fe64 y_out, fe64 z_out, const fe64 x,
+                           const fe64 y, const fe64 z) {
+  fe64 delta, gamma, alpha, beta, tmp, tmp2;
+
+  fe64_square(delta, z);
+  fe64_square(gamma, y);
+  fe64_mul(beta, x, gamma);
+
+  fe64_add(tmp, x, delta);
+  fe64_sub(tmp2, x, delta);
+  fe64_mul(alpha, tmp, tmp2);
+  fe64_add(tmp, alpha, alpha);
+  fe64_add(alpha, tmp, alpha);
+
+  fe64_add(tmp, y, z);
+  fe64_square(tmp, tmp);
+  fe64_sub(tmp, tmp, gamma);
+  fe64_sub(z_out, tmp, delta);
+
+  fe64_add(beta, beta, beta);
+  fe64_add(beta, beta, beta);
+  fe64_square(x_out, alpha);
+  fe64_sub(x_out, x_out, beta);
+  fe64_sub(x_out, x_out, beta);
+
+  fe64_sub(tmp, beta, x_out);
+  fe64_mul(tmp, alpha, tmp);
+  fe64_square(tmp2, gamma);
+  fe64_add(tmp2, tmp2, tmp2);
+  fe64_add(tmp2, tmp2, tmp2);
+  fe64_add(tmp2, tmp2, tmp2);
+  fe64_sub(y_out, tmp, tmp2);
+}
+
+/* point64_add_vartime sets {x,y,z} += {x2,y2,z2}, negated first if negate
+ * is set. *is_infinity tracks whether {x,y,z} is the point at infinity. A
+ * z2 of NULL stands for 1, an affine point.
+ *
+ * See http://www.hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-0.html#addition-add-2007-bl */
+static void point64_add_vartime(fe64 x, fe64 y, fe64 z, char* is_infinity,
+                                const fe64 x2, const fe64 y2, const fe64 z2,
+                                char negate) {
+  fe64 z1z1, z1z1z1, z2z2, z2z2z2, s1, s2, u1, u2, h, i, j, r, rr, v, tmp;
+  fe64 neg_y2;
+
+  if (negate) {
+    fe64_sub(neg_y2, kZero64, y2);
+    y2 = neg_y2;
+  }
+  if (*is_infinity) {
+    memcpy(x, x2, sizeof(fe64));
+    memcpy(y, y2, sizeof(fe64));
+    memcpy(z, z2 ? z2 : kOne64, sizeof(fe64));
+    *is_infinity = 0;
+    return;
+  }
+
+  fe64_square(z1z1, z);
+  if (z2) {
+    fe64_square(z2z2, z2);
+    fe64_mul(u1, x, z2z2);
+    fe64_mul(z2z2z2, z2, z2z2);
+    fe64_mul(s1, y, z2z2z2);
+  } else {
+    memcpy(u1, x, sizeof(fe64));
+    memcpy(s1, y, sizeof(fe64));
+  }
+
+  fe64_mul(u2, x2, z1z1);
+  fe64_mul(z1z1z1, z, z1z1);
+  fe64_mul(s2, y2, z1z1z1);
+  fe64_sub(h, u2, u1);
+  fe64_sub(r, s2, s1);
+  if (fe64_is_zero(h)) {
+    if (fe64_is_zero(r)) {
+      point64_double(x, y, z, x, y, z);
+    } else {
+      *is_infinity = 1;
     }
+    return;
+  }
+  fe64_add(i, h, h);
+  fe64_square(i, i);
+  fe64_mul(j, h, i);
+  fe64_add(r, r, r);
+  fe64_mul(v, u1, i);
+
+  /* z_out = ((z1 + z2)**2 - z1z1 - z2z2) * h = 2 * z1 * z2 * h */
+  if (z2) {
+    fe64_mul(tmp, z, z2);
+  } else {
+    memcpy(tmp, z, sizeof(fe64));
+  }
+  fe64_add(tmp, tmp, tmp);
+  fe64_mul(z, tmp, h);
+  fe64_square(rr, r);
+  fe64_sub(x, rr, j);
+  fe64_sub(x, x, v);
+  fe64_sub(x, x, v);
+
+  fe64_sub(tmp, v, x);
+  fe64_mul(y, tmp, r);
+  fe64_mul(tmp, s1, j);
+  fe64_sub(y, y, tmp);
+  fe64_sub(y, y, tmp);
+}
 
-    index = (p256_get_bit(scalar, 255 - i - 0) << 3) |
-            (p256_get_bit(scalar, 255 - i - 1) << 2) |
-            (p256_get_bit(scalar, 255 - i - 2) << 1) |
-            p256_get_bit(scalar, 255 - i - 3);
-
-    /* See the comments in scalar_base_mult about handling infinities. */
-    select_jacobian_point(px, py, pz, precomp[0][0], index);
-    point_add(tx, ty, tz, nx, ny, nz, px, py, pz);
-    copy_conditional(nx, px, n_is_infinity_mask);
-    copy_conditional(ny, py, n_is_infinity_mask);
-    copy_conditional(nz, pz, n_is_infinity_mask);
-
-    p_is_noninfinite_mask = NON_ZERO_TO_ALL_ONES(index);
-    mask = p_is_noninfinite_mask & ~n_is_infinity_mask;
-
-    copy_conditional(nx, tx, mask);
-    copy_conditional(ny, ty, mask);
-    copy_conditional(nz, tz, mask);
-    n_is_infinity_mask &= ~p_is_noninfinite_mask;
+/* points_mul_vartime sets {out_x,out_y} = n1*G + n2*{in_x,in_y}, or zero
+ * if that is the point at infinity.
+ *
+ * The two multiplications are interleaved, as in Shamir's trick, sharing
+ * the doublings, with both scalars in wNAF form so that few additions
+ * are needed. The odd multiples of G come from kOddMultiples64, those of
+ * {in_x,in_y} are computed here. */
+static void points_mul_vartime(const p256_int* n1, const p256_int* n2,
+                               const p256_int* in_x, const p256_int* in_y,
+                               p256_int* out_x, p256_int* out_y) {
+  signed char naf1[257], naf2[257];
+  fe64 precomp[8][3];
+  fe64 x, y, z, x2, y2, z2;
+  char is_infinity, precomp_is_infinity = 0;
+  int i;
+
+  wnaf(naf1, n1, 7);
+  wnaf(naf2, n2, 5);
+
+  /* precomp[i] is (2i+1)*{in_x,in_y}. */
+  fe64_from_p256(precomp[0][0], in_x);
+  fe64_from_p256(precomp[0][1], in_y);
+  memcpy(precomp[0][2], kOne64, sizeof(fe64));
+  point64_double(x2, y2, z2, precomp[0][0], precomp[0][1], precomp[0][2]);
+  for (i = 1; i < 8; i++) {
+    memcpy(precomp[i], precomp[i - 1], sizeof(precomp[i]));
+    point64_add_vartime(precomp[i][0], precomp[i][1], precomp[i][2],
+                        &precomp_is_infinity, x2, y2, z2, 0);
+  }
+
+  is_infinity = 1;
+  for (i = 256; i >= 0; i--) {
+    if (!is_infinity) {
+      point64_double(x, y, z, x, y, z);
+    }
+    if (naf1[i]) {
+      const fe64* entry = kOddMultiples64 + (abs(naf1[i]) >> 1) * 2;
+      point64_add_vartime(x, y, z, &is_infinity, entry[0], entry[1], NULL,
+                          naf1[i] < 0);
+    }
+    if (naf2[i]) {
+      fe64* entry = precomp[abs(naf2[i]) >> 1];
+      point64_add_vartime(x, y, z, &is_infinity, entry[0], entry[1], entry[2],
+                          naf2[i] < 0);
+    }
+  }
+
+  if (is_infinity) {
+    p256_clear(out_x);
+    p256_clear(out_y);
+    return;
+  }
+
+  /* Back to affine coordinates. */
+  fe64_inv(z2, z);
+  fe64_square(x2, z2);
+  fe64_mul(y2, z2, x2);
+  fe64_mul(x, x, x2);
+  fe64_mul(y, y, y2);
+  fe64_to_p256(out_x, x);
+  fe64_to_p256(out_y, y);
+}
+
+#else
+
+/* kOddMultiples contains the affine (x,y) felem pairs for G, 3G, 5G, ...,
+ * 63G, the multiples of the base point that the signed digits computed by
+ * wnaf() with w = 7 call for.
+ *
+ * This is ~2KB of data, generated with the functions in this file. */
+static const limb kOddMultiples[NLIMBS * 2 * 32] = {
+    0x11522878, 0xe730d41, 0xdb60179, 0x4afe2ff, 0x12883add, 0xcaddd88, 0x119e7edc, 0xd4a6eab, 0x3120bee,
+    0x1d2aac15, 0xf25357c, 0x19e45cdd, 0x5c721d0, 0x1992c5a5, 0xa237487, 0x154ba21, 0x14b10bb, 0xae3fe3,
+    0x1dd7824e, 0xac3f904, 0x1d81fbff, 0xfc25043, 0x1e4c5813, 0xf761f2e, 0x1f99ab5d, 0xf6dfee8, 0x4d26d47,
+    0x13074fd7, 0x4c5c1fc, 0x1fe1ab0, 0x23d6443, 0x14c72c1f, 0xc468bb, 0x1be2082, 0x4cb0f98, 0xabe0d45,
+    0x8b8c3eb, 0x1b8aaec, 0x19537dbe, 0x324d0a5, 0x1064876, 0x6ab41db, 0x1205072d, 0xc120a47, 0x920f2c0,
+    0xf749e20, 0x309b4ae, 0xb882beb, 0xb477f2f, 0xfb439e2, 0x61df9e8, 0x58d502a, 0x65ba3d2, 0xe740ed7,
+    0x2e769e, 0x46354ea, 0x1c00f707, 0x109e91, 0x1d8415e9, 0xad4308e, 0xfd0faa, 0x386247c, 0x2774a23,
+    0x1eb73a9b, 0x47d0303, 0x67bdd28, 0x7978eed, 0xcab3a1, 0xf71df25, 0x19dbe4ce, 0xbdc4810, 0xd5dbb22,
+    0xc9c41d1, 0xc96e8f2, 0x7a84175, 0x5ff66cd, 0x158055f3, 0x111323, 0x1aab3027, 0x2e189c2, 0xc0b6610,
+    0x8be6628, 0xb7777aa, 0x1d45e31e, 0xbdf6e72, 0x178d2b57, 0x66a22c4, 0x6cadb80, 0xbfb06bf, 0x10ccb39,
+    0x48bc808, 0x7d260a6, 0x1fdfe0ea, 0x3cab73, 0xd5acef2, 0x5636b0, 0x1cc7fce9, 0x2c93920, 0x7ce121e,
+    0x17289d10, 0x7685612, 0x1f61c81a, 0xc9cf72b, 0x121e9287, 0xa247ab5, 0x383036a, 0x7c24b71, 0xd126004,
+    0x165dae12, 0xc425634, 0xfd30dcc, 0xb3b4c2b, 0xc08871a, 0xfd567a, 0x166f2f35, 0x8a72b6e, 0xe708ef5,
+    0x1dc2ff, 0x752b90c, 0xed2e335, 0x41c7fa1, 0xde0b43a, 0x8af47d, 0x5bf3419, 0x493cf6f, 0xf7810ed,
+    0x18c00ab7, 0xbcd8b7b, 0x27e4b72, 0x11f6eb7, 0x9b801e6, 0x939206, 0x25b8cdd, 0x715a7b4, 0xc5541c8,
+    0x70788ba, 0xb8524f6, 0x41b2540, 0x1aaa215, 0x3cbebb3, 0xb79de29, 0x1d193be9, 0x4e0f35b, 0x40842e1,
+    0xa78b93b, 0x91dcbd, 0xa177b97, 0x125b160, 0x16fff8bb, 0x5d4b3f8, 0x138c3c4e, 0x5d8f4ae, 0x8346b81,
+    0x7cf330f, 0x7d31469, 0x1cb80e22, 0xdf98344, 0x1dd82ba, 0x1fc3462, 0x13ebd389, 0xd64e987, 0xd7aa244,
+    0xacb35d1, 0xa912baa, 0x1a16efe, 0x1d5cd2f, 0xd6341b, 0x9ddd4b1, 0x1f0e2108, 0x1512f87, 0xfca8b85,
+    0x1898d2d7, 0x36e9e7d, 0x977c52d, 0x12253dd, 0x460ac03, 0xa6f8e54, 0x1ec15997, 0xbda24b2, 0xee41dc4,
+    0x26b6411, 0x2e4cecc, 0x3f47d56, 0xd93263c, 0x1d983a70, 0x1b168fc, 0x1efb4a94, 0xa82cec5, 0xd9d5b3e,
+    0x50dcb73, 0x9dd4b2e, 0x1b3c61f2, 0xd6e001d, 0x14d20d87, 0x8f9feb0, 0x8be9d40, 0x4928eff, 0x810dabe,
+    0x1bc8a0d1, 0xf876532, 0xe1f6ef4, 0xd3f40f1, 0x349be3, 0xe8a8d61, 0x10942097, 0x92e4f7e, 0x5e59d4f,
+    0x1c8f0b53, 0x60a4fb9, 0x99f4a03, 0xd24dd39, 0x17b8f2fe, 0x84dc6b0, 0x1bb201a3, 0x820eecc, 0x7a0d0f,
+    0x106f0f3f, 0xa319acd, 0xb67b0a4, 0xda4f36b, 0x19d7b7e0, 0x4cccbc7, 0xb98e566, 0x7ca8654, 0x2cce85d,
+    0x92cc450, 0x8dc9feb, 0x1439504b, 0x318921f, 0x18f74b66, 0x16726dc, 0x1a0481a2, 0x6adef32, 0xf7291b8,
+    0xfc5fd69, 0x2c2af49, 0x1f731304, 0x216b975, 0x1eebe9b5, 0x7ac213f, 0x1a7274b2, 0x75def8e, 0x3f154a9,
+    0x1312bce0, 0xb7ba0, 0x17fb5892, 0x6337eed, 0x65d9de8, 0x421e3ad, 0xc4b65f4, 0x1b097bc, 0x5a8620d,
+    0x16cdc265, 0x5db46ac, 0x1258805e, 0x4b1cc6c, 0x1cf178df, 0x9c0c5e, 0x1205129c, 0x390c07a, 0xc4cdf2b,
+    0x18411132, 0xdb66735, 0x1b18a398, 0x9223d17, 0x10cfc823, 0x4e5ddf1, 0x6e2a59a, 0x45477c4, 0x6f30285,
+    0xeabff13, 0xf73c696, 0x1017e6e2, 0x7bf3639, 0x1006ee9e, 0x274f3dd, 0xd03bd5a, 0x263f90f, 0x291b89f,
+    0x1d4a6533, 0xe9fe814, 0xb6028d9, 0xe510c7, 0x1fe16c9, 0x7f43260, 0x115ebb3b, 0x39af68e, 0xe715d12,
+    0x1ecc8a68, 0x1514560, 0x8f10387, 0x573e25b, 0x55cc2e7, 0x2b9955e, 0x32b0271, 0x1e08962, 0x67d8d0d,
+    0x151d83e3, 0xc4832b3, 0x7d5ef6a, 0xe893ec2, 0xaba2a84, 0x13dd8fc, 0x111e4258, 0x8865ec7, 0x62d8860,
+    0x1d8cfdeb, 0x16847fd, 0x1e76b7fd, 0x7231d19, 0x1a643a17, 0x4d3bf0a, 0x822e390, 0xd8547ca, 0x94c8170,
+    0x19d6d552, 0x3a01908, 0x1852d565, 0x18062a3, 0x1d7b989e, 0xc49ac8d, 0x1e09392a, 0x51768f5, 0x575202c,
+    0x199c116a, 0x467bc58, 0x178d5500, 0x22c63f8, 0xc035b1b, 0xeba99df, 0x1af15d22, 0xfbf4729, 0x4ec7470,
+    0x1a79d76c, 0x2b448a7, 0xd850a1, 0xed1f379, 0x31673d6, 0x3945561, 0xa3d8faf, 0x6c40111, 0xb166c28,
+    0xb38284, 0xd89488a, 0xb9346a9, 0x738a7f8, 0x1b3237ad, 0xdf45bec, 0xb01a3c8, 0x86c630d, 0xb0a7c98,
+    0x78a5f30, 0xd87d236, 0x28876e2, 0x53b340c, 0x1d8e1762, 0x3eb8539, 0x211ee19, 0xad23248, 0x181781c,
+    0x1da45d23, 0x4d60492, 0x7282262, 0xf05a778, 0x1138b7ef, 0x454e738, 0x13dbb284, 0xb602c2, 0x302014a,
+    0x6b8c51f, 0xb0daa2a, 0x1e9a47b6, 0xa697243, 0xce75b7c, 0x964755f, 0x1ed19dcc, 0x9071094, 0xee17fdd,
+    0x914fa0c, 0xf23ffd2, 0x873fa4f, 0xdfda43c, 0xcc0c062, 0x64015d1, 0x52df66b, 0x67b6033, 0x2f390bb,
+    0x34d2cd8, 0x41b0626, 0x1ce5a8ba, 0x6829756, 0x118c26c1, 0x4ee979a, 0x827a473, 0xf2b65bb, 0x8ef2be9,
+    0xb9af37f, 0xe426ccd, 0xc6e181e, 0x4a058a3, 0x1fac0019, 0xb815d1d, 0x1de6c7a2, 0x9db0464, 0xd29efa6,
+    0x10574435, 0x47cb967, 0xb33a5c7, 0xa234bb9, 0x640e292, 0xb7b1fe0, 0xd3dcbbd, 0xd59b3cd, 0xae7597f,
+    0x154ec12e, 0x3c7513c, 0x8390628, 0x27d49b6, 0x19638531, 0xfb1c56b, 0x1f5ac82b, 0x9d74f17, 0x972d32e,
+    0x1243ac1d, 0x755ccd, 0xeca1322, 0x2707fdd, 0x9ea4dca, 0x54577b6, 0x9a12067, 0xddbbbfa, 0x377ff0d,
+    0x1fed59a7, 0x950b421, 0x1c690921, 0x8241e9e, 0x1093fff3, 0x2c8a1d9, 0xadfd334, 0x19f6fb6, 0x57b7cc1,
+    0x1c2213d1, 0x7c92285, 0x45b5a83, 0x3e93ba3, 0x76c130a, 0x64bde06, 0xd735e3d, 0xee48ff4, 0xa7280ef,
+    0x167ec993, 0x8cec1c3, 0x1edf3f50, 0xe05ccf2, 0xc6a7105, 0xe14bd0c, 0x10d6877a, 0xbb87f48, 0xa41d7c1,
+    0x6483d47, 0xb4ea77, 0x1a5f6537, 0xa88def0, 0xe3130f8, 0x8f609a0, 0xb466978, 0x845ea98, 0xae63c70,
+    0x8d89b1b, 0x3596385, 0x12467997, 0x1fe2097, 0x166cafce, 0xfb6a322, 0xc044ba2, 0xb60cc69, 0xd874631,
+    0x63964c9, 0x167f41c, 0x113f280, 0x17b7691, 0x10cb9edc, 0x34b72bf, 0xcc556f, 0x3868ca5, 0xf743b4b,
+    0xe60ad06, 0x8bbbf9e, 0xf5be625, 0x52df83f, 0xa6098f7, 0x9291b20, 0x17437ac3, 0x34f6e61, 0xb9dd089,
+    0x3057bc, 0xb495c5a, 0x7a6b4ea, 0xcfc3cf1, 0xc65773a, 0x9a20394, 0x1d30b3da, 0xfe299e7, 0x4bd0027,
+    0x15959451, 0xc832e77, 0x185b293e, 0x752ba39, 0x179c0dff, 0xb8ff47a, 0x12e1a084, 0x1d59f19, 0x8265306,
+    0x15593cb3, 0x9f2db2, 0x1782ab9, 0x3069b3, 0x1d00aba4, 0x8cb1e6d, 0x9916ac9, 0xd0002ec, 0xb4898d8,
+    0x188d551c, 0xd44ed65, 0x1063d169, 0x6ae9d46, 0x1e1b1080, 0xfaa8b45, 0xdf2e5c9, 0x715baa7, 0x9857563,
+    0xa84ce09, 0x84e90c1, 0x17ebeaa0, 0x7e69941, 0x1bfc3bc5, 0xc05f391, 0x2b9947d, 0x18df6f5, 0x40c4933,
+    0x1e980999, 0x67eb1a7, 0x4f8436, 0xb31094a, 0x1a852caa, 0x94dfb3a, 0x1e7c737d, 0xe37066b, 0x3294894,
+    0x17d736d2, 0xfaf819d, 0x14350dd7, 0x2b40776, 0x1dd1239e, 0x19b6912, 0x1ced9961, 0x10e57b7, 0x1a378f0,
+    0x1ff23fca, 0xd3d9319, 0x118eedb8, 0x2400782, 0x59301ce, 0x8ca460b, 0x36570dd, 0x905f8ad, 0xec7486,
+    0x107ced75, 0x7c04d53, 0xe819770, 0x5c98012, 0x6f0564c, 0x23e448c, 0x1c04afdf, 0x3812b36, 0x210ed40,
+};
+
+/* add_vartime sets {x,y,z} += {x2,y2,z2}, negated first if negate is set.
+ * *is_infinity tracks whether {x,y,z} is the point at infinity, which the
+ * group operations can't represent. */
+static void add_vartime(felem x, felem y, felem z, char* is_infinity,
+                        const felem x2, const felem y2, const felem z2,
+                        char negate) {
+  felem neg_y2;
+
+  if (negate) {
+    felem_diff(neg_y2, kZero, y2);
+    y2 = neg_y2;
+  }
+  if (*is_infinity) {
+    felem_assign(x, x2);
+    felem_assign(y, y2);
+    felem_assign(z, z2);
+    *is_infinity = 0;
+    return;
+  }
+  point_add_or_double_vartime(x, y, z, x, y, z, x2, y2, z2);
+  /* Adding the opposite point gives z == 0. */
+  *is_infinity = felem_is_zero_vartime(z);
+}
+
+/* points_mul_vartime sets {nx,ny,nz} = n1*G + n2*{x,y}, setting
+ * *is_infinity if that is the point at infinity.
+ *
+ * The two multiplications are interleaved, as in Shamir's trick, sharing
+ * the doublings, with both scalars in wNAF form so that few additions
+ * are needed. The odd multiples of G come from kOddMultiples, those of
+ * {x,y} are computed here. */
+static void points_mul_vartime(felem nx, felem ny, felem nz, char* is_infinity,
+                               const p256_int* n1, const p256_int* n2,
+                               const felem x, const felem y) {
+  signed char naf1[257], naf2[257];
+  felem precomp[8][3];
+  felem x2, y2, z2;
+  int i;
+
+  wnaf(naf1, n1, 7);
+  wnaf(naf2, n2, 5);
+
+  /* precomp[i] is (2i+1)*{x,y}. */
+  felem_assign(precomp[0][0], x);
+  felem_assign(precomp[0][1], y);
+  felem_assign(precomp[0][2], kOne);
+  point_double(x2, y2, z2, x, y, kOne);
+  for (i = 1; i < 8; i++) {
+    point_add(precomp[i][0], precomp[i][1], precomp[i][2],
+              precomp[i - 1][0], precomp[i - 1][1], precomp[i - 1][2],
+              x2, y2, z2);
+  }
+
+  *is_infinity = 1;
+  for (i = 256; i >= 0; i--) {
+    if (!*is_infinity) {
+      point_double(nx, ny, nz, nx, ny, nz);
+    }
+    if (naf1[i]) {
+      const limb* entry = kOddMultiples + (abs(naf1[i]) >> 1) * 2 * NLIMBS;
+      add_vartime(nx, ny, nz, is_infinity, entry, entry + NLIMBS, kOne,
+                  naf1[i] < 0);
+    }
+    if (naf2[i]) {
+      felem* entry = precomp[abs(naf2[i]) >> 1];
+      add_vartime(nx, ny, nz, is_infinity, entry[0], entry[1], entry[2],
+                  naf2[i] < 0);
+    }
   }
 }
 
+#endif  // __SIZEOF_INT128__
+
 #define kRDigits {2, 0, 0, 0xfffffffe, 0xffffffff, 0xffffffff, 0xfffffffd, 1} // 2^257 mod p256.p
 
 #define kRInvDigits {0x80000000, 1, 0xffffffff, 0, 0x80000001, 0xfffffffe, 1, 0x7fffffff}  // 1 / 2^257 mod p256.p
 
-static const p256_int kR = { kRDigits };
 static const p256_int kRInv = { kRInvDigits };
 
+#if !defined(__SIZEOF_INT128__)
+static const p256_int kR = { kRDigits };
+
 /* to_montgomery sets out = R*in. */
 static void to_montgomery(felem out, const p256_int* in) {
   p256_int in_shifted;
@@ -1195,6 +1726,7 @@ static void to_montgomery(felem out, const p256_int* in) {
 
   p256_clear(&in_shifted);
 }
+#endif
 
 /* from_montgomery sets out=in/R. */
 static void from_montgomery(p256_int* out, const felem in) {
@@ -1245,35 +1777,24 @@ void p256_base_point_mul(const p256_int* n, p256_int* out_x, p256_int* out_y) {
 void p256_points_mul_vartime(
     const p256_int* n1, const p256_int* n2, const p256_int* in_x,
     const p256_int* in_y, p256_int* out_x, p256_int* out_y) {
-  felem x1, y1, z1, x2, y2, z2, px, py;
+#if defined(__SIZEOF_INT128__)
+  points_mul_vartime(n1, n2, in_x, in_y, out_x, out_y);
+#else
+  felem x, y, z, px, py;
+  char is_infinity;
+
+  to_montgomery(px, in_x);
+  to_montgomery(py, in_y);
+  points_mul_vartime(x, y, z, &is_infinity, n1, n2, px, py);
 
-  /* If both scalars are zero, then the result is the point at infinity. */
-  if (p256_is_zero(n1) != 0 && p256_is_zero(n2) != 0) {
+  if (is_infinity) {
     p256_clear(out_x);
     p256_clear(out_y);
     return;
   }
 
-  to_montgomery(px, in_x);
-  to_montgomery(py, in_y);
-  scalar_base_mult(x1, y1, z1, n1);
-  scalar_mult(x2, y2, z2, px, py, n2);
-
-  if (p256_is_zero(n2) != 0) {
-    /* If n2 == 0, then {x2,y2,z2} is zero and the result is just
-         * {x1,y1,z1}. */
-  } else if (p256_is_zero(n1) != 0) {
-    /* If n1 == 0, then {x1,y1,z1} is zero and the result is just
-         * {x2,y2,z2}. */
-    memcpy(x1, x2, sizeof(x2));
-    memcpy(y1, y2, sizeof(y2));
-    memcpy(z1, z2, sizeof(z2));
-  } else {
-    /* This function handles the case where {x1,y1,z1} == {x2,y2,z2}. */
-    point_add_or_double_vartime(x1, y1, z1, x1, y1, z1, x2, y2, z2);
-  }
-
-  point_to_affine(px, py, x1, y1, z1);
+  point_to_affine(px, py, x, y, z);
   from_montgomery(out_x, px);
   from_montgomery(out_y, py);
+#endif
 }
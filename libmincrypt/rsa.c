@@ -92,10 +92,157 @@ static void montMul(const RSAPublicKey* key,
     }
 }
 
+#if defined(__SIZEOF_INT128__)
+
+// On 64-bit CPUs the same arithmetic on 64-bit words takes a quarter of
+// the multiplies. R is 2^2048 either way, so key->rr and the result are
+// the same.
+
+#define RSANUMLIMBS (RSANUMWORDS / 2)
+
+typedef unsigned __int128 uint128_t;
+
+typedef struct RSAKey64 {
+    uint64_t n0inv;           // -1 / n[0] mod 2^64
+    uint64_t n[RSANUMLIMBS];
+} RSAKey64;
+
+// a[] -= mod
+static void subM64(const RSAKey64* key,
+                   uint64_t* a) {
+    uint64_t borrow = 0;
+    int i;
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        uint128_t A = (uint128_t)a[i] - key->n[i] - borrow;
+        a[i] = (uint64_t)A;
+        borrow = (uint64_t)(A >> 64) & 1;
+    }
+}
+
+// return a[] >= mod
+static int geM64(const RSAKey64* key,
+                 const uint64_t* a) {
+    int i;
+    for (i = RSANUMLIMBS; i;) {
+        --i;
+        if (a[i] < key->n[i]) return 0;
+        if (a[i] > key->n[i]) return 1;
+    }
+    return 1;  // equal
+}
+
+// montgomery c[] += a * b[] / R % mod
+static void montMulAdd64(const RSAKey64* key,
+                         uint64_t* c,
+                         const uint64_t a,
+                         const uint64_t* b) {
+    uint128_t A = (uint128_t)a * b[0] + c[0];
+    uint64_t d0 = (uint64_t)A * key->n0inv;
+    uint128_t B = (uint128_t)d0 * key->n[0] + (uint64_t)A;
+    int i;
+
+    for (i = 1; i < RSANUMLIMBS; ++i) {
+        A = (A >> 64) + (uint128_t)a * b[i] + c[i];
+        B = (B >> 64) + (uint128_t)d0 * key->n[i] + (uint64_t)A;
+        c[i - 1] = (uint64_t)B;
+    }
+
+    A = (A >> 64) + (B >> 64);
+
+    c[i - 1] = (uint64_t)A;
+
+    if (A >> 64) {
+        subM64(key, c);
+    }
+}
+
+// montgomery c[] = a[] * b[] / R % mod
+static void montMul64(const RSAKey64* key,
+                      uint64_t* c,
+                      const uint64_t* a,
+                      const uint64_t* b) {
+    int i;
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        c[i] = 0;
+    }
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        montMulAdd64(key, c, a[i], b);
+    }
+}
+
+// In-place public exponentiation, as modpow() below, for 2048-bit keys.
+static void modpow64(const RSAPublicKey* key,
+                     uint8_t* inout) {
+    RSAKey64 key64;
+    uint64_t rr[RSANUMLIMBS];
+    uint64_t a[RSANUMLIMBS];
+    uint64_t aR[RSANUMLIMBS];
+    uint64_t aaR[RSANUMLIMBS];
+    uint64_t* aaa = 0;
+    uint64_t inv;
+    int i, j;
+
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        key64.n[i] = key->n[2 * i] | (uint64_t)key->n[2 * i + 1] << 32;
+        rr[i] = key->rr[2 * i] | (uint64_t)key->rr[2 * i + 1] << 32;
+    }
+
+    // 1 / n[0] mod 2^32 is good for 32 bits; one Newton step doubles that.
+    inv = (uint32_t)-key->n0inv;
+    inv *= 2 - key64.n[0] * inv;
+    key64.n0inv = -inv;
+
+    // Convert from big endian byte array to little endian word array.
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        const uint8_t* p = inout + (RSANUMLIMBS - 1 - i) * 8;
+        uint64_t tmp = 0;
+        for (j = 0; j < 8; ++j) {
+            tmp = (tmp << 8) | p[j];
+        }
+        a[i] = tmp;
+    }
+
+    if (key->exponent == 65537) {
+        aaa = aaR;  // Re-use location.
+        montMul64(&key64, aR, a, rr);  // aR = a * RR / R mod M
+        for (i = 0; i < 16; i += 2) {
+            montMul64(&key64, aaR, aR, aR);  // aaR = aR * aR / R mod M
+            montMul64(&key64, aR, aaR, aaR);  // aR = aaR * aaR / R mod M
+        }
+        montMul64(&key64, aaa, aR, a);  // aaa = aR * a / R mod M
+    } else if (key->exponent == 3) {
+        aaa = aR;  // Re-use location.
+        montMul64(&key64, aR, a, rr);  /* aR = a * RR / R mod M   */
+        montMul64(&key64, aaR, aR, aR);  /* aaR = aR * aR / R mod M */
+        montMul64(&key64, aaa, aaR, a);  /* aaa = aaR * a / R mod M */
+    }
+
+    // Make sure aaa < mod; aaa is at most 1x mod too large.
+    if (geM64(&key64, aaa)) {
+        subM64(&key64, aaa);
+    }
+
+    // Convert to bigendian byte array
+    for (i = RSANUMLIMBS - 1; i >= 0; --i) {
+        uint64_t tmp = aaa[i];
+        for (j = 56; j >= 0; j -= 8) {
+            *inout++ = tmp >> j;
+        }
+    }
+}
+
+#endif  // __SIZEOF_INT128__
+
 // In-place public exponentiation.
 // Input and output big-endian byte array in inout.
 static void modpow(const RSAPublicKey* key,
                    uint8_t* inout) {
+#if defined(__SIZEOF_INT128__)
+    if (key->len == RSANUMWORDS) {
+        modpow64(key, inout);
+        return;
+    }
+#endif
     uint32_t a[RSANUMWORDS];
     uint32_t aR[RSANUMWORDS];
     uint32_t aaR[RSANUMWORDS];
@@ -239,39 +386,17 @@ static const uint8_t kExpectedPadSha256Rsa2048[SHA256_DIGEST_SIZE] = {
     0x90, 0xe8, 0x7d, 0x8b, 0xe1, 0x7c, 0x87, 0x59,
 };
 
-// Verify a 2048-bit RSA PKCS1.5 signature against an expected hash.
-// Both e=3 and e=65537 are supported.  hash_len may be
-// SHA_DIGEST_SIZE (== 20) to indicate a SHA-1 hash, or
-// SHA256_DIGEST_SIZE (== 32) to indicate a SHA-256 hash.  No other
-// values are supported.
-//
-// Returns 1 on successful verification, 0 on failure.
-int RSA_verify(const RSAPublicKey *key,
-               const uint8_t *signature,
-               const int len,
-               const uint8_t *hash,
-               const int hash_len) {
+// Checks a signature against the padded hash, with key already known to
+// be a supported 2048-bit key and len and hash_len checked by the caller.
+static int verify(const RSAPublicKey *key,
+                  const uint8_t *signature,
+                  const int len,
+                  const uint8_t *hash,
+                  const int hash_len) {
     uint8_t buf[RSANUMBYTES];
     int i;
     const uint8_t* padding_hash;
 
-    if (key->len != RSANUMWORDS) {
-        return 0;  // Wrong key passed in.
-    }
-
-    if (len != sizeof(buf)) {
-        return 0;  // Wrong input length.
-    }
-
-    if (hash_len != SHA_DIGEST_SIZE &&
-        hash_len != SHA256_DIGEST_SIZE) {
-        return 0;  // Unsupported hash.
-    }
-
-    if (key->exponent != 3 && key->exponent != 65537) {
-        return 0;  // Unsupported exponent.
-    }
-
     for (i = 0; i < len; ++i) {  // Copy input to local workspace.
         buf[i] = signature[i];
     }
@@ -306,3 +431,83 @@ int RSA_verify(const RSAPublicKey *key,
 
     return 1;  // All checked out OK.
 }
+
+static int supported(const RSAPublicKey *key) {
+    if (key->len != RSANUMWORDS) {
+        return 0;  // Wrong key passed in.
+    }
+
+    if (key->exponent != 3 && key->exponent != 65537) {
+        return 0;  // Unsupported exponent.
+    }
+
+    return 1;
+}
+
+// A valid signature is less than the modulus. Comparing the top word of
+// both rules most keys out before exponentiating.
+static int below_modulus(const RSAPublicKey *key,
+                         const uint8_t *signature) {
+    uint32_t top = (signature[0] << 24) | (signature[1] << 16) |
+                   (signature[2] << 8) | signature[3];
+    return top <= key->n[RSANUMWORDS - 1];
+}
+
+// Verify a 2048-bit RSA PKCS1.5 signature against an expected hash.
+// Both e=3 and e=65537 are supported.  hash_len may be
+// SHA_DIGEST_SIZE (== 20) to indicate a SHA-1 hash, or
+// SHA256_DIGEST_SIZE (== 32) to indicate a SHA-256 hash.  No other
+// values are supported.
+//
+// Returns 1 on successful verification, 0 on failure.
+int RSA_verify(const RSAPublicKey *key,
+               const uint8_t *signature,
+               const int len,
+               const uint8_t *hash,
+               const int hash_len) {
+    if (!supported(key)) {
+        return 0;
+    }
+
+    if (len != RSANUMBYTES) {
+        return 0;  // Wrong input length.
+    }
+
+    if (hash_len != SHA_DIGEST_SIZE &&
+        hash_len != SHA256_DIGEST_SIZE) {
+        return 0;  // Unsupported hash.
+    }
+
+    return verify(key, signature, len, hash, hash_len);
+}
+
+// Verify a signature as RSA_verify() does, against each of count keys in
+// turn, skipping the keys whose modulus the signature is too large for.
+//
+// Returns the index of the first key the signature verifies with, or -1.
+int RSA_verify_any(const RSAPublicKey* const *keys,
+                   const int count,
+                   const uint8_t *signature,
+                   const int len,
+                   const uint8_t *hash,
+                   const int hash_len) {
+    int i;
+
+    if (len != RSANUMBYTES) {
+        return -1;  // Wrong input length.
+    }
+
+    if (hash_len != SHA_DIGEST_SIZE &&
+        hash_len != SHA256_DIGEST_SIZE) {
+        return -1;  // Unsupported hash.
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (supported(keys[i]) && below_modulus(keys[i], signature) &&
+            verify(keys[i], signature, len, hash, hash_len)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
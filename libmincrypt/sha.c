@@ -25,65 +25,238 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// The portable code is optimized for minimal code size.
 
 #include "mincrypt/sha.h"
 
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_Transform(SHA_CTX* ctx) {
+static void SHA1_Transform(uint32_t* state, const uint8_t* p, size_t blocks) {
     uint32_t W[80];
     uint32_t A, B, C, D, E;
-    uint8_t* p = ctx->buf;
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
+    while (blocks--) {
+        for(t = 0; t < 16; ++t) {
+            uint32_t tmp =  *p++ << 24;
+            tmp |= *p++ << 16;
+            tmp |= *p++ << 8;
+            tmp |= *p++;
+            W[t] = tmp;
+        }
+
+        for(; t < 80; t++) {
+            W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+        }
+
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+
+        for(t = 0; t < 80; t++) {
+            uint32_t tmp = rol(5,A) + E + W[t];
+
+            if (t < 20)
+                tmp += (D^(B&(C^D))) + 0x5A827999;
+            else if ( t < 40)
+                tmp += (B^C^D) + 0x6ED9EBA1;
+            else if ( t < 60)
+                tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
+            else
+                tmp += (B^C^D) + 0xCA62C1D6;
+
+            E = D;
+            D = C;
+            C = rol(30,B);
+            B = A;
+            A = tmp;
+        }
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+    }
+}
+
+// The CPU's own SHA-1 instructions, when it has them, are picked on first
+// use instead of the code above.
+static void (*SHA1_Transform_blocks)(uint32_t* state, const uint8_t* p,
+                                     size_t blocks) = SHA1_Transform;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#ifndef bit_SHA
+#define bit_SHA (1 << 29)
+#endif
+
+// Four rounds q*4 to q*4+3 with the Intel SHA extensions, f being the
+// round function, 0 to 3. The rounds alternate between E0 and E1 for E,
+// and the message quads are expanded in M[] three quads ahead.
+#define SHA1_ROUNDS4(q, f) do { \
+    __m128i* e = &E[(q) & 1]; \
+    if ((q) < 4) \
+        M[(q) & 3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * (q))), MASK); \
+    if ((q) == 0) \
+        *e = _mm_add_epi32(*e, M[0]); \
+    else \
+        *e = _mm_sha1nexte_epu32(*e, M[(q) & 3]); \
+    E[((q) + 1) & 1] = ABCD; \
+    if ((q) >= 3 && (q) <= 18) \
+        M[((q) + 1) & 3] = _mm_sha1msg2_epu32(M[((q) + 1) & 3], M[(q) & 3]); \
+    ABCD = _mm_sha1rnds4_epu32(ABCD, *e, f); \
+    if ((q) >= 1 && (q) <= 16) \
+        M[((q) + 3) & 3] = _mm_sha1msg1_epu32(M[((q) + 3) & 3], M[(q) & 3]); \
+    if ((q) >= 2 && (q) <= 17) \
+        M[((q) + 2) & 3] = _mm_xor_si128(M[((q) + 2) & 3], M[(q) & 3]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void SHA1_Transform_shani(uint32_t* state, const uint8_t* p, size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, ABCD0, E0;
+    __m128i E[2];
+    __m128i M[4];
+
+    ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+    E[0] = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        ABCD0 = ABCD;
+        E0 = E[0];
+        SHA1_ROUNDS4(0, 0);
+        SHA1_ROUNDS4(1, 0);
+        SHA1_ROUNDS4(2, 0);
+        SHA1_ROUNDS4(3, 0);
+        SHA1_ROUNDS4(4, 0);
+        SHA1_ROUNDS4(5, 1);
+        SHA1_ROUNDS4(6, 1);
+        SHA1_ROUNDS4(7, 1);
+        SHA1_ROUNDS4(8, 1);
+        SHA1_ROUNDS4(9, 1);
+        SHA1_ROUNDS4(10, 2);
+        SHA1_ROUNDS4(11, 2);
+        SHA1_ROUNDS4(12, 2);
+        SHA1_ROUNDS4(13, 2);
+        SHA1_ROUNDS4(14, 2);
+        SHA1_ROUNDS4(15, 3);
+        SHA1_ROUNDS4(16, 3);
+        SHA1_ROUNDS4(17, 3);
+        SHA1_ROUNDS4(18, 3);
+        SHA1_ROUNDS4(19, 3);
+        E[0] = _mm_sha1nexte_epu32(E[0], E0);
+        ABCD = _mm_add_epi32(ABCD, ABCD0);
+        p += 64;
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(ABCD, 0x1B));
+    state[4] = _mm_extract_epi32(E[0], 3);
+}
+
+static void SHA1_select(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+            !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (ebx & bit_SHA) {
+        SHA1_Transform_blocks = SHA1_Transform_shani;
     }
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+
+// ARMv8 Crypto Extension, checked for at runtime as it is optional.
+static void SHA1_Transform_armv8(uint32_t* state, const uint8_t* p, size_t blocks) {
+    static const uint32_t K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t ABCD = vld1q_u32(state);
+    uint32_t E = state[4];
+    uint32x4_t ABCD0, WK;
+    uint32x4_t M[4];
+    uint32_t E0, E1;
+    int q;
+
+    while (blocks--) {
+        ABCD0 = ABCD;
+        E0 = E;
+        for (q = 0; q < 4; q++) {
+            M[q] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * q)));
+        }
+        for (q = 0; q < 20; q++) {
+            WK = vaddq_u32(M[q & 3], vdupq_n_u32(K[q / 5]));
+            if (q < 16) {
+                M[q & 3] = vsha1su1q_u32(vsha1su0q_u32(M[q & 3], M[(q + 1) & 3], M[(q + 2) & 3]),
+                                         M[(q + 3) & 3]);
+            }
+            E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+            if (q < 5) {
+                ABCD = vsha1cq_u32(ABCD, E, WK);
+            } else if (q >= 10 && q < 15) {
+                ABCD = vsha1mq_u32(ABCD, E, WK);
+            } else {
+                ABCD = vsha1pq_u32(ABCD, E, WK);
+            }
+            E = E1;
+        }
+        ABCD = vaddq_u32(ABCD, ABCD0);
+        E += E0;
+        p += 64;
+    }
+
+    vst1q_u32(state, ABCD);
+    state[4] = E;
+}
 
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
+static void SHA1_select(void) {
+    if (getauxval(AT_HWCAP) & HWCAP_SHA1) {
+        SHA1_Transform_blocks = SHA1_Transform_armv8;
     }
+}
+
+#else
+
+static void SHA1_select(void) {
+}
+
+#endif
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
+#ifdef USE_MINGW
+static int SHA1_selected;
+
+static void SHA1_select_once(void) {
+    // No threads in the Windows tools to race with
+    if (!SHA1_selected) {
+        SHA1_select();
+        SHA1_selected = 1;
     }
+}
+#else
+static pthread_once_t SHA1_once = PTHREAD_ONCE_INIT;
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+static void SHA1_select_once(void) {
+    pthread_once(&SHA1_once, SHA1_select);
 }
+#endif
 
 static const HASH_VTAB SHA_VTAB = {
     SHA_init,
@@ -101,6 +274,7 @@ void SHA_init(SHA_CTX* ctx) {
     ctx->state[3] = 0x10325476;
     ctx->state[4] = 0xC3D2E1F0;
     ctx->count = 0;
+    SHA1_select_once();
 }
 
 
@@ -110,13 +284,27 @@ void SHA_update(SHA_CTX* ctx, const void* data, int len) {
 
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA1_Transform(ctx);
-            i = 0;
+    if (i > 0) {
+        int n = 64 - i;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) {
+            return;
         }
+        SHA1_Transform_blocks(ctx->state, ctx->buf, 1);
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer.
+    if (len >= 64) {
+        SHA1_Transform_blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
     }
+    memcpy(ctx->buf, p, len);
 }
 
 
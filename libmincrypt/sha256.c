@@ -25,10 +25,13 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// The portable code is optimized for minimal code size.
 
 #include "mincrypt/sha256.h"
 
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -54,62 +57,203 @@ static const uint32_t K[64] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-static void SHA256_Transform(SHA256_CTX* ctx) {
+static void SHA256_Transform(uint32_t* state, const uint8_t* p, size_t blocks) {
     uint32_t W[64];
     uint32_t A, B, C, D, E, F, G, H;
-    uint8_t* p = ctx->buf;
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
+    while (blocks--) {
+        for(t = 0; t < 16; ++t) {
+            uint32_t tmp =  *p++ << 24;
+            tmp |= *p++ << 16;
+            tmp |= *p++ << 8;
+            tmp |= *p++;
+            W[t] = tmp;
+        }
+
+        for(; t < 64; t++) {
+            uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
+            uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
+            W[t] = W[t-16] + s0 + W[t-7] + s1;
+        }
+
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+        F = state[5];
+        G = state[6];
+        H = state[7];
+
+        for(t = 0; t < 64; t++) {
+            uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
+            uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
+            uint32_t t2 = s0 + maj;
+            uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
+            uint32_t ch = (E & F) ^ ((~E) & G);
+            uint32_t t1 = H + s1 + ch + K[t] + W[t];
+
+            H = G;
+            G = F;
+            F = E;
+            E = D + t1;
+            D = C;
+            C = B;
+            B = A;
+            A = t1 + t2;
+        }
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        state[5] += F;
+        state[6] += G;
+        state[7] += H;
+    }
+}
+
+// The CPU's own SHA-256 instructions, when it has them, run several times
+// faster than the code above. They are picked on first use.
+static void (*SHA256_Transform_blocks)(uint32_t* state, const uint8_t* p,
+                                       size_t blocks) = SHA256_Transform;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#ifndef bit_SHA
+#define bit_SHA (1 << 29)
+#endif
+
+// Intel SHA extensions. The state is kept as ABEF and CDGH, the layout
+// sha256rnds2 works on; each message quad is expanded four rounds ahead.
+__attribute__((target("sha,sse4.1")))
+static void SHA256_Transform_shani(uint32_t* state, const uint8_t* p, size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, TMP, ABEF, CDGH;
+    __m128i M[4];
+    int q;
+
+    TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[0]), 0xB1);
+    STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[4]), 0x1B);
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    while (blocks--) {
+        ABEF = STATE0;
+        CDGH = STATE1;
+        for (q = 0; q < 4; q++) {
+            M[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * q)), MASK);
+        }
+        for (q = 0; q < 16; q++) {
+            TMP = _mm_add_epi32(M[q & 3], _mm_loadu_si128((const __m128i*) &K[4 * q]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, TMP);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, _mm_shuffle_epi32(TMP, 0x0E));
+            if (q < 12) {
+                TMP = _mm_sha256msg1_epu32(M[q & 3], M[(q + 1) & 3]);
+                TMP = _mm_add_epi32(TMP, _mm_alignr_epi8(M[(q + 3) & 3], M[(q + 2) & 3], 4));
+                M[q & 3] = _mm_sha256msg2_epu32(TMP, M[(q + 3) & 3]);
+            }
+        }
+        STATE0 = _mm_add_epi32(STATE0, ABEF);
+        STATE1 = _mm_add_epi32(STATE1, CDGH);
+        p += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(TMP, STATE1, 0xF0));
+    _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(STATE1, TMP, 8));
+}
+
+static void SHA256_select(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+            !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (ebx & bit_SHA) {
+        SHA256_Transform_blocks = SHA256_Transform_shani;
     }
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+// ARMv8 Crypto Extension. The instructions are optional, so a build that
+// targets them (-march=armv8-a+crypto) still checks the CPU has them.
+static void SHA256_Transform_armv8(uint32_t* state, const uint8_t* p, size_t blocks) {
+    uint32x4_t ABCD = vld1q_u32(&state[0]);
+    uint32x4_t EFGH = vld1q_u32(&state[4]);
+    uint32x4_t ABCD0, EFGH0, WK, TMP;
+    uint32x4_t M[4];
+    int q;
+
+    while (blocks--) {
+        ABCD0 = ABCD;
+        EFGH0 = EFGH;
+        for (q = 0; q < 4; q++) {
+            M[q] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * q)));
+        }
+        for (q = 0; q < 16; q++) {
+            WK = vaddq_u32(M[q & 3], vld1q_u32(&K[4 * q]));
+            if (q < 12) {
+                M[q & 3] = vsha256su1q_u32(vsha256su0q_u32(M[q & 3], M[(q + 1) & 3]),
+                                           M[(q + 2) & 3], M[(q + 3) & 3]);
+            }
+            TMP = ABCD;
+            ABCD = vsha256hq_u32(ABCD, EFGH, WK);
+            EFGH = vsha256h2q_u32(EFGH, TMP, WK);
+        }
+        ABCD = vaddq_u32(ABCD, ABCD0);
+        EFGH = vaddq_u32(EFGH, EFGH0);
+        p += 64;
+    }
+
+    vst1q_u32(&state[0], ABCD);
+    vst1q_u32(&state[4], EFGH);
+}
 
-    for(; t < 64; t++) {
-        uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
-        uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
-        W[t] = W[t-16] + s0 + W[t-7] + s1;
+static void SHA256_select(void) {
+    if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+        SHA256_Transform_blocks = SHA256_Transform_armv8;
     }
+}
+
+#else
+
+static void SHA256_select(void) {
+}
+
+#endif
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
-
-    for(t = 0; t < 64; t++) {
-        uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
-        uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
-        uint32_t t2 = s0 + maj;
-        uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
-        uint32_t ch = (E & F) ^ ((~E) & G);
-        uint32_t t1 = H + s1 + ch + K[t] + W[t];
-
-        H = G;
-        G = F;
-        F = E;
-        E = D + t1;
-        D = C;
-        C = B;
-        B = A;
-        A = t1 + t2;
+#ifdef USE_MINGW
+static int SHA256_selected;
+
+static void SHA256_select_once(void) {
+    // No threads in the Windows tools to race with
+    if (!SHA256_selected) {
+        SHA256_select();
+        SHA256_selected = 1;
     }
+}
+#else
+static pthread_once_t SHA256_once = PTHREAD_ONCE_INIT;
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+static void SHA256_select_once(void) {
+    pthread_once(&SHA256_once, SHA256_select);
 }
+#endif
 
 static const HASH_VTAB SHA256_VTAB = {
     SHA256_init,
@@ -130,6 +274,7 @@ void SHA256_init(SHA256_CTX* ctx) {
     ctx->state[6] = 0x1f83d9ab;
     ctx->state[7] = 0x5be0cd19;
     ctx->count = 0;
+    SHA256_select_once();
 }
 
 
@@ -139,13 +284,27 @@ void SHA256_update(SHA256_CTX* ctx, const void* data, int len) {
 
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA256_Transform(ctx);
-            i = 0;
+    if (i > 0) {
+        int n = 64 - i;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) {
+            return;
         }
+        SHA256_Transform_blocks(ctx->state, ctx->buf, 1);
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer.
+    if (len >= 64) {
+        SHA256_Transform_blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
     }
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Google Inc. nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mincrypt/sha256_fd.h"
+
+#if defined(__APPLE__) && defined(__MACH__)
+#define mmap64 mmap
+#define pread64 pread
+#define off64_t off_t
+#endif
+
+// How much of a file is mapped at a time. The next window is read ahead
+// while this one is hashed.
+#define WINDOW_SIZE (8 * 1024 * 1024)
+// How much is read at a time when the file can't be mapped, and by each
+// thread building a hash tree.
+#define READ_SIZE (1024 * 1024)
+
+#define MAX_THREADS 16
+#define MAX_LEVELS 32
+// Fewer blocks than this aren't worth another thread.
+#define MIN_THREAD_BLOCKS 256
+
+static void read_ahead(int fd, uint64_t offset, uint64_t length) {
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+#else
+    (void)fd; (void)offset; (void)length;
+#endif
+}
+
+// Reads exactly length bytes of fd from offset.
+static int read_fully(int fd, uint64_t offset, uint8_t* buf, size_t length) {
+    while (length > 0) {
+        ssize_t n = pread64(fd, buf, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        buf += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int hash_read(SHA256_CTX* ctx, int fd, uint64_t offset, uint64_t length) {
+    uint8_t* buf = malloc(READ_SIZE);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    while (length > 0) {
+        size_t n = length < READ_SIZE ? length : READ_SIZE;
+        if (read_fully(fd, offset, buf, n) != 0) {
+            free(buf);
+            return -1;
+        }
+        SHA256_update(ctx, buf, n);
+        offset += n;
+        length -= n;
+    }
+    free(buf);
+    return 0;
+}
+
+int SHA256_hash_fd(int fd, uint64_t offset, uint64_t length, uint8_t* digest) {
+    const uint64_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    const uint64_t end = offset + length;
+    uint64_t pos = offset;
+    SHA256_CTX ctx;
+
+    SHA256_init(&ctx);
+    read_ahead(fd, offset, WINDOW_SIZE);
+    while (pos < end) {
+        // Windows start on pages, the first one where the range does.
+        uint64_t start = pos & ~page_mask;
+        uint64_t stop = start + WINDOW_SIZE < end ? start + WINDOW_SIZE : end;
+        uint8_t* map = mmap64(NULL, stop - start, PROT_READ, MAP_SHARED,
+                              fd, start);
+        if (map == MAP_FAILED) {
+            if (hash_read(&ctx, fd, pos, end - pos) != 0) return -1;
+            break;
+        }
+        madvise(map, stop - start, MADV_SEQUENTIAL);
+        if (stop < end) {
+            read_ahead(fd, stop, WINDOW_SIZE);
+        }
+        SHA256_update(&ctx, map + (pos - start), stop - pos);
+        munmap(map, stop - start);
+        pos = stop;
+    }
+    memcpy(digest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+    return 0;
+}
+
+// Sets blocks[i] to the number of blocks of level i of the tree, level 0
+// being the hashes of the data, and returns the number of levels.
+static int verity_levels(uint64_t data_size, uint32_t block_size,
+                         uint64_t blocks[MAX_LEVELS]) {
+    const uint32_t hashes_per_block = block_size / SHA256_DIGEST_SIZE;
+    uint64_t count;
+    int levels = 0;
+
+    if (block_size < 2 * SHA256_DIGEST_SIZE ||
+        (block_size & (block_size - 1)) != 0 ||
+        data_size == 0 || data_size % block_size != 0) {
+        return 0;
+    }
+    count = data_size / block_size;
+    do {
+        count = (count + hashes_per_block - 1) / hashes_per_block;
+        blocks[levels++] = count;
+    } while (count > 1);
+    return levels;
+}
+
+uint64_t SHA256_verity_tree_size(uint64_t data_size, uint32_t block_size) {
+    uint64_t blocks[MAX_LEVELS];
+    uint64_t size = 0;
+    int levels = verity_levels(data_size, block_size, blocks);
+    int i;
+
+    for (i = 0; i < levels; i++) {
+        size += blocks[i] * block_size;
+    }
+    return size;
+}
+
+// Hashes count blocks, read from fd or in memory at data, into out.
+typedef struct {
+    pthread_t thread;
+    int fd;
+    uint64_t offset;
+    const uint8_t* data;
+    uint64_t count;
+    uint32_t block_size;
+    const SHA256_CTX* salted;
+    uint8_t* out;
+    int error;
+} hash_job;
+
+static void hash_block(const hash_job* job, const uint8_t* block, uint8_t* out) {
+    SHA256_CTX ctx;
+    memcpy(&ctx, job->salted, sizeof(ctx));
+    SHA256_update(&ctx, block, job->block_size);
+    memcpy(out, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+}
+
+static void* hash_blocks(void* arg) {
+    hash_job* job = arg;
+    uint64_t i;
+
+    if (job->data != NULL) {
+        for (i = 0; i < job->count; i++) {
+            hash_block(job, job->data + i * job->block_size,
+                       job->out + i * SHA256_DIGEST_SIZE);
+        }
+        return NULL;
+    }
+
+    const uint64_t chunk = READ_SIZE > job->block_size ?
+            READ_SIZE / job->block_size : 1;
+    uint8_t* buf = malloc(chunk * job->block_size);
+    if (buf == NULL) {
+        job->error = ENOMEM;
+        return NULL;
+    }
+    for (i = 0; i < job->count; i += chunk) {
+        uint64_t n = job->count - i < chunk ? job->count - i : chunk;
+        uint64_t j;
+        if (read_fully(job->fd, job->offset + i * job->block_size, buf,
+                       n * job->block_size) != 0) {
+            job->error = errno;
+            break;
+        }
+        // Hashing this chunk overlaps with reading the next one.
+        read_ahead(job->fd, job->offset + (i + n) * job->block_size,
+                   chunk * job->block_size);
+        for (j = 0; j < n; j++) {
+            hash_block(job, buf + j * job->block_size,
+                       job->out + (i + j) * SHA256_DIGEST_SIZE);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// Hashes the count blocks of proto on up to threads threads, each taking
+// a contiguous run of them.
+static int hash_level(const hash_job* proto, int threads) {
+    hash_job jobs[MAX_THREADS];
+    uint64_t first = 0;
+    int started[MAX_THREADS];
+    int i;
+
+    if ((uint64_t)threads > proto->count / MIN_THREAD_BLOCKS) {
+        threads = proto->count / MIN_THREAD_BLOCKS;
+    }
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    for (i = 0; i < threads; i++) {
+        uint64_t last = proto->count * (i + 1) / threads;
+        jobs[i] = *proto;
+        jobs[i].count = last - first;
+        if (jobs[i].data != NULL) {
+            jobs[i].data += first * proto->block_size;
+        }
+        jobs[i].offset += first * proto->block_size;
+        jobs[i].out += first * SHA256_DIGEST_SIZE;
+        first = last;
+    }
+    // The calling thread does the first run, and any other whose thread
+    // couldn't be started.
+    for (i = 1; i < threads; i++) {
+        started[i] = pthread_create(&jobs[i].thread, NULL, hash_blocks,
+                                    &jobs[i]) == 0;
+    }
+    hash_blocks(&jobs[0]);
+    for (i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(jobs[i].thread, NULL);
+        } else {
+            hash_blocks(&jobs[i]);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        if (jobs[i].error) {
+            errno = jobs[i].error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SHA256_verity_tree(int fd, uint64_t offset, uint64_t data_size,
+                       uint32_t block_size, const uint8_t* salt,
+                       size_t salt_size, int threads, uint8_t* tree,
+                       uint8_t* root_digest) {
+    uint64_t blocks[MAX_LEVELS];
+    uint8_t* level[MAX_LEVELS];
+    int levels = verity_levels(data_size, block_size, blocks);
+    uint8_t* pos = tree;
+    SHA256_CTX salted;
+    hash_job job;
+    int i;
+
+    if (levels == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The levels are stored top down, each padded with zeroes to a block.
+    for (i = levels - 1; i >= 0; i--) {
+        level[i] = pos;
+        pos += blocks[i] * block_size;
+    }
+    memset(tree, 0, pos - tree);
+
+    // Every block is hashed after the salt, so hash it once.
+    SHA256_init(&salted);
+    SHA256_update(&salted, salt, salt_size);
+
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.offset = offset;
+    job.count = data_size / block_size;
+    job.block_size = block_size;
+    job.salted = &salted;
+    job.out = level[0];
+    if (hash_level(&job, threads) != 0) return -1;
+
+    for (i = 1; i < levels; i++) {
+        job.data = level[i - 1];
+        job.count = blocks[i - 1];
+        job.out = level[i];
+        hash_level(&job, threads);
+    }
+
+    job.data = level[levels - 1];
+    hash_block(&job, job.data, root_digest);
+    return 0;
+}
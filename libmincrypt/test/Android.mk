@@ -19,3 +19,16 @@ LOCAL_MODULE := p256_unittest
 LOCAL_SRC_FILES := p256_unittest.c
 LOCAL_STATIC_LIBRARIES := libmincrypt
 include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := sha_test
+LOCAL_SRC_FILES := sha_test.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := sha256_fd_test
+LOCAL_SRC_FILES := sha256_fd_test.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_NATIVE_TEST)
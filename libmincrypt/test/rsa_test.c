@@ -836,6 +836,22 @@ int main(int arg __unused, char** argv __unused) {
     TEST_MESSAGE(19);
     TEST_MESSAGE(20);
 
+    // The same key with e=3 does not verify the signatures; key_15 after it does.
+    RSAPublicKey key_15_e3 = key_15;
+    key_15_e3.exponent = 3;
+    const RSAPublicKey* keys[] = { &key_15_e3, &key_15 };
+
+    message = parsehex(message_1, &mlen);
+    SHA_hash(message, mlen, hash);
+    signature = parsehex(signature_1, &slen);
+    int index = RSA_verify_any(keys, 2, signature, slen, hash, sizeof(hash));
+    printf("any key: %s\n", index == 1 ? "verified" : "not verified");
+    success = success && index == 1;
+    signature[slen / 2] ^= 1;
+    index = RSA_verify_any(keys, 2, signature, slen, hash, sizeof(hash));
+    printf("any key, bad signature: %s\n", index == -1 ? "rejected" : "not rejected");
+    success = success && index == -1;
+
     printf("\n%s\n\n", success ? "PASS" : "FAIL");
 
     return !success;
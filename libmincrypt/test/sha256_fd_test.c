@@ -0,0 +1,187 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Google Inc. nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mincrypt/sha256.h"
+#include "mincrypt/sha256_fd.h"
+
+// Crosses a mapping window of SHA256_hash_fd().
+#define DATA_SIZE (9 * 1024 * 1024 + 4096)
+
+static const uint8_t kSalt[] = "a grain of salt";
+
+// Builds the tree the obvious way, level by level, into tree and root.
+static void reference_tree(const uint8_t* data, uint64_t size,
+                           uint32_t block_size, uint8_t* tree,
+                           uint8_t* root) {
+    uint8_t* levels[32];
+    uint64_t lengths[32];
+    int count = 0;
+    const uint8_t* in = data;
+    uint64_t in_size = size;
+    SHA256_CTX ctx;
+    uint8_t* pos;
+    uint64_t i;
+    int l;
+
+    for (;;) {
+        uint64_t blocks = in_size / block_size;
+        uint64_t length = (blocks * SHA256_DIGEST_SIZE + block_size - 1) /
+                block_size * block_size;
+        uint8_t* out = calloc(1, length);
+        for (i = 0; i < blocks; i++) {
+            SHA256_init(&ctx);
+            SHA256_update(&ctx, kSalt, sizeof(kSalt));
+            SHA256_update(&ctx, in + i * block_size, block_size);
+            memcpy(out + i * SHA256_DIGEST_SIZE, SHA256_final(&ctx),
+                   SHA256_DIGEST_SIZE);
+        }
+        levels[count] = out;
+        lengths[count++] = length;
+        if (length == block_size) break;
+        in = out;
+        in_size = length;
+    }
+
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, kSalt, sizeof(kSalt));
+    SHA256_update(&ctx, levels[count - 1], block_size);
+    memcpy(root, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+
+    pos = tree;
+    for (l = count - 1; l >= 0; l--) {
+        memcpy(pos, levels[l], lengths[l]);
+        pos += lengths[l];
+        free(levels[l]);
+    }
+}
+
+static int test_hash_fd(int fd, const uint8_t* data) {
+    static const uint64_t kRanges[][2] = {
+        { 0, DATA_SIZE }, { 0, 0 }, { 1, 100 }, { 4095, 8 * 1024 * 1024 + 2 },
+        { 5000, DATA_SIZE - 5000 }, { DATA_SIZE - 1, 1 },
+    };
+    uint8_t expected[SHA256_DIGEST_SIZE];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    size_t i;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(kRanges) / sizeof(kRanges[0]); i++) {
+        SHA256_hash(data + kRanges[i][0], kRanges[i][1], expected);
+        if (SHA256_hash_fd(fd, kRanges[i][0], kRanges[i][1], digest) != 0 ||
+            memcmp(digest, expected, SHA256_DIGEST_SIZE) != 0) {
+            printf("SHA256_hash_fd of %llu bytes at %llu differs\n",
+                   (unsigned long long)kRanges[i][1],
+                   (unsigned long long)kRanges[i][0]);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+static int test_verity_tree(int fd, const uint8_t* data) {
+    static const struct {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t block_size;
+    } kTrees[] = {
+        { 0, 4096, 4096 },            // a single data block
+        { 0, 300 * 512, 512 },        // three levels
+        { 4096, 2300 * 4096, 4096 },  // two levels, and an offset
+        { 0, 70000 * 128, 128 },      // many levels
+    };
+    static const int kThreads[] = { 1, 4 };
+    uint8_t expected_root[SHA256_DIGEST_SIZE];
+    uint8_t root[SHA256_DIGEST_SIZE];
+    size_t i, j;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(kTrees) / sizeof(kTrees[0]); i++) {
+        uint64_t size = SHA256_verity_tree_size(kTrees[i].size,
+                                                kTrees[i].block_size);
+        uint8_t* expected = malloc(size);
+        uint8_t* tree = malloc(size);
+        reference_tree(data + kTrees[i].offset, kTrees[i].size,
+                       kTrees[i].block_size, expected, expected_root);
+        for (j = 0; j < sizeof(kThreads) / sizeof(kThreads[0]); j++) {
+            memset(tree, 0xff, size);
+            if (SHA256_verity_tree(fd, kTrees[i].offset, kTrees[i].size,
+                                   kTrees[i].block_size, kSalt, sizeof(kSalt),
+                                   kThreads[j], tree, root) != 0 ||
+                memcmp(tree, expected, size) != 0 ||
+                memcmp(root, expected_root, SHA256_DIGEST_SIZE) != 0) {
+                printf("tree of %llu bytes in blocks of %u on %d threads "
+                       "differs\n", (unsigned long long)kTrees[i].size,
+                       kTrees[i].block_size, kThreads[j]);
+                failed = 1;
+            }
+        }
+        free(expected);
+        free(tree);
+    }
+
+    if (SHA256_verity_tree_size(4096, 4096) != 4096 ||
+        SHA256_verity_tree_size(129 * 4096, 4096) != 3 * 4096 ||
+        SHA256_verity_tree_size(4095, 4096) != 0 ||
+        SHA256_verity_tree_size(0, 4096) != 0 ||
+        SHA256_verity_tree_size(3000, 1000) != 0) {
+        printf("SHA256_verity_tree_size is wrong\n");
+        failed = 1;
+    }
+    return failed;
+}
+
+int main(void) {
+    char path[] = "/tmp/sha256_fd_test.XXXXXX";
+    uint8_t* data = malloc(DATA_SIZE);
+    uint32_t seed = 1;
+    int failed = 0;
+    int fd;
+    int i;
+
+    for (i = 0; i < DATA_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 24;
+    }
+    fd = mkstemp(path);
+    if (fd < 0 || write(fd, data, DATA_SIZE) != DATA_SIZE) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    unlink(path);
+
+    failed |= test_hash_fd(fd, data);
+    failed |= test_verity_tree(fd, data);
+
+    close(fd);
+    free(data);
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
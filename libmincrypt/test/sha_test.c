@@ -0,0 +1,120 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Google Inc. nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cdefs.h>
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+
+#ifndef __unused
+#define __unused __attribute__((__unused__))
+#endif
+
+// The FIPS 180-2 example messages, and a million times "a".
+static const char* kMessages[] = {
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    NULL,
+};
+
+static const char* kSHA1[] = {
+    "a9993e364706816aba3e25717850c26c9cd0d89d",
+    "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+    "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+};
+
+static const char* kSHA256[] = {
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+};
+
+#define MILLION 1000000
+
+static int check(const char* name, int n, const char* how,
+                 const uint8_t* digest, int size, const char* expected) {
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    int i;
+    for (i = 0; i < size; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+    if (strcmp(hex, expected)) {
+        printf("%s message %d %s: %s, expected %s\n", name, n, how, hex, expected);
+        return 0;
+    }
+    return 1;
+}
+
+// Hashes the message in one go and in uneven pieces, which go through
+// both the buffered and the direct paths of the update functions.
+static int test_message(int n, const uint8_t* msg, int len) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    SHA_CTX sha;
+    SHA256_CTX sha256;
+    int success = 1;
+    int i, step;
+
+    SHA_hash(msg, len, digest);
+    success &= check("SHA-1", n, "whole", digest, SHA_DIGEST_SIZE, kSHA1[n]);
+    SHA256_hash(msg, len, digest);
+    success &= check("SHA-256", n, "whole", digest, SHA256_DIGEST_SIZE, kSHA256[n]);
+
+    SHA_init(&sha);
+    SHA256_init(&sha256);
+    for (i = 0, step = 1; i < len; i += step, step = step * 7 % 197 + 1) {
+        int size = len - i < step ? len - i : step;
+        SHA_update(&sha, msg + i, size);
+        SHA256_update(&sha256, msg + i, size);
+    }
+    success &= check("SHA-1", n, "in pieces", SHA_final(&sha), SHA_DIGEST_SIZE, kSHA1[n]);
+    success &= check("SHA-256", n, "in pieces", SHA256_final(&sha256),
+                     SHA256_DIGEST_SIZE, kSHA256[n]);
+    return success;
+}
+
+int main(int arg __unused, char** argv __unused) {
+    uint8_t* million = malloc(MILLION);
+    int success = 1;
+    int n;
+
+    memset(million, 'a', MILLION);
+    for (n = 0; n < 3; n++) {
+        if (kMessages[n]) {
+            success &= test_message(n, (const uint8_t*) kMessages[n], strlen(kMessages[n]));
+        } else {
+            success &= test_message(n, million, MILLION);
+        }
+    }
+    free(million);
+
+    printf("\n%s\n\n", success ? "PASS" : "FAIL");
+
+    return !success;
+}
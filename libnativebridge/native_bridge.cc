@@ -25,6 +25,9 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 namespace android {
 
@@ -98,6 +101,30 @@ static constexpr const char* kCodeCacheDir = "code_cache";
 
 static constexpr uint32_t kLibNativeBridgeVersion = 2;
 
+// The trampolines the bridge has returned, null ones included. The runtime looks a native method
+// up under both its short and its long JNI name, in each library of the class loader, and the
+// bridge may have to translate code to answer, so the same questions are only asked once.
+struct TrampolineKey {
+  void* handle;
+  std::string name;
+  std::string shorty;
+
+  bool operator==(const TrampolineKey& other) const {
+    return handle == other.handle && name == other.name && shorty == other.shorty;
+  }
+};
+
+struct TrampolineKeyHash {
+  size_t operator()(const TrampolineKey& key) const {
+    size_t hash = std::hash<void*>()(key.handle);
+    hash = hash * 31 + std::hash<std::string>()(key.name);
+    return hash * 31 + std::hash<std::string>()(key.shorty);
+  }
+};
+
+static std::mutex trampolines_lock;
+static std::unordered_map<TrampolineKey, void*, TrampolineKeyHash>* trampolines = nullptr;
+
 // Characters allowed in a native bridge filename. The first character must
 // be in [a-zA-Z] (expected 'l' for "libx"). The rest must be in [a-zA-Z0-9._-].
 static bool CharacterAllowed(char c, bool first) {
@@ -164,6 +191,10 @@ static void CloseNativeBridge(bool with_error) {
   had_error |= with_error;
   delete[] app_code_cache_dir;
   app_code_cache_dir = nullptr;
+
+  std::lock_guard<std::mutex> guard(trampolines_lock);
+  delete trampolines;
+  trampolines = nullptr;
 }
 
 bool LoadNativeBridge(const char* nb_library_filename,
@@ -488,10 +519,34 @@ void* NativeBridgeLoadLibrary(const char* libpath, int flag) {
 
 void* NativeBridgeGetTrampoline(void* handle, const char* name, const char* shorty,
                                 uint32_t len) {
-  if (NativeBridgeInitialized()) {
+  if (!NativeBridgeInitialized()) {
+    return nullptr;
+  }
+  if (name == nullptr) {
     return callbacks->getTrampoline(handle, name, shorty, len);
   }
-  return nullptr;
+
+  TrampolineKey key = { handle, name, shorty != nullptr ? std::string(shorty, len) : "" };
+  {
+    std::lock_guard<std::mutex> guard(trampolines_lock);
+    if (trampolines != nullptr) {
+      auto it = trampolines->find(key);
+      if (it != trampolines->end()) {
+        return it->second;
+      }
+    }
+  }
+
+  // Not under the lock: the bridge may take a while, and asks for the same trampoline twice are
+  // harmless.
+  void* trampoline = callbacks->getTrampoline(handle, name, shorty, len);
+
+  std::lock_guard<std::mutex> guard(trampolines_lock);
+  if (trampolines == nullptr) {
+    trampolines = new std::unordered_map<TrampolineKey, void*, TrampolineKeyHash>();
+  }
+  trampolines->emplace(std::move(key), trampoline);
+  return trampoline;
 }
 
 bool NativeBridgeIsSupported(const char* libpath) {
@@ -16,22 +16,28 @@
 
 /* Utilities for managing the dhcpcd DHCP client daemon */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
 #include <cutils/properties.h>
 
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
 static const char DAEMON_NAME[]        = "dhcpcd";
 static const char DAEMON_PROP_NAME[]   = "init.svc.dhcpcd";
 static const char HOSTNAME_PROP_NAME[] = "net.hostname";
 static const char DHCP_PROP_NAME_PREFIX[]  = "dhcp";
 static const char DHCP_CONFIG_PATH[]   = "/system/etc/dhcpcd/dhcpcd.conf";
-static const int NAP_TIME = 200;   /* wait for 200ms at a time */
-                                  /* when polling for property values */
+static const int NAP_TIME = 200;   /* wait for 200ms at a time when polling */
+                                  /* for property values without the watcher */
 static const char DAEMON_NAME_RENEW[]  = "iprenew";
 static char errmsg[100] = "\0";
 /* interface length for dhcpcd daemon start (dhcpcd_<interface> as defined in init.rc file)
@@ -57,6 +63,63 @@ void get_p2p_interface_replacement(const char *interface, char *p2p_interface) {
     }
 }
 
+/*
+ * The property watcher thread blocks until any system property changes and
+ * then wakes up everyone in wait_for_property(), so that they see the new
+ * value right away instead of at their next nap.  It is started the first
+ * time a property is waited for and stays around for the process.
+ */
+static pthread_once_t prop_watcher_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t prop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prop_changed;
+static unsigned int prop_serial;
+static int prop_watcher_running;
+
+static void *prop_watcher(void *arg __attribute__((unused)))
+{
+    unsigned int serial = __system_property_area_serial();
+
+    for (;;) {
+        serial = __system_property_wait_any(serial);
+        pthread_mutex_lock(&prop_lock);
+        prop_serial = serial;
+        pthread_cond_broadcast(&prop_changed);
+        pthread_mutex_unlock(&prop_lock);
+    }
+    return NULL;
+}
+
+static void start_prop_watcher(void)
+{
+    pthread_condattr_t cattr;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&prop_changed, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    prop_serial = __system_property_area_serial();
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    prop_watcher_running = pthread_create(&thread, &attr, prop_watcher, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+static int property_matches(const char *name, const char *desired_value)
+{
+    char value[PROPERTY_VALUE_MAX] = {'\0'};
+
+    if (property_get(name, value, NULL)) {
+        if (desired_value == NULL ||
+                strcmp(value, desired_value) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /*
  * Wait for a system property to be assigned a specified value.
  * If desired_value is NULL, then just wait for the property to
@@ -65,25 +128,50 @@ void get_p2p_interface_replacement(const char *interface, char *p2p_interface) {
  */
 static int wait_for_property(const char *name, const char *desired_value, int maxwait)
 {
-    char value[PROPERTY_VALUE_MAX] = {'\0'};
-    int maxnaps = (maxwait * 1000) / NAP_TIME;
+    struct timespec deadline;
+    unsigned int serial;
+    int ret = 0;
 
-    if (maxnaps < 1) {
-        maxnaps = 1;
-    }
+    pthread_once(&prop_watcher_once, start_prop_watcher);
+    if (!prop_watcher_running) {
+        int maxnaps = (maxwait * 1000) / NAP_TIME;
 
-    while (maxnaps-- >= 0) {
-        if (property_get(name, value, NULL)) {
-            if (desired_value == NULL ||
-                    strcmp(value, desired_value) == 0) {
+        if (maxnaps < 1) {
+            maxnaps = 1;
+        }
+        while (maxnaps-- >= 0) {
+            if (property_matches(name, desired_value)) {
                 return 0;
             }
+            if (maxnaps >= 0) {
+                usleep(NAP_TIME * 1000);
+            }
+        }
+        return -1; /* failure */
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += maxwait;
+
+    pthread_mutex_lock(&prop_lock);
+    for (;;) {
+        /*
+         * Any change after the serial is taken wakes us up below, even one
+         * that the check only just missed.
+         */
+        serial = prop_serial;
+        pthread_mutex_unlock(&prop_lock);
+        if (property_matches(name, desired_value)) {
+            return 0;
+        }
+        if (ret == ETIMEDOUT) {
+            return -1; /* failure */
         }
-        if (maxnaps >= 0) {
-            usleep(NAP_TIME * 1000);
+        pthread_mutex_lock(&prop_lock);
+        while (prop_serial == serial && ret != ETIMEDOUT) {
+            ret = pthread_cond_timedwait(&prop_changed, &prop_lock, &deadline);
         }
     }
-    return -1; /* failure */
 }
 
 static int fill_ip_info(const char *interface,
@@ -357,52 +357,485 @@ int ifc_del_address(const char *name, const char * address, int prefixlen) {
 }
 
 /*
- * Clears IPv6 addresses on the specified interface.
+ * A batch of rtnetlink requests, sent to the kernel as a single multi-part
+ * message by ifc_batch_commit().  The first error building the batch is
+ * kept, and the commit then returns it without sending anything.
  */
-int ifc_clear_ipv6_addresses(const char *name) {
-    char rawaddrstr[INET6_ADDRSTRLEN], addrstr[INET6_ADDRSTRLEN];
-    unsigned int prefixlen;
-    int lasterror = 0, i, j, ret;
-    char ifname[64];  // Currently, IFNAMSIZ = 16.
-    FILE *f = fopen("/proc/net/if_inet6", "r");
-    if (!f) {
-        return -errno;
+struct ifc_batch {
+    char *buf;
+    size_t len;
+    size_t size;
+    unsigned int count;
+    int error;
+};
+
+#define IFC_NL_RECV_SIZE 8192
+
+struct ifc_batch *ifc_batch_new(void)
+{
+    return calloc(1, sizeof(struct ifc_batch));
+}
+
+void ifc_batch_free(struct ifc_batch *batch)
+{
+    if (batch != NULL) {
+        free(batch->buf);
+        free(batch);
+    }
+}
+
+/*
+ * Starts a request of type with a header of hdrlen bytes and room for
+ * attrlen bytes of attributes.  Returns NULL, with the batch error set, if
+ * there is no memory.
+ */
+static struct nlmsghdr *ifc_batch_start(struct ifc_batch *batch, int type,
+                                        int flags, size_t hdrlen, size_t attrlen)
+{
+    size_t need = NLMSG_SPACE(hdrlen) + attrlen;
+    struct nlmsghdr *nh;
+
+    if (batch->error) {
+        return NULL;
+    }
+    if (batch->len + need > batch->size) {
+        size_t size = batch->size ? batch->size * 2 : 1024;
+        char *buf;
+
+        while (size < batch->len + need) {
+            size *= 2;
+        }
+        buf = realloc(batch->buf, size);
+        if (buf == NULL) {
+            batch->error = -ENOMEM;
+            return NULL;
+        }
+        batch->buf = buf;
+        batch->size = size;
+    }
+
+    nh = (struct nlmsghdr *) (batch->buf + batch->len);
+    memset(nh, 0, need);
+    nh->nlmsg_len = NLMSG_LENGTH(hdrlen);
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    nh->nlmsg_seq = ++batch->count;
+    return nh;
+}
+
+static void ifc_batch_add_attr(struct nlmsghdr *nh, int type, const void *data,
+                               size_t len)
+{
+    struct rtattr *rta = (struct rtattr *) (((char *) nh) + NLMSG_ALIGN(nh->nlmsg_len));
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_LENGTH(len);
+}
+
+static void ifc_batch_end(struct ifc_batch *batch, struct nlmsghdr *nh)
+{
+    batch->len += NLMSG_ALIGN(nh->nlmsg_len);
+}
+
+/*
+ * Looks up the interface index of name, setting the batch error if there
+ * is no such interface.
+ */
+static int ifc_batch_ifindex(struct ifc_batch *batch, const char *name)
+{
+    int ifindex = if_nametoindex(name);
+
+    if (ifindex == 0 && !batch->error) {
+        batch->error = -errno;
+    }
+    return ifindex;
+}
+
+/*
+ * Converts a numeric address to its family, binary form and length,
+ * setting the batch error if it isn't one.
+ */
+static int ifc_batch_address_of(struct ifc_batch *batch, const char *address,
+                                struct sockaddr_storage *ss, void **addr,
+                                size_t *addrlen)
+{
+    int ret = string_to_ip(address, ss);
+
+    if (ret == 0) {
+        if (ss->ss_family == AF_INET) {
+            *addr = &((struct sockaddr_in *) ss)->sin_addr;
+            *addrlen = INET_ADDRLEN;
+            return 0;
+        }
+        if (ss->ss_family == AF_INET6) {
+            *addr = &((struct sockaddr_in6 *) ss)->sin6_addr;
+            *addrlen = INET6_ADDRLEN;
+            return 0;
+        }
+        ret = -EAFNOSUPPORT;
+    } else {
+        ret = -EINVAL;
+    }
+    if (!batch->error) {
+        batch->error = ret;
+    }
+    return ret;
+}
+
+/*
+ * Adds bringing the named interface up or down to the batch.
+ */
+void ifc_batch_link(struct ifc_batch *batch, const char *name, int up)
+{
+    int ifindex = ifc_batch_ifindex(batch, name);
+    struct nlmsghdr *nh;
+    struct ifinfomsg *ifi;
+
+    nh = ifc_batch_start(batch, RTM_NEWLINK, 0, sizeof(*ifi), 0);
+    if (nh == NULL) {
+        return;
+    }
+    ifi = NLMSG_DATA(nh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    ifi->ifi_flags = up ? IFF_UP : 0;
+    ifi->ifi_change = IFF_UP;
+    ifc_batch_end(batch, nh);
+}
+
+/*
+ * Adds adding (RTM_NEWADDR) or deleting (RTM_DELADDR) an IP address on the
+ * named interface to the batch, as ifc_act_on_address() does.
+ */
+void ifc_batch_address(struct ifc_batch *batch, int action, const char *name,
+                       const char *address, int prefixlen)
+{
+    int ifindex = ifc_batch_ifindex(batch, name);
+    struct sockaddr_storage ss;
+    void *addr;
+    size_t addrlen;
+    struct nlmsghdr *nh;
+    struct ifaddrmsg *ifa;
+
+    if (ifc_batch_address_of(batch, address, &ss, &addr, &addrlen)) {
+        return;
+    }
+    nh = ifc_batch_start(batch, action, 0, sizeof(*ifa), RTA_SPACE(INET6_ADDRLEN));
+    if (nh == NULL) {
+        return;
+    }
+    ifa = NLMSG_DATA(nh);
+    ifa->ifa_family = ss.ss_family;
+    ifa->ifa_prefixlen = prefixlen;
+    ifa->ifa_index = ifindex;
+    ifc_batch_add_attr(nh, IFA_LOCAL, addr, addrlen);
+    ifc_batch_end(batch, nh);
+}
+
+/*
+ * Adds adding (RTM_NEWROUTE) or deleting (RTM_DELROUTE) a route through the
+ * named interface to the batch.  gateway may be NULL for a directly
+ * connected route.  Adding a route that already exists is not an error,
+ * as with ifc_act_on_ipv4_route().
+ */
+void ifc_batch_route(struct ifc_batch *batch, int action, const char *name,
+                     const char *dst, int prefixlen, const char *gateway)
+{
+    int ifindex = ifc_batch_ifindex(batch, name);
+    struct sockaddr_storage dst_ss, gw_ss;
+    void *dst_addr, *gw_addr = NULL;
+    size_t dst_len, gw_len;
+    struct nlmsghdr *nh;
+    struct rtmsg *rtm;
+
+    if (ifc_batch_address_of(batch, dst, &dst_ss, &dst_addr, &dst_len)) {
+        return;
+    }
+    if (gateway != NULL &&
+            ifc_batch_address_of(batch, gateway, &gw_ss, &gw_addr, &gw_len)) {
+        return;
+    }
+    if (gw_addr != NULL && gw_ss.ss_family != dst_ss.ss_family) {
+        if (!batch->error) {
+            batch->error = -EINVAL;
+        }
+        return;
+    }
+
+    nh = ifc_batch_start(batch, action,
+                         action == RTM_NEWROUTE ? NLM_F_CREATE | NLM_F_EXCL : 0,
+                         sizeof(*rtm),
+                         2 * RTA_SPACE(INET6_ADDRLEN) + RTA_SPACE(sizeof(int)));
+    if (nh == NULL) {
+        return;
+    }
+    rtm = NLMSG_DATA(nh);
+    rtm->rtm_family = dst_ss.ss_family;
+    rtm->rtm_dst_len = prefixlen;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    if (action == RTM_NEWROUTE) {
+        rtm->rtm_protocol = RTPROT_BOOT;
+        rtm->rtm_scope = gw_addr != NULL ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+        rtm->rtm_type = RTN_UNICAST;
+    } else {
+        rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    if (prefixlen > 0) {
+        ifc_batch_add_attr(nh, RTA_DST, dst_addr, dst_len);
+    }
+    if (gw_addr != NULL) {
+        ifc_batch_add_attr(nh, RTA_GATEWAY, gw_addr, gw_len);
+    }
+    ifc_batch_add_attr(nh, RTA_OIF, &ifindex, sizeof(ifindex));
+    ifc_batch_end(batch, nh);
+}
+
+/*
+ * Sends all the requests of the batch in one message and waits for the
+ * kernel to acknowledge each of them.  The kernel carries on after a
+ * request fails, so all of them are attempted.  The batch is emptied
+ * either way.
+ *
+ * Returns zero on success and the first negative errno on failure.
+ */
+int ifc_batch_commit(struct ifc_batch *batch)
+{
+    char buf[IFC_NL_RECV_SIZE];
+    unsigned int acked = 0;
+    int s, len, ret = batch->error;
+
+    if (ret || batch->count == 0) {
+        goto out;
+    }
+
+    s = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (s < 0) {
+        ret = -errno;
+        goto out;
     }
+    if (send(s, batch->buf, batch->len, 0) < 0) {
+        ret = -errno;
+        close(s);
+        goto out;
+    }
+
+    while (acked < batch->count) {
+        struct nlmsghdr *nh;
 
-    // Format:
-    // 20010db8000a0001fc446aa4b5b347ed 03 40 00 01    wlan0
-    while (fscanf(f, "%32s %*02x %02x %*02x %*02x %63s\n",
-                  rawaddrstr, &prefixlen, ifname) == 3) {
-        // Is this the interface we're looking for?
-        if (strcmp(name, ifname)) {
-            continue;
+        len = recv(s, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!ret) {
+                ret = -errno;
+            }
+            break;
         }
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned) len);
+                nh = NLMSG_NEXT(nh, len)) {
+            struct nlmsgerr *err;
 
-        // Put the colons back into the address.
-        for (i = 0, j = 0; i < 32; i++, j++) {
-            addrstr[j] = rawaddrstr[i];
-            if (i % 4 == 3) {
-                addrstr[++j] = ':';
+            if (nh->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            err = NLMSG_DATA(nh);
+            acked++;
+            if (err->error == -EEXIST && err->msg.nlmsg_type == RTM_NEWROUTE) {
+                continue;
+            }
+            if (err->error && !ret) {
+                ret = err->error;
             }
         }
-        addrstr[j - 1] = '\0';
+    }
+    close(s);
+
+out:
+    batch->len = 0;
+    batch->count = 0;
+    batch->error = 0;
+    return ret;
+}
+
+/*
+ * Dumps the addresses of family (or AF_UNSPEC for all) on the interface
+ * with index ifindex, calling cb for each.  Returns zero or negative errno.
+ */
+static int ifc_dump_addresses(int ifindex, int family,
+                              void (*cb)(struct ifaddrmsg *ifa, void *addr, void *data),
+                              void *data)
+{
+    struct {
+        struct nlmsghdr n;
+        struct ifaddrmsg r;
+    } req;
+    char buf[IFC_NL_RECV_SIZE];
+    int s, len, ret = 0, done = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.r));
+    req.n.nlmsg_type = RTM_GETADDR;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.n.nlmsg_seq = 1;
+    req.r.ifa_family = family;
 
-        // Don't delete the link-local address as well, or it will disable IPv6
-        // on the interface.
-        if (strncmp(addrstr, "fe80:", 5) == 0) {
-            continue;
+    s = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (s < 0) {
+        return -errno;
+    }
+    if (send(s, &req, req.n.nlmsg_len, 0) < 0) {
+        ret = -errno;
+        close(s);
+        return ret;
+    }
+
+    while (!done) {
+        struct nlmsghdr *nh;
+
+        len = recv(s, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = -errno;
+            break;
         }
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned) len);
+                nh = NLMSG_NEXT(nh, len)) {
+            struct ifaddrmsg *ifa;
+            struct rtattr *rta;
+            int rtalen;
+            void *local = NULL, *address = NULL;
+
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                ret = ((struct nlmsgerr *) NLMSG_DATA(nh))->error;
+                done = 1;
+                break;
+            }
+            if (nh->nlmsg_type != RTM_NEWADDR) {
+                continue;
+            }
+            ifa = NLMSG_DATA(nh);
+            if ((int) ifa->ifa_index != ifindex) {
+                continue;
+            }
+            rtalen = IFA_PAYLOAD(nh);
+            for (rta = IFA_RTA(ifa); RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen)) {
+                if (rta->rta_type == IFA_LOCAL) {
+                    local = RTA_DATA(rta);
+                } else if (rta->rta_type == IFA_ADDRESS) {
+                    address = RTA_DATA(rta);
+                }
+            }
+            // IFA_ADDRESS is the peer on point-to-point links; IFA_LOCAL,
+            // when present, is always our own address.
+            if (local != NULL) {
+                cb(ifa, local, data);
+            } else if (address != NULL) {
+                cb(ifa, address, data);
+            }
+        }
+    }
+    close(s);
+    return ret;
+}
+
+struct ifc_get_addresses_state {
+    struct ifc_address *addrs;
+    int max;
+    int count;
+};
+
+static void ifc_get_addresses_cb(struct ifaddrmsg *ifa, void *addr, void *data)
+{
+    struct ifc_get_addresses_state *state = data;
+
+    if (state->count < state->max) {
+        struct ifc_address *a = &state->addrs[state->count];
 
-        ret = ifc_del_address(ifname, addrstr, prefixlen);
+        a->family = ifa->ifa_family;
+        a->prefixlen = ifa->ifa_prefixlen;
+        a->flags = ifa->ifa_flags;
+        a->scope = ifa->ifa_scope;
+        inet_ntop(ifa->ifa_family, addr, a->address, sizeof(a->address));
+    }
+    state->count++;
+}
+
+/*
+ * Fills in up to max addresses of family (or AF_UNSPEC for all) on the
+ * named interface, from a single dump of the kernel's address table.
+ *
+ * Returns the number of addresses the interface has, which may be more
+ * than max, or negative errno on failure.
+ */
+int ifc_get_addresses(const char *name, int family, struct ifc_address *addrs,
+                      int max)
+{
+    struct ifc_get_addresses_state state = { addrs, max, 0 };
+    int ifindex, ret;
+
+    ifindex = if_nametoindex(name);
+    if (ifindex == 0) {
+        return -errno;
+    }
+    ret = ifc_dump_addresses(ifindex, family, ifc_get_addresses_cb, &state);
+    return ret ? ret : state.count;
+}
+
+struct ifc_clear_ipv6_state {
+    struct ifc_batch *batch;
+    const char *name;
+};
+
+static void ifc_clear_ipv6_cb(struct ifaddrmsg *ifa, void *addr, void *data)
+{
+    struct ifc_clear_ipv6_state *state = data;
+    char addrstr[INET6_ADDRSTRLEN];
+
+    // Don't delete the link-local address as well, or it will disable IPv6
+    // on the interface.
+    if (IN6_IS_ADDR_LINKLOCAL((struct in6_addr *) addr)) {
+        return;
+    }
+    inet_ntop(AF_INET6, addr, addrstr, sizeof(addrstr));
+    ifc_batch_address(state->batch, RTM_DELADDR, state->name, addrstr,
+                      ifa->ifa_prefixlen);
+}
+
+/*
+ * Clears IPv6 addresses on the specified interface.
+ */
+int ifc_clear_ipv6_addresses(const char *name) {
+    struct ifc_clear_ipv6_state state;
+    int ifindex, ret;
+
+    ifindex = if_nametoindex(name);
+    if (ifindex == 0) {
+        return -errno;
+    }
+    state.batch = ifc_batch_new();
+    if (state.batch == NULL) {
+        return -ENOMEM;
+    }
+    state.name = name;
+
+    ret = ifc_dump_addresses(ifindex, AF_INET6, ifc_clear_ipv6_cb, &state);
+    if (ret == 0) {
+        ret = ifc_batch_commit(state.batch);
         if (ret) {
-            ALOGE("Deleting address %s/%d on %s: %s", addrstr, prefixlen, ifname,
-                 strerror(-ret));
-            lasterror = ret;
+            ALOGE("Deleting addresses on %s: %s", name, strerror(-ret));
         }
     }
-
-    fclose(f);
-    return lasterror;
+    ifc_batch_free(state.batch);
+    return ret;
 }
 
 /*
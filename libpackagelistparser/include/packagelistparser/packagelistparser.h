@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PACKAGELISTPARSER_H_
+#define _PACKAGELISTPARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/cdefs.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/* The file containing the list of installed packages on the system */
+#define PACKAGES_LIST_FILE  "/data/system/packages.list"
+
+/*
+ * An index of packages.list, with lookups by package name and by appid
+ * in constant time. It is a single block of memory without pointers, so
+ * that it can be kept in a file and mapped again as it is, see
+ * packagelist_save() and packagelist_load().
+ */
+struct packagelist;
+
+/*
+ * A package, as on its line of packages.list:
+ *
+ *  <name> <uid> <debuggable> <data_dir> <seinfo> <gids>
+ *
+ * The strings point into the index and live as long as it does.
+ */
+struct pkg_info {
+    const char *name;
+    uid_t uid;          /* the appid, the uid of the package for user 0 */
+    bool debuggable;
+    const char *data_dir;
+    const char *seinfo;
+    const char *gids;   /* comma-separated, or "none" */
+};
+
+/*
+ * Indexes the packages.list contents in data. Lines that are not in the
+ * format above are left out. source, if not NULL, is the stat of the file
+ * data was read from, which packagelist_load() checks the index against.
+ *
+ * Returns NULL and sets errno on failure.
+ */
+struct packagelist *packagelist_parse(const char *data, size_t len,
+                                      const struct stat *source);
+
+void packagelist_free(struct packagelist *list);
+
+/* The number of packages in the index. */
+size_t packagelist_size(const struct packagelist *list);
+
+/*
+ * Looks up the package called name, ignoring the case of ASCII letters if
+ * icase. Returns 0 and fills in info, or -1 and sets errno to ENOENT if
+ * there is no such package.
+ */
+int packagelist_find_name(const struct packagelist *list, const char *name,
+                          bool icase, struct pkg_info *info);
+
+/*
+ * Looks up a package with the given appid. Packages sharing a uid share
+ * their appid too; it is the first of them in packages.list that is found.
+ */
+int packagelist_find_appid(const struct packagelist *list, uid_t appid,
+                           struct pkg_info *info);
+
+/*
+ * Writes the index to path, through a temporary file next to it renamed
+ * over it, readable and writable by the owner only. Returns 0, or -1 and
+ * sets errno.
+ */
+int packagelist_save(const struct packagelist *list, const char *path);
+
+/*
+ * Maps the index saved at path. It is only used if it was made from a file
+ * with the same inode, size and modification time as source, if it is
+ * owned by root and can't be written by anyone else. Only its header is
+ * checked here, the lookups check the rest as they use it. Returns NULL and
+ * sets errno otherwise, ESTALE when it was made from another version of
+ * the file.
+ */
+struct packagelist *packagelist_load(const char *path,
+                                     const struct stat *source);
+
+__END_DECLS
+
+#endif /* _PACKAGELISTPARSER_H_ */
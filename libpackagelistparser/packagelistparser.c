@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <packagelistparser/packagelistparser.h>
+
+/*
+ * The index is laid out as
+ *
+ *   struct packagelist                     the header
+ *   uint32_t by_name[buckets]              hash table by package name
+ *   uint32_t by_appid[buckets]             hash table by appid
+ *   struct pkg_record records[count]
+ *   char strings[strings_size]             the strings of the records
+ *
+ * A hash table entry is the index of a record plus one, or 0 if empty.
+ * Collisions are resolved by linear probing. Everything is an offset, so
+ * that a saved index can be used as it is mapped. Since a saved index is
+ * read from a file, the lookups check every offset before they use it,
+ * and load only has to check the header.
+ *
+ * It is built with mmap() rather than malloc(), because run-as builds it
+ * while it is still running as root.
+ */
+
+#define PACKAGELIST_MAGIC   0x4c474b50  /* "PKGL" */
+#define PACKAGELIST_VERSION 1
+
+#define MIN_BUCKETS 16
+
+struct packagelist {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_ino;
+    uint64_t source_size;
+    uint64_t source_mtime_sec;
+    uint64_t source_mtime_nsec;
+    uint32_t size;          /* of the whole index */
+    uint32_t count;         /* of records */
+    uint32_t buckets;       /* of each hash table, a power of 2 */
+    uint32_t strings_size;
+};
+
+struct pkg_record {
+    uint32_t name;          /* offsets into the strings */
+    uint32_t data_dir;
+    uint32_t seinfo;
+    uint32_t gids;
+    uint32_t uid;
+    uint32_t debuggable;
+};
+
+/* A line of packages.list, split into its fields */
+struct pkg_line {
+    const char *name;
+    size_t name_len;
+    const char *data_dir;
+    size_t data_dir_len;
+    const char *seinfo;
+    size_t seinfo_len;
+    const char *gids;
+    size_t gids_len;
+    uint32_t uid;
+    uint32_t debuggable;
+};
+
+static uint64_t layout_size(uint64_t buckets, uint64_t count, uint64_t strings_size)
+{
+    return sizeof(struct packagelist) + 2 * buckets * sizeof(uint32_t) +
+           count * sizeof(struct pkg_record) + strings_size;
+}
+
+static const uint32_t *by_name(const struct packagelist *list)
+{
+    return (const uint32_t *)(list + 1);
+}
+
+static const uint32_t *by_appid(const struct packagelist *list)
+{
+    return by_name(list) + list->buckets;
+}
+
+static const struct pkg_record *records(const struct packagelist *list)
+{
+    return (const struct pkg_record *)(by_appid(list) + list->buckets);
+}
+
+static const char *strings(const struct packagelist *list)
+{
+    return (const char *)(records(list) + list->count);
+}
+
+static char fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+/* FNV-1a, of the name with ASCII letters folded so that both exact and
+ * case-insensitive lookups find it in the same bucket. */
+static uint32_t hash_name(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)fold(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_appid(uint32_t appid)
+{
+    return appid * 2654435761u;
+}
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Takes the field at *pp, up to the next space or end, and the spaces
+ * after it. Returns its length, 0 if there is none. */
+static size_t next_field(const char **pp, const char *end, const char **field)
+{
+    const char *p = *pp;
+    size_t len;
+
+    *field = p;
+    while (p < end && !is_space(*p) && *p != '\0')
+        p++;
+    len = p - *field;
+    while (p < end && is_space(*p))
+        p++;
+    *pp = p;
+    return len;
+}
+
+/* Parses a decimal number of up to INT_MAX. Returns -1 if the field is
+ * anything else. */
+static int64_t parse_decimal(const char *p, size_t len)
+{
+    int64_t value = 0;
+    size_t i;
+
+    if (len == 0)
+        return -1;
+    for (i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        value = value * 10 + (p[i] - '0');
+        if (value > INT_MAX)
+            return -1;
+    }
+    return value;
+}
+
+/* Splits the line from p to end into its fields. The gids are missing
+ * from old versions of the file. Returns 0, or -1 if the line is not in
+ * the expected format. */
+static int parse_line(const char *p, const char *end, struct pkg_line *line)
+{
+    const char *field;
+    size_t len;
+    int64_t value;
+
+    line->name_len = next_field(&p, end, &line->name);
+    if (line->name_len == 0)
+        return -1;
+
+    len = next_field(&p, end, &field);
+    value = parse_decimal(field, len);
+    if (value < 0)
+        return -1;
+    line->uid = (uint32_t)value;
+
+    len = next_field(&p, end, &field);
+    value = parse_decimal(field, len);
+    if (value != 0 && value != 1)
+        return -1;
+    line->debuggable = (uint32_t)value;
+
+    line->data_dir_len = next_field(&p, end, &line->data_dir);
+    if (line->data_dir_len == 0)
+        return -1;
+
+    line->seinfo_len = next_field(&p, end, &line->seinfo);
+    if (line->seinfo_len == 0)
+        return -1;
+
+    line->gids_len = next_field(&p, end, &line->gids);
+    return 0;
+}
+
+/* Copies the len bytes at s to the strings of list, at *offset, which is
+ * advanced past them. Returns the offset they were copied to. */
+static uint32_t add_string(struct packagelist *list, uint32_t *offset,
+                           const char *s, size_t len)
+{
+    char *dst = (char *)strings(list) + *offset;
+    uint32_t ret = *offset;
+
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    *offset += len + 1;
+    return ret;
+}
+
+static void insert(uint32_t *table, uint32_t buckets, uint32_t hash, uint32_t entry)
+{
+    uint32_t i = hash & (buckets - 1);
+
+    while (table[i] != 0)
+        i = (i + 1) & (buckets - 1);
+    table[i] = entry;
+}
+
+struct packagelist *packagelist_parse(const char *data, size_t len,
+                                      const struct stat *source)
+{
+    const char *end = data + len;
+    const char *p;
+    struct pkg_line line;
+    uint64_t count = 0;
+    uint64_t strings_size = 1;  /* keeps a '\0' at the end */
+    uint64_t buckets = MIN_BUCKETS;
+    uint64_t size;
+    struct packagelist *list;
+    struct pkg_record *record;
+    uint32_t offset = 0;
+
+    /* Sizes everything first, so that it takes a single mapping */
+    for (p = data; p < end; ) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        if (parse_line(p, eol, &line) == 0) {
+            count++;
+            strings_size += line.name_len + line.data_dir_len +
+                            line.seinfo_len + line.gids_len + 4;
+        }
+        p = eol + 1;
+    }
+    while (buckets < 2 * count)
+        buckets *= 2;
+
+    size = layout_size(buckets, count, strings_size);
+    if (size > UINT32_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+    list = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (list == MAP_FAILED)
+        return NULL;
+
+    list->magic = PACKAGELIST_MAGIC;
+    list->version = PACKAGELIST_VERSION;
+    if (source != NULL) {
+        list->source_ino = source->st_ino;
+        list->source_size = source->st_size;
+        list->source_mtime_sec = source->st_mtim.tv_sec;
+        list->source_mtime_nsec = source->st_mtim.tv_nsec;
+    }
+    list->size = size;
+    list->count = count;
+    list->buckets = buckets;
+    list->strings_size = strings_size;
+
+    record = (struct pkg_record *)records(list);
+    for (p = data; p < end; ) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        if (parse_line(p, eol, &line) == 0) {
+            uint32_t entry = record - records(list) + 1;
+
+            record->name = add_string(list, &offset, line.name, line.name_len);
+            record->data_dir = add_string(list, &offset, line.data_dir, line.data_dir_len);
+            record->seinfo = add_string(list, &offset, line.seinfo, line.seinfo_len);
+            record->gids = add_string(list, &offset, line.gids, line.gids_len);
+            record->uid = line.uid;
+            record->debuggable = line.debuggable;
+            /* In file order, so that the first of equal keys is found */
+            insert((uint32_t *)by_name(list), buckets,
+                   hash_name(line.name, line.name_len), entry);
+            insert((uint32_t *)by_appid(list), buckets, hash_appid(line.uid), entry);
+            record++;
+        }
+        p = eol + 1;
+    }
+
+    mprotect(list, size, PROT_READ);
+    return list;
+}
+
+void packagelist_free(struct packagelist *list)
+{
+    int old_errno = errno;
+
+    if (list != NULL)
+        munmap(list, list->size);
+    errno = old_errno;
+}
+
+size_t packagelist_size(const struct packagelist *list)
+{
+    return list->count;
+}
+
+/* Returns the record of a hash table entry, NULL if the entry is empty or
+ * if the record isn't within the index. */
+static const struct pkg_record *get_record(const struct packagelist *list,
+                                           uint32_t entry)
+{
+    const struct pkg_record *record;
+
+    if (entry == 0 || entry > list->count)
+        return NULL;
+    record = &records(list)[entry - 1];
+    if (record->name >= list->strings_size || record->data_dir >= list->strings_size ||
+            record->seinfo >= list->strings_size || record->gids >= list->strings_size)
+        return NULL;
+    return record;
+}
+
+static void fill_info(const struct packagelist *list, const struct pkg_record *record,
+                      struct pkg_info *info)
+{
+    info->name = strings(list) + record->name;
+    info->uid = record->uid;
+    info->debuggable = record->debuggable != 0;
+    info->data_dir = strings(list) + record->data_dir;
+    info->seinfo = strings(list) + record->seinfo;
+    info->gids = strings(list) + record->gids;
+}
+
+int packagelist_find_name(const struct packagelist *list, const char *name,
+                          bool icase, struct pkg_info *info)
+{
+    const uint32_t *table = by_name(list);
+    uint32_t mask = list->buckets - 1;
+    uint32_t i = hash_name(name, strlen(name)) & mask;
+    uint32_t probes;
+
+    for (probes = 0; probes < list->buckets && table[i] != 0; probes++) {
+        const struct pkg_record *record = get_record(list, table[i]);
+        if (record != NULL) {
+            const char *s = strings(list) + record->name;
+            if (icase ? !strcasecmp(s, name) : !strcmp(s, name)) {
+                fill_info(list, record, info);
+                return 0;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+int packagelist_find_appid(const struct packagelist *list, uid_t appid,
+                           struct pkg_info *info)
+{
+    const uint32_t *table = by_appid(list);
+    uint32_t mask = list->buckets - 1;
+    uint32_t i = hash_appid(appid) & mask;
+    uint32_t probes;
+
+    for (probes = 0; probes < list->buckets && table[i] != 0; probes++) {
+        const struct pkg_record *record = get_record(list, table[i]);
+        if (record != NULL && record->uid == appid) {
+            fill_info(list, record, info);
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+int packagelist_save(const struct packagelist *list, const char *path)
+{
+    char tmp[PATH_MAX];
+    const char *p = (const char *)list;
+    size_t left = list->size;
+    int fd;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+
+    while (left > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, left));
+        if (n <= 0)
+            goto err;
+        p += n;
+        left -= n;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        goto err;
+    }
+    if (rename(tmp, path) < 0) {
+        fd = -1;
+        goto err;
+    }
+    return 0;
+
+err:
+    {
+        int old_errno = errno;
+        if (fd >= 0)
+            close(fd);
+        unlink(tmp);
+        errno = old_errno;
+    }
+    return -1;
+}
+
+struct packagelist *packagelist_load(const char *path,
+                                     const struct stat *source)
+{
+    struct packagelist *list;
+    struct stat st;
+    int old_errno;
+    int fd;
+
+    fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0)
+        goto err_close;
+    if (!S_ISREG(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+            st.st_size < (off_t)sizeof(*list) || st.st_size > UINT32_MAX) {
+        errno = EINVAL;
+        goto err_close;
+    }
+
+    list = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (list == MAP_FAILED)
+        goto err_close;
+    close(fd);
+
+    if (list->magic != PACKAGELIST_MAGIC || list->version != PACKAGELIST_VERSION ||
+            list->size != st.st_size || list->buckets == 0 ||
+            (list->buckets & (list->buckets - 1)) != 0 || list->strings_size == 0 ||
+            layout_size(list->buckets, list->count, list->strings_size) != list->size ||
+            strings(list)[list->strings_size - 1] != '\0') {
+        munmap(list, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (list->source_ino != (uint64_t)source->st_ino ||
+            list->source_size != (uint64_t)source->st_size ||
+            list->source_mtime_sec != (uint64_t)source->st_mtim.tv_sec ||
+            list->source_mtime_nsec != (uint64_t)source->st_mtim.tv_nsec) {
+        munmap(list, st.st_size);
+        errno = ESTALE;
+        return NULL;
+    }
+    return list;
+
+err_close:
+    old_errno = errno;
+    close(fd);
+    errno = old_errno;
+    return NULL;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <packagelistparser/packagelistparser.h>
+
+static const char kList[] =
+    "com.example.app 10045 1 /data/data/com.example.app default 3003,1028\n"
+    "com.example.shared 10050 0 /data/data/com.example.shared platform none\n"
+    "com.example.Shared2 10050 0 /data/data/com.example.shared2 platform none\n"
+    "broken line\n"
+    "com.example.baddebug 10060 2 /data/data/com.example.baddebug default none\n"
+    "com.example.old 10070 0 /data/data/com.example.old default";
+
+TEST(PackageListParser, Parse)
+{
+    struct packagelist *list = packagelist_parse(kList, strlen(kList), NULL);
+    ASSERT_TRUE(list != NULL);
+    EXPECT_EQ(4U, packagelist_size(list));
+
+    struct pkg_info info;
+    ASSERT_EQ(0, packagelist_find_name(list, "com.example.app", false, &info));
+    EXPECT_STREQ("com.example.app", info.name);
+    EXPECT_EQ(10045U, info.uid);
+    EXPECT_TRUE(info.debuggable);
+    EXPECT_STREQ("/data/data/com.example.app", info.data_dir);
+    EXPECT_STREQ("default", info.seinfo);
+    EXPECT_STREQ("3003,1028", info.gids);
+
+    // Without the gids, as in old versions of the file
+    ASSERT_EQ(0, packagelist_find_name(list, "com.example.old", false, &info));
+    EXPECT_EQ(10070U, info.uid);
+    EXPECT_STREQ("", info.gids);
+
+    EXPECT_EQ(-1, packagelist_find_name(list, "com.example", false, &info));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_EQ(-1, packagelist_find_name(list, "com.example.baddebug", false, &info));
+    EXPECT_EQ(-1, packagelist_find_name(list, "broken", false, &info));
+
+    packagelist_free(list);
+}
+
+TEST(PackageListParser, CaseInsensitive)
+{
+    struct packagelist *list = packagelist_parse(kList, strlen(kList), NULL);
+    ASSERT_TRUE(list != NULL);
+
+    struct pkg_info info;
+    EXPECT_EQ(-1, packagelist_find_name(list, "COM.example.APP", false, &info));
+    ASSERT_EQ(0, packagelist_find_name(list, "COM.example.APP", true, &info));
+    EXPECT_STREQ("com.example.app", info.name);
+    ASSERT_EQ(0, packagelist_find_name(list, "com.example.shared2", true, &info));
+    EXPECT_STREQ("com.example.Shared2", info.name);
+
+    packagelist_free(list);
+}
+
+TEST(PackageListParser, Appid)
+{
+    struct packagelist *list = packagelist_parse(kList, strlen(kList), NULL);
+    ASSERT_TRUE(list != NULL);
+
+    struct pkg_info info;
+    ASSERT_EQ(0, packagelist_find_appid(list, 10045, &info));
+    EXPECT_STREQ("com.example.app", info.name);
+    // The first of the packages sharing a uid
+    ASSERT_EQ(0, packagelist_find_appid(list, 10050, &info));
+    EXPECT_STREQ("com.example.shared", info.name);
+    EXPECT_EQ(-1, packagelist_find_appid(list, 10046, &info));
+    EXPECT_EQ(ENOENT, errno);
+
+    packagelist_free(list);
+}
+
+TEST(PackageListParser, Many)
+{
+    std::string data;
+    for (int i = 0; i < 5000; i++) {
+        data += "com.example.p" + std::to_string(i) + " " + std::to_string(10000 + i) +
+                " 0 /data/data/p default none\n";
+    }
+    struct packagelist *list = packagelist_parse(data.c_str(), data.size(), NULL);
+    ASSERT_TRUE(list != NULL);
+    EXPECT_EQ(5000U, packagelist_size(list));
+
+    struct pkg_info info;
+    for (int i = 0; i < 5000; i++) {
+        std::string name = "com.example.p" + std::to_string(i);
+        ASSERT_EQ(0, packagelist_find_name(list, name.c_str(), false, &info));
+        ASSERT_EQ(10000U + i, info.uid);
+        ASSERT_EQ(0, packagelist_find_appid(list, 10000 + i, &info));
+        ASSERT_STREQ(name.c_str(), info.name);
+    }
+
+    packagelist_free(list);
+}
+
+TEST(PackageListParser, Empty)
+{
+    struct packagelist *list = packagelist_parse("", 0, NULL);
+    ASSERT_TRUE(list != NULL);
+    EXPECT_EQ(0U, packagelist_size(list));
+
+    struct pkg_info info;
+    EXPECT_EQ(-1, packagelist_find_name(list, "com.example.app", true, &info));
+    EXPECT_EQ(-1, packagelist_find_appid(list, 10045, &info));
+
+    packagelist_free(list);
+}
+
+TEST(PackageListParser, SaveLoad)
+{
+    if (getuid() != 0) {
+        // A saved index is only used if owned by root
+        return;
+    }
+
+    char source[] = "/data/local/tmp/packages.list.XXXXXX";
+    int fd = mkstemp(source);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ((ssize_t)strlen(kList), write(fd, kList, strlen(kList)));
+    struct stat st;
+    ASSERT_EQ(0, fstat(fd, &st));
+    close(fd);
+
+    std::string path = std::string(source) + ".idx";
+    struct packagelist *list = packagelist_parse(kList, strlen(kList), &st);
+    ASSERT_TRUE(list != NULL);
+    ASSERT_EQ(0, packagelist_save(list, path.c_str()));
+    packagelist_free(list);
+
+    list = packagelist_load(path.c_str(), &st);
+    ASSERT_TRUE(list != NULL);
+    EXPECT_EQ(4U, packagelist_size(list));
+    struct pkg_info info;
+    ASSERT_EQ(0, packagelist_find_name(list, "com.example.shared", false, &info));
+    EXPECT_EQ(10050U, info.uid);
+    EXPECT_STREQ("/data/data/com.example.shared", info.data_dir);
+    packagelist_free(list);
+
+    // Stale once packages.list is written again
+    struct stat changed = st;
+    changed.st_mtim.tv_nsec++;
+    EXPECT_TRUE(packagelist_load(path.c_str(), &changed) == NULL);
+    EXPECT_EQ(ESTALE, errno);
+
+    // Not used if anyone else could have written it
+    ASSERT_EQ(0, chmod(path.c_str(), 0666));
+    EXPECT_TRUE(packagelist_load(path.c_str(), &st) == NULL);
+    ASSERT_EQ(0, chmod(path.c_str(), 0600));
+
+    // Nor if it was cut short
+    ASSERT_EQ(0, truncate(path.c_str(), 64));
+    EXPECT_TRUE(packagelist_load(path.c_str(), &st) == NULL);
+    EXPECT_EQ(EINVAL, errno);
+
+    unlink(path.c_str());
+    unlink(source);
+}
@@ -8,6 +8,7 @@ include $(CLEAR_VARS)
 include $(CLEAR_VARS)
 PIXELFLINGER_SRC_FILES:= \
 	codeflinger/CodeCache.cpp \
+	bands.cpp \
 	format.cpp \
 	clear.cpp \
 	raster.cpp \
@@ -0,0 +1,193 @@
+/* libs/pixelflinger/bands.cpp
+**
+** Copyright 2016, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "bands.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// bands thinner than this are not worth handing to another thread
+#define MIN_BAND_ROWS   32
+#define MAX_THREADS     16
+
+struct band_pool_t {
+    pthread_mutex_t     busy;       // held by the context drawing
+    pthread_mutex_t     lock;       // protects what follows
+    pthread_cond_t      start;
+    pthread_cond_t      done;
+    uint32_t            generation;
+    int                 pending;
+
+    // the band being drawn by each thread, the caller's first
+    int                 count;
+    context_t*          bands[MAX_THREADS];
+
+    // what is being drawn
+    const context_t*    c;
+    void                (*draw)(context_t*, const void*);
+    const void*         args;
+    int32_t             top;
+    int32_t             bottom;
+    int                 num_bands;
+};
+
+static band_pool_t gPool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    0, 0, 0, { 0 }, 0, 0, 0, 0, 0, 0
+};
+static pthread_once_t gPoolOnce = PTHREAD_ONCE_INIT;
+
+static void draw_band(band_pool_t* p, int index)
+{
+    context_t* band = p->bands[index];
+    memcpy(band, p->c, sizeof(context_t));
+    const int32_t rows = p->bottom - p->top;
+    band->state.scissor.top    = p->top + (rows * index) / p->num_bands;
+    band->state.scissor.bottom = p->top + (rows * (index + 1)) / p->num_bands;
+    p->draw(band, p->args);
+}
+
+static void* band_worker(void* arg)
+{
+    band_pool_t* p = &gPool;
+    const int index = int(intptr_t(arg));
+    uint32_t generation = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->generation == generation) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        generation = p->generation;
+        if (index < p->num_bands) {
+            pthread_mutex_unlock(&p->lock);
+            draw_band(p, index);
+            pthread_mutex_lock(&p->lock);
+            if (--p->pending == 0) {
+                pthread_cond_signal(&p->done);
+            }
+        }
+    }
+    return NULL;
+}
+
+static context_t* alloc_band_context()
+{
+    // aligned on cache lines, like the contexts from gglInit()
+    void* base = malloc(sizeof(context_t) + 32);
+    if (!base) {
+        return NULL;
+    }
+    return (context_t*)((ptrdiff_t(base)+31) & ~0x1FL);
+}
+
+static void init_pool()
+{
+    band_pool_t* p = &gPool;
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.pf.threads", value, "1");
+    int threads = atoi(value);
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (threads < 2) {
+        return;
+    }
+
+    p->bands[0] = alloc_band_context();
+    if (!p->bands[0]) {
+        return;
+    }
+    int count = 1;
+    for ( ; count < threads ; count++) {
+        p->bands[count] = alloc_band_context();
+        if (!p->bands[count]) {
+            break;
+        }
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        int err = pthread_create(&thread, &attr, band_worker, (void*)intptr_t(count));
+        pthread_attr_destroy(&attr);
+        if (err) {
+            ALOGW("Could not start rasterizer thread: %s", strerror(err));
+            break;
+        }
+    }
+    p->count = count;
+}
+
+bool ggl_bands_enabled()
+{
+    pthread_once(&gPoolOnce, init_pool);
+    return gPool.count > 1;
+}
+
+bool ggl_bands_draw(context_t* c, int32_t top, int32_t bottom,
+        void (*draw)(context_t* band, const void* args), const void* args)
+{
+    band_pool_t* p = &gPool;
+    if (top < int32_t(c->state.scissor.top))
+        top = int32_t(c->state.scissor.top);
+    if (bottom > int32_t(c->state.scissor.bottom))
+        bottom = int32_t(c->state.scissor.bottom);
+    int num_bands = (bottom - top) / MIN_BAND_ROWS;
+    if (num_bands > p->count)
+        num_bands = p->count;
+    if (num_bands < 2)
+        return false;
+
+    // contexts on other threads draw without the pool for now
+    if (pthread_mutex_trylock(&p->busy) != 0)
+        return false;
+
+    pthread_mutex_lock(&p->lock);
+    p->c = c;
+    p->draw = draw;
+    p->args = args;
+    p->top = top;
+    p->bottom = bottom;
+    p->num_bands = num_bands;
+    p->pending = num_bands - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    draw_band(p, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->pending) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    pthread_mutex_unlock(&p->busy);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
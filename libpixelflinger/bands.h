@@ -0,0 +1,50 @@
+/* libs/pixelflinger/bands.h
+**
+** Copyright 2016, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_GGL_BANDS_H
+#define ANDROID_GGL_BANDS_H
+
+#include <private/pixelflinger/ggl_context.h>
+
+namespace android {
+
+/* Large primitives can be rasterized by a pool of worker threads, each
+ * drawing the rows of one horizontal band of the buffers. The pool has
+ * as many threads as debug.pf.threads says, and is off by default.
+ *
+ * Each band is drawn with a copy of the context whose scissor is
+ * clipped to the band, so the scanline functions, which only touch the
+ * rows they are given, run unchanged. ggl_bands_draw() returns once all
+ * the bands are drawn, so the context can change state right after, as
+ * without the pool.
+ */
+
+bool ggl_bands_enabled();
+
+/* Calls draw(band, args) once per band of rows top to bottom, on the pool
+ * and the calling thread, with band a copy of c. Returns false, having
+ * done nothing, if there aren't enough rows for several bands or the
+ * pool is busy with another context; the caller then draws as usual.
+ * The state of c must be validated.
+ */
+bool ggl_bands_draw(context_t* c, int32_t top, int32_t bottom,
+        void (*draw)(context_t* band, const void* args), const void* args);
+
+}; // namespace android
+
+#endif // ANDROID_GGL_BANDS_H
@@ -17,6 +17,7 @@
 
 #include <cutils/memory.h>
 
+#include "bands.h"
 #include "clear.h"
 #include "buffer.h"
 
@@ -29,6 +30,9 @@ static void ggl_clearColorx(void* c,
         GGLclampx r, GGLclampx g, GGLclampx b, GGLclampx a);        
 static void ggl_clearDepthx(void* c, GGLclampx depth);
 static void ggl_clearStencil(void* c, GGLint s);
+static void clear_rows(context_t* c, GGLbitfield mask,
+        uint32_t l, uint32_t t, uint32_t w, uint32_t h);
+static void clear_band(context_t* c, const void* args);
 
 // ----------------------------------------------------------------------------
 
@@ -127,8 +131,6 @@ static void ggl_clear(void* con, GGLbitfield mask)
 
             c->state.clear.colorPacked = GGL_HOST_TO_RGBA(colorPacked);
         }
-        const uint32_t packed = c->state.clear.colorPacked;
-        memset2d(c, c->state.buffers.color, packed, l, t, w, h);
     }
     if (mask & GGL_DEPTH_BUFFER_BIT) {
         if (c->state.clear.dirty & GGL_DEPTH_BUFFER_BIT) {
@@ -136,6 +138,23 @@ static void ggl_clear(void* con, GGLbitfield mask)
             uint32_t depth = fixedToZ(c->state.clear.depth);
             c->state.clear.depthPacked = (depth<<16)|depth;
         }
+    }
+
+    if (ggl_bands_enabled() &&
+            ggl_bands_draw(c, t, t + h, clear_band, &mask)) {
+        return;
+    }
+    clear_rows(c, mask, l, t, w, h);
+}
+
+static void clear_rows(context_t* c, GGLbitfield mask,
+        uint32_t l, uint32_t t, uint32_t w, uint32_t h)
+{
+    if (mask & GGL_COLOR_BUFFER_BIT) {
+        const uint32_t packed = c->state.clear.colorPacked;
+        memset2d(c, c->state.buffers.color, packed, l, t, w, h);
+    }
+    if (mask & GGL_DEPTH_BUFFER_BIT) {
         const uint32_t packed = c->state.clear.depthPacked;
         memset2d(c, c->state.buffers.depth, packed, l, t, w, h);
     }
@@ -143,6 +162,15 @@ static void ggl_clear(void* con, GGLbitfield mask)
     // XXX: do stencil buffer
 }
 
+static void clear_band(context_t* c, const void* args)
+{
+    const GGLbitfield mask = *static_cast<const GGLbitfield*>(args);
+    const uint32_t l = c->state.scissor.left;
+    const uint32_t t = c->state.scissor.top;
+    clear_rows(c, mask, l, t, c->state.scissor.right - l,
+            c->state.scissor.bottom - t);
+}
+
 static void ggl_clearColorx(void* con,
         GGLclampx r, GGLclampx g, GGLclampx b, GGLclampx a)
 {
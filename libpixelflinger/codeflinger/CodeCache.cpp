@@ -17,13 +17,20 @@
 
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <cutils/ashmem.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 #define LOG_TAG "CodeCache"
 #include <cutils/log.h>
 
@@ -101,7 +108,7 @@ static mspace getMspace()
 }
 
 Assembly::Assembly(size_t size)
-    : mCount(1), mSize(0)
+    : mCount(1), mSize(0), mOwned(true)
 {
     mBase = (uint32_t*)mspace_malloc(getMspace(), size);
     LOG_ALWAYS_FATAL_IF(mBase == NULL,
@@ -110,9 +117,16 @@ Assembly::Assembly(size_t size)
     mSize = size;
 }
 
+Assembly::Assembly(uint32_t* base, size_t size)
+    : mCount(1), mBase(base), mSize(size), mOwned(false)
+{
+}
+
 Assembly::~Assembly()
 {
-    mspace_free(getMspace(), mBase);
+    if (mOwned) {
+        mspace_free(getMspace(), mBase);
+    }
 }
 
 void Assembly::incStrong(const void*) const
@@ -150,8 +164,92 @@ ssize_t Assembly::resize(size_t newSize)
 
 // ----------------------------------------------------------------------------
 
+// The persistent cache file is a header followed by entries, back to back:
+//   header: "PFCC", the version, the length of the variant and the
+//           variant, padded to 16 bytes
+//   entry:  the size of the key, the size of the code, the key, padded
+//           to 16 bytes, then the code, padded to 16 bytes
+// Sizes are uint32_t. Entries are only ever appended, under flock(), so
+// that the mappings other processes have of the file stay valid; a file of
+// another variant is replaced with a new one for the same reason.
+
+static const uint32_t kPersistentMagic = 0x43434650; // "PFCC"
+static const uint32_t kPersistentVersion = 1;
+const size_t kMaxPersistentSize = kMaxCodeCacheCapacity;
+
+#if defined(__aarch64__)
+#define CODEGEN_ARCH "arm64"
+#elif defined(__arm__)
+#define CODEGEN_ARCH "arm"
+#elif defined(__mips__)
+#define CODEGEN_ARCH "mips"
+#elif defined(__i386__)
+#define CODEGEN_ARCH "x86"
+#else
+#define CODEGEN_ARCH "unknown"
+#endif
+
+static size_t align16(size_t size)
+{
+    return (size + 15) & ~size_t(15);
+}
+
+// Builds the header into buf, returning its size. Other than on the key,
+// the code generated depends on the build and on the features of the CPU,
+// which make up the variant.
+static size_t persistentHeader(uint8_t* buf, size_t bufSize)
+{
+    char fingerprint[PROPERTY_VALUE_MAX];
+    property_get("ro.build.fingerprint", fingerprint, "");
+    char variant[PROPERTY_VALUE_MAX + 64];
+    snprintf(variant, sizeof(variant), "%s %lx %s", CODEGEN_ARCH,
+             getauxval(AT_HWCAP), fingerprint);
+
+    const uint32_t length = strlen(variant);
+    const size_t size = align16(12 + length);
+    if (size > bufSize) {
+        return 0;
+    }
+    memset(buf, 0, size);
+    memcpy(buf, &kPersistentMagic, 4);
+    memcpy(buf + 4, &kPersistentVersion, 4);
+    memcpy(buf + 8, &length, 4);
+    memcpy(buf + 12, variant, length);
+    return size;
+}
+
+// A key read back from the persistent cache, as the bytes of the key the
+// code was generated for.
+class PersistentKey : public AssemblyKeyBase
+{
+public:
+    PersistentKey(const void* data, size_t size) : mData(data), mSize(size) { }
+    virtual const void* data() const { return mData; }
+    virtual size_t size() const { return mSize; }
+private:
+    const void* mData;
+    size_t mSize;
+};
+
+class PersistentAssembly : public Assembly
+{
+public:
+    PersistentAssembly(const uint8_t* key, size_t keySize,
+                       const uint8_t* code, size_t codeSize)
+        : Assembly(reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(code)), codeSize),
+          mKey(key, keySize) { }
+    const AssemblyKeyBase& key() const { return mKey; }
+private:
+    PersistentKey mKey;
+};
+
+// ----------------------------------------------------------------------------
+
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mCacheSize(size), mCacheInUse(0),
+      mCacheData(LruCache<key_t, sp<Assembly> >::kUnlimitedCapacity),
+      mPersistent(LruCache<key_t, sp<Assembly> >::kUnlimitedCapacity),
+      mPersistentLoaded(false)
 {
     pthread_mutex_init(&mLock, 0);
 }
@@ -164,12 +262,12 @@ CodeCache::~CodeCache()
 sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
 {
     pthread_mutex_lock(&mLock);
-    sp<Assembly> r;
-    ssize_t index = mCacheData.indexOfKey(key_t(keyBase));
-    if (index >= 0) {
-        const cache_entry_t& e = mCacheData.valueAt(index);
-        e.when = mWhen++;
-        r = e.entry;
+    sp<Assembly> r = mCacheData.get(key_t(keyBase));
+    if (r == 0) {
+        if (!mPersistentLoaded) {
+            loadPersistent();
+        }
+        r = mPersistent.get(key_t(keyBase));
     }
     pthread_mutex_unlock(&mLock);
     return r;
@@ -180,34 +278,183 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
 {
     pthread_mutex_lock(&mLock);
 
+    // replace any assembly already cached for the key
+    sp<Assembly> old = mCacheData.get(key_t(keyBase));
+    if (old != 0) {
+        mCacheInUse -= old->size();
+        mCacheData.remove(key_t(keyBase));
+    }
+
     const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
+    while (mCacheInUse + assemblySize > mCacheSize && mCacheData.size()) {
         // evict the LRU
-        size_t lru = 0;
-        size_t count = mCacheData.size();
-        for (size_t i=0 ; i<count ; i++) {
-            const cache_entry_t& e = mCacheData.valueAt(i);
-            if (e.when < mCacheData.valueAt(lru).when) {
-                lru = i;
-            }
+        mCacheInUse -= mCacheData.peekOldestValue()->size();
+        mCacheData.removeOldest();
+    }
+
+    mCacheData.put(key_t(keyBase), assembly);
+    mCacheInUse += assemblySize;
+    // synchronize caches...
+    char* base = reinterpret_cast<char*>(assembly->base());
+    char* curr = reinterpret_cast<char*>(base + assembly->size());
+    __builtin___clear_cache(base, curr);
+
+    persist(keyBase, assembly);
+
+    pthread_mutex_unlock(&mLock);
+    return NO_ERROR;
+}
+
+// Called with mLock held, on the first lookup that misses.
+void CodeCache::loadPersistent() const
+{
+    mPersistentLoaded = true;
+
+    char path[PROPERTY_VALUE_MAX];
+    if (property_get("debug.pf.code_cache", path, "") <= 0) {
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    // wait for any entry being appended to be complete
+    flock(fd, LOCK_SH);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0 ||
+            size_t(st.st_size) > kMaxPersistentSize) {
+        close(fd);
+        return;
+    }
+    const size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    // the mapping holds on to the open file, and with it the lock
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ALOGW("Mapping code cache %s failed with error '%s'", path, strerror(errno));
+        return;
+    }
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(map);
+    uint8_t header[PROPERTY_VALUE_MAX + 96];
+    size_t offset = persistentHeader(header, sizeof(header));
+    if (!offset || size < offset || memcmp(p, header, offset)) {
+        munmap(map, size);
+        return;
+    }
+
+    size_t count = 0;
+    while (offset + 8 <= size) {
+        uint32_t keySize, codeSize;
+        memcpy(&keySize, p + offset, 4);
+        memcpy(&codeSize, p + offset + 4, 4);
+        if (keySize > size || codeSize == 0 || codeSize > size) {
+            break;
+        }
+        const size_t codeOffset = align16(offset + 8 + keySize);
+        const size_t next = align16(codeOffset + codeSize);
+        if (next > size) {
+            break;
         }
-        const cache_entry_t& e = mCacheData.valueAt(lru);
-        mCacheInUse -= e.entry->size();
-        mCacheData.removeItemsAt(lru);
+        sp<PersistentAssembly> a = new PersistentAssembly(
+                p + offset + 8, keySize, p + codeOffset, codeSize);
+        char* base = reinterpret_cast<char*>(a->base());
+        __builtin___clear_cache(base, base + codeSize);
+        mPersistent.put(key_t(a->key()), a);
+        offset = next;
+        count++;
     }
+    if (!count) {
+        munmap(map, size);
+    }
+}
 
-    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
-    if (err >= 0) {
-        mCacheInUse += assemblySize;
-        mWhen++;
-        // synchronize caches...
-        char* base = reinterpret_cast<char*>(assembly->base());
-        char* curr = reinterpret_cast<char*>(base + assembly->size());
-        __builtin___clear_cache(base, curr);
+// Called with mLock held, for each assembly generated.
+void CodeCache::persist(const AssemblyKeyBase& key, const sp<Assembly>& assembly)
+{
+    char path[PROPERTY_VALUE_MAX];
+    if (property_get("debug.pf.code_cache", path, "") <= 0) {
+        return;
     }
 
-    pthread_mutex_unlock(&mLock);
-    return err;
+    uint8_t header[PROPERTY_VALUE_MAX + 96];
+    const size_t headerSize = persistentHeader(header, sizeof(header));
+    if (!headerSize) {
+        return;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    uint8_t buf[PROPERTY_VALUE_MAX + 96];
+    if (size && (size < headerSize ||
+            pread(fd, buf, headerSize, 0) != ssize_t(headerSize) ||
+            memcmp(buf, header, headerSize))) {
+        // written for another build or CPU
+        unlink(path);
+        close(fd);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return;
+        }
+        flock(fd, LOCK_EX);
+        size = 0;
+    }
+    if (!size) {
+        if (pwrite(fd, header, headerSize, 0) != ssize_t(headerSize)) {
+            close(fd);
+            return;
+        }
+        size = headerSize;
+    }
+
+    // another process may have added it since this one loaded the file
+    size_t offset = headerSize;
+    while (offset + 8 <= size) {
+        uint32_t sizes[2];
+        if (pread(fd, sizes, 8, offset) != 8 || sizes[0] > size) {
+            break;
+        }
+        if (sizes[0] == key.size() && sizes[0] <= sizeof(buf) &&
+                pread(fd, buf, sizes[0], offset + 8) == ssize_t(sizes[0]) &&
+                !memcmp(buf, key.data(), sizes[0])) {
+            close(fd);
+            return;
+        }
+        offset = align16(align16(offset + 8 + sizes[0]) + sizes[1]);
+    }
+
+    const size_t codeSize = assembly->size();
+    const size_t codeOffset = align16(8 + key.size());
+    const size_t entrySize = align16(codeOffset + codeSize);
+    if ((size & 15) || size + entrySize > kMaxPersistentSize) {
+        close(fd);
+        return;
+    }
+    uint8_t* entry = static_cast<uint8_t*>(calloc(1, entrySize));
+    if (entry) {
+        const uint32_t sizes[2] = { uint32_t(key.size()), uint32_t(codeSize) };
+        memcpy(entry, sizes, 8);
+        memcpy(entry + 8, key.data(), key.size());
+        memcpy(entry + codeOffset, assembly->base(), codeSize);
+        if (pwrite(fd, entry, entrySize, size) != ssize_t(entrySize)) {
+            // leave no partial entry behind
+            ftruncate(fd, size);
+        }
+        free(entry);
+    }
+    close(fd);
 }
 
 // ----------------------------------------------------------------------------
@@ -20,10 +20,13 @@
 #define ANDROID_CODECACHE_H
 
 #include <stdint.h>
+#include <string.h>
 #include <pthread.h>
 #include <sys/types.h>
 
-#include "utils/KeyedVector.h"
+#include "utils/Errors.h"
+#include "utils/JenkinsHash.h"
+#include "utils/LruCache.h"
 #include "tinyutils/smartpointer.h"
 
 namespace android {
@@ -32,21 +35,31 @@ using namespace tinyutils;
 
 // ----------------------------------------------------------------------------
 
+// Keys are compared and hashed as bytes, which is also how they are
+// written to the persistent cache.
 class AssemblyKeyBase {
 public:
     virtual ~AssemblyKeyBase() { }
-    virtual int compare_type(const AssemblyKeyBase& key) const = 0;
+    virtual const void* data() const = 0;
+    virtual size_t size() const = 0;
+
+    bool equals(const AssemblyKeyBase& key) const {
+        return (size() == key.size()) && !memcmp(data(), key.data(), size());
+    }
+    hash_t hash() const {
+        return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+                reinterpret_cast<const uint8_t*>(data()), size()));
+    }
 };
 
+// T must be plain data without padding, such as needs_t.
 template  <typename T>
 class AssemblyKey : public AssemblyKeyBase
 {
 public:
     AssemblyKey(const T& rhs) : mKey(rhs) { }
-    virtual int compare_type(const AssemblyKeyBase& key) const {
-        const T& rhs = static_cast<const AssemblyKey&>(key).mKey;
-        return android::compare_type(mKey, rhs);
-    }
+    virtual const void* data() const { return &mKey; }
+    virtual size_t size() const { return sizeof(T); }
 private:
     T mKey;
 };
@@ -68,14 +81,29 @@ public:
             void    decStrong(const void* id) const;
     typedef void    weakref_type;
 
+protected:
+    // Code already in executable memory that the assembly doesn't own,
+    // such as that of the persistent cache.
+                Assembly(uint32_t* base, size_t size);
+
 private:
     mutable int32_t     mCount;
             uint32_t*   mBase;
             size_t      mSize;
+            bool        mOwned;
 };
 
 // ----------------------------------------------------------------------------
 
+// Assemblies are kept in a hash table, the least recently used being
+// evicted once they take up more than size bytes.
+//
+// If debug.pf.code_cache names a file, the assemblies are also written
+// there, and those already in it are used instead of generating them
+// again. The file is mapped read-only and shared by all the processes
+// using it, and is only valid for the build and CPU it was written on.
+// Generated code makes no calls and addresses nothing but the context it
+// is passed, so it runs at whatever address the file is mapped.
 class CodeCache
 {
 public:
@@ -88,44 +116,35 @@ public:
             int                 cache(  const AssemblyKeyBase& key,
                                         const sp<Assembly>& assembly);
 
-private:
-    // nothing to see here...
-    struct cache_entry_t {
-        inline cache_entry_t() { }
-        inline cache_entry_t(const sp<Assembly>& a, int64_t w)
-                : entry(a), when(w) { }
-        sp<Assembly>            entry;
-        mutable int64_t         when;
-    };
-
+    // The hash table's key, which refers to the key held by the assembly.
     class key_t {
-        friend int compare_type(
-            const key_value_pair_t<key_t, cache_entry_t>&,
-            const key_value_pair_t<key_t, cache_entry_t>&);
         const AssemblyKeyBase* mKey;
     public:
-        key_t() { };
+        key_t() : mKey(0) { }
         key_t(const AssemblyKeyBase& k) : mKey(&k)  { }
+        bool operator == (const key_t& rhs) const {
+            return mKey->equals(*rhs.mKey);
+        }
+        hash_t hash() const { return mKey->hash(); }
     };
 
+private:
+    // nothing to see here...
+            void                loadPersistent() const;
+            void                persist(const AssemblyKeyBase& key,
+                                        const sp<Assembly>& assembly);
+
     mutable pthread_mutex_t             mLock;
-    mutable int64_t                     mWhen;
     size_t                              mCacheSize;
     size_t                              mCacheInUse;
-    KeyedVector<key_t, cache_entry_t>   mCacheData;
-
-    friend int compare_type(
-        const key_value_pair_t<key_t, cache_entry_t>&,
-        const key_value_pair_t<key_t, cache_entry_t>&);
+    mutable LruCache<key_t, sp<Assembly> > mCacheData;
+    // the contents of the persistent cache, which are never evicted
+    mutable LruCache<key_t, sp<Assembly> > mPersistent;
+    mutable bool                        mPersistentLoaded;
 };
 
-// KeyedVector uses compare_type(), which is more efficient, than
-// just using operator < ()
-inline int compare_type(
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& lhs,
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& rhs)
-{
-    return lhs.key.mKey->compare_type(*(rhs.key.mKey));
+template<> inline hash_t hash_type(const CodeCache::key_t& key) {
+    return key.hash();
 }
 
 // ----------------------------------------------------------------------------
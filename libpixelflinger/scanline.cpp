@@ -30,6 +30,12 @@
 #include <machine/cpu-features.h>
 #endif
 
+#if defined(__ARM_HAVE_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "buffer.h"
 #include "scanline.h"
 
@@ -74,6 +80,15 @@
 
 #define DEBUG__CODEGEN_ONLY     0
 
+/* The shortcuts that blend modulated textures work on 8 pixels at once
+ * with these, and fall back to one pixel at a time otherwise.
+ */
+#if BYTE_ORDER == LITTLE_ENDIAN && (defined(__ARM_HAVE_NEON) || defined(__aarch64__))
+#   define ANDROID_SIMD_NEON    1
+#elif BYTE_ORDER == LITTLE_ENDIAN && defined(__SSE2__)
+#   define ANDROID_SIMD_SSE2    1
+#endif
+
 /* Set to 1 to dump to the log the states that need a new
  * code-generated scanline callback, i.e. those that don't
  * have a corresponding shortcut function.
@@ -115,6 +130,7 @@ static void scanline_t32cb16blend_clamp_mod(context_t* c);
 static void scanline_x32cb16blend_clamp_mod(context_t* c);
 static void scanline_t32cb16blend_clamp_mod_dither(context_t* c);
 static void scanline_x32cb16blend_clamp_mod_dither(context_t* c);
+static void scanline_t32cb32blend_clamp_mod(context_t* c);
 static void scanline_t32cb16(context_t* c);
 static void scanline_t32cb16_dither(context_t* c);
 static void scanline_t32cb16_clamp(context_t* c);
@@ -233,6 +249,10 @@ static shortcut_t shortcuts[] = {
     { { { 0x03515104, 0x00000177, { 0x00001002, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
         "565 fb, x888 tx, SRC_OVER clamp modulate dither", scanline_x32cb16blend_clamp_mod_dither, init_y },
+    /* dithering has no effect on 8888 buffers */
+    { { { 0x03515101, 0x00000077, { 0x00001001, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "8888 fb, 8888 tx, SRC_OVER clamp modulate", scanline_t32cb32blend_clamp_mod, init_y },
     { { { 0x03010104, 0x00000077, { 0x00000001, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
         "565 fb, 8888 tx, SRC clamp", scanline_t32cb16_clamp, init_y  },
@@ -291,14 +311,28 @@ static  const needs_filter_t fill16noblend = {
 
 // ----------------------------------------------------------------------------
 
+static uint32_t gScanlinePipelines =
+        GGL_PIPELINE_SHORTCUTS | GGL_PIPELINE_GENERATED;
+
+uint32_t ggl_set_scanline_pipelines(uint32_t pipelines)
+{
+#if !(ANDROID_ARM_CODEGEN || ANDROID_IA32_CODEGEN)
+    pipelines &= ~GGL_PIPELINE_GENERATED;
+#endif
+    gScanlinePipelines = pipelines;
+    return pipelines;
+}
+
+// ----------------------------------------------------------------------------
+
 #if ANDROID_ARM_CODEGEN || ANDROID_IA32_CODEGEN
 
 #if defined(__mips__) && !defined(__LP64__) && __mips_isa_rev < 6
-static CodeCache gCodeCache(32 * 1024);
+static CodeCache gCodeCache(128 * 1024);
 #elif defined(__aarch64__)
-static CodeCache gCodeCache(48 * 1024);
+static CodeCache gCodeCache(192 * 1024);
 #else
-static CodeCache gCodeCache(12 * 1024);
+static CodeCache gCodeCache(48 * 1024);
 #endif
 
 class ScanlineAssembly : public Assembly {
@@ -331,17 +365,8 @@ void ggl_uninit_scanline(context_t* c)
 
 // ----------------------------------------------------------------------------
 
-static void pick_scanline(context_t* c)
+static bool pick_shortcut(context_t* c)
 {
-#if (!defined(DEBUG__CODEGEN_ONLY) || (DEBUG__CODEGEN_ONLY == 0))
-
-#if ANDROID_CODEGEN == ANDROID_CODEGEN_GENERIC
-    c->init_y = init_y;
-    c->step_y = step_y__generic;
-    c->scanline = scanline;
-    return;
-#endif
-
     //printf("*** needs [%08lx:%08lx:%08lx:%08lx]\n",
     //    c->state.needs.n, c->state.needs.p,
     //    c->state.needs.t[0], c->state.needs.t[1]);
@@ -364,7 +389,7 @@ static void pick_scanline(context_t* c)
                 // (so the current color doesn't show through)
                 c->scanline = scanline_memcpy;
                 c->init_y = init_y_noop;
-                return;
+                return true;
             }
         }
     }
@@ -372,9 +397,9 @@ static void pick_scanline(context_t* c)
     if (c->state.needs.match(fill16noblend)) {
         c->init_y = init_y_packed;
         switch (c->formats[cb_format].size) {
-        case 1: c->scanline = scanline_memset8;  return;
-        case 2: c->scanline = scanline_memset16; return;
-        case 4: c->scanline = scanline_memset32; return;
+        case 1: c->scanline = scanline_memset8;  return true;
+        case 2: c->scanline = scanline_memset16; return true;
+        case 4: c->scanline = scanline_memset32; return true;
         }
     }
 
@@ -383,9 +408,26 @@ static void pick_scanline(context_t* c)
         if (c->state.needs.match(shortcuts[i].filter)) {
             c->scanline = shortcuts[i].scanline;
             c->init_y = shortcuts[i].init_y;
-            return;
+            return true;
         }
     }
+    return false;
+}
+
+static void pick_scanline(context_t* c)
+{
+#if (!defined(DEBUG__CODEGEN_ONLY) || (DEBUG__CODEGEN_ONLY == 0))
+
+#if ANDROID_CODEGEN == ANDROID_CODEGEN_GENERIC
+    c->init_y = init_y;
+    c->step_y = step_y__generic;
+    c->scanline = scanline;
+    return;
+#endif
+
+    if ((gScanlinePipelines & GGL_PIPELINE_SHORTCUTS) && pick_shortcut(c)) {
+        return;
+    }
 
 #if DEBUG_NEEDS
     ALOGI("Needs: n=0x%08x p=0x%08x t0=0x%08x t1=0x%08x",
@@ -398,6 +440,11 @@ static void pick_scanline(context_t* c)
     c->init_y = init_y;
     c->step_y = step_y__generic;
 
+    if (!(gScanlinePipelines & GGL_PIPELINE_GENERATED)) {
+        c->scanline = scanline;
+        return;
+    }
+
 #if ANDROID_ARM_CODEGEN
     // we're going to have to generate some code...
     // here, generate code for our pixel pipeline
@@ -504,14 +551,8 @@ static void blend_factor(context_t* c, pixel_t* r, uint32_t factor,
         const pixel_t* src, const pixel_t* dst);
 static void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv);
 
-#if (ANDROID_ARM_CODEGEN || ANDROID_IA32_CODEGEN) && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
-
-// no need to compile the generic-pipeline, it can't be reached
-void scanline(context_t*)
-{
-}
-
-#else
+// The generic pipeline is also the reference the others are checked
+// against, see ggl_set_scanline_pipelines().
 
 void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv)
 {
@@ -979,8 +1020,6 @@ discard:
 	}
 }
 
-#endif // (ANDROID_ARM_CODEGEN || ANDROID_IA32_CODEGEN) && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
-
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -1173,6 +1212,16 @@ struct ditherer {
         m_index++;
         return ret;
     }
+    /* The thresholds of the next GGL_DITHER_ORDER pixels, in the 0.8
+     * format the blenders use. */
+    void get_thresholds(uint8_t* thresholds) const {
+        for (int i=0 ; i<GGL_DITHER_ORDER ; i++) {
+            thresholds[i] = m_line[(m_index + i) & GGL_DITHER_MASK] << (8 - GGL_DITHER_BITS);
+        }
+    }
+    void skip(int count) {
+        m_index += count;
+    }
     uint16_t abgr8888ToRgb565(uint32_t s) {
         uint32_t r = s & 0xff;
         uint32_t g = (s >> 8) & 0xff;
@@ -1285,6 +1334,279 @@ struct blender_32to16_srcA {
     }
 };
 
+/* These blend 8 pixels at a time of a modulated source, with the exact
+ * arithmetic of blender_32to16_modulate and blender_x32to16_modulate,
+ * and return how many of the count pixels they did; the blenders do
+ * the rest one by one. The 8 dither thresholds, if any, are those of
+ * the first pixel and the following ones, and repeat every 8 pixels.
+ */
+template <bool XRGB, bool DITHER>
+static inline size_t blend_mod_32to16_simd(const uint32_t* src, uint16_t* dst,
+        size_t count, int mr, int mg, int mb, int ma, const uint8_t* thresholds)
+{
+#if ANDROID_SIMD_NEON
+    const uint16x8_t vmr = vdupq_n_u16(mr);
+    const uint16x8_t vmg = vdupq_n_u16(mg);
+    const uint16x8_t vmb = vdupq_n_u16(mb);
+    const uint16x8_t vma = vdupq_n_u16(ma);
+    const uint16x8_t v100 = vdupq_n_u16(0x100);
+    const uint16x8_t v1f = vdupq_n_u16(0x1f);
+    const uint16x8_t v3f = vdupq_n_u16(0x3f);
+    const uint16x8_t vthr = DITHER ? vmovl_u8(vld1_u8(thresholds)) : vdupq_n_u16(0);
+    size_t i = 0;
+    for ( ; i + 8 <= count ; i += 8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint16x8_t d = vld1q_u16(dst + i);
+        uint16x8_t f;
+        if (XRGB) {
+            f = vsubq_u16(v100, vma);
+        } else {
+            uint16x8_t a = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[3]), vma), 8);
+            f = vsubq_u16(v100, vaddq_u16(a, vshrq_n_u16(a, 7)));
+        }
+        uint16x8_t r = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[0]), vmr), 8 - 5);
+        uint16x8_t g = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[1]), vmg), 8 - 6);
+        uint16x8_t b = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[2]), vmb), 8 - 5);
+        r = vmlaq_u16(r, f, vshrq_n_u16(d, 11));
+        g = vmlaq_u16(g, f, vandq_u16(vshrq_n_u16(d, 5), v3f));
+        b = vmlaq_u16(b, f, vandq_u16(d, v1f));
+        if (DITHER) {
+            r = vminq_u16(vshrq_n_u16(vaddq_u16(r, vthr), 8), v1f);
+            g = vminq_u16(vshrq_n_u16(vaddq_u16(g, vthr), 8), v3f);
+            b = vminq_u16(vshrq_n_u16(vaddq_u16(b, vthr), 8), v1f);
+        } else {
+            r = vshrq_n_u16(r, 8);
+            g = vshrq_n_u16(g, 8);
+            b = vshrq_n_u16(b, 8);
+        }
+        uint16x8_t out = vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+        if (!XRGB) {
+            // transparent pixels leave the destination alone
+            const uint8x8_t any = vorr_u8(vorr_u8(s.val[0], s.val[1]),
+                                          vorr_u8(s.val[2], s.val[3]));
+            out = vbslq_u16(vceqq_u16(vmovl_u8(any), vdupq_n_u16(0)), d, out);
+        }
+        vst1q_u16(dst + i, out);
+    }
+    return i;
+#elif ANDROID_SIMD_SSE2
+    const __m128i vmr = _mm_set1_epi16(mr);
+    const __m128i vmg = _mm_set1_epi16(mg);
+    const __m128i vmb = _mm_set1_epi16(mb);
+    const __m128i vma = _mm_set1_epi16(ma);
+    const __m128i v100 = _mm_set1_epi16(0x100);
+    const __m128i v1f = _mm_set1_epi16(0x1f);
+    const __m128i v3f = _mm_set1_epi16(0x3f);
+    const __m128i vff = _mm_set1_epi32(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vthr = DITHER ? _mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(thresholds)), zero) : zero;
+    size_t i = 0;
+    for ( ; i + 8 <= count ; i += 8) {
+        const __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i f;
+        if (XRGB) {
+            f = _mm_sub_epi16(v100, vma);
+        } else {
+            __m128i a = _mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24));
+            a = _mm_srli_epi16(_mm_mullo_epi16(a, vma), 8);
+            f = _mm_sub_epi16(v100, _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+        }
+        __m128i r = _mm_packs_epi32(_mm_and_si128(s0, vff), _mm_and_si128(s1, vff));
+        __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), vff),
+                                    _mm_and_si128(_mm_srli_epi32(s1, 8), vff));
+        __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), vff),
+                                    _mm_and_si128(_mm_srli_epi32(s1, 16), vff));
+        r = _mm_srli_epi16(_mm_mullo_epi16(r, vmr), 8 - 5);
+        g = _mm_srli_epi16(_mm_mullo_epi16(g, vmg), 8 - 6);
+        b = _mm_srli_epi16(_mm_mullo_epi16(b, vmb), 8 - 5);
+        r = _mm_add_epi16(r, _mm_mullo_epi16(f, _mm_srli_epi16(d, 11)));
+        g = _mm_add_epi16(g, _mm_mullo_epi16(f, _mm_and_si128(_mm_srli_epi16(d, 5), v3f)));
+        b = _mm_add_epi16(b, _mm_mullo_epi16(f, _mm_and_si128(d, v1f)));
+        if (DITHER) {
+            r = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(r, vthr), 8), v1f);
+            g = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(g, vthr), 8), v3f);
+            b = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(b, vthr), 8), v1f);
+        } else {
+            r = _mm_srli_epi16(r, 8);
+            g = _mm_srli_epi16(g, 8);
+            b = _mm_srli_epi16(b, 8);
+        }
+        __m128i out = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11),
+                                                _mm_slli_epi16(g, 5)), b);
+        if (!XRGB) {
+            // transparent pixels leave the destination alone
+            const __m128i z = _mm_packs_epi32(_mm_cmpeq_epi32(s0, zero),
+                                              _mm_cmpeq_epi32(s1, zero));
+            out = _mm_or_si128(_mm_and_si128(z, d), _mm_andnot_si128(z, out));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+    return i;
+#else
+    (void)src; (void)dst; (void)count; (void)thresholds;
+    (void)mr; (void)mg; (void)mb; (void)ma;
+    return 0;
+#endif
+}
+
+/* Same for blender_32to32_modulate. */
+static inline size_t blend_mod_32to32_simd(const uint32_t* src, uint32_t* dst,
+        size_t count, int mr, int mg, int mb, int ma)
+{
+#if ANDROID_SIMD_NEON
+    const uint16x8_t vm[4] = {
+        vdupq_n_u16(mr), vdupq_n_u16(mg), vdupq_n_u16(mb), vdupq_n_u16(ma)
+    };
+    const uint16x8_t v100 = vdupq_n_u16(0x100);
+    size_t i = 0;
+    for ( ; i + 8 <= count ; i += 8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint8x8x4_t d = vld4_u8(reinterpret_cast<const uint8_t*>(dst + i));
+        const uint16x8_t a = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[3]), vm[3]), 8);
+        const uint16x8_t f = vsubq_u16(v100, vaddq_u16(a, vshrq_n_u16(a, 7)));
+        // transparent pixels leave the destination alone
+        const uint8x8_t z = vceq_u8(vorr_u8(vorr_u8(s.val[0], s.val[1]),
+                                            vorr_u8(s.val[2], s.val[3])), vdup_n_u8(0));
+        uint8x8x4_t out;
+        for (int j = 0 ; j < 4 ; j++) {
+            uint16x8_t v = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[j]), vm[j]), 8);
+            v = vaddq_u16(v, vshrq_n_u16(vmulq_u16(f, vmovl_u8(d.val[j])), 8));
+            out.val[j] = vbsl_u8(z, d.val[j], vqmovn_u16(v));
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dst + i), out);
+    }
+    return i;
+#elif ANDROID_SIMD_SSE2
+    const __m128i vm = _mm_setr_epi16(mr, mg, mb, ma, mr, mg, mb, ma);
+    const __m128i v100 = _mm_set1_epi16(0x100);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for ( ; i + 4 <= count ; i += 4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i v[2];
+        for (int j = 0 ; j < 2 ; j++) {
+            // two pixels, with a, r, g, b on 16 bits each
+            const __m128i sj = j ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+            const __m128i dj = j ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+            const __m128i m = _mm_srli_epi16(_mm_mullo_epi16(sj, vm), 8);
+            const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(m, 0xff), 0xff);
+            const __m128i f = _mm_sub_epi16(v100, _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+            v[j] = _mm_add_epi16(m, _mm_srli_epi16(_mm_mullo_epi16(f, dj), 8));
+        }
+        __m128i out = _mm_packus_epi16(v[0], v[1]);
+        // transparent pixels leave the destination alone
+        const __m128i z = _mm_cmpeq_epi32(s, zero);
+        out = _mm_or_si128(_mm_and_si128(z, d), _mm_andnot_si128(z, out));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+    return i;
+#else
+    (void)src; (void)dst; (void)count;
+    (void)mr; (void)mg; (void)mb; (void)ma;
+    return 0;
+#endif
+}
+
+/* This converts 16 pixels at a time from 8888 to 565, with the exact
+ * arithmetic of convertAbgr8888ToRgb565() or, dithering, of
+ * ditherer::abgr8888ToRgb565(), and returns how many of the count
+ * pixels it did. The thresholds are as for blend_mod_32to16_simd().
+ */
+template <bool DITHER>
+static inline size_t convert_32to16_simd(const uint32_t* src, uint16_t* dst,
+        size_t count, const uint8_t* thresholds)
+{
+#if ANDROID_SIMD_NEON
+    uint8x16_t tr = vdupq_n_u8(0);
+    uint8x16_t tg = vdupq_n_u8(0);
+    if (DITHER) {
+        const uint8x8_t t = vld1_u8(thresholds);
+        tr = vcombine_u8(vshr_n_u8(t, 5), vshr_n_u8(t, 5));
+        tg = vcombine_u8(vshr_n_u8(t, 6), vshr_n_u8(t, 6));
+    }
+    size_t i = 0;
+    for ( ; i + 16 <= count ; i += 16) {
+        uint8x16x4_t s = vld4q_u8(reinterpret_cast<const uint8_t*>(src + i));
+        if (DITHER) {
+            s.val[0] = vqaddq_u8(s.val[0], tr);
+            s.val[1] = vqaddq_u8(s.val[1], tg);
+            s.val[2] = vqaddq_u8(s.val[2], tr);
+        }
+        uint16x8_t lo = vshll_n_u8(vget_low_u8(s.val[0]), 8);
+        uint16x8_t hi = vshll_n_u8(vget_high_u8(s.val[0]), 8);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(s.val[1]), 8), 5);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(s.val[1]), 8), 5);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(s.val[2]), 8), 11);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(s.val[2]), 8), 11);
+        vst1q_u16(dst + i, lo);
+        vst1q_u16(dst + i + 8, hi);
+    }
+    return i;
+#elif ANDROID_SIMD_SSE2
+    // what the thresholds add to the r, g, b bytes of pixels 0-3 and 4-7
+    __m128i t[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    if (DITHER) {
+        uint32_t add[8];
+        for (int j=0 ; j<8 ; j++) {
+            const uint32_t r = thresholds[j] >> 5;
+            const uint32_t g = thresholds[j] >> 6;
+            add[j] = r | (g << 8) | (r << 16);
+        }
+        t[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add));
+        t[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + 4));
+    }
+    const __m128i mr = _mm_set1_epi32(0xf8);
+    const __m128i mg = _mm_set1_epi32(0x7e0);
+    const __m128i mb = _mm_set1_epi32(0x1f);
+    size_t i = 0;
+    for ( ; i + 16 <= count ; i += 16) {
+        __m128i v[4];
+        for (int j=0 ; j<4 ; j++) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + j*4));
+            if (DITHER) {
+                s = _mm_adds_epu8(s, t[j & 1]);
+            }
+            const __m128i r = _mm_slli_epi32(_mm_and_si128(s, mr), 8);
+            const __m128i g = _mm_and_si128(_mm_srli_epi32(s, 5), mg);
+            const __m128i b = _mm_and_si128(_mm_srli_epi32(s, 19), mb);
+            // sign extended, so that the signed pack keeps all 16 bits
+            v[j] = _mm_srai_epi32(_mm_slli_epi32(
+                    _mm_or_si128(_mm_or_si128(r, g), b), 16), 16);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(v[0], v[1]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_packs_epi32(v[2], v[3]));
+    }
+    return i;
+#else
+    (void)src; (void)dst; (void)count; (void)thresholds;
+    return 0;
+#endif
+}
+
+/* This converts 8888 to 565 without blending, for blend_spans().
+ */
+struct converter_32to16 {
+    void write(const uint32_t* src, uint16_t* dst, size_t count) {
+        size_t i = convert_32to16_simd<false>(src, dst, count, NULL);
+        for ( ; i < count ; i++) {
+            dst[i] = convertAbgr8888ToRgb565(src[i]);
+        }
+    }
+    void write(const uint32_t* src, uint16_t* dst, size_t count, ditherer& di) {
+        uint8_t thresholds[GGL_DITHER_ORDER];
+        di.get_thresholds(thresholds);
+        size_t i = convert_32to16_simd<true>(src, dst, count, thresholds);
+        di.skip(i);
+        for ( ; i < count ; i++) {
+            dst[i] = di.abgr8888ToRgb565(src[i]);
+        }
+    }
+};
+
 /* Common init code the modulating blenders */
 struct blender_modulate {
     void init(const context_t* c) {
@@ -1372,6 +1694,23 @@ struct blender_32to16_modulate : blender_modulate {
         if (sB > 0x1f) sB = 0x1f;
         *dst = uint16_t((sR<<11)|(sG<<5)|sB);
     }
+    void write(const uint32_t* src, uint16_t* dst, size_t count) {
+        size_t i = blend_mod_32to16_simd<false, false>(src, dst, count,
+                m_r, m_g, m_b, m_a, NULL);
+        for ( ; i < count ; i++) {
+            write(src[i], dst + i);
+        }
+    }
+    void write(const uint32_t* src, uint16_t* dst, size_t count, ditherer& di) {
+        uint8_t thresholds[GGL_DITHER_ORDER];
+        di.get_thresholds(thresholds);
+        size_t i = blend_mod_32to16_simd<false, true>(src, dst, count,
+                m_r, m_g, m_b, m_a, thresholds);
+        di.skip(i);
+        for ( ; i < count ; i++) {
+            write(src[i], dst + i, di);
+        }
+    }
 };
 
 /* same as 32to16_modulate, except that the input is xRGB, instead of ARGB */
@@ -1427,6 +1766,61 @@ struct blender_x32to16_modulate : blender_modulate {
         if (sB > 0x1f) sB = 0x1f;
         *dst = uint16_t((sR<<11)|(sG<<5)|sB);
     }
+    void write(const uint32_t* src, uint16_t* dst, size_t count) {
+        size_t i = blend_mod_32to16_simd<true, false>(src, dst, count,
+                m_r, m_g, m_b, m_a, NULL);
+        for ( ; i < count ; i++) {
+            write(src[i], dst + i);
+        }
+    }
+    void write(const uint32_t* src, uint16_t* dst, size_t count, ditherer& di) {
+        uint8_t thresholds[GGL_DITHER_ORDER];
+        di.get_thresholds(thresholds);
+        size_t i = blend_mod_32to16_simd<true, true>(src, dst, count,
+                m_r, m_g, m_b, m_a, thresholds);
+        di.skip(i);
+        for ( ; i < count ; i++) {
+            write(src[i], dst + i, di);
+        }
+    }
+};
+
+/* This blender does a normal blend after modulation, onto 32-bit
+ * destination pixels. Components that overflow are clamped.
+ */
+struct blender_32to32_modulate : blender_modulate {
+    blender_32to32_modulate(const context_t* c) {
+        init(c);
+    }
+    void write(uint32_t s, uint32_t* dst) {
+        if (!s) {
+            return;
+        }
+        s = GGL_RGBA_TO_HOST(s);
+        uint32_t d = GGL_RGBA_TO_HOST(*dst);
+
+        uint32_t  sA = ((s >> 24)*m_a) >> 8;
+        uint32_t  sB = (((s >> 16) & 0xff)*m_b) >> 8;
+        uint32_t  sG = (((s >> 8) & 0xff)*m_g) >> 8;
+        uint32_t  sR = ((s & 0xff)*m_r) >> 8;
+
+        uint32_t f = 0x100 - (sA + (sA>>7));
+        sA += (f*(d >> 24)) >> 8;
+        sB += (f*((d >> 16) & 0xff)) >> 8;
+        sG += (f*((d >> 8) & 0xff)) >> 8;
+        sR += (f*(d & 0xff)) >> 8;
+        if (sA > 0xff) sA = 0xff;
+        if (sB > 0xff) sB = 0xff;
+        if (sG > 0xff) sG = 0xff;
+        if (sR > 0xff) sR = 0xff;
+        *dst = GGL_HOST_TO_RGBA((sA<<24)|(sB<<16)|(sG<<8)|sR);
+    }
+    void write(const uint32_t* src, uint32_t* dst, size_t count) {
+        size_t i = blend_mod_32to32_simd(src, dst, count, m_r, m_g, m_b, m_a);
+        for ( ; i < count ; i++) {
+            write(src[i], dst + i);
+        }
+    }
 };
 
 /* Same as above, but source is 16bit rgb565 */
@@ -1479,59 +1873,98 @@ struct dst_iterator16 {
     uint16_t*  dst;
 };
 
+/* Same for a 32-bit destination color buffer. */
+struct dst_iterator32 {
+    dst_iterator32(const context_t* c) {
+        const int x = c->iterators.xl;
+        const int width = c->iterators.xr - x;
+        const int32_t y = c->iterators.y;
+        const surface_t* cb = &(c->state.buffers.color);
+        count = width;
+        dst = reinterpret_cast<uint32_t*>(cb->data) + (x+(cb->stride*y));
+    }
+    int        count;
+    uint32_t*  dst;
+};
+
+/* This feeds the blenders that work on several pixels at once with
+ * spans of source pixels, fetched one at a time by the iterator:
+ *
+ *   blend_spans(src_iterator, blender, dst_iterator);
+ */
+#define BLEND_SPAN_SIZE     32
+
+template <typename SRC, typename BLENDER, typename DST>
+static inline void blend_spans(SRC& si, BLENDER& bl, DST& di)
+{
+    uint32_t src[BLEND_SPAN_SIZE];
+    while (di.count > 0) {
+        const int n = di.count < BLEND_SPAN_SIZE ? di.count : BLEND_SPAN_SIZE;
+        for (int i=0 ; i<n ; i++) {
+            src[i] = si.get_pixel32();
+        }
+        bl.write(src, di.dst, n);
+        di.dst += n;
+        di.count -= n;
+    }
+}
+
+template <typename SRC, typename BLENDER, typename DST>
+static inline void blend_spans(SRC& si, BLENDER& bl, DST& di, ditherer& dither)
+{
+    uint32_t src[BLEND_SPAN_SIZE];
+    while (di.count > 0) {
+        const int n = di.count < BLEND_SPAN_SIZE ? di.count : BLEND_SPAN_SIZE;
+        for (int i=0 ; i<n ; i++) {
+            src[i] = si.get_pixel32();
+        }
+        bl.write(src, di.dst, n, dither);
+        di.dst += n;
+        di.count -= n;
+    }
+}
+
 
 static void scanline_t32cb16_clamp(context_t* c)
 {
-    dst_iterator16  di(c);
+    dst_iterator16      di(c);
+    converter_32to16    cv;
 
     if (is_context_horizontal(c)) {
         /* Special case for simple horizontal scaling */
         horz_clamp_iterator32 ci(c);
-        while (di.count--) {
-            uint32_t s = ci.get_pixel32();
-            *di.dst++ = convertAbgr8888ToRgb565(s);
-        }
+        blend_spans(ci, cv, di);
     } else {
         /* General case */
         clamp_iterator ci(c);
-        while (di.count--) {
-            uint32_t s = ci.get_pixel32();
-            *di.dst++ = convertAbgr8888ToRgb565(s);
-        }
+        blend_spans(ci, cv, di);
     }
 }
 
 static void scanline_t32cb16_dither(context_t* c)
 {
-    horz_iterator32 si(c);
-    dst_iterator16  di(c);
-    ditherer        dither(c);
+    horz_iterator32     si(c);
+    dst_iterator16      di(c);
+    ditherer            dither(c);
+    converter_32to16    cv;
 
-    while (di.count--) {
-        uint32_t s = si.get_pixel32();
-        *di.dst++ = dither.abgr8888ToRgb565(s);
-    }
+    blend_spans(si, cv, di, dither);
 }
 
 static void scanline_t32cb16_clamp_dither(context_t* c)
 {
-    dst_iterator16  di(c);
-    ditherer        dither(c);
+    dst_iterator16      di(c);
+    ditherer            dither(c);
+    converter_32to16    cv;
 
     if (is_context_horizontal(c)) {
         /* Special case for simple horizontal scaling */
         horz_clamp_iterator32 ci(c);
-        while (di.count--) {
-            uint32_t s = ci.get_pixel32();
-            *di.dst++ = dither.abgr8888ToRgb565(s);
-        }
+        blend_spans(ci, cv, di, dither);
     } else {
         /* General case */
         clamp_iterator ci(c);
-        while (di.count--) {
-            uint32_t s = ci.get_pixel32();
-            *di.dst++ = dither.abgr8888ToRgb565(s);
-        }
+        blend_spans(ci, cv, di, dither);
     }
 }
 
@@ -1590,11 +2023,7 @@ void scanline_t32cb16blend_clamp_mod(context_t* c)
     blender_32to16_modulate bl(c);
 
     clamp_iterator ci(c);
-    while (di.count--) {
-        uint32_t s = ci.get_pixel32();
-        bl.write(s, di.dst);
-        di.dst++;
-    }
+    blend_spans(ci, bl, di);
 }
 
 void scanline_t32cb16blend_clamp_mod_dither(context_t* c)
@@ -1604,11 +2033,7 @@ void scanline_t32cb16blend_clamp_mod_dither(context_t* c)
     ditherer dither(c);
 
     clamp_iterator ci(c);
-    while (di.count--) {
-        uint32_t s = ci.get_pixel32();
-        bl.write(s, di.dst, dither);
-        di.dst++;
-    }
+    blend_spans(ci, bl, di, dither);
 }
 
 /* Variant of scanline_t32cb16blend_clamp_mod with a xRGB texture */
@@ -1618,11 +2043,7 @@ void scanline_x32cb16blend_clamp_mod(context_t* c)
     blender_x32to16_modulate  bl(c);
 
     clamp_iterator ci(c);
-    while (di.count--) {
-        uint32_t s = ci.get_pixel32();
-        bl.write(s, di.dst);
-        di.dst++;
-    }
+    blend_spans(ci, bl, di);
 }
 
 void scanline_x32cb16blend_clamp_mod_dither(context_t* c)
@@ -1632,11 +2053,16 @@ void scanline_x32cb16blend_clamp_mod_dither(context_t* c)
     ditherer dither(c);
 
     clamp_iterator ci(c);
-    while (di.count--) {
-        uint32_t s = ci.get_pixel32();
-        bl.write(s, di.dst, dither);
-        di.dst++;
-    }
+    blend_spans(ci, bl, di, dither);
+}
+
+void scanline_t32cb32blend_clamp_mod(context_t* c)
+{
+    dst_iterator32 di(c);
+    blender_32to32_modulate bl(c);
+
+    clamp_iterator ci(c);
+    blend_spans(ci, bl, di);
 }
 
 void scanline_t16cb16_clamp(context_t* c)
@@ -2183,6 +2609,14 @@ void scanline_t32cb16(context_t* c)
     int sR, sG, sB;
     uint32_t s, d;
 
+    const size_t done = convert_32to16_simd<false>(src, dst, ct, NULL);
+    src += done;
+    dst += done;
+    ct -= done;
+    if (ct == 0) {
+        return;
+    }
+
     if (ct==1 || uintptr_t(dst)&2) {
 last_one:
         s = GGL_RGBA_TO_HOST( *src++ );
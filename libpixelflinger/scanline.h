@@ -27,6 +27,18 @@ void ggl_init_scanline(context_t* c);
 void ggl_uninit_scanline(context_t* c);
 void ggl_pick_scanline(context_t* c);
 
+/* The pixel pipelines ggl_pick_scanline() may choose, besides the generic
+ * one, which is always there. Tests and benchmarks turn them off to check
+ * them against each other; the change applies to all contexts, from their
+ * next state change. Returns the pipelines that are now in use.
+ */
+enum {
+    GGL_PIPELINE_SHORTCUTS  = 0x1,  // hand-written C and assembly
+    GGL_PIPELINE_GENERATED  = 0x2,  // code generated by codeflinger
+};
+
+uint32_t ggl_set_scanline_pipelines(uint32_t pipelines);
+
 }; // namespace android
 
 #endif
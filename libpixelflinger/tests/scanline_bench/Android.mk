@@ -0,0 +1,23 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+ifeq ($(TARGET_ARCH),x86)
+LOCAL_SRC_FILES:= \
+    scanline_bench.cpp
+else
+LOCAL_SRC_FILES:= \
+    scanline_bench.cpp.arm
+endif
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+    libpixelflinger
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../..
+
+LOCAL_MODULE:= test-pixelflinger-scanline-bench
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_NATIVE_TEST)
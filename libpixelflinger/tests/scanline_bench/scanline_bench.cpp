@@ -0,0 +1,315 @@
+/*
+ * Renders a few fixed workloads through each scanline pipeline, reporting
+ * how fast each one goes and how many pixels it draws differently from the
+ * generic C pipeline. The generated code must match the generic pipeline
+ * exactly; some of the hand-written shortcuts round differently, which is
+ * reported but not an error.
+ *
+ * usage: test-pixelflinger-scanline-bench [frames]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pixelflinger/pixelflinger.h>
+#include "private/pixelflinger/ggl_context.h"
+
+#include "scanline.h"
+
+using namespace android;
+
+#define WIDTH   512
+#define HEIGHT  512
+
+static const int kBpp[] = { 0, 4, 4, 3, 2 };   // by GGL_PIXEL_FORMAT_*
+
+struct workload_t {
+    const char* name;
+    int         dst_format;
+    int         tex_format;     // 0 if untextured
+    void        (*draw)(GGLContext* c);
+};
+
+static void fill(GGLContext* c)
+{
+    GGLcolor color[4] = { 0x4000, 0x8000, 0xc000, 0x10000 };
+    c->color4xv(c, color);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void fill_blend(GGLContext* c)
+{
+    c->enable(c, GGL_BLEND);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+    GGLcolor color[4] = { 0x2000, 0x4000, 0x6000, 0x8000 };
+    c->color4xv(c, color);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void blit(GGLContext* c)
+{
+    c->enable(c, GGL_TEXTURE_2D);
+    c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+    c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    c->texCoord2i(c, 0, 0);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void blit_dither(GGLContext* c)
+{
+    c->enable(c, GGL_DITHER);
+    blit(c);
+}
+
+static void blit_blend(GGLContext* c)
+{
+    c->enable(c, GGL_BLEND);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+    blit(c);
+}
+
+static void blit_blend_dither(GGLContext* c)
+{
+    c->enable(c, GGL_DITHER);
+    blit_blend(c);
+}
+
+static void quad_modulate(GGLContext* c)
+{
+    c->enable(c, GGL_BLEND);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+    c->enable(c, GGL_TEXTURE_2D);
+    c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_MODULATE);
+    c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    GGLcolor color[4] = { 0x8000, 0xc000, 0x10000, 0xe000 };
+    c->color4xv(c, color);
+    c->texCoord2i(c, 0, 0);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void quad_modulate_dither(GGLContext* c)
+{
+    c->enable(c, GGL_DITHER);
+    quad_modulate(c);
+}
+
+static void quad_modulate_clamp(GGLContext* c)
+{
+    // the texture mapped 1:1 with texture coordinates, clamped
+    c->enable(c, GGL_BLEND);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+    c->enable(c, GGL_TEXTURE_2D);
+    c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_MODULATE);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, GGL_CLAMP);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, GGL_CLAMP);
+    c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    int32_t texcoords[8] = { 0, 0x10000, 0, 0, 0, 0x10000, 0, 0 };
+    c->texCoordGradScale8xv(c, 0, texcoords);
+    GGLcolor color[4] = { 0x8000, 0xc000, 0x10000, 0xe000 };
+    c->color4xv(c, color);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void quad_scaled_copy(GGLContext* c)
+{
+    // the texture stretched by 3/2 and clamped, as gglBitBlit() does it
+    c->enable(c, GGL_TEXTURE_2D);
+    c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, GGL_CLAMP);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, GGL_CLAMP);
+    c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    int32_t texcoords[8] = { 0, 0xaaaa, 0, 0, 0, 0xaaaa, 0, 0 };
+    c->texCoordGradScale8xv(c, 0, texcoords);
+    c->recti(c, 0, 0, WIDTH, HEIGHT);
+}
+
+static void quad_scaled_copy_dither(GGLContext* c)
+{
+    c->enable(c, GGL_DITHER);
+    quad_scaled_copy(c);
+}
+
+static void quad_scaled(GGLContext* c)
+{
+    c->enable(c, GGL_BLEND);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+    quad_scaled_copy(c);
+}
+
+static void triangle_smooth(GGLContext* c)
+{
+    c->enable(c, GGL_DITHER);
+    c->shadeModel(c, GGL_SMOOTH);
+    GGLcolor grad[12] = {
+        0x1000, 0x40, 0x80,     // r, dr/dx, dr/dy
+        0x8000, 0x14, 0xc0,
+        0x4000, 0x80, 0x40,
+        0x10000, 0, 0 };
+    c->colorGrad12xv(c, grad);
+    GGLcoord v0[2] = { 16 * 3 + 5, 16 * 7 + 3 };
+    GGLcoord v1[2] = { 16 * (WIDTH - 4) + 9, 16 * 200 + 1 };
+    GGLcoord v2[2] = { 16 * 100 + 11, 16 * (HEIGHT - 2) + 7 };
+    c->trianglex(c, v0, v1, v2);
+}
+
+static const workload_t kWorkloads[] = {
+    { "fill 565",                   GGL_PIXEL_FORMAT_RGB_565,   0, fill },
+    { "fill blend 565",             GGL_PIXEL_FORMAT_RGB_565,   0, fill_blend },
+    { "fill blend 8888",            GGL_PIXEL_FORMAT_RGBA_8888, 0, fill_blend },
+    { "blit 565 to 565",            GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGB_565,   blit },
+    { "blit 8888 to 565",           GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, blit },
+    { "blit 8888 to 565 dither",    GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, blit_dither },
+    { "blend 8888 to 565",          GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, blit_blend },
+    { "blend 8888 to 565 dither",   GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, blit_blend_dither },
+    { "blend 8888 to 8888",         GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888, blit_blend },
+    { "modulate 8888 to 565",       GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, quad_modulate },
+    { "modulate 8888 to 565 dither",GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, quad_modulate_dither },
+    { "modulate 8888 to 8888",      GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888, quad_modulate },
+    { "modulate clamp 8888 to 8888",GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888, quad_modulate_clamp },
+    { "scaled 8888 to 565",         GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, quad_scaled },
+    { "stretch 8888 to 565",        GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, quad_scaled_copy },
+    { "stretch 8888 to 565 dither", GGL_PIXEL_FORMAT_RGB_565,   GGL_PIXEL_FORMAT_RGBA_8888, quad_scaled_copy_dither },
+    { "smooth triangle 565",        GGL_PIXEL_FORMAT_RGB_565,   0, triangle_smooth },
+};
+
+struct pipeline_t {
+    const char* name;
+    uint32_t    pipelines;
+    bool        exact;          // must draw what the generic pipeline draws
+};
+
+// the generic pipeline comes first, it is the reference
+static const pipeline_t kPipelines[] = {
+    { "generic",    0,                                              true },
+    { "shortcuts",  GGL_PIPELINE_SHORTCUTS,                         false },
+    { "generated",  GGL_PIPELINE_GENERATED,                         true },
+    { "default",    GGL_PIPELINE_SHORTCUTS | GGL_PIPELINE_GENERATED, false },
+};
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void fill_random(uint8_t* data, size_t size, int format)
+{
+    srand(1);
+    for (size_t i=0 ; i<size ; i+=kBpp[format]) {
+        if (format == GGL_PIXEL_FORMAT_RGBA_8888) {
+            // premultiplied, with all kinds of alpha
+            uint32_t a = rand() & 0xff;
+            data[i+0] = rand() % (a+1);
+            data[i+1] = rand() % (a+1);
+            data[i+2] = rand() % (a+1);
+            data[i+3] = a;
+        } else {
+            for (int j=0 ; j<kBpp[format] ; j++)
+                data[i+j] = rand();
+        }
+    }
+}
+
+// Draws the workload frames times into dst with the given pipelines,
+// returns the time it took and where the needs went.
+static double render(const workload_t& w, uint32_t pipelines, int frames,
+        uint8_t* dst, uint8_t* tex, needs_t* needs)
+{
+    ggl_set_scanline_pipelines(pipelines);
+    GGLContext* c;
+    gglInit(&c);
+
+    const size_t size = WIDTH * HEIGHT * kBpp[w.dst_format];
+    GGLSurface cb = { sizeof(GGLSurface), WIDTH, HEIGHT, WIDTH, dst, w.dst_format };
+    c->colorBuffer(c, &cb);
+    c->scissor(c, 0, 0, WIDTH, HEIGHT);
+    if (w.tex_format) {
+        GGLSurface ts = { sizeof(GGLSurface), WIDTH, HEIGHT, WIDTH, tex, w.tex_format };
+        c->bindTexture(c, &ts);
+    }
+
+    double elapsed = 0;
+    for (int i=0 ; i<frames ; i++) {
+        // every frame starts from the same destination
+        fill_random(dst, size, w.dst_format);
+        double t = now();
+        w.draw(c);
+        elapsed += now() - t;
+    }
+
+    *needs = ((context_t*)c)->state.needs;
+    gglUninit(c);
+    return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 20;
+    if (argc == 2) {
+        frames = atoi(argv[1]);
+    }
+    if (frames <= 0) {
+        printf("usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+
+    const int count = sizeof(kPipelines) / sizeof(*kPipelines);
+    const size_t max_size = WIDTH * HEIGHT * 4;
+    uint8_t* tex = (uint8_t*)malloc(max_size);
+    uint8_t* ref = (uint8_t*)malloc(max_size);
+    uint8_t* dst = (uint8_t*)malloc(max_size);
+    int failures = 0;
+
+    printf("%-28s %-26s", "workload", "needs (p:n_t0_t1)");
+    for (int j=0 ; j<count ; j++)
+        printf(" %10s", kPipelines[j].name);
+    printf("   Mpixels/s\n");
+
+    for (size_t i=0 ; i<sizeof(kWorkloads)/sizeof(*kWorkloads) ; i++) {
+        const workload_t& w = kWorkloads[i];
+        const size_t size = WIDTH * HEIGHT * kBpp[w.dst_format];
+        if (w.tex_format)
+            fill_random(tex, WIDTH * HEIGHT * kBpp[w.tex_format], w.tex_format);
+
+        double mpps[count];
+        needs_t needs;
+        for (int j=0 ; j<count ; j++) {
+            uint8_t* out = j ? dst : ref;
+            double t = render(w, kPipelines[j].pipelines, frames, out, tex, &needs);
+            mpps[j] = (double(WIDTH) * HEIGHT * frames) / (t * 1e6);
+            if (j && memcmp(out, ref, size)) {
+                const int bpp = kBpp[w.dst_format];
+                int bad = 0;
+                for (size_t k=0 ; k<size ; k+=bpp)
+                    bad += memcmp(out+k, ref+k, bpp) != 0;
+                printf("%s: %s draws %d pixels differently%s\n",
+                        w.name, kPipelines[j].name, bad,
+                        kPipelines[j].exact ? " (error)" : "");
+                if (kPipelines[j].exact)
+                    failures++;
+            }
+        }
+
+        char key[40];
+        snprintf(key, sizeof(key), "%08x:%08x_%08x_%08x",
+                needs.p, needs.n, needs.t[0], needs.t[1]);
+        printf("%-28s %-26s", w.name, key);
+        for (int j=0 ; j<count ; j++)
+            printf(" %10.1f", mpps[j]);
+        printf("\n");
+    }
+
+    free(tex);
+    free(ref);
+    free(dst);
+    ggl_set_scanline_pipelines(GGL_PIPELINE_SHORTCUTS | GGL_PIPELINE_GENERATED);
+    return failures ? 1 : 0;
+}
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "bands.h"
 #include "trap.h"
 #include "picker.h"
 
@@ -45,6 +46,7 @@ static void aa_linex(void *con, const GGLcoord* v0, const GGLcoord* v1, GGLcoord
 
 static void recti_validate(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
 static void recti(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
+static void recti_bands(void* c, GGLint l, GGLint t, GGLint r, GGLint b);
 
 static void trianglex_validate(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
@@ -52,6 +54,8 @@ static void trianglex_small(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void trianglex_big(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
+static void trianglex_bands(void*,
+        const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void aa_trianglex(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void trianglex_debug(void* con,
@@ -412,7 +416,7 @@ void recti_validate(void *con, GGLint l, GGLint t, GGLint r, GGLint b)
 {
     GGL_CONTEXT(c, con);
     ggl_pick(c);
-    c->procs.recti = recti;
+    c->procs.recti = ggl_bands_enabled() ? recti_bands : recti;
     c->procs.recti(con, l, t, r, b);
 }
 
@@ -440,6 +444,25 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
     }
 }
 
+struct recti_args_t {
+    GGLint l, t, r, b;
+};
+
+static void recti_band(context_t* c, const void* args)
+{
+    const recti_args_t* a = static_cast<const recti_args_t*>(args);
+    recti(c, a->l, a->t, a->r, a->b);
+}
+
+void recti_bands(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
+{
+    GGL_CONTEXT(c, con);
+    const recti_args_t args = { l, t, r, b };
+    if (!ggl_bands_draw(c, t, b, recti_band, &args)) {
+        recti(con, l, t, r, b);
+    }
+}
+
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -497,7 +520,8 @@ void trianglex_validate(void *con,
     if (c->state.needs.p & GGL_NEED_MASK(P_AA)) {
         c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug : aa_trianglex;
     } else {
-        c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug : trianglex_big;
+        c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug :
+                (ggl_bands_enabled() ? trianglex_bands : trianglex_big);
     }
     c->procs.trianglex(con, v0, v1, v2);
 }
@@ -808,6 +832,32 @@ void trianglex_big(void* con,
     }
 }
 
+struct trianglex_args_t {
+    const GGLcoord* v0;
+    const GGLcoord* v1;
+    const GGLcoord* v2;
+};
+
+static void trianglex_band(context_t* c, const void* args)
+{
+    const trianglex_args_t* a = static_cast<const trianglex_args_t*>(args);
+    trianglex_big(c, a->v0, a->v1, a->v2);
+}
+
+void trianglex_bands(void* con,
+        const GGLcoord* v0, const GGLcoord* v1, const GGLcoord* v2)
+{
+    GGL_CONTEXT(c, con);
+    // edges are set up from the first scanline of each band, which gives
+    // the same x as stepping down to it
+    const int32_t top = min(v0[1], v1[1], v2[1]) >> TRI_FRACTION_BITS;
+    const int32_t bottom = (max(v0[1], v1[1], v2[1]) >> TRI_FRACTION_BITS) + 1;
+    const trianglex_args_t args = { v0, v1, v2 };
+    if (!ggl_bands_draw(c, top, bottom, trianglex_band, &args)) {
+        trianglex_big(con, v0, v1, v2);
+    }
+}
+
 void aa_trianglex(void* con,
         const GGLcoord* a, const GGLcoord* b, const GGLcoord* c)
 {
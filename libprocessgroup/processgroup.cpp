@@ -25,9 +25,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <log/log.h>
 #include <private/android_filesystem_config.h>
@@ -37,14 +42,28 @@
 #include <processgroup/processgroup.h>
 #include "processgroup_priv.h"
 
-struct ctx {
-    bool initialized;
-    int fd;
-    char buf[128];
-    char *buf_ptr;
-    size_t buf_len;
+// How long killProcessGroup() waits for the processes to go
+#define KILL_TIMEOUT_MS 200
+
+// Empty pid directories kept ready under each uid directory, as spare_<n>,
+// for createProcessGroup() to rename into place rather than make.
+#define SPARE_GROUPS_PER_UID 2
+
+// Work for the background thread: making spares, removing dead groups.
+#define MAX_PENDING_WORK 64
+
+struct work {
+    uid_t uid;
+    int pid;    // the group to remove, or 0 to make spares for the uid
 };
 
+static pthread_mutex_t workLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static struct work pendingWork[MAX_PENDING_WORK];
+static size_t pendingStart;
+static size_t pendingCount;
+static bool workerStarted;
+
 static int convertUidToPath(char *path, size_t size, uid_t uid)
 {
     return snprintf(path, size, "%s/%s%d",
@@ -63,87 +82,121 @@ static int convertUidPidToPath(char *path, size_t size, uid_t uid, int pid)
             pid);
 }
 
-static int initCtx(uid_t uid, int pid, struct ctx *ctx)
+// Reads the whole cgroup.procs file of the group into a NUL terminated
+// buffer for the caller to free, so that a single snapshot of the group is
+// signalled rather than one pid per read.
+static int readAppProcesses(uid_t uid, int pid, char **procs)
 {
     int ret;
     char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
     convertUidPidToPath(path, sizeof(path), uid, pid);
     strlcat(path, PROCESSGROUP_CGROUP_PROCS_FILE, sizeof(path));
 
-    int fd = open(path, O_RDONLY);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         ret = -errno;
         SLOGW("failed to open %s: %s", path, strerror(errno));
         return ret;
     }
 
-    ctx->fd = fd;
-    ctx->buf_ptr = ctx->buf;
-    ctx->buf_len = 0;
-    ctx->initialized = true;
+    size_t size = 1024;
+    size_t len = 0;
+    char *buf = (char *)malloc(size);
+    while (buf != NULL) {
+        if (len + 1 == size) {
+            size *= 2;
+            char *bigger = (char *)realloc(buf, size);
+            if (bigger == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = bigger;
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, buf + len, size - len - 1));
+        if (n < 0) {
+            ret = -errno;
+            close(fd);
+            free(buf);
+            return ret;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    close(fd);
 
-    SLOGV("Initialized context for %s", path);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    buf[len] = '\0';
+    SLOGV("Read %zu bytes from %s", len, path);
 
+    *procs = buf;
     return 0;
 }
 
-static int refillBuffer(struct ctx *ctx)
+// Waits up to timeout_ms for the group to have no processes left, as told by
+// the populated field of its cgroup.events file, which the kernel notifies
+// changes of. Returns false, without waiting, for cgroups without the file.
+static bool waitForEmptyGroup(uid_t uid, int pid, int timeout_ms)
 {
-    memmove(ctx->buf, ctx->buf_ptr, ctx->buf_len);
-    ctx->buf_ptr = ctx->buf;
+    char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
+    convertUidPidToPath(path, sizeof(path), uid, pid);
+    strlcat(path, PROCESSGROUP_CGROUP_EVENTS_FILE, sizeof(path));
 
-    ssize_t ret = read(ctx->fd, ctx->buf_ptr + ctx->buf_len,
-                sizeof(ctx->buf) - ctx->buf_len - 1);
-    if (ret < 0) {
-        return -errno;
-    } else if (ret == 0) {
-        return 0;
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (ifd < 0) {
+        return false;
     }
-
-    ctx->buf_len += ret;
-    ctx->buf[ctx->buf_len] = 0;
-    SLOGV("Read %zd to buffer: %s", ret, ctx->buf);
-
-    assert(ctx->buf_len <= sizeof(ctx->buf));
-
-    return ret;
-}
-
-static pid_t getOneAppProcess(uid_t uid, int appProcessPid, struct ctx *ctx)
-{
-    if (!ctx->initialized) {
-        int ret = initCtx(uid, appProcessPid, ctx);
-        if (ret < 0) {
-            return ret;
-        }
+    if (inotify_add_watch(ifd, path, IN_MODIFY) < 0) {
+        close(ifd);
+        return false;
     }
 
-    char *eptr;
-    while ((eptr = (char *)memchr(ctx->buf_ptr, '\n', ctx->buf_len)) == NULL) {
-        int ret = refillBuffer(ctx);
-        if (ret == 0) {
-            return -ERANGE;
+    int64_t deadline = android::uptimeMillis() + timeout_ms;
+    for (;;) {
+        // Checked after the watch is in place, so no change goes unseen.
+        char buf[256];
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            break;
         }
-        if (ret < 0) {
-            return ret;
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf) - 1));
+        close(fd);
+        if (n <= 0) {
+            break;
+        }
+        buf[n] = '\0';
+        if (strstr(buf, "populated 0") != NULL) {
+            break;
         }
-    }
 
-    *eptr = '\0';
-    char *pid_eptr = NULL;
-    errno = 0;
-    long pid = strtol(ctx->buf_ptr, &pid_eptr, 10);
-    if (errno != 0) {
-        return -errno;
-    }
-    if (pid_eptr != eptr) {
-        return -EINVAL;
+        int64_t remaining = deadline - android::uptimeMillis();
+        if (remaining <= 0) {
+            break;
+        }
+        struct pollfd pfd = { ifd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, remaining)) <= 0) {
+            break;
+        }
+        struct inotify_event events[4];
+        TEMP_FAILURE_RETRY(read(ifd, events, sizeof(events)));
     }
 
-    ctx->buf_len -= (eptr - ctx->buf_ptr) + 1;
-    ctx->buf_ptr = eptr + 1;
+    close(ifd);
+    return true;
+}
 
-    return (pid_t)pid;
+static int convertUidSpareToPath(char *path, size_t size, uid_t uid, int spare)
+{
+    return snprintf(path, size, "%s/%s%d/%s%d",
+            PROCESSGROUP_CGROUP_PATH,
+            PROCESSGROUP_UID_PREFIX,
+            uid,
+            PROCESSGROUP_SPARE_PREFIX,
+            spare);
 }
 
 static int removeProcessGroup(uid_t uid, int pid)
@@ -173,7 +226,8 @@ static void removeUidProcessGroups(const char *uid_path)
                 continue;
             }
 
-            if (strncmp(dir->d_name, PROCESSGROUP_PID_PREFIX, strlen(PROCESSGROUP_PID_PREFIX))) {
+            if (strncmp(dir->d_name, PROCESSGROUP_PID_PREFIX, strlen(PROCESSGROUP_PID_PREFIX)) &&
+                strncmp(dir->d_name, PROCESSGROUP_SPARE_PREFIX, strlen(PROCESSGROUP_SPARE_PREFIX))) {
                 continue;
             }
 
@@ -213,15 +267,120 @@ void removeAllProcessGroups()
     }
 }
 
+static int mkdirAndChown(const char *path, mode_t mode, uid_t uid, gid_t gid)
+{
+    int ret;
+
+    ret = mkdir(path, mode);
+    if (ret < 0 && errno != EEXIST) {
+        return -errno;
+    }
+
+    ret = chown(path, uid, gid);
+    if (ret < 0) {
+        ret = -errno;
+        rmdir(path);
+        return ret;
+    }
+
+    return 0;
+}
+
+static void makeSpareProcessGroups(uid_t uid)
+{
+    char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
+
+    convertUidToPath(path, sizeof(path), uid);
+    if (mkdirAndChown(path, 0750, AID_SYSTEM, AID_SYSTEM) < 0) {
+        return;
+    }
+
+    for (int i = 0; i < SPARE_GROUPS_PER_UID; i++) {
+        convertUidSpareToPath(path, sizeof(path), uid, i);
+        if (access(path, F_OK) == 0) {
+            continue;
+        }
+        int ret = mkdirAndChown(path, 0750, AID_SYSTEM, AID_SYSTEM);
+        if (ret < 0) {
+            SLOGW("failed to make spare %s: %s", path, strerror(-ret));
+        }
+    }
+}
+
+static void *workerThread(void *)
+{
+    pthread_mutex_lock(&workLock);
+    for (;;) {
+        while (pendingCount == 0) {
+            pthread_cond_wait(&workCond, &workLock);
+        }
+        struct work w = pendingWork[pendingStart];
+        pendingStart = (pendingStart + 1) % MAX_PENDING_WORK;
+        pendingCount--;
+        pthread_mutex_unlock(&workLock);
+
+        if (w.pid != 0) {
+            SLOGV("removing process group uid %d pid %d", w.uid, w.pid);
+            removeProcessGroup(w.uid, w.pid);
+        } else {
+            makeSpareProcessGroups(w.uid);
+        }
+
+        pthread_mutex_lock(&workLock);
+    }
+    return NULL;
+}
+
+// Hands the work to the background thread, starting it if needed. Returns
+// false if it can't take it, for the caller to do it or let it go.
+static bool queueWork(uid_t uid, int pid)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&workLock);
+    if (!workerStarted) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        workerStarted = pthread_create(&thread, &attr, workerThread, NULL) == 0;
+        pthread_attr_destroy(&attr);
+    }
+    if (workerStarted && pendingCount < MAX_PENDING_WORK) {
+        struct work *w = &pendingWork[(pendingStart + pendingCount) % MAX_PENDING_WORK];
+        w->uid = uid;
+        w->pid = pid;
+        pendingCount++;
+        pthread_cond_signal(&workCond);
+        queued = true;
+    }
+    pthread_mutex_unlock(&workLock);
+
+    return queued;
+}
+
 static int killProcessGroupOnce(uid_t uid, int initialPid, int signal)
 {
     int processes = 0;
-    struct ctx ctx;
-    pid_t pid;
+    char *procs;
 
-    ctx.initialized = false;
+    if (readAppProcesses(uid, initialPid, &procs) < 0) {
+        return 0;
+    }
+
+    char *line = procs;
+    char *eptr;
+    while ((eptr = strchr(line, '\n')) != NULL) {
+        *eptr = '\0';
+        char *pid_eptr = NULL;
+        errno = 0;
+        long pid = strtol(line, &pid_eptr, 10);
+        if (errno != 0 || pid_eptr != eptr) {
+            SLOGW("bad pid '%s' in process group %d", line, initialPid);
+            break;
+        }
+        line = eptr + 1;
 
-    while ((pid = getOneAppProcess(uid, initialPid, &ctx)) >= 0) {
         processes++;
         if (pid == 0) {
             // Should never happen...  but if it does, trying to kill this
@@ -234,90 +393,91 @@ static int killProcessGroupOnce(uid_t uid, int initialPid, int signal)
             // what is going on in the log; however, don't be noisy about the base
             // process, since that it something we always kill, and we have already
             // logged elsewhere about killing it.
-            SLOGI("Killing pid %d in uid %d as part of process group %d", pid, uid, initialPid);
+            SLOGI("Killing pid %ld in uid %d as part of process group %d", pid, uid, initialPid);
         }
         int ret = kill(pid, signal);
         if (ret == -1) {
-            SLOGW("failed to kill pid %d: %s", pid, strerror(errno));
+            SLOGW("failed to kill pid %ld: %s", pid, strerror(errno));
         }
     }
 
-    if (ctx.initialized) {
-        close(ctx.fd);
-    }
-
+    free(procs);
     return processes;
 }
 
 int killProcessGroup(uid_t uid, int initialPid, int signal)
 {
     int processes;
-    const int sleep_us = 5 * 1000;  // 5ms
+    int sleep_us = 500;
     int64_t startTime = android::uptimeMillis();
-    int retry = 40;
 
     while ((processes = killProcessGroupOnce(uid, initialPid, signal)) > 0) {
         SLOGV("killed %d processes for processgroup %d\n", processes, initialPid);
-        if (retry > 0) {
-            usleep(sleep_us);
-            --retry;
-        } else {
+        int64_t elapsed = android::uptimeMillis() - startTime;
+        if (elapsed >= KILL_TIMEOUT_MS) {
             SLOGE("failed to kill %d processes for processgroup %d\n",
                     processes, initialPid);
             break;
         }
+        if (!waitForEmptyGroup(uid, initialPid, KILL_TIMEOUT_MS - elapsed)) {
+            // No notifications from this cgroup: poll, most processes are
+            // gone within a millisecond or two of the signal.
+            usleep(sleep_us);
+            if (sleep_us < 5 * 1000) {
+                sleep_us *= 2;
+            }
+        }
     }
 
     SLOGV("Killed process group uid %d pid %d in %" PRId64 "ms, %d procs remain", uid, initialPid,
             android::uptimeMillis()-startTime, processes);
 
     if (processes == 0) {
+        // The empty group can go at leisure.
+        if (queueWork(uid, initialPid)) {
+            return 0;
+        }
         return removeProcessGroup(uid, initialPid);
     } else {
         return -1;
     }
 }
 
-static int mkdirAndChown(const char *path, mode_t mode, uid_t uid, gid_t gid)
-{
-    int ret;
-
-    ret = mkdir(path, mode);
-    if (ret < 0 && errno != EEXIST) {
-        return -errno;
-    }
-
-    ret = chown(path, uid, gid);
-    if (ret < 0) {
-        ret = -errno;
-        rmdir(path);
-        return ret;
-    }
-
-    return 0;
-}
-
 int createProcessGroup(uid_t uid, int initialPid)
 {
     char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
     int ret;
 
-    convertUidToPath(path, sizeof(path), uid);
+    convertUidPidToPath(path, sizeof(path), uid, initialPid);
 
-    ret = mkdirAndChown(path, 0750, AID_SYSTEM, AID_SYSTEM);
-    if (ret < 0) {
-        SLOGE("failed to make and chown %s: %s", path, strerror(-ret));
-        return ret;
+    // Claim a spare if there is one, it already has its owner.
+    bool claimed = false;
+    for (int i = 0; i < SPARE_GROUPS_PER_UID && !claimed; i++) {
+        char spare[PROCESSGROUP_MAX_PATH_LEN] = {0};
+        convertUidSpareToPath(spare, sizeof(spare), uid, i);
+        claimed = rename(spare, path) == 0;
     }
 
-    convertUidPidToPath(path, sizeof(path), uid, initialPid);
+    if (!claimed) {
+        char uid_path[PROCESSGROUP_MAX_PATH_LEN] = {0};
+        convertUidToPath(uid_path, sizeof(uid_path), uid);
 
-    ret = mkdirAndChown(path, 0750, AID_SYSTEM, AID_SYSTEM);
-    if (ret < 0) {
-        SLOGE("failed to make and chown %s: %s", path, strerror(-ret));
-        return ret;
+        ret = mkdirAndChown(uid_path, 0750, AID_SYSTEM, AID_SYSTEM);
+        if (ret < 0) {
+            SLOGE("failed to make and chown %s: %s", uid_path, strerror(-ret));
+            return ret;
+        }
+
+        ret = mkdirAndChown(path, 0750, AID_SYSTEM, AID_SYSTEM);
+        if (ret < 0) {
+            SLOGE("failed to make and chown %s: %s", path, strerror(-ret));
+            return ret;
+        }
     }
 
+    // Get spares ready for the next start of this uid.
+    queueWork(uid, 0);
+
     strlcat(path, PROCESSGROUP_CGROUP_PROCS_FILE, sizeof(path));
 
     int fd = open(path, O_WRONLY);
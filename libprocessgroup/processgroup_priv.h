@@ -20,7 +20,9 @@
 #define PROCESSGROUP_CGROUP_PATH "/acct"
 #define PROCESSGROUP_UID_PREFIX "uid_"
 #define PROCESSGROUP_PID_PREFIX "pid_"
+#define PROCESSGROUP_SPARE_PREFIX "spare_"
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
 #define PROCESSGROUP_MAX_UID_LEN 11
 #define PROCESSGROUP_MAX_PID_LEN 11
 #define PROCESSGROUP_MAX_PATH_LEN \
@@ -29,7 +31,7 @@
          PROCESSGROUP_MAX_UID_LEN + \
          sizeof(PROCESSGROUP_PID_PREFIX) + 1 + \
          PROCESSGROUP_MAX_PID_LEN + \
-         sizeof(PROCESSGROUP_CGROUP_PROCS_FILE) + \
+         sizeof(PROCESSGROUP_CGROUP_EVENTS_FILE) + \
          1)
 
 #endif
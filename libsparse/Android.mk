@@ -27,6 +27,7 @@ LOCAL_SRC_FILES := $(libsparse_src_files)
 LOCAL_MODULE := libsparse
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/include
 LOCAL_SHARED_LIBRARIES := \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_SHARED_LIBRARY)
@@ -50,6 +51,7 @@ LOCAL_MODULE := simg2img_host
 LOCAL_MODULE_STEM := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
@@ -61,6 +63,7 @@ LOCAL_SRC_FILES := simg2img.c \
 LOCAL_MODULE := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_static \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_EXECUTABLE)
@@ -73,6 +76,7 @@ LOCAL_MODULE := img2simg_host
 LOCAL_MODULE_STEM := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
@@ -83,6 +87,7 @@ LOCAL_SRC_FILES := img2simg.c
 LOCAL_MODULE := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_static \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_EXECUTABLE)
@@ -95,6 +100,7 @@ LOCAL_SRC_FILES := append2simg.c
 LOCAL_MODULE := append2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
+    libcutils \
     libz
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
@@ -44,11 +44,23 @@ struct backed_block {
 		} fill;
 	};
 	struct backed_block *next;
+	/* Links at skip list levels 1 to levels - 1, see below */
+	struct backed_block **skip;
+	unsigned int levels;
 };
 
+/*
+ * The blocks are kept in a list sorted by block number, linked through
+ * next, with a skip list on top of it so that they can be inserted and
+ * found anywhere in O(log n) time.  A block is linked at level 0, next,
+ * and with probability 1/4 at each level above the last one.
+ */
+#define SKIP_LEVELS 16
+
 struct backed_block_list {
 	struct backed_block *data_blocks;
-	struct backed_block *last_used;
+	struct backed_block *skip[SKIP_LEVELS - 1];
+	uint32_t random;
 	unsigned int block_size;
 };
 
@@ -117,6 +129,7 @@ void backed_block_destroy(struct backed_block *bb)
 		free(bb->file.filename);
 	}
 
+	free(bb->skip);
 	free(bb);
 }
 
@@ -124,9 +137,90 @@ struct backed_block_list *backed_block_list_new(unsigned int block_size)
 {
 	struct backed_block_list *b = calloc(sizeof(struct backed_block_list), 1);
 	b->block_size = block_size;
+	b->random = 2463534242U;
 	return b;
 }
 
+/* The link out of bb, or out of the head of the list if bb is NULL */
+static struct backed_block **skip_link(struct backed_block_list *bbl,
+		struct backed_block *bb, unsigned int level)
+{
+	if (level == 0) {
+		return bb ? &bb->next : &bbl->data_blocks;
+	}
+	return bb ? &bb->skip[level - 1] : &bbl->skip[level - 1];
+}
+
+/*
+ * Sets links[level] to the link at each level that points to the first
+ * block at or after block, and returns the last block before it, if any.
+ */
+static struct backed_block *skip_search(struct backed_block_list *bbl,
+		unsigned int block, struct backed_block **links[SKIP_LEVELS])
+{
+	struct backed_block *bb = NULL;
+	struct backed_block **link;
+	int level;
+
+	for (level = SKIP_LEVELS - 1; level >= 0; level--) {
+		link = skip_link(bbl, bb, level);
+		while (*link && (*link)->block < block) {
+			bb = *link;
+			link = skip_link(bbl, bb, level);
+		}
+		links[level] = link;
+	}
+	return bb;
+}
+
+/* Links a new bb in at the place skip_search found for it */
+static void skip_insert(struct backed_block_list *bbl, struct backed_block *bb,
+		struct backed_block **links[SKIP_LEVELS])
+{
+	unsigned int level;
+	uint32_t r;
+
+	if (!bb->levels) {
+		/* xorshift32, two bits per level */
+		r = bbl->random;
+		r ^= r << 13;
+		r ^= r >> 17;
+		r ^= r << 5;
+		bbl->random = r;
+
+		bb->levels = 1;
+		while (bb->levels < SKIP_LEVELS && (r & 3) == 0) {
+			bb->levels++;
+			r >>= 2;
+		}
+		bb->skip = NULL;
+		if (bb->levels > 1) {
+			bb->skip = calloc(bb->levels - 1, sizeof(*bb->skip));
+			if (!bb->skip) {
+				/* Still correct, if slower to find things after it */
+				bb->levels = 1;
+			}
+		}
+	}
+
+	for (level = 0; level < bb->levels; level++) {
+		*skip_link(bbl, bb, level) = *links[level];
+		*links[level] = bb;
+	}
+}
+
+static void skip_remove(struct backed_block_list *bbl, struct backed_block *bb)
+{
+	struct backed_block **links[SKIP_LEVELS];
+	unsigned int level;
+
+	skip_search(bbl, bb->block, links);
+	for (level = 0; level < bb->levels; level++) {
+		assert(*links[level] == bb);
+		*links[level] = *skip_link(bbl, bb, level);
+	}
+}
+
 void backed_block_list_destroy(struct backed_block_list *bbl)
 {
 	if (bbl->data_blocks) {
@@ -145,44 +239,43 @@ void backed_block_list_move(struct backed_block_list *from,
 		struct backed_block_list *to, struct backed_block *start,
 		struct backed_block *end)
 {
+	struct backed_block **links[SKIP_LEVELS];
 	struct backed_block *bb;
+	struct backed_block *next;
+	int level;
 
 	if (start == NULL) {
 		start = from->data_blocks;
 	}
 
 	if (!end) {
-		for (end = start; end && end->next; end = end->next)
-			;
+		/* The last block, found from the top level down */
+		for (level = SKIP_LEVELS - 1; level >= 0; level--) {
+			while (*skip_link(from, end, level)) {
+				end = *skip_link(from, end, level);
+			}
+		}
 	}
 
 	if (start == NULL || end == NULL) {
 		return;
 	}
 
-	from->last_used = NULL;
-	to->last_used = NULL;
-	if (from->data_blocks == start) {
-		from->data_blocks = end->next;
-	} else {
-		for (bb = from->data_blocks; bb; bb = bb->next) {
-			if (bb->next == start) {
-				bb->next = end->next;
-				break;
-			}
-		}
+	/* Unlink start to end from every level of from, keeping their next */
+	skip_search(from, start->block, links);
+	for (level = 0; level < SKIP_LEVELS; level++) {
+		for (bb = *links[level]; bb && bb->block <= end->block;
+				bb = *skip_link(from, bb, level))
+			;
+		*links[level] = bb;
 	}
 
-	if (!to->data_blocks) {
-		to->data_blocks = start;
-		end->next = NULL;
-	} else {
-		for (bb = to->data_blocks; bb; bb = bb->next) {
-			if (!bb->next || bb->next->block > start->block) {
-				end->next = bb->next;
-				bb->next = start;
-				break;
-			}
+	for (bb = start;; bb = next) {
+		next = bb->next;
+		skip_search(to, bb->block, links);
+		skip_insert(to, bb, links);
+		if (bb == end) {
+			break;
 		}
 	}
 }
@@ -237,7 +330,7 @@ static int merge_bb(struct backed_block_list *bbl,
 	/* Blocks are compatible and adjacent, with a before b.  Merge b into a,
 	 * and free b */
 	a->len += b->len;
-	a->next = b->next;
+	skip_remove(bbl, b);
 
 	backed_block_destroy(b);
 
@@ -246,41 +339,18 @@ static int merge_bb(struct backed_block_list *bbl,
 
 static int queue_bb(struct backed_block_list *bbl, struct backed_block *new_bb)
 {
+	struct backed_block **links[SKIP_LEVELS];
 	struct backed_block *bb;
 
-	if (bbl->data_blocks == NULL) {
-		bbl->data_blocks = new_bb;
-		return 0;
-	}
-
-	if (bbl->data_blocks->block > new_bb->block) {
-		new_bb->next = bbl->data_blocks;
-		bbl->data_blocks = new_bb;
-		return 0;
-	}
+	bb = skip_search(bbl, new_bb->block, links);
+	skip_insert(bbl, new_bb, links);
 
-	/* Optimization: blocks are mostly queued in sequence, so save the
-	   pointer to the last bb that was added, and start searching from
-	   there if the next block number is higher */
-	if (bbl->last_used && new_bb->block > bbl->last_used->block)
-		bb = bbl->last_used;
-	else
-		bb = bbl->data_blocks;
-	bbl->last_used = new_bb;
-
-	for (; bb->next && bb->next->block < new_bb->block; bb = bb->next)
-		;
-
-	if (bb->next == NULL) {
-		bb->next = new_bb;
-	} else {
-		new_bb->next = bb->next;
-		bb->next = new_bb;
+	/* As before, a block queued at the head of the list isn't merged */
+	if (bb) {
+		merge_bb(bbl, new_bb, new_bb->next);
+		merge_bb(bbl, bb, new_bb);
 	}
 
-	merge_bb(bbl, new_bb, new_bb->next);
-	merge_bb(bbl, bb, new_bb);
-
 	return 0;
 }
 
@@ -361,6 +431,7 @@ int backed_block_add_fd(struct backed_block_list *bbl, int fd, int64_t offset,
 int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 		unsigned int max_len)
 {
+	struct backed_block **links[SKIP_LEVELS];
 	struct backed_block *new_bb;
 
 	max_len = ALIGN_DOWN(max_len, bbl->block_size);
@@ -378,8 +449,9 @@ int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 
 	new_bb->len = bb->len - max_len;
 	new_bb->block = bb->block + max_len / bbl->block_size;
-	new_bb->next = bb->next;
-	bb->next = new_bb;
+	new_bb->levels = 0;
+	skip_search(bbl, new_bb->block, links);
+	skip_insert(bbl, new_bb, links);
 	bb->len = max_len;
 
 	switch (bb->type) {
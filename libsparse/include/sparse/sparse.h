@@ -175,6 +175,25 @@ int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
  */
 int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc);
 
+/**
+ * sparse_file_block_size - return the block size of a sparse file
+ *
+ * @s - sparse file cookie
+ *
+ * Returns the block_size the sparse file was created or imported with.
+ */
+unsigned int sparse_file_block_size(struct sparse_file *s);
+
+/**
+ * sparse_file_expanded_len - return the length of a sparse file as a normal file
+ *
+ * @s - sparse file cookie
+ *
+ * Returns the len the sparse file was created or imported with, the same as
+ * sparse_file_len(s, false, false) but without walking the file.
+ */
+int64_t sparse_file_expanded_len(struct sparse_file *s);
+
 /**
  * sparse_file_callback - call a callback for blocks in sparse file
  *
@@ -260,6 +279,62 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+/** sparse_file_resparse_next - take the next smaller file off a sparse file
+ *
+ * @in_s - sparse file cookie of the existing sparse file
+ * @max_len - maximum file size
+ * @out_s - set to the sparse file cookie of the smaller file
+ *
+ * Moves chunks from the start of in_s into a new sparse file that is less
+ * than max_len, splitting a chunk like sparse_file_resparse does.  Calling
+ * it until it returns 0 gives the same files as sparse_file_resparse, one
+ * at a time and in a single pass over in_s, and leaves in_s empty.  Unlike
+ * sparse_file_resparse, an in_s with no chunks gives no files at all.
+ *
+ * Returns 1 with *out_s set, 0 if in_s is empty, or a negative errno.
+ */
+int sparse_file_resparse_next(struct sparse_file *in_s, unsigned int max_len,
+		struct sparse_file **out_s);
+
+/**
+ * sparse_file_chunk_crc32 - checksum the data of a sparse file, chunk by chunk
+ *
+ * @s - sparse file cookie
+ * @chunk_len - length of the chunks, a multiple of the block size
+ * @func - function to call for each run of blocks with data in a chunk
+ * @priv - value that will be passed as the first argument to func
+ *
+ * Divides the expanded file into chunks of chunk_len bytes, and calls func,
+ * in order, for each run of blocks within a chunk that aren't skipped, with
+ * the first block, the number of blocks, and the crc32 (as computed by
+ * zlib's crc32) of their contents as sparse_file_write would write them
+ * out.  func should return 0 to carry on.
+ *
+ * Returns 0 on success, the first non-zero value func returned, or a
+ * negative errno.
+ */
+int sparse_file_chunk_crc32(struct sparse_file *s, unsigned int chunk_len,
+		int (*func)(void *priv, unsigned int block, unsigned int count,
+				uint32_t crc),
+		void *priv);
+
+/**
+ * sparse_file_copy_blocks - add some of the blocks of a sparse file to another
+ *
+ * @in_s - sparse file cookie to copy from
+ * @out_s - sparse file cookie to copy to, with the same block size
+ * @block - the first block to copy
+ * @count - the number of blocks to copy
+ *
+ * Adds whatever in_s has between block and block + count to out_s at the
+ * same place, leaving what in_s skips skipped.  The data is not copied: the
+ * buffers, files and fds it comes from must stay around as long as out_s.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_copy_blocks(struct sparse_file *in_s, struct sparse_file *out_s,
+		unsigned int block, unsigned int count);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
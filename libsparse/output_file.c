@@ -29,6 +29,8 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include <cutils/memory.h>
+
 #include "defs.h"
 #include "output_file.h"
 #include "sparse_crc32.h"
@@ -68,8 +70,9 @@ struct output_file_ops {
 };
 
 struct sparse_file_ops {
+	/* data_crc, if not NULL, is the sparse_crc32 of the len bytes of data */
 	int (*write_data_chunk)(struct output_file *out, unsigned int len,
-			void *data);
+			void *data, const uint32_t *data_crc);
 	int (*write_fill_chunk)(struct output_file *out, unsigned int len,
 			uint32_t fill_val);
 	int (*write_skip_chunk)(struct output_file *out, int64_t len);
@@ -87,6 +90,7 @@ struct output_file {
 	int64_t len;
 	char *zero_buf;
 	uint32_t *fill_buf;
+	uint32_t fill_buf_val;
 	char *buf;
 };
 
@@ -399,7 +403,7 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 }
 
 static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
-		void *data)
+		void *data, const uint32_t *data_crc)
 {
 	chunk_header_t chunk_header;
 	int rnd_up_len, zero_len;
@@ -428,7 +432,10 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 	}
 
 	if (out->use_crc) {
-		out->crc32 = sparse_crc32(out->crc32, data, len);
+		if (data_crc)
+			out->crc32 = sparse_crc32_combine(out->crc32, *data_crc, len);
+		else
+			out->crc32 = sparse_crc32(out->crc32, data, len);
 		if (zero_len)
 			out->crc32 = sparse_crc32(out->crc32, out->zero_buf, zero_len);
 	}
@@ -473,7 +480,7 @@ static struct sparse_file_ops sparse_file_ops = {
 };
 
 static int write_normal_data_chunk(struct output_file *out, unsigned int len,
-		void *data)
+		void *data, const uint32_t *data_crc __unused)
 {
 	int ret;
 	unsigned int rnd_up_len = ALIGN(len, out->block_size);
@@ -494,12 +501,12 @@ static int write_normal_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val)
 {
 	int ret;
-	unsigned int i;
 	unsigned int write_len;
 
-	/* Initialize fill_buf with the fill_val */
-	for (i = 0; i < out->block_size / sizeof(uint32_t); i++) {
-		out->fill_buf[i] = fill_val;
+	/* Fill values repeat across chunks, so only refill fill_buf on a change */
+	if (fill_val != out->fill_buf_val) {
+		android_memset32(out->fill_buf, fill_val, out->block_size);
+		out->fill_buf_val = fill_val;
 	}
 
 	while (len) {
@@ -562,6 +569,7 @@ static int output_file_init(struct output_file *out, int block_size,
 		ret = -ENOMEM;
 		goto err_fill_buf;
 	}
+	out->fill_buf_val = 0;
 
 	if (sparse) {
 		out->sparse_ops = &sparse_file_ops;
@@ -682,7 +690,14 @@ struct output_file *output_file_open_fd(int fd, unsigned int block_size, int64_t
 /* Write a contiguous region of data blocks from a memory buffer */
 int write_data_chunk(struct output_file *out, unsigned int len, void *data)
 {
-	return out->sparse_ops->write_data_chunk(out, len, data);
+	return out->sparse_ops->write_data_chunk(out, len, data, NULL);
+}
+
+/* Same as write_data_chunk, with the sparse_crc32 of data already computed */
+int write_data_chunk_crc(struct output_file *out, unsigned int len, void *data,
+		uint32_t data_crc)
+{
+	return out->sparse_ops->write_data_chunk(out, len, data, &data_crc);
 }
 
 /* Write a contiguous region of data blocks with a fill value */
@@ -731,7 +746,7 @@ int write_fd_chunk(struct output_file *out, unsigned int len,
 	ptr = data;
 #endif
 
-	ret = out->sparse_ops->write_data_chunk(out, len, ptr);
+	ret = out->sparse_ops->write_data_chunk(out, len, ptr, NULL);
 
 #ifndef USE_MINGW
 	munmap(data, buffer_size);
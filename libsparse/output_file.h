@@ -27,6 +27,8 @@ struct output_file *output_file_open_callback(int (*write)(void *, const void *,
 		void *priv, unsigned int block_size, int64_t len, int gz, int sparse,
 		int chunks, int crc);
 int write_data_chunk(struct output_file *out, unsigned int len, void *data);
+int write_data_chunk_crc(struct output_file *out, unsigned int len, void *data,
+		uint32_t data_crc);
 int write_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val);
 int write_file_chunk(struct output_file *out, unsigned int len,
@@ -14,8 +14,24 @@
  * limitations under the License.
  */
 
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef USE_MINGW
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__APPLE__) && defined(__MACH__)
+#define mmap64 mmap
+#endif
 
 #include <sparse/sparse.h>
 
@@ -24,9 +40,15 @@
 
 #include "output_file.h"
 #include "backed_block.h"
+#include "sparse_crc32.h"
 #include "sparse_defs.h"
 #include "sparse_format.h"
 
+#define min(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
+#define max(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a > _b) ? _a : _b; })
+
 struct sparse_file *sparse_file_new(unsigned int block_size, int64_t len)
 {
 	struct sparse_file *s = calloc(sizeof(struct sparse_file), 1);
@@ -129,13 +151,289 @@ static int sparse_file_write_block(struct output_file *out,
 	return ret;
 }
 
-static int write_all_blocks(struct sparse_file *s, struct output_file *out)
+#ifndef USE_MINGW
+/*
+ * With the pipeline, worker threads fault in (and checksum, when the output
+ * has a CRC) the data of the blocks ahead of the one being written, in
+ * pieces, while the calling thread writes the chunks out in order.
+ */
+#define PIPELINE_THREADS 4
+#define PIPELINE_PIECE_SIZE (4 * 1024 * 1024)
+/* How far ahead of the writer blocks are mapped */
+#define PIPELINE_WINDOW (256 * 1024 * 1024)
+
+struct pipeline_block {
+	struct backed_block *bb;
+	char *map;		/* NULL for data and fill blocks */
+	size_t map_len;
+	char *data;		/* NULL for fill blocks */
+	unsigned int pieces;
+	unsigned int pieces_left;
+	uint32_t *crcs;		/* of each piece */
+	int error;
+};
+
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	/* All protected by lock */
+	struct pipeline_block *blocks;
+	unsigned int count;
+	unsigned int mapped;		/* blocks [0, mapped) are ready for the workers */
+	unsigned int next_block;	/* the next piece for a worker */
+	unsigned int next_piece;
+	bool quit;
+	/* Set before the workers start */
+	bool crc;
+};
+
+static int pipeline_map_block(struct pipeline_block *pb)
+{
+	struct backed_block *bb = pb->bb;
+	unsigned int len = backed_block_len(bb);
+	int64_t offset, aligned_offset;
+	int fd;
+
+	switch (backed_block_type(bb)) {
+	case BACKED_BLOCK_DATA:
+		pb->data = backed_block_data(bb);
+		break;
+	case BACKED_BLOCK_FILE:
+	case BACKED_BLOCK_FD:
+		if (backed_block_type(bb) == BACKED_BLOCK_FILE) {
+			fd = open(backed_block_filename(bb), O_RDONLY);
+			if (fd < 0)
+				return -errno;
+		} else {
+			fd = backed_block_fd(bb);
+		}
+		offset = backed_block_file_offset(bb);
+		aligned_offset = offset & ~(4096 - 1);
+		pb->map_len = len + (offset - aligned_offset);
+		pb->map = mmap64(NULL, pb->map_len, PROT_READ, MAP_SHARED, fd,
+				aligned_offset);
+		if (backed_block_type(bb) == BACKED_BLOCK_FILE)
+			close(fd);
+		if (pb->map == MAP_FAILED) {
+			pb->map = NULL;
+			return -errno;
+		}
+		pb->data = pb->map + (offset - aligned_offset);
+		break;
+	case BACKED_BLOCK_FILL:
+		return 0;
+	}
+
+	pb->crcs = calloc(DIV_ROUND_UP(len, PIPELINE_PIECE_SIZE), sizeof(uint32_t));
+	if (!pb->crcs)
+		return -ENOMEM;
+	pb->pieces = DIV_ROUND_UP(len, PIPELINE_PIECE_SIZE);
+	pb->pieces_left = pb->pieces;
+	return 0;
+}
+
+static void pipeline_unmap_block(struct pipeline_block *pb)
+{
+	if (pb->map)
+		munmap(pb->map, pb->map_len);
+	pb->map = NULL;
+	free(pb->crcs);
+	pb->crcs = NULL;
+}
+
+static void *pipeline_worker(void *arg)
+{
+	struct pipeline *p = arg;
+	struct pipeline_block *pb;
+	unsigned int piece;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->quit) {
+		if (p->next_block == p->mapped) {
+			pthread_cond_wait(&p->work_cond, &p->lock);
+			continue;
+		}
+		pb = &p->blocks[p->next_block];
+		if (p->next_piece >= pb->pieces) {
+			p->next_block++;
+			p->next_piece = 0;
+			continue;
+		}
+		piece = p->next_piece++;
+		pthread_mutex_unlock(&p->lock);
+
+		unsigned int start = piece * PIPELINE_PIECE_SIZE;
+		unsigned int len = backed_block_len(pb->bb) - start;
+		if (len > PIPELINE_PIECE_SIZE)
+			len = PIPELINE_PIECE_SIZE;
+		if (p->crc) {
+			pb->crcs[piece] = sparse_crc32(0, pb->data + start, len);
+		} else {
+			/* Just read it in */
+			const volatile char *c;
+			for (c = pb->data + start; c < pb->data + start + len; c += 4096)
+				(void)*c;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if (--pb->pieces_left == 0)
+			pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static int pipeline_write_block(struct output_file *out, struct pipeline_block *pb,
+		bool crc)
+{
+	struct backed_block *bb = pb->bb;
+	unsigned int len = backed_block_len(bb);
+	unsigned int i;
+	uint32_t data_crc;
+
+	if (backed_block_type(bb) == BACKED_BLOCK_FILL)
+		return write_fill_chunk(out, len, backed_block_fill_val(bb));
+
+	if (!crc)
+		return write_data_chunk(out, len, pb->data);
+
+	data_crc = pb->crcs[0];
+	for (i = 1; i < pb->pieces; i++) {
+		unsigned int piece_len = len - i * PIPELINE_PIECE_SIZE;
+		if (piece_len > PIPELINE_PIECE_SIZE)
+			piece_len = PIPELINE_PIECE_SIZE;
+		data_crc = sparse_crc32_combine(data_crc, pb->crcs[i], piece_len);
+	}
+	return write_data_chunk_crc(out, len, pb->data, data_crc);
+}
+
+static int write_all_blocks_pipelined(struct sparse_file *s, struct output_file *out,
+		unsigned int count, bool crc)
 {
+	struct pipeline p;
+	pthread_t threads[PIPELINE_THREADS];
+	unsigned int nthreads = 0;
 	struct backed_block *bb;
 	unsigned int last_block = 0;
+	unsigned int i;
+	int64_t ahead = 0;
 	int64_t pad;
 	int ret = 0;
 
+	memset(&p, 0, sizeof(p));
+	p.blocks = calloc(count, sizeof(struct pipeline_block));
+	if (!p.blocks)
+		return -ENOMEM;
+	for (i = 0, bb = backed_block_iter_new(s->backed_block_list); bb;
+			i++, bb = backed_block_iter_next(bb)) {
+		p.blocks[i].bb = bb;
+	}
+	p.count = count;
+	p.crc = crc;
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.work_cond, NULL);
+	pthread_cond_init(&p.done_cond, NULL);
+
+	while (nthreads < PIPELINE_THREADS &&
+			!pthread_create(&threads[nthreads], NULL, pipeline_worker, &p)) {
+		nthreads++;
+	}
+	if (nthreads == 0) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct pipeline_block *pb = &p.blocks[i];
+
+		/* Keep the workers PIPELINE_WINDOW ahead, at least one block */
+		pthread_mutex_lock(&p.lock);
+		while (p.mapped < count && (p.mapped == i || ahead < PIPELINE_WINDOW)) {
+			struct pipeline_block *next = &p.blocks[p.mapped];
+			pthread_mutex_unlock(&p.lock);
+			next->error = pipeline_map_block(next);
+			if (next->error)
+				next->pieces = next->pieces_left = 0;
+			ahead += backed_block_len(next->bb);
+			pthread_mutex_lock(&p.lock);
+			p.mapped++;
+			pthread_cond_broadcast(&p.work_cond);
+		}
+		while (pb->pieces_left)
+			pthread_cond_wait(&p.done_cond, &p.lock);
+		pthread_mutex_unlock(&p.lock);
+
+		if (pb->error) {
+			ret = pb->error;
+			goto out;
+		}
+		if (backed_block_block(bb = pb->bb) > last_block) {
+			unsigned int blocks = backed_block_block(bb) - last_block;
+			write_skip_chunk(out, (int64_t)blocks * s->block_size);
+		}
+		ret = pipeline_write_block(out, pb, crc);
+		ahead -= backed_block_len(bb);
+		pipeline_unmap_block(pb);
+		if (ret)
+			goto out;
+		last_block = backed_block_block(bb) +
+				DIV_ROUND_UP(backed_block_len(bb), s->block_size);
+	}
+
+	pad = s->len - (int64_t)last_block * s->block_size;
+	assert(pad >= 0);
+	if (pad > 0) {
+		write_skip_chunk(out, pad);
+	}
+
+out:
+	pthread_mutex_lock(&p.lock);
+	p.quit = true;
+	pthread_cond_broadcast(&p.work_cond);
+	pthread_mutex_unlock(&p.lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < p.mapped; i++)
+		pipeline_unmap_block(&p.blocks[i]);
+	pthread_cond_destroy(&p.done_cond);
+	pthread_cond_destroy(&p.work_cond);
+	pthread_mutex_destroy(&p.lock);
+	free(p.blocks);
+	return ret;
+}
+#endif
+
+/*
+ * pipeline reads the data ahead on other threads, for when it is all going
+ * to be read anyway.
+ */
+static int write_all_blocks(struct sparse_file *s, struct output_file *out, bool crc,
+		bool pipeline)
+{
+	struct backed_block *bb;
+	unsigned int last_block = 0;
+	int64_t pad;
+	int ret = 0;
+
+#ifndef USE_MINGW
+	unsigned int count = 0;
+	for (bb = backed_block_iter_new(s->backed_block_list); bb;
+			bb = backed_block_iter_next(bb)) {
+		count++;
+	}
+	if (pipeline && count > 1) {
+		ret = write_all_blocks_pipelined(s, out, count, crc);
+		if (ret != -EAGAIN)
+			return ret;
+		/* No threads, nothing written yet */
+		ret = 0;
+	}
+#else
+	(void)crc;
+	(void)pipeline;
+#endif
+
 	for (bb = backed_block_iter_new(s->backed_block_list); bb;
 			bb = backed_block_iter_next(bb)) {
 		if (backed_block_block(bb) > last_block) {
@@ -171,7 +469,7 @@ int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
 	if (!out)
 		return -ENOMEM;
 
-	ret = write_all_blocks(s, out);
+	ret = write_all_blocks(s, out, crc, true);
 
 	output_file_close(out);
 
@@ -192,7 +490,7 @@ int sparse_file_callback(struct sparse_file *s, bool sparse, bool crc,
 	if (!out)
 		return -ENOMEM;
 
-	ret = write_all_blocks(s, out);
+	ret = write_all_blocks(s, out, crc, true);
 
 	output_file_close(out);
 
@@ -206,6 +504,16 @@ static int out_counter_write(void *priv, const void *data __unused, int len)
 	return 0;
 }
 
+unsigned int sparse_file_block_size(struct sparse_file *s)
+{
+	return s->block_size;
+}
+
+int64_t sparse_file_expanded_len(struct sparse_file *s)
+{
+	return s->len;
+}
+
 int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc)
 {
 	int ret;
@@ -219,7 +527,7 @@ int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc)
 		return -1;
 	}
 
-	ret = write_all_blocks(s, out);
+	ret = write_all_blocks(s, out, crc, false);
 
 	output_file_close(out);
 
@@ -333,6 +641,183 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 	return c;
 }
 
+int sparse_file_resparse_next(struct sparse_file *in_s, unsigned int max_len,
+		struct sparse_file **out_s)
+{
+	struct sparse_file *s;
+
+	if (!backed_block_iter_new(in_s->backed_block_list)) {
+		return 0;
+	}
+
+	s = sparse_file_new(in_s->block_size, in_s->len);
+	if (!s) {
+		return -ENOMEM;
+	}
+
+	move_chunks_up_to_len(in_s, s, max_len);
+	if (!backed_block_iter_new(s->backed_block_list)) {
+		/* Counting the size of the first chunk failed */
+		sparse_file_destroy(s);
+		return -EIO;
+	}
+
+	*out_s = s;
+	return 1;
+}
+
+struct chunk_crc32_state {
+	unsigned int block_size;
+	unsigned int chunk_len;
+	int (*func)(void *priv, unsigned int block, unsigned int count, uint32_t crc);
+	void *priv;
+	int64_t pos;		/* in the expanded image */
+	int64_t run_start;	/* of the data being summed, or -1 */
+	uint32_t crc;
+};
+
+static int chunk_crc32_flush(struct chunk_crc32_state *st)
+{
+	int ret;
+
+	if (st->run_start < 0) {
+		return 0;
+	}
+	ret = st->func(st->priv, st->run_start / st->block_size,
+			DIV_ROUND_UP(st->pos - st->run_start, st->block_size), st->crc);
+	st->run_start = -1;
+	return ret;
+}
+
+static int chunk_crc32_write(void *priv, const void *data, int len)
+{
+	struct chunk_crc32_state *st = priv;
+	const char *ptr = data;
+	unsigned int n;
+	int ret;
+
+	if (!data) {
+		ret = chunk_crc32_flush(st);
+		st->pos += len;
+		return ret;
+	}
+
+	while (len > 0) {
+		n = st->chunk_len - st->pos % st->chunk_len;
+		if (n > (unsigned int)len) {
+			n = len;
+		}
+		if (st->run_start < 0) {
+			st->run_start = st->pos;
+			st->crc = 0;
+		}
+		st->crc = sparse_crc32(st->crc, ptr, n);
+		st->pos += n;
+		ptr += n;
+		len -= n;
+		if (st->pos % st->chunk_len == 0) {
+			ret = chunk_crc32_flush(st);
+			if (ret) {
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int sparse_file_chunk_crc32(struct sparse_file *s, unsigned int chunk_len,
+		int (*func)(void *priv, unsigned int block, unsigned int count,
+				uint32_t crc),
+		void *priv)
+{
+	struct chunk_crc32_state st;
+	int ret;
+
+	if (chunk_len == 0 || chunk_len % s->block_size) {
+		return -EINVAL;
+	}
+
+	st.block_size = s->block_size;
+	st.chunk_len = chunk_len;
+	st.func = func;
+	st.priv = priv;
+	st.pos = 0;
+	st.run_start = -1;
+	st.crc = 0;
+
+	ret = sparse_file_callback(s, false, false, chunk_crc32_write, &st);
+	if (ret) {
+		return ret;
+	}
+	return chunk_crc32_flush(&st);
+}
+
+int sparse_file_copy_blocks(struct sparse_file *in_s, struct sparse_file *out_s,
+		unsigned int block, unsigned int count)
+{
+	struct backed_block *bb;
+	unsigned int bs = in_s->block_size;
+	unsigned int bb_block;
+	unsigned int bb_end;
+	unsigned int start;
+	unsigned int end;
+	unsigned int len;
+	int64_t skip;
+	int ret = 0;
+
+	if (out_s->block_size != bs) {
+		return -EINVAL;
+	}
+
+	for (bb = backed_block_iter_new(in_s->backed_block_list); bb;
+			bb = backed_block_iter_next(bb)) {
+		bb_block = backed_block_block(bb);
+		bb_end = bb_block + DIV_ROUND_UP(backed_block_len(bb), bs);
+		if (bb_end <= block) {
+			continue;
+		}
+		if (bb_block >= block + count) {
+			break;
+		}
+
+		start = max(block, bb_block);
+		end = min(block + count, bb_end);
+		skip = (int64_t)(start - bb_block) * bs;
+		if (end == bb_end) {
+			len = backed_block_len(bb) - skip;
+		} else {
+			len = (end - start) * bs;
+		}
+
+		switch (backed_block_type(bb)) {
+		case BACKED_BLOCK_DATA:
+			ret = backed_block_add_data(out_s->backed_block_list,
+					(char *)backed_block_data(bb) + skip, len, start);
+			break;
+		case BACKED_BLOCK_FILE:
+			ret = backed_block_add_file(out_s->backed_block_list,
+					backed_block_filename(bb),
+					backed_block_file_offset(bb) + skip, len, start);
+			break;
+		case BACKED_BLOCK_FD:
+			ret = backed_block_add_fd(out_s->backed_block_list,
+					backed_block_fd(bb),
+					backed_block_file_offset(bb) + skip, len, start);
+			break;
+		case BACKED_BLOCK_FILL:
+			ret = backed_block_add_fill(out_s->backed_block_list,
+					backed_block_fill_val(bb), len, start);
+			break;
+		}
+		if (ret) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 void sparse_file_verbose(struct sparse_file *s)
 {
 	s->verbose = true;
@@ -43,7 +43,13 @@
  */
 
 /* Code taken from FreeBSD 8 */
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
 #include <stdint.h>
+#include <string.h>
+
+#include "sparse_crc32.h"
 
 static uint32_t crc32_tab[] = {
         0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -92,20 +98,278 @@ static uint32_t crc32_tab[] = {
 };
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * The byte at a time loop above, extended to eight bytes at a time:
+ * crc32_tab8[k][n] is the CRC of byte n followed by k zero bytes, so the
+ * eight lookups for a little-endian 64-bit word can be done independently
+ * and xored together.  The tables are generated on first use.
+ */
+static uint32_t crc32_tab8[8][256];
+
+/* x2n_tab[k] is x^(2^k) modulo the polynomial, for sparse_crc32_combine */
+static uint32_t x2n_tab[32];
+
+#define CRC32_POLY 0xedb88320U
+
+/* a * b modulo the polynomial, both in the reflected representation */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+	}
+	return p;
+}
+
+/* x^(n * 2^k) modulo the polynomial */
+static uint32_t x2nmodp(uint64_t n, unsigned k)
+{
+	uint32_t p = 1U << 31;	/* x^0 == 1 */
+
+	while (n) {
+		if (n & 1)
+			p = multmodp(x2n_tab[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void (*crc32_accel)(uint32_t *crc, const uint8_t **p, size_t *size);
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CRC32_TARGET __attribute__((target("pclmul,sse4.1")))
+
+/*
+ * Folds the data 64 bytes at a time with carry-less multiplies, then
+ * reduces to 32 bits, as in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction".  The constants are powers of x
+ * modulo the bit-reflected polynomial.  Takes at least 64 bytes and leaves
+ * up to 15 for the table loop.
  */
+CRC32_TARGET static void crc32_pclmul(uint32_t *crc, const uint8_t **p, size_t *size)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = {
+		0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = {
+		0x01751997d0, 0x00ccaa009e };
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = {
+		0x0163cd6124, 0x0000000000 };
+	static const uint64_t __attribute__((aligned(16))) poly[] = {
+		0x01db710641, 0x01f7011641 };
+	const uint8_t *buf = *p;
+	size_t len = *size;
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	if (len < 64)
+		return;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(*crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* Four folds of 128 bits in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				_mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				_mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				_mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				_mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold the four into one, then fold in what is left 16 bytes at a time */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* 128 bits to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
 
-uint32_t sparse_crc32(uint32_t crc_in, const void *buf, int size)
+	*crc = _mm_extract_epi32(x1, 1);
+	*p = buf;
+	*size = len;
+}
+
+static void crc32_accel_init(void)
 {
-        const uint8_t *p = buf;
-        uint32_t crc;
+	unsigned int eax, ebx, ecx, edx;
 
-        crc = crc_in ^ ~0U;
-        while (size--)
-                crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-        return crc ^ ~0U;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+			(ecx & bit_PCLMUL) && (ecx & bit_SSE4_1))
+		crc32_accel = crc32_pclmul;
 }
 
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+/*
+ * The ARMv8 CRC32 instructions are optional before ARMv8.1, but a build
+ * that targets them (-march=armv8-a+crc) may use them unconditionally.
+ */
+static void crc32_armv8(uint32_t *crc, const uint8_t **p, size_t *size)
+{
+	const uint8_t *buf = *p;
+	size_t len = *size;
+	uint32_t c = *crc;
+	uint64_t v;
+
+	while (len >= 8) {
+		memcpy(&v, buf, sizeof(v));
+		c = __crc32d(c, v);
+		buf += 8;
+		len -= 8;
+	}
+	*crc = c;
+	*p = buf;
+	*size = len;
+}
+
+static void crc32_accel_init(void)
+{
+	crc32_accel = crc32_armv8;
+}
+
+#else
+
+static void crc32_accel_init(void)
+{
+}
+
+#endif
+
+static void crc32_init_tables(void)
+{
+	unsigned int n, k;
+
+	for (n = 0; n < 256; n++)
+		crc32_tab8[0][n] = crc32_tab[n];
+	for (k = 1; k < 8; k++)
+		for (n = 0; n < 256; n++)
+			crc32_tab8[k][n] = (crc32_tab8[k - 1][n] >> 8) ^
+				crc32_tab[crc32_tab8[k - 1][n] & 0xFF];
+
+	x2n_tab[0] = 1U << 30;	/* x^1 */
+	for (k = 1; k < 32; k++)
+		x2n_tab[k] = multmodp(x2n_tab[k - 1], x2n_tab[k - 1]);
+
+	crc32_accel_init();
+}
+
+#ifdef USE_MINGW
+static int crc32_initialized;
+
+static void crc32_init(void)
+{
+	/* No threads in the Windows tools to race with */
+	if (!crc32_initialized) {
+		crc32_init_tables();
+		crc32_initialized = 1;
+	}
+}
+#else
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+	pthread_once(&crc32_once, crc32_init_tables);
+}
+#endif
+
+uint32_t sparse_crc32(uint32_t crc_in, const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint32_t crc;
+
+	crc32_init();
+
+	crc = crc_in ^ ~0U;
+	if (crc32_accel)
+		crc32_accel(&crc, &p, &size);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (size >= 8) {
+		uint32_t lo, hi;
+
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, p + 4, sizeof(hi));
+		lo ^= crc;
+		crc = crc32_tab8[7][lo & 0xFF] ^
+			crc32_tab8[6][(lo >> 8) & 0xFF] ^
+			crc32_tab8[5][(lo >> 16) & 0xFF] ^
+			crc32_tab8[4][lo >> 24] ^
+			crc32_tab8[3][hi & 0xFF] ^
+			crc32_tab8[2][(hi >> 8) & 0xFF] ^
+			crc32_tab8[1][(hi >> 16) & 0xFF] ^
+			crc32_tab8[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+#endif
+	while (size--)
+		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ ~0U;
+}
+
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t len2)
+{
+	crc32_init();
+
+	return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
@@ -18,3 +18,9 @@
 
 uint32_t sparse_crc32(uint32_t crc, const void *buf, size_t size);
 
+/*
+ * The sparse_crc32 of A followed by B, given crc1 of A and crc2 of the
+ * len2 bytes of B, without the data.
+ */
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t len2);
+
@@ -18,6 +18,7 @@
 #define _FILE_OFFSET_BITS 64
 #define _LARGEFILE64_SOURCE 1
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -27,6 +28,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <cutils/memory.h>
 #include <sparse/sparse.h>
 
 #include "defs.h"
@@ -49,6 +51,8 @@ static char *copybuf;
 
 #define min(a, b) \
 	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
+#define max(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a > _b) ? _a : _b; })
 
 static void verbose_error(bool verbose, int err, const char *fmt, ...)
 {
@@ -142,8 +146,6 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 	int chunk;
 	int64_t len = (int64_t)blocks * s->block_size;
 	uint32_t fill_val;
-	uint32_t *fillbuf;
-	unsigned int i;
 
 	if (chunk_size != sizeof(fill_val)) {
 		return -EINVAL;
@@ -161,10 +163,7 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 
 	if (crc32) {
 		/* Fill copy_buf with the fill value */
-		fillbuf = (uint32_t *)copybuf;
-		for (i = 0; i < (COPY_BUF_SIZE / sizeof(fill_val)); i++) {
-			fillbuf[i] = fill_val;
-		}
+		android_memset32((uint32_t *)copybuf, fill_val, min(len, COPY_BUF_SIZE));
 
 		while (len) {
 			chunk = min(len, COPY_BUF_SIZE);
@@ -353,56 +352,194 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 	return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file *s, int fd)
+/*
+ * Raw images are read this much at a time.  Runs of blocks of the same
+ * kind are added as one backed block of up to MAX_RUN_LEN bytes, rather
+ * than one block at a time for queue_bb to merge.
+ */
+#define READ_BUF_SIZE (4U * 1024U * 1024U)
+#define MAX_RUN_LEN (1024U * 1024U * 1024U)
+
+enum run_type {
+	RUN_NONE,
+	RUN_DATA,
+	RUN_FILL,
+};
+
+struct block_run {
+	enum run_type type;
+	uint32_t fill_val;
+	unsigned int block;
+	int64_t offset;
+	unsigned int len;
+	unsigned int max_len;
+};
+
+static int run_flush(struct sparse_file *s, int fd, struct block_run *run)
+{
+	int ret = 0;
+
+	if (run->type == RUN_DATA) {
+		ret = sparse_file_add_fd(s, fd, run->offset, run->len, run->block);
+	} else if (run->type == RUN_FILL) {
+		/* TODO: add flag to use skip instead of fill for fill_val == 0 */
+		ret = sparse_file_add_fill(s, run->fill_val, run->len, run->block);
+	}
+	run->type = RUN_NONE;
+	return ret;
+}
+
+/* Adds the len bytes at offset, the next ones after those in run, to it */
+static int run_add(struct sparse_file *s, int fd, struct block_run *run,
+		enum run_type type, uint32_t fill_val, int64_t offset, unsigned int len)
 {
 	int ret;
-	uint32_t *buf = malloc(s->block_size);
-	unsigned int block = 0;
-	int64_t remain = s->len;
+
+	if (run->type == type && (type == RUN_DATA || run->fill_val == fill_val) &&
+			run->len <= run->max_len - len) {
+		run->len += len;
+		return 0;
+	}
+
+	ret = run_flush(s, fd, run);
+	if (ret < 0) {
+		return ret;
+	}
+	run->type = type;
+	run->fill_val = fill_val;
+	run->block = offset / s->block_size;
+	run->offset = offset;
+	run->len = len;
+	return 0;
+}
+
+/*
+ * A block is a fill block if every 32-bit word in it is the same, which
+ * is to say if it equals itself shifted by one word.  libc's memcmp is
+ * vectorized for the CPU, and stops at the first difference.
+ */
+static bool is_fill_block(const uint8_t *block, unsigned int block_size,
+		uint32_t *fill_val)
+{
+	if (memcmp(block, block + sizeof(uint32_t), block_size - sizeof(uint32_t))) {
+		return false;
+	}
+	memcpy(fill_val, block, sizeof(uint32_t));
+	return true;
+}
+
+/*
+ * Finds the first extent of data at or after offset, [*start, *end),
+ * clamped to len, in a file that may have holes.  Returns false if the
+ * file system can't say where the holes are.
+ */
+static bool find_data(int fd, int64_t offset, int64_t len, int64_t *start,
+		int64_t *end)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	int64_t data;
+	int64_t hole;
+
+	data = lseek64(fd, offset, SEEK_DATA);
+	if (data < 0) {
+		if (errno != ENXIO) {
+			return false;
+		}
+		/* Nothing but hole up to the end of the file */
+		*start = *end = len;
+		return true;
+	}
+	hole = lseek64(fd, data, SEEK_HOLE);
+	if (hole < 0) {
+		return false;
+	}
+	*start = min(data, len);
+	*end = min(hole, len);
+	return true;
+#else
+	return false;
+#endif
+}
+
+static int sparse_file_read_normal(struct sparse_file *s, int fd)
+{
+	int ret = 0;
+	unsigned int buf_size = max(READ_BUF_SIZE / s->block_size, 1U) * s->block_size;
+	uint8_t *buf = malloc(buf_size);
+	struct block_run run = {
+		.type = RUN_NONE,
+		.max_len = MAX_RUN_LEN / s->block_size * s->block_size,
+	};
 	int64_t offset = 0;
+	int64_t data_start;
+	int64_t data_end = 0;
+	bool holes = true;
 	unsigned int to_read;
+	unsigned int len;
 	unsigned int i;
-	bool sparse_block;
+	uint32_t fill_val;
 
 	if (!buf) {
 		return -ENOMEM;
 	}
 
-	while (remain > 0) {
-		to_read = min(remain, s->block_size);
-		ret = read_all(fd, buf, to_read);
-		if (ret < 0) {
-			error("failed to read sparse file");
-			free(buf);
-			return ret;
-		}
-
-		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
+	while (offset < s->len) {
+		if (holes && offset >= data_end) {
+			if (!find_data(fd, offset, s->len, &data_start, &data_end)) {
+				holes = false;
+			} else {
+				/* The whole blocks of a hole read as zeros, so skip them */
+				while (data_start - offset >= s->block_size) {
+					len = min(data_start - offset, (int64_t)run.max_len);
+					len -= len % s->block_size;
+					ret = run_add(s, fd, &run, RUN_FILL, 0, offset, len);
+					if (ret < 0) {
+						goto out;
+					}
+					offset += len;
+				}
+				if (offset >= s->len) {
 					break;
 				}
 			}
-		} else {
-			sparse_block = false;
+			if (lseek64(fd, offset, SEEK_SET) < 0) {
+				ret = -errno;
+				error_errno("failed to seek sparse file");
+				goto out;
+			}
 		}
 
-		if (sparse_block) {
-			/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-			sparse_file_add_fill(s, buf[0], to_read, block);
-		} else {
-			sparse_file_add_fd(s, fd, offset, to_read, block);
+		to_read = min(s->len - offset, (int64_t)buf_size);
+		if (holes) {
+			/* Up to the next hole, rounded up to a whole block */
+			len = min(data_end - offset + s->block_size - 1, (int64_t)buf_size);
+			to_read = min(to_read, len - len % s->block_size);
+		}
+		ret = read_all(fd, buf, to_read);
+		if (ret < 0) {
+			error("failed to read sparse file");
+			goto out;
 		}
 
-		remain -= to_read;
+		for (i = 0; i < to_read; i += len) {
+			len = min(to_read - i, s->block_size);
+			if (len == s->block_size && is_fill_block(buf + i, len, &fill_val)) {
+				ret = run_add(s, fd, &run, RUN_FILL, fill_val, offset + i, len);
+			} else {
+				ret = run_add(s, fd, &run, RUN_DATA, 0, offset + i, len);
+			}
+			if (ret < 0) {
+				goto out;
+			}
+		}
 		offset += to_read;
-		block++;
 	}
 
+	ret = run_flush(s, fd, &run);
+
+out:
 	free(buf);
-	return 0;
+	return ret;
 }
 
 int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc)
@@ -23,23 +23,78 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LOG_TAG "libsuspend"
 //#define LOG_NDEBUG 0
 #include <cutils/log.h>
 
+#include <suspend/autosuspend.h>
+
 #include "autosuspend_ops.h"
 
 #define SYS_POWER_STATE "/sys/power/state"
 #define SYS_POWER_WAKEUP_COUNT "/sys/power/wakeup_count"
 
+/*
+ * Time to wait before the next attempt: BASE_SLEEP_TIME after a suspend,
+ * doubled for each attempt in a row that failed, up to MAX_SLEEP_TIME.
+ * There is no need to wait for the wakeup sources to be released: the read
+ * of wakeup_count blocks until none is active.
+ */
+#define BASE_SLEEP_TIME 100000
+#define MAX_SLEEP_TIME 60000000
+
 static int state_fd;
 static int wakeup_count_fd;
 static pthread_t suspend_thread;
 static sem_t suspend_lockout;
 static const char *sleep_state = "mem";
 static void (*wakeup_func)(bool success) = NULL;
+static useconds_t sleep_time = BASE_SLEEP_TIME;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct autosuspend_stats stats;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void update_sleep_time(bool success)
+{
+    if (success) {
+        sleep_time = BASE_SLEEP_TIME;
+    } else if (sleep_time < MAX_SLEEP_TIME / 2) {
+        sleep_time *= 2;
+    } else {
+        sleep_time = MAX_SLEEP_TIME;
+    }
+}
+
+/* attempt_us is how long the write of the sleep state took, suspended time
+ * excluded; entered is false if the state was not written at all. */
+static void update_stats(bool success, bool entered, uint64_t attempt_us)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats.attempts++;
+    if (success) {
+        stats.successes++;
+    } else if (entered) {
+        stats.aborted++;
+    } else {
+        stats.wakeup_count_changed++;
+    }
+    stats.total_attempt_time_us += attempt_us;
+    if (attempt_us > stats.max_attempt_time_us) {
+        stats.max_attempt_time_us = attempt_us;
+    }
+    stats.sleep_time_us = sleep_time;
+    pthread_mutex_unlock(&stats_lock);
+}
 
 static void *suspend_thread_func(void *arg __attribute__((unused)))
 {
@@ -48,9 +103,12 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
     int wakeup_count_len;
     int ret;
     bool success;
+    bool entered;
+    uint64_t start;
+    uint64_t attempt_us;
 
     while (1) {
-        usleep(100000);
+        usleep(sleep_time);
         ALOGV("%s: read wakeup_count\n", __func__);
         lseek(wakeup_count_fd, 0, SEEK_SET);
         wakeup_count_len = TEMP_FAILURE_RETRY(read(wakeup_count_fd, wakeup_count,
@@ -75,14 +133,20 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
         }
 
         success = true;
+        entered = false;
+        attempt_us = 0;
         ALOGV("%s: write %*s to wakeup_count\n", __func__, wakeup_count_len, wakeup_count);
         ret = TEMP_FAILURE_RETRY(write(wakeup_count_fd, wakeup_count, wakeup_count_len));
         if (ret < 0) {
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error writing to %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
+            success = false;
         } else {
             ALOGV("%s: write %s to %s\n", __func__, sleep_state, SYS_POWER_STATE);
+            entered = true;
+            start = now_us();
             ret = TEMP_FAILURE_RETRY(write(state_fd, sleep_state, strlen(sleep_state)));
+            attempt_us = now_us() - start;
             if (ret < 0) {
                 success = false;
             }
@@ -91,6 +155,8 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
                 (*func)(success);
             }
         }
+        update_sleep_time(success);
+        update_stats(success, entered, attempt_us);
 
         ALOGV("%s: release sem\n", __func__);
         ret = sem_post(&suspend_lockout);
@@ -140,6 +206,15 @@ static int autosuspend_wakeup_count_disable(void)
     return ret;
 }
 
+static int autosuspend_wakeup_count_get_stats(struct autosuspend_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
 void set_wakeup_callback(void (*func)(bool success))
 {
     if (wakeup_func != NULL) {
@@ -152,6 +227,7 @@ void set_wakeup_callback(void (*func)(bool success))
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
         .enable = autosuspend_wakeup_count_enable,
         .disable = autosuspend_wakeup_count_disable,
+        .get_stats = autosuspend_wakeup_count_get_stats,
 };
 
 struct autosuspend_ops *autosuspend_wakeup_count_init(void)
@@ -186,6 +262,7 @@ struct autosuspend_ops *autosuspend_wakeup_count_init(void)
         goto err_pthread_create;
     }
 
+    stats.sleep_time_us = sleep_time;
     ALOGI("Selected wakeup count\n");
     return &autosuspend_wakeup_count_ops;
 
@@ -19,6 +19,7 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -53,6 +54,26 @@ int autosuspend_disable(void);
  */
 void set_wakeup_callback(void (*func)(bool success));
 
+struct autosuspend_stats {
+    uint64_t attempts;              /* times the suspend was tried */
+    uint64_t successes;             /* of which the device suspended */
+    uint64_t aborted;               /* the suspend was aborted */
+    uint64_t wakeup_count_changed;  /* a wakeup event came in first */
+    uint64_t total_attempt_time_us; /* spent entering and leaving suspend */
+    uint64_t max_attempt_time_us;
+    uint64_t sleep_time_us;         /* current wait between two attempts */
+};
+
+/*
+ * autosuspend_get_stats
+ *
+ * Fill in stats with the suspend attempts made so far.  The wait between
+ * two attempts is backed off while they keep failing.
+ *
+ * Returns 0 on success, -1 if autosuspend is not done by libsuspend.
+ */
+int autosuspend_get_stats(struct autosuspend_stats *stats);
+
 __END_DECLS
 
 #endif
@@ -20,6 +20,7 @@
 #define __SYS_CORE_SYNC_H
 
 #include <sys/cdefs.h>
+#include <stddef.h>
 #include <stdint.h>
 
 __BEGIN_DECLS
@@ -45,8 +46,23 @@ struct __attribute__((__may_alias__)) sync_pt_info {
 
 /* timeout in msecs */
 int sync_wait(int fd, int timeout);
+
+/* Waits on the count fences in fds at once, without merging them into a new
+ * fence: for any of them to signal with SYNC_WAIT_ANY, which returns the index
+ * of one that did, or for all of them with SYNC_WAIT_ALL, which returns 0.
+ * Fails with ETIME on timeout (in msecs, -1 for none), and with the error of
+ * a fence that signaled an error.
+ */
+#define SYNC_WAIT_ANY 0
+#define SYNC_WAIT_ALL 1
+int sync_wait_many(const int *fds, size_t count, int timeout, int mode);
+
 int sync_merge(const char *name, int fd1, int fd2);
 struct sync_fence_info_data *sync_fence_info(int fd);
+/* As sync_fence_info(), into the len bytes at info instead of a new buffer.
+ * Returns 0, or -1 with errno ENOMEM if len is too small for all the points.
+ */
+int sync_fence_info_into(int fd, struct sync_fence_info_data *info, size_t len);
 struct sync_pt_info *sync_pt_info(struct sync_fence_info_data *info,
                                   struct sync_pt_info *itr);
 void sync_fence_info_free(struct sync_fence_info_data *info);
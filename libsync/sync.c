@@ -16,10 +16,13 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <poll.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include <linux/sync.h>
 #include <linux/sw_sync.h>
@@ -35,6 +38,118 @@ int sync_wait(int fd, int timeout)
     return ioctl(fd, SYNC_IOC_WAIT, &to);
 }
 
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* From <sync/sync.h>, whose structs clash with <linux/sync.h>. */
+#define SYNC_WAIT_ALL 1
+
+/* Enough for the fences of a frame without going to the heap. */
+#define WAIT_MANY_STACK_FDS 16
+
+int sync_wait_many(const int *fds, size_t count, int timeout, int mode)
+{
+    struct pollfd stack_pfds[WAIT_MANY_STACK_FDS];
+    struct pollfd *pfds = stack_pfds;
+    size_t *index;
+    size_t stack_index[WAIT_MANY_STACK_FDS];
+    size_t pending = count;
+    int64_t deadline = timeout < 0 ? -1 : now_ms() + timeout;
+    int ret = -1;
+    size_t i;
+
+    if (count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    index = stack_index;
+    if (count > WAIT_MANY_STACK_FDS) {
+        pfds = malloc(count * sizeof(*pfds));
+        index = malloc(count * sizeof(*index));
+        if (pfds == NULL || index == NULL) {
+            free(pfds);
+            free(index);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        index[i] = i;
+    }
+
+    for (;;) {
+        int wait = -1;
+        int n;
+
+        if (deadline >= 0) {
+            int64_t left = deadline - now_ms();
+            wait = left > 0 ? (int)left : 0;
+        }
+
+        n = poll(pfds, pending, wait);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0) {
+            errno = ETIME;
+            break;
+        }
+
+        /* Drop the signaled fences, keeping the others packed at the front. */
+        for (i = 0; i < pending; ) {
+            short revents = pfds[i].revents;
+
+            if (revents & POLLNVAL) {
+                errno = EBADF;
+                goto done;
+            }
+            if (revents & POLLERR) {
+                /* for the error the fence signaled */
+                ret = sync_wait(pfds[i].fd, 0);
+                if (ret == 0) {
+                    errno = EINVAL;
+                    ret = -1;
+                }
+                goto done;
+            }
+            if (revents & POLLIN) {
+                if (mode != SYNC_WAIT_ALL) {
+                    ret = index[i];
+                    goto done;
+                }
+                pending--;
+                pfds[i] = pfds[pending];
+                index[i] = index[pending];
+                continue;
+            }
+            i++;
+        }
+
+        if (pending == 0) {
+            ret = 0;
+            break;
+        }
+    }
+
+done:
+    if (pfds != stack_pfds) {
+        free(pfds);
+        free(index);
+    }
+    return ret;
+}
+
 int sync_merge(const char *name, int fd1, int fd2)
 {
     struct sync_merge_data data;
@@ -50,6 +165,17 @@ int sync_merge(const char *name, int fd1, int fd2)
     return data.fence;
 }
 
+int sync_fence_info_into(int fd, struct sync_fence_info_data *info, size_t len)
+{
+    if (len < sizeof(*info) || len > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    info->len = len;
+    return ioctl(fd, SYNC_IOC_FENCE_INFO, info);
+}
+
 struct sync_fence_info_data *sync_fence_info(int fd)
 {
     struct sync_fence_info_data *info;
@@ -59,8 +185,7 @@ struct sync_fence_info_data *sync_fence_info(int fd)
     if (info == NULL)
         return NULL;
 
-    info->len = 4096;
-    err = ioctl(fd, SYNC_IOC_FENCE_INFO, info);
+    err = sync_fence_info_into(fd, info, 4096);
     if (err < 0) {
         free(info);
         return NULL;
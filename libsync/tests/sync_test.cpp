@@ -438,6 +438,77 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, WaitManyAny) {
+    SyncTimeline timelineA, timelineB, timelineC;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    SyncFence fenceC(timelineC, 5);
+    int fds[] = { fenceA.getFd(), fenceB.getFd(), fenceC.getFd() };
+
+    ASSERT_EQ(sync_wait_many(fds, 3, 0, SYNC_WAIT_ANY), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineB.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 3, 100, SYNC_WAIT_ANY), 1);
+}
+
+TEST(FenceTest, WaitManyAll) {
+    vector<SyncTimeline> timelines(40);
+    vector<SyncFence> fences;
+    vector<int> fds;
+
+    for (auto &timeline : timelines) {
+        fences.push_back(SyncFence(timeline, 1));
+        ASSERT_TRUE(fences.back().isValid());
+    }
+    for (auto &fence : fences) {
+        fds.push_back(fence.getFd());
+    }
+
+    // All but the last signaled isn't enough.
+    for (size_t i = 0; i + 1 < timelines.size(); i++) {
+        timelines[i].inc(1);
+    }
+    ASSERT_EQ(sync_wait_many(fds.data(), fds.size(), 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    thread signaler([&timelines]{
+        usleep(10000);
+        timelines.back().inc(1);
+    });
+    ASSERT_EQ(sync_wait_many(fds.data(), fds.size(), -1, SYNC_WAIT_ALL), 0);
+    signaler.join();
+}
+
+TEST(FenceTest, InfoInto) {
+    SyncTimeline timelineA, timelineB;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    SyncFence merged(fenceA, fenceB);
+    ASSERT_TRUE(merged.isValid());
+
+    timelineA.inc(5);
+
+    uint8_t buf[1024];
+    struct sync_fence_info_data *info = reinterpret_cast<sync_fence_info_data *>(buf);
+    ASSERT_EQ(sync_fence_info_into(merged.getFd(), info, sizeof(buf)), 0);
+
+    int signaled = 0, active = 0;
+    struct sync_pt_info *pointInfo = nullptr;
+    while ((pointInfo = sync_pt_info(info, pointInfo))) {
+        signaled += pointInfo->status == 1;
+        active += pointInfo->status == 0;
+    }
+    ASSERT_EQ(signaled, 1);
+    ASSERT_EQ(active, 1);
+
+    // Too small for the points.
+    ASSERT_EQ(sync_fence_info_into(merged.getFd(), info, sizeof(*info) + 1), -1);
+    ASSERT_EQ(errno, ENOMEM);
+}
+
 TEST(StressTest, TwoThreadsSharedTimeline) {
     const int iterations = 1 << 16;
     int counter = 0;
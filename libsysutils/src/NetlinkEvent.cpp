@@ -13,6 +13,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -50,12 +51,16 @@ const int LOCAL_NFLOG_PACKET = NFNL_SUBSYS_ULOG << 8 | NFULNL_MSG_PACKET;
 NetlinkEvent::NetlinkEvent() {
     mAction = Action::kUnknown;
     memset(mParams, 0, sizeof(mParams));
+    memset(mParamNameLen, 0, sizeof(mParamNameLen));
     mPath = NULL;
     mSubsystem = NULL;
+    mOwnsStrings = true;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (!mOwnsStrings)
+        return;
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -595,6 +600,10 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
     /* Ensure the buffer is zero-terminated, the code below depends on this */
     buffer[size-1] = '\0';
 
+    /* Every field is NUL-terminated in place, so point at them rather
+     * than copying them. */
+    mOwnsStrings = false;
+
     end = s + size;
     while (s < end) {
         if (first) {
@@ -605,7 +614,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = buffer + (p + 1 - buffer);
             first = 0;
         } else {
             const char* a;
@@ -619,9 +628,13 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
             } else if ((a = HAS_CONST_PREFIX(s, end, "SEQNUM=")) != NULL) {
                 mSeq = atoi(a);
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != NULL) {
-                mSubsystem = strdup(a);
+                mSubsystem = buffer + (a - buffer);
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                const char *eq = strchr(s, '=');
+                mParams[param_idx] = buffer + (s - buffer);
+                if (eq && eq - s <= USHRT_MAX)
+                    mParamNameLen[param_idx] = eq - s;
+                param_idx++;
             }
         }
         s += strlen(s) + 1;
@@ -641,6 +654,12 @@ bool NetlinkEvent::decode(char *buffer, int size, int format) {
 const char *NetlinkEvent::findParam(const char *paramName) {
     size_t len = strlen(paramName);
     for (int i = 0; i < NL_PARAMS_MAX && mParams[i] != NULL; ++i) {
+        if (mParamNameLen[i]) {
+            /* Indexed when parsed: compare lengths before any bytes */
+            if (mParamNameLen[i] == len && !memcmp(mParams[i], paramName, len))
+                return mParams[i] + len + 1;
+            continue;
+        }
         const char *ptr = mParams[i] + len;
         if (!strncmp(mParams[i], paramName, len) && *ptr == '=')
             return ++ptr;
@@ -47,6 +47,10 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
     ssize_t count;
     uid_t uid = -1;
 
+    if (mFormat == NETLINK_FORMAT_ASCII) {
+        return receiveUevents(socket);
+    }
+
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
@@ -61,15 +65,48 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
+    dispatchEvent(mBuffer, count);
+    return true;
+}
+
+/*
+ * Uevents are small and come in bursts on hotplug, so mBuffer is split into
+ * slots and as many as are queued are taken with one recvmmsg().
+ */
+bool NetlinkListener::receiveUevents(int socket)
+{
+    const size_t slotSize = sizeof(mBuffer) / UEVENT_RECV_BATCH_MAX;
+    ssize_t lengths[UEVENT_RECV_BATCH_MAX];
+    uid_t uids[UEVENT_RECV_BATCH_MAX];
+    int count;
+
+    count = TEMP_FAILURE_RETRY(uevent_kernel_recv_batch(socket, mBuffer, slotSize,
+            UEVENT_RECV_BATCH_MAX, true, lengths, uids));
+    if (count < 0) {
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] < 0) {
+            if (uids[i] > 0)
+                LOG_EVENT_INT(65537, uids[i]);
+            SLOGE("Dropped a uevent that was not from the kernel or was truncated");
+            continue;
+        }
+        dispatchEvent(mBuffer + i * slotSize, lengths[i]);
+    }
+    return true;
+}
+
+void NetlinkListener::dispatchEvent(char *buffer, ssize_t count)
+{
+    NetlinkEvent evt;
+    if (evt.decode(buffer, count, mFormat)) {
+        onEvent(&evt);
     } else if (mFormat != NETLINK_FORMAT_BINARY) {
         // Don't complain if parseBinaryNetlinkMessage returns false. That can
         // just mean that the buffer contained no messages we're interested in.
         SLOGE("Error decoding NetlinkEvent");
     }
-
-    delete evt;
-    return true;
 }
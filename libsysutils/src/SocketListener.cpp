@@ -16,8 +16,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -32,6 +33,8 @@
 #define CtrlPipe_Shutdown 0
 #define CtrlPipe_Wakeup   1
 
+#define MAX_EPOLL_EVENTS  32
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -51,6 +54,14 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mUseCmdNum = useCmdNum;
     pthread_mutex_init(&mClientsLock, NULL);
     mClients = new SocketClientCollection();
+    mCtrlPipe[0] = -1;
+    mCtrlPipe[1] = -1;
+    mEpollFd = -1;
+    mWorkerCount = 0;
+    mWorkers = NULL;
+    mWorkersExiting = false;
+    pthread_mutex_init(&mWorkLock, NULL);
+    pthread_cond_init(&mWorkCond, NULL);
 }
 
 SocketListener::~SocketListener() {
@@ -61,6 +72,10 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1) {
+        close(mEpollFd);
+    }
+    delete[] mWorkers;
     SocketClientCollection::iterator it;
     for (it = mClients->begin(); it != mClients->end();) {
         (*it)->decRef();
@@ -74,6 +89,10 @@ int SocketListener::startListener() {
 }
 
 int SocketListener::startListener(int backlog) {
+    return startListener(backlog, 0);
+}
+
+int SocketListener::startListener(int backlog, int workerThreads) {
 
     if (!mSocketName && mSock == -1) {
         SLOGE("Failed to start unbound listener");
@@ -100,6 +119,45 @@ int SocketListener::startListener(int backlog) {
         return -1;
     }
 
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = mCtrlPipe[0];
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtrlPipe[0], &ev) < 0) {
+        SLOGE("epoll_ctl failed (%s)", strerror(errno));
+        return -1;
+    }
+    if (mListen) {
+        ev.data.fd = mSock;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSock, &ev) < 0) {
+            SLOGE("epoll_ctl failed (%s)", strerror(errno));
+            return -1;
+        }
+    }
+    SocketClientCollection::iterator it;
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        if (!watchClient(*it, EPOLL_CTL_ADD)) {
+            return -1;
+        }
+    }
+
+    if (workerThreads > 0) {
+        mWorkers = new pthread_t[workerThreads];
+        for (mWorkerCount = 0; mWorkerCount < workerThreads; mWorkerCount++) {
+            if (pthread_create(&mWorkers[mWorkerCount], NULL,
+                               SocketListener::workerStart, this)) {
+                SLOGE("pthread_create (%s)", strerror(errno));
+                break;
+            }
+        }
+    }
+
     if (pthread_create(&mThread, NULL, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -127,6 +185,8 @@ int SocketListener::stopListener() {
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
     mCtrlPipe[1] = -1;
+    close(mEpollFd);
+    mEpollFd = -1;
 
     if (mSocketName && mSock > -1) {
         close(mSock);
@@ -152,53 +212,79 @@ void *SocketListener::threadStart(void *obj) {
 void SocketListener::runListener() {
 
     SocketClientCollection pendingList;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int readyFds[MAX_EPOLL_EVENTS];
 
     while(1) {
         SocketClientCollection::iterator it;
-        fd_set read_fds;
-        int rc = 0;
-        int max = -1;
+        bool pendingAccept = false;
+        int nready = 0;
+        int rc;
 
-        FD_ZERO(&read_fds);
-
-        if (mListen) {
-            max = mSock;
-            FD_SET(mSock, &read_fds);
+        if ((rc = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
+            sleep(1);
+            continue;
         }
 
-        FD_SET(mCtrlPipe[0], &read_fds);
-        if (mCtrlPipe[0] > max)
-            max = mCtrlPipe[0];
+        for (int i = 0; i < rc; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0]) {
+                char c = CtrlPipe_Shutdown;
+                TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
+                if (c == CtrlPipe_Shutdown) {
+                    stopWorkers();
+                    return;
+                }
+            } else if (mListen && fd == mSock) {
+                pendingAccept = true;
+            } else {
+                readyFds[nready++] = fd;
+            }
+        }
 
+        /* Add all active clients to the pending list first. A client
+         * released since epoll_wait() returned is no longer in mClients. */
+        pendingList.clear();
         pthread_mutex_lock(&mClientsLock);
         for (it = mClients->begin(); it != mClients->end(); ++it) {
+            SocketClient* c = *it;
             // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = (*it)->getSocket();
-            FD_SET(fd, &read_fds);
-            if (fd > max) {
-                max = fd;
+            int fd = c->getSocket();
+            for (int i = 0; i < nready; i++) {
+                if (readyFds[i] == fd) {
+                    pendingList.push_back(c);
+                    c->incRef();
+                    break;
+                }
             }
         }
         pthread_mutex_unlock(&mClientsLock);
-        SLOGV("mListen=%d, max=%d, mSocketName=%s", mListen, max, mSocketName);
-        if ((rc = select(max + 1, &read_fds, NULL, NULL, NULL)) < 0) {
-            if (errno == EINTR)
-                continue;
-            SLOGE("select failed (%s) mListen=%d, max=%d", strerror(errno), mListen, max);
-            sleep(1);
-            continue;
-        } else if (!rc)
-            continue;
 
-        if (FD_ISSET(mCtrlPipe[0], &read_fds)) {
-            char c = CtrlPipe_Shutdown;
-            TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
-            if (c == CtrlPipe_Shutdown) {
-                break;
+        /* Process the pending list, since it is owned by the thread,
+         * there is no need to lock it */
+        while (!pendingList.empty()) {
+            /* Pop the first item from the list */
+            it = pendingList.begin();
+            SocketClient* c = *it;
+            pendingList.erase(it);
+            if (mWorkerCount > 0) {
+                /* The worker drops the reference */
+                pthread_mutex_lock(&mWorkLock);
+                mWorkQueue.push_back(c);
+                pthread_cond_signal(&mWorkCond);
+                pthread_mutex_unlock(&mWorkLock);
+            } else {
+                dispatch(c);
+                c->decRef();
             }
-            continue;
         }
-        if (mListen && FD_ISSET(mSock, &read_fds)) {
+
+        /* Accept only after the pending list is built, so that a new
+         * client can't be taken for one whose fd it reuses. */
+        if (pendingAccept) {
             struct sockaddr addr;
             socklen_t alen;
             int c;
@@ -214,39 +300,101 @@ void SocketListener::runListener() {
                 continue;
             }
             fcntl(c, F_SETFD, FD_CLOEXEC);
+            SocketClient* client = new SocketClient(c, true, mUseCmdNum);
             pthread_mutex_lock(&mClientsLock);
-            mClients->push_back(new SocketClient(c, true, mUseCmdNum));
+            if (watchClient(client, EPOLL_CTL_ADD)) {
+                mClients->push_back(client);
+            } else {
+                client->decRef();
+            }
             pthread_mutex_unlock(&mClientsLock);
         }
+    }
+}
 
-        /* Add all active clients to the pending list first */
-        pendingList.clear();
-        pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            SocketClient* c = *it;
-            // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = c->getSocket();
-            if (FD_ISSET(fd, &read_fds)) {
-                pendingList.push_back(c);
-                c->incRef();
-            }
+/*
+ * Clients are registered one-shot, so that no further events are reported
+ * for a client until dispatch() has finished with it and re-armed it, even
+ * when a worker thread is still running its command.
+ */
+bool SocketListener::watchClient(SocketClient *c, int op) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = c->getSocket();
+    if (epoll_ctl(mEpollFd, op, ev.data.fd, &ev) < 0) {
+        SLOGE("epoll_ctl failed for %d (%s)", ev.data.fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void SocketListener::dispatch(SocketClient *c) {
+    /* Process it, if false is returned, remove from list */
+    if (!onDataAvailable(c) && mListen) {
+        release(c, false);
+        return;
+    }
+
+    /* Re-arm it, unless it has been released meanwhile */
+    pthread_mutex_lock(&mClientsLock);
+    SocketClientCollection::iterator it;
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        if (*it == c) {
+            watchClient(c, EPOLL_CTL_MOD);
+            break;
         }
-        pthread_mutex_unlock(&mClientsLock);
+    }
+    pthread_mutex_unlock(&mClientsLock);
+}
 
-        /* Process the pending list, since it is owned by the thread,
-         * there is no need to lock it */
-        while (!pendingList.empty()) {
-            /* Pop the first item from the list */
-            it = pendingList.begin();
-            SocketClient* c = *it;
-            pendingList.erase(it);
-            /* Process it, if false is returned, remove from list */
-            if (!onDataAvailable(c)) {
-                release(c, false);
-            }
-            c->decRef();
+void *SocketListener::workerStart(void *obj) {
+    SocketListener *me = reinterpret_cast<SocketListener *>(obj);
+
+    me->runWorker();
+    return NULL;
+}
+
+void SocketListener::runWorker() {
+    pthread_mutex_lock(&mWorkLock);
+    while (1) {
+        while (mWorkQueue.empty() && !mWorkersExiting) {
+            pthread_cond_wait(&mWorkCond, &mWorkLock);
+        }
+        if (mWorkQueue.empty()) {
+            break;
         }
+        SocketClientCollection::iterator it = mWorkQueue.begin();
+        SocketClient* c = *it;
+        mWorkQueue.erase(it);
+        pthread_mutex_unlock(&mWorkLock);
+
+        dispatch(c);
+        c->decRef();
+
+        pthread_mutex_lock(&mWorkLock);
+    }
+    pthread_mutex_unlock(&mWorkLock);
+}
+
+/* Lets the workers finish what is queued, then joins them. */
+void SocketListener::stopWorkers() {
+    if (!mWorkerCount) {
+        return;
+    }
+
+    pthread_mutex_lock(&mWorkLock);
+    mWorkersExiting = true;
+    pthread_cond_broadcast(&mWorkCond);
+    pthread_mutex_unlock(&mWorkLock);
+
+    for (int i = 0; i < mWorkerCount; i++) {
+        pthread_join(mWorkers[i], NULL);
     }
+    delete[] mWorkers;
+    mWorkers = NULL;
+    mWorkerCount = 0;
+    mWorkersExiting = false;
 }
 
 bool SocketListener::release(SocketClient* c, bool wakeup) {
@@ -260,6 +408,8 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         for (it = mClients->begin(); it != mClients->end(); ++it) {
             if (*it == c) {
                 mClients->erase(it);
+                /* Before decRef() below can close the fd */
+                epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), NULL);
                 ret = true;
                 break;
             }
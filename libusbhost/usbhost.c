@@ -44,6 +44,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <poll.h>
 
 #include <linux/usbdevice_fs.h>
 #include <asm/byteorder.h>
@@ -81,6 +82,28 @@ struct usb_device {
     int desc_length;
     int fd;
     int writeable;
+
+    // Guards the fields below, which streams and usb_request_wait() share
+    // as they all reap the URBs of the device.
+    pthread_mutex_t lock;
+    struct usb_stream *streams;
+    // requests reaped by a stream, for usb_request_wait() to return
+    struct usb_request **reaped;
+    int reaped_count;
+    int reaped_capacity;
+};
+
+struct usb_stream {
+    struct usb_device *dev;
+    struct usb_stream *next;
+    usb_stream_cb cb;
+    void *client_data;
+    int in;
+    int stopping;
+    int in_flight;
+    int count;
+    struct usb_request **requests;
+    unsigned char *buffers;
 };
 
 static inline int badname(const char *name)
@@ -351,6 +374,8 @@ retry:
 void usb_device_close(struct usb_device *device)
 {
     close(device->fd);
+    pthread_mutex_destroy(&device->lock);
+    free(device->reaped);
     free(device);
 }
 
@@ -373,6 +398,7 @@ struct usb_device *usb_device_new(const char *dev_name, int fd)
     device->desc_length = length;
     // assume we are writeable, since usb_device_get_fd will only return writeable fds
     device->writeable = 1;
+    pthread_mutex_init(&device->lock, NULL);
     return device;
 
 failed:
@@ -676,11 +702,83 @@ int usb_request_queue(struct usb_request *req)
     return res;
 }
 
+static void usb_stream_complete(struct usb_stream *stream,
+        struct usb_request *req, int status);
+
+// Returns the stream of the device that req belongs to, or NULL if it is a
+// request of its own.
+static struct usb_stream *find_stream(struct usb_device *dev,
+        struct usb_request *req)
+{
+    struct usb_stream *stream;
+    int i;
+
+    pthread_mutex_lock(&dev->lock);
+    for (stream = dev->streams; stream; stream = stream->next) {
+        for (i = 0; i < stream->count; i++) {
+            if (stream->requests[i] == req) {
+                pthread_mutex_unlock(&dev->lock);
+                return stream;
+            }
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+// Hands a reaped URB to its stream, or keeps it for usb_request_wait().
+// Returns the request if it is not a stream's.
+static struct usb_request *dispatch_urb(struct usb_device *dev,
+        struct usbdevfs_urb *urb, int keep)
+{
+    struct usb_request *req = (struct usb_request*)urb->usercontext;
+    struct usb_stream *stream;
+
+    D("[ urb @%p status = %d, actual = %d ]\n",
+        urb, urb->status, urb->actual_length);
+    req->actual_length = urb->actual_length;
+
+    stream = find_stream(dev, req);
+    if (stream) {
+        usb_stream_complete(stream, req, urb->status);
+        return NULL;
+    }
+    if (!keep)
+        return req;
+
+    pthread_mutex_lock(&dev->lock);
+    if (dev->reaped_count == dev->reaped_capacity) {
+        int capacity = dev->reaped_capacity ? dev->reaped_capacity * 2 : 8;
+        struct usb_request **reaped = realloc(dev->reaped,
+                capacity * sizeof(*reaped));
+        if (!reaped) {
+            pthread_mutex_unlock(&dev->lock);
+            D("dropping reaped request %p\n", req);
+            return NULL;
+        }
+        dev->reaped = reaped;
+        dev->reaped_capacity = capacity;
+    }
+    dev->reaped[dev->reaped_count++] = req;
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
 struct usb_request *usb_request_wait(struct usb_device *dev)
 {
     struct usbdevfs_urb *urb = NULL;
     struct usb_request *req = NULL;
 
+    pthread_mutex_lock(&dev->lock);
+    if (dev->reaped_count > 0) {
+        req = dev->reaped[0];
+        memmove(dev->reaped, dev->reaped + 1,
+                --dev->reaped_count * sizeof(*dev->reaped));
+    }
+    pthread_mutex_unlock(&dev->lock);
+    if (req)
+        return req;
+
     while (1) {
         int res = ioctl(dev->fd, USBDEVFS_REAPURB, &urb);
         D("USBDEVFS_REAPURB returned %d\n", res);
@@ -690,13 +788,11 @@ struct usb_request *usb_request_wait(struct usb_device *dev)
             }
             D("[ reap urb - error ]\n");
             return NULL;
-        } else {
-            D("[ urb @%p status = %d, actual = %d ]\n",
-                urb, urb->status, urb->actual_length);
-            req = (struct usb_request*)urb->usercontext;
-            req->actual_length = urb->actual_length;
         }
-        break;
+        // the URBs of streams are handled on the way
+        req = dispatch_urb(dev, urb, 0);
+        if (req)
+            break;
     }
     return req;
 }
@@ -707,3 +803,176 @@ int usb_request_cancel(struct usb_request *req)
     return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, urb);
 }
 
+
+struct usb_stream *usb_stream_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc,
+        int num_requests, int buffer_length,
+        usb_stream_cb cb, void *client_data)
+{
+    struct usb_stream *stream;
+    int i;
+
+    if (num_requests <= 0 || buffer_length <= 0 || !cb)
+        return NULL;
+
+    stream = calloc(1, sizeof(struct usb_stream));
+    if (!stream)
+        return NULL;
+    stream->dev = dev;
+    stream->cb = cb;
+    stream->client_data = client_data;
+    stream->in = (ep_desc->bEndpointAddress & USB_ENDPOINT_DIR_MASK) == USB_DIR_IN;
+    stream->requests = calloc(num_requests, sizeof(struct usb_request *));
+    stream->buffers = malloc((size_t)num_requests * buffer_length);
+    if (!stream->requests || !stream->buffers)
+        goto failed;
+
+    for (i = 0; i < num_requests; i++) {
+        struct usb_request *req = usb_request_new(dev, ep_desc);
+        if (!req)
+            goto failed;
+        req->buffer = stream->buffers + (size_t)i * buffer_length;
+        req->buffer_length = buffer_length;
+        stream->requests[stream->count++] = req;
+    }
+
+    pthread_mutex_lock(&dev->lock);
+    stream->next = dev->streams;
+    dev->streams = stream;
+    pthread_mutex_unlock(&dev->lock);
+    return stream;
+
+failed:
+    for (i = 0; i < stream->count; i++)
+        usb_request_free(stream->requests[i]);
+    free(stream->requests);
+    free(stream->buffers);
+    free(stream);
+    return NULL;
+}
+
+// Asks the callback what to do with a free request and queues it again if
+// it is to go on.
+static void usb_stream_recycle(struct usb_stream *stream,
+        struct usb_request *req, int status)
+{
+    if (stream->stopping)
+        return;
+    if (stream->cb(req, status, stream->client_data) != 0)
+        return;
+    if (!stream->in && req->buffer_length <= 0)
+        return;
+    if (usb_request_queue(req) < 0) {
+        D("usb_stream: queueing request failed errno %d\n", errno);
+        return;
+    }
+    stream->in_flight++;
+}
+
+static void usb_stream_complete(struct usb_stream *stream,
+        struct usb_request *req, int status)
+{
+    stream->in_flight--;
+    usb_stream_recycle(stream, req, status);
+}
+
+int usb_stream_start(struct usb_stream *stream)
+{
+    int i;
+
+    for (i = 0; i < stream->count; i++) {
+        struct usb_request *req = stream->requests[i];
+        if (stream->in) {
+            if (usb_request_queue(req) < 0)
+                break;
+            stream->in_flight++;
+        } else {
+            // OUT buffers are filled by the callback first
+            req->actual_length = 0;
+            usb_stream_recycle(stream, req, 0);
+        }
+    }
+    return stream->in_flight > 0 ? 0 : -1;
+}
+
+int usb_stream_get_fd(struct usb_stream *stream)
+{
+    return stream->dev->fd;
+}
+
+int usb_stream_process(struct usb_stream *stream)
+{
+    struct usbdevfs_urb *urb = NULL;
+
+    while (1) {
+        int res = ioctl(stream->dev->fd, USBDEVFS_REAPURBNDELAY, &urb);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            D("USBDEVFS_REAPURBNDELAY failed errno %d\n", errno);
+            return -1;
+        }
+        dispatch_urb(stream->dev, urb, 1);
+    }
+    return stream->in_flight;
+}
+
+int usb_stream_run(struct usb_stream *stream)
+{
+    struct pollfd pfd;
+
+    pfd.fd = stream->dev->fd;
+    pfd.events = POLLOUT;
+    while (stream->in_flight > 0) {
+        int res = poll(&pfd, 1, -1);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            return -1;
+        if (usb_stream_process(stream) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void usb_stream_free(struct usb_stream *stream)
+{
+    struct usb_device *dev = stream->dev;
+    struct usb_stream **prev;
+    struct usbdevfs_urb *urb = NULL;
+    int i;
+
+    // Cancel what is in flight and reap it, handing on what isn't ours.
+    stream->stopping = 1;
+    for (i = 0; i < stream->count; i++)
+        usb_request_cancel(stream->requests[i]);
+    while (stream->in_flight > 0) {
+        int res = ioctl(dev->fd, USBDEVFS_REAPURB, &urb);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        dispatch_urb(dev, urb, 1);
+    }
+
+    pthread_mutex_lock(&dev->lock);
+    for (prev = &dev->streams; *prev; prev = &(*prev)->next) {
+        if (*prev == stream) {
+            *prev = stream->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    for (i = 0; i < stream->count; i++)
+        usb_request_free(stream->requests[i]);
+    free(stream->requests);
+    free(stream->buffers);
+    free(stream);
+}
@@ -32,6 +32,7 @@ commonSources:= \
 	String8.cpp \
 	String16.cpp \
 	SystemClock.cpp \
+	ThreadPool.cpp \
 	Threads.cpp \
 	Timers.cpp \
 	Tokenizer.cpp \
@@ -42,16 +42,8 @@ BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
-        mTotalSize(0) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-#ifdef _WIN32
-    srand(now);
-#else
-    mRandState[0] = (now >> 0) & 0xFFFF;
-    mRandState[1] = (now >> 16) & 0xFFFF;
-    mRandState[2] = (now >> 32) & 0xFFFF;
-#endif
-    ALOGV("initializing random seed using %lld", (unsigned long long)now);
+        mTotalSize(0),
+        mUseCount(0) {
 }
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
@@ -103,7 +95,8 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
+            index = mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
+            mCacheEntries.editItemAt(index).setLastUse(++mUseCount);
             mTotalSize = newTotalSize;
             ALOGV("set: created new cache entry with %zu byte key and %zu byte value",
                     keySize, valueSize);
@@ -124,7 +117,9 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.editItemAt(index).setValue(valueBlob);
+            CacheEntry& entry(mCacheEntries.editItemAt(index));
+            entry.setValue(valueBlob);
+            entry.setLastUse(++mUseCount);
             mTotalSize = newTotalSize;
             ALOGV("set: updated existing cache entry with %zu byte key and %zu byte "
                     "value", keySize, valueSize);
@@ -150,6 +145,7 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
+    mCacheEntries.editItemAt(index).setLastUse(++mUseCount);
     sp<Blob> valueBlob(mCacheEntries[index].getValue());
     size_t valueBlobSize = valueBlob->getSize();
     if (valueBlobSize <= valueSize) {
@@ -193,11 +189,13 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
     header->mBuildIdLength = property_get("ro.build.id", buildId, "");
     memcpy(header->mBuildId, buildId, header->mBuildIdLength);
 
-    // Write cache entries
+    // Write cache entries, least recently used first
+    Vector<size_t> indices;
+    getIndicesByLastUse(&indices);
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
+    for (size_t i = 0; i < indices.size(); i++) {
+        const CacheEntry& e(mCacheEntries[indices[i]]);
         sp<Blob> keyBlob = e.getKey();
         sp<Blob> valueBlob = e.getValue();
         size_t keySize = keyBlob->getSize();
@@ -254,10 +252,14 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
         return OK;
     }
 
-    // Read cache entries
+    // Read cache entries. They are collected and merged into the cache all
+    // at once, rather than set() one by one into the sorted entries.
     const uint8_t* byteBuffer = reinterpret_cast<const uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
     size_t numEntries = header->mNumEntries;
+    Vector<CacheEntry> entries;
+    entries.setCapacity(numEntries);
+    size_t entriesSize = 0;
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
             mCacheEntries.clear();
@@ -278,32 +280,91 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
             return BAD_VALUE;
         }
 
-        const uint8_t* data = eheader->mData;
-        set(data, keySize, data + keySize, valueSize);
+        // The entries set() would not cache are left out.
+        if (keySize != 0 && keySize <= mMaxKeySize &&
+                valueSize != 0 && valueSize <= mMaxValueSize &&
+                keySize + valueSize <= mMaxTotalSize) {
+            const uint8_t* data = eheader->mData;
+            sp<Blob> keyBlob(new Blob(data, keySize, true));
+            sp<Blob> valueBlob(new Blob(data + keySize, valueSize, true));
+            entries.add(CacheEntry(keyBlob, valueBlob));
+            entries.editTop().setLastUse(++mUseCount);
+            entriesSize += keySize + valueSize;
+        }
 
         byteOffset += totalSize;
     }
 
+    if (entriesSize > mMaxTotalSize) {
+        // More than fits: set() them in order, so the cache is cleaned of
+        // the earlier ones as it fills up.
+        for (size_t i = 0; i < entries.size(); i++) {
+            const CacheEntry& entry(entries[i]);
+            set(entry.getKey()->getData(), entry.getKey()->getSize(),
+                    entry.getValue()->getData(), entry.getValue()->getSize());
+        }
+        return OK;
+    }
+
+    mCacheEntries.merge(entries);
+    mTotalSize = 0;
+    for (size_t i = 0; i < mCacheEntries.size(); i++) {
+        const CacheEntry& entry(mCacheEntries[i]);
+        mTotalSize += entry.getKey()->getSize() + entry.getValue()->getSize();
+    }
     return OK;
 }
 
-long int BlobCache::blob_random() {
-#ifdef _WIN32
-    return rand();
-#else
-    return nrand48(mRandState);
-#endif
+struct LastUse {
+    uint64_t lastUse;
+    size_t index;
+};
+
+static int compareLastUse(const LastUse* lhs, const LastUse* rhs) {
+    uint64_t l = lhs->lastUse;
+    uint64_t r = rhs->lastUse;
+    if (l == r) {
+        return 0;
+    }
+    return l < r ? -1 : 1;
+}
+
+void BlobCache::getIndicesByLastUse(Vector<size_t>* indices) const {
+    Vector<LastUse> byLastUse;
+    byLastUse.setCapacity(mCacheEntries.size());
+    for (size_t i = 0; i < mCacheEntries.size(); i++) {
+        LastUse l = { mCacheEntries[i].getLastUse(), i };
+        byLastUse.add(l);
+    }
+    byLastUse.sort(compareLastUse);
+
+    indices->clear();
+    indices->setCapacity(byLastUse.size());
+    for (size_t i = 0; i < byLastUse.size(); i++) {
+        indices->add(byLastUse[i].index);
+    }
 }
 
 void BlobCache::clean() {
-    // Remove a random cache entry until the total cache size gets below half
-    // the maximum total cache size.
-    while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+    // Find the least recently used entries whose removal brings the total
+    // cache size below half the maximum total cache size, then remove them
+    // all in one pass.
+    Vector<size_t> indices;
+    getIndicesByLastUse(&indices);
+    uint64_t evictUpTo = 0;
+    size_t totalSize = mTotalSize;
+    for (size_t i = 0; i < indices.size() && totalSize > mMaxTotalSize / 2; i++) {
+        const CacheEntry& entry(mCacheEntries[indices[i]]);
+        totalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
+        evictUpTo = entry.getLastUse();
     }
+    for (size_t i = mCacheEntries.size(); i > 0; i--) {
+        const CacheEntry& entry(mCacheEntries[i - 1]);
+        if (entry.getLastUse() <= evictUpTo) {
+            mCacheEntries.removeAt(i - 1);
+        }
+    }
+    mTotalSize = totalSize;
 }
 
 bool BlobCache::isCleanable() const {
@@ -341,17 +402,20 @@ size_t BlobCache::Blob::getSize() const {
     return mSize;
 }
 
-BlobCache::CacheEntry::CacheEntry() {
+BlobCache::CacheEntry::CacheEntry():
+        mLastUse(0) {
 }
 
 BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, const sp<Blob>& value):
         mKey(key),
-        mValue(value) {
+        mValue(value),
+        mLastUse(0) {
 }
 
 BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
         mKey(ce.mKey),
-        mValue(ce.mValue) {
+        mValue(ce.mValue),
+        mLastUse(ce.mLastUse) {
 }
 
 bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
@@ -361,6 +425,7 @@ bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
 const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
     mKey = rhs.mKey;
     mValue = rhs.mValue;
+    mLastUse = rhs.mLastUse;
     return *this;
 }
 
@@ -376,4 +441,12 @@ void BlobCache::CacheEntry::setValue(const sp<Blob>& value) {
     mValue = value;
 }
 
+uint64_t BlobCache::CacheEntry::getLastUse() const {
+    return mLastUse;
+}
+
+void BlobCache::CacheEntry::setLastUse(uint64_t lastUse) {
+    mLastUse = lastUse;
+}
+
 } // namespace android
@@ -62,16 +62,18 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 // Hint for number of file descriptors to be associated with the epoll instance.
 static const int EPOLL_SIZE_HINT = 8;
 
-// Maximum number of file descriptors for which to retrieve poll events each iteration.
-static const int EPOLL_MAX_EVENTS = 16;
+// Epoll item of the wake event fd.  Never that of a request, whose sequence number
+// is never -1.
+static const uint64_t WAKE_EVENT_FD_ITEM = UINT64_MAX;
 
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
+        mAllowNonCallbacks(allowNonCallbacks), mNextMessageSeq(0), mSendingMessage(false),
         mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
-        mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
+        mNextRequestSeq(0), mResponseCount(0), mResponseIndex(0),
+        mNextMessageUptime(LLONG_MAX) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     LOG_ALWAYS_FATAL_IF(mWakeEventFd < 0, "Could not make wake event fd.  errno=%d", errno);
 
@@ -153,15 +155,18 @@ void Looper::rebuildEpollLocked() {
     struct epoll_event eventItem;
     memset(& eventItem, 0, sizeof(epoll_event)); // zero out unused members of data field union
     eventItem.events = EPOLLIN;
-    eventItem.data.fd = mWakeEventFd;
+    eventItem.data.u64 = WAKE_EVENT_FD_ITEM;
     int result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeEventFd, & eventItem);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance.  errno=%d",
             errno);
 
     for (size_t i = 0; i < mRequests.size(); i++) {
-        const Request& request = mRequests.valueAt(i);
+        const Request& request = mRequests.itemAt(i);
+        if (request.fd < 0) {
+            continue;
+        }
         struct epoll_event eventItem;
-        request.initEventItem(&eventItem);
+        request.initEventItem(&eventItem, i);
 
         int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, request.fd, & eventItem);
         if (epollResult < 0) {
@@ -184,8 +189,8 @@ void Looper::scheduleEpollRebuildLocked() {
 int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     int result = 0;
     for (;;) {
-        while (mResponseIndex < mResponses.size()) {
-            const Response& response = mResponses.itemAt(mResponseIndex++);
+        while (mResponseIndex < mResponseCount) {
+            const Response& response = mResponses[mResponseIndex++];
             int ident = response.request.ident;
             if (ident >= 0) {
                 int fd = response.request.fd;
@@ -238,7 +243,7 @@ int Looper::pollInner(int timeoutMillis) {
 
     // Poll.
     int result = POLL_WAKE;
-    mResponses.clear();
+    mResponseCount = 0;
     mResponseIndex = 0;
 
     // We are about to idle.
@@ -285,26 +290,28 @@ int Looper::pollInner(int timeoutMillis) {
 #endif
 
     for (int i = 0; i < eventCount; i++) {
-        int fd = eventItems[i].data.fd;
+        uint64_t item = eventItems[i].data.u64;
         uint32_t epollEvents = eventItems[i].events;
-        if (fd == mWakeEventFd) {
+        if (item == WAKE_EVENT_FD_ITEM) {
             if (epollEvents & EPOLLIN) {
                 awoken();
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
         } else {
-            ssize_t requestIndex = mRequests.indexOfKey(fd);
-            if (requestIndex >= 0) {
+            size_t slot = size_t(uint32_t(item));
+            int seq = int(uint32_t(item >> 32));
+            if (slot < mRequests.size() && mRequests.itemAt(slot).fd >= 0
+                    && mRequests.itemAt(slot).seq == seq) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                pushResponse(events, mRequests.valueAt(requestIndex));
+                pushResponse(events, mRequests.itemAt(slot));
             } else {
-                ALOGW("Ignoring unexpected epoll events 0x%x on fd %d that is "
-                        "no longer registered.", epollEvents, fd);
+                ALOGW("Ignoring unexpected epoll events 0x%x on request %d that is "
+                        "no longer registered.", epollEvents, seq);
             }
         }
     }
@@ -323,7 +330,7 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                dequeueMessageEnvelopeLocked();
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -348,8 +355,8 @@ Done: ;
     mLock.unlock();
 
     // Invoke all response callbacks.
-    for (size_t i = 0; i < mResponses.size(); i++) {
-        Response& response = mResponses.editItemAt(i);
+    for (size_t i = 0; i < mResponseCount; i++) {
+        Response& response = mResponses[i];
         if (response.request.ident == POLL_CALLBACK) {
             int fd = response.request.fd;
             int events = response.events;
@@ -425,10 +432,11 @@ void Looper::awoken() {
 }
 
 void Looper::pushResponse(int events, const Request& request) {
-    Response response;
+    // The copy holds a strong reference to the callback, so that it survives being
+    // removed by another callback invoked before it.
+    Response& response = mResponses[mResponseCount++];
     response.events = events;
     response.request = request;
-    mResponses.push(response);
 }
 
 int Looper::addFd(int fd, int ident, int events, Looper_callbackFunc callback, void* data) {
@@ -467,17 +475,32 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         request.data = data;
         if (mNextRequestSeq == -1) mNextRequestSeq = 0; // reserve sequence number -1
 
+        ssize_t slotIndex = mRequestSlotsByFd.indexOfKey(fd);
+        size_t slot;
+        if (slotIndex >= 0) {
+            slot = mRequestSlotsByFd.valueAt(slotIndex);
+        } else if (!mFreeRequestSlots.isEmpty()) {
+            slot = mFreeRequestSlots.top();
+        } else {
+            slot = mRequests.size();
+        }
+
         struct epoll_event eventItem;
-        request.initEventItem(&eventItem);
+        request.initEventItem(&eventItem, slot);
 
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        if (slotIndex < 0) {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
             if (epollResult < 0) {
                 ALOGE("Error adding epoll events for fd %d, errno=%d", fd, errno);
                 return -1;
             }
-            mRequests.add(fd, request);
+            if (slot == mRequests.size()) {
+                mRequests.add(request);
+            } else {
+                mFreeRequestSlots.pop();
+                mRequests.editItemAt(slot) = request;
+            }
+            mRequestSlotsByFd.add(fd, slot);
         } else {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
             if (epollResult < 0) {
@@ -512,7 +535,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     return -1;
                 }
             }
-            mRequests.replaceValueAt(requestIndex, request);
+            mRequests.editItemAt(slot) = request;
         }
     } // release lock
     return 1;
@@ -529,23 +552,28 @@ int Looper::removeFd(int fd, int seq) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        ssize_t slotIndex = mRequestSlotsByFd.indexOfKey(fd);
+        if (slotIndex < 0) {
             return 0;
         }
+        size_t slot = mRequestSlotsByFd.valueAt(slotIndex);
 
         // Check the sequence number if one was given.
-        if (seq != -1 && mRequests.valueAt(requestIndex).seq != seq) {
+        if (seq != -1 && mRequests.itemAt(slot).seq != seq) {
 #if DEBUG_CALLBACKS
             ALOGD("%p ~ removeFd - sequence number mismatch, oldSeq=%d",
-                    this, mRequests.valueAt(requestIndex).seq);
+                    this, mRequests.itemAt(slot).seq);
 #endif
             return 0;
         }
 
-        // Always remove the FD from the request map even if an error occurs while
+        // Always remove the FD from the request table even if an error occurs while
         // updating the epoll set so that we avoid accidentally leaking callbacks.
-        mRequests.removeItemsAt(requestIndex);
+        Request& request = mRequests.editItemAt(slot);
+        request.fd = -1;
+        request.callback.clear();
+        mFreeRequestSlots.push(slot);
+        mRequestSlotsByFd.removeItemsAt(slotIndex);
 
         int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
         if (epollResult < 0) {
@@ -598,17 +626,12 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    size_t i;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        MessageEnvelope messageEnvelope(uptime, mNextMessageSeq++, handler, message);
+        i = enqueueMessageEnvelopeLocked(messageEnvelope);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -633,12 +656,21 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
+        size_t messageCount = mMessageEnvelopes.size();
+        size_t keptCount = 0;
+        for (size_t i = 0; i < messageCount; i++) {
+            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(i);
+            if (messageEnvelope.handler != handler) {
+                if (keptCount != i) {
+                    mMessageEnvelopes.editItemAt(keptCount) = messageEnvelope;
+                }
+                keptCount += 1;
             }
         }
+        if (keptCount != messageCount) {
+            mMessageEnvelopes.removeItemsAt(keptCount, messageCount - keptCount);
+            heapifyMessageEnvelopesLocked();
+        }
     } // release lock
 }
 
@@ -650,28 +682,91 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
+        size_t messageCount = mMessageEnvelopes.size();
+        size_t keptCount = 0;
+        for (size_t i = 0; i < messageCount; i++) {
+            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(i);
+            if (messageEnvelope.handler != handler
+                    || messageEnvelope.message.what != what) {
+                if (keptCount != i) {
+                    mMessageEnvelopes.editItemAt(keptCount) = messageEnvelope;
+                }
+                keptCount += 1;
             }
         }
+        if (keptCount != messageCount) {
+            mMessageEnvelopes.removeItemsAt(keptCount, messageCount - keptCount);
+            heapifyMessageEnvelopesLocked();
+        }
     } // release lock
 }
 
+size_t Looper::enqueueMessageEnvelopeLocked(const MessageEnvelope& messageEnvelope) {
+    // Add at the end, then move up past every parent that is due later.
+    size_t index = mMessageEnvelopes.add(messageEnvelope);
+    while (index != 0) {
+        size_t parent = (index - 1) / 2;
+        if (!(messageEnvelope < mMessageEnvelopes.itemAt(parent))) {
+            break;
+        }
+        mMessageEnvelopes.editItemAt(index) = mMessageEnvelopes.itemAt(parent);
+        index = parent;
+    }
+    mMessageEnvelopes.editItemAt(index) = messageEnvelope;
+    return index;
+}
+
+void Looper::dequeueMessageEnvelopeLocked() {
+    // Replace the head with the last message, then move that back down.
+    size_t last = mMessageEnvelopes.size() - 1;
+    if (last != 0) {
+        mMessageEnvelopes.editItemAt(0) = mMessageEnvelopes.itemAt(last);
+    }
+    mMessageEnvelopes.removeAt(last);
+    if (last > 1) {
+        siftDownMessageEnvelopeLocked(0);
+    }
+}
+
+void Looper::siftDownMessageEnvelopeLocked(size_t index) {
+    size_t messageCount = mMessageEnvelopes.size();
+    MessageEnvelope messageEnvelope = mMessageEnvelopes.itemAt(index);
+    for (;;) {
+        size_t child = index * 2 + 1;
+        if (child >= messageCount) {
+            break;
+        }
+        if (child + 1 < messageCount
+                && mMessageEnvelopes.itemAt(child + 1) < mMessageEnvelopes.itemAt(child)) {
+            child += 1;
+        }
+        if (!(mMessageEnvelopes.itemAt(child) < messageEnvelope)) {
+            break;
+        }
+        mMessageEnvelopes.editItemAt(index) = mMessageEnvelopes.itemAt(child);
+        index = child;
+    }
+    mMessageEnvelopes.editItemAt(index) = messageEnvelope;
+}
+
+void Looper::heapifyMessageEnvelopesLocked() {
+    for (size_t i = mMessageEnvelopes.size() / 2; i != 0; ) {
+        siftDownMessageEnvelopeLocked(--i);
+    }
+}
+
 bool Looper::isPolling() const {
     return mPolling;
 }
 
-void Looper::Request::initEventItem(struct epoll_event* eventItem) const {
+void Looper::Request::initEventItem(struct epoll_event* eventItem, size_t slot) const {
     int epollEvents = 0;
     if (events & EVENT_INPUT) epollEvents |= EPOLLIN;
     if (events & EVENT_OUTPUT) epollEvents |= EPOLLOUT;
 
     memset(eventItem, 0, sizeof(epoll_event)); // zero out unused members of data field union
     eventItem->events = epollEvents;
-    eventItem->data.fd = fd;
+    eventItem->data.u64 = (uint64_t(uint32_t(seq)) << 32) | uint32_t(slot);
 }
 
 } // namespace android
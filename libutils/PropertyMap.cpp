@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <utils/JenkinsHash.h>
 #include <utils/PropertyMap.h>
 #include <utils/Log.h>
 
@@ -37,31 +38,126 @@ static const char* WHITESPACE_OR_PROPERTY_DELIMITER = " \t\r=";
 
 // --- PropertyMap ---
 
-PropertyMap::PropertyMap() {
+static hash_t hashKey(const char* key, size_t length) {
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+            reinterpret_cast<const uint8_t*>(key), length));
+}
+
+PropertyMap::PropertyMap() :
+        mPropertiesValid(true) {
 }
 
 PropertyMap::~PropertyMap() {
 }
 
 void PropertyMap::clear() {
+    mEntries.clear();
+    mIndex.clear();
+    mText.clear();
     mProperties.clear();
+    mPropertiesValid = true;
+}
+
+ssize_t PropertyMap::indexOf(const char* key, size_t keyLength, hash_t hash) const {
+    size_t mask = mIndex.size() - 1;
+    if (mIndex.isEmpty()) {
+        return -1;
+    }
+    const int32_t* index = mIndex.array();
+    for (size_t slot = hash & mask; index[slot] >= 0; slot = (slot + 1) & mask) {
+        const Entry& entry = mEntries[index[slot]];
+        if (entry.hash == hash && entry.keyLength == keyLength
+                && !memcmp(entry.key, key, keyLength)) {
+            return index[slot];
+        }
+    }
+    return -1;
+}
+
+void PropertyMap::rebuildIndex(size_t capacity) {
+    size_t size = 8;
+    while (size < capacity * 2) {
+        size <<= 1;
+    }
+    mIndex.clear();
+    mIndex.insertAt(-1, 0, size);
+
+    int32_t* index = mIndex.editArray();
+    size_t mask = size - 1;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        size_t slot = mEntries[i].hash & mask;
+        while (index[slot] >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = i;
+    }
+}
+
+// Adds or replaces a property whose key and value already live in mText.
+void PropertyMap::put(const char* key, size_t keyLength, const char* value, size_t valueLength) {
+    hash_t hash = hashKey(key, keyLength);
+    ssize_t i = indexOf(key, keyLength, hash);
+    if (i >= 0) {
+        Entry& entry = mEntries.editItemAt(i);
+        entry.value = value;
+        entry.valueLength = valueLength;
+    } else {
+        Entry entry;
+        entry.key = key;
+        entry.keyLength = keyLength;
+        entry.value = value;
+        entry.valueLength = valueLength;
+        entry.hash = hash;
+        mEntries.add(entry);
+        if (mEntries.size() * 2 > mIndex.size()) {
+            rebuildIndex(mEntries.size() * 2);
+        } else {
+            size_t mask = mIndex.size() - 1;
+            int32_t* index = mIndex.editArray();
+            size_t slot = hash & mask;
+            while (index[slot] >= 0) {
+                slot = (slot + 1) & mask;
+            }
+            index[slot] = mEntries.size() - 1;
+        }
+    }
+    mPropertiesValid = false;
+}
+
+// Moves entries that point into [oldBase, oldBase + length) to the same offsets in text.
+void PropertyMap::rebase(const char* oldBase, size_t length, const String8& text) {
+    const char* newBase = text.string();
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry& entry = mEntries.editItemAt(i);
+        if (entry.key >= oldBase && entry.key < oldBase + length) {
+            entry.key = newBase + (entry.key - oldBase);
+            entry.value = newBase + (entry.value - oldBase);
+        }
+    }
+    mText.add(text);
 }
 
 void PropertyMap::addProperty(const String8& key, const String8& value) {
-    mProperties.add(key, value);
+    // String8s share their buffers, so holding on to these copies costs no allocation.
+    mText.add(key);
+    const char* keyText = mText.top().string();
+    mText.add(value);
+    const char* valueText = mText.top().string();
+    put(keyText, key.length(), valueText, value.length());
 }
 
 bool PropertyMap::hasProperty(const String8& key) const {
-    return mProperties.indexOfKey(key) >= 0;
+    return indexOf(key.string(), key.length(), hashKey(key.string(), key.length())) >= 0;
 }
 
 bool PropertyMap::tryGetProperty(const String8& key, String8& outValue) const {
-    ssize_t index = mProperties.indexOfKey(key);
+    ssize_t index = indexOf(key.string(), key.length(), hashKey(key.string(), key.length()));
     if (index < 0) {
         return false;
     }
 
-    outValue = mProperties.valueAt(index);
+    const Entry& entry = mEntries[index];
+    outValue.setTo(entry.value, entry.valueLength);
     return true;
 }
 
@@ -75,17 +171,23 @@ bool PropertyMap::tryGetProperty(const String8& key, bool& outValue) const {
     return true;
 }
 
+/*
+ * Values are parsed where they are stored. A value is always followed by
+ * whitespace, a newline or a null, none of which can continue a number, so
+ * strtol and strtof stop at its end when it is well formed.
+ */
 bool PropertyMap::tryGetProperty(const String8& key, int32_t& outValue) const {
-    String8 stringValue;
-    if (! tryGetProperty(key, stringValue) || stringValue.length() == 0) {
+    ssize_t index = indexOf(key.string(), key.length(), hashKey(key.string(), key.length()));
+    if (index < 0 || mEntries[index].valueLength == 0) {
         return false;
     }
 
+    const Entry& entry = mEntries[index];
     char* end;
-    int value = strtol(stringValue.string(), & end, 10);
-    if (*end != '\0') {
-        ALOGW("Property key '%s' has invalid value '%s'.  Expected an integer.",
-                key.string(), stringValue.string());
+    int value = strtol(entry.value, & end, 10);
+    if (end != entry.value + entry.valueLength) {
+        ALOGW("Property key '%s' has invalid value '%.*s'.  Expected an integer.",
+                key.string(), int(entry.valueLength), entry.value);
         return false;
     }
     outValue = value;
@@ -93,16 +195,17 @@ bool PropertyMap::tryGetProperty(const String8& key, int32_t& outValue) const {
 }
 
 bool PropertyMap::tryGetProperty(const String8& key, float& outValue) const {
-    String8 stringValue;
-    if (! tryGetProperty(key, stringValue) || stringValue.length() == 0) {
+    ssize_t index = indexOf(key.string(), key.length(), hashKey(key.string(), key.length()));
+    if (index < 0 || mEntries[index].valueLength == 0) {
         return false;
     }
 
+    const Entry& entry = mEntries[index];
     char* end;
-    float value = strtof(stringValue.string(), & end);
-    if (*end != '\0') {
-        ALOGW("Property key '%s' has invalid value '%s'.  Expected a float.",
-                key.string(), stringValue.string());
+    float value = strtof(entry.value, & end);
+    if (end != entry.value + entry.valueLength) {
+        ALOGW("Property key '%s' has invalid value '%.*s'.  Expected a float.",
+                key.string(), int(entry.valueLength), entry.value);
         return false;
     }
     outValue = value;
@@ -110,11 +213,35 @@ bool PropertyMap::tryGetProperty(const String8& key, float& outValue) const {
 }
 
 void PropertyMap::addAll(const PropertyMap* map) {
-    for (size_t i = 0; i < map->mProperties.size(); i++) {
-        mProperties.add(map->mProperties.keyAt(i), map->mProperties.valueAt(i));
+    if (map == this) {
+        return;
+    }
+    // Share the other map's text; its entries stay valid as long as we hold it.
+    mText.appendVector(map->mText);
+    for (size_t i = 0; i < map->mEntries.size(); i++) {
+        const Entry& entry = map->mEntries[i];
+        put(entry.key, entry.keyLength, entry.value, entry.valueLength);
     }
 }
 
+const KeyedVector<String8, String8>& PropertyMap::getProperties() const {
+    if (!mPropertiesValid) {
+        // Sorted and merged in at once rather than added one by one.
+        Vector< key_value_pair_t<String8, String8> > properties;
+        properties.setCapacity(mEntries.size());
+        for (size_t i = 0; i < mEntries.size(); i++) {
+            const Entry& entry = mEntries[i];
+            properties.add(key_value_pair_t<String8, String8>(
+                    String8(entry.key, entry.keyLength),
+                    String8(entry.value, entry.valueLength)));
+        }
+        mProperties.clear();
+        mProperties.merge(properties);
+        mPropertiesValid = true;
+    }
+    return mProperties;
+}
+
 status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
     *outMap = NULL;
 
@@ -133,6 +260,11 @@ status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
 #endif
             Parser parser(map, tokenizer);
             status = parser.parse();
+            if (!status) {
+                // The entries point into the tokenizer; give them a copy of the file instead.
+                map->rebase(tokenizer->getContents(), tokenizer->getLength(),
+                        String8(tokenizer->getContents(), tokenizer->getLength()));
+            }
 #if DEBUG_PARSER_PERFORMANCE
             nsecs_t elapsedTime = systemTime(SYSTEM_TIME_MONOTONIC) - startTime;
             ALOGD("Parsed property file '%s' %d lines in %0.3fms.",
@@ -170,8 +302,10 @@ status_t PropertyMap::Parser::parse() {
         mTokenizer->skipDelimiters(WHITESPACE);
 
         if (!mTokenizer->isEol() && mTokenizer->peekChar() != '#') {
-            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER);
-            if (keyToken.isEmpty()) {
+            size_t keyLength;
+            const char* key = mTokenizer->nextTokenView(WHITESPACE_OR_PROPERTY_DELIMITER,
+                    &keyLength);
+            if (keyLength == 0) {
                 ALOGE("%s: Expected non-empty property key.", mTokenizer->getLocation().string());
                 return BAD_VALUE;
             }
@@ -186,8 +320,9 @@ status_t PropertyMap::Parser::parse() {
 
             mTokenizer->skipDelimiters(WHITESPACE);
 
-            String8 valueToken = mTokenizer->nextToken(WHITESPACE);
-            if (valueToken.find("\\", 0) >= 0 || valueToken.find("\"", 0) >= 0) {
+            size_t valueLength;
+            const char* value = mTokenizer->nextTokenView(WHITESPACE, &valueLength);
+            if (memchr(value, '\\', valueLength) || memchr(value, '"', valueLength)) {
                 ALOGE("%s: Found reserved character '\\' or '\"' in property value.",
                         mTokenizer->getLocation().string());
                 return BAD_VALUE;
@@ -201,13 +336,13 @@ status_t PropertyMap::Parser::parse() {
                 return BAD_VALUE;
             }
 
-            if (mMap->hasProperty(keyToken)) {
-                ALOGE("%s: Duplicate property value for key '%s'.",
-                        mTokenizer->getLocation().string(), keyToken.string());
+            if (mMap->indexOf(key, keyLength, hashKey(key, keyLength)) >= 0) {
+                ALOGE("%s: Duplicate property value for key '%.*s'.",
+                        mTokenizer->getLocation().string(), int(keyLength), key);
                 return BAD_VALUE;
             }
 
-            mMap->addProperty(keyToken, valueToken);
+            mMap->put(key, keyLength, value, valueLength);
         }
 
         mTokenizer->nextLine();
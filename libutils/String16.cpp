@@ -109,6 +109,13 @@ String16::String16(const String16& o)
     SharedBuffer::bufferFromData(mString)->acquire();
 }
 
+String16::String16(String16&& o)
+    : mString(o.mString)
+{
+    // take over o's reference; o is left holding the shared empty string
+    o.mString = getEmptyString();
+}
+
 String16::String16(const String16& o, size_t len, size_t begin)
     : mString(getEmptyString())
 {
@@ -165,6 +172,16 @@ String16::~String16()
     SharedBuffer::bufferFromData(mString)->release();
 }
 
+String16& String16::operator=(String16&& other)
+{
+    if (this != &other) {
+        SharedBuffer::bufferFromData(mString)->release();
+        mString = other.mString;
+        other.mString = getEmptyString();
+    }
+    return *this;
+}
+
 void String16::setTo(const String16& other)
 {
     SharedBuffer::bufferFromData(other.mString)->acquire();
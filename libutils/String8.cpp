@@ -167,6 +167,13 @@ String8::String8(const String8& o)
     SharedBuffer::bufferFromData(mString)->acquire();
 }
 
+String8::String8(String8&& o)
+    : mString(o.mString)
+{
+    // take over o's reference; o is left holding the shared empty string
+    o.mString = getEmptyString();
+}
+
 String8::String8(const char* o)
     : mString(allocFromUTF8(o, strlen(o)))
 {
@@ -236,6 +243,16 @@ void String8::clear() {
     mString = getEmptyString();
 }
 
+String8& String8::operator=(String8&& other)
+{
+    if (this != &other) {
+        SharedBuffer::bufferFromData(mString)->release();
+        mString = other.mString;
+        other.mString = getEmptyString();
+    }
+    return *this;
+}
+
 void String8::setTo(const String8& other)
 {
     SharedBuffer::bufferFromData(other.mString)->acquire();
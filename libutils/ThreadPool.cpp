@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "ThreadPool"
+
+#include <utils/AndroidThreads.h>
+#include <utils/Log.h>
+#include <utils/ThreadPool.h>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+ThreadPool::Task::Task()
+    : mDone(false)
+{
+}
+
+ThreadPool::Task::~Task()
+{
+}
+
+void ThreadPool::Task::wait()
+{
+    Mutex::Autolock _l(mLock);
+    while (!mDone) {
+        mDoneCondition.wait(mLock);
+    }
+}
+
+bool ThreadPool::Task::waitRelative(nsecs_t timeout)
+{
+    Mutex::Autolock _l(mLock);
+    if (!mDone) {
+        mDoneCondition.waitRelative(mLock, timeout);
+    }
+    return mDone;
+}
+
+bool ThreadPool::Task::isDone() const
+{
+    Mutex::Autolock _l(mLock);
+    return mDone;
+}
+
+void ThreadPool::Task::execute()
+{
+    run();
+
+    Mutex::Autolock _l(mLock);
+    mDone = true;
+    mDoneCondition.broadcast();
+}
+
+// ---------------------------------------------------------------------------
+
+ThreadPool::Worker::Worker(ThreadPool* pool, size_t index)
+    : Thread(false),
+      mThreadId(0),
+      mPool(pool),
+      mIndex(index)
+{
+}
+
+status_t ThreadPool::Worker::readyToRun()
+{
+    // Read under the same lock, by currentWorkerIndex().
+    Mutex::Autolock _l(mPool->mLock);
+    mThreadId = androidGetThreadId();
+    return NO_ERROR;
+}
+
+bool ThreadPool::Worker::threadLoop()
+{
+    return mPool->runOneTask(mIndex);
+}
+
+// ---------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(const char* name, size_t threadCount, int32_t priority)
+    : mName(name),
+      mThreadCount(threadCount ? threadCount : 1),
+      mPriority(priority),
+      mQueues(new Queue[mThreadCount]),
+      mPendingTasks(0),
+      mNextQueue(0),
+      mRunning(false),
+      mExiting(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    shutdown();
+    delete[] mQueues;
+}
+
+status_t ThreadPool::start()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (mRunning || mExiting) {
+            return INVALID_OPERATION;
+        }
+        mRunning = true;
+    }
+
+    for (size_t i = 0; i < mThreadCount; i++) {
+        sp<Worker> worker = new Worker(this, i);
+        String8 name = String8::format("%s-%zu", mName.string(), i);
+        status_t err = worker->run(name.string(), mPriority);
+        if (err != NO_ERROR) {
+            ALOGE("Could not start worker %s: %d", name.string(), err);
+            shutdown();
+            return err;
+        }
+        Mutex::Autolock _l(mLock);
+        mWorkers.add(worker);
+    }
+    return NO_ERROR;
+}
+
+status_t ThreadPool::post(const sp<Task>& task)
+{
+    size_t index;
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mRunning || mExiting) {
+            return INVALID_OPERATION;
+        }
+        // Counted before it is queued, so that a worker never parks while a
+        // task is in a queue.
+        mPendingTasks++;
+
+        ssize_t current = currentWorkerIndex();
+        if (current >= 0) {
+            index = current;
+        } else {
+            index = mNextQueue;
+            mNextQueue = (mNextQueue + 1) % mThreadCount;
+        }
+    }
+
+    {
+        Mutex::Autolock _l(mQueues[index].lock);
+        mQueues[index].tasks.push(task);
+    }
+
+    Mutex::Autolock _l(mLock);
+    mWorkAvailable.signal();
+    return NO_ERROR;
+}
+
+void ThreadPool::wait(const sp<Task>& task)
+{
+    ssize_t index;
+    {
+        Mutex::Autolock _l(mLock);
+        index = currentWorkerIndex();
+    }
+    if (index < 0) {
+        task->wait();
+        return;
+    }
+
+    // The task may be sitting in a queue behind us, or may post more work
+    // to our queue while it runs elsewhere, so keep helping and only block
+    // briefly when there is nothing to take.
+    while (!task->isDone()) {
+        sp<Task> other = takeTask(index);
+        if (other != NULL) {
+            other->execute();
+        } else if (task->waitRelative(milliseconds(1))) {
+            break;
+        }
+    }
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mRunning) {
+            return;
+        }
+        LOG_ALWAYS_FATAL_IF(currentWorkerIndex() >= 0,
+                "ThreadPool %s shut down from one of its own tasks", mName.string());
+        mExiting = true;
+        mWorkAvailable.broadcast();
+    }
+
+    // Workers exit once every queue is empty.
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+    }
+
+    Mutex::Autolock _l(mLock);
+    mWorkers.clear();
+    mRunning = false;
+}
+
+ssize_t ThreadPool::currentWorkerIndex() const
+{
+    thread_id_t self = androidGetThreadId();
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        if (mWorkers[i]->mThreadId == self) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+sp<ThreadPool::Task> ThreadPool::takeTask(size_t index)
+{
+    sp<Task> task;
+
+    // Most recently queued task first from our own queue, for locality...
+    {
+        Queue& queue = mQueues[index];
+        Mutex::Autolock _l(queue.lock);
+        if (!queue.tasks.isEmpty()) {
+            task = queue.tasks.top();
+            queue.tasks.pop();
+        }
+    }
+
+    // ...otherwise the oldest task of another worker.
+    for (size_t i = 1; task == NULL && i < mThreadCount; i++) {
+        Queue& queue = mQueues[(index + i) % mThreadCount];
+        Mutex::Autolock _l(queue.lock);
+        if (!queue.tasks.isEmpty()) {
+            task = queue.tasks[0];
+            queue.tasks.removeAt(0);
+        }
+    }
+
+    if (task != NULL) {
+        Mutex::Autolock _l(mLock);
+        mPendingTasks--;
+    }
+    return task;
+}
+
+bool ThreadPool::runOneTask(size_t index)
+{
+    sp<Task> task = takeTask(index);
+    if (task != NULL) {
+        task->execute();
+        return true;
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (mPendingTasks == 0) {
+        if (mExiting) {
+            return false;
+        }
+        mWorkAvailable.wait(mLock);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -127,6 +127,12 @@ String8 Tokenizer::peekRemainderOfLine() const {
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    size_t length;
+    const char* token = nextTokenView(delimiters, &length);
+    return String8(token, length);
+}
+
+const char* Tokenizer::nextTokenView(const char* delimiters, size_t* outLength) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
@@ -139,7 +145,8 @@ String8 Tokenizer::nextToken(const char* delimiters) {
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    *outLength = mCurrent - tokenStart;
+    return tokenStart;
 }
 
 void Tokenizer::nextLine() {
@@ -17,6 +17,7 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <string.h>
 
 #ifdef HAVE_WINSOCK
 # undef  nhtol
@@ -62,6 +63,26 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// Most strings that go through here are plain ASCII, so the converters
+// below check 8 bytes at a time (8 UTF-8 units or 4 UTF-16 units) and
+// handle whole runs of ASCII without decoding each character.
+static const size_t kAsciiBlockBytes = sizeof(uint64_t);
+static const size_t kAsciiBlockUtf16 = sizeof(uint64_t) / sizeof(char16_t);
+
+static inline bool utf8_block_is_ascii(const uint8_t* src)
+{
+    uint64_t block;
+    memcpy(&block, src, sizeof(block));
+    return (block & 0x8080808080808080ULL) == 0;
+}
+
+static inline bool utf16_block_is_ascii(const char16_t* src)
+{
+    uint64_t block;
+    memcpy(&block, src, sizeof(block));
+    return (block & 0xFF80FF80FF80FF80ULL) == 0;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -334,6 +355,19 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80) {
+            while ((size_t)(end_utf16 - cur_utf16) >= kAsciiBlockUtf16
+                    && utf16_block_is_ascii(cur_utf16)) {
+                for (size_t i = 0; i < kAsciiBlockUtf16; i++) {
+                    cur[i] = (char) cur_utf16[i];
+                }
+                cur += kAsciiBlockUtf16;
+                cur_utf16 += kAsciiBlockUtf16;
+            }
+            if (cur_utf16 == end_utf16) {
+                break;
+            }
+        }
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -407,6 +441,15 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        if (*src < 0x80) {
+            while ((size_t)(end - src) >= kAsciiBlockUtf16 && utf16_block_is_ascii(src)) {
+                ret += kAsciiBlockUtf16;
+                src += kAsciiBlockUtf16;
+            }
+            if (src == end) {
+                break;
+            }
+        }
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -519,6 +562,15 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            while ((size_t)(u8end - u8cur) >= kAsciiBlockBytes && utf8_block_is_ascii(u8cur)) {
+                u16measuredLen += kAsciiBlockBytes;
+                u8cur += kAsciiBlockBytes;
+            }
+            if (u8cur == u8end) {
+                break;
+            }
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -544,6 +596,18 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            while ((size_t)(u8end - u8cur) >= kAsciiBlockBytes && utf8_block_is_ascii(u8cur)) {
+                for (size_t i = 0; i < kAsciiBlockBytes; i++) {
+                    u16cur[i] = (char16_t) u8cur[i];
+                }
+                u16cur += kAsciiBlockBytes;
+                u8cur += kAsciiBlockBytes;
+            }
+            if (u8cur == u8end) {
+                break;
+            }
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -575,6 +639,20 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        if (*u8cur < 0x80) {
+            while ((size_t)(u8end - u8cur) >= kAsciiBlockBytes
+                    && (size_t)(u16end - u16cur) >= kAsciiBlockBytes
+                    && utf8_block_is_ascii(u8cur)) {
+                for (size_t i = 0; i < kAsciiBlockBytes; i++) {
+                    u16cur[i] = (char16_t) u8cur[i];
+                }
+                u16cur += kAsciiBlockBytes;
+                u8cur += kAsciiBlockBytes;
+            }
+            if (u8cur == u8end || u16cur == u16end) {
+                break;
+            }
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -36,6 +36,9 @@ namespace android {
 
 const size_t kMinVectorCapacity = 4;
 
+// Runs no longer than this are insertion sorted rather than merge sorted.
+const size_t kInsertionSortMax = 16;
+
 static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
@@ -170,53 +173,177 @@ status_t VectorImpl::sort(VectorImpl::compar_t cmp)
 
 status_t VectorImpl::sort(VectorImpl::compar_r_t cmp, void* state)
 {
-    // the sort must be stable. we're using insertion sort which
-    // is well suited for small and already sorted arrays
-    // for big arrays, it could be better to use mergesort
-    const ssize_t count = size();
-    if (count > 1) {
-        void* array = const_cast<void*>(arrayImpl());
-        void* temp = 0;
-        ssize_t i = 1;
-        while (i < count) {
-            void* item = reinterpret_cast<char*>(array) + mItemSize*(i);
-            void* curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-            if (cmp(curr, item, state) > 0) {
-
-                if (!temp) {
-                    // we're going to have to modify the array...
-                    array = editArrayImpl();
-                    if (!array) return NO_MEMORY;
-                    temp = malloc(mItemSize);
-                    if (!temp) return NO_MEMORY;
-                    item = reinterpret_cast<char*>(array) + mItemSize*(i);
-                    curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-                } else {
-                    _do_destroy(temp, 1);
-                }
+    return sortItems(0, size(), cmp, state);
+}
 
-                _do_copy(temp, item, 1);
+status_t VectorImpl::sortItems(size_t from, size_t count,
+        VectorImpl::compar_r_t cmp, void* state)
+{
+    // the sort must be stable: a merge sort, down to insertion sorts of
+    // short runs, which do well on small and already sorted arrays.
+    if (count < 2) {
+        return NO_ERROR;
+    }
 
-                ssize_t j = i-1;
-                void* next = reinterpret_cast<char*>(array) + mItemSize*(i);                    
-                do {
-                    _do_destroy(next, 1);
-                    _do_copy(next, curr, 1);
-                    next = curr;
-                    --j;
-                    curr = reinterpret_cast<char*>(array) + mItemSize*(j);                    
-                } while (j>=0 && (cmp(curr, temp, state) > 0));
+    // an array already sorted is left alone, and left shared
+    const uint8_t* items = reinterpret_cast<const uint8_t*>(arrayImpl()) + from*mItemSize;
+    size_t i = 1;
+    while (i < count && cmp(items + (i-1)*mItemSize, items + i*mItemSize, state) <= 0) {
+        i++;
+    }
+    if (i == count) {
+        return NO_ERROR;
+    }
 
-                _do_destroy(next, 1);
-                _do_copy(next, temp, 1);
-            }
-            i++;
+    uint8_t* array = reinterpret_cast<uint8_t*>(editArrayImpl());
+    if (!array) return NO_MEMORY;
+    // room for the left half of a merge, or the item an insertion sort holds
+    void* scratch = malloc(((count + 1) / 2) * mItemSize);
+    if (!scratch) return NO_MEMORY;
+    _merge_sort(array + from*mItemSize, count, cmp, state,
+            reinterpret_cast<uint8_t*>(scratch));
+    free(scratch);
+    return NO_ERROR;
+}
+
+void VectorImpl::_insertion_sort(uint8_t* array, size_t count,
+        VectorImpl::compar_r_t cmp, void* state, uint8_t* temp) const
+{
+    const size_t s = mItemSize;
+    for (size_t i = 1; i < count; i++) {
+        uint8_t* item = array + i*s;
+        if (cmp(item - s, item, state) <= 0) {
+            continue;
+        }
+        _do_move_forward(temp, item, 1);
+        size_t j = i;
+        do {
+            _do_move_forward(array + j*s, array + (j-1)*s, 1);
+            j--;
+        } while (j > 0 && cmp(array + (j-1)*s, temp, state) > 0);
+        _do_move_forward(array + j*s, temp, 1);
+    }
+}
+
+void VectorImpl::_merge_sort(uint8_t* array, size_t count,
+        VectorImpl::compar_r_t cmp, void* state, uint8_t* scratch) const
+{
+    const size_t s = mItemSize;
+    if (count <= kInsertionSortMax) {
+        _insertion_sort(array, count, cmp, state, scratch);
+        return;
+    }
+
+    const size_t half = count / 2;
+    _merge_sort(array, half, cmp, state, scratch);
+    _merge_sort(array + half*s, count - half, cmp, state, scratch);
+    if (cmp(array + (half-1)*s, array + half*s, state) <= 0) {
+        return;
+    }
+
+    // the left half goes to the scratch space and is merged back with the
+    // right one, which is never overtaken: the item written is always one
+    // before the next right item
+    _do_move_forward(scratch, array, half);
+    size_t l = 0, r = half, k = 0;
+    while (l < half && r < count) {
+        if (cmp(scratch + l*s, array + r*s, state) <= 0) {
+            _do_move_forward(array + k*s, scratch + l*s, 1);
+            l++;
+        } else {
+            _do_move_forward(array + k*s, array + r*s, 1);
+            r++;
         }
-        
-        if (temp) {
-            _do_destroy(temp, 1);
-            free(temp);
+        k++;
+    }
+    if (l < half) {
+        _do_move_forward(array + k*s, scratch + l*s, half - l);
+    }
+}
+
+ssize_t VectorImpl::uniqueItems(size_t from, VectorImpl::compar_r_t cmp, void* state)
+{
+    const size_t s = mItemSize;
+    const uint8_t* items = reinterpret_cast<const uint8_t*>(arrayImpl());
+    size_t r = from + 1;
+    while (r < mCount && cmp(items + (r-1)*s, items + r*s, state) != 0) {
+        r++;
+    }
+    if (r >= mCount) {
+        return mCount;
+    }
+
+    uint8_t* array = reinterpret_cast<uint8_t*>(editArrayImpl());
+    if (!array) return NO_MEMORY;
+    // items before r-1 are all unique, so are left where they are
+    size_t w = r - 1;
+    for (r = w; r < mCount; r++) {
+        uint8_t* item = array + r*s;
+        if (r + 1 < mCount && cmp(item, item + s, state) == 0) {
+            _do_destroy(item, 1);
+            continue;
+        }
+        if (w != r) {
+            _do_move_backward(array + w*s, item, 1);
+        }
+        w++;
+    }
+    mCount = w;
+    return mCount;
+}
+
+status_t VectorImpl::mergeItems(size_t split, VectorImpl::compar_r_t cmp, void* state)
+{
+    const size_t s = mItemSize;
+    const size_t n = split;
+    const size_t m = mCount - split;
+    if (n == 0 || m == 0) {
+        return NO_ERROR;
+    }
+    const uint8_t* items = reinterpret_cast<const uint8_t*>(arrayImpl());
+    if (cmp(items + (n-1)*s, items + n*s, state) < 0) {
+        return NO_ERROR;
+    }
+
+    uint8_t* array = reinterpret_cast<uint8_t*>(editArrayImpl());
+    if (!array) return NO_MEMORY;
+    uint8_t* scratch = reinterpret_cast<uint8_t*>(malloc(m*s));
+    if (!scratch) return NO_MEMORY;
+
+    // merged from the end, the second run out of the way in the scratch
+    // space; the first run's items only ever move up
+    _do_move_forward(scratch, array + n*s, m);
+    ssize_t i = n - 1, j = m - 1, k = n + m - 1;
+    size_t dups = 0;
+    while (i >= 0 && j >= 0) {
+        uint8_t* a = array + i*s;
+        uint8_t* b = scratch + j*s;
+        const int c = cmp(a, b, state);
+        if (c > 0) {
+            _do_move_forward(array + k*s, a, 1);
+            i--;
+        } else {
+            _do_move_forward(array + k*s, b, 1);
+            j--;
+            if (c == 0) {
+                // the item from the second run replaces it
+                _do_destroy(a, 1);
+                i--;
+                dups++;
+            }
         }
+        k--;
+    }
+    if (j >= 0) {
+        _do_move_forward(array + (k - j)*s, scratch, j + 1);
+    }
+    free(scratch);
+
+    // the replaced items left a gap of dups items just past i
+    if (dups) {
+        const size_t to = i + 1;
+        _do_move_backward(array + to*s, array + (to + dups)*s, n + m - (to + dups));
+        mCount = n + m - dups;
     }
     return NO_ERROR;
 }
@@ -342,8 +469,13 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
+        if (_can_relocate()) {
+            _do_relocate(array, mStorage, size());
+            _release_relocated_storage();
+        } else {
+            _do_copy(array, mStorage, size());
+            release_storage();
+        }
         mStorage = const_cast<void*>(array);
     } else {
         return NO_MEMORY;
@@ -404,10 +536,11 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                             "new_alloc_size overflow");
 
 //        ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
+        const bool relocate = _can_relocate();
         if ((mStorage) &&
             (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
+            (relocate ||
+             ((mFlags & HAS_TRIVIAL_COPY) && (mFlags & HAS_TRIVIAL_DTOR))))
         {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
@@ -420,15 +553,21 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != mCount) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                if (relocate) {
+                    _do_relocate(array, mStorage, where);
+                    _do_relocate(dest, from, mCount-where);
+                    _release_relocated_storage();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else {
                 return NULL;
@@ -487,15 +626,24 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != new_size) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
+                if (_can_relocate()) {
+                    // the removed items still have to be destroyed; the
+                    // survivors are simply relocated
+                    _do_destroy(reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize, amount);
+                    _do_relocate(array, mStorage, where);
+                    _do_relocate(dest, from, new_size - where);
+                    _release_relocated_storage();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_copy(dest, from, new_size - where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else{
                 return;
@@ -545,11 +693,37 @@ void VectorImpl::_do_splat(void* dest, const void* item, size_t num) const {
 }
 
 void VectorImpl::_do_move_forward(void* dest, const void* from, size_t num) const {
-    do_move_forward(dest, from, num);
+    if (!(mFlags & HAS_TRIVIAL_MOVE)) {
+        do_move_forward(dest, from, num);
+    } else {
+        memmove(dest, from, num*itemSize());
+    }
 }
 
 void VectorImpl::_do_move_backward(void* dest, const void* from, size_t num) const {
-    do_move_backward(dest, from, num);
+    if (!(mFlags & HAS_TRIVIAL_MOVE)) {
+        do_move_backward(dest, from, num);
+    } else {
+        memmove(dest, from, num*itemSize());
+    }
+}
+
+bool VectorImpl::_can_relocate() const {
+    // Items that can be moved with memcpy() don't need to be copied and
+    // destroyed one by one when the storage is reallocated, as long as no
+    // other vector shares it.
+    return (mStorage) &&
+           (mFlags & HAS_TRIVIAL_MOVE) &&
+           SharedBuffer::bufferFromData(mStorage)->onlyOwner();
+}
+
+void VectorImpl::_do_relocate(void* dest, const void* from, size_t num) const {
+    memcpy(dest, from, num*itemSize());
+}
+
+void VectorImpl::_release_relocated_storage() {
+    // the items have been relocated, only free the memory
+    SharedBuffer::dealloc(SharedBuffer::bufferFromData(mStorage));
 }
 
 /*****************************************************************************/
@@ -623,19 +797,40 @@ ssize_t SortedVectorImpl::add(const void* item)
     return index;
 }
 
+int SortedVectorImpl::compareProxy(const void* lhs, const void* rhs, void* state)
+{
+    return static_cast<const SortedVectorImpl*>(state)->do_compare(lhs, rhs);
+}
+
 ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
-            if (err<0) {
-                return err;
-            }
-        }
+    if (vector.isEmpty()) {
+        return NO_ERROR;
+    }
+    if (vector.size() == 1) {
+        ssize_t err = add(vector.arrayImpl());
+        return err < 0 ? err : NO_ERROR;
+    }
+
+    // the items are appended, sorted among themselves, and the two sorted
+    // runs merged, rather than added one by one. As with add(), an item
+    // replaces the one equal to it, and the last of equal items wins.
+    const size_t split = size();
+    ssize_t err = VectorImpl::appendVector(vector);
+    if (err < 0) {
+        return err;
+    }
+    void* state = const_cast<SortedVectorImpl*>(this);
+    err = sortItems(split, size() - split, compareProxy, state);
+    if (err == NO_ERROR) {
+        err = uniqueItems(split, compareProxy, state);
+    }
+    if (err >= 0) {
+        err = mergeItems(split, compareProxy, state);
+    }
+    if (err < 0) {
+        VectorImpl::removeItemsAt(split, size() - split);
+        return err;
     }
     return NO_ERROR;
 }
@@ -643,19 +838,20 @@ ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
 {
     // we've merging a sorted vector... nice!
-    ssize_t err = NO_ERROR;
-    if (!vector.isEmpty()) {
-        // first take care of the case where the vectors are sorted together
-        if (do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) <= 0) {
-            err = VectorImpl::insertVectorAt(static_cast<const VectorImpl&>(vector), 0);
-        } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
-            err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
-        } else {
-            // this could be made a little better
-            err = merge(static_cast<const VectorImpl&>(vector));
-        }
+    if (vector.isEmpty()) {
+        return NO_ERROR;
     }
-    return err;
+    const size_t split = size();
+    ssize_t err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
+    if (err < 0) {
+        return err;
+    }
+    err = mergeItems(split, compareProxy, const_cast<SortedVectorImpl*>(this));
+    if (err < 0) {
+        VectorImpl::removeItemsAt(split, size() - split);
+        return err;
+    }
+    return NO_ERROR;
 }
 
 ssize_t SortedVectorImpl::remove(const void* item)
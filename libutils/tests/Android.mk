@@ -27,7 +27,10 @@ LOCAL_SRC_FILES := \
     BitSet_test.cpp \
     Looper_test.cpp \
     LruCache_test.cpp \
+    PropertyMap_test.cpp \
     String8_test.cpp \
+    StrongPointer_test.cpp \
+    ThreadPool_test.cpp \
     Unicode_test.cpp \
     Vector_test.cpp \
 
@@ -46,3 +49,29 @@ LOCAL_SRC_FILES := Vector_test.cpp
 LOCAL_STATIC_LIBRARIES := libutils liblog
 
 include $(BUILD_HOST_NATIVE_TEST)
+
+#
+# Benchmarks, using the harness from liblog's tests (device only). Run with:
+#   adb shell /data/nativetest/libutils_benchmark/libutils_benchmark [regex]
+#
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libutils_benchmark
+LOCAL_CFLAGS += -Wall -Werror
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../liblog/tests
+
+LOCAL_SRC_FILES := \
+    ../../liblog/tests/benchmark_main.cpp \
+    Cache_benchmark.cpp \
+    Looper_benchmark.cpp \
+    RefBase_benchmark.cpp \
+    String_benchmark.cpp \
+    Vector_benchmark.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libcutils \
+    libutils \
+
+include $(BUILD_NATIVE_TEST)
@@ -258,6 +258,30 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, ExceedingTotalLimitEvictsLeastRecentlyUsed) {
+    // Fill up the entire cache with 1 char key/value pairs.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Use the first half of the entries again.
+    for (int i = 0; i < maxEntries / 2; i++) {
+        uint8_t k = i;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+    // Insert one more entry, causing a cache overflow.
+    {
+        uint8_t k = maxEntries;
+        mBC->set(&k, 1, "x", 1);
+    }
+    for (int i = 0; i < maxEntries + 1; i++) {
+        uint8_t k = i;
+        bool recent = i < maxEntries / 2 || i == maxEntries;
+        ASSERT_EQ(size_t(recent ? 1 : 0), mBC->get(&k, 1, NULL, 0)) << "key " << i;
+    }
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -311,6 +335,33 @@ TEST_F(BlobCacheFlattenTest, FlattenFullCache) {
     }
 }
 
+TEST_F(BlobCacheFlattenTest, FlattenKeepsLeastRecentlyUsedOrder) {
+    // Fill up the entire cache with 1 char key/value pairs, then use the
+    // entries again in reverse order.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, &k, 1);
+    }
+    for (int i = maxEntries - 1; i >= 0; i--) {
+        uint8_t k = i;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+
+    roundTrip();
+
+    // Overflowing the deserialized cache evicts the highest keys.
+    {
+        uint8_t k = maxEntries;
+        mBC2->set(&k, 1, &k, 1);
+    }
+    for (int i = 0; i < maxEntries + 1; i++) {
+        uint8_t k = i;
+        bool recent = i < maxEntries / 2 || i == maxEntries;
+        ASSERT_EQ(size_t(recent ? 1 : 0), mBC2->get(&k, 1, NULL, 0)) << "key " << i;
+    }
+}
+
 TEST_F(BlobCacheFlattenTest, FlattenDoesntChangeCache) {
     // Fill up the entire cache with 1 char key/value pairs.
     const int maxEntries = MAX_TOTAL_SIZE / 2;
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for LruCache get and put, and BlobCache set and get. All
+// report ns/op, an op being one get, put or set.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <benchmark.h>
+#include <utils/BlobCache.h>
+#include <utils/LruCache.h>
+
+using namespace android;
+
+static void BM_LruCache_get_hit(int iters, int n) {
+  LruCache<int, int> cache(n);
+  for (int j = 0; j < n; ++j) {
+    cache.put(j, j);
+  }
+  volatile int sink;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sink = cache.get(i % n);
+  }
+  StopBenchmarkTiming();
+  (void)sink;
+}
+BENCHMARK(BM_LruCache_get_hit)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_LruCache_get_miss(int iters, int n) {
+  LruCache<int, int> cache(n);
+  for (int j = 0; j < n; ++j) {
+    cache.put(j, j);
+  }
+  volatile int sink;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sink = cache.get(n + i);
+  }
+  StopBenchmarkTiming();
+  (void)sink;
+}
+BENCHMARK(BM_LruCache_get_miss)->Arg(16)->Arg(256)->Arg(4096);
+
+// Every put past the first n evicts the oldest entry.
+static void BM_LruCache_put_evict(int iters, int n) {
+  LruCache<int, int> cache(n);
+  for (int j = 0; j < n; ++j) {
+    cache.put(j, j);
+  }
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    cache.put(n + i, i);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_LruCache_put_evict)->Arg(16)->Arg(256)->Arg(4096);
+
+static const size_t kMaxKeySize = 64;
+static const size_t kMaxValueSize = 4096;
+static const size_t kMaxTotalSize = 1024 * 1024;
+
+static void BM_BlobCache_set(int iters, int value_size) {
+  BlobCache cache(kMaxKeySize, kMaxValueSize, kMaxTotalSize);
+  uint8_t value[kMaxValueSize];
+  memset(value, 0xa5, sizeof(value));
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    // the cache fills up and gets cleaned as it would in use
+    cache.set(&i, sizeof(i), value, value_size);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_BlobCache_set)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_BlobCache_get(int iters, int value_size) {
+  BlobCache cache(kMaxKeySize, kMaxValueSize, kMaxTotalSize);
+  uint8_t value[kMaxValueSize];
+  memset(value, 0xa5, sizeof(value));
+  // no more entries than fit without a clean
+  int n = kMaxTotalSize / 2 / (value_size + sizeof(int));
+  if (n > 1024) {
+    n = 1024;
+  }
+  for (int j = 0; j < n; ++j) {
+    cache.set(&j, sizeof(j), value, value_size);
+  }
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    int key = i % n;
+    cache.get(&key, sizeof(key), value, sizeof(value));
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_BlobCache_get)->Arg(16)->Arg(256)->Arg(4096);
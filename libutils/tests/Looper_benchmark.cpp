@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for Looper message passing: posting messages from the looper's
+// own thread and dispatching them, and the round trip of a wake() from
+// another thread. All report ns/op, an op being one message or wake.
+
+#include <pthread.h>
+
+#include <benchmark.h>
+#include <utils/Looper.h>
+
+using namespace android;
+
+class CountingHandler : public MessageHandler {
+ public:
+  CountingHandler() : count(0) {}
+  virtual void handleMessage(const Message&) { ++count; }
+  int count;
+};
+
+static void BM_Looper_send_dispatch(int iters, int batch) {
+  sp<Looper> looper = new Looper(false);
+  sp<CountingHandler> handler = new CountingHandler;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += batch) {
+    for (int j = 0; j < batch; ++j) {
+      looper->sendMessage(handler, Message(j));
+    }
+    while (handler->count < i + batch) {
+      looper->pollOnce(0);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_Looper_send_dispatch)->Arg(1)->Arg(16)->Arg(256);
+
+static void BM_Looper_pollOnce_idle(int iters) {
+  sp<Looper> looper = new Looper(false);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    looper->pollOnce(0);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_Looper_pollOnce_idle);
+
+struct PingPong {
+  sp<Looper> ping;
+  sp<Looper> pong;
+  int iters;
+};
+
+static void* ponger(void* arg) {
+  PingPong* pp = static_cast<PingPong*>(arg);
+  for (int i = 0; i < pp->iters; ++i) {
+    pp->pong->pollOnce(-1);
+    pp->ping->wake();
+  }
+  return NULL;
+}
+
+// A wake() of a looper polling on another thread, answered by a wake() back.
+static void BM_Looper_wake_round_trip(int iters) {
+  PingPong pp = { new Looper(false), new Looper(false), iters };
+  pthread_t thread;
+  pthread_create(&thread, NULL, ponger, &pp);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    pp.pong->wake();
+    pp.ping->pollOnce(-1);
+  }
+  StopBenchmarkTiming();
+  pthread_join(thread, NULL);
+}
+BENCHMARK(BM_Looper_wake_round_trip);
@@ -15,6 +15,7 @@
  */
 
 #include <stdlib.h>
+#include <utils/FixedLruCache.h>
 #include <utils/JenkinsHash.h>
 #include <utils/LruCache.h>
 #include <cutils/log.h>
@@ -79,6 +80,7 @@ ssize_t ComplexValue::instanceCount = 0;
 namespace android {
 
 typedef LruCache<ComplexKey, ComplexValue> ComplexCache;
+typedef FixedLruCache<ComplexKey, ComplexValue> FixedComplexCache;
 
 template<> inline android::hash_t hash_type(const ComplexKey& value) {
     return hash_type(value.k);
@@ -293,4 +295,115 @@ TEST_F(LruCacheTest, CallbackOnClear) {
     EXPECT_EQ(3, callback.callbackCount);
 }
 
+TEST_F(LruCacheTest, FixedSimple) {
+    FixedLruCache<SimpleKey, StringValue> cache(100);
+
+    EXPECT_EQ(NULL, cache.get(0));
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_FALSE(cache.put(3, "tres"));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_EQ(3u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedMaxCapacity) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    EXPECT_STREQ("one", cache.get(1));
+    cache.put(3, "three");
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_EQ(NULL, cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_EQ(2u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedIteratesOldestFirst) {
+    FixedLruCache<SimpleKey, StringValue> cache(100);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    cache.get(1);
+
+    FixedLruCache<SimpleKey, StringValue>::Iterator it(cache);
+    ASSERT_TRUE(it.next());
+    EXPECT_EQ(2, it.key());
+    ASSERT_TRUE(it.next());
+    EXPECT_EQ(3, it.key());
+    ASSERT_TRUE(it.next());
+    EXPECT_EQ(1, it.key());
+    EXPECT_FALSE(it.next());
+}
+
+TEST_F(LruCacheTest, FixedMatchesLruCache) {
+    // Few distinct slots, so that removals shift long probe sequences.
+    const size_t kCacheSize = 64;
+    const size_t kNumKeys = 256;
+    LruCache<SimpleKey, StringValue> expected(kCacheSize);
+    FixedLruCache<SimpleKey, StringValue> cache(kCacheSize);
+    const char* value = "value";
+
+    srandom(12345);
+    for (size_t i = 0; i < 100000; i++) {
+        int key = random() % kNumKeys;
+        switch (random() % 3) {
+        case 0:
+            ASSERT_EQ(expected.get(key), cache.get(key));
+            break;
+        case 1:
+            // LruCache::put() evicts even when the key is already present
+            if (expected.get(key) == NULL) {
+                expected.put(key, value);
+            }
+            if (cache.get(key) == NULL) {
+                cache.put(key, value);
+            }
+            break;
+        default:
+            ASSERT_EQ(expected.remove(key), cache.remove(key));
+            break;
+        }
+        ASSERT_EQ(expected.size(), cache.size());
+    }
+}
+
+TEST_F(LruCacheTest, FixedCallback) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+    EntryRemovedCallback callback;
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_EQ(1, callback.callbackCount);
+    EXPECT_EQ(1, callback.lastKey);
+    EXPECT_STREQ("one", callback.lastValue);
+    cache.clear();
+    EXPECT_EQ(3, callback.callbackCount);
+}
+
+TEST_F(LruCacheTest, FixedNoLeak) {
+    {
+        FixedComplexCache cache(100);
+
+        cache.put(ComplexKey(0), ComplexValue(0));
+        cache.put(ComplexKey(1), ComplexValue(1));
+        cache.put(ComplexKey(2), ComplexValue(2));
+        EXPECT_EQ(3U, cache.size());
+        assertInstanceCount(3, 4);  // the null value counts as an instance
+        cache.removeOldest();
+        assertInstanceCount(2, 3);
+        cache.clear();
+        assertInstanceCount(0, 1);
+        cache.put(ComplexKey(0), ComplexValue(0));
+        assertInstanceCount(1, 2);
+    }
+    assertInstanceCount(0, 0);
+}
+
 }
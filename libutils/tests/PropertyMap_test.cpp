@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <utils/PropertyMap.h>
+#include <utils/String8.h>
+
+using namespace android;
+
+class PropertyMapTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        mPath = String8(getenv("TMPDIR") ? getenv("TMPDIR") : "/data/local/tmp");
+        mPath.appendFormat("/PropertyMap_test.%d", getpid());
+    }
+
+    virtual void TearDown() {
+        unlink(mPath.string());
+    }
+
+    PropertyMap* load(const char* contents) {
+        FILE* f = fopen(mPath.string(), "w");
+        if (f == NULL) {
+            ADD_FAILURE() << "can't create " << mPath.string();
+            return NULL;
+        }
+        fputs(contents, f);
+        fclose(f);
+
+        PropertyMap* map;
+        if (PropertyMap::load(mPath, &map) != NO_ERROR) {
+            return NULL;
+        }
+        return map;
+    }
+
+    String8 mPath;
+};
+
+TEST_F(PropertyMapTest, LoadsFile) {
+    PropertyMap* map = load(
+            "# Comment\n"
+            "touch.deviceType = touchScreen\n"
+            "  touch.orientationAware=1\r\n"
+            "\n"
+            "cursor.scale = 1.5\n"
+            "device.internal = 0");
+    ASSERT_TRUE(map != NULL);
+
+    String8 stringValue;
+    EXPECT_TRUE(map->tryGetProperty(String8("touch.deviceType"), stringValue));
+    EXPECT_STREQ("touchScreen", stringValue.string());
+
+    bool boolValue = false;
+    EXPECT_TRUE(map->tryGetProperty(String8("touch.orientationAware"), boolValue));
+    EXPECT_TRUE(boolValue);
+
+    float floatValue = 0;
+    EXPECT_TRUE(map->tryGetProperty(String8("cursor.scale"), floatValue));
+    EXPECT_EQ(1.5f, floatValue);
+
+    int32_t intValue = -1;
+    EXPECT_TRUE(map->tryGetProperty(String8("device.internal"), intValue));
+    EXPECT_EQ(0, intValue);
+
+    EXPECT_FALSE(map->tryGetProperty(String8("touch.deviceType"), intValue));
+    EXPECT_FALSE(map->hasProperty(String8("touch")));
+
+    const KeyedVector<String8, String8>& properties = map->getProperties();
+    ASSERT_EQ(4U, properties.size());
+    EXPECT_STREQ("1.5", properties.valueFor(String8("cursor.scale")).string());
+
+    delete map;
+}
+
+TEST_F(PropertyMapTest, RejectsBadFiles) {
+    EXPECT_TRUE(load("a = 1\nb = 2\na = 3\n") == NULL);
+    EXPECT_TRUE(load("a = \"quoted\"\n") == NULL);
+    EXPECT_TRUE(load("a 1\n") == NULL);
+    EXPECT_TRUE(load("a = 1 2\n") == NULL);
+}
+
+TEST_F(PropertyMapTest, AddAndReplace) {
+    PropertyMap map;
+    for (int i = 0; i < 100; i++) {
+        map.addProperty(String8::format("key%d", i), String8::format("%d", i));
+    }
+    map.addProperty(String8("key7"), String8("seven"));
+
+    int32_t intValue;
+    for (int i = 0; i < 100; i++) {
+        if (i == 7) continue;
+        ASSERT_TRUE(map.tryGetProperty(String8::format("key%d", i), intValue));
+        EXPECT_EQ(i, intValue);
+    }
+    String8 stringValue;
+    EXPECT_TRUE(map.tryGetProperty(String8("key7"), stringValue));
+    EXPECT_STREQ("seven", stringValue.string());
+    EXPECT_EQ(100U, map.getProperties().size());
+
+    map.clear();
+    EXPECT_FALSE(map.hasProperty(String8("key1")));
+    EXPECT_EQ(0U, map.getProperties().size());
+}
+
+TEST_F(PropertyMapTest, AddAllOutlivesSource) {
+    PropertyMap* loaded = load("a = 1\nb = 2\n");
+    ASSERT_TRUE(loaded != NULL);
+
+    PropertyMap map;
+    map.addProperty(String8("b"), String8("old"));
+    map.addAll(loaded);
+    delete loaded;
+
+    PropertyMap copy(map);
+    map.clear();
+
+    String8 value;
+    EXPECT_TRUE(copy.tryGetProperty(String8("a"), value));
+    EXPECT_STREQ("1", value.string());
+    EXPECT_TRUE(copy.tryGetProperty(String8("b"), value));
+    EXPECT_STREQ("2", value.string());
+}
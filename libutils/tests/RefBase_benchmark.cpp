@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for the reference counting of RefBase: copying sp<> and wp<>,
+// promoting a wp<> and creating and destroying objects. All report ns/op.
+
+#include <benchmark.h>
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+using namespace android;
+
+class Counted : public RefBase {
+};
+
+class LightCounted : public LightRefBase<LightCounted> {
+};
+
+static void BM_sp_copy(int iters) {
+  sp<Counted> p(new Counted);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<Counted> copy(p);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_sp_copy);
+
+static void BM_sp_copy_light(int iters) {
+  sp<LightCounted> p(new LightCounted);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<LightCounted> copy(p);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_sp_copy_light);
+
+static void BM_wp_copy(int iters) {
+  sp<Counted> p(new Counted);
+  wp<Counted> w(p);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    wp<Counted> copy(w);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_wp_copy);
+
+static void BM_wp_promote(int iters) {
+  sp<Counted> p(new Counted);
+  wp<Counted> w(p);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<Counted> promoted = w.promote();
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_wp_promote);
+
+static void BM_wp_promote_dead(int iters) {
+  wp<Counted> w;
+  {
+    sp<Counted> p(new Counted);
+    w = p;
+  }
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<Counted> promoted = w.promote();
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_wp_promote_dead);
+
+static void BM_sp_new_delete(int iters) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<Counted> p(new Counted);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_sp_new_delete);
+
+static void BM_sp_new_delete_light(int iters) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sp<LightCounted> p(new LightCounted);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_sp_new_delete_light);
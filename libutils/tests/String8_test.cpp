@@ -72,4 +72,29 @@ TEST_F(String8Test, OperatorPlusEquals) {
     EXPECT_STREQ(src3, " Verify me.");
 }
 
+TEST_F(String8Test, MoveConstructor) {
+    String8 src("Hello, world!");
+    const char* buf = src.string();
+
+    String8 dst(static_cast<String8&&>(src));
+    EXPECT_EQ(buf, dst.string());
+    EXPECT_STREQ(dst.string(), "Hello, world!");
+    EXPECT_TRUE(src.isEmpty());
+}
+
+TEST_F(String8Test, MoveAssignment) {
+    String8 src("Hello, world!");
+    const char* buf = src.string();
+
+    String8 dst("Goodbye");
+    dst = static_cast<String8&&>(src);
+    EXPECT_EQ(buf, dst.string());
+    EXPECT_STREQ(dst.string(), "Hello, world!");
+    EXPECT_TRUE(src.isEmpty());
+
+    // src is still usable after being moved from
+    src = "again";
+    EXPECT_STREQ(src.string(), "again");
+}
+
 }
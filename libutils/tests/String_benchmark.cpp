@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for String8 and String16 construction, appending and the
+// conversions between UTF-8 and UTF-16. All report ns/op.
+
+#include <benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+using namespace android;
+
+static const char kShort[] = "android.hardware.camera";
+static const char kLong[] =
+    "The quick brown fox jumps over the lazy dog, the five boxing wizards "
+    "jump quickly, and pack my box with five dozen liquor jugs.";
+static const char kNonAscii[] = "Sch\xc3\xb6n \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80";
+
+static void BM_String8_construct(int iters, const char* s) {
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    String8 str(s);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String8_construct)
+    ->Arg("short", kShort)->Arg("long", kLong)->Arg("non_ascii", kNonAscii);
+
+static void BM_String8_copy(int iters) {
+  String8 str(kLong);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    String8 copy(str);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String8_copy);
+
+static void BM_String8_append(int iters) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += 64) {
+    String8 str;
+    for (int j = 0; j < 64; ++j) {
+      str.append(kShort);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String8_append);
+
+static void BM_String8_appendFormat(int iters) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += 64) {
+    String8 str;
+    for (int j = 0; j < 64; ++j) {
+      str.appendFormat("%s=%d ", kShort, j);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String8_appendFormat);
+
+static void BM_String16_construct(int iters, const char* s) {
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    String16 str(s);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String16_construct)
+    ->Arg("short", kShort)->Arg("long", kLong)->Arg("non_ascii", kNonAscii);
+
+static void BM_String8_from_String16(int iters, const char* s) {
+  String16 str16(s);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    String8 str(str16);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_String8_from_String16)
+    ->Arg("short", kShort)->Arg("long", kLong)->Arg("non_ascii", kNonAscii);
+
+static void BM_String16_compare(int iters) {
+  String16 a(kLong);
+  String16 b(kLong);
+  volatile bool sink;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sink = (a == b);
+  }
+  StopBenchmarkTiming();
+  (void)sink;
+}
+BENCHMARK(BM_String16_compare);
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+#include <utility>
+
+using namespace android;
+
+class Foo : public RefBase {
+public:
+    Foo(bool* deleted) : mDeleted(deleted) { *mDeleted = false; }
+    ~Foo() { *mDeleted = true; }
+private:
+    bool* mDeleted;
+};
+
+class Bar : public Foo {
+public:
+    Bar(bool* deleted) : Foo(deleted) { }
+};
+
+TEST(StrongPointer, moveConstructorTransfersReference) {
+    bool deleted;
+    sp<Foo> foo = new Foo(&deleted);
+    sp<Foo> moved(std::move(foo));
+    EXPECT_EQ(NULL, foo.get());
+    EXPECT_EQ(1, moved->getStrongCount());
+    moved.clear();
+    EXPECT_TRUE(deleted);
+}
+
+TEST(StrongPointer, moveAssignmentReleasesOldReference) {
+    bool deleted1, deleted2;
+    sp<Foo> foo1 = new Foo(&deleted1);
+    sp<Foo> foo2 = new Foo(&deleted2);
+    foo1 = std::move(foo2);
+    EXPECT_TRUE(deleted1);
+    EXPECT_FALSE(deleted2);
+    EXPECT_EQ(NULL, foo2.get());
+    EXPECT_EQ(1, foo1->getStrongCount());
+    foo1.clear();
+    EXPECT_TRUE(deleted2);
+}
+
+TEST(StrongPointer, moveFromDerivedType) {
+    bool deleted;
+    sp<Bar> bar = new Bar(&deleted);
+    sp<Foo> foo;
+    foo = std::move(bar);
+    EXPECT_EQ(NULL, bar.get());
+    EXPECT_EQ(1, foo->getStrongCount());
+    foo.clear();
+    EXPECT_TRUE(deleted);
+}
+
+TEST(StrongPointer, weakMoveKeepsWeakCount) {
+    bool deleted;
+    sp<Foo> foo = new Foo(&deleted);
+    wp<Foo> weak(foo);
+    int32_t weakCount = foo->getWeakRefs()->getWeakCount();
+    wp<Foo> moved(std::move(weak));
+    EXPECT_EQ(weakCount, foo->getWeakRefs()->getWeakCount());
+    EXPECT_TRUE(moved.promote() == foo);
+    foo.clear();
+    EXPECT_TRUE(deleted);
+    EXPECT_EQ(NULL, moved.promote().get());
+}
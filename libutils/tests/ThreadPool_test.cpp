@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utils/Atomic.h>
+#include <utils/ThreadPool.h>
+#include <utils/Vector.h>
+
+using namespace android;
+
+class CountingTask : public ThreadPool::Task {
+public:
+    CountingTask(volatile int32_t* counter) : mCounter(counter) { }
+
+protected:
+    virtual void run() {
+        android_atomic_inc(mCounter);
+    }
+
+private:
+    volatile int32_t* mCounter;
+};
+
+class SumTask : public ThreadPool::Task {
+public:
+    SumTask(int from, int to) : mFrom(from), mTo(to), mSum(0) { }
+
+    int64_t sum() const { return mSum; }
+
+protected:
+    virtual void run() {
+        for (int i = mFrom; i < mTo; i++) {
+            mSum += i;
+        }
+    }
+
+private:
+    const int mFrom;
+    const int mTo;
+    int64_t mSum;
+};
+
+// Posts its children from inside the pool, then waits for them. There are
+// more of these than workers, so this only completes if waiting workers keep
+// running queued tasks.
+class ForkTask : public ThreadPool::Task {
+public:
+    ForkTask(const sp<ThreadPool>& pool, volatile int32_t* counter)
+        : mPool(pool), mCounter(counter) { }
+
+protected:
+    virtual void run() {
+        Vector<sp<ThreadPool::Task> > children;
+        for (int i = 0; i < 10; i++) {
+            sp<ThreadPool::Task> child = new CountingTask(mCounter);
+            ASSERT_EQ(NO_ERROR, mPool->post(child));
+            children.add(child);
+        }
+        for (size_t i = 0; i < children.size(); i++) {
+            mPool->wait(children[i]);
+        }
+    }
+
+private:
+    sp<ThreadPool> mPool;
+    volatile int32_t* mCounter;
+};
+
+TEST(ThreadPool, postBeforeStartFails) {
+    sp<ThreadPool> pool = new ThreadPool("test", 2);
+    volatile int32_t counter = 0;
+    EXPECT_EQ(INVALID_OPERATION, pool->post(new CountingTask(&counter)));
+}
+
+TEST(ThreadPool, waitReturnsResult) {
+    sp<ThreadPool> pool = new ThreadPool("test", 4);
+    ASSERT_EQ(NO_ERROR, pool->start());
+
+    Vector<sp<SumTask> > tasks;
+    for (int i = 0; i < 100; i++) {
+        sp<SumTask> task = new SumTask(i * 1000, (i + 1) * 1000);
+        ASSERT_EQ(NO_ERROR, pool->post(task));
+        tasks.add(task);
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        tasks[i]->wait();
+        EXPECT_TRUE(tasks[i]->isDone());
+        sum += tasks[i]->sum();
+    }
+    EXPECT_EQ(int64_t(99999) * 100000 / 2, sum);
+}
+
+TEST(ThreadPool, shutdownRunsQueuedTasks) {
+    sp<ThreadPool> pool = new ThreadPool("test", 2);
+    ASSERT_EQ(NO_ERROR, pool->start());
+
+    volatile int32_t counter = 0;
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_EQ(NO_ERROR, pool->post(new CountingTask(&counter)));
+    }
+    pool->shutdown();
+    EXPECT_EQ(1000, counter);
+    EXPECT_EQ(INVALID_OPERATION, pool->post(new CountingTask(&counter)));
+}
+
+TEST(ThreadPool, tasksCanPostTasks) {
+    sp<ThreadPool> pool = new ThreadPool("test", 3);
+    ASSERT_EQ(NO_ERROR, pool->start());
+
+    volatile int32_t counter = 0;
+    Vector<sp<ThreadPool::Task> > tasks;
+    for (int i = 0; i < 10; i++) {
+        sp<ThreadPool::Task> task = new ForkTask(pool, &counter);
+        ASSERT_EQ(NO_ERROR, pool->post(task));
+        tasks.add(task);
+    }
+    for (size_t i = 0; i < tasks.size(); i++) {
+        tasks[i]->wait();
+    }
+    EXPECT_EQ(100, counter);
+    pool->shutdown();
+}
@@ -112,4 +112,31 @@ TEST_F(UnicodeTest, UTF8toUTF16Normal) {
             << "should be NULL terminated";
 }
 
+TEST_F(UnicodeTest, UTF8toUTF16LongASCIIWithNonASCII) {
+    // ASCII runs longer than a block on both sides of a U+0100
+    const uint8_t str[] = "0123456789abcdef\xC4\x80ghijklmnopqrstuvwxyz";
+    const size_t len = sizeof(str) - 1;
+
+    ASSERT_EQ(37, utf8_to_utf16_length(str, len));
+
+    char16_t output[37 + 1];
+    utf8_to_utf16(str, len, output);
+    for (size_t i = 0; i < 16; i++) {
+        EXPECT_EQ(str[i], output[i]);
+    }
+    EXPECT_EQ(0x0100, output[16])
+            << "should be U+0100";
+    for (size_t i = 17; i < 37; i++) {
+        EXPECT_EQ(str[i + 1], output[i]);
+    }
+    EXPECT_EQ(NULL, output[37])
+            << "should be NULL terminated";
+
+    ASSERT_EQ((ssize_t) len, utf16_to_utf8_length(output, 37));
+
+    char back[sizeof(str)];
+    utf16_to_utf8(output, 37, back);
+    EXPECT_STREQ((const char*) str, back);
+}
+
 }
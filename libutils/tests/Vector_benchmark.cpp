@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for Vector, SortedVector and KeyedVector: appending, inserting
+// at the front, erasing and lookups, over a few sizes. All report ns/op,
+// an op being one element added, removed or looked up.
+
+#include <benchmark.h>
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/Vector.h>
+
+using namespace android;
+
+static void BM_Vector_add(int iters, int n) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += n) {
+    Vector<int> v;
+    for (int j = 0; j < n; ++j) {
+      v.add(j);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_Vector_add)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_Vector_insert_front(int iters, int n) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += n) {
+    Vector<int> v;
+    for (int j = 0; j < n; ++j) {
+      v.insertAt(j, 0);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_Vector_insert_front)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_Vector_remove_front(int iters, int n) {
+  Vector<int> full;
+  for (int j = 0; j < n; ++j) {
+    full.add(j);
+  }
+
+  for (int i = 0; i < iters; i += n) {
+    Vector<int> v(full);
+    v.editArray();  // the copy on write, outside of the timing
+    StartBenchmarkTiming();
+    for (int j = 0; j < n; ++j) {
+      v.removeAt(0);
+    }
+    StopBenchmarkTiming();
+  }
+}
+BENCHMARK(BM_Vector_remove_front)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_SortedVector_add(int iters, int n) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += n) {
+    SortedVector<int> v;
+    for (int j = 0; j < n; ++j) {
+      // spread over the vector rather than appended
+      v.add((j * 2654435761u) % n);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_SortedVector_add)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_SortedVector_indexOf(int iters, int n) {
+  SortedVector<int> v;
+  for (int j = 0; j < n; ++j) {
+    v.add(j);
+  }
+  volatile ssize_t sink;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sink = v.indexOf(i % n);
+  }
+  StopBenchmarkTiming();
+  (void)sink;
+}
+BENCHMARK(BM_SortedVector_indexOf)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_SortedVector_remove(int iters, int n) {
+  SortedVector<int> full;
+  for (int j = 0; j < n; ++j) {
+    full.add(j);
+  }
+
+  for (int i = 0; i < iters; i += n) {
+    SortedVector<int> v(full);
+    v.editArray();
+    StartBenchmarkTiming();
+    for (int j = 0; j < n; ++j) {
+      v.remove((j * 2654435761u) % n);
+    }
+    StopBenchmarkTiming();
+  }
+}
+BENCHMARK(BM_SortedVector_remove)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_KeyedVector_add(int iters, int n) {
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; i += n) {
+    KeyedVector<int, int> v;
+    for (int j = 0; j < n; ++j) {
+      v.add((j * 2654435761u) % n, j);
+    }
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_KeyedVector_add)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_KeyedVector_valueFor(int iters, int n) {
+  KeyedVector<int, int> v;
+  for (int j = 0; j < n; ++j) {
+    v.add(j, j);
+  }
+  volatile int sink;
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    sink = v.valueFor(i % n);
+  }
+  StopBenchmarkTiming();
+  (void)sink;
+}
+BENCHMARK(BM_KeyedVector_valueFor)->Arg(16)->Arg(256)->Arg(4096);
@@ -18,6 +18,9 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <cutils/log.h>
 #include <gtest/gtest.h>
@@ -25,6 +28,25 @@
 
 namespace android {
 
+// Counts copies and destructions. Marked as trivially movable, so Vector
+// is allowed to relocate it with memcpy() instead.
+struct Counted {
+    static int sCopies;
+    static int sLive;
+
+    int value;
+
+    Counted() : value(0) { sLive++; }
+    Counted(int v) : value(v) { sLive++; }
+    Counted(const Counted& o) : value(o.value) { sCopies++; sLive++; }
+    ~Counted() { sLive--; }
+};
+
+int Counted::sCopies = 0;
+int Counted::sLive = 0;
+
+ANDROID_TRIVIAL_MOVE_TRAIT(Counted)
+
 class VectorTest : public testing::Test {
 protected:
     virtual void SetUp() {
@@ -149,4 +171,184 @@ TEST_F(VectorTest, editArray_Shared) {
   }
 }
 
+TEST_F(VectorTest, TrivialMove_RelocatesWithoutCopying) {
+  Counted::sCopies = 0;
+  Counted::sLive = 0;
+  {
+    Vector<Counted> vector;
+    for (int i = 0; i < 100; i++) {
+      vector.insertAt(Counted(i), 0);
+    }
+    // one copy per insertion, none when the storage grows or items shift
+    EXPECT_EQ(100, Counted::sCopies);
+    EXPECT_EQ(100, Counted::sLive);
+
+    // shrinks the storage, relocating the survivors
+    vector.removeItemsAt(10, 80);
+    EXPECT_EQ(100, Counted::sCopies);
+    EXPECT_EQ(20, Counted::sLive);
+    ASSERT_EQ(20U, vector.size());
+    for (int i = 0; i < 10; i++) {
+      EXPECT_EQ(99 - i, vector[i].value);
+      EXPECT_EQ(9 - i, vector[i + 10].value);
+    }
+
+    // a shared buffer still has to be copied
+    Vector<Counted> other(vector);
+    vector.setCapacity(64);
+    EXPECT_EQ(120, Counted::sCopies);
+    EXPECT_EQ(40, Counted::sLive);
+  }
+  EXPECT_EQ(0, Counted::sLive);
+}
+
+// A key and the order it was added in, not trivially movable so that
+// sorting and merging go through the copy and destroy helpers.
+struct Keyed {
+    static int sLive;
+
+    int key;
+    int seq;
+
+    Keyed() : key(0), seq(0) { sLive++; }
+    Keyed(int k, int s) : key(k), seq(s) { sLive++; }
+    Keyed(const Keyed& o) : key(o.key), seq(o.seq) { sLive++; }
+    ~Keyed() { sLive--; }
+};
+
+int Keyed::sLive = 0;
+
+inline int compare_type(const Keyed& lhs, const Keyed& rhs) {
+    return lhs.key - rhs.key;
+}
+
+static int compareKeyed(const Keyed* lhs, const Keyed* rhs) {
+    return lhs->key - rhs->key;
+}
+
+TEST_F(VectorTest, Sort_LargeAndStable) {
+  Keyed::sLive = 0;
+  {
+    Vector<Keyed> vector;
+    for (int i = 0; i < 1000; i++) {
+      vector.add(Keyed((i * 7919) % 100, i));
+    }
+    ASSERT_EQ(NO_ERROR, vector.sort(compareKeyed));
+    ASSERT_EQ(1000U, vector.size());
+    for (size_t i = 1; i < vector.size(); i++) {
+      ASSERT_LE(vector[i - 1].key, vector[i].key);
+      if (vector[i - 1].key == vector[i].key) {
+        ASSERT_LT(vector[i - 1].seq, vector[i].seq);
+      }
+    }
+    EXPECT_EQ(1000, Keyed::sLive);
+
+    // sorting a sorted vector doesn't copy a shared buffer
+    Vector<Keyed> other(vector);
+    ASSERT_EQ(NO_ERROR, vector.sort(compareKeyed));
+    EXPECT_EQ(other.array(), vector.array());
+  }
+  EXPECT_EQ(0, Keyed::sLive);
+}
+
+TEST_F(VectorTest, SortedVector_MergeUnsorted) {
+  Keyed::sLive = 0;
+  {
+    SortedVector<Keyed> sorted;
+    for (int i = 0; i < 100; i += 2) {
+      sorted.add(Keyed(i, -1));
+    }
+
+    // odd keys, some even ones again, and keys twice
+    Vector<Keyed> items;
+    for (int i = 0; i < 300; i++) {
+      items.add(Keyed((i * 37) % 150, i));
+    }
+    ASSERT_EQ(NO_ERROR, sorted.merge(items));
+    ASSERT_EQ(150U, sorted.size());
+    for (int i = 0; i < 150; i++) {
+      ASSERT_EQ(i, sorted[i].key);
+      // the last of the items with the key, as with add()
+      int last = -1;
+      for (int j = 0; j < 300; j++) {
+        if ((j * 37) % 150 == i) last = j;
+      }
+      ASSERT_EQ(last, sorted[i].seq);
+    }
+    EXPECT_EQ(450, Keyed::sLive);
+  }
+  EXPECT_EQ(0, Keyed::sLive);
+}
+
+TEST_F(VectorTest, SortedVector_MergeSorted) {
+  Keyed::sLive = 0;
+  {
+    SortedVector<Keyed> sorted;
+    SortedVector<Keyed> other;
+    for (int i = 0; i < 100; i++) {
+      if (i % 3) sorted.add(Keyed(i, 0));
+      if (i % 2) other.add(Keyed(i, 1));
+    }
+    ASSERT_EQ(NO_ERROR, sorted.merge(other));
+    ASSERT_EQ(83U, sorted.size());
+    for (size_t i = 1; i < sorted.size(); i++) {
+      ASSERT_LT(sorted[i - 1].key, sorted[i].key);
+    }
+    for (size_t i = 0; i < sorted.size(); i++) {
+      EXPECT_EQ(sorted[i].key % 2 ? 1 : 0, sorted[i].seq);
+    }
+
+    // into an empty one
+    SortedVector<Keyed> empty;
+    ASSERT_EQ(NO_ERROR, empty.merge(other));
+    EXPECT_EQ(other.size(), empty.size());
+    EXPECT_EQ(133 + 50, Keyed::sLive);
+  }
+  EXPECT_EQ(0, Keyed::sLive);
+}
+
+TEST_F(VectorTest, KeyedVector_Merge) {
+  KeyedVector<String8, int> map;
+  map.add(String8("b"), 1);
+  map.add(String8("d"), 2);
+
+  Vector< key_value_pair_t<String8, int> > pairs;
+  pairs.add(key_value_pair_t<String8, int>(String8("c"), 3));
+  pairs.add(key_value_pair_t<String8, int>(String8("a"), 4));
+  pairs.add(key_value_pair_t<String8, int>(String8("d"), 5));
+  pairs.add(key_value_pair_t<String8, int>(String8("a"), 6));
+  ASSERT_EQ(NO_ERROR, map.merge(pairs));
+
+  ASSERT_EQ(4U, map.size());
+  EXPECT_EQ(6, map.valueFor(String8("a")));
+  EXPECT_EQ(1, map.valueFor(String8("b")));
+  EXPECT_EQ(3, map.valueFor(String8("c")));
+  EXPECT_EQ(5, map.valueFor(String8("d")));
+
+  KeyedVector<String8, int> other;
+  other.add(String8("b"), 7);
+  other.add(String8("e"), 8);
+  ASSERT_EQ(NO_ERROR, map.merge(other));
+  ASSERT_EQ(5U, map.size());
+  EXPECT_EQ(7, map.valueFor(String8("b")));
+  EXPECT_EQ(8, map.valueFor(String8("e")));
+}
+
+TEST_F(VectorTest, KeyedVector_IndexOfEquivalentKey) {
+  KeyedVector<String8, int> map;
+  for (int i = 0; i < 100; i++) {
+    map.add(String8::format("key%d", i), i);
+  }
+  for (int i = 0; i < 100; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%d", i);
+    ssize_t index = map.indexOfEquivalentKey(key);
+    ASSERT_GE(index, 0);
+    EXPECT_EQ(map.indexOfKey(String8(key)), index);
+    EXPECT_EQ(i, map.valueAt(index));
+  }
+  EXPECT_EQ(NAME_NOT_FOUND, map.indexOfEquivalentKey("key"));
+  EXPECT_EQ(NAME_NOT_FOUND, map.indexOfEquivalentKey("key100"));
+}
+
 } // namespace android
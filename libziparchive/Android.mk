@@ -83,3 +83,20 @@ LOCAL_STATIC_LIBRARIES := \
     libz \
     libutils
 include $(BUILD_HOST_NATIVE_TEST)
+
+# Open/find/extract benchmarks, using the harness from liblog's tests. Run with:
+#   adb shell /data/nativetest/ziparchive_benchmark/ziparchive_benchmark
+include $(CLEAR_VARS)
+LOCAL_MODULE := ziparchive_benchmark
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(common_c_flags)
+# No -Wold-style-cast, BENCHMARK() uses one.
+LOCAL_CPPFLAGS := -Wno-missing-field-initializers
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../liblog/tests
+LOCAL_SRC_FILES := \
+    ../liblog/tests/benchmark_main.cpp \
+    zip_archive_benchmark.cc \
+
+LOCAL_SHARED_LIBRARIES := liblog libbase
+LOCAL_STATIC_LIBRARIES := libziparchive libz libutils
+include $(BUILD_NATIVE_TEST)
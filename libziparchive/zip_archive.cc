@@ -27,8 +27,14 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
+#if !defined(_WIN32)
+#include <thread>
+#endif
 
 #include "base/file.h"
 #include "base/macros.h"  // TEMP_FAILURE_RETRY may or may not be in unistd
@@ -66,7 +72,8 @@ static const char* kErrorMessages[] = {
   "Inconsistent information",
   "Invalid entry name",
   "I/O Error",
-  "File mapping failed"
+  "File mapping failed",
+  "Entry is compressed or empty"
 };
 
 static const int32_t kErrorMessageUpperBound = 0;
@@ -113,7 +120,11 @@ static const int32_t kIoError = -11;
 // We were not able to mmap the central directory or entry contents.
 static const int32_t kMmapFailed = -12;
 
-static const int32_t kErrorMessageLowerBound = -13;
+// MapEntry was asked for an entry whose data isn't stored as is, or
+// which has no data to map.
+static const int32_t kEntryNotMappable = -13;
+
+static const int32_t kErrorMessageLowerBound = -14;
 
 /*
  * A Read-only Zip archive.
@@ -133,7 +144,18 @@ static const int32_t kErrorMessageLowerBound = -13;
  * the record structure.  However, this requires a private mapping of
  * every page that the Central Directory touches.  Easier to tuck a copy
  * of the string length into the hash table entry.
+ *
+ * Each entry also keeps the full hash of its name, so that a probe only
+ * touches the mapped directory once the hashes match.
  */
+struct ZipEntrySlot {
+  uint32_t hash;
+  // Of the name from the start of the mapped central directory, 0 for a
+  // free slot: a name always follows a CentralDirectoryRecord.
+  uint32_t name_offset;
+  uint16_t name_length;
+};
+
 struct ZipArchive {
   /* open Zip archive */
   const int fd;
@@ -153,7 +175,25 @@ struct ZipArchive {
    * ((4 * UINT16_MAX) / 3 + 1) which can safely fit into a uint32_t.
    */
   uint32_t hash_table_size;
-  ZipString* hash_table;
+  ZipEntrySlot* hash_table;
+
+  /*
+   * Whether the central directory was scanned into the hash table yet,
+   * and how that went. An archive opened lazily is scanned on its first
+   * lookup instead of by OpenArchive.
+   */
+  std::mutex parse_lock;
+  std::atomic<bool> parsed;
+  int32_t parse_result;
+
+  /*
+   * Indices of the used hash table slots sorted by name, for iterating
+   * over the entries with a given prefix. Only built on the first such
+   * iteration.
+   */
+  std::mutex sorted_lock;
+  bool sorted_built;
+  std::vector<uint32_t> sorted;
 
   ZipArchive(const int fd, bool assume_ownership) :
       fd(fd),
@@ -161,7 +201,10 @@ struct ZipArchive {
       directory_offset(0),
       num_entries(0),
       hash_table_size(0),
-      hash_table(NULL) {}
+      hash_table(NULL),
+      parsed(false),
+      parse_result(0),
+      sorted_built(false) {}
 
   ~ZipArchive() {
     if (close_file && fd >= 0) {
@@ -189,31 +232,58 @@ static uint32_t RoundUpPower2(uint32_t val) {
   return val;
 }
 
+/*
+ * Hashes the name eight bytes at a time, names in large archives tend to
+ * be long and share long prefixes.
+ */
 static uint32_t ComputeHash(const ZipString& name) {
-  uint32_t hash = 0;
-  uint16_t len = name.name_length;
   const uint8_t* str = name.name;
-
-  while (len--) {
-    hash = hash * 31 + *str++;
+  uint16_t len = name.name_length;
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len;
+
+  while (len >= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, str, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+    str += sizeof(word);
+    len -= sizeof(word);
   }
+  uint64_t tail = 0;
+  memcpy(&tail, str, len);
+  hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 29;
+
+  return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+static ZipString SlotName(const ZipArchive* archive, const ZipEntrySlot& slot) {
+  ZipString name;
+  name.name = reinterpret_cast<const uint8_t*>(archive->directory_map.getDataPtr()) +
+      slot.name_offset;
+  name.name_length = slot.name_length;
+  return name;
+}
 
-  return hash;
+static bool SlotMatches(const ZipArchive* archive, const ZipEntrySlot& slot,
+                        const uint32_t hash, const ZipString& name) {
+  return slot.hash == hash && slot.name_length == name.name_length &&
+      SlotName(archive, slot) == name;
 }
 
 /*
  * Convert a ZipEntry to a hash table index, verifying that it's in a
  * valid range.
  */
-static int64_t EntryToIndex(const ZipString* hash_table,
-                            const uint32_t hash_table_size,
-                            const ZipString& name) {
+static int64_t EntryToIndex(const ZipArchive* archive, const ZipString& name) {
+  const ZipEntrySlot* hash_table = archive->hash_table;
+  const uint32_t hash_table_size = archive->hash_table_size;
   const uint32_t hash = ComputeHash(name);
 
   // NOTE: (hash_table_size - 1) is guaranteed to be non-negative.
   uint32_t ent = hash & (hash_table_size - 1);
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent] == name) {
+  while (hash_table[ent].name_offset != 0) {
+    if (SlotMatches(archive, hash_table[ent], hash, name)) {
       return ent;
     }
 
@@ -227,17 +297,18 @@ static int64_t EntryToIndex(const ZipString* hash_table,
 /*
  * Add a new entry to the hash table.
  */
-static int32_t AddToHash(ZipString *hash_table, const uint64_t hash_table_size,
-                         const ZipString& name) {
-  const uint64_t hash = ComputeHash(name);
+static int32_t AddToHash(ZipArchive* archive, const ZipString& name) {
+  ZipEntrySlot* hash_table = archive->hash_table;
+  const uint32_t hash_table_size = archive->hash_table_size;
+  const uint32_t hash = ComputeHash(name);
   uint32_t ent = hash & (hash_table_size - 1);
 
   /*
    * We over-allocated the table, so we're guaranteed to find an empty slot.
    * Further, we guarantee that the hashtable size is not 0.
    */
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent] == name) {
+  while (hash_table[ent].name_offset != 0) {
+    if (SlotMatches(archive, hash_table[ent], hash, name)) {
       // We've found a duplicate entry. We don't accept it
       ALOGW("Zip: Found duplicate entry %.*s", name.name_length, name.name);
       return kDuplicateEntry;
@@ -245,7 +316,9 @@ static int32_t AddToHash(ZipString *hash_table, const uint64_t hash_table_size,
     ent = (ent + 1) & (hash_table_size - 1);
   }
 
-  hash_table[ent].name = name.name;
+  hash_table[ent].hash = hash;
+  hash_table[ent].name_offset = name.name -
+      reinterpret_cast<const uint8_t*>(archive->directory_map.getDataPtr());
   hash_table[ent].name_length = name.name_length;
   return 0;
 }
@@ -409,8 +482,8 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
    * least one unused entry to avoid an infinite loop during creation.
    */
   archive->hash_table_size = RoundUpPower2(1 + (num_entries * 4) / 3);
-  archive->hash_table = reinterpret_cast<ZipString*>(calloc(archive->hash_table_size,
-      sizeof(ZipString)));
+  archive->hash_table = reinterpret_cast<ZipEntrySlot*>(calloc(archive->hash_table_size,
+      sizeof(ZipEntrySlot)));
 
   /*
    * Walk through the central directory, adding entries to the hash
@@ -452,8 +525,7 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
     ZipString entry_name;
     entry_name.name = file_name;
     entry_name.name_length = file_name_length;
-    const int add_result = AddToHash(archive->hash_table,
-        archive->hash_table_size, entry_name);
+    const int add_result = AddToHash(archive, entry_name);
     if (add_result != 0) {
       ALOGW("Zip: Error adding entry to hash table %d", add_result);
       return add_result;
@@ -471,28 +543,49 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
   return 0;
 }
 
+/*
+ * Scans the central directory the first time it's needed, from whichever
+ * thread gets there first.
+ *
+ * Returns 0 on success.
+ */
+static int32_t EnsureParsed(ZipArchive* archive) {
+  if (archive->parsed.load(std::memory_order_acquire)) {
+    return archive->parse_result;
+  }
+
+  std::lock_guard<std::mutex> lock(archive->parse_lock);
+  if (!archive->parsed.load(std::memory_order_relaxed)) {
+    archive->parse_result = ParseZipArchive(archive);
+    archive->parsed.store(true, std::memory_order_release);
+  }
+  return archive->parse_result;
+}
+
 static int32_t OpenArchiveInternal(ZipArchive* archive,
-                                   const char* debug_file_name) {
+                                   const char* debug_file_name, bool lazy) {
   int32_t result = -1;
   if ((result = MapCentralDirectory(archive->fd, debug_file_name, archive))) {
     return result;
   }
 
-  if ((result = ParseZipArchive(archive))) {
+  if (!lazy && (result = EnsureParsed(archive))) {
     return result;
   }
 
   return 0;
 }
 
-int32_t OpenArchiveFd(int fd, const char* debug_file_name,
-                      ZipArchiveHandle* handle, bool assume_ownership) {
+static int32_t OpenArchiveFdInternal(int fd, const char* debug_file_name,
+                                     ZipArchiveHandle* handle, bool assume_ownership,
+                                     bool lazy) {
   ZipArchive* archive = new ZipArchive(fd, assume_ownership);
   *handle = archive;
-  return OpenArchiveInternal(archive, debug_file_name);
+  return OpenArchiveInternal(archive, debug_file_name, lazy);
 }
 
-int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
+static int32_t OpenArchiveFileInternal(const char* fileName, ZipArchiveHandle* handle,
+                                       bool lazy) {
   const int fd = open(fileName, O_RDONLY | O_BINARY, 0);
   ZipArchive* archive = new ZipArchive(fd, true);
   *handle = archive;
@@ -502,7 +595,25 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
     return kIoError;
   }
 
-  return OpenArchiveInternal(archive, fileName);
+  return OpenArchiveInternal(archive, fileName, lazy);
+}
+
+int32_t OpenArchiveFd(int fd, const char* debug_file_name,
+                      ZipArchiveHandle* handle, bool assume_ownership) {
+  return OpenArchiveFdInternal(fd, debug_file_name, handle, assume_ownership, false);
+}
+
+int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
+  return OpenArchiveFileInternal(fileName, handle, false);
+}
+
+int32_t OpenArchiveFdLazy(int fd, const char* debug_file_name,
+                          ZipArchiveHandle* handle, bool assume_ownership) {
+  return OpenArchiveFdInternal(fd, debug_file_name, handle, assume_ownership, true);
+}
+
+int32_t OpenArchiveLazy(const char* fileName, ZipArchiveHandle* handle) {
+  return OpenArchiveFileInternal(fileName, handle, true);
 }
 
 /*
@@ -514,25 +625,6 @@ void CloseArchive(ZipArchiveHandle handle) {
   delete archive;
 }
 
-static int32_t UpdateEntryFromDataDescriptor(int fd,
-                                             ZipEntry *entry) {
-  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
-  ssize_t actual = TEMP_FAILURE_RETRY(read(fd, ddBuf, sizeof(ddBuf)));
-  if (actual != sizeof(ddBuf)) {
-    return kIoError;
-  }
-
-  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
-  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
-  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
-
-  entry->crc32 = descriptor->crc32;
-  entry->compressed_length = descriptor->compressed_size;
-  entry->uncompressed_length = descriptor->uncompressed_size;
-
-  return 0;
-}
-
 // Attempts to read |len| bytes into |buf| at offset |off|.
 //
 // This method uses pread64 on platforms that support it and
@@ -556,14 +648,37 @@ static inline ssize_t ReadAtOffset(int fd, uint8_t* buf, size_t len,
 #endif
 }
 
+// The data descriptor follows the entry's data.
+static int32_t UpdateEntryFromDataDescriptor(int fd,
+                                             ZipEntry *entry) {
+  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
+  ssize_t actual = ReadAtOffset(fd, ddBuf, sizeof(ddBuf),
+                                entry->offset + entry->compressed_length);
+  if (actual != sizeof(ddBuf)) {
+    return kIoError;
+  }
+
+  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
+  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
+  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
+
+  entry->crc32 = descriptor->crc32;
+  entry->compressed_length = descriptor->compressed_size;
+  entry->uncompressed_length = descriptor->uncompressed_size;
+
+  return 0;
+}
+
+
 static int32_t FindEntry(const ZipArchive* archive, const int ent,
                          ZipEntry* data) {
-  const uint16_t nameLen = archive->hash_table[ent].name_length;
+  const ZipString entry_name = SlotName(archive, archive->hash_table[ent]);
+  const uint16_t nameLen = entry_name.name_length;
 
   // Recover the start of the central directory entry from the filename
   // pointer.  The filename is the first entry past the fixed-size data,
   // so we can just subtract back from that.
-  const uint8_t* ptr = archive->hash_table[ent].name;
+  const uint8_t* ptr = entry_name.name;
   ptr -= sizeof(CentralDirectoryRecord);
 
   // This is the base of our mmapped region, we have to sanity check that
@@ -655,7 +770,7 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
       return kIoError;
     }
 
-    if (memcmp(archive->hash_table[ent].name, name_buf, nameLen)) {
+    if (memcmp(entry_name.name, name_buf, nameLen)) {
       free(name_buf);
       return kInconsistentInformation;
     }
@@ -691,7 +806,37 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
   return 0;
 }
 
+/*
+ * Orders names the way memcmp does, a name before any longer name it
+ * starts.
+ */
+static bool NameLess(const ZipString& lhs, const ZipString& rhs) {
+  const int cmp = memcmp(lhs.name, rhs.name, std::min(lhs.name_length, rhs.name_length));
+  return cmp < 0 || (cmp == 0 && lhs.name_length < rhs.name_length);
+}
+
+static void BuildSortedIndex(ZipArchive* archive) {
+  std::lock_guard<std::mutex> lock(archive->sorted_lock);
+  if (archive->sorted_built) {
+    return;
+  }
+
+  archive->sorted.reserve(archive->num_entries);
+  for (uint32_t i = 0; i < archive->hash_table_size; ++i) {
+    if (archive->hash_table[i].name_offset != 0) {
+      archive->sorted.push_back(i);
+    }
+  }
+  std::sort(archive->sorted.begin(), archive->sorted.end(),
+            [archive](uint32_t lhs, uint32_t rhs) {
+              return NameLess(SlotName(archive, archive->hash_table[lhs]),
+                              SlotName(archive, archive->hash_table[rhs]));
+            });
+  archive->sorted_built = true;
+}
+
 struct IterationHandle {
+  // Into the hash table, or with a prefix into archive->sorted.
   uint32_t position;
   // We're not using vector here because this code is used in the Windows SDK
   // where the STL is not available.
@@ -732,7 +877,17 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
                        const ZipString* optional_suffix) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
 
-  if (archive == NULL || archive->hash_table == NULL) {
+  if (archive == NULL) {
+    ALOGW("Zip: Invalid ZipArchiveHandle");
+    return kInvalidHandle;
+  }
+
+  const int32_t parse_result = EnsureParsed(archive);
+  if (parse_result != 0) {
+    return parse_result;
+  }
+
+  if (archive->hash_table == NULL) {
     ALOGW("Zip: Invalid ZipArchiveHandle");
     return kInvalidHandle;
   }
@@ -741,6 +896,17 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
   cookie->position = 0;
   cookie->archive = archive;
 
+  // The entries with a prefix are next to each other once sorted, so
+  // only those have to be looked at rather than the whole table.
+  if (cookie->prefix.name_length != 0) {
+    BuildSortedIndex(archive);
+    const std::vector<uint32_t>& sorted = archive->sorted;
+    cookie->position = std::lower_bound(sorted.begin(), sorted.end(), cookie->prefix,
+        [archive](uint32_t ent, const ZipString& prefix) {
+          return NameLess(SlotName(archive, archive->hash_table[ent]), prefix);
+        }) - sorted.begin();
+  }
+
   *cookie_ptr = cookie ;
   return 0;
 }
@@ -751,14 +917,18 @@ void EndIteration(void* cookie) {
 
 int32_t FindEntry(const ZipArchiveHandle handle, const ZipString& entryName,
                   ZipEntry* data) {
-  const ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   if (entryName.name_length == 0) {
     ALOGW("Zip: Invalid filename %.*s", entryName.name_length, entryName.name);
     return kInvalidEntryName;
   }
 
-  const int64_t ent = EntryToIndex(archive->hash_table,
-    archive->hash_table_size, entryName);
+  const int32_t parse_result = EnsureParsed(archive);
+  if (parse_result != 0) {
+    return parse_result;
+  }
+
+  const int64_t ent = EntryToIndex(archive, entryName);
 
   if (ent < 0) {
     ALOGV("Zip: Could not find entry %.*s", entryName.name_length, entryName.name);
@@ -782,22 +952,42 @@ int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
 
   const uint32_t currentOffset = handle->position;
   const uint32_t hash_table_length = archive->hash_table_size;
-  const ZipString* hash_table = archive->hash_table;
+  const ZipEntrySlot* hash_table = archive->hash_table;
 
-  for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
-    if (hash_table[i].name != NULL &&
-        (handle->prefix.name_length == 0 ||
-         hash_table[i].StartsWith(handle->prefix)) &&
-        (handle->suffix.name_length == 0 ||
-         hash_table[i].EndsWith(handle->suffix))) {
-      handle->position = (i + 1);
-      const int error = FindEntry(archive, i, data);
-      if (!error) {
-        name->name = hash_table[i].name;
-        name->name_length = hash_table[i].name_length;
+  if (handle->prefix.name_length != 0) {
+    const std::vector<uint32_t>& sorted = archive->sorted;
+    for (uint32_t i = currentOffset; i < sorted.size(); ++i) {
+      const ZipString entry_name = SlotName(archive, hash_table[sorted[i]]);
+      if (!entry_name.StartsWith(handle->prefix)) {
+        break;
+      }
+      if (handle->suffix.name_length == 0 || entry_name.EndsWith(handle->suffix)) {
+        handle->position = (i + 1);
+        const int error = FindEntry(archive, sorted[i], data);
+        if (!error) {
+          *name = entry_name;
+        }
+
+        return error;
       }
+    }
+
+    handle->position = sorted.size();
+    return kIterationEnd;
+  }
 
-      return error;
+  for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
+    if (hash_table[i].name_offset != 0) {
+      const ZipString entry_name = SlotName(archive, hash_table[i]);
+      if (handle->suffix.name_length == 0 || entry_name.EndsWith(handle->suffix)) {
+        handle->position = (i + 1);
+        const int error = FindEntry(archive, i, data);
+        if (!error) {
+          *name = entry_name;
+        }
+
+        return error;
+      }
     }
   }
 
@@ -808,6 +998,16 @@ int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
 class Writer {
  public:
   virtual bool Append(uint8_t* buf, size_t buf_size) = 0;
+
+  // Writers holding the whole destination in memory return it here,
+  // before anything was appended, so that the entry can be decompressed
+  // straight into it instead of going through Append. The data must not
+  // be Append'ed as well.
+  virtual uint8_t* GetBuffer(size_t* size) {
+    *size = 0;
+    return nullptr;
+  }
+
   virtual ~Writer() {}
  protected:
   Writer() = default;
@@ -836,12 +1036,33 @@ class MemoryWriter : public Writer {
     return true;
   }
 
+  virtual uint8_t* GetBuffer(size_t* size) override {
+    *size = size_;
+    return buf_;
+  }
+
  private:
   uint8_t* const buf_;
   const size_t size_;
   size_t bytes_written_;
 };
 
+// A Writer that hands the data to a ProcessZipEntryFunction.
+class FunctionWriter : public Writer {
+ public:
+  FunctionWriter(ProcessZipEntryFunction func, void* cookie) : Writer(),
+      func_(func), cookie_(cookie) {
+  }
+
+  virtual bool Append(uint8_t* buf, size_t buf_size) override {
+    return func_(buf, buf_size, cookie_);
+  }
+
+ private:
+  ProcessZipEntryFunction func_;
+  void* cookie_;
+};
+
 // A Writer that appends data to a file |fd| at its current position.
 // The file will be truncated to the end of the written data.
 class FileWriter : public Writer {
@@ -932,8 +1153,16 @@ static inline int zlib_inflateInit2(z_stream* stream, int window_bits) {
 static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
                                     Writer* writer, uint64_t* crc_out) {
   const size_t kBufSize = 32768;
-  std::vector<uint8_t> read_buf(kBufSize);
-  std::vector<uint8_t> write_buf(kBufSize);
+  // Fewer, larger reads of the compressed data; a read is far more
+  // expensive than the extra inflate work it feeds.
+  const size_t kReadBufSize = 4 * kBufSize;
+  std::vector<uint8_t> read_buf(kReadBufSize);
+
+  // When the whole destination is at hand, inflate into it directly,
+  // without copying each block out of an intermediate buffer.
+  size_t direct_size;
+  uint8_t* const direct_buf = writer->GetBuffer(&direct_size);
+  std::vector<uint8_t> write_buf(direct_buf == nullptr ? kBufSize : 0);
   z_stream zstream;
   int zerr;
 
@@ -946,8 +1175,13 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
   zstream.opaque = Z_NULL;
   zstream.next_in = NULL;
   zstream.avail_in = 0;
-  zstream.next_out = &write_buf[0];
-  zstream.avail_out = kBufSize;
+  if (direct_buf != nullptr) {
+    zstream.next_out = direct_buf;
+    zstream.avail_out = direct_size;
+  } else {
+    zstream.next_out = &write_buf[0];
+    zstream.avail_out = kBufSize;
+  }
   zstream.data_type = Z_UNKNOWN;
 
   /*
@@ -975,17 +1209,19 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
   const uint32_t uncompressed_length = entry->uncompressed_length;
 
   uint32_t compressed_length = entry->compressed_length;
+  off64_t offset = entry->offset;
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
-      const ZD_TYPE getSize = (compressed_length > kBufSize) ? kBufSize : compressed_length;
-      const ZD_TYPE actual = TEMP_FAILURE_RETRY(read(fd, &read_buf[0], getSize));
+      const ZD_TYPE getSize = (compressed_length > kReadBufSize) ? kReadBufSize : compressed_length;
+      const ZD_TYPE actual = ReadAtOffset(fd, &read_buf[0], getSize, offset);
       if (actual != getSize) {
         ALOGW("Zip: inflate read failed (" ZD " vs " ZD ")", actual, getSize);
         return kIoError;
       }
 
       compressed_length -= getSize;
+      offset += getSize;
 
       zstream.next_in = &read_buf[0];
       zstream.avail_in = getSize;
@@ -993,6 +1229,11 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
 
     /* uncompress the data */
     zerr = inflate(&zstream, Z_NO_FLUSH);
+    if (zerr == Z_BUF_ERROR && direct_buf != nullptr && zstream.avail_out == 0) {
+      // There's more data than room for it.
+      ALOGW("Zip: Unexpected size " ZD " (declared) vs more (actual)", direct_size);
+      return kInconsistentInformation;
+    }
     if (zerr != Z_OK && zerr != Z_STREAM_END) {
       ALOGW("Zip: inflate zerr=%d (nIn=%p aIn=%u nOut=%p aOut=%u)",
           zerr, zstream.next_in, zstream.avail_in,
@@ -1001,8 +1242,8 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
     }
 
     /* write when we're full or when we're done */
-    if (zstream.avail_out == 0 ||
-      (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
+    if (direct_buf == nullptr && (zstream.avail_out == 0 ||
+      (zerr == Z_STREAM_END && zstream.avail_out != kBufSize))) {
       const size_t write_size = zstream.next_out - &write_buf[0];
       if (!writer->Append(&write_buf[0], write_size)) {
         // The file might have declared a bogus length.
@@ -1042,7 +1283,7 @@ static int32_t CopyEntryToWriter(int fd, const ZipEntry* entry, Writer* writer,
     // Safe conversion because kBufSize is narrow enough for a 32 bit signed
     // value.
     const ssize_t block_size = (remaining > kBufSize) ? kBufSize : remaining;
-    const ssize_t actual = TEMP_FAILURE_RETRY(read(fd, &buf[0], block_size));
+    const ssize_t actual = ReadAtOffset(fd, &buf[0], block_size, entry->offset + count);
 
     if (actual != block_size) {
       ALOGW("CopyFileToFile: copy read failed (" ZD " vs " ZD ")", actual, block_size);
@@ -1065,13 +1306,9 @@ int32_t ExtractToWriter(ZipArchiveHandle handle,
                         ZipEntry* entry, Writer* writer) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   const uint16_t method = entry->method;
-  off64_t data_offset = entry->offset;
-
-  if (lseek64(archive->fd, data_offset, SEEK_SET) != data_offset) {
-    ALOGW("Zip: lseek to data at %" PRId64 " failed", static_cast<int64_t>(data_offset));
-    return kIoError;
-  }
 
+  // Everything is read with ReadAtOffset, so that entries can be
+  // extracted from several threads at once, see ExtractEntries.
   // this should default to kUnknownCompressionMethod.
   int32_t return_value = -1;
   uint64_t crc = 0;
@@ -1114,6 +1351,91 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle,
   return ExtractToWriter(handle, entry, writer.get());
 }
 
+int32_t ProcessZipEntryContents(ZipArchiveHandle handle, ZipEntry* entry,
+                                ProcessZipEntryFunction func, void* cookie) {
+  FunctionWriter writer(func, cookie);
+  return ExtractToWriter(handle, entry, &writer);
+}
+
+static int32_t ExtractOne(ZipArchiveHandle handle, ZipExtraction* extraction) {
+  if (extraction->fd >= 0) {
+    return ExtractEntryToFile(handle, extraction->entry, extraction->fd);
+  }
+  return ExtractToMemory(handle, extraction->entry, extraction->begin, extraction->size);
+}
+
+int32_t ExtractEntries(ZipArchiveHandle handle, ZipExtraction* extractions,
+                       size_t count, size_t num_threads) {
+#if defined(_WIN32)
+  // ReadAtOffset moves the shared file offset there.
+  num_threads = 1;
+#else
+  if (num_threads == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = (cpus > 0) ? cpus : 1;
+  }
+#endif
+  num_threads = std::min(num_threads, count);
+
+  // Biggest first, so that one large entry doesn't start last and leave
+  // the other threads idle while it finishes.
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [extractions](size_t a, size_t b) {
+    return extractions[a].entry->uncompressed_length > extractions[b].entry->uncompressed_length;
+  });
+
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    size_t i;
+    while ((i = next++) < count) {
+      ZipExtraction* extraction = &extractions[order[i]];
+      extraction->result = ExtractOne(handle, extraction);
+    }
+  };
+
+#if !defined(_WIN32)
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+#else
+  work();
+#endif
+
+  for (size_t i = 0; i < count; ++i) {
+    if (extractions[i].result) {
+      return extractions[i].result;
+    }
+  }
+  return 0;
+}
+
+int32_t MapEntry(const ZipArchiveHandle handle, const ZipEntry* entry,
+                 android::FileMap* map) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+
+  if (entry->method != kCompressStored || entry->compressed_length == 0) {
+    return kEntryNotMappable;
+  }
+
+  // FindEntry has already checked that the data lies before the central
+  // directory.
+  if (!map->create(NULL, archive->fd, entry->offset, entry->compressed_length,
+                   true /* read only */)) {
+    ALOGW("Zip: failed to map entry at %" PRId64, static_cast<int64_t>(entry->offset));
+    return kMmapFailed;
+  }
+
+  return 0;
+}
+
 const char* ErrorCodeString(int32_t error_code) {
   if (error_code > kErrorMessageLowerBound && error_code < kErrorMessageUpperBound) {
     return kErrorMessages[error_code * -1];
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for opening, searching and extracting from zip files, run
+// against archives generated with ZipWriter on first use: APK-like ones
+// with 10, 1k and 50k small deflated entries, and ones holding a single
+// stored or deflated entry from 4 KiB to 64 MiB. The open/find/iterate
+// benchmarks report ns per operation, the extraction ones MB/s.
+//
+// Build with "mmm system/core/libziparchive" and run with:
+//   adb shell /data/nativetest/ziparchive_benchmark/ziparchive_benchmark [regex]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/stringprintf.h>
+#include <benchmark.h>
+
+#include "ziparchive/zip_archive.h"
+#include "ziparchive/zip_writer.h"
+
+static void fail(const char* what) {
+  fprintf(stderr, "ziparchive_benchmark: %s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static void fail_zip(const char* what, int32_t error) {
+  fprintf(stderr, "ziparchive_benchmark: %s: %s\n", what, ErrorCodeString(error));
+  exit(1);
+}
+
+static std::string bench_dir;
+static std::map<std::string, std::string> archives;  // by description, see archive_path
+
+static void cleanup() {
+  for (auto& archive : archives) {
+    unlink(archive.second.c_str());
+  }
+  unlink((bench_dir + "/extracted").c_str());
+  rmdir(bench_dir.c_str());
+}
+
+static const std::string& scratch_dir() {
+  if (bench_dir.empty()) {
+    const char* tmp = getenv("TMPDIR");
+    std::string templ = std::string(tmp ? tmp : "/data/local/tmp") + "/ziparchive_benchmark-XXXXXX";
+    std::vector<char> dir(templ.begin(), templ.end());
+    dir.push_back('\0');
+    if (mkdtemp(dir.data()) == nullptr) fail("mkdtemp");
+    bench_dir = dir.data();
+    atexit(cleanup);
+  }
+  return bench_dir;
+}
+
+// Named like the resources of an app, which share long prefixes.
+static std::string entry_name(int i) {
+  return android::base::StringPrintf("res/drawable-xxhdpi-v4/ic_launcher_%05d.png", i);
+}
+
+// Text that deflates about as well as code and resources do.
+static std::vector<uint8_t> entry_data(size_t size, uint32_t seed) {
+  static const char kWords[][8] = { "android", "zip", "entry", "the", "of", "data", "<view>",
+                                    "0x7f01" };
+  std::vector<uint8_t> data;
+  data.reserve(size + 8);
+  while (data.size() < size) {
+    seed = seed * 1103515245 + 12345;
+    const char* word = kWords[(seed >> 16) % (sizeof(kWords) / sizeof(kWords[0]))];
+    data.insert(data.end(), word, word + strlen(word));
+    data.push_back(((seed >> 8) & 7) ? ' ' : '\n');
+  }
+  data.resize(size);
+  return data;
+}
+
+// An archive of |count| entries of |size| bytes, made on first use.
+static const std::string& archive_path(int count, size_t size, bool compress) {
+  std::string key = android::base::StringPrintf("%d-%zu-%s", count, size,
+                                                compress ? "deflated" : "stored");
+  auto it = archives.find(key);
+  if (it != archives.end()) {
+    return it->second;
+  }
+
+  std::string path = scratch_dir() + "/" + key + ".zip";
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) fail("fopen");
+  ZipWriter writer(file, 0);
+  const size_t flags = compress ? ZipWriter::kCompress : ZipWriter::kAlign32;
+  for (int i = 0; i < count; ++i) {
+    std::vector<uint8_t> data = entry_data(size, i);
+    int32_t error;
+    if ((error = writer.StartEntry(entry_name(i).c_str(), flags)) ||
+        (error = writer.WriteBytes(data.data(), data.size())) ||
+        (error = writer.FinishEntry())) {
+      fprintf(stderr, "ziparchive_benchmark: writing %s: %s\n", path.c_str(),
+              ZipWriter::ErrorCodeString(error));
+      exit(1);
+    }
+  }
+  if (writer.Finish() != 0) fail("ZipWriter::Finish");
+  fclose(file);
+
+  return archives[key] = path;
+}
+
+static ZipArchiveHandle open_archive(const std::string& path) {
+  ZipArchiveHandle handle;
+  int32_t error = OpenArchive(path.c_str(), &handle);
+  if (error) fail_zip("OpenArchive", error);
+  return handle;
+}
+
+static ZipEntry find_entry(ZipArchiveHandle handle, const std::string& name) {
+  ZipEntry entry;
+  int32_t error = FindEntry(handle, ZipString(name.c_str()), &entry);
+  if (error) fail_zip("FindEntry", error);
+  return entry;
+}
+
+/*
+ * OpenArchive and CloseArchive of an archive with |count| entries.
+ */
+static void BM_open_archive(int iters, int count) {
+  const std::string& path = archive_path(count, 512, true);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    CloseArchive(open_archive(path));
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_open_archive)->Arg(10)->Arg(1000)->Arg(50000);
+
+/*
+ * OpenArchiveLazy followed by the one FindEntry an app launch might do.
+ */
+static void BM_open_archive_lazy_find(int iters, int count) {
+  const std::string& path = archive_path(count, 512, true);
+  const std::string name = entry_name(count / 2);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    ZipArchiveHandle handle;
+    int32_t error = OpenArchiveLazy(path.c_str(), &handle);
+    if (error) fail_zip("OpenArchiveLazy", error);
+    find_entry(handle, name);
+    CloseArchive(handle);
+  }
+  StopBenchmarkTiming();
+}
+BENCHMARK(BM_open_archive_lazy_find)->Arg(10)->Arg(1000)->Arg(50000);
+
+/*
+ * FindEntry of entries spread over an archive with |count| entries.
+ */
+static void BM_find_entry(int iters, int count) {
+  ZipArchiveHandle handle = open_archive(archive_path(count, 512, true));
+  std::vector<std::string> names;
+  for (int i = 0; i < 64; ++i) {
+    names.push_back(entry_name((i * 7919) % count));
+  }
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    find_entry(handle, names[i % names.size()]);
+  }
+  StopBenchmarkTiming();
+
+  CloseArchive(handle);
+}
+BENCHMARK(BM_find_entry)->Arg(10)->Arg(1000)->Arg(50000);
+
+/*
+ * A StartIteration/Next walk over all of an archive with |count| entries;
+ * one iteration is one entry.
+ */
+static void BM_iterate(int iters, int count) {
+  ZipArchiveHandle handle = open_archive(archive_path(count, 512, true));
+
+  ZipEntry entry;
+  ZipString name;
+  void* cookie = nullptr;
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    if (i % count == 0) {
+      if (cookie) EndIteration(cookie);
+      int32_t error = StartIteration(handle, &cookie, nullptr, nullptr);
+      if (error) fail_zip("StartIteration", error);
+    }
+    int32_t error = Next(cookie, &entry, &name);
+    if (error) fail_zip("Next", error);
+  }
+  StopBenchmarkTiming();
+
+  if (cookie) EndIteration(cookie);
+  CloseArchive(handle);
+}
+BENCHMARK(BM_iterate)->Arg(10)->Arg(1000)->Arg(50000);
+
+static void extract_to_memory(int iters, size_t size, bool compress) {
+  ZipArchiveHandle handle = open_archive(archive_path(1, size, compress));
+  ZipEntry entry = find_entry(handle, entry_name(0));
+  std::vector<uint8_t> buffer(size);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    int32_t error = ExtractToMemory(handle, &entry, buffer.data(), buffer.size());
+    if (error) fail_zip("ExtractToMemory", error);
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * size);
+  CloseArchive(handle);
+}
+
+/*
+ * ExtractToMemory of a single |size| byte entry.
+ */
+static void BM_extract_to_memory_stored(int iters, int size) {
+  extract_to_memory(iters, size, false);
+}
+BENCHMARK(BM_extract_to_memory_stored)->Arg(4096)->Arg(1024 * 1024)->Arg(64 * 1024 * 1024);
+
+static void BM_extract_to_memory_deflated(int iters, int size) {
+  extract_to_memory(iters, size, true);
+}
+BENCHMARK(BM_extract_to_memory_deflated)->Arg(4096)->Arg(1024 * 1024)->Arg(64 * 1024 * 1024);
+
+/*
+ * ExtractEntryToFile of a single deflated |size| byte entry, into a file
+ * in the same directory as the archive.
+ */
+static void BM_extract_entry_to_file(int iters, int size) {
+  ZipArchiveHandle handle = open_archive(archive_path(1, size, true));
+  ZipEntry entry = find_entry(handle, entry_name(0));
+  std::string path = scratch_dir() + "/extracted";
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) fail("open");
+    int32_t error = ExtractEntryToFile(handle, &entry, fd);
+    if (error) fail_zip("ExtractEntryToFile", error);
+    close(fd);
+  }
+  StopBenchmarkTiming();
+
+  SetBenchmarkBytesProcessed(static_cast<uint64_t>(iters) * size);
+  CloseArchive(handle);
+}
+BENCHMARK(BM_extract_entry_to_file)->Arg(4096)->Arg(1024 * 1024)->Arg(64 * 1024 * 1024);
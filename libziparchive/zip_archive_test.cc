@@ -25,6 +25,7 @@
 
 #include <base/file.h>
 #include <gtest/gtest.h>
+#include <utils/FileMap.h>
 
 static std::string test_data_dir;
 
@@ -120,21 +121,21 @@ TEST(ziparchive, Iteration) {
   ZipEntry data;
   ZipString name;
 
-  // b/c.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/c.txt", name);
-
-  // b/d.txt
+  // b.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/d.txt", name);
+  AssertNameEquals("b.txt", name);
 
   // a.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("a.txt", name);
 
-  // b.txt
+  // b/d.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
+  AssertNameEquals("b/d.txt", name);
+
+  // b/c.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
 
   // b/
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
@@ -157,6 +158,10 @@ TEST(ziparchive, IterationWithPrefix) {
   ZipEntry data;
   ZipString name;
 
+  // b/
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/", name);
+
   // b/c.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/c.txt", name);
@@ -165,10 +170,6 @@ TEST(ziparchive, IterationWithPrefix) {
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/d.txt", name);
 
-  // b/
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/", name);
-
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
 
@@ -186,21 +187,21 @@ TEST(ziparchive, IterationWithSuffix) {
   ZipEntry data;
   ZipString name;
 
-  // b/c.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/c.txt", name);
-
-  // b/d.txt
+  // b.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/d.txt", name);
+  AssertNameEquals("b.txt", name);
 
   // a.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("a.txt", name);
 
-  // b.txt
+  // b/d.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
+  AssertNameEquals("b/d.txt", name);
+
+  // b/c.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
 
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
@@ -220,6 +221,10 @@ TEST(ziparchive, IterationWithPrefixAndSuffix) {
   ZipEntry data;
   ZipString name;
 
+  // b.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b.txt", name);
+
   // b/c.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/c.txt", name);
@@ -228,16 +233,47 @@ TEST(ziparchive, IterationWithPrefixAndSuffix) {
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/d.txt", name);
 
-  // b.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
-
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
 
   CloseArchive(handle);
 }
 
+TEST(ziparchive, IterationWithPrefixRestarts) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // Each iteration finds the entries of its own directory,
+  // whatever the other iterations did with the sorted index.
+  void* iteration_cookie;
+  ZipString prefix("b/");
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, &prefix, NULL));
+
+  void* other_cookie;
+  ZipString other_prefix("a");
+  ASSERT_EQ(0, StartIteration(handle, &other_cookie, &other_prefix, NULL));
+
+  ZipEntry data;
+  ZipString name;
+
+  ASSERT_EQ(0, Next(other_cookie, &data, &name));
+  AssertNameEquals("a.txt", name);
+  ASSERT_EQ(-1, Next(other_cookie, &data, &name));
+  EndIteration(other_cookie);
+
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/", name);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/d.txt", name);
+  ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
+  EndIteration(iteration_cookie);
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, IterationWithBadPrefixAndSuffix) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
@@ -282,6 +318,49 @@ TEST(ziparchive, FindEntry) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, OpenLazy) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveLazy((test_data_dir + "/" + kValidZip).c_str(), &handle));
+
+  ZipEntry data;
+  ZipString name;
+  name.name = kATxtName;
+  name.name_length = kATxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(63, data.offset);
+  ASSERT_EQ(static_cast<uint32_t>(17), data.uncompressed_length);
+
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, NULL, NULL));
+  int entries = 0;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    entries++;
+  }
+  ASSERT_EQ(5, entries);
+  EndIteration(iteration_cookie);
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, OpenFdLazyIterationFirst) {
+  int fd = open((test_data_dir + "/" + kValidZip).c_str(), O_RDONLY);
+  ASSERT_NE(-1, fd);
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFdLazy(fd, "OpenFdLazyIterationFirst", &handle));
+
+  void* iteration_cookie;
+  ZipString prefix("b/");
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, &prefix, NULL));
+
+  ZipEntry data;
+  ZipString name;
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/", name);
+  EndIteration(iteration_cookie);
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, TestInvalidDeclaredLength) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper("declaredlength.zip", &handle));
@@ -330,6 +409,133 @@ TEST(ziparchive, ExtractToMemory) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, ExtractToMemoryTooSmall) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // A deflated entry, which would be inflated straight into the buffer.
+  ZipEntry data;
+  ZipString a_name;
+  a_name.name = kATxtName;
+  a_name.name_length = kATxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, a_name, &data));
+  std::vector<uint8_t> buffer(data.uncompressed_length - 1);
+  ASSERT_GT(0, ExtractToMemory(handle, &data, &buffer[0], buffer.size()));
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntries) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  ZipString a_name;
+  a_name.name = kATxtName;
+  a_name.name_length = kATxtNameLength;
+  ZipString b_name;
+  b_name.name = kBTxtName;
+  b_name.name_length = kBTxtNameLength;
+  ZipEntry a_entry, b_entry, bad_entry;
+  ASSERT_EQ(0, FindEntry(handle, a_name, &a_entry));
+  ASSERT_EQ(0, FindEntry(handle, b_name, &b_entry));
+  ASSERT_EQ(0, FindEntry(handle, a_name, &bad_entry));
+
+  char output_file_pattern[] = "extract_entries_output_XXXXXX";
+  int output_fd = mkstemp(output_file_pattern);
+  ASSERT_NE(-1, output_fd);
+  unlink(output_file_pattern);
+
+  std::vector<uint8_t> a_buf(sizeof(kATxtContents));
+  std::vector<uint8_t> short_buf(sizeof(kATxtContents) - 1);
+  ZipExtraction extractions[] = {
+    { &a_entry, -1, &a_buf[0], static_cast<uint32_t>(a_buf.size()), 1 },
+    { &b_entry, output_fd, nullptr, 0, 1 },
+    { &bad_entry, -1, &short_buf[0], static_cast<uint32_t>(short_buf.size()), 0 },
+  };
+  ASSERT_GT(0, ExtractEntries(handle, extractions, 3, 3));
+
+  ASSERT_EQ(0, extractions[0].result);
+  ASSERT_EQ(0, memcmp(&a_buf[0], kATxtContents, sizeof(kATxtContents)));
+
+  ASSERT_EQ(0, extractions[1].result);
+  std::vector<uint8_t> b_buf(sizeof(kBTxtContents));
+  ASSERT_EQ(static_cast<ssize_t>(b_buf.size()),
+            TEMP_FAILURE_RETRY(pread(output_fd, &b_buf[0], b_buf.size(), 0)));
+  ASSERT_EQ(0, memcmp(&b_buf[0], kBTxtContents, sizeof(kBTxtContents)));
+
+  // The buffer is smaller than the entry declares.
+  ASSERT_GT(0, extractions[2].result);
+
+  close(output_fd);
+  CloseArchive(handle);
+}
+
+static bool AppendToVector(const uint8_t* buf, size_t buf_size, void* cookie) {
+  std::vector<uint8_t>* output = reinterpret_cast<std::vector<uint8_t>*>(cookie);
+  output->insert(output->end(), buf, buf + buf_size);
+  return true;
+}
+
+static bool RefuseData(const uint8_t*, size_t, void*) {
+  return false;
+}
+
+TEST(ziparchive, ProcessZipEntryContents) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's deflated.
+  ZipEntry data;
+  ZipString a_name;
+  a_name.name = kATxtName;
+  a_name.name_length = kATxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, a_name, &data));
+  std::vector<uint8_t> a_output;
+  ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &a_output));
+  ASSERT_EQ(std::vector<uint8_t>(kATxtContents, kATxtContents + sizeof(kATxtContents)),
+            a_output);
+  ASSERT_GT(0, ProcessZipEntryContents(handle, &data, RefuseData, nullptr));
+
+  // An entry that's stored.
+  ZipString b_name;
+  b_name.name = kBTxtName;
+  b_name.name_length = kBTxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, b_name, &data));
+  std::vector<uint8_t> b_output;
+  ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &b_output));
+  ASSERT_EQ(std::vector<uint8_t>(kBTxtContents, kBTxtContents + sizeof(kBTxtContents)),
+            b_output);
+  ASSERT_GT(0, ProcessZipEntryContents(handle, &data, RefuseData, nullptr));
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, MapEntry) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's stored maps to its contents.
+  ZipEntry data;
+  ZipString b_name;
+  b_name.name = kBTxtName;
+  b_name.name_length = kBTxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, b_name, &data));
+  android::FileMap map;
+  ASSERT_EQ(0, MapEntry(handle, &data, &map));
+  ASSERT_EQ(sizeof(kBTxtContents), map.getDataLength());
+  ASSERT_EQ(0, memcmp(map.getDataPtr(), kBTxtContents, sizeof(kBTxtContents)));
+
+  // An entry that's deflated can't be mapped.
+  ZipString a_name;
+  a_name.name = kATxtName;
+  a_name.name_length = kATxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, a_name, &data));
+  android::FileMap deflated_map;
+  ASSERT_GT(0, MapEntry(handle, &data, &deflated_map));
+
+  CloseArchive(handle);
+}
+
 static const uint32_t kEmptyEntriesZip[] = {
       0x04034b50, 0x0000000a, 0x63600000, 0x00004438, 0x00000000, 0x00000000,
       0x00090000, 0x6d65001c, 0x2e797470, 0x55747874, 0x03000954, 0x52e25c13,
@@ -20,10 +20,25 @@
 
 #include <utils/Log.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <unistd.h>
 #include <zlib.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+#if !defined(_WIN32)
+#include <thread>
+#endif
 #define DEF_MEM_LEVEL 8                // normally in zutil.h?
 
 /* Zip compression methods we support */
@@ -35,6 +50,14 @@ enum {
 // Size of the output buffer used for compression.
 static const size_t kBufSize = 32768u;
 
+// When compressing in parallel, entries are split into chunks of this
+// size, each deflated with the 32 KiB of data before it as dictionary.
+static const size_t kChunkSize = 128 * 1024u;
+static const size_t kDictSize = 32768u;
+
+// How much entry data a parallel ZipWriter holds before compressing it.
+static const size_t kMaxPendingBytes = 64 * 1024 * 1024u;
+
 // No error, operation completed successfully.
 static const int32_t kNoError = 0;
 
@@ -50,13 +73,20 @@ static const int32_t kInvalidEntryName = -3;
 // An error occurred in zlib.
 static const int32_t kZlibError = -4;
 
+// The requested alignment was not a power of 2 or too large.
+static const int32_t kInvalidAlignment = -5;
+
 static const char* sErrorCodes[] = {
     "Invalid state",
     "IO error",
     "Invalid entry name",
     "Zlib error",
+    "Invalid alignment",
 };
 
+// Padding goes in the 16 bit extra field length.
+static const uint32_t kMaxAlignment = 32768u;
+
 const char* ZipWriter::ErrorCodeString(int32_t error_code) {
   if (error_code < 0 && (-error_code) < static_cast<int32_t>(arraysize(sErrorCodes))) {
     return sErrorCodes[-error_code];
@@ -69,8 +99,33 @@ static void DeleteZStream(z_stream* stream) {
   delete stream;
 }
 
+// An entry of a parallel ZipWriter, waiting for FlushPendingEntries.
+struct ZipWriter::PendingEntry {
+  size_t file_index;
+  uint32_t alignment;
+  std::vector<uint8_t> data;
+  // The deflated chunks of data, which make up one deflate stream.
+  std::vector<std::vector<uint8_t>> chunks;
+};
+
 ZipWriter::ZipWriter(FILE* f) : file_(f), current_offset_(0), state_(State::kWritingZip),
-                                z_stream_(nullptr, DeleteZStream), buffer_(kBufSize) {
+                                z_stream_(nullptr, DeleteZStream), buffer_(kBufSize),
+                                num_threads_(0), pending_bytes_(0) {
+}
+
+ZipWriter::ZipWriter(FILE* f, size_t num_threads) : ZipWriter(f) {
+#if !defined(_WIN32)
+  if (num_threads == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = (cpus > 0) ? cpus : 1;
+  }
+#else
+  num_threads = 1;
+#endif
+  num_threads_ = num_threads;
+}
+
+ZipWriter::~ZipWriter() {
 }
 
 ZipWriter::ZipWriter(ZipWriter&& writer) : file_(writer.file_),
@@ -78,7 +133,10 @@ ZipWriter::ZipWriter(ZipWriter&& writer) : file_(writer.file_),
                                            state_(writer.state_),
                                            files_(std::move(writer.files_)),
                                            z_stream_(std::move(writer.z_stream_)),
-                                           buffer_(std::move(writer.buffer_)){
+                                           buffer_(std::move(writer.buffer_)),
+                                           num_threads_(writer.num_threads_),
+                                           pending_(std::move(writer.pending_)),
+                                           pending_bytes_(writer.pending_bytes_) {
   writer.file_ = nullptr;
   writer.state_ = State::kError;
 }
@@ -90,6 +148,9 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) {
   files_ = std::move(writer.files_);
   z_stream_ = std::move(writer.z_stream_);
   buffer_ = std::move(writer.buffer_);
+  num_threads_ = writer.num_threads_;
+  pending_ = std::move(writer.pending_);
+  pending_bytes_ = writer.pending_bytes_;
   writer.file_ = nullptr;
   writer.state_ = State::kError;
   return *this;
@@ -98,6 +159,7 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) {
 int32_t ZipWriter::HandleError(int32_t error_code) {
   state_ = State::kError;
   z_stream_.reset();
+  pending_.clear();
   return error_code;
 }
 
@@ -105,6 +167,10 @@ int32_t ZipWriter::StartEntry(const char* path, size_t flags) {
   return StartEntryWithTime(path, flags, time_t());
 }
 
+int32_t ZipWriter::StartAlignedEntry(const char* path, size_t flags, uint32_t alignment) {
+  return StartAlignedEntryWithTime(path, flags, time_t(), alignment);
+}
+
 static void ExtractTimeAndDate(time_t when, uint16_t* out_time, uint16_t* out_date) {
   /* round up to an even number of seconds */
   when = static_cast<time_t>((static_cast<unsigned long>(when) + 1) & (~1));
@@ -127,48 +193,80 @@ static void ExtractTimeAndDate(time_t when, uint16_t* out_time, uint16_t* out_da
 }
 
 int32_t ZipWriter::StartEntryWithTime(const char* path, size_t flags, time_t time) {
+  return StartAlignedEntryWithTime(path, flags, time, (flags & ZipWriter::kAlign32) ? 4 : 0);
+}
+
+int32_t ZipWriter::StartAlignedEntryWithTime(const char* path, size_t flags, time_t time,
+                                             uint32_t alignment) {
   if (state_ != State::kWritingZip) {
     return kInvalidState;
   }
 
+  if ((alignment & (alignment - 1)) != 0 || alignment > kMaxAlignment) {
+    return kInvalidAlignment;
+  }
+
   FileInfo fileInfo = {};
   fileInfo.path = std::string(path);
-  fileInfo.local_file_header_offset = current_offset_;
 
   if (!IsValidEntryName(reinterpret_cast<const uint8_t*>(fileInfo.path.data()),
                        fileInfo.path.size())) {
     return kInvalidEntryName;
   }
 
-  LocalFileHeader header = {};
-  header.lfh_signature = LocalFileHeader::kSignature;
+  fileInfo.compression_method = (flags & ZipWriter::kCompress) ? kCompressDeflated
+                                                               : kCompressStored;
+  ExtractTimeAndDate(time, &fileInfo.last_mod_time, &fileInfo.last_mod_date);
 
-  // Set this flag to denote that a DataDescriptor struct will appear after the data,
-  // containing the crc and size fields.
-  header.gpb_flags |= kGPBDDFlagMask;
+  if (num_threads_ != 0) {
+    // The header is written once the offset of the entry is known.
+    std::unique_ptr<PendingEntry> pending(new PendingEntry());
+    pending->file_index = files_.size();
+    pending->alignment = alignment;
+    pending_.emplace_back(std::move(pending));
+    files_.emplace_back(std::move(fileInfo));
+    state_ = State::kWritingEntry;
+    return kNoError;
+  }
 
   if (flags & ZipWriter::kCompress) {
-    fileInfo.compression_method = kCompressDeflated;
-
     int32_t result = PrepareDeflate();
     if (result != kNoError) {
       return result;
     }
-  } else {
-    fileInfo.compression_method = kCompressStored;
   }
-  header.compression_method = fileInfo.compression_method;
 
-  ExtractTimeAndDate(time, &fileInfo.last_mod_time, &fileInfo.last_mod_date);
-  header.last_mod_time = fileInfo.last_mod_time;
-  header.last_mod_date = fileInfo.last_mod_date;
+  int32_t result = WriteLocalFileHeader(&fileInfo, path, alignment);
+  if (result != kNoError) {
+    return result;
+  }
 
-  header.file_name_length = fileInfo.path.size();
+  files_.emplace_back(std::move(fileInfo));
 
-  off64_t offset = current_offset_ + sizeof(header) + fileInfo.path.size();
-  if ((flags & ZipWriter::kAlign32) && (offset & 0x03)) {
+  state_ = State::kWritingEntry;
+  return kNoError;
+}
+
+int32_t ZipWriter::WriteLocalFileHeader(FileInfo* file, const char* path, uint32_t alignment) {
+  file->local_file_header_offset = current_offset_;
+
+  LocalFileHeader header = {};
+  header.lfh_signature = LocalFileHeader::kSignature;
+
+  // Set this flag to denote that a DataDescriptor struct will appear after the data,
+  // containing the crc and size fields.
+  header.gpb_flags |= kGPBDDFlagMask;
+
+  header.compression_method = file->compression_method;
+  header.last_mod_time = file->last_mod_time;
+  header.last_mod_date = file->last_mod_date;
+
+  header.file_name_length = file->path.size();
+
+  off64_t offset = current_offset_ + sizeof(header) + file->path.size();
+  if (alignment != 0 && (offset & (alignment - 1))) {
     // Pad the extra field so the data will be aligned.
-    uint16_t padding = 4 - (offset % 4);
+    uint16_t padding = alignment - (offset % alignment);
     header.extra_field_length = padding;
     offset += padding;
   }
@@ -177,18 +275,16 @@ int32_t ZipWriter::StartEntryWithTime(const char* path, size_t flags, time_t tim
     return HandleError(kIoError);
   }
 
-  if (fwrite(path, sizeof(*path), fileInfo.path.size(), file_) != fileInfo.path.size()) {
+  if (fwrite(path, sizeof(*path), file->path.size(), file_) != file->path.size()) {
     return HandleError(kIoError);
   }
 
-  if (fwrite("\0\0\0", 1, header.extra_field_length, file_) != header.extra_field_length) {
+  const std::vector<char> padding(header.extra_field_length);
+  if (fwrite(padding.data(), 1, padding.size(), file_) != padding.size()) {
     return HandleError(kIoError);
   }
 
-  files_.emplace_back(std::move(fileInfo));
-
   current_offset_ = offset;
-  state_ = State::kWritingEntry;
   return kNoError;
 }
 
@@ -222,7 +318,11 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
 
   FileInfo& currentFile = files_.back();
   int32_t result = kNoError;
-  if (currentFile.compression_method & kCompressDeflated) {
+  if (num_threads_ != 0) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    pending_.back()->data.insert(pending_.back()->data.end(), bytes, bytes + len);
+    pending_bytes_ += len;
+  } else if (currentFile.compression_method & kCompressDeflated) {
     result = CompressBytes(&currentFile, data, len);
   } else {
     result = StoreBytes(&currentFile, data, len);
@@ -237,6 +337,90 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
   return kNoError;
 }
 
+#if !defined(_WIN32)
+int32_t ZipWriter::WriteBytesFromFd(int fd, off64_t offset, size_t len) {
+  if (state_ != State::kWritingEntry) {
+    return HandleError(kInvalidState);
+  }
+  if (len == 0) {
+    return kNoError;
+  }
+
+  // The CRC (and deflate) read the data straight from the page cache.
+  const off64_t page_size = sysconf(_SC_PAGESIZE);
+  const off64_t map_offset = offset & ~(page_size - 1);
+  const size_t adjust = offset - map_offset;
+  void* map = mmap64(nullptr, len + adjust, PROT_READ, MAP_SHARED, fd, map_offset);
+  if (map == MAP_FAILED) {
+    ALOGE("mmap of fd %d failed: %s", fd, strerror(errno));
+    return HandleError(kIoError);
+  }
+  madvise(map, len + adjust, MADV_SEQUENTIAL);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(map) + adjust;
+
+  FileInfo& currentFile = files_.back();
+  int32_t result;
+  if (num_threads_ != 0 || (currentFile.compression_method & kCompressDeflated)) {
+    result = WriteBytes(data, len);
+  } else {
+    result = CopyBytesFromFd(fd, offset, len, data);
+    if (result == kNoError) {
+      currentFile.crc32 = crc32(currentFile.crc32, data, len);
+      currentFile.uncompressed_size += len;
+      currentFile.compressed_size += len;
+      current_offset_ += len;
+    }
+  }
+
+  munmap(map, len + adjust);
+  return result;
+}
+
+// Copies the data from |fd| to the zip file's descriptor, behind the FILE's
+// back, falling back to writing |data|, the same bytes mapped.
+int32_t ZipWriter::CopyBytesFromFd(int fd, off64_t offset, size_t len, const uint8_t* data) {
+  if (fflush(file_) != 0) {
+    return HandleError(kIoError);
+  }
+  const int out_fd = fileno(file_);
+
+  size_t copied = 0;
+#if defined(__linux__)
+#if defined(__NR_copy_file_range)
+  loff_t in_offset = offset;
+  while (copied < len) {
+    ssize_t n = syscall(__NR_copy_file_range, fd, &in_offset, out_fd, nullptr, len - copied, 0);
+    if (n <= 0) {
+      break;
+    }
+    copied += n;
+  }
+#endif
+  off64_t sendfile_offset = offset + copied;
+  while (copied < len) {
+    ssize_t n = sendfile64(out_fd, fd, &sendfile_offset, len - copied);
+    if (n <= 0) {
+      break;
+    }
+    copied += n;
+  }
+#endif
+
+  if (copied != 0) {
+    // The FILE's idea of the position is stale now.
+    const off64_t position = lseek64(out_fd, 0, SEEK_CUR);
+    if (position == -1 || fseeko(file_, position, SEEK_SET) != 0) {
+      return HandleError(kIoError);
+    }
+  }
+
+  if (copied < len && fwrite(data + copied, 1, len - copied, file_) != len - copied) {
+    return HandleError(kIoError);
+  }
+  return kNoError;
+}
+#endif
+
 int32_t ZipWriter::StoreBytes(FileInfo* file, const void* data, size_t len) {
   assert(state_ == State::kWritingEntry);
 
@@ -310,6 +494,14 @@ int32_t ZipWriter::FinishEntry() {
     return kInvalidState;
   }
 
+  if (num_threads_ != 0) {
+    state_ = State::kWritingZip;
+    if (pending_bytes_ >= kMaxPendingBytes) {
+      return FlushPendingEntries();
+    }
+    return kNoError;
+  }
+
   FileInfo& currentFile = files_.back();
   if (currentFile.compression_method & kCompressDeflated) {
     int32_t result = FlushCompressedBytes(&currentFile);
@@ -318,6 +510,16 @@ int32_t ZipWriter::FinishEntry() {
     }
   }
 
+  int32_t result = WriteDataDescriptor(currentFile);
+  if (result != kNoError) {
+    return result;
+  }
+
+  state_ = State::kWritingZip;
+  return kNoError;
+}
+
+int32_t ZipWriter::WriteDataDescriptor(const FileInfo& file) {
   const uint32_t sig = DataDescriptor::kOptSignature;
   if (fwrite(&sig, sizeof(sig), 1, file_) != 1) {
     state_ = State::kError;
@@ -325,15 +527,140 @@ int32_t ZipWriter::FinishEntry() {
   }
 
   DataDescriptor dd = {};
-  dd.crc32 = currentFile.crc32;
-  dd.compressed_size = currentFile.compressed_size;
-  dd.uncompressed_size = currentFile.uncompressed_size;
+  dd.crc32 = file.crc32;
+  dd.compressed_size = file.compressed_size;
+  dd.uncompressed_size = file.uncompressed_size;
   if (fwrite(&dd, sizeof(dd), 1, file_) != 1) {
     return HandleError(kIoError);
   }
 
   current_offset_ += sizeof(DataDescriptor::kOptSignature) + sizeof(dd);
-  state_ = State::kWritingZip;
+  return kNoError;
+}
+
+// Deflates one chunk of an entry, continuing from |dict|, the data just
+// before it. All but the last chunk end with a sync flush, a byte aligned
+// stored block, so that the chunks can simply be concatenated.
+static bool DeflateChunk(const uint8_t* dict, size_t dict_len, const uint8_t* data, size_t len,
+                         bool last, std::vector<uint8_t>* out) {
+  z_stream zstream = {};
+  int zerr = deflateInit2(&zstream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                          DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+  if (zerr != Z_OK) {
+    ALOGE("deflateInit2 failed (zerr=%d)", zerr);
+    return false;
+  }
+  std::unique_ptr<z_stream, int(*)(z_stream*)> zstream_guard(&zstream, deflateEnd);
+
+  if (dict_len != 0 && deflateSetDictionary(&zstream, dict, dict_len) != Z_OK) {
+    return false;
+  }
+
+  // Room for the sync flush's empty stored block too.
+  out->resize(deflateBound(&zstream, len) + 16);
+  zstream.next_in = data;
+  zstream.avail_in = len;
+  zstream.next_out = out->data();
+  zstream.avail_out = out->size();
+  zerr = deflate(&zstream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (last ? (zerr != Z_STREAM_END) : (zerr != Z_OK || zstream.avail_out == 0)) {
+    ALOGE("deflate failed (zerr=%d)", zerr);
+    return false;
+  }
+  out->resize(zstream.total_out);
+  return true;
+}
+
+int32_t ZipWriter::FlushPendingEntries() {
+  // Every chunk of every compressed entry is compressed independently.
+  struct Chunk {
+    PendingEntry* entry;
+    size_t index;
+  };
+  std::vector<Chunk> chunks;
+  for (auto& pending : pending_) {
+    if (files_[pending->file_index].compression_method != kCompressDeflated) {
+      continue;
+    }
+    const size_t count = std::max<size_t>(1, (pending->data.size() + kChunkSize - 1) / kChunkSize);
+    pending->chunks.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      chunks.push_back(Chunk{pending.get(), i});
+    }
+  }
+
+  // Biggest entries first, so that one doesn't start last on its own.
+  std::stable_sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) {
+    return a.entry->data.size() > b.entry->data.size();
+  });
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  auto work = [&]() {
+    size_t i;
+    while ((i = next++) < chunks.size()) {
+      const std::vector<uint8_t>& data = chunks[i].entry->data;
+      const size_t start = chunks[i].index * kChunkSize;
+      const size_t len = std::min(kChunkSize, data.size() - start);
+      const size_t dict_len = std::min(kDictSize, start);
+      const bool last = (start + len == data.size());
+      if (!DeflateChunk(data.data() + start - dict_len, dict_len, data.data() + start, len, last,
+                        &chunks[i].entry->chunks[chunks[i].index])) {
+        failed = true;
+      }
+    }
+  };
+
+  const size_t num_threads = std::min(num_threads_, chunks.size());
+#if !defined(_WIN32)
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+#else
+  (void) num_threads;
+  work();
+#endif
+
+  if (failed) {
+    return HandleError(kZlibError);
+  }
+
+  // Now that the sizes are known, write the entries out in order.
+  for (auto& pending : pending_) {
+    FileInfo* file = &files_[pending->file_index];
+    int32_t result = WriteLocalFileHeader(file, file->path.c_str(), pending->alignment);
+    if (result != kNoError) {
+      return result;
+    }
+
+    if (file->compression_method == kCompressDeflated) {
+      for (const auto& chunk : pending->chunks) {
+        if (fwrite(chunk.data(), 1, chunk.size(), file_) != chunk.size()) {
+          return HandleError(kIoError);
+        }
+        file->compressed_size += chunk.size();
+      }
+    } else {
+      if (fwrite(pending->data.data(), 1, pending->data.size(), file_) != pending->data.size()) {
+        return HandleError(kIoError);
+      }
+      file->compressed_size = pending->data.size();
+    }
+    current_offset_ += file->compressed_size;
+
+    result = WriteDataDescriptor(*file);
+    if (result != kNoError) {
+      return result;
+    }
+  }
+
+  pending_.clear();
+  pending_bytes_ = 0;
   return kNoError;
 }
 
@@ -342,6 +669,13 @@ int32_t ZipWriter::Finish() {
     return kInvalidState;
   }
 
+  if (!pending_.empty()) {
+    int32_t result = FlushPendingEntries();
+    if (result != kNoError) {
+      return result;
+    }
+  }
+
   off64_t startOfCdr = current_offset_;
   for (FileInfo& file : files_) {
     CentralDirectoryRecord cdr = {};
@@ -168,3 +168,118 @@ TEST_F(zipwriter, WriteCompressedZipWithOneFile) {
 
   CloseArchive(handle);
 }
+
+TEST_F(zipwriter, WriteCompressedZipInParallel) {
+  ZipWriter writer(file_, 4);
+
+  // Compressible, but not so much that it fits in one chunk's output.
+  std::vector<uint8_t> large(1024 * 1024);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < large.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    large[i] = "abcdefgh"[(seed >> 16) & 7];
+  }
+
+  ASSERT_EQ(0, writer.StartEntry("large.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes(large.data(), large.size() / 3));
+  ASSERT_EQ(0, writer.WriteBytes(large.data() + large.size() / 3,
+                                 large.size() - large.size() / 3));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("stored.txt", ZipWriter::kAlign32));
+  ASSERT_EQ(0, writer.WriteBytes("he", 2));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("small.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("helo", 4));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("empty.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("large.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  EXPECT_EQ(large.size(), data.uncompressed_length);
+  EXPECT_GT(large.size(), data.compressed_length);
+  std::vector<uint8_t> buffer(large.size());
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, buffer.data(), buffer.size()));
+  EXPECT_TRUE(large == buffer);
+  EXPECT_EQ(crc32(0, large.data(), large.size()), data.crc32);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("stored.txt"), &data));
+  EXPECT_EQ(kCompressStored, data.method);
+  EXPECT_EQ(0, data.offset & 0x03);
+  EXPECT_EQ(2u, data.compressed_length);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("small.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  char small[5];
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, reinterpret_cast<uint8_t*>(small), 4));
+  small[4] = 0;
+  EXPECT_STREQ("helo", small);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("empty.txt"), &data));
+  EXPECT_EQ(0u, data.uncompressed_length);
+
+  CloseArchive(handle);
+}
+
+TEST_F(zipwriter, WriteAlignedEntryFromFd) {
+  TemporaryFile source;
+  std::vector<uint8_t> payload(3 * 4096 + 17);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = i * 7;
+  }
+  ASSERT_EQ(static_cast<ssize_t>(payload.size()),
+            TEMP_FAILURE_RETRY(write(source.fd, payload.data(), payload.size())));
+
+  ZipWriter writer(file_);
+
+  ASSERT_EQ(0, writer.StartEntry("file.txt", 0));
+  ASSERT_EQ(0, writer.WriteBytes("he", 2));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_NE(0, writer.StartAlignedEntry("bad.so", 0, 3));
+
+  // Not from the start of the source, or page aligned in it.
+  ASSERT_EQ(0, writer.StartAlignedEntry("lib.so", 0, 4096));
+  ASSERT_EQ(0, writer.WriteBytesFromFd(source.fd, 5, payload.size() - 5));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("after.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytesFromFd(source.fd, 0, 100));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("lib.so"), &data));
+  EXPECT_EQ(kCompressStored, data.method);
+  EXPECT_EQ(0, data.offset & 4095);
+  ASSERT_EQ(payload.size() - 5, data.uncompressed_length);
+  std::vector<uint8_t> buffer(data.uncompressed_length);
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, buffer.data(), buffer.size()));
+  EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), payload.begin() + 5));
+  EXPECT_EQ(crc32(0, buffer.data(), buffer.size()), data.crc32);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("after.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  buffer.resize(data.uncompressed_length);
+  ASSERT_EQ(100u, buffer.size());
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, buffer.data(), buffer.size()));
+  EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), payload.begin()));
+
+  CloseArchive(handle);
+}
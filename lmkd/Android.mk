@@ -1,9 +1,10 @@
 LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := lmkd.c
+LOCAL_SRC_FILES := lmkd.c event.logtags
 LOCAL_SHARED_LIBRARIES := liblog libm libc libprocessgroup
-LOCAL_CFLAGS := -Werror
+# Hard-coded from event.logtags
+LOCAL_CFLAGS := -Werror -DLMK_KILL_LOG_TAG=10195355
 
 LOCAL_MODULE := lmkd
 
@@ -42,6 +42,7 @@
 #define MEMCG_SYSFS_PATH "/dev/memcg/"
 #define MEMPRESSURE_WATCH_LEVEL "medium"
 #define ZONEINFO_PATH "/proc/zoneinfo"
+#define VMSTAT_PATH "/proc/vmstat"
 #define LINE_MAX 128
 
 #define INKERNEL_MINFREE_PATH "/sys/module/lowmemorykiller/parameters/minfree"
@@ -53,6 +54,7 @@ enum lmk_cmd {
     LMK_TARGET,
     LMK_PROCPRIO,
     LMK_PROCREMOVE,
+    LMK_GETSTATS,
 };
 
 #define MAX_TARGETS 6
@@ -62,6 +64,30 @@ enum lmk_cmd {
  */
 #define CTRL_PACKET_MAX (sizeof(int) * (MAX_TARGETS * 2 + 1))
 
+/*
+ * Statistics kept of kill decisions, for tuning the minfree levels.
+ * LMK_GETSTATS replies with LMK_GETSTATS, these in order, and then the
+ * kills from each oom_adj, from OOM_ADJUST_MIN up, all in network order.
+ */
+enum lmk_stat {
+    LMK_STAT_EVENTS,            /* memory pressure events */
+    LMK_STAT_EVENTS_DEFERRED,   /* events ignored while kills were in flight */
+    LMK_STAT_KILLS,
+    LMK_STAT_KILLED_KB,         /* sum of the RSS of the processes killed */
+    LMK_STAT_CANDIDATES,        /* processes looked at to choose them */
+    LMK_STAT_KILL_MS_TOTAL,     /* time from each event to the kills it caused */
+    LMK_STAT_KILL_US_MAX,
+    /* What the last kill was decided on */
+    LMK_STAT_LAST_KILL_US,
+    LMK_STAT_LAST_FREE_KB,
+    LMK_STAT_LAST_FILE_KB,
+    LMK_STAT_LAST_MIN_ADJ,
+    LMK_STAT_LAST_ADJ,
+    LMK_STAT_LAST_RSS_KB,
+    LMK_STAT_LAST_CANDIDATES,
+    LMK_STAT_COUNT,
+};
+
 /* default to old in-kernel interface if no memory pressure events */
 static int use_inkernel_interface = 1;
 
@@ -118,17 +144,46 @@ static struct proc *pidhash[PIDHASH_SZ];
 #define ADJTOSLOT(adj) (adj + -OOM_ADJUST_MIN)
 static struct adjslot_list procadjslot_list[ADJTOSLOT(OOM_ADJUST_MAX) + 1];
 
+static int lmk_stats[LMK_STAT_COUNT];
+static int lmk_kills_by_adj[ADJTOSLOT(OOM_ADJUST_MAX) + 1];
+
+/* When the memory pressure event being handled arrived */
+static struct timespec mp_event_time;
+
 /*
- * Wait 1-2 seconds for the death report of a killed process prior to
+ * Wait 1-2 seconds for the memory of a killed process to be freed prior to
  * considering killing more processes.
  */
 #define KILL_TIMEOUT 2
-/* Time of last process kill we initiated, stop me before I kill again */
-static time_t kill_lasttime;
+
+/*
+ * Processes we killed whose memory may not have been freed yet.  No more
+ * are killed until they are gone or KILL_TIMEOUT has passed, so that
+ * pressure events while they exit don't cost further victims.
+ */
+#define MAX_INFLIGHT_KILLS 16
+struct inflight_kill {
+    int pid;
+    time_t time;
+};
+static struct inflight_kill inflight_kills[MAX_INFLIGHT_KILLS];
+static int inflight_kills_size;
 
 /* PAGE_SIZE / 1024 */
 static long page_k;
 
+/*
+ * Free and file pages are read from /proc/vmstat, where they come first
+ * and which is much smaller than /proc/zoneinfo.  Only the reserved pages
+ * still need /proc/zoneinfo; they only change with sysctls, so are read
+ * again at most every ZONEINFO_REFRESH seconds.
+ */
+#define ZONEINFO_REFRESH 60
+static int zoneinfo_fd = -1;
+static int vmstat_fd = -1;
+static int totalreserve_pages;
+static time_t zoneinfo_lasttime;
+
 static ssize_t read_all(int fd, char *buf, size_t max_len)
 {
     ssize_t ret = 0;
@@ -149,6 +204,34 @@ static ssize_t read_all(int fd, char *buf, size_t max_len)
     return ret;
 }
 
+/*
+ * Reads a /proc file from the start through *fdp, which is opened on first
+ * use and then kept open, so that reading it under memory pressure takes
+ * no more than the read itself.  Returns the size read, NUL terminated.
+ */
+static ssize_t proc_read(int *fdp, const char *path, char *buf, size_t max_len)
+{
+    ssize_t size;
+
+    if (*fdp == -1) {
+        *fdp = open(path, O_RDONLY | O_CLOEXEC);
+        if (*fdp == -1) {
+            ALOGE("%s open: errno=%d", path, errno);
+            return -1;
+        }
+    }
+
+    if (lseek(*fdp, 0, SEEK_SET) == -1 ||
+            (size = read_all(*fdp, buf, max_len - 1)) < 0) {
+        ALOGE("%s read: errno=%d", path, errno);
+        close(*fdp);
+        *fdp = -1;
+        return -1;
+    }
+    buf[size] = 0;
+    return size;
+}
+
 static int lowmem_oom_adj_to_oom_score_adj(int oom_adj)
 {
     if (oom_adj == OOM_ADJUST_MAX)
@@ -303,12 +386,23 @@ static void cmd_procprio(int pid, uid_t uid, int oomadj) {
     }
 }
 
+static void inflight_kill_remove(int pid) {
+    int i;
+
+    for (i = 0; i < inflight_kills_size; i++) {
+        if (inflight_kills[i].pid == pid) {
+            inflight_kills[i] = inflight_kills[--inflight_kills_size];
+            return;
+        }
+    }
+}
+
 static void cmd_procremove(int pid) {
     if (use_inkernel_interface)
         return;
 
     pid_remove(pid);
-    kill_lasttime = 0;
+    inflight_kill_remove(pid);
 }
 
 static void cmd_target(int ntargets, int *params) {
@@ -357,6 +451,23 @@ static void ctrl_data_close(void) {
     maxevents--;
 }
 
+static void cmd_getstats(void) {
+    int obuf[1 + LMK_STAT_COUNT + ADJTOSLOT(OOM_ADJUST_MAX) + 1];
+    int n = 0;
+    int i;
+    ssize_t ret;
+
+    obuf[n++] = htonl(LMK_GETSTATS);
+    for (i = 0; i < LMK_STAT_COUNT; i++)
+        obuf[n++] = htonl(lmk_stats[i]);
+    for (i = 0; i <= ADJTOSLOT(OOM_ADJUST_MAX); i++)
+        obuf[n++] = htonl(lmk_kills_by_adj[i]);
+
+    ret = TEMP_FAILURE_RETRY(write(ctrl_dfd, obuf, sizeof(obuf)));
+    if (ret == -1)
+        ALOGE("control data socket write failed; errno=%d", errno);
+}
+
 static int ctrl_data_read(char *buf, size_t bufsz) {
     int ret = 0;
 
@@ -406,6 +517,11 @@ static void ctrl_command_handler(void) {
             goto wronglen;
         cmd_procremove(ntohl(ibuf[1]));
         break;
+    case LMK_GETSTATS:
+        if (nargs != 0)
+            goto wronglen;
+        cmd_getstats();
+        break;
     default:
         ALOGE("Received unknown command code %d", cmd);
         return;
@@ -496,7 +612,6 @@ static void zoneinfo_parse_line(char *line, struct sysmeminfo *mip) {
 }
 
 static int zoneinfo_parse(struct sysmeminfo *mip) {
-    int fd;
     ssize_t size;
     char buf[PAGE_SIZE];
     char *save_ptr;
@@ -504,25 +619,62 @@ static int zoneinfo_parse(struct sysmeminfo *mip) {
 
     memset(mip, 0, sizeof(struct sysmeminfo));
 
-    fd = open(ZONEINFO_PATH, O_RDONLY | O_CLOEXEC);
-    if (fd == -1) {
-        ALOGE("%s open: errno=%d", ZONEINFO_PATH, errno);
+    size = proc_read(&zoneinfo_fd, ZONEINFO_PATH, buf, sizeof(buf));
+    if (size < 0)
         return -1;
-    }
-
-    size = read_all(fd, buf, sizeof(buf) - 1);
-    if (size < 0) {
-        ALOGE("%s read: errno=%d", ZONEINFO_PATH, errno);
-        close(fd);
-        return -1;
-    }
     ALOG_ASSERT((size_t)size < sizeof(buf) - 1, "/proc/zoneinfo too large");
-    buf[size] = 0;
 
     for (line = strtok_r(buf, "\n", &save_ptr); line; line = strtok_r(NULL, "\n", &save_ptr))
             zoneinfo_parse_line(line, mip);
 
-    close(fd);
+    return 0;
+}
+
+static bool vmstat_parse_line(const char *line, const char *name, int *valp) {
+    size_t len = strlen(name);
+
+    if (strncmp(line, name, len) || line[len] != ' ')
+        return false;
+    *valp = strtol(line + len + 1, NULL, 0);
+    return true;
+}
+
+/*
+ * Reads the free and file pages from /proc/vmstat, stopping at the last of
+ * them.  Leaves totalreserve_pages to the caller.
+ */
+static int vmstat_parse(struct sysmeminfo *mip) {
+    char buf[PAGE_SIZE];
+    char *line;
+    char *next;
+    int found = 0;
+
+    if (proc_read(&vmstat_fd, VMSTAT_PATH, buf, sizeof(buf)) < 0)
+        return -1;
+
+    /* Only complete lines count; a larger file is cut off in the middle. */
+    for (line = buf; found < 3 && (next = strchr(line, '\n')); line = next + 1) {
+        if (vmstat_parse_line(line, "nr_free_pages", &mip->nr_free_pages) ||
+                vmstat_parse_line(line, "nr_file_pages", &mip->nr_file_pages) ||
+                vmstat_parse_line(line, "nr_shmem", &mip->nr_shmem))
+            found++;
+    }
+
+    return found == 3 ? 0 : -1;
+}
+
+static int meminfo_parse(struct sysmeminfo *mip) {
+    time_t now = time(NULL);
+
+    if (now - zoneinfo_lasttime < ZONEINFO_REFRESH && !vmstat_parse(mip)) {
+        mip->totalreserve_pages = totalreserve_pages;
+        return 0;
+    }
+
+    if (zoneinfo_parse(mip) < 0)
+        return -1;
+    totalreserve_pages = mip->totalreserve_pages;
+    zoneinfo_lasttime = now;
     return 0;
 }
 
@@ -544,6 +696,7 @@ static int proc_get_size(int pid) {
         close(fd);
         return -1;
     }
+    line[ret] = 0;
 
     sscanf(line, "%d %d ", &total, &rss);
     close(fd);
@@ -578,10 +731,68 @@ static struct proc *proc_adj_lru(int oomadj) {
     return (struct proc *)adjslot_tail(&procadjslot_list[ADJTOSLOT(oomadj)]);
 }
 
-/* Kill one process specified by procp.  Returns the size of the process killed */
+/*
+ * Appends an int to an event log list being built at *bufp, like
+ * android.util.EventLog writes it.
+ */
+static void event_list_add_int(char **bufp, int val)
+{
+    int32_t val32 = val;
+
+    *(*bufp)++ = EVENT_TYPE_INT;
+    memcpy(*bufp, &val32, sizeof(val32));
+    *bufp += sizeof(val32);
+}
+
+/* Accounts a kill in lmk_stats and writes an lmk_kill event log record */
+static void record_kill(int pid, uid_t uid, int oomadj, int min_score_adj, int tasksize,
+        int other_free, int other_file, int candidates)
+{
+    struct timespec now;
+    long kill_us;
+    char buf[2 + 9 * (1 + sizeof(int32_t))];
+    char *cp = buf;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    kill_us = (now.tv_sec - mp_event_time.tv_sec) * 1000000 +
+            (now.tv_nsec - mp_event_time.tv_nsec) / 1000;
+
+    lmk_stats[LMK_STAT_KILLS]++;
+    lmk_stats[LMK_STAT_KILLED_KB] += tasksize * page_k;
+    lmk_stats[LMK_STAT_KILL_MS_TOTAL] += kill_us / 1000;
+    if (kill_us > lmk_stats[LMK_STAT_KILL_US_MAX])
+        lmk_stats[LMK_STAT_KILL_US_MAX] = kill_us;
+    lmk_stats[LMK_STAT_LAST_KILL_US] = kill_us;
+    lmk_stats[LMK_STAT_LAST_FREE_KB] = other_free * page_k;
+    lmk_stats[LMK_STAT_LAST_FILE_KB] = other_file * page_k;
+    lmk_stats[LMK_STAT_LAST_MIN_ADJ] = min_score_adj;
+    lmk_stats[LMK_STAT_LAST_ADJ] = oomadj;
+    lmk_stats[LMK_STAT_LAST_RSS_KB] = tasksize * page_k;
+    lmk_stats[LMK_STAT_LAST_CANDIDATES] = candidates;
+    lmk_kills_by_adj[ADJTOSLOT(oomadj)]++;
+
+    *cp++ = EVENT_TYPE_LIST;
+    *cp++ = 9;
+    event_list_add_int(&cp, pid);
+    event_list_add_int(&cp, uid);
+    event_list_add_int(&cp, oomadj);
+    event_list_add_int(&cp, min_score_adj);
+    event_list_add_int(&cp, tasksize * page_k);
+    event_list_add_int(&cp, other_free * page_k);
+    event_list_add_int(&cp, other_file * page_k);
+    event_list_add_int(&cp, kill_us);
+    event_list_add_int(&cp, candidates);
+    __android_log_bwrite(LMK_KILL_LOG_TAG, buf, cp - buf);
+}
+
+/*
+ * Kill one process specified by procp, the candidates'th looked at.  Returns
+ * the size of the process killed
+ */
 static int kill_one_process(struct proc *procp, int other_free, int other_file,
-        int minfree, int min_score_adj, bool first)
+        int minfree, int min_score_adj, bool first, int candidates)
 {
+    int oomadj = procp->oomadj;
     int pid = procp->pid;
     uid_t uid = procp->uid;
     char *taskname;
@@ -603,7 +814,7 @@ static int kill_one_process(struct proc *procp, int other_free, int other_file,
     ALOGI("Killing '%s' (%d), uid %u, adj %d\n"
           "   to free %ldkB because cache %s%ldkB is below limit %ldkB for oom_adj %d\n"
           "   Free memory is %s%ldkB %s reserved",
-          taskname, pid, uid, procp->oomadj, tasksize * page_k,
+          taskname, pid, uid, oomadj, tasksize * page_k,
           first ? "" : "~", other_file * page_k, minfree * page_k, min_score_adj,
           first ? "" : "~", other_free * page_k, other_free >= 0 ? "above" : "below");
     r = kill(pid, SIGKILL);
@@ -611,13 +822,48 @@ static int kill_one_process(struct proc *procp, int other_free, int other_file,
     pid_remove(pid);
 
     if (r) {
-        ALOGE("kill(%d): errno=%d", procp->pid, errno);
+        ALOGE("kill(%d): errno=%d", pid, errno);
         return -1;
     } else {
+        if (inflight_kills_size < MAX_INFLIGHT_KILLS) {
+            inflight_kills[inflight_kills_size].pid = pid;
+            inflight_kills[inflight_kills_size].time = time(NULL);
+            inflight_kills_size++;
+        }
+        record_kill(pid, uid, oomadj, min_score_adj, tasksize, other_free, other_file,
+                    candidates);
         return tasksize;
     }
 }
 
+/*
+ * Forgets the killed processes whose memory has been freed, which shows as
+ * an RSS of 0 while they are zombies and no statm at all once reaped, or
+ * which have had KILL_TIMEOUT to free it.  Returns whether any are left.
+ */
+static bool kills_in_flight(void)
+{
+    time_t now = time(NULL);
+    int i;
+    int n = 0;
+
+    for (i = 0; i < inflight_kills_size; i++) {
+        struct inflight_kill *killp = &inflight_kills[i];
+
+        if (proc_get_size(killp->pid) <= 0)
+            continue;
+        if (now - killp->time >= KILL_TIMEOUT) {
+            ALOGW("pid %d still holds memory %lds after being killed",
+                  killp->pid, (long)(now - killp->time));
+            continue;
+        }
+        inflight_kills[n++] = *killp;
+    }
+    inflight_kills_size = n;
+
+    return n > 0;
+}
+
 /*
  * Find a process to kill based on the current (possibly estimated) free memory
  * and cached memory sizes.  Returns the size of the killed processes.
@@ -628,6 +874,7 @@ static int find_and_kill_process(int other_free, int other_file, bool first)
     int min_score_adj = OOM_ADJUST_MAX + 1;
     int minfree = 0;
     int killed_size = 0;
+    int candidates = 0;
 
     for (i = 0; i < lowmem_targets_size; i++) {
         minfree = lowmem_minfree[i];
@@ -647,7 +894,10 @@ retry:
         procp = proc_adj_lru(i);
 
         if (procp) {
-            killed_size = kill_one_process(procp, other_free, other_file, minfree, min_score_adj, first);
+            candidates++;
+            lmk_stats[LMK_STAT_CANDIDATES]++;
+            killed_size = kill_one_process(procp, other_free, other_file, minfree, min_score_adj,
+                                           first, candidates);
             if (killed_size < 0) {
                 goto retry;
             } else {
@@ -668,16 +918,21 @@ static void mp_event(uint32_t events __unused) {
     int killed_size;
     bool first = true;
 
+    clock_gettime(CLOCK_MONOTONIC, &mp_event_time);
+    lmk_stats[LMK_STAT_EVENTS]++;
+
     ret = read(mpevfd, &evcount, sizeof(evcount));
     if (ret < 0)
         ALOGE("Error reading memory pressure event fd; errno=%d",
               errno);
 
-    if (time(NULL) - kill_lasttime < KILL_TIMEOUT)
+    if (kills_in_flight()) {
+        lmk_stats[LMK_STAT_EVENTS_DEFERRED]++;
         return;
+    }
 
-    while (zoneinfo_parse(&mi) < 0) {
-        // Failed to read /proc/zoneinfo, assume ENOMEM and kill something
+    while (meminfo_parse(&mi) < 0) {
+        // Failed to read memory stats, assume ENOMEM and kill something
         find_and_kill_process(0, 0, true);
     }
 
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -35,6 +36,7 @@
 #include <log/logger.h>
 #include <log/logprint.h>
 #include <utils/threads.h>
+#include <zlib.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
@@ -76,6 +78,26 @@ static size_t g_outByteCount = 0;
 static int g_printBinary = 0;
 static int g_devCount = 0;                              // >1 means multiple
 
+// When dumping (-d, -t) or logging to a file (-f), lines are formatted one
+// after the other into the g_outBuffer staging buffer. The output thread
+// takes it over LOGCAT_BATCH_SIZE or so at a time, or whatever is there
+// every LOGCAT_FLUSH_PERIOD_MS, and writes it out of g_writeBuffer while
+// the next batch is staged. To a file, each batch is followed by one
+// fdatasync, and rotation happens on the output thread too, so a slow
+// flash holds up the reader only once LOGCAT_STAGING_SIZE is staged.
+#define LOGCAT_BATCH_SIZE (64 * 1024)
+#define LOGCAT_STAGING_SIZE (2 * 1024 * 1024)
+#define LOGCAT_FLUSH_PERIOD_MS 1000
+static bool g_batchOutput = false;
+static bool g_compressRotated = false;
+static AndroidLogBuffer g_outBuffer;  // protected by g_outLock
+static AndroidLogBuffer g_writeBuffer;
+static pthread_mutex_t g_outLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_outCond = PTHREAD_COND_INITIALIZER;
+static bool g_outFlush = false;  // take g_outBuffer however little is in it
+static bool g_writing = false;   // g_writeBuffer is being written out
+static bool g_outputThread = false;
+
 __noreturn static void logcat_panic(bool showHelp, const char *fmt, ...) __printflike(2,3);
 
 static int openLogFile (const char *pathname)
@@ -83,6 +105,48 @@ static int openLogFile (const char *pathname)
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
+// Replace fileName with a gzip'd fileName.gz
+static void compressLog(const char *fileName)
+{
+    char *gzName;
+    if (asprintf(&gzName, "%s.gz", fileName) < 0) {
+        return;
+    }
+
+    int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+    int gzFd = open(gzName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR);
+    gzFile gz = (gzFd >= 0) ? gzdopen(gzFd, "wb") : NULL;
+    bool ok = (fd >= 0) && gz;
+
+    if (!gz && (gzFd >= 0)) {
+        close(gzFd);
+    }
+    while (ok) {
+        char buf[LOGCAT_BATCH_SIZE];
+        ssize_t len = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)));
+        if (len <= 0) {
+            ok = len == 0;
+            break;
+        }
+        ok = gzwrite(gz, buf, len) == len;
+    }
+    if (gz && (gzclose(gz) != Z_OK)) {
+        ok = false;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (ok) {
+        unlink(fileName);
+    } else {
+        fprintf(stderr, "+++ LOG: failed to compress %s\n", fileName);
+        unlink(gzName);
+    }
+    free(gzName);
+}
+
 static void rotateLogs()
 {
     int err;
@@ -121,6 +185,16 @@ static void rotateLogs()
             perror("while rotating log files");
         }
 
+        if (g_compressRotated && (i > 1)) {
+            std::string gz0 = std::string(file0) + ".gz";
+            std::string gz1 = std::string(file1) + ".gz";
+            err = rename(gz0.c_str(), gz1.c_str());
+
+            if (err < 0 && errno != ENOENT) {
+                perror("while rotating log files");
+            }
+        }
+
         free(file1);
         free(file0);
     }
@@ -133,6 +207,179 @@ static void rotateLogs()
 
     g_outByteCount = 0;
 
+    if (g_compressRotated && (g_maxRotatedLogs > 0)) {
+        char *file1;
+        if (asprintf(&file1, "%s.%.*d", g_outputFileName,
+                     maxRotationCountDigits, 1) >= 0) {
+            compressLog(file1);
+            free(file1);
+        }
+    }
+}
+
+static void writeFully(const char *buf, size_t len)
+{
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(g_outFD, buf + written,
+                                               len - written));
+        if (ret <= 0) {
+            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+            break;
+        }
+        written += ret;
+    }
+}
+
+// Write out a batch of whole lines, rotating between the line that takes
+// the file to its -r size and the next, as when writing line by line.
+static void writeOutput(AndroidLogBuffer *buffer)
+{
+    const char *buf = buffer->buf;
+    size_t len = buffer->len;
+    size_t limit = g_logRotateSizeKBytes * 1024;
+
+    while (len) {
+        size_t n = len;
+        if (limit) {
+            if (g_outByteCount >= limit) {
+                fdatasync(g_outFD);
+                rotateLogs();
+            }
+            size_t room = limit - g_outByteCount;
+            if (room < len) {
+                const char *nl = static_cast<const char *>(
+                    memchr(buf + room - 1, '\n', len - room + 1));
+                if (nl) {
+                    n = nl + 1 - buf;
+                }
+            }
+        }
+        writeFully(buf, n);
+        g_outByteCount += n;
+        buf += n;
+        len -= n;
+    }
+    if (limit && (g_outByteCount >= limit)) {
+        fdatasync(g_outFD);
+        rotateLogs();
+    } else if (g_outputFileName && buffer->len) {
+        fdatasync(g_outFD);
+    }
+    buffer->len = 0;
+}
+
+static void *outputThread(void * /*arg*/)
+{
+    pthread_mutex_lock(&g_outLock);
+    for (;;) {
+        while (!g_outFlush && (g_outBuffer.len < LOGCAT_BATCH_SIZE)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += LOGCAT_FLUSH_PERIOD_MS / 1000;
+            ts.tv_nsec += (LOGCAT_FLUSH_PERIOD_MS % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ++ts.tv_sec;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if ((pthread_cond_timedwait(&g_outCond, &g_outLock, &ts) == ETIMEDOUT)
+                    && g_outBuffer.len) {
+                break;
+            }
+        }
+        g_outFlush = false;
+
+        AndroidLogBuffer swap = g_writeBuffer;
+        g_writeBuffer = g_outBuffer;
+        g_outBuffer = swap;
+        g_writing = true;
+        pthread_cond_broadcast(&g_outCond);
+        pthread_mutex_unlock(&g_outLock);
+
+        writeOutput(&g_writeBuffer);
+
+        pthread_mutex_lock(&g_outLock);
+        g_writing = false;
+        pthread_cond_broadcast(&g_outCond);
+    }
+    return NULL;
+}
+
+static void startOutput()
+{
+    pthread_attr_t attr;
+
+    if (!pthread_attr_init(&attr)) {
+        pthread_t thread;
+        if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)
+                && !pthread_create(&thread, &attr, outputThread, NULL)) {
+            g_outputThread = true;
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// Bracket changes to g_outBuffer. Holds the reader back while the staging
+// buffer is full.
+static void beginOutput()
+{
+    if (g_outputThread) {
+        pthread_mutex_lock(&g_outLock);
+        while (g_outBuffer.len >= LOGCAT_STAGING_SIZE) {
+            pthread_cond_broadcast(&g_outCond);
+            pthread_cond_wait(&g_outCond, &g_outLock);
+        }
+    }
+}
+
+static void endOutput()
+{
+    if (!g_outputThread) {
+        // should the thread not have started, write synchronously
+        if (g_outBuffer.len >= LOGCAT_BATCH_SIZE) {
+            writeOutput(&g_outBuffer);
+        }
+        return;
+    }
+    if (g_outBuffer.len >= LOGCAT_BATCH_SIZE) {
+        pthread_cond_broadcast(&g_outCond);
+    }
+    pthread_mutex_unlock(&g_outLock);
+}
+
+// Return once all that has been staged is written out.
+static void flushOutput()
+{
+    if (!g_outputThread) {
+        writeOutput(&g_outBuffer);
+        return;
+    }
+    pthread_mutex_lock(&g_outLock);
+    while (g_outBuffer.len || g_writing) {
+        g_outFlush = true;
+        pthread_cond_broadcast(&g_outCond);
+        pthread_cond_wait(&g_outCond, &g_outLock);
+    }
+    pthread_mutex_unlock(&g_outLock);
+}
+
+static void appendOutput(const char *buf, size_t len)
+{
+    if (g_outBuffer.len + len > g_outBuffer.size) {
+        size_t size = g_outBuffer.size ? g_outBuffer.size : LOGCAT_BATCH_SIZE;
+        while (size < g_outBuffer.len + len) {
+            size *= 2;
+        }
+        char *p = static_cast<char *>(realloc(g_outBuffer.buf, size));
+        if (!p) {
+            logcat_panic(false, "out of memory");
+        }
+        g_outBuffer.buf = p;
+        g_outBuffer.size = size;
+    }
+    memcpy(g_outBuffer.buf + g_outBuffer.len, buf, len);
+    g_outBuffer.len += len;
 }
 
 void printBinary(struct log_msg *buf)
@@ -171,13 +418,25 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
     }
 
     if (android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
-        bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
+        if (g_batchOutput) {
+            beginOutput();
+            bytesWritten = android_log_formatLogLines(g_logformat, &g_outBuffer,
+                                                      &entry, 1);
+            endOutput();
+        } else {
+            bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
+        }
 
         if (bytesWritten < 0) {
             logcat_panic(false, "output error");
         }
     }
 
+    // When batching, the output thread counts and rotates
+    if (g_batchOutput) {
+        return;
+    }
+
     g_outByteCount += bytesWritten;
 
     if (g_logRotateSizeKBytes > 0
@@ -198,7 +457,12 @@ static void maybePrintStart(log_device_t* dev, bool printDividers) {
             snprintf(buf, sizeof(buf), "--------- %s %s\n",
                      dev->printed ? "switch to" : "beginning of",
                      dev->device);
-            if (write(g_outFD, buf, strlen(buf)) < 0) {
+            if (g_batchOutput) {
+                // in line with the entries around it
+                beginOutput();
+                appendOutput(buf, strlen(buf));
+                endOutput();
+            } else if (write(g_outFD, buf, strlen(buf)) < 0) {
                 logcat_panic(false, "output error");
             }
         }
@@ -258,6 +522,7 @@ static void show_help(const char *cmd)
                     "  -f <filename>   Log to file. Default is stdout\n"
                     "  -r <kbytes>     Rotate log every kbytes. Requires -f\n"
                     "  -n <count>      Sets max number of rotated logs to <count>, default 4\n"
+                    "  -z              gzip rotated logs. Requires -r\n"
                     "  -v <format>     Sets the log print format, where <format> is:\n\n"
                     "                      brief color long printable process raw tag thread\n"
                     "                      threadtime time usec UTC year zone\n\n"
@@ -501,7 +766,7 @@ int main(int argc, char **argv)
     for (;;) {
         int ret;
 
-        ret = getopt(argc, argv, ":cdDLt:T:gG:sQf:r:n:v:b:BSpCP:");
+        ret = getopt(argc, argv, ":cdDLt:T:gG:sQf:r:n:zv:b:BSpCP:");
 
         if (ret < 0) {
             break;
@@ -680,6 +945,10 @@ int main(int argc, char **argv)
                 }
             break;
 
+            case 'z':
+                g_compressRotated = true;
+            break;
+
             case 'v':
                 err = setLogFormat (optarg);
                 if (err < 0) {
@@ -787,6 +1056,10 @@ int main(int argc, char **argv)
         logcat_panic(true, "-r requires -f as well\n");
     }
 
+    if (g_compressRotated && g_logRotateSizeKBytes == 0) {
+        logcat_panic(true, "-z requires -r as well\n");
+    }
+
     setupOutput();
 
     if (hasSetLogFormat == 0) {
@@ -985,11 +1258,20 @@ int main(int argc, char **argv)
 
     dev = NULL;
     log_device_t unexpected("unexpected", false);
+    g_batchOutput = !g_printBinary
+            && ((mode & ANDROID_LOG_NONBLOCK) || g_outputFileName);
+    if (g_batchOutput) {
+        startOutput();
+    }
     while (1) {
         struct log_msg log_msg;
         log_device_t* d;
         int ret = android_logger_list_read(logger_list, &log_msg);
 
+        if (ret <= 0 && g_batchOutput) {
+            flushOutput();
+        }
+
         if (ret == 0) {
             logcat_panic(false, "read: unexpected EOF!\n");
         }
@@ -1031,6 +1313,11 @@ int main(int argc, char **argv)
     }
 
     android_logger_list_free(logger_list);
+    if (g_batchOutput) {
+        flushOutput();
+    }
+    free(g_outBuffer.buf);
+    free(g_writeBuffer.buf);
 
     return EXIT_SUCCESS;
 }
@@ -661,6 +661,50 @@ TEST(logcat, logrotate_suffix) {
     EXPECT_FALSE(system(command));
 }
 
+TEST(logcat, logrotate_compress) {
+    static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char tmp_out_dir[sizeof(tmp_out_dir_form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(tmp_out_dir, tmp_out_dir_form)));
+
+    static const char logcat_cmd[] = "logcat -b radio -b events -b system -b main"
+                                     " -d -f %s/log.txt -n 4 -r 1 -z";
+    char command[sizeof(tmp_out_dir) + sizeof(logcat_cmd)];
+    snprintf(command, sizeof(command), logcat_cmd, tmp_out_dir);
+
+    int ret;
+    EXPECT_FALSE((ret = system(command)));
+    if (!ret) {
+        snprintf(command, sizeof(command), "ls %s 2>/dev/null", tmp_out_dir);
+
+        FILE *fp;
+        EXPECT_TRUE(NULL != (fp = popen(command, "r")));
+        char buffer[5120];
+        int log_file_count = 0;
+        int compressed_count = 0;
+
+        while (fgets(buffer, sizeof(buffer), fp)) {
+            int suffix;
+            char c;
+
+            if (!strcmp(buffer, "log.txt\n")) {
+                ++log_file_count;
+            } else if ((2 == sscanf(buffer, "log.txt.%d.g%c", &suffix, &c))
+                    && (c == 'z') && (suffix > 0) && (suffix <= 4)) {
+                ++compressed_count;
+            } else {
+                // rotated logs are all to have been compressed
+                fprintf(stderr, "ERROR: Unexpected file: %s", buffer);
+                ADD_FAILURE();
+            }
+        }
+        pclose(fp);
+        EXPECT_EQ(1, log_file_count);
+        EXPECT_EQ(4, compressed_count);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", tmp_out_dir);
+    EXPECT_FALSE(system(command));
+}
+
 TEST(logcat, logrotate_continue) {
     static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
     char tmp_out_dir[sizeof(tmp_out_dir_form)];
@@ -16,6 +16,10 @@ LOCAL_SRC_FILES := \
     LogBuffer.cpp \
     LogBufferElement.cpp \
     LogTimes.cpp \
+    LogFilter.cpp \
+    LogFormats.cpp \
+    LogFrame.cpp \
+    LogRing.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
     libaudit.c \
@@ -27,7 +31,8 @@ LOCAL_SHARED_LIBRARIES := \
     libsysutils \
     liblog \
     libcutils \
-    libutils
+    libutils \
+    libz
 
 # This is what we want to do:
 #  event_logtags = $(shell \
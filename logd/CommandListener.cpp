@@ -31,8 +31,9 @@
 
 #include "CommandListener.h"
 #include "LogCommand.h"
+#include "LogRing.h"
 
-CommandListener::CommandListener(LogBuffer *buf, LogReader * /*reader*/,
+CommandListener::CommandListener(LogBuffer *buf, LogReader *reader,
                                  LogListener * /*swl*/) :
         FrameworkListener(getLogSocket()),
         mBuf(*buf) {
@@ -44,6 +45,7 @@ CommandListener::CommandListener(LogBuffer *buf, LogReader * /*reader*/,
     registerCmd(new GetStatisticsCmd(buf));
     registerCmd(new SetPruneListCmd(buf));
     registerCmd(new GetPruneListCmd(buf));
+    registerCmd(new GetLogRingCmd(buf, reader));
     registerCmd(new ReinitCmd());
 }
 
@@ -301,6 +303,25 @@ int CommandListener::SetPruneListCmd::runCommand(SocketClient *cli,
     return 0;
 }
 
+CommandListener::GetLogRingCmd::GetLogRingCmd(LogBuffer *buf,
+                                              LogReader *reader) :
+        LogCommand("getLogRing"),
+        mBuf(*buf),
+        mReader(*reader) {
+}
+
+// The reply carries the ring and its doorbell, see LogRing
+int CommandListener::GetLogRingCmd::runCommand(SocketClient *cli,
+                                             int /*argc*/, char ** /*argv*/) {
+    setname();
+
+    if (LogRing::create(&mBuf, &mReader, cli)) {
+        cli->sendMsg("Unavailable");
+    }
+
+    return 0;
+}
+
 CommandListener::ReinitCmd::ReinitCmd() : LogCommand("reinit") {
 }
 
@@ -64,6 +64,16 @@ private:
     LogBufferCmd(GetPruneList)
     LogBufferCmd(SetPruneList)
 
+    class GetLogRingCmd : public LogCommand {
+        LogBuffer &mBuf;
+        LogReader &mReader;
+
+    public:
+        GetLogRingCmd(LogBuffer *buf, LogReader *reader);
+        virtual ~GetLogRingCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    };
+
     class ReinitCmd : public LogCommand {
     public:
         ReinitCmd();
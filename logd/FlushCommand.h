@@ -16,6 +16,8 @@
 #ifndef _FLUSH_COMMAND_H
 #define _FLUSH_COMMAND_H
 
+#include <memory>
+
 #include <log/log_read.h>
 #include <sysutils/SocketClientCommand.h>
 
@@ -32,6 +34,8 @@ class FlushCommand : public SocketClientCommand {
     unsigned int mLogMask;
     pid_t mPid;
     uint64_t mStart;
+    std::shared_ptr<const LogFilter> mFilter;
+    size_t mFrameSize;
 
 public:
     FlushCommand(LogReader &mReader,
@@ -39,7 +43,9 @@ public:
                  unsigned long tail = -1,
                  unsigned int logMask = -1,
                  pid_t pid = 0,
-                 uint64_t start = 1);
+                 uint64_t start = 1,
+                 const std::shared_ptr<const LogFilter> &filter = nullptr,
+                 size_t frameSize = 0);
     virtual void runSocketCommand(SocketClient *client);
 
     static bool hasReadLogs(SocketClient *client);
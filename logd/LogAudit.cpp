@@ -18,11 +18,14 @@
 #include <endian.h>
 #include <errno.h>
 #include <limits.h>
-#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/uio.h>
 #include <syslog.h>
+#include <time.h>
+
+#include <algorithm>
 
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
@@ -37,12 +40,20 @@
     '0' + LOG_MAKEPRI(LOG_AUTH, LOG_PRI(PRI)) % 10, \
     '>'
 
+// Identical denials closer than this to the first of them are counted
+// rather than logged, which a permissive device can produce thousands of.
+#define LOG_AUDIT_COALESCE_NS (1000000000ULL)
+
 LogAudit::LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg) :
         SocketListener(getLogSocket(), false),
         logbuf(buf),
         reader(reader),
         fdDmesg(fdDmesg),
-        initialized(false) {
+        initialized(false),
+        lastDenialNs(0),
+        suppressed(0),
+        count(0),
+        used(0) {
     static const char auditd_message[] = { KMSG_PRIORITY(LOG_INFO),
         'l', 'o', 'g', 'd', '.', 'a', 'u', 'd', 'i', 't', 'd', ':',
         ' ', 's', 't', 'a', 'r', 't', '\n' };
@@ -56,41 +67,127 @@ bool LogAudit::onDataAvailable(SocketClient *cli) {
     }
 
     struct audit_message rep;
+    char str[sizeof(rep.data) + 32];
+
+    // Wait for the first message only, then take those queued behind it
+    for (int i = 0; i < LOG_AUDIT_BATCH; ++i) {
+        rep.nlh.nlmsg_type = 0;
+        rep.nlh.nlmsg_len = 0;
+        rep.data[0] = '\0';
+
+        if (audit_get_reply(cli->getSocket(), &rep,
+                            i ? GET_REPLY_NONBLOCKING : GET_REPLY_BLOCKING,
+                            0) < 0) {
+            SLOGE("Failed on audit_get_reply with error: %s", strerror(errno));
+            flush();
+            return false;
+        }
+        if (i && !rep.nlh.nlmsg_len) {
+            break;
+        }
 
-    rep.nlh.nlmsg_type = 0;
-    rep.nlh.nlmsg_len = 0;
-    rep.data[0] = '\0';
+        snprintf(str, sizeof(str), "type=%d %.*s",
+                 rep.nlh.nlmsg_type, rep.nlh.nlmsg_len, rep.data);
+        logPrint(str);
+    }
 
-    if (audit_get_reply(cli->getSocket(), &rep, GET_REPLY_BLOCKING, 0) < 0) {
-        SLOGE("Failed on audit_get_reply with error: %s", strerror(errno));
-        return false;
+    flush();
+    return true;
+}
+
+// Returns room for an entry of len bytes in the arena, logging what is in
+// it first if there is not enough, or NULL if len is too large for it.
+char *LogAudit::reserve(size_t len) {
+    if ((count >= (sizeof(entries) / sizeof(entries[0])))
+            || ((used + len) > sizeof(arena))) {
+        flush();
     }
+    return (len <= sizeof(arena)) ? arena + used : NULL;
+}
 
-    logPrint("type=%d %.*s",
-        rep.nlh.nlmsg_type, rep.nlh.nlmsg_len, rep.data);
+// Adds the entry of len bytes written where reserve() said to the batch.
+void LogAudit::add(log_id_t id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid, size_t len) {
+    LogBufferEntry &entry = entries[count++];
+    entry.log_id = id;
+    entry.realtime = realtime;
+    entry.uid = uid;
+    entry.pid = pid;
+    entry.tid = tid;
+    entry.msg = arena + used;
+    entry.len = (len <= USHRT_MAX) ? (unsigned short) len : USHRT_MAX;
+    used += len;
+}
 
-    return true;
+void LogAudit::flush() {
+    if (count && logbuf->log(entries, count)) {
+        reader->notifyNewLog();
+    }
+    count = used = 0;
 }
 
-int LogAudit::logPrint(const char *fmt, ...) {
-    if (fmt == NULL) {
-        return -EINVAL;
+// Whether str is a denial identical to the last one logged, and less than
+// LOG_AUDIT_COALESCE_NS after it, in which case it is only counted. The
+// count is logged to main before the next denial that is logged. Only
+// what follows the audit(<time>:<serial>) stamp, which differs each time,
+// is compared.
+bool LogAudit::coalesce(const char *str) {
+    if (!strstr(str, " avc: denied ")) {
+        return false;
     }
 
-    va_list args;
+    static const char stamp_end[] = "): ";
+    const char *stamp = strstr(str, " audit(");
+    const char *rest = stamp ? strstr(stamp, stamp_end) : NULL;
+    if (!rest) {
+        return false;
+    }
+    rest += sizeof(stamp_end) - 1;
 
-    char *str = NULL;
-    va_start(args, fmt);
-    int rc = vasprintf(&str, fmt, args);
-    va_end(args);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 
-    if (rc < 0) {
-        return rc;
+    if (!lastDenial.compare(rest)
+            && ((ns - lastDenialNs) < LOG_AUDIT_COALESCE_NS)) {
+        ++suppressed;
+        return true;
     }
 
-    char *cp;
-    while ((cp = strstr(str, "  "))) {
-        memmove(cp, cp + 1, strlen(cp + 1) + 1);
+    if (suppressed) {
+        static const char tag[] = "auditd";
+        char msg[512];
+        int len = snprintf(msg, sizeof(msg),
+                           "%u identical denials not logged: %s",
+                           suppressed, lastDenial.c_str());
+        len = std::min(len, (int)sizeof(msg) - 1);
+        size_t n = 1 + sizeof(tag) + len + 1;
+        char *cp = reserve(n);
+        *cp = ANDROID_LOG_WARN;
+        memcpy(cp + 1, tag, sizeof(tag));
+        memcpy(cp + 1 + sizeof(tag), msg, len + 1);
+        add(LOG_ID_MAIN, log_time(CLOCK_REALTIME), AID_LOGD, getpid(), gettid(), n);
+        suppressed = 0;
+    }
+
+    lastDenial.assign(rest);
+    lastDenialNs = ns;
+    return false;
+}
+
+// Formats the audit message str, which is modified in place, into an
+// events and a main entry of the batch, and echoes it to dmesg.
+int LogAudit::logPrint(char *str) {
+    char *cp = str;
+    for (const char *sp = str; *sp; ++sp) {
+        if ((sp[0] != ' ') || (sp[1] != ' ')) {
+            *cp++ = *sp;
+        }
+    }
+    *cp = '\0';
+
+    if (coalesce(str)) {
+        return 0;
     }
 
     bool info = strstr(str, " permissive=1") || strstr(str, " policy loaded ");
@@ -155,26 +252,17 @@ int LogAudit::logPrint(const char *fmt, ...) {
 
     size_t l = strlen(str);
     size_t n = l + sizeof(android_log_event_string_t);
+    int rc = -ENOMEM;
 
-    bool notify = false;
-
-    android_log_event_string_t *event = static_cast<android_log_event_string_t *>(malloc(n));
-    if (!event) {
-        rc = -ENOMEM;
-    } else {
+    android_log_event_string_t *event =
+        reinterpret_cast<android_log_event_string_t *>(reserve(n));
+    if (event) {
         event->header.tag = htole32(AUDITD_LOG_TAG);
         event->type = EVENT_TYPE_STRING;
         event->length = htole32(l);
         memcpy(event->data, str, l);
-
-        rc = logbuf->log(LOG_ID_EVENTS, now, uid, pid, tid,
-                         reinterpret_cast<char *>(event),
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-        free(event);
-
-        if (rc >= 0) {
-            notify = true;
-        }
+        add(LOG_ID_EVENTS, now, uid, pid, tid, n);
+        rc = n;
     }
 
     // log to main
@@ -208,33 +296,19 @@ int LogAudit::logPrint(const char *fmt, ...) {
     }
     n = (estr - str) + strlen(ecomm) + l + 2;
 
-    char *newstr = static_cast<char *>(malloc(n));
-    if (!newstr) {
-        rc = -ENOMEM;
-    } else {
+    char *newstr = reserve(n);
+    if (newstr) {
         *newstr = info ? ANDROID_LOG_INFO : ANDROID_LOG_WARN;
         strlcpy(newstr + 1, comm, l);
         strncpy(newstr + 1 + l, str, estr - str);
         strcpy(newstr + 1 + l + (estr - str), ecomm);
-
-        rc = logbuf->log(LOG_ID_MAIN, now, uid, pid, tid, newstr,
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-        free(newstr);
-
-        if (rc >= 0) {
-            notify = true;
-        }
+        add(LOG_ID_MAIN, now, uid, pid, tid, n);
+        rc = n;
+    } else {
+        rc = -ENOMEM;
     }
 
     free(commfree);
-    free(str);
-
-    if (notify) {
-        reader->notifyNewLog();
-        if (rc < 0) {
-            rc = n;
-        }
-    }
 
     return rc;
 }
@@ -247,14 +321,17 @@ int LogAudit::log(char *buf) {
 
     *audit = '\0';
 
-    int rc;
+    char str[MAX_AUDIT_MESSAGE_LENGTH + 32];
     char *type = strstr(buf, "type=");
     if (type) {
-        rc = logPrint("%s %s", type, audit + 1);
+        snprintf(str, sizeof(str), "%s %s", type, audit + 1);
     } else {
-        rc = logPrint("%s", audit + 1);
+        snprintf(str, sizeof(str), "%s", audit + 1);
     }
     *audit = ' ';
+
+    int rc = logPrint(str);
+    flush();
     return rc;
 }
 
@@ -17,15 +17,33 @@
 #ifndef _LOGD_LOG_AUDIT_H__
 #define _LOGD_LOG_AUDIT_H__
 
+#include <string>
+
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
 
+// audit messages read from the socket at each wakeup, and the room their
+// events and main entries are formatted into to be logged under one lock
+#define LOG_AUDIT_BATCH      16
+#define LOG_AUDIT_ARENA_SIZE (64 * 1024)
+
 class LogAudit : public SocketListener {
     LogBuffer *logbuf;
     LogReader *reader;
     int fdDmesg;
     bool initialized;
 
+    // The last denial logged, without its timestamp, when, and how many
+    // identical ones were counted rather than logged since.
+    std::string lastDenial;
+    uint64_t lastDenialNs;
+    unsigned suppressed;
+
+    LogBufferEntry entries[LOG_AUDIT_BATCH * 2];
+    size_t count;
+    char arena[LOG_AUDIT_ARENA_SIZE];
+    size_t used;
+
 public:
     LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg);
     int log(char *buf);
@@ -35,8 +53,12 @@ protected:
 
 private:
     static int getLogSocket();
-    int logPrint(const char *fmt, ...)
-        __attribute__ ((__format__ (__printf__, 2, 3)));
+    int logPrint(char *str);
+    bool coalesce(const char *str);
+    char *reserve(size_t len);
+    void add(log_id_t id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
+             size_t len);
+    void flush();
 };
 
 #endif
@@ -16,18 +16,27 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/user.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
 
+#include <cutils/daemon_trace.h>
 #include <cutils/properties.h>
 #include <log/logger.h>
+#include <private/android_logger.h>
 
 #include "LogBuffer.h"
+#include "LogFormats.h"
+#include "LogFrame.h"
 #include "LogReader.h"
 
 // Default
@@ -35,6 +44,18 @@
 #define log_buffer_size(id) mMaxSize[id]
 #define LOG_BUFFER_MIN_SIZE (64 * 1024UL)
 #define LOG_BUFFER_MAX_SIZE (256 * 1024 * 1024UL)
+// flushTo() drops its read lock after this many filtered out entries
+#define FLUSH_YIELD_ELEMENTS 64
+
+// The pruner thread prunes this many entries per log id at a time, and lets
+// writers and readers in for this long in between.
+#define PRUNE_STEP_ROWS 256
+#define PRUNE_STEP_DELAY_US 2000
+// How long it waits when a reader holds the entries it would prune next
+#define PRUNE_BLOCKED_DELAY_US 100000
+
+// mIndex holds one of every this many entries appended
+#define LOG_BUFFER_INDEX_INTERVAL 256
 
 static bool valid_size(unsigned long value) {
     if ((value < LOG_BUFFER_MIN_SIZE) || (LOG_BUFFER_MAX_SIZE < value)) {
@@ -128,40 +149,173 @@ void LogBuffer::init() {
     }
 }
 
-LogBuffer::LogBuffer(LastLogTimes *times) : mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+LogBuffer::LogBuffer(LastLogTimes *times) :
+        mPrunerStarted(false),
+        mCompress(false),
+        mSinceIndexed(0),
+        mTimes(*times) {
+    pthread_rwlock_init(&mLogElementsLock, NULL);
+    sem_init(&mPrunerWake, 0, 0);
 
     init();
 }
 
+// Messages shorter than this rarely deflate enough to be worth the CPU.
+#define LOG_COMPRESS_MIN_SIZE 128
+
+// One deflate stream for every writer, reset between messages rather than
+// set up and torn down for each as compress2() would. Messages fit in a 4 KiB
+// window, so a larger one would only cost memory.
+static pthread_mutex_t sDeflateLock = PTHREAD_MUTEX_INITIALIZER;
+static z_stream sDeflate;
+static bool sDeflateReady;
+
+// Deflate msg into buffer, which holds LOGGER_ENTRY_MAX_PAYLOAD bytes.
+// Returns the deflated size, or 0 if it would save less than an eighth.
+static unsigned short compressMessage(log_id_t log_id,
+                                      const char *msg, unsigned short len,
+                                      char *buffer) {
+    // Binary event payloads are short and their tags are looked up in place,
+    // deferred ones are already compact and are formatted in place.
+    if ((log_id == LOG_ID_EVENTS) || (len < LOG_COMPRESS_MIN_SIZE)
+            || (static_cast<unsigned char>(msg[0]) & LOGGER_DEFERRED)) {
+        return 0;
+    }
+    unsigned short packedLen = 0;
+    pthread_mutex_lock(&sDeflateLock);
+    if (!sDeflateReady) {
+        sDeflateReady = deflateInit2(&sDeflate, Z_BEST_SPEED, Z_DEFLATED,
+                                     12, 4, Z_DEFAULT_STRATEGY) == Z_OK;
+    } else {
+        deflateReset(&sDeflate);
+    }
+    if (sDeflateReady) {
+        sDeflate.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(msg));
+        sDeflate.avail_in = len;
+        sDeflate.next_out = reinterpret_cast<Bytef *>(buffer);
+        sDeflate.avail_out = std::min(len - len / 8, LOGGER_ENTRY_MAX_PAYLOAD);
+        if (deflate(&sDeflate, Z_FINISH) == Z_STREAM_END) {
+            packedLen = sDeflate.total_out;
+        }
+    }
+    pthread_mutex_unlock(&sDeflateLock);
+    return packedLen;
+}
+
+// Build the element for entry, deflating the message if enabled.
+LogBufferElement *LogBuffer::newElement(const LogBufferEntry &entry) {
+    char packed[LOGGER_ENTRY_MAX_PAYLOAD];
+    unsigned short packedLen = mCompress
+        ? compressMessage(entry.log_id, entry.msg, entry.len, packed) : 0;
+    if (packedLen) {
+        return new (packedLen) LogBufferElement(entry.log_id, entry.realtime,
+                                                entry.uid, entry.pid, entry.tid,
+                                                packed, packedLen, entry.len);
+    }
+    return new (entry.len) LogBufferElement(entry.log_id, entry.realtime,
+                                            entry.uid, entry.pid, entry.tid,
+                                            entry.msg, entry.len);
+}
+
+static bool isLoggable(const LogBufferEntry &entry,
+                       const LogBufferElement *elem) {
+    int prio = ANDROID_LOG_INFO;
+    const char *tag = NULL;
+    if (entry.log_id == LOG_ID_EVENTS) {
+        tag = android::tagToName(elem->getTag());
+    } else {
+        prio = static_cast<unsigned char>(*entry.msg) & ~LOGGER_DEFERRED;
+        tag = entry.msg + 1;
+    }
+    return __android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE);
+}
+
+// Take the format from a LOGGER_DEFERRED_REGISTER entry, which is not
+// logged itself. Returns true if entry was one.
+static bool registerFormat(const LogBufferEntry &entry) {
+    if ((entry.log_id == LOG_ID_EVENTS) || !entry.len
+            || (static_cast<unsigned char>(*entry.msg) != LOGGER_DEFERRED_REGISTER)) {
+        return false;
+    }
+    LogFormats::add(entry.uid, entry.msg, entry.len);
+    return true;
+}
+
 int LogBuffer::log(log_id_t log_id, log_time realtime,
                    uid_t uid, pid_t pid, pid_t tid,
                    const char *msg, unsigned short len) {
+    daemon_trace_poll();
+    DAEMON_TRACE_SCOPE("logd log");
     if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
         return -EINVAL;
     }
 
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
-    int prio = ANDROID_LOG_INFO;
-    const char *tag = NULL;
-    if (log_id == LOG_ID_EVENTS) {
-        tag = android::tagToName(elem->getTag());
-    } else {
-        prio = *msg;
-        tag = msg + 1;
+    LogBufferEntry entry = { log_id, realtime, uid, pid, tid, msg, len };
+    if (registerFormat(entry)) {
+        return -EACCES;
     }
-    if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
+    LogBufferElement *elem = newElement(entry);
+    if (!isLoggable(entry, elem)) {
         // Log traffic received to total
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_wrlock(&mLogElementsLock);
         stats.add(elem);
         stats.subtract(elem);
-        pthread_mutex_unlock(&mLogElementsLock);
+        pthread_rwlock_unlock(&mLogElementsLock);
         delete elem;
         return -EACCES;
     }
 
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    insert_Locked(elem);
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return len;
+}
+
+size_t LogBuffer::log(const LogBufferEntry *entries, size_t count) {
+    daemon_trace_poll();
+    DAEMON_TRACE_SCOPE("logd log batch");
+    // Elements are built, and deflated, before taking the lock; a NULL
+    // element marks an entry with an invalid log id or a registration.
+    std::vector<LogBufferElement *> elems(count, NULL);
+    std::vector<bool> loggable(count, false);
+    for (size_t i = 0; i < count; ++i) {
+        const LogBufferEntry &entry = entries[i];
+        if ((entry.log_id >= LOG_ID_MAX) || (entry.log_id < 0)
+                || registerFormat(entry)) {
+            continue;
+        }
+        elems[i] = newElement(entry);
+        loggable[i] = isLoggable(entry, elems[i]);
+    }
+
+    size_t logged = 0;
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    for (size_t i = 0; i < count; ++i) {
+        LogBufferElement *elem = elems[i];
+        if (!elem) {
+            continue;
+        }
+        if (!loggable[i]) {
+            // Log traffic received to total
+            stats.add(elem);
+            stats.subtract(elem);
+            delete elem;
+            continue;
+        }
+        insert_Locked(elem);
+        ++logged;
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return logged;
+}
+
+// Insert elem in time sorted order, account for it and prune to make room.
+//
+// mLogElementsLock must be held for writing when this function is called.
+void LogBuffer::insert_Locked(LogBufferElement *elem) {
+    log_time realtime = elem->getRealTime();
 
     // Insert elements in time sorted order if possible
     //  NB: if end is region locked, place element at end of list
@@ -177,6 +331,8 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 
     if (last == mLogElements.end()) {
         mLogElements.push_back(elem);
+        link(--mLogElements.end());
+        index(--mLogElements.end());
     } else {
         uint64_t end = 1;
         bool end_set = false;
@@ -203,26 +359,25 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
         if (end_always
                 || (end_set && (end >= (*last)->getSequence()))) {
             mLogElements.push_back(elem);
+            link(--mLogElements.end());
+            index(--mLogElements.end());
         } else {
-            mLogElements.insert(last,elem);
+            link(mLogElements.insert(last,elem));
         }
 
         LogTimeEntry::unlock();
     }
 
     stats.add(elem);
-    maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
-
-    return len;
+    maybePrune(elem->getLogId());
 }
 
 // Prune at most 10% of the log entries or 256, whichever is less.
 //
-// mLogElementsLock must be held when this function is called.
+// mLogElementsLock must be held for writing when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
     size_t sizes = stats.sizes(id);
-    unsigned long maxSize = log_buffer_size(id);
+    unsigned long maxSize = mPruneLimit[id];
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
         size_t elements = stats.elements(id);
@@ -238,15 +393,206 @@ void LogBuffer::maybePrune(log_id_t id) {
     }
 }
 
+// Append the entry at "it" to the chain of its uid's entries. Entries are
+// chained in the order they arrive, so a chain is in sequence order even
+// where mLogElements is not.
+void LogBuffer::link(LogBufferElementCollection::iterator it) {
+    LogBufferElement *e = *it;
+    e->mUidNext = mLogElements.end();
+    countPid(e, true);
+
+    LogBufferUidChainMap &chains = mUidChain[e->getLogId()];
+    LogBufferUidChainMap::iterator c = chains.find(e->getUid());
+    if (c == chains.end()) {
+        e->mUidPrev = mLogElements.end();
+        chains.insert(std::make_pair(e->getUid(), std::make_pair(it, it)));
+        return;
+    }
+    e->mUidPrev = c->second.second;
+    (*c->second.second)->mUidNext = it;
+    c->second.second = it;
+}
+
+void LogBuffer::unlink(LogBufferElementCollection::iterator it) {
+    LogBufferElement *e = *it;
+    LogBufferUidChainMap &chains = mUidChain[e->getLogId()];
+    LogBufferUidChainMap::iterator c = chains.find(e->getUid());
+    if (c == chains.end()) {
+        return;
+    }
+    countPid(e, false);
+    if (e->mUidPrev == mLogElements.end()) {
+        c->second.first = e->mUidNext;
+    } else {
+        (*e->mUidPrev)->mUidNext = e->mUidNext;
+    }
+    if (e->mUidNext == mLogElements.end()) {
+        c->second.second = e->mUidPrev;
+    } else {
+        (*e->mUidNext)->mUidPrev = e->mUidPrev;
+    }
+    if (c->second.first == mLogElements.end()) {
+        chains.erase(c);
+    }
+}
+
+// A pid nearly always logs as a single uid, so the list is kept short.
+void LogBuffer::countPid(const LogBufferElement *e, bool add) {
+    std::vector<std::pair<uid_t, size_t> > &uids = mPidUids[e->getPid()];
+    std::vector<std::pair<uid_t, size_t> >::iterator u = uids.begin();
+    while ((u != uids.end()) && (u->first != e->getUid())) {
+        ++u;
+    }
+    if (add) {
+        if (u == uids.end()) {
+            uids.push_back(std::make_pair(e->getUid(), 1));
+        } else {
+            ++u->second;
+        }
+        return;
+    }
+    if ((u != uids.end()) && !--u->second) {
+        uids.erase(u);
+    }
+    if (uids.empty()) {
+        mPidUids.erase(e->getPid());
+    }
+}
+
+// The oldest (or newest) entry of each uid chain that pid has entries in,
+// for the log ids of logMask, as the starting cursors of a walk that merges
+// the chains by sequence.
+void LogBuffer::pidChains_Locked(
+        pid_t pid, unsigned int logMask, bool privileged, uid_t uid,
+        bool newest, std::vector<LogBufferElementCollection::iterator> &cursors) {
+    LogBufferPidUidMap::const_iterator p = mPidUids.find(pid);
+    if (p == mPidUids.end()) {
+        return;
+    }
+    for (log_id_t id = LOG_ID_MIN; id < LOG_ID_MAX; id = (log_id_t) (id + 1)) {
+        if (!(logMask & (1 << id))) {
+            continue;
+        }
+        for (size_t i = 0; i < p->second.size(); ++i) {
+            uid_t chainUid = p->second[i].first;
+            if (!privileged && (chainUid != uid)) {
+                continue;
+            }
+            LogBufferUidChainMap::iterator c = mUidChain[id].find(chainUid);
+            if (c != mUidChain[id].end()) {
+                cursors.push_back(newest ? c->second.second : c->second.first);
+            }
+        }
+    }
+}
+
+// Entries are inserted out of order rarely enough that only those
+// appended are indexed, which keeps mIndex in mLogElements order.
+void LogBuffer::index(LogBufferElementCollection::iterator it) {
+    if (++mSinceIndexed < LOG_BUFFER_INDEX_INTERVAL) {
+        return;
+    }
+    mSinceIndexed = 0;
+    LogBufferElement *e = *it;
+    e->mIndexed = true;
+    IndexEntry entry = { e->getSequence(), e->getRealTime(), it };
+    mIndex.push_back(entry);
+}
+
+void LogBuffer::unindex(LogBufferElementCollection::iterator it) {
+    // pruning is mostly oldest first
+    if (mIndex.front().it == it) {
+        mIndex.pop_front();
+        return;
+    }
+    for (std::deque<IndexEntry>::iterator i = mIndex.begin(); i != mIndex.end(); ++i) {
+        if (i->it == it) {
+            mIndex.erase(i);
+            return;
+        }
+    }
+}
+
+// Where in mLogElements to start looking for entries newer than start.
+LogBufferElementCollection::iterator LogBuffer::seek_Locked(uint64_t start) {
+    std::deque<IndexEntry>::iterator i = mIndex.end();
+    if (!mIndex.empty() && (start < mIndex.back().sequence)) {
+        i = mIndex.begin();
+        size_t count = mIndex.size();
+        while (count) { // upper_bound on sequence
+            size_t step = count / 2;
+            if (i[step].sequence <= start) {
+                i += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        if (i == mIndex.begin()) {
+            return mLogElements.begin();
+        }
+        // One more interval back, for the entries appended out of
+        // sequence as they raced to the lock from LogBuffer::log()
+        --i;
+        if (i != mIndex.begin()) {
+            --i;
+        }
+        return i->it;
+    }
+
+    // Chances are we are better off starting from the end of the time
+    // sorted list, no more than an interval or so away.
+    LogBufferElementCollection::iterator it;
+    for (it = mLogElements.end(); it != mLogElements.begin(); /* do nothing */) {
+        --it;
+        LogBufferElement *element = *it;
+        if (element->getSequence() <= start) {
+            it++;
+            break;
+        }
+    }
+    return it;
+}
+
+uint64_t LogBuffer::seek(const log_time &realtime) {
+    uint64_t retval = 1;
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
+    std::deque<IndexEntry>::iterator i = mIndex.begin();
+    size_t count = mIndex.size();
+    while (count) { // lower_bound on realtime
+        size_t step = count / 2;
+        if (i[step].realtime < realtime) {
+            i += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    // the last one before realtime, and one more interval for good measure
+    if ((i != mIndex.begin()) && (--i != mIndex.begin())) {
+        --i;
+        retval = i->sequence - 1;
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return retval ? retval : 1;
+}
+
 LogBufferElementCollection::iterator LogBuffer::erase(
         LogBufferElementCollection::iterator it, bool engageStats) {
     LogBufferElement *e = *it;
     log_id_t id = e->getLogId();
 
+    if (e->mIndexed) {
+        unindex(it);
+    }
+
     LogBufferIteratorMap::iterator f = mLastWorstUid[id].find(e->getUid());
     if ((f != mLastWorstUid[id].end()) && (it == f->second)) {
         mLastWorstUid[id].erase(f);
     }
+    unlink(it);
     it = mLogElements.erase(it);
     if (engageStats) {
         stats.subtract(e);
@@ -258,6 +604,17 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     return it;
 }
 
+// Replace the element at "it" with a chatty placeholder counting one
+// dropped entry, releasing the memory held by its message.
+LogBufferElement *LogBuffer::drop(LogBufferElementCollection::iterator it) {
+    LogBufferElement *e = *it;
+    stats.drop(e);
+    LogBufferElement *dropped = new (0) LogBufferElement(*e, 1);
+    *it = dropped;
+    delete e;
+    return dropped;
+}
+
 // Define a temporary mechanism to report the last LogBufferElement pointer
 // for the specified uid, pid and tid. Used below to help merge-sort when
 // pruning for worst UID.
@@ -372,9 +729,10 @@ public:
 // The third thread is optional, and only gets hit if there was a whitelist
 // and more needs to be pruned against the backstop of the region lock.
 //
-// mLogElementsLock must be held when this function is called.
+// mLogElementsLock must be held for writing when this function is called.
 //
 void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
+    DAEMON_TRACE_SCOPE("logd prune");
     LogTimeEntry *oldest = NULL;
 
     LogTimeEntry::lock();
@@ -477,6 +835,64 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         lastt = mLogElements.end();
         --lastt;
         LogBufferElementLast last;
+        // Resuming from the worst uid's watermark with no blacklist to apply,
+        // only its own entries need looking at, so follow its uid chain.
+        while (!leading && !hasBlacklist && (it != mLogElements.end())) {
+            LogBufferElement *e = *it;
+            LogBufferElementCollection::iterator next = e->mUidNext;
+
+            if (oldest && (oldest->mStart <= e->getSequence())) {
+                break;
+            }
+
+            // The full walk would have expired stale merge targets at the
+            // other uids' entries in between.
+            last.clear(e);
+
+            // merge any drops
+            unsigned short dropped = e->getDropped();
+            if (dropped && last.merge(e, dropped)) {
+                erase(it, false);
+                it = next;
+                continue;
+            }
+
+            if ((e->getRealTime() < ((*lastt)->getRealTime() - too_old))
+                    || (e->getRealTime() > (*lastt)->getRealTime())) {
+                break;
+            }
+
+            if (dropped) {
+                last.add(e);
+                mLastWorstUid[id][worst] = it;
+                it = next;
+                continue;
+            }
+
+            pruneRows--;
+            if (pruneRows == 0) {
+                break;
+            }
+
+            kick = true;
+
+            unsigned short len = e->getMsgLen();
+            e = drop(it);
+            if (last.merge(e, 1)) {
+                erase(it, false);
+            } else {
+                last.add(e);
+                mLastWorstUid[id][worst] = it;
+            }
+            it = next;
+            if (worst_sizes < second_worst_sizes) {
+                break;
+            }
+            worst_sizes -= len;
+        }
+        if (!leading && !hasBlacklist) {
+            it = mLogElements.end();
+        }
         while (it != mLogElements.end()) {
             LogBufferElement *e = *it;
 
@@ -562,8 +978,7 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             if (leading) {
                 it = erase(it);
             } else {
-                stats.drop(e);
-                e->setDropped(1);
+                e = drop(it);
                 if (last.merge(e, 1)) {
                     it = erase(it, false);
                 } else {
@@ -653,16 +1068,16 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
 // clear all rows of type "id" from the buffer.
 void LogBuffer::clear(log_id_t id, uid_t uid) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
     prune(id, ULONG_MAX, uid);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
 }
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
     size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
@@ -672,43 +1087,161 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
     log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
+    mPruneLimit[id] = size;
+    // Leave a shrunk buffer to the pruner thread rather than to the writers
+    if (stats.sizes(id) > size) {
+        if (!mPrunerStarted) {
+            pthread_attr_t attr;
+            if (!pthread_attr_init(&attr)) {
+                pthread_t thread;
+                mPrunerStarted =
+                    !pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)
+                    && !pthread_create(&thread, &attr, pruneThreadStart, this);
+                pthread_attr_destroy(&attr);
+            }
+        }
+        if (mPrunerStarted) {
+            mPruneLimit[id] = stats.sizes(id);
+            sem_post(&mPrunerWake);
+        }
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
     return 0;
 }
 
+void *LogBuffer::pruneThreadStart(void *obj) {
+    prctl(PR_SET_NAME, "logd.pruner");
+
+    LogBuffer *me = reinterpret_cast<LogBuffer *>(obj);
+    while (!sem_wait(&me->mPrunerWake) || (errno == EINTR)) {
+        me->pruneDown();
+    }
+
+    return NULL;
+}
+
+// Prune every log id that setSize() left above its size down to it, a step
+// at a time, taking mLogElementsLock for one step only.
+void LogBuffer::pruneDown() {
+    bool behind;
+    do {
+        bool progress = false;
+        behind = false;
+
+        log_id_for_each(id) {
+            pthread_rwlock_wrlock(&mLogElementsLock);
+            unsigned long maxSize = log_buffer_size(id);
+            if (mPruneLimit[id] > maxSize) {
+                size_t sizes = stats.sizes(id);
+                if (sizes > maxSize) {
+                    prune(id, PRUNE_STEP_ROWS);
+                    progress |= stats.sizes(id) < sizes;
+                    sizes = stats.sizes(id);
+                }
+                mPruneLimit[id] = std::max<unsigned long>(maxSize, sizes);
+                behind |= mPruneLimit[id] > maxSize;
+            }
+            pthread_rwlock_unlock(&mLogElementsLock);
+        }
+
+        if (behind) {
+            usleep(progress ? PRUNE_STEP_DELAY_US : PRUNE_BLOCKED_DELAY_US);
+        }
+    } while (behind);
+}
+
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
     size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
 uint64_t LogBuffer::flushTo(
         SocketClient *reader, const uint64_t start, bool privileged,
-        int (*filter)(const LogBufferElement *element, void *arg), void *arg) {
+        int (*filter)(const LogBufferElement *element, void *arg), void *arg,
+        bool yield, LogFrame *frame, pid_t pid, unsigned int logMask) {
+    DAEMON_TRACE_SCOPE("logd flushTo");
     LogBufferElementCollection::iterator it;
     uint64_t max = start;
     uid_t uid = reader->getUid();
+    unsigned filtered = 0;
+
+    // Readers only share the lock, so they do not hold each other up, and
+    // drop it while writing to their socket.
+    pthread_rwlock_rdlock(&mLogElementsLock);
+
+    if (pid) {
+        // Merge the pid's chains oldest first. The walk is short, so the
+        // lock is only dropped to send; the region lock keeps the entries
+        // the cursors are on from being pruned meanwhile.
+        std::vector<LogBufferElementCollection::iterator> cursors;
+        pidChains_Locked(pid, logMask, privileged, uid, false, cursors);
+        for (;;) {
+            size_t next = cursors.size();
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if ((cursors[i] != mLogElements.end())
+                        && ((next == cursors.size())
+                            || ((*cursors[i])->getSequence()
+                                < (*cursors[next])->getSequence()))) {
+                    next = i;
+                }
+            }
+            if (next == cursors.size()) {
+                break;
+            }
+            it = cursors[next];
+            LogBufferElement *element = *it;
+
+            if ((element->getPid() != pid)
+                    || (element->getSequence() <= start)) {
+                cursors[next] = element->mUidNext;
+                continue;
+            }
+
+            // NB: calling out to another object with mLogElementsLock held (safe)
+            if (filter) {
+                int ret = (*filter)(element, arg);
+                if (ret == false) {
+                    cursors[next] = element->mUidNext;
+                    continue;
+                }
+                if (ret != true) {
+                    break;
+                }
+            }
+
+            pthread_rwlock_unlock(&mLogElementsLock);
+
+            // range locking in LastLogTimes looks after us
+            max = element->flushTo(reader, this, frame);
+
+            if (max == element->FLUSH_ERROR) {
+                return max;
+            }
+
+            pthread_rwlock_rdlock(&mLogElementsLock);
+            // *it may have been replaced by drop() in the meantime
+            cursors[next] = (*it)->mUidNext;
+        }
+        pthread_rwlock_unlock(&mLogElementsLock);
+
+        if (frame && frame->flush(reader)) {
+            return LogBufferElement::FLUSH_ERROR;
+        }
 
-    pthread_mutex_lock(&mLogElementsLock);
+        return max;
+    }
 
     if (start <= 1) {
         // client wants to start from the beginning
         it = mLogElements.begin();
     } else {
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        for (it = mLogElements.end(); it != mLogElements.begin(); /* do nothing */) {
-            --it;
-            LogBufferElement *element = *it;
-            if (element->getSequence() <= start) {
-                it++;
-                break;
-            }
-        }
+        // Client wants to start from some specified time
+        it = seek_Locked(start);
     }
 
     for (; it != mLogElements.end(); ++it) {
@@ -726,6 +1259,17 @@ uint64_t LogBuffer::flushTo(
         if (filter) {
             int ret = (*filter)(element, arg);
             if (ret == false) {
+                // The filter has moved our region lock up to this element,
+                // so let log() and prune() in now and then during long
+                // runs of entries we are not interested in. prune() only
+                // honours that lock for the ids we watch, so the element
+                // we stand on must be one of those, or it could be freed.
+                if (yield && (++filtered >= FLUSH_YIELD_ELEMENTS)
+                        && (logMask & (1 << element->getLogId()))) {
+                    filtered = 0;
+                    pthread_rwlock_unlock(&mLogElementsLock);
+                    pthread_rwlock_rdlock(&mLogElementsLock);
+                }
                 continue;
             }
             if (ret != true) {
@@ -733,26 +1277,113 @@ uint64_t LogBuffer::flushTo(
             }
         }
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        pthread_rwlock_unlock(&mLogElementsLock);
 
         // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader, this);
+        max = element->flushTo(reader, this, frame);
 
         if (max == element->FLUSH_ERROR) {
             return max;
         }
 
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_rdlock(&mLogElementsLock);
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    if (frame && frame->flush(reader)) {
+        return LogBufferElement::FLUSH_ERROR;
     }
-    pthread_mutex_unlock(&mLogElementsLock);
 
     return max;
 }
 
+uint64_t LogBuffer::flushToReverse(
+        SocketClient *reader, const uint64_t start, bool privileged,
+        int (*filter)(const LogBufferElement *element, void *arg), void *arg,
+        pid_t pid, unsigned int logMask) {
+    DAEMON_TRACE_SCOPE("logd flushToReverse");
+    uid_t uid = reader->getUid();
+    uint64_t first = 0;
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
+
+    if (pid) {
+        // Merge the pid's chains newest first
+        std::vector<LogBufferElementCollection::iterator> cursors;
+        pidChains_Locked(pid, logMask, privileged, uid, true, cursors);
+        for (;;) {
+            size_t next = cursors.size();
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if ((cursors[i] != mLogElements.end())
+                        && ((next == cursors.size())
+                            || ((*cursors[i])->getSequence()
+                                > (*cursors[next])->getSequence()))) {
+                    next = i;
+                }
+            }
+            if (next == cursors.size()) {
+                break;
+            }
+            LogBufferElement *element = *cursors[next];
+
+            if (element->getSequence() <= start) {
+                cursors[next] = mLogElements.end();
+                continue;
+            }
+            cursors[next] = element->mUidPrev;
+
+            if (element->getPid() != pid) {
+                continue;
+            }
+
+            first = element->getSequence();
+
+            // NB: calling out to another object with mLogElementsLock held (safe)
+            if ((*filter)(element, arg)) {
+                break;
+            }
+        }
+
+        pthread_rwlock_unlock(&mLogElementsLock);
+
+        return first ? (first - 1) : start;
+    }
+
+    LogBufferElementCollection::iterator it = mLogElements.end();
+    while (it != mLogElements.begin()) {
+        LogBufferElement *element = *--it;
+
+        if (element->getSequence() <= start) {
+            break;
+        }
+
+        if (!privileged && (element->getUid() != uid)) {
+            continue;
+        }
+
+        first = element->getSequence();
+
+        // NB: calling out to another object with mLogElementsLock held (safe)
+        if ((*filter)(element, arg)) {
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return first ? (first - 1) : start;
+}
+
 void LogBuffer::formatStatistics(char **strp, uid_t uid, unsigned int logMask) {
-    pthread_mutex_lock(&mLogElementsLock);
+    // The tables are bounded, a copy is quick to take. Rendering it, and the
+    // name lookups that go with it, then holds up no one logging.
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    LogStatistics snapshot(stats);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
-    stats.format(strp, uid, logMask);
+    snapshot.format(strp, uid, logMask);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    stats.adoptNames(snapshot);
+    pthread_rwlock_unlock(&mLogElementsLock);
 }
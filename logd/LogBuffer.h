@@ -17,9 +17,13 @@
 #ifndef _LOGD_LOG_BUFFER_H__
 #define _LOGD_LOG_BUFFER_H__
 
+#include <semaphore.h>
 #include <sys/types.h>
 
+#include <deque>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include <log/log.h>
 #include <sysutils/SocketClient.h>
@@ -31,11 +35,21 @@
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
 
-typedef std::list<LogBufferElement *> LogBufferElementCollection;
+// A message as received from a writer, see LogBuffer::log(entries, count)
+struct LogBufferEntry {
+    log_id_t log_id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    const char *msg;
+    unsigned short len;
+};
 
 class LogBuffer {
     LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    // Held for reading by flushTo() and for writing by everything else
+    pthread_rwlock_t mLogElementsLock;
 
     LogStatistics stats;
 
@@ -45,8 +59,38 @@ class LogBuffer {
                                LogBufferElementCollection::iterator>
                 LogBufferIteratorMap;
     LogBufferIteratorMap mLastWorstUid[LOG_ID_MAX];
+    // oldest and newest entry of each uid, see LogBufferElement::mUidNext
+    typedef std::unordered_map<uid_t,
+                               std::pair<LogBufferElementCollection::iterator,
+                                         LogBufferElementCollection::iterator> >
+                LogBufferUidChainMap;
+    LogBufferUidChainMap mUidChain[LOG_ID_MAX];
+    // how many entries each pid has in the chains of each uid it logged
+    // as, so that readers of a single pid can walk just those chains
+    typedef std::unordered_map<pid_t,
+                               std::vector<std::pair<uid_t, size_t> > >
+                LogBufferPidUidMap;
+    LogBufferPidUidMap mPidUids;
 
     unsigned long mMaxSize[LOG_ID_MAX];
+    // What maybePrune() holds each log id to. Stays above mMaxSize after
+    // setSize() shrinks a full buffer, while the pruner thread works it down
+    // a step at a time, so that writers don't have to prune it all at once.
+    unsigned long mPruneLimit[LOG_ID_MAX];
+    bool mPrunerStarted;
+    sem_t mPrunerWake;
+
+    bool mCompress;
+
+    // Every LOG_BUFFER_INDEX_INTERVAL'th entry appended to mLogElements,
+    // oldest first, for readers to binary search where they are to start.
+    struct IndexEntry {
+        uint64_t sequence;
+        log_time realtime;
+        LogBufferElementCollection::iterator it;
+    };
+    std::deque<IndexEntry> mIndex;
+    unsigned int mSinceIndexed;
 
 public:
     LastLogTimes &mTimes;
@@ -57,10 +101,33 @@ public:
     int log(log_id_t log_id, log_time realtime,
             uid_t uid, pid_t pid, pid_t tid,
             const char *msg, unsigned short len);
+    // Log a batch of entries under a single lock, returns how many of them
+    // made it into the buffer.
+    size_t log(const LogBufferEntry *entries, size_t count);
+    // yield: the filter is a LogTimeEntry pass, whose region lock lets us
+    // drop mLogElementsLock between the entries it filters out.
+    // frame: collect entries into it, sending it when full and at the end.
+    // pid: if not zero, only that pid's entries in the log ids of logMask
+    // are handed to filter, found through the uid chains it logged into
+    // rather than by walking every entry in the buffer.
     uint64_t flushTo(SocketClient *writer, const uint64_t start,
                      bool privileged,
                      int (*filter)(const LogBufferElement *element, void *arg) = NULL,
-                     void *arg = NULL);
+                     void *arg = NULL, bool yield = false,
+                     LogFrame *frame = NULL,
+                     pid_t pid = 0, unsigned int logMask = -1);
+    // Walk back from the newest entry to those after start, handing each
+    // to filter until it returns true. Returns where to flushTo() from to
+    // begin with the last entry handed over, or start if it never did.
+    // pid and logMask narrow the walk as they do for flushTo().
+    uint64_t flushToReverse(SocketClient *writer, const uint64_t start,
+                            bool privileged,
+                            int (*filter)(const LogBufferElement *element, void *arg),
+                            void *arg, pid_t pid = 0,
+                            unsigned int logMask = -1);
+    // Where to flushTo() from to see every entry logged at realtime or
+    // later, without walking all those before them.
+    uint64_t seek(const log_time &realtime);
 
     void clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -73,6 +140,10 @@ public:
         stats.enableStatistics();
     }
 
+    // Hold long messages deflated; the statistics and the size limits
+    // then count the deflated bytes.
+    void enableCompression() { mCompress = true; }
+
     int initPrune(char *cp) { return mPrune.init(cp); }
     // *strp uses malloc, use free to release.
     void formatPrune(char **strp) { mPrune.format(strp); }
@@ -81,14 +152,28 @@ public:
     char *pidToName(pid_t pid) { return stats.pidToName(pid); }
     uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
     char *uidToName(uid_t uid) { return stats.uidToName(uid); }
-    void lock() { pthread_mutex_lock(&mLogElementsLock); }
-    void unlock() { pthread_mutex_unlock(&mLogElementsLock); }
+    void lock() { pthread_rwlock_wrlock(&mLogElementsLock); }
+    void unlock() { pthread_rwlock_unlock(&mLogElementsLock); }
 
 private:
+    LogBufferElement *newElement(const LogBufferEntry &entry);
+    void insert_Locked(LogBufferElement *elem);
     void maybePrune(log_id_t id);
+    static void *pruneThreadStart(void *obj);
+    void pruneDown();
+    void link(LogBufferElementCollection::iterator it);
+    void unlink(LogBufferElementCollection::iterator it);
+    void countPid(const LogBufferElement *e, bool add);
+    void pidChains_Locked(pid_t pid, unsigned int logMask, bool privileged,
+                          uid_t uid, bool newest,
+                          std::vector<LogBufferElementCollection::iterator> &cursors);
+    void index(LogBufferElementCollection::iterator it);
+    void unindex(LogBufferElementCollection::iterator it);
+    LogBufferElementCollection::iterator seek_Locked(uint64_t start);
     void prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool engageStats = true);
+    LogBufferElement *drop(LogBufferElementCollection::iterator it);
 };
 
 #endif // _LOGD_LOG_BUFFER_H__
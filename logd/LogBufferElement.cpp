@@ -17,16 +17,20 @@
 #include <ctype.h>
 #include <endian.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <log/logger.h>
 #include <private/android_logger.h>
 
 #include "LogBufferElement.h"
 #include "LogCommand.h"
+#include "LogFormats.h"
+#include "LogFrame.h"
 #include "LogReader.h"
 
 const uint64_t LogBufferElement::FLUSH_ERROR(0);
@@ -34,29 +38,112 @@ atomic_int_fast64_t LogBufferElement::sequence(1);
 
 LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
                                    uid_t uid, pid_t pid, pid_t tid,
-                                   const char *msg, unsigned short len) :
+                                   const char *msg, unsigned short len,
+                                   unsigned short rawLen) :
         mLogId(log_id),
         mUid(uid),
         mPid(pid),
         mTid(tid),
         mMsgLen(len),
+        mRawLen(rawLen),
         mSequence(sequence.fetch_add(1, memory_order_relaxed)),
-        mRealTime(realtime) {
-    mMsg = new char[len];
+        mRealTime(realtime),
+        mIndexed(false) {
+    mMsg = reinterpret_cast<char *>(this + 1);
     memcpy(mMsg, msg, len);
 }
 
+LogBufferElement::LogBufferElement(const LogBufferElement &elem,
+                                   unsigned short dropped) :
+        mLogId(elem.mLogId),
+        mUid(elem.mUid),
+        mPid(elem.mPid),
+        mTid(elem.mTid),
+        mMsg(NULL),
+        mDropped(dropped),
+        mRawLen(0),
+        mSequence(elem.mSequence),
+        mRealTime(elem.mRealTime),
+        mUidPrev(elem.mUidPrev),
+        mUidNext(elem.mUidNext),
+        mIndexed(elem.mIndexed) {
+}
+
 LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
 }
 
 uint32_t LogBufferElement::getTag() const {
-    if ((mLogId != LOG_ID_EVENTS) || !mMsg || (mMsgLen < sizeof(uint32_t))) {
+    if ((mLogId != LOG_ID_EVENTS) || !mMsg || mRawLen
+            || (mMsgLen < sizeof(uint32_t))) {
         return 0;
     }
     return le32toh(reinterpret_cast<android_event_header_t *>(mMsg)->tag);
 }
 
+bool LogBufferElement::isDeferred() const {
+    // never deflated, see compressMessage()
+    return (mLogId != LOG_ID_EVENTS) && mMsg && !mRawLen && mMsgLen
+        && (static_cast<unsigned char>(mMsg[0]) & LOGGER_DEFERRED);
+}
+
+// Each reader thread keeps its own inflate stream, reset between messages
+// rather than set up and torn down for each as uncompress() would.
+static pthread_key_t sInflateKey;
+static pthread_once_t sInflateOnce = PTHREAD_ONCE_INIT;
+
+static void freeInflate(void *arg) {
+    z_stream *stream = static_cast<z_stream *>(arg);
+    inflateEnd(stream);
+    delete stream;
+}
+
+static void createInflateKey() {
+    pthread_key_create(&sInflateKey, freeInflate);
+}
+
+static z_stream *threadInflate() {
+    pthread_once(&sInflateOnce, createInflateKey);
+    z_stream *stream = static_cast<z_stream *>(pthread_getspecific(sInflateKey));
+    if (stream) {
+        inflateReset(stream);
+        return stream;
+    }
+    stream = new z_stream();
+    if (inflateInit(stream) != Z_OK) {
+        delete stream;
+        return NULL;
+    }
+    pthread_setspecific(sInflateKey, stream);
+    return stream;
+}
+
+const char *LogBufferElement::getMsg(char *scratch, unsigned short *len) const {
+    if (!mMsg) {
+        return NULL;
+    }
+    if (isDeferred()) {
+        *len = LogFormats::format(mUid, mMsg, mMsgLen, scratch);
+        return scratch;
+    }
+    if (!mRawLen) {
+        *len = mMsgLen;
+        return mMsg;
+    }
+    z_stream *stream = threadInflate();
+    if (!stream) {
+        return NULL;
+    }
+    stream->next_in = reinterpret_cast<Bytef *>(mMsg);
+    stream->avail_in = mMsgLen;
+    stream->next_out = reinterpret_cast<Bytef *>(scratch);
+    stream->avail_out = LOGGER_ENTRY_MAX_PAYLOAD;
+    if (inflate(stream, Z_FINISH) != Z_STREAM_END) {
+        return NULL;
+    }
+    *len = stream->total_out;
+    return scratch;
+}
+
 // caller must own and free character string
 char *android::tidToName(pid_t tid) {
     char *retval = NULL;
@@ -190,7 +277,8 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
     return retval;
 }
 
-uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent) {
+uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
+                                   LogFrame *frame) {
     struct logger_entry_v3 entry;
 
     memset(&entry, 0, sizeof(struct logger_entry_v3));
@@ -207,6 +295,7 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent) {
     iovec[0].iov_len = sizeof(struct logger_entry_v3);
 
     char *buffer = NULL;
+    char scratch[LOGGER_ENTRY_MAX_PAYLOAD];
 
     if (!mMsg) {
         entry.len = populateDroppedMessage(buffer, parent);
@@ -214,13 +303,21 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent) {
             return mSequence;
         }
         iovec[1].iov_base = buffer;
+    } else if (mRawLen || isDeferred()) {
+        unsigned short len;
+        if (!getMsg(scratch, &len)) {
+            return mSequence;
+        }
+        entry.len = len;
+        iovec[1].iov_base = scratch;
     } else {
         entry.len = mMsgLen;
         iovec[1].iov_base = mMsg;
     }
     iovec[1].iov_len = entry.len;
 
-    uint64_t retval = reader->sendDatav(iovec, 2) ? FLUSH_ERROR : mSequence;
+    int ret = frame ? frame->add(reader, iovec, 2) : reader->sendDatav(iovec, 2);
+    uint64_t retval = ret ? FLUSH_ERROR : mSequence;
 
     if (buffer) {
         free(buffer);
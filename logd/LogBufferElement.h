@@ -21,11 +21,18 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include <list>
+#include <new>
+
 #include <sysutils/SocketClient.h>
 #include <log/log.h>
 #include <log/log_read.h>
 
 class LogBuffer;
+class LogBufferElement;
+class LogFrame;
+
+typedef std::list<LogBufferElement *> LogBufferElementCollection;
 
 #define EXPIRE_HOUR_THRESHOLD 24 // Only expire chatty UID logs to preserve
                                  // non-chatty UIDs less than this age in hours
@@ -43,41 +50,80 @@ class LogBufferElement {
         const unsigned short mMsgLen; // mMSg != NULL
         unsigned short mDropped;      // mMsg == NULL
     };
+    const unsigned short mRawLen; // mMsg is deflated if not zero
     const uint64_t mSequence;
     const log_time mRealTime;
     static atomic_int_fast64_t sequence;
+    // the message follows the element in the same allocation, see new()
 
     // assumption: mMsg == NULL
     size_t populateDroppedMessage(char *&buffer,
                                   LogBuffer *parent);
 
 public:
+    // An element and its message are a single allocation, so every element
+    // must be created with new (len) LogBufferElement(...).
+    static void *operator new(size_t size, unsigned short len) {
+        return ::operator new(size + len);
+    }
+    static void operator delete(void *p) { ::operator delete(p); }
+    static void operator delete(void *p, unsigned short) { ::operator delete(p); }
+
+    // If rawLen is not zero, msg is deflated and inflates to rawLen bytes.
     LogBufferElement(log_id_t log_id, log_time realtime,
                      uid_t uid, pid_t pid, pid_t tid,
-                     const char *msg, unsigned short len);
+                     const char *msg, unsigned short len,
+                     unsigned short rawLen = 0);
+    // A message-less copy of elem standing in for dropped entries, built
+    // with new (0) so that the message memory goes away with the original.
+    // It takes over elem's place in its uid chain.
+    LogBufferElement(const LogBufferElement &elem, unsigned short dropped);
     virtual ~LogBufferElement();
 
+    // The older and newer entries of the same log id and uid, linking each
+    // uid's entries in LogBuffer::mLogElements in the order they were
+    // added; the list's end() terminates. Maintained by LogBuffer.
+    LogBufferElementCollection::iterator mUidPrev;
+    LogBufferElementCollection::iterator mUidNext;
+    // Has an entry in LogBuffer::mIndex, maintained by LogBuffer
+    bool mIndexed;
+
     log_id_t getLogId() const { return mLogId; }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
     unsigned short getDropped(void) const { return mMsg ? 0 : mDropped; }
+    // Does not release the message memory, see LogBuffer::drop()
     unsigned short setDropped(unsigned short value) {
-        if (mMsg) {
-            free(mMsg);
-            mMsg = NULL;
-        }
+        mMsg = NULL;
         return mDropped = value;
     }
+    // the bytes held in memory, which may be less than the reader receives
     unsigned short getMsgLen() const { return mMsg ? mMsgLen : 0; }
+    // What an element holding len bytes of message takes of the heap: the
+    // element and message, allocated together, and its node in
+    // LogBuffer::mLogElements, each rounded up to the allocator's granule.
+    static size_t getMemory(unsigned short len) {
+        return ((sizeof(LogBufferElement) + len + 15) & ~15)
+             + ((3 * sizeof(void *) + 15) & ~15);
+    }
+    size_t getMemory() const { return getMemory(getMsgLen()); }
     uint64_t getSequence(void) const { return mSequence; }
     static uint64_t getCurrentSequence(void) { return sequence.load(memory_order_relaxed); }
     log_time getRealTime(void) const { return mRealTime; }
 
     uint32_t getTag(void) const;
+    // A text log whose arguments logd formats once read, see LOGGER_DEFERRED
+    bool isDeferred(void) const;
+    // The message as the reader would receive it, inflated or formatted
+    // into scratch (LOGGER_ENTRY_MAX_PAYLOAD bytes) if need be; NULL if
+    // dropped.
+    const char *getMsg(char *scratch, unsigned short *len) const;
 
     static const uint64_t FLUSH_ERROR;
-    uint64_t flushTo(SocketClient *writer, LogBuffer *parent);
+    // frame, if not NULL, collects the entry rather than it being sent
+    uint64_t flushTo(SocketClient *writer, LogBuffer *parent,
+                     LogFrame *frame = NULL);
 };
 
 #endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include <log/logger.h>
+
+#include "LogFilter.h"
+#include "LogUtils.h"
+
+LogFilter::LogFilter() :
+        mDefaultPriority(ANDROID_LOG_VERBOSE),
+        mUid(uid_all),
+        mHasRegex(false) {
+}
+
+LogFilter::~LogFilter() {
+    if (mHasRegex) {
+        regfree(&mRegex);
+    }
+}
+
+// same letters as liblog's filterCharToPri()
+static int charToPriority(char c) {
+    if (isdigit(c)) {
+        return c - '0';
+    }
+    switch (tolower(c)) {
+    case 'v': return ANDROID_LOG_VERBOSE;
+    case 'd': return ANDROID_LOG_DEBUG;
+    case 'i': return ANDROID_LOG_INFO;
+    case 'w': return ANDROID_LOG_WARN;
+    case 'e': return ANDROID_LOG_ERROR;
+    case 'f': return ANDROID_LOG_FATAL;
+    case 's': return ANDROID_LOG_SILENT;
+    }
+    return ANDROID_LOG_UNKNOWN;
+}
+
+int LogFilter::initTags(const char *spec) {
+    mTagPriority.clear();
+    mDefaultPriority = ANDROID_LOG_VERBOSE;
+
+    while (*spec) {
+        const char *colon = strchr(spec, ':');
+        if (!colon || (colon == spec)) {
+            return 1;
+        }
+        int priority = charToPriority(colon[1]);
+        if ((priority == ANDROID_LOG_UNKNOWN)
+                || (colon[2] && (colon[2] != ','))) {
+            return 1;
+        }
+        std::string tag(spec, colon - spec);
+        if (tag == "*") {
+            mDefaultPriority = priority;
+        } else {
+            mTagPriority[tag] = priority;
+        }
+        spec = colon + 2;
+        if (*spec == ',') {
+            ++spec;
+        }
+    }
+    return 0;
+}
+
+int LogFilter::initRegex(const char *regex) {
+    if (mHasRegex) {
+        regfree(&mRegex);
+        mHasRegex = false;
+    }
+    if (regcomp(&mRegex, regex, REG_EXTENDED | REG_NOSUB)) {
+        return 1;
+    }
+    mHasRegex = true;
+    return 0;
+}
+
+bool LogFilter::isLoggable(const LogBufferElement *element) const {
+    if ((mUid != uid_all) && (mUid != element->getUid())) {
+        return false;
+    }
+
+    if (mTagPriority.empty() && !mHasRegex) {
+        return mDefaultPriority <= ANDROID_LOG_FATAL;
+    }
+
+    // chatty placeholders carry neither tag nor text, they are reported
+    // as "chatty" at INFO, the way the reader will see them.
+    if (element->getDropped()) {
+        std::unordered_map<std::string, int>::const_iterator it =
+            mTagPriority.find("chatty");
+        int priority = (it != mTagPriority.end()) ? it->second : mDefaultPriority;
+        return priority <= ANDROID_LOG_INFO;
+    }
+
+    const char *tag;
+    int priority;
+    char scratch[LOGGER_ENTRY_MAX_PAYLOAD + 1];
+    const char *msg = NULL;
+    unsigned short len = 0;
+
+    if (element->getLogId() == LOG_ID_EVENTS) {
+        tag = android::tagToName(element->getTag());
+        priority = ANDROID_LOG_INFO;
+    } else {
+        msg = element->getMsg(scratch, &len);
+        if (!msg || (len < 2)) {
+            return false;
+        }
+        priority = msg[0];
+        tag = msg + 1;
+        size_t tagLen = strnlen(tag, len - 1);
+        if (tagLen >= (size_t)(len - 1)) {
+            return false;
+        }
+        msg = tag + tagLen + 1;
+        len -= tagLen + 2;
+    }
+
+    std::unordered_map<std::string, int>::const_iterator it =
+        tag ? mTagPriority.find(tag) : mTagPriority.end();
+    int minPriority = (it != mTagPriority.end()) ? it->second : mDefaultPriority;
+    if (priority < minPriority) {
+        return false;
+    }
+
+    if (!mHasRegex) {
+        return true;
+    }
+    if (!msg) {
+        return false;
+    }
+
+    // the text is normally nul terminated, but the writer is not trusted
+    if (!len || msg[len - 1]) {
+        if (msg != scratch) {
+            memmove(scratch, msg, len);
+        }
+        scratch[len] = '\0';
+        msg = scratch;
+    }
+    return regexec(&mRegex, msg, 0, NULL, 0) == 0;
+}
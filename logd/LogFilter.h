@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FILTER_H__
+#define _LOGD_LOG_FILTER_H__
+
+#include <regex.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "LogBufferElement.h"
+
+// A reader's tag/priority, uid and message filters, parsed and compiled
+// once when the reader connects and then applied to every entry in
+// LogTimeEntry's flushTo filters, so that unwanted entries are never sent.
+class LogFilter {
+    // minimum priority by tag, with mDefaultPriority for the rest
+    std::unordered_map<std::string, int> mTagPriority;
+    int mDefaultPriority;
+    uid_t mUid;
+    bool mHasRegex;
+    regex_t mRegex;
+
+public:
+    static const uid_t uid_all = (uid_t) -1;
+
+    LogFilter();
+    ~LogFilter();
+
+    // "TAG:P,TAG:P,*:P" using logcat's filterspec priority letters.
+    // Returns non-zero on a parse error.
+    int initTags(const char *spec);
+    void setUid(uid_t uid) { mUid = uid; }
+    // Extended POSIX regular expression matched against the message text
+    // of non-binary logs. Returns non-zero if it does not compile.
+    int initRegex(const char *regex);
+
+    bool isLoggable(const LogBufferElement *element) const;
+};
+
+#endif // _LOGD_LOG_FILTER_H__
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+#include "LogFormats.h"
+
+pthread_rwlock_t LogFormats::formatsLock = PTHREAD_RWLOCK_INITIALIZER;
+std::unordered_map<uint64_t, std::string> LogFormats::formats;
+std::unordered_map<uid_t, size_t> LogFormats::uidFormats;
+size_t LogFormats::sizes;
+
+static uint64_t formatKey(uid_t uid, uint32_t id) {
+    return (static_cast<uint64_t>(uid) << 32) | id;
+}
+
+int LogFormats::add(uid_t uid, const char *msg, unsigned short len) {
+    uint32_t id;
+    if ((len < (1 + sizeof(id) + 1)) || msg[len - 1]) {
+        return -EINVAL;
+    }
+    memcpy(&id, msg + 1, sizeof(id));
+    const char *fmt = msg + 1 + sizeof(id);
+    size_t fmtLen = len - 1 - sizeof(id) - 1;
+    if (strlen(fmt) != fmtLen) {
+        return -EINVAL;
+    }
+    uint64_t key = formatKey(uid, id);
+
+    pthread_rwlock_wrlock(&formatsLock);
+    std::unordered_map<uint64_t, std::string>::iterator it = formats.find(key);
+    if (it != formats.end()) {
+        // Same process registering again after logd or it restarted,
+        // or a hash collision, in which case the latest wins.
+        sizes -= it->second.length();
+        sizes += fmtLen;
+        it->second.assign(fmt, fmtLen);
+        pthread_rwlock_unlock(&formatsLock);
+        return 0;
+    }
+    size_t &count = uidFormats[uid];
+    if ((formats.size() >= LOG_FORMATS_MAX) || (count >= LOG_FORMATS_UID_MAX)
+            || ((sizes + fmtLen) > LOG_FORMATS_SIZE)) {
+        pthread_rwlock_unlock(&formatsLock);
+        return -ENOSPC;
+    }
+    formats[key].assign(fmt, fmtLen);
+    ++count;
+    sizes += fmtLen;
+    pthread_rwlock_unlock(&formatsLock);
+    return 0;
+}
+
+unsigned short LogFormats::format(uid_t uid, const char *msg, unsigned short len,
+                                  char *buffer) {
+    // priority and tag are copied as they are
+    size_t tagLen = (len > 1) ? strnlen(msg + 1, len - 1) : 0;
+    size_t hdrLen = 1 + tagLen + 1;
+    uint32_t id;
+    if ((hdrLen + sizeof(id)) > len) {
+        buffer[0] = ANDROID_LOG_INFO;
+        buffer[1] = '\0';
+        hdrLen = 2;
+        id = 0;
+    } else {
+        memcpy(buffer, msg, hdrLen);
+        buffer[0] &= ~LOGGER_DEFERRED;
+        memcpy(&id, msg + hdrLen, sizeof(id));
+    }
+    const char *args = msg + hdrLen + sizeof(id);
+    size_t argsLen = (len > (hdrLen + sizeof(id))) ? (len - hdrLen - sizeof(id)) : 0;
+
+    char *text = buffer + hdrLen;
+    size_t textLen = LOGGER_ENTRY_MAX_PAYLOAD - hdrLen;
+    ssize_t ret = -1;
+
+    pthread_rwlock_rdlock(&formatsLock);
+    std::unordered_map<uint64_t, std::string>::const_iterator it =
+        formats.find(formatKey(uid, id));
+    bool found = it != formats.end();
+    if (found) {
+        ret = __android_log_deferred_format(it->second.c_str(), args, argsLen,
+                                            text, textLen);
+    }
+    pthread_rwlock_unlock(&formatsLock);
+
+    if (ret < 0) {
+        ret = snprintf(text, textLen, found
+                ? "<format %08x does not match its arguments>"
+                : "<format %08x not registered>", id);
+        if (ret >= (ssize_t)textLen) {
+            ret = textLen - 1;
+        }
+    }
+    return hdrLen + ret + 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FORMATS_H__
+#define _LOGD_LOG_FORMATS_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+
+#define LOG_FORMATS_MAX 8192         // formats held for all uids
+#define LOG_FORMATS_UID_MAX 2048     // formats held for any one uid
+#define LOG_FORMATS_SIZE (512 * 1024) // bytes of format held for all uids
+
+// The formats writers of format deferred logs have registered, see
+// LOGGER_DEFERRED, kept by uid so that no writer can change how another
+// uid's entries read. Formats are never forgotten; once full, new ones
+// are refused and entries using them read as such.
+class LogFormats {
+    static pthread_rwlock_t formatsLock;
+    static std::unordered_map<uint64_t, std::string> formats;
+    static std::unordered_map<uid_t, size_t> uidFormats;
+    static size_t sizes;
+
+public:
+    // msg and len are those of a LOGGER_DEFERRED_REGISTER entry.
+    // Returns zero, or a negative errno.
+    static int add(uid_t uid, const char *msg, unsigned short len);
+
+    // Format the LOGGER_DEFERRED entry msg as the plain text entry
+    // the reader expects into buffer, LOGGER_ENTRY_MAX_PAYLOAD bytes.
+    // Returns its length.
+    static unsigned short format(uid_t uid, const char *msg, unsigned short len,
+                                 char *buffer);
+};
+
+#endif // _LOGD_LOG_FORMATS_H__
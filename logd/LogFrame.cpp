@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+#include "LogFrame.h"
+
+static size_t clampFrameSize(size_t size) {
+    if (size < LOGGER_ENTRY_MAX_LEN) {
+        return LOGGER_ENTRY_MAX_LEN;
+    }
+    if (size > LOGGER_FRAME_MAX) {
+        return LOGGER_FRAME_MAX;
+    }
+    return size;
+}
+
+LogFrame::LogFrame(size_t size) :
+        mSize(clampFrameSize(size)),
+        mLen(0),
+        mBuffer(new char[mSize]) {
+}
+
+int LogFrame::add(SocketClient *writer, const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+    if ((mLen + len) > mSize) {
+        int ret = flush(writer);
+        if (ret) {
+            return ret;
+        }
+    }
+    for (int i = 0; i < iovcnt; ++i) {
+        memcpy(mBuffer.get() + mLen, iov[i].iov_base, iov[i].iov_len);
+        mLen += iov[i].iov_len;
+    }
+    return 0;
+}
+
+int LogFrame::flush(SocketClient *writer) {
+    if (!mLen) {
+        return 0;
+    }
+    int ret = writer->sendData(mBuffer.get(), mLen);
+    mLen = 0;
+    return ret;
+}
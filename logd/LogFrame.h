@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FRAME_H__
+#define _LOGD_LOG_FRAME_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <memory>
+
+#include <sysutils/SocketClient.h>
+
+// Collects the entries written to a reader that asked for frame=<bytes>,
+// sending back to back logger_entry_v3 records in one packet of at most
+// that size rather than one packet per entry.
+class LogFrame {
+    const size_t mSize;
+    size_t mLen;
+    std::unique_ptr<char[]> mBuffer;
+
+public:
+    // size is clamped to [LOGGER_ENTRY_MAX_LEN, LOGGER_FRAME_MAX]
+    explicit LogFrame(size_t size);
+
+    // Append one entry, sending the frame first if the entry does not fit.
+    // Returns non-zero on a write error, like SocketClient::sendDatav().
+    int add(SocketClient *writer, const struct iovec *iov, int iovcnt);
+    // Send whatever has been collected.
+    int flush(SocketClient *writer);
+};
+
+#endif // _LOGD_LOG_FRAME_H__
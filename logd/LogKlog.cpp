@@ -36,6 +36,12 @@
 
 static const char priority_message[] = { KMSG_PRIORITY(LOG_INFO), '\0' };
 
+// kernel records are at most a line of 1024 characters, escaped
+#define LOG_KLOG_RECORD_MAX 8192
+// messages logged into the LogBuffer under each lock, and their room
+#define LOG_KLOG_BATCH      64
+#define LOG_KLOG_ARENA_SIZE (32 * 1024)
+
 // Parsing is hard
 
 // called if we see a '<', s is the next character, returns pointer after '>'
@@ -172,13 +178,15 @@ char *log_strtok_r(char *s, char **last) {
 
 log_time LogKlog::correction = log_time(CLOCK_REALTIME) - log_time(CLOCK_MONOTONIC);
 
-LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd) :
+LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+                 bool auditd, bool kmsg) :
         SocketListener(fdRead, false),
         logbuf(buf),
         reader(reader),
         signature(CLOCK_MONOTONIC),
         fdWrite(fdWrite),
         fdRead(fdRead),
+        kmsg(kmsg),
         initialized(false),
         enableLogging(true),
         auditd(auditd) {
@@ -193,7 +201,13 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
     if (!initialized) {
         prctl(PR_SET_NAME, "logd.klogd");
         initialized = true;
-        enableLogging = false;
+        // records start from the oldest still in the kernel, nothing
+        // before our signature has been logged by readDmesg.
+        enableLogging = kmsg;
+    }
+
+    if (kmsg) {
+        return readRecords(cli->getSocket());
     }
 
     char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
@@ -251,43 +265,54 @@ void LogKlog::calculateCorrection(const log_time &monotonic,
     correction = real - monotonic;
 }
 
+// Adjust the monotonic to realtime correction for the messages that
+// report on suspend and resume, cp is the message past its timestamp.
+void LogKlog::sniffCorrection(const log_time &monotonic, const char *cp,
+                              bool reverse) {
+    static const char suspend[] = "PM: suspend entry ";
+    static const char resume[] = "PM: suspend exit ";
+    static const char healthd[] = "healthd: battery ";
+    static const char suspended[] = "Suspended for ";
+
+    // quick reject for all the rest
+    if ((*cp != 'P') && (*cp != 'h') && (*cp != 'S')) {
+        return;
+    }
+    if (!strncmp(cp, suspend, sizeof(suspend) - 1)) {
+        calculateCorrection(monotonic, cp + sizeof(suspend) - 1);
+    } else if (!strncmp(cp, resume, sizeof(resume) - 1)) {
+        calculateCorrection(monotonic, cp + sizeof(resume) - 1);
+    } else if (!strncmp(cp, healthd, sizeof(healthd) - 1)) {
+        // look for " 2???-??-?? ??:??:??.????????? ???"
+        const char *tp;
+        for (tp = cp + sizeof(healthd) - 1; *tp && (*tp != '\n'); ++tp) {
+            if ((tp[0] == ' ') && (tp[1] == '2') && (tp[5] == '-')) {
+                calculateCorrection(monotonic, tp + 1);
+                break;
+            }
+        }
+    } else if (!strncmp(cp, suspended, sizeof(suspended) - 1)) {
+        log_time real;
+        char *endp;
+        real.tv_sec = strtol(cp + sizeof(suspended) - 1, &endp, 10);
+        if (*endp == '.') {
+            real.tv_nsec = strtol(endp + 1, &endp, 10) * 1000000L;
+            if (reverse) {
+                correction -= real;
+            } else {
+                correction += real;
+            }
+        }
+    }
+}
+
 void LogKlog::sniffTime(log_time &now, const char **buf, bool reverse) {
     const char *cp;
     if ((cp = now.strptime(*buf, "[ %s.%q]"))) {
-        static const char suspend[] = "PM: suspend entry ";
-        static const char resume[] = "PM: suspend exit ";
-        static const char healthd[] = "healthd: battery ";
-        static const char suspended[] = "Suspended for ";
-
         if (isspace(*cp)) {
             ++cp;
         }
-        if (!strncmp(cp, suspend, sizeof(suspend) - 1)) {
-            calculateCorrection(now, cp + sizeof(suspend) - 1);
-        } else if (!strncmp(cp, resume, sizeof(resume) - 1)) {
-            calculateCorrection(now, cp + sizeof(resume) - 1);
-        } else if (!strncmp(cp, healthd, sizeof(healthd) - 1)) {
-            // look for " 2???-??-?? ??:??:??.????????? ???"
-            const char *tp;
-            for (tp = cp + sizeof(healthd) - 1; *tp && (*tp != '\n'); ++tp) {
-                if ((tp[0] == ' ') && (tp[1] == '2') && (tp[5] == '-')) {
-                    calculateCorrection(now, tp + 1);
-                    break;
-                }
-            }
-        } else if (!strncmp(cp, suspended, sizeof(suspended) - 1)) {
-            log_time real;
-            char *endp;
-            real.tv_sec = strtol(cp + sizeof(suspended) - 1, &endp, 10);
-            if (*endp == '.') {
-                real.tv_nsec = strtol(endp + 1, &endp, 10) * 1000000L;
-                if (reverse) {
-                    correction -= real;
-                } else {
-                    correction += real;
-                }
-            }
-        }
+        sniffCorrection(now, cp, reverse);
 
         convertMonotonicToReal(now);
         *buf = cp;
@@ -433,6 +458,39 @@ int LogKlog::log(const char *buf) {
     log_time now;
     sniffTime(now, &buf, false);
 
+    // Allocate a buffer to hold the interpreted log message, it is never
+    // more than the priority and two nuls longer than what it came from
+    char *newstr = reinterpret_cast<char *>(malloc(strlen(buf) + 3));
+    if (!newstr) {
+        return -ENOMEM;
+    }
+
+    LogBufferEntry entry;
+    int rc = interpret(pri, now, buf, entry, newstr);
+    if (rc <= 0) {
+        free(newstr);
+        return rc;
+    }
+
+    // Log message
+    rc = logbuf->log(entry.log_id, entry.realtime, entry.uid, entry.pid,
+                     entry.tid, entry.msg, entry.len);
+    free(newstr);
+
+    // notify readers
+    if (!rc) {
+        reader->notifyNewLog();
+    }
+
+    return rc;
+}
+
+// Interpret buf, the message past its <PRI> and [<TIME>], into entry,
+// with the payload written to msg which must hold strlen(buf) + 3.
+// Returns -1 for our signature, 0 if the message is not to be logged and
+// 1 if entry is to be.
+int LogKlog::interpret(int pri, const log_time &now, const char *buf,
+                       LogBufferEntry &entry, char *msg) {
     // sniff for start marker
     const char klogd_message[] = "logd.klogd: ";
     const char *start = strstr(buf, klogd_message);
@@ -610,14 +668,7 @@ int LogKlog::log(const char *buf) {
     }
     size_t n = 1 + taglen + 1 + b + 1;
 
-    // Allocate a buffer to hold the interpreted log message
-    int rc = n;
-    char *newstr = reinterpret_cast<char *>(malloc(n));
-    if (!newstr) {
-        rc = -ENOMEM;
-        return rc;
-    }
-    np = newstr;
+    np = msg;
 
     // Convert priority into single-byte Android logger priority
     *np = convertKernelPrioToAndroidPrio(pri);
@@ -633,15 +684,103 @@ int LogKlog::log(const char *buf) {
     strncpy(np, buf, b);
     np[b] = '\0';
 
-    // Log message
-    rc = logbuf->log(LOG_ID_KERNEL, now, uid, pid, tid, newstr,
-                     (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-    free(newstr);
+    entry.log_id = LOG_ID_KERNEL;
+    entry.realtime = now;
+    entry.uid = uid;
+    entry.pid = pid;
+    entry.tid = tid;
+    entry.msg = msg;
+    entry.len = (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
+    return 1;
+}
 
-    // notify readers
-    if (!rc) {
-        reader->notifyNewLog();
+// Undo the \xNN escapes /dev/kmsg puts on unprintable characters
+static void unescape(char *s) {
+    char *d = s;
+    while (*s) {
+        if ((s[0] == '\\') && (s[1] == 'x')
+                && isxdigit(s[2]) && isxdigit(s[3])) {
+            char hex[3] = { s[2], s[3], '\0' };
+            *d++ = strtol(hex, NULL, 16);
+            s += 4;
+        } else {
+            *d++ = *s++;
+        }
     }
+    *d = '\0';
+}
 
-    return rc;
+// Read the /dev/kmsg records "<pri>,<seq>,<usec>,<flags>[,...];<text>\n"
+// with their optional " KEY=value\n" dictionary lines, until there are no
+// more, and log them LOG_KLOG_BATCH at a time. The priority and monotonic
+// timestamp come as numbers, there is no text prefix to sniff.
+bool LogKlog::readRecords(int fd) {
+    char record[LOG_KLOG_RECORD_MAX];
+    char arena[LOG_KLOG_ARENA_SIZE];
+    LogBufferEntry entries[LOG_KLOG_BATCH];
+    size_t count = 0;
+    size_t used = 0;
+    bool retval = true;
+
+    for (;;) {
+        ssize_t len = read(fd, record, sizeof(record) - 1);
+        if (len < 0) {
+            if ((errno == EINTR) || (errno == EPIPE)) {
+                // EPIPE: overwritten before we got to them, carry on
+                continue;
+            }
+            retval = errno == EAGAIN;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        record[len] = '\0';
+
+        char *cp;
+        int pri = strtol(record, &cp, 10);
+        if (*cp != ',') {
+            continue;
+        }
+        strtoull(cp + 1, &cp, 10); // sequence number
+        if (*cp != ',') {
+            continue;
+        }
+        unsigned long long usec = strtoull(cp + 1, &cp, 10);
+        char *text = strchr(cp, ';');
+        if (!text) {
+            continue;
+        }
+        ++text;
+        char *ep = strchr(text, '\n');
+        if (ep) {
+            *ep = '\0';
+        }
+        unescape(text);
+
+        if (auditd && strstr(text, " audit(")) {
+            continue;
+        }
+
+        log_time now(usec / 1000000, (usec % 1000000) * 1000);
+        sniffCorrection(now, text, false);
+        convertMonotonicToReal(now);
+
+        size_t need = strlen(text) + 3;
+        if ((count >= LOG_KLOG_BATCH) || ((used + need) > sizeof(arena))) {
+            if (count && logbuf->log(entries, count)) {
+                reader->notifyNewLog();
+            }
+            count = used = 0;
+        }
+        if (interpret(pri, now, text, entries[count], arena + used) > 0) {
+            used += entries[count].len;
+            ++count;
+        }
+    }
+
+    if (count && logbuf->log(entries, count)) {
+        reader->notifyNewLog();
+    }
+    return retval;
 }
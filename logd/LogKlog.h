@@ -19,6 +19,7 @@
 
 #include <sysutils/SocketListener.h>
 #include <log/log_read.h>
+#include "LogBuffer.h"
 #include "LogReader.h"
 
 char *log_strtok_r(char *str, char **saveptr);
@@ -28,7 +29,10 @@ class LogKlog : public SocketListener {
     LogReader *reader;
     const log_time signature;
     const int fdWrite; // /dev/kmsg
-    const int fdRead;  // /proc/kmsg
+    const int fdRead;  // /proc/kmsg, or /dev/kmsg if kmsg
+    // fdRead hands out one structured record per read(), the history
+    // included, rather than a stream of text lines.
+    const bool kmsg;
     // Set once thread is started, separates KLOG_ACTION_READ_ALL
     // and KLOG_ACTION_READ phases.
     bool initialized;
@@ -41,16 +45,22 @@ class LogKlog : public SocketListener {
     static log_time correction;
 
 public:
-    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd);
+    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+            bool auditd, bool kmsg = false);
     int log(const char *buf);
     void synchronize(const char *buf);
+    bool isKmsg() const { return kmsg; }
 
     static void convertMonotonicToReal(log_time &real) { real += correction; }
 
 protected:
     void sniffTime(log_time &now, const char **buf, bool reverse);
+    void sniffCorrection(const log_time &monotonic, const char *cp, bool reverse);
     pid_t sniffPid(const char *buf);
     void calculateCorrection(const log_time &monotonic, const char *real_string);
+    int interpret(int pri, const log_time &now, const char *buf,
+                  LogBufferEntry &entry, char *msg);
+    bool readRecords(int fd);
     virtual bool onDataAvailable(SocketClient *cli);
 
 };
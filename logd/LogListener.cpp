@@ -15,6 +15,7 @@
  */
 
 #include <limits.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -34,48 +35,30 @@ LogListener::LogListener(LogBuffer *buf, LogReader *reader) :
         reader(reader) {
 }
 
-bool LogListener::onDataAvailable(SocketClient *cli) {
-    static bool name_set;
-    if (!name_set) {
-        prctl(PR_SET_NAME, "logd.writer");
-        name_set = true;
-    }
+// Datagrams drained from the socket with each recvmmsg(), and so logged
+// under one lock and announced to the readers with one notification.
+#define LOG_LISTENER_BATCH 32
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
-    struct iovec iov = { buffer, sizeof(buffer) };
-
-    char control[CMSG_SPACE(sizeof(struct ucred))];
-    struct msghdr hdr = {
-        NULL,
-        0,
-        &iov,
-        1,
-        control,
-        sizeof(control),
-        0,
-    };
-
-    int socket = cli->getSocket();
+#define LOG_LISTENER_BUFFER_SIZE (sizeof_log_id_t + sizeof(uint16_t) \
+        + sizeof(log_time) + LOGGER_ENTRY_MAX_PAYLOAD)
 
-    // To clear the entire buffer is secure/safe, but this contributes to 1.68%
-    // overhead under logging load. We are safe because we check counts.
-    // memset(buffer, 0, sizeof(buffer));
-    ssize_t n = recvmsg(socket, &hdr, 0);
+// Fill in entry from a datagram, returns false if it is to be ignored.
+static bool parseMessage(struct msghdr *hdr, char *buffer, ssize_t n,
+                         LogBufferEntry *entry) {
     if (n <= (ssize_t)(sizeof(android_log_header_t))) {
         return false;
     }
 
     struct ucred *cred = NULL;
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != NULL) {
         if (cmsg->cmsg_level == SOL_SOCKET
                 && cmsg->cmsg_type  == SCM_CREDENTIALS) {
             cred = (struct ucred *)CMSG_DATA(cmsg);
             break;
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
     }
 
     if (cred == NULL) {
@@ -94,15 +77,67 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    char *msg = ((char *)buffer) + sizeof(android_log_header_t);
     n -= sizeof(android_log_header_t);
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // NB: hdr->msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    if (logbuf->log((log_id_t)header->id, header->realtime,
-            cred->uid, cred->pid, header->tid, msg,
-            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0) {
+    entry->log_id = (log_id_t)header->id;
+    entry->realtime = header->realtime;
+    entry->uid = cred->uid;
+    entry->pid = cred->pid;
+    entry->tid = header->tid;
+    entry->msg = buffer + sizeof(android_log_header_t);
+    entry->len = ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
+    return true;
+}
+
+bool LogListener::onDataAvailable(SocketClient *cli) {
+    static bool name_set;
+    if (!name_set) {
+        prctl(PR_SET_NAME, "logd.writer");
+        name_set = true;
+    }
+
+    // Only the logd.writer thread gets here, so these can be static.
+    static char buffers[LOG_LISTENER_BATCH][LOG_LISTENER_BUFFER_SIZE];
+    static char controls[LOG_LISTENER_BATCH][CMSG_SPACE(sizeof(struct ucred))];
+    struct iovec iov[LOG_LISTENER_BATCH];
+    struct mmsghdr hdrs[LOG_LISTENER_BATCH];
+
+    for (size_t i = 0; i < LOG_LISTENER_BATCH; ++i) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = sizeof(buffers[i]);
+        memset(&hdrs[i], 0, sizeof(hdrs[i]));
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_control = controls[i];
+        hdrs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    int socket = cli->getSocket();
+
+    // To clear the entire buffer is secure/safe, but this contributes to 1.68%
+    // overhead under logging load. We are safe because we check counts.
+    // memset(buffers, 0, sizeof(buffers));
+    //
+    // select() said there is at least one datagram, take whatever else is
+    // already queued behind it without blocking.
+    int n = recvmmsg(socket, hdrs, LOG_LISTENER_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        return false;
+    }
+
+    LogBufferEntry entries[LOG_LISTENER_BATCH];
+    size_t count = 0;
+    for (int i = 0; i < n; ++i) {
+        if (parseMessage(&hdrs[i].msg_hdr, buffers[i], hdrs[i].msg_len,
+                         &entries[count])) {
+            ++count;
+        }
+    }
+
+    if (count && logbuf->log(entries, count)) {
         reader->notifyNewLog();
     }
 
@@ -21,6 +21,7 @@
 
 #include <cutils/sockets.h>
 
+#include "LogFilter.h"
 #include "LogReader.h"
 #include "FlushCommand.h"
 
@@ -44,6 +45,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     }
 
     char buffer[255];
+    char *cp;
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -52,9 +54,58 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     }
     buffer[len] = '\0';
 
+    // Reader filters are compiled once here and applied by LogTimeEntry:
+    //   filter=TAG:P,TAG:P,*:P  logcat filterspecs, *:V unless given
+    //   uid=<uid>               only entries logged by this uid
+    //   regex=<ERE>             message text of non-binary logs must match,
+    //                           must be the last option, runs to the end
+    // and frame=<bytes> packs many entries into each packet, see LogFrame.
+    std::shared_ptr<LogFilter> filter;
+
+    static const char _regex[] = " regex=";
+    cp = strstr(buffer, _regex);
+    if (cp) {
+        *cp = '\0';
+        filter = std::make_shared<LogFilter>();
+        if (filter->initRegex(cp + sizeof(_regex) - 1)) {
+            doSocketDelete(cli);
+            return false;
+        }
+    }
+
+    static const char _filter[] = " filter=";
+    cp = strstr(buffer, _filter);
+    if (cp) {
+        cp += sizeof(_filter) - 1;
+        std::string spec(cp, strcspn(cp, " "));
+        if (!filter) {
+            filter = std::make_shared<LogFilter>();
+        }
+        if (filter->initTags(spec.c_str())) {
+            doSocketDelete(cli);
+            return false;
+        }
+    }
+
+    static const char _uid[] = " uid=";
+    cp = strstr(buffer, _uid);
+    if (cp) {
+        if (!filter) {
+            filter = std::make_shared<LogFilter>();
+        }
+        filter->setUid(atol(cp + sizeof(_uid) - 1));
+    }
+
+    size_t frameSize = 0;
+    static const char _frame[] = " frame=";
+    cp = strstr(buffer, _frame);
+    if (cp) {
+        frameSize = atol(cp + sizeof(_frame) - 1);
+    }
+
     unsigned long tail = 0;
     static const char _tail[] = " tail=";
-    char *cp = strstr(buffer, _tail);
+    cp = strstr(buffer, _tail);
     if (cp) {
         tail = atol(cp + sizeof(_tail) - 1);
     }
@@ -146,7 +197,10 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
             }
 
             bool found() { return startTimeSet; }
-        } logFindStart(logMask, pid, start, sequence);
+        };
+        // binary search most of the way there
+        sequence = logbuf().seek(start);
+        LogFindStart logFindStart(logMask, pid, start, sequence);
 
         logbuf().flushTo(cli, sequence, FlushCommand::hasReadLogs(cli),
                          logFindStart.callback, &logFindStart);
@@ -160,7 +214,8 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         }
     }
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence);
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, filter,
+                         frameSize);
     command.runSocketCommand(cli);
     return true;
 }
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <private/android_filesystem_config.h>
+
+#include "LogRing.h"
+
+// entries moved into the LogBuffer under each lock, as LogListener does
+#define LOG_RING_BATCH 32
+
+pthread_mutex_t LogRing::ringsLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned int LogRing::rings;
+
+LogRing::LogRing(LogBuffer &buf, LogReader &reader, SocketClient *cli) :
+        mBuf(buf),
+        mReader(reader),
+        mUid(cli->getUid()),
+        mPid(cli->getPid()),
+        mRing(NULL),
+        mMemFd(ashmem_create_region("logd.ring", sizeof(android_log_ring_t))),
+        mDoorbell(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        mPeer(fcntl(cli->getSocket(), F_DUPFD_CLOEXEC, 0)),
+        mHead(0) {
+    if (mMemFd < 0) {
+        return;
+    }
+    void *p = mmap(NULL, sizeof(android_log_ring_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, mMemFd, 0);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    mRing = reinterpret_cast<android_log_ring_t *>(p);
+    mRing->tail = 0;
+    mRing->sleeping = 0;
+    for (uint32_t i = 0; i < LOGGER_RING_SLOTS; ++i) {
+        mRing->slots[i].sequence = i;
+    }
+    __atomic_store_n(&mRing->magic, LOGGER_RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+LogRing::~LogRing() {
+    if (mRing) {
+        munmap(mRing, sizeof(android_log_ring_t));
+    }
+    if (mMemFd >= 0) {
+        close(mMemFd);
+    }
+    if (mDoorbell >= 0) {
+        close(mDoorbell);
+    }
+    if (mPeer >= 0) {
+        close(mPeer);
+    }
+
+    pthread_mutex_lock(&ringsLock);
+    --rings;
+    pthread_mutex_unlock(&ringsLock);
+}
+
+int LogRing::create(LogBuffer *buf, LogReader *reader, SocketClient *cli) {
+    pthread_mutex_lock(&ringsLock);
+    if (rings >= LOG_RING_MAX) {
+        pthread_mutex_unlock(&ringsLock);
+        return -EBUSY;
+    }
+    ++rings;
+    pthread_mutex_unlock(&ringsLock);
+
+    LogRing *me = new LogRing(*buf, *reader, cli);
+    if (!me->mRing || (me->mDoorbell < 0) || (me->mPeer < 0)) {
+        delete me;
+        return -ENOMEM;
+    }
+
+    static const char reply[] = "ring";
+    struct iovec iov = { const_cast<char *>(reply), sizeof(reply) };
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int *fds = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+    fds[0] = me->mMemFd;
+    fds[1] = me->mDoorbell;
+
+    if (TEMP_FAILURE_RETRY(sendmsg(cli->getSocket(), &hdr, MSG_NOSIGNAL)) < 0) {
+        int ret = -errno;
+        delete me;
+        return ret;
+    }
+
+    pthread_attr_t attr;
+    if (!pthread_attr_init(&attr)) {
+        pthread_t thread;
+        if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)
+                && !pthread_create(&thread, &attr, LogRing::threadStart, me)) {
+            pthread_attr_destroy(&attr);
+            return 0;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    // the writer is left with a ring nobody reads, it soon finds it full
+    delete me;
+    return -ENOMEM;
+}
+
+// Move what the writer has published into the LogBuffer. Returns true if
+// it stopped because the batch was full, and there may be more.
+bool LogRing::drain() {
+    // Copied out first, the writer can still scribble on the shared slots
+    static const size_t len_max = LOGGER_RING_SLOT_PAYLOAD;
+    char buffers[LOG_RING_BATCH][len_max];
+    LogBufferEntry entries[LOG_RING_BATCH];
+    size_t count = 0;
+    size_t taken = 0;
+
+    while (taken < LOG_RING_BATCH) {
+        android_log_ring_slot_t *slot =
+            &mRing->slots[mHead & (LOGGER_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (mHead + 1)) {
+            break;
+        }
+
+        android_log_header_t header;
+        memcpy(&header, &slot->header, sizeof(header));
+        size_t len = slot->len;
+        if (len > len_max) {
+            len = 0;
+        }
+        memcpy(buffers[count], slot->msg, len);
+
+        __atomic_store_n(&slot->sequence, mHead + LOGGER_RING_SLOTS,
+                         __ATOMIC_RELEASE);
+        ++mHead;
+        ++taken;
+
+        // Same checks as LogListener, attributed to the ring's owner
+        if (!len || (header.id >= LOG_ID_MAX) || (header.id == LOG_ID_KERNEL)
+                || (mUid == AID_LOGD)) {
+            continue;
+        }
+
+        LogBufferEntry &entry = entries[count];
+        entry.log_id = (log_id_t)header.id;
+        entry.realtime = header.realtime;
+        entry.uid = mUid;
+        entry.pid = mPid;
+        entry.tid = header.tid;
+        entry.msg = buffers[count];
+        entry.len = len;
+        ++count;
+    }
+
+    if (count && mBuf.log(entries, count)) {
+        mReader.notifyNewLog();
+    }
+
+    return taken == LOG_RING_BATCH;
+}
+
+void *LogRing::threadStart(void *obj) {
+    prctl(PR_SET_NAME, "logd.ring");
+
+    LogRing *me = reinterpret_cast<LogRing *>(obj);
+    android_log_ring_t *ring = me->mRing;
+
+    struct pollfd fds[2];
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = me->mDoorbell;
+    fds[0].events = POLLIN;
+    fds[1].fd = me->mPeer;
+    fds[1].events = POLLRDHUP;
+
+    for (;;) {
+        while (me->drain()) {
+            ;
+        }
+
+        // Let the next writer know to ring, then check we did not just
+        // miss one that published before it could see the flag.
+        __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+        android_log_ring_slot_t *slot =
+            &ring->slots[me->mHead & (LOGGER_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) == (me->mHead + 1)) {
+            __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if ((poll(fds, 2, -1) < 0) && (errno != EINTR)) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t rung;
+            TEMP_FAILURE_RETRY(read(me->mDoorbell, &rung, sizeof(rung)));
+        }
+        if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)) {
+            // writer went away, take what it left behind
+            while (me->drain()) {
+                ;
+            }
+            break;
+        }
+    }
+
+    delete me;
+    return NULL;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RING_H__
+#define _LOGD_LOG_RING_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <sysutils/SocketClient.h>
+#include <private/android_logger.h>
+
+#include "LogBuffer.h"
+#include "LogReader.h"
+
+#define LOG_RING_MAX 32 // rings handed out at any one time
+
+// The logd end of one writer's android_log_ring_t. Each ring has its own
+// "logd.ring" thread that drains it into the LogBuffer whenever its
+// doorbell rings, and goes away when the writer closes the control socket
+// the ring was asked for on.
+class LogRing {
+    static pthread_mutex_t ringsLock;
+    static unsigned int rings;
+
+    LogBuffer &mBuf;
+    LogReader &mReader;
+    const uid_t mUid;
+    const pid_t mPid;
+    android_log_ring_t *mRing;
+    int mMemFd;
+    int mDoorbell;
+    int mPeer; // dup of the control socket, for hangup
+    uint32_t mHead;
+
+    LogRing(LogBuffer &buf, LogReader &reader, SocketClient *cli);
+    ~LogRing();
+
+    bool drain();
+    static void *threadStart(void *me);
+
+public:
+    // Hand cli a new ring, replies with the ring and doorbell descriptors.
+    // Returns zero on success, or a negative errno.
+    static int create(LogBuffer *buf, LogReader *reader, SocketClient *cli);
+};
+
+#endif // _LOGD_LOG_RING_H__
@@ -26,12 +26,17 @@
 
 #include "LogStatistics.h"
 
-LogStatistics::LogStatistics() : enable(false) {
+LogStatistics::LogStatistics() :
+        enable(false),
+        pidTable(LOG_STATISTICS_ENTRIES_MAX),
+        tidTable(LOG_STATISTICS_ENTRIES_MAX),
+        tagTable(LOG_STATISTICS_ENTRIES_MAX) {
     log_id_for_each(id) {
         mSizes[id] = 0;
         mElements[id] = 0;
         mSizesTotal[id] = 0;
         mElementsTotal[id] = 0;
+        mMemory[id] = 0;
     }
 }
 
@@ -63,11 +68,42 @@ char *pidToName(pid_t pid) {
 
 }
 
+// Move uid to its new place in uidRank[id]; ranked and sizes describe the
+// uidTable entry as it was before it changed.
+void LogStatistics::rerank(log_id_t id, uid_t uid, bool ranked, size_t sizes) {
+    if (ranked) {
+        uidRank[id].erase(std::make_pair(sizes, uid));
+    }
+    uidTable_t::iterator it = uidTable[id].find(uid);
+    if (it != uidTable[id].end()) {
+        uidRank[id].insert(std::make_pair(it->second.getSizes(), uid));
+    }
+}
+
+std::unique_ptr<const UidEntry *[]> LogStatistics::sort(size_t n, log_id id) {
+    if (!n) {
+        std::unique_ptr<const UidEntry *[]> sorted(NULL);
+        return sorted;
+    }
+
+    const UidEntry **retval = new const UidEntry* [n];
+    memset(retval, 0, sizeof(*retval) * n);
+
+    size_t i = 0;
+    for (uidRank_t::reverse_iterator it = uidRank[id].rbegin();
+            (it != uidRank[id].rend()) && (i < n); ++it) {
+        retval[i++] = &uidTable[id].find(it->second)->second;
+    }
+    std::unique_ptr<const UidEntry *[]> sorted(retval);
+    return sorted;
+}
+
 void LogStatistics::add(LogBufferElement *e) {
     log_id_t log_id = e->getLogId();
     unsigned short size = e->getMsgLen();
     mSizes[log_id] += size;
     ++mElements[log_id];
+    mMemory[log_id] += e->getMemory();
 
     mSizesTotal[log_id] += size;
     ++mElementsTotal[log_id];
@@ -76,7 +112,12 @@ void LogStatistics::add(LogBufferElement *e) {
         return;
     }
 
-    uidTable[log_id].add(e->getUid(), e);
+    uid_t uid = e->getUid();
+    uidTable_t::iterator u = uidTable[log_id].find(uid);
+    bool ranked = u != uidTable[log_id].end();
+    size_t sizes = ranked ? u->second.getSizes() : 0;
+    uidTable[log_id].add(uid, e);
+    rerank(log_id, uid, ranked, sizes);
 
     if (!enable) {
         return;
@@ -96,12 +137,18 @@ void LogStatistics::subtract(LogBufferElement *e) {
     unsigned short size = e->getMsgLen();
     mSizes[log_id] -= size;
     --mElements[log_id];
+    mMemory[log_id] -= e->getMemory();
 
     if (log_id == LOG_ID_KERNEL) {
         return;
     }
 
-    uidTable[log_id].subtract(e->getUid(), e);
+    uid_t uid = e->getUid();
+    uidTable_t::iterator u = uidTable[log_id].find(uid);
+    bool ranked = u != uidTable[log_id].end();
+    size_t sizes = ranked ? u->second.getSizes() : 0;
+    uidTable[log_id].subtract(uid, e);
+    rerank(log_id, uid, ranked, sizes);
 
     if (!enable) {
         return;
@@ -117,13 +164,20 @@ void LogStatistics::subtract(LogBufferElement *e) {
 }
 
 // Atomically set an entry to drop
-// entry->setDropped(1) must follow this call, caller should do this explicitly.
+// The entry must be replaced by a dropped copy after this call, caller should
+// do this explicitly (see LogBuffer::drop).
 void LogStatistics::drop(LogBufferElement *e) {
     log_id_t log_id = e->getLogId();
     unsigned short size = e->getMsgLen();
     mSizes[log_id] -= size;
+    mMemory[log_id] -= e->getMemory() - LogBufferElement::getMemory(0);
 
-    uidTable[log_id].drop(e->getUid(), e);
+    uid_t uid = e->getUid();
+    uidTable_t::iterator u = uidTable[log_id].find(uid);
+    bool ranked = u != uidTable[log_id].end();
+    size_t sizes = ranked ? u->second.getSizes() : 0;
+    uidTable[log_id].drop(uid, e);
+    rerank(log_id, uid, ranked, sizes);
 
     if (!enable) {
         return;
@@ -183,6 +237,63 @@ char *LogStatistics::uidToName(uid_t uid) {
     return name;
 }
 
+void LogStatistics::nameEntries(size_t n) {
+    if (!enable) {
+        return;
+    }
+
+    std::unique_ptr<const PidEntry *[]> pids = pidTable.sort(n);
+    for (size_t i = 0; (i < n) && pids[i]; ++i) {
+        if (pids[i]->needsName()) {
+            pid_t pid = pids[i]->getKey();
+            char *name = android::pidToName(pid);
+            if (name) {
+                pidTable.find(pid)->second.setName(name);
+            }
+        }
+    }
+
+    std::unique_ptr<const TidEntry *[]> tids = tidTable.sort(n);
+    for (size_t i = 0; (i < n) && tids[i]; ++i) {
+        if (tids[i]->needsName()) {
+            pid_t tid = tids[i]->getKey();
+            char *name = android::tidToName(tid);
+            if (name) {
+                tidTable.find(tid)->second.setName(name);
+            }
+        }
+    }
+}
+
+void LogStatistics::adoptNames(LogStatistics &s) {
+    if (!enable) {
+        return;
+    }
+
+    for (pidTable_t::iterator it = s.pidTable.begin(); it != s.pidTable.end(); ++it) {
+        const PidEntry &entry = it->second;
+        if (entry.needsName()) {
+            continue;
+        }
+        pidTable_t::iterator p = pidTable.find(it->first);
+        if ((p != pidTable.end()) && p->second.needsName()
+                && (p->second.getUid() == entry.getUid())) {
+            p->second.setName(strdup(entry.getName()));
+        }
+    }
+    for (tidTable_t::iterator it = s.tidTable.begin(); it != s.tidTable.end(); ++it) {
+        const TidEntry &entry = it->second;
+        if (entry.needsName()) {
+            continue;
+        }
+        tidTable_t::iterator t = tidTable.find(it->first);
+        if ((t != tidTable.end()) && t->second.needsName()
+                && (t->second.getUid() == entry.getUid())) {
+            t->second.setName(strdup(entry.getName()));
+        }
+    }
+}
+
 static void format_line(android::String8 &output,
         android::String8 &name, android::String8 &size, android::String8 &pruned) {
     static const size_t pruned_len = 6;
@@ -210,6 +321,10 @@ void LogStatistics::format(char **buf, uid_t uid, unsigned int logMask) {
         *buf = NULL;
     }
 
+    // Chattiest by process and thread, named before they are sorted
+    static const size_t maximum_sorted_entries = 32;
+    nameEntries(maximum_sorted_entries);
+
     // Report on total logging, current and for all time
 
     android::String8 output("size/num");
@@ -264,10 +379,29 @@ void LogStatistics::format(char **buf, uid_t uid, unsigned int logMask) {
         spaces += spaces_total;
     }
 
+    // What the entries take of the heap, element overhead included
+    spaces = 3;
+    output.appendFormat("\nMemory");
+
+    log_id_for_each(id) {
+        if (!(logMask & (1 << id))) {
+            continue;
+        }
+
+        if (elements(id)) {
+            oldLength = output.length();
+            if (spaces < 0) {
+                spaces = 0;
+            }
+            output.appendFormat("%*s%zu", spaces, "", memory(id));
+            spaces -= output.length() - oldLength;
+        }
+        spaces += spaces_total;
+    }
+
     // Report on Chattiest
 
     // Chattiest by application (UID)
-    static const size_t maximum_sorted_entries = 32;
     log_id_for_each(id) {
         if (!(logMask & (1 << id))) {
             continue;
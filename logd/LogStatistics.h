@@ -21,7 +21,9 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include <set>
 #include <unordered_map>
+#include <utility>
 
 #include <log/log.h>
 
@@ -31,15 +33,53 @@
 #define log_id_for_each(i) \
     for (log_id_t i = LOG_ID_MIN; i < LOG_ID_MAX; i = (log_id_t) (i + 1))
 
+// Bound on the pid, tid and tag tables, and how many of their entries are
+// looked at to find one to give up for a newcomer once they are full.
+#define LOG_STATISTICS_ENTRIES_MAX 1024
+#define LOG_STATISTICS_EVICT_SAMPLES 8
+
 template <typename TKey, typename TEntry>
 class LogHashtable {
 
     std::unordered_map<TKey, TEntry> map;
+    size_t limit; // 0 is unbounded
+    size_t cursor; // bucket the next eviction starts sampling from
+
+    // Keep to the limit by evicting the smallest of a few entries, taken
+    // from where the last eviction left off. The chattiest have the most
+    // to lose before they become a candidate, all the short lived pids
+    // that logged a line or two are soon gone.
+    void makeRoom() {
+        if (!limit || (map.size() < limit)) {
+            return;
+        }
+        size_t buckets = map.bucket_count();
+        size_t sampled = 0;
+        TKey victim = TKey();
+        size_t victimSizes = 0;
+        for (size_t b = 0; (b < buckets) && (sampled < LOG_STATISTICS_EVICT_SAMPLES); ++b) {
+            size_t bucket = (cursor + b) % buckets;
+            for (typename std::unordered_map<TKey, TEntry>::local_iterator
+                    it = map.begin(bucket); it != map.end(bucket); ++it) {
+                size_t s = it->second.getSizes();
+                if (!sampled++ || (s < victimSizes)) {
+                    victim = it->first;
+                    victimSizes = s;
+                }
+            }
+            cursor = bucket + 1;
+        }
+        if (sampled) {
+            map.erase(victim);
+        }
+    }
 
 public:
 
     typedef typename std::unordered_map<TKey, TEntry>::iterator iterator;
 
+    LogHashtable(size_t l = 0):limit(l),cursor(0) { }
+
     std::unique_ptr<const TEntry *[]> sort(size_t n) {
         if (!n) {
             std::unique_ptr<const TEntry *[]> sorted(NULL);
@@ -80,6 +120,7 @@ public:
     inline iterator add(TKey key, LogBufferElement *e) {
         iterator it = map.find(key);
         if (it == map.end()) {
+            makeRoom();
             it = map.insert(std::make_pair(key, TEntry(e))).first;
         } else {
             it->second.add(e);
@@ -90,6 +131,7 @@ public:
     inline iterator add(TKey key) {
         iterator it = map.find(key);
         if (it == map.end()) {
+            makeRoom();
             it = map.insert(std::make_pair(key, TEntry(key))).first;
         } else {
             it->second.add(key);
@@ -104,6 +146,8 @@ public:
         }
     }
 
+    inline iterator find(TKey key) { return map.find(key); }
+
     inline void drop(TKey key, LogBufferElement *e) {
         iterator it = map.find(key);
         if (it != map.end()) {
@@ -116,6 +160,8 @@ public:
 
 };
 
+// Subtraction saturates: an entry evicted and added again has not
+// accounted for what was logged before.
 struct EntryBase {
     size_t size;
 
@@ -125,7 +171,11 @@ struct EntryBase {
     size_t getSizes() const { return size; }
 
     inline void add(LogBufferElement *e) { size += e->getMsgLen(); }
-    inline bool subtract(LogBufferElement *e) { size -= e->getMsgLen(); return !size; }
+    inline bool subtract(LogBufferElement *e) {
+        size_t len = e->getMsgLen();
+        size = (size > len) ? (size - len) : 0;
+        return !size;
+    }
 };
 
 struct EntryBaseDropped : public EntryBase {
@@ -141,7 +191,8 @@ struct EntryBaseDropped : public EntryBase {
         EntryBase::add(e);
     }
     inline bool subtract(LogBufferElement *e) {
-        dropped -= e->getDropped();
+        size_t d = e->getDropped();
+        dropped = (dropped > d) ? (dropped - d) : 0;
         return EntryBase::subtract(e) && !dropped;
     }
     inline void drop(LogBufferElement *e) {
@@ -172,11 +223,12 @@ struct PidEntry : public EntryBaseDropped {
         pid(p),
         uid(android::pidToUid(p)),
         name(android::pidToName(pid)) { }
+    // named by nameEntries, not from the logging path
     PidEntry(LogBufferElement *e):
         EntryBaseDropped(e),
         pid(e->getPid()),
         uid(e->getUid()),
-        name(android::pidToName(e->getPid())) { }
+        name(NULL) { }
     PidEntry(const PidEntry &c):
         EntryBaseDropped(c),
         pid(c.pid),
@@ -187,16 +239,15 @@ struct PidEntry : public EntryBaseDropped {
     const pid_t&getKey() const { return pid; }
     const uid_t&getUid() const { return uid; }
     const char*getName() const { return name; }
+    // zygote children are yet to be renamed
+    bool needsName() const { return !name || !strncmp(name, "zygote", 6); }
+    void setName(char *n) { free(name); name = n; }
 
     inline void add(pid_t p) {
-        if (name && !strncmp(name, "zygote", 6)) {
-            free(name);
-            name = NULL;
-        }
-        if (!name) {
+        if (needsName()) {
             char *n = android::pidToName(p);
             if (n) {
-                name = n;
+                setName(n);
             }
         }
     }
@@ -205,10 +256,7 @@ struct PidEntry : public EntryBaseDropped {
         uid_t u = e->getUid();
         if (getUid() != u) {
             uid = u;
-            free(name);
-            name = android::pidToName(e->getPid());
-        } else {
-            add(e->getPid());
+            setName(NULL);
         }
         EntryBaseDropped::add(e);
     }
@@ -224,11 +272,12 @@ struct TidEntry : public EntryBaseDropped {
         tid(t),
         uid(android::pidToUid(t)),
         name(android::tidToName(tid)) { }
+    // named by nameEntries, not from the logging path
     TidEntry(LogBufferElement *e):
         EntryBaseDropped(e),
         tid(e->getTid()),
         uid(e->getUid()),
-        name(android::tidToName(e->getTid())) { }
+        name(NULL) { }
     TidEntry(const TidEntry &c):
         EntryBaseDropped(c),
         tid(c.tid),
@@ -239,16 +288,14 @@ struct TidEntry : public EntryBaseDropped {
     const pid_t&getKey() const { return tid; }
     const uid_t&getUid() const { return uid; }
     const char*getName() const { return name; }
+    bool needsName() const { return !name || !strncmp(name, "zygote", 6); }
+    void setName(char *n) { free(name); name = n; }
 
     inline void add(pid_t t) {
-        if (name && !strncmp(name, "zygote", 6)) {
-            free(name);
-            name = NULL;
-        }
-        if (!name) {
+        if (needsName()) {
             char *n = android::tidToName(t);
             if (n) {
-                name = n;
+                setName(n);
             }
         }
     }
@@ -257,10 +304,7 @@ struct TidEntry : public EntryBaseDropped {
         uid_t u = e->getUid();
         if (getUid() != u) {
             uid = u;
-            free(name);
-            name = android::tidToName(e->getTid());
-        } else {
-            add(e->getTid());
+            setName(NULL);
         }
         EntryBaseDropped::add(e);
     }
@@ -294,11 +338,19 @@ class LogStatistics {
     size_t mElements[LOG_ID_MAX];
     size_t mSizesTotal[LOG_ID_MAX];
     size_t mElementsTotal[LOG_ID_MAX];
+    // heap taken by the elements now in the buffer, see
+    // LogBufferElement::getMemory()
+    size_t mMemory[LOG_ID_MAX];
     bool enable;
 
     // uid to size list
     typedef LogHashtable<uid_t, UidEntry> uidTable_t;
     uidTable_t uidTable[LOG_ID_MAX];
+    // every uidTable entry by size, kept current by add, subtract and drop
+    // so that finding the worst offenders never has to sort the table
+    typedef std::set<std::pair<size_t, uid_t> > uidRank_t;
+    uidRank_t uidRank[LOG_ID_MAX];
+    void rerank(log_id_t id, uid_t uid, bool ranked, size_t sizes);
 
     // pid to uid list
     typedef LogHashtable<pid_t, PidEntry> pidTable_t;
@@ -312,6 +364,9 @@ class LogStatistics {
     typedef LogHashtable<uint32_t, TagEntry> tagTable_t;
     tagTable_t tagTable;
 
+    // name the pid and tid entries that are to be reported
+    void nameEntries(size_t n);
+
 public:
     LogStatistics();
 
@@ -319,21 +374,30 @@ public:
 
     void add(LogBufferElement *entry);
     void subtract(LogBufferElement *entry);
-    // entry->setDropped(1) must follow this call
+    // entry must be replaced by a dropped copy after this call
     void drop(LogBufferElement *entry);
     // Correct for merging two entries referencing dropped content
-    void erase(LogBufferElement *e) { --mElements[e->getLogId()]; }
+    void erase(LogBufferElement *e) {
+        --mElements[e->getLogId()];
+        mMemory[e->getLogId()] -= e->getMemory();
+    }
 
-    std::unique_ptr<const UidEntry *[]> sort(size_t n, log_id i) { return uidTable[i].sort(n); }
+    // the n largest uids, in order, NULL terminated if fewer
+    std::unique_ptr<const UidEntry *[]> sort(size_t n, log_id i);
 
     // fast track current value by id only
     size_t sizes(log_id_t id) const { return mSizes[id]; }
     size_t elements(log_id_t id) const { return mElements[id]; }
     size_t sizesTotal(log_id_t id) const { return mSizesTotal[id]; }
     size_t elementsTotal(log_id_t id) const { return mElementsTotal[id]; }
+    size_t memory(log_id_t id) const { return mMemory[id]; }
 
-    // *strp = malloc, balance with free
+    // *strp = malloc, balance with free. Looks up names in /proc and
+    // packages.list, so call on a copy taken under mLogElementsLock, not
+    // while holding it.
     void format(char **strp, uid_t uid, unsigned int logMask);
+    // take up the names format found for entries in the copy it ran on
+    void adoptNames(LogStatistics &snapshot);
 
     // helper (must be locked directly or implicitly by mLogElementsLock)
     char *pidToName(pid_t pid);
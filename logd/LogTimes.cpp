@@ -26,7 +26,9 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid,
-                           uint64_t start) :
+                           uint64_t start,
+                           const std::shared_ptr<const LogFilter> &filter,
+                           size_t frameSize) :
         mRefCount(1),
         mRelease(false),
         mError(false),
@@ -35,6 +37,8 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         mReader(reader),
         mLogMask(logMask),
         mPid(pid),
+        mFilter(filter),
+        mFrame(frameSize ? new LogFrame(frameSize) : NULL),
         mCount(0),
         mTail(tail),
         mIndex(0),
@@ -134,10 +138,18 @@ void *LogTimeEntry::threadStart(void *obj) {
         unlock();
 
         if (me->mTail) {
-            logbuf.flushTo(client, start, privileged, FilterFirstPass, me);
+            // count back from the newest, rather than all from the oldest
+            lock();
+            me->mCount = 0;
+            me->mIndex = 0;
+            unlock();
+            start = logbuf.flushToReverse(client, start, privileged,
+                                          FilterFirstPass, me,
+                                          me->mPid, me->mLogMask);
             me->leadingDropped = true;
         }
-        start = logbuf.flushTo(client, start, privileged, FilterSecondPass, me);
+        start = logbuf.flushTo(client, start, privileged, FilterSecondPass, me,
+                               true, me->mFrame.get(), me->mPid, me->mLogMask);
 
         lock();
 
@@ -164,32 +176,26 @@ void *LogTimeEntry::threadStart(void *obj) {
     return NULL;
 }
 
-// A first pass to count the number of elements
+// A first pass, newest first, to count up to mTail elements to be sent
 int LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(obj);
 
     LogTimeEntry::lock();
 
-    if (me->leadingDropped) {
-        if (element->getDropped()) {
-            LogTimeEntry::unlock();
-            return false;
-        }
-        me->leadingDropped = false;
-    }
-
-    if (me->mCount == 0) {
-        me->mStart = element->getSequence();
-    }
+    // region lock what we have counted so far
+    me->mStart = element->getSequence();
 
     if ((!me->mPid || (me->mPid == element->getPid()))
-            && (me->isWatching(element->getLogId()))) {
+            && (me->isWatching(element->getLogId()))
+            && (me->isLoggable(element))) {
         ++me->mCount;
     }
 
+    bool counted = me->mCount >= me->mTail;
+
     LogTimeEntry::unlock();
 
-    return false;
+    return counted;
 }
 
 // A second pass to send the selected elements
@@ -225,6 +231,10 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
         goto skip;
     }
 
+    if (!me->isLoggable(element)) {
+        goto skip;
+    }
+
     if (me->isError_Locked()) {
         goto stop;
     }
@@ -22,10 +22,14 @@
 #include <sys/types.h>
 
 #include <list>
+#include <memory>
 
 #include <sysutils/SocketClient.h>
 #include <log/log.h>
 
+#include "LogFilter.h"
+#include "LogFrame.h"
+
 class LogReader;
 
 class LogTimeEntry {
@@ -42,6 +46,8 @@ class LogTimeEntry {
     static void threadStop(void *me);
     const unsigned int mLogMask;
     const pid_t mPid;
+    const std::shared_ptr<const LogFilter> mFilter;
+    std::unique_ptr<LogFrame> mFrame; // NULL unless the reader asked
     unsigned int skipAhead[LOG_ID_MAX];
     unsigned long mCount;
     unsigned long mTail;
@@ -50,7 +56,9 @@ class LogTimeEntry {
 public:
     LogTimeEntry(LogReader &reader, SocketClient *client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 uint64_t start);
+                 uint64_t start,
+                 const std::shared_ptr<const LogFilter> &filter = nullptr,
+                 size_t frameSize = 0);
 
     SocketClient *mClient;
     uint64_t mStart;
@@ -110,7 +118,10 @@ public:
         delete this;
     }
     bool isWatching(log_id_t id) { return (mLogMask & (1<<id)) != 0; }
-    // flushTo filter callbacks
+    bool isLoggable(const LogBufferElement *element) const {
+        return !mFilter || mFilter->isLoggable(element);
+    }
+    // flushTo filter callbacks, flushToReverse for the first pass
     static int FilterFirstPass(const LogBufferElement *element, void *me);
     static int FilterSecondPass(const LogBufferElement *element, void *me);
 };
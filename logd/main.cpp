@@ -312,6 +312,14 @@ static void readDmesg(LogAudit *al, LogKlog *kl) {
         kl->synchronize(buf.get());
     }
 
+    // the records read from /dev/kmsg start with the history
+    if (kl && kl->isKmsg()) {
+        kl = NULL;
+        if (!al) {
+            return;
+        }
+    }
+
     for (char *ptr = NULL, *tok = buf.get();
          (rc >= 0) && ((tok = log_strtok_r(tok, &ptr)));
          tok = NULL) {
@@ -332,9 +340,17 @@ static void readDmesg(LogAudit *al, LogKlog *kl) {
 // transitory per-client threads are created for each reader.
 int main(int argc, char *argv[]) {
     int fdPmesg = -1;
+    bool kmsg = false;
     bool klogd = property_get_bool_svelte("logd.klogd");
     if (klogd) {
-        fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        // Prefer the structured records, fall back to the text stream
+        if (property_get_bool("logd.klogd.kmsg", true)) {
+            fdPmesg = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            kmsg = fdPmesg >= 0;
+        }
+        if (fdPmesg < 0) {
+            fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        }
     }
     fdDmesg = open("/dev/kmsg", O_WRONLY);
 
@@ -416,6 +432,10 @@ int main(int argc, char *argv[]) {
         logBuf->enableStatistics();
     }
 
+    if (property_get_bool("logd.compress", true)) {
+        logBuf->enableCompression();
+    }
+
     // LogReader listens on /dev/socket/logdr. When a client
     // connects, log entries in the LogBuffer are written to the client.
 
@@ -456,7 +476,7 @@ int main(int argc, char *argv[]) {
 
     LogKlog *kl = NULL;
     if (klogd) {
-        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL);
+        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL, kmsg);
     }
 
     readDmesg(al, kl);
@@ -19,6 +19,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
@@ -499,3 +500,91 @@ TEST(logd, benchmark) {
     // 50% threshold for SPAM filter (<20% typical, lots of engineering margin)
     ASSERT_GT(totalSize, nowSpamSize * 2);
 }
+
+TEST(logd, frame) {
+    int fd = socket_local_client("logdr",
+                                 ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_SEQPACKET);
+    ASSERT_TRUE(fd >= 0);
+
+    struct sigaction ignore, old_sigaction;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = caught_signal;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGALRM, &ignore, &old_sigaction);
+    unsigned int old_alarm = alarm(10);
+
+    static const char ask[] = "dumpAndClose lids=0,1,2,3 frame=65536";
+    ASSERT_EQ((ssize_t)sizeof(ask), write(fd, ask, sizeof(ask)));
+
+    static char frame[65536];
+    size_t entries = 0;
+    size_t packets = 0;
+    ssize_t ret;
+    while ((ret = recv(fd, frame, sizeof(frame), 0)) > 0) {
+        ++packets;
+        // every packet holds whole entries, back to back
+        size_t pos = 0;
+        while (pos < (size_t)ret) {
+            struct logger_entry_v2 *entry =
+                reinterpret_cast<struct logger_entry_v2 *>(frame + pos);
+            ASSERT_LE(pos + sizeof(*entry), (size_t)ret);
+            ASSERT_EQ(sizeof(struct logger_entry_v3), entry->hdr_size);
+            pos += entry->hdr_size + entry->len;
+            ++entries;
+        }
+        EXPECT_EQ((size_t)ret, pos);
+    }
+
+    alarm(old_alarm);
+    sigaction(SIGALRM, &old_sigaction, NULL);
+    close(fd);
+
+    fprintf(stderr, "%zu entries in %zu packets\n", entries, packets);
+    EXPECT_LT(0U, packets);
+    EXPECT_LE(packets, entries);
+}
+
+TEST(logd, pid_tail) {
+    pid_t pid = getpid();
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             "logd_test", "pid_tail %d", i));
+    }
+    // Give logd a moment to take them in
+    usleep(100000);
+
+    int fd = socket_local_client("logdr",
+                                 ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_SEQPACKET);
+    ASSERT_TRUE(fd >= 0);
+
+    struct sigaction ignore, old_sigaction;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = caught_signal;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGALRM, &ignore, &old_sigaction);
+    unsigned int old_alarm = alarm(10);
+
+    char ask[64];
+    snprintf(ask, sizeof(ask), "dumpAndClose lids=0 tail=5 pid=%d", pid);
+    ASSERT_EQ((ssize_t)strlen(ask) + 1, write(fd, ask, strlen(ask) + 1));
+
+    log_msg msg;
+    size_t entries = 0;
+    const char *last = NULL;
+    while (recv(fd, msg.buf, sizeof(msg.buf), 0) > 0) {
+        EXPECT_EQ(pid, msg.entry.pid);
+        ++entries;
+        last = msg.msg() + 1;  // skip the priority
+        last += strlen(last) + 1;  // and the tag
+    }
+
+    alarm(old_alarm);
+    sigaction(SIGALRM, &old_sigaction, NULL);
+    close(fd);
+
+    EXPECT_EQ(5U, entries);
+    ASSERT_TRUE(last != NULL);
+    EXPECT_STREQ("pid_tail 19", last);
+}
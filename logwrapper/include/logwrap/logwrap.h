@@ -48,6 +48,11 @@ __BEGIN_DECLS
  *           log), or LOG_FILE (and you need to specify a pathname in the
  *           file_path argument, otherwise pass NULL).  These are bit fields,
  *           and can be OR'ed together to log to multiple places.
+ *           Adding LOG_SHM to an abbreviated log_target has the child write
+ *           its output to a memory backed file rather than a pty, so that it
+ *           never waits for logwrap to keep up; the whole output is held in
+ *           memory until the child exits.  Without kernel support for
+ *           memfd_create, the pty is used as usual.
  *   abbreviated: If true, capture up to the first 100 lines and last 4K of
  *           output from the child.  The abbreviated output is not dumped to
  *           the specified log until the child has exited.
@@ -67,6 +72,7 @@ __BEGIN_DECLS
 #define LOG_ALOG        1
 #define LOG_KLOG        2
 #define LOG_FILE        4
+#define LOG_SHM         8
 
 int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int_quit,
         int log_target, bool abbreviated, char *file_path);
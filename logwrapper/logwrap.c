@@ -17,6 +17,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <poll.h>
 #include <sys/wait.h>
 #include <stdio.h>
@@ -52,6 +54,14 @@ do {                                                                          \
 
 #define MAX_KLOG_TAG 16
 
+/* Larger than what the pty hands out in one read, so that a read takes all
+ * that is buffered */
+#define READ_BUF_SIZE 0x10000
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 /* This is a simple buffer that holds up to the first beginning_buf->buf_size
  * bytes of output from a command.
  */
@@ -97,26 +107,6 @@ struct log_info {
     struct abbr_buf a_buf;
 };
 
-/* Forware declaration */
-static void add_line_to_abbr_buf(struct abbr_buf *a_buf, char *linebuf, int linelen);
-
-/* Return 0 on success, and 1 when full */
-static int add_line_to_linear_buf(struct beginning_buf *b_buf,
-                                   char *line, ssize_t line_len)
-{
-    int full = 0;
-
-    if ((line_len + b_buf->used_len) > b_buf->buf_size) {
-        full = 1;
-    } else {
-        /* Add to the end of the buf */
-        memcpy(b_buf->buf + b_buf->used_len, line, line_len);
-        b_buf->used_len += line_len;
-    }
-
-    return full;
-}
-
 static void add_line_to_circular_buf(struct ending_buf *e_buf,
                                      char *line, ssize_t line_len)
 {
@@ -154,30 +144,55 @@ static void add_line_to_circular_buf(struct ending_buf *e_buf,
     e_buf->write = (e_buf->write + line_len) % e_buf->buf_size;
 }
 
+/* Adds len bytes of output, made of whole lines, to the abbreviated buf.  The
+ * lines that still fit go to the beginning buf; once a line doesn't fit, all
+ * that follows goes to the ending buf, of which only the tail that it can
+ * hold is copied.
+ */
+static void add_chunk_to_abbr_buf(struct abbr_buf *a_buf, char *buf, size_t len)
+{
+    struct beginning_buf *b_buf = &a_buf->b_buf;
+    struct ending_buf *e_buf = &a_buf->e_buf;
+
+    if (!a_buf->beginning_buf_full) {
+        size_t room = b_buf->buf_size - b_buf->used_len;
+        size_t fit = len;
+
+        if (len > room) {
+            char *nl = memrchr(buf, '\n', room);
+
+            fit = nl ? (size_t) (nl - buf + 1) : 0;
+            a_buf->beginning_buf_full = 1;
+        }
+        memcpy(b_buf->buf + b_buf->used_len, buf, fit);
+        b_buf->used_len += fit;
+        buf += fit;
+        len -= fit;
+    }
+
+    if (len == 0 || e_buf->buf == NULL) {
+        return;
+    }
+    if ((ssize_t) len > e_buf->buf_size) {
+        buf += len - e_buf->buf_size;
+        len = e_buf->buf_size;
+    }
+    add_line_to_circular_buf(e_buf, buf, len);
+}
+
 /* Log directly to the specified log */
 static void do_log_line(struct log_info *log_info, char *line) {
     if (log_info->log_target & LOG_KLOG) {
         klog_write(6, log_info->klog_fmt, line);
     }
     if (log_info->log_target & LOG_ALOG) {
-        ALOG(LOG_INFO, log_info->btag, "%s", line);
+        __android_log_write(ANDROID_LOG_INFO, log_info->btag, line);
     }
     if (log_info->log_target & LOG_FILE) {
         fprintf(log_info->fp, "%s\n", line);
     }
 }
 
-/* Log to either the abbreviated buf, or directly to the specified log
- * via do_log_line() above.
- */
-static void log_line(struct log_info *log_info, char *line, int len) {
-    if (log_info->abbreviated) {
-        add_line_to_abbr_buf(&log_info->a_buf, line, len);
-    } else {
-        do_log_line(log_info, line);
-    }
-}
-
 /*
  * The kernel will take a maximum of 1024 bytes in any single write to
  * the kernel logging device file, so find and print each line one at
@@ -236,16 +251,6 @@ static void free_abbr_buf(struct abbr_buf *a_buf) {
     free(a_buf->e_buf.buf);
 }
 
-static void add_line_to_abbr_buf(struct abbr_buf *a_buf, char *linebuf, int linelen) {
-    if (!a_buf->beginning_buf_full) {
-        a_buf->beginning_buf_full =
-            add_line_to_linear_buf(&a_buf->b_buf, linebuf, linelen);
-    }
-    if (a_buf->beginning_buf_full) {
-        add_line_to_circular_buf(&a_buf->e_buf, linebuf, linelen);
-    }
-}
-
 static void print_abbr_buf(struct log_info *log_info) {
     struct abbr_buf *a_buf = &log_info->a_buf;
 
@@ -290,10 +295,56 @@ static void print_abbr_buf(struct log_info *log_info) {
     }
 }
 
+/* Reads the output captured in fd, a file the child wrote to instead of the
+ * pty, straight into the abbreviated buf: the first lines that fit into the
+ * beginning buf and the tail that fits into the ending buf.  Nothing in
+ * between is read at all.
+ */
+static void read_capture(struct abbr_buf *a_buf, int fd)
+{
+    struct beginning_buf *b_buf = &a_buf->b_buf;
+    struct ending_buf *e_buf = &a_buf->e_buf;
+    struct stat st;
+    off_t start;
+    ssize_t len;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        return;
+    }
+
+    len = TEMP_FAILURE_RETRY(pread(fd, b_buf->buf, b_buf->buf_size, 0));
+    if (len < 0) {
+        return;
+    }
+    if (len < st.st_size) {
+        char *nl = memrchr(b_buf->buf, '\n', len);
+
+        len = nl ? nl - b_buf->buf + 1 : 0;
+        a_buf->beginning_buf_full = 1;
+    }
+    b_buf->used_len = len;
+    start = len;
+
+    if (start == st.st_size || e_buf->buf == NULL) {
+        return;
+    }
+    if (st.st_size - start > e_buf->buf_size) {
+        start = st.st_size - e_buf->buf_size;
+    }
+    len = TEMP_FAILURE_RETRY(pread(fd, e_buf->buf, st.st_size - start, start));
+    if (len <= 0) {
+        return;
+    }
+    e_buf->used_len = len;
+    e_buf->read = 0;
+    e_buf->write = len % e_buf->buf_size;
+}
+
 static int parent(const char *tag, int parent_read, pid_t pid,
-        int *chld_sts, int log_target, bool abbreviated, char *file_path) {
+        int *chld_sts, int log_target, bool abbreviated, char *file_path,
+        bool capture) {
     int status = 0;
-    char buffer[4096];
+    char *buffer = NULL;
     struct pollfd poll_fds[] = {
         [0] = {
             .fd = parent_read,
@@ -347,6 +398,22 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     log_info.log_target = log_target;
     log_info.abbreviated = abbreviated;
 
+    buffer = malloc(READ_BUF_SIZE);
+    if (!buffer) {
+        ERROR("Cannot allocate the read buffer\n");
+        rc = -1;
+        goto err_poll;
+    }
+
+    if (capture) {
+        if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) < 0) {
+            rc = errno;
+            ALOG(LOG_ERROR, "logwrap", "waitpid failed with %s\n", strerror(errno));
+            goto err_waitpid;
+        }
+        found_child = true;
+    }
+
     while (!found_child) {
         if (TEMP_FAILURE_RETRY(poll(poll_fds, ARRAY_SIZE(poll_fds), -1)) < 0) {
             ERROR("poll failed\n");
@@ -356,37 +423,55 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
         if (poll_fds[0].revents & POLLIN) {
             sz = TEMP_FAILURE_RETRY(
-                read(parent_read, &buffer[b], sizeof(buffer) - 1 - b));
+                read(parent_read, &buffer[b], READ_BUF_SIZE - 1 - b));
+            if (sz < 0) {
+                sz = 0;
+            }
 
             sz += b;
-            // Log one line at a time
-            for (b = 0; b < sz; b++) {
-                if (buffer[b] == '\r') {
-                    if (abbreviated) {
-                        /* The abbreviated logging code uses newline as
-                         * the line separator.  Lucikly, the pty layer
-                         * helpfully cooks the output of the command
-                         * being run and inserts a CR before NL.  So
-                         * I just change it to NL here when doing
-                         * abbreviated logging.
-                         */
-                        buffer[b] = '\n';
+            if (abbreviated) {
+                /* The abbreviated logging code uses newline as the line
+                 * separator.  Luckily, the pty layer helpfully cooks the
+                 * output of the command being run and inserts a CR before
+                 * NL.  So the CR becomes the NL and the NL is dropped, in
+                 * place, and all the complete lines are added in one go.
+                 */
+                int w = b;
+
+                for (; b < sz; b++) {
+                    if (buffer[b] == '\n') {
+                        a = w;
                     } else {
+                        buffer[w++] = buffer[b] == '\r' ? '\n' : buffer[b];
+                    }
+                }
+                if (a == 0 && w == READ_BUF_SIZE - 1) {
+                    // buffer is full, flush
+                    a = w;
+                }
+                add_chunk_to_abbr_buf(&log_info.a_buf, buffer, a);
+                b = w;
+            } else {
+                // Log one line at a time
+                for (b = 0; b < sz; b++) {
+                    if (buffer[b] == '\r') {
+                        buffer[b] = '\0';
+                    } else if (buffer[b] == '\n') {
                         buffer[b] = '\0';
+                        do_log_line(&log_info, &buffer[a]);
+                        a = b + 1;
                     }
-                } else if (buffer[b] == '\n') {
+                }
+
+                if (a == 0 && b == READ_BUF_SIZE - 1) {
+                    // buffer is full, flush
                     buffer[b] = '\0';
-                    log_line(&log_info, &buffer[a], b - a);
-                    a = b + 1;
+                    do_log_line(&log_info, &buffer[a]);
+                    a = b;
                 }
             }
 
-            if (a == 0 && b == sizeof(buffer) - 1) {
-                // buffer is full, flush
-                buffer[b] = '\0';
-                log_line(&log_info, &buffer[a], b - a);
-                b = 0;
-            } else if (a != b) {
+            if (a != b) {
                 // Keep left-overs
                 b -= a;
                 memmove(buffer, &buffer[a], b);
@@ -424,7 +509,15 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     // Flush remaining data
     if (a != b) {
       buffer[b] = '\0';
-      log_line(&log_info, &buffer[a], b - a);
+      if (abbreviated) {
+        add_chunk_to_abbr_buf(&log_info.a_buf, &buffer[a], b - a);
+      } else {
+        do_log_line(&log_info, &buffer[a]);
+      }
+    }
+
+    if (capture) {
+        read_capture(&log_info.a_buf, parent_read);
     }
 
     /* All the output has been processed, time to dump the abbreviated output */
@@ -452,6 +545,7 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
 err_waitpid:
 err_poll:
+    free(buffer);
     if (log_target & LOG_FILE) {
         fclose(log_info.fp); /* Also closes underlying fd */
     }
@@ -461,6 +555,17 @@ err_poll:
     return rc;
 }
 
+/* Creates the file that LOG_SHM has the child write its output to, or returns
+ * -1 if the kernel has no memfd_create, in which case the pty is used.
+ */
+static int create_capture_fd() {
+#ifdef __NR_memfd_create
+    return syscall(__NR_memfd_create, "logwrap", MFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
 static void child(int argc, char* argv[]) {
     // create null terminated argv_child array
     char* argv_child[argc + 1];
@@ -483,6 +588,7 @@ int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int
     sigset_t blockset;
     sigset_t oldset;
     int rc = 0;
+    bool capture = false;
 
     rc = pthread_mutex_lock(&fd_mutex);
     if (rc) {
@@ -490,27 +596,44 @@ int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int
         goto err_lock;
     }
 
-    /* Use ptty instead of socketpair so that STDOUT is not buffered */
-    parent_ptty = TEMP_FAILURE_RETRY(open("/dev/ptmx", O_RDWR));
-    if (parent_ptty < 0) {
-        ERROR("Cannot create parent ptty\n");
-        rc = -1;
-        goto err_open;
+    if ((log_target & LOG_SHM) && abbreviated && (log_target & ~LOG_SHM)) {
+        parent_ptty = create_capture_fd();
+        capture = parent_ptty >= 0;
     }
+    log_target &= ~LOG_SHM;
 
-    char child_devname[64];
-    if (grantpt(parent_ptty) || unlockpt(parent_ptty) ||
-            ptsname_r(parent_ptty, child_devname, sizeof(child_devname)) != 0) {
-        ERROR("Problem with /dev/ptmx\n");
-        rc = -1;
-        goto err_ptty;
-    }
+    if (capture) {
+        /* The child writes to its own copy of the capture fd, and never
+         * waits for us to read */
+        child_ptty = dup(parent_ptty);
+        if (child_ptty < 0) {
+            ERROR("Cannot dup capture fd\n");
+            rc = -1;
+            goto err_child_ptty;
+        }
+    } else {
+        /* Use ptty instead of socketpair so that STDOUT is not buffered */
+        parent_ptty = TEMP_FAILURE_RETRY(open("/dev/ptmx", O_RDWR));
+        if (parent_ptty < 0) {
+            ERROR("Cannot create parent ptty\n");
+            rc = -1;
+            goto err_open;
+        }
 
-    child_ptty = TEMP_FAILURE_RETRY(open(child_devname, O_RDWR));
-    if (child_ptty < 0) {
-        ERROR("Cannot open child_ptty\n");
-        rc = -1;
-        goto err_child_ptty;
+        char child_devname[64];
+        if (grantpt(parent_ptty) || unlockpt(parent_ptty) ||
+                ptsname_r(parent_ptty, child_devname, sizeof(child_devname)) != 0) {
+            ERROR("Problem with /dev/ptmx\n");
+            rc = -1;
+            goto err_ptty;
+        }
+
+        child_ptty = TEMP_FAILURE_RETRY(open(child_devname, O_RDWR));
+        if (child_ptty < 0) {
+            ERROR("Cannot open child_ptty\n");
+            rc = -1;
+            goto err_child_ptty;
+        }
     }
 
     sigemptyset(&blockset);
@@ -547,7 +670,7 @@ int android_fork_execvp_ext(int argc, char* argv[], int *status, bool ignore_int
         }
 
         rc = parent(argv[0], parent_ptty, pid, status, log_target,
-                    abbreviated, file_path);
+                    abbreviated, file_path, capture);
     }
 
     if (ignore_int_quit) {
@@ -10,8 +10,38 @@ LOCAL_MODULE := init.rc
 LOCAL_SRC_FILES := $(LOCAL_MODULE)
 LOCAL_MODULE_CLASS := ETC
 LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT)
+LOCAL_REQUIRED_MODULES := init.rc.cache
 
 include $(BUILD_PREBUILT)
+
+#######################################
+# init.rc.cache
+# The ramdisk's .rc files pre-tokenized for init, see system/core/init/rc_cache.h.
+# Files installed from elsewhere are simply parsed as text.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := init.rc.cache
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT)
+
+include $(BUILD_SYSTEM)/base_rules.mk
+
+rc_cache_files := \
+    init.rc \
+    init.usb.rc \
+    init.usb.configfs.rc \
+    init.zygote32.rc \
+    init.zygote32_64.rc \
+    init.zygote64.rc \
+    init.zygote64_32.rc \
+
+$(LOCAL_BUILT_MODULE): PRIVATE_RC_FILES := $(foreach f,$(rc_cache_files),/$(f)=$(LOCAL_PATH)/$(f))
+$(LOCAL_BUILT_MODULE): $(addprefix $(LOCAL_PATH)/,$(rc_cache_files)) $(HOST_OUT_EXECUTABLES)/init_rc_cache
+	@echo "Generate: $@"
+	@mkdir -p $(dir $@)
+	$(hide) $(HOST_OUT_EXECUTABLES)/init_rc_cache $@ $(PRIVATE_RC_FILES)
+
+rc_cache_files :=
 endif
 #######################################
 # init.environ.rc
@@ -24,10 +24,12 @@
 #include <limits.h>
 #include <linux/fuse.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/resource.h>
@@ -35,12 +37,16 @@
 #include <sys/statfs.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <cutils/atomic.h>
+#include <cutils/daemon_trace.h>
 #include <cutils/fs.h>
-#include <cutils/hashmap.h>
+#include <cutils/flat_hashmap.h>
 #include <cutils/log.h>
 #include <cutils/multiuser.h>
+#include <packagelistparser/packagelistparser.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -99,12 +105,35 @@
  * the largest possible data payload. */
 #define MAX_REQUEST_SIZE (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in) + MAX_WRITE)
 
+/* Requests at least this long are taken to be writes, when the rest of them
+ * is left in the handler's pipe for handle_write to splice to the file. */
+#define MIN_SPLICE_WRITE (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in) + PAGESIZE)
+
+/* Most handler threads to start for each mount, by default one per core but
+ * at least two, since what they mostly wait for is I/O. */
+#define MAX_HANDLER_THREADS 8
+
+/* How long, in seconds, the kernel may cache entries and attributes.
+ * Changes made through one view are pushed to the others as they happen,
+ * so this only bounds how long changes made to the underlying storage
+ * behind our back can go unseen. */
+#define CACHE_TIMEOUT 60
+
 /* Pseudo-error constant used to indicate that no fuse status is needed
  * or that a reply has already been written. */
 #define NO_STATUS 1
 
+/* Opcodes below this have their own request statistics, FUSE_READDIRPLUS
+ * being the highest we handle. The rest are counted together in slot 0,
+ * which no opcode uses. */
+#define MAX_STATS_OPCODE (FUSE_READDIRPLUS + 1)
+
+/* Request latencies are counted in buckets by powers of two microseconds,
+ * the last of which also takes everything slower. */
+#define LATENCY_BUCKETS 20
+
 /* Path to system-provided mapping of package name to appIds */
-static const char* const kPackagesListFile = "/data/system/packages.list";
+static const char* const kPackagesListFile = PACKAGES_LIST_FILE;
 
 /* Supplementary groups to execute with */
 static const gid_t kGroups[1] = { AID_PACKAGE_INFO };
@@ -129,8 +158,26 @@ typedef enum {
     PERM_ANDROID_MEDIA,
 } perm_t;
 
+/* What a handler has seen of the requests with one opcode. */
+struct fuse_op_stats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint32_t latency[LATENCY_BUCKETS];
+};
+
+/* How long threads waited for one kind of hold on the tree lock, counting
+ * only the times they had to wait at all. */
+struct lock_wait_stats {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
 struct handle {
     int fd;
+    bool writable;
 };
 
 struct dirhandle {
@@ -156,6 +203,9 @@ struct node {
     struct node *next;          /* per-dir sibling list */
     struct node *child;         /* first contained file by this dir */
     struct node *parent;        /* containing directory */
+    /* Children that aren't deleted, by name. Only an index over the sibling
+     * list: if it couldn't be allocated, lookups walk the list instead. */
+    FlatHashmap* children;
 
     size_t namelen;
     char *name;
@@ -171,21 +221,27 @@ struct node {
     char* graft_path;
     size_t graft_pathlen;
 
+    /* The absolute path of this node in the underlying storage, set when it
+     * is created and again when it or a directory above it is renamed.
+     * NULL if that failed for lack of memory. */
+    char* path;
+    size_t pathlen;
+
     bool deleted;
 };
 
-static int str_hash(void *key) {
-    return hashmapHash(key, strlen(key));
-}
-
-/** Test if two string keys are equal ignoring case */
-static bool str_icase_equals(void *keyA, void *keyB) {
-    return strcasecmp(keyA, keyB) == 0;
-}
-
 /* Global data for all FUSE mounts */
 struct fuse_global {
-    pthread_mutex_t lock;
+    /* Protects the node tree. The handler threads of all mounts walk it
+     * far more often than they change it, so lookups and path building
+     * take it for reading and only creating, forgetting, renaming and
+     * deleting nodes, or deriving their permissions, take it for writing. */
+    pthread_rwlock_t lock;
+
+    /* Guards the statistics of waits for the tree lock. */
+    pthread_mutex_t stats_lock;
+    struct lock_wait_stats read_waits;
+    struct lock_wait_stats write_waits;
 
     uid_t uid;
     gid_t gid;
@@ -194,7 +250,7 @@ struct fuse_global {
     char source_path[PATH_MAX];
     char obb_path[PATH_MAX];
 
-    Hashmap* package_to_appid;
+    struct packagelist* package_to_appid;
 
     __u64 next_generation;
     struct node root;
@@ -233,12 +289,30 @@ struct fuse {
 
     gid_t gid;
     mode_t mask;
+
+    /* FUSE_SPLICE_* set by handle_init if the kernel can splice /dev/fuse */
+    int32_t splice_flags;
+
+    /* All handlers of this mount, linked through their next */
+    struct fuse_handler* handlers;
 };
 
 /* Private data used by a single FUSE handler */
 struct fuse_handler {
     struct fuse* fuse;
     int token;
+    struct fuse_handler* next;
+
+    /* Requests handled, by opcode. Only the handler's own thread updates
+     * them, and dump_fuse_stats reads them without any locking, so may
+     * see a count that is being updated at the time. */
+    struct fuse_op_stats stats[MAX_STATS_OPCODE];
+
+    /* For splicing data between /dev/fuse and files, set up on first use.
+     * pipe_data says how much of the request being handled is still in it. */
+    int pipe[2];
+    bool pipe_failed;
+    size_t pipe_data;
 
     /* To save memory, we never use the contents of the request buffer and the read
      * buffer at the same time.  This allows us to share the underlying storage. */
@@ -248,6 +322,40 @@ struct fuse_handler {
     };
 };
 
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void count_lock_wait(struct fuse_global* global, struct lock_wait_stats* stats,
+        uint64_t start) {
+    uint64_t us = now_us() - start;
+    pthread_mutex_lock(&global->stats_lock);
+    stats->count++;
+    stats->total_us += us;
+    stats->max_us = MAX(stats->max_us, us);
+    pthread_mutex_unlock(&global->stats_lock);
+}
+
+/* Take the tree lock for reading or writing. The clock is only read when
+ * the lock isn't free, so timing the waits costs nothing otherwise. */
+static void lock_tree_read(struct fuse_global* global) {
+    if (pthread_rwlock_tryrdlock(&global->lock)) {
+        uint64_t start = now_us();
+        pthread_rwlock_rdlock(&global->lock);
+        count_lock_wait(global, &global->read_waits, start);
+    }
+}
+
+static void lock_tree_write(struct fuse_global* global) {
+    if (pthread_rwlock_trywrlock(&global->lock)) {
+        uint64_t start = now_us();
+        pthread_rwlock_wrlock(&global->lock);
+        count_lock_wait(global, &global->write_waits, start);
+    }
+}
+
 static inline void *id_to_ptr(__u64 nid)
 {
     return (void *) (uintptr_t) nid;
@@ -258,9 +366,12 @@ static inline __u64 ptr_to_id(void *ptr)
     return (__u64) (uintptr_t) ptr;
 }
 
+/* May be called with the lock held only for reading, by several threads
+ * at once, so the count goes up atomically. It only goes down with the
+ * lock held for writing. */
 static void acquire_node_locked(struct node* node)
 {
-    node->refcount++;
+    android_atomic_inc((volatile int32_t*) &node->refcount);
     TRACE("ACQUIRE %p (%s) rc=%d\n", node, node->name, node->refcount);
 }
 
@@ -279,6 +390,10 @@ static void release_node_locked(struct node* node)
             memset(node->name, 0xef, node->namelen);
             free(node->name);
             free(node->actual_name);
+            free(node->path);
+            if (node->children) {
+                flatHashmapFree(node->children);
+            }
             memset(node, 0xfc, sizeof(*node));
             free(node);
         }
@@ -287,16 +402,81 @@ static void release_node_locked(struct node* node)
     }
 }
 
+/* Builds the index of parent from its whole list of children, newest first
+ * as lookups through the list find them. Returns false, leaving it to the
+ * list, if it runs out of memory. */
+static bool build_child_index_locked(struct node* parent)
+{
+    struct node* node;
+
+    parent->children = flatHashmapCreate(FLAT_HASHMAP_STRING_KEYS, 8);
+    if (!parent->children) {
+        return false;
+    }
+    for (node = parent->child; node; node = node->next) {
+        if (node->deleted || flatHashmapGet(parent->children, node->name)) {
+            continue;
+        }
+        flatHashmapPut(parent->children, node->name, node);
+        if (flatHashmapGet(parent->children, node->name) != node) {
+            flatHashmapFree(parent->children);
+            parent->children = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void index_child_locked(struct node* parent, struct node* child)
+{
+    /* A missing index is built from all the children, not just this one:
+     * there may be older ones that were only added to the list, while an
+     * earlier index couldn't be made or kept. */
+    if (!parent->children && !build_child_index_locked(parent)) {
+        return;
+    }
+    /* Drop any entry for a node of the same name first, so that the map
+     * doesn't keep pointing at that node's name as its key. */
+    flatHashmapRemove(parent->children, child->name, NULL);
+    flatHashmapPut(parent->children, child->name, child);
+    if (flatHashmapGet(parent->children, child->name) != child) {
+        /* Out of memory, so it's incomplete now; fall back on the list. */
+        flatHashmapFree(parent->children);
+        parent->children = NULL;
+    }
+}
+
+/* Drops child from the index of parent, unless some other node of the same
+ * name has taken its place there. */
+static void unindex_child_locked(struct node* parent, struct node* child)
+{
+    if (parent->children && flatHashmapGet(parent->children, child->name) == child) {
+        flatHashmapRemove(parent->children, child->name, NULL);
+    }
+}
+
 static void add_node_to_parent_locked(struct node *node, struct node *parent) {
     node->parent = parent;
     node->next = parent->child;
     parent->child = node;
+    if (!node->deleted) {
+        index_child_locked(parent, node);
+    }
     acquire_node_locked(parent);
 }
 
+static void mark_node_deleted_locked(struct node* node)
+{
+    if (node->parent) {
+        unindex_child_locked(node->parent, node);
+    }
+    node->deleted = true;
+}
+
 static void remove_node_from_parent_locked(struct node* node)
 {
     if (node->parent) {
+        unindex_child_locked(node->parent, node);
         if (node->parent->child == node) {
             node->parent->child = node->parent->child->next;
         } else {
@@ -318,6 +498,18 @@ static void remove_node_from_parent_locked(struct node* node)
  * or returns -1 if the path is too long for the provided buffer.
  */
 static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize) {
+    if (!node->path || bufsize < node->pathlen + 1) {
+        return -1;
+    }
+    memcpy(buf, node->path, node->pathlen + 1); /* include trailing \0 */
+    return node->pathlen;
+}
+
+/* Sets the absolute path of a node that is, or is about to be, a child of
+ * the given parent. Returns 0 on success or -ENOMEM, leaving it without
+ * a path.
+ */
+static int set_node_path_locked(struct node* node, struct node* parent) {
     const char* name;
     size_t namelen;
     if (node->graft_path) {
@@ -331,21 +523,35 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
         namelen = node->namelen;
     }
 
-    if (bufsize < namelen + 1) {
-        return -1;
-    }
-
-    ssize_t pathlen = 0;
-    if (node->parent && node->graft_path == NULL) {
-        pathlen = get_node_path_locked(node->parent, buf, bufsize - namelen - 1);
-        if (pathlen < 0) {
-            return -1;
+    free(node->path);
+    node->path = NULL;
+    size_t pathlen = 0;
+    if (parent && node->graft_path == NULL) {
+        if (!parent->path) {
+            return -ENOMEM;
         }
-        buf[pathlen++] = '/';
+        pathlen = parent->pathlen + 1;
+    }
+    char* path = malloc(pathlen + namelen + 1);
+    if (!path) {
+        return -ENOMEM;
+    }
+    if (pathlen) {
+        memcpy(path, parent->path, parent->pathlen);
+        path[pathlen - 1] = '/';
     }
+    memcpy(path + pathlen, name, namelen + 1);
+    node->path = path;
+    node->pathlen = pathlen + namelen;
+    return 0;
+}
 
-    memcpy(buf + pathlen, name, namelen + 1); /* include trailing \0 */
-    return pathlen + namelen;
+static void set_node_paths_recursive_locked(struct node* node, struct node* parent) {
+    set_node_path_locked(node, parent);
+    struct node* child;
+    for (child = node->child; child; child = child->next) {
+        set_node_paths_recursive_locked(child, node);
+    }
 }
 
 /* Finds the absolute path of a file within a given directory.
@@ -453,6 +659,16 @@ static int touch(char* path, mode_t mode) {
     return 0;
 }
 
+/* Returns the appid of the package called name, 0 if there is none. Like
+ * the rest of the filesystem, the name is looked up ignoring case. */
+static appid_t get_package_appid(struct packagelist* packages, const char* name) {
+    struct pkg_info info;
+    if (packagelist_find_name(packages, name, true, &info) < 0) {
+        return 0;
+    }
+    return info.uid;
+}
+
 static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
         struct node *node) {
     appid_t appid;
@@ -499,7 +715,7 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
     case PERM_ANDROID_DATA:
     case PERM_ANDROID_OBB:
     case PERM_ANDROID_MEDIA:
-        appid = (appid_t) (uintptr_t) hashmapGet(fuse->global->package_to_appid, node->name);
+        appid = get_package_appid(fuse->global->package_to_appid, node->name);
         if (appid != 0) {
             node->uid = multiuser_get_uid(parent->userid, appid);
         }
@@ -507,16 +723,68 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
     }
 }
 
+static void fuse_notify_inval_inode_views(struct fuse_global* global, struct fuse* except,
+        __u64 nid, __s64 off, __s64 len);
+
+/* Derives the permissions of a node again, and when they change has every
+ * view drop the attributes it may have cached, which default_permissions
+ * has the kernel check access against. */
+static void rederive_permissions_locked(struct fuse* fuse, struct node *parent,
+        struct node *node) {
+    perm_t perm = node->perm;
+    userid_t userid = node->userid;
+    uid_t uid = node->uid;
+    bool under_android = node->under_android;
+
+    derive_permissions_locked(fuse, parent, node);
+    if (node->perm != perm || node->userid != userid || node->uid != uid
+            || node->under_android != under_android) {
+        /* Only the attributes: that takes no locks in the kernel, so is
+         * safe with ours held. */
+        fuse_notify_inval_inode_views(fuse->global, NULL, node->nid, -1, 0);
+    }
+}
+
 static void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent) {
     struct node *node;
     for (node = parent->child; node; node = node->next) {
-        derive_permissions_locked(fuse, parent, node);
+        rederive_permissions_locked(fuse, parent, node);
         if (node->child) {
             derive_permissions_recursive_locked(fuse, node);
         }
     }
 }
 
+/* Derives permissions again after package_to_appid replaced old_appids.
+ * Only the app directories under Android/data, obb and media, and what is
+ * inside them, depend on it, so only those whose appid changed are done,
+ * rather than the whole tree. */
+static void derive_package_permissions_locked(struct fuse* fuse, struct node *parent,
+        struct packagelist* old_appids) {
+    struct node *node;
+    for (node = parent->child; node; node = node->next) {
+        switch (parent->perm) {
+        case PERM_PRE_ROOT:
+        case PERM_ROOT:
+        case PERM_ANDROID:
+            derive_package_permissions_locked(fuse, node, old_appids);
+            break;
+        case PERM_ANDROID_DATA:
+        case PERM_ANDROID_OBB:
+        case PERM_ANDROID_MEDIA:
+            if (get_package_appid(old_appids, node->name)
+                    != get_package_appid(fuse->global->package_to_appid, node->name)) {
+                rederive_permissions_locked(fuse, parent, node);
+                derive_permissions_recursive_locked(fuse, node);
+            }
+            break;
+        default:
+            /* Inherited, unaffected by packages */
+            return;
+        }
+    }
+}
+
 /* Kernel has already enforced everything we returned through
  * derive_permissions_locked(), so this is used to lock down access
  * even further, such as enforcing that apps hold sdcard_rw. */
@@ -587,6 +855,12 @@ struct node *create_node_locked(struct fuse* fuse,
     node->deleted = false;
 
     derive_permissions_locked(fuse, parent, node);
+    if (set_node_path_locked(node, parent) < 0) {
+        free(node->actual_name);
+        free(node->name);
+        free(node);
+        return NULL;
+    }
     acquire_node_locked(node);
     add_node_to_parent_locked(node, parent);
     return node;
@@ -654,6 +928,9 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
 
 static struct node *lookup_child_by_name_locked(struct node *node, const char *name)
 {
+    if (node->children) {
+        return flatHashmapGet(node->children, name);
+    }
     for (node = node->child; node; node = node->next) {
         /* use exact string comparison, nodes that differ by case
          * must be considered distinct even if they refer to the same
@@ -709,31 +986,165 @@ static void fuse_reply(struct fuse *fuse, __u64 unique, void *data, int len)
     }
 }
 
-static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
-        struct node* parent, const char* name, const char* actual_name,
-        const char* path)
+static bool splice_pipe_ready(struct fuse_handler* handler)
+{
+    if (handler->pipe[0] != -1) {
+        return true;
+    }
+    if (handler->pipe_failed) {
+        return false;
+    }
+    /* The pipe has to hold all of the largest request or reply at once. */
+    if (pipe2(handler->pipe, O_CLOEXEC) == -1) {
+        handler->pipe[0] = handler->pipe[1] = -1;
+    } else if (fcntl(handler->pipe[0], F_SETPIPE_SZ, MAX_REQUEST_SIZE) < (int) MAX_REQUEST_SIZE) {
+        close(handler->pipe[0]);
+        close(handler->pipe[1]);
+        handler->pipe[0] = handler->pipe[1] = -1;
+    }
+    if (handler->pipe[0] == -1) {
+        ERROR("[%d] cannot set up splice pipe, copying instead: %s\n",
+                handler->token, strerror(errno));
+        handler->pipe_failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Throws away whatever is left in the pipe; a new one is made when needed. */
+static void splice_pipe_reset(struct fuse_handler* handler)
+{
+    if (handler->pipe[0] != -1) {
+        close(handler->pipe[0]);
+        close(handler->pipe[1]);
+        handler->pipe[0] = handler->pipe[1] = -1;
+    }
+    handler->pipe_data = 0;
+}
+
+static bool read_pipe_fully(struct fuse_handler* handler, void* buf, size_t len)
+{
+    __u8* ptr = buf;
+    while (len > 0) {
+        ssize_t res = TEMP_FAILURE_RETRY(read(handler->pipe[0], ptr, len));
+        if (res <= 0) {
+            return false;
+        }
+        ptr += res;
+        len -= res;
+    }
+    return true;
+}
+
+/* Replies to a read with up to size bytes of fd at offset, spliced into
+ * /dev/fuse through the handler's pipe instead of copied through the read
+ * buffer.  Returns NO_STATUS once it has replied, or a negative errno if
+ * nothing was read, in which case -EINVAL means fd can't be spliced. */
+static int fuse_reply_splice(struct fuse* fuse, struct fuse_handler* handler,
+        __u64 unique, int fd, __u64 offset, __u32 size)
+{
+    __u8 *read_buffer = (__u8 *) ((uintptr_t)(handler->read_buffer + PAGESIZE) & ~((uintptr_t)PAGESIZE-1));
+    struct fuse_out_header hdr;
+    loff_t off = offset;
+    struct stat st;
+    size_t got = 0;
+    int err = 0;
+    ssize_t res;
+
+    /* The length goes in ahead of the data, so find out what there is to read
+     * first; reads that run past the end of the file are common. */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size = ((__u64) st.st_size > offset) ? MIN(size, st.st_size - offset) : 0;
+    }
+
+    hdr.len = sizeof(hdr) + size;
+    hdr.error = 0;
+    hdr.unique = unique;
+    if (TEMP_FAILURE_RETRY(write(handler->pipe[1], &hdr, sizeof(hdr))) != sizeof(hdr)) {
+        splice_pipe_reset(handler);
+        return -EINVAL;
+    }
+    while (got < size) {
+        res = TEMP_FAILURE_RETRY(splice(fd, &off, handler->pipe[1], NULL, size - got,
+                SPLICE_F_MOVE));
+        if (res <= 0) {
+            err = (res < 0) ? errno : 0;
+            break;
+        }
+        got += res;
+    }
+
+    if (got == size) {
+        unsigned flags = (android_atomic_acquire_load(&fuse->splice_flags) & FUSE_SPLICE_MOVE)
+                ? SPLICE_F_MOVE : 0;
+        res = TEMP_FAILURE_RETRY(splice(handler->pipe[0], NULL, fuse->fd, NULL, hdr.len, flags));
+        if (res != (ssize_t) hdr.len) {
+            ERROR("*** REPLY FAILED *** %d\n", res < 0 ? errno : EIO);
+            splice_pipe_reset(handler);
+        }
+        return NO_STATUS;
+    }
+
+    /* The file got shorter or couldn't be read: take back what is in the
+     * pipe and reply with it the usual way, with the right length. */
+    if (!read_pipe_fully(handler, read_buffer, sizeof(hdr) + got)) {
+        splice_pipe_reset(handler);
+        return -EIO;
+    }
+    if (got == 0 && err) {
+        return -err;
+    }
+    fuse_reply(fuse, unique, read_buffer + sizeof(hdr), got);
+    return NO_STATUS;
+}
+
+/* Fills in the entry for a child of parent, taking a reference on its node
+ * for the kernel, as LOOKUP and READDIRPLUS do. */
+static int make_entry(struct fuse* fuse, struct node* parent, const char* name,
+        const char* actual_name, const char* path, struct fuse_entry_out* out)
 {
     struct node* node;
-    struct fuse_entry_out out;
     struct stat s;
 
     if (lstat(path, &s) < 0) {
         return -errno;
     }
 
-    pthread_mutex_lock(&fuse->global->lock);
-    node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
+    /* Most entries are for nodes we already have, which only needs the
+     * lock for reading. Creating one changes the tree, so needs it for
+     * writing, and another thread may have made it in the meantime. */
+    lock_tree_read(fuse->global);
+    node = lookup_child_by_name_locked(parent, name);
+    if (node) {
+        acquire_node_locked(node);
+    } else {
+        pthread_rwlock_unlock(&fuse->global->lock);
+        lock_tree_write(fuse->global);
+        node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
+    }
     if (!node) {
-        pthread_mutex_unlock(&fuse->global->lock);
+        pthread_rwlock_unlock(&fuse->global->lock);
         return -ENOMEM;
     }
-    memset(&out, 0, sizeof(out));
-    attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
-    out.entry_valid = 10;
-    out.nodeid = node->nid;
-    out.generation = node->gen;
-    pthread_mutex_unlock(&fuse->global->lock);
+    memset(out, 0, sizeof(*out));
+    attr_from_stat(fuse, &out->attr, &s, node);
+    out->attr_valid = CACHE_TIMEOUT;
+    out->entry_valid = CACHE_TIMEOUT;
+    out->nodeid = node->nid;
+    out->generation = node->gen;
+    pthread_rwlock_unlock(&fuse->global->lock);
+    return 0;
+}
+
+static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
+        struct node* parent, const char* name, const char* actual_name,
+        const char* path)
+{
+    struct fuse_entry_out out;
+    int res = make_entry(fuse, parent, name, actual_name, path, &out);
+    if (res < 0) {
+        return res;
+    }
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -749,7 +1160,7 @@ static int fuse_reply_attr(struct fuse* fuse, __u64 unique, const struct node* n
     }
     memset(&out, 0, sizeof(out));
     attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
+    out.attr_valid = CACHE_TIMEOUT;
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -785,6 +1196,91 @@ static void fuse_notify_delete(struct fuse* fuse, const __u64 parent,
     }
 }
 
+/* With a negative off, only the attributes are dropped, otherwise also the
+ * cached data from off, to the end of the file if len is 0. */
+static void fuse_notify_inval_inode(struct fuse* fuse, const __u64 nid,
+        const __s64 off, const __s64 len) {
+    struct fuse_out_header hdr;
+    struct fuse_notify_inval_inode_out data;
+    struct iovec vec[2];
+    int res;
+
+    hdr.len = sizeof(hdr) + sizeof(data);
+    hdr.error = FUSE_NOTIFY_INVAL_INODE;
+    hdr.unique = 0;
+
+    data.ino = nid;
+    data.off = off;
+    data.len = len;
+
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = sizeof(hdr);
+    vec[1].iov_base = &data;
+    vec[1].iov_len = sizeof(data);
+
+    res = writev(fuse->fd, vec, 2);
+    /* Ignore ENOENT, since other views may not have seen the node */
+    if (res < 0 && errno != ENOENT) {
+        ERROR("*** NOTIFY FAILED *** %d\n", errno);
+    }
+}
+
+/* Drops name in parent from the dentry cache. The kernel takes the lock of
+ * the parent directory for this, so it must not be sent to the view whose
+ * request we are handling, or with our lock held. */
+static void fuse_notify_inval_entry(struct fuse* fuse, const __u64 parent,
+        const char* name) {
+    struct fuse_out_header hdr;
+    struct fuse_notify_inval_entry_out data;
+    struct iovec vec[3];
+    size_t namelen = strlen(name);
+    int res;
+
+    hdr.len = sizeof(hdr) + sizeof(data) + namelen + 1;
+    hdr.error = FUSE_NOTIFY_INVAL_ENTRY;
+    hdr.unique = 0;
+
+    memset(&data, 0, sizeof(data));
+    data.parent = parent;
+    data.namelen = namelen;
+
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = sizeof(hdr);
+    vec[1].iov_base = &data;
+    vec[1].iov_len = sizeof(data);
+    vec[2].iov_base = (void*) name;
+    vec[2].iov_len = namelen + 1;
+
+    res = writev(fuse->fd, vec, 3);
+    /* Ignore ENOENT, since other views may not have seen the entry */
+    if (res < 0 && errno != ENOENT) {
+        ERROR("*** NOTIFY FAILED *** %d\n", errno);
+    }
+}
+
+/* Sends the invalidation to every view but except, which may be NULL. */
+static void fuse_notify_inval_inode_views(struct fuse_global* global, struct fuse* except,
+        __u64 nid, __s64 off, __s64 len) {
+    struct fuse* views[] = { global->fuse_default, global->fuse_read, global->fuse_write };
+    size_t i;
+    for (i = 0; i < sizeof(views) / sizeof(views[0]); i++) {
+        if (views[i] != except) {
+            fuse_notify_inval_inode(views[i], nid, off, len);
+        }
+    }
+}
+
+static void fuse_notify_inval_entry_views(struct fuse_global* global, struct fuse* except,
+        __u64 parent, const char* name) {
+    struct fuse* views[] = { global->fuse_default, global->fuse_read, global->fuse_write };
+    size_t i;
+    for (i = 0; i < sizeof(views) / sizeof(views[0]); i++) {
+        if (views[i] != except) {
+            fuse_notify_inval_entry(views[i], parent, name);
+        }
+    }
+}
+
 static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header *hdr, const char* name)
 {
@@ -793,12 +1289,12 @@ static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] LOOKUP %s @ %"PRIx64" (%s)\n", handler->token, name, hdr->nodeid,
         parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -816,7 +1312,7 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
 {
     struct node* node;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_write(fuse->global);
     node = lookup_node_by_id_locked(fuse, hdr->nodeid);
     TRACE("[%d] FORGET #%"PRIu64" @ %"PRIx64" (%s)\n", handler->token, req->nlookup,
             hdr->nodeid, node ? node->name : "?");
@@ -826,7 +1322,36 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
             release_node_locked(node);
         }
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
+    return NO_STATUS; /* no reply */
+}
+
+static int handle_batch_forget(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header *hdr, const struct fuse_batch_forget_in *req,
+        size_t len)
+{
+    const struct fuse_forget_one *forgets = (const void*) (req + 1);
+    struct node* node;
+    __u32 count;
+    __u32 i;
+
+    if (len < sizeof(*req)) {
+        return NO_STATUS;
+    }
+    count = MIN(req->count, (len - sizeof(*req)) / sizeof(*forgets));
+
+    lock_tree_write(fuse->global);
+    TRACE("[%d] BATCH_FORGET %u\n", handler->token, count);
+    for (i = 0; i < count; i++) {
+        node = lookup_node_by_id_locked(fuse, forgets[i].nodeid);
+        if (node) {
+            __u64 n = forgets[i].nlookup;
+            while (n--) {
+                release_node_locked(node);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&fuse->global->lock);
     return NO_STATUS; /* no reply */
 }
 
@@ -836,11 +1361,11 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
     struct node* node;
     char path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] GETATTR flags=%x fh=%"PRIx64" @ %"PRIx64" (%s)\n", handler->token,
             req->getattr_flags, req->fh, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!node) {
         return -ENOENT;
@@ -859,11 +1384,11 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
     char path[PATH_MAX];
     struct timespec times[2];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] SETATTR fh=%"PRIx64" valid=%x @ %"PRIx64" (%s)\n", handler->token,
             req->fh, req->valid, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!node) {
         return -ENOENT;
@@ -912,6 +1437,8 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
             return -errno;
         }
     }
+    fuse_notify_inval_inode_views(fuse->global, fuse, hdr->nodeid,
+            (req->valid & FATTR_SIZE) ? 0 : -1, 0);
     return fuse_reply_attr(fuse, hdr->unique, node, path);
 }
 
@@ -923,12 +1450,12 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKNOD %s 0%o @ %"PRIx64" (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -941,6 +1468,7 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     if (mknod(child_path, mode, req->rdev) < 0) {
         return -errno;
     }
+    fuse_notify_inval_inode_views(fuse->global, fuse, hdr->nodeid, -1, 0);
     return fuse_reply_entry(fuse, hdr->unique, parent_node, name, actual_name, child_path);
 }
 
@@ -952,12 +1480,12 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKDIR %s 0%o @ %"PRIx64" (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!parent_node || !(actual_name = find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1))) {
@@ -989,6 +1517,7 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
         }
     }
 
+    fuse_notify_inval_inode_views(fuse->global, fuse, hdr->nodeid, -1, 0);
     return fuse_reply_entry(fuse, hdr->unique, parent_node, name, actual_name, child_path);
 }
 
@@ -1000,12 +1529,12 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] UNLINK %s @ %"PRIx64" (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -1017,12 +1546,12 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     if (unlink(child_path) < 0) {
         return -errno;
     }
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_write(fuse->global);
     child_node = lookup_child_by_name_locked(parent_node, name);
     if (child_node) {
-        child_node->deleted = true;
+        mark_node_deleted_locked(child_node);
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
     if (parent_node && child_node) {
         /* Tell all other views that node is gone */
         TRACE("[%d] fuse_notify_delete parent=%"PRIx64", child=%"PRIx64", name=%s\n",
@@ -1048,12 +1577,12 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] RMDIR %s @ %"PRIx64" (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!parent_node || !find_file_within(parent_path, name,
             child_path, sizeof(child_path), 1)) {
@@ -1065,12 +1594,12 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     if (rmdir(child_path) < 0) {
         return -errno;
     }
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_write(fuse->global);
     child_node = lookup_child_by_name_locked(parent_node, name);
     if (child_node) {
-        child_node->deleted = true;
+        mark_node_deleted_locked(child_node);
     }
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
     if (parent_node && child_node) {
         /* Tell all other views that node is gone */
         TRACE("[%d] fuse_notify_delete parent=%"PRIx64", child=%"PRIx64", name=%s\n",
@@ -1102,7 +1631,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     const char* new_actual_name;
     int res;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     old_parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             old_parent_path, sizeof(old_parent_path));
     new_parent_node = lookup_node_and_path_by_id_locked(fuse, req->newdir,
@@ -1130,7 +1659,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto lookup_error;
     }
     acquire_node_locked(child_node);
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     /* Special case for renaming a file where destination is same path
      * differing only by case.  In this case we don't want to look for a case
@@ -1151,22 +1680,31 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto io_error;
     }
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_write(fuse->global);
+    /* The index of the old parent refers to the name being changed. */
+    unindex_child_locked(old_parent_node, child_node);
     res = rename_node_locked(child_node, new_name, new_actual_name);
     if (!res) {
         remove_node_from_parent_locked(child_node);
-        derive_permissions_locked(fuse, new_parent_node, child_node);
+        rederive_permissions_locked(fuse, new_parent_node, child_node);
         derive_permissions_recursive_locked(fuse, child_node);
+        set_node_paths_recursive_locked(child_node, new_parent_node);
         add_node_to_parent_locked(child_node, new_parent_node);
+    } else if (!child_node->deleted) {
+        index_child_locked(old_parent_node, child_node);
     }
     goto done;
 
 io_error:
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_write(fuse->global);
 done:
     release_node_locked(child_node);
 lookup_error:
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
+    if (!res) {
+        fuse_notify_inval_entry_views(fuse->global, fuse, hdr->nodeid, old_name);
+        fuse_notify_inval_entry_views(fuse->global, fuse, req->newdir, new_name);
+    }
     return res;
 }
 
@@ -1189,11 +1727,11 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out;
     struct handle *h;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPEN 0%o @ %"PRIx64" (%s)\n", handler->token,
             req->flags, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!node) {
         return -ENOENT;
@@ -1207,6 +1745,7 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
         return -ENOMEM;
     }
     TRACE("[%d] OPEN %s\n", handler->token, path);
+    h->writable = (req->flags & O_ACCMODE) != O_RDONLY;
     h->fd = open(path, req->flags);
     if (h->fd < 0) {
         free(h);
@@ -1244,6 +1783,13 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
     if (size > MAX_READ) {
         return -EINVAL;
     }
+    if ((android_atomic_acquire_load(&fuse->splice_flags) & FUSE_SPLICE_WRITE)
+            && splice_pipe_ready(handler)) {
+        res = fuse_reply_splice(fuse, handler, unique, h->fd, offset, size);
+        if (res != -EINVAL) {
+            return res;
+        }
+    }
     res = pread64(h->fd, read_buffer, size, offset);
     if (res < 0) {
         return -errno;
@@ -1252,6 +1798,51 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Writes the data handle_fuse_requests left in the pipe to the file. */
+static int handle_write_splice(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_write_in* req,
+        struct handle* h)
+{
+    struct fuse_write_out out;
+    loff_t off = req->offset;
+    size_t done = 0;
+    ssize_t res = 0;
+
+    if (handler->pipe_data != req->size) {
+        return -EINVAL;
+    }
+    if (req->flags & O_DIRECT) {
+        /* Needs an aligned buffer anyway. */
+        __u8 aligned_buffer[req->size] __attribute__((__aligned__(PAGESIZE)));
+        if (!read_pipe_fully(handler, aligned_buffer, req->size)) {
+            return -EIO;
+        }
+        handler->pipe_data = 0;
+        res = pwrite64(h->fd, aligned_buffer, req->size, req->offset);
+        if (res < 0) {
+            return -errno;
+        }
+        done = res;
+    } else {
+        while (done < req->size) {
+            res = TEMP_FAILURE_RETRY(splice(handler->pipe[0], NULL, h->fd, &off,
+                    req->size - done, SPLICE_F_MOVE));
+            if (res <= 0) {
+                break;
+            }
+            done += res;
+            handler->pipe_data -= res;
+        }
+        if (done == 0 && res < 0) {
+            return -errno;
+        }
+    }
+    out.size = done;
+    out.padding = 0;
+    fuse_reply(fuse, hdr->unique, &out, sizeof(out));
+    return NO_STATUS;
+}
+
 static int handle_write(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_write_in* req,
         const void* buffer)
@@ -1259,6 +1850,10 @@ static int handle_write(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_write_out out;
     struct handle *h = id_to_ptr(req->fh);
     int res;
+    if (handler->pipe_data) {
+        return handle_write_splice(fuse, handler, hdr, req, h);
+    }
+
     __u8 aligned_buffer[req->size] __attribute__((__aligned__(PAGESIZE)));
 
     if (req->flags & O_DIRECT) {
@@ -1286,10 +1881,10 @@ static int handle_statfs(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_statfs_out out;
     int res;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     TRACE("[%d] STATFS\n", handler->token);
     res = get_node_path_locked(&fuse->global->root, path, sizeof(path));
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
     if (res < 0) {
         return -ENOENT;
     }
@@ -1315,6 +1910,10 @@ static int handle_release(struct fuse* fuse, struct fuse_handler* handler,
     struct handle *h = id_to_ptr(req->fh);
 
     TRACE("[%d] RELEASE %p(%d)\n", handler->token, h, h->fd);
+    if (h->writable) {
+        /* The other views may have cached what it was before. */
+        fuse_notify_inval_inode_views(fuse->global, fuse, hdr->nodeid, 0, 0);
+    }
     close(h->fd);
     free(h);
     return 0;
@@ -1360,11 +1959,11 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out;
     struct dirhandle *h;
 
-    pthread_mutex_lock(&fuse->global->lock);
+    lock_tree_read(fuse->global);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPENDIR @ %"PRIx64" (%s)\n", handler->token,
             hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->global->lock);
+    pthread_rwlock_unlock(&fuse->global->lock);
 
     if (!node) {
         return -ENOENT;
@@ -1424,6 +2023,59 @@ static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Like READDIR, with the entry LOOKUP would give for the name, so that
+ * listing a directory with attributes is one round trip per file. */
+static int handle_readdirplus(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+{
+    char buffer[8192];
+    struct fuse_direntplus *fdep = (struct fuse_direntplus*) buffer;
+    struct dirent *de;
+    struct dirhandle *h = id_to_ptr(req->fh);
+    struct node* parent_node;
+    char parent_path[PATH_MAX];
+    char child_path[PATH_MAX];
+
+    TRACE("[%d] READDIRPLUS %p\n", handler->token, h);
+    if (req->offset == 0) {
+        /* rewinddir() might have been called above us, so rewind here too */
+        TRACE("[%d] calling rewinddir()\n", handler->token);
+        rewinddir(h->d);
+    }
+    de = readdir(h->d);
+    if (!de) {
+        return 0;
+    }
+
+    /* A zero nodeid tells the kernel there is no entry to go with the name,
+     * as it expects for "." and "..". */
+    memset(&fdep->entry_out, 0, sizeof(fdep->entry_out));
+    if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")) {
+        lock_tree_read(fuse->global);
+        parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
+                parent_path, sizeof(parent_path));
+        pthread_rwlock_unlock(&fuse->global->lock);
+
+        if (parent_node
+                && check_caller_access_to_name(fuse, hdr, parent_node, de->d_name, R_OK)
+                && (size_t) snprintf(child_path, sizeof(child_path), "%s/%s",
+                        parent_path, de->d_name) < sizeof(child_path)
+                && make_entry(fuse, parent_node, de->d_name, de->d_name, child_path,
+                        &fdep->entry_out) < 0) {
+            memset(&fdep->entry_out, 0, sizeof(fdep->entry_out));
+        }
+    }
+
+    fdep->dirent.ino = fdep->entry_out.nodeid ? fdep->entry_out.attr.ino : FUSE_UNKNOWN_INO;
+    /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
+    fdep->dirent.off = req->offset + 1;
+    fdep->dirent.type = de->d_type;
+    fdep->dirent.namelen = strlen(de->d_name);
+    memcpy(fdep->dirent.name, de->d_name, fdep->dirent.namelen + 1);
+    fuse_reply(fuse, hdr->unique, fdep, FUSE_DIRENTPLUS_SIZE(fdep));
+    return NO_STATUS;
+}
+
 static int handle_releasedir(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_release_in* req)
 {
@@ -1441,6 +2093,7 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_init_out out;
     size_t fuse_struct_size;
 
+    memset(&out, 0, sizeof(out));
     TRACE("[%d] INIT ver=%d.%d maxread=%d flags=%x\n",
             handler->token, req->major, req->minor, req->max_readahead, req->flags);
 
@@ -1455,8 +2108,9 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
         return -1;
     }
 
-    /* We limit ourselves to 15 because we don't handle BATCH_FORGET yet */
-    out.minor = MIN(req->minor, 15);
+    /* We limit ourselves to 21, the first with READDIRPLUS, since nothing
+     * newer is of use to us. */
+    out.minor = MIN(req->minor, 21);
     fuse_struct_size = sizeof(out);
 #if defined(FUSE_COMPAT_22_INIT_OUT_SIZE)
     /* FUSE_KERNEL_VERSION >= 23. */
@@ -1472,6 +2126,16 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
     out.major = FUSE_KERNEL_VERSION;
     out.max_readahead = req->max_readahead;
     out.flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+    /* Left to the kernel, which uses it when the entries are stat'ed. */
+    out.flags |= req->flags & (FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO);
+
+    /* Kernels have taken splices to and from /dev/fuse since 7.14, without
+     * saying so in the init flags: FUSE_SPLICE_* are libfuse's names for it,
+     * and ours for what the handlers should do. */
+    if (req->minor >= 14) {
+        android_atomic_release_store(FUSE_SPLICE_READ | FUSE_SPLICE_WRITE | FUSE_SPLICE_MOVE,
+                &fuse->splice_flags);
+    }
 
 #ifdef FUSE_STACKED_IO
     out.flags |= FUSE_STACKED_IO;
@@ -1484,6 +2148,54 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+static const char* const kOpcodeNames[MAX_STATS_OPCODE] = {
+    [0] = "OTHER",
+    [FUSE_LOOKUP] = "LOOKUP",
+    [FUSE_FORGET] = "FORGET",
+    [FUSE_GETATTR] = "GETATTR",
+    [FUSE_SETATTR] = "SETATTR",
+    [FUSE_MKNOD] = "MKNOD",
+    [FUSE_MKDIR] = "MKDIR",
+    [FUSE_UNLINK] = "UNLINK",
+    [FUSE_RMDIR] = "RMDIR",
+    [FUSE_RENAME] = "RENAME",
+    [FUSE_OPEN] = "OPEN",
+    [FUSE_READ] = "READ",
+    [FUSE_WRITE] = "WRITE",
+    [FUSE_STATFS] = "STATFS",
+    [FUSE_RELEASE] = "RELEASE",
+    [FUSE_FSYNC] = "FSYNC",
+    [FUSE_FLUSH] = "FLUSH",
+    [FUSE_OPENDIR] = "OPENDIR",
+    [FUSE_READDIR] = "READDIR",
+    [FUSE_RELEASEDIR] = "RELEASEDIR",
+    [FUSE_FSYNCDIR] = "FSYNCDIR",
+    [FUSE_INIT] = "INIT",
+    [FUSE_BATCH_FORGET] = "BATCH_FORGET",
+    [FUSE_READDIRPLUS] = "READDIRPLUS",
+};
+
+/* Slot of handler->stats that requests with opcode are counted in */
+static __u32 stats_slot(__u32 opcode) {
+    return (opcode < MAX_STATS_OPCODE && kOpcodeNames[opcode]) ? opcode : 0;
+}
+
+static void count_request(struct fuse_handler* handler, __u32 opcode, int res, uint64_t us) {
+    struct fuse_op_stats* stats = &handler->stats[stats_slot(opcode)];
+    int bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && (us >> (bucket + 1))) {
+        bucket++;
+    }
+    stats->count++;
+    if (res < 0) {
+        stats->errors++;
+    }
+    stats->total_us += us;
+    stats->max_us = MAX(stats->max_us, us);
+    stats->latency[bucket]++;
+}
+
 static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         const struct fuse_in_header *hdr, const void *data, size_t data_len)
 {
@@ -1589,6 +2301,11 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_readdir(fuse, handler, hdr, req);
     }
 
+    case FUSE_READDIRPLUS: {
+        const struct fuse_read_in *req = data;
+        return handle_readdirplus(fuse, handler, hdr, req);
+    }
+
     case FUSE_RELEASEDIR: { /* release_in -> */
         const struct fuse_release_in *req = data;
         return handle_releasedir(fuse, handler, hdr, req);
@@ -1599,6 +2316,11 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_init(fuse, handler, hdr, req);
     }
 
+    case FUSE_BATCH_FORGET: { /* batch_forget_in, forget_one[] -> */
+        const struct fuse_batch_forget_in *req = data;
+        return handle_batch_forget(fuse, handler, hdr, req, data_len);
+    }
+
     default: {
         TRACE("[%d] NOTIMPL op=%d uniq=%"PRIx64" nid=%"PRIx64"\n",
                 handler->token, hdr->opcode, hdr->unique, hdr->nodeid);
@@ -1607,12 +2329,59 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
     }
 }
 
+/* Reads a request through the handler's pipe.  The data of a write is left
+ * there, for handle_write to splice to the file, and counted in pipe_data. */
+static ssize_t read_request_splice(struct fuse_handler* handler)
+{
+    struct fuse* fuse = handler->fuse;
+    const struct fuse_in_header *hdr = (void*)handler->request_buffer;
+    size_t head;
+    ssize_t len;
+
+    len = TEMP_FAILURE_RETRY(splice(fuse->fd, NULL, handler->pipe[1], NULL,
+            sizeof(handler->request_buffer), 0));
+    if (len <= 0) {
+        return len;
+    }
+
+    /* Only writes are this long, but check before leaving the rest behind. */
+    head = ((size_t) len >= MIN_SPLICE_WRITE)
+            ? sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in) : (size_t) len;
+    if (!read_pipe_fully(handler, handler->request_buffer, head)) {
+        goto fail;
+    }
+    if (head < (size_t) len) {
+        if (hdr->opcode == FUSE_WRITE) {
+            handler->pipe_data = len - head;
+        } else if (!read_pipe_fully(handler, handler->request_buffer + head, len - head)) {
+            goto fail;
+        }
+    }
+    return len;
+
+fail:
+    ERROR("[%d] lost a request in the splice pipe\n", handler->token);
+    splice_pipe_reset(handler);
+    errno = EIO;
+    return -1;
+}
+
 static void handle_fuse_requests(struct fuse_handler* handler)
 {
     struct fuse* fuse = handler->fuse;
     for (;;) {
-        ssize_t len = TEMP_FAILURE_RETRY(read(fuse->fd,
-                handler->request_buffer, sizeof(handler->request_buffer)));
+        ssize_t len;
+        if (handler->pipe_data) {
+            /* The data of a write that was never taken out of the pipe. */
+            splice_pipe_reset(handler);
+        }
+        if ((android_atomic_acquire_load(&fuse->splice_flags) & FUSE_SPLICE_READ)
+                && splice_pipe_ready(handler)) {
+            len = read_request_splice(handler);
+        } else {
+            len = TEMP_FAILURE_RETRY(read(fuse->fd,
+                    handler->request_buffer, sizeof(handler->request_buffer)));
+        }
         if (len < 0) {
             if (errno == ENODEV) {
                 ERROR("[%d] someone stole our marbles!\n", handler->token);
@@ -1637,6 +2406,10 @@ static void handle_fuse_requests(struct fuse_handler* handler)
         const void *data = handler->request_buffer + sizeof(struct fuse_in_header);
         size_t data_len = len - sizeof(struct fuse_in_header);
         __u64 unique = hdr->unique;
+        __u32 opcode = hdr->opcode;
+        uint64_t start = now_us();
+        daemon_trace_poll();
+        bool traced = daemon_trace_begin(kOpcodeNames[stats_slot(opcode)]);
         int res = handle_fuse_request(fuse, handler, hdr, data, data_len);
 
         /* We do not access the request again after this point because the underlying
@@ -1648,6 +2421,8 @@ static void handle_fuse_requests(struct fuse_handler* handler)
             }
             fuse_status(fuse, unique, res);
         }
+        daemon_trace_end(traced);
+        count_request(handler, opcode, res, now_us() - start);
     }
 }
 
@@ -1658,45 +2433,126 @@ static void* start_handler(void* data)
     return NULL;
 }
 
-static bool remove_str_to_int(void *key, void *value, void *context) {
-    Hashmap* map = context;
-    hashmapRemove(map, key);
-    free(key);
-    return true;
+/* Logs the requests every handler of fuse has handled, by opcode. */
+static void dump_fuse_stats(struct fuse* fuse) {
+    __u32 op;
+
+    for (op = 0; op < MAX_STATS_OPCODE; op++) {
+        struct fuse_op_stats total;
+        struct fuse_handler* handler;
+        char latency[LATENCY_BUCKETS * 20];
+        size_t pos = 0;
+        int i;
+
+        memset(&total, 0, sizeof(total));
+        for (handler = fuse->handlers; handler; handler = handler->next) {
+            const struct fuse_op_stats* stats = &handler->stats[op];
+            total.count += stats->count;
+            total.errors += stats->errors;
+            total.total_us += stats->total_us;
+            total.max_us = MAX(total.max_us, stats->max_us);
+            for (i = 0; i < LATENCY_BUCKETS; i++) {
+                total.latency[i] += stats->latency[i];
+            }
+        }
+        if (!total.count) {
+            continue;
+        }
+
+        latency[0] = '\0';
+        for (i = 0; i < LATENCY_BUCKETS && pos < sizeof(latency); i++) {
+            if (total.latency[i]) {
+                pos += snprintf(latency + pos, sizeof(latency) - pos, " %s%uus:%u",
+                        (i < LATENCY_BUCKETS - 1) ? "<" : ">=",
+                        (i < LATENCY_BUCKETS - 1) ? 2u << i : 1u << i, total.latency[i]);
+            }
+        }
+        ALOGI("%s %s: %"PRIu64" requests, %"PRIu64" failed, avg %"PRIu64"us, max %"PRIu64"us,"
+                " latency%s\n", fuse->dest_path, kOpcodeNames[op], total.count, total.errors,
+                total.total_us / total.count, total.max_us, latency);
+    }
 }
 
-static int read_package_list(struct fuse_global* global) {
-    pthread_mutex_lock(&global->lock);
+static void dump_lock_wait_stats(const char* kind, const struct lock_wait_stats* stats) {
+    ALOGI("tree lock: %"PRIu64" waits for %s, avg %"PRIu64"us, max %"PRIu64"us\n",
+            stats->count, kind, stats->count ? stats->total_us / stats->count : 0,
+            stats->max_us);
+}
+
+/* Logs the request statistics of every mount each time SIGUSR1 arrives,
+ * as sent by "kill -USR1 `pidof sdcard`" to see why storage is slow.
+ * Every other thread has the signal blocked, so only this one takes it. */
+static void* start_stats_dumper(void* data) {
+    struct fuse_global* global = data;
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    for (;;) {
+        struct lock_wait_stats read_waits;
+        struct lock_wait_stats write_waits;
+        int sig;
 
-    hashmapForEach(global->package_to_appid, remove_str_to_int, global->package_to_appid);
+        if (sigwait(&set, &sig)) {
+            continue;
+        }
+        dump_fuse_stats(global->fuse_default);
+        dump_fuse_stats(global->fuse_read);
+        dump_fuse_stats(global->fuse_write);
 
-    FILE* file = fopen(kPackagesListFile, "r");
-    if (!file) {
+        pthread_mutex_lock(&global->stats_lock);
+        read_waits = global->read_waits;
+        write_waits = global->write_waits;
+        pthread_mutex_unlock(&global->stats_lock);
+        dump_lock_wait_stats("reading", &read_waits);
+        dump_lock_wait_stats("writing", &write_waits);
+    }
+    return NULL;
+}
+
+/* Reads the package list into a new index without holding the lock, which
+ * is then only taken to swap it in and update the affected nodes. */
+static int read_package_list(struct fuse_global* global) {
+    int fd = open(kPackagesListFile, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         ERROR("failed to open package list: %s\n", strerror(errno));
-        pthread_mutex_unlock(&global->lock);
         return -1;
     }
 
-    char buf[512];
-    while (fgets(buf, sizeof(buf), file) != NULL) {
-        char package_name[512];
-        int appid;
-        char gids[512];
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
 
-        if (sscanf(buf, "%s %d %*d %*s %*s %s", package_name, &appid, gids) == 3) {
-            char* package_name_dup = strdup(package_name);
-            hashmapPut(global->package_to_appid, package_name_dup, (void*) (uintptr_t) appid);
+    struct packagelist* package_to_appid;
+    if (st.st_size == 0) {
+        package_to_appid = packagelist_parse("", 0, &st);
+    } else {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
         }
+        package_to_appid = packagelist_parse(data, st.st_size, &st);
+        munmap(data, st.st_size);
+    }
+    close(fd);
+    if (!package_to_appid) {
+        return -1;
     }
 
-    TRACE("read_package_list: found %zu packages\n",
-            hashmapSize(global->package_to_appid));
-    fclose(file);
+    TRACE("read_package_list: found %zu packages\n", packagelist_size(package_to_appid));
 
+    lock_tree_write(global);
+    struct packagelist* old_package_to_appid = global->package_to_appid;
+    global->package_to_appid = package_to_appid;
     /* Regenerate ownership details using newly loaded mapping */
-    derive_permissions_recursive_locked(global->fuse_default, &global->root);
+    derive_package_permissions_locked(global->fuse_default, &global->root,
+            old_package_to_appid);
+    pthread_rwlock_unlock(&global->lock);
 
-    pthread_mutex_unlock(&global->lock);
+    packagelist_free(old_package_to_appid);
     return 0;
 }
 
@@ -1769,6 +2625,7 @@ static int usage() {
             "    -U: specify user ID that owns device\n"
             "    -m: source_path is multi-user\n"
             "    -w: runtime write mount has full write access\n"
+            "    -t: specify number of threads to handle each mount with\n"
             "\n");
     return 1;
 }
@@ -1799,29 +2656,47 @@ static int fuse_setup(struct fuse* fuse, gid_t gid, mode_t mask) {
     return 0;
 }
 
+/* Starts threads handlers for fuse, which all read from its fd: the kernel
+ * hands each request to whichever of them is free, so a slow fsync or read
+ * doesn't hold up the lookups behind it. */
+static void start_handlers(struct fuse* fuse, int first_token, int threads) {
+    int i;
+
+    for (i = 0; i < threads; i++) {
+        struct fuse_handler* handler = calloc(1, sizeof(*handler));
+        pthread_t thread;
+
+        if (!handler) {
+            ERROR("failed to allocate handler\n");
+            exit(1);
+        }
+        handler->fuse = fuse;
+        handler->token = first_token + i;
+        handler->pipe[0] = handler->pipe[1] = -1;
+        handler->next = fuse->handlers;
+        fuse->handlers = handler;
+        if (pthread_create(&thread, NULL, start_handler, handler)) {
+            ERROR("failed to pthread_create\n");
+            exit(1);
+        }
+    }
+}
+
 static void run(const char* source_path, const char* label, uid_t uid,
-        gid_t gid, userid_t userid, bool multi_user, bool full_write) {
+        gid_t gid, userid_t userid, bool multi_user, bool full_write, int threads) {
     struct fuse_global global;
     struct fuse fuse_default;
     struct fuse fuse_read;
     struct fuse fuse_write;
-    struct fuse_handler handler_default;
-    struct fuse_handler handler_read;
-    struct fuse_handler handler_write;
-    pthread_t thread_default;
-    pthread_t thread_read;
-    pthread_t thread_write;
 
     memset(&global, 0, sizeof(global));
     memset(&fuse_default, 0, sizeof(fuse_default));
     memset(&fuse_read, 0, sizeof(fuse_read));
     memset(&fuse_write, 0, sizeof(fuse_write));
-    memset(&handler_default, 0, sizeof(handler_default));
-    memset(&handler_read, 0, sizeof(handler_read));
-    memset(&handler_write, 0, sizeof(handler_write));
 
-    pthread_mutex_init(&global.lock, NULL);
-    global.package_to_appid = hashmapCreate(256, str_hash, str_icase_equals);
+    pthread_rwlock_init(&global.lock, NULL);
+    pthread_mutex_init(&global.stats_lock, NULL);
+    global.package_to_appid = packagelist_parse("", 0, NULL);
     global.uid = uid;
     global.gid = gid;
     global.multi_user = multi_user;
@@ -1833,6 +2708,8 @@ static void run(const char* source_path, const char* label, uid_t uid,
     global.root.refcount = 2;
     global.root.namelen = strlen(source_path);
     global.root.name = strdup(source_path);
+    global.root.path = global.root.name;
+    global.root.pathlen = global.root.namelen;
     global.root.userid = userid;
     global.root.uid = AID_ROOT;
     global.root.under_android = false;
@@ -1859,14 +2736,6 @@ static void run(const char* source_path, const char* label, uid_t uid,
     snprintf(fuse_read.dest_path, PATH_MAX, "/mnt/runtime/read/%s", label);
     snprintf(fuse_write.dest_path, PATH_MAX, "/mnt/runtime/write/%s", label);
 
-    handler_default.fuse = &fuse_default;
-    handler_read.fuse = &fuse_read;
-    handler_write.fuse = &fuse_write;
-
-    handler_default.token = 0;
-    handler_read.token = 1;
-    handler_write.token = 2;
-
     umask(0);
 
     if (multi_user) {
@@ -1908,11 +2777,20 @@ static void run(const char* source_path, const char* label, uid_t uid,
         fs_prepare_dir(global.obb_path, 0775, uid, gid);
     }
 
-    if (pthread_create(&thread_default, NULL, start_handler, &handler_default)
-            || pthread_create(&thread_read, NULL, start_handler, &handler_read)
-            || pthread_create(&thread_write, NULL, start_handler, &handler_write)) {
-        ERROR("failed to pthread_create\n");
-        exit(1);
+    /* Every thread started from here on inherits SIGUSR1 being blocked,
+     * leaving it to the stats dumper. */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    start_handlers(&fuse_default, 0, threads);
+    start_handlers(&fuse_read, threads, threads);
+    start_handlers(&fuse_write, 2 * threads, threads);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, start_stats_dumper, &global)) {
+        ERROR("failed to start stats dumper\n");
     }
 
     watch_package_list(&global);
@@ -1928,12 +2806,13 @@ int main(int argc, char **argv) {
     userid_t userid = 0;
     bool multi_user = false;
     bool full_write = false;
+    int threads = 0;
     int i;
     struct rlimit rlim;
     int fs_version;
 
     int opt;
-    while ((opt = getopt(argc, argv, "u:g:U:mw")) != -1) {
+    while ((opt = getopt(argc, argv, "u:g:U:mwt:")) != -1) {
         switch (opt) {
             case 'u':
                 uid = strtoul(optarg, NULL, 10);
@@ -1950,6 +2829,9 @@ int main(int argc, char **argv) {
             case 'w':
                 full_write = true;
                 break;
+            case 't':
+                threads = strtoul(optarg, NULL, 10);
+                break;
             case '?':
             default:
                 return usage();
@@ -1980,6 +2862,9 @@ int main(int argc, char **argv) {
         ERROR("uid and gid must be nonzero\n");
         return usage();
     }
+    if (!threads) {
+        threads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 2), MAX_HANDLER_THREADS);
+    }
 
     rlim.rlim_cur = 8192;
     rlim.rlim_max = 8192;
@@ -1992,6 +2877,6 @@ int main(int argc, char **argv) {
         sleep(1);
     }
 
-    run(source_path, label, uid, gid, userid, multi_user, full_write);
+    run(source_path, label, uid, gid, userid, multi_user, full_write, threads);
     return 1;
 }
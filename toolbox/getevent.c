@@ -36,6 +36,20 @@ static struct pollfd *ufds;
 static char **device_names;
 static int nfds;
 
+/* The events read from a device in one go */
+#define EVENT_BATCH 64
+
+/* What -b writes for each event, in host byte order */
+struct event_record {
+    uint32_t sec;
+    uint32_t usec;
+    uint16_t device;    /* N of /dev/input/eventN, or 0xffff */
+    uint16_t type;
+    uint16_t code;
+    uint16_t reserved;
+    int32_t value;
+};
+
 enum {
     PRINT_DEVICE_ERRORS     = 1U << 0,
     PRINT_DEVICE            = 1U << 1,
@@ -276,6 +290,21 @@ static void print_event(int type, int code, int value, int print_flags)
     }
 }
 
+static uint16_t device_number(const char *device)
+{
+    const char *p = strrchr(device, '/');
+    char *end;
+    unsigned long n;
+
+    p = p ? p + 1 : device;
+    if(strncmp(p, "event", 5) != 0)
+        return 0xffff;
+    n = strtoul(p + 5, &end, 10);
+    if(end == p + 5 || *end != '\0' || n >= 0xffff)
+        return 0xffff;
+    return n;
+}
+
 static void print_hid_descriptor(int bus, int vendor, int product)
 {
     const char *dirname = "/sys/kernel/debug/hid";
@@ -497,7 +526,7 @@ static int scan_dir(const char *dirname, int print_flags)
 
 static void usage(char *name)
 {
-    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [device]\n", name);
+    fprintf(stderr, "Usage: %s [-t] [-n] [-s switchmask] [-S] [-v [mask]] [-d] [-p] [-i] [-l] [-q] [-c count] [-r] [-b] [device]\n", name);
     fprintf(stderr, "    -t: show time stamps\n");
     fprintf(stderr, "    -n: don't print newlines\n");
     fprintf(stderr, "    -s: print switch states for given bits\n");
@@ -510,6 +539,8 @@ static void usage(char *name)
     fprintf(stderr, "    -q: quiet (clear verbosity mask)\n");
     fprintf(stderr, "    -c: print given number of events then exit\n");
     fprintf(stderr, "    -r: print rate events are received\n");
+    fprintf(stderr, "    -b: write events as binary records instead of text: u32 sec, u32 usec,\n"
+                    "        u16 device (N of eventN), u16 type, u16 code, u16 reserved, s32 value\n");
 }
 
 int getevent_main(int argc, char *argv[])
@@ -521,7 +552,9 @@ int getevent_main(int argc, char *argv[])
     int print_device = 0;
     char *newline = "\n";
     uint16_t get_switch = 0;
-    struct input_event event;
+    struct input_event events[EVENT_BATCH];
+    struct event_record record;
+    int binary = 0;
     int print_flags = 0;
     int print_flags_set = 0;
     int dont_block = -1;
@@ -533,7 +566,7 @@ int getevent_main(int argc, char *argv[])
 
     opterr = 0;
     do {
-        c = getopt(argc, argv, "tns:Sv::dpilqc:rh");
+        c = getopt(argc, argv, "tns:Sv::dpilqc:rbh");
         if (c == EOF)
             break;
         switch (c) {
@@ -589,6 +622,9 @@ int getevent_main(int argc, char *argv[])
         case 'r':
             sync_rate = 1;
             break;
+        case 'b':
+            binary = 1;
+            break;
         case '?':
             fprintf(stderr, "%s: invalid option -%c\n",
                 argv[0], optopt);
@@ -651,6 +687,10 @@ int getevent_main(int argc, char *argv[])
     if(dont_block)
         return 0;
 
+    /* Events go out when all that poll found has been read, not line by line */
+    setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+    memset(&record, 0, sizeof(record));
+
     while(1) {
         //int pollres =
         poll(ufds, nfds, -1);
@@ -661,29 +701,48 @@ int getevent_main(int argc, char *argv[])
         for(i = 1; i < nfds; i++) {
             if(ufds[i].revents) {
                 if(ufds[i].revents & POLLIN) {
-                    res = read(ufds[i].fd, &event, sizeof(event));
-                    if(res < (int)sizeof(event)) {
+                    int count;
+                    int j;
+
+                    res = read(ufds[i].fd, events, sizeof(events));
+                    if(res < (int)sizeof(events[0])) {
                         fprintf(stderr, "could not get event\n");
                         return 1;
                     }
-                    if(get_time) {
-                        printf("[%8ld.%06ld] ", event.time.tv_sec, event.time.tv_usec);
-                    }
-                    if(print_device)
-                        printf("%s: ", device_names[i]);
-                    print_event(event.type, event.code, event.value, print_flags);
-                    if(sync_rate && event.type == 0 && event.code == 0) {
-                        int64_t now = event.time.tv_sec * 1000000LL + event.time.tv_usec;
-                        if(last_sync_time)
-                            printf(" rate %lld", 1000000LL / (now - last_sync_time));
-                        last_sync_time = now;
+                    count = res / sizeof(events[0]);
+                    record.device = device_number(device_names[i]);
+                    for(j = 0; j < count; j++) {
+                        struct input_event *event = &events[j];
+
+                        if(binary) {
+                            record.sec = event->time.tv_sec;
+                            record.usec = event->time.tv_usec;
+                            record.type = event->type;
+                            record.code = event->code;
+                            record.value = event->value;
+                            fwrite(&record, sizeof(record), 1, stdout);
+                        } else {
+                            if(get_time) {
+                                printf("[%8ld.%06ld] ", event->time.tv_sec, event->time.tv_usec);
+                            }
+                            if(print_device)
+                                printf("%s: ", device_names[i]);
+                            print_event(event->type, event->code, event->value, print_flags);
+                            if(sync_rate && event->type == 0 && event->code == 0) {
+                                int64_t now = event->time.tv_sec * 1000000LL + event->time.tv_usec;
+                                if(last_sync_time)
+                                    printf(" rate %lld", 1000000LL / (now - last_sync_time));
+                                last_sync_time = now;
+                            }
+                            printf("%s", newline);
+                        }
+                        if(event_count && --event_count == 0)
+                            return 0;
                     }
-                    printf("%s", newline);
-                    if(event_count && --event_count == 0)
-                        return 0;
                 }
             }
         }
+        fflush(stdout);
     }
 
     return 0;
@@ -66,6 +66,7 @@ static const char rcsid[] =
 #define MINBPS    512       /* minimum bytes per sector */
 #define MAXSPC    128       /* maximum sectors per cluster */
 #define MAXNFT    16        /* maximum number of FATs */
+#define MAXWRITE  0x100000  /* bytes written at a time */
 #define DEFBLK    4096      /* default block size */
 #define DEFBLK16  2048      /* default block size FAT16 */
 #define DEFRDE    512       /* default root directory entries */
@@ -222,6 +223,7 @@ static const u_int8_t bootcode[] = {
 };
 
 static void check_mounted(const char *, mode_t);
+static void discard(int, const char *, mode_t, off_t, off_t);
 static void getstdfmt(const char *, struct bpb *);
 static void getdiskinfo(int, const char *, const char *, int, struct bpb *);
 static void print_bpb(struct bpb *);
@@ -238,13 +240,13 @@ static void usage(void);
  */
 int newfs_msdos_main(int argc, char *argv[])
 {
-    static const char opts[] = "@:NAB:C:F:I:L:O:S:a:b:c:e:f:h:i:k:m:n:o:r:s:u:";
+    static const char opts[] = "@:NAB:C:F:I:L:O:S:Ta:b:c:e:f:h:i:k:m:n:o:r:s:u:";
     const char *opt_B = NULL, *opt_L = NULL, *opt_O = NULL, *opt_f = NULL;
     u_int opt_F = 0, opt_I = 0, opt_S = 0, opt_a = 0, opt_b = 0, opt_c = 0;
     u_int opt_e = 0, opt_h = 0, opt_i = 0, opt_k = 0, opt_m = 0, opt_n = 0;
     u_int opt_o = 0, opt_r = 0, opt_s = 0, opt_u = 0;
     u_int opt_A = 0;
-    int opt_N = 0;
+    int opt_N = 0, opt_T = 0;
     int Iflag = 0, mflag = 0, oflag = 0;
     char buf[MAXPATHLEN];
     struct stat sb;
@@ -256,11 +258,12 @@ int newfs_msdos_main(int argc, char *argv[])
     struct bsxbpb *bsxbpb;
     struct bsx *bsx;
     struct de *de;
-    u_int8_t *img;
+    u_int8_t *img, *wbuf;
+    size_t wlen;
     const char *fname, *dtype, *bname;
     ssize_t n;
     time_t now;
-    u_int fat, bss, rds, cls, dir, lsn, x, x1, x2;
+    u_int fat, bss, rds, cls, dir, end, spw, lsn, x, x1, x2;
     u_int extra_res, alignment=0, set_res, set_spf, set_spc, tempx, attempts=0;
     int ch, fd, fd1;
     off_t opt_create = 0, opt_ofs = 0;
@@ -273,6 +276,9 @@ int newfs_msdos_main(int argc, char *argv[])
         case 'N':
             opt_N = 1;
             break;
+        case 'T':
+            opt_T = 1;
+            break;
         case 'A':
             opt_A = 1;
             break;
@@ -638,10 +644,15 @@ int newfs_msdos_main(int argc, char *argv[])
         gettimeofday(&tv, NULL);
         now = tv.tv_sec;
         tm = localtime(&now);
-        if (!(img = malloc(bpb.bps)))
-            err(1, "%u", bpb.bps);
+        /* The sectors are built in place in a large buffer, written out
+         * whenever it fills up */
+        spw = MAXWRITE / bpb.bps;
+        if (!(wbuf = malloc(spw * bpb.bps)))
+            err(1, "%u", spw * bpb.bps);
         dir = bpb.res + (bpb.spf ? bpb.spf : bpb.bspf) * bpb.nft;
-        for (lsn = 0; lsn < dir + (fat == 32 ? bpb.spc : rds); lsn++) {
+        end = dir + (fat == 32 ? bpb.spc : rds);
+        for (lsn = 0; lsn < end; lsn++) {
+            img = wbuf + (lsn % spw) * bpb.bps;
             x = lsn;
             if (opt_B && fat == 32 && bpb.bkbs != MAXU16 && bss <= bpb.bkbs && x >= bpb.bkbs) {
                 x -= bpb.bkbs;
@@ -734,17 +745,50 @@ int newfs_msdos_main(int argc, char *argv[])
                         (u_int)tm->tm_mday;
                 mk2(de->date, x);
             }
-            if ((n = write(fd, img, bpb.bps)) == -1)
+            if (lsn % spw != spw - 1 && lsn != end - 1)
+                continue;
+            wlen = (size_t)(lsn % spw + 1) * bpb.bps;
+            if ((n = write(fd, wbuf, wlen)) == -1)
                 err(1, "%s", fname);
-            if ((unsigned)n != bpb.bps) {
-                errx(1, "%s: can't write sector %u", fname, lsn);
+            if ((size_t)n != wlen) {
+                errx(1, "%s: can't write sector %u", fname, lsn - lsn % spw);
                 exit(1);
             }
         }
+        free(wbuf);
+        if (opt_T)
+            discard(fd, fname, sb.st_mode, opt_ofs + (off_t)end * bpb.bps,
+                    opt_ofs + (off_t)(bpb.sec ? bpb.sec : bpb.bsec) * bpb.bps);
     }
     return 0;
 }
 
+/*
+ * Discard the data area, from start to end, so that the device neither has
+ * to keep nor to write what was there before.
+ */
+static void discard(int fd, const char *fname, mode_t mode, off_t start,
+                    off_t end)
+{
+#ifdef BLKDISCARD
+    u_int64_t range[2];
+
+    if (!S_ISBLK(mode)) {
+        warnx("%s is not a block device, not discarding", fname);
+        return;
+    }
+    if (end <= start)
+        return;
+    range[0] = start;
+    range[1] = end - start;
+    if (ioctl(fd, BLKDISCARD, range))
+        warn("%s: can't discard data area", fname);
+#else
+    (void)fd; (void)mode; (void)start; (void)end;
+    warnx("%s: discard not supported", fname);
+#endif
+}
+
 /*
  * Exit with error if file system is mounted.
  */
@@ -1080,6 +1124,7 @@ static void usage(void)
             "\t-N don't create file system: just print out parameters\n"
             "\t-O OEM string\n"
             "\t-S bytes/sector\n"
+            "\t-T discard (trim) the data area\n"
             "\t-a sectors/FAT\n"
             "\t-b block size\n"
             "\t-c sectors/cluster\n"
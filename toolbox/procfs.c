@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016, The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Google, Inc. nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "procfs.h"
+
+ssize_t procfs_read(int dirfd, const char *path, char *buf, size_t size) {
+    ssize_t len = 0, r;
+    int fd;
+
+    fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    // procfs hands out at most a page per read.
+    while ((size_t) len < size - 1) {
+        r = read(fd, buf + len, size - 1 - len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        if (r == 0) break;
+        len += r;
+    }
+    close(fd);
+    buf[len] = '\0';
+    return len;
+}
+
+/* Skips a space and parses a decimal number, stopping at the end of the
+ * line.  Fields that are missing read as 0. */
+static int64_t next_field(char **p) {
+    char *s = *p;
+    int64_t v = 0;
+    int neg = 0;
+
+    while (*s == ' ') s++;
+    if (*s == '-') {
+        neg = 1;
+        s++;
+    }
+    while (*s >= '0' && *s <= '9') {
+        v = v * 10 + (*s - '0');
+        s++;
+    }
+    *p = s;
+    return neg ? -v : v;
+}
+
+int procfs_parse_stat(char *buf, struct procfs_stat *st) {
+    char *open_paren, *close_paren, *p;
+    int64_t f[42];
+    size_t len;
+    int i;
+
+    /* The name may contain spaces and parens: it runs from the first '('
+     * to the last ')'. */
+    open_paren = strchr(buf, '(');
+    close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return -1;
+
+    len = close_paren - open_paren - 1;
+    if (len >= PROCFS_COMM_LEN) len = PROCFS_COMM_LEN - 1;
+    memcpy(st->comm, open_paren + 1, len);
+    st->comm[len] = '\0';
+
+    p = close_paren + 1;
+    while (*p == ' ') p++;
+    st->state = *p ? *p++ : '?';
+
+    // Fields are numbered from 1 as in proc(5); the state is field 3.
+    for (i = 4; i < 42; i++) f[i] = next_field(&p);
+
+    st->ppid = f[4];
+    st->utime = f[14];
+    st->stime = f[15];
+    st->priority = f[18];
+    st->nice = f[19];
+    st->num_threads = f[20];
+    st->starttime = f[22];
+    st->vsize = f[23];
+    st->rss = f[24];
+    st->kstkeip = f[30];
+    st->processor = f[39];
+    st->rt_priority = f[40];
+    st->policy = f[41];
+    return 0;
+}
+
+int procfs_status_id(const char *buf, const char *key, unsigned *id) {
+    size_t keylen = strlen(key);
+    const char *line = buf;
+
+    while (line && *line) {
+        if (!strncmp(line, key, keylen)) {
+            *id = strtoul(line + keylen, NULL, 10);
+            return 0;
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    return -1;
+}
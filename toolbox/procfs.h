@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016, The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Google, Inc. nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _TOOLBOX_PROCFS_H
+#define _TOOLBOX_PROCFS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Reading of /proc without stdio, shared by ps and top.  Paths are relative
+ * to a directory fd, normally that of /proc itself, so that no full path
+ * has to be formatted and looked up for every file.
+ */
+
+#define PROCFS_COMM_LEN 64
+
+struct procfs_stat {
+    char comm[PROCFS_COMM_LEN];
+    char state;
+    int ppid;
+    uint64_t utime;
+    uint64_t stime;
+    long priority;
+    long nice;
+    int num_threads;
+    uint64_t starttime;
+    uint64_t vsize;
+    uint64_t rss;
+    uintptr_t kstkeip;
+    int processor;
+    unsigned rt_priority;
+    unsigned policy;
+};
+
+/* Reads up to size - 1 bytes of dirfd/path into buf and NUL-terminates it.
+ * Returns the length read or -1. */
+ssize_t procfs_read(int dirfd, const char *path, char *buf, size_t size);
+
+/* Parses the contents of a stat file.  buf is modified.  Returns 0, or -1
+ * if it isn't a stat line. */
+int procfs_parse_stat(char *buf, struct procfs_stat *st);
+
+/* Finds the first value of the "Uid:" or "Gid:" line of a status file. */
+int procfs_status_id(const char *buf, const char *key, unsigned *id);
+
+#endif /* _TOOLBOX_PROCFS_H */
@@ -12,15 +12,7 @@
 
 #include <cutils/sched_policy.h>
 
-static char *nexttoksep(char **strp, char *sep)
-{
-    char *p = strsep(strp,sep);
-    return (p == 0) ? "" : p;
-}
-static char *nexttok(char **strp)
-{
-    return nexttoksep(strp, " ");
-}
+#include "procfs.h"
 
 #define SHOW_PRIO 1
 #define SHOW_TIME 2
@@ -39,6 +31,9 @@ static char *nexttok(char **strp)
 static int display_flags = 0;
 static int ppid_filter = 0;
 
+/* /proc, which all the files are read relative to. */
+static int proc_fd = -1;
+
 static void print_exe_abi(int pid);
 
 static int ps_line(int pid, int tid, char *namefilter)
@@ -48,8 +43,8 @@ static int ps_line(int pid, int tid, char *namefilter)
     char macline[1024];
     char user[32];
     struct stat stats;
-    int fd, r;
-    char *ptr, *name, *state;
+    struct procfs_stat st;
+    char *name, state[2];
     int ppid;
     unsigned rss, vss;
     uintptr_t eip;
@@ -57,90 +52,38 @@ static int ps_line(int pid, int tid, char *namefilter)
     int prio, nice, rtprio, sched, psr;
     struct passwd *pw;
 
-    snprintf(statline, sizeof(statline), "/proc/%d", pid);
-    stat(statline, &stats);
+    snprintf(statline, sizeof(statline), "%d", pid);
+    fstatat(proc_fd, statline, &stats, 0);
 
     if(tid) {
-        snprintf(statline, sizeof(statline), "/proc/%d/task/%d/stat", pid, tid);
+        snprintf(statline, sizeof(statline), "%d/task/%d/stat", pid, tid);
         cmdline[0] = 0;
-        snprintf(macline, sizeof(macline), "/proc/%d/task/%d/attr/current", pid, tid);
+        snprintf(macline, sizeof(macline), "%d/task/%d/attr/current", pid, tid);
     } else {
-        snprintf(statline, sizeof(statline), "/proc/%d/stat", pid);
-        snprintf(cmdline, sizeof(cmdline), "/proc/%d/cmdline", pid);
-        snprintf(macline, sizeof(macline), "/proc/%d/attr/current", pid);
-        fd = open(cmdline, O_RDONLY);
-        if(fd == 0) {
-            r = 0;
-        } else {
-            r = read(fd, cmdline, 1023);
-            close(fd);
-            if(r < 0) r = 0;
-        }
-        cmdline[r] = 0;
+        snprintf(statline, sizeof(statline), "%d/stat", pid);
+        snprintf(cmdline, sizeof(cmdline), "%d/cmdline", pid);
+        snprintf(macline, sizeof(macline), "%d/attr/current", pid);
+        if (procfs_read(proc_fd, cmdline, cmdline, sizeof(cmdline)) < 0)
+            cmdline[0] = 0;
     }
 
-    fd = open(statline, O_RDONLY);
-    if(fd == 0) return -1;
-    r = read(fd, statline, 1023);
-    close(fd);
-    if(r < 0) return -1;
-    statline[r] = 0;
-
-    ptr = statline;
-    nexttok(&ptr); // skip pid
-    ptr++;          // skip "("
+    if (procfs_read(proc_fd, statline, statline, sizeof(statline)) < 0) return -1;
+    if (procfs_parse_stat(statline, &st)) return -1;
 
-    name = ptr;
-    ptr = strrchr(ptr, ')'); // Skip to *last* occurence of ')',
-    *ptr++ = '\0';           // and null-terminate name.
-
-    ptr++;          // skip " "
-    state = nexttok(&ptr);
-    ppid = atoi(nexttok(&ptr));
-    nexttok(&ptr); // pgrp
-    nexttok(&ptr); // sid
-    nexttok(&ptr); // tty
-    nexttok(&ptr); // tpgid
-    nexttok(&ptr); // flags
-    nexttok(&ptr); // minflt
-    nexttok(&ptr); // cminflt
-    nexttok(&ptr); // majflt
-    nexttok(&ptr); // cmajflt
-#if 1
-    utime = atoi(nexttok(&ptr));
-    stime = atoi(nexttok(&ptr));
-#else
-    nexttok(&ptr); // utime
-    nexttok(&ptr); // stime
-#endif
-    nexttok(&ptr); // cutime
-    nexttok(&ptr); // cstime
-    prio = atoi(nexttok(&ptr));
-    nice = atoi(nexttok(&ptr));
-    nexttok(&ptr); // threads
-    nexttok(&ptr); // itrealvalue
-    nexttok(&ptr); // starttime
-    vss = strtoul(nexttok(&ptr), 0, 10); // vsize
-    rss = strtoul(nexttok(&ptr), 0, 10); // rss
-    nexttok(&ptr); // rlim
-    nexttok(&ptr); // startcode
-    nexttok(&ptr); // endcode
-    nexttok(&ptr); // startstack
-    nexttok(&ptr); // kstkesp
-    eip = strtoul(nexttok(&ptr), 0, 10); // kstkeip
-    nexttok(&ptr); // signal
-    nexttok(&ptr); // blocked
-    nexttok(&ptr); // sigignore
-    nexttok(&ptr); // sigcatch
-    nexttok(&ptr); // wchan
-    nexttok(&ptr); // nswap
-    nexttok(&ptr); // cnswap
-    nexttok(&ptr); // exit signal
-    psr = atoi(nexttok(&ptr)); // processor
-    rtprio = atoi(nexttok(&ptr)); // rt_priority
-    sched = atoi(nexttok(&ptr)); // scheduling policy
-
-    nexttok(&ptr); // tty
+    name = st.comm;
+    state[0] = st.state;
+    state[1] = '\0';
+    ppid = st.ppid;
+    utime = st.utime;
+    stime = st.stime;
+    prio = st.priority;
+    nice = st.nice;
+    vss = st.vsize;
+    rss = st.rss;
+    eip = st.kstkeip;
+    psr = st.processor;
+    rtprio = st.rt_priority;
+    sched = st.policy;
 
     if(tid != 0) {
         ppid = pid;
@@ -160,14 +103,8 @@ static int ps_line(int pid, int tid, char *namefilter)
 
     if(!namefilter || !strncmp(cmdline[0] ? cmdline : name, namefilter, strlen(namefilter))) {
         if (display_flags & SHOW_MACLABEL) {
-            fd = open(macline, O_RDONLY);
-            strcpy(macline, "-");
-            if (fd >= 0) {
-                r = read(fd, macline, sizeof(macline)-1);
-                close(fd);
-                if (r > 0)
-                    macline[r] = 0;
-            }
+            if (procfs_read(proc_fd, macline, macline, sizeof(macline)) <= 0)
+                strcpy(macline, "-");
             printf("%-30s %-9s %-5d %-5d %s\n", macline, user, pid, ppid, cmdline[0] ? cmdline : name);
             return 0;
         }
@@ -185,14 +122,12 @@ static int ps_line(int pid, int tid, char *namefilter)
                 printf(" %.2s ", get_sched_policy_name(p));
         }
         char path[PATH_MAX];
-        snprintf(path, sizeof(path), "/proc/%d/wchan", pid);
-        char wchan[10];
-        int fd = open(path, O_RDONLY);
-        ssize_t wchan_len = read(fd, wchan, sizeof(wchan));
+        snprintf(path, sizeof(path), "%d/wchan", pid);
+        char wchan[11];
+        ssize_t wchan_len = procfs_read(proc_fd, path, wchan, sizeof(wchan));
         if (wchan_len == -1) {
             wchan[wchan_len = 0] = '\0';
         }
-        close(fd);
         printf(" %10.*s %0*" PRIxPTR " %s ", (int) wchan_len, wchan, (int) PC_WIDTH, eip, state);
         if (display_flags & SHOW_ABI) {
             print_exe_abi(pid);
@@ -270,6 +205,7 @@ int ps_main(int argc, char **argv)
 
     d = opendir("/proc");
     if(d == 0) return -1;
+    proc_fd = dirfd(d);
 
     while(argc > 1){
         if(!strcmp(argv[1],"-t")) {
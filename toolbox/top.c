@@ -31,6 +31,7 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <inttypes.h>
 #include <pwd.h>
@@ -42,6 +43,8 @@
 
 #include <cutils/sched_policy.h>
 
+#include "procfs.h"
+
 struct cpu_info {
     long unsigned utime, ntime, stime, itime;
     long unsigned iowtime, irqtime, sirqtime;
@@ -60,6 +63,7 @@ struct proc_info {
     char name[PROC_NAME_LEN];
     char tname[THREAD_NAME_LEN];
     char state;
+    uint64_t starttime;
     uint64_t utime;
     uint64_t stime;
     char pr[3];
@@ -82,8 +86,10 @@ struct proc_list {
 
 #define INIT_PROCS 50
 #define THREAD_MULT 8
+/* The arrays are swapped and reused from one update to the next. */
 static struct proc_info **old_procs, **new_procs;
 static int num_old_procs, num_new_procs;
+static int size_old_procs, size_new_procs;
 static struct proc_info *free_procs;
 static int num_used_procs, num_free_procs;
 
@@ -93,6 +99,7 @@ static struct cpu_info old_cpu, new_cpu;
 
 static struct proc_info *alloc_proc(void);
 static void free_proc(struct proc_info *proc);
+static void swap_procs(void);
 static void read_procs(void);
 static int read_stat(char *filename, struct proc_info *proc);
 static void read_policy(int pid, struct proc_info *proc);
@@ -102,6 +109,7 @@ static int read_status(char *filename, struct proc_info *proc);
 static void print_procs(void);
 static struct proc_info *find_old_proc(pid_t pid, pid_t tid);
 static void free_old_procs(void);
+static int proc_id_cmp(const void *a, const void *b);
 static int (*proc_cmp)(const void *a, const void *b);
 static int proc_cpu_cmp(const void *a, const void *b);
 static int proc_vss_cmp(const void *a, const void *b);
@@ -181,8 +189,7 @@ int top_main(int argc, char *argv[]) {
 
     read_procs();
     while ((iterations == -1) || (iterations-- > 0)) {
-        old_procs = new_procs;
-        num_old_procs = num_new_procs;
+        swap_procs();
         memcpy(&old_cpu, &new_cpu, sizeof(old_cpu));
         read_procs();
         print_procs();
@@ -220,29 +227,49 @@ static void free_proc(struct proc_info *proc) {
 }
 
 #define MAX_LINE 256
+#define MAX_STATUS 2048
+
+/* /proc, which all the files are read relative to. */
+static int proc_fd = -1;
+
+static void swap_procs(void) {
+    struct proc_info **procs = old_procs;
+    int size = size_old_procs;
+
+    old_procs = new_procs;
+    num_old_procs = num_new_procs;
+    size_old_procs = size_new_procs;
+    new_procs = procs;
+    num_new_procs = 0;
+    size_new_procs = size;
+}
 
 static void read_procs(void) {
     DIR *proc_dir, *task_dir;
     struct dirent *pid_dir, *tid_dir;
     char filename[64];
-    FILE *file;
-    int proc_num;
-    struct proc_info *proc;
+    char buf[MAX_LINE];
+    int proc_num, task_fd;
+    struct proc_info *proc, *old_proc;
     pid_t pid, tid;
 
-    int i;
-
     proc_dir = opendir("/proc");
     if (!proc_dir) die("Could not open /proc.\n");
+    proc_fd = dirfd(proc_dir);
+
+    if (!new_procs) {
+        size_new_procs = INIT_PROCS * (threads ? THREAD_MULT : 1);
+        new_procs = malloc(size_new_procs * sizeof(struct proc_info *));
+        if (!new_procs) die("Could not allocate procs array.\n");
+    }
 
-    new_procs = calloc(INIT_PROCS * (threads ? THREAD_MULT : 1), sizeof(struct proc_info *));
-    num_new_procs = INIT_PROCS * (threads ? THREAD_MULT : 1);
+    // Entries of the previous update are looked up by pid and tid.
+    if (num_old_procs)
+        qsort(old_procs, num_old_procs, sizeof(struct proc_info *), proc_id_cmp);
 
-    file = fopen("/proc/stat", "r");
-    if (!file) die("Could not open /proc/stat.\n");
-    fscanf(file, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
+    if (procfs_read(proc_fd, "stat", buf, sizeof(buf)) < 0) die("Could not open /proc/stat.\n");
+    sscanf(buf, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
             &new_cpu.itime, &new_cpu.iowtime, &new_cpu.irqtime, &new_cpu.sirqtime);
-    fclose(file);
 
     proc_num = 0;
     while ((pid_dir = readdir(proc_dir))) {
@@ -258,143 +285,126 @@ static void read_procs(void) {
 
             proc->pid = proc->tid = pid;
 
-            snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
-            read_stat(filename, proc);
+            snprintf(filename, sizeof(filename), "%d/stat", pid);
+            if (read_stat(filename, proc)) {
+                // It exited while we were looking.
+                free_proc(proc);
+                continue;
+            }
 
-            snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
-            read_cmdline(filename, proc);
+            // A process that is still the one seen last time, under the
+            // same name, still has the same command line.
+            old_proc = find_old_proc(pid, pid);
+            if (old_proc && old_proc->starttime == proc->starttime &&
+                    !strcmp(old_proc->tname, proc->tname)) {
+                strcpy(proc->name, old_proc->name);
+            } else {
+                snprintf(filename, sizeof(filename), "%d/cmdline", pid);
+                read_cmdline(filename, proc);
+            }
 
-            snprintf(filename, sizeof(filename), "/proc/%d/status", pid);
+            snprintf(filename, sizeof(filename), "%d/status", pid);
             read_status(filename, proc);
 
             read_policy(pid, proc);
 
-            proc->num_threads = 0;
-        } else {
-            snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
-            read_cmdline(filename, &cur_proc);
+            add_proc(proc_num++, proc);
+            continue;
+        }
 
-            snprintf(filename, sizeof(filename), "/proc/%d/status", pid);
-            read_status(filename, &cur_proc);
+        snprintf(filename, sizeof(filename), "%d/cmdline", pid);
+        read_cmdline(filename, &cur_proc);
 
-            proc = NULL;
-        }
+        snprintf(filename, sizeof(filename), "%d/status", pid);
+        read_status(filename, &cur_proc);
 
-        snprintf(filename, sizeof(filename), "/proc/%d/task", pid);
-        task_dir = opendir(filename);
-        if (!task_dir) continue;
+        snprintf(filename, sizeof(filename), "%d/task", pid);
+        task_fd = openat(proc_fd, filename, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (task_fd < 0) continue;
+        task_dir = fdopendir(task_fd);
+        if (!task_dir) {
+            close(task_fd);
+            continue;
+        }
 
         while ((tid_dir = readdir(task_dir))) {
             if (!isdigit(tid_dir->d_name[0]))
                 continue;
 
-            if (threads) {
-                tid = atoi(tid_dir->d_name);
+            tid = atoi(tid_dir->d_name);
 
-                proc = alloc_proc();
+            proc = alloc_proc();
 
-                proc->pid = pid; proc->tid = tid;
+            proc->pid = pid; proc->tid = tid;
 
-                snprintf(filename, sizeof(filename), "/proc/%d/task/%d/stat", pid, tid);
-                read_stat(filename, proc);
+            snprintf(filename, sizeof(filename), "%d/task/%d/stat", pid, tid);
+            if (read_stat(filename, proc)) {
+                free_proc(proc);
+                continue;
+            }
 
-                read_policy(tid, proc);
+            read_policy(tid, proc);
 
-                strcpy(proc->name, cur_proc.name);
-                proc->uid = cur_proc.uid;
-                proc->gid = cur_proc.gid;
+            strcpy(proc->name, cur_proc.name);
+            proc->uid = cur_proc.uid;
+            proc->gid = cur_proc.gid;
 
-                add_proc(proc_num++, proc);
-            } else {
-                proc->num_threads++;
-            }
+            add_proc(proc_num++, proc);
         }
 
         closedir(task_dir);
-
-        if (!threads)
-            add_proc(proc_num++, proc);
     }
 
-    for (i = proc_num; i < num_new_procs; i++)
-        new_procs[i] = NULL;
+    num_new_procs = proc_num;
 
     closedir(proc_dir);
+    proc_fd = -1;
 }
 
 static int read_stat(char *filename, struct proc_info *proc) {
-    FILE *file;
-    char buf[MAX_LINE], *open_paren, *close_paren;
+    char buf[MAX_LINE];
+    struct procfs_stat st;
 
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    fgets(buf, MAX_LINE, file);
-    fclose(file);
+    if (procfs_read(proc_fd, filename, buf, sizeof(buf)) <= 0) return 1;
+    if (procfs_parse_stat(buf, &st)) return 1;
 
-    /* Split at first '(' and last ')' to get process name. */
-    open_paren = strchr(buf, '(');
-    close_paren = strrchr(buf, ')');
-    if (!open_paren || !close_paren) return 1;
-
-    *open_paren = *close_paren = '\0';
-    strncpy(proc->tname, open_paren + 1, THREAD_NAME_LEN);
+    strncpy(proc->tname, st.comm, THREAD_NAME_LEN);
     proc->tname[THREAD_NAME_LEN-1] = 0;
 
-    // Scan rest of string.
-    long pr;
-    sscanf(close_paren + 1,
-           " %c "
-           "%*d %*d %*d %*d %*d %*d %*d %*d %*d %*d "
-           "%" SCNu64 // utime %lu (14)
-           "%" SCNu64 // stime %lu (15)
-           "%*d %*d "
-           "%ld " // priority %ld (18)
-           "%ld " // nice %ld (19)
-           "%*d %*d %*d "
-           "%" SCNu64 // vsize %lu (23)
-           "%" SCNu64, // rss %ld (24)
-           &proc->state,
-           &proc->utime,
-           &proc->stime,
-           &pr,
-           &proc->ni,
-           &proc->vss,
-           &proc->rss);
+    proc->state = st.state;
+    proc->starttime = st.starttime;
+    proc->utime = st.utime;
+    proc->stime = st.stime;
+    proc->ni = st.nice;
+    proc->vss = st.vsize;
+    proc->rss = st.rss;
+    proc->num_threads = st.num_threads;
 
     // Translate the PR field.
-    if (pr < -9) strcpy(proc->pr, "RT");
-    else snprintf(proc->pr, sizeof(proc->pr), "%ld", pr);
+    if (st.priority < -9) strcpy(proc->pr, "RT");
+    else snprintf(proc->pr, sizeof(proc->pr), "%ld", st.priority);
 
     return 0;
 }
 
 static void add_proc(int proc_num, struct proc_info *proc) {
-    int i;
-
-    if (proc_num >= num_new_procs) {
-        new_procs = realloc(new_procs, 2 * num_new_procs * sizeof(struct proc_info *));
+    if (proc_num >= size_new_procs) {
+        new_procs = realloc(new_procs, 2 * size_new_procs * sizeof(struct proc_info *));
         if (!new_procs) die("Could not expand procs array.\n");
-        for (i = num_new_procs; i < 2 * num_new_procs; i++)
-            new_procs[i] = NULL;
-        num_new_procs = 2 * num_new_procs;
+        size_new_procs = 2 * size_new_procs;
     }
     new_procs[proc_num] = proc;
 }
 
 static int read_cmdline(char *filename, struct proc_info *proc) {
-    FILE *file;
-    char line[MAX_LINE];
-
-    line[0] = '\0';
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    fgets(line, MAX_LINE, file);
-    fclose(file);
-    if (strlen(line) > 0) {
-        strncpy(proc->name, line, PROC_NAME_LEN);
-        proc->name[PROC_NAME_LEN-1] = 0;
-    } else
+    char line[PROC_NAME_LEN];
+
+    if (procfs_read(proc_fd, filename, line, sizeof(line)) < 0) {
         proc->name[0] = 0;
+        return 1;
+    }
+    // The arguments are separated by NULs: this keeps the first.
+    strcpy(proc->name, line);
     return 0;
 }
 
@@ -409,17 +419,12 @@ static void read_policy(int pid, struct proc_info *proc) {
 }
 
 static int read_status(char *filename, struct proc_info *proc) {
-    FILE *file;
-    char line[MAX_LINE];
-    unsigned int uid, gid;
-
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    while (fgets(line, MAX_LINE, file)) {
-        sscanf(line, "Uid: %u", &uid);
-        sscanf(line, "Gid: %u", &gid);
-    }
-    fclose(file);
+    char buf[MAX_STATUS];
+    unsigned int uid = 0, gid = 0;
+
+    if (procfs_read(proc_fd, filename, buf, sizeof(buf)) < 0) return 1;
+    procfs_status_id(buf, "Uid:", &uid);
+    procfs_status_id(buf, "Gid:", &gid);
     proc->uid = uid; proc->gid = gid;
     return 0;
 }
@@ -503,12 +508,21 @@ static void print_procs(void) {
     }
 }
 
+/* old_procs is sorted by proc_id_cmp while the new ones are read. */
 static struct proc_info *find_old_proc(pid_t pid, pid_t tid) {
-    int i;
-
-    for (i = 0; i < num_old_procs; i++)
-        if (old_procs[i] && (old_procs[i]->pid == pid) && (old_procs[i]->tid == tid))
-            return old_procs[i];
+    int lo = 0, hi = num_old_procs;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct proc_info *old_proc = old_procs[mid];
+
+        if (old_proc->pid == pid && old_proc->tid == tid)
+            return old_proc;
+        if (old_proc->pid < pid || (old_proc->pid == pid && old_proc->tid < tid))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
     return NULL;
 }
@@ -517,10 +531,18 @@ static void free_old_procs(void) {
     int i;
 
     for (i = 0; i < num_old_procs; i++)
-        if (old_procs[i])
-            free_proc(old_procs[i]);
+        free_proc(old_procs[i]);
+
+    num_old_procs = 0;
+}
+
+static int proc_id_cmp(const void *a, const void *b) {
+    struct proc_info *pa, *pb;
+
+    pa = *((struct proc_info **)a); pb = *((struct proc_info **)b);
 
-    free(old_procs);
+    if (pa->pid != pb->pid) return numcmp(pa->pid, pb->pid);
+    return numcmp(pa->tid, pb->tid);
 }
 
 static int proc_cpu_cmp(const void *a, const void *b) {
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <cutils/properties.h>
 #include <cutils/hashmap.h>
@@ -10,14 +12,32 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
-static int str_hash(void *key)
+/*
+ * The watchlist is keyed by prop_info: a property stays where it is in the
+ * property area for good, so each change of the area only costs a look at
+ * the serial of every property, and just the ones that changed, or that
+ * are new, are read.
+ */
+struct watched {
+    unsigned serial;
+    bool match;     /* whether its name matches the prefixes */
+};
+
+struct watchlist {
+    Hashmap *props;
+    char **prefixes;
+    int nprefixes;
+    bool changed;   /* whether anything was announced */
+};
+
+static int ptr_hash(void *key)
 {
-    return hashmapHash(key, strlen(key));
+    return (int) ((uintptr_t) key >> 3);
 }
 
-static bool str_equals(void *keyA, void *keyB)
+static bool ptr_equals(void *keyA, void *keyB)
 {
-    return strcmp(keyA, keyB) == 0;
+    return keyA == keyB;
 }
 
 static void announce(char *name, char *value)
@@ -31,21 +51,35 @@ static void announce(char *name, char *value)
     fprintf(stderr,"%10d %s = '%s'\n", (int) time(0), name, value);
 }
 
-static void add_to_watchlist(Hashmap *watchlist, const char *name,
-        const prop_info *pi)
+static bool matches(struct watchlist *watchlist, const char *name)
 {
-    char *key = strdup(name);
-    unsigned *value = malloc(sizeof(unsigned));
-    if (!key || !value)
+    int i;
+
+    if (watchlist->nprefixes == 0)
+        return true;
+    for (i = 0; i < watchlist->nprefixes; i++) {
+        if (!strncmp(name, watchlist->prefixes[i], strlen(watchlist->prefixes[i])))
+            return true;
+    }
+    return false;
+}
+
+static struct watched *add_to_watchlist(struct watchlist *watchlist,
+        const char *name, const prop_info *pi)
+{
+    struct watched *w = malloc(sizeof(*w));
+    if (!w)
         exit(1);
 
-    *value = __system_property_serial(pi);
-    hashmapPut(watchlist, key, value);
+    w->serial = __system_property_serial(pi);
+    w->match = matches(watchlist, name);
+    hashmapPut(watchlist->props, (void *) pi, w);
+    return w;
 }
 
 static void populate_watchlist(const prop_info *pi, void *cookie)
 {
-    Hashmap *watchlist = cookie;
+    struct watchlist *watchlist = cookie;
     char name[PROP_NAME_MAX];
     char value_unused[PROP_VALUE_MAX];
 
@@ -55,38 +89,73 @@ static void populate_watchlist(const prop_info *pi, void *cookie)
 
 static void update_watchlist(const prop_info *pi, void *cookie)
 {
-    Hashmap *watchlist = cookie;
+    struct watchlist *watchlist = cookie;
     char name[PROP_NAME_MAX];
     char value[PROP_VALUE_MAX];
-    unsigned *serial;
+    struct watched *w;
+    unsigned serial;
 
-    __system_property_read(pi, name, value);
-    serial = hashmapGet(watchlist, name);
-    if (!serial) {
-        add_to_watchlist(watchlist, name, pi);
-        announce(name, value);
+    w = hashmapGet(watchlist->props, (void *) pi);
+    if (!w) {
+        __system_property_read(pi, name, value);
+        w = add_to_watchlist(watchlist, name, pi);
     } else {
-        unsigned tmp = __system_property_serial(pi);
-        if (*serial != tmp) {
-            *serial = tmp;
-            announce(name, value);
-        }
+        if (!w->match)
+            return;
+        serial = __system_property_serial(pi);
+        if (w->serial == serial)
+            return;
+        w->serial = serial;
+        __system_property_read(pi, name, value);
     }
+    if (w->match) {
+        announce(name, value);
+        watchlist->changed = true;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: watchprops [-1] [PREFIX...]\n"
+            "Report the properties that change, or only those whose names\n"
+            "start with one of the PREFIXes.\n"
+            "  -1  exit after the first change reported\n");
+    exit(1);
 }
 
 int watchprops_main(int argc, char *argv[])
 {
+    struct watchlist watchlist;
     unsigned serial;
-    
-    Hashmap *watchlist = hashmapCreate(1024, str_hash, str_equals);
-    if (!watchlist)
+    bool once = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "1")) != -1) {
+        switch (c) {
+        case '1':
+            once = true;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    watchlist.props = hashmapCreate(1024, ptr_hash, ptr_equals);
+    if (!watchlist.props)
         exit(1);
+    watchlist.prefixes = argv + optind;
+    watchlist.nprefixes = argc - optind;
+    watchlist.changed = false;
 
-    __system_property_foreach(populate_watchlist, watchlist);
+    /* The serial of the area before the scan, so that no change is missed */
+    serial = __system_property_area_serial();
+    __system_property_foreach(populate_watchlist, &watchlist);
 
-    for(serial = 0;;) {
+    for(;;) {
         serial = __system_property_wait_any(serial);
-        __system_property_foreach(update_watchlist, watchlist);
+        __system_property_foreach(update_watchlist, &watchlist);
+        if (once && watchlist.changed)
+            break;
     }
     return 0;
 }